@@ -32,10 +32,12 @@
 #include "datatypes.h"
 #include "viralloc.h"
 #include "virerror.h"
+#include "virfdstream.h"
 #include "virlog.h"
 #include "virnetdaemon.h"
 #include "virnetserver.h"
 #include "virstring.h"
+#include "virthread.h"
 #include "virthreadjob.h"
 #include "virtypedparam.h"
 
@@ -273,7 +275,7 @@ adminDispatchClientGetInfo(virNetServerPtr server ATTRIBUTE_UNUSED,
         goto cleanup;
     }
 
-    if (adminClientGetInfo(clnt, &params, &nparams, args->flags) < 0)
+    if (adminClientGetInfo(srv, clnt, &params, &nparams, args->flags) < 0)
         goto cleanup;
 
     if (nparams > ADMIN_CLIENT_INFO_PARAMETERS_MAX) {
@@ -415,6 +417,17 @@ adminConnectGetLoggingFilters(char **filters, unsigned int flags)
     return ret;
 }
 
+static int
+adminConnectDumpLoggingMemory(char **messages, unsigned int flags)
+{
+    virCheckFlags(0, -1);
+
+    if (!(*messages = virLogDumpMemory(ADMIN_STRING_MAX)))
+        return -1;
+
+    return 0;
+}
+
 static int
 adminConnectSetLoggingOutputs(virNetDaemonPtr dmn ATTRIBUTE_UNUSED,
                               const char *outputs,
@@ -457,6 +470,26 @@ adminDispatchConnectGetLoggingOutputs(virNetServerPtr server ATTRIBUTE_UNUSED,
     return 0;
 }
 
+static int
+adminDispatchConnectDumpLoggingMemory(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                      virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                                      virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                      virNetMessageErrorPtr rerr,
+                                      admin_connect_dump_logging_memory_args *args,
+                                      admin_connect_dump_logging_memory_ret *ret)
+{
+    char *messages = NULL;
+
+    if (adminConnectDumpLoggingMemory(&messages, args->flags) < 0) {
+        virNetMessageSaveError(rerr);
+        return -1;
+    }
+
+    VIR_STEAL_PTR(ret->messages, messages);
+
+    return 0;
+}
+
 static int
 adminDispatchConnectGetLoggingFilters(virNetServerPtr server ATTRIBUTE_UNUSED,
                                       virNetServerClientPtr client ATTRIBUTE_UNUSED,
@@ -487,4 +520,510 @@ adminDispatchConnectGetLoggingFilters(virNetServerPtr server ATTRIBUTE_UNUSED,
 
     return 0;
 }
+/* The pool of message buffers is shared by all servers of the daemon */
+static int
+adminConnectGetMessagePoolStats(virTypedParameterPtr *params,
+                                int *nparams,
+                                unsigned int flags)
+{
+    virNetMessagePoolStats stats;
+    virTypedParameterPtr tmpparams = NULL;
+    int maxparams = 0;
+
+    virCheckFlags(0, -1);
+
+    virNetMessagePoolGetStats(&stats);
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_MESSAGE_POOL_HITS, stats.hits) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_MESSAGE_POOL_MISSES, stats.misses) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_MESSAGE_POOL_DISCARDS, stats.discards) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_MESSAGE_POOL_BUFFERS, stats.buffers) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_MESSAGE_POOL_BYTES, stats.bytes) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_MESSAGE_POOL_MAX_BYTES, stats.maxBytes) < 0) {
+        virTypedParamsFree(tmpparams, *nparams);
+        return -1;
+    }
+
+    *params = tmpparams;
+    return 0;
+}
+
+static int
+adminDispatchConnectGetMessagePoolStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                        virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                                        virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                        virNetMessageErrorPtr rerr,
+                                        admin_connect_get_message_pool_stats_args *args,
+                                        admin_connect_get_message_pool_stats_ret *ret)
+{
+    int rv = -1;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+
+    if (adminConnectGetMessagePoolStats(&params, &nparams, args->flags) < 0)
+        goto cleanup;
+
+    if (virTypedParamsSerialize(params, nparams,
+                                (virTypedParameterRemotePtr *) &ret->params.params_val,
+                                &ret->params.params_len, 0) < 0)
+        goto cleanup;
+
+    rv = 0;
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virTypedParamsFree(params, nparams);
+    return rv;
+}
+
+/* Object classes are shared by all servers of the daemon */
+static int
+adminConnectGetObjectStats(virTypedParameterPtr *params,
+                           int *nparams,
+                           unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virTypedParameterPtr tmpparams = NULL;
+    virClassStatsPtr stats = NULL;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t nstats = 0;
+    size_t count = 0;
+    size_t i;
+
+    virCheckFlags(0, -1);
+
+    if (virClassGetStats(&stats, &nstats) < 0)
+        return -1;
+
+    /* The count goes first and is updated once all classes are added */
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_OBJECT_STATS_COUNT, 0) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nstats; i++) {
+        if (!stats[i].live && !stats[i].cached)
+            continue;
+
+        snprintf(field, sizeof(field), VIR_OBJECT_STATS_PREFIX
+                 "%zu" VIR_OBJECT_STATS_SUFFIX_NAME, count);
+        if (virTypedParamsAddString(&tmpparams, nparams, &maxparams,
+                                    field, stats[i].name) < 0)
+            goto cleanup;
+
+        snprintf(field, sizeof(field), VIR_OBJECT_STATS_PREFIX
+                 "%zu" VIR_OBJECT_STATS_SUFFIX_SIZE, count);
+        if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                    field, stats[i].objectSize) < 0)
+            goto cleanup;
+
+        snprintf(field, sizeof(field), VIR_OBJECT_STATS_PREFIX
+                 "%zu" VIR_OBJECT_STATS_SUFFIX_LIVE, count);
+        if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                                  field, stats[i].live) < 0)
+            goto cleanup;
+
+        snprintf(field, sizeof(field), VIR_OBJECT_STATS_PREFIX
+                 "%zu" VIR_OBJECT_STATS_SUFFIX_CACHED, count);
+        if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                                  field, stats[i].cached) < 0)
+            goto cleanup;
+
+        count++;
+    }
+
+    tmpparams[0].value.ui = count;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    VIR_FREE(stats);
+    return ret;
+}
+
+static int
+adminDispatchConnectGetObjectStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                   virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                                   virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                   virNetMessageErrorPtr rerr,
+                                   admin_connect_get_object_stats_args *args,
+                                   admin_connect_get_object_stats_ret *ret)
+{
+    int rv = -1;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+
+    if (adminConnectGetObjectStats(&params, &nparams, args->flags) < 0)
+        goto cleanup;
+
+    if (nparams > ADMIN_OBJECT_STATS_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of object statistics %d exceeds "
+                         "max allowed limit: %d"), nparams,
+                       ADMIN_OBJECT_STATS_MAX);
+        goto cleanup;
+    }
+
+    if (virTypedParamsSerialize(params, nparams,
+                                (virTypedParameterRemotePtr *) &ret->params.params_val,
+                                &ret->params.params_len, 0) < 0)
+        goto cleanup;
+
+    rv = 0;
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virTypedParamsFree(params, nparams);
+    return rv;
+}
+
+/* The I/O workers of file streams are shared by all servers */
+static int
+adminConnectGetStreamStats(virTypedParameterPtr *params,
+                           int *nparams,
+                           unsigned int flags)
+{
+    virFDStreamStats stats;
+    virTypedParameterPtr tmpparams = NULL;
+    int maxparams = 0;
+
+    virCheckFlags(0, -1);
+
+    virFDStreamGetStats(&stats);
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_STREAM_STATS_OPENED, stats.opened) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_STREAM_STATS_ACTIVE, stats.active) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_STREAM_STATS_QUEUED, stats.queued) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_STREAM_STATS_WORKERS, stats.workers) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_STREAM_STATS_BYTES_READ,
+                                stats.bytesRead) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_STREAM_STATS_BYTES_WRITTEN,
+                                stats.bytesWritten) < 0) {
+        virTypedParamsFree(tmpparams, *nparams);
+        return -1;
+    }
+
+    *params = tmpparams;
+    return 0;
+}
+
+static int
+adminDispatchConnectGetStreamStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                   virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                                   virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                   virNetMessageErrorPtr rerr,
+                                   admin_connect_get_stream_stats_args *args,
+                                   admin_connect_get_stream_stats_ret *ret)
+{
+    int rv = -1;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+
+    if (adminConnectGetStreamStats(&params, &nparams, args->flags) < 0)
+        goto cleanup;
+
+    if (virTypedParamsSerialize(params, nparams,
+                                (virTypedParameterRemotePtr *) &ret->params.params_val,
+                                &ret->params.params_len, 0) < 0)
+        goto cleanup;
+
+    rv = 0;
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virTypedParamsFree(params, nparams);
+    return rv;
+}
+
+static int
+adminLockStatsAdd(virTypedParameterPtr *params,
+                  int *nparams,
+                  int *maxparams,
+                  size_t num,
+                  const char *suffix,
+                  unsigned long long value)
+{
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+    snprintf(field, sizeof(field), VIR_LOCK_STATS_PREFIX "%zu%s",
+             num, suffix);
+    return virTypedParamsAddULLong(params, nparams, maxparams, field, value);
+}
+
+/* The locks are profiled process wide rather than per server */
+static int
+adminConnectGetLockStats(virTypedParameterPtr *params,
+                         int *nparams,
+                         unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virTypedParameterPtr tmpparams = NULL;
+    virMutexStatsPtr stats = NULL;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t nstats = 0;
+    size_t count = 0;
+    size_t i;
+
+    virCheckFlags(VIR_ADM_LOCK_STATS_RESET, -1);
+
+    if (virMutexGetStats(&stats, &nstats) < 0)
+        return -1;
+
+    if (flags & VIR_ADM_LOCK_STATS_RESET)
+        virMutexResetStats();
+
+    /* The count is updated once all classes are added */
+    if (virTypedParamsAddBoolean(&tmpparams, nparams, &maxparams,
+                                 VIR_LOCK_STATS_ENABLED,
+                                 virMutexProfileEnabled()) < 0 ||
+        virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_LOCK_STATS_COUNT, 0) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nstats; i++) {
+        if (!stats[i].acquired && !stats[i].condWaits)
+            continue;
+
+        snprintf(field, sizeof(field), VIR_LOCK_STATS_PREFIX
+                 "%zu" VIR_LOCK_STATS_SUFFIX_NAME, count);
+        if (virTypedParamsAddString(&tmpparams, nparams, &maxparams,
+                                    field, stats[i].name) < 0)
+            goto cleanup;
+
+        if (adminLockStatsAdd(&tmpparams, nparams, &maxparams, count,
+                              VIR_LOCK_STATS_SUFFIX_ACQUIRED,
+                              stats[i].acquired) < 0 ||
+            adminLockStatsAdd(&tmpparams, nparams, &maxparams, count,
+                              VIR_LOCK_STATS_SUFFIX_CONTENDED,
+                              stats[i].contended) < 0 ||
+            adminLockStatsAdd(&tmpparams, nparams, &maxparams, count,
+                              VIR_LOCK_STATS_SUFFIX_WAIT_TIME,
+                              stats[i].waitTime) < 0 ||
+            adminLockStatsAdd(&tmpparams, nparams, &maxparams, count,
+                              VIR_LOCK_STATS_SUFFIX_MAX_WAIT_TIME,
+                              stats[i].maxWaitTime) < 0 ||
+            adminLockStatsAdd(&tmpparams, nparams, &maxparams, count,
+                              VIR_LOCK_STATS_SUFFIX_HOLD_TIME,
+                              stats[i].holdTime) < 0 ||
+            adminLockStatsAdd(&tmpparams, nparams, &maxparams, count,
+                              VIR_LOCK_STATS_SUFFIX_MAX_HOLD_TIME,
+                              stats[i].maxHoldTime) < 0 ||
+            adminLockStatsAdd(&tmpparams, nparams, &maxparams, count,
+                              VIR_LOCK_STATS_SUFFIX_COND_WAITS,
+                              stats[i].condWaits) < 0 ||
+            adminLockStatsAdd(&tmpparams, nparams, &maxparams, count,
+                              VIR_LOCK_STATS_SUFFIX_COND_WAIT_TIME,
+                              stats[i].condWaitTime) < 0)
+            goto cleanup;
+
+        count++;
+    }
+
+    tmpparams[1].value.ui = count;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    VIR_FREE(stats);
+    return ret;
+}
+
+static int
+adminDispatchConnectGetLockStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                 virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                                 virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                 virNetMessageErrorPtr rerr,
+                                 admin_connect_get_lock_stats_args *args,
+                                 admin_connect_get_lock_stats_ret *ret)
+{
+    int rv = -1;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+
+    if (adminConnectGetLockStats(&params, &nparams, args->flags) < 0)
+        goto cleanup;
+
+    if (virTypedParamsSerialize(params, nparams,
+                                (virTypedParameterRemotePtr *) &ret->params.params_val,
+                                &ret->params.params_len, 0) < 0)
+        goto cleanup;
+
+    rv = 0;
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virTypedParamsFree(params, nparams);
+    return rv;
+}
+
+static int
+adminDispatchServerGetProcedureStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                     virNetServerClientPtr client,
+                                     virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                     virNetMessageErrorPtr rerr,
+                                     admin_server_get_procedure_stats_args *args,
+                                     admin_server_get_procedure_stats_ret *ret)
+{
+    int rv = -1;
+    virNetServerPtr srv = NULL;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    struct daemonAdmClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!(srv = virNetDaemonGetServer(priv->dmn, args->srv.name)))
+        goto cleanup;
+
+    if (adminServerGetProcedureStats(srv, &params, &nparams, args->flags) < 0)
+        goto cleanup;
+
+    if (nparams > ADMIN_SERVER_PROCEDURE_STATS_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of procedure statistics %d exceeds "
+                         "max allowed limit: %d"), nparams,
+                       ADMIN_SERVER_PROCEDURE_STATS_MAX);
+        goto cleanup;
+    }
+
+    if (virTypedParamsSerialize(params, nparams,
+                                (virTypedParameterRemotePtr *) &ret->params.params_val,
+                                &ret->params.params_len, 0) < 0)
+        goto cleanup;
+
+    rv = 0;
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+
+    virTypedParamsFree(params, nparams);
+    virObjectUnref(srv);
+    return rv;
+}
+
+static int
+adminDispatchServerListClientsFiltered(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                       virNetServerClientPtr client,
+                                       virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                       virNetMessageErrorPtr rerr,
+                                       admin_server_list_clients_filtered_args *args,
+                                       admin_server_list_clients_filtered_ret *ret)
+{
+    int rv = -1;
+    size_t i;
+    virNetServerPtr srv = NULL;
+    virNetServerClientPtr *result = NULL;
+    int nresults = 0;
+    virTypedParameterPtr filters = NULL;
+    int nfilters = 0;
+    unsigned long long next = 0;
+    struct daemonAdmClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!(srv = virNetDaemonGetServer(priv->dmn, args->srv.name)))
+        goto cleanup;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) args->filters.filters_val,
+                                  args->filters.filters_len,
+                                  ADMIN_CLIENT_LIST_FILTERS_MAX,
+                                  &filters,
+                                  &nfilters) < 0)
+        goto cleanup;
+
+    if ((nresults = adminServerListClientsFiltered(srv, filters, nfilters,
+                                                   args->start,
+                                                   args->limit ?
+                                                   MIN(args->limit,
+                                                       ADMIN_CLIENT_LIST_MAX) :
+                                                   ADMIN_CLIENT_LIST_MAX,
+                                                   &result, &next,
+                                                   args->flags)) < 0)
+        goto cleanup;
+
+    if (nresults) {
+        if (VIR_ALLOC_N(ret->clients.clients_val, nresults) < 0)
+            goto cleanup;
+
+        ret->clients.clients_len = nresults;
+        for (i = 0; i < nresults; i++) {
+            make_nonnull_client(ret->clients.clients_val + i, result[i]);
+            make_nonnull_server(&ret->clients.clients_val[i].srv, srv);
+        }
+    }
+
+    ret->next = next;
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+
+    virObjectListFreeCount(result, nresults);
+    virTypedParamsFree(filters, nfilters);
+    virObjectUnref(srv);
+    return rv;
+}
+
+static int
+adminDispatchServerGetClientStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                  virNetServerClientPtr client,
+                                  virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                  virNetMessageErrorPtr rerr,
+                                  admin_server_get_client_stats_args *args,
+                                  admin_server_get_client_stats_ret *ret)
+{
+    int rv = -1;
+    virNetServerPtr srv = NULL;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    struct daemonAdmClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!(srv = virNetDaemonGetServer(priv->dmn, args->srv.name)))
+        goto cleanup;
+
+    if (adminServerGetClientStats(srv, &params, &nparams, args->flags) < 0)
+        goto cleanup;
+
+    if (nparams > ADMIN_SERVER_CLIENT_STATS_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of client statistics %d exceeds "
+                         "max allowed limit: %d"), nparams,
+                       ADMIN_SERVER_CLIENT_STATS_MAX);
+        goto cleanup;
+    }
+
+    if (virTypedParamsSerialize(params, nparams,
+                                (virTypedParameterRemotePtr *) &ret->params.params_val,
+                                &ret->params.params_len, 0) < 0)
+        goto cleanup;
+
+    rv = 0;
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+
+    virTypedParamsFree(params, nparams);
+    virObjectUnref(srv);
+    return rv;
+}
+
 #include "admin_dispatch.h"
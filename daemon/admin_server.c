@@ -202,6 +202,66 @@ adminServerListClients(virNetServerPtr srv,
     return ret;
 }
 
+int
+adminServerListClientsFiltered(virNetServerPtr srv,
+                               virTypedParameterPtr filters,
+                               int nfilters,
+                               unsigned long long start,
+                               size_t limit,
+                               virNetServerClientPtr **clients,
+                               unsigned long long *next,
+                               unsigned int flags)
+{
+    virNetServerClientMatch match = { .transport = -1 };
+    virTypedParameterPtr param = NULL;
+
+    virCheckFlags(0, -1);
+
+    if (virTypedParamsValidate(filters, nfilters,
+                               VIR_CLIENT_FILTER_TRANSPORT,
+                               VIR_TYPED_PARAM_INT,
+                               VIR_CLIENT_FILTER_IDENTITY,
+                               VIR_TYPED_PARAM_STRING,
+                               VIR_CLIENT_FILTER_MIN_AGE,
+                               VIR_TYPED_PARAM_ULLONG,
+                               VIR_CLIENT_FILTER_MIN_IDLE,
+                               VIR_TYPED_PARAM_ULLONG,
+                               NULL) < 0)
+        return -1;
+
+    if ((param = virTypedParamsGet(filters, nfilters,
+                                   VIR_CLIENT_FILTER_TRANSPORT))) {
+        if (param->value.i < 0 || param->value.i >= VIR_CLIENT_TRANS_LAST) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unknown client transport %d"), param->value.i);
+            return -1;
+        }
+        match.transport = param->value.i;
+    }
+
+    if ((param = virTypedParamsGet(filters, nfilters,
+                                   VIR_CLIENT_FILTER_IDENTITY)))
+        match.identity = param->value.s;
+
+    if ((param = virTypedParamsGet(filters, nfilters,
+                                   VIR_CLIENT_FILTER_MIN_AGE)))
+        match.minAge = MIN(param->value.ul, LLONG_MAX);
+
+    if ((param = virTypedParamsGet(filters, nfilters,
+                                   VIR_CLIENT_FILTER_MIN_IDLE)))
+        match.minIdle = MIN(param->value.ul, LLONG_MAX);
+
+    if ((match.minAge || match.minIdle) &&
+        (match.now = time(NULL)) == (time_t) -1) {
+        virReportSystemError(errno, "%s", _("failed to get current time"));
+        return -1;
+    }
+
+    return virNetServerGetClientsPage(srv, start, limit,
+                                      nfilters ? &match : NULL,
+                                      clients, next);
+}
+
 virNetServerClientPtr
 adminServerLookupClient(virNetServerPtr srv,
                         unsigned long long id,
@@ -213,7 +273,8 @@ adminServerLookupClient(virNetServerPtr srv,
 }
 
 int
-adminClientGetInfo(virNetServerClientPtr client,
+adminClientGetInfo(virNetServerPtr srv,
+                   virNetServerClientPtr client,
                    virTypedParameterPtr *params,
                    int *nparams,
                    unsigned int flags)
@@ -221,6 +282,8 @@ adminClientGetInfo(virNetServerClientPtr client,
     int ret = -1;
     int maxparams = 0;
     bool readonly;
+    size_t queued;
+    unsigned long long throttled;
     char *sock_addr = NULL;
     const char *attr = NULL;
     virTypedParameterPtr tmpparams = NULL;
@@ -294,6 +357,15 @@ adminClientGetInfo(virNetServerClientPtr client,
                                 VIR_CLIENT_INFO_SELINUX_CONTEXT, attr) < 0))
         goto cleanup;
 
+    virNetServerGetClientSchedStats(srv, client, &queued, &throttled);
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_CLIENT_INFO_QUEUED_REQUESTS, queued) < 0 ||
+        virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_CLIENT_INFO_THROTTLED_REQUESTS,
+                                throttled) < 0)
+        goto cleanup;
+
     *params = tmpparams;
     tmpparams = NULL;
     ret = 0;
@@ -321,6 +393,7 @@ adminServerGetClientLimits(virNetServerPtr srv,
 {
     int ret = -1;
     int maxparams = 0;
+    unsigned int rateLimit, rateBurst, rwWeight;
     virTypedParameterPtr tmpparams = NULL;
 
     virCheckFlags(0, -1);
@@ -345,6 +418,16 @@ adminServerGetClientLimits(virNetServerPtr srv,
                               virNetServerGetCurrentUnauthClients(srv)) < 0)
         goto cleanup;
 
+    virNetServerGetClientRateLimits(srv, &rateLimit, &rateBurst, &rwWeight);
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_RATE_LIMIT, rateLimit) < 0 ||
+        virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_RATE_BURST, rateBurst) < 0 ||
+        virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_RW_WEIGHT, rwWeight) < 0)
+        goto cleanup;
+
     *params = tmpparams;
     tmpparams = NULL;
     ret = 0;
@@ -354,6 +437,199 @@ adminServerGetClientLimits(virNetServerPtr srv,
     return ret;
 }
 
+int
+adminServerGetClientStats(virNetServerPtr srv,
+                          virTypedParameterPtr *params,
+                          int *nparams,
+                          unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virNetServerClientStats stats;
+    virTypedParameterPtr tmpparams = NULL;
+
+    virCheckFlags(0, -1);
+
+    virNetServerGetClientStats(srv, &stats);
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_CURRENT,
+                              stats.nclients) < 0 ||
+        virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_UNIX,
+                              stats.ntransport[VIR_CLIENT_TRANS_UNIX]) < 0 ||
+        virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_TCP,
+                              stats.ntransport[VIR_CLIENT_TRANS_TCP]) < 0 ||
+        virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_TLS,
+                              stats.ntransport[VIR_CLIENT_TRANS_TLS]) < 0 ||
+        virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_READONLY,
+                              stats.nreadonly) < 0 ||
+        virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_UNAUTH_CURRENT,
+                              stats.nunauth) < 0 ||
+        virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_CLIENTS_PENDING,
+                              stats.npending) < 0)
+        goto cleanup;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    return ret;
+}
+
+verify(VIR_NET_SERVER_PROGRAM_HISTOGRAM_BUCKETS ==
+       VIR_SERVER_PROCEDURE_STATS_BUCKETS);
+
+static int
+adminServerAddProcedureStat(virTypedParameterPtr *params,
+                            int *nparams,
+                            int *maxparams,
+                            size_t idx,
+                            const char *suffix,
+                            unsigned long long value)
+{
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+    snprintf(field, sizeof(field), VIR_SERVER_PROCEDURE_STATS_PREFIX "%zu%s",
+             idx, suffix);
+    return virTypedParamsAddULLong(params, nparams, maxparams, field, value);
+}
+
+static int
+adminServerAddProcedureHistogram(virTypedParameterPtr *params,
+                                 int *nparams,
+                                 int *maxparams,
+                                 size_t idx,
+                                 const char *suffix,
+                                 const unsigned long long *buckets)
+{
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t i;
+
+    for (i = 0; i < VIR_NET_SERVER_PROGRAM_HISTOGRAM_BUCKETS; i++) {
+        if (!buckets[i])
+            continue;
+
+        snprintf(field, sizeof(field),
+                 VIR_SERVER_PROCEDURE_STATS_PREFIX "%zu%s%zu", idx, suffix, i);
+        if (virTypedParamsAddULLong(params, nparams, maxparams,
+                                    field, buckets[i]) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int
+adminServerGetProcedureStats(virNetServerPtr srv,
+                             virTypedParameterPtr *params,
+                             int *nparams,
+                             unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virTypedParameterPtr tmpparams = NULL;
+    virNetServerProgramPtr *progs = NULL;
+    virNetServerProgramProcStatsPtr stats = NULL;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    ssize_t nstats = 0;
+    int nprogs = 0;
+    size_t count = 0;
+    size_t i;
+    ssize_t j;
+
+    virCheckFlags(0, -1);
+
+    if ((nprogs = virNetServerGetPrograms(srv, &progs)) < 0)
+        return -1;
+
+    /* The count goes first and is updated once all procedures are added */
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_PROCEDURE_STATS_COUNT, 0) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nprogs; i++) {
+        if ((nstats = virNetServerProgramGetStats(progs[i], &stats)) < 0)
+            goto cleanup;
+
+        for (j = 0; j < nstats; j++) {
+            const char *name;
+
+            if (!stats[j].calls)
+                continue;
+
+            snprintf(field, sizeof(field), VIR_SERVER_PROCEDURE_STATS_PREFIX
+                     "%zu" VIR_SERVER_PROCEDURE_STATS_SUFFIX_PROGRAM, count);
+            if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams, field,
+                                      virNetServerProgramGetID(progs[i])) < 0)
+                goto cleanup;
+
+            snprintf(field, sizeof(field), VIR_SERVER_PROCEDURE_STATS_PREFIX
+                     "%zu" VIR_SERVER_PROCEDURE_STATS_SUFFIX_NUMBER, count);
+            if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                                      field, j) < 0)
+                goto cleanup;
+
+            if ((name = virNetServerProgramGetProcName(progs[i], j))) {
+                snprintf(field, sizeof(field), VIR_SERVER_PROCEDURE_STATS_PREFIX
+                         "%zu" VIR_SERVER_PROCEDURE_STATS_SUFFIX_NAME, count);
+                if (virTypedParamsAddString(&tmpparams, nparams, &maxparams,
+                                            field, name) < 0)
+                    goto cleanup;
+            }
+
+            if (adminServerAddProcedureStat(&tmpparams, nparams, &maxparams,
+                                            count,
+                                            VIR_SERVER_PROCEDURE_STATS_SUFFIX_CALLS,
+                                            stats[j].calls) < 0 ||
+                adminServerAddProcedureStat(&tmpparams, nparams, &maxparams,
+                                            count,
+                                            VIR_SERVER_PROCEDURE_STATS_SUFFIX_ERRORS,
+                                            stats[j].errors) < 0 ||
+                adminServerAddProcedureStat(&tmpparams, nparams, &maxparams,
+                                            count,
+                                            VIR_SERVER_PROCEDURE_STATS_SUFFIX_WAIT_TOTAL,
+                                            stats[j].waitTotal) < 0 ||
+                adminServerAddProcedureStat(&tmpparams, nparams, &maxparams,
+                                            count,
+                                            VIR_SERVER_PROCEDURE_STATS_SUFFIX_EXEC_TOTAL,
+                                            stats[j].execTotal) < 0 ||
+                adminServerAddProcedureHistogram(&tmpparams, nparams, &maxparams,
+                                                 count,
+                                                 VIR_SERVER_PROCEDURE_STATS_SUFFIX_WAIT_BUCKET,
+                                                 stats[j].wait) < 0 ||
+                adminServerAddProcedureHistogram(&tmpparams, nparams, &maxparams,
+                                                 count,
+                                                 VIR_SERVER_PROCEDURE_STATS_SUFFIX_EXEC_BUCKET,
+                                                 stats[j].exec) < 0)
+                goto cleanup;
+
+            count++;
+        }
+
+        VIR_FREE(stats);
+    }
+
+    tmpparams[0].value.ui = count;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    virObjectListFreeCount(progs, nprogs);
+    VIR_FREE(stats);
+    return ret;
+}
+
 int
 adminServerSetClientLimits(virNetServerPtr srv,
                            virTypedParameterPtr params,
@@ -362,6 +638,9 @@ adminServerSetClientLimits(virNetServerPtr srv,
 {
     long long int maxClients = -1;
     long long int maxClientsUnauth = -1;
+    long long int rateLimit = -1;
+    long long int rateBurst = -1;
+    long long int rwWeight = -1;
     virTypedParameterPtr param = NULL;
 
     virCheckFlags(0, -1);
@@ -371,6 +650,12 @@ adminServerSetClientLimits(virNetServerPtr srv,
                                VIR_TYPED_PARAM_UINT,
                                VIR_SERVER_CLIENTS_UNAUTH_MAX,
                                VIR_TYPED_PARAM_UINT,
+                               VIR_SERVER_CLIENTS_RATE_LIMIT,
+                               VIR_TYPED_PARAM_UINT,
+                               VIR_SERVER_CLIENTS_RATE_BURST,
+                               VIR_TYPED_PARAM_UINT,
+                               VIR_SERVER_CLIENTS_RW_WEIGHT,
+                               VIR_TYPED_PARAM_UINT,
                                NULL) < 0)
         return -1;
 
@@ -382,9 +667,26 @@ adminServerSetClientLimits(virNetServerPtr srv,
                                    VIR_SERVER_CLIENTS_UNAUTH_MAX)))
         maxClientsUnauth = param->value.ui;
 
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_SERVER_CLIENTS_RATE_LIMIT)))
+        rateLimit = param->value.ui;
+
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_SERVER_CLIENTS_RATE_BURST)))
+        rateBurst = param->value.ui;
+
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_SERVER_CLIENTS_RW_WEIGHT)))
+        rwWeight = param->value.ui;
+
     if (virNetServerSetClientLimits(srv, maxClients,
                                     maxClientsUnauth) < 0)
         return -1;
 
+    if ((rateLimit >= 0 || rateBurst >= 0 || rwWeight >= 0) &&
+        virNetServerSetClientRateLimits(srv, rateLimit,
+                                        rateBurst, rwWeight) < 0)
+        return -1;
+
     return 0;
 }
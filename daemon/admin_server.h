@@ -50,11 +50,21 @@ int adminServerListClients(virNetServerPtr srv,
                            virNetServerClientPtr **clients,
                            unsigned int flags);
 
+int adminServerListClientsFiltered(virNetServerPtr srv,
+                                   virTypedParameterPtr filters,
+                                   int nfilters,
+                                   unsigned long long start,
+                                   size_t limit,
+                                   virNetServerClientPtr **clients,
+                                   unsigned long long *next,
+                                   unsigned int flags);
+
 virNetServerClientPtr adminServerLookupClient(virNetServerPtr srv,
                                               unsigned long long id,
                                               unsigned int flags);
 
-int adminClientGetInfo(virNetServerClientPtr client,
+int adminClientGetInfo(virNetServerPtr srv,
+                       virNetServerClientPtr client,
                        virTypedParameterPtr *params,
                        int *nparams,
                        unsigned int flags);
@@ -67,6 +77,16 @@ int adminServerGetClientLimits(virNetServerPtr srv,
                                int *nparams,
                                unsigned int flags);
 
+int adminServerGetClientStats(virNetServerPtr srv,
+                              virTypedParameterPtr *params,
+                              int *nparams,
+                              unsigned int flags);
+
+int adminServerGetProcedureStats(virNetServerPtr srv,
+                                 virTypedParameterPtr *params,
+                                 int *nparams,
+                                 unsigned int flags);
+
 int adminServerSetClientLimits(virNetServerPtr srv,
                                virTypedParameterPtr params,
                                int nparams,
@@ -142,6 +142,7 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
     data->auth_tcp = REMOTE_AUTH_NONE;
 #endif
     data->auth_tls = REMOTE_AUTH_NONE;
+    data->tls_session_cache_lifetime = 300;
 
     data->mdns_adv = 0;
 
@@ -150,11 +151,20 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
     data->max_clients = 5000;
     data->max_queued_clients = 1000;
     data->max_anonymous_clients = 20;
+    data->accept_workers = 0;
+    data->max_pending_clients = 50;
 
     data->prio_workers = 5;
 
+    data->event_loop_threads = 1;
+
     data->max_requests = 20;
     data->max_client_requests = 5;
+    data->client_rate_limit = 0;
+    data->client_rate_burst = 20;
+    data->client_rw_weight = 1;
+
+    data->message_pool_size = 32;
 
     data->audit_level = 1;
     data->audit_logging = 0;
@@ -334,6 +344,10 @@ daemonConfigLoadOptions(struct daemonConfig *data,
     if (virConfGetValueString(conf, "tls_priority", &data->tls_priority) < 0)
         goto error;
 
+    if (virConfGetValueUInt(conf, "tls_session_cache_lifetime",
+                            &data->tls_session_cache_lifetime) < 0)
+        goto error;
+
     if (virConfGetValueUInt(conf, "min_workers", &data->min_workers) < 0)
         goto error;
     if (virConfGetValueUInt(conf, "max_workers", &data->max_workers) < 0)
@@ -344,14 +358,52 @@ daemonConfigLoadOptions(struct daemonConfig *data,
         goto error;
     if (virConfGetValueUInt(conf, "max_anonymous_clients", &data->max_anonymous_clients) < 0)
         goto error;
+    if (virConfGetValueUInt(conf, "accept_workers", &data->accept_workers) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "max_pending_clients", &data->max_pending_clients) < 0)
+        goto error;
 
     if (virConfGetValueUInt(conf, "prio_workers", &data->prio_workers) < 0)
         goto error;
 
+    if (virConfGetValueUInt(conf, "event_loop_threads", &data->event_loop_threads) < 0)
+        goto error;
+
     if (virConfGetValueUInt(conf, "max_requests", &data->max_requests) < 0)
         goto error;
     if (virConfGetValueUInt(conf, "max_client_requests", &data->max_client_requests) < 0)
         goto error;
+    if (virConfGetValueUInt(conf, "client_rate_limit", &data->client_rate_limit) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "client_rate_burst", &data->client_rate_burst) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "client_rw_weight", &data->client_rw_weight) < 0)
+        goto error;
+
+    if (virConfGetValueUInt(conf, "message_pool_size", &data->message_pool_size) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "event_coalesce_window", &data->event_coalesce_window) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "socket_send_buffer", &data->socket_send_buffer) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "socket_recv_buffer", &data->socket_recv_buffer) < 0)
+        goto error;
+    if (data->socket_send_buffer > UINT_MAX / 1024 ||
+        data->socket_recv_buffer > UINT_MAX / 1024) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("%s: socket buffer sizes must be below %u KiB"),
+                       filename, UINT_MAX / 1024);
+        goto error;
+    }
+
+    if (virConfGetValueUInt(conf, "compression_level", &data->compression_level) < 0)
+        goto error;
+    if (data->compression_level > 9) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("%s: compression_level must be between 0 and 9"),
+                       filename);
+        goto error;
+    }
 
     if (virConfGetValueUInt(conf, "admin_min_workers", &data->admin_min_workers) < 0)
         goto error;
@@ -380,6 +432,8 @@ daemonConfigLoadOptions(struct daemonConfig *data,
         goto error;
     if (virConfGetValueString(conf, "log_outputs", &data->log_outputs) < 0)
         goto error;
+    if (virConfGetValueUInt(conf, "log_queue_size", &data->log_queue_size) < 0)
+        goto error;
 
     if (virConfGetValueInt(conf, "keepalive_interval", &data->keepalive_interval) < 0)
         goto error;
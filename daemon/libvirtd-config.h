@@ -57,6 +57,7 @@ struct daemonConfig {
     char **tls_allowed_dn_list;
     char **sasl_allowed_username_list;
     char *tls_priority;
+    unsigned int tls_session_cache_lifetime;
 
     char *key_file;
     char *cert_file;
@@ -68,15 +69,30 @@ struct daemonConfig {
     unsigned int max_clients;
     unsigned int max_queued_clients;
     unsigned int max_anonymous_clients;
+    unsigned int accept_workers;
+    unsigned int max_pending_clients;
 
     unsigned int prio_workers;
 
+    unsigned int event_loop_threads;
+
     unsigned int max_requests;
     unsigned int max_client_requests;
+    unsigned int client_rate_limit;
+    unsigned int client_rate_burst;
+    unsigned int client_rw_weight;
+
+    unsigned int message_pool_size;
+    unsigned int event_coalesce_window;
+    unsigned int socket_send_buffer;
+    unsigned int socket_recv_buffer;
+
+    unsigned int compression_level;
 
     unsigned int log_level;
     char *log_filters;
     char *log_outputs;
+    unsigned int log_queue_size;
 
     unsigned int audit_level;
     bool audit_logging;
@@ -50,6 +50,7 @@
 #include "virconf.h"
 #include "virnetlink.h"
 #include "virnetdaemon.h"
+#include "vireventpoll.h"
 #include "remote.h"
 #include "virhook.h"
 #include "viraudit.h"
@@ -541,6 +542,8 @@ daemonSetupNetworking(virNetServerPtr srv,
         if (config->listen_tls) {
             virNetTLSContextPtr ctxt = NULL;
 
+            virNetTLSSetCacheLifetime(config->tls_session_cache_lifetime);
+
             if (config->ca_file ||
                 config->cert_file ||
                 config->key_file) {
@@ -1339,6 +1342,13 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    /* The log writer thread has to be started by the process which is
+     * going to stay, that is after forking into background */
+    if (virLogSetQueueSize(config->log_queue_size) < 0) {
+        ret = VIR_DAEMON_ERR_CONFIG;
+        goto cleanup;
+    }
+
     if (virNetlinkStartup() < 0) {
         ret = VIR_DAEMON_ERR_INIT;
         goto cleanup;
@@ -1367,6 +1377,31 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    virNetMessagePoolSetMaxBytes((size_t) config->message_pool_size * 1024 * 1024);
+    remoteSetEventCoalesceWindow(config->event_coalesce_window);
+    virNetServerSetCompressionLevel(srv, config->compression_level);
+    virNetServerSetSocketBufferSizes(srv, config->socket_send_buffer * 1024,
+                                     config->socket_recv_buffer * 1024);
+
+    if (virNetServerSetAcceptWorkers(srv, config->accept_workers,
+                                     config->max_pending_clients) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
+    if (virNetServerSetClientRateLimits(srv, config->client_rate_limit,
+                                        config->client_rate_burst,
+                                        config->client_rw_weight) < 0) {
+        ret = VIR_DAEMON_ERR_CONFIG;
+        goto cleanup;
+    }
+
+    /* Must happen before any socket or monitor is registered */
+    if (virEventPollStartShards(config->event_loop_threads) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
     /* Beyond this point, nothing should rely on using
      * getuid/geteuid() == 0, for privilege level checks.
      */
@@ -1585,5 +1620,9 @@ int main(int argc, char **argv) {
      * 'dmn' as a parameter are done, we can finally unref 'dmn' */
     virObjectUnref(dmn);
 
+    virAuditClose();
+
+    virLogFlush();
+
     return ret;
 }
@@ -48,6 +48,8 @@ typedef struct daemonAdmClientPrivate daemonAdmClientPrivate;
 typedef daemonAdmClientPrivate *daemonAdmClientPrivatePtr;
 typedef struct daemonClientEventCallback daemonClientEventCallback;
 typedef daemonClientEventCallback *daemonClientEventCallbackPtr;
+typedef struct daemonClientPendingEvent daemonClientPendingEvent;
+typedef daemonClientPendingEvent *daemonClientPendingEventPtr;
 
 /* Stores the per-client connection state */
 struct daemonClientPrivate {
@@ -68,6 +70,14 @@ struct daemonClientPrivate {
     size_t nsecretEventCallbacks;
     bool closeRegistered;
 
+    /* Events held back to be merged with later ones of the same kind,
+     * protected by their own lock as they are queued while the event
+     * state is locked */
+    virMutex pendingEventsLock;
+    daemonClientPendingEventPtr pendingEvents;
+    size_t npendingEvents;
+    int pendingEventsTimer; /* -1 if events are never held back */
+
 # if WITH_SASL
     virNetSASLSessionPtr sasl;
 # endif
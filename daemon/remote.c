@@ -37,6 +37,7 @@
 #include "virnetserverservice.h"
 #include "virnetserver.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "virtypedparam.h"
 #include "virdbus.h"
 #include "virprocess.h"
@@ -83,6 +84,19 @@ struct daemonClientEventCallback {
     bool legacy;
 };
 
+/* An encoded event which only reports the latest value of something,
+ * e.g. the balloon size, waiting in case a newer one replaces it */
+struct daemonClientPendingEvent {
+    int procnr;
+    int callbackID;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char *key; /* device the event is about, if any */
+    virNetMessagePtr msg;
+};
+
+/* Milliseconds such events are held back, 0 to relay them at once */
+static unsigned int remoteEventCoalesceWindow;
+
 static virDomainPtr get_nonnull_domain(virConnectPtr conn, remote_nonnull_domain domain);
 static virNetworkPtr get_nonnull_network(virConnectPtr conn, remote_nonnull_network network);
 static virInterfacePtr get_nonnull_interface(virConnectPtr conn, remote_nonnull_interface iface);
@@ -121,6 +135,22 @@ remoteDispatchObjectEventSend(virNetServerClientPtr client,
                               xdrproc_t proc,
                               void *data);
 
+static void
+remoteDispatchObjectEventCoalesce(virNetServerClientPtr client,
+                                  virNetServerProgramPtr program,
+                                  int procnr,
+                                  xdrproc_t proc,
+                                  void *data,
+                                  int callbackID,
+                                  virDomainPtr dom,
+                                  const char *key);
+
+static void
+remoteDiscardPendingEvents(daemonClientPrivatePtr priv);
+
+static void
+remotePendingEventsTimer(int timer, void *opaque);
+
 static void
 remoteEventCallbackFree(void *opaque)
 {
@@ -394,16 +424,18 @@ remoteRelayDomainEventRTCChange(virConnectPtr conn,
     data.offset = offset;
 
     if (callback->legacy) {
-        remoteDispatchObjectEventSend(callback->client, remoteProgram,
-                                      REMOTE_PROC_DOMAIN_EVENT_RTC_CHANGE,
-                                      (xdrproc_t)xdr_remote_domain_event_rtc_change_msg, &data);
+        remoteDispatchObjectEventCoalesce(callback->client, remoteProgram,
+                                          REMOTE_PROC_DOMAIN_EVENT_RTC_CHANGE,
+                                          (xdrproc_t)xdr_remote_domain_event_rtc_change_msg, &data,
+                                          callback->callbackID, dom, NULL);
     } else {
         remote_domain_event_callback_rtc_change_msg msg = { callback->callbackID,
                                                             data };
 
-        remoteDispatchObjectEventSend(callback->client, remoteProgram,
-                                      REMOTE_PROC_DOMAIN_EVENT_CALLBACK_RTC_CHANGE,
-                                      (xdrproc_t)xdr_remote_domain_event_callback_rtc_change_msg, &msg);
+        remoteDispatchObjectEventCoalesce(callback->client, remoteProgram,
+                                          REMOTE_PROC_DOMAIN_EVENT_CALLBACK_RTC_CHANGE,
+                                          (xdrproc_t)xdr_remote_domain_event_callback_rtc_change_msg, &msg,
+                                          callback->callbackID, dom, NULL);
     }
 
     return 0;
@@ -800,16 +832,18 @@ remoteRelayDomainEventTrayChange(virConnectPtr conn,
     make_nonnull_domain(&data.dom, dom);
 
     if (callback->legacy) {
-        remoteDispatchObjectEventSend(callback->client, remoteProgram,
-                                      REMOTE_PROC_DOMAIN_EVENT_TRAY_CHANGE,
-                                      (xdrproc_t)xdr_remote_domain_event_tray_change_msg, &data);
+        remoteDispatchObjectEventCoalesce(callback->client, remoteProgram,
+                                          REMOTE_PROC_DOMAIN_EVENT_TRAY_CHANGE,
+                                          (xdrproc_t)xdr_remote_domain_event_tray_change_msg, &data,
+                                          callback->callbackID, dom, devAlias);
     } else {
         remote_domain_event_callback_tray_change_msg msg = { callback->callbackID,
                                                              data };
 
-        remoteDispatchObjectEventSend(callback->client, remoteProgram,
-                                      REMOTE_PROC_DOMAIN_EVENT_CALLBACK_TRAY_CHANGE,
-                                      (xdrproc_t)xdr_remote_domain_event_callback_tray_change_msg, &msg);
+        remoteDispatchObjectEventCoalesce(callback->client, remoteProgram,
+                                          REMOTE_PROC_DOMAIN_EVENT_CALLBACK_TRAY_CHANGE,
+                                          (xdrproc_t)xdr_remote_domain_event_callback_tray_change_msg, &msg,
+                                          callback->callbackID, dom, devAlias);
     }
 
     return 0;
@@ -909,16 +943,18 @@ remoteRelayDomainEventBalloonChange(virConnectPtr conn,
     data.actual = actual;
 
     if (callback->legacy) {
-        remoteDispatchObjectEventSend(callback->client, remoteProgram,
-                                      REMOTE_PROC_DOMAIN_EVENT_BALLOON_CHANGE,
-                                      (xdrproc_t)xdr_remote_domain_event_balloon_change_msg, &data);
+        remoteDispatchObjectEventCoalesce(callback->client, remoteProgram,
+                                          REMOTE_PROC_DOMAIN_EVENT_BALLOON_CHANGE,
+                                          (xdrproc_t)xdr_remote_domain_event_balloon_change_msg, &data,
+                                          callback->callbackID, dom, NULL);
     } else {
         remote_domain_event_callback_balloon_change_msg msg = { callback->callbackID,
                                                                 data };
 
-        remoteDispatchObjectEventSend(callback->client, remoteProgram,
-                                      REMOTE_PROC_DOMAIN_EVENT_CALLBACK_BALLOON_CHANGE,
-                                      (xdrproc_t)xdr_remote_domain_event_callback_balloon_change_msg, &msg);
+        remoteDispatchObjectEventCoalesce(callback->client, remoteProgram,
+                                          REMOTE_PROC_DOMAIN_EVENT_CALLBACK_BALLOON_CHANGE,
+                                          (xdrproc_t)xdr_remote_domain_event_callback_balloon_change_msg, &msg,
+                                          callback->callbackID, dom, NULL);
     }
 
     return 0;
@@ -1331,9 +1367,10 @@ remoteRelayDomainEventBlockThreshold(virConnectPtr conn,
     data.excess = excess;
     make_nonnull_domain(&data.dom, dom);
 
-    remoteDispatchObjectEventSend(callback->client, remoteProgram,
-                                  REMOTE_PROC_DOMAIN_EVENT_BLOCK_THRESHOLD,
-                                  (xdrproc_t)xdr_remote_domain_event_block_threshold_msg, &data);
+    remoteDispatchObjectEventCoalesce(callback->client, remoteProgram,
+                                      REMOTE_PROC_DOMAIN_EVENT_BLOCK_THRESHOLD,
+                                      (xdrproc_t)xdr_remote_domain_event_block_threshold_msg, &data,
+                                      callback->callbackID, dom, dev);
 
     return 0;
  error:
@@ -1736,6 +1773,8 @@ void remoteClientFreeFunc(void *data)
         virObjectUnref(sysident);
     }
 
+    remoteDiscardPendingEvents(priv);
+    virMutexDestroy(&priv->pendingEventsLock);
     VIR_FREE(priv);
 }
 #undef DEREG_CB
@@ -1746,6 +1785,16 @@ static void remoteClientCloseFunc(virNetServerClientPtr client)
     struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
 
     daemonRemoveAllClientStreams(priv->streams);
+
+    /* The timer holds a reference on the client, drop it now */
+    virMutexLock(&priv->pendingEventsLock);
+    if (priv->pendingEventsTimer >= 0) {
+        virEventRemoveTimeout(priv->pendingEventsTimer);
+        priv->pendingEventsTimer = -1;
+    }
+    virMutexUnlock(&priv->pendingEventsLock);
+
+    remoteDiscardPendingEvents(priv);
 }
 
 
@@ -1763,6 +1812,25 @@ void *remoteClientInitHook(virNetServerClientPtr client,
         return NULL;
     }
 
+    if (virMutexInit(&priv->pendingEventsLock) < 0) {
+        virMutexDestroy(&priv->lock);
+        VIR_FREE(priv);
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        return NULL;
+    }
+
+    /* Without a timer events are simply relayed at once */
+    priv->pendingEventsTimer = -1;
+    if (remoteEventCoalesceWindow > 0 &&
+        (priv->pendingEventsTimer =
+         virEventAddTimeout(-1, remotePendingEventsTimer,
+                            virObjectRef(client),
+                            virObjectFreeCallback)) < 0) {
+        VIR_WARN("Unable to add timer, events will not be coalesced");
+        virObjectUnref(client);
+        priv->pendingEventsTimer = -1;
+    }
+
     virNetServerClientSetCloseHook(client, remoteClientCloseFunc);
     return priv;
 }
@@ -3981,17 +4049,16 @@ remoteDispatchConnectDomainEventDeregister(virNetServerPtr server ATTRIBUTE_UNUS
     return rv;
 }
 
-static void
-remoteDispatchObjectEventSend(virNetServerClientPtr client,
-                              virNetServerProgramPtr program,
-                              int procnr,
-                              xdrproc_t proc,
-                              void *data)
+static virNetMessagePtr
+remoteObjectEventMessageNew(virNetServerProgramPtr program,
+                            int procnr,
+                            xdrproc_t proc,
+                            void *data)
 {
     virNetMessagePtr msg;
 
     if (!(msg = virNetMessageNew(false)))
-        goto cleanup;
+        return NULL;
 
     msg->header.prog = virNetServerProgramGetID(program);
     msg->header.vers = virNetServerProgramGetVersion(program);
@@ -4000,19 +4067,161 @@ remoteDispatchObjectEventSend(virNetServerClientPtr client,
     msg->header.serial = 1;
     msg->header.status = VIR_NET_OK;
 
-    if (virNetMessageEncodeHeader(msg) < 0)
-        goto cleanup;
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg, proc, data) < 0) {
+        virNetMessageFree(msg);
+        return NULL;
+    }
 
-    if (virNetMessageEncodePayload(msg, proc, data) < 0)
-        goto cleanup;
+    return msg;
+}
+
+void
+remoteSetEventCoalesceWindow(unsigned int window)
+{
+    remoteEventCoalesceWindow = window;
+}
+
+static void
+remoteDiscardPendingEvents(daemonClientPrivatePtr priv)
+{
+    size_t i;
 
-    VIR_DEBUG("Queue event %d %zu", procnr, msg->bufferLength);
-    virNetServerClientSendMessage(client, msg);
+    virMutexLock(&priv->pendingEventsLock);
+    for (i = 0; i < priv->npendingEvents; i++) {
+        virNetMessageFree(priv->pendingEvents[i].msg);
+        VIR_FREE(priv->pendingEvents[i].key);
+    }
+    VIR_FREE(priv->pendingEvents);
+    priv->npendingEvents = 0;
+    virMutexUnlock(&priv->pendingEventsLock);
+}
+
+/* Queues the held back events of @client, oldest first */
+static void
+remoteFlushPendingEvents(virNetServerClientPtr client)
+{
+    daemonClientPrivatePtr priv = virNetServerClientGetPrivateData(client);
+    daemonClientPendingEventPtr pending;
+    size_t npending;
+    size_t i;
+
+    virMutexLock(&priv->pendingEventsLock);
+    pending = priv->pendingEvents;
+    npending = priv->npendingEvents;
+    priv->pendingEvents = NULL;
+    priv->npendingEvents = 0;
+    if (npending && priv->pendingEventsTimer >= 0)
+        virEventUpdateTimeout(priv->pendingEventsTimer, -1);
+    virMutexUnlock(&priv->pendingEventsLock);
+
+    for (i = 0; i < npending; i++) {
+        VIR_DEBUG("Queue held back event %d %zu",
+                  pending[i].procnr, pending[i].msg->bufferLength);
+        virNetServerClientSendMessage(client, pending[i].msg);
+        VIR_FREE(pending[i].key);
+    }
+    VIR_FREE(pending);
+}
+
+static void
+remotePendingEventsTimer(int timer ATTRIBUTE_UNUSED,
+                         void *opaque)
+{
+    remoteFlushPendingEvents(opaque);
+}
+
+static void
+remoteDispatchObjectEventSend(virNetServerClientPtr client,
+                              virNetServerProgramPtr program,
+                              int procnr,
+                              xdrproc_t proc,
+                              void *data)
+{
+    virNetMessagePtr msg;
+
+    if ((msg = remoteObjectEventMessageNew(program, procnr, proc, data))) {
+        /* Held back events happened before this one */
+        remoteFlushPendingEvents(client);
+
+        VIR_DEBUG("Queue event %d %zu", procnr, msg->bufferLength);
+        virNetServerClientSendMessage(client, msg);
+    }
 
     xdr_free(proc, data);
-    return;
+}
+
+/*
+ * Like remoteDispatchObjectEventSend, for events which only report the
+ * latest value of something about @dom, or its device @key. The event
+ * is held back for the coalescing window and replaces an older event
+ * of the same kind still waiting, so that a client only sees the last
+ * update when they come in bursts. The next event of any other kind
+ * for the client flushes the held back ones first, so the order in
+ * which the client sees events is kept.
+ */
+static void
+remoteDispatchObjectEventCoalesce(virNetServerClientPtr client,
+                                  virNetServerProgramPtr program,
+                                  int procnr,
+                                  xdrproc_t proc,
+                                  void *data,
+                                  int callbackID,
+                                  virDomainPtr dom,
+                                  const char *key)
+{
+    daemonClientPrivatePtr priv = virNetServerClientGetPrivateData(client);
+    daemonClientPendingEvent event;
+    virNetMessagePtr msg = NULL;
+    char *keycopy = NULL;
+    size_t i;
+
+    if (priv->pendingEventsTimer < 0) {
+        remoteDispatchObjectEventSend(client, program, procnr, proc, data);
+        return;
+    }
+
+    if (!(msg = remoteObjectEventMessageNew(program, procnr, proc, data)) ||
+        VIR_STRDUP(keycopy, key) < 0)
+        goto cleanup;
+
+    virMutexLock(&priv->pendingEventsLock);
+    for (i = 0; i < priv->npendingEvents; i++) {
+        daemonClientPendingEventPtr pending = &priv->pendingEvents[i];
+
+        if (pending->procnr == procnr &&
+            pending->callbackID == callbackID &&
+            memcmp(pending->uuid, dom->uuid, VIR_UUID_BUFLEN) == 0 &&
+            STREQ_NULLABLE(pending->key, key)) {
+            VIR_DEBUG("Replacing held back event %d", procnr);
+            virNetMessageFree(pending->msg);
+            pending->msg = msg;
+            msg = NULL;
+            break;
+        }
+    }
+
+    if (msg) {
+        event.procnr = procnr;
+        event.callbackID = callbackID;
+        memcpy(event.uuid, dom->uuid, VIR_UUID_BUFLEN);
+        event.key = keycopy;
+        event.msg = msg;
+
+        if (VIR_APPEND_ELEMENT(priv->pendingEvents,
+                               priv->npendingEvents, event) == 0) {
+            VIR_DEBUG("Holding back event %d", procnr);
+            if (priv->npendingEvents == 1)
+                virEventUpdateTimeout(priv->pendingEventsTimer,
+                                      remoteEventCoalesceWindow);
+            keycopy = NULL;
+            msg = NULL;
+        }
+    }
+    virMutexUnlock(&priv->pendingEventsLock);
 
  cleanup:
+    VIR_FREE(keycopy);
     virNetMessageFree(msg);
     xdr_free(proc, data);
 }
@@ -4657,6 +4866,12 @@ static int remoteDispatchConnectSupportsFeature(virNetServerPtr server ATTRIBUTE
         goto done;
     }
 
+    /* Also asked before opening the connection, see remote driver */
+    if (args->feature == VIR_DRV_FEATURE_COMPRESSION) {
+        supported = virNetServerClientEnableCompression(client);
+        goto done;
+    }
+
     if (!priv->conn) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
         goto cleanup;
@@ -4666,6 +4881,7 @@ static int remoteDispatchConnectSupportsFeature(virNetServerPtr server ATTRIBUTE
     case VIR_DRV_FEATURE_FD_PASSING:
     case VIR_DRV_FEATURE_REMOTE_EVENT_CALLBACK:
     case VIR_DRV_FEATURE_REMOTE_CLOSE_CALLBACK:
+    case VIR_DRV_FEATURE_REMOTE_COMPACT_STATS:
         supported = 1;
         break;
 
@@ -5323,7 +5539,7 @@ remoteDispatchDomainMigratePrepareTunnel3Params(virNetServerPtr server ATTRIBUTE
 
     if (!(st = virStreamNew(priv->conn, VIR_STREAM_NONBLOCK)) ||
         !(stream = daemonCreateClientStream(client, st, remoteProgram,
-                                            &msg->header)))
+                                            &msg->header, false)))
         goto cleanup;
 
     if (virDomainMigratePrepareTunnel3Params(priv->conn, st, params, nparams,
@@ -6500,6 +6716,48 @@ remoteDispatchNetworkGetDHCPLeases(virNetServerPtr server ATTRIBUTE_UNUSED,
 }
 
 
+static int
+remoteGetAllDomainStats(virConnectPtr conn,
+                        remote_nonnull_domain *doms_val,
+                        unsigned int doms_len,
+                        unsigned int stats,
+                        virDomainStatsRecordPtr **retStats,
+                        unsigned int flags)
+{
+    virDomainPtr *doms = NULL;
+    int nrecords = -1;
+    size_t i;
+
+    if (doms_len) {
+        if (VIR_ALLOC_N(doms, doms_len + 1) < 0)
+            goto cleanup;
+
+        for (i = 0; i < doms_len; i++) {
+            if (!(doms[i] = get_nonnull_domain(conn, doms_val[i])))
+                goto cleanup;
+        }
+
+        nrecords = virDomainListGetStats(doms, stats, retStats, flags);
+    } else {
+        nrecords = virConnectGetAllDomainStats(conn, stats, retStats, flags);
+    }
+
+    if (nrecords > REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of domain stats records is %d, "
+                         "which exceeds max limit: %d"),
+                       nrecords, REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX);
+        virDomainStatsRecordListFree(*retStats);
+        *retStats = NULL;
+        nrecords = -1;
+    }
+
+ cleanup:
+    virObjectListFree(doms);
+    return nrecords;
+}
+
+
 static int
 remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
                                        virNetServerClientPtr client,
@@ -6513,42 +6771,19 @@ remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
     struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
     virDomainStatsRecordPtr *retStats = NULL;
     int nrecords = 0;
-    virDomainPtr *doms = NULL;
 
     if (!priv->conn) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
         goto cleanup;
     }
 
-    if (args->doms.doms_len) {
-        if (VIR_ALLOC_N(doms, args->doms.doms_len + 1) < 0)
-            goto cleanup;
-
-        for (i = 0; i < args->doms.doms_len; i++) {
-            if (!(doms[i] = get_nonnull_domain(priv->conn, args->doms.doms_val[i])))
-                goto cleanup;
-        }
-
-        if ((nrecords = virDomainListGetStats(doms,
-                                              args->stats,
-                                              &retStats,
-                                              args->flags)) < 0)
-            goto cleanup;
-    } else {
-        if ((nrecords = virConnectGetAllDomainStats(priv->conn,
-                                                    args->stats,
-                                                    &retStats,
-                                                    args->flags)) < 0)
-            goto cleanup;
-    }
-
-    if (nrecords > REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Number of domain stats records is %d, "
-                         "which exceeds max limit: %d"),
-                       nrecords, REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX);
+    if ((nrecords = remoteGetAllDomainStats(priv->conn,
+                                            args->doms.doms_val,
+                                            args->doms.doms_len,
+                                            args->stats,
+                                            &retStats,
+                                            args->flags)) < 0)
         goto cleanup;
-    }
 
     if (nrecords) {
         if (VIR_ALLOC_N(ret->retStats.retStats_val, nrecords) < 0)
@@ -6580,7 +6815,119 @@ remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
         virNetMessageSaveError(rerr);
 
     virDomainStatsRecordListFree(retStats);
-    virObjectListFree(doms);
+
+    return rv;
+}
+
+
+/*
+ * Unlike remoteDispatchConnectGetAllDomainStats, every parameter name
+ * is sent only once per reply and each record refers to it by index.
+ * With many domains most of the reply used to be the same names over
+ * and over again.
+ */
+static int
+remoteDispatchConnectGetAllDomainStatsCompact(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                              virNetServerClientPtr client,
+                                              virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                              virNetMessageErrorPtr rerr,
+                                              remote_connect_get_all_domain_stats_compact_args *args,
+                                              remote_connect_get_all_domain_stats_compact_ret *ret)
+{
+    int rv = -1;
+    size_t i, j;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+    virDomainStatsRecordPtr *retStats = NULL;
+    virHashTablePtr indexes = NULL;
+    size_t maxnames = 0;
+    int nrecords = 0;
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if ((nrecords = remoteGetAllDomainStats(priv->conn,
+                                            args->doms.doms_val,
+                                            args->doms.doms_len,
+                                            args->stats,
+                                            &retStats,
+                                            args->flags)) < 0)
+        goto cleanup;
+
+    if (!(indexes = virHashCreate(256, NULL)))
+        goto cleanup;
+
+    if (nrecords &&
+        VIR_ALLOC_N(ret->retStats.retStats_val, nrecords) < 0)
+        goto cleanup;
+    ret->retStats.retStats_len = nrecords;
+
+    for (i = 0; i < nrecords; i++) {
+        remote_domain_stats_compact_record *dst = ret->retStats.retStats_val + i;
+        virDomainStatsRecordPtr src = retStats[i];
+
+        make_nonnull_domain(&dst->dom, src->dom);
+
+        if (src->nparams &&
+            (VIR_ALLOC_N(dst->fields.fields_val, src->nparams) < 0 ||
+             VIR_ALLOC_N(dst->values.values_val, src->nparams) < 0))
+            goto cleanup;
+
+        for (j = 0; j < src->nparams; j++) {
+            virTypedParameterPtr param = src->params + j;
+            virTypedParameterRemoteValuePtr value;
+            void *entry;
+            size_t idx;
+
+            /* Skip holes in sparse arrays, see virTypedParamsSerialize */
+            if (!param->type)
+                continue;
+
+            entry = virHashLookup(indexes, param->field);
+            if (!(idx = (size_t) entry)) {
+                if (ret->names.names_len ==
+                    REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_NAMES_MAX) {
+                    virReportError(VIR_ERR_INTERNAL_ERROR,
+                                   _("Number of domain stats names exceeds "
+                                     "max limit: %d"),
+                                   REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_NAMES_MAX);
+                    goto cleanup;
+                }
+
+                if (VIR_RESIZE_N(ret->names.names_val, maxnames,
+                                 ret->names.names_len, 1) < 0 ||
+                    VIR_STRDUP(ret->names.names_val[ret->names.names_len],
+                               param->field) < 0)
+                    goto cleanup;
+
+                /* Stored off by one so that NULL means not found */
+                idx = ++ret->names.names_len;
+                if (virHashAddEntry(indexes, param->field, (void *) idx) < 0)
+                    goto cleanup;
+            }
+
+            value = (virTypedParameterRemoteValuePtr)
+                &dst->values.values_val[dst->values.values_len];
+            if (virTypedParameterSerializeValue(param, value) < 0)
+                goto cleanup;
+
+            dst->fields.fields_val[dst->fields.fields_len++] = idx - 1;
+            dst->values.values_len++;
+        }
+    }
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0) {
+        virNetMessageSaveError(rerr);
+        xdr_free((xdrproc_t) xdr_remote_connect_get_all_domain_stats_compact_ret,
+                 (char *) ret);
+    }
+
+    virHashFree(indexes);
+    virDomainStatsRecordListFree(retStats);
 
     return rv;
 }
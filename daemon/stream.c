@@ -47,6 +47,9 @@ struct daemonClientStream {
     bool recvEOF;
     bool closed;
 
+    /* Whether the stream may carry holes */
+    bool allowSkip;
+
     int filterID;
 
     virNetMessagePtr rx;
@@ -285,7 +288,8 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 
     virMutexLock(&stream->priv->lock);
 
-    if (msg->header.type != VIR_NET_STREAM)
+    if (msg->header.type != VIR_NET_STREAM &&
+        msg->header.type != VIR_NET_STREAM_HOLE)
         goto cleanup;
 
     if (!virNetServerProgramMatches(stream->prog, msg))
@@ -312,6 +316,7 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 /*
  * @conn: a connection object to associate the stream with
  * @header: the method call to associate with the stream
+ * @allowSkip: whether the stream is sparse, ie. may carry holes
  *
  * Creates a new stream for this conn
  *
@@ -321,13 +326,14 @@ daemonClientStream *
 daemonCreateClientStream(virNetServerClientPtr client,
                          virStreamPtr st,
                          virNetServerProgramPtr prog,
-                         virNetMessageHeaderPtr header)
+                         virNetMessageHeaderPtr header,
+                         bool allowSkip)
 {
     daemonClientStream *stream;
     daemonClientPrivatePtr priv = virNetServerClientGetPrivateData(client);
 
-    VIR_DEBUG("client=%p, proc=%d, serial=%u, st=%p",
-              client, header->proc, header->serial, st);
+    VIR_DEBUG("client=%p, proc=%d, serial=%u, st=%p, allowSkip=%d",
+              client, header->proc, header->serial, st, allowSkip);
 
     if (VIR_ALLOC(stream) < 0)
         return NULL;
@@ -339,6 +345,7 @@ daemonCreateClientStream(virNetServerClientPtr client,
     stream->serial = header->serial;
     stream->filterID = -1;
     stream->st = st;
+    stream->allowSkip = allowSkip;
 
     return stream;
 }
@@ -557,6 +564,64 @@ daemonStreamHandleWriteData(virNetServerClientPtr client,
 }
 
 
+/*
+ * Process a hole packet from the client, skipping the
+ * given amount of bytes in the underlying stream.
+ *
+ * Returns:
+ *   -1  if fatal error occurred
+ *    0  if message was fully processed
+ *    1  if message is still being processed
+ */
+static int
+daemonStreamHandleHole(virNetServerClientPtr client,
+                       daemonClientStream *stream,
+                       virNetMessagePtr msg)
+{
+    int ret;
+    virNetStreamHole data;
+
+    VIR_DEBUG("client=%p, stream=%p, proc=%d, serial=%u",
+              client, stream, msg->header.proc, msg->header.serial);
+
+    memset(&data, 0, sizeof(data));
+
+    if (!stream->allowSkip) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("Unexpected stream hole"));
+        ret = -1;
+    } else if (virNetMessageDecodePayload(msg,
+                                          (xdrproc_t) xdr_virNetStreamHole,
+                                          &data) < 0) {
+        ret = -1;
+    } else {
+        ret = virStreamSendHole(stream->st, data.length, data.flags);
+        /* Blocking, so indicate we have more todo later */
+        if (ret == -2)
+            return 1;
+    }
+
+    if (ret < 0) {
+        virNetMessageError rerr;
+
+        memset(&rerr, 0, sizeof(rerr));
+
+        VIR_INFO("Stream send hole failed");
+        stream->closed = true;
+        virStreamEventRemoveCallback(stream->st);
+        virStreamAbort(stream->st);
+
+        return virNetServerProgramSendReplyError(stream->prog,
+                                                 client,
+                                                 msg,
+                                                 &rerr,
+                                                 &msg->header);
+    }
+
+    return 0;
+}
+
+
 /*
  * Process a finish handshake from the client.
  *
@@ -672,7 +737,10 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
             break;
 
         case VIR_NET_CONTINUE:
-            ret = daemonStreamHandleWriteData(client, stream, msg);
+            if (msg->header.type == VIR_NET_STREAM_HOLE)
+                ret = daemonStreamHandleHole(client, stream, msg);
+            else
+                ret = daemonStreamHandleWriteData(client, stream, msg);
             break;
 
         case VIR_NET_ERROR:
@@ -751,13 +819,49 @@ daemonStreamHandleRead(virNetServerClientPtr client,
 
     memset(&rerr, 0, sizeof(rerr));
 
-    if (VIR_ALLOC_N(buffer, bufferLen) < 0)
-        return -1;
-
     if (!(msg = virNetMessageNew(false)))
         goto cleanup;
 
-    rv = virStreamRecv(stream->st, buffer, bufferLen);
+    /* Read the data straight into the payload of the outgoing packet */
+    if (!(buffer = virNetServerProgramStreamDataBegin(remoteProgram,
+                                                      msg,
+                                                      stream->procedure,
+                                                      stream->serial,
+                                                      bufferLen)))
+        goto cleanup;
+
+    if (stream->allowSkip)
+        rv = virStreamRecvFlags(stream->st, buffer, bufferLen,
+                                VIR_STREAM_RECV_STOP_AT_HOLE);
+    else
+        rv = virStreamRecv(stream->st, buffer, bufferLen);
+
+    if (rv == -3) {
+        long long length;
+
+        /* We're at a hole, tell the client to skip it instead
+         * of sending it as a chunk of zeroes */
+        if (virStreamRecvHole(stream->st, &length, 0) < 0) {
+            rv = -1;
+        } else {
+            stream->tx = false;
+            msg->cb = daemonStreamMessageFinished;
+            msg->opaque = stream;
+            stream->refs++;
+            if (virNetServerProgramSendStreamHole(remoteProgram,
+                                                  client,
+                                                  msg,
+                                                  stream->procedure,
+                                                  stream->serial,
+                                                  length,
+                                                  0) < 0)
+                goto cleanup;
+            msg = NULL;
+            ret = 0;
+            goto cleanup;
+        }
+    }
+
     if (rv == -2) {
         /* Should never get this, since we're only called when we know
          * we're readable, but hey things change... */
@@ -778,19 +882,13 @@ daemonStreamHandleRead(virNetServerClientPtr client,
         msg->cb = daemonStreamMessageFinished;
         msg->opaque = stream;
         stream->refs++;
-        if (virNetServerProgramSendStreamData(remoteProgram,
-                                              client,
-                                              msg,
-                                              stream->procedure,
-                                              stream->serial,
-                                              buffer, rv) < 0)
+        if (virNetServerProgramSendStreamDataEnd(client, msg, rv) < 0)
             goto cleanup;
         msg = NULL;
     }
 
     ret = 0;
  cleanup:
-    VIR_FREE(buffer);
     virNetMessageFree(msg);
     return ret;
 }
@@ -200,6 +200,390 @@ int virAdmServerSetThreadPoolParameters(virAdmServerPtr srv,
                                         int nparams,
                                         unsigned int flags);
 
+/* Monitor the pool of RPC message buffers */
+
+/**
+ * VIR_MESSAGE_POOL_HITS:
+ * Macro for the number of message buffers reused from the pool,
+ * as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_MESSAGE_POOL_HITS "hits"
+
+/**
+ * VIR_MESSAGE_POOL_MISSES:
+ * Macro for the number of message buffers which had to be allocated
+ * because the pool held no buffer of suitable size, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_MESSAGE_POOL_MISSES "misses"
+
+/**
+ * VIR_MESSAGE_POOL_DISCARDS:
+ * Macro for the number of released message buffers which were freed
+ * instead of being kept because the pool was full, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_MESSAGE_POOL_DISCARDS "discards"
+
+/**
+ * VIR_MESSAGE_POOL_BUFFERS:
+ * Macro for the current number of idle buffers in the pool, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_MESSAGE_POOL_BUFFERS "buffers"
+
+/**
+ * VIR_MESSAGE_POOL_BYTES:
+ * Macro for the amount of memory in bytes currently held by idle
+ * buffers in the pool, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_MESSAGE_POOL_BYTES "bytes"
+
+/**
+ * VIR_MESSAGE_POOL_MAX_BYTES:
+ * Macro for the upper limit in bytes on memory held by idle buffers in
+ * the pool, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_MESSAGE_POOL_MAX_BYTES "maxBytes"
+
+int virAdmConnectGetMessagePoolStats(virAdmConnectPtr conn,
+                                     virTypedParameterPtr *params,
+                                     int *nparams,
+                                     unsigned int flags);
+
+/* Per procedure RPC latency statistics of a server */
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_COUNT:
+ * Macro for the number of procedures reported, as VIR_TYPED_PARAM_UINT.
+ * Only procedures which were called at least once are reported, each
+ * of them as a group of "procedure.<num>." prefixed parameters where
+ * <num> ranges from 0 to the count minus one.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_COUNT "procedure.count"
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_PREFIX:
+ * Macro for the prefix of the parameters describing a single procedure.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_PREFIX "procedure."
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_SUFFIX_PROGRAM:
+ * Suffix for the RPC program number the procedure belongs to, as
+ * VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_SUFFIX_PROGRAM ".program"
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_SUFFIX_NUMBER:
+ * Suffix for the procedure number within its program, as
+ * VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_SUFFIX_NUMBER ".number"
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_SUFFIX_NAME:
+ * Suffix for the name of the procedure, as VIR_TYPED_PARAM_STRING.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_SUFFIX_NAME ".name"
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_SUFFIX_CALLS:
+ * Suffix for the number of completed calls of the procedure, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_SUFFIX_CALLS ".calls"
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_SUFFIX_ERRORS:
+ * Suffix for the number of calls of the procedure which failed, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_SUFFIX_ERRORS ".errors"
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_SUFFIX_WAIT_TOTAL:
+ * Suffix for the total time in microseconds calls of the procedure spent
+ * queued waiting for a worker thread, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_SUFFIX_WAIT_TOTAL ".wait.total"
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_SUFFIX_EXEC_TOTAL:
+ * Suffix for the total time in microseconds spent executing calls of the
+ * procedure, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_SUFFIX_EXEC_TOTAL ".exec.total"
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_SUFFIX_WAIT_BUCKET:
+ * Suffix of the histogram of queue wait times, followed by the bucket
+ * index <b>, as VIR_TYPED_PARAM_ULLONG. Bucket <b> counts calls which
+ * waited less than 2^(<b>+1) microseconds and at least 2^<b>
+ * microseconds (bucket 0 starts at zero), the last bucket also counts
+ * all longer waits. Empty buckets are omitted.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_SUFFIX_WAIT_BUCKET ".wait.bucket."
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_SUFFIX_EXEC_BUCKET:
+ * Suffix of the histogram of execution times, followed by the bucket
+ * index, using the same buckets as
+ * VIR_SERVER_PROCEDURE_STATS_SUFFIX_WAIT_BUCKET, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_SUFFIX_EXEC_BUCKET ".exec.bucket."
+
+/**
+ * VIR_SERVER_PROCEDURE_STATS_BUCKETS:
+ * Number of histogram buckets kept for every procedure.
+ */
+
+# define VIR_SERVER_PROCEDURE_STATS_BUCKETS 24
+
+int virAdmServerGetProcedureStats(virAdmServerPtr srv,
+                                  virTypedParameterPtr *params,
+                                  int *nparams,
+                                  unsigned int flags);
+
+/* Monitor the objects allocated by the daemon */
+
+/**
+ * VIR_OBJECT_STATS_COUNT:
+ * Macro for the number of object classes reported, as
+ * VIR_TYPED_PARAM_UINT. Only classes with live or cached instances are
+ * reported, each of them as a group of "class.<num>." prefixed
+ * parameters where <num> ranges from 0 to the count minus one.
+ */
+
+# define VIR_OBJECT_STATS_COUNT "class.count"
+
+/**
+ * VIR_OBJECT_STATS_PREFIX:
+ * Macro for the prefix of the parameters describing a single class.
+ */
+
+# define VIR_OBJECT_STATS_PREFIX "class."
+
+/**
+ * VIR_OBJECT_STATS_SUFFIX_NAME:
+ * Suffix for the name of the class, as VIR_TYPED_PARAM_STRING.
+ */
+
+# define VIR_OBJECT_STATS_SUFFIX_NAME ".name"
+
+/**
+ * VIR_OBJECT_STATS_SUFFIX_SIZE:
+ * Suffix for the size in bytes of one instance of the class, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_OBJECT_STATS_SUFFIX_SIZE ".size"
+
+/**
+ * VIR_OBJECT_STATS_SUFFIX_LIVE:
+ * Suffix for the number of instances of the class currently in use, as
+ * VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_OBJECT_STATS_SUFFIX_LIVE ".live"
+
+/**
+ * VIR_OBJECT_STATS_SUFFIX_CACHED:
+ * Suffix for the number of released instances of the class kept in the
+ * shared cache for reuse, as VIR_TYPED_PARAM_UINT. Instances cached by
+ * the individual threads are not included.
+ */
+
+# define VIR_OBJECT_STATS_SUFFIX_CACHED ".cached"
+
+int virAdmConnectGetObjectStats(virAdmConnectPtr conn,
+                                virTypedParameterPtr *params,
+                                int *nparams,
+                                unsigned int flags);
+
+/* Monitor the streams of files and block devices */
+
+/**
+ * VIR_STREAM_STATS_OPENED:
+ * Macro for the number of file and block device streams handed to the
+ * daemon's I/O workers so far, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_STREAM_STATS_OPENED "opened"
+
+/**
+ * VIR_STREAM_STATS_ACTIVE:
+ * Macro for the number of streams an I/O worker is copying data for
+ * right now, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_STREAM_STATS_ACTIVE "active"
+
+/**
+ * VIR_STREAM_STATS_QUEUED:
+ * Macro for the number of streams waiting for an I/O worker to become
+ * free, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_STREAM_STATS_QUEUED "queued"
+
+/**
+ * VIR_STREAM_STATS_WORKERS:
+ * Macro for the number of I/O worker threads, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_STREAM_STATS_WORKERS "workers"
+
+/**
+ * VIR_STREAM_STATS_BYTES_READ:
+ * Macro for the number of bytes read from files and block devices into
+ * streams, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_STREAM_STATS_BYTES_READ "bytesRead"
+
+/**
+ * VIR_STREAM_STATS_BYTES_WRITTEN:
+ * Macro for the number of bytes written from streams into files and
+ * block devices, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_STREAM_STATS_BYTES_WRITTEN "bytesWritten"
+
+int virAdmConnectGetStreamStats(virAdmConnectPtr conn,
+                                virTypedParameterPtr *params,
+                                int *nparams,
+                                unsigned int flags);
+
+/* Monitor the contention of the daemon's locks */
+
+/**
+ * VIR_LOCK_STATS_ENABLED:
+ * Macro for whether the daemon was started with lock profiling
+ * enabled, as VIR_TYPED_PARAM_BOOLEAN. No locks are reported otherwise.
+ */
+
+# define VIR_LOCK_STATS_ENABLED "enabled"
+
+/**
+ * VIR_LOCK_STATS_COUNT:
+ * Macro for the number of lock classes reported, as
+ * VIR_TYPED_PARAM_UINT. Each of them is reported as a group of
+ * "lock.<num>." prefixed parameters where <num> ranges from 0 to the
+ * count minus one, ordered by the time spent waiting for the locks of
+ * the class, longest first.
+ */
+
+# define VIR_LOCK_STATS_COUNT "lock.count"
+
+/**
+ * VIR_LOCK_STATS_PREFIX:
+ * Macro for the prefix of the parameters describing a single class.
+ */
+
+# define VIR_LOCK_STATS_PREFIX "lock."
+
+/**
+ * VIR_LOCK_STATS_SUFFIX_NAME:
+ * Suffix for the name of the class, as VIR_TYPED_PARAM_STRING. The
+ * locks of reference counted objects are named after the class of the
+ * object, unnamed locks are reported together as "virMutex".
+ */
+
+# define VIR_LOCK_STATS_SUFFIX_NAME ".name"
+
+/**
+ * VIR_LOCK_STATS_SUFFIX_ACQUIRED:
+ * Suffix for the number of times a lock of the class was acquired, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_LOCK_STATS_SUFFIX_ACQUIRED ".acquired"
+
+/**
+ * VIR_LOCK_STATS_SUFFIX_CONTENDED:
+ * Suffix for the number of those acquisitions which had to wait for
+ * another thread to release the lock, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_LOCK_STATS_SUFFIX_CONTENDED ".contended"
+
+/**
+ * VIR_LOCK_STATS_SUFFIX_WAIT_TIME:
+ * Suffix for the total time spent waiting to acquire a lock of the
+ * class in microseconds, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_LOCK_STATS_SUFFIX_WAIT_TIME ".waitTime"
+
+/**
+ * VIR_LOCK_STATS_SUFFIX_MAX_WAIT_TIME:
+ * Suffix for the longest time spent waiting to acquire a lock of the
+ * class in microseconds, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_LOCK_STATS_SUFFIX_MAX_WAIT_TIME ".maxWaitTime"
+
+/**
+ * VIR_LOCK_STATS_SUFFIX_HOLD_TIME:
+ * Suffix for the total time the locks of the class were held in
+ * microseconds, as VIR_TYPED_PARAM_ULLONG. Time spent waiting on a
+ * condition, which releases the lock, is not included.
+ */
+
+# define VIR_LOCK_STATS_SUFFIX_HOLD_TIME ".holdTime"
+
+/**
+ * VIR_LOCK_STATS_SUFFIX_MAX_HOLD_TIME:
+ * Suffix for the longest time a lock of the class was held in
+ * microseconds, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_LOCK_STATS_SUFFIX_MAX_HOLD_TIME ".maxHoldTime"
+
+/**
+ * VIR_LOCK_STATS_SUFFIX_COND_WAITS:
+ * Suffix for the number of times a thread waited on a condition
+ * associated with a lock of the class, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_LOCK_STATS_SUFFIX_COND_WAITS ".condWaits"
+
+/**
+ * VIR_LOCK_STATS_SUFFIX_COND_WAIT_TIME:
+ * Suffix for the total time spent waiting on those conditions in
+ * microseconds, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_LOCK_STATS_SUFFIX_COND_WAIT_TIME ".condWaitTime"
+
+typedef enum {
+    VIR_ADM_LOCK_STATS_RESET = (1 << 0), /* clear the statistics once read */
+} virAdmConnectGetLockStatsFlags;
+
+int virAdmConnectGetLockStats(virAdmConnectPtr conn,
+                              virTypedParameterPtr *params,
+                              int *nparams,
+                              unsigned int flags);
+
 /* virAdmClient object accessors */
 unsigned long long virAdmClientGetID(virAdmClientPtr client);
 long long virAdmClientGetTimestamp(virAdmClientPtr client);
@@ -220,6 +604,51 @@ int virAdmServerListClients(virAdmServerPtr srv,
                             virAdmClientPtr **clients,
                             unsigned int flags);
 
+/* Client list filters */
+
+/**
+ * VIR_CLIENT_FILTER_TRANSPORT:
+ * Macro for the client list filter only keeping the clients connected
+ * over the given transport, as VIR_TYPED_PARAM_INT holding one of
+ * virClientTransport.
+ */
+
+# define VIR_CLIENT_FILTER_TRANSPORT "transport"
+
+/**
+ * VIR_CLIENT_FILTER_IDENTITY:
+ * Macro for the client list filter only keeping the clients whose UNIX
+ * user name, SASL user name or x509 distinguished name equals the given
+ * one, as VIR_TYPED_PARAM_STRING.
+ */
+
+# define VIR_CLIENT_FILTER_IDENTITY "identity"
+
+/**
+ * VIR_CLIENT_FILTER_MIN_AGE:
+ * Macro for the client list filter only keeping the clients connected
+ * for at least the given number of seconds, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_CLIENT_FILTER_MIN_AGE "minAge"
+
+/**
+ * VIR_CLIENT_FILTER_MIN_IDLE:
+ * Macro for the client list filter only keeping the clients which have
+ * not issued any request other than keepalives for at least the given
+ * number of seconds, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_CLIENT_FILTER_MIN_IDLE "minIdle"
+
+int virAdmServerListClientsFiltered(virAdmServerPtr srv,
+                                    virTypedParameterPtr filters,
+                                    int nfilters,
+                                    unsigned long long *cursor,
+                                    unsigned int limit,
+                                    virAdmClientPtr **clients,
+                                    unsigned int flags);
+
 virAdmClientPtr
 virAdmServerLookupClient(virAdmServerPtr srv,
                          unsigned long long id,
@@ -345,6 +774,30 @@ virAdmServerLookupClient(virAdmServerPtr srv,
 
 # define VIR_CLIENT_INFO_SELINUX_CONTEXT "selinux_context"
 
+/**
+ * VIR_CLIENT_INFO_QUEUED_REQUESTS:
+ * Macro represents the number of the client's requests waiting for a worker
+ * thread, either because all workers are busy or because the client exceeds
+ * its rate limit, as VIR_TYPED_PARAM_UINT.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_CLIENT_INFO_QUEUED_REQUESTS "queued_requests"
+
+/**
+ * VIR_CLIENT_INFO_THROTTLED_REQUESTS:
+ * Macro represents the number of the client's requests that were delayed by
+ * the server's client rate limit since the client connected,
+ * as VIR_TYPED_PARAM_ULLONG.
+ *
+ * NOTE: This attribute is read-only and any attempt to set it will be denied
+ * by daemon
+ */
+
+# define VIR_CLIENT_INFO_THROTTLED_REQUESTS "throttled_requests"
+
 int virAdmClientGetInfo(virAdmClientPtr client,
                         virTypedParameterPtr *params,
                         int *nparams,
@@ -394,6 +847,34 @@ int virAdmClientClose(virAdmClientPtr client, unsigned int flags);
 
 # define VIR_SERVER_CLIENTS_UNAUTH_CURRENT "nclients_unauth"
 
+/**
+ * VIR_SERVER_CLIENTS_RATE_LIMIT:
+ * Macro for per-server client_rate_limit limit: represents the number of
+ * requests per second each client may issue before further requests are
+ * delayed, 0 meaning no limit, as VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_CLIENTS_RATE_LIMIT "client_rate_limit"
+
+/**
+ * VIR_SERVER_CLIENTS_RATE_BURST:
+ * Macro for per-server client_rate_burst limit: represents the number of
+ * requests a client may issue at once in excess of VIR_SERVER_CLIENTS_RATE_LIMIT
+ * before they get delayed, as VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_CLIENTS_RATE_BURST "client_rate_burst"
+
+/**
+ * VIR_SERVER_CLIENTS_RW_WEIGHT:
+ * Macro for per-server client_rw_weight attribute: when requests have to
+ * wait for a worker thread, worker threads are shared fairly between the
+ * clients, with a read-write client getting this many times the share of a
+ * read-only one, as VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_CLIENTS_RW_WEIGHT "client_rw_weight"
+
 int virAdmServerGetClientLimits(virAdmServerPtr srv,
                                 virTypedParameterPtr *params,
                                 int *nparams,
@@ -404,6 +885,57 @@ int virAdmServerSetClientLimits(virAdmServerPtr srv,
                                 int nparams,
                                 unsigned int flags);
 
+/* Per-server client statistics */
+
+/**
+ * VIR_SERVER_CLIENTS_UNIX:
+ * Macro for the number of clients connected to the server over
+ * a UNIX socket, as VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_CLIENTS_UNIX "nclients_unix"
+
+/**
+ * VIR_SERVER_CLIENTS_TCP:
+ * Macro for the number of clients connected to the server over
+ * unencrypted TCP, as VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_CLIENTS_TCP "nclients_tcp"
+
+/**
+ * VIR_SERVER_CLIENTS_TLS:
+ * Macro for the number of clients connected to the server over
+ * TLS, as VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_CLIENTS_TLS "nclients_tls"
+
+/**
+ * VIR_SERVER_CLIENTS_READONLY:
+ * Macro for the number of read-only clients connected to the server,
+ * as VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_CLIENTS_READONLY "nclients_readonly"
+
+/**
+ * VIR_SERVER_CLIENTS_PENDING:
+ * Macro for the number of connections accepted by the server, but not
+ * set up as clients yet, as VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_CLIENTS_PENDING "nclients_pending"
+
+int virAdmServerGetClientStats(virAdmServerPtr srv,
+                               virTypedParameterPtr *params,
+                               int *nparams,
+                               unsigned int flags);
+
+int virAdmConnectDumpLoggingMemory(virAdmConnectPtr conn,
+                                   char **messages,
+                                   unsigned int flags);
+
 int virAdmConnectGetLoggingOutputs(virAdmConnectPtr conn,
                                    char **outputs,
                                    unsigned int flags);
@@ -823,6 +823,13 @@ typedef enum {
      */
     VIR_MIGRATE_TLS               = (1 << 16),
 
+    /* Setting the VIR_MIGRATE_PARALLEL flag tells libvirt to send migration
+     * data over several connections in parallel. The number of connections
+     * may be set with VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS. Parallel
+     * migration cannot be combined with VIR_MIGRATE_TUNNELLED.
+     */
+    VIR_MIGRATE_PARALLEL          = (1 << 17),
+
 } virDomainMigrateFlags;
 
 
@@ -946,6 +953,49 @@ typedef enum {
  */
 # define VIR_MIGRATE_PARAM_DISKS_PORT    "disks_port"
 
+/**
+ * VIR_MIGRATE_PARAM_DISKS_BANDWIDTH:
+ *
+ * virDomainMigrate* params field: the maximum bandwidth (in MiB/s) each of
+ * the disks may use while being copied to the destination during migration
+ * with non-shared storage, as VIR_TYPED_PARAM_ULLONG. If omitted, the
+ * migration bandwidth applies to each disk. At the moment this is only
+ * supported by the QEMU driver.
+ */
+# define VIR_MIGRATE_PARAM_DISKS_BANDWIDTH    "disks_bandwidth"
+
+/**
+ * VIR_MIGRATE_PARAM_DISKS_TOTAL_BANDWIDTH:
+ *
+ * virDomainMigrate* params field: the maximum bandwidth (in MiB/s) all the
+ * disks copied during migration with non-shared storage may use together,
+ * as VIR_TYPED_PARAM_ULLONG. The bandwidth is split evenly among the disks.
+ * At the moment this is only supported by the QEMU driver.
+ */
+# define VIR_MIGRATE_PARAM_DISKS_TOTAL_BANDWIDTH    "disks_total_bandwidth"
+
+/**
+ * VIR_MIGRATE_PARAM_DISKS_BUF_SIZE:
+ *
+ * virDomainMigrate* params field: the size (in bytes) of the buffer each
+ * disk copy may use for data in flight during migration with non-shared
+ * storage, as VIR_TYPED_PARAM_ULLONG. If omitted or 0, the hypervisor
+ * chooses a default. At the moment this is only supported by the QEMU
+ * driver.
+ */
+# define VIR_MIGRATE_PARAM_DISKS_BUF_SIZE    "disks_buf_size"
+
+/**
+ * VIR_MIGRATE_PARAM_DISKS_GRANULARITY:
+ *
+ * virDomainMigrate* params field: the granularity (in bytes, a power of 2)
+ * at which dirty disk blocks are tracked and copied during migration with
+ * non-shared storage, as VIR_TYPED_PARAM_UINT. If omitted or 0, the
+ * hypervisor chooses a default. At the moment this is only supported by
+ * the QEMU driver.
+ */
+# define VIR_MIGRATE_PARAM_DISKS_GRANULARITY    "disks_granularity"
+
 /**
  * VIR_MIGRATE_PARAM_COMPRESSION:
  *
@@ -1008,6 +1058,38 @@ typedef enum {
  */
 # define VIR_MIGRATE_PARAM_AUTO_CONVERGE_INCREMENT  "auto_converge.increment"
 
+/**
+ * VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS:
+ *
+ * virDomainMigrate* params field: number of connections used during parallel
+ * migration. As VIR_TYPED_PARAM_INT. Only valid together with the
+ * VIR_MIGRATE_PARALLEL flag.
+ */
+# define VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS     "parallel.connections"
+
+/**
+ * VIR_MIGRATE_PARAM_CONVERGE_MAX_DOWNTIME:
+ *
+ * virDomainMigrate* params field: the maximum downtime (in milliseconds)
+ * the hypervisor may let the domain be paused for at the end of migration
+ * when it sees the migration is not converging, as VIR_TYPED_PARAM_ULLONG.
+ * The downtime is raised gradually towards this limit as needed. At the
+ * moment this is only supported by the QEMU driver.
+ */
+# define VIR_MIGRATE_PARAM_CONVERGE_MAX_DOWNTIME    "converge.max_downtime"
+
+/**
+ * VIR_MIGRATE_PARAM_CONVERGE_MAX_TIME:
+ *
+ * virDomainMigrate* params field: the time (in seconds) migration is
+ * expected to finish within, as VIR_TYPED_PARAM_ULLONG. Once it runs
+ * longer, the hypervisor switches to post-copy if VIR_MIGRATE_POSTCOPY
+ * was used or lets the downtime grow to
+ * VIR_MIGRATE_PARAM_CONVERGE_MAX_DOWNTIME otherwise. At the moment this
+ * is only supported by the QEMU driver.
+ */
+# define VIR_MIGRATE_PARAM_CONVERGE_MAX_TIME        "converge.max_time"
+
 /* Domain migration. */
 virDomainPtr virDomainMigrate (virDomainPtr domain, virConnectPtr dconn,
                                unsigned long flags, const char *dname,
@@ -2000,6 +2082,9 @@ typedef enum {
     /* Additionally, these flags may be bitwise-OR'd in.  */
     VIR_DOMAIN_DEVICE_MODIFY_FORCE = (1 << 2), /* Forcibly modify device
                                                   (ex. force eject a cdrom) */
+    VIR_DOMAIN_DEVICE_MODIFY_ASYNC = (1 << 3), /* Don't wait for the guest
+                                                  to release a detached
+                                                  device */
 } virDomainDeviceModifyFlags;
 
 int virDomainAttachDevice(virDomainPtr domain, const char *xml);
@@ -2028,6 +2113,14 @@ typedef enum {
     VIR_DOMAIN_STATS_INTERFACE = (1 << 4), /* return domain interfaces info */
     VIR_DOMAIN_STATS_BLOCK = (1 << 5), /* return domain block info */
     VIR_DOMAIN_STATS_PERF = (1 << 6), /* return domain perf event info */
+    VIR_DOMAIN_STATS_MONITOR = (1 << 7), /* return hypervisor monitor info */
+    VIR_DOMAIN_STATS_STARTUP = (1 << 8), /* return domain startup timing */
+    VIR_DOMAIN_STATS_METADATA = (1 << 9), /* return domain metadata */
+    VIR_DOMAIN_STATS_AGENT = (1 << 10), /* return info from the guest agent */
+    VIR_DOMAIN_STATS_JOB = (1 << 11), /* return domain job wait info */
+    VIR_DOMAIN_STATS_FOOTPRINT = (1 << 12), /* return daemon memory used by
+                                               the domain */
+    VIR_DOMAIN_STATS_DIRTYRATE = (1 << 13), /* return domain dirty rate info */
 } virDomainStatsTypes;
 
 typedef enum {
@@ -2042,6 +2135,8 @@ typedef enum {
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_SHUTOFF = VIR_CONNECT_LIST_DOMAINS_SHUTOFF,
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_OTHER = VIR_CONNECT_LIST_DOMAINS_OTHER,
 
+    VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLE_HISTORY = 1 << 28, /* return all kept background samples */
+    VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED = 1 << 29, /* return the latest background sample */
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING = 1 << 30, /* include backing chain for block stats */
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS = 1U << 31, /* enforce requested stats */
 } virConnectGetAllDomainStatsFlags;
@@ -2325,6 +2420,9 @@ typedef enum {
     /* Active Block Commit (virDomainBlockCommit with flags), job
      * exists as long as sync is active */
 
+    VIR_DOMAIN_BLOCK_JOB_TYPE_BACKUP = 5,
+    /* Block Backup (virDomainBlockBackup), job ends on completion */
+
 # ifdef VIR_ENUM_SENTINELS
     VIR_DOMAIN_BLOCK_JOB_TYPE_LAST
 # endif
@@ -2475,6 +2573,34 @@ int virDomainBlockCopy(virDomainPtr dom, const char *disk,
                        int nparams,
                        unsigned int flags);
 
+/**
+ * virDomainBlockBackupFlags:
+ *
+ * Flags available for virDomainBlockBackup().
+ */
+typedef enum {
+    VIR_DOMAIN_BLOCK_BACKUP_INCREMENTAL = 1 << 0, /* Copy only the data
+                                                     changed since the
+                                                     previous backup */
+    VIR_DOMAIN_BLOCK_BACKUP_REUSE_EXT   = 1 << 1, /* Reuse existing external
+                                                     file for the backup */
+} virDomainBlockBackupFlags;
+
+/**
+ * VIR_DOMAIN_BLOCK_BACKUP_BANDWIDTH:
+ * Macro for the virDomainBlockBackup bandwidth tunable: it represents
+ * the maximum bandwidth in bytes/s used by the backup job, with a type
+ * of ullong.  Specifying 0 is the same as omitting this parameter, to
+ * request no bandwidth limiting.
+ */
+# define VIR_DOMAIN_BLOCK_BACKUP_BANDWIDTH "bandwidth"
+
+int virDomainBlockBackup(virDomainPtr dom, const char *disk,
+                         const char *destxml,
+                         virTypedParameterPtr params,
+                         int nparams,
+                         unsigned int flags);
+
 /**
  * virDomainBlockCommitFlags:
  *
@@ -3415,6 +3541,34 @@ typedef enum {
  */
 # define VIR_DOMAIN_JOB_AUTO_CONVERGE_THROTTLE  "auto_converge_throttle"
 
+/**
+ * VIR_DOMAIN_JOB_PARALLEL_CONNECTIONS:
+ *
+ * virDomainGetJobStats field: number of connections used by a parallel
+ * migration, as VIR_TYPED_PARAM_INT.
+ */
+# define VIR_DOMAIN_JOB_PARALLEL_CONNECTIONS    "parallel_connections"
+
+/**
+ * VIR_DOMAIN_JOB_QUEUE_POSITION:
+ *
+ * virDomainGetJobStats field: position of the migration in the queue of
+ * migrations waiting until the host allows them to start, as
+ * VIR_TYPED_PARAM_UINT. The field is only present while the migration is
+ * queued; 1 means the migration is the next one to start.
+ */
+# define VIR_DOMAIN_JOB_QUEUE_POSITION          "queue_position"
+
+/**
+ * VIR_DOMAIN_JOB_QUEUE_TIME_REMAINING:
+ *
+ * virDomainGetJobStats field: estimated time in milliseconds until a
+ * queued migration is allowed to start, as VIR_TYPED_PARAM_ULLONG. The
+ * estimate is based on the duration of previous migrations and is
+ * missing if no migration finished yet.
+ */
+# define VIR_DOMAIN_JOB_QUEUE_TIME_REMAINING    "queue_time_remaining"
+
 
 /**
  * virConnectDomainEventGenericCallback:
@@ -4694,4 +4848,27 @@ int virDomainSetBlockThreshold(virDomainPtr domain,
                                unsigned long long threshold,
                                unsigned int flags);
 
+/**
+ * virDomainDirtyRateStatus:
+ *
+ * Status of the dirty page rate calculation, as reported in the
+ * "dirtyrate.calc_status" field of the VIR_DOMAIN_STATS_DIRTYRATE group.
+ */
+typedef enum {
+    VIR_DOMAIN_DIRTYRATE_UNSTARTED = 0, /* the dirtyrate calculation has
+                                           not been started */
+    VIR_DOMAIN_DIRTYRATE_MEASURING = 1, /* the dirtyrate calculation is
+                                           measuring */
+    VIR_DOMAIN_DIRTYRATE_MEASURED = 2, /* the dirtyrate calculation is
+                                          completed */
+
+# ifdef VIR_ENUM_SENTINELS
+    VIR_DOMAIN_DIRTYRATE_LAST
+# endif
+} virDomainDirtyRateStatus;
+
+int virDomainStartDirtyRateCalc(virDomainPtr domain,
+                                int seconds,
+                                unsigned int flags);
+
 #endif /* __VIR_LIBVIRT_DOMAIN_H__ */
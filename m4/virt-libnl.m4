@@ -72,6 +72,13 @@ AC_DEFUN([LIBVIRT_CHECK_LIBNL], [
   fi
   AM_CONDITIONAL([HAVE_LIBNL], [test "$with_libnl" = "yes"])
 
+  if test "$with_libnl" = "yes"; then
+    AC_CHECK_DECLS([TCA_HTB_RATE64, TCA_POLICE_RATE64], [], [], [[
+      #include <linux/pkt_sched.h>
+      #include <linux/pkt_cls.h>
+    ]])
+  fi
+
   AC_SUBST([LIBNL_CFLAGS])
   AC_SUBST([LIBNL_LIBS])
 ])
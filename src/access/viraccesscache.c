@@ -0,0 +1,253 @@
+/*
+ * viraccesscache.c: cache of access control decisions
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "viraccesscache.h"
+#include "viralloc.h"
+#include "virbuffer.h"
+#include "virhash.h"
+#include "virlog.h"
+#include "virobject.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_ACCESS
+
+VIR_LOG_INIT("access.accesscache");
+
+/* A decision made by an access driver, valid until @expires */
+typedef struct _virAccessCacheEntry virAccessCacheEntry;
+typedef virAccessCacheEntry *virAccessCacheEntryPtr;
+struct _virAccessCacheEntry {
+    bool allowed;
+    unsigned long long expires;
+};
+
+struct _virAccessCache {
+    virObjectLockable parent;
+
+    unsigned int ttl; /* in milliseconds */
+    size_t maxEntries;
+    virHashTablePtr entries;
+};
+
+static virClassPtr virAccessCacheClass;
+
+static void virAccessCacheDispose(void *obj);
+
+static int
+virAccessCacheOnceInit(void)
+{
+    if (!(virAccessCacheClass = virClassNew(virClassForObjectLockable(),
+                                            "virAccessCache",
+                                            sizeof(virAccessCache),
+                                            virAccessCacheDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virAccessCache);
+
+
+static void
+virAccessCacheDispose(void *obj)
+{
+    virAccessCachePtr cache = obj;
+
+    virHashFree(cache->entries);
+}
+
+
+/**
+ * virAccessCacheNew:
+ * @ttl: how long decisions are remembered, in milliseconds
+ * @maxEntries: how many decisions are remembered at most
+ *
+ * Create a cache for the decisions of an access driver whose checks are
+ * expensive. Decisions are forgotten after @ttl, so that changes to the
+ * policy are picked up quickly.
+ *
+ * Returns the new cache, or NULL on error
+ */
+virAccessCachePtr
+virAccessCacheNew(unsigned int ttl,
+                  size_t maxEntries)
+{
+    virAccessCachePtr cache;
+
+    if (virAccessCacheInitialize() < 0)
+        return NULL;
+
+    if (!(cache = virObjectLockableNew(virAccessCacheClass)))
+        return NULL;
+
+    cache->ttl = ttl;
+    cache->maxEntries = maxEntries;
+
+    if (!(cache->entries = virHashCreate(32, virHashValueFree))) {
+        virObjectUnref(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+
+/**
+ * virAccessCacheKey:
+ * @subject: identifies the caller, e.g. its process and user ID
+ * @typename: the type of object checked
+ * @permname: the permission checked
+ * @attrs: NULL terminated list of name, value pairs describing the object
+ *
+ * Build the key under which a decision is stored. A subject that gets
+ * a different identity, a new process for instance, must get a
+ * different @subject string so that it doesn't inherit decisions.
+ *
+ * Returns the key, or NULL on error
+ */
+char *
+virAccessCacheKey(const char *subject,
+                  const char *typename,
+                  const char *permname,
+                  const char **attrs)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    virBufferAsprintf(&buf, "%s\n%s\n%s", subject, typename, permname);
+
+    while (attrs && attrs[0] && attrs[1]) {
+        virBufferAsprintf(&buf, "\n%s=%s", attrs[0], attrs[1]);
+        attrs += 2;
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/**
+ * virAccessCacheLookup:
+ * @cache: the cache
+ * @key: the key built by virAccessCacheKey()
+ *
+ * Returns 1 if access was granted, 0 if it was denied or -1 if there
+ * is no valid decision in @cache.
+ */
+int
+virAccessCacheLookup(virAccessCachePtr cache,
+                     const char *key)
+{
+    virAccessCacheEntryPtr entry;
+    unsigned long long now;
+    int ret = -1;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    virObjectLock(cache);
+
+    if ((entry = virHashLookup(cache->entries, key))) {
+        if (entry->expires > now)
+            ret = entry->allowed ? 1 : 0;
+        else
+            virHashRemoveEntry(cache->entries, key);
+    }
+
+    virObjectUnlock(cache);
+
+    return ret;
+}
+
+
+static int
+virAccessCacheEntryExpired(const void *payload,
+                           const void *name ATTRIBUTE_UNUSED,
+                           const void *opaque)
+{
+    const virAccessCacheEntry *entry = payload;
+    const unsigned long long *now = opaque;
+
+    return entry->expires <= *now;
+}
+
+
+/**
+ * virAccessCacheStore:
+ * @cache: the cache
+ * @key: the key built by virAccessCacheKey()
+ * @allowed: whether access was granted
+ *
+ * Remember a decision. Errors are not fatal: the decision is simply
+ * not remembered and has to be made again next time.
+ */
+void
+virAccessCacheStore(virAccessCachePtr cache,
+                    const char *key,
+                    bool allowed)
+{
+    virAccessCacheEntryPtr entry = NULL;
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0 ||
+        VIR_ALLOC_QUIET(entry) < 0)
+        goto error;
+
+    entry->allowed = allowed;
+    entry->expires = now + cache->ttl;
+
+    virObjectLock(cache);
+
+    if ((size_t) virHashSize(cache->entries) >= cache->maxEntries) {
+        virHashRemoveSet(cache->entries, virAccessCacheEntryExpired, &now);
+        if ((size_t) virHashSize(cache->entries) >= cache->maxEntries)
+            virHashRemoveAll(cache->entries);
+    }
+
+    if (virHashUpdateEntry(cache->entries, key, entry) < 0) {
+        virObjectUnlock(cache);
+        goto error;
+    }
+
+    virObjectUnlock(cache);
+    return;
+
+ error:
+    VIR_FREE(entry);
+    virResetLastError();
+}
+
+
+/**
+ * virAccessCacheFlush:
+ * @cache: the cache
+ *
+ * Forget all decisions, e.g. because the policy changed.
+ */
+void
+virAccessCacheFlush(virAccessCachePtr cache)
+{
+    virObjectLock(cache);
+    virHashRemoveAll(cache->entries);
+    virObjectUnlock(cache);
+}
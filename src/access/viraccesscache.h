@@ -0,0 +1,50 @@
+/*
+ * viraccesscache.h: cache of access control decisions
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_ACCESS_CACHE_H__
+# define __VIR_ACCESS_CACHE_H__
+
+# include "internal.h"
+
+typedef struct _virAccessCache virAccessCache;
+typedef virAccessCache *virAccessCachePtr;
+
+virAccessCachePtr virAccessCacheNew(unsigned int ttl,
+                                    size_t maxEntries);
+
+char *virAccessCacheKey(const char *subject,
+                        const char *typename,
+                        const char *permname,
+                        const char **attrs)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
+int virAccessCacheLookup(virAccessCachePtr cache,
+                         const char *key)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+void virAccessCacheStore(virAccessCachePtr cache,
+                         const char *key,
+                         bool allowed)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+void virAccessCacheFlush(virAccessCachePtr cache)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_ACCESS_CACHE_H__ */
@@ -21,6 +21,7 @@
 #include <config.h>
 
 #include "viraccessdriverpolkit.h"
+#include "viraccesscache.h"
 #include "viralloc.h"
 #include "vircommand.h"
 #include "virlog.h"
@@ -39,16 +40,36 @@ VIR_LOG_INIT("access.accessdriverpolkit");
 
 #define VIR_ACCESS_DRIVER_POLKIT_ACTION_PREFIX "org.libvirt.api"
 
+/* Every check is a DBus round trip to polkitd, and a single API call may
+ * check many objects, so decisions are remembered for a little while */
+#define VIR_ACCESS_DRIVER_POLKIT_CACHE_TTL 2000
+#define VIR_ACCESS_DRIVER_POLKIT_CACHE_SIZE 4096
+
 typedef struct _virAccessDriverPolkitPrivate virAccessDriverPolkitPrivate;
 typedef virAccessDriverPolkitPrivate *virAccessDriverPolkitPrivatePtr;
 
 struct _virAccessDriverPolkitPrivate {
-    bool ignore;
+    virAccessCachePtr cache;
 };
 
 
-static void virAccessDriverPolkitCleanup(virAccessManagerPtr manager ATTRIBUTE_UNUSED)
+static int virAccessDriverPolkitSetup(virAccessManagerPtr manager)
 {
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+
+    if (!(priv->cache = virAccessCacheNew(VIR_ACCESS_DRIVER_POLKIT_CACHE_TTL,
+                                          VIR_ACCESS_DRIVER_POLKIT_CACHE_SIZE)))
+        return -1;
+
+    return 0;
+}
+
+
+static void virAccessDriverPolkitCleanup(virAccessManagerPtr manager)
+{
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+
+    virObjectUnref(priv->cache);
 }
 
 
@@ -113,12 +134,15 @@ virAccessDriverPolkitGetCaller(const char *actionid,
 
 
 static int
-virAccessDriverPolkitCheck(virAccessManagerPtr manager ATTRIBUTE_UNUSED,
+virAccessDriverPolkitCheck(virAccessManagerPtr manager,
                            const char *typename,
                            const char *permname,
                            const char **attrs)
 {
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
     char *actionid = NULL;
+    char *subject = NULL;
+    char *key = NULL;
     int ret = -1;
     pid_t pid;
     uid_t uid;
@@ -134,6 +158,19 @@ virAccessDriverPolkitCheck(virAccessManagerPtr manager ATTRIBUTE_UNUSED,
                                        &uid) < 0)
         goto cleanup;
 
+    /* polkit identifies the caller by its process and start time, so
+     * a new process, even with a recycled PID, won't share decisions */
+    if (virAsprintf(&subject, "%lld %llu %d",
+                    (long long) pid, startTime, (int) uid) < 0 ||
+        !(key = virAccessCacheKey(subject, typename, permname, attrs)))
+        goto cleanup;
+
+    if ((ret = virAccessCacheLookup(priv->cache, key)) >= 0) {
+        VIR_DEBUG("Cached decision %d for action '%s' process '%lld' uid %d",
+                  ret, actionid, (long long) pid, uid);
+        goto cleanup;
+    }
+
     VIR_DEBUG("Check action '%s' for process '%lld' time %lld uid %d",
               actionid, (long long) pid, startTime, uid);
 
@@ -154,7 +191,13 @@ virAccessDriverPolkitCheck(virAccessManagerPtr manager ATTRIBUTE_UNUSED,
         }
     }
 
+    /* Errors, e.g. polkitd not running, are not remembered */
+    if (ret >= 0)
+        virAccessCacheStore(priv->cache, key, ret == 1);
+
  cleanup:
+    VIR_FREE(key);
+    VIR_FREE(subject);
     VIR_FREE(actionid);
     return ret;
 }
@@ -402,6 +445,7 @@ virAccessDriverPolkitCheckStorageVol(virAccessManagerPtr manager,
 virAccessDriver accessDriverPolkit = {
     .privateDataLen = sizeof(virAccessDriverPolkitPrivate),
     .name = "polkit",
+    .setup = virAccessDriverPolkitSetup,
     .cleanup = virAccessDriverPolkitCleanup,
     .checkConnect = virAccessDriverPolkitCheckConnect,
     .checkDomain = virAccessDriverPolkitCheckDomain,
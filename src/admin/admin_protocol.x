@@ -48,6 +48,27 @@ const ADMIN_CLIENT_INFO_PARAMETERS_MAX = 64;
 /* Upper limit on number of client processing controls */
 const ADMIN_SERVER_CLIENT_LIMITS_MAX = 32;
 
+/* Upper limit on number of message pool statistics */
+const ADMIN_MESSAGE_POOL_STATS_MAX = 16;
+
+/* Upper limit on number of procedure statistics parameters */
+const ADMIN_SERVER_PROCEDURE_STATS_MAX = 65536;
+
+/* Upper limit on number of object statistics parameters */
+const ADMIN_OBJECT_STATS_MAX = 4096;
+
+/* Upper limit on number of stream statistics */
+const ADMIN_STREAM_STATS_MAX = 16;
+
+/* Upper limit on number of lock statistics parameters */
+const ADMIN_LOCK_STATS_MAX = 4096;
+
+/* Upper limit on number of client list filters */
+const ADMIN_CLIENT_LIST_FILTERS_MAX = 16;
+
+/* Upper limit on number of client statistics parameters */
+const ADMIN_SERVER_CLIENT_STATS_MAX = 32;
+
 /* A long string, which may NOT be NULL. */
 typedef string admin_nonnull_string<ADMIN_STRING_MAX>;
 
@@ -211,6 +232,77 @@ struct admin_connect_set_logging_filters_args {
     unsigned int flags;
 };
 
+struct admin_connect_get_message_pool_stats_args {
+    unsigned int flags;
+};
+
+struct admin_connect_get_message_pool_stats_ret {
+    admin_typed_param params<ADMIN_MESSAGE_POOL_STATS_MAX>;
+};
+
+struct admin_server_get_procedure_stats_args {
+    admin_nonnull_server srv;
+    unsigned int flags;
+};
+
+struct admin_server_get_procedure_stats_ret {
+    admin_typed_param params<ADMIN_SERVER_PROCEDURE_STATS_MAX>;
+};
+
+struct admin_connect_get_object_stats_args {
+    unsigned int flags;
+};
+
+struct admin_connect_get_object_stats_ret {
+    admin_typed_param params<ADMIN_OBJECT_STATS_MAX>;
+};
+
+struct admin_connect_get_stream_stats_args {
+    unsigned int flags;
+};
+
+struct admin_connect_get_stream_stats_ret {
+    admin_typed_param params<ADMIN_STREAM_STATS_MAX>;
+};
+
+struct admin_connect_get_lock_stats_args {
+    unsigned int flags;
+};
+
+struct admin_connect_get_lock_stats_ret {
+    admin_typed_param params<ADMIN_LOCK_STATS_MAX>;
+};
+
+struct admin_server_list_clients_filtered_args {
+    admin_nonnull_server srv;
+    admin_typed_param filters<ADMIN_CLIENT_LIST_FILTERS_MAX>;
+    unsigned hyper start;
+    unsigned int limit;
+    unsigned int flags;
+};
+
+struct admin_server_list_clients_filtered_ret {
+    admin_nonnull_client clients<ADMIN_CLIENT_LIST_MAX>;
+    unsigned hyper next;
+};
+
+struct admin_server_get_client_stats_args {
+    admin_nonnull_server srv;
+    unsigned int flags;
+};
+
+struct admin_server_get_client_stats_ret {
+    admin_typed_param params<ADMIN_SERVER_CLIENT_STATS_MAX>;
+};
+
+struct admin_connect_dump_logging_memory_args {
+    unsigned int flags;
+};
+
+struct admin_connect_dump_logging_memory_ret {
+    admin_nonnull_string messages;
+};
+
 /* Define the program number, protocol version and procedure numbers here. */
 const ADMIN_PROGRAM = 0x06900690;
 const ADMIN_PROTOCOL_VERSION = 1;
@@ -316,5 +408,45 @@ enum admin_procedure {
     /**
      * @generate: both
      */
-    ADMIN_PROC_CONNECT_SET_LOGGING_FILTERS = 17
+    ADMIN_PROC_CONNECT_SET_LOGGING_FILTERS = 17,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_GET_MESSAGE_POOL_STATS = 18,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_SERVER_GET_PROCEDURE_STATS = 19,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_DUMP_LOGGING_MEMORY = 20,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_GET_OBJECT_STATS = 21,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_GET_STREAM_STATS = 22,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_CONNECT_GET_LOCK_STATS = 23,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_SERVER_LIST_CLIENTS_FILTERED = 24,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_SERVER_GET_CLIENT_STATS = 25
 };
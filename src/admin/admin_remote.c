@@ -461,6 +461,40 @@ remoteAdminConnectGetLoggingOutputs(virAdmConnectPtr conn,
     return rv;
 }
 
+static int
+remoteAdminConnectDumpLoggingMemory(virAdmConnectPtr conn,
+                                    char **messages,
+                                    unsigned int flags)
+{
+    int rv = -1;
+    remoteAdminPrivPtr priv = conn->privateData;
+    admin_connect_dump_logging_memory_args args;
+    admin_connect_dump_logging_memory_ret ret;
+
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    virObjectLock(priv);
+
+    if (call(conn,
+             0,
+             ADMIN_PROC_CONNECT_DUMP_LOGGING_MEMORY,
+             (xdrproc_t) xdr_admin_connect_dump_logging_memory_args,
+             (char *) &args,
+             (xdrproc_t) xdr_admin_connect_dump_logging_memory_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    VIR_STEAL_PTR(*messages, ret.messages);
+
+    rv = 0;
+    xdr_free((xdrproc_t) xdr_admin_connect_dump_logging_memory_ret, (char *) &ret);
+
+ done:
+    virObjectUnlock(priv);
+    return rv;
+}
+
 static int
 remoteAdminConnectGetLoggingFilters(virAdmConnectPtr conn,
                                     char **filters,
@@ -495,3 +529,330 @@ remoteAdminConnectGetLoggingFilters(virAdmConnectPtr conn,
     virObjectUnlock(priv);
     return rv;
 }
+
+static int
+remoteAdminConnectGetMessagePoolStats(virAdmConnectPtr conn,
+                                      virTypedParameterPtr *params,
+                                      int *nparams,
+                                      unsigned int flags)
+{
+    int rv = -1;
+    remoteAdminPrivPtr priv = conn->privateData;
+    admin_connect_get_message_pool_stats_args args;
+    admin_connect_get_message_pool_stats_ret ret;
+
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    virObjectLock(priv);
+
+    if (call(conn,
+             0,
+             ADMIN_PROC_CONNECT_GET_MESSAGE_POOL_STATS,
+             (xdrproc_t) xdr_admin_connect_get_message_pool_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_admin_connect_get_message_pool_stats_ret,
+             (char *) &ret) == -1)
+        goto cleanup;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) ret.params.params_val,
+                                  ret.params.params_len,
+                                  ADMIN_MESSAGE_POOL_STATS_MAX,
+                                  params,
+                                  nparams) < 0)
+        goto cleanup;
+
+    rv = 0;
+    xdr_free((xdrproc_t) xdr_admin_connect_get_message_pool_stats_ret,
+             (char *) &ret);
+
+ cleanup:
+    virObjectUnlock(priv);
+    return rv;
+}
+
+static int
+remoteAdminConnectGetObjectStats(virAdmConnectPtr conn,
+                                 virTypedParameterPtr *params,
+                                 int *nparams,
+                                 unsigned int flags)
+{
+    int rv = -1;
+    remoteAdminPrivPtr priv = conn->privateData;
+    admin_connect_get_object_stats_args args;
+    admin_connect_get_object_stats_ret ret;
+
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    virObjectLock(priv);
+
+    if (call(conn,
+             0,
+             ADMIN_PROC_CONNECT_GET_OBJECT_STATS,
+             (xdrproc_t) xdr_admin_connect_get_object_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_admin_connect_get_object_stats_ret,
+             (char *) &ret) == -1)
+        goto cleanup;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) ret.params.params_val,
+                                  ret.params.params_len,
+                                  ADMIN_OBJECT_STATS_MAX,
+                                  params,
+                                  nparams) < 0)
+        goto cleanup;
+
+    rv = 0;
+    xdr_free((xdrproc_t) xdr_admin_connect_get_object_stats_ret,
+             (char *) &ret);
+
+ cleanup:
+    virObjectUnlock(priv);
+    return rv;
+}
+
+static int
+remoteAdminConnectGetStreamStats(virAdmConnectPtr conn,
+                                 virTypedParameterPtr *params,
+                                 int *nparams,
+                                 unsigned int flags)
+{
+    int rv = -1;
+    remoteAdminPrivPtr priv = conn->privateData;
+    admin_connect_get_stream_stats_args args;
+    admin_connect_get_stream_stats_ret ret;
+
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    virObjectLock(priv);
+
+    if (call(conn,
+             0,
+             ADMIN_PROC_CONNECT_GET_STREAM_STATS,
+             (xdrproc_t) xdr_admin_connect_get_stream_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_admin_connect_get_stream_stats_ret,
+             (char *) &ret) == -1)
+        goto cleanup;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) ret.params.params_val,
+                                  ret.params.params_len,
+                                  ADMIN_STREAM_STATS_MAX,
+                                  params,
+                                  nparams) < 0)
+        goto cleanup;
+
+    rv = 0;
+    xdr_free((xdrproc_t) xdr_admin_connect_get_stream_stats_ret,
+             (char *) &ret);
+
+ cleanup:
+    virObjectUnlock(priv);
+    return rv;
+}
+
+static int
+remoteAdminConnectGetLockStats(virAdmConnectPtr conn,
+                               virTypedParameterPtr *params,
+                               int *nparams,
+                               unsigned int flags)
+{
+    int rv = -1;
+    remoteAdminPrivPtr priv = conn->privateData;
+    admin_connect_get_lock_stats_args args;
+    admin_connect_get_lock_stats_ret ret;
+
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    virObjectLock(priv);
+
+    if (call(conn,
+             0,
+             ADMIN_PROC_CONNECT_GET_LOCK_STATS,
+             (xdrproc_t) xdr_admin_connect_get_lock_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_admin_connect_get_lock_stats_ret,
+             (char *) &ret) == -1)
+        goto cleanup;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) ret.params.params_val,
+                                  ret.params.params_len,
+                                  ADMIN_LOCK_STATS_MAX,
+                                  params,
+                                  nparams) < 0)
+        goto cleanup;
+
+    rv = 0;
+    xdr_free((xdrproc_t) xdr_admin_connect_get_lock_stats_ret,
+             (char *) &ret);
+
+ cleanup:
+    virObjectUnlock(priv);
+    return rv;
+}
+
+static int
+remoteAdminServerGetProcedureStats(virAdmServerPtr srv,
+                                   virTypedParameterPtr *params,
+                                   int *nparams,
+                                   unsigned int flags)
+{
+    int rv = -1;
+    remoteAdminPrivPtr priv = srv->conn->privateData;
+    admin_server_get_procedure_stats_args args;
+    admin_server_get_procedure_stats_ret ret;
+
+    args.flags = flags;
+    make_nonnull_server(&args.srv, srv);
+
+    memset(&ret, 0, sizeof(ret));
+    virObjectLock(priv);
+
+    if (call(srv->conn,
+             0,
+             ADMIN_PROC_SERVER_GET_PROCEDURE_STATS,
+             (xdrproc_t) xdr_admin_server_get_procedure_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_admin_server_get_procedure_stats_ret,
+             (char *) &ret) == -1)
+        goto cleanup;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) ret.params.params_val,
+                                  ret.params.params_len,
+                                  ADMIN_SERVER_PROCEDURE_STATS_MAX,
+                                  params,
+                                  nparams) < 0)
+        goto cleanup;
+
+    rv = 0;
+    xdr_free((xdrproc_t) xdr_admin_server_get_procedure_stats_ret,
+             (char *) &ret);
+
+ cleanup:
+    virObjectUnlock(priv);
+    return rv;
+}
+
+static int
+remoteAdminServerListClientsFiltered(virAdmServerPtr srv,
+                                     virTypedParameterPtr filters,
+                                     int nfilters,
+                                     unsigned long long *cursor,
+                                     unsigned int limit,
+                                     virAdmClientPtr **clients,
+                                     unsigned int flags)
+{
+    int rv = -1;
+    remoteAdminPrivPtr priv = srv->conn->privateData;
+    admin_server_list_clients_filtered_args args;
+    admin_server_list_clients_filtered_ret ret;
+    virAdmClientPtr *tmp_clients = NULL;
+    size_t i;
+
+    args.flags = flags;
+    args.start = *cursor;
+    args.limit = limit;
+    make_nonnull_server(&args.srv, srv);
+
+    memset(&ret, 0, sizeof(ret));
+    virObjectLock(priv);
+
+    if (virTypedParamsSerialize(filters, nfilters,
+                                (virTypedParameterRemotePtr *) &args.filters.filters_val,
+                                &args.filters.filters_len,
+                                0) < 0)
+        goto done;
+
+    if (call(srv->conn,
+             0,
+             ADMIN_PROC_SERVER_LIST_CLIENTS_FILTERED,
+             (xdrproc_t) xdr_admin_server_list_clients_filtered_args,
+             (char *) &args,
+             (xdrproc_t) xdr_admin_server_list_clients_filtered_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    if (ret.clients.clients_len > ADMIN_CLIENT_LIST_MAX ||
+        (limit && ret.clients.clients_len > limit)) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many remote clients: %d > %d"),
+                       ret.clients.clients_len,
+                       limit ? MIN(limit, ADMIN_CLIENT_LIST_MAX) :
+                       ADMIN_CLIENT_LIST_MAX);
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(tmp_clients, ret.clients.clients_len + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ret.clients.clients_len; i++) {
+        if (!(tmp_clients[i] = get_nonnull_client(srv,
+                                                  ret.clients.clients_val[i])))
+            goto cleanup;
+    }
+
+    *clients = tmp_clients;
+    tmp_clients = NULL;
+    *cursor = ret.next;
+    rv = ret.clients.clients_len;
+
+ cleanup:
+    if (tmp_clients) {
+        for (i = 0; i < ret.clients.clients_len; i++)
+            virObjectUnref(tmp_clients[i]);
+        VIR_FREE(tmp_clients);
+    }
+    xdr_free((xdrproc_t) xdr_admin_server_list_clients_filtered_ret,
+             (char *) &ret);
+
+ done:
+    virTypedParamsRemoteFree((virTypedParameterRemotePtr) args.filters.filters_val,
+                             args.filters.filters_len);
+    virObjectUnlock(priv);
+    return rv;
+}
+
+static int
+remoteAdminServerGetClientStats(virAdmServerPtr srv,
+                                virTypedParameterPtr *params,
+                                int *nparams,
+                                unsigned int flags)
+{
+    int rv = -1;
+    remoteAdminPrivPtr priv = srv->conn->privateData;
+    admin_server_get_client_stats_args args;
+    admin_server_get_client_stats_ret ret;
+
+    args.flags = flags;
+    make_nonnull_server(&args.srv, srv);
+
+    memset(&ret, 0, sizeof(ret));
+    virObjectLock(priv);
+
+    if (call(srv->conn,
+             0,
+             ADMIN_PROC_SERVER_GET_CLIENT_STATS,
+             (xdrproc_t) xdr_admin_server_get_client_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_admin_server_get_client_stats_ret,
+             (char *) &ret) == -1)
+        goto cleanup;
+
+    if (virTypedParamsDeserialize((virTypedParameterRemotePtr) ret.params.params_val,
+                                  ret.params.params_len,
+                                  ADMIN_SERVER_CLIENT_STATS_MAX,
+                                  params,
+                                  nparams) < 0)
+        goto cleanup;
+
+    rv = 0;
+    xdr_free((xdrproc_t) xdr_admin_server_get_client_stats_ret,
+             (char *) &ret);
+
+ cleanup:
+    virObjectUnlock(priv);
+    return rv;
+}
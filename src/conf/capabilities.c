@@ -243,6 +243,12 @@ virCapabilitiesDispose(void *object)
         virCapsHostCacheBankFree(caps->host.caches[i]);
     VIR_FREE(caps->host.caches);
 
+    for (i = 0; i < caps->host.nnodes; i++)
+        virCapsHostMemBWNodeFree(caps->host.nodes[i]);
+    VIR_FREE(caps->host.nodes);
+
+    virResctrlInfoFree(caps->host.resctrl);
+
     VIR_FREE(caps->host.netprefix);
     VIR_FREE(caps->host.pagesSize);
     virCPUDefFree(caps->host.cpu);
@@ -872,6 +878,7 @@ virCapabilitiesFormatCaches(virBufferPtr buf,
                             virCapsHostCacheBankPtr *caches)
 {
     size_t i = 0;
+    size_t j = 0;
 
     if (!ncaches)
         return 0;
@@ -893,14 +900,49 @@ virCapabilitiesFormatCaches(virBufferPtr buf,
          */
         virBufferAsprintf(buf,
                           "<bank id='%u' level='%u' type='%s' "
-                          "size='%llu' unit='%s' cpus='%s'/>\n",
+                          "size='%llu' unit='%s' cpus='%s'",
                           bank->id, bank->level,
                           virCacheTypeToString(bank->type),
                           bank->size >> (kilos * 10),
                           kilos ? "KiB" : "B",
                           cpus_str);
-
         VIR_FREE(cpus_str);
+
+        if (!bank->ncontrols) {
+            virBufferAddLit(buf, "/>\n");
+            continue;
+        }
+
+        virBufferAddLit(buf, ">\n");
+        virBufferAdjustIndent(buf, 2);
+
+        for (j = 0; j < bank->ncontrols; j++) {
+            virResctrlInfoPerCachePtr control = bank->controls[j];
+            bool min_kilos;
+
+            kilos = !(control->granularity % 1024);
+            min_kilos = !(control->min % 1024);
+
+            /* Only use KiB if both values are divisible */
+            if (control->min)
+                kilos = kilos && min_kilos;
+
+            virBufferAsprintf(buf, "<control granularity='%llu'",
+                              control->granularity >> (kilos * 10));
+
+            if (control->min)
+                virBufferAsprintf(buf, " min='%llu'",
+                                  control->min >> (kilos * 10));
+
+            virBufferAsprintf(buf,
+                              " unit='%s' type='%s' maxAllocs='%u'/>\n",
+                              kilos ? "KiB" : "B",
+                              virCacheTypeToString(control->scope),
+                              control->max_allocation);
+        }
+
+        virBufferAdjustIndent(buf, -2);
+        virBufferAddLit(buf, "</bank>\n");
     }
 
     virBufferAdjustIndent(buf, -2);
@@ -909,6 +951,47 @@ virCapabilitiesFormatCaches(virBufferPtr buf,
     return 0;
 }
 
+static int
+virCapabilitiesFormatMemoryBandwidth(virBufferPtr buf,
+                                     size_t nnodes,
+                                     virCapsHostMemBWNodePtr *nodes)
+{
+    size_t i = 0;
+
+    if (!nnodes)
+        return 0;
+
+    virBufferAddLit(buf, "<memory_bandwidth>\n");
+    virBufferAdjustIndent(buf, 2);
+
+    for (i = 0; i < nnodes; i++) {
+        virCapsHostMemBWNodePtr node = nodes[i];
+        char *cpus_str = virBitmapFormat(node->cpus);
+
+        if (!cpus_str)
+            return -1;
+
+        virBufferAsprintf(buf, "<node id='%u' cpus='%s'>\n",
+                          node->id, cpus_str);
+        VIR_FREE(cpus_str);
+
+        virBufferAdjustIndent(buf, 2);
+        virBufferAsprintf(buf,
+                          "<control granularity='%u' min='%u' "
+                          "maxAllocs='%u'/>\n",
+                          node->control.granularity,
+                          node->control.min,
+                          node->control.max_allocation);
+        virBufferAdjustIndent(buf, -2);
+        virBufferAddLit(buf, "</node>\n");
+    }
+
+    virBufferAdjustIndent(buf, -2);
+    virBufferAddLit(buf, "</memory_bandwidth>\n");
+
+    return 0;
+}
+
 /**
  * virCapabilitiesFormatXML:
  * @caps: capabilities to format
@@ -1009,6 +1092,10 @@ virCapabilitiesFormatXML(virCapsPtr caps)
                                     caps->host.caches) < 0)
         goto error;
 
+    if (virCapabilitiesFormatMemoryBandwidth(&buf, caps->host.nnodes,
+                                             caps->host.nodes) < 0)
+        goto error;
+
     for (i = 0; i < caps->host.nsecModels; i++) {
         virBufferAddLit(&buf, "<secmodel>\n");
         virBufferAdjustIndent(&buf, 2);
@@ -1492,19 +1579,6 @@ virCapabilitiesInitPages(virCapsPtr caps)
     return ret;
 }
 
-/* Cache name mapping for Linux kernel naming */
-VIR_ENUM_DECL(virCacheKernel);
-VIR_ENUM_IMPL(virCacheKernel, VIR_CACHE_TYPE_LAST,
-              "Unified",
-              "Instruction",
-              "Data")
-
-/* Our naming for cache types and scopes */
-VIR_ENUM_IMPL(virCache, VIR_CACHE_TYPE_LAST,
-              "both",
-              "code",
-              "data")
-
 bool
 virCapsHostCacheBankEquals(virCapsHostCacheBankPtr a,
                            virCapsHostCacheBankPtr b)
@@ -1518,6 +1592,21 @@ virCapsHostCacheBankEquals(virCapsHostCacheBankPtr a,
 
 void
 virCapsHostCacheBankFree(virCapsHostCacheBankPtr ptr)
+{
+    size_t i;
+
+    if (!ptr)
+        return;
+
+    virBitmapFree(ptr->cpus);
+    for (i = 0; i < ptr->ncontrols; i++)
+        VIR_FREE(ptr->controls[i]);
+    VIR_FREE(ptr->controls);
+    VIR_FREE(ptr);
+}
+
+void
+virCapsHostMemBWNodeFree(virCapsHostMemBWNodePtr ptr)
 {
     if (!ptr)
         return;
@@ -1526,6 +1615,65 @@ virCapsHostCacheBankFree(virCapsHostCacheBankPtr ptr)
     VIR_FREE(ptr);
 }
 
+
+static int
+virCapabilitiesInitResctrl(virCapsPtr caps)
+{
+    if (caps->host.resctrl)
+        return 0;
+
+    caps->host.resctrl = virResctrlInfoNew();
+    if (!caps->host.resctrl)
+        return -1;
+
+    return 0;
+}
+
+
+/*
+ * Memory bandwidth is allocated per bank of the last level cache, so
+ * each such bank is reported as one memory bandwidth node.
+ */
+static int
+virCapabilitiesInitResctrlMemory(virCapsPtr caps)
+{
+    virCapsHostMemBWNodePtr node = NULL;
+    virResctrlInfoMemBWPerNode control;
+    unsigned int level = 0;
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; i < caps->host.ncaches; i++)
+        level = MAX(level, caps->host.caches[i]->level);
+
+    for (i = 0; i < caps->host.ncaches; i++) {
+        virCapsHostCacheBankPtr bank = caps->host.caches[i];
+
+        if (bank->level != level)
+            continue;
+
+        if (virResctrlInfoGetMemoryBandwidth(caps->host.resctrl,
+                                             &control) <= 0)
+            break;
+
+        if (VIR_ALLOC(node) < 0)
+            goto cleanup;
+
+        node->id = bank->id;
+        node->control = control;
+        if (!(node->cpus = virBitmapNewCopy(bank->cpus)))
+            goto cleanup;
+
+        if (VIR_APPEND_ELEMENT(caps->host.nodes, caps->host.nnodes, node) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virCapsHostMemBWNodeFree(node);
+    return ret;
+}
+
 int
 virCapabilitiesInitCaches(virCapsPtr caps)
 {
@@ -1544,6 +1692,9 @@ virCapabilitiesInitCaches(virCapsPtr caps)
      * lose information. */
     const int cache_min_level = 3;
 
+    if (virCapabilitiesInitResctrl(caps) < 0)
+        return -1;
+
     /* offline CPUs don't provide cache info */
     if (virFileReadValueBitmap(&cpus, "%s/cpu/online", SYSFS_SYSTEM_PATH) < 0)
         return -1;
@@ -1615,12 +1766,18 @@ virCapabilitiesInitCaches(virCapsPtr caps)
                 goto cleanup;
             }
             bank->type = kernel_type;
+            VIR_FREE(type);
 
             for (i = 0; i < caps->host.ncaches; i++) {
                 if (virCapsHostCacheBankEquals(bank, caps->host.caches[i]))
                     break;
             }
             if (i == caps->host.ncaches) {
+                if (virResctrlInfoGetCache(caps->host.resctrl, bank->level,
+                                           bank->size, &bank->ncontrols,
+                                           &bank->controls) < 0)
+                    goto cleanup;
+
                 if (VIR_APPEND_ELEMENT(caps->host.caches,
                                        caps->host.ncaches,
                                        bank) < 0) {
@@ -1635,10 +1792,14 @@ virCapabilitiesInitCaches(virCapsPtr caps)
             goto cleanup;
     }
 
+    if (virCapabilitiesInitResctrlMemory(caps) < 0)
+        goto cleanup;
+
     ret = 0;
  cleanup:
     VIR_FREE(path);
     virDirClose(&dirp);
     virCapsHostCacheBankFree(bank);
+    virBitmapFree(cpus);
     return ret;
 }
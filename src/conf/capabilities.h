@@ -30,6 +30,7 @@
 # include "virarch.h"
 # include "virmacaddr.h"
 # include "virobject.h"
+# include "virresctrl.h"
 
 # include <libxml/xpath.h>
 
@@ -138,16 +139,6 @@ struct _virCapsHostSecModel {
     virCapsHostSecModelLabelPtr labels;
 };
 
-typedef enum {
-    VIR_CACHE_TYPE_BOTH,
-    VIR_CACHE_TYPE_CODE,
-    VIR_CACHE_TYPE_DATA,
-
-    VIR_CACHE_TYPE_LAST
-} virCacheType;
-
-VIR_ENUM_DECL(virCache);
-
 typedef struct _virCapsHostCacheBank virCapsHostCacheBank;
 typedef virCapsHostCacheBank *virCapsHostCacheBankPtr;
 struct _virCapsHostCacheBank {
@@ -156,6 +147,16 @@ struct _virCapsHostCacheBank {
     unsigned long long size; /* B */
     virCacheType type;  /* Data, Instruction or Unified */
     virBitmapPtr cpus;  /* All CPUs that share this bank */
+    size_t ncontrols;
+    virResctrlInfoPerCachePtr *controls;
+};
+
+typedef struct _virCapsHostMemBWNode virCapsHostMemBWNode;
+typedef virCapsHostMemBWNode *virCapsHostMemBWNodePtr;
+struct _virCapsHostMemBWNode {
+    unsigned int id;
+    virBitmapPtr cpus;  /* All CPUs that belong to this node */
+    virResctrlInfoMemBWPerNode control;
 };
 
 typedef struct _virCapsHost virCapsHost;
@@ -177,9 +178,14 @@ struct _virCapsHost {
     size_t nnumaCell_max;
     virCapsHostNUMACellPtr *numaCell;
 
+    virResctrlInfoPtr resctrl;
+
     size_t ncaches;
     virCapsHostCacheBankPtr *caches;
 
+    size_t nnodes;
+    virCapsHostMemBWNodePtr *nodes;
+
     size_t nsecModels;
     virCapsHostSecModelPtr secModels;
 
@@ -329,6 +335,7 @@ int virCapabilitiesInitNUMA(virCapsPtr caps);
 bool virCapsHostCacheBankEquals(virCapsHostCacheBankPtr a,
                                 virCapsHostCacheBankPtr b);
 void virCapsHostCacheBankFree(virCapsHostCacheBankPtr ptr);
+void virCapsHostMemBWNodeFree(virCapsHostMemBWNodePtr ptr);
 
 int virCapabilitiesInitCaches(virCapsPtr caps);
 
@@ -23,6 +23,8 @@
 
 #include <config.h>
 
+#include <strings.h>
+
 #include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
@@ -197,6 +199,24 @@ virDomainPCIAddressFlagsCompatible(virPCIDeviceAddressPtr addr,
 }
 
 
+/* Same as virDomainPCIAddressFlagsCompatible() for an automatically
+ * assigned address, without any error reporting.
+ */
+static bool
+virDomainPCIAddressFlagsMatch(virDomainPCIConnectFlags busFlags,
+                              virDomainPCIConnectFlags devFlags)
+{
+    if (!(devFlags & busFlags & VIR_PCI_CONNECT_TYPES_MASK))
+        return false;
+
+    if ((devFlags & VIR_PCI_CONNECT_HOTPLUGGABLE) &&
+        !(busFlags & VIR_PCI_CONNECT_HOTPLUGGABLE))
+        return false;
+
+    return true;
+}
+
+
 /* Verify that the address is in bounds for the chosen bus, and
  * that the bus is of the correct type for the device (via
  * comparing the flags).
@@ -470,8 +490,11 @@ virDomainPCIAddressSetGrow(virDomainPCIAddressSetPtr addrs,
 
     i = addrs->nbuses;
 
-    if (VIR_EXPAND_N(addrs->buses, addrs->nbuses, add) < 0)
+    /* On a dry run buses are added one at a time as devices are
+     * assigned, so grow the array geometrically */
+    if (VIR_RESIZE_N(addrs->buses, addrs->nbuses_max, addrs->nbuses, add) < 0)
         return -1;
+    addrs->nbuses += add;
 
     if (needDMIToPCIBridge) {
         /* first of the new buses is dmi-to-pci-bridge, the
@@ -506,6 +529,40 @@ virDomainPCIAddressAsString(virPCIDeviceAddressPtr addr)
 }
 
 
+/* Bring the slot summary of @bus up to date after a change of @slot */
+static void
+virDomainPCIAddressBusUpdateSlot(virDomainPCIAddressBusPtr bus,
+                                 unsigned int slot)
+{
+    uint32_t bit = 1U << slot;
+    uint8_t functions = bus->slot[slot].functions;
+
+    if (functions)
+        bus->usedSlots |= bit;
+    else
+        bus->usedSlots &= ~bit;
+
+    if (bus->slot[slot].aggregate &&
+        functions != (1 << (VIR_PCI_ADDRESS_FUNCTION_LAST + 1)) - 1)
+        bus->aggregateSlots |= bit;
+    else
+        bus->aggregateSlots &= ~bit;
+}
+
+
+/* Mask of the slots of @bus from @first up to its last one */
+static uint32_t
+virDomainPCIAddressBusSlotRange(virDomainPCIAddressBusPtr bus,
+                                unsigned int first)
+{
+    if (first > bus->maxSlot)
+        return 0;
+
+    return (UINT32_MAX >> (VIR_PCI_ADDRESS_SLOT_LAST - bus->maxSlot)) &
+           (UINT32_MAX << first);
+}
+
+
 /*
  * Check if the PCI slot is used by another device.
  */
@@ -567,6 +624,7 @@ virDomainPCIAddressReserveAddrInternal(virDomainPCIAddressSetPtr addrs,
 
     /* mark the requested function as reserved */
     bus->slot[addr->slot].functions |= (1 << addr->function);
+    virDomainPCIAddressBusUpdateSlot(bus, addr->slot);
     VIR_DEBUG("Reserving PCI address %s (aggregate='%s')", addrStr,
               bus->slot[addr->slot].aggregate ? "true" : "false");
 
@@ -633,7 +691,10 @@ int
 virDomainPCIAddressReleaseAddr(virDomainPCIAddressSetPtr addrs,
                                virPCIDeviceAddressPtr addr)
 {
-    addrs->buses[addr->bus].slot[addr->slot].functions &= ~(1 << addr->function);
+    virDomainPCIAddressBusPtr bus = &addrs->buses[addr->bus];
+
+    bus->slot[addr->slot].functions &= ~(1 << addr->function);
+    virDomainPCIAddressBusUpdateSlot(bus, addr->slot);
     return 0;
 }
 
@@ -648,7 +709,7 @@ virDomainPCIAddressSetAlloc(unsigned int nbuses)
     if (VIR_ALLOC_N(addrs->buses, nbuses) < 0)
         goto error;
 
-    addrs->nbuses = nbuses;
+    addrs->nbuses = addrs->nbuses_max = nbuses;
     return addrs;
 
  error:
@@ -668,70 +729,54 @@ virDomainPCIAddressSetFree(virDomainPCIAddressSetPtr addrs)
 }
 
 
-static int
+/* Look for a slot on @bus from @searchAddr->slot onwards which a
+ * device with @flags can use, and update @searchAddr to it. Returns
+ * true if one was found.
+ */
+static bool
 virDomainPCIAddressFindUnusedFunctionOnBus(virDomainPCIAddressBusPtr bus,
                                            virPCIDeviceAddressPtr searchAddr,
                                            int function,
-                                           virDomainPCIConnectFlags flags,
-                                           bool *found)
+                                           virDomainPCIConnectFlags flags)
 {
-    int ret = -1;
-    char *addrStr = NULL;
-
-    *found = false;
-
-    if (!(addrStr = virDomainPCIAddressAsString(searchAddr)))
-        goto cleanup;
+    uint32_t candidates;
 
-    if (!virDomainPCIAddressFlagsCompatible(searchAddr, addrStr, bus->flags,
-                                            flags, false, false)) {
+    if (!virDomainPCIAddressFlagsMatch(bus->flags, flags)) {
         VIR_DEBUG("PCI bus %.4x:%.2x is not compatible with the device",
                   searchAddr->domain, searchAddr->bus);
-    } else {
-        while (searchAddr->slot <= bus->maxSlot) {
-            if (bus->slot[searchAddr->slot].functions == 0) {
-                *found = true;
-                break;
-            }
+        return false;
+    }
 
-            if (flags & VIR_PCI_CONNECT_AGGREGATE_SLOT &&
-                bus->slot[searchAddr->slot].aggregate) {
-                /* slot and device are okay with aggregating devices */
-                if ((bus->slot[searchAddr->slot].functions &
-                     (1 << searchAddr->function)) == 0) {
-                    *found = true;
-                    break;
-                }
-
-                /* also check for *any* unused function if caller
-                 * sent function = -1
-                 */
-                if (function == -1) {
-                    while (searchAddr->function < 8) {
-                        if ((bus->slot[searchAddr->slot].functions &
-                             (1 << searchAddr->function)) == 0) {
-                            *found = true;
-                            break; /* out of inner while */
-                        }
-                        searchAddr->function++;
-                    }
-                    if (*found)
-                       break; /* out of outer while */
-                    searchAddr->function = 0; /* reset for next try */
-                }
-            }
+    /* unused slots, and those shared with devices like this one */
+    candidates = ~bus->usedSlots;
+    if (flags & VIR_PCI_CONNECT_AGGREGATE_SLOT)
+        candidates |= bus->aggregateSlots;
+    candidates &= virDomainPCIAddressBusSlotRange(bus, searchAddr->slot);
+
+    while (candidates) {
+        unsigned int slot = ffs(candidates) - 1;
+        uint8_t functions = bus->slot[slot].functions;
 
-            VIR_DEBUG("PCI slot %.4x:%.2x:%.2x already in use",
-                      searchAddr->domain, searchAddr->bus, searchAddr->slot);
-            searchAddr->slot++;
+        candidates &= ~(1U << slot);
+
+        if (functions) {
+            /* slot and device are okay with aggregating devices, take
+             * the requested function if it is free, or *any* unused
+             * function if caller sent function = -1
+             */
+            if (function == -1)
+                searchAddr->function = ffs(~functions) - 1;
+            else if (functions & (1 << searchAddr->function))
+                continue;
         }
-    }
 
-    ret = 0;
+        searchAddr->slot = slot;
+        return true;
+    }
 
- cleanup:
-    VIR_FREE(addrStr);
-    return ret;
+    VIR_DEBUG("No free PCI slot on bus %.4x:%.2x",
+              searchAddr->domain, searchAddr->bus);
+    return false;
 }
 
 
@@ -745,7 +790,6 @@ virDomainPCIAddressGetNextAddr(virDomainPCIAddressSetPtr addrs,
      * the first slot of domain 0 bus 0...
      */
     virPCIDeviceAddress a = { 0 };
-    bool found = false;
 
     if (addrs->nbuses == 0) {
         virReportError(VIR_ERR_XML_ERROR, "%s", _("No PCI buses available"));
@@ -770,12 +814,7 @@ virDomainPCIAddressGetNextAddr(virDomainPCIAddressSetPtr addrs,
 
     while (a.bus < addrs->nbuses) {
         if (virDomainPCIAddressFindUnusedFunctionOnBus(&addrs->buses[a.bus],
-                                                       &a, function,
-                                                       flags, &found) < 0) {
-            goto error;
-        }
-
-        if (found)
+                                                       &a, function, flags))
             goto success;
 
         /* nothing on this bus, go to the next bus */
@@ -797,12 +836,7 @@ virDomainPCIAddressGetNextAddr(virDomainPCIAddressSetPtr addrs,
             a.slot = addrs->buses[a.bus].minSlot;
 
             if (virDomainPCIAddressFindUnusedFunctionOnBus(&addrs->buses[a.bus],
-                                                           &a, function,
-                                                           flags, &found) < 0) {
-                goto error;
-            }
-
-            if (found)
+                                                           &a, function, flags))
                 goto success;
         }
     }
@@ -100,12 +100,22 @@ typedef struct {
      * bit is set, that function is in use by a device.
      */
     virDomainPCIAddressSlot slot[VIR_PCI_ADDRESS_SLOT_LAST + 1];
+
+    /* Summary of @slot kept up to date when addresses are reserved
+     * and released, so that free slots can be found by scanning bits:
+     * bit N of usedSlots is set if slot N has any function in use, and
+     * bit N of aggregateSlots if slot N is an aggregate slot which
+     * still has a free function.
+     */
+    uint32_t usedSlots;
+    uint32_t aggregateSlots;
 } virDomainPCIAddressBus;
 typedef virDomainPCIAddressBus *virDomainPCIAddressBusPtr;
 
 struct _virDomainPCIAddressSet {
     virDomainPCIAddressBus *buses;
     size_t nbuses;
+    size_t nbuses_max;
     virPCIDeviceAddress lastaddr;
     virDomainPCIConnectFlags lastFlags;
     bool dryRun;          /* on a dry run, new buses are auto-added
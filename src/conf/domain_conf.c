@@ -863,7 +863,7 @@ VIR_ENUM_IMPL(virDomainLoader,
  * <mirror> XML (remaining types are not two-phase). */
 VIR_ENUM_DECL(virDomainBlockJob)
 VIR_ENUM_IMPL(virDomainBlockJob, VIR_DOMAIN_BLOCK_JOB_TYPE_LAST,
-              "", "", "copy", "", "active-commit")
+              "", "", "copy", "", "active-commit", "backup")
 
 VIR_ENUM_IMPL(virDomainMemoryModel,
               VIR_DOMAIN_MEMORY_MODEL_LAST,
@@ -1951,6 +1951,7 @@ virDomainNetDefClear(virDomainNetDefPtr def)
     virNetDevBandwidthFree(def->bandwidth);
     def->bandwidth = NULL;
     virNetDevVlanClear(&def->vlan);
+    VIR_FREE(def->coalesce);
 }
 
 void
@@ -2682,6 +2683,17 @@ virDomainLoaderDefFree(virDomainLoaderDefPtr loader)
     VIR_FREE(loader);
 }
 
+static void
+virDomainResctrlDefFree(virDomainResctrlDefPtr resctrl)
+{
+    if (!resctrl)
+        return;
+
+    virBitmapFree(resctrl->vcpus);
+    virResctrlAllocFree(resctrl->alloc);
+    VIR_FREE(resctrl);
+}
+
 void virDomainDefFree(virDomainDefPtr def)
 {
     size_t i;
@@ -2833,6 +2845,10 @@ void virDomainDefFree(virDomainDefPtr def)
 
     virDomainIOThreadIDDefArrayFree(def->iothreadids, def->niothreadids);
 
+    for (i = 0; i < def->nresctrls; i++)
+        virDomainResctrlDefFree(def->resctrls[i]);
+    VIR_FREE(def->resctrls);
+
     virBitmapFree(def->cputune.emulatorpin);
 
     virDomainNumaFree(def->numa);
@@ -2983,6 +2999,25 @@ void virDomainObjAssignDef(virDomainObjPtr domain,
             domain->def = def;
         }
     }
+
+    virDomainObjBumpGeneration(domain);
+}
+
+
+/**
+ * virDomainObjBumpGeneration:
+ * @obj: domain object, must be locked
+ *
+ * Record that the definitions of @obj may have changed, so that
+ * anything derived from them, like a formatted XML description, needs
+ * to be recomputed. Drivers call this whenever they modify the
+ * definitions; assigning or swapping them through the virDomainObj
+ * helpers does so automatically.
+ */
+void
+virDomainObjBumpGeneration(virDomainObjPtr obj)
+{
+    obj->generation++;
 }
 
 
@@ -3084,6 +3119,7 @@ virDomainObjSetDefTransient(virCapsPtr caps,
     if (!(domain->newDef = virDomainDefCopy(domain->def, caps, xmlopt, NULL, false)))
         goto out;
 
+    virDomainObjBumpGeneration(domain);
     ret = 0;
  out:
     return ret;
@@ -3105,6 +3141,7 @@ virDomainObjRemoveTransientDef(virDomainObjPtr domain)
     domain->def = domain->newDef;
     domain->def->id = -1;
     domain->newDef = NULL;
+    virDomainObjBumpGeneration(domain);
 }
 
 
@@ -8101,6 +8138,15 @@ virDomainDiskDefDriverParseXML(virDomainDiskDefPtr def,
 #define VENDOR_LEN  8
 #define PRODUCT_LEN 16
 
+static int
+virDomainParseScaledValue(const char *xpath,
+                          const char *units_xpath,
+                          xmlXPathContextPtr ctxt,
+                          unsigned long long *val,
+                          unsigned long long scale,
+                          unsigned long long max,
+                          bool required);
+
 /* Parse the XML definition for a disk
  * @param node XML nodeset to parse for disk definition
  */
@@ -8257,6 +8303,17 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
         } else if (xmlStrEqual(cur->name, BAD_CAST "iotune")) {
             if (virDomainDiskDefIotuneParse(def, ctxt) < 0)
                 goto error;
+        } else if (xmlStrEqual(cur->name, BAD_CAST "watermark")) {
+            if (virDomainParseScaledValue("./watermark[1]", NULL, ctxt,
+                                          &def->watermark, 1, ULLONG_MAX,
+                                          true) < 0)
+                goto error;
+
+            if (!def->watermark) {
+                virReportError(VIR_ERR_XML_ERROR, "%s",
+                               _("disk watermark must be greater than zero"));
+                goto error;
+            }
         } else if (xmlStrEqual(cur->name, BAD_CAST "readonly")) {
             def->src->readonly = true;
         } else if (xmlStrEqual(cur->name, BAD_CAST "shareable")) {
@@ -10149,7 +10206,9 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             }
             def->driver.virtio.event_idx = val;
         }
-        if (queues) {
+        if (queues && STREQ(queues, "auto")) {
+            def->driver.virtio.queues_auto = true;
+        } else if (queues) {
             unsigned int q;
             if (virStrToLong_uip(queues, NULL, 10, &q) < 0) {
                 virReportError(VIR_ERR_XML_DETAIL,
@@ -14167,24 +14226,17 @@ virDomainIOMMUDefParseXML(xmlNodePtr node)
 }
 
 
-virDomainDeviceDefPtr
-virDomainDeviceDefParse(const char *xmlStr,
-                        const virDomainDef *def,
-                        virCapsPtr caps,
-                        virDomainXMLOptionPtr xmlopt,
-                        unsigned int flags)
+static virDomainDeviceDefPtr
+virDomainDeviceDefParseNode(xmlNodePtr node,
+                            xmlXPathContextPtr ctxt,
+                            const virDomainDef *def,
+                            virCapsPtr caps,
+                            virDomainXMLOptionPtr xmlopt,
+                            unsigned int flags)
 {
-    xmlDocPtr xml;
-    xmlNodePtr node;
-    xmlXPathContextPtr ctxt = NULL;
     virDomainDeviceDefPtr dev = NULL;
     char *netprefix;
 
-    if (!(xml = virXMLParseStringCtxt(xmlStr, _("(device_definition)"), &ctxt)))
-        goto error;
-
-    node = ctxt->node;
-
     if (VIR_ALLOC(dev) < 0)
         goto error;
 
@@ -14329,14 +14381,115 @@ virDomainDeviceDefParse(const char *xmlStr,
     if (virDomainDeviceDefValidate(dev, def, flags, xmlopt) < 0)
         goto error;
 
- cleanup:
-    xmlFreeDoc(xml);
-    xmlXPathFreeContext(ctxt);
     return dev;
 
  error:
     VIR_FREE(dev);
-    goto cleanup;
+    return NULL;
+}
+
+
+virDomainDeviceDefPtr
+virDomainDeviceDefParse(const char *xmlStr,
+                        const virDomainDef *def,
+                        virCapsPtr caps,
+                        virDomainXMLOptionPtr xmlopt,
+                        unsigned int flags)
+{
+    xmlDocPtr xml;
+    xmlXPathContextPtr ctxt = NULL;
+    virDomainDeviceDefPtr dev = NULL;
+
+    if (!(xml = virXMLParseStringCtxt(xmlStr, _("(device_definition)"), &ctxt)))
+        return NULL;
+
+    dev = virDomainDeviceDefParseNode(ctxt->node, ctxt, def, caps, xmlopt, flags);
+
+    xmlFreeDoc(xml);
+    xmlXPathFreeContext(ctxt);
+    return dev;
+}
+
+
+/**
+ * virDomainDeviceDefParseList:
+ * @xmlStr: XML of a single device, or of several devices wrapped in
+ *          a <devices> element
+ * @def: domain definition the devices are meant for
+ * @caps: driver capabilities
+ * @xmlopt: XML parser configuration
+ * @flags: VIR_DOMAIN_DEF_PARSE_* flags
+ * @devs: filled with the parsed devices
+ * @ndevs: filled with the number of entries in @devs
+ *
+ * Returns 0 on success and -1 on error, in which case nothing is
+ * returned in @devs.
+ */
+int
+virDomainDeviceDefParseList(const char *xmlStr,
+                            const virDomainDef *def,
+                            virCapsPtr caps,
+                            virDomainXMLOptionPtr xmlopt,
+                            unsigned int flags,
+                            virDomainDeviceDefPtr **devs,
+                            size_t *ndevs)
+{
+    xmlDocPtr xml;
+    xmlXPathContextPtr ctxt = NULL;
+    xmlNodePtr root;
+    xmlNodePtr cur;
+    virDomainDeviceDefPtr dev = NULL;
+    virDomainDeviceDefPtr *list = NULL;
+    size_t nlist = 0;
+    size_t i;
+    int ret = -1;
+
+    *devs = NULL;
+    *ndevs = 0;
+
+    if (!(xml = virXMLParseStringCtxt(xmlStr, _("(device_definition)"), &ctxt)))
+        return -1;
+
+    root = ctxt->node;
+
+    if (!xmlStrEqual(root->name, BAD_CAST "devices")) {
+        if (!(dev = virDomainDeviceDefParseNode(root, ctxt, def, caps,
+                                                xmlopt, flags)) ||
+            VIR_APPEND_ELEMENT(list, nlist, dev) < 0)
+            goto cleanup;
+    } else {
+        for (cur = root->children; cur; cur = cur->next) {
+            if (cur->type != XML_ELEMENT_NODE)
+                continue;
+
+            ctxt->node = cur;
+            if (!(dev = virDomainDeviceDefParseNode(cur, ctxt, def, caps,
+                                                    xmlopt, flags)) ||
+                VIR_APPEND_ELEMENT(list, nlist, dev) < 0)
+                goto cleanup;
+        }
+
+        if (nlist == 0) {
+            virReportError(VIR_ERR_XML_ERROR, "%s",
+                           _("no device found in <devices>"));
+            goto cleanup;
+        }
+    }
+
+    *devs = list;
+    *ndevs = nlist;
+    list = NULL;
+    nlist = 0;
+    ret = 0;
+
+ cleanup:
+    virDomainDeviceDefFree(dev);
+    for (i = 0; i < nlist; i++)
+        virDomainDeviceDefFree(list[i]);
+    VIR_FREE(list);
+    xmlFreeDoc(xml);
+    xmlXPathFreeContext(ctxt);
+    return ret;
 }
 
 
@@ -16564,120 +16717,387 @@ virDomainIOThreadSchedParse(xmlNodePtr node,
 }
 
 
-static int
-virDomainVcpuParse(virDomainDefPtr def,
-                   xmlXPathContextPtr ctxt,
-                   virDomainXMLOptionPtr xmlopt)
-{
-    int n;
-    xmlNodePtr *nodes = NULL;
+/*
+ * Find the allocation of the vcpus described by the 'vcpus' attribute of
+ * @node or create a new one. A cachetune and a memorytune element with the
+ * same vcpus share the allocation, any other overlap of vcpus is refused.
+ */
+static virResctrlAllocPtr
+virDomainResctrlVcpusParse(xmlNodePtr node,
+                           virDomainDefPtr def)
+{
+    virDomainResctrlDefPtr resctrl = NULL;
+    virBitmapPtr vcpus = NULL;
+    virResctrlAllocPtr ret = NULL;
+    char *vcpus_str = NULL;
+    char *id = NULL;
     size_t i;
-    char *tmp = NULL;
-    unsigned int maxvcpus;
-    unsigned int vcpus;
-    int ret = -1;
 
-    if ((n = virXPathUInt("string(./vcpu[1])", ctxt, &maxvcpus)) < 0) {
-        if (n == -2) {
-            virReportError(VIR_ERR_XML_ERROR, "%s",
-                           _("maximum vcpus count must be an integer"));
-            goto cleanup;
-        }
+    if (!(vcpus_str = virXMLPropString(node, "vcpus"))) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Missing attribute vcpus for %s"), node->name);
+        goto cleanup;
+    }
 
-        maxvcpus = 1;
+    if (virBitmapParse(vcpus_str, &vcpus, VIR_DOMAIN_CPUMASK_LEN) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Invalid %s attribute 'vcpus' value '%s'"),
+                       node->name, vcpus_str);
+        goto cleanup;
     }
 
-    if (virDomainDefSetVcpusMax(def, maxvcpus, xmlopt) < 0)
+    if (virBitmapIsAllClear(vcpus) ||
+        virBitmapLastSetBit(vcpus) >= (ssize_t) def->maxvcpus) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("%s attribute 'vcpus' value '%s' does not match "
+                         "the vCPUs of the domain"), node->name, vcpus_str);
         goto cleanup;
+    }
 
-    if ((n = virXPathUInt("string(./vcpu[1]/@current)", ctxt, &vcpus)) < 0) {
-        if (n == -2) {
-            virReportError(VIR_ERR_XML_ERROR, "%s",
-                           _("current vcpus count must be an integer"));
+    for (i = 0; i < def->nresctrls; i++) {
+        if (virBitmapEqual(def->resctrls[i]->vcpus, vcpus)) {
+            ret = def->resctrls[i]->alloc;
             goto cleanup;
         }
 
-        vcpus = maxvcpus;
-    }
-
-
-    tmp = virXPathString("string(./vcpu[1]/@placement)", ctxt);
-    if (tmp) {
-        if ((def->placement_mode =
-             virDomainCpuPlacementModeTypeFromString(tmp)) < 0) {
-             virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
-                            _("Unsupported CPU placement mode '%s'"),
-                            tmp);
-             goto cleanup;
+        if (virBitmapOverlaps(def->resctrls[i]->vcpus, vcpus)) {
+            virReportError(VIR_ERR_XML_ERROR, "%s",
+                           _("Overlapping vcpus in resource tunings"));
+            goto cleanup;
         }
-        VIR_FREE(tmp);
-    } else {
-        def->placement_mode = VIR_DOMAIN_CPU_PLACEMENT_MODE_STATIC;
     }
 
-    if (def->placement_mode != VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) {
-        tmp = virXPathString("string(./vcpu[1]/@cpuset)", ctxt);
-        if (tmp) {
-            if (virBitmapParse(tmp, &def->cpumask, VIR_DOMAIN_CPUMASK_LEN) < 0)
-                goto cleanup;
-
-            if (virBitmapIsAllClear(def->cpumask)) {
-                virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
-                               _("Invalid value of 'cpuset': %s"), tmp);
-                goto cleanup;
-            }
+    VIR_FREE(vcpus_str);
+    if (!(vcpus_str = virBitmapFormat(vcpus)) ||
+        virAsprintf(&id, "vcpus_%s", vcpus_str) < 0)
+        goto cleanup;
 
-            VIR_FREE(tmp);
-        }
-    }
+    if (VIR_ALLOC(resctrl) < 0 ||
+        !(resctrl->alloc = virResctrlAllocNew()) ||
+        virResctrlAllocSetID(resctrl->alloc, id) < 0)
+        goto cleanup;
 
-    if ((n = virXPathNodeSet("./vcpus/vcpu", ctxt, &nodes)) < 0)
+    VIR_STEAL_PTR(resctrl->vcpus, vcpus);
+    if (VIR_APPEND_ELEMENT(def->resctrls, def->nresctrls, resctrl) < 0)
         goto cleanup;
 
-    if (n) {
-        /* if individual vcpu states are provided take them as master */
-        def->individualvcpus = true;
+    ret = def->resctrls[def->nresctrls - 1]->alloc;
 
-        for (i = 0; i < n; i++) {
-            virDomainVcpuDefPtr vcpu;
-            int state;
-            unsigned int id;
-            unsigned int order;
+ cleanup:
+    virDomainResctrlDefFree(resctrl);
+    virBitmapFree(vcpus);
+    VIR_FREE(vcpus_str);
+    VIR_FREE(id);
+    return ret;
+}
 
-            if (!(tmp = virXMLPropString(nodes[i], "id")) ||
-                virStrToLong_uip(tmp, NULL, 10, &id) < 0) {
-                virReportError(VIR_ERR_XML_ERROR, "%s",
-                               _("missing or invalid vcpu id"));
-                goto cleanup;
-            }
 
-            VIR_FREE(tmp);
+static int
+virDomainCachetuneDefParseCache(xmlXPathContextPtr ctxt,
+                                xmlNodePtr node,
+                                virResctrlAllocPtr alloc)
+{
+    xmlNodePtr oldnode = ctxt->node;
+    unsigned int level;
+    unsigned int cache;
+    int type;
+    unsigned long long size;
+    char *tmp = NULL;
+    int ret = -1;
 
-            if (id >= def->maxvcpus) {
-                virReportError(VIR_ERR_XML_ERROR,
-                               _("vcpu id '%u' is out of range of maximum "
-                                 "vcpu count"), id);
-                goto cleanup;
-            }
+    ctxt->node = node;
 
-            vcpu = virDomainDefGetVcpu(def, id);
+    tmp = virXMLPropString(node, "id");
+    if (!tmp) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("Missing cachetune attribute 'id'"));
+        goto cleanup;
+    }
+    if (virStrToLong_uip(tmp, NULL, 10, &cache) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Invalid cachetune attribute 'id' value '%s'"),
+                       tmp);
+        goto cleanup;
+    }
+    VIR_FREE(tmp);
 
-            if (!(tmp = virXMLPropString(nodes[i], "enabled"))) {
-                virReportError(VIR_ERR_XML_ERROR, "%s",
-                               _("missing vcpu enabled state"));
-                goto cleanup;
-            }
+    tmp = virXMLPropString(node, "level");
+    if (!tmp) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("Missing cachetune attribute 'level'"));
+        goto cleanup;
+    }
+    if (virStrToLong_uip(tmp, NULL, 10, &level) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Invalid cachetune attribute 'level' value '%s'"),
+                       tmp);
+        goto cleanup;
+    }
+    VIR_FREE(tmp);
 
-            if ((state = virTristateBoolTypeFromString(tmp)) < 0) {
-                virReportError(VIR_ERR_XML_ERROR,
-                               _("invalid vcpu 'enabled' value '%s'"), tmp);
-                goto cleanup;
-            }
-            VIR_FREE(tmp);
+    tmp = virXMLPropString(node, "type");
+    if (!tmp) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("Missing cachetune attribute 'type'"));
+        goto cleanup;
+    }
+    type = virCacheTypeFromString(tmp);
+    if (type < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Invalid cachetune attribute 'type' value '%s'"),
+                       tmp);
+        goto cleanup;
+    }
+    VIR_FREE(tmp);
 
-            vcpu->online = state == VIR_TRISTATE_BOOL_YES;
+    if (virDomainParseScaledValue("./@size", "./@unit",
+                                  ctxt, &size, 1024,
+                                  ULLONG_MAX, true) < 0)
+        goto cleanup;
 
-            if ((tmp = virXMLPropString(nodes[i], "hotpluggable"))) {
+    if (virResctrlAllocSetCacheSize(alloc, level, type, cache, size) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    ctxt->node = oldnode;
+    VIR_FREE(tmp);
+    return ret;
+}
+
+
+static int
+virDomainCachetuneDefParse(virDomainDefPtr def,
+                           xmlXPathContextPtr ctxt,
+                           xmlNodePtr node)
+{
+    xmlNodePtr oldnode = ctxt->node;
+    xmlNodePtr *nodes = NULL;
+    virResctrlAllocPtr alloc;
+    ssize_t i;
+    int n;
+    int ret = -1;
+
+    ctxt->node = node;
+
+    if (!(alloc = virDomainResctrlVcpusParse(node, def)))
+        goto cleanup;
+
+    if ((n = virXPathNodeSet("./cache", ctxt, &nodes)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Cannot extract cache nodes under cachetune"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (virDomainCachetuneDefParseCache(ctxt, nodes[i], alloc) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    ctxt->node = oldnode;
+    VIR_FREE(nodes);
+    return ret;
+}
+
+
+static int
+virDomainMemorytuneDefParseNode(xmlNodePtr node,
+                                virResctrlAllocPtr alloc)
+{
+    unsigned int id;
+    unsigned int bandwidth;
+    char *tmp = NULL;
+    int ret = -1;
+
+    tmp = virXMLPropString(node, "id");
+    if (!tmp) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("Missing memorytune attribute 'id'"));
+        goto cleanup;
+    }
+    if (virStrToLong_uip(tmp, NULL, 10, &id) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Invalid memorytune attribute 'id' value '%s'"),
+                       tmp);
+        goto cleanup;
+    }
+    VIR_FREE(tmp);
+
+    tmp = virXMLPropString(node, "bandwidth");
+    if (!tmp) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("Missing memorytune attribute 'bandwidth'"));
+        goto cleanup;
+    }
+    if (virStrToLong_uip(tmp, NULL, 10, &bandwidth) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Invalid memorytune attribute 'bandwidth' value '%s'"),
+                       tmp);
+        goto cleanup;
+    }
+
+    if (virResctrlAllocSetMemoryBandwidth(alloc, id, bandwidth) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(tmp);
+    return ret;
+}
+
+
+static int
+virDomainMemorytuneDefParse(virDomainDefPtr def,
+                            xmlXPathContextPtr ctxt,
+                            xmlNodePtr node)
+{
+    xmlNodePtr oldnode = ctxt->node;
+    xmlNodePtr *nodes = NULL;
+    virResctrlAllocPtr alloc;
+    ssize_t i;
+    int n;
+    int ret = -1;
+
+    ctxt->node = node;
+
+    if (!(alloc = virDomainResctrlVcpusParse(node, def)))
+        goto cleanup;
+
+    if ((n = virXPathNodeSet("./node", ctxt, &nodes)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Cannot extract node nodes under memorytune"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (virDomainMemorytuneDefParseNode(nodes[i], alloc) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    ctxt->node = oldnode;
+    VIR_FREE(nodes);
+    return ret;
+}
+
+
+static int
+virDomainVcpuParse(virDomainDefPtr def,
+                   xmlXPathContextPtr ctxt,
+                   virDomainXMLOptionPtr xmlopt)
+{
+    int n;
+    xmlNodePtr *nodes = NULL;
+    size_t i;
+    char *tmp = NULL;
+    unsigned int maxvcpus;
+    unsigned int vcpus;
+    int ret = -1;
+
+    if ((n = virXPathUInt("string(./vcpu[1])", ctxt, &maxvcpus)) < 0) {
+        if (n == -2) {
+            virReportError(VIR_ERR_XML_ERROR, "%s",
+                           _("maximum vcpus count must be an integer"));
+            goto cleanup;
+        }
+
+        maxvcpus = 1;
+    }
+
+    if (virDomainDefSetVcpusMax(def, maxvcpus, xmlopt) < 0)
+        goto cleanup;
+
+    if ((n = virXPathUInt("string(./vcpu[1]/@current)", ctxt, &vcpus)) < 0) {
+        if (n == -2) {
+            virReportError(VIR_ERR_XML_ERROR, "%s",
+                           _("current vcpus count must be an integer"));
+            goto cleanup;
+        }
+
+        vcpus = maxvcpus;
+    }
+
+
+    tmp = virXPathString("string(./vcpu[1]/@placement)", ctxt);
+    if (tmp) {
+        if ((def->placement_mode =
+             virDomainCpuPlacementModeTypeFromString(tmp)) < 0) {
+             virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                            _("Unsupported CPU placement mode '%s'"),
+                            tmp);
+             goto cleanup;
+        }
+        VIR_FREE(tmp);
+    } else {
+        def->placement_mode = VIR_DOMAIN_CPU_PLACEMENT_MODE_STATIC;
+    }
+
+    if (def->placement_mode != VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) {
+        tmp = virXPathString("string(./vcpu[1]/@cpuset)", ctxt);
+        if (tmp) {
+            if (virBitmapParse(tmp, &def->cpumask, VIR_DOMAIN_CPUMASK_LEN) < 0)
+                goto cleanup;
+
+            if (virBitmapIsAllClear(def->cpumask)) {
+                virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                               _("Invalid value of 'cpuset': %s"), tmp);
+                goto cleanup;
+            }
+
+            VIR_FREE(tmp);
+        }
+    }
+
+    if ((n = virXPathNodeSet("./vcpus/vcpu", ctxt, &nodes)) < 0)
+        goto cleanup;
+
+    if (n) {
+        /* if individual vcpu states are provided take them as master */
+        def->individualvcpus = true;
+
+        for (i = 0; i < n; i++) {
+            virDomainVcpuDefPtr vcpu;
+            int state;
+            unsigned int id;
+            unsigned int order;
+
+            if (!(tmp = virXMLPropString(nodes[i], "id")) ||
+                virStrToLong_uip(tmp, NULL, 10, &id) < 0) {
+                virReportError(VIR_ERR_XML_ERROR, "%s",
+                               _("missing or invalid vcpu id"));
+                goto cleanup;
+            }
+
+            VIR_FREE(tmp);
+
+            if (id >= def->maxvcpus) {
+                virReportError(VIR_ERR_XML_ERROR,
+                               _("vcpu id '%u' is out of range of maximum "
+                                 "vcpu count"), id);
+                goto cleanup;
+            }
+
+            vcpu = virDomainDefGetVcpu(def, id);
+
+            if (!(tmp = virXMLPropString(nodes[i], "enabled"))) {
+                virReportError(VIR_ERR_XML_ERROR, "%s",
+                               _("missing vcpu enabled state"));
+                goto cleanup;
+            }
+
+            if ((state = virTristateBoolTypeFromString(tmp)) < 0) {
+                virReportError(VIR_ERR_XML_ERROR,
+                               _("invalid vcpu 'enabled' value '%s'"), tmp);
+                goto cleanup;
+            }
+            VIR_FREE(tmp);
+
+            vcpu->online = state == VIR_TRISTATE_BOOL_YES;
+
+            if ((tmp = virXMLPropString(nodes[i], "hotpluggable"))) {
                 int hotpluggable;
                 if ((hotpluggable = virTristateBoolTypeFromString(tmp)) < 0) {
                     virReportError(VIR_ERR_XML_ERROR,
@@ -16830,47 +17250,140 @@ virDomainDefParseBootOptions(virDomainDefPtr def,
 }
 
 
-static virDomainDefPtr
-virDomainDefParseXML(xmlDocPtr xml,
-                     xmlNodePtr root,
-                     xmlXPathContextPtr ctxt,
-                     virCapsPtr caps,
-                     virDomainXMLOptionPtr xmlopt,
-                     void *parseOpaque,
-                     unsigned int flags)
+typedef struct _virDomainDefParseDeviceNodes virDomainDefParseDeviceNodes;
+typedef virDomainDefParseDeviceNodes *virDomainDefParseDeviceNodesPtr;
+struct _virDomainDefParseDeviceNodes {
+    xmlNodePtr *nodes;
+    size_t nnodes;
+};
+
+
+static void
+virDomainDefParseDeviceNodesFree(void *payload,
+                                 const void *name ATTRIBUTE_UNUSED)
 {
-    xmlNodePtr *nodes = NULL, node = NULL;
-    char *tmp = NULL;
-    size_t i, j;
-    int n, virtType, gic_version;
-    long id = -1;
-    virDomainDefPtr def;
-    bool uuid_generated = false;
-    virHashTablePtr bootHash = NULL;
-    bool usb_none = false;
-    bool usb_other = false;
-    bool usb_master = false;
-    char *netprefix = NULL;
+    virDomainDefParseDeviceNodesPtr devnodes = payload;
 
-    if (flags & VIR_DOMAIN_DEF_PARSE_VALIDATE_SCHEMA) {
-        char *schema = virFileFindResource("domain.rng",
-                                           abs_topsrcdir "/docs/schemas",
-                                           PKGDATADIR "/schemas");
-        if (!schema)
-            return NULL;
-        if (virXMLValidateAgainstSchema(schema, xml) < 0) {
-            VIR_FREE(schema);
-            return NULL;
-        }
-        VIR_FREE(schema);
-    }
+    VIR_FREE(devnodes->nodes);
+    VIR_FREE(devnodes);
+}
 
-    if (!(def = virDomainDefNew()))
-        return NULL;
 
-    if (!(flags & VIR_DOMAIN_DEF_PARSE_INACTIVE))
-        if (virXPathLong("string(./@id)", ctxt, &id) < 0)
-            id = -1;
+/* Sort the elements of <devices> by their names in a single pass over
+ * the document, rather than evaluating an XPath expression over all of
+ * them for every device type. The nodes of each name are kept in
+ * document order, as virXPathNodeSet would return them. */
+static virHashTablePtr
+virDomainDefParseCollectDevices(xmlNodePtr root)
+{
+    virHashTablePtr devices;
+    virDomainDefParseDeviceNodesPtr devnodes;
+    xmlNodePtr cur;
+    xmlNodePtr child;
+
+    if (!(devices = virHashCreate(32, virDomainDefParseDeviceNodesFree)))
+        return NULL;
+
+    for (cur = root->children; cur; cur = cur->next) {
+        if (cur->type != XML_ELEMENT_NODE || cur->ns ||
+            !xmlStrEqual(cur->name, BAD_CAST "devices"))
+            continue;
+
+        for (child = cur->children; child; child = child->next) {
+            const char *name = (const char *) child->name;
+
+            if (child->type != XML_ELEMENT_NODE || child->ns)
+                continue;
+
+            if (!(devnodes = virHashLookup(devices, name))) {
+                if (VIR_ALLOC(devnodes) < 0)
+                    goto error;
+                if (virHashAddEntry(devices, name, devnodes) < 0) {
+                    VIR_FREE(devnodes);
+                    goto error;
+                }
+            }
+
+            if (VIR_APPEND_ELEMENT_COPY(devnodes->nodes, devnodes->nnodes,
+                                        child) < 0)
+                goto error;
+        }
+    }
+
+    return devices;
+
+ error:
+    virHashFree(devices);
+    return NULL;
+}
+
+
+/* Hand the nodes of all <devices> sub-elements called @name over to
+ * the caller, returns their count. */
+static int
+virDomainDefParseTakeDevices(virHashTablePtr devices,
+                             const char *name,
+                             xmlNodePtr **nodes)
+{
+    virDomainDefParseDeviceNodesPtr devnodes;
+    int ret;
+
+    *nodes = NULL;
+
+    if (!(devnodes = virHashLookup(devices, name)))
+        return 0;
+
+    ret = devnodes->nnodes;
+    *nodes = devnodes->nodes;
+    devnodes->nodes = NULL;
+    devnodes->nnodes = 0;
+
+    return ret;
+}
+
+
+static virDomainDefPtr
+virDomainDefParseXML(xmlDocPtr xml,
+                     xmlNodePtr root,
+                     xmlXPathContextPtr ctxt,
+                     virCapsPtr caps,
+                     virDomainXMLOptionPtr xmlopt,
+                     void *parseOpaque,
+                     unsigned int flags)
+{
+    xmlNodePtr *nodes = NULL, node = NULL;
+    char *tmp = NULL;
+    size_t i, j;
+    int n, virtType, gic_version;
+    long id = -1;
+    virDomainDefPtr def;
+    bool uuid_generated = false;
+    virHashTablePtr bootHash = NULL;
+    virHashTablePtr devices = NULL;
+    bool usb_none = false;
+    bool usb_other = false;
+    bool usb_master = false;
+    char *netprefix = NULL;
+
+    if (flags & VIR_DOMAIN_DEF_PARSE_VALIDATE_SCHEMA) {
+        char *schema = virFileFindResource("domain.rng",
+                                           abs_topsrcdir "/docs/schemas",
+                                           PKGDATADIR "/schemas");
+        if (!schema)
+            return NULL;
+        if (virXMLValidateAgainstSchema(schema, xml) < 0) {
+            VIR_FREE(schema);
+            return NULL;
+        }
+        VIR_FREE(schema);
+    }
+
+    if (!(def = virDomainDefNew()))
+        return NULL;
+
+    if (!(flags & VIR_DOMAIN_DEF_PARSE_INACTIVE))
+        if (virXPathLong("string(./@id)", ctxt, &id) < 0)
+            id = -1;
     def->id = (int)id;
 
     /* Find out what type of virtualization to use */
@@ -17058,6 +17571,18 @@ virDomainDefParseXML(xmlDocPtr xml,
         VIR_FREE(tmp);
     }
 
+    tmp = virXPathString("string(./memoryBacking/allocation/@threads)", ctxt);
+    if (tmp) {
+        if (virStrToLong_uip(tmp, NULL, 10, &def->mem.allocation_threads) < 0 ||
+            def->mem.allocation_threads == 0) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("invalid memoryBacking/allocation/threads '%s'"),
+                           tmp);
+            goto error;
+        }
+        VIR_FREE(tmp);
+    }
+
     if (virXPathNode("./memoryBacking/hugepages", ctxt)) {
         /* hugepages will be used */
 
@@ -17382,6 +17907,30 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
+    if ((n = virXPathNodeSet("./cputune/cachetune", ctxt, &nodes)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot extract cachetune nodes"));
+        goto error;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (virDomainCachetuneDefParse(def, ctxt, nodes[i]) < 0)
+            goto error;
+    }
+    VIR_FREE(nodes);
+
+    if ((n = virXPathNodeSet("./cputune/memorytune", ctxt, &nodes)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot extract memorytune nodes"));
+        goto error;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (virDomainMemorytuneDefParse(def, ctxt, nodes[i]) < 0)
+            goto error;
+    }
+    VIR_FREE(nodes);
+
     /* analysis of cpu handling */
     if ((node = virXPathNode("./cpu[1]", ctxt)) != NULL) {
         xmlNodePtr oldnode = ctxt->node;
@@ -17845,8 +18394,11 @@ virDomainDefParseXML(xmlDocPtr xml,
     if (virDomainDefParseBootOptions(def, ctxt, &bootHash) < 0)
         goto error;
 
+    if (!(devices = virDomainDefParseCollectDevices(ctxt->node)))
+        goto error;
+
     /* analysis of the disk devices */
-    if ((n = virXPathNodeSet("./devices/disk", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "disk", &nodes)) < 0)
         goto error;
 
     if (n && VIR_ALLOC_N(def->disks, n) < 0)
@@ -17868,7 +18420,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the controller devices */
-    if ((n = virXPathNodeSet("./devices/controller", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "controller", &nodes)) < 0)
         goto error;
 
     if (n && VIR_ALLOC_N(def->controllers, n) < 0)
@@ -17919,7 +18471,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
 
     /* analysis of the resource leases */
-    if ((n = virXPathNodeSet("./devices/lease", ctxt, &nodes)) < 0) {
+    if ((n = virDomainDefParseTakeDevices(devices, "lease", &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("cannot extract device leases"));
         goto error;
@@ -17936,7 +18488,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the filesystems */
-    if ((n = virXPathNodeSet("./devices/filesystem", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "filesystem", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->fss, n) < 0)
         goto error;
@@ -17951,7 +18503,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the network devices */
-    if ((n = virXPathNodeSet("./devices/interface", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "interface", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->nets, n) < 0)
         goto error;
@@ -17981,7 +18533,7 @@ virDomainDefParseXML(xmlDocPtr xml,
 
 
     /* analysis of the smartcard devices */
-    if ((n = virXPathNodeSet("./devices/smartcard", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "smartcard", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->smartcards, n) < 0)
         goto error;
@@ -17999,7 +18551,7 @@ virDomainDefParseXML(xmlDocPtr xml,
 
 
     /* analysis of the character devices */
-    if ((n = virXPathNodeSet("./devices/parallel", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "parallel", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->parallels, n) < 0)
         goto error;
@@ -18026,7 +18578,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/serial", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "serial", &nodes)) < 0)
         goto error;
 
     if (n && VIR_ALLOC_N(def->serials, n) < 0)
@@ -18054,7 +18606,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/console", ctxt, &nodes)) < 0) {
+    if ((n = virDomainDefParseTakeDevices(devices, "console", &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("cannot extract console devices"));
         goto error;
@@ -18077,7 +18629,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/channel", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "channel", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->channels, n) < 0)
         goto error;
@@ -18098,7 +18650,7 @@ virDomainDefParseXML(xmlDocPtr xml,
 
 
     /* analysis of the input devices */
-    if ((n = virXPathNodeSet("./devices/input", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "input", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->inputs, n) < 0)
         goto error;
@@ -18125,7 +18677,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the graphics devices */
-    if ((n = virXPathNodeSet("./devices/graphics", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "graphics", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->graphics, n) < 0)
         goto error;
@@ -18141,7 +18693,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the sound devices */
-    if ((n = virXPathNodeSet("./devices/sound", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "sound", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->sounds, n) < 0)
         goto error;
@@ -18157,7 +18709,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the video devices */
-    if ((n = virXPathNodeSet("./devices/video", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "video", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->videos, n) < 0)
         goto error;
@@ -18190,7 +18742,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the host devices */
-    if ((n = virXPathNodeSet("./devices/hostdev", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "hostdev", &nodes)) < 0)
         goto error;
     if (n && VIR_REALLOC_N(def->hostdevs, def->nhostdevs + n) < 0)
         goto error;
@@ -18226,7 +18778,7 @@ virDomainDefParseXML(xmlDocPtr xml,
 
     /* analysis of the watchdog devices */
     def->watchdog = NULL;
-    if ((n = virXPathNodeSet("./devices/watchdog", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "watchdog", &nodes)) < 0)
         goto error;
     if (n > 1) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -18245,7 +18797,7 @@ virDomainDefParseXML(xmlDocPtr xml,
 
     /* analysis of the memballoon devices */
     def->memballoon = NULL;
-    if ((n = virXPathNodeSet("./devices/memballoon", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "memballoon", &nodes)) < 0)
         goto error;
     if (n > 1) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -18263,7 +18815,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
 
     /* Parse the RNG devices */
-    if ((n = virXPathNodeSet("./devices/rng", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "rng", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->rngs, n) < 0)
         goto error;
@@ -18278,7 +18830,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* Parse the TPM devices */
-    if ((n = virXPathNodeSet("./devices/tpm", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "tpm", &nodes)) < 0)
         goto error;
 
     if (n > 1) {
@@ -18293,7 +18845,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/nvram", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "nvram", &nodes)) < 0)
         goto error;
 
     if (n > 1) {
@@ -18310,7 +18862,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
 
     /* analysis of the hub devices */
-    if ((n = virXPathNodeSet("./devices/hub", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "hub", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->hubs, n) < 0)
         goto error;
@@ -18332,7 +18884,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the redirected devices */
-    if ((n = virXPathNodeSet("./devices/redirdev", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "redirdev", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->redirdevs, n) < 0)
         goto error;
@@ -18347,7 +18899,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the redirection filter rules */
-    if ((n = virXPathNodeSet("./devices/redirfilter", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "redirfilter", &nodes)) < 0)
         goto error;
     if (n > 1) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -18366,7 +18918,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the panic devices */
-    if ((n = virXPathNodeSet("./devices/panic", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "panic", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->panics, n) < 0)
         goto error;
@@ -18380,7 +18932,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the shmem devices */
-    if ((n = virXPathNodeSet("./devices/shmem", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "shmem", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->shmems, n) < 0)
         goto error;
@@ -18399,7 +18951,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of memory devices */
-    if ((n = virXPathNodeSet("./devices/memory", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "memory", &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->mems, n) < 0)
         goto error;
@@ -18415,7 +18967,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/iommu", ctxt, &nodes)) < 0)
+    if ((n = virDomainDefParseTakeDevices(devices, "iommu", &nodes)) < 0)
         goto error;
 
     if (n > 1) {
@@ -18510,6 +19062,7 @@ virDomainDefParseXML(xmlDocPtr xml,
         goto error;
 
     virHashFree(bootHash);
+    virHashFree(devices);
 
     return def;
 
@@ -18517,6 +19070,7 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(tmp);
     VIR_FREE(nodes);
     virHashFree(bootHash);
+    virHashFree(devices);
     virDomainDefFree(def);
     return NULL;
 }
@@ -21194,6 +21748,10 @@ virDomainDiskDefFormat(virBufferPtr buf,
         virBufferAddLit(buf, "</iotune>\n");
     }
 
+    if (def->watermark)
+        virBufferAsprintf(buf, "<watermark unit='bytes'>%llu</watermark>\n",
+                          def->watermark);
+
     if (def->src->readonly)
         virBufferAddLit(buf, "<readonly/>\n");
     if (def->src->shared)
@@ -21938,7 +22496,9 @@ virDomainVirtioNetDriverFormat(char **outstr,
         virBufferAsprintf(&buf, "event_idx='%s' ",
                           virTristateSwitchTypeToString(def->driver.virtio.event_idx));
     }
-    if (def->driver.virtio.queues)
+    if (def->driver.virtio.queues_auto)
+        virBufferAddLit(&buf, "queues='auto' ");
+    else if (def->driver.virtio.queues)
         virBufferAsprintf(&buf, "queues='%u' ", def->driver.virtio.queues);
     if (def->driver.virtio.rx_queue_size)
         virBufferAsprintf(&buf, "rx_queue_size='%u' ",
@@ -23916,6 +24476,100 @@ virDomainSchedulerFormat(virBufferPtr buf,
 }
 
 
+static int
+virDomainCachetuneDefFormatHelper(unsigned int level,
+                                  virCacheType type,
+                                  unsigned int cache,
+                                  unsigned long long size,
+                                  void *opaque)
+{
+    static const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    virBufferPtr buf = opaque;
+    unsigned long long short_size = size;
+    size_t unit = 0;
+
+    /* Use the largest unit the size can be expressed in exactly */
+    while (unit < ARRAY_CARDINALITY(units) - 1 && short_size &&
+           short_size % 1024 == 0) {
+        short_size /= 1024;
+        unit++;
+    }
+
+    virBufferAsprintf(buf,
+                      "<cache id='%u' level='%u' type='%s' "
+                      "size='%llu' unit='%s'/>\n",
+                      cache, level, virCacheTypeToString(type),
+                      short_size, units[unit]);
+
+    return 0;
+}
+
+
+static int
+virDomainMemorytuneDefFormatHelper(unsigned int id,
+                                   unsigned int bandwidth,
+                                   void *opaque)
+{
+    virBufferPtr buf = opaque;
+
+    virBufferAsprintf(buf, "<node id='%u' bandwidth='%u'/>\n", id, bandwidth);
+
+    return 0;
+}
+
+
+static int
+virDomainResctrlDefFormat(virBufferPtr buf,
+                          virDomainResctrlDefPtr resctrl)
+{
+    virBuffer childrenBuf = VIR_BUFFER_INITIALIZER;
+    char *vcpus = NULL;
+    int ret = -1;
+
+    if (!(vcpus = virBitmapFormat(resctrl->vcpus)))
+        goto cleanup;
+
+    virBufferAdjustIndent(&childrenBuf, virBufferGetIndent(buf, false) + 2);
+
+    if (virResctrlAllocForeachCache(resctrl->alloc,
+                                    virDomainCachetuneDefFormatHelper,
+                                    &childrenBuf) < 0)
+        goto cleanup;
+
+    if (virBufferCheckError(&childrenBuf) < 0)
+        goto cleanup;
+
+    if (virBufferUse(&childrenBuf)) {
+        virBufferAsprintf(buf, "<cachetune vcpus='%s'>\n", vcpus);
+        virBufferAddBuffer(buf, &childrenBuf);
+        virBufferAddLit(buf, "</cachetune>\n");
+    }
+
+    virBufferFreeAndReset(&childrenBuf);
+    virBufferAdjustIndent(&childrenBuf, virBufferGetIndent(buf, false) + 2);
+
+    if (virResctrlAllocForeachMemory(resctrl->alloc,
+                                     virDomainMemorytuneDefFormatHelper,
+                                     &childrenBuf) < 0)
+        goto cleanup;
+
+    if (virBufferCheckError(&childrenBuf) < 0)
+        goto cleanup;
+
+    if (virBufferUse(&childrenBuf)) {
+        virBufferAsprintf(buf, "<memorytune vcpus='%s'>\n", vcpus);
+        virBufferAddBuffer(buf, &childrenBuf);
+        virBufferAddLit(buf, "</memorytune>\n");
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&childrenBuf);
+    VIR_FREE(vcpus);
+    return ret;
+}
+
+
 static int
 virDomainCputuneDefFormat(virBufferPtr buf,
                           virDomainDefPtr def)
@@ -24017,6 +24671,11 @@ virDomainCputuneDefFormat(virBufferPtr buf,
                                  def->iothreadids[i]->iothread_id);
     }
 
+    for (i = 0; i < def->nresctrls; i++) {
+        if (virDomainResctrlDefFormat(&childrenBuf, def->resctrls[i]) < 0)
+            goto cleanup;
+    }
+
     if (virBufferUse(&childrenBuf)) {
         virBufferAddLit(buf, "<cputune>\n");
         virBufferAddBuffer(buf, &childrenBuf);
@@ -24269,7 +24928,8 @@ virDomainDefFormatInternal(virDomainDefPtr def,
     }
 
     if (def->mem.nhugepages || def->mem.nosharepages || def->mem.locked
-        || def->mem.source || def->mem.access || def->mem.allocation)
+        || def->mem.source || def->mem.access || def->mem.allocation
+        || def->mem.allocation_threads)
     {
         virBufferAddLit(buf, "<memoryBacking>\n");
         virBufferAdjustIndent(buf, 2);
@@ -24285,9 +24945,16 @@ virDomainDefFormatInternal(virDomainDefPtr def,
         if (def->mem.access)
             virBufferAsprintf(buf, "<access mode='%s'/>\n",
                 virDomainMemoryAccessTypeToString(def->mem.access));
-        if (def->mem.allocation)
-            virBufferAsprintf(buf, "<allocation mode='%s'/>\n",
-                virDomainMemoryAllocationTypeToString(def->mem.allocation));
+        if (def->mem.allocation || def->mem.allocation_threads) {
+            virBufferAddLit(buf, "<allocation");
+            if (def->mem.allocation)
+                virBufferAsprintf(buf, " mode='%s'",
+                    virDomainMemoryAllocationTypeToString(def->mem.allocation));
+            if (def->mem.allocation_threads)
+                virBufferAsprintf(buf, " threads='%u'",
+                                  def->mem.allocation_threads);
+            virBufferAddLit(buf, "/>\n");
+        }
 
         virBufferAdjustIndent(buf, -2);
         virBufferAddLit(buf, "</memoryBacking>\n");
@@ -25145,6 +25812,9 @@ virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
     int ret = -1;
     char *xml;
 
+    /* Saving the status is how drivers record runtime changes */
+    virDomainObjBumpGeneration(obj);
+
     if (!(xml = virDomainObjFormat(xmlopt, obj, caps, flags)))
         goto cleanup;
 
@@ -25487,27 +26157,1299 @@ virDomainDiskDefForeachPath(virDomainDiskDefPtr disk,
 }
 
 
-/* Copy src into a new definition; with the quality of the copy
- * depending on the migratable flag (false for transitions between
- * persistent and active, true for transitions across save files or
- * snapshots).  */
-virDomainDefPtr
-virDomainDefCopy(virDomainDefPtr src,
-                 virCapsPtr caps,
-                 virDomainXMLOptionPtr xmlopt,
-                 void *parseOpaque,
-                 bool migratable)
+/* The helpers below produce the same definition a round-trip of a
+ * definition through VIR_DOMAIN_DEF_FORMAT_SECURE and
+ * VIR_DOMAIN_DEF_PARSE_INACTIVE would give, without paying for the
+ * XML.  Runtime-only state which the inactive parser ignores (aliases,
+ * block job mirrors, generated interface names, ...) is dropped.  */
+static int
+virDomainDefCopyDeviceInfo(virDomainDeviceInfoPtr dst,
+                           virDomainDeviceInfoPtr src)
 {
-    char *xml;
-    virDomainDefPtr ret;
-    unsigned int format_flags = VIR_DOMAIN_DEF_FORMAT_SECURE;
-    unsigned int parse_flags = VIR_DOMAIN_DEF_PARSE_INACTIVE |
-                               VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE;
+    /* first a shallow copy of *everything* */
+    *dst = *src;
+
+    /* then redo the two fields that are pointers, aliases are not
+     * parsed from inactive XML */
+    dst->alias = NULL;
+    dst->romfile = NULL;
+
+    if (VIR_STRDUP(dst->romfile, src->romfile) < 0)
+        return -1;
+    return 0;
+}
+
+
+static int
+virDomainDefCopyDeviceSeclabels(virSecurityDeviceLabelDefPtr **dst,
+                                size_t *ndst,
+                                virSecurityDeviceLabelDefPtr *src,
+                                size_t nsrc,
+                                bool inactive)
+{
+    virSecurityDeviceLabelDefPtr seclabel;
+    size_t i;
+
+    if (nsrc == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(*dst, nsrc) < 0)
+        return -1;
+
+    for (i = 0; i < nsrc; i++) {
+        /* Overrides without a label are not formatted for inactive XML */
+        if (inactive && !src[i]->label && src[i]->relabel)
+            continue;
+
+        if (!(seclabel = virSecurityDeviceLabelDefCopy(src[i])))
+            return -1;
+
+        /* labelskip is only parsed from live XML; relabel is implied */
+        if (seclabel->labelskip) {
+            seclabel->labelskip = false;
+            seclabel->relabel = true;
+        }
+
+        (*dst)[(*ndst)++] = seclabel;
+    }
+
+    if (*ndst == 0)
+        VIR_FREE(*dst);
+
+    return 0;
+}
+
+
+static virStorageSourcePtr
+virDomainDefCopyStorageSource(virStorageSourcePtr src,
+                              bool inactive)
+{
+    virStorageSourcePtr ret;
+    virStorageSourcePtr tmp;
+    virSecurityDeviceLabelDefPtr *seclabels = NULL;
+    size_t nseclabels = 0;
+    size_t i;
+
+    /* The backing chain is only formatted into live XML */
+    if (!(ret = virStorageSourceCopy(src, !inactive)))
+        return NULL;
+
+    for (i = 0; i < ret->nseclabels; i++)
+        virSecurityDeviceLabelDefFree(ret->seclabels[i]);
+    VIR_FREE(ret->seclabels);
+    ret->nseclabels = 0;
+
+    if (virDomainDefCopyDeviceSeclabels(&seclabels, &nseclabels,
+                                        src->seclabels, src->nseclabels,
+                                        inactive) < 0)
+        goto error;
+    ret->seclabels = seclabels;
+    ret->nseclabels = nseclabels;
+
+    /* Labels of backing chain elements are not formatted at all */
+    for (tmp = ret->backingStore; tmp; tmp = tmp->backingStore) {
+        for (i = 0; i < tmp->nseclabels; i++)
+            virSecurityDeviceLabelDefFree(tmp->seclabels[i]);
+        VIR_FREE(tmp->seclabels);
+        tmp->nseclabels = 0;
+    }
+
+    return ret;
+
+ error:
+    virStorageSourceFree(ret);
+    return NULL;
+}
+
+
+static virDomainDiskDefPtr
+virDomainDefCopyDisk(virDomainDiskDefPtr src,
+                     virDomainXMLOptionPtr xmlopt,
+                     bool inactive)
+{
+    virDomainDiskDefPtr ret;
+    virObjectPtr privateData;
+
+    if (!(ret = virDomainDiskDefNew(xmlopt)))
+        return NULL;
+
+    virStorageSourceFree(ret->src);
+    privateData = ret->privateData;
+
+    /* first a shallow copy of *everything* */
+    *ret = *src;
+
+    /* then redo all the fields that are pointers; the block job
+     * mirror is never parsed from inactive XML */
+    ret->privateData = privateData;
+    ret->src = NULL;
+    ret->mirror = NULL;
+    ret->mirrorState = 0;
+    ret->mirrorJob = 0;
+    ret->dst = NULL;
+    ret->serial = NULL;
+    ret->wwn = NULL;
+    ret->vendor = NULL;
+    ret->product = NULL;
+    ret->domain_name = NULL;
+    ret->blkdeviotune.group_name = NULL;
+    ret->info.alias = NULL;
+    ret->info.romfile = NULL;
+
+    if (!(ret->src = virDomainDefCopyStorageSource(src->src, inactive)) ||
+        VIR_STRDUP(ret->dst, src->dst) < 0 ||
+        VIR_STRDUP(ret->serial, src->serial) < 0 ||
+        VIR_STRDUP(ret->wwn, src->wwn) < 0 ||
+        VIR_STRDUP(ret->vendor, src->vendor) < 0 ||
+        VIR_STRDUP(ret->product, src->product) < 0 ||
+        VIR_STRDUP(ret->domain_name, src->domain_name) < 0 ||
+        VIR_STRDUP(ret->blkdeviotune.group_name,
+                   src->blkdeviotune.group_name) < 0 ||
+        virDomainDefCopyDeviceInfo(&ret->info, &src->info) < 0)
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainDiskDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainControllerDefPtr
+virDomainDefCopyController(virDomainControllerDefPtr src)
+{
+    virDomainControllerDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    *ret = *src;
+    memset(&ret->info, 0, sizeof(ret->info));
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info) < 0) {
+        virDomainControllerDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+static virDomainLeaseDefPtr
+virDomainDefCopyLease(virDomainLeaseDefPtr src)
+{
+    virDomainLeaseDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->offset = src->offset;
+
+    if (VIR_STRDUP(ret->lockspace, src->lockspace) < 0 ||
+        VIR_STRDUP(ret->key, src->key) < 0 ||
+        VIR_STRDUP(ret->path, src->path) < 0) {
+        virDomainLeaseDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+static virDomainFSDefPtr
+virDomainDefCopyFS(virDomainFSDefPtr src)
+{
+    virDomainFSDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    *ret = *src;
+    ret->src = NULL;
+    ret->dst = NULL;
+    memset(&ret->info, 0, sizeof(ret->info));
+
+    if (!(ret->src = virStorageSourceCopy(src->src, false)) ||
+        VIR_STRDUP(ret->dst, src->dst) < 0 ||
+        virDomainDefCopyDeviceInfo(&ret->info, &src->info) < 0) {
+        virDomainFSDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+static int
+virDomainDefCopyChrSource(virDomainChrSourceDefPtr dst,
+                          virDomainChrSourceDefPtr src)
+{
+    /* @dst is empty apart from its private data */
+    dst->type = src->type;
+    dst->data = src->data;
+    dst->logappend = src->logappend;
+
+    /* then redo the fields that are pointers */
+    switch ((virDomainChrType) src->type) {
+    case VIR_DOMAIN_CHR_TYPE_PTY:
+        /* PTY path is only parsed from live XML */
+        dst->data.file.path = NULL;
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_DEV:
+    case VIR_DOMAIN_CHR_TYPE_FILE:
+    case VIR_DOMAIN_CHR_TYPE_PIPE:
+        dst->data.file.path = NULL;
+        if (VIR_STRDUP(dst->data.file.path, src->data.file.path) < 0)
+            return -1;
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_NMDM:
+        dst->data.nmdm.master = NULL;
+        dst->data.nmdm.slave = NULL;
+        if (VIR_STRDUP(dst->data.nmdm.master, src->data.nmdm.master) < 0 ||
+            VIR_STRDUP(dst->data.nmdm.slave, src->data.nmdm.slave) < 0)
+            return -1;
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_UDP:
+        dst->data.udp.bindHost = NULL;
+        dst->data.udp.bindService = NULL;
+        dst->data.udp.connectHost = NULL;
+        dst->data.udp.connectService = NULL;
+        if (VIR_STRDUP(dst->data.udp.bindHost, src->data.udp.bindHost) < 0 ||
+            VIR_STRDUP(dst->data.udp.bindService,
+                       src->data.udp.bindService) < 0 ||
+            VIR_STRDUP(dst->data.udp.connectHost,
+                       src->data.udp.connectHost) < 0 ||
+            VIR_STRDUP(dst->data.udp.connectService,
+                       src->data.udp.connectService) < 0)
+            return -1;
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_TCP:
+        dst->data.tcp.host = NULL;
+        dst->data.tcp.service = NULL;
+        if (VIR_STRDUP(dst->data.tcp.host, src->data.tcp.host) < 0 ||
+            VIR_STRDUP(dst->data.tcp.service, src->data.tcp.service) < 0)
+            return -1;
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_UNIX:
+        dst->data.nix.path = NULL;
+        if (VIR_STRDUP(dst->data.nix.path, src->data.nix.path) < 0)
+            return -1;
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_SPICEPORT:
+        dst->data.spiceport.channel = NULL;
+        if (VIR_STRDUP(dst->data.spiceport.channel,
+                       src->data.spiceport.channel) < 0)
+            return -1;
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_NULL:
+    case VIR_DOMAIN_CHR_TYPE_VC:
+    case VIR_DOMAIN_CHR_TYPE_STDIO:
+    case VIR_DOMAIN_CHR_TYPE_SPICEVMC:
+    case VIR_DOMAIN_CHR_TYPE_LAST:
+        break;
+    }
+
+    if (VIR_STRDUP(dst->logfile, src->logfile) < 0)
+        return -1;
+    return 0;
+}
+
+
+static virDomainChrDefPtr
+virDomainDefCopyChr(virDomainChrDefPtr src,
+                    virDomainXMLOptionPtr xmlopt,
+                    bool inactive)
+{
+    virDomainChrDefPtr ret;
+
+    if (!(ret = virDomainChrDefNew(xmlopt)))
+        return NULL;
+
+    ret->deviceType = src->deviceType;
+    ret->targetTypeAttr = src->targetTypeAttr;
+    ret->targetType = src->targetType;
+
+    if (src->deviceType == VIR_DOMAIN_CHR_DEVICE_TYPE_CHANNEL &&
+        src->targetType == VIR_DOMAIN_CHR_CHANNEL_TARGET_TYPE_GUESTFWD) {
+        if (src->target.addr) {
+            if (VIR_ALLOC(ret->target.addr) < 0)
+                goto error;
+            *ret->target.addr = *src->target.addr;
+        }
+    } else if (src->deviceType == VIR_DOMAIN_CHR_DEVICE_TYPE_CHANNEL &&
+               (src->targetType == VIR_DOMAIN_CHR_CHANNEL_TARGET_TYPE_XEN ||
+                src->targetType == VIR_DOMAIN_CHR_CHANNEL_TARGET_TYPE_VIRTIO)) {
+        if (VIR_STRDUP(ret->target.name, src->target.name) < 0)
+            goto error;
+    } else {
+        ret->target.port = src->target.port;
+    }
+
+    /* The state of virtio channels is only parsed from live XML, so
+     * it's left at its default */
+
+    if (virDomainDefCopyChrSource(ret->source, src->source) < 0 ||
+        virDomainDefCopyDeviceInfo(&ret->info, &src->info) < 0 ||
+        virDomainDefCopyDeviceSeclabels(&ret->seclabels, &ret->nseclabels,
+                                        src->seclabels, src->nseclabels,
+                                        inactive) < 0)
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainChrDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainNetDefPtr
+virDomainDefCopyNet(virDomainNetDefPtr src,
+                    virDomainXMLOptionPtr xmlopt,
+                    const char *netprefix)
+{
+    virDomainNetDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->type = src->type;
+    ret->mac = src->mac;
+    ret->driver = src->driver;
+    ret->tune = src->tune;
+    ret->trustGuestRxFilters = src->trustGuestRxFilters;
+    ret->linkstate = src->linkstate;
+    ret->mtu = src->mtu;
+
+    switch (src->type) {
+    case VIR_DOMAIN_NET_TYPE_VHOSTUSER:
+        if (!(ret->data.vhostuser = virDomainChrSourceDefNew(xmlopt)) ||
+            virDomainDefCopyChrSource(ret->data.vhostuser,
+                                      src->data.vhostuser) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_SERVER:
+    case VIR_DOMAIN_NET_TYPE_CLIENT:
+    case VIR_DOMAIN_NET_TYPE_MCAST:
+    case VIR_DOMAIN_NET_TYPE_UDP:
+        ret->data.socket.port = src->data.socket.port;
+        ret->data.socket.localport = src->data.socket.localport;
+        if (VIR_STRDUP(ret->data.socket.address,
+                       src->data.socket.address) < 0 ||
+            VIR_STRDUP(ret->data.socket.localaddr,
+                       src->data.socket.localaddr) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_NETWORK:
+        if (VIR_STRDUP(ret->data.network.name, src->data.network.name) < 0 ||
+            VIR_STRDUP(ret->data.network.portgroup,
+                       src->data.network.portgroup) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_BRIDGE:
+        if (VIR_STRDUP(ret->data.bridge.brname, src->data.bridge.brname) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_INTERNAL:
+        if (VIR_STRDUP(ret->data.internal.name, src->data.internal.name) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_DIRECT:
+        ret->data.direct.mode = src->data.direct.mode;
+        if (VIR_STRDUP(ret->data.direct.linkdev,
+                       src->data.direct.linkdev) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_HOSTDEV:
+    case VIR_DOMAIN_NET_TYPE_ETHERNET:
+    case VIR_DOMAIN_NET_TYPE_USER:
+    case VIR_DOMAIN_NET_TYPE_LAST:
+        break;
+    }
+
+    /* An auto-generated target name is blanked out by the parser */
+    if (src->ifname &&
+        !STRPREFIX(src->ifname, VIR_NET_GENERATED_TAP_PREFIX) &&
+        !(netprefix && STRPREFIX(src->ifname, netprefix)) &&
+        !(src->type == VIR_DOMAIN_NET_TYPE_DIRECT &&
+          STRPREFIX(src->ifname, VIR_NET_GENERATED_MACVTAP_PREFIX)) &&
+        VIR_STRDUP(ret->ifname, src->ifname) < 0)
+        goto error;
+
+    if (VIR_STRDUP(ret->model, src->model) < 0 ||
+        VIR_STRDUP(ret->backend.tap, src->backend.tap) < 0 ||
+        VIR_STRDUP(ret->backend.vhost, src->backend.vhost) < 0 ||
+        VIR_STRDUP(ret->script, src->script) < 0 ||
+        VIR_STRDUP(ret->domain_name, src->domain_name) < 0 ||
+        VIR_STRDUP(ret->ifname_guest, src->ifname_guest) < 0 ||
+        VIR_STRDUP(ret->ifname_guest_actual, src->ifname_guest_actual) < 0 ||
+        VIR_STRDUP(ret->filter, src->filter) < 0)
+        goto error;
+
+    if (src->virtPortProfile) {
+        if (VIR_ALLOC(ret->virtPortProfile) < 0)
+            goto error;
+        *ret->virtPortProfile = *src->virtPortProfile;
+    }
+
+    if (src->coalesce) {
+        if (VIR_ALLOC(ret->coalesce) < 0)
+            goto error;
+        *ret->coalesce = *src->coalesce;
+    }
+
+    if (src->filter && src->filterparams &&
+        (!(ret->filterparams = virNWFilterHashTableCreate(0)) ||
+         virNWFilterHashTablePutAll(src->filterparams,
+                                    ret->filterparams) < 0))
+        goto error;
+
+    if (virNetDevBandwidthCopy(&ret->bandwidth, src->bandwidth) < 0 ||
+        virNetDevVlanCopy(&ret->vlan, &src->vlan) < 0 ||
+        virDomainDefCopyDeviceInfo(&ret->info, &src->info) < 0)
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainNetDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainInputDefPtr
+virDomainDefCopyInput(virDomainInputDefPtr src)
+{
+    virDomainInputDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->type = src->type;
+    ret->bus = src->bus;
+
+    if (VIR_STRDUP(ret->source.evdev, src->source.evdev) < 0 ||
+        virDomainDefCopyDeviceInfo(&ret->info, &src->info) < 0) {
+        virDomainInputDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+static virDomainSoundDefPtr
+virDomainDefCopySound(virDomainSoundDefPtr src)
+{
+    virDomainSoundDefPtr ret;
+    size_t i;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->model = src->model;
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info) < 0)
+        goto error;
+
+    if (src->ncodecs && VIR_ALLOC_N(ret->codecs, src->ncodecs) < 0)
+        goto error;
+
+    for (i = 0; i < src->ncodecs; i++) {
+        if (VIR_ALLOC(ret->codecs[i]) < 0)
+            goto error;
+        ret->ncodecs++;
+        *ret->codecs[i] = *src->codecs[i];
+    }
+
+    return ret;
+
+ error:
+    virDomainSoundDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainVideoDefPtr
+virDomainDefCopyVideo(virDomainVideoDefPtr src)
+{
+    virDomainVideoDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    *ret = *src;
+    ret->accel = NULL;
+    memset(&ret->info, 0, sizeof(ret->info));
+
+    if (src->accel) {
+        if (VIR_ALLOC(ret->accel) < 0)
+            goto error;
+        *ret->accel = *src->accel;
+    }
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info) < 0)
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainVideoDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainHubDefPtr
+virDomainDefCopyHub(virDomainHubDefPtr src)
+{
+    virDomainHubDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->type = src->type;
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info) < 0) {
+        virDomainHubDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+static virDomainRNGDefPtr
+virDomainDefCopyRNG(virDomainRNGDefPtr src,
+                    virDomainXMLOptionPtr xmlopt)
+{
+    virDomainRNGDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->model = src->model;
+    ret->backend = src->backend;
+    ret->rate = src->rate;
+    ret->period = src->period;
+
+    switch ((virDomainRNGBackend) src->backend) {
+    case VIR_DOMAIN_RNG_BACKEND_RANDOM:
+        if (VIR_STRDUP(ret->source.file, src->source.file) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_RNG_BACKEND_EGD:
+        if (!(ret->source.chardev = virDomainChrSourceDefNew(xmlopt)) ||
+            virDomainDefCopyChrSource(ret->source.chardev,
+                                      src->source.chardev) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_RNG_BACKEND_LAST:
+        break;
+    }
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info) < 0)
+        goto error;
+
+    return ret;
+
+ error:
+    virDomainRNGDefFree(ret);
+    return NULL;
+}
+
+
+static virDomainPanicDefPtr
+virDomainDefCopyPanic(virDomainPanicDefPtr src)
+{
+    virDomainPanicDefPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->model = src->model;
+
+    if (virDomainDefCopyDeviceInfo(&ret->info, &src->info) < 0) {
+        virDomainPanicDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+static virSecurityLabelDefPtr
+virDomainDefCopySeclabel(virSecurityLabelDefPtr src)
+{
+    virSecurityLabelDefPtr ret;
+
+    if (!(ret = virSecurityLabelDefNew(src->model)))
+        return NULL;
+
+    ret->type = src->type;
+    ret->relabel = src->relabel;
+
+    /* Mirror the fixups done when parsing inactive XML: model 'none'
+     * and type 'none' don't carry any labels, a dynamic label only
+     * keeps its base label and only a static one keeps the label.  */
+    if (STREQ_NULLABLE(src->model, "none") ||
+        src->type == VIR_DOMAIN_SECLABEL_NONE) {
+        ret->type = VIR_DOMAIN_SECLABEL_NONE;
+        ret->relabel = false;
+        return ret;
+    }
+
+    if ((src->type == VIR_DOMAIN_SECLABEL_STATIC &&
+         VIR_STRDUP(ret->label, src->label) < 0) ||
+        (src->type == VIR_DOMAIN_SECLABEL_DYNAMIC &&
+         VIR_STRDUP(ret->baselabel, src->baselabel) < 0)) {
+        virSecurityLabelDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+/* Returns true if @def uses configuration the structural copy does not
+ * know about yet, in which case it has to be copied via XML.  */
+static bool
+virDomainDefCopyNeedsXML(virDomainDefPtr def)
+{
+    size_t i;
+
+    if (def->namespaceData ||
+        def->sysinfo ||
+        def->redirfilter ||
+        def->tpm ||
+        def->ngraphics ||
+        def->nhostdevs ||
+        def->nredirdevs ||
+        def->nsmartcards ||
+        def->nshmems ||
+        def->nmems)
+        return true;
+
+    /* A missing model is filled in from the host capabilities */
+    for (i = 0; i < def->nseclabels; i++) {
+        if (!def->seclabels[i]->model)
+            return true;
+    }
+
+    for (i = 0; i < def->nnets; i++) {
+        virDomainNetDefPtr net = def->nets[i];
+
+        if (net->type == VIR_DOMAIN_NET_TYPE_HOSTDEV ||
+            (net->type == VIR_DOMAIN_NET_TYPE_NETWORK &&
+             net->data.network.actual) ||
+            net->hostIP.nips || net->hostIP.nroutes ||
+            net->guestIP.nips || net->guestIP.nroutes)
+            return true;
+    }
+
+    return false;
+}
+
+
+static int
+virDomainDefCopyOS(virDomainOSDefPtr dst,
+                   virDomainOSDefPtr src)
+{
+    size_t i;
+
+    /* first a shallow copy of *everything* */
+    *dst = *src;
+
+    /* then redo all the fields that are pointers */
+    dst->machine = NULL;
+    dst->init = NULL;
+    dst->initargv = NULL;
+    dst->kernel = NULL;
+    dst->initrd = NULL;
+    dst->cmdline = NULL;
+    dst->dtb = NULL;
+    dst->root = NULL;
+    dst->slic_table = NULL;
+    dst->loader = NULL;
+    dst->bootloader = NULL;
+    dst->bootloaderArgs = NULL;
+
+    if (VIR_STRDUP(dst->machine, src->machine) < 0 ||
+        VIR_STRDUP(dst->init, src->init) < 0 ||
+        VIR_STRDUP(dst->kernel, src->kernel) < 0 ||
+        VIR_STRDUP(dst->initrd, src->initrd) < 0 ||
+        VIR_STRDUP(dst->cmdline, src->cmdline) < 0 ||
+        VIR_STRDUP(dst->dtb, src->dtb) < 0 ||
+        VIR_STRDUP(dst->root, src->root) < 0 ||
+        VIR_STRDUP(dst->slic_table, src->slic_table) < 0 ||
+        VIR_STRDUP(dst->bootloader, src->bootloader) < 0 ||
+        VIR_STRDUP(dst->bootloaderArgs, src->bootloaderArgs) < 0)
+        return -1;
+
+    if (src->initargv) {
+        for (i = 0; src->initargv[i]; i++)
+            ;
+
+        if (VIR_ALLOC_N(dst->initargv, i + 1) < 0)
+            return -1;
+
+        for (i = 0; src->initargv[i]; i++) {
+            if (VIR_STRDUP(dst->initargv[i], src->initargv[i]) < 0)
+                return -1;
+        }
+    }
+
+    if (src->loader) {
+        if (VIR_ALLOC(dst->loader) < 0)
+            return -1;
+
+        dst->loader->readonly = src->loader->readonly;
+        dst->loader->type = src->loader->type;
+        dst->loader->secure = src->loader->secure;
+
+        if (VIR_STRDUP(dst->loader->path, src->loader->path) < 0 ||
+            VIR_STRDUP(dst->loader->nvram, src->loader->nvram) < 0 ||
+            VIR_STRDUP(dst->loader->templt, src->loader->templt) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+virDomainDefCopyClock(virDomainClockDefPtr dst,
+                      virDomainClockDefPtr src)
+{
+    size_t i;
+
+    dst->offset = src->offset;
+    dst->data = src->data;
+
+    switch ((virDomainClockOffsetType) src->offset) {
+    case VIR_DOMAIN_CLOCK_OFFSET_VARIABLE:
+        /* only formatted into the status XML */
+        dst->data.variable.adjustment0 = 0;
+        break;
+
+    case VIR_DOMAIN_CLOCK_OFFSET_TIMEZONE:
+        dst->data.timezone = NULL;
+        if (VIR_STRDUP(dst->data.timezone, src->data.timezone) < 0)
+            return -1;
+        break;
+
+    case VIR_DOMAIN_CLOCK_OFFSET_UTC:
+    case VIR_DOMAIN_CLOCK_OFFSET_LOCALTIME:
+    case VIR_DOMAIN_CLOCK_OFFSET_LAST:
+        break;
+    }
+
+    if (src->ntimers && VIR_ALLOC_N(dst->timers, src->ntimers) < 0)
+        return -1;
+
+    for (i = 0; i < src->ntimers; i++) {
+        if (VIR_ALLOC(dst->timers[i]) < 0)
+            return -1;
+        dst->ntimers++;
+        *dst->timers[i] = *src->timers[i];
+    }
+
+    return 0;
+}
+
+
+static int
+virDomainDefCopyBitmap(virBitmapPtr *dst,
+                       virBitmapPtr src)
+{
+    if (src && !(*dst = virBitmapNewCopy(src)))
+        return -1;
+
+    return 0;
+}
+
+
+static int
+virDomainDefCopyResctrlCache(unsigned int level,
+                             virCacheType type,
+                             unsigned int cache,
+                             unsigned long long size,
+                             void *opaque)
+{
+    return virResctrlAllocSetCacheSize(opaque, level, type, cache, size);
+}
+
+
+static int
+virDomainDefCopyResctrlMemory(unsigned int id,
+                              unsigned int bandwidth,
+                              void *opaque)
+{
+    return virResctrlAllocSetMemoryBandwidth(opaque, id, bandwidth);
+}
+
+
+static virDomainResctrlDefPtr
+virDomainDefCopyResctrl(virDomainResctrlDefPtr src)
+{
+    virDomainResctrlDefPtr ret;
+
+    /* The group path is runtime state which is never formatted */
+    if (VIR_ALLOC(ret) < 0 ||
+        virDomainDefCopyBitmap(&ret->vcpus, src->vcpus) < 0 ||
+        !(ret->alloc = virResctrlAllocNew()) ||
+        virResctrlAllocSetID(ret->alloc,
+                             virResctrlAllocGetID(src->alloc)) < 0 ||
+        virResctrlAllocForeachCache(src->alloc,
+                                    virDomainDefCopyResctrlCache,
+                                    ret->alloc) < 0 ||
+        virResctrlAllocForeachMemory(src->alloc,
+                                     virDomainDefCopyResctrlMemory,
+                                     ret->alloc) < 0) {
+        virDomainResctrlDefFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+static int
+virDomainDefCopyTuning(virDomainDefPtr dst,
+                       virDomainDefPtr src,
+                       virDomainXMLOptionPtr xmlopt)
+{
+    size_t i;
+
+    dst->blkio.weight = src->blkio.weight;
+    if (src->blkio.ndevices &&
+        VIR_ALLOC_N(dst->blkio.devices, src->blkio.ndevices) < 0)
+        return -1;
+
+    for (i = 0; i < src->blkio.ndevices; i++) {
+        dst->blkio.devices[i] = src->blkio.devices[i];
+        dst->blkio.devices[i].path = NULL;
+        dst->blkio.ndevices++;
+        if (VIR_STRDUP(dst->blkio.devices[i].path,
+                       src->blkio.devices[i].path) < 0)
+            return -1;
+    }
+
+    dst->mem = src->mem;
+    dst->mem.hugepages = NULL;
+    dst->mem.nhugepages = 0;
+    if (src->mem.nhugepages &&
+        VIR_ALLOC_N(dst->mem.hugepages, src->mem.nhugepages) < 0)
+        return -1;
+
+    for (i = 0; i < src->mem.nhugepages; i++) {
+        dst->mem.hugepages[i].size = src->mem.hugepages[i].size;
+        dst->mem.nhugepages++;
+        if (virDomainDefCopyBitmap(&dst->mem.hugepages[i].nodemask,
+                                   src->mem.hugepages[i].nodemask) < 0)
+            return -1;
+    }
+
+    if (virDomainDefSetVcpusMax(dst, src->maxvcpus, xmlopt) < 0)
+        return -1;
+
+    for (i = 0; i < src->maxvcpus; i++) {
+        virDomainVcpuDefPtr srcvcpu = src->vcpus[i];
+        virDomainVcpuDefPtr dstvcpu = dst->vcpus[i];
+
+        dstvcpu->online = srcvcpu->online;
+        dstvcpu->hotpluggable = srcvcpu->hotpluggable;
+        dstvcpu->order = srcvcpu->order;
+        dstvcpu->sched = srcvcpu->sched;
+        if (virDomainDefCopyBitmap(&dstvcpu->cpumask, srcvcpu->cpumask) < 0)
+            return -1;
+    }
+
+    dst->individualvcpus = src->individualvcpus;
+    dst->placement_mode = src->placement_mode;
+    if (virDomainDefCopyBitmap(&dst->cpumask, src->cpumask) < 0)
+        return -1;
+
+    if (src->niothreadids &&
+        VIR_ALLOC_N(dst->iothreadids, src->niothreadids) < 0)
+        return -1;
+
+    for (i = 0; i < src->niothreadids; i++) {
+        virDomainIOThreadIDDefPtr iothrid;
+
+        if (VIR_ALLOC(iothrid) < 0)
+            return -1;
+        dst->iothreadids[dst->niothreadids++] = iothrid;
+
+        /* thread_id is runtime state which is never formatted */
+        iothrid->autofill = src->iothreadids[i]->autofill;
+        iothrid->iothread_id = src->iothreadids[i]->iothread_id;
+        iothrid->sched = src->iothreadids[i]->sched;
+        if (virDomainDefCopyBitmap(&iothrid->cpumask,
+                                   src->iothreadids[i]->cpumask) < 0)
+            return -1;
+    }
+
+    dst->cputune = src->cputune;
+    dst->cputune.emulatorpin = NULL;
+    if (virDomainDefCopyBitmap(&dst->cputune.emulatorpin,
+                               src->cputune.emulatorpin) < 0)
+        return -1;
+
+    if (src->nresctrls &&
+        VIR_ALLOC_N(dst->resctrls, src->nresctrls) < 0)
+        return -1;
+
+    for (i = 0; i < src->nresctrls; i++) {
+        /* Allocations without any tuning are never formatted */
+        if (virResctrlAllocIsEmpty(src->resctrls[i]->alloc))
+            continue;
+
+        if (!(dst->resctrls[dst->nresctrls] =
+              virDomainDefCopyResctrl(src->resctrls[i])))
+            return -1;
+        dst->nresctrls++;
+    }
+    if (dst->nresctrls == 0)
+        VIR_FREE(dst->resctrls);
+
+    virDomainNumaFree(dst->numa);
+    if (!(dst->numa = virDomainNumaCopy(src->numa)))
+        return -1;
+
+    if (src->resource) {
+        if (VIR_ALLOC(dst->resource) < 0 ||
+            VIR_STRDUP(dst->resource->partition,
+                       src->resource->partition) < 0)
+            return -1;
+    }
+
+    if (src->idmap.nuidmap) {
+        if (VIR_ALLOC_N(dst->idmap.uidmap, src->idmap.nuidmap) < 0)
+            return -1;
+        memcpy(dst->idmap.uidmap, src->idmap.uidmap,
+               src->idmap.nuidmap * sizeof(*src->idmap.uidmap));
+        dst->idmap.nuidmap = src->idmap.nuidmap;
+    }
+
+    if (src->idmap.ngidmap) {
+        if (VIR_ALLOC_N(dst->idmap.gidmap, src->idmap.ngidmap) < 0)
+            return -1;
+        memcpy(dst->idmap.gidmap, src->idmap.gidmap,
+               src->idmap.ngidmap * sizeof(*src->idmap.gidmap));
+        dst->idmap.ngidmap = src->idmap.ngidmap;
+    }
+
+    return 0;
+}
+
+
+static int
+virDomainDefCopyDevices(virDomainDefPtr dst,
+                        virDomainDefPtr src,
+                        virCapsPtr caps,
+                        virDomainXMLOptionPtr xmlopt)
+{
+    bool inactive = src->id == -1;
+    const char *netprefix = caps ? caps->host.netprefix : NULL;
+    size_t i;
+
+    if (src->ndisks && VIR_ALLOC_N(dst->disks, src->ndisks) < 0)
+        return -1;
+    for (i = 0; i < src->ndisks; i++) {
+        if (!(dst->disks[i] = virDomainDefCopyDisk(src->disks[i], xmlopt,
+                                                    inactive)))
+            return -1;
+        dst->ndisks++;
+    }
+
+    if (src->ncontrollers &&
+        VIR_ALLOC_N(dst->controllers, src->ncontrollers) < 0)
+        return -1;
+    for (i = 0; i < src->ncontrollers; i++) {
+        virDomainControllerDefPtr controller;
+
+        /* Implicit controllers are appended after parsing, the parser
+         * would sort them in between the others */
+        if (!(controller = virDomainDefCopyController(src->controllers[i])))
+            return -1;
+        virDomainControllerInsertPreAlloced(dst, controller);
+    }
+
+    if (src->nleases && VIR_ALLOC_N(dst->leases, src->nleases) < 0)
+        return -1;
+    for (i = 0; i < src->nleases; i++) {
+        if (!(dst->leases[i] = virDomainDefCopyLease(src->leases[i])))
+            return -1;
+        dst->nleases++;
+    }
+
+    if (src->nfss && VIR_ALLOC_N(dst->fss, src->nfss) < 0)
+        return -1;
+    for (i = 0; i < src->nfss; i++) {
+        if (!(dst->fss[i] = virDomainDefCopyFS(src->fss[i])))
+            return -1;
+        dst->nfss++;
+    }
+
+    if (src->nnets && VIR_ALLOC_N(dst->nets, src->nnets) < 0)
+        return -1;
+    for (i = 0; i < src->nnets; i++) {
+        if (!(dst->nets[i] = virDomainDefCopyNet(src->nets[i], xmlopt,
+                                                  netprefix)))
+            return -1;
+        dst->nnets++;
+    }
+
+    if (src->ninputs && VIR_ALLOC_N(dst->inputs, src->ninputs) < 0)
+        return -1;
+    for (i = 0; i < src->ninputs; i++) {
+        if (!(dst->inputs[i] = virDomainDefCopyInput(src->inputs[i])))
+            return -1;
+        dst->ninputs++;
+    }
+
+    if (src->nsounds && VIR_ALLOC_N(dst->sounds, src->nsounds) < 0)
+        return -1;
+    for (i = 0; i < src->nsounds; i++) {
+        if (!(dst->sounds[i] = virDomainDefCopySound(src->sounds[i])))
+            return -1;
+        dst->nsounds++;
+    }
+
+    if (src->nvideos && VIR_ALLOC_N(dst->videos, src->nvideos) < 0)
+        return -1;
+    for (i = 0; i < src->nvideos; i++) {
+        if (!(dst->videos[i] = virDomainDefCopyVideo(src->videos[i])))
+            return -1;
+        dst->nvideos++;
+    }
+
+    if (src->nserials && VIR_ALLOC_N(dst->serials, src->nserials) < 0)
+        return -1;
+    for (i = 0; i < src->nserials; i++) {
+        if (!(dst->serials[i] = virDomainDefCopyChr(src->serials[i], xmlopt,
+                                                     inactive)))
+            return -1;
+        dst->nserials++;
+    }
+
+    if (src->nparallels && VIR_ALLOC_N(dst->parallels, src->nparallels) < 0)
+        return -1;
+    for (i = 0; i < src->nparallels; i++) {
+        if (!(dst->parallels[i] = virDomainDefCopyChr(src->parallels[i],
+                                                       xmlopt, inactive)))
+            return -1;
+        dst->nparallels++;
+    }
+
+    if (src->nchannels && VIR_ALLOC_N(dst->channels, src->nchannels) < 0)
+        return -1;
+    for (i = 0; i < src->nchannels; i++) {
+        if (!(dst->channels[i] = virDomainDefCopyChr(src->channels[i],
+                                                      xmlopt, inactive)))
+            return -1;
+        dst->nchannels++;
+    }
+
+    if (src->nconsoles && VIR_ALLOC_N(dst->consoles, src->nconsoles) < 0)
+        return -1;
+    for (i = 0; i < src->nconsoles; i++) {
+        if (!(dst->consoles[i] = virDomainDefCopyChr(src->consoles[i],
+                                                      xmlopt, inactive)))
+            return -1;
+        /* the parser numbers consoles by their position */
+        dst->consoles[i]->target.port = i;
+        dst->nconsoles++;
+    }
+
+    if (src->nhubs && VIR_ALLOC_N(dst->hubs, src->nhubs) < 0)
+        return -1;
+    for (i = 0; i < src->nhubs; i++) {
+        if (!(dst->hubs[i] = virDomainDefCopyHub(src->hubs[i])))
+            return -1;
+        dst->nhubs++;
+    }
+
+    if (src->nrngs && VIR_ALLOC_N(dst->rngs, src->nrngs) < 0)
+        return -1;
+    for (i = 0; i < src->nrngs; i++) {
+        if (!(dst->rngs[i] = virDomainDefCopyRNG(src->rngs[i], xmlopt)))
+            return -1;
+        dst->nrngs++;
+    }
+
+    if (src->npanics && VIR_ALLOC_N(dst->panics, src->npanics) < 0)
+        return -1;
+    for (i = 0; i < src->npanics; i++) {
+        if (!(dst->panics[i] = virDomainDefCopyPanic(src->panics[i])))
+            return -1;
+        dst->npanics++;
+    }
+
+    if (src->watchdog) {
+        if (VIR_ALLOC(dst->watchdog) < 0)
+            return -1;
+        dst->watchdog->model = src->watchdog->model;
+        dst->watchdog->action = src->watchdog->action;
+        if (virDomainDefCopyDeviceInfo(&dst->watchdog->info,
+                                       &src->watchdog->info) < 0)
+            return -1;
+    }
+
+    if (src->memballoon) {
+        if (VIR_ALLOC(dst->memballoon) < 0)
+            return -1;
+        dst->memballoon->model = src->memballoon->model;
+        dst->memballoon->period = src->memballoon->period;
+        dst->memballoon->autodeflate = src->memballoon->autodeflate;
+        if (virDomainDefCopyDeviceInfo(&dst->memballoon->info,
+                                       &src->memballoon->info) < 0)
+            return -1;
+    }
+
+    if (src->nvram) {
+        if (VIR_ALLOC(dst->nvram) < 0 ||
+            virDomainDefCopyDeviceInfo(&dst->nvram->info,
+                                       &src->nvram->info) < 0)
+            return -1;
+    }
+
+    if (src->iommu) {
+        if (VIR_ALLOC(dst->iommu) < 0)
+            return -1;
+        *dst->iommu = *src->iommu;
+    }
+
+    return 0;
+}
+
+
+static virDomainDefPtr
+virDomainDefCopyInternal(virDomainDefPtr src,
+                         virCapsPtr caps,
+                         virDomainXMLOptionPtr xmlopt)
+{
+    virDomainDefPtr ret;
+    size_t i;
+
+    if (!(ret = virDomainDefNew()))
+        return NULL;
+
+    ret->virtType = src->virtType;
+    ret->id = -1;
+    memcpy(ret->uuid, src->uuid, VIR_UUID_BUFLEN);
+
+    ret->onReboot = src->onReboot;
+    ret->onPoweroff = src->onPoweroff;
+    ret->onCrash = src->onCrash;
+    ret->onLockFailure = src->onLockFailure;
+    ret->pm = src->pm;
+    ret->perf = src->perf;
+
+    memcpy(ret->features, src->features, sizeof(src->features));
+    ret->apic_eoi = src->apic_eoi;
+    memcpy(ret->hyperv_features, src->hyperv_features,
+           sizeof(src->hyperv_features));
+    memcpy(ret->kvm_features, src->kvm_features, sizeof(src->kvm_features));
+    ret->hyperv_spinlocks = src->hyperv_spinlocks;
+    ret->gic_version = src->gic_version;
+    memcpy(ret->caps_features, src->caps_features,
+           sizeof(src->caps_features));
+    if (xmlopt)
+        ret->ns = xmlopt->ns;
+
+    if (VIR_STRDUP(ret->name, src->name) < 0 ||
+        VIR_STRDUP(ret->title, src->title) < 0 ||
+        VIR_STRDUP(ret->description, src->description) < 0 ||
+        VIR_STRDUP(ret->emulator, src->emulator) < 0 ||
+        VIR_STRDUP(ret->hyperv_vendor_id, src->hyperv_vendor_id) < 0)
+        goto error;
+
+    if (virDomainDefCopyTuning(ret, src, xmlopt) < 0 ||
+        virDomainDefCopyOS(&ret->os, &src->os) < 0 ||
+        virDomainDefCopyClock(&ret->clock, &src->clock) < 0 ||
+        virDomainDefCopyDevices(ret, src, caps, xmlopt) < 0)
+        goto error;
+
+    if (src->cpu && !(ret->cpu = virCPUDefCopy(src->cpu)))
+        goto error;
+
+    if (src->nseclabels && VIR_ALLOC_N(ret->seclabels, src->nseclabels) < 0)
+        goto error;
+    for (i = 0; i < src->nseclabels; i++) {
+        /* The default label type is never formatted */
+        if (src->seclabels[i]->type == VIR_DOMAIN_SECLABEL_DEFAULT)
+            continue;
+
+        if (!(ret->seclabels[ret->nseclabels] =
+              virDomainDefCopySeclabel(src->seclabels[i])))
+            goto error;
+        ret->nseclabels++;
+    }
+    if (ret->nseclabels == 0)
+        VIR_FREE(ret->seclabels);
+
+    if (src->keywrap) {
+        if (VIR_ALLOC(ret->keywrap) < 0)
+            goto error;
+        *ret->keywrap = *src->keywrap;
+    }
+
+    if (src->metadata &&
+        !(ret->metadata = xmlCopyNode(src->metadata, 1))) {
+        virReportOOMError();
+        goto error;
+    }
+
+    return ret;
+
+ error:
+    virDomainDefFree(ret);
+    return NULL;
+}
+
+
+/* Copy src into a new definition; with the quality of the copy
+ * depending on the migratable flag (false for transitions between
+ * persistent and active, true for transitions across save files or
+ * snapshots).  Non-migratable copies are done structurally unless the
+ * definition uses devices the structural copy doesn't handle yet.  */
+virDomainDefPtr
+virDomainDefCopy(virDomainDefPtr src,
+                 virCapsPtr caps,
+                 virDomainXMLOptionPtr xmlopt,
+                 void *parseOpaque,
+                 bool migratable)
+{
+    char *xml;
+    virDomainDefPtr ret;
+    unsigned int format_flags = VIR_DOMAIN_DEF_FORMAT_SECURE;
+    unsigned int parse_flags = VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                               VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE;
+
+    if (!migratable && !virDomainDefCopyNeedsXML(src))
+        return virDomainDefCopyInternal(src, caps, xmlopt);
 
     if (migratable)
         format_flags |= VIR_DOMAIN_DEF_FORMAT_INACTIVE | VIR_DOMAIN_DEF_FORMAT_MIGRATABLE;
 
-    /* Easiest to clone via a round-trip through XML.  */
+    /* Fall back to cloning via a round-trip through XML.  */
     if (!(xml = virDomainDefFormat(src, caps, format_flags)))
         return NULL;
 
@@ -643,6 +643,10 @@ struct _virDomainDiskDef {
 
     virDomainBlockIoTuneInfo blkdeviotune;
 
+    /* growth of the allocation in bytes between two write threshold
+     * events re-armed by the driver, 0 if disabled */
+    unsigned long long watermark;
+
     char *serial;
     char *wwn;
     char *vendor;
@@ -959,6 +963,7 @@ struct _virDomainNetDef {
             virTristateSwitch ioeventfd;
             virTristateSwitch event_idx;
             unsigned int queues; /* Multiqueue virtio-net */
+            bool queues_auto; /* size @queues from the vCPU count */
             unsigned int rx_queue_size;
             struct {
                 virTristateSwitch csum;
@@ -2095,6 +2100,15 @@ struct _virDomainIOThreadIDDef {
 void virDomainIOThreadIDDefFree(virDomainIOThreadIDDefPtr def);
 
 
+typedef struct _virDomainResctrlDef virDomainResctrlDef;
+typedef virDomainResctrlDef *virDomainResctrlDefPtr;
+
+struct _virDomainResctrlDef {
+    virBitmapPtr vcpus;
+    virResctrlAllocPtr alloc;
+};
+
+
 typedef struct _virDomainCputune virDomainCputune;
 typedef virDomainCputune *virDomainCputunePtr;
 
@@ -2166,6 +2180,7 @@ struct _virDomainMemtune {
     int source; /* enum virDomainMemorySource */
     int access; /* enum virDomainMemoryAccess */
     int allocation; /* enum virDomainMemoryAllocation */
+    unsigned int allocation_threads; /* number of preallocation threads */
 };
 
 typedef struct _virDomainPowerManagement virDomainPowerManagement;
@@ -2231,6 +2246,9 @@ struct _virDomainDef {
 
     virDomainCputune cputune;
 
+    size_t nresctrls;
+    virDomainResctrlDefPtr *resctrls;
+
     virDomainNumaPtr numa;
     virDomainResourceDefPtr resource;
     virDomainIdMapDef idmap;
@@ -2413,6 +2431,9 @@ struct _virDomainObj {
 
     unsigned long long original_memlock; /* Original RLIMIT_MEMLOCK, zero if no
                                           * restore will be required later */
+
+    unsigned long long generation; /* Changes whenever the XML description
+                                    * of the domain may have changed */
 };
 
 typedef bool (*virDomainObjListACLFilter)(virConnectPtr conn,
@@ -2670,6 +2691,7 @@ int virDomainObjSetDefTransient(virCapsPtr caps,
                                 virDomainXMLOptionPtr xmlopt,
                                 virDomainObjPtr domain);
 void virDomainObjRemoveTransientDef(virDomainObjPtr domain);
+void virDomainObjBumpGeneration(virDomainObjPtr obj);
 virDomainDefPtr
 virDomainObjGetPersistentDef(virCapsPtr caps,
                              virDomainXMLOptionPtr xmlopt,
@@ -2761,6 +2783,14 @@ virDomainDeviceDefPtr virDomainDeviceDefParse(const char *xmlStr,
                                               virCapsPtr caps,
                                               virDomainXMLOptionPtr xmlopt,
                                               unsigned int flags);
+int virDomainDeviceDefParseList(const char *xmlStr,
+                                const virDomainDef *def,
+                                virCapsPtr caps,
+                                virDomainXMLOptionPtr xmlopt,
+                                unsigned int flags,
+                                virDomainDeviceDefPtr **devs,
+                                size_t *ndevs)
+    ATTRIBUTE_NONNULL(6) ATTRIBUTE_NONNULL(7);
 virStorageSourcePtr virDomainDiskDefSourceParse(const char *xmlStr,
                                                 const virDomainDef *def,
                                                 virDomainXMLOptionPtr xmlopt,
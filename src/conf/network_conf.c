@@ -192,6 +192,8 @@ virNetworkForwardDefClear(virNetworkForwardDefPtr def)
     for (i = 0; i < def->nifs && def->ifs; i++)
         virNetworkForwardIfDefClear(&def->ifs[i]);
     VIR_FREE(def->ifs);
+    virBitmapFree(def->idleIfs);
+    def->idleIfs = NULL;
     def->nifs = def->npfs = 0;
 }
 
@@ -187,6 +187,7 @@ struct _virNetworkForwardIfDef {
         char *dev;      /* name of device */
     }device;
     int connections; /* how many guest interfaces are connected to this device? */
+    int numaNode; /* NUMA node of the device, -1 if unknown (runtime only) */
 };
 
 typedef struct _virNetworkForwardPfDef virNetworkForwardPfDef;
@@ -211,6 +212,9 @@ struct _virNetworkForwardDef {
 
     size_t nifs;
     virNetworkForwardIfDefPtr ifs;
+    /* Runtime only: the interfaces in @ifs without any connections,
+     * kept up to date by the network driver */
+    virBitmapPtr idleIfs;
 
     /* ranges for NAT */
     virSocketAddrRange addr;
@@ -303,10 +303,6 @@ struct _virNodeDeviceObj {
 
 typedef struct _virNodeDeviceObjList virNodeDeviceObjList;
 typedef virNodeDeviceObjList *virNodeDeviceObjListPtr;
-struct _virNodeDeviceObjList {
-    size_t count;
-    virNodeDeviceObjPtr *objs;
-};
 
 char *
 virNodeDeviceDefFormat(const virNodeDeviceDef *def);
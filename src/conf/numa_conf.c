@@ -351,6 +351,53 @@ virDomainNumaFree(virDomainNumaPtr numa)
     VIR_FREE(numa);
 }
 
+virDomainNumaPtr
+virDomainNumaCopy(virDomainNumaPtr src)
+{
+    virDomainNumaPtr ret = NULL;
+    size_t i;
+
+    if (!(ret = virDomainNumaNew()))
+        return NULL;
+
+    ret->memory.specified = src->memory.specified;
+    ret->memory.mode = src->memory.mode;
+    ret->memory.placement = src->memory.placement;
+
+    if (src->memory.nodeset &&
+        !(ret->memory.nodeset = virBitmapNewCopy(src->memory.nodeset)))
+        goto error;
+
+    if (src->nmem_nodes) {
+        if (VIR_ALLOC_N(ret->mem_nodes, src->nmem_nodes) < 0)
+            goto error;
+        ret->nmem_nodes = src->nmem_nodes;
+    }
+
+    for (i = 0; i < src->nmem_nodes; i++) {
+        virDomainNumaNodePtr srcnode = &src->mem_nodes[i];
+        virDomainNumaNodePtr dstnode = &ret->mem_nodes[i];
+
+        dstnode->mem = srcnode->mem;
+        dstnode->mode = srcnode->mode;
+        dstnode->memAccess = srcnode->memAccess;
+
+        if (srcnode->cpumask &&
+            !(dstnode->cpumask = virBitmapNewCopy(srcnode->cpumask)))
+            goto error;
+
+        if (srcnode->nodeset &&
+            !(dstnode->nodeset = virBitmapNewCopy(srcnode->nodeset)))
+            goto error;
+    }
+
+    return ret;
+
+ error:
+    virDomainNumaFree(ret);
+    return NULL;
+}
+
 /**
  * virDomainNumatuneGetMode:
  * @numatune: pointer to numatune definition
@@ -57,6 +57,8 @@ VIR_ENUM_DECL(virDomainMemoryAccess)
 
 virDomainNumaPtr virDomainNumaNew(void);
 void virDomainNumaFree(virDomainNumaPtr numa);
+virDomainNumaPtr virDomainNumaCopy(virDomainNumaPtr src)
+    ATTRIBUTE_NONNULL(1);
 
 /*
  * XML Parse/Format functions
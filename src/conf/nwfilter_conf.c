@@ -2859,6 +2859,7 @@ virNWFilterCallbackDriversUnlock(void)
 
 
 static virDomainObjListIterator virNWFilterDomainFWUpdateCB;
+static virNWFilterDomainFWUpdateFinishFunc virNWFilterDomainFWUpdateFinishCB;
 static void *virNWFilterDomainFWUpdateOpaque;
 
 /**
@@ -2884,8 +2885,19 @@ virNWFilterInstFiltersOnAllVMs(void)
 }
 
 
+/**
+ * virNWFilterTriggerVMFilterRebuild:
+ * @filters: names of the filters whose instantiation is affected by
+ *           the change, or NULL to rebuild the filters of all interfaces
+ *
+ * Instantiate the new version of the filters on all interfaces using one
+ * of @filters and switch over to them if that succeeded everywhere, or
+ * remove them again otherwise.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
 int
-virNWFilterTriggerVMFilterRebuild(void)
+virNWFilterTriggerVMFilterRebuild(virHashTablePtr filters)
 {
     size_t i;
     int ret = 0;
@@ -2893,6 +2905,7 @@ virNWFilterTriggerVMFilterRebuild(void)
         .opaque = virNWFilterDomainFWUpdateOpaque,
         .step = STEP_APPLY_NEW,
         .skipInterfaces = virHashCreate(0, NULL),
+        .filters = filters,
     };
 
     if (!cb.skipInterfaces)
@@ -2904,6 +2917,11 @@ virNWFilterTriggerVMFilterRebuild(void)
             ret = -1;
     }
 
+    /* the new rules may only have been prepared by the callbacks */
+    if (virNWFilterDomainFWUpdateFinishCB &&
+        virNWFilterDomainFWUpdateFinishCB(&cb) < 0)
+        ret = -1;
+
     if (ret < 0) {
         cb.step = STEP_TEAR_NEW; /* rollback */
 
@@ -3194,12 +3212,14 @@ virNWFilterDefFormat(const virNWFilterDef *def)
 
 int
 virNWFilterConfLayerInit(virDomainObjListIterator domUpdateCB,
+                         virNWFilterDomainFWUpdateFinishFunc domUpdateFinish,
                          void *opaque)
 {
     if (initialized)
         return -1;
 
     virNWFilterDomainFWUpdateCB = domUpdateCB;
+    virNWFilterDomainFWUpdateFinishCB = domUpdateFinish;
     virNWFilterDomainFWUpdateOpaque = opaque;
 
     initialized = true;
@@ -3222,6 +3242,7 @@ virNWFilterConfLayerShutdown(void)
     initialized = false;
     virNWFilterDomainFWUpdateOpaque = NULL;
     virNWFilterDomainFWUpdateCB = NULL;
+    virNWFilterDomainFWUpdateFinishCB = NULL;
 }
 
 
@@ -557,8 +557,13 @@ struct domUpdateCBStruct {
     void *opaque;
     UpdateStep step;
     virHashTablePtr skipInterfaces;
+    virHashTablePtr filters;  /* names of the affected filters, NULL for all */
+    void *privateData;        /* owned by the update callbacks */
 };
 
+typedef int
+(*virNWFilterDomainFWUpdateFinishFunc)(struct domUpdateCBStruct *cb);
+
 
 void
 virNWFilterRuleDefFree(virNWFilterRuleDefPtr def);
@@ -567,7 +572,7 @@ void
 virNWFilterDefFree(virNWFilterDefPtr def);
 
 int
-virNWFilterTriggerVMFilterRebuild(void);
+virNWFilterTriggerVMFilterRebuild(virHashTablePtr filters);
 
 int
 virNWFilterDeleteDef(const char *configDir,
@@ -606,6 +611,7 @@ virNWFilterUnlockFilterUpdates(void);
 
 int
 virNWFilterConfLayerInit(virDomainObjListIterator domUpdateCB,
+                         virNWFilterDomainFWUpdateFinishFunc domUpdateFinish,
                          void *opaque);
 
 void
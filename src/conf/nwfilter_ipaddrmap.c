@@ -26,15 +26,79 @@
 
 #include "internal.h"
 
+#include "viralloc.h"
 #include "virerror.h"
+#include "virlog.h"
 #include "datatypes.h"
 #include "nwfilter_params.h"
 #include "nwfilter_ipaddrmap.h"
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
 
+VIR_LOG_INIT("conf.nwfilter_ipaddrmap");
+
 static virMutex ipAddressMapLock = VIR_MUTEX_INITIALIZER;
 static virNWFilterHashTablePtr ipAddressMap;
+/* the reverse map: IP address -> interfaces using it */
+static virNWFilterHashTablePtr ipAddressIndex;
+
+
+static bool
+virNWFilterIPAddrIndexHas(virNWFilterVarValuePtr ifnames, const char *ifname)
+{
+    size_t i;
+
+    for (i = 0; i < virNWFilterVarValueGetCardinality(ifnames); i++) {
+        if (STREQ(virNWFilterVarValueGetNthValue(ifnames, i), ifname))
+            return true;
+    }
+
+    return false;
+}
+
+
+static int
+virNWFilterIPAddrIndexAdd(const char *addr, const char *ifname)
+{
+    virNWFilterVarValuePtr ifnames;
+
+    ifnames = virHashLookup(ipAddressIndex->hashTable, addr);
+    if (!ifnames) {
+        if (!(ifnames = virNWFilterVarValueCreateSimpleCopyValue(ifname)))
+            return -1;
+        if (virNWFilterHashTablePut(ipAddressIndex, addr, ifnames) < 0) {
+            virNWFilterVarValueFree(ifnames);
+            return -1;
+        }
+        return 0;
+    }
+
+    VIR_WARN("IP address %s of interface %s is also used by interface %s",
+             addr, ifname, virNWFilterVarValueGetNthValue(ifnames, 0));
+
+    return virNWFilterVarValueAddValueCopy(ifnames, ifname);
+}
+
+
+static void
+virNWFilterIPAddrIndexDel(const char *addr, const char *ifname)
+{
+    virNWFilterVarValuePtr ifnames;
+
+    ifnames = virHashLookup(ipAddressIndex->hashTable, addr);
+    if (!ifnames)
+        return;
+
+    if (virNWFilterVarValueGetCardinality(ifnames) == 1) {
+        if (STREQ(virNWFilterVarValueGetNthValue(ifnames, 0), ifname)) {
+            ifnames = virNWFilterHashTableRemoveEntry(ipAddressIndex, addr);
+            virNWFilterVarValueFree(ifnames);
+        }
+        return;
+    }
+
+    ignore_value(virNWFilterVarValueDelValue(ifnames, ifname));
+}
 
 
 /* Add an IP address to the list of IP addresses an interface is
@@ -43,7 +107,9 @@ static virNWFilterHashTablePtr ipAddressMap;
  *
  * @ifname: The name of the (tap) interface
  * @addr: An IPv4 address in dotted decimal format that the (tap)
- *        interface is known to use.
+ *        interface is known to use. The map takes ownership of it.
+ *
+ * Adding an address the interface is already known to use is a no-op.
  *
  * This function returns 0 on success, -1 otherwise
  */
@@ -52,19 +118,34 @@ virNWFilterIPAddrMapAddIPAddr(const char *ifname, char *addr)
 {
     int ret = -1;
     virNWFilterVarValuePtr val;
+    virNWFilterVarValuePtr ifnames;
 
     virMutexLock(&ipAddressMapLock);
 
+    ifnames = virHashLookup(ipAddressIndex->hashTable, addr);
+    if (ifnames && virNWFilterIPAddrIndexHas(ifnames, ifname)) {
+        VIR_FREE(addr);
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virNWFilterIPAddrIndexAdd(addr, ifname) < 0)
+        goto cleanup;
+
     val = virHashLookup(ipAddressMap->hashTable, ifname);
     if (!val) {
         val = virNWFilterVarValueCreateSimple(addr);
         if (!val)
-            goto cleanup;
-        ret = virNWFilterHashTablePut(ipAddressMap, ifname, val);
-        goto cleanup;
+            goto error;
+        if (virNWFilterHashTablePut(ipAddressMap, ifname, val) < 0) {
+            /* addr is owned by the caller again */
+            val->u.simple.value = NULL;
+            virNWFilterVarValueFree(val);
+            goto error;
+        }
     } else {
         if (virNWFilterVarValueAddValue(val, addr) < 0)
-            goto cleanup;
+            goto error;
     }
 
     ret = 0;
@@ -73,6 +154,10 @@ virNWFilterIPAddrMapAddIPAddr(const char *ifname, char *addr)
     virMutexUnlock(&ipAddressMapLock);
 
     return ret;
+
+ error:
+    virNWFilterIPAddrIndexDel(addr, ifname);
+    goto cleanup;
 }
 
 /* Delete all or a specific IP address from an interface. After this
@@ -94,10 +179,23 @@ virNWFilterIPAddrMapDelIPAddr(const char *ifname, const char *ipaddr)
 {
     int ret = -1;
     virNWFilterVarValuePtr val = NULL;
+    virNWFilterVarValuePtr ifnames;
+    size_t i;
 
     virMutexLock(&ipAddressMapLock);
 
     if (ipaddr != NULL) {
+        ifnames = virHashLookup(ipAddressIndex->hashTable, ipaddr);
+        if (!ifnames || !virNWFilterIPAddrIndexHas(ifnames, ifname)) {
+            /* not known to be associated with the interface */
+            val = virHashLookup(ipAddressMap->hashTable, ifname);
+            if (val)
+                ret = virNWFilterVarValueGetCardinality(val);
+            goto cleanup;
+        }
+
+        virNWFilterIPAddrIndexDel(ipaddr, ifname);
+
         val = virHashLookup(ipAddressMap->hashTable, ifname);
         if (val) {
             if (virNWFilterVarValueGetCardinality(val) == 1 &&
@@ -108,6 +206,10 @@ virNWFilterIPAddrMapDelIPAddr(const char *ifname, const char *ipaddr)
             ret = virNWFilterVarValueGetCardinality(val);
         }
     } else {
+        val = virHashLookup(ipAddressMap->hashTable, ifname);
+        for (i = 0; val && i < virNWFilterVarValueGetCardinality(val); i++)
+            virNWFilterIPAddrIndexDel(virNWFilterVarValueGetNthValue(val, i),
+                                      ifname);
  remove_entry:
         /* remove whole entry */
         val = virNWFilterHashTableRemoveEntry(ipAddressMap, ifname);
@@ -115,6 +217,7 @@ virNWFilterIPAddrMapDelIPAddr(const char *ifname, const char *ipaddr)
         ret = 0;
     }
 
+ cleanup:
     virMutexUnlock(&ipAddressMapLock);
 
     return ret;
@@ -147,6 +250,12 @@ virNWFilterIPAddrMapInit(void)
     if (!ipAddressMap)
         return -1;
 
+    ipAddressIndex = virNWFilterHashTableCreate(0);
+    if (!ipAddressIndex) {
+        virNWFilterIPAddrMapShutdown();
+        return -1;
+    }
+
     return 0;
 }
 
@@ -155,4 +264,6 @@ virNWFilterIPAddrMapShutdown(void)
 {
     virNWFilterHashTableFree(ipAddressMap);
     ipAddressMap = NULL;
+    virNWFilterHashTableFree(ipAddressIndex);
+    ipAddressIndex = NULL;
 }
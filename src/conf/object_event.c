@@ -32,6 +32,7 @@
 #include "datatypes.h"
 #include "viralloc.h"
 #include "virerror.h"
+#include "virhash.h"
 #include "virobject.h"
 #include "virstring.h"
 
@@ -58,10 +59,20 @@ struct _virObjectEventCallback {
 typedef struct _virObjectEventCallback virObjectEventCallback;
 typedef virObjectEventCallback *virObjectEventCallbackPtr;
 
+typedef struct _virObjectEventCallbackBucket virObjectEventCallbackBucket;
+typedef virObjectEventCallbackBucket *virObjectEventCallbackBucketPtr;
+struct _virObjectEventCallbackBucket {
+    size_t count;
+    virObjectEventCallbackPtr *callbacks; /* not owned, by callbackID */
+};
+
 struct _virObjectEventCallbackList {
     unsigned int nextID;
     size_t count;
     virObjectEventCallbackPtr *callbacks;
+    /* @callbacks grouped by event ID and key, rebuilt on demand */
+    virHashTablePtr index;
+    bool indexDirty;
 };
 
 struct _virObjectEventQueue {
@@ -174,10 +185,170 @@ virObjectEventCallbackListFree(virObjectEventCallbackListPtr list)
         VIR_FREE(list->callbacks[i]);
     }
     VIR_FREE(list->callbacks);
+    virHashFree(list->index);
     VIR_FREE(list);
 }
 
 
+static void
+virObjectEventCallbackBucketFree(void *payload,
+                                 const void *name ATTRIBUTE_UNUSED)
+{
+    virObjectEventCallbackBucketPtr bucket = payload;
+
+    if (!bucket)
+        return;
+
+    VIR_FREE(bucket->callbacks);
+    VIR_FREE(bucket);
+}
+
+
+static int
+virObjectEventCallbackIndexKey(char **name,
+                               int eventID,
+                               const char *key)
+{
+    if (key)
+        return virAsprintf(name, "%d:%s", eventID, key);
+    return virAsprintf(name, "%d", eventID);
+}
+
+
+/**
+ * virObjectEventCallbackListIndex:
+ * @cbList: the list
+ *
+ * Rebuilds the index of @cbList if callbacks were added or removed since
+ * it was built last. Callbacks are grouped by event ID and, for
+ * per-object callbacks, by key so that dispatching an event only needs
+ * to look at the callbacks that might want it.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+virObjectEventCallbackListIndex(virObjectEventCallbackListPtr cbList)
+{
+    virHashTablePtr index = NULL;
+    virObjectEventCallbackBucketPtr bucket = NULL;
+    char *name = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (cbList->index && !cbList->indexDirty)
+        return 0;
+
+    if (!(index = virHashCreate(32, virObjectEventCallbackBucketFree)))
+        return -1;
+
+    for (i = 0; i < cbList->count; i++) {
+        virObjectEventCallbackPtr cb = cbList->callbacks[i];
+
+        if (virObjectEventCallbackIndexKey(&name, cb->eventID,
+                                           cb->key_filter ? cb->key : NULL) < 0)
+            goto cleanup;
+
+        if (!(bucket = virHashLookup(index, name))) {
+            if (VIR_ALLOC(bucket) < 0)
+                goto cleanup;
+            if (virHashAddEntry(index, name, bucket) < 0) {
+                VIR_FREE(bucket);
+                goto cleanup;
+            }
+        }
+
+        if (VIR_APPEND_ELEMENT_COPY(bucket->callbacks, bucket->count, cb) < 0)
+            goto cleanup;
+
+        VIR_FREE(name);
+    }
+
+    virHashFree(cbList->index);
+    cbList->index = index;
+    cbList->indexDirty = false;
+    index = NULL;
+    ret = 0;
+
+ cleanup:
+    virHashFree(index);
+    VIR_FREE(name);
+    return ret;
+}
+
+
+/**
+ * virObjectEventCallbackListCandidates:
+ * @cbList: the list
+ * @event: the event to dispatch
+ * @cbs: filled with callbacks which may want @event
+ * @ncbs: filled with the number of items in @cbs
+ *
+ * Collects the global and per-object callbacks registered for the event
+ * ID of @event in the order in which they were registered. The caller
+ * still has to check each callback with
+ * virObjectEventDispatchMatchCallback and free @cbs.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+virObjectEventCallbackListCandidates(virObjectEventCallbackListPtr cbList,
+                                     virObjectEventPtr event,
+                                     virObjectEventCallbackPtr **cbs,
+                                     size_t *ncbs)
+{
+    virObjectEventCallbackBucketPtr global;
+    virObjectEventCallbackBucketPtr object = NULL;
+    char *name = NULL;
+    size_t i = 0, j = 0, n = 0;
+    int ret = -1;
+
+    *cbs = NULL;
+    *ncbs = 0;
+
+    if (virObjectEventCallbackListIndex(cbList) < 0)
+        return -1;
+
+    if (virObjectEventCallbackIndexKey(&name, event->eventID, NULL) < 0)
+        return -1;
+    global = virHashLookup(cbList->index, name);
+    VIR_FREE(name);
+
+    if (event->meta.key) {
+        if (virObjectEventCallbackIndexKey(&name, event->eventID,
+                                           event->meta.key) < 0)
+            return -1;
+        object = virHashLookup(cbList->index, name);
+        VIR_FREE(name);
+    }
+
+    if (!global && !object)
+        return 0;
+
+    if (VIR_ALLOC_N(*cbs, (global ? global->count : 0) +
+                          (object ? object->count : 0)) < 0)
+        goto cleanup;
+
+    /* Both buckets are sorted by callbackID, merge them */
+    while ((global && i < global->count) || (object && j < object->count)) {
+        if (!object || j == object->count ||
+            (global && i < global->count &&
+             global->callbacks[i]->callbackID <
+             object->callbacks[j]->callbackID))
+            (*cbs)[n++] = global->callbacks[i++];
+        else
+            (*cbs)[n++] = object->callbacks[j++];
+    }
+
+    *ncbs = n;
+    ret = 0;
+
+ cleanup:
+    if (ret < 0)
+        VIR_FREE(*cbs);
+    return ret;
+}
+
+
 /**
  * virObjectEventCallbackListCount:
  * @conn: pointer to the connection
@@ -260,6 +431,7 @@ virObjectEventCallbackListRemoveID(virConnectPtr conn,
                 (*cb->freecb)(cb->opaque);
             virObjectEventCallbackFree(cb);
             VIR_DELETE_ELEMENT(cbList->callbacks, i, cbList->count);
+            cbList->indexDirty = true;
             return ret;
         }
     }
@@ -310,6 +482,7 @@ virObjectEventCallbackListPurgeMarked(virObjectEventCallbackListPtr cbList)
             virObjectEventCallbackFree(cbList->callbacks[n]);
 
             VIR_DELETE_ELEMENT(cbList->callbacks, n, cbList->count);
+            cbList->indexDirty = true;
             n--;
         }
     }
@@ -451,6 +624,7 @@ virObjectEventCallbackListAddID(virConnectPtr conn,
 
     if (VIR_APPEND_ELEMENT(cbList->callbacks, cbList->count, cb) < 0)
         goto cleanup;
+    cbList->indexDirty = true;
 
     /* When additional filtering is being done, every client callback
      * is matched to exactly one server callback.  */
@@ -693,14 +867,20 @@ virObjectEventStateDispatchCallbacks(virObjectEventStatePtr state,
                                      virObjectEventPtr event,
                                      virObjectEventCallbackListPtr callbacks)
 {
+    virObjectEventCallbackPtr *cbs = NULL;
+    size_t ncbs;
     size_t i;
-    /* Cache this now, since we may be dropping the lock,
-       and have more callbacks added. We're guaranteed not
-       to have any removed */
-    size_t cbCount = callbacks->count;
 
-    for (i = 0; i < cbCount; i++) {
-        virObjectEventCallbackPtr cb = callbacks->callbacks[i];
+    /* Work on a copy since we may be dropping the lock, and have more
+     * callbacks added. We're guaranteed not to have any removed */
+    if (virObjectEventCallbackListCandidates(callbacks, event,
+                                             &cbs, &ncbs) < 0) {
+        VIR_WARN("Unable to look up callbacks for event %d", event->eventID);
+        return;
+    }
+
+    for (i = 0; i < ncbs; i++) {
+        virObjectEventCallbackPtr cb = cbs[i];
 
         if (!virObjectEventDispatchMatchCallback(event, cb))
             continue;
@@ -710,6 +890,8 @@ virObjectEventStateDispatchCallbacks(virObjectEventStatePtr state,
         event->dispatch(cb->conn, event, cb->cb, cb->opaque);
         virObjectLock(state);
     }
+
+    VIR_FREE(cbs);
 }
 
 
@@ -102,6 +102,7 @@ void virDomainSnapshotDefFree(virDomainSnapshotDefPtr def)
         virDomainSnapshotDiskDefClear(&def->disks[i]);
     VIR_FREE(def->disks);
     virDomainDefFree(def->dom);
+    VIR_FREE(def->domxml);
     VIR_FREE(def);
 }
 
@@ -192,9 +193,23 @@ virDomainSnapshotDiskDefParseXML(xmlNodePtr node,
     return ret;
 }
 
+static unsigned int
+virDomainSnapshotDefDomainParseFlags(unsigned int flags)
+{
+    unsigned int domainflags = VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                               VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE;
+
+    if (flags & VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL)
+        domainflags |= VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS;
+
+    return domainflags;
+}
+
 /* flags is bitwise-or of virDomainSnapshotParseFlags.
  * If flags does not include VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE, then
- * caps are ignored.
+ * caps are ignored.  With VIR_DOMAIN_SNAPSHOT_PARSE_DEFER_DOMAIN, the
+ * <domain> element is only kept as a string, to be parsed by
+ * virDomainSnapshotDefParseDomain() when it is needed.
  */
 static virDomainSnapshotDefPtr
 virDomainSnapshotDefParse(xmlXPathContextPtr ctxt,
@@ -267,10 +282,6 @@ virDomainSnapshotDefParse(xmlXPathContextPtr ctxt,
          * clients will have to decide between best effort
          * initialization or outright failure.  */
         if ((tmp = virXPathString("string(./domain/@type)", ctxt))) {
-            int domainflags = VIR_DOMAIN_DEF_PARSE_INACTIVE |
-                              VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE;
-            if (flags & VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL)
-                domainflags |= VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS;
             xmlNodePtr domainNode = virXPathNode("./domain", ctxt);
 
             VIR_FREE(tmp);
@@ -279,10 +290,17 @@ virDomainSnapshotDefParse(xmlXPathContextPtr ctxt,
                                _("missing domain in snapshot"));
                 goto cleanup;
             }
-            def->dom = virDomainDefParseNode(ctxt->node->doc, domainNode,
-                                             caps, xmlopt, NULL, domainflags);
-            if (!def->dom)
-                goto cleanup;
+            if (flags & VIR_DOMAIN_SNAPSHOT_PARSE_DEFER_DOMAIN) {
+                if (!(def->domxml = virXMLNodeToString(ctxt->node->doc,
+                                                       domainNode)))
+                    goto cleanup;
+            } else {
+                def->dom = virDomainDefParseNode(ctxt->node->doc, domainNode,
+                                                 caps, xmlopt, NULL,
+                                                 virDomainSnapshotDefDomainParseFlags(flags));
+                if (!def->dom)
+                    goto cleanup;
+            }
         } else {
             VIR_WARN("parsing older snapshot that lacks domain");
         }
@@ -428,6 +446,36 @@ virDomainSnapshotDefParseString(const char *xmlStr,
     return ret;
 }
 
+/**
+ * virDomainSnapshotDefParseDomain:
+ * @def: snapshot def object
+ * @caps: capabilities
+ * @xmlopt: XML parser configuration
+ * @flags: the virDomainSnapshotParseFlags @def was parsed with
+ *
+ * Parse the domain definition of a snapshot which was parsed with
+ * VIR_DOMAIN_SNAPSHOT_PARSE_DEFER_DOMAIN into @def->dom, unless that
+ * already happened.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virDomainSnapshotDefParseDomain(virDomainSnapshotDefPtr def,
+                                virCapsPtr caps,
+                                virDomainXMLOptionPtr xmlopt,
+                                unsigned int flags)
+{
+    if (!def->domxml)
+        return 0;
+
+    if (!(def->dom = virDomainDefParseString(def->domxml, caps, xmlopt, NULL,
+                                             virDomainSnapshotDefDomainParseFlags(flags))))
+        return -1;
+
+    VIR_FREE(def->domxml);
+    return 0;
+}
+
 
 /**
  * virDomainSnapshotDefAssignExternalNames:
@@ -736,6 +784,17 @@ char *virDomainSnapshotDefFormat(const char *domain_uuid,
             virBufferFreeAndReset(&buf);
             return NULL;
         }
+    } else if (def->domxml) {
+        /* Only the internal format is known to match what was parsed */
+        if (!internal) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("domain definition of snapshot '%s' "
+                             "was not parsed"), def->name);
+            virBufferFreeAndReset(&buf);
+            return NULL;
+        }
+        virBufferAdd(&buf, def->domxml, -1);
+        virBufferAddLit(&buf, "\n");
     } else if (domain_uuid) {
         virBufferAddLit(&buf, "<domain>\n");
         virBufferAdjustIndent(&buf, 2);
@@ -775,6 +834,7 @@ static void virDomainSnapshotObjFree(virDomainSnapshotObjPtr snapshot)
     VIR_DEBUG("obj=%p", snapshot);
 
     virDomainSnapshotDefFree(snapshot->def);
+    VIR_FREE(snapshot->children);
     VIR_FREE(snapshot);
 }
 
@@ -832,6 +892,7 @@ virDomainSnapshotObjListFree(virDomainSnapshotObjListPtr snapshots)
     if (!snapshots)
         return;
     virHashFree(snapshots->objs);
+    VIR_FREE(snapshots->metaroot.children);
     VIR_FREE(snapshots);
 }
 
@@ -933,15 +994,19 @@ virDomainSnapshotObjListGetNames(virDomainSnapshotObjListPtr snapshots,
         data.flags &= ~VIR_DOMAIN_SNAPSHOT_FILTERS_LOCATION;
 
     if (flags & VIR_DOMAIN_SNAPSHOT_LIST_DESCENDANTS) {
-        if (from->def)
-            virDomainSnapshotForEachDescendant(from,
-                                               virDomainSnapshotObjListCopyNames,
-                                               &data);
-        else if (names || data.flags)
-            virHashForEach(snapshots->objs, virDomainSnapshotObjListCopyNames,
-                           &data);
-        else
+        if (names || data.flags) {
+            if (from->def)
+                virDomainSnapshotForEachDescendant(from,
+                                                   virDomainSnapshotObjListCopyNames,
+                                                   &data);
+            else
+                virHashForEach(snapshots->objs,
+                               virDomainSnapshotObjListCopyNames, &data);
+        } else if (from->def) {
+            data.count = from->ndescendants;
+        } else {
             data.count = virHashSize(snapshots->objs);
+        }
     } else if (names || data.flags) {
         virDomainSnapshotForEachChild(from,
                                       virDomainSnapshotObjListCopyNames, &data);
@@ -995,67 +1060,167 @@ virDomainSnapshotForEachChild(virDomainSnapshotObjPtr snapshot,
                               virHashIterator iter,
                               void *data)
 {
-    virDomainSnapshotObjPtr child = snapshot->first_child;
+    size_t i;
 
-    while (child) {
-        virDomainSnapshotObjPtr next = child->sibling;
+    for (i = 0; i < snapshot->nchildren; i++) {
+        virDomainSnapshotObjPtr child = snapshot->children[i];
         (iter)(child, child->def->name, data);
-        child = next;
     }
 
     return snapshot->nchildren;
 }
 
-struct snapshot_act_on_descendant {
-    int number;
-    virHashIterator iter;
-    void *data;
-};
+/* Run iter(data) on all descendants of snapshot, while ignoring all
+ * other entries in snapshots.  Return the number of descendants
+ * visited.  Children are always visited before their parent, which
+ * lets iter free the snapshots it is given; other than that no
+ * particular ordering is guaranteed.  */
+int
+virDomainSnapshotForEachDescendant(virDomainSnapshotObjPtr snapshot,
+                                   virHashIterator iter,
+                                   void *data)
+{
+    virDomainSnapshotObjPtr node = snapshot;
+    size_t next = 0;
+    int number = 0;
+
+    /* Walk the tree through the parent links rather than recursing,
+     * snapshot chains can be thousands of levels deep */
+    for (;;) {
+        virDomainSnapshotObjPtr parent;
+
+        if (next < node->nchildren) {
+            node = node->children[next];
+            next = 0;
+            continue;
+        }
+
+        if (node == snapshot)
+            break;
+
+        parent = node->parent;
+        next = node->parent_idx + 1;
+        (iter)(node, node->def->name, data);
+        number++;
+        node = parent;
+    }
+
+    return number;
+}
+
+/* Add @count to the descendant count of @snapshot and all its
+ * ancestors.  */
+static void
+virDomainSnapshotAdjustDescendants(virDomainSnapshotObjPtr snapshot,
+                                   ssize_t count)
+{
+    while (snapshot) {
+        snapshot->ndescendants += count;
+        snapshot = snapshot->parent;
+    }
+}
 
+/* Add @snapshot to the children of @parent, leaving descendant counts
+ * alone.  */
 static int
-virDomainSnapshotActOnDescendant(void *payload,
-                                 const void *name,
-                                 void *data)
+virDomainSnapshotLink(virDomainSnapshotObjPtr snapshot,
+                      virDomainSnapshotObjPtr parent)
 {
-    virDomainSnapshotObjPtr obj = payload;
-    struct snapshot_act_on_descendant *curr = data;
+    size_t idx = parent->nchildren;
+
+    if (VIR_APPEND_ELEMENT_COPY(parent->children, parent->nchildren,
+                                snapshot) < 0)
+        return -1;
 
-    curr->number += 1 + virDomainSnapshotForEachDescendant(obj,
-                                                           curr->iter,
-                                                           curr->data);
-    (curr->iter)(payload, name, curr->data);
+    snapshot->parent = parent;
+    snapshot->parent_idx = idx;
     return 0;
 }
 
-/* Run iter(data) on all descendants of snapshot, while ignoring all
- * other entries in snapshots.  Return the number of descendants
- * visited.  No particular ordering is guaranteed.  */
+/* Remove @snapshot from the children of its parent, leaving descendant
+ * counts alone.  */
+static int
+virDomainSnapshotUnlink(virDomainSnapshotObjPtr snapshot)
+{
+    virDomainSnapshotObjPtr parent = snapshot->parent;
+    size_t idx = snapshot->parent_idx;
+
+    if (idx >= parent->nchildren || parent->children[idx] != snapshot) {
+        VIR_WARN("inconsistent snapshot relations");
+        return -1;
+    }
+
+    /* Children are unordered, so fill the hole with the last one */
+    parent->children[idx] = parent->children[parent->nchildren - 1];
+    parent->children[idx]->parent_idx = idx;
+    VIR_SHRINK_N(parent->children, parent->nchildren, 1);
+
+    snapshot->parent = NULL;
+    snapshot->parent_idx = 0;
+    return 0;
+}
+
+/* Link @snapshot below @parent, which must not be one of its
+ * descendants.  @snapshot must not have a parent yet.  Return 0 on
+ * success, -1 on OOM.  */
 int
-virDomainSnapshotForEachDescendant(virDomainSnapshotObjPtr snapshot,
-                                   virHashIterator iter,
-                                   void *data)
+virDomainSnapshotSetParent(virDomainSnapshotObjPtr snapshot,
+                           virDomainSnapshotObjPtr parent)
 {
-    struct snapshot_act_on_descendant act;
+    if (virDomainSnapshotLink(snapshot, parent) < 0)
+        return -1;
+
+    virDomainSnapshotAdjustDescendants(parent,
+                                       1 + (ssize_t)snapshot->ndescendants);
+    return 0;
+}
 
-    act.number = 0;
-    act.iter = iter;
-    act.data = data;
-    virDomainSnapshotForEachChild(snapshot,
-                                  virDomainSnapshotActOnDescendant, &act);
+/* Recompute the descendant counts of the tree below @root, which
+ * must already have its children wired up.  Return the number of
+ * snapshots below @root.  */
+static size_t
+virDomainSnapshotCountDescendants(virDomainSnapshotObjPtr root)
+{
+    virDomainSnapshotObjPtr node = root;
+    size_t next = 0;
+
+    root->ndescendants = 0;
+    for (;;) {
+        if (next < node->nchildren) {
+            node = node->children[next];
+            node->ndescendants = 0;
+            next = 0;
+            continue;
+        }
 
-    return act.number;
+        if (node == root)
+            break;
+
+        node->parent->ndescendants += 1 + node->ndescendants;
+        next = node->parent_idx + 1;
+        node = node->parent;
+    }
+
+    return root->ndescendants;
 }
 
-/* Struct and callback function used as a hash table callback; each call
- * inspects the pre-existing snapshot->def->parent field, and adjusts
- * the snapshot->parent field as well as the parent's child fields to
- * wire up the hierarchical relations for the given snapshot.  The error
- * indicator gets set if a parent is missing or a requested parent would
- * cause a circular parent chain.  */
+/* Struct and callback functions used as hash table callbacks; the
+ * first pass looks up the pre-existing snapshot->def->parent field of
+ * each snapshot and links it below that parent, or the metaroot if it
+ * is missing.  Only if some snapshots turn out not to be reachable
+ * from the metaroot afterwards, the second pass looks for the circular
+ * parent chains responsible among them and cuts them.  The error
+ * indicator gets set if a parent is missing or a requested parent
+ * would cause a circular parent chain.  */
 struct snapshot_set_relation {
     virDomainSnapshotObjListPtr snapshots;
+    size_t unreachable;
     int err;
 };
+
+/* Descendant count of snapshots not reached by
+ * virDomainSnapshotCountDescendants */
+#define SNAPSHOT_UNREACHABLE ((size_t) -1)
 static int
 virDomainSnapshotSetRelations(void *payload,
                               const void *name ATTRIBUTE_UNUSED,
@@ -1063,70 +1228,125 @@ virDomainSnapshotSetRelations(void *payload,
 {
     virDomainSnapshotObjPtr obj = payload;
     struct snapshot_set_relation *curr = data;
-    virDomainSnapshotObjPtr tmp;
+    virDomainSnapshotObjPtr parent;
 
-    obj->parent = virDomainSnapshotFindByName(curr->snapshots,
-                                              obj->def->parent);
-    if (!obj->parent) {
+    parent = virDomainSnapshotFindByName(curr->snapshots, obj->def->parent);
+    if (!parent) {
         curr->err = -1;
-        obj->parent = &curr->snapshots->metaroot;
+        parent = &curr->snapshots->metaroot;
         VIR_WARN("snapshot %s lacks parent", obj->def->name);
-    } else {
-        tmp = obj->parent;
-        while (tmp && tmp->def) {
-            if (tmp == obj) {
-                curr->err = -1;
-                obj->parent = &curr->snapshots->metaroot;
-                VIR_WARN("snapshot %s in circular chain", obj->def->name);
-                break;
-            }
-            tmp = tmp->parent;
-        }
     }
-    obj->parent->nchildren++;
-    obj->sibling = obj->parent->first_child;
-    obj->parent->first_child = obj;
+
+    /* Descendant counts are computed once everything is linked */
+    obj->ndescendants = SNAPSHOT_UNREACHABLE;
+    if (virDomainSnapshotLink(obj, parent) < 0)
+        curr->err = -1;
     return 0;
 }
 
-/* Populate parent link and child count of all snapshots, with all
- * relations starting as 0/NULL.  Return 0 on success, -1 if a parent
- * is missing or if a circular relationship was requested.  */
+static int
+virDomainSnapshotBreakCycles(void *payload,
+                             const void *name ATTRIBUTE_UNUSED,
+                             void *data)
+{
+    virDomainSnapshotObjPtr obj = payload;
+    struct snapshot_set_relation *curr = data;
+    virDomainSnapshotObjPtr tmp = obj->parent;
+    size_t steps = curr->unreachable;
+
+    /* Any cycle consists of unreachable snapshots only, so it is
+     * closed within that many steps */
+    if (obj->ndescendants != SNAPSHOT_UNREACHABLE)
+        return 0;
+
+    while (tmp && tmp->def && tmp != obj && steps-- > 0)
+        tmp = tmp->parent;
+
+    if (tmp == obj) {
+        curr->err = -1;
+        VIR_WARN("snapshot %s in circular chain", obj->def->name);
+        if (virDomainSnapshotUnlink(obj) == 0)
+            ignore_value(virDomainSnapshotLink(obj,
+                                               &curr->snapshots->metaroot));
+    }
+    return 0;
+}
+
+/* Populate parent link, children and descendant count of all
+ * snapshots, with all relations starting as 0/NULL.  Return 0 on
+ * success, -1 if a parent is missing or if a circular relationship
+ * was requested.  */
 int
 virDomainSnapshotUpdateRelations(virDomainSnapshotObjListPtr snapshots)
 {
-    struct snapshot_set_relation act = { snapshots, 0 };
+    struct snapshot_set_relation act = { snapshots, 0, 0 };
 
     virHashForEach(snapshots->objs, virDomainSnapshotSetRelations, &act);
+
+    act.unreachable = virHashSize(snapshots->objs) -
+        virDomainSnapshotCountDescendants(&snapshots->metaroot);
+    if (act.unreachable) {
+        virHashForEach(snapshots->objs, virDomainSnapshotBreakCycles, &act);
+        virDomainSnapshotCountDescendants(&snapshots->metaroot);
+    }
+
     return act.err;
 }
 
 /* Prepare to reparent or delete snapshot, by removing it from its
- * current listed parent.  Note that when bulk removing all children
- * of a parent, it is faster to just 0 the count rather than calling
- * this function on each child.  */
+ * current listed parent.  */
 void
 virDomainSnapshotDropParent(virDomainSnapshotObjPtr snapshot)
 {
-    virDomainSnapshotObjPtr prev = NULL;
-    virDomainSnapshotObjPtr curr = NULL;
-
-    snapshot->parent->nchildren--;
-    curr = snapshot->parent->first_child;
-    while (curr != snapshot) {
-        if (!curr) {
-            VIR_WARN("inconsistent snapshot relations");
-            return;
-        }
-        prev = curr;
-        curr = curr->sibling;
+    virDomainSnapshotObjPtr parent = snapshot->parent;
+
+    if (!parent || virDomainSnapshotUnlink(snapshot) < 0)
+        return;
+
+    virDomainSnapshotAdjustDescendants(parent,
+                                       -1 - (ssize_t)snapshot->ndescendants);
+}
+
+/* Make all children of @from children of @to instead, which must not
+ * be @from or one of its descendants.  Return 0 on success, -1 on OOM
+ * in which case nothing changes.  */
+int
+virDomainSnapshotMoveChildren(virDomainSnapshotObjPtr from,
+                              virDomainSnapshotObjPtr to)
+{
+    ssize_t count = from->ndescendants;
+    size_t i;
+
+    if (!from->nchildren)
+        return 0;
+
+    if (VIR_REALLOC_N(to->children, to->nchildren + from->nchildren) < 0)
+        return -1;
+
+    for (i = 0; i < from->nchildren; i++) {
+        virDomainSnapshotObjPtr child = from->children[i];
+
+        child->parent = to;
+        child->parent_idx = to->nchildren;
+        to->children[to->nchildren++] = child;
     }
-    if (prev)
-        prev->sibling = snapshot->sibling;
-    else
-        snapshot->parent->first_child = snapshot->sibling;
-    snapshot->parent = NULL;
-    snapshot->sibling = NULL;
+    VIR_FREE(from->children);
+    from->nchildren = 0;
+
+    virDomainSnapshotAdjustDescendants(from, -count);
+    virDomainSnapshotAdjustDescendants(to, count);
+    return 0;
+}
+
+/* Forget all children of @snapshot, for example after they have all
+ * been freed.  */
+void
+virDomainSnapshotDropChildren(virDomainSnapshotObjPtr snapshot)
+{
+    virDomainSnapshotAdjustDescendants(snapshot,
+                                       -(ssize_t)snapshot->ndescendants);
+    VIR_FREE(snapshot->children);
+    snapshot->nchildren = 0;
 }
 
 int
@@ -78,6 +78,8 @@ struct _virDomainSnapshotDef {
 
     /* Internal use.  */
     bool current; /* At most one snapshot in the list should have this set */
+    char *domxml; /* <domain> not parsed into dom yet, see
+                     VIR_DOMAIN_SNAPSHOT_PARSE_DEFER_DOMAIN */
 };
 
 struct _virDomainSnapshotObj {
@@ -86,9 +88,10 @@ struct _virDomainSnapshotObj {
     virDomainSnapshotObjPtr parent; /* non-NULL except for metaroot, before
                                        virDomainSnapshotUpdateRelations, or
                                        after virDomainSnapshotDropParent */
-    virDomainSnapshotObjPtr sibling; /* NULL if last child of parent */
+    size_t parent_idx; /* position in parent->children */
+    virDomainSnapshotObjPtr *children; /* in no particular order */
     size_t nchildren;
-    virDomainSnapshotObjPtr first_child; /* NULL if no children */
+    size_t ndescendants; /* all snapshots below this one */
 };
 
 virDomainSnapshotObjListPtr virDomainSnapshotObjListNew(void);
@@ -99,12 +102,17 @@ typedef enum {
     VIR_DOMAIN_SNAPSHOT_PARSE_DISKS    = 1 << 1,
     VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL = 1 << 2,
     VIR_DOMAIN_SNAPSHOT_PARSE_OFFLINE  = 1 << 3,
+    VIR_DOMAIN_SNAPSHOT_PARSE_DEFER_DOMAIN = 1 << 4,
 } virDomainSnapshotParseFlags;
 
 virDomainSnapshotDefPtr virDomainSnapshotDefParseString(const char *xmlStr,
                                                         virCapsPtr caps,
                                                         virDomainXMLOptionPtr xmlopt,
                                                         unsigned int flags);
+int virDomainSnapshotDefParseDomain(virDomainSnapshotDefPtr def,
+                                    virCapsPtr caps,
+                                    virDomainXMLOptionPtr xmlopt,
+                                    unsigned int flags);
 virDomainSnapshotDefPtr virDomainSnapshotDefParseNode(xmlDocPtr xml,
                                                       xmlNodePtr root,
                                                       virCapsPtr caps,
@@ -143,7 +151,12 @@ int virDomainSnapshotForEachDescendant(virDomainSnapshotObjPtr snapshot,
                                        virHashIterator iter,
                                        void *data);
 int virDomainSnapshotUpdateRelations(virDomainSnapshotObjListPtr snapshots);
+int virDomainSnapshotSetParent(virDomainSnapshotObjPtr snapshot,
+                               virDomainSnapshotObjPtr parent);
 void virDomainSnapshotDropParent(virDomainSnapshotObjPtr snapshot);
+int virDomainSnapshotMoveChildren(virDomainSnapshotObjPtr from,
+                                  virDomainSnapshotObjPtr to);
+void virDomainSnapshotDropChildren(virDomainSnapshotObjPtr snapshot);
 
 # define VIR_DOMAIN_SNAPSHOT_FILTERS_METADATA           \
                (VIR_DOMAIN_SNAPSHOT_LIST_METADATA     | \
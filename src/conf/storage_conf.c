@@ -66,6 +66,10 @@ VIR_ENUM_IMPL(virStoragePool,
               "sheepdog", "gluster", "zfs",
               "vstorage")
 
+VIR_ENUM_IMPL(virStoragePoolRefreshMode,
+              VIR_STORAGE_POOL_REFRESH_LAST,
+              "default", "scan", "watch")
+
 VIR_ENUM_IMPL(virStoragePoolFormatFileSystem,
               VIR_STORAGE_POOL_FS_LAST,
               "auto", "ext2", "ext3",
@@ -679,6 +683,8 @@ virStoragePoolDefParseXML(xmlXPathContextPtr ctxt)
     char *type = NULL;
     char *uuid = NULL;
     char *target_path = NULL;
+    char *refresh = NULL;
+    char *maxage = NULL;
 
     if (VIR_ALLOC(ret) < 0)
         return NULL;
@@ -803,10 +809,50 @@ virStoragePoolDefParseXML(xmlXPathContextPtr ctxt)
             goto error;
     }
 
+    if ((refresh = virXPathString("string(./refresh/@mode)", ctxt))) {
+        if ((ret->refreshMode =
+             virStoragePoolRefreshModeTypeFromString(refresh)) <= 0) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("unknown storage pool refresh mode '%s'"),
+                           refresh);
+            goto error;
+        }
+
+        if (ret->type != VIR_STORAGE_POOL_DIR &&
+            ret->type != VIR_STORAGE_POOL_FS &&
+            ret->type != VIR_STORAGE_POOL_NETFS &&
+            ret->type != VIR_STORAGE_POOL_VSTORAGE) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("refresh mode is not supported for '%s' pools"),
+                           virStoragePoolTypeToString(ret->type));
+            goto error;
+        }
+    }
+
+    if ((maxage = virXPathString("string(./refresh/allocation/@maxage)",
+                                 ctxt))) {
+        if (virStrToLong_uip(maxage, NULL, 10, &ret->allocationMaxAge) < 0) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("malformed allocation maxage value '%s'"),
+                           maxage);
+            goto error;
+        }
+
+        if (ret->type != VIR_STORAGE_POOL_RBD) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("allocation refresh policy is not supported "
+                             "for '%s' pools"),
+                           virStoragePoolTypeToString(ret->type));
+            goto error;
+        }
+    }
+
  cleanup:
     VIR_FREE(uuid);
     VIR_FREE(type);
     VIR_FREE(target_path);
+    VIR_FREE(refresh);
+    VIR_FREE(maxage);
     return ret;
 
  error:
@@ -1037,6 +1083,25 @@ virStoragePoolDefFormatBuf(virBufferPtr buf,
         virBufferAdjustIndent(buf, -2);
         virBufferAddLit(buf, "</target>\n");
     }
+
+    if (def->refreshMode != VIR_STORAGE_POOL_REFRESH_DEFAULT ||
+        def->allocationMaxAge) {
+        virBufferAddLit(buf, "<refresh");
+        if (def->refreshMode != VIR_STORAGE_POOL_REFRESH_DEFAULT)
+            virBufferAsprintf(buf, " mode='%s'",
+                              virStoragePoolRefreshModeTypeToString(def->refreshMode));
+        if (def->allocationMaxAge) {
+            virBufferAddLit(buf, ">\n");
+            virBufferAdjustIndent(buf, 2);
+            virBufferAsprintf(buf, "<allocation maxage='%u'/>\n",
+                              def->allocationMaxAge);
+            virBufferAdjustIndent(buf, -2);
+            virBufferAddLit(buf, "</refresh>\n");
+        } else {
+            virBufferAddLit(buf, "/>\n");
+        }
+    }
+
     virBufferAdjustIndent(buf, -2);
     virBufferAddLit(buf, "</pool>\n");
 
@@ -28,6 +28,7 @@
 # include "virstorageencryption.h"
 # include "virstoragefile.h"
 # include "virbitmap.h"
+# include "virhash.h"
 # include "virthread.h"
 # include "device_conf.h"
 # include "object_event.h"
@@ -59,6 +60,21 @@ struct _virStorageVolSource {
 };
 
 
+/*
+ * Identity of the local file a volume was probed from, which lets
+ * a refresh of the pool skip files that have not changed since
+ */
+typedef struct _virStorageVolFingerprint virStorageVolFingerprint;
+typedef virStorageVolFingerprint *virStorageVolFingerprintPtr;
+struct _virStorageVolFingerprint {
+    bool valid;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+};
+
 typedef struct _virStorageVolDef virStorageVolDef;
 typedef virStorageVolDef *virStorageVolDefPtr;
 struct _virStorageVolDef {
@@ -71,6 +87,12 @@ struct _virStorageVolDef {
 
     virStorageVolSource source;
     virStorageSource target;
+
+    virStorageVolFingerprint fingerprint;
+
+    /* When the backend last computed target.allocation the costly way,
+     * 0 if it didn't */
+    time_t allocationTime;
 };
 
 typedef struct _virStorageVolDefList virStorageVolDefList;
@@ -78,6 +100,11 @@ typedef virStorageVolDefList *virStorageVolDefListPtr;
 struct _virStorageVolDefList {
     size_t count;
     virStorageVolDefPtr *objs;
+
+    /* Lookup indexes into @objs, see virStoragePoolObjAddVol */
+    virHashTablePtr objsName;
+    virHashTablePtr objsKey;
+    virHashTablePtr objsPath;
 };
 
 VIR_ENUM_DECL(virStorageVol)
@@ -102,6 +129,16 @@ typedef enum {
 
 VIR_ENUM_DECL(virStoragePool)
 
+typedef enum {
+    VIR_STORAGE_POOL_REFRESH_DEFAULT = 0,
+    VIR_STORAGE_POOL_REFRESH_SCAN,     /* Rescan the pool on refresh */
+    VIR_STORAGE_POOL_REFRESH_WATCH,    /* Also follow changes with inotify */
+
+    VIR_STORAGE_POOL_REFRESH_LAST,
+} virStoragePoolRefreshMode;
+
+VIR_ENUM_DECL(virStoragePoolRefreshMode)
+
 typedef enum {
     VIR_STORAGE_DEVICE_TYPE_DISK = 0x00,
     VIR_STORAGE_DEVICE_TYPE_ROM = 0x05,
@@ -229,6 +266,9 @@ struct _virStoragePoolDef {
 
     virStoragePoolSource source;
     virStoragePoolTarget target;
+
+    int refreshMode; /* virStoragePoolRefreshMode */
+    unsigned int allocationMaxAge; /* seconds, 0 to always recompute */
 };
 
 typedef struct _virStoragePoolSourceList virStoragePoolSourceList;
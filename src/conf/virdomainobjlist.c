@@ -32,6 +32,8 @@
 #include "virfile.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virthreadpool.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -42,7 +44,9 @@ static void virDomainObjListDispose(void *obj);
 
 
 struct _virDomainObjList {
-    virObjectLockable parent;
+    /* Lookups and listings only take the lock for reading, anything
+     * modifying the hash tables takes it for writing */
+    virObjectRWLockable parent;
 
     /* uuid string -> virDomainObj  mapping
      * for O(1), lockless lookup-by-uuid */
@@ -56,7 +60,7 @@ struct _virDomainObjList {
 
 static int virDomainObjListOnceInit(void)
 {
-    if (!(virDomainObjListClass = virClassNew(virClassForObjectLockable(),
+    if (!(virDomainObjListClass = virClassNew(virClassForObjectRWLockable(),
                                               "virDomainObjList",
                                               sizeof(virDomainObjList),
                                               virDomainObjListDispose)))
@@ -74,11 +78,14 @@ virDomainObjListPtr virDomainObjListNew(void)
     if (virDomainObjListInitialize() < 0)
         return NULL;
 
-    if (!(doms = virObjectLockableNew(virDomainObjListClass)))
+    if (!(doms = virObjectRWLockableNew(virDomainObjListClass)))
         return NULL;
 
-    if (!(doms->objs = virHashCreate(50, virObjectFreeHashData)) ||
-        !(doms->objsName = virHashCreate(50, virObjectFreeHashData))) {
+    /* Lookups by UUID and name are hot with many domains defined */
+    if (!(doms->objs = virHashCreateFlags(50, virObjectFreeHashData,
+                                          VIR_HASH_OPEN_ADDRESSING)) ||
+        !(doms->objsName = virHashCreateFlags(50, virObjectFreeHashData,
+                                              VIR_HASH_OPEN_ADDRESSING))) {
         virObjectUnref(doms);
         return NULL;
     }
@@ -118,11 +125,11 @@ virDomainObjListFindByIDInternal(virDomainObjListPtr doms,
                                  bool ref)
 {
     virDomainObjPtr obj;
-    virObjectLock(doms);
+    virObjectRWLockRead(doms);
     obj = virHashSearch(doms->objs, virDomainObjListSearchID, &id);
     if (ref) {
         virObjectRef(obj);
-        virObjectUnlock(doms);
+        virObjectRWUnlock(doms);
     }
     if (obj) {
         virObjectLock(obj);
@@ -134,7 +141,7 @@ virDomainObjListFindByIDInternal(virDomainObjListPtr doms,
         }
     }
     if (!ref)
-        virObjectUnlock(doms);
+        virObjectRWUnlock(doms);
     return obj;
 }
 
@@ -160,13 +167,13 @@ virDomainObjListFindByUUIDInternal(virDomainObjListPtr doms,
     char uuidstr[VIR_UUID_STRING_BUFLEN];
     virDomainObjPtr obj;
 
-    virObjectLock(doms);
+    virObjectRWLockRead(doms);
     virUUIDFormat(uuid, uuidstr);
 
     obj = virHashLookup(doms->objs, uuidstr);
     if (ref) {
         virObjectRef(obj);
-        virObjectUnlock(doms);
+        virObjectRWUnlock(doms);
     }
     if (obj) {
         virObjectLock(obj);
@@ -178,7 +185,7 @@ virDomainObjListFindByUUIDInternal(virDomainObjListPtr doms,
         }
     }
     if (!ref)
-        virObjectUnlock(doms);
+        virObjectRWUnlock(doms);
     return obj;
 }
 
@@ -204,10 +211,10 @@ virDomainObjPtr virDomainObjListFindByName(virDomainObjListPtr doms,
 {
     virDomainObjPtr obj;
 
-    virObjectLock(doms);
+    virObjectRWLockRead(doms);
     obj = virHashLookup(doms->objsName, name);
     virObjectRef(obj);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     if (obj) {
         virObjectLock(obj);
         if (obj->removing) {
@@ -327,9 +334,9 @@ virDomainObjPtr virDomainObjListAdd(virDomainObjListPtr doms,
 {
     virDomainObjPtr ret;
 
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     ret = virDomainObjListAddLocked(doms, def, xmlopt, flags, oldDef);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     return ret;
 }
 
@@ -349,13 +356,13 @@ void virDomainObjListRemove(virDomainObjListPtr doms,
     virObjectRef(dom);
     virObjectUnlock(dom);
 
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     virObjectLock(dom);
     virHashRemoveEntry(doms->objs, uuidstr);
     virHashRemoveEntry(doms->objsName, dom->def->name);
     virObjectUnlock(dom);
     virObjectUnref(dom);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
 }
 
 
@@ -394,7 +401,7 @@ virDomainObjListRename(virDomainObjListPtr doms,
      * hold a lock on dom but not refcount it. */
     virObjectRef(dom);
     virObjectUnlock(dom);
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     virObjectLock(dom);
     virObjectUnref(dom);
 
@@ -420,7 +427,7 @@ virDomainObjListRename(virDomainObjListPtr doms,
 
     ret = 0;
  cleanup:
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     VIR_FREE(old_name);
     return ret;
 }
@@ -444,21 +451,16 @@ void virDomainObjListRemoveLocked(virDomainObjListPtr doms,
 }
 
 
-static virDomainObjPtr
-virDomainObjListLoadConfig(virDomainObjListPtr doms,
-                           virCapsPtr caps,
-                           virDomainXMLOptionPtr xmlopt,
-                           const char *configDir,
-                           const char *autostartDir,
-                           const char *name,
-                           virDomainLoadConfigNotify notify,
-                           void *opaque)
+static virDomainDefPtr
+virDomainObjListParseConfig(virCapsPtr caps,
+                            virDomainXMLOptionPtr xmlopt,
+                            const char *configDir,
+                            const char *autostartDir,
+                            const char *name,
+                            int *autostart)
 {
     char *configFile = NULL, *autostartLink = NULL;
     virDomainDefPtr def = NULL;
-    virDomainObjPtr dom;
-    int autostart;
-    virDomainDefPtr oldDef = NULL;
 
     if ((configFile = virDomainConfigFile(configDir, name)) == NULL)
         goto error;
@@ -471,21 +473,12 @@ virDomainObjListLoadConfig(virDomainObjListPtr doms,
     if ((autostartLink = virDomainConfigFile(autostartDir, name)) == NULL)
         goto error;
 
-    if ((autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
+    if ((*autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
         goto error;
 
-    if (!(dom = virDomainObjListAddLocked(doms, def, xmlopt, 0, &oldDef)))
-        goto error;
-
-    dom->autostart = autostart;
-
-    if (notify)
-        (*notify)(dom, oldDef == NULL, opaque);
-
-    virDomainDefFree(oldDef);
     VIR_FREE(configFile);
     VIR_FREE(autostartLink);
-    return dom;
+    return def;
 
  error:
     VIR_FREE(configFile);
@@ -496,28 +489,62 @@ virDomainObjListLoadConfig(virDomainObjListPtr doms,
 
 
 static virDomainObjPtr
-virDomainObjListLoadStatus(virDomainObjListPtr doms,
-                           const char *statusDir,
-                           const char *name,
-                           virCapsPtr caps,
+virDomainObjListLoadConfig(virDomainObjListPtr doms,
+                           virDomainDefPtr def,
+                           int autostart,
                            virDomainXMLOptionPtr xmlopt,
                            virDomainLoadConfigNotify notify,
                            void *opaque)
+{
+    virDomainObjPtr dom;
+    virDomainDefPtr oldDef = NULL;
+
+    if (!(dom = virDomainObjListAddLocked(doms, def, xmlopt, 0, &oldDef))) {
+        virDomainDefFree(def);
+        return NULL;
+    }
+
+    dom->autostart = autostart;
+
+    if (notify)
+        (*notify)(dom, oldDef == NULL, opaque);
+
+    virDomainDefFree(oldDef);
+    return dom;
+}
+
+
+static virDomainObjPtr
+virDomainObjListParseStatus(const char *statusDir,
+                            const char *name,
+                            virCapsPtr caps,
+                            virDomainXMLOptionPtr xmlopt)
 {
     char *statusFile = NULL;
     virDomainObjPtr obj = NULL;
-    char uuidstr[VIR_UUID_STRING_BUFLEN];
 
     if ((statusFile = virDomainConfigFile(statusDir, name)) == NULL)
-        goto error;
+        return NULL;
 
-    if (!(obj = virDomainObjParseFile(statusFile, caps, xmlopt,
-                                      VIR_DOMAIN_DEF_PARSE_STATUS |
-                                      VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
-                                      VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
-        goto error;
+    obj = virDomainObjParseFile(statusFile, caps, xmlopt,
+                                VIR_DOMAIN_DEF_PARSE_STATUS |
+                                VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
+                                VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
+                                VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
+                                VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE);
+
+    VIR_FREE(statusFile);
+    return obj;
+}
+
+
+static virDomainObjPtr
+virDomainObjListLoadStatus(virDomainObjListPtr doms,
+                           virDomainObjPtr obj,
+                           virDomainLoadConfigNotify notify,
+                           void *opaque)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
 
     virUUIDFormat(obj->def->uuid, uuidstr);
 
@@ -543,16 +570,56 @@ virDomainObjListLoadStatus(virDomainObjListPtr doms,
     if (notify)
         (*notify)(obj, 1, opaque);
 
-    VIR_FREE(statusFile);
     return obj;
 
  error:
     virObjectUnref(obj);
-    VIR_FREE(statusFile);
     return NULL;
 }
 
 
+typedef struct _virDomainObjListLoadEntry virDomainObjListLoadEntry;
+typedef virDomainObjListLoadEntry *virDomainObjListLoadEntryPtr;
+struct _virDomainObjListLoadEntry {
+    char *name;
+    virDomainDefPtr def;    /* persistent config */
+    int autostart;
+    virDomainObjPtr obj;    /* live status */
+};
+
+struct virDomainObjListLoadData {
+    const char *configDir;
+    const char *autostartDir;
+    int liveStatus;
+    virCapsPtr caps;
+    virDomainXMLOptionPtr xmlopt;
+    virDomainObjListLoadEntryPtr entries;
+};
+
+
+static void
+virDomainObjListParseEntry(size_t idx,
+                           void *opaque)
+{
+    struct virDomainObjListLoadData *data = opaque;
+    virDomainObjListLoadEntryPtr entry = &data->entries[idx];
+
+    VIR_INFO("Loading config file '%s.xml'", entry->name);
+    if (data->liveStatus)
+        entry->obj = virDomainObjListParseStatus(data->configDir,
+                                                 entry->name,
+                                                 data->caps,
+                                                 data->xmlopt);
+    else
+        entry->def = virDomainObjListParseConfig(data->caps,
+                                                 data->xmlopt,
+                                                 data->configDir,
+                                                 data->autostartDir,
+                                                 entry->name,
+                                                 &entry->autostart);
+}
+
+
 int
 virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                const char *configDir,
@@ -565,6 +632,16 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
 {
     DIR *dir;
     struct dirent *entry;
+    struct virDomainObjListLoadData data = {
+        .configDir = configDir, .autostartDir = autostartDir,
+        .liveStatus = liveStatus, .caps = caps, .xmlopt = xmlopt,
+        .entries = NULL,
+    };
+    size_t nentries = 0;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
+    size_t nloaded = 0;
+    size_t i;
     int ret = -1;
     int rc;
 
@@ -573,43 +650,73 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
     if ((rc = virDirOpenIfExists(&dir, configDir)) <= 0)
         return rc;
 
-    virObjectLock(doms);
+    ignore_value(virTimeMillisNow(&start));
 
     while ((ret = virDirRead(dir, &entry, configDir)) > 0) {
-        virDomainObjPtr dom;
+        virDomainObjListLoadEntry tmp = { 0 };
 
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        VIR_INFO("Loading config file '%s.xml'", entry->d_name);
-        if (liveStatus)
-            dom = virDomainObjListLoadStatus(doms,
-                                             configDir,
-                                             entry->d_name,
-                                             caps,
-                                             xmlopt,
-                                             notify,
-                                             opaque);
-        else
-            dom = virDomainObjListLoadConfig(doms,
-                                             caps,
-                                             xmlopt,
-                                             configDir,
-                                             autostartDir,
-                                             entry->d_name,
-                                             notify,
-                                             opaque);
+        if (VIR_STRDUP(tmp.name, entry->d_name) < 0 ||
+            VIR_APPEND_ELEMENT(data.entries, nentries, tmp) < 0) {
+            VIR_FREE(tmp.name);
+            ret = -1;
+            break;
+        }
+    }
+
+    VIR_DIR_CLOSE(dir);
+
+    if (ret < 0)
+        goto cleanup;
+
+    /* Parsing is by far the most expensive part and doesn't need the
+     * list, so do it in parallel. The results are then added in the
+     * directory order so that nothing changes for the notify callback.
+     * NB: ignoring errors, so one malformed config doesn't
+     * kill the whole process */
+    virThreadPoolParallelFor(nentries, 0, virDomainObjListParseEntry, &data);
+
+    virObjectRWLockWrite(doms);
+
+    for (i = 0; i < nentries; i++) {
+        virDomainObjPtr dom = NULL;
+
+        if (liveStatus) {
+            if (data.entries[i].obj)
+                dom = virDomainObjListLoadStatus(doms, data.entries[i].obj,
+                                                 notify, opaque);
+        } else {
+            if (data.entries[i].def)
+                dom = virDomainObjListLoadConfig(doms, data.entries[i].def,
+                                                 data.entries[i].autostart,
+                                                 xmlopt, notify, opaque);
+        }
+        data.entries[i].obj = NULL;
+        data.entries[i].def = NULL;
+
         if (dom) {
             if (!liveStatus)
                 dom->persistent = 1;
             virObjectUnlock(dom);
+            nloaded++;
         }
     }
 
-    VIR_DIR_CLOSE(dir);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
+
+    ignore_value(virTimeMillisNow(&end));
+    VIR_INFO("Loaded %zu of %zu configs from %s in %llu ms",
+             nloaded, nentries, configDir, end - start);
+
+ cleanup:
+    for (i = 0; i < nentries; i++) {
+        VIR_FREE(data.entries[i].name);
+        virDomainDefFree(data.entries[i].def);
+        virObjectUnref(data.entries[i].obj);
+    }
+    VIR_FREE(data.entries);
     return ret;
 }
 
@@ -653,9 +760,9 @@ virDomainObjListNumOfDomains(virDomainObjListPtr doms,
                              virConnectPtr conn)
 {
     struct virDomainObjListData data = { filter, conn, active, 0 };
-    virObjectLock(doms);
-    virHashForEach(doms->objs, virDomainObjListCount, &data);
-    virObjectUnlock(doms);
+    virObjectRWLockRead(doms);
+    virHashForEachReadOnly(doms->objs, virDomainObjListCount, &data);
+    virObjectRWUnlock(doms);
     return data.count;
 }
 
@@ -697,9 +804,10 @@ virDomainObjListGetActiveIDs(virDomainObjListPtr doms,
 {
     struct virDomainIDData data = { filter, conn,
                                     0, maxids, ids };
-    virObjectLock(doms);
-    virHashForEach(doms->objs, virDomainObjListCopyActiveIDs, &data);
-    virObjectUnlock(doms);
+    virObjectRWLockRead(doms);
+    virHashForEachReadOnly(doms->objs, virDomainObjListCopyActiveIDs,
+                           &data);
+    virObjectRWUnlock(doms);
     return data.numids;
 }
 
@@ -751,9 +859,10 @@ virDomainObjListGetInactiveNames(virDomainObjListPtr doms,
     struct virDomainNameData data = { filter, conn,
                                       0, 0, maxnames, names };
     size_t i;
-    virObjectLock(doms);
-    virHashForEach(doms->objs, virDomainObjListCopyInactiveNames, &data);
-    virObjectUnlock(doms);
+    virObjectRWLockRead(doms);
+    virHashForEachReadOnly(doms->objs, virDomainObjListCopyInactiveNames,
+                           &data);
+    virObjectRWUnlock(doms);
     if (data.oom) {
         for (i = 0; i < data.numnames; i++)
             VIR_FREE(data.names[i]);
@@ -792,9 +901,9 @@ virDomainObjListForEach(virDomainObjListPtr doms,
     struct virDomainListIterData data = {
         callback, opaque, 0,
     };
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     virHashForEach(doms->objs, virDomainObjListHelper, &data);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     return data.ret;
 }
 
@@ -925,15 +1034,16 @@ virDomainObjListCollect(virDomainObjListPtr domlist,
 {
     struct virDomainListData data = { NULL, 0 };
 
-    virObjectLock(domlist);
+    virObjectRWLockRead(domlist);
     sa_assert(domlist->objs);
     if (VIR_ALLOC_N(data.vms, virHashSize(domlist->objs)) < 0) {
-        virObjectUnlock(domlist);
+        virObjectRWUnlock(domlist);
         return -1;
     }
 
-    virHashForEach(domlist->objs, virDomainObjListCollectIterator, &data);
-    virObjectUnlock(domlist);
+    virHashForEachReadOnly(domlist->objs, virDomainObjListCollectIterator,
+                           &data);
+    virObjectRWUnlock(domlist);
 
     virDomainObjListFilter(&data.vms, &data.nvms, conn, filter, flags);
 
@@ -962,7 +1072,7 @@ virDomainObjListConvert(virDomainObjListPtr domlist,
     *nvms = 0;
     *vms = NULL;
 
-    virObjectLock(domlist);
+    virObjectRWLockRead(domlist);
     for (i = 0; i < ndoms; i++) {
         virDomainPtr dom = doms[i];
 
@@ -972,7 +1082,7 @@ virDomainObjListConvert(virDomainObjListPtr domlist,
             if (skip_missing)
                 continue;
 
-            virObjectUnlock(domlist);
+            virObjectRWUnlock(domlist);
             virReportError(VIR_ERR_NO_DOMAIN,
                            _("no domain with matching uuid '%s' (%s)"),
                            uuidstr, dom->name);
@@ -982,12 +1092,12 @@ virDomainObjListConvert(virDomainObjListPtr domlist,
         virObjectRef(vm);
 
         if (VIR_APPEND_ELEMENT(*vms, *nvms, vm) < 0) {
-            virObjectUnlock(domlist);
+            virObjectRWUnlock(domlist);
             virObjectUnref(vm);
             goto error;
         }
     }
-    virObjectUnlock(domlist);
+    virObjectRWUnlock(domlist);
 
     sa_assert(*vms);
     virDomainObjListFilter(vms, nvms, conn, filter, flags);
@@ -29,6 +29,8 @@
 #include "virhash.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virthreadpool.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NETWORK
 
@@ -40,7 +42,19 @@ VIR_LOG_INIT("conf.virnetworkobj");
 struct _virNetworkObjList {
     virObjectLockable parent;
 
+    /* uuid string -> virNetworkObj mapping
+     * for O(1), lookup-by-uuid */
     virHashTablePtr objs;
+
+    /* name -> virNetworkObj mapping
+     * for O(1), lookup-by-name */
+    virHashTablePtr objsName;
+
+    /* bridge name -> virNetworkObj mapping for O(1) lookup-by-bridge.
+     * Every bridge used by a network in @objs has an entry, but the
+     * entry might be stale or point to just one of several networks
+     * claiming the same bridge. See virNetworkObjBridgeInUse(). */
+    virHashTablePtr objsBridge;
 };
 
 static virClassPtr virNetworkObjClass;
@@ -118,7 +132,9 @@ virNetworkObjListNew(void)
     if (!(nets = virObjectLockableNew(virNetworkObjListClass)))
         return NULL;
 
-    if (!(nets->objs = virHashCreate(50, virObjectFreeHashData))) {
+    if (!(nets->objs = virHashCreate(50, virObjectFreeHashData)) ||
+        !(nets->objsName = virHashCreate(50, virObjectFreeHashData)) ||
+        !(nets->objsBridge = virHashCreate(50, virObjectFreeHashData))) {
         virObjectUnref(nets);
         return NULL;
     }
@@ -177,22 +193,6 @@ virNetworkObjFindByUUID(virNetworkObjListPtr nets,
 }
 
 
-static int
-virNetworkObjSearchName(const void *payload,
-                        const void *name ATTRIBUTE_UNUSED,
-                        const void *data)
-{
-    virNetworkObjPtr net = (virNetworkObjPtr) payload;
-    int want = 0;
-
-    virObjectLock(net);
-    if (STREQ(net->def->name, (const char *)data))
-        want = 1;
-    virObjectUnlock(net);
-    return want;
-}
-
-
 /*
  * virNetworkObjFindByNameLocked:
  * @nets: list of network objects
@@ -208,7 +208,7 @@ virNetworkObjFindByNameLocked(virNetworkObjListPtr nets,
 {
     virNetworkObjPtr ret = NULL;
 
-    ret = virHashSearch(nets->objs, virNetworkObjSearchName, name);
+    ret = virHashLookup(nets->objsName, name);
     if (ret)
         virObjectRef(ret);
     return ret;
@@ -272,6 +272,101 @@ virNetworkObjListDispose(void *obj)
     virNetworkObjListPtr nets = obj;
 
     virHashFree(nets->objs);
+    virHashFree(nets->objsName);
+    virHashFree(nets->objsBridge);
+}
+
+
+struct virNetworkObjBridgeInUseHelperData {
+    const char *bridge;
+    const char *skipname;
+};
+
+static int
+virNetworkObjBridgeInUseHelper(const void *payload,
+                               const void *name ATTRIBUTE_UNUSED,
+                               const void *opaque)
+{
+    int ret;
+    virNetworkObjPtr net = (virNetworkObjPtr) payload;
+    const struct virNetworkObjBridgeInUseHelperData *data = opaque;
+
+    virObjectLock(net);
+    if (data->skipname &&
+        ((net->def && STREQ(net->def->name, data->skipname)) ||
+         (net->newDef && STREQ(net->newDef->name, data->skipname))))
+        ret = 0;
+    else if ((net->def && net->def->bridge &&
+              STREQ(net->def->bridge, data->bridge)) ||
+             (net->newDef && net->newDef->bridge &&
+              STREQ(net->newDef->bridge, data->bridge)))
+        ret = 1;
+    else
+        ret = 0;
+    virObjectUnlock(net);
+    return ret;
+}
+
+
+/*
+ * virNetworkObjListAddBridgeLocked:
+ * @nets: list of network objects, locked
+ * @net: network object
+ * @def: definition of @net
+ *
+ * Record that the bridge of @def is used by @net. Any previous
+ * entry for the same bridge is replaced.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+virNetworkObjListAddBridgeLocked(virNetworkObjListPtr nets,
+                                 virNetworkObjPtr net,
+                                 virNetworkDefPtr def)
+{
+    if (!def || !def->bridge ||
+        virHashLookup(nets->objsBridge, def->bridge) == net)
+        return 0;
+
+    if (virHashUpdateEntry(nets->objsBridge, def->bridge, net) < 0)
+        return -1;
+
+    virObjectRef(net);
+    return 0;
+}
+
+
+static int
+virNetworkObjListRebuildBridgesHelper(void *payload,
+                                      const void *name ATTRIBUTE_UNUSED,
+                                      void *opaque)
+{
+    virNetworkObjPtr net = payload;
+    virNetworkObjListPtr nets = opaque;
+    int ret = 0;
+
+    virObjectLock(net);
+    if (virNetworkObjListAddBridgeLocked(nets, net, net->def) < 0 ||
+        virNetworkObjListAddBridgeLocked(nets, net, net->newDef) < 0)
+        ret = -1;
+    virObjectUnlock(net);
+    return ret;
+}
+
+
+/*
+ * virNetworkObjListRebuildBridgesLocked:
+ * @nets: list of network objects, locked
+ *
+ * Drop all the bridge entries and recreate them from the networks
+ * currently in @nets. This gets rid both of stale entries and of
+ * those pointing to networks being removed from the list.
+ */
+static void
+virNetworkObjListRebuildBridgesLocked(virNetworkObjListPtr nets)
+{
+    virHashRemoveAll(nets->objsBridge);
+    virHashForEach(nets->objs, virNetworkObjListRebuildBridgesHelper, nets);
 }
 
 
@@ -378,6 +473,12 @@ virNetworkObjAssignDefLocked(virNetworkObjListPtr nets,
             }
         }
 
+        /* The new definition might come with a different bridge. The
+         * entries for the bridges used by the current definitions are
+         * left in place, they are only stale once @def replaces them. */
+        if (virNetworkObjListAddBridgeLocked(nets, network, def) < 0)
+            goto cleanup;
+
         virNetworkObjUpdateAssignDef(network,
                                      def,
                                      !!(flags & VIR_NETWORK_OBJ_LIST_ADD_LIVE));
@@ -401,6 +502,19 @@ virNetworkObjAssignDefLocked(virNetworkObjListPtr nets,
         if (virHashAddEntry(nets->objs, uuidstr, network) < 0)
             goto cleanup;
 
+        if (virHashAddEntry(nets->objsName, def->name, network) < 0) {
+            virHashSteal(nets->objs, uuidstr);
+            goto cleanup;
+        }
+        virObjectRef(network);
+
+        if (virNetworkObjListAddBridgeLocked(nets, network, def) < 0) {
+            virHashSteal(nets->objsName, def->name);
+            virObjectUnref(network);
+            virHashSteal(nets->objs, uuidstr);
+            goto cleanup;
+        }
+
         network->def = def;
         network->persistent = !(flags & VIR_NETWORK_OBJ_LIST_ADD_LIVE);
         virObjectRef(network);
@@ -591,6 +705,8 @@ virNetworkObjRemoveInactive(virNetworkObjListPtr nets,
     virObjectLock(nets);
     virObjectLock(net);
     virHashRemoveEntry(nets->objs, uuidstr);
+    virHashRemoveEntry(nets->objsName, net->def->name);
+    virNetworkObjListRebuildBridgesLocked(nets);
     virObjectUnlock(nets);
     virObjectUnref(net);
 }
@@ -783,23 +899,21 @@ virNetworkLoadState(virNetworkObjListPtr nets,
 }
 
 
-static virNetworkObjPtr
-virNetworkLoadConfig(virNetworkObjListPtr nets,
-                     const char *configDir,
-                     const char *autostartDir,
-                     const char *name)
+static virNetworkDefPtr
+virNetworkParseConfig(const char *configDir,
+                      const char *autostartDir,
+                      const char *name,
+                      int *autostart)
 {
     char *configFile = NULL, *autostartLink = NULL;
     virNetworkDefPtr def = NULL;
-    virNetworkObjPtr net;
-    int autostart;
 
     if ((configFile = virNetworkConfigFile(configDir, name)) == NULL)
         goto error;
     if ((autostartLink = virNetworkConfigFile(autostartDir, name)) == NULL)
         goto error;
 
-    if ((autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
+    if ((*autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
         goto error;
 
     if (!(def = virNetworkDefParseFile(configFile)))
@@ -828,15 +942,10 @@ virNetworkLoadConfig(virNetworkObjListPtr nets,
         def->mac_specified = false;
     }
 
-    if (!(net = virNetworkObjAssignDef(nets, def, 0)))
-        goto error;
-
-    net->autostart = autostart;
-
     VIR_FREE(configFile);
     VIR_FREE(autostartLink);
 
-    return net;
+    return def;
 
  error:
     VIR_FREE(configFile);
@@ -846,6 +955,24 @@ virNetworkLoadConfig(virNetworkObjListPtr nets,
 }
 
 
+static virNetworkObjPtr
+virNetworkLoadConfig(virNetworkObjListPtr nets,
+                     virNetworkDefPtr def,
+                     int autostart)
+{
+    virNetworkObjPtr net;
+
+    if (!(net = virNetworkObjAssignDef(nets, def, 0))) {
+        virNetworkDefFree(def);
+        return NULL;
+    }
+
+    net->autostart = autostart;
+
+    return net;
+}
+
+
 int
 virNetworkObjLoadAllState(virNetworkObjListPtr nets,
                           const char *stateDir)
@@ -873,6 +1000,35 @@ virNetworkObjLoadAllState(virNetworkObjListPtr nets,
 }
 
 
+typedef struct _virNetworkObjLoadEntry virNetworkObjLoadEntry;
+typedef virNetworkObjLoadEntry *virNetworkObjLoadEntryPtr;
+struct _virNetworkObjLoadEntry {
+    char *name;
+    virNetworkDefPtr def;
+    int autostart;
+};
+
+struct virNetworkObjLoadData {
+    const char *configDir;
+    const char *autostartDir;
+    virNetworkObjLoadEntryPtr entries;
+};
+
+
+static void
+virNetworkObjParseEntry(size_t idx,
+                        void *opaque)
+{
+    struct virNetworkObjLoadData *data = opaque;
+    virNetworkObjLoadEntryPtr entry = &data->entries[idx];
+
+    entry->def = virNetworkParseConfig(data->configDir,
+                                       data->autostartDir,
+                                       entry->name,
+                                       &entry->autostart);
+}
+
+
 int
 virNetworkObjLoadAllConfigs(virNetworkObjListPtr nets,
                             const char *configDir,
@@ -880,28 +1036,67 @@ virNetworkObjLoadAllConfigs(virNetworkObjListPtr nets,
 {
     DIR *dir;
     struct dirent *entry;
+    struct virNetworkObjLoadData data = {
+        .configDir = configDir, .autostartDir = autostartDir,
+        .entries = NULL,
+    };
+    size_t nentries = 0;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
+    size_t i;
     int ret = -1;
     int rc;
 
     if ((rc = virDirOpenIfExists(&dir, configDir)) <= 0)
         return rc;
 
+    ignore_value(virTimeMillisNow(&start));
+
     while ((ret = virDirRead(dir, &entry, configDir)) > 0) {
-        virNetworkObjPtr net;
+        virNetworkObjLoadEntry tmp = { 0 };
 
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        net = virNetworkLoadConfig(nets,
-                                   configDir,
-                                   autostartDir,
-                                   entry->d_name);
-        virNetworkObjEndAPI(&net);
+        if (VIR_STRDUP(tmp.name, entry->d_name) < 0 ||
+            VIR_APPEND_ELEMENT(data.entries, nentries, tmp) < 0) {
+            VIR_FREE(tmp.name);
+            ret = -1;
+            break;
+        }
     }
 
     VIR_DIR_CLOSE(dir);
+
+    if (ret < 0)
+        goto cleanup;
+
+    /* NB: ignoring errors, so one malformed config doesn't
+       kill the whole process */
+    virThreadPoolParallelFor(nentries, 0, virNetworkObjParseEntry, &data);
+
+    for (i = 0; i < nentries; i++) {
+        virNetworkObjPtr net;
+
+        if (!data.entries[i].def)
+            continue;
+
+        net = virNetworkLoadConfig(nets, data.entries[i].def,
+                                   data.entries[i].autostart);
+        data.entries[i].def = NULL;
+        virNetworkObjEndAPI(&net);
+    }
+
+    ignore_value(virTimeMillisNow(&end));
+    VIR_INFO("Loaded %zu network configs from %s in %llu ms",
+             nentries, configDir, end - start);
+
+ cleanup:
+    for (i = 0; i < nentries; i++) {
+        VIR_FREE(data.entries[i].name);
+        virNetworkDefFree(data.entries[i].def);
+    }
+    VIR_FREE(data.entries);
     return ret;
 }
 
@@ -940,37 +1135,6 @@ virNetworkObjDeleteConfig(const char *configDir,
 }
 
 
-struct virNetworkObjBridgeInUseHelperData {
-    const char *bridge;
-    const char *skipname;
-};
-
-static int
-virNetworkObjBridgeInUseHelper(const void *payload,
-                               const void *name ATTRIBUTE_UNUSED,
-                               const void *opaque)
-{
-    int ret;
-    virNetworkObjPtr net = (virNetworkObjPtr) payload;
-    const struct virNetworkObjBridgeInUseHelperData *data = opaque;
-
-    virObjectLock(net);
-    if (data->skipname &&
-        ((net->def && STREQ(net->def->name, data->skipname)) ||
-         (net->newDef && STREQ(net->newDef->name, data->skipname))))
-        ret = 0;
-    else if ((net->def && net->def->bridge &&
-              STREQ(net->def->bridge, data->bridge)) ||
-             (net->newDef && net->newDef->bridge &&
-              STREQ(net->newDef->bridge, data->bridge)))
-        ret = 1;
-    else
-        ret = 0;
-    virObjectUnlock(net);
-    return ret;
-}
-
-
 int
 virNetworkObjBridgeInUse(virNetworkObjListPtr nets,
                          const char *bridge,
@@ -978,12 +1142,22 @@ virNetworkObjBridgeInUse(virNetworkObjListPtr nets,
 {
     virNetworkObjPtr obj;
     struct virNetworkObjBridgeInUseHelperData data = {bridge, skipname};
+    int ret;
 
     virObjectLock(nets);
-    obj = virHashSearch(nets->objs, virNetworkObjBridgeInUseHelper, &data);
+    if (!(obj = virHashLookup(nets->objsBridge, bridge))) {
+        ret = 0;
+    } else if (virNetworkObjBridgeInUseHelper(obj, NULL, &data)) {
+        ret = 1;
+    } else {
+        /* The entry is either stale or it points to @skipname, but
+         * some other network might still use @bridge */
+        obj = virHashSearch(nets->objs, virNetworkObjBridgeInUseHelper, &data);
+        ret = obj != NULL;
+    }
     virObjectUnlock(nets);
 
-    return obj != NULL;
+    return ret;
 }
 
 
@@ -1333,6 +1507,7 @@ virNetworkObjListNumOfNetworks(virNetworkObjListPtr nets,
 
 
 struct virNetworkObjListPruneHelperData {
+    virNetworkObjListPtr nets;
     unsigned int flags;
 };
 
@@ -1347,6 +1522,8 @@ virNetworkObjListPruneHelper(const void *payload,
 
     virObjectLock(obj);
     want = virNetworkMatch(obj, data->flags);
+    if (want)
+        virHashRemoveEntry(data->nets->objsName, obj->def->name);
     virObjectUnlock(obj);
     return want;
 }
@@ -1364,9 +1541,10 @@ void
 virNetworkObjListPrune(virNetworkObjListPtr nets,
                        unsigned int flags)
 {
-    struct virNetworkObjListPruneHelperData data = {flags};
+    struct virNetworkObjListPruneHelperData data = {nets, flags};
 
     virObjectLock(nets);
     virHashRemoveSet(nets->objs, virNetworkObjListPruneHelper, &data);
+    virNetworkObjListRebuildBridgesLocked(nets);
     virObjectUnlock(nets);
 }
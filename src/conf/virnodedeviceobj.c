@@ -25,6 +25,7 @@
 #include "viralloc.h"
 #include "virnodedeviceobj.h"
 #include "virerror.h"
+#include "virhash.h"
 #include "virlog.h"
 #include "virstring.h"
 
@@ -32,6 +33,21 @@
 
 VIR_LOG_INIT("conf.virnodedeviceobj");
 
+struct _virNodeDeviceObjList {
+    /* name -> virNodeDeviceObj mapping
+     * for O(1), lookup-by-name */
+    virHashTablePtr objs;
+
+    /* sysfs path -> virNodeDeviceObj mapping
+     * for O(1), lookup-by-sysfs-path */
+    virHashTablePtr objsSysfs;
+
+    /* name -> virNodeDeviceObj mapping of the devices with the
+     * scsi_host capability, the only ones which can be found by
+     * their WWNs or vport capability */
+    virHashTablePtr objsSCSIHost;
+};
+
 
 static int
 virNodeDeviceObjHasCap(const virNodeDeviceObj *dev,
@@ -108,22 +124,37 @@ virNodeDeviceFindVPORTCapDef(const virNodeDeviceObj *dev)
 }
 
 
+static bool
+virNodeDeviceDefHasSCSIHostCap(const virNodeDeviceDef *def)
+{
+    virNodeDevCapsDefPtr caps;
+
+    for (caps = def->caps; caps; caps = caps->next) {
+        if (caps->data.type == VIR_NODE_DEV_CAP_SCSI_HOST)
+            return true;
+    }
+    return false;
+}
+
+
 virNodeDeviceObjPtr
 virNodeDeviceObjFindBySysfsPath(virNodeDeviceObjListPtr devs,
                                 const char *sysfs_path)
 {
-    size_t i;
+    virNodeDeviceObjPtr obj;
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if ((devs->objs[i]->def->sysfs_path != NULL) &&
-            (STREQ(devs->objs[i]->def->sysfs_path, sysfs_path))) {
-            return devs->objs[i];
-        }
-        virNodeDeviceObjUnlock(devs->objs[i]);
+    if (!(obj = virHashLookup(devs->objsSysfs, sysfs_path)))
+        return NULL;
+
+    virNodeDeviceObjLock(obj);
+    /* An entry left behind by a failed virNodeDeviceObjAssignDef
+     * may not match the current definition anymore */
+    if (STRNEQ_NULLABLE(obj->def->sysfs_path, sysfs_path)) {
+        virNodeDeviceObjUnlock(obj);
+        return NULL;
     }
 
-    return NULL;
+    return obj;
 }
 
 
@@ -131,16 +162,79 @@ virNodeDeviceObjPtr
 virNodeDeviceObjFindByName(virNodeDeviceObjListPtr devs,
                            const char *name)
 {
-    size_t i;
+    virNodeDeviceObjPtr obj;
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if (STREQ(devs->objs[i]->def->name, name))
-            return devs->objs[i];
-        virNodeDeviceObjUnlock(devs->objs[i]);
-    }
+    if ((obj = virHashLookup(devs->objs, name)))
+        virNodeDeviceObjLock(obj);
 
-    return NULL;
+    return obj;
+}
+
+
+struct virNodeDeviceObjListSearchData {
+    virNodeDeviceObjListSearcher searcher;
+    const void *opaque;
+};
+
+
+static int
+virNodeDeviceObjListSearchHelper(const void *payload,
+                                 const void *name ATTRIBUTE_UNUSED,
+                                 const void *opaque)
+{
+    virNodeDeviceObjPtr obj = (virNodeDeviceObjPtr) payload;
+    const struct virNodeDeviceObjListSearchData *data = opaque;
+
+    virNodeDeviceObjLock(obj);
+    /* the matching object is returned locked */
+    if (data->searcher(obj, data->opaque))
+        return 1;
+    virNodeDeviceObjUnlock(obj);
+    return 0;
+}
+
+
+/**
+ * virNodeDeviceObjListSearchSCSIHost:
+ * @devs: list of node device objects
+ * @searcher: callback to match a device
+ * @opaque: data passed to @searcher
+ *
+ * Call @searcher on every device with the scsi_host capability, with
+ * the device object locked, until it returns true.
+ *
+ * Returns: the locked device object for which @searcher returned true,
+ * or NULL if there is none.
+ */
+virNodeDeviceObjPtr
+virNodeDeviceObjListSearchSCSIHost(virNodeDeviceObjListPtr devs,
+                                   virNodeDeviceObjListSearcher searcher,
+                                   const void *opaque)
+{
+    struct virNodeDeviceObjListSearchData data = { searcher, opaque };
+
+    return virHashSearch(devs->objsSCSIHost,
+                         virNodeDeviceObjListSearchHelper, &data);
+}
+
+
+struct virNodeDeviceWWNsData {
+    const char *wwnn;
+    const char *wwpn;
+    const char *fabric_wwn;
+};
+
+
+static bool
+virNodeDeviceWWNsSearcher(virNodeDeviceObjPtr obj,
+                          const void *opaque)
+{
+    const struct virNodeDeviceWWNsData *data = opaque;
+    virNodeDevCapsDefPtr cap;
+
+    return (cap = virNodeDeviceFindFCCapDef(obj)) &&
+        STREQ_NULLABLE(cap->data.scsi_host.wwnn, data->wwnn) &&
+        STREQ_NULLABLE(cap->data.scsi_host.wwpn, data->wwpn);
 }
 
 
@@ -149,19 +243,22 @@ virNodeDeviceFindByWWNs(virNodeDeviceObjListPtr devs,
                         const char *parent_wwnn,
                         const char *parent_wwpn)
 {
-    size_t i;
+    struct virNodeDeviceWWNsData data = { parent_wwnn, parent_wwpn, NULL };
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDevCapsDefPtr cap;
-        virNodeDeviceObjLock(devs->objs[i]);
-        if ((cap = virNodeDeviceFindFCCapDef(devs->objs[i])) &&
-            STREQ_NULLABLE(cap->data.scsi_host.wwnn, parent_wwnn) &&
-            STREQ_NULLABLE(cap->data.scsi_host.wwpn, parent_wwpn))
-            return devs->objs[i];
-        virNodeDeviceObjUnlock(devs->objs[i]);
-    }
+    return virNodeDeviceObjListSearchSCSIHost(devs, virNodeDeviceWWNsSearcher,
+                                              &data);
+}
 
-    return NULL;
+
+static bool
+virNodeDeviceFabricWWNSearcher(virNodeDeviceObjPtr obj,
+                               const void *opaque)
+{
+    const struct virNodeDeviceWWNsData *data = opaque;
+    virNodeDevCapsDefPtr cap;
+
+    return (cap = virNodeDeviceFindFCCapDef(obj)) &&
+        STREQ_NULLABLE(cap->data.scsi_host.fabric_wwn, data->fabric_wwn);
 }
 
 
@@ -169,35 +266,30 @@ static virNodeDeviceObjPtr
 virNodeDeviceFindByFabricWWN(virNodeDeviceObjListPtr devs,
                              const char *parent_fabric_wwn)
 {
-    size_t i;
+    struct virNodeDeviceWWNsData data = { NULL, NULL, parent_fabric_wwn };
+
+    return virNodeDeviceObjListSearchSCSIHost(devs,
+                                              virNodeDeviceFabricWWNSearcher,
+                                              &data);
+}
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDevCapsDefPtr cap;
-        virNodeDeviceObjLock(devs->objs[i]);
-        if ((cap = virNodeDeviceFindFCCapDef(devs->objs[i])) &&
-            STREQ_NULLABLE(cap->data.scsi_host.fabric_wwn, parent_fabric_wwn))
-            return devs->objs[i];
-        virNodeDeviceObjUnlock(devs->objs[i]);
-    }
 
-    return NULL;
+static bool
+virNodeDeviceCapSearcher(virNodeDeviceObjPtr obj,
+                         const void *opaque)
+{
+    return virNodeDeviceObjHasCap(obj, opaque);
 }
 
 
+/* Only used for the fc_host and vports capabilities, which are both
+ * flags of the scsi_host capability */
 static virNodeDeviceObjPtr
 virNodeDeviceFindByCap(virNodeDeviceObjListPtr devs,
                        const char *cap)
 {
-    size_t i;
-
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if (virNodeDeviceObjHasCap(devs->objs[i], cap))
-            return devs->objs[i];
-        virNodeDeviceObjUnlock(devs->objs[i]);
-    }
-
-    return NULL;
+    return virNodeDeviceObjListSearchSCSIHost(devs, virNodeDeviceCapSearcher,
+                                              cap);
 }
 
 
@@ -217,14 +309,98 @@ virNodeDeviceObjFree(virNodeDeviceObjPtr dev)
 }
 
 
+static void
+virNodeDeviceObjListDataFree(void *payload,
+                             const void *name ATTRIBUTE_UNUSED)
+{
+    virNodeDeviceObjFree(payload);
+}
+
+
+virNodeDeviceObjListPtr
+virNodeDeviceObjListNew(void)
+{
+    virNodeDeviceObjListPtr devs;
+
+    if (VIR_ALLOC(devs) < 0)
+        return NULL;
+
+    if (!(devs->objs = virHashCreate(50, virNodeDeviceObjListDataFree)) ||
+        !(devs->objsSysfs = virHashCreate(50, NULL)) ||
+        !(devs->objsSCSIHost = virHashCreate(50, NULL))) {
+        virNodeDeviceObjListFree(devs);
+        return NULL;
+    }
+
+    return devs;
+}
+
+
 void
 virNodeDeviceObjListFree(virNodeDeviceObjListPtr devs)
 {
-    size_t i;
-    for (i = 0; i < devs->count; i++)
-        virNodeDeviceObjFree(devs->objs[i]);
-    VIR_FREE(devs->objs);
-    devs->count = 0;
+    if (!devs)
+        return;
+
+    virHashFree(devs->objsSysfs);
+    virHashFree(devs->objsSCSIHost);
+    virHashFree(devs->objs);
+    VIR_FREE(devs);
+}
+
+
+/*
+ * virNodeDeviceObjListAddIndexes:
+ * @devs: list of node device objects
+ * @obj: node device object
+ * @def: the definition @obj is going to have
+ *
+ * Make the secondary lookup tables of @devs point to @obj according
+ * to @def.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+virNodeDeviceObjListAddIndexes(virNodeDeviceObjListPtr devs,
+                               virNodeDeviceObjPtr obj,
+                               virNodeDeviceDefPtr def)
+{
+    if (def->sysfs_path &&
+        virHashUpdateEntry(devs->objsSysfs, def->sysfs_path, obj) < 0)
+        return -1;
+
+    if (virNodeDeviceDefHasSCSIHostCap(def) &&
+        virHashUpdateEntry(devs->objsSCSIHost, def->name, obj) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+/*
+ * virNodeDeviceObjListRemoveIndexes:
+ * @devs: list of node device objects
+ * @obj: node device object
+ * @def: a definition @obj no longer has
+ * @newdef: the definition replacing @def, if any
+ *
+ * Drop the entries of the secondary lookup tables of @devs which
+ * point to @obj because of @def, unless @newdef needs them as well.
+ */
+static void
+virNodeDeviceObjListRemoveIndexes(virNodeDeviceObjListPtr devs,
+                                  virNodeDeviceObjPtr obj,
+                                  virNodeDeviceDefPtr def,
+                                  virNodeDeviceDefPtr newdef)
+{
+    if (def->sysfs_path &&
+        !(newdef && STREQ_NULLABLE(def->sysfs_path, newdef->sysfs_path)) &&
+        virHashLookup(devs->objsSysfs, def->sysfs_path) == obj)
+        virHashRemoveEntry(devs->objsSysfs, def->sysfs_path);
+
+    if (!(newdef && virNodeDeviceDefHasSCSIHostCap(newdef)) &&
+        virHashLookup(devs->objsSCSIHost, def->name) == obj)
+        virHashRemoveEntry(devs->objsSCSIHost, def->name);
 }
 
 
@@ -235,6 +411,11 @@ virNodeDeviceObjAssignDef(virNodeDeviceObjListPtr devs,
     virNodeDeviceObjPtr device;
 
     if ((device = virNodeDeviceObjFindByName(devs, def->name))) {
+        if (virNodeDeviceObjListAddIndexes(devs, device, def) < 0) {
+            virNodeDeviceObjUnlock(device);
+            return NULL;
+        }
+        virNodeDeviceObjListRemoveIndexes(devs, device, device->def, def);
         virNodeDeviceDefFree(device->def);
         device->def = def;
         return device;
@@ -251,7 +432,15 @@ virNodeDeviceObjAssignDef(virNodeDeviceObjListPtr devs,
     }
     virNodeDeviceObjLock(device);
 
-    if (VIR_APPEND_ELEMENT_COPY(devs->objs, devs->count, device) < 0) {
+    if (virHashAddEntry(devs->objs, def->name, device) < 0) {
+        virNodeDeviceObjUnlock(device);
+        virNodeDeviceObjFree(device);
+        return NULL;
+    }
+
+    if (virNodeDeviceObjListAddIndexes(devs, device, def) < 0) {
+        virNodeDeviceObjListRemoveIndexes(devs, device, def, NULL);
+        virHashSteal(devs->objs, def->name);
         virNodeDeviceObjUnlock(device);
         virNodeDeviceObjFree(device);
         return NULL;
@@ -267,22 +456,14 @@ void
 virNodeDeviceObjRemove(virNodeDeviceObjListPtr devs,
                        virNodeDeviceObjPtr *dev)
 {
-    size_t i;
-
-    virNodeDeviceObjUnlock(*dev);
+    virNodeDeviceObjPtr obj = *dev;
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(*dev);
-        if (devs->objs[i] == *dev) {
-            virNodeDeviceObjUnlock(*dev);
-            virNodeDeviceObjFree(devs->objs[i]);
-            *dev = NULL;
+    virNodeDeviceObjUnlock(obj);
 
-            VIR_DELETE_ELEMENT(devs->objs, i, devs->count);
-            break;
-        }
-        virNodeDeviceObjUnlock(*dev);
-    }
+    virNodeDeviceObjListRemoveIndexes(devs, obj, obj->def, NULL);
+    /* frees @obj */
+    virHashRemoveEntry(devs->objs, obj->def->name);
+    *dev = NULL;
 }
 
 
@@ -474,25 +655,78 @@ virNodeDeviceCapMatch(virNodeDeviceObjPtr devobj,
 }
 
 
+struct virNodeDeviceCountData {
+    virConnectPtr conn;
+    virNodeDeviceObjListFilter aclfilter;
+    const char *cap;
+    int count;
+};
+
+
+static int
+virNodeDeviceObjListNumOfDevicesCallback(void *payload,
+                                         const void *name ATTRIBUTE_UNUSED,
+                                         void *opaque)
+{
+    virNodeDeviceObjPtr obj = payload;
+    struct virNodeDeviceCountData *data = opaque;
+
+    virNodeDeviceObjLock(obj);
+    if ((!data->aclfilter || data->aclfilter(data->conn, obj->def)) &&
+        (!data->cap || virNodeDeviceObjHasCap(obj, data->cap)))
+        data->count++;
+    virNodeDeviceObjUnlock(obj);
+    return 0;
+}
+
+
 int
 virNodeDeviceObjNumOfDevices(virNodeDeviceObjListPtr devs,
                              virConnectPtr conn,
                              const char *cap,
                              virNodeDeviceObjListFilter aclfilter)
 {
-    size_t i;
-    int ndevs = 0;
+    struct virNodeDeviceCountData data = { conn, aclfilter, cap, 0 };
+
+    virHashForEach(devs->objs, virNodeDeviceObjListNumOfDevicesCallback,
+                   &data);
+
+    return data.count;
+}
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjPtr obj = devs->objs[i];
-        virNodeDeviceObjLock(obj);
-        if ((!aclfilter || aclfilter(conn, obj->def)) &&
-            (!cap || virNodeDeviceObjHasCap(obj, cap)))
-            ++ndevs;
-        virNodeDeviceObjUnlock(obj);
-    }
 
-    return ndevs;
+struct virNodeDeviceGetNamesData {
+    virConnectPtr conn;
+    virNodeDeviceObjListFilter aclfilter;
+    const char *cap;
+    char **const names;
+    int nnames;
+    int maxnames;
+    bool error;
+};
+
+
+static int
+virNodeDeviceObjListGetNamesCallback(void *payload,
+                                     const void *name ATTRIBUTE_UNUSED,
+                                     void *opaque)
+{
+    virNodeDeviceObjPtr obj = payload;
+    struct virNodeDeviceGetNamesData *data = opaque;
+
+    if (data->error || data->nnames >= data->maxnames)
+        return 0;
+
+    virNodeDeviceObjLock(obj);
+    if ((!data->aclfilter || data->aclfilter(data->conn, obj->def)) &&
+        (!data->cap || virNodeDeviceObjHasCap(obj, data->cap))) {
+        if (VIR_STRDUP(data->names[data->nnames], obj->def->name) < 0)
+            data->error = true;
+        else
+            data->nnames++;
+    }
+    virNodeDeviceObjUnlock(obj);
+    return 0;
 }
 
 
@@ -504,29 +738,18 @@ virNodeDeviceObjGetNames(virNodeDeviceObjListPtr devs,
                          char **const names,
                          int maxnames)
 {
-    int nnames = 0;
-    size_t i;
+    struct virNodeDeviceGetNamesData data = {
+        conn, aclfilter, cap, names, 0, maxnames, false };
 
-    for (i = 0; i < devs->count && nnames < maxnames; i++) {
-        virNodeDeviceObjPtr obj = devs->objs[i];
-        virNodeDeviceObjLock(obj);
-        if ((!aclfilter || aclfilter(conn, obj->def)) &&
-            (!cap || virNodeDeviceObjHasCap(obj, cap))) {
-            if (VIR_STRDUP(names[nnames], obj->def->name) < 0) {
-                virNodeDeviceObjUnlock(obj);
-                goto failure;
-            }
-            nnames++;
-        }
-        virNodeDeviceObjUnlock(obj);
-    }
+    virHashForEach(devs->objs, virNodeDeviceObjListGetNamesCallback, &data);
 
-    return nnames;
+    if (data.error) {
+        while (--data.nnames >= 0)
+            VIR_FREE(names[data.nnames]);
+        return -1;
+    }
 
- failure:
-    while (--nnames >= 0)
-        VIR_FREE(names[nnames]);
-    return -1;
+    return data.nnames;
 }
 
 
@@ -559,6 +782,49 @@ virNodeDeviceMatch(virNodeDeviceObjPtr devobj,
 #undef MATCH
 
 
+struct virNodeDeviceObjListExportData {
+    virConnectPtr conn;
+    virNodeDeviceObjListFilter filter;
+    unsigned int flags;
+    virNodeDevicePtr *devices;
+    int ndevices;
+    bool error;
+};
+
+
+static int
+virNodeDeviceObjListExportCallback(void *payload,
+                                   const void *name ATTRIBUTE_UNUSED,
+                                   void *opaque)
+{
+    virNodeDeviceObjPtr devobj = payload;
+    struct virNodeDeviceObjListExportData *data = opaque;
+    virNodeDevicePtr device = NULL;
+
+    if (data->error)
+        return 0;
+
+    virNodeDeviceObjLock(devobj);
+    if ((!data->filter || data->filter(data->conn, devobj->def)) &&
+        virNodeDeviceMatch(devobj, data->flags)) {
+        if (data->devices) {
+            if (!(device = virGetNodeDevice(data->conn, devobj->def->name)) ||
+                VIR_STRDUP(device->parent, devobj->def->parent) < 0) {
+                virObjectUnref(device);
+                data->error = true;
+                goto cleanup;
+            }
+            data->devices[data->ndevices] = device;
+        }
+        data->ndevices++;
+    }
+
+ cleanup:
+    virNodeDeviceObjUnlock(devobj);
+    return 0;
+}
+
+
 int
 virNodeDeviceObjListExport(virConnectPtr conn,
                            virNodeDeviceObjListPtr devobjs,
@@ -566,49 +832,30 @@ virNodeDeviceObjListExport(virConnectPtr conn,
                            virNodeDeviceObjListFilter filter,
                            unsigned int flags)
 {
-    virNodeDevicePtr *tmp_devices = NULL;
-    virNodeDevicePtr device = NULL;
-    int ndevices = 0;
-    int ret = -1;
+    struct virNodeDeviceObjListExportData data = {
+        conn, filter, flags, NULL, 0, false };
     size_t i;
 
-    if (devices && VIR_ALLOC_N(tmp_devices, devobjs->count + 1) < 0)
-        goto cleanup;
-
-    for (i = 0; i < devobjs->count; i++) {
-        virNodeDeviceObjPtr devobj = devobjs->objs[i];
-        virNodeDeviceObjLock(devobj);
-        if ((!filter || filter(conn, devobj->def)) &&
-            virNodeDeviceMatch(devobj, flags)) {
-            if (devices) {
-                if (!(device = virGetNodeDevice(conn, devobj->def->name)) ||
-                    VIR_STRDUP(device->parent, devobj->def->parent) < 0) {
-                    virObjectUnref(device);
-                    virNodeDeviceObjUnlock(devobj);
-                    goto cleanup;
-                }
-                tmp_devices[ndevices] = device;
-            }
-            ndevices++;
-        }
-        virNodeDeviceObjUnlock(devobj);
-    }
+    if (devices &&
+        VIR_ALLOC_N(data.devices, virHashSize(devobjs->objs) + 1) < 0)
+        return -1;
 
-    if (tmp_devices) {
-        /* trim the array to the final size */
-        ignore_value(VIR_REALLOC_N(tmp_devices, ndevices + 1));
-        *devices = tmp_devices;
-        tmp_devices = NULL;
-    }
+    virHashForEach(devobjs->objs, virNodeDeviceObjListExportCallback, &data);
 
-    ret = ndevices;
+    if (data.error)
+        goto error;
 
- cleanup:
-    if (tmp_devices) {
-        for (i = 0; i < ndevices; i++)
-            virObjectUnref(tmp_devices[i]);
+    if (data.devices) {
+        /* trim the array to the final size */
+        ignore_value(VIR_REALLOC_N(data.devices, data.ndevices + 1));
+        *devices = data.devices;
     }
 
-    VIR_FREE(tmp_devices);
-    return ret;
+    return data.ndevices;
+
+ error:
+    for (i = 0; i < data.ndevices; i++)
+        virObjectUnref(data.devices[i]);
+    VIR_FREE(data.devices);
+    return -1;
 }
@@ -32,7 +32,7 @@ typedef virNodeDeviceDriverState *virNodeDeviceDriverStatePtr;
 struct _virNodeDeviceDriverState {
     virMutex lock;
 
-    virNodeDeviceObjList devs;		/* currently-known devices */
+    virNodeDeviceObjListPtr devs;		/* currently-known devices */
     void *privateData;			/* driver-specific private data */
 
     /* Immutable pointer, self-locking APIs */
@@ -49,6 +49,15 @@ virNodeDeviceObjFindBySysfsPath(virNodeDeviceObjListPtr devs,
                                 const char *sysfs_path)
     ATTRIBUTE_NONNULL(2);
 
+typedef bool
+(*virNodeDeviceObjListSearcher)(virNodeDeviceObjPtr obj,
+                                const void *opaque);
+
+virNodeDeviceObjPtr
+virNodeDeviceObjListSearchSCSIHost(virNodeDeviceObjListPtr devs,
+                                   virNodeDeviceObjListSearcher searcher,
+                                   const void *opaque);
+
 virNodeDeviceObjPtr
 virNodeDeviceObjAssignDef(virNodeDeviceObjListPtr devs,
                           virNodeDeviceDefPtr def);
@@ -65,6 +74,9 @@ virNodeDeviceObjGetParentHost(virNodeDeviceObjListPtr devs,
 void
 virNodeDeviceObjFree(virNodeDeviceObjPtr dev);
 
+virNodeDeviceObjListPtr
+virNodeDeviceObjListNew(void);
+
 void
 virNodeDeviceObjListFree(virNodeDeviceObjListPtr devs);
 
@@ -45,6 +45,9 @@ struct _virNWFilterObj {
 struct _virNWFilterObjList {
     size_t count;
     virNWFilterObjPtr *objs;
+
+    /* bumped whenever any definition in the list changes */
+    unsigned int generation;
 };
 
 
@@ -134,6 +137,8 @@ virNWFilterObjListRemove(virNWFilterObjListPtr nwfilters,
 
     virNWFilterObjUnlock(obj);
 
+    nwfilters->generation++;
+
     for (i = 0; i < nwfilters->count; i++) {
         virNWFilterObjLock(nwfilters->objs[i]);
         if (nwfilters->objs[i] == obj) {
@@ -246,18 +251,98 @@ virNWFilterObjListDefLoopDetect(virNWFilterObjListPtr nwfilters,
 }
 
 
+static bool
+virNWFilterDefIncludesAny(virNWFilterDefPtr def,
+                          virHashTablePtr names)
+{
+    size_t i;
+
+    for (i = 0; i < def->nentries; i++) {
+        virNWFilterIncludeDefPtr inc = def->filterEntries[i]->include;
+
+        if (inc && virHashLookup(names, inc->filterref))
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * virNWFilterObjListGetDependents:
+ * @nwfilters : the nwfilters to search
+ * @name : the name of the filter
+ *
+ * Collect the names of all filters that reference the filter @name,
+ * directly or through other filters, along with @name itself.
+ *
+ * Returns a hash table indexed by the filter names, NULL on error.
+ */
+static virHashTablePtr
+virNWFilterObjListGetDependents(virNWFilterObjListPtr nwfilters,
+                                const char *name)
+{
+    virHashTablePtr names;
+    bool added = true;
+    size_t i;
+
+    if (!(names = virHashCreate(10, NULL)))
+        return NULL;
+
+    if (virHashAddEntry(names, name, (void *)1) < 0)
+        goto error;
+
+    /* filters cannot reference each other in a loop, so this ends after
+     * at most as many passes as the longest chain of references */
+    while (added) {
+        added = false;
+
+        for (i = 0; i < nwfilters->count; i++) {
+            virNWFilterObjPtr obj = nwfilters->objs[i];
+            int rc = 0;
+
+            virNWFilterObjLock(obj);
+            if (!virHashLookup(names, obj->def->name) &&
+                virNWFilterDefIncludesAny(obj->def, names)) {
+                rc = virHashAddEntry(names, obj->def->name, (void *)1);
+                added = true;
+            }
+            virNWFilterObjUnlock(obj);
+
+            if (rc < 0)
+                goto error;
+        }
+    }
+
+    return names;
+
+ error:
+    virHashFree(names);
+    return NULL;
+}
+
+
 int
-virNWFilterObjTestUnassignDef(virNWFilterObjPtr obj)
+virNWFilterObjTestUnassignDef(virNWFilterObjListPtr nwfilters,
+                              virNWFilterObjPtr obj)
 {
+    virHashTablePtr filters;
     int rc = 0;
 
+    if (!(filters = virNWFilterObjListGetDependents(nwfilters,
+                                                    obj->def->name)))
+        return -1;
+
     obj->wantRemoved = true;
+    nwfilters->generation++;
     /* trigger the update on VMs referencing the filter */
-    if (virNWFilterTriggerVMFilterRebuild())
+    if (virNWFilterTriggerVMFilterRebuild(filters))
         rc = -1;
 
     obj->wantRemoved = false;
+    nwfilters->generation++;
 
+    virHashFree(filters);
     return rc;
 }
 
@@ -300,6 +385,8 @@ virNWFilterObjListAssignDef(virNWFilterObjListPtr nwfilters,
 {
     virNWFilterObjPtr obj;
     virNWFilterDefPtr objdef;
+    virHashTablePtr filters;
+    int rc;
 
     if ((obj = virNWFilterObjListFindByUUID(nwfilters, def->uuid))) {
         objdef = obj->def;
@@ -340,13 +427,24 @@ virNWFilterObjListAssignDef(virNWFilterObjListPtr nwfilters,
         if (virNWFilterDefEqual(def, objdef, false)) {
             virNWFilterDefFree(objdef);
             obj->def = def;
+            nwfilters->generation++;
             return obj;
         }
 
+        if (!(filters = virNWFilterObjListGetDependents(nwfilters,
+                                                        def->name))) {
+            virNWFilterObjUnlock(obj);
+            return NULL;
+        }
+
         obj->newDef = def;
+        nwfilters->generation++;
         /* trigger the update on VMs referencing the filter */
-        if (virNWFilterTriggerVMFilterRebuild()) {
+        rc = virNWFilterTriggerVMFilterRebuild(filters);
+        virHashFree(filters);
+        if (rc < 0) {
             obj->newDef = NULL;
+            nwfilters->generation++;
             virNWFilterObjUnlock(obj);
             return NULL;
         }
@@ -354,6 +452,7 @@ virNWFilterObjListAssignDef(virNWFilterObjListPtr nwfilters,
         virNWFilterDefFree(objdef);
         obj->def = def;
         obj->newDef = NULL;
+        nwfilters->generation++;
         return obj;
     }
 
@@ -367,11 +466,28 @@ virNWFilterObjListAssignDef(virNWFilterObjListPtr nwfilters,
         return NULL;
     }
     obj->def = def;
+    nwfilters->generation++;
 
     return obj;
 }
 
 
+/**
+ * virNWFilterObjListGetGeneration:
+ * @nwfilters: the nwfilters list
+ *
+ * Returns a counter that changes whenever a filter is added to or
+ * removed from the list, or a definition in it is replaced or about
+ * to be removed. Results derived from the definitions can be reused
+ * for as long as the counter stays the same.
+ */
+unsigned int
+virNWFilterObjListGetGeneration(virNWFilterObjListPtr nwfilters)
+{
+    return nwfilters->generation;
+}
+
+
 int
 virNWFilterObjListNumOfNWFilters(virNWFilterObjListPtr nwfilters,
                                  virConnectPtr conn,
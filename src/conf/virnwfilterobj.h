@@ -73,7 +73,11 @@ virNWFilterObjListAssignDef(virNWFilterObjListPtr nwfilters,
                             virNWFilterDefPtr def);
 
 int
-virNWFilterObjTestUnassignDef(virNWFilterObjPtr obj);
+virNWFilterObjTestUnassignDef(virNWFilterObjListPtr nwfilters,
+                              virNWFilterObjPtr obj);
+
+unsigned int
+virNWFilterObjListGetGeneration(virNWFilterObjListPtr nwfilters);
 
 typedef bool
 (*virNWFilterObjListFilter)(virConnectPtr conn,
@@ -44,12 +44,15 @@ struct _virSecretObj {
     virSecretDefPtr def;
     unsigned char *value;       /* May be NULL */
     size_t value_size;
+    bool loadValue;             /* value not read from base64File yet */
 };
 
 static virClassPtr virSecretObjClass;
 static virClassPtr virSecretObjListClass;
 static void virSecretObjDispose(void *obj);
 static void virSecretObjListDispose(void *obj);
+static int virSecretObjEnsureValue(virSecretObjPtr obj);
+static int virSecretLoadValue(virSecretObjPtr obj);
 
 struct _virSecretObjList {
     virObjectLockable parent;
@@ -57,11 +60,19 @@ struct _virSecretObjList {
     /* uuid string -> virSecretObj  mapping
      * for O(1), lockless lookup-by-uuid */
     virHashTable *objs;
+
+    /* usage ID -> virSecretObjUsage mapping for lookup-by-usage
+     * without scanning all secrets. The usage ID of a secret never
+     * changes, its usage type might on redefine. */
+    virHashTable *objsUsage;
 };
 
-struct virSecretSearchData {
-    int usageType;
-    const char *usageID;
+typedef struct _virSecretObjUsage virSecretObjUsage;
+typedef virSecretObjUsage *virSecretObjUsagePtr;
+struct _virSecretObjUsage {
+    /* not ref'd, the entry is removed along with the object */
+    virSecretObjPtr *objs;
+    size_t nobjs;
 };
 
 
@@ -115,6 +126,17 @@ virSecretObjEndAPI(virSecretObjPtr *obj)
 }
 
 
+static void
+virSecretObjUsageFree(void *payload,
+                      const void *name ATTRIBUTE_UNUSED)
+{
+    virSecretObjUsagePtr usage = payload;
+
+    VIR_FREE(usage->objs);
+    VIR_FREE(usage);
+}
+
+
 virSecretObjListPtr
 virSecretObjListNew(void)
 {
@@ -126,7 +148,8 @@ virSecretObjListNew(void)
     if (!(secrets = virObjectLockableNew(virSecretObjListClass)))
         return NULL;
 
-    if (!(secrets->objs = virHashCreate(50, virObjectFreeHashData))) {
+    if (!(secrets->objs = virHashCreate(50, virObjectFreeHashData)) ||
+        !(secrets->objsUsage = virHashCreate(50, virSecretObjUsageFree))) {
         virObjectUnref(secrets);
         return NULL;
     }
@@ -157,6 +180,7 @@ virSecretObjListDispose(void *obj)
     virSecretObjListPtr secrets = obj;
 
     virHashFree(secrets->objs);
+    virHashFree(secrets->objsUsage);
 }
 
 
@@ -206,29 +230,52 @@ virSecretObjListFindByUUID(virSecretObjListPtr secrets,
 }
 
 
+/* Must be called with @secrets locked */
 static int
-virSecretObjSearchName(const void *payload,
-                       const void *name ATTRIBUTE_UNUSED,
-                       const void *opaque)
+virSecretObjListAddUsage(virSecretObjListPtr secrets,
+                         virSecretObjPtr obj,
+                         const char *usageID)
 {
-    virSecretObjPtr obj = (virSecretObjPtr) payload;
-    virSecretDefPtr def;
-    struct virSecretSearchData *data = (struct virSecretSearchData *) opaque;
-    int found = 0;
+    virSecretObjUsagePtr usage;
 
-    virObjectLock(obj);
-    def = obj->def;
+    if (!usageID)
+        return 0;
 
-    if (def->usage_type != data->usageType)
-        goto cleanup;
+    if (!(usage = virHashLookup(secrets->objsUsage, usageID))) {
+        if (VIR_ALLOC(usage) < 0)
+            return -1;
+        if (virHashAddEntry(secrets->objsUsage, usageID, usage) < 0) {
+            VIR_FREE(usage);
+            return -1;
+        }
+    }
 
-    if (data->usageType != VIR_SECRET_USAGE_TYPE_NONE &&
-        STREQ(def->usage_id, data->usageID))
-        found = 1;
+    return VIR_APPEND_ELEMENT(usage->objs, usage->nobjs, obj);
+}
 
- cleanup:
-    virObjectUnlock(obj);
-    return found;
+
+/* Must be called with @secrets locked */
+static void
+virSecretObjListRemoveUsage(virSecretObjListPtr secrets,
+                            virSecretObjPtr obj,
+                            const char *usageID)
+{
+    virSecretObjUsagePtr usage;
+    size_t i;
+
+    if (!usageID ||
+        !(usage = virHashLookup(secrets->objsUsage, usageID)))
+        return;
+
+    for (i = 0; i < usage->nobjs; i++) {
+        if (usage->objs[i] == obj) {
+            VIR_DELETE_ELEMENT(usage->objs, i, usage->nobjs);
+            break;
+        }
+    }
+
+    if (!usage->nobjs)
+        virHashRemoveEntry(secrets->objsUsage, usageID);
 }
 
 
@@ -247,14 +294,26 @@ virSecretObjListFindByUsageLocked(virSecretObjListPtr secrets,
                                   int usageType,
                                   const char *usageID)
 {
-    virSecretObjPtr obj = NULL;
-    struct virSecretSearchData data = { .usageType = usageType,
-                                        .usageID = usageID };
+    virSecretObjUsagePtr usage;
+    size_t i;
 
-    obj = virHashSearch(secrets->objs, virSecretObjSearchName, &data);
-    if (obj)
-        virObjectRef(obj);
-    return obj;
+    if (usageType == VIR_SECRET_USAGE_TYPE_NONE || !usageID ||
+        !(usage = virHashLookup(secrets->objsUsage, usageID)))
+        return NULL;
+
+    for (i = 0; i < usage->nobjs; i++) {
+        virSecretObjPtr obj = usage->objs[i];
+        bool found;
+
+        virObjectLock(obj);
+        found = obj->def->usage_type == usageType;
+        virObjectUnlock(obj);
+
+        if (found)
+            return virObjectRef(obj);
+    }
+
+    return NULL;
 }
 
 
@@ -311,6 +370,7 @@ virSecretObjListRemove(virSecretObjListPtr secrets,
 
     virObjectLock(secrets);
     virObjectLock(obj);
+    virSecretObjListRemoveUsage(secrets, obj, obj->def->usage_id);
     virHashRemoveEntry(secrets->objs, uuidstr);
     virObjectUnlock(obj);
     virObjectUnref(obj);
@@ -366,6 +426,12 @@ virSecretObjListAdd(virSecretObjListPtr secrets,
             goto cleanup;
         }
 
+        /* The value file is going away when the secret turns ephemeral,
+         * so make sure the value is in memory before that happens */
+        if (!def->isephemeral && newdef->isephemeral &&
+            virSecretObjEnsureValue(obj) < 0)
+            goto cleanup;
+
         if (oldDef)
             *oldDef = def;
         else
@@ -398,9 +464,14 @@ virSecretObjListAdd(virSecretObjListPtr secrets,
         if (!(obj = virSecretObjNew()))
             goto cleanup;
 
-        if (virHashAddEntry(secrets->objs, uuidstr, obj) < 0)
+        if (virSecretObjListAddUsage(secrets, obj, newdef->usage_id) < 0)
             goto cleanup;
 
+        if (virHashAddEntry(secrets->objs, uuidstr, obj) < 0) {
+            virSecretObjListRemoveUsage(secrets, obj, newdef->usage_id);
+            goto cleanup;
+        }
+
         obj->def = newdef;
         VIR_STEAL_PTR(obj->configFile, configFile);
         VIR_STEAL_PTR(obj->base64File, base64File);
@@ -747,12 +818,32 @@ virSecretObjSetDef(virSecretObjPtr obj,
 }
 
 
+/* Values of secrets loaded from configDir are only read when they are
+ * first needed, which keeps startup of the driver cheap and the values
+ * of unused secrets out of memory. */
+static int
+virSecretObjEnsureValue(virSecretObjPtr obj)
+{
+    if (!obj->loadValue)
+        return 0;
+
+    if (virSecretLoadValue(obj) < 0)
+        return -1;
+
+    obj->loadValue = false;
+    return 0;
+}
+
+
 unsigned char *
 virSecretObjGetValue(virSecretObjPtr obj)
 {
     virSecretDefPtr def = obj->def;
     unsigned char *ret = NULL;
 
+    if (virSecretObjEnsureValue(obj) < 0)
+        goto cleanup;
+
     if (!obj->value) {
         char uuidstr[VIR_UUID_STRING_BUFLEN];
         virUUIDFormat(def->uuid, uuidstr);
@@ -797,6 +888,7 @@ virSecretObjSetValue(virSecretObjPtr obj,
         memset(old_value, 0, old_value_size);
         VIR_FREE(old_value);
     }
+    obj->loadValue = false;
 
     return 0;
 
@@ -922,7 +1014,6 @@ virSecretLoad(virSecretObjListPtr secrets,
               const char *configDir)
 {
     virSecretDefPtr def = NULL;
-    virSecretObjPtr obj = NULL;
     virSecretObjPtr ret = NULL;
 
     if (!(def = virSecretDefParseFile(path)))
@@ -931,18 +1022,19 @@ virSecretLoad(virSecretObjListPtr secrets,
     if (virSecretLoadValidateUUID(def, file) < 0)
         goto cleanup;
 
-    if (!(obj = virSecretObjListAdd(secrets, def, configDir, NULL)))
+    if (!(ret = virSecretObjListAdd(secrets, def, configDir, NULL)))
         goto cleanup;
     def = NULL;
 
-    if (virSecretLoadValue(obj) < 0)
-        goto cleanup;
-
-    ret = obj;
-    obj = NULL;
+    /* Forget whatever value a reload found in memory, the file wins */
+    if (ret->value) {
+        memset(ret->value, 0, ret->value_size);
+        VIR_FREE(ret->value);
+        ret->value_size = 0;
+    }
+    ret->loadValue = true;
 
  cleanup:
-    virSecretObjListRemove(secrets, obj);
     virSecretDefFree(def);
     return ret;
 }
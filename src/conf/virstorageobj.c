@@ -30,6 +30,9 @@
 #include "virlog.h"
 #include "virscsihost.h"
 #include "virstring.h"
+#include "virthreadpool.h"
+#include "virtime.h"
+#include "viruuid.h"
 #include "virvhba.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
@@ -44,6 +47,7 @@ virStoragePoolObjFree(virStoragePoolObjPtr obj)
         return;
 
     virStoragePoolObjClearVols(obj);
+    virStoragePoolObjClearStaleVols(obj);
 
     virStoragePoolDefFree(obj->def);
     virStoragePoolDefFree(obj->newDef);
@@ -65,6 +69,11 @@ virStoragePoolObjListFree(virStoragePoolObjListPtr pools)
         virStoragePoolObjFree(pools->objs[i]);
     VIR_FREE(pools->objs);
     pools->count = 0;
+
+    virHashFree(pools->objsName);
+    pools->objsName = NULL;
+    virHashFree(pools->objsUUID);
+    pools->objsUUID = NULL;
 }
 
 
@@ -72,6 +81,7 @@ void
 virStoragePoolObjRemove(virStoragePoolObjListPtr pools,
                         virStoragePoolObjPtr pool)
 {
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
     size_t i;
 
     virStoragePoolObjUnlock(pool);
@@ -79,6 +89,10 @@ virStoragePoolObjRemove(virStoragePoolObjListPtr pools,
     for (i = 0; i < pools->count; i++) {
         virStoragePoolObjLock(pools->objs[i]);
         if (pools->objs[i] == pool) {
+            virUUIDFormat(pool->def->uuid, uuidstr);
+            virHashRemoveEntry(pools->objsName, pool->def->name);
+            virHashRemoveEntry(pools->objsUUID, uuidstr);
+
             virStoragePoolObjUnlock(pools->objs[i]);
             virStoragePoolObjFree(pools->objs[i]);
 
@@ -94,16 +108,15 @@ virStoragePoolObjPtr
 virStoragePoolObjFindByUUID(virStoragePoolObjListPtr pools,
                             const unsigned char *uuid)
 {
-    size_t i;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    virStoragePoolObjPtr pool;
 
-    for (i = 0; i < pools->count; i++) {
-        virStoragePoolObjLock(pools->objs[i]);
-        if (!memcmp(pools->objs[i]->def->uuid, uuid, VIR_UUID_BUFLEN))
-            return pools->objs[i];
-        virStoragePoolObjUnlock(pools->objs[i]);
-    }
+    virUUIDFormat(uuid, uuidstr);
+    if (!(pool = virHashLookup(pools->objsUUID, uuidstr)))
+        return NULL;
 
-    return NULL;
+    virStoragePoolObjLock(pool);
+    return pool;
 }
 
 
@@ -111,16 +124,13 @@ virStoragePoolObjPtr
 virStoragePoolObjFindByName(virStoragePoolObjListPtr pools,
                             const char *name)
 {
-    size_t i;
+    virStoragePoolObjPtr pool;
 
-    for (i = 0; i < pools->count; i++) {
-        virStoragePoolObjLock(pools->objs[i]);
-        if (STREQ(pools->objs[i]->def->name, name))
-            return pools->objs[i];
-        virStoragePoolObjUnlock(pools->objs[i]);
-    }
+    if (!(pool = virHashLookup(pools->objsName, name)))
+        return NULL;
 
-    return NULL;
+    virStoragePoolObjLock(pool);
+    return pool;
 }
 
 
@@ -141,6 +151,178 @@ virStoragePoolSourceFindDuplicateDevices(virStoragePoolObjPtr pool,
 }
 
 
+/*
+ * Volume lookups by name happen on nearly every volume API call and
+ * those by key or path for every disk of a starting domain, so the
+ * volume list keeps hash tables on the side instead of being scanned.
+ *
+ * The name index is kept up to date by virStoragePoolObjAddVol and
+ * virStoragePoolObjRemoveVol. Some backends only fill in the key and
+ * target path once the volume is in the list, so those two indexes
+ * are dropped whenever the list changes and built again by the next
+ * lookup. If several volumes share a key, name or path, the index
+ * points at the first of them in the list.
+ */
+static void
+virStorageVolDefListResetIndexes(virStorageVolDefListPtr volumes)
+{
+    virHashFree(volumes->objsName);
+    volumes->objsName = NULL;
+    virHashFree(volumes->objsKey);
+    volumes->objsKey = NULL;
+    virHashFree(volumes->objsPath);
+    volumes->objsPath = NULL;
+}
+
+
+static void
+virStorageVolDefListDropIndexes(virStorageVolDefListPtr volumes)
+{
+    virHashFree(volumes->objsKey);
+    volumes->objsKey = NULL;
+    virHashFree(volumes->objsPath);
+    volumes->objsPath = NULL;
+}
+
+
+static int
+virStorageVolDefListIndexAdd(virHashTablePtr table,
+                             const char *name,
+                             virStorageVolDefPtr vol)
+{
+    if (!name || virHashLookup(table, name))
+        return 0;
+
+    return virHashAddEntry(table, name, vol);
+}
+
+
+typedef enum {
+    VIR_STORAGE_VOL_INDEX_NAME,
+    VIR_STORAGE_VOL_INDEX_KEY,
+    VIR_STORAGE_VOL_INDEX_PATH,
+} virStorageVolIndex;
+
+
+static const char *
+virStorageVolDefListIndexName(virStorageVolDefPtr vol,
+                              virStorageVolIndex index)
+{
+    switch (index) {
+    case VIR_STORAGE_VOL_INDEX_NAME:
+        return vol->name;
+    case VIR_STORAGE_VOL_INDEX_KEY:
+        return vol->key;
+    case VIR_STORAGE_VOL_INDEX_PATH:
+        return vol->target.path;
+    }
+
+    return NULL;
+}
+
+
+static virHashTablePtr
+virStorageVolDefListIndexBuild(virStorageVolDefListPtr volumes,
+                               virStorageVolIndex index)
+{
+    virHashTablePtr table;
+    size_t i;
+
+    if (!(table = virHashCreate(MAX(volumes->count, 32), NULL)))
+        return NULL;
+
+    for (i = 0; i < volumes->count; i++) {
+        virStorageVolDefPtr vol = volumes->objs[i];
+        const char *name = virStorageVolDefListIndexName(vol, index);
+
+        if (virStorageVolDefListIndexAdd(table, name, vol) < 0) {
+            virHashFree(table);
+            return NULL;
+        }
+    }
+
+    return table;
+}
+
+
+/**
+ * virStoragePoolObjAddVol:
+ * @pool: locked storage pool object
+ * @vol: volume definition
+ *
+ * Append @vol to the volume list of @pool, which takes over the
+ * definition on success.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                        virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr volumes = &pool->volumes;
+
+    if (!volumes->objsName &&
+        !(volumes->objsName =
+          virStorageVolDefListIndexBuild(volumes, VIR_STORAGE_VOL_INDEX_NAME)))
+        return -1;
+
+    if (virStorageVolDefListIndexAdd(volumes->objsName, vol->name, vol) < 0)
+        return -1;
+
+    if (VIR_APPEND_ELEMENT_COPY(volumes->objs, volumes->count, vol) < 0) {
+        if (virHashLookup(volumes->objsName, vol->name) == vol)
+            virHashRemoveEntry(volumes->objsName, vol->name);
+        return -1;
+    }
+
+    virStorageVolDefListDropIndexes(volumes);
+    return 0;
+}
+
+
+/**
+ * virStoragePoolObjRemoveVol:
+ * @pool: locked storage pool object
+ * @vol: volume definition
+ *
+ * Remove @vol from the volume list of @pool, without freeing it.
+ */
+void
+virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                           virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr volumes = &pool->volumes;
+    size_t i;
+
+    for (i = 0; i < volumes->count; i++) {
+        if (volumes->objs[i] == vol)
+            break;
+    }
+    if (i == volumes->count)
+        return;
+
+    VIR_DELETE_ELEMENT(volumes->objs, i, volumes->count);
+    virStorageVolDefListDropIndexes(volumes);
+
+    if (virHashLookup(volumes->objsName, vol->name) != vol)
+        return;
+
+    virHashRemoveEntry(volumes->objsName, vol->name);
+
+    /* Let the next volume of the same name take over */
+    for (i = 0; i < volumes->count; i++) {
+        if (STREQ(volumes->objs[i]->name, vol->name)) {
+            if (virHashAddEntry(volumes->objsName, vol->name,
+                                volumes->objs[i]) < 0) {
+                virHashFree(volumes->objsName);
+                volumes->objsName = NULL;
+            }
+            break;
+        }
+    }
+}
+
+
 void
 virStoragePoolObjClearVols(virStoragePoolObjPtr pool)
 {
@@ -150,6 +332,41 @@ virStoragePoolObjClearVols(virStoragePoolObjPtr pool)
 
     VIR_FREE(pool->volumes.objs);
     pool->volumes.count = 0;
+    virStorageVolDefListResetIndexes(&pool->volumes);
+}
+
+
+/**
+ * virStoragePoolObjStashVols:
+ * @pool: storage pool object
+ *
+ * Empty the volume list of @pool ahead of a refresh, like
+ * virStoragePoolObjClearVols, but keep the volumes around as stale
+ * so that the backend may reuse those whose files have not changed.
+ * The caller must call virStoragePoolObjClearStaleVols once the
+ * refresh is done.
+ */
+void
+virStoragePoolObjStashVols(virStoragePoolObjPtr pool)
+{
+    virStoragePoolObjClearStaleVols(pool);
+
+    virStorageVolDefListResetIndexes(&pool->volumes);
+    pool->staleVolumes = pool->volumes;
+    pool->volumes.objs = NULL;
+    pool->volumes.count = 0;
+}
+
+
+void
+virStoragePoolObjClearStaleVols(virStoragePoolObjPtr pool)
+{
+    size_t i;
+    for (i = 0; i < pool->staleVolumes.count; i++)
+        virStorageVolDefFree(pool->staleVolumes.objs[i]);
+
+    VIR_FREE(pool->staleVolumes.objs);
+    pool->staleVolumes.count = 0;
 }
 
 
@@ -157,11 +374,20 @@ virStorageVolDefPtr
 virStorageVolDefFindByKey(virStoragePoolObjPtr pool,
                           const char *key)
 {
+    virStorageVolDefListPtr volumes = &pool->volumes;
     size_t i;
 
-    for (i = 0; i < pool->volumes.count; i++)
-        if (STREQ(pool->volumes.objs[i]->key, key))
-            return pool->volumes.objs[i];
+    if (!volumes->objsKey)
+        volumes->objsKey =
+            virStorageVolDefListIndexBuild(volumes, VIR_STORAGE_VOL_INDEX_KEY);
+    if (volumes->objsKey)
+        return virHashLookup(volumes->objsKey, key);
+
+    /* Out of memory for the index, but the lookup can still succeed */
+    virResetLastError();
+    for (i = 0; i < volumes->count; i++)
+        if (STREQ_NULLABLE(volumes->objs[i]->key, key))
+            return volumes->objs[i];
 
     return NULL;
 }
@@ -171,11 +397,20 @@ virStorageVolDefPtr
 virStorageVolDefFindByPath(virStoragePoolObjPtr pool,
                            const char *path)
 {
+    virStorageVolDefListPtr volumes = &pool->volumes;
     size_t i;
 
-    for (i = 0; i < pool->volumes.count; i++)
-        if (STREQ(pool->volumes.objs[i]->target.path, path))
-            return pool->volumes.objs[i];
+    if (!volumes->objsPath)
+        volumes->objsPath =
+            virStorageVolDefListIndexBuild(volumes, VIR_STORAGE_VOL_INDEX_PATH);
+    if (volumes->objsPath)
+        return virHashLookup(volumes->objsPath, path);
+
+    /* Out of memory for the index, but the lookup can still succeed */
+    virResetLastError();
+    for (i = 0; i < volumes->count; i++)
+        if (STREQ_NULLABLE(volumes->objs[i]->target.path, path))
+            return volumes->objs[i];
 
     return NULL;
 }
@@ -185,11 +420,15 @@ virStorageVolDefPtr
 virStorageVolDefFindByName(virStoragePoolObjPtr pool,
                            const char *name)
 {
+    virStorageVolDefListPtr volumes = &pool->volumes;
     size_t i;
 
-    for (i = 0; i < pool->volumes.count; i++)
-        if (STREQ(pool->volumes.objs[i]->name, name))
-            return pool->volumes.objs[i];
+    if (volumes->objsName)
+        return virHashLookup(volumes->objsName, name);
+
+    for (i = 0; i < volumes->count; i++)
+        if (STREQ(volumes->objs[i]->name, name))
+            return volumes->objs[i];
 
     return NULL;
 }
@@ -296,6 +535,7 @@ virStoragePoolObjPtr
 virStoragePoolObjAssignDef(virStoragePoolObjListPtr pools,
                            virStoragePoolDefPtr def)
 {
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
     virStoragePoolObjPtr pool;
 
     if ((pool = virStoragePoolObjFindByName(pools, def->name))) {
@@ -320,26 +560,44 @@ virStoragePoolObjAssignDef(virStoragePoolObjListPtr pools,
     }
     virStoragePoolObjLock(pool);
     pool->active = 0;
+    pool->watch = -1;
+
+    if (!pools->objsName &&
+        !(pools->objsName = virHashCreate(32, NULL)))
+        goto error;
+    if (!pools->objsUUID &&
+        !(pools->objsUUID = virHashCreate(32, NULL)))
+        goto error;
+
+    virUUIDFormat(def->uuid, uuidstr);
+    if (virHashAddEntry(pools->objsName, def->name, pool) < 0)
+        goto error;
+    if (virHashAddEntry(pools->objsUUID, uuidstr, pool) < 0) {
+        virHashRemoveEntry(pools->objsName, def->name);
+        goto error;
+    }
 
     if (VIR_APPEND_ELEMENT_COPY(pools->objs, pools->count, pool) < 0) {
-        virStoragePoolObjUnlock(pool);
-        virStoragePoolObjFree(pool);
-        return NULL;
+        virHashRemoveEntry(pools->objsName, def->name);
+        virHashRemoveEntry(pools->objsUUID, uuidstr);
+        goto error;
     }
     pool->def = def;
 
     return pool;
+
+ error:
+    virStoragePoolObjUnlock(pool);
+    virStoragePoolObjFree(pool);
+    return NULL;
 }
 
 
-static virStoragePoolObjPtr
-virStoragePoolObjLoad(virStoragePoolObjListPtr pools,
-                      const char *file,
-                      const char *path,
-                      const char *autostartLink)
+static virStoragePoolDefPtr
+virStoragePoolObjParseConfig(const char *file,
+                             const char *path)
 {
     virStoragePoolDefPtr def;
-    virStoragePoolObjPtr pool;
 
     if (!(def = virStoragePoolDefParseFile(path)))
         return NULL;
@@ -353,6 +611,18 @@ virStoragePoolObjLoad(virStoragePoolObjListPtr pools,
         return NULL;
     }
 
+    return def;
+}
+
+
+static virStoragePoolObjPtr
+virStoragePoolObjLoad(virStoragePoolObjListPtr pools,
+                      virStoragePoolDefPtr def,
+                      const char *path,
+                      const char *autostartLink)
+{
+    virStoragePoolObjPtr pool;
+
     if (!(pool = virStoragePoolObjAssignDef(pools, def))) {
         virStoragePoolDefFree(def);
         return NULL;
@@ -464,6 +734,27 @@ virStoragePoolObjLoadAllState(virStoragePoolObjListPtr pools,
 }
 
 
+typedef struct _virStoragePoolObjLoadEntry virStoragePoolObjLoadEntry;
+typedef virStoragePoolObjLoadEntry *virStoragePoolObjLoadEntryPtr;
+struct _virStoragePoolObjLoadEntry {
+    char *file;
+    char *path;
+    char *autostartLink;
+    virStoragePoolDefPtr def;
+};
+
+
+static void
+virStoragePoolObjParseEntry(size_t idx,
+                            void *opaque)
+{
+    virStoragePoolObjLoadEntryPtr entry = opaque;
+
+    entry[idx].def = virStoragePoolObjParseConfig(entry[idx].file,
+                                                  entry[idx].path);
+}
+
+
 int
 virStoragePoolObjLoadAllConfigs(virStoragePoolObjListPtr pools,
                                 const char *configDir,
@@ -471,39 +762,71 @@ virStoragePoolObjLoadAllConfigs(virStoragePoolObjListPtr pools,
 {
     DIR *dir;
     struct dirent *entry;
+    virStoragePoolObjLoadEntryPtr entries = NULL;
+    size_t nentries = 0;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
+    size_t i;
     int ret;
     int rc;
 
     if ((rc = virDirOpenIfExists(&dir, configDir)) <= 0)
         return rc;
 
+    ignore_value(virTimeMillisNow(&start));
+
     while ((ret = virDirRead(dir, &entry, configDir)) > 0) {
-        char *path;
-        char *autostartLink;
-        virStoragePoolObjPtr pool;
+        virStoragePoolObjLoadEntry tmp = { 0 };
 
         if (!virFileHasSuffix(entry->d_name, ".xml"))
             continue;
 
-        if (!(path = virFileBuildPath(configDir, entry->d_name, NULL)))
+        if (VIR_STRDUP(tmp.file, entry->d_name) < 0 ||
+            !(tmp.path = virFileBuildPath(configDir, entry->d_name, NULL)) ||
+            !(tmp.autostartLink = virFileBuildPath(autostartDir, entry->d_name,
+                                                   NULL)) ||
+            VIR_APPEND_ELEMENT(entries, nentries, tmp) < 0) {
+            VIR_FREE(tmp.file);
+            VIR_FREE(tmp.path);
+            VIR_FREE(tmp.autostartLink);
             continue;
+        }
+    }
+
+    VIR_DIR_CLOSE(dir);
 
-        if (!(autostartLink = virFileBuildPath(autostartDir, entry->d_name,
-                                               NULL))) {
-            VIR_FREE(path);
+    if (ret < 0)
+        goto cleanup;
+
+    /* Parse all the definitions in parallel first, the pool list is
+     * only touched afterwards and in the directory order. */
+    virThreadPoolParallelFor(nentries, 0, virStoragePoolObjParseEntry, entries);
+
+    for (i = 0; i < nentries; i++) {
+        virStoragePoolObjPtr pool;
+
+        if (!entries[i].def)
             continue;
-        }
 
-        pool = virStoragePoolObjLoad(pools, entry->d_name, path,
-                                     autostartLink);
+        pool = virStoragePoolObjLoad(pools, entries[i].def, entries[i].path,
+                                     entries[i].autostartLink);
+        entries[i].def = NULL;
         if (pool)
             virStoragePoolObjUnlock(pool);
-
-        VIR_FREE(path);
-        VIR_FREE(autostartLink);
     }
 
-    VIR_DIR_CLOSE(dir);
+    ignore_value(virTimeMillisNow(&end));
+    VIR_INFO("Loaded %zu storage pool configs from %s in %llu ms",
+             nentries, configDir, end - start);
+
+ cleanup:
+    for (i = 0; i < nentries; i++) {
+        VIR_FREE(entries[i].file);
+        VIR_FREE(entries[i].path);
+        VIR_FREE(entries[i].autostartLink);
+        virStoragePoolDefFree(entries[i].def);
+    }
+    VIR_FREE(entries);
     return ret;
 }
 
@@ -40,6 +40,12 @@ struct _virStoragePoolObj {
     virStoragePoolDefPtr newDef;
 
     virStorageVolDefList volumes;
+
+    /* Volumes of the previous refresh, which the backend may take
+     * over instead of probing unchanged files again */
+    virStorageVolDefList staleVolumes;
+
+    int watch; /* inotify event handle, or -1 */
 };
 
 typedef struct _virStoragePoolObjList virStoragePoolObjList;
@@ -47,6 +53,11 @@ typedef virStoragePoolObjList *virStoragePoolObjListPtr;
 struct _virStoragePoolObjList {
     size_t count;
     virStoragePoolObjPtr *objs;
+
+    /* Lookup indexes into @objs, keyed by the pool name and the
+     * formatted UUID */
+    virHashTablePtr objsName;
+    virHashTablePtr objsUUID;
 };
 
 typedef struct _virStorageDriverState virStorageDriverState;
@@ -105,9 +116,25 @@ virStorageVolDefPtr
 virStorageVolDefFindByName(virStoragePoolObjPtr pool,
                            const char *name);
 
+int
+virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                        virStorageVolDefPtr vol)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
+void
+virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                           virStorageVolDefPtr vol)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 void
 virStoragePoolObjClearVols(virStoragePoolObjPtr pool);
 
+void
+virStoragePoolObjStashVols(virStoragePoolObjPtr pool);
+
+void
+virStoragePoolObjClearStaleVols(virStoragePoolObjPtr pool);
+
 typedef bool
 (*virStoragePoolVolumeACLFilter)(virConnectPtr conn,
                                  virStoragePoolDefPtr pool,
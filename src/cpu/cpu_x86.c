@@ -32,6 +32,7 @@
 #include "cpu_x86.h"
 #include "virbuffer.h"
 #include "virendian.h"
+#include "virhash.h"
 #include "virstring.h"
 
 #define VIR_FROM_THIS VIR_FROM_CPU
@@ -51,12 +52,25 @@ struct _virCPUx86Vendor {
     virCPUx86CPUID cpuid;
 };
 
+/* A word of CPUID data in the compact representation, see
+ * x86MapCompile() */
+typedef struct _virCPUx86CompactWord virCPUx86CompactWord;
+typedef virCPUx86CompactWord *virCPUx86CompactWordPtr;
+struct _virCPUx86CompactWord {
+    size_t pos;
+    uint32_t bits;
+};
+
 typedef struct _virCPUx86Feature virCPUx86Feature;
 typedef virCPUx86Feature *virCPUx86FeaturePtr;
 struct _virCPUx86Feature {
     char *name;
     virCPUx86Data data;
     bool migratable;
+
+    /* non-zero words of @data in the compact representation */
+    size_t ncompact;
+    virCPUx86CompactWordPtr compact;
 };
 
 
@@ -137,6 +151,10 @@ struct _virCPUx86Model {
     virCPUx86VendorPtr vendor;
     uint32_t signature;
     virCPUx86Data data;
+
+    /* @data in the compact representation, only set for models in
+     * the map */
+    uint32_t *compact;
 };
 
 typedef struct _virCPUx86Map virCPUx86Map;
@@ -150,6 +168,14 @@ struct _virCPUx86Map {
     virCPUx86ModelPtr *models;
     size_t nblockers;
     virCPUx86FeaturePtr *migrate_blockers;
+
+    virHashTablePtr featureNames;
+    virHashTablePtr modelNames;
+
+    /* all the CPUID bits used by any feature; CPUID data restricted
+     * to them is stored as an array of leaves.len * 4 words, see
+     * x86MapCompile() */
+    virCPUx86Data leaves;
 };
 
 static virCPUx86MapPtr cpuMap;
@@ -749,6 +775,7 @@ x86FeatureFree(virCPUx86FeaturePtr feature)
 
     VIR_FREE(feature->name);
     virCPUx86DataClear(&feature->data);
+    VIR_FREE(feature->compact);
     VIR_FREE(feature);
 }
 
@@ -757,14 +784,7 @@ static virCPUx86FeaturePtr
 x86FeatureFind(virCPUx86MapPtr map,
                const char *name)
 {
-    size_t i;
-
-    for (i = 0; i < map->nfeatures; i++) {
-        if (STREQ(map->features[i]->name, name))
-            return map->features[i];
-    }
-
-    return NULL;
+    return virHashLookup(map->featureNames, name);
 }
 
 
@@ -957,6 +977,8 @@ x86FeaturesLoad(virCPUx86MapPtr map,
         if (!(feature = x86FeatureParse(ctxt, map)))
             return -1;
         map->features[map->nfeatures++] = feature;
+        if (virHashAddEntry(map->featureNames, feature->name, feature) < 0)
+            return -1;
         if (!feature->migratable &&
             VIR_APPEND_ELEMENT(map->migrate_blockers,
                                map->nblockers,
@@ -988,6 +1010,7 @@ x86ModelFree(virCPUx86ModelPtr model)
 
     VIR_FREE(model->name);
     virCPUx86DataClear(&model->data);
+    VIR_FREE(model->compact);
     VIR_FREE(model);
 }
 
@@ -1015,14 +1038,7 @@ static virCPUx86ModelPtr
 x86ModelFind(virCPUx86MapPtr map,
              const char *name)
 {
-    size_t i;
-
-    for (i = 0; i < map->nmodels; i++) {
-        if (STREQ(map->models[i]->name, name))
-            return map->models[i];
-    }
-
-    return NULL;
+    return virHashLookup(map->modelNames, name);
 }
 
 
@@ -1307,6 +1323,10 @@ x86ModelsLoad(virCPUx86MapPtr map,
         if (!(model = x86ModelParse(ctxt, map)))
             return -1;
         map->models[map->nmodels++] = model;
+        /* the first definition of a model wins */
+        if (!virHashLookup(map->modelNames, model->name) &&
+            virHashAddEntry(map->modelNames, model->name, model) < 0)
+            return -1;
     }
 
     return 0;
@@ -1338,6 +1358,10 @@ x86MapFree(virCPUx86MapPtr map)
      */
     VIR_FREE(map->migrate_blockers);
 
+    virHashFree(map->featureNames);
+    virHashFree(map->modelNames);
+    virCPUx86DataClear(&map->leaves);
+
     VIR_FREE(map);
 }
 
@@ -1366,6 +1390,101 @@ x86MapLoadCallback(cpuMapElement element,
 }
 
 
+/* Restricts @data to the bits used by the features in @map and
+ * stores the result in @compact, which has room for map->leaves.len * 4
+ * words.
+ */
+static void
+x86DataToCompact(virCPUx86MapPtr map,
+                 const virCPUx86Data *data,
+                 uint32_t *compact)
+{
+    size_t i;
+
+    for (i = 0; i < map->leaves.len; i++) {
+        const virCPUx86CPUID *leaf = map->leaves.data + i;
+        const virCPUx86CPUID *cpuid = x86DataCpuid(data, leaf);
+
+        if (!cpuid)
+            cpuid = &cpuidNull;
+
+        compact[i * 4] = cpuid->eax & leaf->eax;
+        compact[i * 4 + 1] = cpuid->ebx & leaf->ebx;
+        compact[i * 4 + 2] = cpuid->ecx & leaf->ecx;
+        compact[i * 4 + 3] = cpuid->edx & leaf->edx;
+    }
+}
+
+
+static int
+x86FeatureCompile(virCPUx86MapPtr map,
+                  virCPUx86FeaturePtr feature)
+{
+    uint32_t *compact = NULL;
+    size_t nwords = map->leaves.len * 4;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(compact, nwords) < 0)
+        return -1;
+
+    x86DataToCompact(map, &feature->data, compact);
+
+    for (i = 0; i < nwords; i++) {
+        virCPUx86CompactWord word = { .pos = i, .bits = compact[i] };
+
+        if (word.bits &&
+            VIR_APPEND_ELEMENT(feature->compact, feature->ncompact, word) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(compact);
+    return ret;
+}
+
+
+/*
+ * Choosing a model for CPUID data needs the features a CPU would have
+ * on top of each model in the map and the features it would lack. To
+ * avoid walking the variable length CPUID arrays, the choice is made
+ * on a compact copy of the data which only keeps the bits that some
+ * feature uses, in an array with fixed positions for each CPUID leaf.
+ * Every model gets such an array and every feature the list of its
+ * non-zero words.
+ */
+static int
+x86MapCompile(virCPUx86MapPtr map)
+{
+    size_t i;
+
+    for (i = 0; i < map->nfeatures; i++) {
+        if (x86DataAdd(&map->leaves, &map->features[i]->data) < 0)
+            return -1;
+    }
+
+    for (i = 0; i < map->nfeatures; i++) {
+        if (x86FeatureCompile(map, map->features[i]) < 0)
+            return -1;
+    }
+
+    for (i = 0; i < map->nmodels; i++) {
+        virCPUx86ModelPtr model = map->models[i];
+
+        if (VIR_ALLOC_N(model->compact, map->leaves.len * 4) < 0)
+            return -1;
+        x86DataToCompact(map, &model->data, model->compact);
+    }
+
+    VIR_DEBUG("Compiled CPU map with %zu features and %zu models "
+              "using %zu CPUID leaves",
+              map->nfeatures, map->nmodels, map->leaves.len);
+    return 0;
+}
+
+
 static virCPUx86MapPtr
 virCPUx86LoadMap(void)
 {
@@ -1374,7 +1493,12 @@ virCPUx86LoadMap(void)
     if (VIR_ALLOC(map) < 0)
         return NULL;
 
-    if (cpuMapLoad("x86", x86MapLoadCallback, map) < 0)
+    if (!(map->featureNames = virHashCreate(256, NULL)) ||
+        !(map->modelNames = virHashCreate(64, NULL)))
+        goto error;
+
+    if (cpuMapLoad("x86", x86MapLoadCallback, map) < 0 ||
+        x86MapCompile(map) < 0)
         goto error;
 
     return map;
@@ -1727,7 +1851,9 @@ virCPUx86Compare(virCPUDefPtr host,
 
 /*
  * Checks whether a candidate model is a better fit for the CPU data than the
- * current model.
+ * current model. The CPU would need @nrequired features on top of the
+ * candidate and @ndisabled of its features disabled; @ncurrent is the
+ * number of features needed with the current model.
  *
  * Returns 0 if current is better,
  *         1 if candidate is better,
@@ -1735,27 +1861,22 @@ virCPUx86Compare(virCPUDefPtr host,
  */
 static int
 x86DecodeUseCandidate(virCPUx86ModelPtr current,
-                      virCPUDefPtr cpuCurrent,
+                      size_t ncurrent,
                       virCPUx86ModelPtr candidate,
-                      virCPUDefPtr cpuCandidate,
+                      size_t nrequired,
+                      size_t ndisabled,
                       uint32_t signature,
                       const char *preferred,
                       bool checkPolicy)
 {
-    if (checkPolicy) {
-        size_t i;
-        for (i = 0; i < cpuCandidate->nfeatures; i++) {
-            if (cpuCandidate->features[i].policy == VIR_CPU_FEATURE_DISABLE)
-                return 0;
-            cpuCandidate->features[i].policy = -1;
-        }
-    }
+    if (checkPolicy && ndisabled > 0)
+        return 0;
 
     if (preferred &&
-        STREQ(cpuCandidate->model, preferred))
+        STREQ(candidate->name, preferred))
         return 2;
 
-    if (!cpuCurrent)
+    if (!current)
         return 1;
 
     /* Ideally we want to select a model with family/model equal to
@@ -1767,7 +1888,7 @@ x86DecodeUseCandidate(virCPUx86ModelPtr current,
         candidate->signature != signature)
         return 0;
 
-    if (cpuCurrent->nfeatures > cpuCandidate->nfeatures)
+    if (ncurrent > nrequired + ndisabled)
         return 1;
 
     /* Prefer a candidate with matching signature even though it would
@@ -1817,6 +1938,39 @@ x86DataFilterTSX(virCPUx86Data *data,
 }
 
 
+/*
+ * Counts the features x86DataToCPUFeatures() would find in the compact
+ * CPUID data @compact, which is consumed in the process.
+ */
+static size_t
+x86CompactCountFeatures(uint32_t *compact,
+                        virCPUx86MapPtr map)
+{
+    size_t count = 0;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < map->nfeatures; i++) {
+        virCPUx86FeaturePtr feature = map->features[i];
+
+        for (j = 0; j < feature->ncompact; j++) {
+            virCPUx86CompactWordPtr word = feature->compact + j;
+
+            if ((compact[word->pos] & word->bits) != word->bits)
+                break;
+        }
+        if (j < feature->ncompact)
+            continue;
+
+        for (j = 0; j < feature->ncompact; j++)
+            compact[feature->compact[j].pos] &= ~feature->compact[j].bits;
+        count++;
+    }
+
+    return count;
+}
+
+
 static int
 x86Decode(virCPUDefPtr cpu,
           const virCPUx86Data *cpuData,
@@ -1828,15 +1982,22 @@ x86Decode(virCPUDefPtr cpu,
     int ret = -1;
     virCPUx86MapPtr map;
     virCPUx86ModelPtr candidate;
-    virCPUDefPtr cpuCandidate;
     virCPUx86ModelPtr model = NULL;
+    size_t nfeatures = 0;
     virCPUDefPtr cpuModel = NULL;
+    uint32_t *compact = NULL;
+    uint32_t *required = NULL;
+    uint32_t *disabled = NULL;
+    size_t nwords;
+    size_t nrequired;
+    size_t ndisabled;
     virCPUx86Data data = VIR_CPU_X86_DATA_INIT;
     virCPUx86Data copy = VIR_CPU_X86_DATA_INIT;
     virCPUx86Data features = VIR_CPU_X86_DATA_INIT;
     virCPUx86VendorPtr vendor;
     uint32_t signature;
     ssize_t i;
+    size_t j;
     int rc;
 
     if (!cpuData || x86DataCopy(&data, cpuData) < 0)
@@ -1850,8 +2011,16 @@ x86Decode(virCPUDefPtr cpu,
 
     x86DataFilterTSX(&data, vendor, map);
 
+    nwords = map->leaves.len * 4;
+    if (VIR_ALLOC_N(compact, nwords) < 0 ||
+        VIR_ALLOC_N(required, nwords) < 0 ||
+        VIR_ALLOC_N(disabled, nwords) < 0)
+        goto cleanup;
+    x86DataToCompact(map, &data, compact);
+
     /* Walk through the CPU models in reverse order to check newest
-     * models first.
+     * models first. Only the number of features matters for the choice,
+     * so they are just counted in the compact data here.
      */
     for (i = map->nmodels - 1; i >= 0; i--) {
         candidate = map->models[i];
@@ -1883,30 +2052,40 @@ x86Decode(virCPUDefPtr cpu,
             continue;
         }
 
-        if (!(cpuCandidate = x86DataToCPU(&data, candidate, map)))
-            goto cleanup;
-        cpuCandidate->type = cpu->type;
+        for (j = 0; j < nwords; j++) {
+            required[j] = compact[j] & ~candidate->compact[j];
+            disabled[j] = candidate->compact[j] & ~compact[j];
+        }
+        nrequired = x86CompactCountFeatures(required, map);
+        ndisabled = x86CompactCountFeatures(disabled, map);
 
-        if ((rc = x86DecodeUseCandidate(model, cpuModel,
-                                        candidate, cpuCandidate,
+        if ((rc = x86DecodeUseCandidate(model, nfeatures,
+                                        candidate, nrequired, ndisabled,
                                         signature, preferred,
                                         cpu->type == VIR_CPU_TYPE_HOST))) {
-            virCPUDefFree(cpuModel);
-            cpuModel = cpuCandidate;
             model = candidate;
+            nfeatures = nrequired + ndisabled;
             if (rc == 2)
                 break;
-        } else {
-            virCPUDefFree(cpuCandidate);
         }
     }
 
-    if (!cpuModel) {
+    if (!model) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("Cannot find suitable CPU model for given data"));
         goto cleanup;
     }
 
+    if (!(cpuModel = x86DataToCPU(&data, model, map)))
+        goto cleanup;
+    cpuModel->type = cpu->type;
+
+    /* because feature policy is ignored for host CPU */
+    if (cpu->type == VIR_CPU_TYPE_HOST) {
+        for (j = 0; j < cpuModel->nfeatures; j++)
+            cpuModel->features[j].policy = -1;
+    }
+
     /* Remove non-migratable features if requested
      * Note: this only works as long as no CPU model contains non-migratable
      * features directly */
@@ -1937,6 +2116,9 @@ x86Decode(virCPUDefPtr cpu,
 
  cleanup:
     virCPUDefFree(cpuModel);
+    VIR_FREE(compact);
+    VIR_FREE(required);
+    VIR_FREE(disabled);
     virCPUx86DataClear(&data);
     virCPUx86DataClear(&copy);
     virCPUx86DataClear(&features);
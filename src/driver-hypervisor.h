@@ -1263,6 +1263,19 @@ typedef int
                                  unsigned long long threshold,
                                  unsigned int flags);
 
+typedef int
+(*virDrvDomainStartDirtyRateCalc)(virDomainPtr domain,
+                                  int seconds,
+                                  unsigned int flags);
+
+typedef int
+(*virDrvDomainBlockBackup)(virDomainPtr dom,
+                           const char *path,
+                           const char *destxml,
+                           virTypedParameterPtr params,
+                           int nparams,
+                           unsigned int flags);
+
 
 typedef struct _virHypervisorDriver virHypervisorDriver;
 typedef virHypervisorDriver *virHypervisorDriverPtr;
@@ -1504,6 +1517,8 @@ struct _virHypervisorDriver {
     virDrvDomainSetGuestVcpus domainSetGuestVcpus;
     virDrvDomainSetVcpu domainSetVcpu;
     virDrvDomainSetBlockThreshold domainSetBlockThreshold;
+    virDrvDomainStartDirtyRateCalc domainStartDirtyRateCalc;
+    virDrvDomainBlockBackup domainBlockBackup;
 };
 
 
@@ -55,7 +55,9 @@ virDriverLoadModuleFile(const char *file)
 
     virUpdateSelfLastChanged(file);
 
-    if (!(handle = dlopen(file, RTLD_NOW | RTLD_GLOBAL)))
+    /* Modules are never unloaded as the logging code keeps pointers to
+     * their log sources */
+    if (!(handle = dlopen(file, RTLD_NOW | RTLD_GLOBAL | RTLD_NODELETE)))
         VIR_ERROR(_("failed to load module %s %s"), file, dlerror());
 
     return handle;
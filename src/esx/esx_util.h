@@ -33,6 +33,7 @@ struct _esxUtil_ParsedUri {
     char *vCenter;
     bool noVerify;
     bool autoAnswer;
+    bool cache;
     bool proxy;
     int proxy_type;
     char *proxy_hostname;
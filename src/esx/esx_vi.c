@@ -341,6 +341,11 @@ esxVI_CURL_Connect(esxVI_CURL *curl, esxUtil_ParsedUri *parsedUri)
     curl_easy_setopt(curl->handle, CURLOPT_WRITEFUNCTION,
                      esxVI_CURL_WriteBuffer);
     curl_easy_setopt(curl->handle, CURLOPT_ERRORBUFFER, curl->error);
+#if LIBCURL_VERSION_NUM >= 0x071900 /* 7.25.0 */
+    /* The connection is reused for all calls, keep it from being dropped
+     * by firewalls while idle */
+    curl_easy_setopt(curl->handle, CURLOPT_TCP_KEEPALIVE, 1L);
+#endif
 #if ESX_VI__CURL__ENABLE_DEBUG_OUTPUT
     curl_easy_setopt(curl->handle, CURLOPT_DEBUGFUNCTION, esxVI_CURL_Debug);
     curl_easy_setopt(curl->handle, CURLOPT_VERBOSE, 1);
@@ -400,6 +405,7 @@ esxVI_CURL_Download(esxVI_CURL *curl, const char *url, char **content,
 
     curl_easy_setopt(curl->handle, CURLOPT_URL, url);
     curl_easy_setopt(curl->handle, CURLOPT_RANGE, range);
+    curl_easy_setopt(curl->handle, CURLOPT_ENCODING, NULL);
     curl_easy_setopt(curl->handle, CURLOPT_WRITEDATA, &buffer);
     curl_easy_setopt(curl->handle, CURLOPT_UPLOAD, 0);
     curl_easy_setopt(curl->handle, CURLOPT_HTTPGET, 1);
@@ -968,6 +974,9 @@ ESX_VI__TEMPLATE__FREE(Context,
     if (item->sessionLock)
         virMutexDestroy(item->sessionLock);
 
+    if (item->inventoryLock)
+        virMutexDestroy(item->inventoryLock);
+
     esxVI_CURL_Free(&item->curl);
     VIR_FREE(item->url);
     VIR_FREE(item->ipAddress);
@@ -989,8 +998,28 @@ ESX_VI__TEMPLATE__FREE(Context,
     esxVI_SelectionSpec_Free(&item->selectSet_computeResourceToHost);
     esxVI_SelectionSpec_Free(&item->selectSet_computeResourceToParentToParent);
     esxVI_SelectionSpec_Free(&item->selectSet_datacenterToNetwork);
+    VIR_FREE(item->inventoryLock);
+    esxVI_ManagedObjectReference_Free(&item->inventoryCollector);
+    VIR_FREE(item->inventoryVersion);
+    esxVI_ObjectContent_Free(&item->inventory);
+    virHashFree(item->inventoryObjects);
 })
 
+
+
+/* The caller must hold ctx->inventoryLock */
+static void
+esxVI_ResetInventory(esxVI_Context *ctx)
+{
+    esxVI_ManagedObjectReference_Free(&ctx->inventoryCollector);
+    VIR_FREE(ctx->inventoryVersion);
+    esxVI_ObjectContent_Free(&ctx->inventory);
+    virHashFree(ctx->inventoryObjects);
+    ctx->inventoryObjects = NULL;
+}
+
+
+
 int
 esxVI_Context_Connect(esxVI_Context *ctx, const char *url,
                       const char *ipAddress, const char *username,
@@ -1119,6 +1148,26 @@ esxVI_Context_Connect(esxVI_Context *ctx, const char *url,
     if (ctx->productLine == esxVI_ProductLine_VPX)
         ctx->hasSessionIsActive = true;
 
+    if (parsedUri->cache) {
+        /* The inventory cache is refreshed using WaitForUpdatesEx */
+        if (ctx->apiVersion < 1000000 * 4 + 1000 * 1 /* 4.1 */) {
+            VIR_WARN("Inventory cache requires %s version %s but found "
+                     "version '%s', disabling it", "VI API", "4.1",
+                     ctx->service->about->apiVersion);
+        } else {
+            if (VIR_ALLOC(ctx->inventoryLock) < 0)
+                goto cleanup;
+
+            if (virMutexInit(ctx->inventoryLock) < 0) {
+                VIR_FREE(ctx->inventoryLock);
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("Could not initialize inventory mutex"));
+                goto cleanup;
+            }
+
+            ctx->hasInventoryCache = true;
+        }
+    }
 
 
     if (esxVI_Login(ctx, username, escapedPassword, NULL, &ctx->session) < 0 ||
@@ -1433,6 +1482,8 @@ esxVI_Context_Execute(esxVI_Context *ctx, const char *methodName,
 
     curl_easy_setopt(ctx->curl->handle, CURLOPT_URL, ctx->url);
     curl_easy_setopt(ctx->curl->handle, CURLOPT_RANGE, NULL);
+    /* SOAP responses are verbose XML, let the server compress them */
+    curl_easy_setopt(ctx->curl->handle, CURLOPT_ENCODING, "");
     curl_easy_setopt(ctx->curl->handle, CURLOPT_WRITEDATA, &buffer);
     curl_easy_setopt(ctx->curl->handle, CURLOPT_UPLOAD, 0);
     curl_easy_setopt(ctx->curl->handle, CURLOPT_POSTFIELDS, request);
@@ -2133,6 +2184,14 @@ esxVI_EnsureSession(esxVI_Context *ctx)
                         &ctx->session) < 0) {
             goto cleanup;
         }
+
+        /* The property collector of the inventory cache went away with
+         * the old session */
+        if (ctx->hasInventoryCache) {
+            virMutexLock(ctx->inventoryLock);
+            esxVI_ResetInventory(ctx);
+            virMutexUnlock(ctx->inventoryLock);
+        }
     } else if (STRNEQ(ctx->session->key, currentSession->key)) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Key of the current session differs from the key at "
@@ -2889,11 +2948,421 @@ esxVI_LookupHostSystemProperties(esxVI_Context *ctx,
 
 
 
+/*
+ * With the 'cache' URI parameter the identity and power state of all
+ * VirtualMachine objects are kept in ctx->inventory. Instead of
+ * retrieving these properties of every VirtualMachine again for each
+ * lookup, a dedicated property collector reports what changed since
+ * ctx->inventoryVersion. Lookups that need other properties still go
+ * to the server.
+ */
+static const char *esxVI_InventoryPropertyList[] = {
+    "configStatus",
+    "name",
+    "config.uuid",
+    "runtime.powerState",
+};
+
+
+
+static bool
+esxVI_InventoryCovers(esxVI_String *propertyNameList)
+{
+    esxVI_String *propertyName;
+    size_t i;
+
+    for (propertyName = propertyNameList; propertyName;
+         propertyName = propertyName->_next) {
+        for (i = 0; i < ARRAY_CARDINALITY(esxVI_InventoryPropertyList); i++) {
+            if (STREQ(propertyName->value, esxVI_InventoryPropertyList[i]))
+                break;
+        }
+
+        if (i == ARRAY_CARDINALITY(esxVI_InventoryPropertyList))
+            return false;
+    }
+
+    return true;
+}
+
+
+
+static int
+esxVI_CreateInventory(esxVI_Context *ctx)
+{
+    int result = -1;
+    esxVI_ObjectSpec *objectSpec = NULL;
+    bool objectSpec_isAppended = false;
+    esxVI_PropertySpec *propertySpec = NULL;
+    bool propertySpec_isAppended = false;
+    esxVI_PropertyFilterSpec *propertyFilterSpec = NULL;
+    esxVI_ManagedObjectReference *propertyFilter = NULL;
+    size_t i;
+
+    if (esxVI_ObjectSpec_Alloc(&objectSpec) < 0)
+        return -1;
+
+    /* FIXME: Switch from ctx->hostSystem to ctx->computeResource->resourcePool
+     *        for cluster support */
+    objectSpec->obj = ctx->hostSystem->_reference;
+    objectSpec->skip = esxVI_Boolean_False;
+    objectSpec->selectSet = ctx->selectSet_hostSystemToVm;
+
+    if (esxVI_PropertySpec_Alloc(&propertySpec) < 0)
+        goto cleanup;
+
+    propertySpec->type = (char *)"VirtualMachine";
+
+    for (i = 0; i < ARRAY_CARDINALITY(esxVI_InventoryPropertyList); i++) {
+        if (esxVI_String_AppendValueToList(&propertySpec->pathSet,
+                                           esxVI_InventoryPropertyList[i]) < 0)
+            goto cleanup;
+    }
+
+    if (esxVI_PropertyFilterSpec_Alloc(&propertyFilterSpec) < 0 ||
+        esxVI_PropertySpec_AppendToList(&propertyFilterSpec->propSet,
+                                        propertySpec) < 0) {
+        goto cleanup;
+    }
+
+    propertySpec_isAppended = true;
+
+    if (esxVI_ObjectSpec_AppendToList(&propertyFilterSpec->objectSet,
+                                      objectSpec) < 0) {
+        goto cleanup;
+    }
+
+    objectSpec_isAppended = true;
+
+    /* The filter lives as long as the collector it was created on */
+    if (esxVI_CreatePropertyCollector(ctx, ctx->service->propertyCollector,
+                                      &ctx->inventoryCollector) < 0 ||
+        esxVI_CreateFilter(ctx, ctx->inventoryCollector, propertyFilterSpec,
+                           esxVI_Boolean_True, &propertyFilter) < 0 ||
+        VIR_STRDUP(ctx->inventoryVersion, "") < 0 ||
+        !(ctx->inventoryObjects = virHashCreate(64, NULL))) {
+        goto cleanup;
+    }
+
+    result = 0;
+
+ cleanup:
+    /*
+     * Remove values given by the context from the data structures to
+     * prevent them from being freed by the call to
+     * esxVI_PropertyFilterSpec_Free(). objectSpec cannot be NULL here.
+     */
+    objectSpec->obj = NULL;
+    objectSpec->selectSet = NULL;
+
+    if (propertySpec)
+        propertySpec->type = NULL;
+
+    if (!objectSpec_isAppended)
+        esxVI_ObjectSpec_Free(&objectSpec);
+
+    if (!propertySpec_isAppended)
+        esxVI_PropertySpec_Free(&propertySpec);
+
+    esxVI_PropertyFilterSpec_Free(&propertyFilterSpec);
+    esxVI_ManagedObjectReference_Free(&propertyFilter);
+
+    return result;
+}
+
+
+
+static int
+esxVI_ApplyInventoryChange(esxVI_ObjectContent *objectContent,
+                           esxVI_PropertyChange *propertyChange)
+{
+    esxVI_DynamicProperty **next;
+    esxVI_DynamicProperty *dynamicProperty = NULL;
+    size_t i;
+
+    /* Partial updates of the properties of the inventory only ever
+     * report the whole property, as they are all simple types */
+    for (i = 0; i < ARRAY_CARDINALITY(esxVI_InventoryPropertyList); i++) {
+        if (STREQ(propertyChange->name, esxVI_InventoryPropertyList[i]))
+            break;
+    }
+
+    if (i == ARRAY_CARDINALITY(esxVI_InventoryPropertyList)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected change of '%s' property of '%s'"),
+                       propertyChange->name, objectContent->obj->value);
+        return -1;
+    }
+
+    for (next = &objectContent->propSet; *next; next = &(*next)->_next) {
+        if (STREQ((*next)->name, propertyChange->name))
+            break;
+    }
+
+    if ((propertyChange->op == esxVI_PropertyChangeOp_Add ||
+         propertyChange->op == esxVI_PropertyChangeOp_Assign) &&
+        propertyChange->val) {
+        if (esxVI_DynamicProperty_Alloc(&dynamicProperty) < 0 ||
+            VIR_STRDUP(dynamicProperty->name, propertyChange->name) < 0 ||
+            esxVI_AnyType_DeepCopy(&dynamicProperty->val,
+                                   propertyChange->val) < 0) {
+            esxVI_DynamicProperty_Free(&dynamicProperty);
+            return -1;
+        }
+    }
+
+    /* Replace or drop the old value */
+    if (*next) {
+        esxVI_DynamicProperty *old = *next;
+
+        *next = old->_next;
+        old->_next = NULL;
+        esxVI_DynamicProperty_Free(&old);
+    }
+
+    if (dynamicProperty) {
+        dynamicProperty->_next = *next;
+        *next = dynamicProperty;
+    }
+
+    return 0;
+}
+
+
+
+static void
+esxVI_RemoveInventoryObject(esxVI_Context *ctx,
+                            esxVI_ObjectContent *objectContent)
+{
+    esxVI_ObjectContent **next;
+
+    for (next = &ctx->inventory; *next; next = &(*next)->_next) {
+        if (*next == objectContent) {
+            *next = objectContent->_next;
+            break;
+        }
+    }
+
+    virHashRemoveEntry(ctx->inventoryObjects, objectContent->obj->value);
+    objectContent->_next = NULL;
+    esxVI_ObjectContent_Free(&objectContent);
+}
+
+
+
+static int
+esxVI_ApplyInventoryUpdates(esxVI_Context *ctx, esxVI_UpdateSet *updateSet)
+{
+    esxVI_PropertyFilterUpdate *propertyFilterUpdate;
+    esxVI_ObjectUpdate *objectUpdate;
+    esxVI_PropertyChange *propertyChange;
+    esxVI_ObjectContent *objectContent;
+
+    for (propertyFilterUpdate = updateSet->filterSet; propertyFilterUpdate;
+         propertyFilterUpdate = propertyFilterUpdate->_next) {
+        for (objectUpdate = propertyFilterUpdate->objectSet; objectUpdate;
+             objectUpdate = objectUpdate->_next) {
+            objectContent = virHashLookup(ctx->inventoryObjects,
+                                          objectUpdate->obj->value);
+
+            if (objectUpdate->kind == esxVI_ObjectUpdateKind_Leave) {
+                if (objectContent)
+                    esxVI_RemoveInventoryObject(ctx, objectContent);
+
+                continue;
+            }
+
+            if (!objectContent) {
+                if (objectUpdate->kind != esxVI_ObjectUpdateKind_Enter) {
+                    virReportError(VIR_ERR_INTERNAL_ERROR,
+                                   _("Update of unknown object '%s'"),
+                                   objectUpdate->obj->value);
+                    return -1;
+                }
+
+                if (esxVI_ObjectContent_Alloc(&objectContent) < 0)
+                    return -1;
+
+                if (esxVI_ManagedObjectReference_DeepCopy(&objectContent->obj,
+                                                          objectUpdate->obj) < 0 ||
+                    virHashAddEntry(ctx->inventoryObjects,
+                                    objectContent->obj->value,
+                                    objectContent) < 0) {
+                    esxVI_ObjectContent_Free(&objectContent);
+                    return -1;
+                }
+
+                /* Cannot fail, the item is not part of a list yet */
+                ignore_value(esxVI_ObjectContent_AppendToList(&ctx->inventory,
+                                                              objectContent));
+            }
+
+            for (propertyChange = objectUpdate->changeSet; propertyChange;
+                 propertyChange = propertyChange->_next) {
+                if (esxVI_ApplyInventoryChange(objectContent,
+                                               propertyChange) < 0)
+                    return -1;
+            }
+        }
+    }
+
+    VIR_FREE(ctx->inventoryVersion);
+
+    return VIR_STRDUP(ctx->inventoryVersion, updateSet->version);
+}
+
+
+
+/*
+ * Bring ctx->inventory up to date, without waiting for changes. On
+ * error the inventory is dropped and built from scratch next time.
+ * The caller must hold ctx->inventoryLock.
+ */
+static int
+esxVI_RefreshInventory(esxVI_Context *ctx)
+{
+    int result = -1;
+    esxVI_WaitOptions *waitOptions = NULL;
+    esxVI_UpdateSet *updateSet = NULL;
+    bool truncated = true;
+
+    if (!ctx->inventoryCollector && esxVI_CreateInventory(ctx) < 0)
+        goto cleanup;
+
+    if (esxVI_WaitOptions_Alloc(&waitOptions) < 0 ||
+        esxVI_Int_Alloc(&waitOptions->maxWaitSeconds) < 0) {
+        goto cleanup;
+    }
+
+    waitOptions->maxWaitSeconds->value = 0;
+
+    /* The initial update of a large inventory can come in pieces */
+    while (truncated) {
+        esxVI_UpdateSet_Free(&updateSet);
+
+        if (esxVI_WaitForUpdatesEx(ctx, ctx->inventoryCollector,
+                                   ctx->inventoryVersion, waitOptions,
+                                   &updateSet) < 0) {
+            goto cleanup;
+        }
+
+        if (!updateSet)
+            break;
+
+        if (esxVI_ApplyInventoryUpdates(ctx, updateSet) < 0)
+            goto cleanup;
+
+        truncated = updateSet->truncated == esxVI_Boolean_True;
+    }
+
+    result = 0;
+
+ cleanup:
+    if (result < 0) {
+        /* Best effort, the collector may already be gone with the session */
+        if (ctx->inventoryCollector &&
+            esxVI_DestroyPropertyCollector(ctx, ctx->inventoryCollector) < 0)
+            VIR_DEBUG("DestroyPropertyCollector failed");
+
+        esxVI_ResetInventory(ctx);
+    }
+
+    esxVI_WaitOptions_Free(&waitOptions);
+    esxVI_UpdateSet_Free(&updateSet);
+
+    return result;
+}
+
+
+
+static int
+esxVI_LookupCachedVirtualMachineList(esxVI_Context *ctx,
+                                     esxVI_ObjectContent **virtualMachineList)
+{
+    int result = -1;
+
+    virMutexLock(ctx->inventoryLock);
+
+    if (esxVI_RefreshInventory(ctx) < 0 ||
+        esxVI_ObjectContent_DeepCopyList(virtualMachineList,
+                                         ctx->inventory) < 0) {
+        goto cleanup;
+    }
+
+    result = 0;
+
+ cleanup:
+    virMutexUnlock(ctx->inventoryLock);
+
+    return result;
+}
+
+
+
+/*
+ * Returns 1 and sets @virtualMachine if the inventory has a
+ * VirtualMachine with @uuid_string, 0 if not and -1 on error.
+ */
+static int
+esxVI_LookupCachedVirtualMachineByUuid(esxVI_Context *ctx,
+                                       const char *uuid_string,
+                                       esxVI_ObjectContent **virtualMachine)
+{
+    int result = -1;
+    esxVI_ObjectContent *candidate;
+    esxVI_DynamicProperty *dynamicProperty;
+
+    virMutexLock(ctx->inventoryLock);
+
+    if (esxVI_RefreshInventory(ctx) < 0)
+        goto cleanup;
+
+    result = 0;
+
+    for (candidate = ctx->inventory; candidate;
+         candidate = candidate->_next) {
+        for (dynamicProperty = candidate->propSet; dynamicProperty;
+             dynamicProperty = dynamicProperty->_next) {
+            if (STREQ(dynamicProperty->name, "config.uuid"))
+                break;
+        }
+
+        if (!dynamicProperty ||
+            dynamicProperty->val->type != esxVI_Type_String ||
+            STRCASENEQ(dynamicProperty->val->string, uuid_string)) {
+            continue;
+        }
+
+        if (esxVI_ObjectContent_DeepCopy(virtualMachine, candidate) < 0)
+            result = -1;
+        else
+            result = 1;
+
+        break;
+    }
+
+ cleanup:
+    virMutexUnlock(ctx->inventoryLock);
+
+    return result;
+}
+
+
+
 int
 esxVI_LookupVirtualMachineList(esxVI_Context *ctx,
                                esxVI_String *propertyNameList,
                                esxVI_ObjectContent **virtualMachineList)
 {
+    if (ctx->hasInventoryCache && esxVI_InventoryCovers(propertyNameList)) {
+        if (esxVI_LookupCachedVirtualMachineList(ctx, virtualMachineList) == 0)
+            return 0;
+
+        VIR_WARN("Inventory cache lookup failed, retrieving properties "
+                 "directly: %s", virGetLastErrorMessage());
+        virResetLastError();
+    }
+
     /* FIXME: Switch from ctx->hostSystem to ctx->computeResource->resourcePool
      *        for cluster support */
     return esxVI_LookupObjectContentByType(ctx, ctx->hostSystem->_reference,
@@ -2921,6 +3390,21 @@ esxVI_LookupVirtualMachineByUuid(esxVI_Context *ctx, const unsigned char *uuid,
 
     virUUIDFormat(uuid, uuid_string);
 
+    /* The inventory only covers this host, so a miss is not final */
+    if (ctx->hasInventoryCache && esxVI_InventoryCovers(propertyNameList)) {
+        int rc = esxVI_LookupCachedVirtualMachineByUuid(ctx, uuid_string,
+                                                        virtualMachine);
+
+        if (rc > 0)
+            return 0;
+
+        if (rc < 0) {
+            VIR_WARN("Inventory cache lookup failed, retrieving properties "
+                     "directly: %s", virGetLastErrorMessage());
+            virResetLastError();
+        }
+    }
+
     if (esxVI_FindByUuid(ctx, ctx->datacenter->_reference, uuid_string,
                          esxVI_Boolean_True, esxVI_Boolean_Undefined,
                          &managedObjectReference) < 0) {
@@ -4541,7 +5025,8 @@ esxVI_WaitForTaskCompletion(esxVI_Context *ctx,
 
     objectSpec_isAppended = true;
 
-    if (esxVI_CreateFilter(ctx, propertyFilterSpec, esxVI_Boolean_True,
+    if (esxVI_CreateFilter(ctx, ctx->service->propertyCollector,
+                           propertyFilterSpec, esxVI_Boolean_True,
                            &propertyFilter) < 0) {
         goto cleanup;
     }
@@ -29,6 +29,7 @@
 
 # include "internal.h"
 # include "virerror.h"
+# include "virhash.h"
 # include "datatypes.h"
 # include "esx_vi_types.h"
 # include "esx_util.h"
@@ -210,6 +211,12 @@ struct _esxVI_Context {
     esxVI_SelectionSpec *selectSet_datacenterToNetwork;
     bool hasQueryVirtualDiskUuid;
     bool hasSessionIsActive;
+    bool hasInventoryCache;
+    virMutexPtr inventoryLock; /* protects the following inventory cache */
+    esxVI_ManagedObjectReference *inventoryCollector;
+    char *inventoryVersion;
+    esxVI_ObjectContent *inventory;
+    virHashTablePtr inventoryObjects; /* inventory items by object value */
 };
 
 int esxVI_Context_Alloc(esxVI_Context **ctx);
@@ -46,11 +46,14 @@ hypervFreePrivate(hypervPrivate **priv)
     if (priv == NULL || *priv == NULL)
         return;
 
+    hypervWmiCacheClear(*priv);
+
     if ((*priv)->client != NULL) {
         /* FIXME: This leaks memory due to bugs in openwsman <= 2.2.6 */
         wsmc_release((*priv)->client);
     }
 
+    virMutexDestroy(&(*priv)->cacheLock);
     hypervFreeParsedUri(&(*priv)->parsedUri);
     VIR_FREE(*priv);
 }
@@ -170,6 +173,13 @@ hypervConnectOpen(virConnectPtr conn, virConnectAuthPtr auth,
     if (VIR_ALLOC(priv) < 0)
         goto cleanup;
 
+    if (virMutexInit(&priv->cacheLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(priv);
+        goto cleanup;
+    }
+
     if (hypervParseUri(&priv->parsedUri, conn->uri) < 0)
         goto cleanup;
 
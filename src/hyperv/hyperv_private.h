@@ -25,6 +25,7 @@
 
 # include "internal.h"
 # include "virerror.h"
+# include "virthread.h"
 # include "hyperv_util.h"
 # include "openwsman.h"
 
@@ -34,11 +35,18 @@ enum _hypervWmiVersion {
     HYPERV_WMI_VERSION_V2,
 };
 
+typedef struct _hypervWmiCacheEntry hypervWmiCacheEntry;
+
 typedef struct _hypervPrivate hypervPrivate;
 struct _hypervPrivate {
     hypervParsedUri *parsedUri;
     WsManClient *client;
     hypervWmiVersion wmiVersion;
+
+    /* Responses to recent queries, see hypervEnumAndPull */
+    virMutex cacheLock;
+    hypervWmiCacheEntry *cache;
+    size_t ncache;
 };
 
 #endif /* __HYPERV_PRIVATE_H__ */
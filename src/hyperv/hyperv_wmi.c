@@ -33,11 +33,15 @@
 #include "hyperv_private.h"
 #include "hyperv_wmi.h"
 #include "virstring.h"
+#include "virtime.h"
+#include "virlog.h"
 
 #define WS_SERIALIZER_FREE_MEM_WORKS 0
 
 #define VIR_FROM_THIS VIR_FROM_HYPERV
 
+VIR_LOG_INIT("hyperv.hyperv_wmi");
+
 
 static int
 hypervGetWmiClassInfo(hypervPrivate *priv, hypervWmiClassInfoListPtr list,
@@ -147,24 +151,211 @@ hypervVerifyResponse(WsManClient *client, WsXmlDocH response,
  * Object
  */
 
+/* How many instances to ask for in a single enumerate or pull request */
+#define HYPERV_WMI_MAX_ELEMENTS 32
+
+/* For how long and how many query responses are remembered; this is only
+ * meant to coalesce the bursts of identical queries that e.g. listing
+ * domains with their info results in */
+#define HYPERV_WMI_CACHE_TTL 2000 /* milliseconds */
+#define HYPERV_WMI_CACHE_MAX 64
+
+struct _hypervWmiCacheEntry {
+    char *key;                  /* resource URI and WQL query */
+    unsigned long long expires; /* milliseconds since the epoch */
+    WsXmlDocH *responses;
+    size_t nresponses;
+    hypervWmiCacheEntry *next;
+};
+
+static void
+hypervWmiCacheEntryFree(hypervWmiCacheEntry *entry)
+{
+    size_t i;
+
+    if (entry == NULL)
+        return;
+
+    for (i = 0; i < entry->nresponses; i++)
+        ws_xml_destroy_doc(entry->responses[i]);
+
+    VIR_FREE(entry->responses);
+    VIR_FREE(entry->key);
+    VIR_FREE(entry);
+}
+
+/* Must be called with priv->cacheLock held */
+static void
+hypervWmiCachePurge(hypervPrivate *priv, unsigned long long now)
+{
+    hypervWmiCacheEntry **entry = &priv->cache;
+
+    while (*entry != NULL) {
+        hypervWmiCacheEntry *tmp = *entry;
+
+        if (now < tmp->expires) {
+            entry = &tmp->next;
+            continue;
+        }
+
+        *entry = tmp->next;
+        hypervWmiCacheEntryFree(tmp);
+        priv->ncache--;
+    }
+}
+
+void
+hypervWmiCacheClear(hypervPrivate *priv)
+{
+    virMutexLock(&priv->cacheLock);
+    hypervWmiCachePurge(priv, ULLONG_MAX);
+    virMutexUnlock(&priv->cacheLock);
+}
+
+/* Steals @responses, unless remembering them fails */
+static void
+hypervWmiCacheAdd(hypervPrivate *priv, const char *key,
+                  WsXmlDocH **responses, size_t *nresponses)
+{
+    hypervWmiCacheEntry *entry = NULL;
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0 || VIR_ALLOC(entry) < 0 ||
+        VIR_STRDUP(entry->key, key) < 0) {
+        VIR_FREE(entry);
+        virResetLastError();
+        return;
+    }
+
+    entry->expires = now + HYPERV_WMI_CACHE_TTL;
+    entry->responses = *responses;
+    entry->nresponses = *nresponses;
+    *responses = NULL;
+    *nresponses = 0;
+
+    virMutexLock(&priv->cacheLock);
+
+    hypervWmiCachePurge(priv, now);
+
+    /* Everything left expires later than what's at the head, so simply
+     * drop that if we're over the limit */
+    if (priv->ncache >= HYPERV_WMI_CACHE_MAX) {
+        hypervWmiCacheEntry *tmp = priv->cache;
+
+        priv->cache = tmp->next;
+        hypervWmiCacheEntryFree(tmp);
+        priv->ncache--;
+    }
+
+    /* Keep the list sorted by expiration by appending */
+    if (priv->cache == NULL) {
+        priv->cache = entry;
+    } else {
+        hypervWmiCacheEntry *tail = priv->cache;
+
+        while (tail->next != NULL)
+            tail = tail->next;
+        tail->next = entry;
+    }
+    priv->ncache++;
+
+    virMutexUnlock(&priv->cacheLock);
+}
+
+/* Returns the node wrapping the instances in a pull response, or in an
+ * optimized enumerate response */
+static WsXmlNodeH
+hypervGetResponseItems(WsXmlDocH response)
+{
+    WsXmlNodeH body = ws_xml_get_soap_body(response);
+    WsXmlNodeH node;
+
+    if (body == NULL)
+        return NULL;
+
+    if ((node = ws_xml_get_child(body, 0, XML_NS_ENUMERATION,
+                                 WSENUM_PULL_RESP)))
+        return ws_xml_get_child(node, 0, XML_NS_ENUMERATION, WSENUM_ITEMS);
+
+    if ((node = ws_xml_get_child(body, 0, XML_NS_ENUMERATION,
+                                 WSENUM_ENUMERATE_RESP)))
+        return ws_xml_get_child(node, 0, XML_NS_WS_MAN, WSENUM_ITEMS);
+
+    return NULL;
+}
+
+/* Deserialize all instances in @responses into @list, which must be
+ * empty. On failure @list may hold some of them. */
+static int
+hypervDeserializeResponses(hypervPrivate *priv, hypervWmiClassInfoPtr wmiInfo,
+                           WsXmlDocH *responses, size_t nresponses,
+                           hypervObject **list)
+{
+    WsSerializerContextH serializerContext;
+    hypervObject *tail = NULL;
+    hypervObject *object;
+    XML_TYPE_PTR data;
+    size_t i;
+    int j;
+
+    serializerContext = wsmc_get_serialization_context(priv->client);
+
+    for (i = 0; i < nresponses; i++) {
+        WsXmlNodeH node = hypervGetResponseItems(responses[i]);
+
+        if (node == NULL)
+            continue;
+
+        for (j = 0; ws_xml_get_child(node, j, wmiInfo->resourceUri,
+                                     wmiInfo->name) != NULL; j++) {
+            data = ws_deserialize(serializerContext, node,
+                                  wmiInfo->serializerInfo, wmiInfo->name,
+                                  wmiInfo->resourceUri, NULL, j, 0);
+
+            if (data == NULL) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("Could not deserialize pull response item"));
+                return -1;
+            }
+
+            if (VIR_ALLOC(object) < 0)
+                return -1;
+
+            object->info = wmiInfo;
+            object->data.common = data;
+
+            if (tail == NULL)
+                *list = object;
+            else
+                tail->next = object;
+
+            tail = object;
+        }
+    }
+
+    return 0;
+}
+
 /* This function guarantees that wqlQuery->query is reset, even on failure */
 int
 hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
                   hypervObject **list)
 {
     int result = -1;
-    WsSerializerContextH serializerContext;
     client_opt_t *options = NULL;
     char *query_string = NULL;
+    char *key = NULL;
     hypervWmiClassInfoPtr wmiInfo = NULL;
     filter_t *filter = NULL;
     WsXmlDocH response = NULL;
+    WsXmlDocH *responses = NULL;
+    size_t nresponses = 0;
     char *enumContext = NULL;
     hypervObject *head = NULL;
-    hypervObject *tail = NULL;
     WsXmlNodeH node = NULL;
-    XML_TYPE_PTR data = NULL;
-    hypervObject *object;
+    hypervWmiCacheEntry *entry;
+    unsigned long long now;
+    size_t i;
 
     if (virBufferCheckError(wqlQuery->query) < 0) {
         virBufferFreeAndReset(wqlQuery->query);
@@ -182,7 +373,36 @@ hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
     if (hypervGetWmiClassInfo(priv, wqlQuery->info, &wmiInfo) < 0)
         goto cleanup;
 
-    serializerContext = wsmc_get_serialization_context(priv->client);
+    if (!wqlQuery->nocache) {
+        if (virAsprintf(&key, "%s\n%s", wmiInfo->resourceUri,
+                        query_string) < 0 ||
+            virTimeMillisNow(&now) < 0)
+            goto cleanup;
+
+        virMutexLock(&priv->cacheLock);
+
+        for (entry = priv->cache; entry != NULL; entry = entry->next) {
+            if (now < entry->expires && STREQ(entry->key, key))
+                break;
+        }
+
+        if (entry != NULL) {
+            VIR_DEBUG("Using cached response to '%s'", query_string);
+            result = hypervDeserializeResponses(priv, wmiInfo,
+                                                entry->responses,
+                                                entry->nresponses, &head);
+            virMutexUnlock(&priv->cacheLock);
+
+            if (result < 0)
+                goto cleanup;
+
+            *list = head;
+            head = NULL;
+            goto cleanup;
+        }
+
+        virMutexUnlock(&priv->cacheLock);
+    }
 
     options = wsmc_options_init();
 
@@ -192,6 +412,11 @@ hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
         goto cleanup;
     }
 
+    /* Fetch instances in batches, starting with the enumerate
+     * response, instead of one per round trip */
+    options->max_elements = HYPERV_WMI_MAX_ELEMENTS;
+    wsmc_set_action_option(options, FLAG_ENUMERATION_OPTIMIZATION);
+
     filter = filter_create_simple(WSM_WQL_FILTER_DIALECT, query_string);
 
     if (filter == NULL) {
@@ -208,8 +433,8 @@ hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
 
     enumContext = wsmc_get_enum_context(response);
 
-    ws_xml_destroy_doc(response);
-    response = NULL;
+    if (VIR_APPEND_ELEMENT(responses, nresponses, response) < 0)
+        goto cleanup;
 
     while (enumContext != NULL && *enumContext != '\0') {
         response = wsmc_action_pull(priv->client, wmiInfo->resourceUri, options,
@@ -218,23 +443,7 @@ hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
         if (hypervVerifyResponse(priv->client, response, "pull") < 0)
             goto cleanup;
 
-        node = ws_xml_get_soap_body(response);
-
-        if (node == NULL) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Could not lookup SOAP body"));
-            goto cleanup;
-        }
-
-        node = ws_xml_get_child(node, 0, XML_NS_ENUMERATION, WSENUM_PULL_RESP);
-
-        if (node == NULL) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Could not lookup pull response"));
-            goto cleanup;
-        }
-
-        node = ws_xml_get_child(node, 0, XML_NS_ENUMERATION, WSENUM_ITEMS);
+        node = hypervGetResponseItems(response);
 
         if (node == NULL) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -246,38 +455,20 @@ hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
                              wmiInfo->name) == NULL)
             break;
 
-        data = ws_deserialize(serializerContext, node, wmiInfo->serializerInfo,
-                              wmiInfo->name, wmiInfo->resourceUri, NULL, 0, 0);
-
-        if (data == NULL) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Could not deserialize pull response item"));
-            goto cleanup;
-        }
-
-        if (VIR_ALLOC(object) < 0)
-            goto cleanup;
-
-        object->info = wmiInfo;
-        object->data.common = data;
-
-        data = NULL;
-
-        if (head == NULL) {
-            head = object;
-        } else {
-            tail->next = object;
-        }
-
-        tail = object;
-
         VIR_FREE(enumContext);
         enumContext = wsmc_get_enum_context(response);
 
-        ws_xml_destroy_doc(response);
-        response = NULL;
+        if (VIR_APPEND_ELEMENT(responses, nresponses, response) < 0)
+            goto cleanup;
     }
 
+    if (hypervDeserializeResponses(priv, wmiInfo, responses, nresponses,
+                                   &head) < 0)
+        goto cleanup;
+
+    if (!wqlQuery->nocache)
+        hypervWmiCacheAdd(priv, key, &responses, &nresponses);
+
     *list = head;
     head = NULL;
 
@@ -290,18 +481,12 @@ hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
     if (filter != NULL)
         filter_destroy(filter);
 
-    if (data != NULL) {
-#if WS_SERIALIZER_FREE_MEM_WORKS
-        /* FIXME: ws_serializer_free_mem is broken in openwsman <= 2.2.6,
-         *        see hypervFreeObject for a detailed explanation. */
-        if (ws_serializer_free_mem(serializerContext, data,
-                                   wmiInfo->serializerInfo) < 0) {
-            VIR_ERROR(_("Could not free deserialized data"));
-        }
-#endif
-    }
+    for (i = 0; i < nresponses; i++)
+        ws_xml_destroy_doc(responses[i]);
+    VIR_FREE(responses);
 
     VIR_FREE(query_string);
+    VIR_FREE(key);
     ws_xml_destroy_doc(response);
     VIR_FREE(enumContext);
     hypervFreeObject(priv, head);
@@ -444,8 +629,14 @@ int
 hypervGetMsvmConcreteJobList(hypervPrivate *priv, virBufferPtr query,
                              Msvm_ConcreteJob **list)
 {
-    return hypervGetWmiClassList(priv, Msvm_ConcreteJob_WmiInfo, query,
-                                 (hypervObject **) list);
+    hypervWqlQuery wqlQuery = HYPERV_WQL_QUERY_INITIALIZER;
+
+    /* Jobs are polled for until they finish */
+    wqlQuery.info = Msvm_ConcreteJob_WmiInfo;
+    wqlQuery.query = query;
+    wqlQuery.nocache = true;
+
+    return hypervEnumAndPull(priv, &wqlQuery, (hypervObject **) list);
 }
 
 int
@@ -638,6 +829,9 @@ hypervInvokeMsvmComputerSystemRequestStateChange(virDomainPtr domain,
     VIR_FREE(instanceID);
     hypervFreeObject(priv, (hypervObject *)concreteJob);
 
+    /* Whatever we remember about the domain is stale now */
+    hypervWmiCacheClear(priv);
+
     return result;
 }
 
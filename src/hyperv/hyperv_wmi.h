@@ -31,7 +31,7 @@
 
 
 
-# define HYPERV_WQL_QUERY_INITIALIZER { NULL, NULL }
+# define HYPERV_WQL_QUERY_INITIALIZER { NULL, NULL, false }
 
 int hypervVerifyResponse(WsManClient *client, WsXmlDocH response,
                          const char *detail);
@@ -66,6 +66,8 @@ typedef hypervWqlQuery *hypervWqlQueryPtr;
 struct _hypervWqlQuery {
     virBufferPtr query;
     hypervWmiClassInfoListPtr info;
+    /* Always ask the server, e.g. when polling for a state change */
+    bool nocache;
 };
 
 int hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
@@ -73,6 +75,8 @@ int hypervEnumAndPull(hypervPrivate *priv, hypervWqlQueryPtr wqlQuery,
 
 void hypervFreeObject(hypervPrivate *priv, hypervObject *object);
 
+void hypervWmiCacheClear(hypervPrivate *priv);
+
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
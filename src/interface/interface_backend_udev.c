@@ -36,11 +36,31 @@
 #include "viraccessapicheck.h"
 #include "virinterfaceobj.h"
 #include "virnetdev.h"
+#include "virlog.h"
 
 #define VIR_FROM_THIS VIR_FROM_INTERFACE
 
+VIR_LOG_INIT("interface.interface_backend_udev");
+
+typedef struct _udevIfaceCacheEntry udevIfaceCacheEntry;
+typedef udevIfaceCacheEntry *udevIfaceCacheEntryPtr;
+struct _udevIfaceCacheEntry {
+    char *name;
+    char *mac;
+    bool tap;       /* has tun_flags, i.e. created for some guest */
+};
+
 struct udev_iface_driver {
     struct udev *udev;
+
+    virMutex lock;
+    /* All the host's net devices, udevIfaceCacheEntry keyed by name.
+     * Kept current by @monitor, or refilled whenever it's used if we
+     * couldn't get a monitor or missed some of its events. */
+    virHashTablePtr ifaces;
+    bool stale;
+    struct udev_monitor *monitor;
+    int watch;
 };
 
 typedef enum {
@@ -53,21 +73,6 @@ static struct udev_iface_driver *driver;
 
 static virInterfaceDef *udevGetIfaceDef(struct udev *udev, const char *name);
 
-static const char *
-virUdevStatusString(virUdevStatus status)
-{
-    switch (status) {
-        case VIR_UDEV_IFACE_ACTIVE:
-            return "active";
-        case VIR_UDEV_IFACE_INACTIVE:
-            return "inactive";
-        case VIR_UDEV_IFACE_ALL:
-            return "all";
-    }
-
-    return "";
-}
-
 /*
  * Get a minimal virInterfaceDef containing enough metadata
  * for access control checks to be performed. Currently
@@ -96,92 +101,282 @@ udevGetMinimalDefForDevice(struct udev_device *dev)
 }
 
 
-static struct udev_enumerate * ATTRIBUTE_NONNULL(1)
-udevGetDevices(struct udev *udev, virUdevStatus status)
+/*
+ * Same as udevGetMinimalDefForDevice, but filled in from a cache
+ * entry without copying anything, so @def must not be freed and
+ * doesn't outlive @entry.
+ */
+static void
+udevIfaceCacheEntryDef(udevIfaceCacheEntryPtr entry,
+                       virInterfaceDefPtr def)
 {
-    struct udev_enumerate *enumerate;
+    memset(def, 0, sizeof(*def));
+    def->name = entry->name;
+    def->mac = entry->mac;
+}
 
-    /* Create a new enumeration to create a list */
-    enumerate = udev_enumerate_new(udev);
 
-    if (!enumerate)
-        return NULL;
+static void
+udevIfaceCacheEntryFree(void *payload,
+                        const void *name ATTRIBUTE_UNUSED)
+{
+    udevIfaceCacheEntryPtr entry = payload;
 
-    /* Enumerate all network subsystem devices */
-    udev_enumerate_add_match_subsystem(enumerate, "net");
+    if (!entry)
+        return;
 
-    /* Ignore devices that are part of a bridge */
-    udev_enumerate_add_nomatch_sysattr(enumerate, "brport/state", NULL);
+    VIR_FREE(entry->name);
+    VIR_FREE(entry->mac);
+    VIR_FREE(entry);
+}
 
-    /* State of the device */
-    switch (status) {
-        case VIR_UDEV_IFACE_ACTIVE:
-            udev_enumerate_add_match_sysattr(enumerate, "operstate", "up");
-            break;
 
-        case VIR_UDEV_IFACE_INACTIVE:
-            udev_enumerate_add_match_sysattr(enumerate, "operstate", "down");
-            break;
+/* Must be called with the driver lock held */
+static int
+udevIfaceCacheAddDevice(struct udev_device *dev)
+{
+    udevIfaceCacheEntryPtr entry = NULL;
+    const char *name = udev_device_get_sysname(dev);
 
-        case VIR_UDEV_IFACE_ALL:
-            break;
-    }
+    if (!name)
+        return 0;
 
-    /* We don't want to see the TUN devices that QEMU creates for other guests
-     * running on this machine. By saying nomatch NULL, we just are getting
-     * devices without the tun_flags sysattr.
-     */
-    udev_enumerate_add_nomatch_sysattr(enumerate, "tun_flags", NULL);
+    if (VIR_ALLOC(entry) < 0)
+        return -1;
+
+    if (VIR_STRDUP(entry->name, name) < 0 ||
+        VIR_STRDUP(entry->mac,
+                   udev_device_get_sysattr_value(dev, "address")) < 0)
+        goto error;
+
+    /* We don't want to see the TUN devices that QEMU creates for other
+     * guests running on this machine when listing, but they can still
+     * be looked up by name. */
+    entry->tap = !!udev_device_get_sysattr_value(dev, "tun_flags");
+
+    if (virHashUpdateEntry(driver->ifaces, name, entry) < 0)
+        goto error;
+
+    return 0;
 
-    return enumerate;
+ error:
+    udevIfaceCacheEntryFree(entry, NULL);
+    return -1;
 }
 
+
+/* Must be called with the driver lock held */
 static int
-udevNumOfInterfacesByStatus(virConnectPtr conn, virUdevStatus status,
-                            virInterfaceObjListFilter filter)
+udevIfaceCacheFill(void)
 {
-    struct udev *udev = udev_ref(driver->udev);
-    struct udev_enumerate *enumerate = NULL;
-    struct udev_list_entry *devices;
+    struct udev_enumerate *enumerate;
     struct udev_list_entry *dev_entry;
-    int count = 0;
+    int ret = -1;
 
-    enumerate = udevGetDevices(udev, status);
+    virHashRemoveAll(driver->ifaces);
 
-    if (!enumerate) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("failed to get number of %s interfaces on host"),
-                       virUdevStatusString(status));
-        count = -1;
-        goto cleanup;
+    if (!(enumerate = udev_enumerate_new(driver->udev))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("failed to enumerate interfaces on host"));
+        return -1;
     }
 
-    /* Do the scan to load up the enumeration */
+    udev_enumerate_add_match_subsystem(enumerate, "net");
     udev_enumerate_scan_devices(enumerate);
 
-    /* Get a list we can walk */
-    devices = udev_enumerate_get_list_entry(enumerate);
-
-    /* For each item so we can count */
-    udev_list_entry_foreach(dev_entry, devices) {
+    udev_list_entry_foreach(dev_entry,
+                            udev_enumerate_get_list_entry(enumerate)) {
         struct udev_device *dev;
-        const char *path;
-        virInterfaceDefPtr def;
+        int rc;
 
-        path = udev_list_entry_get_name(dev_entry);
-        dev = udev_device_new_from_syspath(udev, path);
+        dev = udev_device_new_from_syspath(driver->udev,
+                                           udev_list_entry_get_name(dev_entry));
+        if (!dev)
+            continue;
 
-        def = udevGetMinimalDefForDevice(dev);
-        if (filter(conn, def))
-            count++;
+        rc = udevIfaceCacheAddDevice(dev);
         udev_device_unref(dev);
-        virInterfaceDefFree(def);
+        if (rc < 0)
+            goto cleanup;
     }
 
+    driver->stale = false;
+    ret = 0;
+
  cleanup:
-    if (enumerate)
-        udev_enumerate_unref(enumerate);
-    udev_unref(udev);
+    udev_enumerate_unref(enumerate);
+    return ret;
+}
+
+
+/* Must be called with the driver lock held */
+static void
+udevIfaceCacheHandleDevice(struct udev_device *dev)
+{
+    const char *action = udev_device_get_action(dev);
+    const char *name = udev_device_get_sysname(dev);
+    const char *oldpath;
+
+    if (!action || !name)
+        return;
+
+    VIR_DEBUG("udev action '%s' on interface '%s'", action, name);
+
+    if (STREQ(action, "remove")) {
+        ignore_value(virHashRemoveEntry(driver->ifaces, name));
+        return;
+    }
+
+    /* A renamed interface is only announced under its new name */
+    if (STREQ(action, "move") &&
+        (oldpath = udev_device_get_property_value(dev, "DEVPATH_OLD")) &&
+        (oldpath = strrchr(oldpath, '/')))
+        ignore_value(virHashRemoveEntry(driver->ifaces, oldpath + 1));
+
+    if (udevIfaceCacheAddDevice(dev) < 0)
+        driver->stale = true;
+}
+
+
+static void
+udevIfaceEventHandleCallback(int watch ATTRIBUTE_UNUSED,
+                             int fd ATTRIBUTE_UNUSED,
+                             int events ATTRIBUTE_UNUSED,
+                             void *opaque ATTRIBUTE_UNUSED)
+{
+    struct udev_device *dev;
+
+    virMutexLock(&driver->lock);
+
+    while (true) {
+        errno = 0;
+        if (!(dev = udev_monitor_receive_device(driver->monitor)))
+            break;
+
+        udevIfaceCacheHandleDevice(dev);
+        udev_device_unref(dev);
+    }
+
+    /* The socket overflowed and we lost some events */
+    if (errno == ENOBUFS) {
+        VIR_DEBUG("udev monitor overflowed, interface cache is stale");
+        driver->stale = true;
+    }
+
+    virMutexUnlock(&driver->lock);
+}
+
+
+/*
+ * Lock the cache and return its entries, refilling it first if it may
+ * be out of date. Returns NULL with the lock released on error, the
+ * caller is responsible for freeing the array (but not its contents)
+ * and unlocking the driver otherwise.
+ */
+static virHashKeyValuePairPtr
+udevIfaceCacheGetItems(void)
+{
+    virHashKeyValuePairPtr items;
+
+    virMutexLock(&driver->lock);
+
+    if ((!driver->monitor || driver->stale) && udevIfaceCacheFill() < 0)
+        goto error;
+
+    if (!(items = virHashGetItems(driver->ifaces, NULL)))
+        goto error;
+
+    return items;
+
+ error:
+    virMutexUnlock(&driver->lock);
+    return NULL;
+}
+
+
+/*
+ * Neither joining a bridge nor link state changes are announced by
+ * udev, so unlike the rest of the cached data these are checked in
+ * sysfs whenever they're needed.
+ */
+static bool
+udevIfaceIsBridgePort(udevIfaceCacheEntryPtr entry)
+{
+    char *path = NULL;
+    bool ret;
+
+    if (virAsprintf(&path, SYSFS_NET_DIR "%s/brport", entry->name) < 0)
+        return false;
+
+    ret = virFileExists(path);
+
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static bool
+udevIfaceHasStatus(udevIfaceCacheEntryPtr entry,
+                   virUdevStatus status)
+{
+    char *operstate = NULL;
+    bool ret = false;
+
+    if (status == VIR_UDEV_IFACE_ALL)
+        return true;
+
+    if (virFileReadValueString(&operstate, SYSFS_NET_DIR "%s/operstate",
+                               entry->name) < 0)
+        return false;
+
+    if (status == VIR_UDEV_IFACE_ACTIVE)
+        ret = STREQ(operstate, "up");
+    else
+        ret = STREQ(operstate, "down");
+
+    VIR_FREE(operstate);
+    return ret;
+}
+
+
+/* Whether @entry would be reported by the list APIs for @status */
+static bool
+udevIfaceIsListable(udevIfaceCacheEntryPtr entry,
+                    virUdevStatus status)
+{
+    /* Ignore devices that are part of a bridge, and guests' devices */
+    if (entry->tap || udevIfaceIsBridgePort(entry))
+        return false;
+
+    return udevIfaceHasStatus(entry, status);
+}
+
+
+static int
+udevNumOfInterfacesByStatus(virConnectPtr conn, virUdevStatus status,
+                            virInterfaceObjListFilter filter)
+{
+    virHashKeyValuePairPtr items;
+    size_t i;
+    int count = 0;
+
+    if (!(items = udevIfaceCacheGetItems()))
+        return -1;
+
+    for (i = 0; items[i].key; i++) {
+        udevIfaceCacheEntryPtr entry = (udevIfaceCacheEntryPtr) items[i].value;
+        virInterfaceDef def;
+
+        if (!udevIfaceIsListable(entry, status))
+            continue;
+
+        udevIfaceCacheEntryDef(entry, &def);
+        if (filter(conn, &def))
+            count++;
+    }
+
+    virMutexUnlock(&driver->lock);
+    VIR_FREE(items);
 
     return count;
 }
@@ -193,62 +388,37 @@ udevListInterfacesByStatus(virConnectPtr conn,
                            virUdevStatus status,
                            virInterfaceObjListFilter filter)
 {
-    struct udev *udev = udev_ref(driver->udev);
-    struct udev_enumerate *enumerate = NULL;
-    struct udev_list_entry *devices;
-    struct udev_list_entry *dev_entry;
+    virHashKeyValuePairPtr items;
+    size_t i;
     int count = 0;
 
-    enumerate = udevGetDevices(udev, status);
-
-    if (!enumerate) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("failed to get list of %s interfaces on host"),
-                       virUdevStatusString(status));
-        goto error;
-    }
-
-    /* Do the scan to load up the enumeration */
-    udev_enumerate_scan_devices(enumerate);
-
-    /* Get a list we can walk */
-    devices = udev_enumerate_get_list_entry(enumerate);
+    if (!(items = udevIfaceCacheGetItems()))
+        return -1;
 
-    /* For each item so we can count */
-    udev_list_entry_foreach(dev_entry, devices) {
-        struct udev_device *dev;
-        const char *path;
-        virInterfaceDefPtr def;
+    for (i = 0; items[i].key && count < names_len; i++) {
+        udevIfaceCacheEntryPtr entry = (udevIfaceCacheEntryPtr) items[i].value;
+        virInterfaceDef def;
 
-        /* Ensure we won't exceed the size of our array */
-        if (count > names_len)
-            break;
+        if (!udevIfaceIsListable(entry, status))
+            continue;
 
-        path = udev_list_entry_get_name(dev_entry);
-        dev = udev_device_new_from_syspath(udev, path);
+        udevIfaceCacheEntryDef(entry, &def);
+        if (!filter(conn, &def))
+            continue;
 
-        def = udevGetMinimalDefForDevice(dev);
-        if (filter(conn, def)) {
-            if (VIR_STRDUP(names[count], udev_device_get_sysname(dev)) < 0) {
-                udev_device_unref(dev);
-                virInterfaceDefFree(def);
-                goto error;
-            }
-            count++;
-        }
-        udev_device_unref(dev);
-        virInterfaceDefFree(def);
+        if (VIR_STRDUP(names[count], entry->name) < 0)
+            goto error;
+        count++;
     }
 
-    udev_enumerate_unref(enumerate);
-    udev_unref(udev);
+    virMutexUnlock(&driver->lock);
+    VIR_FREE(items);
 
     return count;
 
  error:
-    if (enumerate)
-        udev_enumerate_unref(enumerate);
-    udev_unref(udev);
+    virMutexUnlock(&driver->lock);
+    VIR_FREE(items);
 
     for (names_len = 0; names_len < count; names_len++)
         VIR_FREE(names[names_len]);
@@ -308,107 +478,55 @@ udevConnectListAllInterfaces(virConnectPtr conn,
                              virInterfacePtr **ifaces,
                              unsigned int flags)
 {
-    struct udev *udev;
-    struct udev_enumerate *enumerate = NULL;
-    struct udev_list_entry *devices;
-    struct udev_list_entry *dev_entry;
+    virHashKeyValuePairPtr items = NULL;
     virInterfacePtr *ifaces_list = NULL;
-    virInterfacePtr iface_obj;
-    int tmp_count;
+    size_t nitems;
+    size_t i;
     int count = 0;
-    int status = 0;
-    int ret;
+    int ret = -1;
 
     virCheckFlags(VIR_CONNECT_LIST_INTERFACES_FILTERS_ACTIVE, -1);
 
     if (virConnectListAllInterfacesEnsureACL(conn) < 0)
         return -1;
 
-    /* Grab a udev reference */
-    udev = udev_ref(driver->udev);
-
-    /* List all interfaces in case we support more filter flags in the future */
-    enumerate = udevGetDevices(udev, VIR_UDEV_IFACE_ALL);
-
-    if (!enumerate) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("failed to get list of %s interfaces on host"),
-                       virUdevStatusString(status));
-        ret = -1;
-        goto cleanup;
-    }
-
-    /* Do the scan to load up the enumeration */
-    udev_enumerate_scan_devices(enumerate);
-
-    /* Get a list we can walk */
-    devices = udev_enumerate_get_list_entry(enumerate);
-
-    /* For each item so we can count */
-    udev_list_entry_foreach(dev_entry, devices) {
-        count++;
-    }
+    if (!(items = udevIfaceCacheGetItems()))
+        return -1;
 
-    /* If we've got nothing, exit out */
-    if (count == 0) {
-        ret = 0;
-        goto cleanup;
-    }
+    nitems = virHashSize(driver->ifaces);
 
     /* If we're asked for the ifaces then alloc up memory */
-    if (ifaces && VIR_ALLOC_N(ifaces_list, count + 1) < 0) {
-        ret = -1;
+    if (ifaces && VIR_ALLOC_N(ifaces_list, nitems + 1) < 0)
         goto cleanup;
-    }
 
-    /* Get a list we can walk */
-    devices = udev_enumerate_get_list_entry(enumerate);
+    for (i = 0; items[i].key; i++) {
+        udevIfaceCacheEntryPtr entry = (udevIfaceCacheEntryPtr) items[i].value;
+        virInterfaceDef def;
 
-    /* reset our iterator */
-    count = 0;
+        if (!udevIfaceIsListable(entry, VIR_UDEV_IFACE_ALL))
+            continue;
 
-    /* Walk through each device */
-    udev_list_entry_foreach(dev_entry, devices) {
-        struct udev_device *dev;
-        const char *path;
-        const char *name;
-        const char *macaddr;
-        virInterfaceDefPtr def;
-
-        path = udev_list_entry_get_name(dev_entry);
-        dev = udev_device_new_from_syspath(udev, path);
-        name = udev_device_get_sysname(dev);
-        macaddr = udev_device_get_sysattr_value(dev, "address");
-        status = STREQ(udev_device_get_sysattr_value(dev, "operstate"), "up");
-
-        def = udevGetMinimalDefForDevice(dev);
-        if (!virConnectListAllInterfacesCheckACL(conn, def)) {
-            udev_device_unref(dev);
-            virInterfaceDefFree(def);
+        udevIfaceCacheEntryDef(entry, &def);
+        if (!virConnectListAllInterfacesCheckACL(conn, &def))
             continue;
-        }
-        virInterfaceDefFree(def);
 
         /* Filter the results */
-        if (MATCH(VIR_CONNECT_LIST_INTERFACES_FILTERS_ACTIVE) &&
-            !((MATCH(VIR_CONNECT_LIST_INTERFACES_ACTIVE) && status) ||
-              (MATCH(VIR_CONNECT_LIST_INTERFACES_INACTIVE) && !status))) {
-            udev_device_unref(dev);
-            continue;
+        if (MATCH(VIR_CONNECT_LIST_INTERFACES_FILTERS_ACTIVE)) {
+            bool status = udevIfaceHasStatus(entry, VIR_UDEV_IFACE_ACTIVE);
+
+            if (!((MATCH(VIR_CONNECT_LIST_INTERFACES_ACTIVE) && status) ||
+                  (MATCH(VIR_CONNECT_LIST_INTERFACES_INACTIVE) && !status)))
+                continue;
         }
 
         /* If we matched a filter, then add it */
-        if (ifaces) {
-            iface_obj = virGetInterface(conn, name, macaddr);
-            ifaces_list[count++] = iface_obj;
-        }
-        udev_device_unref(dev);
+        if (ifaces &&
+            !(ifaces_list[count] = virGetInterface(conn, entry->name,
+                                                   entry->mac)))
+            goto cleanup;
+        count++;
     }
 
-    /* Drop our refcounts */
-    udev_enumerate_unref(enumerate);
-    udev_unref(udev);
-
     /* Trim the array to its final size */
     if (ifaces) {
         ignore_value(VIR_REALLOC_N(ifaces_list, count + 1));
@@ -416,53 +534,49 @@ udevConnectListAllInterfaces(virConnectPtr conn,
         ifaces_list = NULL;
     }
 
-    return count;
+    ret = count;
 
  cleanup:
-    if (enumerate)
-        udev_enumerate_unref(enumerate);
-    udev_unref(udev);
+    virMutexUnlock(&driver->lock);
+    VIR_FREE(items);
 
-    if (ifaces) {
-        for (tmp_count = 0; tmp_count < count; tmp_count++)
-            virObjectUnref(ifaces_list[tmp_count]);
+    if (ifaces_list) {
+        for (i = 0; i < count; i++)
+            virObjectUnref(ifaces_list[i]);
+        VIR_FREE(ifaces_list);
     }
 
-    VIR_FREE(ifaces_list);
-
     return ret;
-
 }
 
 static virInterfacePtr
 udevInterfaceLookupByName(virConnectPtr conn, const char *name)
 {
-    struct udev *udev = udev_ref(driver->udev);
-    struct udev_device *dev;
+    virHashKeyValuePairPtr items;
+    udevIfaceCacheEntryPtr entry;
     virInterfacePtr ret = NULL;
-    virInterfaceDefPtr def = NULL;
+    virInterfaceDef def;
 
-    /* get a device reference based on the device name */
-    dev = udev_device_new_from_subsystem_sysname(udev, "net", name);
-    if (!dev) {
+    if (!(items = udevIfaceCacheGetItems()))
+        return NULL;
+
+    if (!(entry = virHashLookup(driver->ifaces, name))) {
         virReportError(VIR_ERR_NO_INTERFACE,
                        _("couldn't find interface named '%s'"),
                        name);
         goto cleanup;
     }
 
-    if (!(def = udevGetMinimalDefForDevice(dev)))
-        goto cleanup;
+    udevIfaceCacheEntryDef(entry, &def);
 
-    if (virInterfaceLookupByNameEnsureACL(conn, def) < 0)
+    if (virInterfaceLookupByNameEnsureACL(conn, &def) < 0)
        goto cleanup;
 
-    ret = virGetInterface(conn, def->name, def->mac);
-    udev_device_unref(dev);
+    ret = virGetInterface(conn, entry->name, entry->mac);
 
  cleanup:
-    udev_unref(udev);
-    virInterfaceDefFree(def);
+    virMutexUnlock(&driver->lock);
+    VIR_FREE(items);
 
     return ret;
 }
@@ -470,63 +584,51 @@ udevInterfaceLookupByName(virConnectPtr conn, const char *name)
 static virInterfacePtr
 udevInterfaceLookupByMACString(virConnectPtr conn, const char *macstr)
 {
-    struct udev *udev = udev_ref(driver->udev);
-    struct udev_enumerate *enumerate = NULL;
-    struct udev_list_entry *dev_entry;
-    struct udev_device *dev;
-    virInterfaceDefPtr def = NULL;
+    virHashKeyValuePairPtr items;
+    udevIfaceCacheEntryPtr entry = NULL;
     virInterfacePtr ret = NULL;
+    virInterfaceDef def;
+    size_t i;
 
-    enumerate = udevGetDevices(udev, VIR_UDEV_IFACE_ALL);
-
-    if (!enumerate) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("failed to lookup interface with MAC address '%s'"),
-                       macstr);
-        goto cleanup;
-    }
+    if (!(items = udevIfaceCacheGetItems()))
+        return NULL;
 
     /* Match on MAC */
-    udev_enumerate_add_match_sysattr(enumerate, "address", macstr);
+    for (i = 0; items[i].key; i++) {
+        udevIfaceCacheEntryPtr tmp = (udevIfaceCacheEntryPtr) items[i].value;
 
-    /* Do the scan to load up the enumeration */
-    udev_enumerate_scan_devices(enumerate);
+        if (!tmp->mac || STRNEQ(tmp->mac, macstr) ||
+            !udevIfaceIsListable(tmp, VIR_UDEV_IFACE_ALL))
+            continue;
 
-    /* Get a list we can walk */
-    dev_entry = udev_enumerate_get_list_entry(enumerate);
+        /* Check that we didn't get multiple items back */
+        if (entry) {
+            virReportError(VIR_ERR_MULTIPLE_INTERFACES,
+                           _("the MAC address '%s' matches multiple interfaces"),
+                           macstr);
+            goto cleanup;
+        }
+        entry = tmp;
+    }
 
     /* Check that we got something back */
-    if (!dev_entry) {
+    if (!entry) {
         virReportError(VIR_ERR_NO_INTERFACE,
                        _("couldn't find interface with MAC address '%s'"),
                        macstr);
         goto cleanup;
     }
 
-    /* Check that we didn't get multiple items back */
-    if (udev_list_entry_get_next(dev_entry)) {
-        virReportError(VIR_ERR_MULTIPLE_INTERFACES,
-                       _("the MAC address '%s' matches multiple interfaces"),
-                       macstr);
-        goto cleanup;
-    }
-
-    dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(dev_entry));
+    udevIfaceCacheEntryDef(entry, &def);
 
-    if (!(def = udevGetMinimalDefForDevice(dev)))
-        goto cleanup;
-
-    if (virInterfaceLookupByMACStringEnsureACL(conn, def) < 0)
+    if (virInterfaceLookupByMACStringEnsureACL(conn, &def) < 0)
        goto cleanup;
 
-    ret = virGetInterface(conn, def->name, def->mac);
-    udev_device_unref(dev);
+    ret = virGetInterface(conn, entry->name, entry->mac);
 
  cleanup:
-    if (enumerate)
-        udev_enumerate_unref(enumerate);
-    udev_unref(udev);
-    virInterfaceDefFree(def);
+    virMutexUnlock(&driver->lock);
+    VIR_FREE(items);
 
     return ret;
 }
@@ -1167,6 +1269,15 @@ udevStateInitialize(bool privileged ATTRIBUTE_UNUSED,
     if (VIR_ALLOC(driver) < 0)
         goto cleanup;
 
+    driver->watch = -1;
+
+    if (virMutexInit(&driver->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(driver);
+        goto cleanup;
+    }
+
     driver->udev = udev_new();
     if (!driver->udev) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -1174,6 +1285,39 @@ udevStateInitialize(bool privileged ATTRIBUTE_UNUSED,
         goto cleanup;
     }
 
+    if (!(driver->ifaces = virHashCreate(64, udevIfaceCacheEntryFree)))
+        goto cleanup;
+
+    /* Start listening before the initial enumeration so that we
+     * don't miss interfaces appearing while it runs. Without the
+     * monitor the cache is simply refilled every time it's used. */
+    if ((driver->monitor = udev_monitor_new_from_netlink(driver->udev,
+                                                         "udev"))) {
+        udev_monitor_filter_add_match_subsystem_devtype(driver->monitor,
+                                                        "net", NULL);
+        udev_monitor_enable_receiving(driver->monitor);
+
+        driver->watch = virEventAddHandle(udev_monitor_get_fd(driver->monitor),
+                                          VIR_EVENT_HANDLE_READABLE,
+                                          udevIfaceEventHandleCallback,
+                                          NULL, NULL);
+    }
+
+    if (driver->watch < 0) {
+        VIR_WARN("Unable to monitor udev events, "
+                 "interfaces will not be cached");
+        if (driver->monitor)
+            udev_monitor_unref(driver->monitor);
+        driver->monitor = NULL;
+    }
+
+    virMutexLock(&driver->lock);
+    if (udevIfaceCacheFill() < 0) {
+        virMutexUnlock(&driver->lock);
+        goto cleanup;
+    }
+    virMutexUnlock(&driver->lock);
+
     ret = 0;
 
  cleanup:
@@ -1186,7 +1330,13 @@ udevStateCleanup(void)
     if (!driver)
         return -1;
 
+    if (driver->watch != -1)
+        virEventRemoveHandle(driver->watch);
+    if (driver->monitor)
+        udev_monitor_unref(driver->monitor);
+    virHashFree(driver->ifaces);
     udev_unref(driver->udev);
+    virMutexDestroy(&driver->lock);
 
     VIR_FREE(driver);
     return 0;
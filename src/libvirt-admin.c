@@ -887,6 +887,74 @@ virAdmServerListClients(virAdmServerPtr srv,
     return -1;
 }
 
+/**
+ * virAdmServerListClientsFiltered:
+ * @srv: a valid server object reference
+ * @filters: criteria the listed clients must satisfy, or NULL
+ * @nfilters: number of parameters in @filters
+ * @cursor: on input, the position to list clients from, 0 for the start
+ *          of the list; on output, the position to pass to get the next
+ *          page, or 0 once the list is exhausted
+ * @limit: maximum number of clients to return, 0 for the daemon's maximum
+ * @clients: pointer to a list to store an array containing objects
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Collect one page of the clients connected to daemon on server @srv,
+ * in the order they connected. Unlike virAdmServerListClients, which
+ * gathers all clients at once, the daemon only has to look at one page
+ * worth of clients per call, which matters for servers with a great
+ * number of connections. See 'Client list filters' in libvirt-admin.h
+ * for the supported parameters in @filters; a client has to satisfy
+ * all of them to be listed. The whole list is obtained by calling this
+ * function until @cursor gets back to 0. Note that a page may hold
+ * fewer than @limit clients, or none at all, before the list is
+ * exhausted, since the daemon bounds the number of clients it checks
+ * against @filters per call.
+ *
+ * Returns the number of clients in @clients or -1 in case of a failure,
+ * setting @clients to NULL. There is a guaranteed extra element set to
+ * NULL in the @clients list returned to make the iteration easier,
+ * excluding this extra element from the final count. Caller is
+ * responsible to call virAdmClientFree() on each list element, followed
+ * by freeing @clients.
+ */
+int
+virAdmServerListClientsFiltered(virAdmServerPtr srv,
+                                virTypedParameterPtr filters,
+                                int nfilters,
+                                unsigned long long *cursor,
+                                unsigned int limit,
+                                virAdmClientPtr **clients,
+                                unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("srv=%p, filters=%p, nfilters=%d, cursor=%p, limit=%u, "
+              "clients=%p, flags=%x",
+              srv, filters, nfilters, cursor, limit, clients, flags);
+    VIR_TYPED_PARAMS_DEBUG(filters, nfilters);
+
+    virResetLastError();
+
+    if (clients)
+        *clients = NULL;
+
+    virCheckAdmServerGoto(srv, error);
+    virCheckNonNegativeArgGoto(nfilters, error);
+    virCheckNonNullArgGoto(cursor, error);
+    virCheckNonNullArgGoto(clients, error);
+
+    if ((ret = remoteAdminServerListClientsFiltered(srv, filters, nfilters,
+                                                    cursor, limit,
+                                                    clients, flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
 /**
  * virAdmServerLookupClient:
  * @srv: a valid server object reference
@@ -1085,6 +1153,48 @@ virAdmServerSetClientLimits(virAdmServerPtr srv,
     return ret;
 }
 
+/**
+ * virAdmServerGetClientStats:
+ * @srv: a valid server object reference
+ * @params: pointer to client statistics object
+ *          (return value, allocated automatically)
+ * @nparams: pointer to number of parameters returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieve summary statistics of the clients connected to server @srv,
+ * such as the number of clients per transport, without enumerating the
+ * clients, which the daemon keeps up to date as clients come and go.
+ * See 'Per-server client statistics' in libvirt-admin.h for the
+ * parameters returned, in addition to VIR_SERVER_CLIENTS_CURRENT and
+ * VIR_SERVER_CLIENTS_UNAUTH_CURRENT.
+ *
+ * Returns 0 on success, allocating @params to size returned in @nparams, or
+ * -1 in case of an error. Caller is responsible for deallocating @params.
+ */
+int
+virAdmServerGetClientStats(virAdmServerPtr srv,
+                           virTypedParameterPtr *params,
+                           int *nparams,
+                           unsigned int flags)
+{
+    VIR_DEBUG("srv=%p, params=%p, nparams=%p, flags=%x",
+              srv, params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckAdmServerGoto(srv, error);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if (remoteAdminServerGetClientStats(srv, params, nparams, flags) < 0)
+        goto error;
+
+    return 0;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
 /**
  * virAdmConnectGetLoggingOutputs:
  * @conn: pointer to an active admin connection
@@ -1166,6 +1276,41 @@ virAdmConnectGetLoggingFilters(virAdmConnectPtr conn,
     return -1;
 }
 
+/**
+ * virAdmConnectDumpLoggingMemory:
+ * @conn: pointer to an active admin connection
+ * @messages: pointer to a variable to store a string containing the
+ *            recorded messages (allocated automatically)
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieves the messages the daemon recorded in memory through a logging
+ * output of type 'memory', ordered by the time they were emitted and with
+ * the oldest ones left out if they would not fit into a single reply. The
+ * string is empty if the daemon has no such output or recorded nothing.
+ * Caller is responsible for freeing @messages.
+ *
+ * Returns 0 on success, -1 in case of an error.
+ */
+int
+virAdmConnectDumpLoggingMemory(virAdmConnectPtr conn,
+                               char **messages,
+                               unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, messages=%p, flags=%x", conn, messages, flags);
+
+    virResetLastError();
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(messages, error);
+
+    if (remoteAdminConnectDumpLoggingMemory(conn, messages, flags) < 0)
+        goto error;
+
+    return 0;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
 /**
  * virAdmConnectSetLoggingOutputs:
  * @conn: pointer to an active admin connection
@@ -1241,3 +1386,212 @@ virAdmConnectSetLoggingFilters(virAdmConnectPtr conn,
     virDispatchError(NULL);
     return -1;
 }
+
+/**
+ * virAdmConnectGetMessagePoolStats:
+ * @conn: pointer to an active admin connection
+ * @params: pointer to a list of typed parameters which will be allocated
+ *          to store all returned parameters
+ * @nparams: pointer which will hold the number of params returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieves usage counters of the pool of idle RPC message buffers the
+ * daemon keeps to avoid allocating a buffer for every message. The pool
+ * is shared by all servers of the daemon. See 'Monitor the pool of RPC
+ * message buffers' in libvirt-admin.h for the returned parameters.
+ *
+ * Returns 0 on success, -1 in case of an error. Caller is responsible
+ * for deallocating @params.
+ */
+int
+virAdmConnectGetMessagePoolStats(virAdmConnectPtr conn,
+                                 virTypedParameterPtr *params,
+                                 int *nparams,
+                                 unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, params=%p, nparams=%p, flags=%x",
+              conn, params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if (remoteAdminConnectGetMessagePoolStats(conn, params, nparams,
+                                              flags) < 0)
+        goto error;
+
+    return 0;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmConnectGetObjectStats:
+ * @conn: pointer to an active admin connection
+ * @params: pointer to a list of typed parameters which will be allocated
+ *          to store all returned parameters
+ * @nparams: pointer which will hold the number of params returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieves, for every class of reference counted objects the daemon
+ * uses, how many instances are in use and how many released ones are
+ * cached for reuse. See 'Monitor the objects allocated by the daemon'
+ * in libvirt-admin.h for the returned parameters.
+ *
+ * Returns 0 on success, -1 in case of an error. Caller is responsible
+ * for deallocating @params.
+ */
+int
+virAdmConnectGetObjectStats(virAdmConnectPtr conn,
+                            virTypedParameterPtr *params,
+                            int *nparams,
+                            unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, params=%p, nparams=%p, flags=%x",
+              conn, params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if (remoteAdminConnectGetObjectStats(conn, params, nparams, flags) < 0)
+        goto error;
+
+    return 0;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmConnectGetStreamStats:
+ * @conn: pointer to an active admin connection
+ * @params: pointer to a list of typed parameters which will be allocated
+ *          to store all returned parameters
+ * @nparams: pointer which will hold the number of params returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieves throughput counters of the streams of files and block
+ * devices, e.g. volume uploads and downloads, whose data is copied by a
+ * bounded pool of I/O workers shared by all servers of the daemon. See
+ * 'Monitor the streams of files and block devices' in libvirt-admin.h
+ * for the returned parameters.
+ *
+ * Returns 0 on success, -1 in case of an error. Caller is responsible
+ * for deallocating @params.
+ */
+int
+virAdmConnectGetStreamStats(virAdmConnectPtr conn,
+                            virTypedParameterPtr *params,
+                            int *nparams,
+                            unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, params=%p, nparams=%p, flags=%x",
+              conn, params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if (remoteAdminConnectGetStreamStats(conn, params, nparams, flags) < 0)
+        goto error;
+
+    return 0;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmConnectGetLockStats:
+ * @conn: pointer to an active admin connection
+ * @params: pointer to a list of typed parameters which will be allocated
+ *          to store all returned parameters
+ * @nparams: pointer which will hold the number of params returned in @params
+ * @flags: bitwise-OR of virAdmConnectGetLockStatsFlags
+ *
+ * Retrieves how often the daemon's locks were contended and how long
+ * they were waited for and held, accounted per class of locks, e.g. all
+ * the locks of domain objects together. The daemon only collects these
+ * statistics when it was started with LIBVIRT_LOCK_PROFILE=1 set in its
+ * environment. See 'Monitor the contention of the daemon's locks' in
+ * libvirt-admin.h for the returned parameters.
+ *
+ * With VIR_ADM_LOCK_STATS_RESET the statistics are cleared once read,
+ * so that the next call reports the period between the two calls.
+ *
+ * Returns 0 on success, -1 in case of an error. Caller is responsible
+ * for deallocating @params.
+ */
+int
+virAdmConnectGetLockStats(virAdmConnectPtr conn,
+                          virTypedParameterPtr *params,
+                          int *nparams,
+                          unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, params=%p, nparams=%p, flags=%x",
+              conn, params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckAdmConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if (remoteAdminConnectGetLockStats(conn, params, nparams, flags) < 0)
+        goto error;
+
+    return 0;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
+/**
+ * virAdmServerGetProcedureStats:
+ * @srv: a valid server object reference
+ * @params: pointer to a list of typed parameters which will be allocated
+ *          to store all returned parameters
+ * @nparams: pointer which will hold the number of params returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieves per procedure statistics of the RPC calls @srv has processed
+ * since it was started: the number of calls and failed calls, the total
+ * time the calls spent waiting in the queue for a worker thread and
+ * executing, and histograms of both with power of two buckets in
+ * microseconds. See 'Per procedure RPC latency statistics of a server'
+ * in libvirt-admin.h for the layout of the returned parameters.
+ *
+ * Returns 0 on success, -1 in case of an error. Caller is responsible
+ * for deallocating @params.
+ */
+int
+virAdmServerGetProcedureStats(virAdmServerPtr srv,
+                              virTypedParameterPtr *params,
+                              int *nparams,
+                              unsigned int flags)
+{
+    VIR_DEBUG("srv=%p, params=%p, nparams=%p, flags=%x",
+              srv, params, nparams, flags);
+
+    virResetLastError();
+
+    virCheckAdmServerReturn(srv, -1);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if (remoteAdminServerGetProcedureStats(srv, params, nparams, flags) < 0)
+        goto error;
+
+    return 0;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
@@ -8130,6 +8130,9 @@ virDomainAttachDevice(virDomainPtr domain, const char *xml)
  * in an existing CDROM/Floppy device, however, applications are
  * recommended to use the virDomainUpdateDeviceFlag method instead.
  *
+ * Some hypervisors accept several devices wrapped in a <devices> element
+ * as @xml. Either all of them are attached, or none is.
+ *
  * Be aware that hotplug changes might not persist across a domain going
  * into S4 state (also known as hibernation) unless you also modify the
  * persistent domain definition.
@@ -8247,7 +8250,14 @@ virDomainDetachDevice(virDomainPtr domain, const char *xml)
  * clients work better in most cases, this API will try to transform an
  * asynchronous device removal that finishes shortly after the request into
  * a synchronous removal. In other words, this API may wait a bit for the
- * removal to complete in case it was not synchronous.
+ * removal to complete in case it was not synchronous. If @flags contains
+ * VIR_DOMAIN_DEVICE_MODIFY_ASYNC, the API returns as soon as the removal
+ * was requested and the VIR_DOMAIN_EVENT_ID_DEVICE_REMOVED event is the
+ * only way to learn that it finished.
+ *
+ * Some hypervisors accept several devices wrapped in a <devices> element
+ * as @xml. All of them are detached at once and the API waits for their
+ * removals concurrently.
  *
  * Be aware that hotplug changes might not persist across a domain going
  * into S4 state (also known as hibernation) unless you also modify the
@@ -10090,6 +10100,102 @@ virDomainBlockCopy(virDomainPtr dom, const char *disk,
 }
 
 
+/**
+ * virDomainBlockBackup:
+ * @dom: pointer to domain object
+ * @disk: path to the block device, or device shorthand
+ * @destxml: XML description of the backup destination
+ * @params: Pointer to block backup parameter objects, or NULL
+ * @nparams: Number of block backup parameters (this value can be the same
+ *           or less than the number of parameters supported)
+ * @flags: bitwise-OR of virDomainBlockBackupFlags
+ *
+ * Copy a point in time view of the guest-visible contents of a disk image
+ * to a new file described by @destxml, while the domain keeps running.
+ * The destination XML has the same format as for virDomainBlockCopy().
+ * The destination will be created unless the
+ * VIR_DOMAIN_BLOCK_BACKUP_REUSE_EXT flag is present stating that the file
+ * was pre-created with the correct format and sufficient size to hold the
+ * backup.
+ *
+ * Every backup also starts tracking the guest writes to the disk in a
+ * persistent dirty bitmap stored in the disk image, so the hypervisor may
+ * require a format able to hold such bitmaps (e.g. qcow2).  By default the
+ * whole disk is copied and the tracking starts over from the point in time
+ * of the backup.  If @flags contains VIR_DOMAIN_BLOCK_BACKUP_INCREMENTAL,
+ * only the data written since the previous backup of @disk is copied, and
+ * the tracking continues from the point in time of this backup once the
+ * job completes.  The resulting file is meant to be layered on top of the
+ * previous backup, e.g. by setting it as the backing file of the new one.
+ * An incremental backup fails if no previous backup of @disk is known.
+ *
+ * This command starts a long-running job, which can be tracked via
+ * virDomainGetBlockJobInfo() with a job type of
+ * VIR_DOMAIN_BLOCK_JOB_TYPE_BACKUP, and ends by itself once all data was
+ * copied; an event is issued at that point.  Canceling the job with
+ * virDomainBlockJobAbort() leaves an unusable destination behind; if it
+ * was an incremental backup, the changes are kept tracked for the next
+ * one, while a failed full backup has to be followed by another full
+ * backup.
+ *
+ * The @disk parameter is either an unambiguous source name of the
+ * block device (the <source file='...'/> sub-element, such as
+ * "/path/to/image"), or the device target shorthand (the
+ * <target dev='...'/> sub-element, such as "vda").  Valid names
+ * can be found by calling virDomainGetXMLDesc() and inspecting
+ * elements within //domain/devices/disk.
+ *
+ * The @params and @nparams arguments can be used to set hypervisor-specific
+ * tuning parameters, such as maximum bandwidth.  For a parameter that the
+ * hypervisor understands, explicitly specifying 0 behaves the same as
+ * omitting the parameter, to use the hypervisor default; however,
+ * omitting a parameter is less likely to fail.
+ *
+ * Returns 0 if the operation has started, -1 on failure.
+ */
+int
+virDomainBlockBackup(virDomainPtr dom, const char *disk,
+                     const char *destxml,
+                     virTypedParameterPtr params,
+                     int nparams,
+                     unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(dom,
+                     "disk=%s, destxml=%s, params=%p, nparams=%d, flags=%x",
+                     disk, destxml, params, nparams, flags);
+    VIR_TYPED_PARAMS_DEBUG(params, nparams);
+
+    virResetLastError();
+
+    virCheckDomainReturn(dom, -1);
+    conn = dom->conn;
+
+    virCheckReadOnlyGoto(conn->flags, error);
+    virCheckNonNullArgGoto(disk, error);
+    virCheckNonNullArgGoto(destxml, error);
+    virCheckNonNegativeArgGoto(nparams, error);
+    if (nparams)
+        virCheckNonNullArgGoto(params, error);
+
+    if (conn->driver->domainBlockBackup) {
+        int ret;
+        ret = conn->driver->domainBlockBackup(dom, disk, destxml,
+                                              params, nparams, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(dom->conn);
+    return -1;
+}
+
+
 /**
  * virDomainBlockCommit:
  * @dom: pointer to domain object
@@ -11119,6 +11225,10 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  *     "state.state" - state of the VM, returned as int from virDomainState enum
  *     "state.reason" - reason for entering given state, returned as int from
  *                      virDomain*Reason enum corresponding to given state.
+ *     "state.generation" - counter which changes whenever the XML description
+ *                          of the domain may have changed, as unsigned long
+ *                          long. Clients can compare it to a value they saw
+ *                          before to skip fetching an unchanged XML.
  *
  * VIR_DOMAIN_STATS_CPU_TOTAL:
  *     Return CPU statistics and usage information. The typed parameter keys
@@ -11283,13 +11393,171 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  *                               long long. It is produced by the
  *                               emulation_faults perf event
  *
+ * VIR_DOMAIN_STATS_MONITOR:
+ *     Return statistics of the channel used to control the hypervisor
+ *     process of a running domain, such as the QEMU monitor.
+ *     The typed parameter keys are in this format:
+ *
+ *     "monitor.bytes.read" - bytes received from the hypervisor as
+ *                            unsigned long long.
+ *     "monitor.bytes.written" - bytes sent to the hypervisor as
+ *                               unsigned long long.
+ *     "monitor.events" - number of asynchronous events received as
+ *                        unsigned long long.
+ *     "monitor.replies" - number of commands which got a reply as
+ *                         unsigned long long.
+ *     "monitor.time" - total time (ms) spent waiting for replies as
+ *                      unsigned long long.
+ *     "monitor.time.max" - longest time (ms) spent waiting for a single
+ *                          reply as unsigned long long.
+ *     "monitor.command.count" - number of distinct commands listed in this
+ *                               group as unsigned int.
+ *     "monitor.command.<num>.name" - name of the command as string.
+ *     "monitor.command.<num>.calls" - number of replies to this command
+ *                                     as unsigned long long.
+ *     "monitor.command.<num>.time" - total time (ms) spent waiting for
+ *                                    replies to this command as
+ *                                    unsigned long long.
+ *     "monitor.command.<num>.time.max" - longest time (ms) spent waiting
+ *                                        for a reply to this command as
+ *                                        unsigned long long.
+ *     "monitor.command.<num>.latency.<limit>" - number of replies to this
+ *                                               command which took at most
+ *                                               <limit> ms, and longer than
+ *                                               the previous limit, as
+ *                                               unsigned long long. <limit>
+ *                                               is one of 1, 10, 100, 1000,
+ *                                               10000 and "inf".
+ *
+ * VIR_DOMAIN_STATS_STARTUP:
+ *     Return how long the last start of a running domain took, broken
+ *     down into the phases of starting it. The typed parameter keys are
+ *     in this format:
+ *
+ *     "startup.time" - total time (ms) it took to start the domain as
+ *                      unsigned long long.
+ *     "startup.<phase>.time" - time (ms) spent in <phase> as unsigned
+ *                              long long. <phase> is one of
+ *                              "prepare-domain", "prepare-host",
+ *                              "command-line", "spawn", "cgroup",
+ *                              "security", "monitor", "setup", "refresh"
+ *                              and "finish". For incoming migration the
+ *                              "finish" phase includes the time spent
+ *                              migrating.
+ *
+ * VIR_DOMAIN_STATS_METADATA:
+ *     Return the title, description and custom metadata elements of the
+ *     domain, as virDomainGetMetadata() would for the live definition of
+ *     a running domain or the persistent one otherwise. The typed
+ *     parameter keys are in this format:
+ *
+ *     "metadata.title" - short title of the domain as string, if set.
+ *     "metadata.description" - description of the domain as string,
+ *                              if set.
+ *     "metadata.element.count" - number of custom metadata elements listed
+ *                                in this group as unsigned int.
+ *     "metadata.element.<num>.uri" - namespace URI of the element as string.
+ *     "metadata.element.<num>.xml" - the element formatted as XML string.
+ *
+ * VIR_DOMAIN_STATS_AGENT:
+ *     Return information the guest agent of a running domain reports,
+ *     gathered in a single exchange with the agent. Items the agent does
+ *     not support are omitted, as is the whole group if the agent is not
+ *     connected. This group is not part of the default set and has to be
+ *     requested explicitly. The typed parameter keys are in this format:
+ *
+ *     "agent.time.seconds" - guest time in seconds since the epoch as
+ *                            long long.
+ *     "agent.time.nseconds" - nanosecond part of the guest time as
+ *                             unsigned int.
+ *     "agent.hostname" - host name of the guest as string.
+ *     "agent.fs.count" - number of mounted filesystems as unsigned int.
+ *     "agent.fs.<num>.mountpoint" - mount point of the filesystem as string.
+ *     "agent.fs.<num>.name" - device name in the guest as string.
+ *     "agent.fs.<num>.fstype" - filesystem type as string.
+ *     "agent.fs.<num>.disk.count" - number of disks backing the filesystem
+ *                                   as unsigned int.
+ *     "agent.fs.<num>.disk.<num>.alias" - target name of the disk in the
+ *                                         domain definition as string.
+ *     "agent.if.count" - number of guest network interfaces as
+ *                        unsigned int.
+ *     "agent.if.<num>.name" - name of the interface in the guest as string.
+ *     "agent.if.<num>.hwaddr" - hardware address of the interface as
+ *                               string, if known.
+ *     "agent.if.<num>.addr.count" - number of addresses of the interface
+ *                                   as unsigned int.
+ *     "agent.if.<num>.addr.<num>.type" - "ipv4" or "ipv6" as string.
+ *     "agent.if.<num>.addr.<num>.addr" - the address as string.
+ *     "agent.if.<num>.addr.<num>.prefix" - prefix length of the address
+ *                                          as unsigned int.
+ *
+ * VIR_DOMAIN_STATS_JOB:
+ *     Return how long API calls waited for the job of the domain, which
+ *     serialises everything that changes or queries the domain, broken
+ *     down by job type. Several calls which only query the domain may hold
+ *     the job together. The typed parameter keys are in this format:
+ *
+ *     "job.query.count" - number of calls currently holding the job for a
+ *                         query as unsigned int.
+ *     "job.wait.count" - number of job types listed in this group as
+ *                        unsigned int.
+ *     "job.wait.<num>.name" - name of the job type as string.
+ *     "job.wait.<num>.calls" - number of jobs of this type which were
+ *                              started as unsigned long long.
+ *     "job.wait.<num>.failures" - number of calls which gave up waiting for
+ *                                 a job of this type as unsigned long long.
+ *     "job.wait.<num>.time" - total time (ms) spent waiting for jobs of this
+ *                             type as unsigned long long.
+ *     "job.wait.<num>.time.max" - longest time (ms) spent waiting for a
+ *                                 job of this type as unsigned long long.
+ *     "job.wait.<num>.latency.<limit>" - number of jobs of this type which
+ *                                        waited at most <limit> ms, and
+ *                                        longer than the previous limit, as
+ *                                        unsigned long long. <limit> is one
+ *                                        of 1, 10, 100, 1000, 10000 and
+ *                                        "inf".
+ *
+ * VIR_DOMAIN_STATS_FOOTPRINT:
+ *     Return how much memory the daemon uses to keep track of the domain,
+ *     broken down by what it is used for. Sizes of definitions are those of
+ *     their XML description, which approximates the memory they take. The
+ *     typed parameter keys are in this format:
+ *
+ *     "footprint.def.live" - size (bytes) of the live or inactive definition
+ *                            as unsigned long long.
+ *     "footprint.def.persistent" - size (bytes) of the persistent definition
+ *                                  of a running domain as unsigned long long.
+ *     "footprint.xml.cache" - bytes taken by cached XML descriptions of the
+ *                             domain as unsigned long long.
+ *     "footprint.monitor.buffer" - bytes allocated for messages from the
+ *                                  hypervisor monitor as unsigned long long.
+ *     "footprint.agent.buffer" - bytes allocated for messages from the guest
+ *                                agent as unsigned long long.
+ *
+ * VIR_DOMAIN_STATS_DIRTYRATE:
+ *     Return the result of the last memory dirty rate calculation started by
+ *     virDomainStartDirtyRateCalc. The typed parameter keys are in this
+ *     format:
+ *
+ *     "dirtyrate.calc_status" - the status of the calculation, as int from
+ *                               the virDomainDirtyRateStatus enum.
+ *     "dirtyrate.calc_start_time" - the start time (seconds since the
+ *                                   hypervisor started) of the calculation
+ *                                   as long long.
+ *     "dirtyrate.calc_period" - the period (seconds) of the calculation
+ *                               as int.
+ *     "dirtyrate.megabytes_per_second" - the rate (MiB per second) at which
+ *                                        the guest dirtied its memory as
+ *                                        long long. Only present once the
+ *                                        calculation is complete.
+ *
  * Note that entire stats groups or individual stat fields may be missing from
  * the output in case they are not supported by the given hypervisor, are not
  * applicable for the current state of the guest domain, or their retrieval
  * was not successful.
  *
  * Using 0 for @stats returns all stats groups supported by the given
- * hypervisor.
+ * hypervisor, except for VIR_DOMAIN_STATS_AGENT.
  *
  * Specifying VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS as @flags makes
  * the function return error in case some of the stat types in @stats were
@@ -11315,6 +11583,22 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  * VIR_CONNECT_GET_ALL_DOMAINS_STATS_SHUTOFF and/or
  * VIR_CONNECT_GET_ALL_DOMAINS_STATS_OTHER for all other states.
  *
+ * Hypervisors which sample the statistics of all domains periodically
+ * in the background can be asked to answer from those samples instead
+ * of querying every domain: VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED
+ * returns the latest sample, and
+ * VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLE_HISTORY returns all samples
+ * still kept, oldest first, with one record per domain and sample.
+ * Only the stats groups the sampler collects are reported, domains which
+ * were not part of a sample are omitted from it, and every record has
+ * an extra field:
+ *
+ *     "sample.time" - time the sample was started, in milliseconds since
+ *                     the epoch as unsigned long long.
+ *
+ * Neither flag can be combined with
+ * VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING.
+ *
  * Returns the count of returned statistics structures on success, -1 on error.
  * The requested data are returned in the @retStats parameter. The returned
  * array should be freed by the caller. See virDomainStatsRecordListFree.
@@ -11373,7 +11657,7 @@ virConnectGetAllDomainStats(virConnectPtr conn,
  * in virConnectGetAllDomainStats.
  *
  * Using 0 for @stats returns all stats groups supported by the given
- * hypervisor.
+ * hypervisor, except for VIR_DOMAIN_STATS_AGENT.
  *
  * Specifying VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS as @flags makes
  * the function return error in case some of the stat types in @stats were
@@ -11885,3 +12169,54 @@ virDomainSetBlockThreshold(virDomainPtr domain,
     virDispatchError(domain->conn);
     return -1;
 }
+
+
+/**
+ * virDomainStartDirtyRateCalc:
+ * @domain: a domain object
+ * @seconds: specified calculating time in seconds
+ * @flags: currently unused, callers should pass 0
+ *
+ * Calculate the rate at which the guest dirties its memory during the
+ * next @seconds seconds, without starting a migration. This allows
+ * management applications to choose a migration strategy, e.g. whether
+ * pre-copy migration is likely to converge, beforehand.
+ *
+ * The calculation runs in the background and the caller should wait at
+ * least @seconds seconds before querying the result, which is reported in
+ * the VIR_DOMAIN_STATS_DIRTYRATE group of virConnectGetAllDomainStats and
+ * virDomainListGetStats.
+ *
+ * Returns 0 if the calculation was started, -1 on failure.
+ */
+int
+virDomainStartDirtyRateCalc(virDomainPtr domain,
+                            int seconds,
+                            unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "seconds=%d flags=%x", seconds, flags);
+
+    virResetLastError();
+
+    virCheckDomainReturn(domain, -1);
+    conn = domain->conn;
+
+    virCheckReadOnlyGoto(conn->flags, error);
+    virCheckPositiveArgGoto(seconds, error);
+
+    if (conn->driver->domainStartDirtyRateCalc) {
+        int ret;
+        ret = conn->driver->domainStartDirtyRateCalc(domain, seconds, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(conn);
+    return -1;
+}
@@ -123,6 +123,18 @@ enum {
      * Support for driver close callback rpc
      */
     VIR_DRV_FEATURE_REMOTE_CLOSE_CALLBACK = 15,
+
+    /*
+     * Remote party accepts compressed RPC messages and agrees to send
+     * them back.
+     */
+    VIR_DRV_FEATURE_COMPRESSION = 16,
+
+    /*
+     * Support for bulk domain stats sent with each parameter name only
+     * once per reply.
+     */
+    VIR_DRV_FEATURE_REMOTE_COMPACT_STATS = 17,
 };
 
 
@@ -78,6 +78,11 @@ libxlDomainObjInitJob(libxlDomainObjPrivatePtr priv)
     if (virCondInit(&priv->job.cond) < 0)
         return -1;
 
+    if (virMutexInit(&priv->job.progressLock) < 0) {
+        ignore_value(virCondDestroy(&priv->job.cond));
+        return -1;
+    }
+
     if (VIR_ALLOC(priv->job.current) < 0)
         return -1;
 
@@ -97,6 +102,7 @@ static void
 libxlDomainObjFreeJob(libxlDomainObjPrivatePtr priv)
 {
     ignore_value(virCondDestroy(&priv->job.cond));
+    virMutexDestroy(&priv->job.progressLock);
     VIR_FREE(priv->job.current);
 }
 
@@ -138,7 +144,11 @@ libxlDomainObjBeginJob(libxlDriverPrivatePtr driver ATTRIBUTE_UNUSED,
     priv->job.active = job;
     priv->job.owner = virThreadSelfID();
     priv->job.started = now;
+    memset(priv->job.current, 0, sizeof(*priv->job.current));
     priv->job.current->type = VIR_DOMAIN_JOB_UNBOUNDED;
+    virMutexLock(&priv->job.progressLock);
+    priv->job.dataSent = 0;
+    virMutexUnlock(&priv->job.progressLock);
 
     return 0;
 
@@ -205,6 +215,28 @@ libxlDomainJobUpdateTime(struct libxlDomainJobObj *job)
     return 0;
 }
 
+/*
+ * May be called without the domain lock, by threads which move the
+ * data of the job
+ */
+void
+libxlDomainJobAddDataSent(struct libxlDomainJobObj *job,
+                          unsigned long long bytes)
+{
+    virMutexLock(&job->progressLock);
+    job->dataSent += bytes;
+    virMutexUnlock(&job->progressLock);
+}
+
+/* The domain must be locked */
+void
+libxlDomainJobUpdateProgress(struct libxlDomainJobObj *job)
+{
+    virMutexLock(&job->progressLock);
+    job->current->dataProcessed = job->dataSent;
+    virMutexUnlock(&job->progressLock);
+}
+
 static void *
 libxlDomainObjPrivateAlloc(void)
 {
@@ -55,6 +55,9 @@ struct libxlDomainJobObj {
     int owner;                          /* Thread which set current job */
     unsigned long long started;         /* When the job started */
     virDomainJobInfoPtr current;        /* Statistics for the current job */
+    virMutex progressLock;              /* Protects dataSent */
+    unsigned long long dataSent;        /* Migration data sent by threads
+                                           that do not hold the domain lock */
 };
 
 typedef struct _libxlDomainObjPrivate libxlDomainObjPrivate;
@@ -95,6 +98,13 @@ int
 libxlDomainJobUpdateTime(struct libxlDomainJobObj *job)
     ATTRIBUTE_RETURN_CHECK;
 
+void
+libxlDomainJobAddDataSent(struct libxlDomainJobObj *job,
+                          unsigned long long bytes);
+
+void
+libxlDomainJobUpdateProgress(struct libxlDomainJobObj *job);
+
 void
 libxlDomainEventQueue(libxlDriverPrivatePtr driver,
                       virObjectEventPtr event);
@@ -666,7 +666,8 @@ libxlStateInitialize(bool privileged,
     if (!(libxl_driver->migrationPorts =
           virPortAllocatorNew(_("migration"),
                               LIBXL_MIGRATION_PORT_MIN,
-                              LIBXL_MIGRATION_PORT_MAX, 0)))
+                              LIBXL_MIGRATION_PORT_MAX,
+                              VIR_PORT_ALLOCATOR_ROTATE)))
         goto error;
 
     if (!(libxl_driver->domains = virDomainObjListNew()))
@@ -5213,6 +5214,7 @@ libxlDomainGetJobInfo(virDomainPtr dom,
      * for the active job. */
     if (libxlDomainJobUpdateTime(&priv->job) < 0)
         goto cleanup;
+    libxlDomainJobUpdateProgress(&priv->job);
 
     memcpy(info, priv->job.current, sizeof(virDomainJobInfo));
     ret = 0;
@@ -5233,6 +5235,8 @@ libxlDomainGetJobStats(virDomainPtr dom,
     libxlDomainObjPrivatePtr priv;
     virDomainObjPtr vm;
     virDomainJobInfoPtr jobInfo;
+    virTypedParameterPtr par = NULL;
+    int npar = 0;
     int ret = -1;
     int maxparams = 0;
 
@@ -5260,16 +5264,34 @@ libxlDomainGetJobStats(virDomainPtr dom,
      * for the active job. */
     if (libxlDomainJobUpdateTime(&priv->job) < 0)
         goto cleanup;
+    libxlDomainJobUpdateProgress(&priv->job);
 
-    if (virTypedParamsAddULLong(params, nparams, &maxparams,
+    if (virTypedParamsAddULLong(&par, &npar, &maxparams,
                                 VIR_DOMAIN_JOB_TIME_ELAPSED,
                                 jobInfo->timeElapsed) < 0)
         goto cleanup;
 
+    /* Only tunnelled migration sees the data libxl sends */
+    if (jobInfo->dataProcessed &&
+        virTypedParamsAddULLong(&par, &npar, &maxparams,
+                                VIR_DOMAIN_JOB_DATA_PROCESSED,
+                                jobInfo->dataProcessed) < 0)
+        goto cleanup;
+
+    if (jobInfo->memTotal &&
+        virTypedParamsAddULLong(&par, &npar, &maxparams,
+                                VIR_DOMAIN_JOB_MEMORY_TOTAL,
+                                jobInfo->memTotal) < 0)
+        goto cleanup;
+
     *type = jobInfo->type;
+    *params = par;
+    *nparams = npar;
+    par = NULL;
     ret = 0;
 
  cleanup:
+    virTypedParamsFree(par, npar);
     if (vm)
         virObjectUnlock(vm);
     return ret;
@@ -24,6 +24,8 @@
 
 #include <config.h>
 
+#include <fcntl.h>
+
 #include "internal.h"
 #include "virlog.h"
 #include "virerror.h"
@@ -45,6 +47,7 @@
 #include "locking/domain_lock.h"
 #include "virtypedparam.h"
 #include "virfdstream.h"
+#include "rpc/virnetprotocol.h"
 
 #define VIR_FROM_THIS VIR_FROM_LIBXL
 
@@ -827,27 +830,163 @@ libxlDomainMigrationPrepare(virConnectPtr dconn,
     return ret;
 }
 
+/* Each chunk read from libxl is sent as a single stream packet. Keep it
+ * within the payload limit that even old daemons accept. */
+#define TUNNEL_SEND_BUF_SIZE VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX
+
+/* Number of chunks which may be queued between reading from libxl and
+ * sending them to the destination */
+#define TUNNEL_SEND_BUF_COUNT 8
+
+/* Size of the pipe between libxl and the migration tunnel */
+#define TUNNEL_PIPE_SIZE (1024 * 1024)
+
+typedef struct _libxlTunnelBuffer libxlTunnelBuffer;
+struct _libxlTunnelBuffer {
+    char *data;
+    size_t len;
+};
+
 typedef struct _libxlTunnelMigrationThread libxlTunnelMigrationThread;
 struct _libxlTunnelMigrationThread {
     virStreamPtr st;
     int srcFD;
+    struct libxlDomainJobObj *job;
+    virError err;
+
+    /* Ring of chunks read from @srcFD waiting to be sent to @st by the
+     * sender thread. Protected by @lock. */
+    virMutex lock;
+    virCond cond;
+    libxlTunnelBuffer bufs[TUNNEL_SEND_BUF_COUNT];
+    size_t head;
+    size_t count;
+    bool eof;           /* no more chunks will be queued */
+    bool quit;          /* both threads have to stop right away */
+    bool sendFailed;    /* virStreamSend failed, see @sendErr */
+    virError sendErr;
 };
-#define TUNNEL_SEND_BUF_SIZE 65536
 
 /*
  * The data flow of tunnel3 migration in the src side:
  * libxlDoMigrateSend() -> pipe
- * libxlTunnel3MigrationFunc() polls pipe out and then write to dest stream.
+ * libxlTunnel3MigrationFunc() polls pipe out and queues the data
+ * libxlTunnel3SendFunc() writes the queued data to dest stream
+ *
+ * Reading the next chunk from libxl thus overlaps with sending the
+ * previous one to the destination.
  */
+static void libxlTunnel3SendFunc(void *arg)
+{
+    libxlTunnelMigrationThread *data = arg;
+    libxlTunnelBuffer *buf;
+
+    virMutexLock(&data->lock);
+    for (;;) {
+        while (!data->count && !data->eof && !data->quit)
+            virCondWait(&data->cond, &data->lock);
+
+        if (data->quit || !data->count)
+            break;
+
+        /* The slot is released only after the chunk is sent */
+        buf = &data->bufs[data->head];
+        virMutexUnlock(&data->lock);
+
+        if (virStreamSend(data->st, buf->data, buf->len) < 0) {
+            virMutexLock(&data->lock);
+            virCopyLastError(&data->sendErr);
+            virResetLastError();
+            data->sendFailed = true;
+            virCondBroadcast(&data->cond);
+            break;
+        }
+        libxlDomainJobAddDataSent(data->job, buf->len);
+
+        virMutexLock(&data->lock);
+        data->head = (data->head + 1) % TUNNEL_SEND_BUF_COUNT;
+        data->count--;
+        virCondBroadcast(&data->cond);
+    }
+    virMutexUnlock(&data->lock);
+}
+
+/* Waits for a free slot in the send queue. Returns NULL if the sender
+ * thread gave up or the tunnel is being torn down. */
+static libxlTunnelBuffer *
+libxlTunnel3GetBuffer(libxlTunnelMigrationThread *data)
+{
+    libxlTunnelBuffer *buf = NULL;
+
+    virMutexLock(&data->lock);
+    while (data->count == TUNNEL_SEND_BUF_COUNT &&
+           !data->sendFailed && !data->quit)
+        virCondWait(&data->cond, &data->lock);
+
+    if (!data->sendFailed && !data->quit)
+        buf = &data->bufs[(data->head + data->count) % TUNNEL_SEND_BUF_COUNT];
+    virMutexUnlock(&data->lock);
+
+    return buf;
+}
+
+static void
+libxlTunnel3PutBuffer(libxlTunnelMigrationThread *data)
+{
+    virMutexLock(&data->lock);
+    data->count++;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+/* Stops the sender thread, either after it sent everything that was
+ * queued (@graceful) or right away. Returns -1 and sets the error if
+ * sending data failed. */
+static int
+libxlTunnel3StopSender(libxlTunnelMigrationThread *data,
+                       virThreadPtr sender,
+                       bool graceful)
+{
+    virMutexLock(&data->lock);
+    if (graceful)
+        data->eof = true;
+    else
+        data->quit = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+
+    virThreadJoin(sender);
+
+    if (data->sendFailed) {
+        virSetError(&data->sendErr);
+        virResetError(&data->sendErr);
+        return -1;
+    }
+
+    return 0;
+}
+
 static void libxlTunnel3MigrationFunc(void *arg)
 {
     libxlTunnelMigrationThread *data = (libxlTunnelMigrationThread *)arg;
-    char *buffer = NULL;
+    libxlTunnelBuffer *buf;
+    virThread sender;
+    bool senderRunning = false;
     struct pollfd fds[1];
     int timeout = -1;
+    size_t i;
 
-    if (VIR_ALLOC_N(buffer, TUNNEL_SEND_BUF_SIZE) < 0)
-        return;
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++) {
+        if (VIR_ALLOC_N(data->bufs[i].data, TUNNEL_SEND_BUF_SIZE) < 0)
+            goto abrt;
+    }
+
+    if (virThreadCreate(&sender, true, libxlTunnel3SendFunc, data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create tunnel migration thread"));
+        goto abrt;
+    }
+    senderRunning = true;
 
     fds[0].fd = data->srcFD;
     for (;;) {
@@ -861,7 +1000,7 @@ static void libxlTunnel3MigrationFunc(void *arg)
                 continue;
             virReportError(errno, "%s",
                            _("poll failed in libxlTunnel3MigrationFunc"));
-            goto cleanup;
+            goto abrt;
         }
 
         if (ret == 0) {
@@ -872,18 +1011,17 @@ static void libxlTunnel3MigrationFunc(void *arg)
         if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
             int nbytes;
 
-            nbytes = read(data->srcFD, buffer, TUNNEL_SEND_BUF_SIZE);
+            if (!(buf = libxlTunnel3GetBuffer(data)))
+                goto abrt;
+
+            nbytes = saferead(data->srcFD, buf->data, TUNNEL_SEND_BUF_SIZE);
             if (nbytes > 0) {
-                /* Write to dest stream */
-                if (virStreamSend(data->st, buffer, nbytes) < 0) {
-                    virStreamAbort(data->st);
-                    goto cleanup;
-                }
+                buf->len = nbytes;
+                libxlTunnel3PutBuffer(data);
             } else if (nbytes < 0) {
                 virReportError(errno, "%s",
                                _("tunnelled migration failed to read from xen side"));
-                virStreamAbort(data->st);
-                goto cleanup;
+                goto abrt;
             } else {
                 /* EOF; transferred all data */
                 break;
@@ -891,20 +1029,96 @@ static void libxlTunnel3MigrationFunc(void *arg)
         }
     }
 
-    ignore_value(virStreamFinish(data->st));
+    /* The write end is closed early if libxl failed */
+    virMutexLock(&data->lock);
+    if (data->quit) {
+        virMutexUnlock(&data->lock);
+        goto abrt;
+    }
+    virMutexUnlock(&data->lock);
 
- cleanup:
-    VIR_FREE(buffer);
+    senderRunning = false;
+    if (libxlTunnel3StopSender(data, &sender, true) < 0)
+        goto abrt;
 
-    return;
+    if (virStreamFinish(data->st) < 0)
+        goto error;
+
+    goto cleanup;
+
+ abrt:
+    /* The stream must not be used by the sender thread while aborting */
+    if (senderRunning)
+        ignore_value(libxlTunnel3StopSender(data, &sender, false));
+    virCopyLastError(&data->err);
+    virStreamAbort(data->st);
+    goto cleanup;
+
+ error:
+    virCopyLastError(&data->err);
+
+ cleanup:
+    virResetLastError();
+    /* Make libxl fail instead of blocking if data is left unread */
+    VIR_FORCE_CLOSE(data->srcFD);
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++)
+        VIR_FREE(data->bufs[i].data);
 }
 
 struct libxlTunnelControl {
     libxlTunnelMigrationThread tmThread;
     virThread thread;
+    bool running;
     int dataFD[2];
 };
 
+/* Let libxl get ahead of the tunnel by more than the default 64KiB.
+ * Failing to do so is not fatal. */
+static void
+libxlMigrationResizeTunnelPipe(int fd ATTRIBUTE_UNUSED)
+{
+#ifdef F_SETPIPE_SZ
+    char ebuf[1024];
+
+    if (fcntl(fd, F_SETPIPE_SZ, TUNNEL_PIPE_SIZE) < 0)
+        VIR_DEBUG("Unable to resize migration pipe: %s",
+                  virStrerror(errno, ebuf, sizeof(ebuf)));
+#endif
+}
+
+/* Waits for the tunnel to send everything libxl wrote to the pipe, or
+ * tears it down if @cancel is true. Returns -1 if the transfer failed. */
+static int
+libxlMigrationWaitTunnel(struct libxlTunnelControl *tc,
+                         bool cancel)
+{
+    libxlTunnelMigrationThread *arg = &tc->tmThread;
+
+    if (!tc->running)
+        return 0;
+
+    if (cancel) {
+        virMutexLock(&arg->lock);
+        arg->quit = true;
+        virCondBroadcast(&arg->cond);
+        virMutexUnlock(&arg->lock);
+    }
+
+    /* Closing the write end lets the tunnel see the end of the data */
+    VIR_FORCE_CLOSE(tc->dataFD[1]);
+    virThreadJoin(&tc->thread);
+    tc->running = false;
+
+    if (arg->err.code != VIR_ERR_OK) {
+        if (!cancel)
+            virSetError(&arg->err);
+        virResetError(&arg->err);
+        return -1;
+    }
+
+    return 0;
+}
+
 static int
 libxlMigrationStartTunnel(libxlDriverPrivatePtr driver,
                           virDomainObjPtr vm,
@@ -912,6 +1126,7 @@ libxlMigrationStartTunnel(libxlDriverPrivatePtr driver,
                           virStreamPtr st,
                           struct libxlTunnelControl **tnl)
 {
+    libxlDomainObjPrivatePtr priv = vm->privateData;
     struct libxlTunnelControl *tc = NULL;
     libxlTunnelMigrationThread *arg = NULL;
     int ret = -1;
@@ -926,24 +1141,55 @@ libxlMigrationStartTunnel(libxlDriverPrivatePtr driver,
         virReportError(errno, "%s", _("Unable to make pipes"));
         goto out;
     }
+    libxlMigrationResizeTunnelPipe(tc->dataFD[1]);
 
     arg = &tc->tmThread;
+    if (virMutexInit(&arg->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize tunnel mutex"));
+        goto out;
+    }
+    if (virCondInit(&arg->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize tunnel condition"));
+        virMutexDestroy(&arg->lock);
+        goto out;
+    }
+
+    if (libxlDomainObjBeginJob(driver, vm, LIBXL_JOB_MODIFY) < 0)
+        goto destroy;
+    priv->job.current->memTotal = virDomainDefGetMemoryTotal(vm->def) * 1024;
+
     /* Read from pipe */
     arg->srcFD = tc->dataFD[0];
     /* Write to dest stream */
     arg->st = st;
+    arg->job = &priv->job;
     if (virThreadCreate(&tc->thread, true,
                         libxlTunnel3MigrationFunc, arg) < 0) {
         virReportError(errno, "%s",
                        _("Unable to create tunnel migration thread"));
-        goto out;
+        goto endjob;
     }
+    /* The tunnel thread closes the read end when it is done */
+    tc->dataFD[0] = -1;
+    tc->running = true;
 
     virObjectUnlock(vm);
     /* Send data to pipe */
     ret = libxlDoMigrateSend(driver, vm, flags, tc->dataFD[1]);
+    /* Do not call Finish3 before all data reached the destination */
+    if (libxlMigrationWaitTunnel(tc, ret < 0) < 0)
+        ret = -1;
     virObjectLock(vm);
 
+ endjob:
+    libxlDomainObjEndJob(driver, vm);
+
+ destroy:
+    ignore_value(virCondDestroy(&arg->cond));
+    virMutexDestroy(&arg->lock);
+
  out:
     /* libxlMigrationStopTunnel will be called in libxlDoMigrateP2P to free
      * all resources for us. */
@@ -955,9 +1201,6 @@ static void libxlMigrationStopTunnel(struct libxlTunnelControl *tc)
     if (!tc)
         return;
 
-    virThreadCancel(&tc->thread);
-    virThreadJoin(&tc->thread);
-
     VIR_FORCE_CLOSE(tc->dataFD[0]);
     VIR_FORCE_CLOSE(tc->dataFD[1]);
     VIR_FREE(tc);
@@ -1229,6 +1472,10 @@ libxlDomainMigrationPerform(libxlDriverPrivatePtr driver,
     sockfd = virNetSocketDupFD(sock, true);
     virObjectUnref(sock);
 
+    if (libxlDomainObjBeginJob(driver, vm, LIBXL_JOB_MODIFY) < 0)
+        goto cleanup;
+    priv->job.current->memTotal = virDomainDefGetMemoryTotal(vm->def) * 1024;
+
     if (virDomainLockProcessPause(driver->lockManager, vm, &priv->lockState) < 0)
         VIR_WARN("Unable to release lease on %s", vm->def->name);
     VIR_DEBUG("Preserving lock state '%s'", NULLSTR(priv->lockState));
@@ -1238,6 +1485,8 @@ libxlDomainMigrationPerform(libxlDriverPrivatePtr driver,
     ret = libxlDoMigrateSend(driver, vm, flags, sockfd);
     virObjectLock(vm);
 
+    libxlDomainObjEndJob(driver, vm);
+
  cleanup:
     VIR_FORCE_CLOSE(sockfd);
     virURIFree(uri);
@@ -24,17 +24,22 @@
 
 #include "rpc/virnetdaemon.h"
 #include "rpc/virnetserverclient.h"
+#include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
 #include "lock_daemon.h"
 #include "lock_protocol.h"
 #include "virerror.h"
 #include "virthreadjob.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
 VIR_LOG_INIT("locking.lock_daemon_dispatch");
 
+/* Acquiring a domain's resources taking longer than this is logged */
+#define VIR_LOCK_DAEMON_SLOW_ACQUIRE_MS 1000
+
 #include "lock_daemon_dispatch_stubs.h"
 
 static int
@@ -97,6 +102,89 @@ virLockSpaceProtocolDispatchAcquireResource(virNetServerPtr server ATTRIBUTE_UNU
 }
 
 
+static int
+virLockSpaceProtocolDispatchAcquireResources(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                             virNetServerClientPtr client,
+                                             virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                             virNetMessageErrorPtr rerr,
+                                             virLockSpaceProtocolAcquireResourcesArgs *args)
+{
+    int rv = -1;
+    unsigned int flags = args->flags;
+    virLockDaemonClientPtr priv =
+        virNetServerClientGetPrivateData(client);
+    virLockSpaceRequestPtr reqs = NULL;
+    size_t nreqs = args->resources.resources_len;
+    unsigned long long start, end;
+    size_t i;
+
+    virMutexLock(&priv->lock);
+
+    virCheckFlagsGoto(0, cleanup);
+
+    if (priv->restricted) {
+        virReportError(VIR_ERR_OPERATION_DENIED, "%s",
+                       _("lock manager connection has been restricted"));
+        goto cleanup;
+    }
+
+    if (!priv->ownerId) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("lock owner details have not been registered"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(reqs, nreqs) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nreqs; i++) {
+        virLockSpaceProtocolResource *res = &args->resources.resources_val[i];
+
+        if (res->flags & ~(VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED |
+                           VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE)) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unsupported flags (0x%x) for resource %s"),
+                           res->flags, res->name);
+            goto cleanup;
+        }
+
+        if (!(reqs[i].lockspace = virLockDaemonFindLockSpace(lockDaemon,
+                                                             res->path))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Lockspace for path %s does not exist"),
+                           res->path);
+            goto cleanup;
+        }
+
+        reqs[i].resname = res->name;
+        if (res->flags & VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED)
+            reqs[i].flags |= VIR_LOCK_SPACE_ACQUIRE_SHARED;
+        if (res->flags & VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE)
+            reqs[i].flags |= VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE;
+    }
+
+    if (virTimeMillisNowRaw(&start) < 0)
+        start = 0;
+
+    if (virLockSpaceAcquireResources(reqs, nreqs, priv->ownerPid) < 0)
+        goto cleanup;
+
+    if (start && virTimeMillisNowRaw(&end) == 0 &&
+        end - start >= VIR_LOCK_DAEMON_SLOW_ACQUIRE_MS)
+        VIR_WARN("Acquiring %zu resources for %s took %llu ms",
+                 nreqs, priv->ownerName, end - start);
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&priv->lock);
+    VIR_FREE(reqs);
+    return rv;
+}
+
+
 static int
 virLockSpaceProtocolDispatchCreateResource(virNetServerPtr server ATTRIBUTE_UNUSED,
                                            virNetServerClientPtr client,
@@ -612,6 +612,87 @@ static int virLockManagerLockDaemonAddResource(virLockManagerPtr lock,
 }
 
 
+static int
+virLockManagerLockDaemonAcquireAll(virLockManagerLockDaemonPrivatePtr priv,
+                                   virNetClientPtr client,
+                                   virNetClientProgramPtr program,
+                                   int *counter)
+{
+    virLockSpaceProtocolAcquireResourcesArgs args;
+    size_t i;
+    int rv = -1;
+
+    memset(&args, 0, sizeof(args));
+
+    if (priv->nresources > VIR_LOCK_SPACE_PROTOCOL_RESOURCES_MAX) {
+        virReportError(VIR_ERR_NO_SUPPORT,
+                       _("Too many resources %zu for one request, max %d"),
+                       priv->nresources, VIR_LOCK_SPACE_PROTOCOL_RESOURCES_MAX);
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(args.resources.resources_val, priv->nresources) < 0)
+        return -1;
+    args.resources.resources_len = priv->nresources;
+
+    for (i = 0; i < priv->nresources; i++) {
+        virLockSpaceProtocolResource *res = &args.resources.resources_val[i];
+
+        res->path = (char *)(priv->resources[i].lockspace ?
+                             priv->resources[i].lockspace : "");
+        res->name = priv->resources[i].name;
+        res->flags = priv->resources[i].flags;
+    }
+
+    if (virNetClientProgramCall(program,
+                                client,
+                                (*counter)++,
+                                VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCES,
+                                0, NULL, NULL, NULL,
+                                (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourcesArgs, &args,
+                                (xdrproc_t)xdr_void, NULL) < 0)
+        goto cleanup;
+
+    rv = 0;
+
+ cleanup:
+    VIR_FREE(args.resources.resources_val);
+    return rv;
+}
+
+
+static int
+virLockManagerLockDaemonAcquireEach(virLockManagerLockDaemonPrivatePtr priv,
+                                    virNetClientPtr client,
+                                    virNetClientProgramPtr program,
+                                    int *counter)
+{
+    size_t i;
+
+    for (i = 0; i < priv->nresources; i++) {
+        virLockSpaceProtocolAcquireResourceArgs args;
+
+        memset(&args, 0, sizeof(args));
+
+        if (priv->resources[i].lockspace)
+            args.path = priv->resources[i].lockspace;
+        args.name = priv->resources[i].name;
+        args.flags = priv->resources[i].flags;
+
+        if (virNetClientProgramCall(program,
+                                    client,
+                                    (*counter)++,
+                                    VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCE,
+                                    0, NULL, NULL, NULL,
+                                    (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourceArgs, &args,
+                                    (xdrproc_t)xdr_void, NULL) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
 static int virLockManagerLockDaemonAcquire(virLockManagerPtr lock,
                                            const char *state ATTRIBUTE_UNUSED,
                                            unsigned int flags,
@@ -642,25 +723,21 @@ static int virLockManagerLockDaemonAcquire(virLockManagerPtr lock,
         (*fd = virNetClientDupFD(client, false)) < 0)
         goto cleanup;
 
-    if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY)) {
-        size_t i;
-        for (i = 0; i < priv->nresources; i++) {
-            virLockSpaceProtocolAcquireResourceArgs args;
-
-            memset(&args, 0, sizeof(args));
-
-            if (priv->resources[i].lockspace)
-                args.path = priv->resources[i].lockspace;
-            args.name = priv->resources[i].name;
-            args.flags = priv->resources[i].flags;
-
-            if (virNetClientProgramCall(program,
-                                        client,
-                                        counter++,
-                                        VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCE,
-                                        0, NULL, NULL, NULL,
-                                        (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourceArgs, &args,
-                                        (xdrproc_t)xdr_void, NULL) < 0)
+    if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY) &&
+        priv->nresources > 0) {
+        int rc;
+
+        if ((rc = virLockManagerLockDaemonAcquireAll(priv, client,
+                                                     program, &counter)) < 0) {
+            virErrorPtr err = virGetLastError();
+
+            /* An older virtlockd only knows about single resources */
+            if (!err || err->code != VIR_ERR_NO_SUPPORT)
+                goto cleanup;
+            virResetLastError();
+
+            if (virLockManagerLockDaemonAcquireEach(priv, client,
+                                                    program, &counter) < 0)
                 goto cleanup;
         }
     }
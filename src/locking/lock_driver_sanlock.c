@@ -44,6 +44,7 @@
 #include "virfile.h"
 #include "virconf.h"
 #include "virstring.h"
+#include "virthread.h"
 
 #include "configmake.h"
 
@@ -54,6 +55,9 @@ VIR_LOG_INIT("locking.lock_driver_sanlock");
 #define VIR_LOCK_MANAGER_SANLOCK_AUTO_DISK_LOCKSPACE "__LIBVIRT__DISKS__"
 #define VIR_LOCK_MANAGER_SANLOCK_KILLPATH LIBEXECDIR "/libvirt_sanlock_helper"
 
+/* Maximum number of threads creating automatic disk leases at once */
+#define VIR_LOCK_MANAGER_SANLOCK_CREATE_WORKERS 8
+
 /*
  * temporary fix for the case where the sanlock devel package is
  * too old to provide that define, and probably the functionality too
@@ -92,6 +96,8 @@ struct _virLockManagerSanlockPrivate {
     bool hasRWDisks;
     int res_count;
     struct sanlk_resource *res_args[SANLK_MAX_RESOURCES];
+    /* automatic disk leases which may not have been created yet */
+    bool res_create[SANLK_MAX_RESOURCES];
 
     /* whether the VM was registered or not */
     bool registered;
@@ -780,6 +786,120 @@ virLockManagerSanlockCreateLease(virLockManagerSanlockDriverPtr driver,
 }
 
 
+struct virLockManagerSanlockCreateData {
+    virLockManagerSanlockDriverPtr driver;
+    virLockManagerSanlockPrivatePtr priv;
+
+    virMutex lock;
+    size_t next;
+    bool failed;
+    virErrorPtr err;
+};
+
+
+static void
+virLockManagerSanlockCreateWorker(void *opaque)
+{
+    struct virLockManagerSanlockCreateData *data = opaque;
+    virLockManagerSanlockPrivatePtr priv = data->priv;
+
+    while (true) {
+        size_t i;
+        int rc;
+
+        virMutexLock(&data->lock);
+        while (data->next < priv->res_count &&
+               !priv->res_create[data->next])
+            data->next++;
+        if (data->failed || data->next == priv->res_count) {
+            virMutexUnlock(&data->lock);
+            return;
+        }
+        i = data->next++;
+        virMutexUnlock(&data->lock);
+
+        rc = virLockManagerSanlockCreateLease(data->driver, priv->res_args[i]);
+
+        virMutexLock(&data->lock);
+        if (rc < 0) {
+            if (!data->failed)
+                data->err = virSaveLastError();
+            data->failed = true;
+        } else {
+            priv->res_create[i] = false;
+        }
+        virMutexUnlock(&data->lock);
+    }
+}
+
+
+/*
+ * Make sure all automatic disk leases exist. Creating one means
+ * several round trips to the storage holding it, so for domains
+ * with many disks they're created from a few threads at once.
+ */
+static int
+virLockManagerSanlockCreateLeases(virLockManagerSanlockDriverPtr driver,
+                                  virLockManagerSanlockPrivatePtr priv)
+{
+    struct virLockManagerSanlockCreateData data;
+    virThread workers[VIR_LOCK_MANAGER_SANLOCK_CREATE_WORKERS - 1];
+    size_t nworkers = 0;
+    size_t npending = 0;
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; i < priv->res_count; i++) {
+        if (priv->res_create[i])
+            npending++;
+    }
+
+    if (npending == 0)
+        return 0;
+
+    VIR_DEBUG("Creating up to %zu leases", npending);
+
+    memset(&data, 0, sizeof(data));
+    data.driver = driver;
+    data.priv = priv;
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    /* The calling thread takes its share of the work as well */
+    for (i = 0; i < MIN(npending, VIR_LOCK_MANAGER_SANLOCK_CREATE_WORKERS) - 1; i++) {
+        /* Fewer threads just means less parallelism */
+        if (virThreadCreate(&workers[nworkers], true,
+                            virLockManagerSanlockCreateWorker, &data) < 0)
+            break;
+        nworkers++;
+    }
+
+    virLockManagerSanlockCreateWorker(&data);
+
+    for (i = 0; i < nworkers; i++)
+        virThreadJoin(&workers[i]);
+
+    if (data.failed) {
+        if (data.err)
+            virSetError(data.err);
+        else
+            virReportOOMError();
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virFreeError(data.err);
+    virMutexDestroy(&data.lock);
+    return ret;
+}
+
+
 static int virLockManagerSanlockAddResource(virLockManagerPtr lock,
                                             unsigned int type,
                                             const char *name,
@@ -811,9 +931,10 @@ static int virLockManagerSanlockAddResource(virLockManagerPtr lock,
                                              !!(flags & VIR_LOCK_MANAGER_RESOURCE_SHARED)) < 0)
                 return -1;
 
-            if (virLockManagerSanlockCreateLease(driver,
-                                                 priv->res_args[priv->res_count-1]) < 0)
-                return -1;
+            /* The lease file is only needed once the lock is acquired,
+             * creating them all at that point lets that happen in
+             * parallel, and not at all when releasing */
+            priv->res_create[priv->res_count-1] = true;
         } else {
             if (!(flags & (VIR_LOCK_MANAGER_RESOURCE_SHARED |
                            VIR_LOCK_MANAGER_RESOURCE_READONLY)))
@@ -1030,6 +1151,9 @@ static int virLockManagerSanlockAcquire(virLockManagerPtr lock,
     }
 
     if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY)) {
+        if (virLockManagerSanlockCreateLeases(driver, priv) < 0)
+            goto error;
+
         VIR_DEBUG("Acquiring object %u", priv->res_count);
         if ((rv = sanlock_acquire(sock, priv->vm_pid, 0,
                                   priv->res_count, priv->res_args,
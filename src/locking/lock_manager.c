@@ -156,7 +156,9 @@ virLockManagerPluginPtr virLockManagerPluginNew(const char *name,
             goto cleanup;
         }
 
-        handle = dlopen(modfile, RTLD_NOW | RTLD_LOCAL);
+        /* The logging code keeps pointers to the log sources of the
+         * plugin, so it must stay mapped even once closed */
+        handle = dlopen(modfile, RTLD_NOW | RTLD_LOCAL | RTLD_NODELETE);
         if (!handle) {
             virReportError(VIR_ERR_SYSTEM_ERROR,
                            _("Failed to load plugin %s: %s"),
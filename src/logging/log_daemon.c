@@ -167,6 +167,7 @@ virLogDaemonNew(virLogDaemonConfigPtr config, bool privileged)
     if (!(logd->handler = virLogHandlerNew(privileged,
                                            config->max_size,
                                            config->max_backups,
+                                           config->compress_backups,
                                            virLogDaemonInhibitor,
                                            logd)))
         goto error;
@@ -231,6 +232,7 @@ virLogDaemonNewPostExecRestart(virJSONValuePtr object, bool privileged,
                                                           privileged,
                                                           config->max_size,
                                                           config->max_backups,
+                                                          config->compress_backups,
                                                           virLogDaemonInhibitor,
                                                           logd)))
         goto error;
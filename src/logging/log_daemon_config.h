@@ -37,6 +37,7 @@ struct _virLogDaemonConfig {
 
     size_t max_backups;
     size_t max_size;
+    bool compress_backups;
 };
 
 
@@ -23,6 +23,7 @@
 #include <config.h>
 
 #include "log_handler.h"
+#include "log_protocol.h"
 #include "virerror.h"
 #include "virobject.h"
 #include "virfile.h"
@@ -43,6 +44,18 @@ VIR_LOG_INIT("logging.log_handler");
 
 #define DEFAULT_MODE 0600
 
+/*
+ * Data read from QEMU is collected in a buffer which is written out once
+ * full, or VIR_LOG_HANDLER_FLUSH_DELAY milliseconds after the first read
+ * into it. The buffer doubles up to VIR_LOG_HANDLER_BUF_MAX bytes every
+ * time it fills up and is halved when mostly unused; when even the largest
+ * one fills up the data is spliced into the file directly from the pipe
+ * until QEMU slows down.
+ */
+#define VIR_LOG_HANDLER_BUF_MIN 4096
+#define VIR_LOG_HANDLER_BUF_MAX (64 * 1024)
+#define VIR_LOG_HANDLER_FLUSH_DELAY 250
+
 typedef struct _virLogHandlerLogFile virLogHandlerLogFile;
 typedef virLogHandlerLogFile *virLogHandlerLogFilePtr;
 
@@ -51,6 +64,11 @@ struct _virLogHandlerLogFile {
     int watch;
     int pipefd; /* Read from QEMU via this */
 
+    char *buf; /* Data not written to @file yet, allocated on demand */
+    size_t bufsize;
+    size_t buflen;
+    bool splice;
+
     char *driver;
     unsigned char domuuid[VIR_UUID_BUFLEN];
     char *domname;
@@ -62,10 +80,14 @@ struct _virLogHandler {
     bool privileged;
     size_t max_size;
     size_t max_backups;
+    bool compress_backups;
 
     virLogHandlerLogFilePtr *files;
     size_t nfiles;
 
+    int timer; /* Flushes the buffered data of all files */
+    bool flushScheduled;
+
     virLogHandlerShutdownInhibitor inhibitor;
     void *opaque;
 };
@@ -88,12 +110,35 @@ virLogHandlerOnceInit(void)
 VIR_ONCE_GLOBAL_INIT(virLogHandler)
 
 
+static int
+virLogHandlerLogFileFlush(virLogHandlerLogFilePtr file)
+{
+    size_t len = file->buflen;
+
+    if (!len)
+        return 0;
+
+    file->buflen = 0;
+    if (virRotatingFileWriterAppend(file->file, file->buf, len) != len)
+        return -1;
+
+    if (len <= file->bufsize / 4 && file->bufsize > VIR_LOG_HANDLER_BUF_MIN) {
+        VIR_FREE(file->buf);
+        file->bufsize /= 2;
+    }
+
+    return 0;
+}
+
+
 static void
 virLogHandlerLogFileFree(virLogHandlerLogFilePtr file)
 {
     if (!file)
         return;
 
+    ignore_value(virLogHandlerLogFileFlush(file));
+    VIR_FREE(file->buf);
     VIR_FORCE_CLOSE(file->pipefd);
     virRotatingFileWriterFree(file->file);
 
@@ -122,6 +167,140 @@ virLogHandlerLogFileClose(virLogHandlerPtr handler,
 }
 
 
+static virLogHandlerLogFilePtr
+virLogHandlerGetLogFileFromPath(virLogHandlerPtr handler,
+                                const char *path)
+{
+    size_t i;
+
+    for (i = 0; i < handler->nfiles; i++) {
+        if (STREQ(virRotatingFileWriterGetPath(handler->files[i]->file),
+                  path))
+            return handler->files[i];
+    }
+
+    return NULL;
+}
+
+
+static void
+virLogHandlerFlushTimer(int timer ATTRIBUTE_UNUSED,
+                        void *opaque)
+{
+    virLogHandlerPtr handler = opaque;
+    size_t i;
+
+    virObjectLock(handler);
+
+    virEventUpdateTimeout(handler->timer, -1);
+    handler->flushScheduled = false;
+
+    i = 0;
+    while (i < handler->nfiles) {
+        virLogHandlerLogFilePtr file = handler->files[i];
+
+        if (virLogHandlerLogFileFlush(file) < 0) {
+            handler->inhibitor(false, handler->opaque);
+            virLogHandlerLogFileClose(handler, file);
+            continue;
+        }
+        i++;
+    }
+
+    virObjectUnlock(handler);
+}
+
+
+static void
+virLogHandlerScheduleFlush(virLogHandlerPtr handler,
+                           virLogHandlerLogFilePtr file)
+{
+    if (handler->flushScheduled)
+        return;
+
+    if (handler->timer == -1) {
+        handler->timer = virEventAddTimeout(VIR_LOG_HANDLER_FLUSH_DELAY,
+                                            virLogHandlerFlushTimer,
+                                            handler, NULL);
+        if (handler->timer < 0) {
+            /* Don't keep the data in memory without a way to write it */
+            VIR_WARN("Unable to add log flush timer, not buffering");
+            ignore_value(virLogHandlerLogFileFlush(file));
+            return;
+        }
+    } else {
+        virEventUpdateTimeout(handler->timer, VIR_LOG_HANDLER_FLUSH_DELAY);
+    }
+
+    handler->flushScheduled = true;
+}
+
+
+/*
+ * Move data available in the pipe of @file to the file, either directly
+ * or through the buffer, depending on how much QEMU writes.
+ *
+ * Returns 0 on success, -1 on error
+ */
+static int
+virLogHandlerLogFileRead(virLogHandlerPtr handler,
+                         virLogHandlerLogFilePtr file)
+{
+    ssize_t len;
+
+    if (file->splice && file->buflen == 0 &&
+        virRotatingFileWriterCanSplice(file->file, VIR_LOG_HANDLER_BUF_MAX)) {
+        len = virRotatingFileWriterSplice(file->file, file->pipefd,
+                                          VIR_LOG_HANDLER_BUF_MAX);
+        if (len == -1)
+            return -1;
+
+        if (len >= 0) {
+            if (len < VIR_LOG_HANDLER_BUF_MIN)
+                file->splice = false;
+            return 0;
+        }
+
+        file->splice = false;
+    }
+
+    if (!file->buf && VIR_ALLOC_N(file->buf, file->bufsize) < 0)
+        return -1;
+
+ reread:
+    len = read(file->pipefd, file->buf + file->buflen,
+               file->bufsize - file->buflen);
+    if (len < 0) {
+        if (errno == EINTR)
+            goto reread;
+
+        virReportSystemError(errno, "%s",
+                             _("Unable to read from log pipe"));
+        return -1;
+    }
+
+    file->buflen += len;
+
+    if (file->buflen < file->bufsize) {
+        if (file->buflen)
+            virLogHandlerScheduleFlush(handler, file);
+        return 0;
+    }
+
+    if (virLogHandlerLogFileFlush(file) < 0)
+        return -1;
+
+    if (file->bufsize < VIR_LOG_HANDLER_BUF_MAX) {
+        VIR_FREE(file->buf);
+        file->bufsize *= 2;
+    } else {
+        file->splice = true;
+    }
+
+    return 0;
+}
+
+
 static virLogHandlerLogFilePtr
 virLogHandlerGetLogFileFromWatch(virLogHandlerPtr handler,
                                  int watch)
@@ -145,8 +324,6 @@ virLogHandlerDomainLogFileEvent(int watch,
 {
     virLogHandlerPtr handler = opaque;
     virLogHandlerLogFilePtr logfile;
-    char buf[1024];
-    ssize_t len;
 
     virObjectLock(handler);
     logfile = virLogHandlerGetLogFileFromWatch(handler, watch);
@@ -156,18 +333,7 @@ virLogHandlerDomainLogFileEvent(int watch,
         return;
     }
 
- reread:
-    len = read(fd, buf, sizeof(buf));
-    if (len < 0) {
-        if (errno == EINTR)
-            goto reread;
-
-        virReportSystemError(errno, "%s",
-                             _("Unable to read from log pipe"));
-        goto error;
-    }
-
-    if (virRotatingFileWriterAppend(logfile->file, buf, len) != len)
+    if (virLogHandlerLogFileRead(handler, logfile) < 0)
         goto error;
 
     if (events & VIR_EVENT_HANDLE_HANGUP)
@@ -187,6 +353,7 @@ virLogHandlerPtr
 virLogHandlerNew(bool privileged,
                  size_t max_size,
                  size_t max_backups,
+                 bool compress_backups,
                  virLogHandlerShutdownInhibitor inhibitor,
                  void *opaque)
 {
@@ -198,9 +365,11 @@ virLogHandlerNew(bool privileged,
     if (!(handler = virObjectLockableNew(virLogHandlerClass)))
         goto error;
 
+    handler->timer = -1;
     handler->privileged = privileged;
     handler->max_size = max_size;
     handler->max_backups = max_backups;
+    handler->compress_backups = compress_backups;
     handler->inhibitor = inhibitor;
     handler->opaque = opaque;
 
@@ -223,6 +392,8 @@ virLogHandlerLogFilePostExecRestart(virLogHandlerPtr handler,
     if (VIR_ALLOC(file) < 0)
         return NULL;
 
+    file->bufsize = VIR_LOG_HANDLER_BUF_MIN;
+
     handler->inhibitor(true, handler->opaque);
 
     if ((path = virJSONValueObjectGetString(object, "path")) == NULL) {
@@ -264,6 +435,7 @@ virLogHandlerLogFilePostExecRestart(virLogHandlerPtr handler,
                                                false,
                                                DEFAULT_MODE)) == NULL)
         goto error;
+    virRotatingFileWriterSetCompress(file->file, handler->compress_backups);
 
     if (virJSONValueObjectGetNumberInt(object, "pipefd", &file->pipefd) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -290,6 +462,7 @@ virLogHandlerNewPostExecRestart(virJSONValuePtr object,
                                 bool privileged,
                                 size_t max_size,
                                 size_t max_backups,
+                                bool compress_backups,
                                 virLogHandlerShutdownInhibitor inhibitor,
                                 void *opaque)
 {
@@ -301,6 +474,7 @@ virLogHandlerNewPostExecRestart(virJSONValuePtr object,
     if (!(handler = virLogHandlerNew(privileged,
                                      max_size,
                                      max_backups,
+                                     compress_backups,
                                      inhibitor,
                                      opaque)))
         return NULL;
@@ -357,6 +531,9 @@ virLogHandlerDispose(void *obj)
         virLogHandlerLogFileFree(handler->files[i]);
     }
     VIR_FREE(handler->files);
+
+    if (handler->timer != -1)
+        virEventRemoveTimeout(handler->timer);
 }
 
 
@@ -397,6 +574,7 @@ virLogHandlerDomainOpenLogFile(virLogHandlerPtr handler,
         goto error;
 
     file->watch = -1;
+    file->bufsize = VIR_LOG_HANDLER_BUF_MIN;
     file->pipefd = pipefd[0];
     pipefd[0] = -1;
     memcpy(file->domuuid, domuuid, VIR_UUID_BUFLEN);
@@ -410,6 +588,7 @@ virLogHandlerDomainOpenLogFile(virLogHandlerPtr handler,
                                                trunc,
                                                DEFAULT_MODE)) == NULL)
         goto error;
+    virRotatingFileWriterSetCompress(file->file, handler->compress_backups);
 
     if (VIR_APPEND_ELEMENT_COPY(handler->files, handler->nfiles, file) < 0)
         goto error;
@@ -448,27 +627,21 @@ virLogHandlerDomainGetLogFilePosition(virLogHandlerPtr handler,
 {
     virLogHandlerLogFilePtr file = NULL;
     int ret = -1;
-    size_t i;
 
     virCheckFlags(0, -1);
 
     virObjectLock(handler);
 
-    for (i = 0; i < handler->nfiles; i++) {
-        if (STREQ(virRotatingFileWriterGetPath(handler->files[i]->file),
-                  path)) {
-            file = handler->files[i];
-            break;
-        }
-    }
-
-    if (!file) {
+    if (!(file = virLogHandlerGetLogFileFromPath(handler, path))) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("No open log file %s"),
                        path);
         goto cleanup;
     }
 
+    if (virLogHandlerLogFileFlush(file) < 0)
+        goto cleanup;
+
     *inode = virRotatingFileWriterGetINode(file->file);
     *offset = virRotatingFileWriterGetOffset(file->file);
 
@@ -489,19 +662,29 @@ virLogHandlerDomainReadLogFile(virLogHandlerPtr handler,
                                unsigned int flags)
 {
     virRotatingFileReaderPtr file = NULL;
+    virLogHandlerLogFilePtr logfile;
     char *data = NULL;
     ssize_t got;
 
-    virCheckFlags(0, NULL);
+    virCheckFlags(VIR_LOG_MANAGER_PROTOCOL_DOMAIN_READ_LOG_FILE_TAIL, NULL);
 
     virObjectLock(handler);
 
-    if (!(file = virRotatingFileReaderNew(path, handler->max_backups)))
+    if ((logfile = virLogHandlerGetLogFileFromPath(handler, path)) &&
+        virLogHandlerLogFileFlush(logfile) < 0)
         goto error;
 
-    if (virRotatingFileReaderSeek(file, inode, offset) < 0)
+    if (!(file = virRotatingFileReaderNew(path, handler->max_backups)))
         goto error;
 
+    if (flags & VIR_LOG_MANAGER_PROTOCOL_DOMAIN_READ_LOG_FILE_TAIL) {
+        if (virRotatingFileReaderSeekTail(file, maxlen) < 0)
+            goto error;
+    } else {
+        if (virRotatingFileReaderSeek(file, inode, offset) < 0)
+            goto error;
+    }
+
     if (VIR_ALLOC_N(data, maxlen + 1) < 0)
         goto error;
 
@@ -531,7 +714,7 @@ virLogHandlerDomainAppendLogFile(virLogHandlerPtr handler,
                                  const char *message,
                                  unsigned int flags)
 {
-    size_t i;
+    virLogHandlerLogFilePtr logfile;
     virRotatingFileWriterPtr writer = NULL;
     virRotatingFileWriterPtr newwriter = NULL;
     int ret = -1;
@@ -542,20 +725,20 @@ virLogHandlerDomainAppendLogFile(virLogHandlerPtr handler,
 
     virObjectLock(handler);
 
-    for (i = 0; i < handler->nfiles; i++) {
-        if (STREQ(virRotatingFileWriterGetPath(handler->files[i]->file), path)) {
-            writer = handler->files[i]->file;
-            break;
-        }
-    }
-
-    if (!writer) {
+    if ((logfile = virLogHandlerGetLogFileFromPath(handler, path))) {
+        /* Keep the message after whatever QEMU wrote before */
+        if (virLogHandlerLogFileFlush(logfile) < 0)
+            goto cleanup;
+        writer = logfile->file;
+    } else {
         if (!(newwriter = virRotatingFileWriterNew(path,
                                                    handler->max_size,
                                                    handler->max_backups,
                                                    false,
                                                    DEFAULT_MODE)))
             goto cleanup;
+        virRotatingFileWriterSetCompress(newwriter,
+                                         handler->compress_backups);
 
         writer = newwriter;
     }
@@ -592,8 +775,12 @@ virLogHandlerPreExecRestart(virLogHandlerPtr handler)
     }
 
     for (i = 0; i < handler->nfiles; i++) {
-        virJSONValuePtr file = virJSONValueNewObject();
-        if (!file)
+        virJSONValuePtr file;
+
+        if (virLogHandlerLogFileFlush(handler->files[i]) < 0)
+            goto error;
+
+        if (!(file = virJSONValueNewObject()))
             goto error;
 
         if (virJSONValueArrayAppend(files, file) < 0) {
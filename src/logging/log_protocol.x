@@ -57,6 +57,11 @@ struct virLogManagerProtocolDomainGetLogFilePositionRet {
     virLogManagerProtocolLogFilePosition pos;
 };
 
+enum virLogManagerProtocolDomainReadLogFileFlags {
+    /* Read the last maxlen bytes of the log, ignoring the position */
+    VIR_LOG_MANAGER_PROTOCOL_DOMAIN_READ_LOG_FILE_TAIL = 1
+};
+
 struct virLogManagerProtocolDomainReadLogFileArgs {
     virLogManagerProtocolNonNullString path;
     virLogManagerProtocolLogFilePosition pos;
@@ -509,6 +509,7 @@ virCgroupPtr virLXCCgroupCreate(virDomainDefPtr def,
                             nnicindexes, nicindexes,
                             def->resource->partition,
                             -1,
+                            NULL,
                             &cgroup) < 0)
         goto cleanup;
 
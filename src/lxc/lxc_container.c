@@ -59,6 +59,7 @@
 #include "virerror.h"
 #include "virlog.h"
 #include "lxc_container.h"
+#include "lxc_fuse.h"
 #include "viralloc.h"
 #include "virnetdevveth.h"
 #include "viruuid.h"
@@ -1011,25 +1012,40 @@ static int lxcContainerMountBasicFS(bool userns_enabled,
 static int lxcContainerMountProcFuse(virDomainDefPtr def,
                                      const char *stateDir)
 {
-    int ret;
-    char *meminfo_path = NULL;
+    int ret = -1;
+    size_t i;
+    char *src = NULL;
+    char *dst = NULL;
 
-    VIR_DEBUG("Mount /proc/meminfo stateDir=%s", stateDir);
+    VIR_DEBUG("Mount emulated /proc files stateDir=%s", stateDir);
 
-    if ((ret = virAsprintf(&meminfo_path,
-                           "/.oldroot/%s/%s.fuse/meminfo",
-                           stateDir,
-                           def->name)) < 0)
-        return ret;
+    for (i = 0; i < VIR_LXC_FUSE_FILE_LAST; i++) {
+        const char *name = virLXCFuseFileTypeToString(i);
 
-    if ((ret = mount(meminfo_path, "/proc/meminfo",
-                     NULL, MS_BIND, NULL)) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to mount %s on /proc/meminfo"),
-                             meminfo_path);
+        if (virAsprintf(&src, "/.oldroot/%s/%s.fuse/%s",
+                        stateDir, def->name, name) < 0 ||
+            virAsprintf(&dst, "/proc/%s", name) < 0)
+            goto cleanup;
+
+        /* Not every kernel provides all of them */
+        if (!virFileExists(dst)) {
+            VIR_DEBUG("Skipping %s which the host lacks", dst);
+        } else if (mount(src, dst, NULL, MS_BIND, NULL) < 0) {
+            virReportSystemError(errno,
+                                 _("Failed to mount %s on %s"),
+                                 src, dst);
+            goto cleanup;
+        }
+
+        VIR_FREE(src);
+        VIR_FREE(dst);
     }
 
-    VIR_FREE(meminfo_path);
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(src);
+    VIR_FREE(dst);
     return ret;
 }
 #else
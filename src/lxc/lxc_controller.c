@@ -102,6 +102,12 @@ struct _virLXCControllerConsole {
     virNetDaemonPtr daemon;
 };
 
+typedef struct _virLXCControllerPhase virLXCControllerPhase;
+struct _virLXCControllerPhase {
+    const char *name;
+    unsigned long long duration; /* in microseconds */
+};
+
 typedef struct _virLXCController virLXCController;
 typedef virLXCController *virLXCControllerPtr;
 struct _virLXCController {
@@ -146,6 +152,23 @@ struct _virLXCController {
     virCgroupPtr cgroup;
 
     virLXCFusePtr fuse;
+
+    /* How long the steps of starting the container took */
+    unsigned long long phaseStart;
+    size_t nphases;
+    virLXCControllerPhase phases[VIR_LXC_MONITOR_STARTUP_PHASES_MAX];
+};
+
+/* Creating the cgroup, which runs in parallel to other setup steps */
+typedef struct _virLXCControllerCgroupJob virLXCControllerCgroupJob;
+typedef virLXCControllerCgroupJob *virLXCControllerCgroupJobPtr;
+struct _virLXCControllerCgroupJob {
+    virLXCControllerPtr ctrl;
+    virThread thread;
+    bool running;
+    int ret;
+    virErrorPtr err;
+    unsigned long long duration;
 };
 
 #include "lxc_controller_dispatch.h"
@@ -153,6 +176,7 @@ struct _virLXCController {
 static void virLXCControllerFree(virLXCControllerPtr ctrl);
 static int virLXCControllerEventSendInit(virLXCControllerPtr ctrl,
                                          pid_t initpid);
+static int virLXCControllerEventSendStartup(virLXCControllerPtr ctrl);
 
 static void virLXCControllerQuitTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 {
@@ -888,6 +912,106 @@ static int virLXCControllerSetupCgroupLimits(virLXCControllerPtr ctrl)
 }
 
 
+static unsigned long long
+virLXCControllerClock(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+static void
+virLXCControllerPhaseAdd(virLXCControllerPtr ctrl,
+                         const char *name,
+                         unsigned long long duration)
+{
+    VIR_DEBUG("Startup phase %s took %lluus", name, duration);
+
+    if (ctrl->nphases < ARRAY_CARDINALITY(ctrl->phases)) {
+        ctrl->phases[ctrl->nphases].name = name;
+        ctrl->phases[ctrl->nphases].duration = duration;
+        ctrl->nphases++;
+    }
+}
+
+
+/* Accounts the time since the previous phase ended to phase @name */
+static void
+virLXCControllerPhaseDone(virLXCControllerPtr ctrl,
+                          const char *name)
+{
+    unsigned long long now = virLXCControllerClock();
+
+    virLXCControllerPhaseAdd(ctrl, name, now - ctrl->phaseStart);
+    ctrl->phaseStart = now;
+}
+
+
+static void
+virLXCControllerCgroupJobRun(void *opaque)
+{
+    virLXCControllerCgroupJobPtr job = opaque;
+    unsigned long long start = virLXCControllerClock();
+
+    if ((job->ret = virLXCControllerSetupCgroupLimits(job->ctrl)) < 0)
+        job->err = virSaveLastError();
+
+    job->duration = virLXCControllerClock() - start;
+}
+
+
+/*
+ * Creating the cgroup, which may mean a round trip to machined, does
+ * not depend on the ID mapping or the interfaces of the container,
+ * so it is done in a thread of its own while those get set up
+ */
+static int
+virLXCControllerCgroupJobStart(virLXCControllerPtr ctrl,
+                               virLXCControllerCgroupJobPtr job)
+{
+    memset(job, 0, sizeof(*job));
+    job->ctrl = ctrl;
+
+    if (virThreadCreate(&job->thread, true,
+                        virLXCControllerCgroupJobRun, job) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create cgroup setup thread"));
+        return -1;
+    }
+
+    job->running = true;
+    return 0;
+}
+
+
+static int
+virLXCControllerCgroupJobWait(virLXCControllerPtr ctrl,
+                              virLXCControllerCgroupJobPtr job)
+{
+    if (!job->running)
+        return 0;
+
+    virThreadJoin(&job->thread);
+    job->running = false;
+
+    virLXCControllerPhaseAdd(ctrl, "cgroup", job->duration);
+    virLXCControllerPhaseDone(ctrl, "cgroup-wait");
+
+    if (job->ret < 0) {
+        virSetError(job->err);
+        virFreeError(job->err);
+        job->err = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static void virLXCControllerClientCloseHook(virNetServerClientPtr client)
 {
     virLXCControllerPtr ctrl = virNetServerClientGetPrivateData(client);
@@ -916,8 +1040,14 @@ static void *virLXCControllerClientPrivateNew(virNetServerClientPtr client,
     VIR_DEBUG("Got new client %p", client);
     ctrl->client = client;
 
-    if (ctrl->initpid && ctrl->firstClient)
+    if (ctrl->initpid && ctrl->firstClient) {
         virLXCControllerEventSendInit(ctrl, ctrl->initpid);
+        if (virLXCControllerEventSendStartup(ctrl) < 0) {
+            VIR_WARN("Unable to report startup timing: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
+        }
+    }
     ctrl->firstClient = false;
 
     return ctrl;
@@ -2312,6 +2442,35 @@ virLXCControllerEventSendInit(virLXCControllerPtr ctrl,
 }
 
 
+static int
+virLXCControllerEventSendStartup(virLXCControllerPtr ctrl)
+{
+    virLXCMonitorStartupEventMsg msg;
+    size_t i;
+
+    memset(&msg, 0, sizeof(msg));
+    if (VIR_ALLOC_N(msg.phases.phases_val, ctrl->nphases) < 0)
+        return -1;
+    msg.phases.phases_len = ctrl->nphases;
+
+    for (i = 0; i < ctrl->nphases; i++) {
+        if (VIR_STRDUP(msg.phases.phases_val[i].name,
+                       ctrl->phases[i].name) < 0) {
+            xdr_free((xdrproc_t)xdr_virLXCMonitorStartupEventMsg,
+                     (char *)&msg);
+            return -1;
+        }
+        msg.phases.phases_val[i].duration = ctrl->phases[i].duration;
+    }
+
+    virLXCControllerEventSend(ctrl,
+                              VIR_LXC_MONITOR_PROC_STARTUP_EVENT,
+                              (xdrproc_t)xdr_virLXCMonitorStartupEventMsg,
+                              (void*)&msg);
+    return 0;
+}
+
+
 static int
 virLXCControllerRun(virLXCControllerPtr ctrl)
 {
@@ -2319,8 +2478,11 @@ virLXCControllerRun(virLXCControllerPtr ctrl)
     int control[2] = { -1, -1};
     int containerhandshake[2] = { -1, -1 };
     char **containerTTYPaths = NULL;
+    virLXCControllerCgroupJob cgroupJob = { .running = false };
     size_t i;
 
+    ctrl->phaseStart = virLXCControllerClock();
+
     if (VIR_ALLOC_N(containerTTYPaths, ctrl->nconsoles) < 0)
         goto cleanup;
 
@@ -2341,21 +2503,26 @@ virLXCControllerRun(virLXCControllerPtr ctrl)
 
     if (virLXCControllerSetupLoopDevices(ctrl) < 0)
         goto cleanup;
+    virLXCControllerPhaseDone(ctrl, "loop-devices");
 
     if (virLXCControllerSetupResourceLimits(ctrl) < 0)
         goto cleanup;
+    virLXCControllerPhaseDone(ctrl, "resource-limits");
 
     if (virLXCControllerSetupDevPTS(ctrl) < 0)
         goto cleanup;
 
     if (virLXCControllerPopulateDevices(ctrl) < 0)
         goto cleanup;
+    virLXCControllerPhaseDone(ctrl, "devices");
 
     if (virLXCControllerSetupAllDisks(ctrl) < 0)
         goto cleanup;
+    virLXCControllerPhaseDone(ctrl, "disks");
 
     if (virLXCControllerSetupAllHostdevs(ctrl) < 0)
         goto cleanup;
+    virLXCControllerPhaseDone(ctrl, "hostdevs");
 
     if (virLXCControllerSetupFuse(ctrl) < 0)
         goto cleanup;
@@ -2365,6 +2532,7 @@ virLXCControllerRun(virLXCControllerPtr ctrl)
 
     if (lxcSetPersonality(ctrl->def) < 0)
         goto cleanup;
+    virLXCControllerPhaseDone(ctrl, "fuse-consoles");
 
     if ((ctrl->initpid = lxcContainerStart(ctrl->def,
                                            ctrl->securityManager,
@@ -2380,6 +2548,7 @@ virLXCControllerRun(virLXCControllerPtr ctrl)
         goto cleanup;
     VIR_FORCE_CLOSE(control[1]);
     VIR_FORCE_CLOSE(containerhandshake[1]);
+    virLXCControllerPhaseDone(ctrl, "clone");
 
     for (i = 0; i < ctrl->npassFDs; i++)
         VIR_FORCE_CLOSE(ctrl->passFDs[i]);
@@ -2388,14 +2557,19 @@ virLXCControllerRun(virLXCControllerPtr ctrl)
         for (i = 0; i < VIR_LXC_DOMAIN_NAMESPACE_LAST; i++)
             VIR_FORCE_CLOSE(ctrl->nsFDs[i]);
 
-    if (virLXCControllerSetupCgroupLimits(ctrl) < 0)
+    if (virLXCControllerCgroupJobStart(ctrl, &cgroupJob) < 0)
         goto cleanup;
 
     if (virLXCControllerSetupUserns(ctrl) < 0)
         goto cleanup;
+    virLXCControllerPhaseDone(ctrl, "userns");
 
     if (virLXCControllerMoveInterfaces(ctrl) < 0)
         goto cleanup;
+    virLXCControllerPhaseDone(ctrl, "interfaces");
+
+    if (virLXCControllerCgroupJobWait(ctrl, &cgroupJob) < 0)
+        goto cleanup;
 
     if (virLXCControllerStartFuse(ctrl) < 0)
         goto cleanup;
@@ -2411,6 +2585,7 @@ virLXCControllerRun(virLXCControllerPtr ctrl)
                              _("error receiving signal from container"));
         goto cleanup;
     }
+    virLXCControllerPhaseDone(ctrl, "container");
 
     /* ...and reduce our privileges */
     if (lxcControllerClearCapabilities() < 0)
@@ -2434,6 +2609,10 @@ virLXCControllerRun(virLXCControllerPtr ctrl)
     virLXCControllerEventSendExit(ctrl, rc);
 
  cleanup:
+    if (cgroupJob.running) {
+        virThreadJoin(&cgroupJob.thread);
+        virFreeError(cgroupJob.err);
+    }
     VIR_FORCE_CLOSE(control[0]);
     VIR_FORCE_CLOSE(control[1]);
     VIR_FORCE_CLOSE(containerhandshake[0]);
@@ -36,12 +36,39 @@
 #include "virfile.h"
 #include "virbuffer.h"
 #include "virstring.h"
+#include "virtime.h"
+#include "c-ctype.h"
 
 #define VIR_FROM_THIS VIR_FROM_LXC
 
+VIR_ENUM_IMPL(virLXCFuseFile, VIR_LXC_FUSE_FILE_LAST,
+              "meminfo",
+              "stat",
+              "cpuinfo",
+              "uptime")
+
 #if WITH_FUSE
 
-static const char *fuse_meminfo_path = "/meminfo";
+/* Tools like top or free poll these files, so their rendered content
+ * is reused for a while instead of going to cgroupfs and the host
+ * /proc on every read */
+# define LXC_FUSE_CACHE_TTL 1000
+
+/* What one open file handle of an emulated file reads */
+typedef struct _lxcProcFile lxcProcFile;
+typedef lxcProcFile *lxcProcFilePtr;
+struct _lxcProcFile {
+    char *content;
+    size_t len;
+};
+
+static int lxcProcLookup(const char *path)
+{
+    if (path[0] != '/')
+        return -1;
+
+    return virLXCFuseFileTypeFromString(path + 1);
+}
 
 static int lxcProcGetattr(const char *path, struct stat *stbuf)
 {
@@ -49,7 +76,8 @@ static int lxcProcGetattr(const char *path, struct stat *stbuf)
     char *mempath = NULL;
     struct stat sb;
     struct fuse_context *context = fuse_get_context();
-    virDomainDefPtr def = (virDomainDefPtr)context->private_data;
+    virLXCFusePtr fuse = context->private_data;
+    virDomainDefPtr def = fuse->def;
 
     memset(stbuf, 0, sizeof(struct stat));
     if (virAsprintf(&mempath, "/proc/%s", path) < 0)
@@ -60,7 +88,7 @@ static int lxcProcGetattr(const char *path, struct stat *stbuf)
     if (STREQ(path, "/")) {
         stbuf->st_mode = S_IFDIR | 0755;
         stbuf->st_nlink = 2;
-    } else if (STREQ(path, fuse_meminfo_path)) {
+    } else if (lxcProcLookup(path) >= 0) {
         if (stat(mempath, &sb) < 0) {
             res = -errno;
             goto cleanup;
@@ -90,24 +118,15 @@ static int lxcProcReaddir(const char *path, void *buf,
                           off_t offset ATTRIBUTE_UNUSED,
                           struct fuse_file_info *fi ATTRIBUTE_UNUSED)
 {
+    size_t i;
+
     if (STRNEQ(path, "/"))
         return -ENOENT;
 
     filler(buf, ".", NULL, 0);
     filler(buf, "..", NULL, 0);
-    filler(buf, fuse_meminfo_path + 1, NULL, 0);
-
-    return 0;
-}
-
-static int lxcProcOpen(const char *path ATTRIBUTE_UNUSED,
-                       struct fuse_file_info *fi ATTRIBUTE_UNUSED)
-{
-    if (STRNEQ(path, fuse_meminfo_path))
-        return -ENOENT;
-
-    if ((fi->flags & 3) != O_RDONLY)
-        return -EACCES;
+    for (i = 0; i < VIR_LXC_FUSE_FILE_LAST; i++)
+        filler(buf, virLXCFuseFileTypeToString(i), NULL, 0);
 
     return 0;
 }
@@ -128,36 +147,24 @@ static int lxcProcHostRead(char *path, char *buf, size_t size, off_t offset)
     return res;
 }
 
-static int lxcProcReadMeminfo(char *hostpath, virDomainDefPtr def,
-                              char *buf, size_t size, off_t offset)
+static int lxcProcRenderMeminfo(virDomainDefPtr def,
+                                virBufferPtr new_meminfo)
 {
-    int res;
+    int res = -1;
     FILE *fd = NULL;
     char *line = NULL;
     size_t n;
     struct virLXCMeminfo meminfo;
-    virBuffer buffer = VIR_BUFFER_INITIALIZER;
-    virBufferPtr new_meminfo = &buffer;
 
-    if (virLXCCgroupGetMeminfo(&meminfo) < 0) {
-        virErrorSetErrnoFromLastError();
-        return -errno;
-    }
+    if (virLXCCgroupGetMeminfo(&meminfo) < 0)
+        return -1;
 
-    fd = fopen(hostpath, "r");
+    fd = fopen("/proc/meminfo", "r");
     if (fd == NULL) {
-        virReportSystemError(errno, _("Cannot open %s"), hostpath);
-        res = -errno;
+        virReportSystemError(errno, "%s", _("Cannot open /proc/meminfo"));
         goto cleanup;
     }
 
-    if (fseek(fd, offset, SEEK_SET) < 0) {
-        virReportSystemError(errno, "%s", _("fseek failed"));
-        res = -errno;
-        goto cleanup;
-    }
-
-    res = -1;
     while (getline(&line, &n, fd) > 0) {
         char *ptr = strchr(line, ':');
         if (!ptr)
@@ -228,54 +235,348 @@ static int lxcProcReadMeminfo(char *hostpath, virDomainDefPtr def,
             virBufferAdd(new_meminfo, line, -1);
         }
 
-        if (virBufferCheckError(new_meminfo) < 0) {
-            res = -errno;
+        if (virBufferCheckError(new_meminfo) < 0)
             goto cleanup;
-        }
     }
-    res = strlen(virBufferCurrentContent(new_meminfo));
-    if (res > size)
-        res = size;
-    memcpy(buf, virBufferCurrentContent(new_meminfo), res);
+    res = 0;
 
  cleanup:
     VIR_FREE(line);
-    virBufferFreeAndReset(new_meminfo);
     VIR_FORCE_FCLOSE(fd);
     return res;
 }
 
-static int lxcProcRead(const char *path ATTRIBUTE_UNUSED,
-                       char *buf ATTRIBUTE_UNUSED,
-                       size_t size ATTRIBUTE_UNUSED,
-                       off_t offset ATTRIBUTE_UNUSED,
-                       struct fuse_file_info *fi ATTRIBUTE_UNUSED)
+/* Host CPUs the container may run on and, if @usage is not NULL, the
+ * CPU time it consumed so far in nanoseconds */
+static int lxcProcGetCpus(virBitmapPtr *cpus, unsigned long long *usage)
 {
-    int res = -ENOENT;
+    int ret = -1;
+    virCgroupPtr cgroup = NULL;
+    char *str = NULL;
+
+    *cpus = NULL;
+
+    if (virCgroupNewSelf(&cgroup) < 0)
+        return -1;
+
+    if (virCgroupGetCpusetCpus(cgroup, &str) < 0 ||
+        virBitmapParse(str, cpus, VIR_DOMAIN_CPUMASK_LEN) < 0)
+        goto cleanup;
+
+    if (usage && virCgroupGetCpuacctUsage(cgroup, usage) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        virBitmapFree(*cpus);
+        *cpus = NULL;
+    }
+    VIR_FREE(str);
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+/* Parses "cpu<N>" at the start of a /proc/stat line */
+static int lxcProcStatCpu(const char *line, unsigned int *cpu, char **fields)
+{
+    if (!STRPREFIX(line, "cpu") || !c_isdigit(line[3]))
+        return -1;
+
+    return virStrToLong_ui(line + 3, fields, 10, cpu);
+}
+
+static int lxcProcRenderStat(virBufferPtr buf)
+{
+    int ret = -1;
+    virBitmapPtr cpus = NULL;
+    char *content = NULL;
+    char **lines = NULL;
+    virBuffer percpu = VIR_BUFFER_INITIALIZER;
+    unsigned long long total[10] = { 0 };
+    size_t ntotal = 0;
+    unsigned int ncpus = 0;
+    size_t i, j;
+
+    if (lxcProcGetCpus(&cpus, NULL) < 0)
+        return -1;
+
+    if (virFileReadAll("/proc/stat", 1024 * 1024, &content) < 0 ||
+        !(lines = virStringSplit(content, "\n", 0)))
+        goto cleanup;
+
+    /* Only the CPUs of the cpuset are listed, renumbered from 0, and
+     * the summary line adds them up */
+    for (i = 0; lines[i]; i++) {
+        unsigned int cpu;
+        char *fields;
+
+        if (lxcProcStatCpu(lines[i], &cpu, &fields) < 0 ||
+            !virBitmapIsBitSet(cpus, cpu))
+            continue;
+
+        virBufferAsprintf(&percpu, "cpu%u%s\n", ncpus++, fields);
+
+        for (j = 0; j < ARRAY_CARDINALITY(total); j++) {
+            unsigned long long val;
+
+            if (virStrToLong_ull(fields, &fields, 10, &val) < 0)
+                break;
+            total[j] += val;
+        }
+        ntotal = MAX(ntotal, j);
+    }
+
+    if (!ncpus || virBufferCheckError(&percpu) < 0)
+        goto cleanup;
+
+    for (i = 0; lines[i]; i++) {
+        unsigned int cpu;
+        char *fields;
+
+        if (!*lines[i] || lxcProcStatCpu(lines[i], &cpu, &fields) == 0)
+            continue;
+
+        if (STRPREFIX(lines[i], "cpu ")) {
+            virBufferAddLit(buf, "cpu ");
+            for (j = 0; j < ntotal; j++)
+                virBufferAsprintf(buf, " %llu", total[j]);
+            virBufferAddChar(buf, '\n');
+            virBufferAdd(buf, virBufferCurrentContent(&percpu), -1);
+        } else {
+            virBufferAsprintf(buf, "%s\n", lines[i]);
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&percpu);
+    virStringListFree(lines);
+    VIR_FREE(content);
+    virBitmapFree(cpus);
+    return ret;
+}
+
+static int lxcProcRenderCpuinfo(virBufferPtr buf)
+{
+    int ret = -1;
+    virBitmapPtr cpus = NULL;
+    char *content = NULL;
+    char **blocks = NULL;
+    unsigned int ncpus = 0;
+    size_t i;
+
+    if (lxcProcGetCpus(&cpus, NULL) < 0)
+        return -1;
+
+    if (virFileReadAll("/proc/cpuinfo", 16 * 1024 * 1024, &content) < 0 ||
+        !(blocks = virStringSplit(content, "\n\n", 0)))
+        goto cleanup;
+
+    /* Every CPU is described by a block starting with its number; the
+     * ones outside the cpuset are dropped and the rest renumbered.
+     * Blocks which describe something else are kept as they are. */
+    for (i = 0; blocks[i]; i++) {
+        unsigned int cpu;
+        char *rest;
+
+        if (!*blocks[i])
+            continue;
+        virStringTrimOptionalNewline(blocks[i]);
+
+        if (!STRPREFIX(blocks[i], "processor") ||
+            !(rest = strchr(blocks[i], ':')) ||
+            virStrToLong_ui(rest + 1, &rest, 10, &cpu) < 0) {
+            virBufferAsprintf(buf, "%s\n\n", blocks[i]);
+            continue;
+        }
+
+        if (!virBitmapIsBitSet(cpus, cpu))
+            continue;
+
+        virBufferAsprintf(buf, "processor\t: %u%s\n\n", ncpus++, rest);
+    }
+
+    /* Leave architectures with a different layout to the host file */
+    if (!ncpus)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virStringListFree(blocks);
+    VIR_FREE(content);
+    virBitmapFree(cpus);
+    return ret;
+}
+
+static int lxcProcRenderUptime(virLXCFusePtr fuse, virBufferPtr buf)
+{
+    virBitmapPtr cpus = NULL;
+    unsigned long long now;
+    unsigned long long uptime;
+    unsigned long long usage = 0;
+    unsigned long long idle = 0;
+    unsigned long long ncpus = 1;
+
+    if (!fuse->started || virTimeMillisNow(&now) < 0)
+        return -1;
+
+    uptime = now > fuse->started ? now - fuse->started : 0;
+
+    /* The CPUs are shared with the host, so idle is merely the time
+     * the container's CPUs did not spend running the container */
+    if (lxcProcGetCpus(&cpus, &usage) == 0)
+        ncpus = virBitmapCountBits(cpus);
+    else
+        virResetLastError();
+    virBitmapFree(cpus);
+
+    usage /= 1000 * 1000;
+    if (uptime * ncpus > usage)
+        idle = uptime * ncpus - usage;
+
+    virBufferAsprintf(buf, "%llu.%02llu %llu.%02llu\n",
+                      uptime / 1000, (uptime % 1000) / 10,
+                      idle / 1000, (idle % 1000) / 10);
+    return 0;
+}
+
+static int lxcProcRender(virLXCFusePtr fuse, int type, virBufferPtr buf)
+{
+    switch ((virLXCFuseFile) type) {
+    case VIR_LXC_FUSE_FILE_MEMINFO:
+        return lxcProcRenderMeminfo(fuse->def, buf);
+    case VIR_LXC_FUSE_FILE_STAT:
+        return lxcProcRenderStat(buf);
+    case VIR_LXC_FUSE_FILE_CPUINFO:
+        return lxcProcRenderCpuinfo(buf);
+    case VIR_LXC_FUSE_FILE_UPTIME:
+        return lxcProcRenderUptime(fuse, buf);
+    case VIR_LXC_FUSE_FILE_LAST:
+        break;
+    }
+
+    return -1;
+}
+
+/* Returns a copy of the content of @type, rendering it again once the
+ * cached one is older than LXC_FUSE_CACHE_TTL */
+static int lxcProcGetContent(virLXCFusePtr fuse, int type,
+                             char **content, size_t *len)
+{
+    int ret = -1;
+    struct virLXCFuseCache *cache = &fuse->cache[type];
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    virMutexLock(&fuse->cacheLock);
+
+    if (!cache->content || now < cache->stamp ||
+        now - cache->stamp >= LXC_FUSE_CACHE_TTL) {
+        if (lxcProcRender(fuse, type, &buf) < 0 ||
+            virBufferCheckError(&buf) < 0)
+            goto cleanup;
+
+        VIR_FREE(cache->content);
+        cache->len = virBufferUse(&buf);
+        cache->content = virBufferContentAndReset(&buf);
+        cache->stamp = now;
+    }
+
+    if (VIR_STRDUP(*content, cache->content) < 0)
+        goto cleanup;
+    *len = cache->len;
+
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&fuse->cacheLock);
+    virBufferFreeAndReset(&buf);
+    return ret;
+}
+
+static int lxcProcOpen(const char *path,
+                       struct fuse_file_info *fi)
+{
+    struct fuse_context *context = fuse_get_context();
+    virLXCFusePtr fuse = context->private_data;
+    lxcProcFilePtr file = NULL;
+    int type;
+
+    if ((type = lxcProcLookup(path)) < 0)
+        return -ENOENT;
+
+    if ((fi->flags & 3) != O_RDONLY)
+        return -EACCES;
+
+    /* The handle keeps its own copy so that reading it in pieces gives
+     * consistent content even when the cache is refreshed meanwhile.
+     * If the content cannot be rendered, the host file is read. */
+    if (VIR_ALLOC(file) < 0)
+        return -ENOMEM;
+
+    if (lxcProcGetContent(fuse, type, &file->content, &file->len) < 0) {
+        virResetLastError();
+        VIR_FREE(file);
+    }
+
+    fi->fh = (uintptr_t) file;
+    return 0;
+}
+
+static int lxcProcRead(const char *path,
+                       char *buf,
+                       size_t size,
+                       off_t offset,
+                       struct fuse_file_info *fi)
+{
+    int res;
     char *hostpath = NULL;
-    struct fuse_context *context = NULL;
-    virDomainDefPtr def = NULL;
+    lxcProcFilePtr file = (lxcProcFilePtr) (uintptr_t) fi->fh;
+
+    if (file) {
+        if (offset < 0 || (size_t) offset >= file->len)
+            return 0;
+
+        size = MIN(size, file->len - offset);
+        memcpy(buf, file->content + offset, size);
+        return size;
+    }
 
     if (virAsprintf(&hostpath, "/proc/%s", path) < 0)
         return -errno;
 
-    context = fuse_get_context();
-    def = (virDomainDefPtr)context->private_data;
-
-    if (STREQ(path, fuse_meminfo_path)) {
-        if ((res = lxcProcReadMeminfo(hostpath, def, buf, size, offset)) < 0)
-            res = lxcProcHostRead(hostpath, buf, size, offset);
-    }
+    res = lxcProcHostRead(hostpath, buf, size, offset);
 
     VIR_FREE(hostpath);
     return res;
 }
 
+static int lxcProcRelease(const char *path ATTRIBUTE_UNUSED,
+                          struct fuse_file_info *fi)
+{
+    lxcProcFilePtr file = (lxcProcFilePtr) (uintptr_t) fi->fh;
+
+    if (file) {
+        VIR_FREE(file->content);
+        VIR_FREE(file);
+    }
+
+    return 0;
+}
+
 static struct fuse_operations lxcProcOper = {
     .getattr = lxcProcGetattr,
     .readdir = lxcProcReaddir,
     .open    = lxcProcOpen,
     .read    = lxcProcRead,
+    .release = lxcProcRelease,
 };
 
 static void lxcFuseDestroy(virLXCFusePtr fuse)
@@ -291,9 +592,9 @@ static void lxcFuseRun(void *opaque)
 {
     virLXCFusePtr fuse = opaque;
 
-    if (fuse_loop(fuse->fuse) < 0)
+    if (fuse_loop_mt(fuse->fuse) < 0)
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("fuse_loop failed"));
+                       _("fuse_loop_mt failed"));
 
     lxcFuseDestroy(fuse);
 }
@@ -312,6 +613,11 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
     if (virMutexInit(&fuse->lock) < 0)
         goto cleanup2;
 
+    if (virMutexInit(&fuse->cacheLock) < 0) {
+        virMutexDestroy(&fuse->lock);
+        goto cleanup2;
+    }
+
     if (virAsprintf(&fuse->mountpoint, "%s/%s.fuse/", LXC_STATE_DIR,
                     def->name) < 0)
         goto cleanup1;
@@ -334,7 +640,7 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
         goto cleanup1;
 
     fuse->fuse = fuse_new(fuse->ch, &args, &lxcProcOper,
-                          sizeof(lxcProcOper), fuse->def);
+                          sizeof(lxcProcOper), fuse);
     if (fuse->fuse == NULL) {
         fuse_unmount(fuse->mountpoint, fuse->ch);
         goto cleanup1;
@@ -347,6 +653,7 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
     return ret;
  cleanup1:
     VIR_FREE(fuse->mountpoint);
+    virMutexDestroy(&fuse->cacheLock);
     virMutexDestroy(&fuse->lock);
  cleanup2:
     VIR_FREE(fuse);
@@ -355,6 +662,12 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
 
 int lxcStartFuse(virLXCFusePtr fuse)
 {
+    /* The container's /proc/uptime counts from here */
+    if (virTimeMillisNow(&fuse->started) < 0) {
+        lxcFuseDestroy(fuse);
+        return -1;
+    }
+
     if (virThreadCreate(&fuse->thread, false, lxcFuseRun,
                         (void *)fuse) < 0) {
         lxcFuseDestroy(fuse);
@@ -367,6 +680,8 @@ int lxcStartFuse(virLXCFusePtr fuse)
 void lxcFreeFuse(virLXCFusePtr *f)
 {
     virLXCFusePtr fuse = *f;
+    size_t i;
+
     /* lxcFuseRun thread create success */
     if (fuse) {
         /* exit fuse_loop, lxcFuseRun thread may try to destroy
@@ -376,6 +691,11 @@ void lxcFreeFuse(virLXCFusePtr *f)
             fuse_exit(fuse->fuse);
         virMutexUnlock(&fuse->lock);
 
+        virMutexLock(&fuse->cacheLock);
+        for (i = 0; i < VIR_LXC_FUSE_FILE_LAST; i++)
+            VIR_FREE(fuse->cache[i].content);
+        virMutexUnlock(&fuse->cacheLock);
+
         VIR_FREE(fuse->mountpoint);
         VIR_FREE(*f);
     }
@@ -47,6 +47,25 @@ struct virLXCMeminfo {
 };
 typedef struct virLXCMeminfo *virLXCMeminfoPtr;
 
+/* Files of the host /proc which are emulated for the container */
+typedef enum {
+    VIR_LXC_FUSE_FILE_MEMINFO,
+    VIR_LXC_FUSE_FILE_STAT,
+    VIR_LXC_FUSE_FILE_CPUINFO,
+    VIR_LXC_FUSE_FILE_UPTIME,
+
+    VIR_LXC_FUSE_FILE_LAST
+} virLXCFuseFile;
+
+VIR_ENUM_DECL(virLXCFuseFile)
+
+/* Last rendered content of an emulated file */
+struct virLXCFuseCache {
+    char *content;
+    size_t len;
+    unsigned long long stamp; /* when @content was rendered, in ms */
+};
+
 struct virLXCFuse {
     virDomainDefPtr def;
     virThread thread;
@@ -54,6 +73,10 @@ struct virLXCFuse {
     struct fuse *fuse;
     struct fuse_chan *ch;
     virMutex lock;
+
+    unsigned long long started; /* when the container was started, in ms */
+    virMutex cacheLock;
+    struct virLXCFuseCache cache[VIR_LXC_FUSE_FILE_LAST];
 };
 typedef struct virLXCFuse *virLXCFusePtr;
 
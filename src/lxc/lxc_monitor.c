@@ -70,6 +70,10 @@ static void
 virLXCMonitorHandleEventInit(virNetClientProgramPtr prog,
                              virNetClientPtr client,
                              void *evdata, void *opaque);
+static void
+virLXCMonitorHandleEventStartup(virNetClientProgramPtr prog,
+                                virNetClientPtr client,
+                                void *evdata, void *opaque);
 
 static virNetClientProgramEvent virLXCMonitorEvents[] = {
     { VIR_LXC_MONITOR_PROC_EXIT_EVENT,
@@ -80,6 +84,10 @@ static virNetClientProgramEvent virLXCMonitorEvents[] = {
       virLXCMonitorHandleEventInit,
       sizeof(virLXCMonitorInitEventMsg),
       (xdrproc_t)xdr_virLXCMonitorInitEventMsg },
+    { VIR_LXC_MONITOR_PROC_STARTUP_EVENT,
+      virLXCMonitorHandleEventStartup,
+      sizeof(virLXCMonitorStartupEventMsg),
+      (xdrproc_t)xdr_virLXCMonitorStartupEventMsg },
 };
 
 
@@ -111,6 +119,21 @@ virLXCMonitorHandleEventInit(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
 }
 
 
+static void
+virLXCMonitorHandleEventStartup(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                                virNetClientPtr client ATTRIBUTE_UNUSED,
+                                void *evdata, void *opaque)
+{
+    virLXCMonitorPtr mon = opaque;
+    virLXCMonitorStartupEventMsg *msg = evdata;
+
+    VIR_DEBUG("Event startup with %u phases", msg->phases.phases_len);
+    if (mon->cb.startupNotify)
+        mon->cb.startupNotify(mon, msg->phases.phases_val,
+                              msg->phases.phases_len, mon->vm);
+}
+
+
 static void virLXCMonitorEOFNotify(virNetClientPtr client ATTRIBUTE_UNUSED,
                                    int reason ATTRIBUTE_UNUSED,
                                    void *opaque)
@@ -44,11 +44,17 @@ typedef void (*virLXCMonitorCallbackInitNotify)(virLXCMonitorPtr mon,
                                                 pid_t pid,
                                                 virDomainObjPtr vm);
 
+typedef void (*virLXCMonitorCallbackStartupNotify)(virLXCMonitorPtr mon,
+                                                   virLXCMonitorStartupPhase *phases,
+                                                   size_t nphases,
+                                                   virDomainObjPtr vm);
+
 struct _virLXCMonitorCallbacks {
     virLXCMonitorCallbackDestroy destroy;
     virLXCMonitorCallbackEOFNotify eofNotify;
     virLXCMonitorCallbackExitNotify exitNotify;
     virLXCMonitorCallbackInitNotify initNotify;
+    virLXCMonitorCallbackStartupNotify startupNotify;
 };
 
 virLXCMonitorPtr virLXCMonitorNew(virDomainObjPtr vm,
@@ -20,10 +20,23 @@ struct virLXCMonitorInitEventMsg {
     unsigned hyper initpid;
 };
 
+const VIR_LXC_MONITOR_STARTUP_PHASE_NAME_MAX = 64;
+const VIR_LXC_MONITOR_STARTUP_PHASES_MAX = 32;
+
+struct virLXCMonitorStartupPhase {
+    string name<VIR_LXC_MONITOR_STARTUP_PHASE_NAME_MAX>;
+    unsigned hyper duration; /* in microseconds */
+};
+
+struct virLXCMonitorStartupEventMsg {
+    virLXCMonitorStartupPhase phases<VIR_LXC_MONITOR_STARTUP_PHASES_MAX>;
+};
+
 const VIR_LXC_MONITOR_PROGRAM = 0x12341234;
 const VIR_LXC_MONITOR_PROGRAM_VERSION = 1;
 
 enum virLXCMonitorProcedure {
     VIR_LXC_MONITOR_PROC_EXIT_EVENT = 1, /* skipgen skipgen */
-    VIR_LXC_MONITOR_PROC_INIT_EVENT = 2 /* skipgen skipgen */
+    VIR_LXC_MONITOR_PROC_INIT_EVENT = 2, /* skipgen skipgen */
+    VIR_LXC_MONITOR_PROC_STARTUP_EVENT = 3 /* skipgen skipgen */
 };
@@ -263,57 +263,128 @@ virLXCProcessValidateInterface(virDomainNetDefPtr net)
 }
 
 
-char *
-virLXCProcessSetupInterfaceTap(virDomainDefPtr vm,
-                               virDomainNetDefPtr net,
-                               const char *brname)
+/* Configures the veth pair which was created for @net, whose parent
+ * end is net->ifname */
+static int
+virLXCProcessSetupInterfaceVeth(virDomainDefPtr vm,
+                                virDomainNetDefPtr net,
+                                const char *brname,
+                                const char *containerVeth)
 {
-    char *ret = NULL;
-    char *parentVeth;
-    char *containerVeth = NULL;
+    const char *parentVeth = net->ifname;
     virNetDevVPortProfilePtr vport = virDomainNetGetActualVirtPortProfile(net);
 
-    VIR_DEBUG("calling vethCreate()");
-    parentVeth = net->ifname;
-    if (virNetDevVethCreate(&parentVeth, &containerVeth) < 0)
-        goto cleanup;
-    VIR_DEBUG("parentVeth: %s, containerVeth: %s", parentVeth, containerVeth);
-
-    if (net->ifname == NULL)
-        net->ifname = parentVeth;
-
     if (virNetDevSetMAC(containerVeth, &net->mac) < 0)
-        goto cleanup;
+        return -1;
 
     if (brname) {
         if (vport && vport->virtPortType == VIR_NETDEV_VPORT_PROFILE_OPENVSWITCH) {
             if (virNetDevOpenvswitchAddPort(brname, parentVeth, &net->mac, vm->uuid,
                                             vport, virDomainNetGetActualVlan(net)) < 0)
-                goto cleanup;
+                return -1;
         } else {
             if (virNetDevBridgeAddPort(brname, parentVeth) < 0)
-                goto cleanup;
+                return -1;
         }
     }
 
     if (virNetDevSetOnline(parentVeth, true) < 0)
-        goto cleanup;
+        return -1;
 
     if (virDomainNetGetActualType(net) == VIR_DOMAIN_NET_TYPE_ETHERNET) {
         /* Set IP info for the host side, but only if the type is
          * 'ethernet'.
          */
         if (virNetDevIPInfoAddToDev(parentVeth, &net->hostIP) < 0)
-            goto cleanup;
+            return -1;
     }
 
     if (net->filter &&
         virDomainConfNWFilterInstantiate(vm->uuid, net) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+char *
+virLXCProcessSetupInterfaceTap(virDomainDefPtr vm,
+                               virDomainNetDefPtr net,
+                               const char *brname)
+{
+    char *parentVeth;
+    char *containerVeth = NULL;
+
+    VIR_DEBUG("calling vethCreate()");
+    parentVeth = net->ifname;
+    if (virNetDevVethCreate(&parentVeth, &containerVeth) < 0)
+        return NULL;
+    VIR_DEBUG("parentVeth: %s, containerVeth: %s", parentVeth, containerVeth);
+
+    if (net->ifname == NULL)
+        net->ifname = parentVeth;
+
+    if (virLXCProcessSetupInterfaceVeth(vm, net, brname, containerVeth) < 0) {
+        VIR_FREE(containerVeth);
+        return NULL;
+    }
+
+    return containerVeth;
+}
+
+
+/* Creates the veth pairs of all the interfaces of @def which need one
+ * in one go. On success, @containerVeths[i] holds the container end
+ * for def->nets[i], or NULL if that interface is not a veth. */
+static int
+virLXCProcessCreateVeths(virDomainDefPtr def,
+                         char **containerVeths)
+{
+    int ret = -1;
+    char **parents = NULL;
+    char **containers = NULL;
+    size_t *idx = NULL;
+    size_t n = 0;
+    size_t i;
+
+    if (VIR_ALLOC_N(parents, def->nnets) < 0 ||
+        VIR_ALLOC_N(containers, def->nnets) < 0 ||
+        VIR_ALLOC_N(idx, def->nnets) < 0)
+        goto cleanup;
+
+    for (i = 0; i < def->nnets; i++) {
+        switch (virDomainNetGetActualType(def->nets[i])) {
+        case VIR_DOMAIN_NET_TYPE_NETWORK:
+        case VIR_DOMAIN_NET_TYPE_BRIDGE:
+        case VIR_DOMAIN_NET_TYPE_ETHERNET:
+            parents[n] = def->nets[i]->ifname;
+            idx[n++] = i;
+            break;
+        default:
+            break;
+        }
+    }
+
+    VIR_DEBUG("Creating %zu veth pairs", n);
+    if (virNetDevVethCreateBatch(parents, containers, n) < 0)
         goto cleanup;
 
-    ret = containerVeth;
+    for (i = 0; i < n; i++) {
+        virDomainNetDefPtr net = def->nets[idx[i]];
+
+        VIR_DEBUG("parentVeth: %s, containerVeth: %s",
+                  parents[i], containers[i]);
+        if (net->ifname == NULL)
+            net->ifname = parents[i];
+        containerVeths[idx[i]] = containers[i];
+    }
+
+    ret = 0;
 
  cleanup:
+    VIR_FREE(parents);
+    VIR_FREE(containers);
+    VIR_FREE(idx);
     return ret;
 }
 
@@ -539,21 +610,35 @@ static int virLXCProcessSetupInterfaces(virConnectPtr conn,
     size_t niface = 0;
     virDomainNetDefPtr net;
     virDomainNetType type;
+    char **containerVeths = NULL;
+
+    if (!def->nnets)
+        return 0;
+
+    if (VIR_ALLOC_N(containerVeths, def->nnets) < 0)
+        return -1;
 
+    /* If appropriate, grab a physical device from the configured
+     * network's pool of devices, or resolve bridge device name
+     * to the one defined in the network definition.
+     */
     for (i = 0; i < def->nnets; i++) {
-        char *veth = NULL;
-        virNetDevBandwidthPtr actualBandwidth;
-        /* If appropriate, grab a physical device from the configured
-         * network's pool of devices, or resolve bridge device name
-         * to the one defined in the network definition.
-         */
         net = def->nets[i];
 
         if (virLXCProcessValidateInterface(net) < 0)
-            return -1;
+            goto cleanup;
 
         if (networkAllocateActualDevice(def, net) < 0)
             goto cleanup;
+    }
+
+    if (virLXCProcessCreateVeths(def, containerVeths) < 0)
+        goto cleanup;
+
+    for (i = 0; i < def->nnets; i++) {
+        char *veth = NULL;
+        virNetDevBandwidthPtr actualBandwidth;
+        net = def->nets[i];
 
         if (VIR_EXPAND_N(*veths, *nveths, 1) < 0)
             goto cleanup;
@@ -568,12 +653,18 @@ static int virLXCProcessSetupInterfaces(virConnectPtr conn,
                                _("No bridge name specified"));
                 goto cleanup;
             }
-            if (!(veth = virLXCProcessSetupInterfaceTap(def, net, brname)))
+            if (virLXCProcessSetupInterfaceVeth(def, net, brname,
+                                                containerVeths[i]) < 0)
                 goto cleanup;
+            veth = containerVeths[i];
+            containerVeths[i] = NULL;
         }   break;
         case VIR_DOMAIN_NET_TYPE_ETHERNET:
-            if (!(veth = virLXCProcessSetupInterfaceTap(def, net, NULL)))
+            if (virLXCProcessSetupInterfaceVeth(def, net, NULL,
+                                                containerVeths[i]) < 0)
                 goto cleanup;
+            veth = containerVeths[i];
+            containerVeths[i] = NULL;
             break;
         case VIR_DOMAIN_NET_TYPE_DIRECT:
             if (!(veth = virLXCProcessSetupInterfaceDirect(conn, def, net)))
@@ -636,6 +727,9 @@ static int virLXCProcessSetupInterfaces(virConnectPtr conn,
             networkReleaseActualDevice(def, iface);
         }
     }
+    for (i = 0; i < def->nnets; i++)
+        VIR_FREE(containerVeths[i]);
+    VIR_FREE(containerVeths);
     return ret;
 }
 
@@ -790,10 +884,35 @@ static void virLXCProcessMonitorInitNotify(virLXCMonitorPtr mon ATTRIBUTE_UNUSED
     virObjectUnref(cfg);
 }
 
+static void
+virLXCProcessMonitorStartupNotify(virLXCMonitorPtr mon ATTRIBUTE_UNUSED,
+                                  virLXCMonitorStartupPhase *phases,
+                                  size_t nphases,
+                                  virDomainObjPtr vm)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *str;
+    size_t i;
+
+    for (i = 0; i < nphases; i++)
+        virBufferAsprintf(&buf, " %s=%llu.%03llums", phases[i].name,
+                          (unsigned long long) phases[i].duration / 1000,
+                          (unsigned long long) phases[i].duration % 1000);
+
+    if (!(str = virBufferContentAndReset(&buf)))
+        return;
+
+    virObjectLock(vm);
+    VIR_INFO("Startup of container %s took:%s", vm->def->name, str);
+    virObjectUnlock(vm);
+    VIR_FREE(str);
+}
+
 static virLXCMonitorCallbacks monitorCallbacks = {
     .eofNotify = virLXCProcessMonitorEOFNotify,
     .exitNotify = virLXCProcessMonitorExitNotify,
     .initNotify = virLXCProcessMonitorInitNotify,
+    .startupNotify = virLXCProcessMonitorStartupNotify,
 };
 
 
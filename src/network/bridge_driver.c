@@ -74,6 +74,8 @@
 #include "network_event.h"
 #include "virhook.h"
 #include "virjson.h"
+#include "virlease.h"
+#include "viratomic.h"
 
 #define VIR_FROM_THIS VIR_FROM_NETWORK
 #define MAX_BRIDGE_ID 256
@@ -309,6 +311,8 @@ networkRemoveInactive(virNetworkDriverStatePtr driver,
 {
     char *leasefile = NULL;
     char *customleasefile = NULL;
+    char *customleaseindex = NULL;
+    char *customleasejournal = NULL;
     char *radvdconfigfile = NULL;
     char *configfile = NULL;
     char *radvdpidbase = NULL;
@@ -331,6 +335,12 @@ networkRemoveInactive(virNetworkDriverStatePtr driver,
     if (!(customleasefile = networkDnsmasqLeaseFileNameCustom(driver, def->bridge)))
         goto cleanup;
 
+    if (virAsprintf(&customleaseindex, "%s" VIR_LEASE_INDEX_SUFFIX,
+                    customleasefile) < 0 ||
+        virAsprintf(&customleasejournal, "%s" VIR_LEASE_JOURNAL_SUFFIX,
+                    customleasefile) < 0)
+        goto cleanup;
+
     if (!(radvdconfigfile = networkRadvdConfigFileName(driver, def->name)))
         goto cleanup;
 
@@ -350,6 +360,8 @@ networkRemoveInactive(virNetworkDriverStatePtr driver,
     dnsmasqDelete(dctx);
     unlink(leasefile);
     unlink(customleasefile);
+    unlink(customleaseindex);
+    unlink(customleasejournal);
     unlink(configfile);
 
     /* MAC map manager */
@@ -371,6 +383,8 @@ networkRemoveInactive(virNetworkDriverStatePtr driver,
     VIR_FREE(leasefile);
     VIR_FREE(configfile);
     VIR_FREE(customleasefile);
+    VIR_FREE(customleaseindex);
+    VIR_FREE(customleasejournal);
     VIR_FREE(radvdconfigfile);
     VIR_FREE(radvdpidbase);
     VIR_FREE(statusfile);
@@ -1639,8 +1653,8 @@ networkStartDhcpDaemon(virNetworkDriverStatePtr driver,
 
 /* networkRefreshDhcpDaemon:
  *  Update dnsmasq config files, then send a SIGHUP so that it rereads
- *  them.   This only works for the dhcp-hostsfile and the
- *  addn-hosts file.
+ *  them, unless none of them changed.   This only works for the
+ *  dhcp-hostsfile and the addn-hosts file.
  *
  *  Returns 0 on success, -1 on failure.
  */
@@ -1649,6 +1663,7 @@ networkRefreshDhcpDaemon(virNetworkDriverStatePtr driver,
                          virNetworkObjPtr network)
 {
     int ret = -1;
+    int rc;
     size_t i;
     virNetworkIPDefPtr ipdef, ipv4def, ipv6def;
     dnsmasqContext *dctx = NULL;
@@ -1696,8 +1711,17 @@ networkRefreshDhcpDaemon(virNetworkDriverStatePtr driver,
     if (networkBuildDnsmasqHostsList(dctx, &network->def->dns) < 0)
         goto cleanup;
 
-    if ((ret = dnsmasqSave(dctx)) < 0)
+    if ((rc = dnsmasqSave(dctx)) < 0)
+        goto cleanup;
+
+    /* Rereading the files pauses DHCP service, don't bother dnsmasq
+     * if nothing changed for it */
+    if (rc == 0) {
+        VIR_DEBUG("dnsmasq config files for network %s are up to date",
+                  network->def->name);
+        ret = 0;
         goto cleanup;
+    }
 
     ret = kill(network->dnsmasqPid, SIGHUP);
  cleanup:
@@ -2031,16 +2055,128 @@ networkRefreshDaemonsHelper(virNetworkObjPtr net,
     return 0;
 }
 
+typedef struct _networkObjCollection networkObjCollection;
+typedef networkObjCollection *networkObjCollectionPtr;
+struct _networkObjCollection {
+    virNetworkObjPtr *nets;
+    size_t nnets;
+};
+
+static int
+networkCollectObjsHelper(virNetworkObjPtr net,
+                         void *opaque)
+{
+    networkObjCollectionPtr data = opaque;
+    virNetworkObjPtr tmp = virObjectRef(net);
+
+    if (VIR_APPEND_ELEMENT(data->nets, data->nnets, tmp) < 0) {
+        virObjectUnref(net);
+        return -1;
+    }
+    return 0;
+}
+
+/* Take a reference on every network, so that they can be processed
+ * without holding the lock of the list */
+static int
+networkCollectObjs(virNetworkDriverStatePtr driver,
+                   networkObjCollectionPtr data)
+{
+    memset(data, 0, sizeof(*data));
+    return virNetworkObjListForEach(driver->networks,
+                                    networkCollectObjsHelper,
+                                    data);
+}
+
+static void
+networkCollectionClear(networkObjCollectionPtr data)
+{
+    while (data->nnets)
+        virObjectUnref(data->nets[--data->nnets]);
+    VIR_FREE(data->nets);
+}
+
+
+/* Maximum number of threads refreshing network daemons together */
+#define NETWORK_REFRESH_WORKERS 8
+
+typedef struct _networkRefreshDaemonsData networkRefreshDaemonsData;
+typedef networkRefreshDaemonsData *networkRefreshDaemonsDataPtr;
+struct _networkRefreshDaemonsData {
+    virNetworkDriverStatePtr driver;
+    networkObjCollection nets;
+    int next; /* atomic: index of the next network to refresh */
+};
+
+static void
+networkRefreshDaemonsWorker(void *opaque)
+{
+    networkRefreshDaemonsDataPtr data = opaque;
+    int i;
+
+    while ((i = virAtomicIntInc(&data->next) - 1) < (int) data->nets.nnets)
+        networkRefreshDaemonsHelper(data->nets.nets[i], data->driver);
+}
+
 /* SIGHUP/restart any dnsmasq or radvd daemons.
  * This should be called when libvirtd is restarted.
+ *
+ * Networks are independent of each other and restarting a daemon
+ * mostly means waiting for it, so several networks are refreshed
+ * at once.
  */
 static void
 networkRefreshDaemons(virNetworkDriverStatePtr driver)
 {
+    networkRefreshDaemonsData data;
+    virThread threads[NETWORK_REFRESH_WORKERS];
+    size_t nthreads = 0;
+    size_t i;
+
     VIR_INFO("Refreshing network daemons");
-    virNetworkObjListForEach(driver->networks,
-                             networkRefreshDaemonsHelper,
-                             driver);
+
+    memset(&data, 0, sizeof(data));
+    data.driver = driver;
+
+    if (networkCollectObjs(driver, &data.nets) < 0) {
+        networkCollectionClear(&data.nets);
+        virNetworkObjListForEach(driver->networks,
+                                 networkRefreshDaemonsHelper,
+                                 driver);
+        return;
+    }
+
+    /* The calling thread takes its share of the networks too */
+    while (nthreads < NETWORK_REFRESH_WORKERS &&
+           nthreads + 1 < data.nets.nnets) {
+        if (virThreadCreate(&threads[nthreads], true,
+                            networkRefreshDaemonsWorker, &data) < 0) {
+            VIR_WARN("Failed to create network refresh thread");
+            break;
+        }
+        nthreads++;
+    }
+
+    networkRefreshDaemonsWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    networkCollectionClear(&data.nets);
+}
+
+static bool
+networkNeedsFirewallRules(virNetworkObjPtr net)
+{
+    /* Only three of the L3 network types that are configured by
+     * libvirt need to have iptables rules reloaded. The 4th L3
+     * network type, forward='open', doesn't need this because it
+     * has no iptables rules.
+     */
+    return virNetworkObjIsActive(net) &&
+        ((net->def->forward.type == VIR_NETWORK_FORWARD_NONE) ||
+         (net->def->forward.type == VIR_NETWORK_FORWARD_NAT) ||
+         (net->def->forward.type == VIR_NETWORK_FORWARD_ROUTE));
 }
 
 static int
@@ -2049,15 +2185,7 @@ networkReloadFirewallRulesHelper(virNetworkObjPtr net,
 {
 
     virObjectLock(net);
-    if (virNetworkObjIsActive(net) &&
-        ((net->def->forward.type == VIR_NETWORK_FORWARD_NONE) ||
-         (net->def->forward.type == VIR_NETWORK_FORWARD_NAT) ||
-         (net->def->forward.type == VIR_NETWORK_FORWARD_ROUTE))) {
-        /* Only three of the L3 network types that are configured by
-         * libvirt need to have iptables rules reloaded. The 4th L3
-         * network type, forward='open', doesn't need this because it
-         * has no iptables rules.
-         */
+    if (networkNeedsFirewallRules(net)) {
         networkRemoveFirewallRules(net->def);
         if (networkAddFirewallRules(net->def) < 0) {
             /* failed to add but already logged */
@@ -2067,13 +2195,62 @@ networkReloadFirewallRulesHelper(virNetworkObjPtr net,
     return 0;
 }
 
+static int
+networkQueueReloadFirewallRulesHelper(virNetworkObjPtr net,
+                                      void *opaque)
+{
+    virFirewallPtr fw = opaque;
+    int ret = 0;
+
+    virObjectLock(net);
+    if (networkNeedsFirewallRules(net))
+        ret = networkQueueReloadFirewallRules(fw, net->def);
+    virObjectUnlock(net);
+    return ret;
+}
+
+/* The rules of all networks are replaced by a single firewall
+ * transaction. Should that fail, for example because the rules of
+ * one network can't be added, every network is reloaded on its own
+ * so that the others still get their rules.
+ */
 static void
 networkReloadFirewallRules(virNetworkDriverStatePtr driver)
 {
+    networkObjCollection data;
+    virFirewallPtr fw = NULL;
+    bool queued = false;
+    size_t i;
+    int rc;
+
     VIR_INFO("Reloading iptables rules");
+
+    if (networkCollectObjs(driver, &data) < 0)
+        goto fallback;
+
+    fw = virFirewallNew();
+    for (i = 0; i < data.nnets; i++) {
+        if ((rc = networkQueueReloadFirewallRulesHelper(data.nets[i], fw)) < 0)
+            goto fallback;
+        if (rc > 0)
+            queued = true;
+    }
+
+    if (queued && virFirewallApply(fw) < 0)
+        goto fallback;
+
+    goto cleanup;
+
+ fallback:
+    VIR_WARN("Unable to reload firewall rules of all networks at once, "
+             "reloading them one by one: %s", virGetLastErrorMessage());
     virNetworkObjListForEach(driver->networks,
                              networkReloadFirewallRulesHelper,
                              NULL);
+
+ cleanup:
+    virFirewallFree(fw);
+    networkCollectionClear(&data);
 }
 
 /* Enable IP Forwarding. Return 0 for success, -1 for failure. */
@@ -2554,6 +2731,134 @@ networkShutdownNetworkBridge(virNetworkObjPtr network ATTRIBUTE_UNUSED)
 }
 
 
+/* networkGetForwardIfNumaNode:
+ * @dev: an interface of a network's pool
+ *
+ * Returns the NUMA node @dev is attached to, or -1 if unknown
+ */
+static int
+networkGetForwardIfNumaNode(virNetworkForwardIfDefPtr dev)
+{
+    char *path = NULL;
+    int node = -1;
+    int rc = -1;
+
+    switch ((virNetworkForwardHostdevDeviceType) dev->type) {
+    case VIR_NETWORK_FORWARD_HOSTDEV_DEVICE_PCI:
+        rc = virPCIDeviceAddressGetSysfsFile(&dev->device.pci, &path);
+        break;
+    case VIR_NETWORK_FORWARD_HOSTDEV_DEVICE_NETDEV:
+        rc = virNetDevSysfsFile(&path, dev->device.dev, "device");
+        break;
+    case VIR_NETWORK_FORWARD_HOSTDEV_DEVICE_NONE:
+    case VIR_NETWORK_FORWARD_HOSTDEV_DEVICE_LAST:
+        break;
+    }
+
+    if (rc < 0 ||
+        (rc = virFileReadValueInt(&node, "%s/numa_node", path)) < 0) {
+        /* Not knowing only means no NUMA preference for @dev */
+        if (rc == -1)
+            virResetLastError();
+        node = -1;
+    }
+
+    VIR_FREE(path);
+    return node < 0 ? -1 : node;
+}
+
+
+/* networkInitInterfacePool:
+ * @netdef: the original NetDef from the network
+ *
+ * Sets up what's needed to quickly pick an interface from the pool:
+ * the bitmap of idle interfaces and the NUMA node of each one.
+ */
+static int
+networkInitInterfacePool(virNetworkDefPtr netdef)
+{
+    virBitmapPtr idle;
+    size_t i;
+
+    if (netdef->forward.idleIfs || netdef->forward.nifs == 0)
+        return 0;
+
+    if (!(idle = virBitmapNew(netdef->forward.nifs)))
+        return -1;
+
+    for (i = 0; i < netdef->forward.nifs; i++) {
+        virNetworkForwardIfDefPtr dev = &netdef->forward.ifs[i];
+
+        if (dev->connections == 0)
+            ignore_value(virBitmapSetBit(idle, i));
+        dev->numaNode = networkGetForwardIfNumaNode(dev);
+    }
+
+    netdef->forward.idleIfs = idle;
+    return 0;
+}
+
+
+static void
+networkForwardIfConnect(virNetworkDefPtr netdef,
+                        virNetworkForwardIfDefPtr dev)
+{
+    dev->connections++;
+    if (netdef->forward.idleIfs)
+        ignore_value(virBitmapClearBit(netdef->forward.idleIfs,
+                                       dev - netdef->forward.ifs));
+}
+
+
+static void
+networkForwardIfDisconnect(virNetworkDefPtr netdef,
+                           virNetworkForwardIfDefPtr dev)
+{
+    dev->connections--;
+    if (dev->connections <= 0 && netdef->forward.idleIfs)
+        ignore_value(virBitmapSetBit(netdef->forward.idleIfs,
+                                     dev - netdef->forward.ifs));
+}
+
+
+/* networkPickIdleInterface:
+ * @netdef: the original NetDef from the network
+ * @dom: domain the interface is for
+ *
+ * Returns an interface of the pool without any connections, preferring
+ * one attached to a NUMA node the memory of @dom is bound to, or NULL
+ * if all of them are in use.
+ */
+static virNetworkForwardIfDefPtr
+networkPickIdleInterface(virNetworkDefPtr netdef,
+                         virDomainDefPtr dom)
+{
+    virBitmapPtr nodeset = virDomainNumatuneGetNodeset(dom->numa, NULL, -1);
+    ssize_t first = -1;
+    ssize_t i = -1;
+
+    if (!netdef->forward.idleIfs)
+        return NULL;
+
+    while ((i = virBitmapNextSetBit(netdef->forward.idleIfs, i)) >= 0) {
+        int node = netdef->forward.ifs[i].numaNode;
+
+        if (!nodeset ||
+            (node >= 0 && virBitmapIsBitSet(nodeset, node)))
+            return &netdef->forward.ifs[i];
+
+        if (first < 0)
+            first = i;
+    }
+
+    if (first >= 0)
+        VIR_DEBUG("No idle interface of network '%s' is local to "
+                  "the memory of domain '%s'", netdef->name, dom->name);
+
+    return first >= 0 ? &netdef->forward.ifs[first] : NULL;
+}
+
+
 /* networkCreateInterfacePool:
  * @netdef: the original NetDef from the network
  *
@@ -2571,7 +2876,7 @@ networkCreateInterfacePool(virNetworkDefPtr netdef)
     size_t i;
 
     if (netdef->forward.npfs == 0 || netdef->forward.nifs > 0)
-       return 0;
+       return networkInitInterfacePool(netdef);
 
     if ((virNetDevGetVirtualFunctions(netdef->forward.pfs->dev, &vfNames,
                                       &virtFns, &numVirtFns, &maxVirtFns)) < 0) {
@@ -2638,6 +2943,9 @@ networkCreateInterfacePool(virNetworkDefPtr netdef)
         goto cleanup;
     }
 
+    if (networkInitInterfacePool(netdef) < 0)
+        goto cleanup;
+
     ret = 0;
  cleanup:
     if (ret < 0) {
@@ -3959,6 +4267,7 @@ networkGetDHCPLeases(virNetworkPtr network,
     long long expirytime_tmp = -1;
     bool ipv6 = false;
     char *lease_entries = NULL;
+    char *journal_entries = NULL;
     char *custom_lease_file = NULL;
     const char *ip_tmp = NULL;
     const char *mac_tmp = NULL;
@@ -3987,6 +4296,12 @@ networkGetDHCPLeases(virNetworkPtr network,
     /* Retrieve custom leases file location */
     custom_lease_file = networkDnsmasqLeaseFileNameCustom(driver, obj->def->bridge);
 
+    /* The journal leaseshelper appends events to has to be read before
+     * the lease file it is eventually folded into */
+    if (!custom_lease_file ||
+        virLeaseJournalRead(custom_lease_file, &journal_entries) < 0)
+        goto error;
+
     /* Read entire contents */
     if ((custom_lease_file_len = virFileReadAll(custom_lease_file,
                                                 VIR_NETWORK_DHCP_LEASE_FILE_SIZE_MAX,
@@ -4004,12 +4319,19 @@ networkGetDHCPLeases(virNetworkPtr network,
                            _("invalid json in file: %s"), custom_lease_file);
             goto error;
         }
+    }
 
-        if ((size = virJSONValueArraySize(leases_array)) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("couldn't fetch array of leases"));
+    if (journal_entries) {
+        if ((!leases_array && !(leases_array = virJSONValueNewArray())) ||
+            virLeaseJournalReplay(leases_array, journal_entries) < 0)
             goto error;
-        }
+    }
+
+    if (leases_array &&
+        (size = virJSONValueArraySize(leases_array)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("couldn't fetch array of leases"));
+        goto error;
     }
 
     currtime = (long long) time(NULL);
@@ -4114,6 +4436,7 @@ networkGetDHCPLeases(virNetworkPtr network,
  cleanup:
     VIR_FREE(lease);
     VIR_FREE(lease_entries);
+    VIR_FREE(journal_entries);
     VIR_FREE(custom_lease_file);
     virJSONValueFree(leases_array);
 
@@ -4382,14 +4705,7 @@ networkAllocateActualDevice(virDomainDefPtr dom,
         if (networkCreateInterfacePool(netdef) < 0)
             goto error;
 
-        /* pick first dev with 0 connections */
-        for (i = 0; i < netdef->forward.nifs; i++) {
-            if (netdef->forward.ifs[i].connections == 0) {
-                dev = &netdef->forward.ifs[i];
-                break;
-            }
-        }
-        if (!dev) {
+        if (!(dev = networkPickIdleInterface(netdef, dom))) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("network '%s' requires exclusive access "
                              "to interfaces, but none are available"),
@@ -4526,13 +4842,7 @@ networkAllocateActualDevice(virDomainDefPtr dom,
                  (iface->data.network.actual->virtPortProfile->virtPortType
                   == VIR_NETDEV_VPORT_PROFILE_8021QBH))) {
 
-                /* pick first dev with 0 connections */
-                for (i = 0; i < netdef->forward.nifs; i++) {
-                    if (netdef->forward.ifs[i].connections == 0) {
-                        dev = &netdef->forward.ifs[i];
-                        break;
-                    }
-                }
+                dev = networkPickIdleInterface(netdef, dom);
             } else {
                 /* pick least used dev */
                 dev = &netdef->forward.ifs[0];
@@ -4611,7 +4921,7 @@ networkAllocateActualDevice(virDomainDefPtr dom,
     if (netdef) {
         netdef->connections++;
         if (dev)
-            dev->connections++;
+            networkForwardIfConnect(netdef, dev);
         /* finally we can call the 'plugged' hook script if any */
         if (networkRunHook(network, dom, iface,
                            VIR_HOOK_NETWORK_OP_IFACE_PLUGGED,
@@ -4619,7 +4929,7 @@ networkAllocateActualDevice(virDomainDefPtr dom,
             /* adjust for failure */
             netdef->connections--;
             if (dev)
-                dev->connections--;
+                networkForwardIfDisconnect(netdef, dev);
             goto error;
         }
         networkLogAllocation(netdef, actualType, dev, iface, true);
@@ -4835,13 +5145,13 @@ networkNotifyActualDevice(virDomainDefPtr dom,
  success:
     netdef->connections++;
     if (dev)
-        dev->connections++;
+        networkForwardIfConnect(netdef, dev);
     /* finally we can call the 'plugged' hook script if any */
     if (networkRunHook(network, dom, iface, VIR_HOOK_NETWORK_OP_IFACE_PLUGGED,
                        VIR_HOOK_SUBOP_BEGIN) < 0) {
         /* adjust for failure */
         if (dev)
-            dev->connections--;
+            networkForwardIfDisconnect(netdef, dev);
         netdef->connections--;
         goto error;
     }
@@ -4982,7 +5292,7 @@ networkReleaseActualDevice(virDomainDefPtr dom,
     if (iface->data.network.actual) {
         netdef->connections--;
         if (dev)
-            dev->connections--;
+            networkForwardIfDisconnect(netdef, dev);
         /* finally we can call the 'unplugged' hook script if any */
         networkRunHook(network, dom, iface, VIR_HOOK_NETWORK_OP_IFACE_UNPLUGGED,
                        VIR_HOOK_SUBOP_BEGIN);
@@ -633,15 +633,14 @@ networkRemoveIPSpecificFirewallRules(virFirewallPtr fw,
 }
 
 
-/* Add all rules for all ip addresses (and general rules) on a network */
-int networkAddFirewallRules(virNetworkDefPtr def)
+/* Queue the groups adding all rules for all ip addresses (and general
+ * rules) on a network */
+static int
+networkAddFirewallRulesGroups(virFirewallPtr fw,
+                              virNetworkDefPtr def)
 {
     size_t i;
     virNetworkIPDefPtr ipdef;
-    virFirewallPtr fw = NULL;
-    int ret = -1;
-
-    fw = virFirewallNew();
 
     virFirewallStartTransaction(fw, 0);
 
@@ -651,7 +650,7 @@ int networkAddFirewallRules(virNetworkDefPtr def)
          (ipdef = virNetworkDefGetIPByIndex(def, AF_UNSPEC, i));
          i++) {
         if (networkAddIPSpecificFirewallRules(fw, def, ipdef) < 0)
-            goto cleanup;
+            return -1;
     }
 
     virFirewallStartRollback(fw, 0);
@@ -660,30 +659,24 @@ int networkAddFirewallRules(virNetworkDefPtr def)
          (ipdef = virNetworkDefGetIPByIndex(def, AF_UNSPEC, i));
          i++) {
         if (networkRemoveIPSpecificFirewallRules(fw, def, ipdef) < 0)
-            goto cleanup;
+            return -1;
     }
     networkRemoveGeneralFirewallRules(fw, def);
 
     virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
     networkAddChecksumFirewallRules(fw, def);
 
-    if (virFirewallApply(fw) < 0)
-        goto cleanup;
-
-    ret = 0;
- cleanup:
-    virFirewallFree(fw);
-    return ret;
+    return 0;
 }
 
-/* Remove all rules for all ip addresses (and general rules) on a network */
-void networkRemoveFirewallRules(virNetworkDefPtr def)
+/* Queue the groups removing all rules for all ip addresses (and general
+ * rules) on a network */
+static int
+networkRemoveFirewallRulesGroups(virFirewallPtr fw,
+                                 virNetworkDefPtr def)
 {
     size_t i;
     virNetworkIPDefPtr ipdef;
-    virFirewallPtr fw = NULL;
-
-    fw = virFirewallNew();
 
     virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
     networkRemoveChecksumFirewallRules(fw, def);
@@ -694,12 +687,57 @@ void networkRemoveFirewallRules(virNetworkDefPtr def)
          (ipdef = virNetworkDefGetIPByIndex(def, AF_UNSPEC, i));
          i++) {
         if (networkRemoveIPSpecificFirewallRules(fw, def, ipdef) < 0)
-            goto cleanup;
+            return -1;
     }
     networkRemoveGeneralFirewallRules(fw, def);
 
+    return 0;
+}
+
+/* Add all rules for all ip addresses (and general rules) on a network */
+int networkAddFirewallRules(virNetworkDefPtr def)
+{
+    virFirewallPtr fw = NULL;
+    int ret = -1;
+
+    fw = virFirewallNew();
+
+    if (networkAddFirewallRulesGroups(fw, def) < 0)
+        goto cleanup;
+
+    if (virFirewallApply(fw) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virFirewallFree(fw);
+    return ret;
+}
+
+/* Remove all rules for all ip addresses (and general rules) on a network */
+void networkRemoveFirewallRules(virNetworkDefPtr def)
+{
+    virFirewallPtr fw = NULL;
+
+    fw = virFirewallNew();
+
+    if (networkRemoveFirewallRulesGroups(fw, def) < 0)
+        goto cleanup;
+
     virFirewallApply(fw);
 
  cleanup:
     virFirewallFree(fw);
 }
+
+/* Queue replacing the rules of a network into @fw, so that the rules
+ * of many networks can be reloaded by a single virFirewallApply() */
+int networkQueueReloadFirewallRules(virFirewallPtr fw,
+                                    virNetworkDefPtr def)
+{
+    if (networkRemoveFirewallRulesGroups(fw, def) < 0 ||
+        networkAddFirewallRulesGroups(fw, def) < 0)
+        return -1;
+
+    return 1;
+}
@@ -34,3 +34,9 @@ int networkAddFirewallRules(virNetworkDefPtr def ATTRIBUTE_UNUSED)
 void networkRemoveFirewallRules(virNetworkDefPtr def ATTRIBUTE_UNUSED)
 {
 }
+
+int networkQueueReloadFirewallRules(virFirewallPtr fw ATTRIBUTE_UNUSED,
+                                    virNetworkDefPtr def ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
@@ -27,6 +27,7 @@
 # include "internal.h"
 # include "virthread.h"
 # include "virdnsmasq.h"
+# include "virfirewall.h"
 # include "virnetworkobj.h"
 # include "object_event.h"
 
@@ -63,4 +64,7 @@ int networkAddFirewallRules(virNetworkDefPtr def);
 
 void networkRemoveFirewallRules(virNetworkDefPtr def);
 
+int networkQueueReloadFirewallRules(virFirewallPtr fw,
+                                    virNetworkDefPtr def);
+
 #endif /* __VIR_BRIDGE_DRIVER_PLATFORM_H__ */
@@ -84,6 +84,7 @@ main(int argc, char **argv)
 {
     char *pid_file = NULL;
     char *custom_lease_file = NULL;
+    char *index_file = NULL;
     const char *ip = NULL;
     const char *mac = NULL;
     const char *leases_str = NULL;
@@ -161,6 +162,10 @@ main(int argc, char **argv)
                     interface) < 0)
         goto cleanup;
 
+    if (virAsprintf(&index_file, "%s" VIR_LEASE_INDEX_SUFFIX,
+                    custom_lease_file) < 0)
+        goto cleanup;
+
     if (VIR_STRDUP(pid_file, LOCALSTATEDIR "/run/leaseshelper.pid") < 0)
         goto cleanup;
 
@@ -206,6 +211,27 @@ main(int argc, char **argv)
         break;
     }
 
+    /* Appending the event to the journal costs the same whatever the
+     * number of leases, the lease file is only rewritten once the
+     * journal has grown big enough */
+    if (delete) {
+        off_t journal_size;
+
+        if ((journal_size = virLeaseJournalAppend(custom_lease_file,
+                                                  lease_new, ip)) < 0)
+            goto cleanup;
+
+        if (journal_size < VIR_LEASE_JOURNAL_COMPACT_SIZE) {
+            rv = EXIT_SUCCESS;
+            goto cleanup;
+        }
+
+        /* The journal replayed below already holds the event */
+        delete = false;
+        virJSONValueFree(lease_new);
+        lease_new = NULL;
+    }
+
     if (!(leases_array_new = virJSONValueNewArray())) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("failed to create json"));
@@ -221,8 +247,8 @@ main(int argc, char **argv)
         if (virLeasePrintLeases(leases_array_new, server_duid) < 0)
             goto cleanup;
 
-        break;
-
+        /* dnsmasq (re)starting is a good time to fold the journal */
+        /* fallthrough */
     case VIR_LEASE_ACTION_OLD:
     case VIR_LEASE_ACTION_ADD:
         if (lease_new && virJSONValueArrayAppend(leases_array_new, lease_new) < 0) {
@@ -249,6 +275,16 @@ main(int argc, char **argv)
         break;
     }
 
+    /* Keep the index the NSS module looks leases up in up to date with
+     * the lease file */
+    if (virLeaseIndexWrite(index_file, custom_lease_file,
+                           leases_array_new) < 0)
+        goto cleanup;
+
+    /* The lease file holds all of the journal by now */
+    if (virLeaseJournalRemove(custom_lease_file) < 0)
+        goto cleanup;
+
     rv = EXIT_SUCCESS;
 
  cleanup:
@@ -258,6 +294,7 @@ main(int argc, char **argv)
     VIR_FREE(pid_file);
     VIR_FREE(server_duid);
     VIR_FREE(custom_lease_file);
+    VIR_FREE(index_file);
     virJSONValueFree(lease_new);
     virJSONValueFree(leases_array_new);
 
@@ -167,7 +167,7 @@ nodeNumOfDevices(virConnectPtr conn,
     virCheckFlags(0, -1);
 
     nodeDeviceLock();
-    ndevs = virNodeDeviceObjNumOfDevices(&driver->devs, conn, cap,
+    ndevs = virNodeDeviceObjNumOfDevices(driver->devs, conn, cap,
                                          virNodeNumOfDevicesCheckACL);
     nodeDeviceUnlock();
 
@@ -190,7 +190,7 @@ nodeListDevices(virConnectPtr conn,
     virCheckFlags(0, -1);
 
     nodeDeviceLock();
-    nnames = virNodeDeviceObjGetNames(&driver->devs, conn,
+    nnames = virNodeDeviceObjGetNames(driver->devs, conn,
                                       virNodeListDevicesCheckACL,
                                       cap, names, maxnames);
     nodeDeviceUnlock();
@@ -211,7 +211,7 @@ nodeConnectListAllNodeDevices(virConnectPtr conn,
         return -1;
 
     nodeDeviceLock();
-    ret = virNodeDeviceObjListExport(conn, &driver->devs, devices,
+    ret = virNodeDeviceObjListExport(conn, driver->devs, devices,
                                      virConnectListAllNodeDevicesCheckACL,
                                      flags);
     nodeDeviceUnlock();
@@ -225,7 +225,7 @@ nodeDeviceLookupByName(virConnectPtr conn, const char *name)
     virNodeDevicePtr ret = NULL;
 
     nodeDeviceLock();
-    obj = virNodeDeviceObjFindByName(&driver->devs, name);
+    obj = virNodeDeviceObjFindByName(driver->devs, name);
     nodeDeviceUnlock();
 
     if (!obj) {
@@ -250,15 +250,41 @@ nodeDeviceLookupByName(virConnectPtr conn, const char *name)
 }
 
 
+struct nodeDeviceWWNsData {
+    const char *wwnn;
+    const char *wwpn;
+};
+
+
+static bool
+nodeDeviceSCSIHostWWNSearcher(virNodeDeviceObjPtr obj,
+                              const void *opaque)
+{
+    const struct nodeDeviceWWNsData *data = opaque;
+    virNodeDevCapsDefPtr cap;
+
+    for (cap = obj->def->caps; cap; cap = cap->next) {
+        if (cap->data.type == VIR_NODE_DEV_CAP_SCSI_HOST) {
+            nodeDeviceSysfsGetSCSIHostCaps(&cap->data.scsi_host);
+            if (cap->data.scsi_host.flags &
+                VIR_NODE_DEV_CAP_FLAG_HBA_FC_HOST &&
+                STREQ(cap->data.scsi_host.wwnn, data->wwnn) &&
+                STREQ(cap->data.scsi_host.wwpn, data->wwpn))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+
 virNodeDevicePtr
 nodeDeviceLookupSCSIHostByWWN(virConnectPtr conn,
                               const char *wwnn,
                               const char *wwpn,
                               unsigned int flags)
 {
-    size_t i;
-    virNodeDeviceObjListPtr devs = &driver->devs;
-    virNodeDevCapsDefPtr cap = NULL;
+    struct nodeDeviceWWNsData data = { wwnn, wwpn };
     virNodeDeviceObjPtr obj = NULL;
     virNodeDevicePtr dev = NULL;
 
@@ -266,38 +292,22 @@ nodeDeviceLookupSCSIHostByWWN(virConnectPtr conn,
 
     nodeDeviceLock();
 
-    for (i = 0; i < devs->count; i++) {
-        obj = devs->objs[i];
-        virNodeDeviceObjLock(obj);
-        cap = obj->def->caps;
-
-        while (cap) {
-            if (cap->data.type == VIR_NODE_DEV_CAP_SCSI_HOST) {
-                nodeDeviceSysfsGetSCSIHostCaps(&cap->data.scsi_host);
-                if (cap->data.scsi_host.flags &
-                    VIR_NODE_DEV_CAP_FLAG_HBA_FC_HOST) {
-                    if (STREQ(cap->data.scsi_host.wwnn, wwnn) &&
-                        STREQ(cap->data.scsi_host.wwpn, wwpn)) {
-
-                        if (virNodeDeviceLookupSCSIHostByWWNEnsureACL(conn, obj->def) < 0)
-                            goto out;
-
-                        if ((dev = virGetNodeDevice(conn, obj->def->name))) {
-                            if (VIR_STRDUP(dev->parent, obj->def->parent) < 0)
-                                virObjectUnref(dev);
-                        }
-                        virNodeDeviceObjUnlock(obj);
-                        goto out;
-                    }
-                }
-            }
-            cap = cap->next;
-        }
+    if (!(obj = virNodeDeviceObjListSearchSCSIHost(driver->devs,
+                                                   nodeDeviceSCSIHostWWNSearcher,
+                                                   &data)))
+        goto out;
 
-        virNodeDeviceObjUnlock(obj);
+    if (virNodeDeviceLookupSCSIHostByWWNEnsureACL(conn, obj->def) < 0)
+        goto out;
+
+    if ((dev = virGetNodeDevice(conn, obj->def->name))) {
+        if (VIR_STRDUP(dev->parent, obj->def->parent) < 0)
+            virObjectUnref(dev);
     }
 
  out:
+    if (obj)
+        virNodeDeviceObjUnlock(obj);
     nodeDeviceUnlock();
     return dev;
 }
@@ -313,7 +323,7 @@ nodeDeviceGetXMLDesc(virNodeDevicePtr dev,
     virCheckFlags(0, NULL);
 
     nodeDeviceLock();
-    obj = virNodeDeviceObjFindByName(&driver->devs, dev->name);
+    obj = virNodeDeviceObjFindByName(driver->devs, dev->name);
     nodeDeviceUnlock();
 
     if (!obj) {
@@ -346,7 +356,7 @@ nodeDeviceGetParent(virNodeDevicePtr dev)
     char *ret = NULL;
 
     nodeDeviceLock();
-    obj = virNodeDeviceObjFindByName(&driver->devs, dev->name);
+    obj = virNodeDeviceObjFindByName(driver->devs, dev->name);
     nodeDeviceUnlock();
 
     if (!obj) {
@@ -383,7 +393,7 @@ nodeDeviceNumOfCaps(virNodeDevicePtr dev)
     int ret = -1;
 
     nodeDeviceLock();
-    obj = virNodeDeviceObjFindByName(&driver->devs, dev->name);
+    obj = virNodeDeviceObjFindByName(driver->devs, dev->name);
     nodeDeviceUnlock();
 
     if (!obj) {
@@ -428,7 +438,7 @@ nodeDeviceListCaps(virNodeDevicePtr dev, char **const names, int maxnames)
     int ret = -1;
 
     nodeDeviceLock();
-    obj = virNodeDeviceObjFindByName(&driver->devs, dev->name);
+    obj = virNodeDeviceObjFindByName(driver->devs, dev->name);
     nodeDeviceUnlock();
 
     if (!obj) {
@@ -566,7 +576,7 @@ nodeDeviceCreateXML(virConnectPtr conn,
     if (virNodeDeviceGetWWNs(def, &wwnn, &wwpn) == -1)
         goto cleanup;
 
-    if ((parent_host = virNodeDeviceObjGetParentHost(&driver->devs, def,
+    if ((parent_host = virNodeDeviceObjGetParentHost(driver->devs, def,
                                                      CREATE_DEVICE)) < 0)
         goto cleanup;
 
@@ -601,7 +611,7 @@ nodeDeviceDestroy(virNodeDevicePtr dev)
     int parent_host = -1;
 
     nodeDeviceLock();
-    if (!(obj = virNodeDeviceObjFindByName(&driver->devs, dev->name))) {
+    if (!(obj = virNodeDeviceObjFindByName(driver->devs, dev->name))) {
         virReportError(VIR_ERR_NO_NODE_DEVICE,
                        _("no node device with matching name '%s'"),
                        dev->name);
@@ -621,7 +631,7 @@ nodeDeviceDestroy(virNodeDevicePtr dev)
     def = obj->def;
     virNodeDeviceObjUnlock(obj);
     obj = NULL;
-    if ((parent_host = virNodeDeviceObjGetParentHost(&driver->devs, def,
+    if ((parent_host = virNodeDeviceObjGetParentHost(driver->devs, def,
                                                      EXISTING_DEVICE)) < 0)
         goto cleanup;
 
@@ -493,7 +493,7 @@ dev_create(const char *udi)
     /* Some devices don't have a path in sysfs, so ignore failure */
     (void)get_str_prop(ctx, udi, "linux.sysfs_path", &devicePath);
 
-    dev = virNodeDeviceObjAssignDef(&driver->devs, def);
+    dev = virNodeDeviceObjAssignDef(driver->devs, def);
     if (!dev) {
         VIR_FREE(devicePath);
         goto failure;
@@ -523,12 +523,12 @@ dev_refresh(const char *udi)
     virNodeDeviceObjPtr dev;
 
     nodeDeviceLock();
-    dev = virNodeDeviceObjFindByName(&driver->devs, name);
+    dev = virNodeDeviceObjFindByName(driver->devs, name);
     if (dev) {
         /* Simply "rediscover" device -- incrementally handling changes
          * to sub-capabilities (like net.80203) is nasty ... so avoid it.
          */
-        virNodeDeviceObjRemove(&driver->devs, &dev);
+        virNodeDeviceObjRemove(driver->devs, &dev);
     } else {
         VIR_DEBUG("no device named %s", name);
     }
@@ -555,10 +555,10 @@ device_removed(LibHalContext *ctx ATTRIBUTE_UNUSED,
     virNodeDeviceObjPtr dev;
 
     nodeDeviceLock();
-    dev = virNodeDeviceObjFindByName(&driver->devs, name);
+    dev = virNodeDeviceObjFindByName(driver->devs, name);
     VIR_DEBUG("%s", name);
     if (dev)
-        virNodeDeviceObjRemove(&driver->devs, &dev);
+        virNodeDeviceObjRemove(driver->devs, &dev);
     else
         VIR_DEBUG("no device named %s", name);
     nodeDeviceUnlock();
@@ -573,7 +573,7 @@ device_cap_added(LibHalContext *ctx,
     virNodeDeviceObjPtr dev;
 
     nodeDeviceLock();
-    dev = virNodeDeviceObjFindByName(&driver->devs, name);
+    dev = virNodeDeviceObjFindByName(driver->devs, name);
     nodeDeviceUnlock();
     VIR_DEBUG("%s %s", cap, name);
     if (dev) {
@@ -638,6 +638,9 @@ nodeStateInitialize(bool privileged ATTRIBUTE_UNUSED,
     nodeDeviceLock();
 
     dbus_error_init(&err);
+    if (!(driver->devs = virNodeDeviceObjListNew()))
+        goto failure;
+
     if (!(sysbus = virDBusGetSystemBus())) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("DBus not available, disabling HAL driver: %s"),
@@ -711,7 +714,7 @@ nodeStateInitialize(bool privileged ATTRIBUTE_UNUSED,
                        _("%s: %s"), err.name, err.message);
         dbus_error_free(&err);
     }
-    virNodeDeviceObjListFree(&driver->devs);
+    virNodeDeviceObjListFree(driver->devs);
     if (hal_ctx)
         (void)libhal_ctx_free(hal_ctx);
     nodeDeviceUnlock();
@@ -727,7 +730,7 @@ nodeStateCleanup(void)
     if (driver) {
         nodeDeviceLock();
         LibHalContext *hal_ctx = DRV_STATE_HAL_CTX(driver);
-        virNodeDeviceObjListFree(&driver->devs);
+        virNodeDeviceObjListFree(driver->devs);
         (void)libhal_ctx_shutdown(hal_ctx, NULL);
         (void)libhal_ctx_free(hal_ctx);
         nodeDeviceUnlock();
@@ -751,7 +754,11 @@ nodeStateReload(void)
     VIR_INFO("Reloading HAL device state");
     nodeDeviceLock();
     VIR_INFO("Removing existing objects");
-    virNodeDeviceObjListFree(&driver->devs);
+    virNodeDeviceObjListFree(driver->devs);
+    if (!(driver->devs = virNodeDeviceObjListNew())) {
+        nodeDeviceUnlock();
+        return -1;
+    }
     nodeDeviceUnlock();
 
     hal_ctx = DRV_STATE_HAL_CTX(driver);
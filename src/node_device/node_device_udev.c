@@ -25,6 +25,7 @@
 #include <pciaccess.h>
 #include <scsi/scsi.h>
 #include <c-ctype.h>
+#include <unistd.h>
 
 #include "dirname.h"
 #include "node_device_conf.h"
@@ -43,6 +44,8 @@
 #include "virpci.h"
 #include "virstring.h"
 #include "virnetdev.h"
+#include "virhash.h"
+#include "virhosttopology.h"
 
 #define VIR_FROM_THIS VIR_FROM_NODEDEV
 
@@ -52,10 +55,36 @@ VIR_LOG_INIT("node_device.node_device_udev");
 # define TYPE_RAID 12
 #endif
 
+/* Upper bound of events handled in one go */
+#define UDEV_EVENT_BATCH_MAX 1024
+
+/* How long to wait for more events to arrive before handling what
+ * has been read off the monitor so far, in milliseconds */
+#define UDEV_EVENT_BATCH_DELAY 20
+
 struct _udevPrivate {
     struct udev_monitor *udev_monitor;
     int watch;
     bool privileged;
+
+    /* The event loop only wakes up the handler thread, which reads
+     * the events off the monitor and processes them in batches */
+    virMutex lock;
+    virCond threadCond;
+    virThread thread;
+    bool threadStarted;
+    bool threadQuit;
+    bool dataReady;
+};
+
+typedef struct _udevEventBatch udevEventBatch;
+typedef udevEventBatch *udevEventBatchPtr;
+struct _udevEventBatch {
+    struct udev_device **devices;
+    size_t ndevices;
+
+    /* syspath -> position in @devices + 1 */
+    virHashTablePtr index;
 };
 
 
@@ -1079,7 +1108,7 @@ static int udevRemoveOneDevice(struct udev_device *device)
     int ret = -1;
 
     name = udev_device_get_syspath(device);
-    dev = virNodeDeviceObjFindBySysfsPath(&driver->devs, name);
+    dev = virNodeDeviceObjFindBySysfsPath(driver->devs, name);
 
     if (!dev) {
         VIR_DEBUG("Failed to find device to remove that has udev name '%s'",
@@ -1093,7 +1122,7 @@ static int udevRemoveOneDevice(struct udev_device *device)
 
     VIR_DEBUG("Removing device '%s' with sysfs path '%s'",
               dev->def->name, name);
-    virNodeDeviceObjRemove(&driver->devs, &dev);
+    virNodeDeviceObjRemove(driver->devs, &dev);
 
     ret = 0;
  cleanup:
@@ -1126,7 +1155,7 @@ static int udevSetParent(struct udev_device *device,
             goto cleanup;
         }
 
-        dev = virNodeDeviceObjFindBySysfsPath(&driver->devs,
+        dev = virNodeDeviceObjFindBySysfsPath(driver->devs,
                                               parent_sysfs_path);
         if (dev != NULL) {
             if (VIR_STRDUP(def->parent, dev->def->name) < 0) {
@@ -1183,7 +1212,7 @@ static int udevAddOneDevice(struct udev_device *device)
     if (udevSetParent(device, def) != 0)
         goto cleanup;
 
-    dev = virNodeDeviceObjFindByName(&driver->devs, def->name);
+    dev = virNodeDeviceObjFindByName(driver->devs, def->name);
     if (dev) {
         virNodeDeviceObjUnlock(dev);
         new_device = false;
@@ -1191,7 +1220,7 @@ static int udevAddOneDevice(struct udev_device *device)
 
     /* If this is a device change, the old definition will be freed
      * and the current definition will take its place. */
-    dev = virNodeDeviceObjAssignDef(&driver->devs, def);
+    dev = virNodeDeviceObjAssignDef(driver->devs, def);
     if (dev == NULL)
         goto cleanup;
 
@@ -1310,6 +1339,17 @@ static void udevPCITranslateDeinit(void)
 }
 
 
+static void udevPrivateFree(udevPrivate *priv)
+{
+    if (!priv)
+        return;
+
+    virCondDestroy(&priv->threadCond);
+    virMutexDestroy(&priv->lock);
+    VIR_FREE(priv);
+}
+
+
 static int nodeStateCleanup(void)
 {
     udevPrivate *priv = NULL;
@@ -1319,12 +1359,23 @@ static int nodeStateCleanup(void)
     if (!driver)
         return -1;
 
+    priv = driver->privateData;
+
+    virPCITopologyEnableCache(false);
+
+    /* The handler thread needs the driver lock to finish its batch */
+    if (priv && priv->threadStarted) {
+        virMutexLock(&priv->lock);
+        priv->threadQuit = true;
+        virCondSignal(&priv->threadCond);
+        virMutexUnlock(&priv->lock);
+        virThreadJoin(&priv->thread);
+    }
+
     nodeDeviceLock();
 
     virObjectUnref(driver->nodeDeviceEventState);
 
-    priv = driver->privateData;
-
     if (priv) {
         if (priv->watch != -1)
             virEventRemoveHandle(priv->watch);
@@ -1340,61 +1391,186 @@ static int nodeStateCleanup(void)
     if (udev != NULL)
         udev_unref(udev);
 
-    virNodeDeviceObjListFree(&driver->devs);
+    virNodeDeviceObjListFree(driver->devs);
     nodeDeviceUnlock();
     virMutexDestroy(&driver->lock);
     VIR_FREE(driver);
-    VIR_FREE(priv);
+    udevPrivateFree(priv);
 
     udevPCITranslateDeinit();
     return 0;
 }
 
 
-static void udevEventHandleCallback(int watch ATTRIBUTE_UNUSED,
+static void udevHandleOneDevice(struct udev_device *device)
+{
+    const char *action = udev_device_get_action(device);
+    const char *subsystem = udev_device_get_subsystem(device);
+
+    VIR_DEBUG("udev action: '%s'", action);
+
+    /* CPU, memory and NUMA node hotplug change the host topology */
+    if (STREQ_NULLABLE(subsystem, "cpu") ||
+        STREQ_NULLABLE(subsystem, "memory") ||
+        STREQ_NULLABLE(subsystem, "node"))
+        virHostTopologyInvalidate();
+
+    /* Binding drivers, which hostdev assignment does all the time,
+     * doesn't change the PCI topology but adding and removing devices,
+     * including VFs, does */
+    if (STREQ_NULLABLE(subsystem, "pci") &&
+        (STREQ(action, "add") || STREQ(action, "remove")))
+        virPCITopologyInvalidate();
+
+    if (STREQ(action, "add") || STREQ(action, "change"))
+        udevAddOneDevice(device);
+    else if (STREQ(action, "remove"))
+        udevRemoveOneDevice(device);
+}
+
+
+static void udevEventBatchAdd(udevEventBatchPtr batch,
+                              struct udev_device *device)
+{
+    const char *syspath = udev_device_get_syspath(device);
+    size_t pos;
+
+    /* Either way the device is read from scratch or removed, so the
+     * last event received for a syspath supersedes any earlier one */
+    if (syspath &&
+        (pos = (uintptr_t) virHashLookup(batch->index, syspath)) > 0) {
+        VIR_DEBUG("Coalescing udev '%s' event for '%s'",
+                  udev_device_get_action(device), syspath);
+        udev_device_unref(batch->devices[pos - 1]);
+        batch->devices[pos - 1] = device;
+        return;
+    }
+
+    if (VIR_APPEND_ELEMENT(batch->devices, batch->ndevices, device) < 0) {
+        udev_device_unref(device);
+        return;
+    }
+
+    /* Failing to index the event only means no coalescing for it */
+    if (syspath)
+        ignore_value(virHashAddEntry(batch->index, syspath,
+                                     (void *) (uintptr_t) batch->ndevices));
+}
+
+
+/* Read whatever is pending on the monitor, returns how many events
+ * were received */
+static size_t udevEventBatchReceive(struct udev_monitor *udev_monitor,
+                                    udevEventBatchPtr batch)
+{
+    struct udev_device *device;
+    size_t received = 0;
+
+    while (received < UDEV_EVENT_BATCH_MAX &&
+           (device = udev_monitor_receive_device(udev_monitor))) {
+        udevEventBatchAdd(batch, device);
+        received++;
+    }
+
+    return received;
+}
+
+
+static void udevEventBatchClear(udevEventBatchPtr batch)
+{
+    size_t i;
+
+    for (i = 0; i < batch->ndevices; i++)
+        udev_device_unref(batch->devices[i]);
+    VIR_FREE(batch->devices);
+    batch->ndevices = 0;
+    virHashRemoveAll(batch->index);
+}
+
+
+static void udevEventHandleThread(void *opaque ATTRIBUTE_UNUSED)
+{
+    udevPrivate *priv = driver->privateData;
+    struct udev_monitor *udev_monitor = DRV_STATE_UDEV_MONITOR(driver);
+    udevEventBatch batch = { NULL, 0, NULL };
+    size_t i;
+
+    /* Without the index events are still handled, just not coalesced */
+    batch.index = virHashCreate(UDEV_EVENT_BATCH_MAX, NULL);
+
+    while (true) {
+        virMutexLock(&priv->lock);
+        while (!priv->dataReady && !priv->threadQuit) {
+            if (virCondWait(&priv->threadCond, &priv->lock) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("udev handler failed to wait on "
+                                       "condition"));
+                virMutexUnlock(&priv->lock);
+                goto cleanup;
+            }
+        }
+
+        if (priv->threadQuit) {
+            virMutexUnlock(&priv->lock);
+            break;
+        }
+
+        priv->dataReady = false;
+        virMutexUnlock(&priv->lock);
+
+        /* Keep reading for as long as events keep coming so that a
+         * storm of them, e.g. when creating lots of VFs, gets handled
+         * in a few batches rather than one event at a time */
+        while (udevEventBatchReceive(udev_monitor, &batch) > 0 &&
+               batch.ndevices < UDEV_EVENT_BATCH_MAX)
+            usleep(UDEV_EVENT_BATCH_DELAY * 1000);
+
+        /* The monitor has been drained, let the event loop tell us
+         * about new data again */
+        virEventUpdateHandle(priv->watch, VIR_EVENT_HANDLE_READABLE);
+
+        VIR_DEBUG("Handling a batch of %zu udev events", batch.ndevices);
+
+        nodeDeviceLock();
+        for (i = 0; i < batch.ndevices; i++)
+            udevHandleOneDevice(batch.devices[i]);
+        nodeDeviceUnlock();
+
+        udevEventBatchClear(&batch);
+    }
+
+ cleanup:
+    udevEventBatchClear(&batch);
+    virHashFree(batch.index);
+}
+
+
+static void udevEventHandleCallback(int watch,
                                     int fd,
                                     int events ATTRIBUTE_UNUSED,
                                     void *data ATTRIBUTE_UNUSED)
 {
-    struct udev_device *device = NULL;
+    udevPrivate *priv = driver->privateData;
     struct udev_monitor *udev_monitor = DRV_STATE_UDEV_MONITOR(driver);
-    const char *action = NULL;
     int udev_fd = -1;
 
-    nodeDeviceLock();
     udev_fd = udev_monitor_get_fd(udev_monitor);
     if (fd != udev_fd) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("File descriptor returned by udev %d does not "
                          "match node device file descriptor %d"),
                        fd, udev_fd);
-        goto cleanup;
+        return;
     }
 
-    device = udev_monitor_receive_device(udev_monitor);
-    if (device == NULL) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("udev_monitor_receive_device returned NULL"));
-        goto cleanup;
-    }
+    /* Stop watching the monitor until the handler thread has read
+     * everything off it, otherwise we'd be woken up right away again */
+    virEventUpdateHandle(watch, 0);
 
-    action = udev_device_get_action(device);
-    VIR_DEBUG("udev action: '%s'", action);
-
-    if (STREQ(action, "add") || STREQ(action, "change")) {
-        udevAddOneDevice(device);
-        goto cleanup;
-    }
-
-    if (STREQ(action, "remove")) {
-        udevRemoveOneDevice(device);
-        goto cleanup;
-    }
-
- cleanup:
-    udev_device_unref(device);
-    nodeDeviceUnlock();
-    return;
+    virMutexLock(&priv->lock);
+    priv->dataReady = true;
+    virCondSignal(&priv->threadCond);
+    virMutexUnlock(&priv->lock);
 }
 
 
@@ -1474,7 +1650,7 @@ static int udevSetupSystemDev(void)
     udevGetDMIData(&def->caps->data.system);
 #endif
 
-    dev = virNodeDeviceObjAssignDef(&driver->devs, def);
+    dev = virNodeDeviceObjAssignDef(driver->devs, def);
     if (dev == NULL)
         goto cleanup;
 
@@ -1522,24 +1698,43 @@ static int nodeStateInitialize(bool privileged,
     if (VIR_ALLOC(priv) < 0)
         return -1;
 
+    if (virMutexInit(&priv->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        VIR_FREE(priv);
+        return -1;
+    }
+
+    if (virCondInit(&priv->threadCond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition variable"));
+        virMutexDestroy(&priv->lock);
+        VIR_FREE(priv);
+        return -1;
+    }
+
     priv->watch = -1;
     priv->privileged = privileged;
 
     if (VIR_ALLOC(driver) < 0) {
-        VIR_FREE(priv);
+        udevPrivateFree(priv);
         return -1;
     }
 
     if (virMutexInit(&driver->lock) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Unable to initialize mutex"));
-        VIR_FREE(priv);
+        udevPrivateFree(priv);
         VIR_FREE(driver);
         return -1;
     }
 
     driver->privateData = priv;
     nodeDeviceLock();
+
+    if (!(driver->devs = virNodeDeviceObjListNew()))
+        goto cleanup;
+
     driver->nodeDeviceEventState = virObjectEventStateNew();
 
     if (udevPCITranslateInit(privileged) < 0)
@@ -1579,6 +1774,16 @@ static int nodeStateInitialize(bool privileged,
     if (priv->watch == -1)
         goto cleanup;
 
+    /* From now on we learn about all PCI hotplug */
+    virPCITopologyEnableCache(true);
+
+    if (virThreadCreate(&priv->thread, true, udevEventHandleThread, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to create udev handler thread"));
+        goto cleanup;
+    }
+    priv->threadStarted = true;
+
     /* Create a fictional 'computer' device to root the device tree. */
     if (udevSetupSystemDev() != 0)
         goto cleanup;
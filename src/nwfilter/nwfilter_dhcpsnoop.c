@@ -80,18 +80,39 @@ VIR_LOG_INIT("nwfilter.nwfilter_dhcpsnoop");
 # define LEASEFILE LEASEFILE_DIR "nwfilter.leases"
 # define TMPLEASEFILE LEASEFILE_DIR "nwfilter.ltmp"
 
+/*
+ * All interfaces are served by a single capture thread. The decoding of
+ * the packets and the instantiation of the rules is spread over a few
+ * workers; an interface always uses the same worker so that its packets
+ * are processed in order.
+ */
+# define SNOOP_DECODE_WORKERS   4
+
+typedef struct _virNWFilterSnoopCapture virNWFilterSnoopCapture;
+typedef virNWFilterSnoopCapture *virNWFilterSnoopCapturePtr;
+
 struct virNWFilterSnoopState {
     /* lease file */
     int                  leaseFD;
     int                  nLeases; /* number of active leases */
     int                  wLeases; /* number of written leases */
-    int                  nThreads; /* number of running threads */
+    int                  nThreads; /* number of snooped interfaces */
     /* thread management */
     virHashTablePtr      snoopReqs;
     virHashTablePtr      ifnameToKey;
     virMutex             snoopLock;  /* protects SnoopReqs and IfNameToKey */
     virHashTablePtr      active;
     virMutex             activeLock; /* protects Active */
+    /* shared capture thread, started with the first snooped interface */
+    bool                 captureRunning;
+    virThread            captureThread;
+    int                  wakeupFD[2];
+    virThreadPoolPtr     decodeWorkers[SNOOP_DECODE_WORKERS];
+    size_t               nextWorker;
+    virNWFilterSnoopCapturePtr *captures;
+    size_t               ncaptures;
+    bool                 captureQuit;
+    virMutex             captureLock; /* protects Captures and CaptureQuit */
 };
 
 # define virNWFilterSnoopLock() \
@@ -119,12 +140,6 @@ typedef virNWFilterSnoopReq *virNWFilterSnoopReqPtr;
 typedef struct _virNWFilterSnoopIPLease virNWFilterSnoopIPLease;
 typedef virNWFilterSnoopIPLease *virNWFilterSnoopIPLeasePtr;
 
-typedef enum {
-    THREAD_STATUS_NONE,
-    THREAD_STATUS_OK,
-    THREAD_STATUS_FAIL,
-} virNWFilterSnoopThreadStatus;
-
 struct _virNWFilterSnoopReq {
     /*
      * reference counter: while the req is on the
@@ -147,9 +162,6 @@ struct _virNWFilterSnoopReq {
     virNWFilterSnoopIPLeasePtr           end;
     char                                *threadkey;
 
-    virNWFilterSnoopThreadStatus         threadStatus;
-    virCond                              threadStatusCond;
-
     int                                  jobCompletionStatus;
     /* the number of submitted jobs in the worker's queue */
     /*
@@ -161,7 +173,6 @@ struct _virNWFilterSnoopReq {
      * - start
      * - end
      * - a lease while it is on the list
-     * - threadStatus
      * (for refctr, see above)
      */
     virMutex                             lock;
@@ -244,6 +255,7 @@ struct _virNWFilterDHCPDecodeJob {
     unsigned char packet[PCAP_PBUFSIZE];
     int caplen;
     bool fromVM;
+    virNWFilterSnoopReqPtr req;
     int *qCtr;
 };
 
@@ -285,6 +297,45 @@ struct _virNWFilterSnoopPcapConf {
     unsigned long long penaltyTimeoutAbs;
 };
 
+/*
+ * The state of the capture on one interface. It is owned by the capture
+ * thread once it has been handed over by virNWFilterSnoopCaptureAdd().
+ */
+struct _virNWFilterSnoopCapture {
+    virNWFilterSnoopReqPtr req; /* holds a reference */
+    char *threadkey;
+    int ifindex;
+    int errcount;
+    size_t worker; /* index into the decodeWorkers */
+    /* the handles are closed, waiting for the queued jobs to finish */
+    bool done;
+    time_t lastDisplayed;
+    time_t lastDisplayedQueue;
+    virNWFilterSnoopPcapConf pcapConf[2]; /* see the template below */
+};
+
+static const virNWFilterSnoopPcapConf virNWFilterSnoopPcapConfTemplate[] = {
+    {
+        .dir = PCAP_D_IN, /* from VM */
+        .filter = "dst port 67 and src port 68",
+        .rateLimit = {
+            .rate = DHCP_PKT_RATE,
+            .burstRate = DHCP_PKT_BURST,
+            .burstInterval = DHCP_BURST_INTERVAL_S,
+        },
+        .maxQSize = MAX_QUEUED_JOBS,
+    }, {
+        .dir = PCAP_D_OUT, /* to VM */
+        .filter = "src port 67 and dst port 68",
+        .rateLimit = {
+            .rate = DHCP_PKT_RATE,
+            .burstRate = DHCP_PKT_BURST,
+            .burstInterval = DHCP_BURST_INTERVAL_S,
+        },
+        .maxQSize = MAX_QUEUED_JOBS,
+    },
+};
+
 /* local function prototypes */
 static int virNWFilterSnoopReqLeaseDel(virNWFilterSnoopReqPtr req,
                                        virSocketAddrPtr ipaddr,
@@ -300,6 +351,7 @@ static void virNWFilterSnoopLeaseFileSave(virNWFilterSnoopIPLeasePtr ipl);
 /* local variables */
 static struct virNWFilterSnoopState virNWFilterSnoopState = {
     .leaseFD = -1,
+    .wakeupFD = { -1, -1 },
 };
 
 static const unsigned char dhcp_magic[4] = { 99, 130, 83, 99 };
@@ -589,22 +641,14 @@ virNWFilterSnoopReqNew(const char *ifkey)
     if (VIR_ALLOC(req) < 0)
         return NULL;
 
-    req->threadStatus = THREAD_STATUS_NONE;
-
     if (virStrcpyStatic(req->ifkey, ifkey) == NULL ||
         virMutexInitRecursive(&req->lock) < 0)
         goto err_free_req;
 
-    if (virCondInit(&req->threadStatusCond) < 0)
-        goto err_destroy_mutex;
-
     virNWFilterSnoopReqGet(req);
 
     return req;
 
- err_destroy_mutex:
-    virMutexDestroy(&req->lock);
-
  err_free_req:
     VIR_FREE(req);
 
@@ -638,7 +682,6 @@ virNWFilterSnoopReqFree(virNWFilterSnoopReqPtr req)
     virNWFilterHashTableFree(req->vars);
 
     virMutexDestroy(&req->lock);
-    virCondDestroy(&req->threadStatusCond);
 
     VIR_FREE(req);
 }
@@ -1159,10 +1202,11 @@ virNWFilterSnoopDHCPOpen(const char *ifname, virMacAddr *mac,
  * Worker function to decode the DHCP message and with that
  * also do the time-consuming work of instantiating the filters
  */
-static void virNWFilterDHCPDecodeWorker(void *jobdata, void *opaque)
+static void virNWFilterDHCPDecodeWorker(void *jobdata,
+                                        void *opaque ATTRIBUTE_UNUSED)
 {
-    virNWFilterSnoopReqPtr req = opaque;
     virNWFilterDHCPDecodeJobPtr job = jobdata;
+    virNWFilterSnoopReqPtr req = job->req;
     virNWFilterSnoopEthHdrPtr packet = (virNWFilterSnoopEthHdrPtr)job->packet;
 
     if (virNWFilterSnoopDHCPDecode(req, packet,
@@ -1182,6 +1226,7 @@ static void virNWFilterDHCPDecodeWorker(void *jobdata, void *opaque)
  */
 static int
 virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPoolPtr pool,
+                                    virNWFilterSnoopReqPtr req,
                                     virNWFilterSnoopEthHdrPtr pep,
                                     int len, pcap_direction_t dir,
                                     int *qCtr)
@@ -1198,6 +1243,7 @@ virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPoolPtr pool,
     memcpy(job->packet, pep, len);
     job->caplen = len;
     job->fromVM = (dir == PCAP_D_IN);
+    job->req = req;
     job->qCtr = qCtr;
 
     ret = virThreadPoolSendJob(pool, 0, job);
@@ -1328,251 +1374,483 @@ virNWFilterSnoopAdjustPoll(virNWFilterSnoopPcapConfPtr pc,
 }
 
 /*
- * The DHCP snooping thread. It spends most of its time in the pcap
- * library and if it gets suitable packets, it submits them to the worker
- * thread for processing.
+ * Wake up the capture thread so that it picks up added interfaces
+ * and notices cancelled ones.
  */
 static void
-virNWFilterDHCPSnoopThread(void *req0)
+virNWFilterSnoopCaptureWakeup(void)
 {
-    virNWFilterSnoopReqPtr req = req0;
-    struct pcap_pkthdr *hdr;
-    virNWFilterSnoopEthHdrPtr packet;
-    int ifindex = 0;
-    int errcount = 0;
-    int tmp = -1, rv, n, pollTo;
+    char c = 0;
+
+    if (virNWFilterSnoopState.wakeupFD[1] >= 0)
+        ignore_value(safewrite(virNWFilterSnoopState.wakeupFD[1], &c, 1));
+}
+
+/*
+ * Hand over the snooping of the interface of the given request to the
+ * capture thread. The caller must hold the lock of the req and must
+ * have activated it. On success the capture takes over the caller's
+ * reference to the req.
+ */
+static int
+virNWFilterSnoopCaptureAdd(virNWFilterSnoopReqPtr req)
+{
+    virNWFilterSnoopCapturePtr capture;
     size_t i;
-    char *threadkey = NULL;
-    virThreadPoolPtr worker = NULL;
-    time_t last_displayed = 0, last_displayed_queue = 0;
-    virNWFilterSnoopPcapConf pcapConf[] = {
-        {
-            .dir = PCAP_D_IN, /* from VM */
-            .filter = "dst port 67 and src port 68",
-            .rateLimit = {
-                .prev = time(0),
-                .rate = DHCP_PKT_RATE,
-                .burstRate = DHCP_PKT_BURST,
-                .burstInterval = DHCP_BURST_INTERVAL_S,
-            },
-            .maxQSize = MAX_QUEUED_JOBS,
-        }, {
-            .dir = PCAP_D_OUT, /* to VM */
-            .filter = "src port 67 and dst port 68",
-            .rateLimit = {
-                .prev = time(0),
-                .rate = DHCP_PKT_RATE,
-                .burstRate = DHCP_PKT_BURST,
-                .burstInterval = DHCP_BURST_INTERVAL_S,
-            },
-            .maxQSize = MAX_QUEUED_JOBS,
-        },
-    };
-    struct pollfd fds[] = {
-        {
-            /* get a POLLERR if interface goes down or disappears */
-            .events = POLLIN | POLLERR,
-        }, {
-            .events = POLLIN | POLLERR,
-        },
-    };
-    bool error = false;
 
-    /* whoever started us increased the reference counter for the req for us */
+    if (VIR_ALLOC(capture) < 0)
+        return -1;
 
-    /* protect req->ifname & req->threadkey */
-    virNWFilterSnoopReqLock(req);
+    memcpy(capture->pcapConf, virNWFilterSnoopPcapConfTemplate,
+           sizeof(capture->pcapConf));
+
+    for (i = 0; i < ARRAY_CARDINALITY(capture->pcapConf); i++) {
+        capture->pcapConf[i].rateLimit.prev = time(0);
+        capture->pcapConf[i].handle =
+            virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
+                                     capture->pcapConf[i].filter,
+                                     capture->pcapConf[i].dir);
+        if (!capture->pcapConf[i].handle)
+            goto error;
+    }
 
-    if (req->ifname && req->threadkey) {
-        for (i = 0; i < ARRAY_CARDINALITY(pcapConf); i++) {
-            pcapConf[i].handle =
-                virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
-                                         pcapConf[i].filter,
-                                         pcapConf[i].dir);
-            if (!pcapConf[i].handle) {
-                error = true;
-                break;
-            }
-            fds[i].fd = pcap_fileno(pcapConf[i].handle);
+    if (virNetDevGetIndex(req->ifname, &capture->ifindex) < 0 ||
+        capture->ifindex != req->ifindex ||
+        VIR_STRDUP(capture->threadkey, req->threadkey) < 0)
+        goto error;
+
+    capture->req = req;
+
+    virMutexLock(&virNWFilterSnoopState.captureLock);
+
+    capture->worker = virNWFilterSnoopState.nextWorker++ %
+                      SNOOP_DECODE_WORKERS;
+
+    if (VIR_APPEND_ELEMENT(virNWFilterSnoopState.captures,
+                           virNWFilterSnoopState.ncaptures, capture) < 0) {
+        virMutexUnlock(&virNWFilterSnoopState.captureLock);
+        goto error;
+    }
+
+    virMutexUnlock(&virNWFilterSnoopState.captureLock);
+
+    virAtomicIntInc(&virNWFilterSnoopState.nThreads);
+
+    virNWFilterSnoopCaptureWakeup();
+
+    return 0;
+
+ error:
+    for (i = 0; i < ARRAY_CARDINALITY(capture->pcapConf); i++) {
+        if (capture->pcapConf[i].handle)
+            pcap_close(capture->pcapConf[i].handle);
+    }
+    VIR_FREE(capture->threadkey);
+    VIR_FREE(capture);
+
+    return -1;
+}
+
+/*
+ * Stop capturing on an interface. With @error the interface is also
+ * disassociated from its req. The capture itself is only freed by
+ * virNWFilterSnoopCaptureFree() once its queued jobs are done.
+ */
+static void
+virNWFilterSnoopCaptureDone(virNWFilterSnoopCapturePtr capture, bool error)
+{
+    virNWFilterSnoopReqPtr req = capture->req;
+    size_t i;
+
+    if (error) {
+        /* protect IfNameToKey */
+        virNWFilterSnoopLock();
+
+        /* protect req->ifname & req->threadkey */
+        virNWFilterSnoopReqLock(req);
+
+        virNWFilterSnoopCancel(&req->threadkey);
+
+        ignore_value(virHashRemoveEntry(virNWFilterSnoopState.ifnameToKey,
+                                        req->ifname));
+
+        VIR_FREE(req->ifname);
+
+        virNWFilterSnoopReqUnlock(req);
+        virNWFilterSnoopUnlock();
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(capture->pcapConf); i++) {
+        if (capture->pcapConf[i].handle) {
+            pcap_close(capture->pcapConf[i].handle);
+            capture->pcapConf[i].handle = NULL;
         }
-        tmp = virNetDevGetIndex(req->ifname, &ifindex);
-        ignore_value(VIR_STRDUP(threadkey, req->threadkey));
-        worker = virThreadPoolNew(1, 1, 0,
-                                  virNWFilterDHCPDecodeWorker,
-                                  req);
     }
 
-    /* let creator know how well we initialized */
-    if (error || !threadkey || tmp < 0 || !worker ||
-        ifindex != req->ifindex)
-        req->threadStatus = THREAD_STATUS_FAIL;
-    else
-        req->threadStatus = THREAD_STATUS_OK;
+    capture->done = true;
+}
 
-    virCondSignal(&req->threadStatusCond);
+static bool
+virNWFilterSnoopCaptureIsIdle(virNWFilterSnoopCapturePtr capture)
+{
+    size_t i;
 
-    virNWFilterSnoopReqUnlock(req);
+    for (i = 0; i < ARRAY_CARDINALITY(capture->pcapConf); i++) {
+        if (virAtomicIntGet(&capture->pcapConf[i].qCtr) != 0)
+            return false;
+    }
 
-    if (req->threadStatus != THREAD_STATUS_OK)
-        goto exit;
+    return true;
+}
 
-    while (!error) {
-        if (virNWFilterSnoopAdjustPoll(pcapConf,
-                                       ARRAY_CARDINALITY(pcapConf),
-                                       fds, &pollTo) < 0) {
+/*
+ * Remove a finished capture from the list of the capture thread
+ * and release it along with its reference to the req.
+ */
+static void
+virNWFilterSnoopCaptureFree(virNWFilterSnoopCapturePtr capture)
+{
+    size_t i;
+
+    virMutexLock(&virNWFilterSnoopState.captureLock);
+
+    for (i = 0; i < virNWFilterSnoopState.ncaptures; i++) {
+        if (virNWFilterSnoopState.captures[i] == capture) {
+            VIR_DELETE_ELEMENT(virNWFilterSnoopState.captures, i,
+                               virNWFilterSnoopState.ncaptures);
             break;
         }
+    }
 
-        /* cap pollTo so we don't hold up the join for too long */
-        if (pollTo < 0 || pollTo > SNOOP_POLL_MAX_TIMEOUT_MS)
-            pollTo = SNOOP_POLL_MAX_TIMEOUT_MS;
+    virMutexUnlock(&virNWFilterSnoopState.captureLock);
 
-        n = poll(fds, ARRAY_CARDINALITY(fds), pollTo);
+    virNWFilterSnoopReqPut(capture->req);
 
-        if (n < 0) {
-            if (errno != EAGAIN && errno != EINTR)
-                error = true;
-        }
+    VIR_FREE(capture->threadkey);
+    VIR_FREE(capture);
 
-        virNWFilterSnoopReqLeaseTimerRun(req);
+    virAtomicIntDecAndTest(&virNWFilterSnoopState.nThreads);
+}
 
-        /*
-         * Check whether we were cancelled or whether
-         * a previously submitted job failed.
-         */
-        if (!virNWFilterSnoopIsActive(threadkey) ||
-            req->jobCompletionStatus != 0)
-            goto exit;
+/*
+ * Read the pending packets of one interface and submit them to its
+ * decode worker.
+ *
+ * Returns 0 on success, -1 if capturing on the interface has to be
+ * stopped.
+ */
+static int
+virNWFilterSnoopCaptureRead(virNWFilterSnoopCapturePtr capture,
+                            struct pollfd *fds)
+{
+    virNWFilterSnoopReqPtr req = capture->req;
+    struct pcap_pkthdr *hdr;
+    virNWFilterSnoopEthHdrPtr packet;
+    int tmp, rv;
+    size_t i;
 
-        for (i = 0; n > 0 && i < ARRAY_CARDINALITY(fds); i++) {
-            if (!fds[i].revents)
-                continue;
+    for (i = 0; i < ARRAY_CARDINALITY(capture->pcapConf); i++) {
+        virNWFilterSnoopPcapConfPtr pc = &capture->pcapConf[i];
+
+        if (!fds[i].revents)
+            continue;
+
+        rv = pcap_next_ex(pc->handle, &hdr, (const u_char **)&packet);
+
+        if (rv < 0) {
+            /* error reading from socket */
+            tmp = -1;
+
+            /* protect req->ifname */
+            virNWFilterSnoopReqLock(req);
 
-            fds[i].revents = 0;
-            n--;
+            if (req->ifname)
+                tmp = virNetDevValidateConfig(req->ifname, NULL,
+                                              capture->ifindex);
 
-            rv = pcap_next_ex(pcapConf[i].handle, &hdr,
-                              (const u_char **)&packet);
+            virNWFilterSnoopReqUnlock(req);
 
-            if (rv < 0) {
-                /* error reading from socket */
-                tmp = -1;
+            if (tmp <= 0)
+                return -1;
+
+            if (++capture->errcount > PCAP_READ_MAXERRS) {
+                pcap_close(pc->handle);
+                pc->handle = NULL;
 
                 /* protect req->ifname */
                 virNWFilterSnoopReqLock(req);
 
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("interface '%s' failing; "
+                                 "reopening"),
+                               req->ifname);
                 if (req->ifname)
-                    tmp = virNetDevValidateConfig(req->ifname, NULL, ifindex);
+                    pc->handle = virNWFilterSnoopDHCPOpen(req->ifname,
+                                                          &req->macaddr,
+                                                          pc->filter,
+                                                          pc->dir);
 
                 virNWFilterSnoopReqUnlock(req);
 
-                if (tmp <= 0) {
-                    error = true;
-                    break;
-                }
+                if (!pc->handle)
+                    return -1;
+            }
+            continue;
+        }
+
+        capture->errcount = 0;
 
-                if (++errcount > PCAP_READ_MAXERRS) {
-                    pcap_close(pcapConf[i].handle);
-                    pcapConf[i].handle = NULL;
-
-                    /* protect req->ifname */
-                    virNWFilterSnoopReqLock(req);
-
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   _("interface '%s' failing; "
-                                     "reopening"),
-                                   req->ifname);
-                    if (req->ifname)
-                        pcapConf[i].handle =
-                            virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
-                                                     pcapConf[i].filter,
-                                                     pcapConf[i].dir);
-
-                    virNWFilterSnoopReqUnlock(req);
-
-                    if (!pcapConf[i].handle) {
-                        error = true;
-                        break;
-                    }
+        if (rv) {
+            unsigned int diff;
+
+            /* submit packet to worker thread */
+            if (virAtomicIntGet(&pc->qCtr) > pc->maxQSize) {
+                if (capture->lastDisplayedQueue - time(0) > 10) {
+                    capture->lastDisplayedQueue = time(0);
+                    VIR_WARN("Worker thread for interface '%s' has a "
+                             "job queue that is too long",
+                             req->ifname);
                 }
                 continue;
             }
 
-            errcount = 0;
-
-            if (rv) {
-                unsigned int diff;
-
-                /* submit packet to worker thread */
-                if (virAtomicIntGet(&pcapConf[i].qCtr) >
-                    pcapConf[i].maxQSize) {
-                    if (last_displayed_queue - time(0) > 10) {
-                        last_displayed_queue = time(0);
-                        VIR_WARN("Worker thread for interface '%s' has a "
-                                 "job queue that is too long",
-                                 req->ifname);
-                    }
-                    continue;
+            diff = virNWFilterSnoopRateLimit(&pc->rateLimit);
+            if (diff > 0) {
+                virNWFilterSnoopRatePenalty(pc, diff, DHCP_PKT_RATE);
+                /* rate-limited warnings */
+                if (time(0) - capture->lastDisplayed > 10) {
+                     capture->lastDisplayed = time(0);
+                     VIR_WARN("Too many DHCP packets on interface '%s'",
+                              req->ifname);
                 }
+                continue;
+            }
 
-                diff = virNWFilterSnoopRateLimit(&pcapConf[i].rateLimit);
-                if (diff > 0) {
-                    virNWFilterSnoopRatePenalty(&pcapConf[i], diff,
-                                                DHCP_PKT_RATE);
-                    /* rate-limited warnings */
-                    if (time(0) - last_displayed > 10) {
-                         last_displayed = time(0);
-                         VIR_WARN("Too many DHCP packets on interface '%s'",
-                                  req->ifname);
-                    }
-                    continue;
-                }
+            if (virNWFilterSnoopDHCPDecodeJobSubmit(
+                    virNWFilterSnoopState.decodeWorkers[capture->worker],
+                    req, packet, hdr->caplen, pc->dir, &pc->qCtr) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Job submission failed on "
+                                 "interface '%s'"), req->ifname);
+                return -1;
+            }
+        }
+    }
 
-                if (virNWFilterSnoopDHCPDecodeJobSubmit(worker, packet,
-                                                      hdr->caplen,
-                                                      pcapConf[i].dir,
-                                                      &pcapConf[i].qCtr) < 0) {
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   _("Job submission failed on "
-                                     "interface '%s'"), req->ifname);
-                    error = true;
-                    break;
-                }
+    return 0;
+}
+
+/*
+ * The DHCP snooping thread. It polls the pcap handles of all snooped
+ * interfaces and if it gets suitable packets, it submits them to the
+ * worker thread of the interface for processing.
+ */
+static void
+virNWFilterDHCPSnoopThread(void *opaque ATTRIBUTE_UNUSED)
+{
+    virNWFilterSnoopCapturePtr *captures = NULL;
+    size_t ncaptures = 0;
+    size_t ncapturesAlloc = 0;
+    struct pollfd *fds = NULL;
+    size_t nfds = 0;
+    size_t nfdsAlloc = 0;
+    const size_t nconf = ARRAY_CARDINALITY(virNWFilterSnoopPcapConfTemplate);
+    size_t i, j;
+    int n, pollTo, tmp;
+    char buf[16];
+    bool error;
+
+    for (;;) {
+        virMutexLock(&virNWFilterSnoopState.captureLock);
+
+        if (virNWFilterSnoopState.captureQuit) {
+            virMutexUnlock(&virNWFilterSnoopState.captureLock);
+            break;
+        }
+
+        ncaptures = virNWFilterSnoopState.ncaptures;
+        nfds = 1 + ncaptures * nconf;
+
+        if (VIR_RESIZE_N(captures, ncapturesAlloc, 0, ncaptures) < 0 ||
+            VIR_RESIZE_N(fds, nfdsAlloc, 0, nfds) < 0) {
+            virMutexUnlock(&virNWFilterSnoopState.captureLock);
+            usleep(PCAP_FLOOD_TIMEOUT_MS * 1000);
+            continue;
+        }
+
+        /* only this thread removes captures from the list */
+        if (ncaptures)
+            memcpy(captures, virNWFilterSnoopState.captures,
+                   ncaptures * sizeof(*captures));
+
+        virMutexUnlock(&virNWFilterSnoopState.captureLock);
+
+        fds[0].fd = virNWFilterSnoopState.wakeupFD[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        pollTo = -1;
+        error = false;
+
+        for (i = 0; i < ncaptures; i++) {
+            virNWFilterSnoopCapturePtr capture = captures[i];
+            struct pollfd *pfd = &fds[1 + i * nconf];
+
+            for (j = 0; j < nconf; j++) {
+                pfd[j].fd = -1;
+                pfd[j].events = POLLIN | POLLERR;
+                pfd[j].revents = 0;
             }
-        } /* for all fds */
-    } /* while (!error) */
 
-    /* protect IfNameToKey */
-    virNWFilterSnoopLock();
+            if (capture->done) {
+                /* check back soon whether its jobs are done */
+                pollTo = PCAP_FLOOD_TIMEOUT_MS;
+                continue;
+            }
 
-    /* protect req->ifname & req->threadkey */
-    virNWFilterSnoopReqLock(req);
+            /* get a POLLERR if interface goes down or disappears */
+            for (j = 0; j < nconf; j++)
+                pfd[j].fd = pcap_fileno(capture->pcapConf[j].handle);
+
+            if (virNWFilterSnoopAdjustPoll(capture->pcapConf, nconf,
+                                           pfd, &tmp) < 0) {
+                virNWFilterSnoopCaptureDone(capture, true);
+                for (j = 0; j < nconf; j++)
+                    pfd[j].fd = -1;
+                continue;
+            }
 
-    virNWFilterSnoopCancel(&req->threadkey);
+            if (tmp >= 0 && (pollTo < 0 || tmp < pollTo))
+                pollTo = tmp;
+        }
 
-    ignore_value(virHashRemoveEntry(virNWFilterSnoopState.ifnameToKey,
-                                    req->ifname));
+        /* cap pollTo so we don't hold up the lease timers for too long */
+        if (pollTo < 0 || pollTo > SNOOP_POLL_MAX_TIMEOUT_MS)
+            pollTo = SNOOP_POLL_MAX_TIMEOUT_MS;
 
-    VIR_FREE(req->ifname);
+        n = poll(fds, nfds, pollTo);
 
-    virNWFilterSnoopReqUnlock(req);
-    virNWFilterSnoopUnlock();
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                virReportSystemError(errno, "%s",
+                                     _("cannot poll DHCP snooping handles"));
+                error = true;
+            }
+        }
 
- exit:
-    virThreadPoolFree(worker);
+        if (fds[0].revents) {
+            while (read(fds[0].fd, buf, sizeof(buf)) > 0)
+                ;
+        }
 
-    virNWFilterSnoopReqPut(req);
+        for (i = 0; i < ncaptures; i++) {
+            virNWFilterSnoopCapturePtr capture = captures[i];
 
-    VIR_FREE(threadkey);
+            if (capture->done) {
+                if (virNWFilterSnoopCaptureIsIdle(capture))
+                    virNWFilterSnoopCaptureFree(capture);
+                continue;
+            }
+
+            virNWFilterSnoopReqLeaseTimerRun(capture->req);
+
+            /*
+             * Check whether we were cancelled or whether
+             * a previously submitted job failed.
+             */
+            if (!virNWFilterSnoopIsActive(capture->threadkey) ||
+                capture->req->jobCompletionStatus != 0) {
+                virNWFilterSnoopCaptureDone(capture, false);
+                continue;
+            }
 
-    for (i = 0; i < ARRAY_CARDINALITY(pcapConf); i++) {
-        if (pcapConf[i].handle)
-            pcap_close(pcapConf[i].handle);
+            if (error ||
+                virNWFilterSnoopCaptureRead(capture, &fds[1 + i * nconf]) < 0)
+                virNWFilterSnoopCaptureDone(capture, true);
+        }
     }
 
-    virAtomicIntDecAndTest(&virNWFilterSnoopState.nThreads);
+    VIR_FREE(captures);
+    VIR_FREE(fds);
+}
 
-    return;
+/*
+ * Start the capture thread and its decode workers unless they are
+ * already running. The caller must hold the SnoopLock.
+ */
+static int
+virNWFilterSnoopCaptureStart(void)
+{
+    size_t i;
+
+    if (virNWFilterSnoopState.captureRunning)
+        return 0;
+
+    for (i = 0; i < SNOOP_DECODE_WORKERS; i++) {
+        virNWFilterSnoopState.decodeWorkers[i] =
+            virThreadPoolNew(1, 1, 0, virNWFilterDHCPDecodeWorker, NULL);
+        if (!virNWFilterSnoopState.decodeWorkers[i])
+            goto error;
+    }
+
+    if (pipe2(virNWFilterSnoopState.wakeupFD, O_CLOEXEC | O_NONBLOCK) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create DHCP snooping wakeup pipe"));
+        goto error;
+    }
+
+    virNWFilterSnoopState.captureQuit = false;
+
+    if (virThreadCreate(&virNWFilterSnoopState.captureThread, true,
+                        virNWFilterDHCPSnoopThread, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create DHCP snooping thread"));
+        goto error;
+    }
+
+    virNWFilterSnoopState.captureRunning = true;
+
+    return 0;
+
+ error:
+    VIR_FORCE_CLOSE(virNWFilterSnoopState.wakeupFD[0]);
+    VIR_FORCE_CLOSE(virNWFilterSnoopState.wakeupFD[1]);
+    for (i = 0; i < SNOOP_DECODE_WORKERS; i++) {
+        virThreadPoolFree(virNWFilterSnoopState.decodeWorkers[i]);
+        virNWFilterSnoopState.decodeWorkers[i] = NULL;
+    }
+
+    return -1;
+}
+
+/*
+ * Stop the capture thread once all interfaces have been released.
+ */
+static void
+virNWFilterSnoopCaptureStop(void)
+{
+    size_t i;
+
+    if (!virNWFilterSnoopState.captureRunning)
+        return;
+
+    virMutexLock(&virNWFilterSnoopState.captureLock);
+    virNWFilterSnoopState.captureQuit = true;
+    virMutexUnlock(&virNWFilterSnoopState.captureLock);
+
+    virNWFilterSnoopCaptureWakeup();
+
+    virThreadJoin(&virNWFilterSnoopState.captureThread);
+
+    VIR_FORCE_CLOSE(virNWFilterSnoopState.wakeupFD[0]);
+    VIR_FORCE_CLOSE(virNWFilterSnoopState.wakeupFD[1]);
+    for (i = 0; i < SNOOP_DECODE_WORKERS; i++) {
+        virThreadPoolFree(virNWFilterSnoopState.decodeWorkers[i]);
+        virNWFilterSnoopState.decodeWorkers[i] = NULL;
+    }
+    VIR_FREE(virNWFilterSnoopState.captures);
+    virNWFilterSnoopState.ncaptures = 0;
+
+    virNWFilterSnoopState.captureRunning = false;
 }
 
 static void
@@ -1598,9 +1876,7 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
     bool isnewreq;
     char ifkey[VIR_IFKEY_LEN];
     int tmp;
-    virThread thread;
     virNWFilterVarValuePtr dhcpsrvrs;
-    bool threadPuts = false;
 
     virNWFilterSnoopIFKeyFMT(ifkey, vmuuid, macaddr);
 
@@ -1682,20 +1958,11 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
         goto exit_rem_ifnametokey;
     }
 
-    /* prevent thread from holding req */
+    /* protect req->threadkey */
     virNWFilterSnoopReqLock(req);
 
-    if (virThreadCreate(&thread, false, virNWFilterDHCPSnoopThread,
-                        req) != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("virNWFilterDHCPSnoopReq virThreadCreate "
-                         "failed on interface '%s'"), ifname);
+    if (virNWFilterSnoopCaptureStart() < 0)
         goto exit_snoopreq_unlock;
-    }
-
-    threadPuts = true;
-
-    virAtomicIntInc(&virNWFilterSnoopState.nThreads);
 
     req->threadkey = virNWFilterSnoopActivate(req);
     if (!req->threadkey) {
@@ -1712,16 +1979,18 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
         goto exit_snoop_cancel;
     }
 
-    /* sync with thread */
-    if (virCondWait(&req->threadStatusCond, &req->lock) < 0 ||
-        req->threadStatus != THREAD_STATUS_OK)
+    if (virNWFilterSnoopCaptureAdd(req) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("virNWFilterDHCPSnoopReq: cannot capture on "
+                         "interface '%s'"), req->ifname);
         goto exit_snoop_cancel;
+    }
 
     virNWFilterSnoopReqUnlock(req);
 
     virNWFilterSnoopUnlock();
 
-    /* do not 'put' the req -- the thread will do this */
+    /* do not 'put' the req -- the capture thread will do this */
 
     return 0;
 
@@ -1734,8 +2003,7 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
  exit_snoopunlock:
     virNWFilterSnoopUnlock();
  exit_snoopreqput:
-    if (!threadPuts)
-        virNWFilterSnoopReqPut(req);
+    virNWFilterSnoopReqPut(req);
 
     return -1;
 }
@@ -2012,13 +2280,13 @@ virNWFilterSnoopLeaseFileLoad(void)
 }
 
 /*
- * Wait until all threads have ended.
+ * Wait until the capture thread has released all interfaces.
  */
 static void
 virNWFilterSnoopJoinThreads(void)
 {
     while (virAtomicIntGet(&virNWFilterSnoopState.nThreads) != 0) {
-        VIR_WARN("Waiting for snooping threads to terminate: %u",
+        VIR_WARN("Waiting for snooping on interfaces to terminate: %u",
                  virAtomicIntGet(&virNWFilterSnoopState.nThreads));
         usleep(1000 * 1000);
     }
@@ -2084,7 +2352,8 @@ virNWFilterDHCPSnoopInit(void)
     VIR_DEBUG("Initializing DHCP snooping");
 
     if (virMutexInitRecursive(&virNWFilterSnoopState.snoopLock) < 0 ||
-        virMutexInit(&virNWFilterSnoopState.activeLock) < 0)
+        virMutexInit(&virNWFilterSnoopState.activeLock) < 0 ||
+        virMutexInit(&virNWFilterSnoopState.captureLock) < 0)
         return -1;
 
     virNWFilterSnoopState.ifnameToKey = virHashCreate(0, NULL);
@@ -2166,6 +2435,8 @@ virNWFilterDHCPSnoopEnd(const char *ifname)
         virNWFilterSnoopReqUnlock(req);
 
         virNWFilterSnoopReqPut(req);
+
+        virNWFilterSnoopCaptureWakeup();
     } else {                      /* free all of them */
         virNWFilterSnoopLeaseFileClose();
 
@@ -2173,6 +2444,7 @@ virNWFilterDHCPSnoopEnd(const char *ifname)
 
         /* tell the threads to terminate */
         virNWFilterSnoopEndThreads();
+        virNWFilterSnoopCaptureWakeup();
 
         virNWFilterSnoopLeaseFileLoad();
     }
@@ -2185,7 +2457,9 @@ void
 virNWFilterDHCPSnoopShutdown(void)
 {
     virNWFilterSnoopEndThreads();
+    virNWFilterSnoopCaptureWakeup();
     virNWFilterSnoopJoinThreads();
+    virNWFilterSnoopCaptureStop();
 
     virNWFilterSnoopLock();
 
@@ -206,6 +206,7 @@ nwfilterStateInitialize(bool privileged,
         goto err_dhcpsnoop_shutdown;
 
     if (virNWFilterConfLayerInit(virNWFilterDomainFWUpdateCB,
+                                 virNWFilterDomainFWUpdateFinish,
                                  driver) < 0)
         goto err_techdrivers_shutdown;
 
@@ -554,7 +555,7 @@ nwfilterUndefine(virNWFilterPtr nwfilter)
     if (virNWFilterUndefineEnsureACL(nwfilter->conn, def) < 0)
         goto cleanup;
 
-    if (virNWFilterObjTestUnassignDef(obj) < 0) {
+    if (virNWFilterObjTestUnassignDef(driver->nwfilters, obj) < 0) {
         virReportError(VIR_ERR_OPERATION_INVALID,
                        "%s",
                        _("nwfilter is in use"));
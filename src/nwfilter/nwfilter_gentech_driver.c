@@ -32,12 +32,15 @@
 #include "virerror.h"
 #include "nwfilter_gentech_driver.h"
 #include "nwfilter_ebiptables_driver.h"
+#include "nwfilter_nftables_driver.h"
 #include "nwfilter_dhcpsnoop.h"
 #include "nwfilter_ipaddrmap.h"
 #include "nwfilter_learnipaddr.h"
 #include "virnetdev.h"
 #include "datatypes.h"
 #include "virstring.h"
+#include "virthreadpool.h"
+#include "viratomic.h"
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
 
@@ -49,10 +52,14 @@ VIR_LOG_INIT("nwfilter.nwfilter_gentech_driver");
 #define NWFILTER_DFLT_LEARN  "any"
 
 static int _virNWFilterTeardownFilter(const char *ifname);
+static int virNWFilterInstTmplCacheInit(void);
+static void virNWFilterInstTmplCacheFree(void);
 
 
+/* nftables relies on ebiptables being initialized first */
 static virNWFilterTechDriverPtr filter_tech_drivers[] = {
     &ebiptables_driver,
+    &nftables_driver,
     NULL
 };
 
@@ -79,6 +86,12 @@ int virNWFilterTechDriversInit(bool privileged)
     if (virMutexInitRecursive(&updateMutex) < 0)
         return -1;
 
+    if (virNWFilterInstTmplCacheInit() < 0) {
+        virNWFilterInstTmplCacheFree();
+        virMutexDestroy(&updateMutex);
+        return -1;
+    }
+
     while (filter_tech_drivers[i]) {
         if (!(filter_tech_drivers[i]->flags & TECHDRV_FLAG_INITIALIZED))
             filter_tech_drivers[i]->init(privileged);
@@ -96,6 +109,7 @@ void virNWFilterTechDriversShutdown(void)
             filter_tech_drivers[i]->shutdown();
         i++;
     }
+    virNWFilterInstTmplCacheFree();
     virMutexDestroy(&updateMutex);
 }
 
@@ -116,6 +130,17 @@ virNWFilterTechDriverForName(const char *name)
 }
 
 
+/* Name of the driver to instantiate filters with; the nftables driver
+ * falls back to ebiptables for whatever it cannot handle itself */
+static const char *
+virNWFilterTechDriverDefaultName(void)
+{
+    if (nftables_driver.flags & TECHDRV_FLAG_INITIALIZED)
+        return NFTABLES_DRIVER_ID;
+    return EBIPTABLES_DRIVER_ID;
+}
+
+
 static void
 virNWFilterRuleInstFree(virNWFilterRuleInstPtr inst)
 {
@@ -302,8 +327,6 @@ virNWFilterCreateVarsFrom(virNWFilterHashTablePtr vars1,
 typedef struct _virNWFilterInst virNWFilterInst;
 typedef virNWFilterInst *virNWFilterInstPtr;
 struct _virNWFilterInst {
-    virNWFilterObjPtr *filters;
-    size_t nfilters;
     virNWFilterRuleInstPtr *rules;
     size_t nrules;
 };
@@ -314,25 +337,313 @@ virNWFilterInstReset(virNWFilterInstPtr inst)
 {
     size_t i;
 
-    for (i = 0; i < inst->nfilters; i++)
-        virNWFilterObjUnlock(inst->filters[i]);
-    VIR_FREE(inst->filters);
-    inst->nfilters = 0;
-
     for (i = 0; i < inst->nrules; i++)
         virNWFilterRuleInstFree(inst->rules[i]);
     VIR_FREE(inst->rules);
+    inst->nrules = 0;
+}
+
+
+/*
+ * The tree of filters referenced by a filter, flattened into the list
+ * of its rules. This only depends on the filter definitions, not on
+ * the parameters of an interface, and is therefore shared by all the
+ * interfaces using the same filter.
+ *
+ * Every rule belongs to a scope, which holds the parameters passed by
+ * the <filterref> the rule's filter was included through. Scope 0 is
+ * the top level filter, the parent of a scope always comes before it.
+ */
+typedef struct _virNWFilterInstScope virNWFilterInstScope;
+typedef virNWFilterInstScope *virNWFilterInstScopePtr;
+struct _virNWFilterInstScope {
+    size_t parent;
+    virNWFilterHashTablePtr params;
+};
+
+typedef struct _virNWFilterInstTmplRule virNWFilterInstTmplRule;
+typedef virNWFilterInstTmplRule *virNWFilterInstTmplRulePtr;
+struct _virNWFilterInstTmplRule {
+    virNWFilterDefPtr def;
+    virNWFilterRuleDefPtr rule;
+    size_t scope;
+};
+
+typedef struct _virNWFilterInstTmpl virNWFilterInstTmpl;
+typedef virNWFilterInstTmpl *virNWFilterInstTmplPtr;
+struct _virNWFilterInstTmpl {
+    virObject parent;
+
+    /* whether a newDef of an included filter was followed */
+    bool foundNewFilter;
+
+    virNWFilterInstScopePtr scopes;
+    size_t nscopes;
+
+    virNWFilterInstTmplRulePtr rules;
+    size_t nrules;
+};
+
+static virClassPtr virNWFilterInstTmplClass;
+
+static void
+virNWFilterInstTmplDispose(void *obj)
+{
+    virNWFilterInstTmplPtr tmpl = obj;
+
+    VIR_FREE(tmpl->scopes);
+    VIR_FREE(tmpl->rules);
+}
+
+static int
+virNWFilterInstTmplOnceInit(void)
+{
+    if (!(virNWFilterInstTmplClass = virClassNew(virClassForObject(),
+                                                 "virNWFilterInstTmpl",
+                                                 sizeof(virNWFilterInstTmpl),
+                                                 virNWFilterInstTmplDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNWFilterInstTmpl)
+
+
+/* Templates indexed by filter name, one table per instCase. Entries
+ * are only valid for the generation of the filter list they were
+ * built from. Protected by updateMutex. */
+static virHashTablePtr instTmplCache[INSTANTIATE_FOLLOW_NEWFILTER + 1];
+static unsigned int instTmplCacheGeneration;
+
+
+static int
+virNWFilterInstTmplCacheInit(void)
+{
+    size_t i;
+
+    if (virNWFilterInstTmplInitialize() < 0)
+        return -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(instTmplCache); i++) {
+        if (!(instTmplCache[i] = virHashCreate(10, virObjectFreeHashData)))
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+virNWFilterInstTmplCacheFree(void)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(instTmplCache); i++) {
+        virHashFree(instTmplCache[i]);
+        instTmplCache[i] = NULL;
+    }
 }
 
 
+static int
+virNWFilterInstTmplAddRule(virNWFilterInstTmplPtr tmpl,
+                           virNWFilterDefPtr def,
+                           virNWFilterRuleDefPtr rule,
+                           size_t scope)
+{
+    virNWFilterInstTmplRule entry = {
+        .def = def,
+        .rule = rule,
+        .scope = scope,
+    };
+
+    return VIR_APPEND_ELEMENT(tmpl->rules, tmpl->nrules, entry);
+}
+
 
 static int
-virNWFilterDefToInst(virNWFilterDriverStatePtr driver,
-                     virNWFilterDefPtr def,
-                     virNWFilterHashTablePtr vars,
-                     enum instCase useNewFilter,
-                     bool *foundNewFilter,
-                     virNWFilterInstPtr inst);
+virNWFilterInstTmplBuildRec(virNWFilterDriverStatePtr driver,
+                            virNWFilterDefPtr def,
+                            size_t scope,
+                            enum instCase useNewFilter,
+                            virNWFilterInstTmplPtr tmpl)
+{
+    virNWFilterObjPtr obj;
+    virNWFilterDefPtr childdef;
+    virNWFilterDefPtr newChilddef;
+    virNWFilterInstScope childscope;
+    size_t i;
+
+    for (i = 0; i < def->nentries; i++) {
+        virNWFilterRuleDefPtr    rule = def->filterEntries[i]->rule;
+        virNWFilterIncludeDefPtr inc  = def->filterEntries[i]->include;
+
+        if (rule) {
+            if (virNWFilterInstTmplAddRule(tmpl, def, rule, scope) < 0)
+                return -1;
+            continue;
+        }
+
+        if (!inc)
+            continue;
+
+        VIR_DEBUG("Following filter %s", inc->filterref);
+        obj = virNWFilterObjListFindByName(driver->nwfilters,
+                                           inc->filterref);
+        if (!obj) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("referenced filter '%s' is missing"),
+                           inc->filterref);
+            return -1;
+        }
+        if (virNWFilterObjWantRemoved(obj)) {
+            virReportError(VIR_ERR_NO_NWFILTER,
+                           _("Filter '%s' is in use."),
+                           inc->filterref);
+            virNWFilterObjUnlock(obj);
+            return -1;
+        }
+
+        childdef = virNWFilterObjGetDef(obj);
+
+        switch (useNewFilter) {
+        case INSTANTIATE_FOLLOW_NEWFILTER:
+            newChilddef = virNWFilterObjGetNewDef(obj);
+            if (newChilddef) {
+                childdef = newChilddef;
+                tmpl->foundNewFilter = true;
+            }
+            break;
+        case INSTANTIATE_ALWAYS:
+            break;
+        }
+
+        /* the definitions cannot change while the filter update lock is
+         * held, so the object need not stay locked */
+        virNWFilterObjUnlock(obj);
+
+        childscope.parent = scope;
+        childscope.params = inc->params;
+        if (VIR_APPEND_ELEMENT(tmpl->scopes, tmpl->nscopes, childscope) < 0)
+            return -1;
+
+        if (virNWFilterInstTmplBuildRec(driver, childdef,
+                                        tmpl->nscopes - 1,
+                                        useNewFilter, tmpl) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virNWFilterInstTmplGet:
+ * @driver: the driver state pointer
+ * @filter: The top level filter
+ * @useNewFilter: instruct whether to use a newDef pointer rather than a
+ *  def ptr which is useful during a filter update
+ *
+ * Get the template of @filter from the cache, resolving the tree of
+ * referenced filters if there is none yet.
+ *
+ * Call this function while holding the NWFilter filter update lock
+ * and updateMutex.
+ *
+ * Returns a new reference to the template, NULL on error.
+ */
+static virNWFilterInstTmplPtr
+virNWFilterInstTmplGet(virNWFilterDriverStatePtr driver,
+                       virNWFilterDefPtr filter,
+                       enum instCase useNewFilter)
+{
+    virHashTablePtr cache = instTmplCache[useNewFilter];
+    unsigned int generation;
+    virNWFilterInstTmplPtr tmpl;
+    virNWFilterInstScope topscope = { 0, NULL };
+
+    generation = virNWFilterObjListGetGeneration(driver->nwfilters);
+    if (cache && generation != instTmplCacheGeneration) {
+        size_t i;
+
+        for (i = 0; i < ARRAY_CARDINALITY(instTmplCache); i++)
+            virHashRemoveAll(instTmplCache[i]);
+        instTmplCacheGeneration = generation;
+    }
+
+    if (cache && (tmpl = virHashLookup(cache, filter->name)))
+        return virObjectRef(tmpl);
+
+    if (virNWFilterInstTmplInitialize() < 0 ||
+        !(tmpl = virObjectNew(virNWFilterInstTmplClass)))
+        return NULL;
+
+    if (VIR_APPEND_ELEMENT(tmpl->scopes, tmpl->nscopes, topscope) < 0 ||
+        virNWFilterInstTmplBuildRec(driver, filter, 0,
+                                    useNewFilter, tmpl) < 0)
+        goto error;
+
+    if (cache) {
+        if (virHashAddEntry(cache, filter->name, tmpl) < 0)
+            goto error;
+        virObjectRef(tmpl);
+    }
+
+    return tmpl;
+
+ error:
+    virObjectUnref(tmpl);
+    return NULL;
+}
+
+
+static void
+virNWFilterInstTmplFreeVars(virNWFilterInstTmplPtr tmpl,
+                            virNWFilterHashTablePtr *scopevars)
+{
+    size_t i;
+
+    if (!scopevars)
+        return;
+
+    /* scope 0 holds the caller's variables */
+    for (i = 1; i < tmpl->nscopes; i++)
+        virNWFilterHashTableFree(scopevars[i]);
+    VIR_FREE(scopevars);
+}
+
+
+/*
+ * Evaluate the variables visible in each scope of @tmpl for the
+ * interface specific @vars; the parameters of each <filterref> are
+ * overridden by the values passed down from above.
+ */
+static virNWFilterHashTablePtr *
+virNWFilterInstTmplGetVars(virNWFilterInstTmplPtr tmpl,
+                           virNWFilterHashTablePtr vars)
+{
+    virNWFilterHashTablePtr *scopevars;
+    size_t i;
+
+    if (VIR_ALLOC_N(scopevars, tmpl->nscopes) < 0)
+        return NULL;
+
+    scopevars[0] = vars;
+    for (i = 1; i < tmpl->nscopes; i++) {
+        virNWFilterInstScopePtr scope = &tmpl->scopes[i];
+        virNWFilterHashTablePtr parentvars = scopevars[scope->parent];
+
+        if (!(scopevars[i] = virNWFilterCreateVarsFrom(scope->params,
+                                                       parentvars))) {
+            virNWFilterInstTmplFreeVars(tmpl, scopevars);
+            return NULL;
+        }
+    }
+
+    return scopevars;
+}
+
 
 static int
 virNWFilterRuleDefToRuleInst(virNWFilterDefPtr def,
@@ -368,238 +679,206 @@ virNWFilterRuleDefToRuleInst(virNWFilterDefPtr def,
 }
 
 
+/**
+ * virNWFilterInstTmplToInst:
+ * @tmpl: The template of the filter to instantiate
+ * @scopevars: The variables of each scope of @tmpl
+ * @inst: The instance to fill
+ *
+ * Expand the filter into a flat list of rule instances, in the order of
+ * a depth-first traversal of the tree.
+ *
+ * Returns 0 on success, -1 on error
+ */
 static int
-virNWFilterIncludeDefToRuleInst(virNWFilterDriverStatePtr driver,
-                                virNWFilterIncludeDefPtr inc,
-                                virNWFilterHashTablePtr vars,
-                                enum instCase useNewFilter,
-                                bool *foundNewFilter,
-                                virNWFilterInstPtr inst)
+virNWFilterInstTmplToInst(virNWFilterInstTmplPtr tmpl,
+                          virNWFilterHashTablePtr *scopevars,
+                          virNWFilterInstPtr inst)
 {
-    virNWFilterObjPtr obj;
-    virNWFilterHashTablePtr tmpvars = NULL;
-    virNWFilterDefPtr childdef;
-    virNWFilterDefPtr newChilddef;
-    int ret = -1;
+    size_t i;
 
-    VIR_DEBUG("Instantiating filter %s", inc->filterref);
-    obj = virNWFilterObjListFindByName(driver->nwfilters,
-                                       inc->filterref);
-    if (!obj) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("referenced filter '%s' is missing"),
-                       inc->filterref);
-        goto cleanup;
-    }
-    if (virNWFilterObjWantRemoved(obj)) {
-        virReportError(VIR_ERR_NO_NWFILTER,
-                       _("Filter '%s' is in use."),
-                       inc->filterref);
-        goto cleanup;
+    for (i = 0; i < tmpl->nrules; i++) {
+        virNWFilterInstTmplRulePtr entry = &tmpl->rules[i];
+
+        if (virNWFilterRuleDefToRuleInst(entry->def,
+                                         entry->rule,
+                                         scopevars[entry->scope],
+                                         inst) < 0) {
+            virNWFilterInstReset(inst);
+            return -1;
+        }
     }
 
-    /* create a temporary hashmap for depth-first tree traversal */
-    if (!(tmpvars = virNWFilterCreateVarsFrom(inc->params,
-                                              vars)))
-        goto cleanup;
+    return 0;
+}
 
-    childdef = virNWFilterObjGetDef(obj);
 
-    switch (useNewFilter) {
-    case INSTANTIATE_FOLLOW_NEWFILTER:
-        newChilddef = virNWFilterObjGetNewDef(obj);
-        if (newChilddef) {
-            childdef = newChilddef;
-            *foundNewFilter = true;
+static int
+virNWFilterInstTmplDetermineMissingVars(virNWFilterInstTmplPtr tmpl,
+                                        virNWFilterHashTablePtr *scopevars,
+                                        virNWFilterHashTablePtr missing_vars)
+{
+    size_t i, j;
+
+    for (i = 0; i < tmpl->nrules; i++) {
+        virNWFilterRuleDefPtr rule = tmpl->rules[i].rule;
+        virNWFilterHashTablePtr vars = scopevars[tmpl->rules[i].scope];
+
+        /* check all variables of this rule */
+        for (j = 0; j < rule->nVarAccess; j++) {
+            if (!virNWFilterVarAccessIsAvailable(rule->varAccess[j],
+                                                 vars)) {
+                char *varAccess;
+                virNWFilterVarValuePtr val;
+                virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+                virNWFilterVarAccessPrint(rule->varAccess[j], &buf);
+                if (virBufferError(&buf)) {
+                    virReportOOMError();
+                    return -1;
+                }
+
+                val = virNWFilterVarValueCreateSimpleCopyValue("1");
+                if (!val) {
+                    virBufferFreeAndReset(&buf);
+                    return -1;
+                }
+
+                varAccess = virBufferContentAndReset(&buf);
+                virNWFilterHashTablePut(missing_vars, varAccess,
+                                        val);
+                VIR_FREE(varAccess);
+            }
         }
-        break;
-    case INSTANTIATE_ALWAYS:
-        break;
     }
 
-    if (VIR_APPEND_ELEMENT(inst->filters,
-                           inst->nfilters,
-                           obj) < 0)
-        goto cleanup;
-    obj = NULL;
-
-    if (virNWFilterDefToInst(driver,
-                             childdef,
-                             tmpvars,
-                             useNewFilter,
-                             foundNewFilter,
-                             inst) < 0)
-        goto cleanup;
-
-    ret = 0;
- cleanup:
-    if (ret < 0)
-        virNWFilterInstReset(inst);
-    virNWFilterHashTableFree(tmpvars);
-    if (obj)
-        virNWFilterObjUnlock(obj);
-    return ret;
+    return 0;
 }
 
 
-/**
- * virNWFilterDefToInst:
- * @driver: the driver state pointer
- * @def: The filter to instantiate
- * @vars: A map holding variable names and values used for instantiating
- *  the filter and its subfilters.
- * @useNewFilter: instruct whether to use a newDef pointer rather than a
- *  def ptr which is useful during a filter update
- * @foundNewFilter: pointer to int indivating whether a newDef pointer was
- *  ever used; variable expected to be initialized to 0 by caller
- * @rulesout: array to be filled with rule instance
- * @nrulesout: counter to be filled with number of rule instances
- *
- * Recursively expand a nested filter into a flat list of rule instances,
- * in a depth-first traversal of the tree.
- *
- * Returns 0 on success, -1 on error
+/*
+ * Rules prepared while rebuilding the filters after a filter definition
+ * changed. They are applied once all interfaces have been looked at,
+ * from several threads in parallel.
  */
-static int
-virNWFilterDefToInst(virNWFilterDriverStatePtr driver,
-                     virNWFilterDefPtr def,
-                     virNWFilterHashTablePtr vars,
-                     enum instCase useNewFilter,
-                     bool *foundNewFilter,
-                     virNWFilterInstPtr inst)
+typedef struct _virNWFilterRebuildJob virNWFilterRebuildJob;
+typedef virNWFilterRebuildJob *virNWFilterRebuildJobPtr;
+struct _virNWFilterRebuildJob {
+    virNWFilterTechDriverPtr techdriver;
+    char *ifname;
+    int ifindex;
+    virNWFilterInst inst;
+
+    int rc;
+    virErrorPtr error;
+};
+
+typedef struct _virNWFilterRebuildBatch virNWFilterRebuildBatch;
+typedef virNWFilterRebuildBatch *virNWFilterRebuildBatchPtr;
+struct _virNWFilterRebuildBatch {
+    virNWFilterRebuildJobPtr *jobs;
+    size_t njobs;
+    size_t nskipped;  /* interfaces not using any affected filter */
+
+    volatile int ndone;
+};
+
+/* Applying rules mostly waits for the firewall tools, don't start too
+ * many of them at once */
+#define NWFILTER_REBUILD_MAX_WORKERS 8
+
+
+static void
+virNWFilterRebuildJobFree(virNWFilterRebuildJobPtr job)
+{
+    if (!job)
+        return;
+
+    virNWFilterInstReset(&job->inst);
+    virFreeError(job->error);
+    VIR_FREE(job->ifname);
+    VIR_FREE(job);
+}
+
+
+static void
+virNWFilterRebuildFree(virNWFilterRebuildBatchPtr rebuild)
 {
     size_t i;
-    int ret = -1;
 
-    for (i = 0; i < def->nentries; i++) {
-        if (def->filterEntries[i]->rule) {
-            if (virNWFilterRuleDefToRuleInst(def,
-                                             def->filterEntries[i]->rule,
-                                             vars,
-                                             inst) < 0)
-                goto cleanup;
-        } else if (def->filterEntries[i]->include) {
-            if (virNWFilterIncludeDefToRuleInst(driver,
-                                                def->filterEntries[i]->include,
-                                                vars,
-                                                useNewFilter, foundNewFilter,
-                                                inst) < 0)
-                goto cleanup;
-        }
-    }
+    if (!rebuild)
+        return;
 
-    ret = 0;
- cleanup:
-    if (ret < 0)
-        virNWFilterInstReset(inst);
-    return ret;
+    for (i = 0; i < rebuild->njobs; i++)
+        virNWFilterRebuildJobFree(rebuild->jobs[i]);
+    VIR_FREE(rebuild->jobs);
+    VIR_FREE(rebuild);
 }
 
 
+/* Take over the rule instances of @inst for applying them later */
 static int
-virNWFilterDetermineMissingVarsRec(virNWFilterDefPtr filter,
-                                   virNWFilterHashTablePtr vars,
-                                   virNWFilterHashTablePtr missing_vars,
-                                   int useNewFilter,
-                                   virNWFilterDriverStatePtr driver)
+virNWFilterRebuildAddJob(virNWFilterRebuildBatchPtr rebuild,
+                         virNWFilterTechDriverPtr techdriver,
+                         const char *ifname,
+                         int ifindex,
+                         virNWFilterInstPtr inst)
 {
-    virNWFilterObjPtr obj;
-    int rc = 0;
-    size_t i, j;
-    virNWFilterDefPtr next_filter;
-    virNWFilterDefPtr newNext_filter;
-    virNWFilterVarValuePtr val;
+    virNWFilterRebuildJobPtr job;
 
-    for (i = 0; i < filter->nentries; i++) {
-        virNWFilterRuleDefPtr    rule = filter->filterEntries[i]->rule;
-        virNWFilterIncludeDefPtr inc  = filter->filterEntries[i]->include;
-        if (rule) {
-            /* check all variables of this rule */
-            for (j = 0; j < rule->nVarAccess; j++) {
-                if (!virNWFilterVarAccessIsAvailable(rule->varAccess[j],
-                                                     vars)) {
-                    char *varAccess;
-                    virBuffer buf = VIR_BUFFER_INITIALIZER;
-
-                    virNWFilterVarAccessPrint(rule->varAccess[j], &buf);
-                    if (virBufferError(&buf)) {
-                        virReportOOMError();
-                        rc = -1;
-                        break;
-                    }
+    if (VIR_ALLOC(job) < 0 ||
+        VIR_STRDUP(job->ifname, ifname) < 0)
+        goto error;
 
-                    val = virNWFilterVarValueCreateSimpleCopyValue("1");
-                    if (!val) {
-                        virBufferFreeAndReset(&buf);
-                        rc = -1;
-                        break;
-                    }
+    job->techdriver = techdriver;
+    job->ifindex = ifindex;
 
-                    varAccess = virBufferContentAndReset(&buf);
-                    virNWFilterHashTablePut(missing_vars, varAccess,
-                                            val);
-                    VIR_FREE(varAccess);
-                }
-            }
-            if (rc)
-                break;
-        } else if (inc) {
-            VIR_DEBUG("Following filter %s", inc->filterref);
-            obj = virNWFilterObjListFindByName(driver->nwfilters, inc->filterref);
-            if (obj) {
-
-                if (virNWFilterObjWantRemoved(obj)) {
-                    virReportError(VIR_ERR_NO_NWFILTER,
-                                   _("Filter '%s' is in use."),
-                                   inc->filterref);
-                    rc = -1;
-                    virNWFilterObjUnlock(obj);
-                    break;
-                }
+    if (VIR_APPEND_ELEMENT(rebuild->jobs, rebuild->njobs, job) < 0)
+        goto error;
 
-                /* create a temporary hashmap for depth-first tree traversal */
-                virNWFilterHashTablePtr tmpvars =
-                                      virNWFilterCreateVarsFrom(inc->params,
-                                                                vars);
-                if (!tmpvars) {
-                    rc = -1;
-                    virNWFilterObjUnlock(obj);
-                    break;
-                }
+    job->inst = *inst;
+    memset(inst, 0, sizeof(*inst));
 
-                next_filter = virNWFilterObjGetDef(obj);
+    return 0;
 
-                switch (useNewFilter) {
-                case INSTANTIATE_FOLLOW_NEWFILTER:
-                    newNext_filter = virNWFilterObjGetNewDef(obj);
-                    if (newNext_filter)
-                        next_filter = newNext_filter;
-                    break;
-                case INSTANTIATE_ALWAYS:
-                    break;
-                }
+ error:
+    virNWFilterRebuildJobFree(job);
+    return -1;
+}
 
-                rc = virNWFilterDetermineMissingVarsRec(next_filter,
-                                                        tmpvars,
-                                                        missing_vars,
-                                                        useNewFilter,
-                                                        driver);
 
-                virNWFilterHashTableFree(tmpvars);
+static void
+virNWFilterRebuildApplyOne(size_t idx, void *opaque)
+{
+    virNWFilterRebuildBatchPtr rebuild = opaque;
+    virNWFilterRebuildJobPtr job = rebuild->jobs[idx];
+    virNWFilterTechDriverPtr techdriver = job->techdriver;
 
-                virNWFilterObjUnlock(obj);
-                if (rc < 0)
-                    break;
-            } else {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("referenced filter '%s' is missing"),
-                               inc->filterref);
-                rc = -1;
-                break;
-            }
-        }
+    if (virNWFilterLockIface(job->ifname) < 0) {
+        job->rc = -1;
+        goto cleanup;
     }
-    return rc;
+
+    job->rc = techdriver->applyNewRules(job->ifname,
+                                        job->inst.rules, job->inst.nrules);
+
+    if (job->rc == 0 &&
+        virNetDevValidateConfig(job->ifname, NULL, job->ifindex) <= 0) {
+        virResetLastError();
+        /* interface changed/disppeared */
+        techdriver->allTeardown(job->ifname);
+        job->rc = -1;
+    }
+
+    virNWFilterUnlockIface(job->ifname);
+
+ cleanup:
+    if (job->rc < 0)
+        job->error = virSaveLastError();
+
+    VIR_DEBUG("Applied new filter on %s: %d (%d of %zu)",
+              job->ifname, job->rc,
+              virAtomicIntInc(&rebuild->ndone), rebuild->njobs);
 }
 
 
@@ -613,6 +892,8 @@ virNWFilterDetermineMissingVarsRec(virNWFilterDefPtr filter,
  *  the filter and its subfilters.
  * @forceWithPendingReq: Ignore the check whether a pending learn request
  *  is active; 'true' only when the rules are applied late
+ * @rebuild: Collect the rules to be applied later rather than applying
+ *  them right away; may be NULL
  *
  * Returns 0 on success, a value otherwise.
  *
@@ -635,10 +916,13 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
                        bool teardownOld,
                        const virMacAddr *macaddr,
                        virNWFilterDriverStatePtr driver,
-                       bool forceWithPendingReq)
+                       bool forceWithPendingReq,
+                       virNWFilterRebuildBatchPtr rebuild)
 {
     int rc;
     virNWFilterInst inst;
+    virNWFilterInstTmplPtr tmpl = NULL;
+    virNWFilterHashTablePtr *scopevars = NULL;
     bool instantiate = true;
     char *buf;
     virNWFilterVarValuePtr lv;
@@ -654,11 +938,14 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
         goto err_exit;
     }
 
-    rc = virNWFilterDetermineMissingVarsRec(filter,
-                                            vars,
-                                            missing_vars,
-                                            useNewFilter,
-                                            driver);
+    if (!(tmpl = virNWFilterInstTmplGet(driver, filter, useNewFilter)) ||
+        !(scopevars = virNWFilterInstTmplGetVars(tmpl, vars))) {
+        rc = -1;
+        goto err_exit;
+    }
+
+    rc = virNWFilterInstTmplDetermineMissingVars(tmpl, scopevars,
+                                                 missing_vars);
     if (rc < 0)
         goto err_exit;
 
@@ -713,11 +1000,10 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
         goto err_exit;
     }
 
-    rc = virNWFilterDefToInst(driver,
-                              filter,
-                              vars,
-                              useNewFilter, foundNewFilter,
-                              &inst);
+    if (tmpl->foundNewFilter)
+        *foundNewFilter = true;
+
+    rc = virNWFilterInstTmplToInst(tmpl, scopevars, &inst);
 
     if (rc < 0)
         goto err_exit;
@@ -731,7 +1017,10 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
         break;
     }
 
-    if (instantiate) {
+    if (instantiate && rebuild) {
+        rc = virNWFilterRebuildAddJob(rebuild, techdriver,
+                                      ifname, ifindex, &inst);
+    } else if (instantiate) {
         if (virNWFilterLockIface(ifname) < 0)
             goto err_exit;
 
@@ -752,6 +1041,9 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
 
  err_exit:
     virNWFilterInstReset(&inst);
+    if (tmpl)
+        virNWFilterInstTmplFreeVars(tmpl, scopevars);
+    virObjectUnref(tmpl);
     virNWFilterHashTableFree(missing_vars);
 
     return rc;
@@ -786,10 +1078,11 @@ __virNWFilterInstantiateFilter(virNWFilterDriverStatePtr driver,
                                virNWFilterHashTablePtr filterparams,
                                enum instCase useNewFilter,
                                bool forceWithPendingReq,
-                               bool *foundNewFilter)
+                               bool *foundNewFilter,
+                               virNWFilterRebuildBatchPtr rebuild)
 {
     int rc;
-    const char *drvname = EBIPTABLES_DRIVER_ID;
+    const char *drvname = virNWFilterTechDriverDefaultName();
     virNWFilterTechDriverPtr techdriver;
     virNWFilterObjPtr obj;
     virNWFilterHashTablePtr vars, vars1;
@@ -878,7 +1171,8 @@ __virNWFilterInstantiateFilter(virNWFilterDriverStatePtr driver,
                                 teardownOld,
                                 macaddr,
                                 driver,
-                                forceWithPendingReq);
+                                forceWithPendingReq,
+                                rebuild);
 
     virNWFilterHashTableFree(vars);
 
@@ -901,7 +1195,8 @@ _virNWFilterInstantiateFilter(virNWFilterDriverStatePtr driver,
                               const virDomainNetDef *net,
                               bool teardownOld,
                               enum instCase useNewFilter,
-                              bool *foundNewFilter)
+                              bool *foundNewFilter,
+                              virNWFilterRebuildBatchPtr rebuild)
 {
     const char *linkdev = (net->type == VIR_DOMAIN_NET_TYPE_DIRECT)
                           ? net->data.direct.linkdev
@@ -934,7 +1229,8 @@ _virNWFilterInstantiateFilter(virNWFilterDriverStatePtr driver,
                                         net->filterparams,
                                         useNewFilter,
                                         false,
-                                        foundNewFilter);
+                                        foundNewFilter,
+                                        rebuild);
 
  cleanup:
     virMutexUnlock(&updateMutex);
@@ -970,7 +1266,8 @@ virNWFilterInstantiateFilterLate(virNWFilterDriverStatePtr driver,
                                         filterparams,
                                         INSTANTIATE_ALWAYS,
                                         true,
-                                        &foundNewFilter);
+                                        &foundNewFilter,
+                                        NULL);
     if (rc < 0) {
         /* something went wrong... 'DOWN' the interface */
         if ((virNetDevValidateConfig(ifname, NULL, ifindex) <= 0) ||
@@ -998,22 +1295,25 @@ virNWFilterInstantiateFilter(virNWFilterDriverStatePtr driver,
     return _virNWFilterInstantiateFilter(driver, vmuuid, net,
                                          1,
                                          INSTANTIATE_ALWAYS,
-                                         &foundNewFilter);
+                                         &foundNewFilter,
+                                         NULL);
 }
 
 
-int
+static int
 virNWFilterUpdateInstantiateFilter(virNWFilterDriverStatePtr driver,
                                    const unsigned char *vmuuid,
                                    const virDomainNetDef *net,
-                                   bool *skipIface)
+                                   bool *skipIface,
+                                   virNWFilterRebuildBatchPtr rebuild)
 {
     bool foundNewFilter = false;
 
     int rc = _virNWFilterInstantiateFilter(driver, vmuuid, net,
                                            0,
                                            INSTANTIATE_FOLLOW_NEWFILTER,
-                                           &foundNewFilter);
+                                           &foundNewFilter,
+                                           rebuild);
 
     *skipIface = !foundNewFilter;
     return rc;
@@ -1022,7 +1322,7 @@ virNWFilterUpdateInstantiateFilter(virNWFilterDriverStatePtr driver,
 static int
 virNWFilterRollbackUpdateFilter(const virDomainNetDef *net)
 {
-    const char *drvname = EBIPTABLES_DRIVER_ID;
+    const char *drvname = virNWFilterTechDriverDefaultName();
     int ifindex;
     virNWFilterTechDriverPtr techdriver;
 
@@ -1048,7 +1348,7 @@ virNWFilterRollbackUpdateFilter(const virDomainNetDef *net)
 static int
 virNWFilterTearOldFilter(virDomainNetDefPtr net)
 {
-    const char *drvname = EBIPTABLES_DRIVER_ID;
+    const char *drvname = virNWFilterTechDriverDefaultName();
     int ifindex;
     virNWFilterTechDriverPtr techdriver;
 
@@ -1074,7 +1374,7 @@ virNWFilterTearOldFilter(virDomainNetDefPtr net)
 static int
 _virNWFilterTeardownFilter(const char *ifname)
 {
-    const char *drvname = EBIPTABLES_DRIVER_ID;
+    const char *drvname = virNWFilterTechDriverDefaultName();
     virNWFilterTechDriverPtr techdriver;
     techdriver = virNWFilterTechDriverForName(drvname);
 
@@ -1120,22 +1420,43 @@ virNWFilterDomainFWUpdateCB(virDomainObjPtr obj,
 {
     virDomainDefPtr vm = obj->def;
     struct domUpdateCBStruct *cb = data;
+    virNWFilterRebuildBatchPtr rebuild = cb->privateData;
     size_t i;
     bool skipIface;
     int ret = 0;
 
+    if (cb->step == STEP_APPLY_NEW && !rebuild) {
+        if (VIR_ALLOC(rebuild) < 0)
+            return -1;
+        cb->privateData = rebuild;
+    }
+
     virObjectLock(obj);
 
     if (virDomainObjIsActive(obj)) {
         for (i = 0; i < vm->nnets; i++) {
             virDomainNetDefPtr net = vm->nets[i];
             if ((net->filter) && (net->ifname)) {
+                /* the interfaces skipped here are remembered as
+                 * unchanged for the following steps */
+                if (cb->step == STEP_APPLY_NEW && cb->filters &&
+                    !virHashLookup(cb->filters, net->filter)) {
+                    rebuild->nskipped++;
+                    ret = virHashAddEntry(cb->skipInterfaces,
+                                          net->ifname,
+                                          (void *)~0);
+                    if (ret)
+                        break;
+                    continue;
+                }
+
                 switch (cb->step) {
                 case STEP_APPLY_NEW:
                     ret = virNWFilterUpdateInstantiateFilter(cb->opaque,
                                                              vm->uuid,
                                                              net,
-                                                             &skipIface);
+                                                             &skipIface,
+                                                             rebuild);
                     if (ret == 0 && skipIface) {
                         /* filter tree unchanged -- no update needed */
                         ret = virHashAddEntry(cb->skipInterfaces,
@@ -1173,3 +1494,47 @@ virNWFilterDomainFWUpdateCB(virDomainObjPtr obj,
     virObjectUnlock(obj);
     return ret;
 }
+
+
+/**
+ * virNWFilterDomainFWUpdateFinish:
+ * @cb: the data passed to virNWFilterDomainFWUpdateCB
+ *
+ * Apply the new rules prepared for each interface during STEP_APPLY_NEW,
+ * in parallel across the interfaces.
+ *
+ * Returns 0 if the rules could be applied on all interfaces, -1
+ * otherwise with the error of the first failing interface reported.
+ */
+int
+virNWFilterDomainFWUpdateFinish(struct domUpdateCBStruct *cb)
+{
+    virNWFilterRebuildBatchPtr rebuild = cb->privateData;
+    size_t i;
+    int ret = 0;
+
+    if (!rebuild)
+        return 0;
+    cb->privateData = NULL;
+
+    VIR_DEBUG("Applying new filters on %zu interfaces", rebuild->njobs);
+
+    virThreadPoolParallelFor(rebuild->njobs, NWFILTER_REBUILD_MAX_WORKERS,
+                             virNWFilterRebuildApplyOne, rebuild);
+
+    for (i = 0; i < rebuild->njobs; i++) {
+        virNWFilterRebuildJobPtr job = rebuild->jobs[i];
+
+        if (job->rc < 0 && ret == 0) {
+            if (job->error)
+                virSetError(job->error);
+            ret = -1;
+        }
+    }
+
+    VIR_INFO("Rebuilt filters on %zu interfaces, %zu interfaces unaffected",
+             rebuild->njobs, rebuild->nskipped);
+
+    virNWFilterRebuildFree(rebuild);
+    return ret;
+}
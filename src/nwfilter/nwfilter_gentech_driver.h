@@ -41,10 +41,6 @@ enum instCase {
 int virNWFilterInstantiateFilter(virNWFilterDriverStatePtr driver,
                                  const unsigned char *vmuuid,
                                  const virDomainNetDef *net);
-int virNWFilterUpdateInstantiateFilter(virNWFilterDriverStatePtr driver,
-                                       const unsigned char *vmuuid,
-                                       const virDomainNetDef *net,
-                                       bool *skipIface);
 
 int virNWFilterInstantiateFilterLate(virNWFilterDriverStatePtr driver,
                                      const unsigned char *vmuuid,
@@ -62,5 +58,6 @@ virNWFilterHashTablePtr virNWFilterCreateVarHashmap(char *macaddr,
 
 int virNWFilterDomainFWUpdateCB(virDomainObjPtr vm,
                                 void *data);
+int virNWFilterDomainFWUpdateFinish(struct domUpdateCBStruct *cb);
 
 #endif
@@ -27,10 +27,14 @@
 
 #ifdef HAVE_LIBPCAP
 # include <pcap.h>
+# include <linux/filter.h>
+# include <netpacket/packet.h>
 #endif
 
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 
 #include <arpa/inet.h>
 #include <net/ethernet.h>
@@ -48,6 +52,9 @@
 #include "virnetdev.h"
 #include "virerror.h"
 #include "virthread.h"
+#include "virthreadpool.h"
+#include "virfile.h"
+#include "virtime.h"
 #include "conf/nwfilter_params.h"
 #include "conf/domain_conf.h"
 #include "nwfilter_gentech_driver.h"
@@ -65,6 +72,8 @@ VIR_LOG_INIT("nwfilter.nwfilter_learnipaddr");
     snprintf(VARNAME, sizeof(VARNAME), "%d", ifindex);
 
 #define PKT_TIMEOUT_MS 500 /* ms */
+#define LEARN_MAX_PKTS 64 /* packets read per wakeup */
+#define LEARN_FINISH_WORKERS 4
 
 /* structure of an ARP request/reply message */
 struct f_arphdr {
@@ -136,6 +145,17 @@ struct _virNWFilterIfaceLock {
 
 static bool threadsTerminate;
 
+#ifdef HAVE_LIBPCAP
+/* the learner thread and the requests handed over to it */
+static bool learnThreadRunning;
+static bool learnThreadQuit;
+static virThread learnThread;
+static int learnWakeupFD[2] = { -1, -1 };
+static virNWFilterIPAddrLearnReqPtr *learnNewReqs;
+static size_t learnNNewReqs;
+static virThreadPoolPtr learnFinishWorkers;
+#endif
+
 
 int
 virNWFilterLockIface(const char *ifname)
@@ -361,45 +381,162 @@ procDHCPOpts(struct dhcp *dhcp, int dhcp_opts_len,
 }
 
 
-/**
- * learnIPAddressThread
- * arg: pointer to virNWFilterIPAddrLearnReq structure
+/*
+ * Process a packet seen on the interface the request is listening on.
  *
- * Learn the IP address being used on an interface. Use ARP Request and
- * Reply messages, DHCP offers and the first IP packet being sent from
- * the VM to detect the IP address it is using. Detects only one IP address
- * per interface (IP aliasing not supported). The method on how the
- * IP address is detected can be chosen through flags. DETECT_DHCP will
- * require that the IP address is detected from a DHCP OFFER, DETECT_STATIC
- * will require that the IP address was taken from an ARP packet or an IPv4
- * packet. Both flags can be set at the same time.
+ * Returns the IP address detected from the packet in network byte order,
+ * 0 if the packet does not reveal it.
  */
-static void
-learnIPAddressThread(void *arg)
+static uint32_t
+learnIPAddressProcessPacket(virNWFilterIPAddrLearnReqPtr req,
+                            const u_char *packet, size_t len)
 {
-    char errbuf[PCAP_ERRBUF_SIZE] = {0};
-    pcap_t *handle = NULL;
-    struct bpf_program fp;
-    struct pcap_pkthdr header;
-    const u_char *packet;
     struct ether_header *ether_hdr;
     struct ether_vlan_header *vlan_hdr;
-    virNWFilterIPAddrLearnReqPtr req = arg;
     uint32_t vmaddr = 0, bcastaddr = 0;
     unsigned int ethHdrSize;
-    char *listen_if = (strlen(req->linkdev) != 0) ? req->linkdev
-                                                  : req->ifname;
     int dhcp_opts_len;
-    char macaddr[VIR_MAC_STRING_BUFLEN];
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
-    char *filter = NULL;
     uint16_t etherType;
-    bool showError = true;
     enum howDetect howDetected = 0;
+
+    if (len < sizeof(struct ether_header))
+        return 0;
+
+    ether_hdr = (struct ether_header*)packet;
+
+    switch (ntohs(ether_hdr->ether_type)) {
+
+    case ETHERTYPE_IP:
+        ethHdrSize = sizeof(struct ether_header);
+        etherType = ntohs(ether_hdr->ether_type);
+        break;
+
+    case ETHERTYPE_VLAN:
+        ethHdrSize = sizeof(struct ether_vlan_header);
+        vlan_hdr = (struct ether_vlan_header *)packet;
+        if (ntohs(vlan_hdr->ether_type) != ETHERTYPE_IP ||
+            len < ethHdrSize)
+            return 0;
+        etherType = ntohs(vlan_hdr->ether_type);
+        break;
+
+    default:
+        return 0;
+    }
+
+    if (virMacAddrCmpRaw(&req->macaddr, ether_hdr->ether_shost) == 0) {
+        /* packets from the VM */
+
+        if (etherType == ETHERTYPE_IP &&
+            (len >= ethHdrSize +
+                    sizeof(struct iphdr))) {
+            VIR_WARNINGS_NO_CAST_ALIGN
+            struct iphdr *iphdr = (struct iphdr*)(packet +
+                                                  ethHdrSize);
+            VIR_WARNINGS_RESET
+            vmaddr = iphdr->saddr;
+            /* skip mcast addresses (224.0.0.0 - 239.255.255.255),
+             * class E (240.0.0.0 - 255.255.255.255, includes eth.
+             * bcast) and zero address in DHCP Requests */
+            if ((ntohl(vmaddr) & 0xe0000000) == 0xe0000000 ||
+                vmaddr == 0)
+                return 0;
+
+            howDetected = DETECT_STATIC;
+        } else if (etherType == ETHERTYPE_ARP &&
+                   (len >= ethHdrSize +
+                           sizeof(struct f_arphdr))) {
+            VIR_WARNINGS_NO_CAST_ALIGN
+            struct f_arphdr *arphdr = (struct f_arphdr*)(packet +
+                                                 ethHdrSize);
+            VIR_WARNINGS_RESET
+            switch (ntohs(arphdr->arphdr.ar_op)) {
+            case ARPOP_REPLY:
+                vmaddr = arphdr->ar_sip;
+                howDetected = DETECT_STATIC;
+            break;
+            case ARPOP_REQUEST:
+                vmaddr = arphdr->ar_tip;
+                howDetected = DETECT_STATIC;
+            break;
+            }
+        }
+    } else if (virMacAddrCmpRaw(&req->macaddr,
+                                ether_hdr->ether_dhost) == 0 ||
+               /* allow Broadcast replies from DHCP server */
+               virMacAddrIsBroadcastRaw(ether_hdr->ether_dhost)) {
+        /* packets to the VM */
+        if (etherType == ETHERTYPE_IP &&
+            (len >= ethHdrSize +
+                    sizeof(struct iphdr))) {
+            VIR_WARNINGS_NO_CAST_ALIGN
+            struct iphdr *iphdr = (struct iphdr*)(packet +
+                                                  ethHdrSize);
+            VIR_WARNINGS_RESET
+            if ((iphdr->protocol == IPPROTO_UDP) &&
+                (len >= ethHdrSize +
+                        iphdr->ihl * 4 +
+                        sizeof(struct udphdr))) {
+                VIR_WARNINGS_NO_CAST_ALIGN
+                struct udphdr *udphdr = (struct udphdr *)
+                                  ((char *)iphdr + iphdr->ihl * 4);
+                VIR_WARNINGS_RESET
+                if (ntohs(udphdr->source) == 67 &&
+                    ntohs(udphdr->dest)   == 68 &&
+                    len >= ethHdrSize +
+                           iphdr->ihl * 4 +
+                           sizeof(struct udphdr) +
+                           sizeof(struct dhcp)) {
+                    struct dhcp *dhcp = (struct dhcp *)
+                                ((char *)udphdr + sizeof(udphdr));
+                    if (dhcp->op == 2 /* BOOTREPLY */ &&
+                        virMacAddrCmpRaw(
+                                &req->macaddr,
+                                &dhcp->chaddr[0]) == 0) {
+                        dhcp_opts_len = len -
+                            (ethHdrSize + iphdr->ihl * 4 +
+                             sizeof(struct udphdr) +
+                             sizeof(struct dhcp));
+                        procDHCPOpts(dhcp, dhcp_opts_len,
+                                     &vmaddr,
+                                     &bcastaddr,
+                                     &howDetected);
+                    }
+                }
+            }
+        }
+    }
+
+    if (vmaddr && (req->howDetect & howDetected) == 0)
+        return 0;
+
+    return vmaddr;
+}
+
+
+static void learnIPAddressDone(virNWFilterIPAddrLearnReqPtr req,
+                               bool showError);
+
+
+/*
+ * Apply the firewall rules that let the VM talk while its IP address is
+ * being learned. Called by the learner thread, which from now on holds
+ * the lock of the interface.
+ *
+ * Returns 0 on success, -1 if the request has been finished.
+ */
+static int
+learnIPAddressStart(virNWFilterIPAddrLearnReqPtr req)
+{
+    const char *listen_if = (strlen(req->linkdev) != 0) ? req->linkdev
+                                                        : req->ifname;
     virNWFilterTechDriverPtr techdriver = req->techdriver;
 
-    if (virNWFilterLockIface(req->ifname) < 0)
-       goto err_no_lock;
+    if (virNWFilterLockIface(req->ifname) < 0) {
+        virNWFilterDeregisterLearnReq(req->ifindex);
+        virNWFilterIPAddrLearnReqFree(req);
+        return -1;
+    }
 
     req->status = 0;
 
@@ -407,255 +544,527 @@ learnIPAddressThread(void *arg)
     if (virNetDevValidateConfig(req->ifname, NULL, req->ifindex) <= 0) {
         virResetLastError();
         req->status = ENODEV;
-        goto done;
+        goto error;
     }
 
-    handle = pcap_open_live(listen_if, BUFSIZ, 0, PKT_TIMEOUT_MS, errbuf);
-
-    if (handle == NULL) {
-        VIR_DEBUG("Couldn't open device %s: %s", listen_if, errbuf);
+    if (virNetDevGetIndex(listen_if, &req->listenIfindex) < 0) {
+        VIR_DEBUG("Couldn't find device %s", listen_if);
+        virResetLastError();
         req->status = ENODEV;
-        goto done;
+        goto error;
     }
 
-    virMacAddrFormat(&req->macaddr, macaddr);
-
     switch (req->howDetect) {
     case DETECT_DHCP:
         if (techdriver->applyDHCPOnlyRules(req->ifname,
                                            &req->macaddr,
                                            NULL, false) < 0) {
             req->status = EINVAL;
-            goto done;
+            goto error;
         }
-        virBufferAddLit(&buf, "src port 67 and dst port 68");
         break;
     default:
         if (techdriver->applyBasicRules(req->ifname,
                                         &req->macaddr) < 0) {
             req->status = EINVAL;
-            goto done;
+            goto error;
         }
-        virBufferAsprintf(&buf, "ether host %s or ether dst ff:ff:ff:ff:ff:ff",
-                          macaddr);
     }
 
-    if (virBufferError(&buf)) {
-        req->status = ENOMEM;
-        goto done;
+    return 0;
+
+ error:
+    learnIPAddressDone(req, true);
+    return -1;
+}
+
+
+/*
+ * Worker function instantiating the filter of an interface once its
+ * IP address has been learned.
+ */
+static void
+learnIPAddressFinish(void *jobdata, void *opaque ATTRIBUTE_UNUSED)
+{
+    virNWFilterIPAddrLearnReqPtr req = jobdata;
+    int ret;
+    virSocketAddr sa;
+    char *inetaddr;
+
+    sa.len = sizeof(sa.data.inet4);
+    sa.data.inet4.sin_family = AF_INET;
+    sa.data.inet4.sin_addr.s_addr = req->vmaddr;
+
+    if ((inetaddr = virSocketAddrFormat(&sa)) != NULL) {
+        if (virNWFilterIPAddrMapAddIPAddr(req->ifname, inetaddr) < 0) {
+            VIR_ERROR(_("Failed to add IP address %s to IP address "
+                      "cache for interface %s"), inetaddr, req->ifname);
+        }
+
+        ret = virNWFilterInstantiateFilterLate(req->driver,
+                                               NULL,
+                                               req->ifname,
+                                               req->ifindex,
+                                               req->linkdev,
+                                               &req->macaddr,
+                                               req->filtername,
+                                               req->filterparams);
+        VIR_DEBUG("Result from applying firewall rules on "
+                  "%s with IP addr %s : %d", req->ifname, inetaddr, ret);
+    }
+
+    VIR_DEBUG("IP address learning done for interface %s", req->ifname);
+
+    virNWFilterDeregisterLearnReq(req->ifindex);
+
+    virNWFilterIPAddrLearnReqFree(req);
+}
+
+
+/*
+ * Finish learning the IP address of an interface, either because it
+ * has been found (req->status == 0) or because of the error given in
+ * req->status. Called by the learner thread.
+ */
+static void
+learnIPAddressDone(virNWFilterIPAddrLearnReqPtr req, bool showError)
+{
+    if (req->status == 0) {
+        /* It is necessary to unlock interface here to avoid updateMutex and
+         * interface ordering deadlocks. Otherwise we are going to
+         * instantiate the filter, which will try to lock updateMutex, and
+         * some other thread instantiating a filter in parallel is holding
+         * updateMutex and is trying to lock interface, both will deadlock.
+         * Also it is safe to unlock interface here because we stopped
+         * capturing and applied necessary rules on the interface, while
+         * instantiating a new filter doesn't require a locked interface.
+         * For the same reason the filter is instantiated by a worker:
+         * the learner thread holds the locks of all other interfaces
+         * it is still learning on.*/
+        virNWFilterUnlockIface(req->ifname);
+
+        if (virThreadPoolSendJob(learnFinishWorkers, 0, req) < 0)
+            learnIPAddressFinish(req, NULL);
+        return;
+    }
+
+    if (showError)
+        virReportSystemError(req->status,
+                             _("encountered an error on interface %s "
+                               "index %d"),
+                             req->ifname, req->ifindex);
+
+    req->techdriver->applyDropAllRules(req->ifname);
+    virNWFilterUnlockIface(req->ifname);
+
+    VIR_DEBUG("IP address learning terminating for interface %s",
+              req->ifname);
+
+    virNWFilterDeregisterLearnReq(req->ifindex);
+
+    virNWFilterIPAddrLearnReqFree(req);
+}
+
+
+/*
+ * Attach a filter to the packet socket that only lets through the
+ * packets that may reveal the IP address of one of the interfaces in
+ * @reqs. The program checks the index of the interface a packet was
+ * seen on and continues with the pcap compiled filter built from the
+ * MAC addresses of the interfaces.
+ */
+static int
+learnIPAddressSetFilter(int fd,
+                        virNWFilterIPAddrLearnReqPtr *reqs,
+                        size_t nreqs)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char macaddr[VIR_MAC_STRING_BUFLEN];
+    char *filter = NULL;
+    pcap_t *handle = NULL;
+    struct bpf_program fp = { 0 };
+    struct sock_filter *insns = NULL;
+    struct sock_fprog prog;
+    size_t nprefix = 2 * nreqs + 2;
+    size_t i, n = 0;
+    int ret = -1;
+
+    for (i = 0; i < nreqs; i++) {
+        if (i > 0)
+            virBufferAddLit(&buf, " or ");
+
+        virMacAddrFormat(&reqs[i]->macaddr, macaddr);
+
+        switch (reqs[i]->howDetect) {
+        case DETECT_DHCP:
+            virBufferAsprintf(&buf, "((ether dst %s or ether broadcast) "
+                              "and src port 67 and dst port 68)", macaddr);
+            break;
+        default:
+            virBufferAsprintf(&buf, "(ether host %s or "
+                              "ether dst ff:ff:ff:ff:ff:ff)", macaddr);
+        }
     }
 
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
     filter = virBufferContentAndReset(&buf);
 
+    if (!(handle = pcap_open_dead(DLT_EN10MB, BUFSIZ))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Couldn't create a pcap handle"));
+        goto cleanup;
+    }
+
     if (pcap_compile(handle, &fp, filter, 1, 0) != 0) {
-        VIR_DEBUG("Couldn't compile filter '%s'", filter);
-        req->status = EINVAL;
-        goto done;
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Couldn't compile filter '%s': %s"),
+                       filter, pcap_geterr(handle));
+        goto cleanup;
+    }
+
+    /* too many interfaces to be selective; let the caller sort it out */
+    if (nprefix + fp.bf_len > BPF_MAXINSNS) {
+        pcap_freecode(&fp);
+        if (nprefix + 1 > BPF_MAXINSNS) {
+            ignore_value(setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER,
+                                    NULL, 0));
+            ret = 0;
+            goto cleanup;
+        }
+    }
+
+    if (VIR_ALLOC_N(insns, nprefix + MAX(fp.bf_len, 1)) < 0)
+        goto cleanup;
+
+    insns[n++] = (struct sock_filter)
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX);
+    for (i = 0; i < nreqs; i++) {
+        insns[n++] = (struct sock_filter)
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, reqs[i]->listenIfindex, 0, 1);
+        /* jump to the first instruction after the prefix */
+        insns[n] = (struct sock_filter)
+            BPF_STMT(BPF_JMP | BPF_JA, nprefix - n - 1);
+        n++;
+    }
+    insns[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+
+    if (fp.bf_len) {
+        /* struct bpf_insn and struct sock_filter share their layout */
+        memcpy(insns + n, fp.bf_insns, fp.bf_len * sizeof(*insns));
+        n += fp.bf_len;
+    } else {
+        insns[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, BUFSIZ);
     }
 
-    if (pcap_setfilter(handle, &fp) != 0) {
-        VIR_DEBUG("Couldn't set filter '%s'", filter);
-        req->status = EINVAL;
+    prog.len = n;
+    prog.filter = insns;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                   &prog, sizeof(prog)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Couldn't attach the IP address learning "
+                               "filter"));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (fp.bf_insns)
         pcap_freecode(&fp);
-        goto done;
+    if (handle)
+        pcap_close(handle);
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(filter);
+    VIR_FREE(insns);
+    return ret;
+}
+
+
+/*
+ * Open the packet socket all interfaces are learned on, unless it is
+ * already open, and set its filter for the given requests.
+ */
+static int
+learnIPAddressUpdateSocket(int *fd,
+                           virNWFilterIPAddrLearnReqPtr *reqs,
+                           size_t nreqs)
+{
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ALL),
+    };
+
+    if (*fd >= 0)
+        return learnIPAddressSetFilter(*fd, reqs, nreqs);
+
+    /* don't receive any packets before the filter is in place */
+    if ((*fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                      0)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Couldn't open packet socket"));
+        return -1;
     }
 
-    pcap_freecode(&fp);
+    if (learnIPAddressSetFilter(*fd, reqs, nreqs) < 0)
+        goto error;
 
-    while (req->status == 0 && vmaddr == 0) {
-        packet = pcap_next(handle, &header);
+    if (bind(*fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Couldn't bind packet socket"));
+        goto error;
+    }
 
-        if (!packet) {
+    return 0;
 
-            if (threadsTerminate || req->terminate) {
-                req->status = ECANCELED;
-                showError = false;
-                break;
-            }
+ error:
+    VIR_FORCE_CLOSE(*fd);
+    return -1;
+}
 
-            /* check whether VM's dev is still there */
-            if (virNetDevValidateConfig(req->ifname, NULL, req->ifindex) <= 0) {
-                virResetLastError();
-                req->status = ENODEV;
-                showError = false;
-                break;
+
+/**
+ * learnIPAddressThread
+ * arg: unused
+ *
+ * Learn the IP addresses being used on all interfaces for which it was
+ * requested. Use ARP Request and Reply messages, DHCP offers and the
+ * first IP packet being sent from the VM to detect the IP address it is
+ * using. Detects only one IP address per interface (IP aliasing not
+ * supported). The method on how the IP address is detected can be chosen
+ * through flags. DETECT_DHCP will require that the IP address is detected
+ * from a DHCP OFFER, DETECT_STATIC will require that the IP address was
+ * taken from an ARP packet or an IPv4 packet. Both flags can be set at
+ * the same time.
+ *
+ * All interfaces are served through a single packet socket whose filter
+ * is rebuilt whenever an interface is added or done. The socket is closed
+ * while there is nothing to learn.
+ */
+static void
+learnIPAddressThread(void *arg ATTRIBUTE_UNUSED)
+{
+    virNWFilterIPAddrLearnReqPtr *reqs = NULL;
+    size_t nreqs = 0;
+    virNWFilterIPAddrLearnReqPtr *newreqs;
+    size_t nnewreqs;
+    virNWFilterIPAddrLearnReqPtr req;
+    u_char packet[BUFSIZ];
+    struct sockaddr_ll sll;
+    socklen_t slllen;
+    struct pollfd fds[2];
+    unsigned long long now = 0, lastCheck = 0;
+    bool changed = false;
+    bool check;
+    bool quit;
+    ssize_t len;
+    size_t i, j, npkts;
+    char buf[16];
+    int fd = -1;
+
+    for (;;) {
+        virMutexLock(&pendingLearnReqLock);
+        newreqs = learnNewReqs;
+        nnewreqs = learnNNewReqs;
+        learnNewReqs = NULL;
+        learnNNewReqs = 0;
+        quit = learnThreadQuit;
+        virMutexUnlock(&pendingLearnReqLock);
+
+        for (i = 0; i < nnewreqs; i++) {
+            req = newreqs[i];
+
+            if (learnIPAddressStart(req) < 0)
+                continue;
+
+            if (VIR_APPEND_ELEMENT(reqs, nreqs, req) < 0) {
+                req->status = ENOMEM;
+                learnIPAddressDone(req, true);
+                continue;
+            }
+            changed = true;
+        }
+        VIR_FREE(newreqs);
+
+        if (quit)
+            break;
+
+        if (changed) {
+            changed = false;
+
+            if (nreqs == 0) {
+                VIR_FORCE_CLOSE(fd);
+            } else if (learnIPAddressUpdateSocket(&fd, reqs, nreqs) < 0) {
+                VIR_FORCE_CLOSE(fd);
+                while (nreqs > 0) {
+                    req = reqs[0];
+                    VIR_DELETE_ELEMENT(reqs, 0, nreqs);
+                    req->status = EINVAL;
+                    learnIPAddressDone(req, false);
+                }
             }
-            continue;
         }
 
-        if (header.len >= sizeof(struct ether_header)) {
-            ether_hdr = (struct ether_header*)packet;
+        fds[0].fd = learnWakeupFD[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = fd;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+
+        if (poll(fds, ARRAY_CARDINALITY(fds),
+                 nreqs ? PKT_TIMEOUT_MS : -1) < 0 &&
+            errno != EAGAIN && errno != EINTR) {
+            VIR_WARN("Polling the IP address learning socket failed: %s",
+                     virStrerror(errno, buf, sizeof(buf)));
+        }
 
-            switch (ntohs(ether_hdr->ether_type)) {
+        if (fds[0].revents) {
+            while (read(fds[0].fd, buf, sizeof(buf)) > 0)
+                ;
+        }
 
-            case ETHERTYPE_IP:
-                ethHdrSize = sizeof(struct ether_header);
-                etherType = ntohs(ether_hdr->ether_type);
+        /* bound the number of packets so timeouts are still noticed */
+        for (npkts = 0; fds[1].revents && npkts < LEARN_MAX_PKTS; npkts++) {
+            slllen = sizeof(sll);
+            len = recvfrom(fd, packet, sizeof(packet), 0,
+                           (struct sockaddr *)&sll, &slllen);
+            if (len < 0)
                 break;
 
-            case ETHERTYPE_VLAN:
-                ethHdrSize = sizeof(struct ether_vlan_header);
-                vlan_hdr = (struct ether_vlan_header *)packet;
-                if (ntohs(vlan_hdr->ether_type) != ETHERTYPE_IP ||
-                    header.len < ethHdrSize)
+            for (j = 0; j < nreqs; j++) {
+                req = reqs[j];
+                if (req->listenIfindex != sll.sll_ifindex || req->vmaddr)
                     continue;
-                etherType = ntohs(vlan_hdr->ether_type);
-                break;
+                req->vmaddr = learnIPAddressProcessPacket(req, packet, len);
+            }
+        }
 
-            default:
+        /* check the interfaces at least every PKT_TIMEOUT_MS */
+        check = virTimeMillisNowRaw(&now) < 0 ||
+                now - lastCheck >= PKT_TIMEOUT_MS;
+        if (check)
+            lastCheck = now;
+
+        j = 0;
+        while (j < nreqs) {
+            req = reqs[j];
+
+            if (req->vmaddr == 0 && check) {
+                if (threadsTerminate || req->terminate) {
+                    req->status = ECANCELED;
+                } else if (virNetDevValidateConfig(req->ifname, NULL,
+                                                   req->ifindex) <= 0) {
+                    /* VM's dev is gone */
+                    virResetLastError();
+                    req->status = ENODEV;
+                }
+            }
+
+            if (req->vmaddr == 0 && req->status == 0) {
+                j++;
                 continue;
             }
 
-            if (virMacAddrCmpRaw(&req->macaddr, ether_hdr->ether_shost) == 0) {
-                /* packets from the VM */
-
-                if (etherType == ETHERTYPE_IP &&
-                    (header.len >= ethHdrSize +
-                                   sizeof(struct iphdr))) {
-                    VIR_WARNINGS_NO_CAST_ALIGN
-                    struct iphdr *iphdr = (struct iphdr*)(packet +
-                                                          ethHdrSize);
-                    VIR_WARNINGS_RESET
-                    vmaddr = iphdr->saddr;
-                    /* skip mcast addresses (224.0.0.0 - 239.255.255.255),
-                     * class E (240.0.0.0 - 255.255.255.255, includes eth.
-                     * bcast) and zero address in DHCP Requests */
-                    if ((ntohl(vmaddr) & 0xe0000000) == 0xe0000000 ||
-                        vmaddr == 0) {
-                        vmaddr = 0;
-                        continue;
-                    }
+            VIR_DELETE_ELEMENT(reqs, j, nreqs);
+            learnIPAddressDone(req, false);
+            changed = true;
+        }
+    }
 
-                    howDetected = DETECT_STATIC;
-                } else if (etherType == ETHERTYPE_ARP &&
-                           (header.len >= ethHdrSize +
-                                          sizeof(struct f_arphdr))) {
-                    VIR_WARNINGS_NO_CAST_ALIGN
-                    struct f_arphdr *arphdr = (struct f_arphdr*)(packet +
-                                                         ethHdrSize);
-                    VIR_WARNINGS_RESET
-                    switch (ntohs(arphdr->arphdr.ar_op)) {
-                    case ARPOP_REPLY:
-                        vmaddr = arphdr->ar_sip;
-                        howDetected = DETECT_STATIC;
-                    break;
-                    case ARPOP_REQUEST:
-                        vmaddr = arphdr->ar_tip;
-                        howDetected = DETECT_STATIC;
-                    break;
-                    }
-                }
-            } else if (virMacAddrCmpRaw(&req->macaddr,
-                                        ether_hdr->ether_dhost) == 0 ||
-                       /* allow Broadcast replies from DHCP server */
-                       virMacAddrIsBroadcastRaw(ether_hdr->ether_dhost)) {
-                /* packets to the VM */
-                if (etherType == ETHERTYPE_IP &&
-                    (header.len >= ethHdrSize +
-                                   sizeof(struct iphdr))) {
-                    VIR_WARNINGS_NO_CAST_ALIGN
-                    struct iphdr *iphdr = (struct iphdr*)(packet +
-                                                          ethHdrSize);
-                    VIR_WARNINGS_RESET
-                    if ((iphdr->protocol == IPPROTO_UDP) &&
-                        (header.len >= ethHdrSize +
-                                       iphdr->ihl * 4 +
-                                       sizeof(struct udphdr))) {
-                        VIR_WARNINGS_NO_CAST_ALIGN
-                        struct udphdr *udphdr = (struct udphdr *)
-                                          ((char *)iphdr + iphdr->ihl * 4);
-                        VIR_WARNINGS_RESET
-                        if (ntohs(udphdr->source) == 67 &&
-                            ntohs(udphdr->dest)   == 68 &&
-                            header.len >= ethHdrSize +
-                                          iphdr->ihl * 4 +
-                                          sizeof(struct udphdr) +
-                                          sizeof(struct dhcp)) {
-                            struct dhcp *dhcp = (struct dhcp *)
-                                        ((char *)udphdr + sizeof(udphdr));
-                            if (dhcp->op == 2 /* BOOTREPLY */ &&
-                                virMacAddrCmpRaw(
-                                        &req->macaddr,
-                                        &dhcp->chaddr[0]) == 0) {
-                                dhcp_opts_len = header.len -
-                                    (ethHdrSize + iphdr->ihl * 4 +
-                                     sizeof(struct udphdr) +
-                                     sizeof(struct dhcp));
-                                procDHCPOpts(dhcp, dhcp_opts_len,
-                                             &vmaddr,
-                                             &bcastaddr,
-                                             &howDetected);
-                            }
-                        }
-                    }
-                }
-            }
+    for (j = 0; j < nreqs; j++) {
+        reqs[j]->status = ECANCELED;
+        learnIPAddressDone(reqs[j], false);
+    }
+    VIR_FREE(reqs);
+    VIR_FORCE_CLOSE(fd);
+}
+
+
+/*
+ * Hand a registered request over to the learner thread, starting the
+ * thread if it is not running yet.
+ */
+static int
+learnIPAddressSubmit(virNWFilterIPAddrLearnReqPtr req)
+{
+    char c = 0;
+    int ret = -1;
+
+    virMutexLock(&pendingLearnReqLock);
+
+    if (!learnThreadRunning) {
+        if (!learnFinishWorkers &&
+            !(learnFinishWorkers = virThreadPoolNew(1, LEARN_FINISH_WORKERS,
+                                                    0, learnIPAddressFinish,
+                                                    NULL)))
+            goto cleanup;
+
+        if (learnWakeupFD[0] < 0 &&
+            pipe2(learnWakeupFD, O_CLOEXEC | O_NONBLOCK) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create IP address learning "
+                                   "wakeup pipe"));
+            goto cleanup;
         }
-        if (vmaddr && (req->howDetect & howDetected) == 0) {
-            vmaddr = 0;
-            howDetected = 0;
+
+        learnThreadQuit = false;
+
+        if (virThreadCreate(&learnThread, true,
+                            learnIPAddressThread, NULL) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create IP address learning "
+                                   "thread"));
+            goto cleanup;
         }
-    } /* while */
 
- done:
-    VIR_FREE(filter);
+        learnThreadRunning = true;
+    }
 
-    if (handle)
-        pcap_close(handle);
+    if (VIR_APPEND_ELEMENT(learnNewReqs, learnNNewReqs, req) < 0)
+        goto cleanup;
 
-    if (req->status == 0) {
-        int ret;
-        virSocketAddr sa;
-        sa.len = sizeof(sa.data.inet4);
-        sa.data.inet4.sin_family = AF_INET;
-        sa.data.inet4.sin_addr.s_addr = vmaddr;
-        char *inetaddr;
+    ignore_value(safewrite(learnWakeupFD[1], &c, 1));
 
-        /* It is necessary to unlock interface here to avoid updateMutex and
-         * interface ordering deadlocks. Otherwise we are going to
-         * instantiate the filter, which will try to lock updateMutex, and
-         * some other thread instantiating a filter in parallel is holding
-         * updateMutex and is trying to lock interface, both will deadlock.
-         * Also it is safe to unlock interface here because we stopped
-         * capturing and applied necessary rules on the interface, while
-         * instantiating a new filter doesn't require a locked interface.*/
-        virNWFilterUnlockIface(req->ifname);
+    ret = 0;
 
-        if ((inetaddr = virSocketAddrFormat(&sa)) != NULL) {
-            if (virNWFilterIPAddrMapAddIPAddr(req->ifname, inetaddr) < 0) {
-                VIR_ERROR(_("Failed to add IP address %s to IP address "
-                          "cache for interface %s"), inetaddr, req->ifname);
-            }
+ cleanup:
+    virMutexUnlock(&pendingLearnReqLock);
 
-            ret = virNWFilterInstantiateFilterLate(req->driver,
-                                                   NULL,
-                                                   req->ifname,
-                                                   req->ifindex,
-                                                   req->linkdev,
-                                                   &req->macaddr,
-                                                   req->filtername,
-                                                   req->filterparams);
-            VIR_DEBUG("Result from applying firewall rules on "
-                      "%s with IP addr %s : %d", req->ifname, inetaddr, ret);
-        }
-    } else {
-        if (showError)
-            virReportSystemError(req->status,
-                                 _("encountered an error on interface %s "
-                                   "index %d"),
-                                 req->ifname, req->ifindex);
+    return ret;
+}
 
-        techdriver->applyDropAllRules(req->ifname);
-        virNWFilterUnlockIface(req->ifname);
+
+/*
+ * Stop the learner thread; all requests must have been terminated.
+ */
+static void
+learnIPAddressStopThread(void)
+{
+    char c = 0;
+
+    virMutexLock(&pendingLearnReqLock);
+
+    if (!learnThreadRunning) {
+        virMutexUnlock(&pendingLearnReqLock);
+        goto cleanup;
     }
 
-    VIR_DEBUG("pcap thread terminating for interface %s", req->ifname);
+    learnThreadQuit = true;
+    ignore_value(safewrite(learnWakeupFD[1], &c, 1));
 
+    virMutexUnlock(&pendingLearnReqLock);
 
- err_no_lock:
-    virNWFilterDeregisterLearnReq(req->ifindex);
+    virThreadJoin(&learnThread);
+    learnThreadRunning = false;
 
-    virNWFilterIPAddrLearnReqFree(req);
+ cleanup:
+    virThreadPoolFree(learnFinishWorkers);
+    learnFinishWorkers = NULL;
+    VIR_FORCE_CLOSE(learnWakeupFD[0]);
+    VIR_FORCE_CLOSE(learnWakeupFD[1]);
 }
 
 
@@ -674,11 +1083,10 @@ learnIPAddressThread(void *arg)
  *              IP address; must choose any of the available flags
  *
  * Instruct to learn the IP address being used on a given interface (ifname).
- * Unless there already is a thread attempting to learn the IP address
- * being used on the interface, a thread is started that will listen on
- * the traffic being sent on the interface (or link device) with the
- * MAC address that is provided. Will then launch the application of the
- * firewall rules on the interface.
+ * Unless there already is a request to learn the IP address being used on
+ * the interface, the learner thread will listen on the traffic being sent
+ * on the interface (or link device) with the MAC address that is provided.
+ * Will then launch the application of the firewall rules on the interface.
  */
 int
 virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
@@ -692,7 +1100,6 @@ virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
                           enum howDetect howDetect)
 {
     int rc;
-    virThread thread;
     virNWFilterIPAddrLearnReqPtr req = NULL;
     virNWFilterHashTablePtr ht = NULL;
 
@@ -749,10 +1156,7 @@ virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
     if (rc < 0)
         goto err_free_req;
 
-    if (virThreadCreate(&thread,
-                        false,
-                        learnIPAddressThread,
-                        req) != 0)
+    if (learnIPAddressSubmit(req) < 0)
         goto err_dereg_req;
 
     return 0;
@@ -822,6 +1226,15 @@ virNWFilterLearnThreadsTerminate(bool allowNewThreads)
 {
     threadsTerminate = true;
 
+#ifdef HAVE_LIBPCAP
+    virMutexLock(&pendingLearnReqLock);
+    if (learnWakeupFD[1] >= 0) {
+        char c = 0;
+        ignore_value(safewrite(learnWakeupFD[1], &c, 1));
+    }
+    virMutexUnlock(&pendingLearnReqLock);
+#endif
+
     while (virHashSize(pendingLearnReq) != 0)
         usleep((PKT_TIMEOUT_MS * 1000) / 3);
 
@@ -841,6 +1254,10 @@ virNWFilterLearnShutdown(void)
 
     virNWFilterLearnThreadsTerminate(false);
 
+#ifdef HAVE_LIBPCAP
+    learnIPAddressStopThread();
+#endif
+
     virHashFree(pendingLearnReq);
     pendingLearnReq = NULL;
 
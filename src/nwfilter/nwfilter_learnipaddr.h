@@ -50,6 +50,10 @@ struct _virNWFilterIPAddrLearnReq {
 
     int status;
     volatile bool terminate;
+
+    /* owned by the learner thread */
+    int listenIfindex;
+    uint32_t vmaddr;
 };
 
 int virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
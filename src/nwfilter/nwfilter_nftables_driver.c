@@ -0,0 +1,1588 @@
+/*
+ * nwfilter_nftables_driver.c: driver for nftables on tap devices
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * All filters live in a single 'bridge' family table whose two base
+ * chains dispatch packets through a verdict map indexed by the name of
+ * the bridge port. Every interface has a fixed anchor chain in those
+ * maps which in turn jumps to the interface's root chain. The root and
+ * protocol chains follow the naming of the ebtables driver so that new
+ * rules can be prepared in the temporary ('J' and 'P') chains and then
+ * swapped in by rewriting the anchor, which nft does atomically.
+ *
+ * Rule variables that hold lists of values are not expanded into one
+ * rule per value when possible; they are matched through an anonymous
+ * set instead, which the kernel looks up in constant time.
+ *
+ * Only the layer 2 protocols are handled here. Filters that need
+ * anything else are passed on to the ebiptables driver, which also
+ * provides the basic rules used while learning IP addresses.
+ */
+
+#include <config.h>
+
+#include <stddef.h>
+
+#include "internal.h"
+
+#include "virbuffer.h"
+#include "viralloc.h"
+#include "virlog.h"
+#include "virerror.h"
+#include "virhash.h"
+#include "virthread.h"
+#include "nwfilter_conf.h"
+#include "nwfilter_ebiptables_driver.h"
+#include "nwfilter_nftables_driver.h"
+#include "virfile.h"
+#include "vircommand.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NWFILTER
+
+VIR_LOG_INIT("nwfilter.nwfilter_nftables_driver");
+
+#define NFTABLES_TABLE_NAME "libvirt-nwfilter"
+#define NFTABLES_TABLE "bridge " NFTABLES_TABLE_NAME
+
+#define NFTABLES_CHAIN_INCOMING "prerouting"
+#define NFTABLES_CHAIN_OUTGOING "postrouting"
+
+#define NFTABLES_MAP_INCOMING "in-ifaces"
+#define NFTABLES_MAP_OUTGOING "out-ifaces"
+
+#define NFTABLES_ANCHOR_INCOMING "in"
+#define NFTABLES_ANCHOR_OUTGOING "out"
+
+#define CHAINPREFIX_HOST_IN       'I'
+#define CHAINPREFIX_HOST_OUT      'O'
+#define CHAINPREFIX_HOST_IN_TEMP  'J'
+#define CHAINPREFIX_HOST_OUT_TEMP 'P'
+
+#define MAX_CHAINNAME_LENGTH_NFT 64
+
+#define PRINT_ROOT_CHAIN(buf, prefix, ifname) \
+    snprintf(buf, sizeof(buf), "%c-%s", prefix, ifname)
+#define PRINT_CHAIN(buf, prefix, ifname, suffix) \
+    snprintf(buf, sizeof(buf), "%c-%s/%s", prefix, ifname, suffix)
+#define PRINT_ANCHOR_CHAIN(buf, incoming, ifname) \
+    snprintf(buf, sizeof(buf), "%s-%s", \
+             incoming ? NFTABLES_ANCHOR_INCOMING : NFTABLES_ANCHOR_OUTGOING, \
+             ifname)
+
+/* Characters that are passed into nft identifiers unquoted */
+#define NFTABLES_VALID_NAME \
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.-"
+
+static char chainprefixes_host[3] = {
+    CHAINPREFIX_HOST_IN,
+    CHAINPREFIX_HOST_OUT,
+    0
+};
+
+static char chainprefixes_host_temp[3] = {
+    CHAINPREFIX_HOST_IN_TEMP,
+    CHAINPREFIX_HOST_OUT_TEMP,
+    0
+};
+
+static char chainprefixes_all[5] = {
+    CHAINPREFIX_HOST_IN,
+    CHAINPREFIX_HOST_OUT,
+    CHAINPREFIX_HOST_IN_TEMP,
+    CHAINPREFIX_HOST_OUT_TEMP,
+    0
+};
+
+
+/* Protocol specific chains, in the same order as the ebtables driver
+ * looks them up; 'match' selects the packets the root chain passes on */
+static const struct {
+    const char *val;
+    const char *match;
+} nftablesSubChains[] = {
+    { "ipv4", "ether type ip" },
+    { "ipv6", "ether type ip6" },
+    { "arp",  "ether type arp" },
+    { "rarp", "ether type 0x8035" },
+    { "vlan", "ether type 0x8100" },
+    { "stp",  "ether daddr " NWFILTER_MAC_BGA },
+    { "mac",  NULL },
+};
+
+
+typedef enum {
+    NFTABLES_MATCH_PLAIN = 0,
+    NFTABLES_MATCH_HEX,    /* value is printed in hexadecimal */
+    NFTABLES_MATCH_MASK,   /* @partner is an optional bit mask */
+    NFTABLES_MATCH_PREFIX, /* @partner is an optional prefix length */
+    NFTABLES_MATCH_RANGE,  /* @partner is an optional upper bound */
+} nftablesMatchType;
+
+typedef struct _nftablesMatch nftablesMatch;
+typedef nftablesMatch *nftablesMatchPtr;
+struct _nftablesMatch {
+    size_t item;         /* offset of the nwItemDesc in the rule */
+    size_t partner;      /* offset of the mask or range end, or 0 */
+    size_t depends;      /* offset of an item that must be present, or 0 */
+    const char *expr;
+    const char *revexpr; /* expr to use in reverse direction, or NULL */
+    nftablesMatchType type;
+    bool set;            /* a list of values may be matched as a set */
+};
+
+#define NFT_ITEM(field) offsetof(virNWFilterRuleDef, p.field)
+
+#define NFT_MATCH(field, partner, depends, expr, revexpr, type, set) \
+    { NFT_ITEM(field), partner, depends, expr, revexpr, \
+      NFTABLES_MATCH_ ## type, set }
+
+#define NFT_MATCH_ETHHDR(hdr) \
+    NFT_MATCH(hdr.ethHdr.dataSrcMACAddr, NFT_ITEM(hdr.ethHdr.dataSrcMACMask), \
+              0, "ether saddr", "ether daddr", MASK, true), \
+    NFT_MATCH(hdr.ethHdr.dataDstMACAddr, NFT_ITEM(hdr.ethHdr.dataDstMACMask), \
+              0, "ether daddr", "ether saddr", MASK, true)
+
+#define NFT_MATCH_LAST { 0, 0, 0, NULL, NULL, 0, false }
+
+#define NFTABLES_ITEM(rule, offset) \
+    ((nwItemDescPtr)((char *)(rule) + (offset)))
+
+static const nftablesMatch nftablesMacMatches[] = {
+    NFT_MATCH_ETHHDR(ethHdrFilter),
+    NFT_MATCH(ethHdrFilter.dataProtocolID, 0, 0,
+              "ether type", NULL, HEX, false),
+    NFT_MATCH_LAST
+};
+
+static const nftablesMatch nftablesIPMatches[] = {
+    NFT_MATCH_ETHHDR(ipHdrFilter),
+    NFT_MATCH(ipHdrFilter.ipHdr.dataSrcIPAddr,
+              NFT_ITEM(ipHdrFilter.ipHdr.dataSrcIPMask), 0,
+              "ip saddr", "ip daddr", PREFIX, true),
+    NFT_MATCH(ipHdrFilter.ipHdr.dataDstIPAddr,
+              NFT_ITEM(ipHdrFilter.ipHdr.dataDstIPMask), 0,
+              "ip daddr", "ip saddr", PREFIX, true),
+    NFT_MATCH(ipHdrFilter.ipHdr.dataProtocolID, 0, 0,
+              "ip protocol", NULL, PLAIN, false),
+    NFT_MATCH(ipHdrFilter.portData.dataSrcPortStart,
+              NFT_ITEM(ipHdrFilter.portData.dataSrcPortEnd),
+              NFT_ITEM(ipHdrFilter.ipHdr.dataProtocolID),
+              "th sport", "th dport", RANGE, true),
+    NFT_MATCH(ipHdrFilter.portData.dataDstPortStart,
+              NFT_ITEM(ipHdrFilter.portData.dataDstPortEnd),
+              NFT_ITEM(ipHdrFilter.ipHdr.dataProtocolID),
+              "th dport", "th sport", RANGE, true),
+    NFT_MATCH_LAST
+};
+
+static const nftablesMatch nftablesIPv6Matches[] = {
+    NFT_MATCH_ETHHDR(ipv6HdrFilter),
+    NFT_MATCH(ipv6HdrFilter.ipHdr.dataSrcIPAddr,
+              NFT_ITEM(ipv6HdrFilter.ipHdr.dataSrcIPMask), 0,
+              "ip6 saddr", "ip6 daddr", PREFIX, true),
+    NFT_MATCH(ipv6HdrFilter.ipHdr.dataDstIPAddr,
+              NFT_ITEM(ipv6HdrFilter.ipHdr.dataDstIPMask), 0,
+              "ip6 daddr", "ip6 saddr", PREFIX, true),
+    NFT_MATCH(ipv6HdrFilter.ipHdr.dataProtocolID, 0, 0,
+              "meta l4proto", NULL, PLAIN, false),
+    NFT_MATCH(ipv6HdrFilter.portData.dataSrcPortStart,
+              NFT_ITEM(ipv6HdrFilter.portData.dataSrcPortEnd),
+              NFT_ITEM(ipv6HdrFilter.ipHdr.dataProtocolID),
+              "th sport", "th dport", RANGE, true),
+    NFT_MATCH(ipv6HdrFilter.portData.dataDstPortStart,
+              NFT_ITEM(ipv6HdrFilter.portData.dataDstPortEnd),
+              NFT_ITEM(ipv6HdrFilter.ipHdr.dataProtocolID),
+              "th dport", "th sport", RANGE, true),
+    NFT_MATCH_LAST
+};
+
+static const nftablesMatch nftablesARPMatches[] = {
+    NFT_MATCH_ETHHDR(arpHdrFilter),
+    NFT_MATCH(arpHdrFilter.dataHWType, 0, 0,
+              "arp htype", NULL, PLAIN, false),
+    NFT_MATCH(arpHdrFilter.dataOpcode, 0, 0,
+              "arp operation", NULL, PLAIN, false),
+    NFT_MATCH(arpHdrFilter.dataProtocolType, 0, 0,
+              "arp ptype", NULL, HEX, false),
+    NFT_MATCH(arpHdrFilter.dataARPSrcIPAddr,
+              NFT_ITEM(arpHdrFilter.dataARPSrcIPMask), 0,
+              "arp saddr ip", "arp daddr ip", PREFIX, true),
+    NFT_MATCH(arpHdrFilter.dataARPDstIPAddr,
+              NFT_ITEM(arpHdrFilter.dataARPDstIPMask), 0,
+              "arp daddr ip", "arp saddr ip", PREFIX, true),
+    NFT_MATCH(arpHdrFilter.dataARPSrcMACAddr, 0, 0,
+              "arp saddr ether", "arp daddr ether", PLAIN, true),
+    NFT_MATCH(arpHdrFilter.dataARPDstMACAddr, 0, 0,
+              "arp daddr ether", "arp saddr ether", PLAIN, true),
+    NFT_MATCH_LAST
+};
+
+static const nftablesMatch nftablesRARPMatches[] = {
+    NFT_MATCH_ETHHDR(arpHdrFilter),
+    NFT_MATCH_LAST
+};
+
+static const nftablesMatch nftablesNoMatches[] = {
+    NFT_MATCH_LAST
+};
+
+/* Attributes that the ebtables driver honours but that have no
+ * equivalent here; rules using them make the whole filter fall back */
+static const size_t nftablesIPUnsupported[] = {
+    NFT_ITEM(ipHdrFilter.ipHdr.dataDSCP),
+    0
+};
+
+static const size_t nftablesIPv6Unsupported[] = {
+    NFT_ITEM(ipv6HdrFilter.dataICMPTypeStart),
+    NFT_ITEM(ipv6HdrFilter.dataICMPTypeEnd),
+    NFT_ITEM(ipv6HdrFilter.dataICMPCodeStart),
+    NFT_ITEM(ipv6HdrFilter.dataICMPCodeEnd),
+    0
+};
+
+static const size_t nftablesARPUnsupported[] = {
+    NFT_ITEM(arpHdrFilter.dataGratuitousARP),
+    0
+};
+
+/* nft can only match ARP payload next to an ARP ethertype */
+static const size_t nftablesRARPUnsupported[] = {
+    NFT_ITEM(arpHdrFilter.dataHWType),
+    NFT_ITEM(arpHdrFilter.dataProtocolType),
+    NFT_ITEM(arpHdrFilter.dataOpcode),
+    NFT_ITEM(arpHdrFilter.dataARPSrcMACAddr),
+    NFT_ITEM(arpHdrFilter.dataARPSrcIPAddr),
+    NFT_ITEM(arpHdrFilter.dataARPDstMACAddr),
+    NFT_ITEM(arpHdrFilter.dataARPDstIPAddr),
+    NFT_ITEM(arpHdrFilter.dataGratuitousARP),
+    0
+};
+
+static const size_t nftablesNoUnsupported[] = {
+    0
+};
+
+typedef struct _nftablesProtocol nftablesProtocol;
+typedef nftablesProtocol *nftablesProtocolPtr;
+struct _nftablesProtocol {
+    virNWFilterRuleProtocolType prtclType;
+    const char *match;
+    const nftablesMatch *matches;
+    const size_t *unsupported;
+};
+
+static const nftablesProtocol nftablesProtocols[] = {
+    { VIR_NWFILTER_RULE_PROTOCOL_NONE, NULL,
+      nftablesNoMatches, nftablesNoUnsupported },
+    { VIR_NWFILTER_RULE_PROTOCOL_MAC, NULL,
+      nftablesMacMatches, nftablesNoUnsupported },
+    { VIR_NWFILTER_RULE_PROTOCOL_IP, "ether type ip",
+      nftablesIPMatches, nftablesIPUnsupported },
+    { VIR_NWFILTER_RULE_PROTOCOL_IPV6, "ether type ip6",
+      nftablesIPv6Matches, nftablesIPv6Unsupported },
+    { VIR_NWFILTER_RULE_PROTOCOL_ARP, "ether type arp",
+      nftablesARPMatches, nftablesARPUnsupported },
+    { VIR_NWFILTER_RULE_PROTOCOL_RARP, "ether type 0x8035",
+      nftablesRARPMatches, nftablesRARPUnsupported },
+};
+
+
+/* Per interface bookkeeping of which driver holds the rules */
+typedef struct _nftablesIface nftablesIface;
+typedef nftablesIface *nftablesIfacePtr;
+struct _nftablesIface {
+    virNWFilterTechDriverPtr active;  /* NULL if unknown */
+    virNWFilterTechDriverPtr pending; /* driver of the new rules */
+};
+
+static virMutex nftablesIfacesLock;
+static virHashTablePtr nftablesIfaces;
+
+
+static const nftablesProtocol *
+nftablesGetProtocol(virNWFilterRuleProtocolType prtclType)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(nftablesProtocols); i++) {
+        if (nftablesProtocols[i].prtclType == prtclType)
+            return &nftablesProtocols[i];
+    }
+
+    return NULL;
+}
+
+
+static bool
+nftablesNameIsValid(const char *name)
+{
+    return *name && strspn(name, NFTABLES_VALID_NAME) == strlen(name);
+}
+
+
+static bool
+nftablesRuleIsSupported(virNWFilterRuleInstPtr rule)
+{
+    const nftablesProtocol *proto;
+    const nftablesMatch *match;
+    size_t i;
+
+    if (!nftablesNameIsValid(rule->chainSuffix))
+        return false;
+
+    if (!(proto = nftablesGetProtocol(rule->def->prtclType)))
+        return false;
+
+    for (i = 0; proto->unsupported[i]; i++) {
+        if (HAS_ENTRY_ITEM(NFTABLES_ITEM(rule->def, proto->unsupported[i])))
+            return false;
+    }
+
+    for (match = proto->matches; match->expr; match++) {
+        if (match->depends &&
+            HAS_ENTRY_ITEM(NFTABLES_ITEM(rule->def, match->item)) &&
+            !HAS_ENTRY_ITEM(NFTABLES_ITEM(rule->def, match->depends)))
+            return false;
+    }
+
+    return true;
+}
+
+
+static bool
+nftablesRulesAreSupported(const char *ifname,
+                          virNWFilterRuleInstPtr *rules,
+                          size_t nrules)
+{
+    size_t i;
+
+    if (!nftablesNameIsValid(ifname) ||
+        strlen(ifname) + MAX_CHAIN_SUFFIX_SIZE + 4 > MAX_CHAINNAME_LENGTH_NFT)
+        return false;
+
+    for (i = 0; i < nrules; i++) {
+        if (!nftablesRuleIsSupported(rules[i]))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Decide whether the values of @access can be matched as a set. This
+ * is only possible if a single attribute of the rule uses the variable
+ * and no other variable is iterated along with it.
+ */
+static bool
+nftablesVarAccessIsSet(virNWFilterRuleDefPtr rule,
+                       virNWFilterVarAccessPtr access)
+{
+    const nftablesProtocol *proto = nftablesGetProtocol(rule->prtclType);
+    const nftablesMatch *match;
+    unsigned int iterId;
+    size_t refs = 0;
+    bool eligible = false;
+    size_t i;
+
+    if (!proto ||
+        virNWFilterVarAccessGetType(access) != VIR_NWFILTER_VAR_ACCESS_ITERATOR)
+        return false;
+
+    iterId = virNWFilterVarAccessGetIterId(access);
+    for (i = 0; i < rule->nVarAccess; i++) {
+        if (rule->varAccess[i] != access &&
+            virNWFilterVarAccessGetType(rule->varAccess[i]) ==
+            VIR_NWFILTER_VAR_ACCESS_ITERATOR &&
+            virNWFilterVarAccessGetIterId(rule->varAccess[i]) == iterId)
+            return false;
+    }
+
+    for (match = proto->matches; match->expr; match++) {
+        nwItemDescPtr item = NFTABLES_ITEM(rule, match->item);
+        nwItemDescPtr partner = NULL;
+
+        if (match->partner)
+            partner = NFTABLES_ITEM(rule, match->partner);
+
+        if (HAS_ENTRY_ITEM(item) && item->varAccess == access) {
+            refs++;
+            eligible = match->set && !(partner && HAS_ENTRY_ITEM(partner));
+        }
+        if (partner && HAS_ENTRY_ITEM(partner) && partner->varAccess == access)
+            refs++;
+    }
+
+    return refs == 1 && eligible;
+}
+
+
+static bool
+nftablesVarAccessInList(virNWFilterVarAccessPtr access,
+                        virNWFilterVarAccessPtr *list,
+                        size_t nlist)
+{
+    size_t i;
+
+    for (i = 0; i < nlist; i++) {
+        if (list[i] == access)
+            return true;
+    }
+
+    return false;
+}
+
+
+static int
+nftablesPrintDataType(virBufferPtr buf,
+                      virNWFilterVarCombIterPtr vars,
+                      nwItemDescPtr item,
+                      bool asHex)
+{
+    char macaddr[VIR_MAC_STRING_BUFLEN];
+    char *data;
+
+    if ((item->flags & NWFILTER_ENTRY_ITEM_FLAG_HAS_VAR)) {
+        const char *val;
+
+        if (!(val = virNWFilterVarCombIterGetVarValue(vars, item->varAccess)))
+            return -1;
+
+        virBufferAdd(buf, val, -1);
+        return 0;
+    }
+
+    switch (item->datatype) {
+    case DATATYPE_IPADDR:
+    case DATATYPE_IPV6ADDR:
+        if (!(data = virSocketAddrFormat(&item->u.ipaddr)))
+            return -1;
+        virBufferAdd(buf, data, -1);
+        VIR_FREE(data);
+        break;
+
+    case DATATYPE_MACADDR:
+    case DATATYPE_MACMASK:
+        virBufferAdd(buf, virMacAddrFormat(&item->u.macaddr, macaddr), -1);
+        break;
+
+    case DATATYPE_IPMASK:
+    case DATATYPE_IPV6MASK:
+        virBufferAsprintf(buf, "%d", item->u.u8);
+        break;
+
+    case DATATYPE_UINT32:
+    case DATATYPE_UINT32_HEX:
+        virBufferAsprintf(buf, asHex ? "0x%x" : "%u", item->u.u32);
+        break;
+
+    case DATATYPE_UINT16:
+    case DATATYPE_UINT16_HEX:
+        virBufferAsprintf(buf, asHex ? "0x%x" : "%d", item->u.u16);
+        break;
+
+    case DATATYPE_UINT8:
+    case DATATYPE_UINT8_HEX:
+        virBufferAsprintf(buf, asHex ? "0x%x" : "%d", item->u.u8);
+        break;
+
+    default:
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unhandled datatype %x"), item->datatype);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+nftablesPrintSet(virBufferPtr buf,
+                 virNWFilterHashTablePtr hash,
+                 virNWFilterVarAccessPtr access)
+{
+    const char *varName = virNWFilterVarAccessGetVarName(access);
+    virNWFilterVarValuePtr value;
+    unsigned int card;
+    unsigned int i, j;
+
+    if (!(value = virHashLookup(hash->hashTable, varName))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Could not find value for variable '%s'"),
+                       varName);
+        return -1;
+    }
+
+    card = virNWFilterVarValueGetCardinality(value);
+    if (card == 1) {
+        virBufferAdd(buf, virNWFilterVarValueGetNthValue(value, 0), -1);
+        return 0;
+    }
+
+    virBufferAddLit(buf, "{ ");
+    for (i = 0; i < card; i++) {
+        const char *val = virNWFilterVarValueGetNthValue(value, i);
+
+        /* nft rejects duplicate elements */
+        for (j = 0; j < i; j++) {
+            if (STREQ(val, virNWFilterVarValueGetNthValue(value, j)))
+                break;
+        }
+        if (j < i)
+            continue;
+
+        if (i > 0)
+            virBufferAddLit(buf, ", ");
+        virBufferAdd(buf, val, -1);
+    }
+    virBufferAddLit(buf, " }");
+
+    return 0;
+}
+
+
+static int
+nftablesHandleMatch(virBufferPtr buf,
+                    virNWFilterRuleInstPtr rule,
+                    virNWFilterVarCombIterPtr vars,
+                    virNWFilterVarAccessPtr *sets,
+                    size_t nsets,
+                    const nftablesMatch *match,
+                    bool reverse)
+{
+    nwItemDescPtr item = NFTABLES_ITEM(rule->def, match->item);
+    nwItemDescPtr partner = NULL;
+
+    if (!HAS_ENTRY_ITEM(item))
+        return 0;
+
+    if (match->partner &&
+        HAS_ENTRY_ITEM(NFTABLES_ITEM(rule->def, match->partner)))
+        partner = NFTABLES_ITEM(rule->def, match->partner);
+
+    virBufferAsprintf(buf, " %s",
+                      reverse && match->revexpr ? match->revexpr : match->expr);
+
+    if (partner && match->type == NFTABLES_MATCH_MASK) {
+        virBufferAddLit(buf, " & ");
+        if (nftablesPrintDataType(buf, vars, partner, false) < 0)
+            return -1;
+        virBufferAdd(buf, ENTRY_WANT_NEG_SIGN(item) ? " != " : " == ", -1);
+    } else {
+        virBufferAdd(buf, ENTRY_WANT_NEG_SIGN(item) ? " != " : " ", -1);
+    }
+
+    if ((item->flags & NWFILTER_ENTRY_ITEM_FLAG_HAS_VAR) &&
+        nftablesVarAccessInList(item->varAccess, sets, nsets))
+        return nftablesPrintSet(buf, rule->vars, item->varAccess);
+
+    if (nftablesPrintDataType(buf, vars, item,
+                              match->type == NFTABLES_MATCH_HEX) < 0)
+        return -1;
+
+    if (partner && match->type == NFTABLES_MATCH_PREFIX) {
+        virBufferAddChar(buf, '/');
+        if (nftablesPrintDataType(buf, vars, partner, false) < 0)
+            return -1;
+    } else if (partner && match->type == NFTABLES_MATCH_RANGE) {
+        virBufferAddChar(buf, '-');
+        if (nftablesPrintDataType(buf, vars, partner, false) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+nftablesCreateRuleInstance(virBufferPtr buf,
+                           char chainPrefix,
+                           virNWFilterRuleInstPtr rule,
+                           const char *ifname,
+                           virNWFilterVarCombIterPtr vars,
+                           virNWFilterVarAccessPtr *sets,
+                           size_t nsets,
+                           bool reverse)
+{
+    const nftablesProtocol *proto = nftablesGetProtocol(rule->def->prtclType);
+    const nftablesMatch *match;
+    char chain[MAX_CHAINNAME_LENGTH_NFT];
+    int action;
+
+    if (!proto) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected rule protocol %d"),
+                       rule->def->prtclType);
+        return -1;
+    }
+
+    if (STREQ(rule->chainSuffix,
+              virNWFilterChainSuffixTypeToString(
+                  VIR_NWFILTER_CHAINSUFFIX_ROOT)))
+        PRINT_ROOT_CHAIN(chain, chainPrefix, ifname);
+    else
+        PRINT_CHAIN(chain, chainPrefix, ifname, rule->chainSuffix);
+
+    virBufferAsprintf(buf, "add rule %s %s", NFTABLES_TABLE, chain);
+
+    if (proto->match)
+        virBufferAsprintf(buf, " %s", proto->match);
+
+    for (match = proto->matches; match->expr; match++) {
+        if (nftablesHandleMatch(buf, rule, vars, sets, nsets,
+                                match, reverse) < 0)
+            return -1;
+    }
+
+    /* REJECT not supported */
+    action = rule->def->action;
+    if (action == VIR_NWFILTER_RULE_ACTION_REJECT)
+        action = VIR_NWFILTER_RULE_ACTION_DROP;
+
+    virBufferAsprintf(buf, " %s\n",
+                      virNWFilterRuleActionTypeToString(action));
+
+    return 0;
+}
+
+
+static int
+nftablesRuleInstCommand(virBufferPtr buf,
+                        const char *ifname,
+                        virNWFilterRuleInstPtr rule)
+{
+    virNWFilterVarCombIterPtr vciter, tmp;
+    virNWFilterVarAccessPtr *sets = NULL;
+    virNWFilterVarAccessPtr *iters = NULL;
+    size_t nsets = 0, niters = 0;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(sets, rule->def->nVarAccess) < 0 ||
+        VIR_ALLOC_N(iters, rule->def->nVarAccess) < 0)
+        goto cleanup;
+
+    for (i = 0; i < rule->def->nVarAccess; i++) {
+        if (nftablesVarAccessIsSet(rule->def, rule->def->varAccess[i]))
+            sets[nsets++] = rule->def->varAccess[i];
+        else
+            iters[niters++] = rule->def->varAccess[i];
+    }
+
+    /* only the variables not matched as a set need to be expanded */
+    tmp = vciter = virNWFilterVarCombIterCreate(rule->vars, iters, niters);
+    if (!vciter)
+        goto cleanup;
+
+    do {
+        if (rule->def->tt == VIR_NWFILTER_RULE_DIRECTION_OUT ||
+            rule->def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+            if (nftablesCreateRuleInstance(buf, CHAINPREFIX_HOST_IN_TEMP,
+                                           rule, ifname, tmp, sets, nsets,
+                                           rule->def->tt ==
+                                           VIR_NWFILTER_RULE_DIRECTION_INOUT) < 0)
+                goto cleanup_iter;
+        }
+
+        if (rule->def->tt == VIR_NWFILTER_RULE_DIRECTION_IN ||
+            rule->def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+            if (nftablesCreateRuleInstance(buf, CHAINPREFIX_HOST_OUT_TEMP,
+                                           rule, ifname, tmp, sets, nsets,
+                                           false) < 0)
+                goto cleanup_iter;
+        }
+        tmp = virNWFilterVarCombIterNext(tmp);
+    } while (tmp != NULL);
+
+    ret = 0;
+ cleanup_iter:
+    virNWFilterVarCombIterFree(vciter);
+ cleanup:
+    VIR_FREE(sets);
+    VIR_FREE(iters);
+    return ret;
+}
+
+
+/*
+ * Get the names of all chains in our table; a missing table is not an
+ * error and simply results in an empty list.
+ */
+static int
+nftablesGetChains(char ***chains, size_t *nchains)
+{
+    virCommandPtr cmd;
+    char *output = NULL;
+    char **lines = NULL;
+    int status;
+    size_t i;
+    int ret = -1;
+
+    *chains = NULL;
+    *nchains = 0;
+
+    cmd = virCommandNewArgList(NFT_PATH, "list", "table",
+                               "bridge", NFTABLES_TABLE_NAME, NULL);
+    virCommandSetOutputBuffer(cmd, &output);
+    if (virCommandRun(cmd, &status) < 0)
+        goto cleanup;
+
+    if (status != 0 || !output) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!(lines = virStringSplit(output, "\n", 0)))
+        goto cleanup;
+
+    for (i = 0; lines[i]; i++) {
+        const char *line = lines[i];
+        const char *end;
+        char *name;
+
+        virSkipSpaces(&line);
+        if (!STRPREFIX(line, "chain "))
+            continue;
+        line += strlen("chain ");
+        if (!(end = strchr(line, ' ')))
+            continue;
+
+        if (VIR_STRNDUP(name, line, end - line) < 0 ||
+            VIR_APPEND_ELEMENT(*chains, *nchains, name) < 0) {
+            VIR_FREE(name);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        for (i = 0; i < *nchains; i++)
+            VIR_FREE((*chains)[i]);
+        VIR_FREE(*chains);
+        *nchains = 0;
+    }
+    virStringListFree(lines);
+    VIR_FREE(output);
+    virCommandFree(cmd);
+    return ret;
+}
+
+
+static void
+nftablesFreeChains(char **chains, size_t nchains)
+{
+    size_t i;
+
+    for (i = 0; i < nchains; i++)
+        VIR_FREE(chains[i]);
+    VIR_FREE(chains);
+}
+
+
+/* Whether the chain belongs to @ifname and has one of the @prefixes */
+static bool
+nftablesChainIsIface(const char *chain,
+                     const char *prefixes,
+                     const char *ifname)
+{
+    size_t len = strlen(ifname);
+
+    if (!chain[0] || !strchr(prefixes, chain[0]) || chain[1] != '-' ||
+        STRNEQLEN(chain + 2, ifname, len))
+        return false;
+
+    return chain[len + 2] == '\0' || chain[len + 2] == '/';
+}
+
+
+static bool
+nftablesHaveRootChain(char **chains,
+                      size_t nchains,
+                      char chainPrefix,
+                      const char *ifname)
+{
+    char chain[MAX_CHAINNAME_LENGTH_NFT];
+    size_t i;
+
+    PRINT_ROOT_CHAIN(chain, chainPrefix, ifname);
+
+    for (i = 0; i < nchains; i++) {
+        if (STREQ(chains[i], chain))
+            return true;
+    }
+
+    return false;
+}
+
+
+static void
+nftablesRemoveChains(virBufferPtr buf,
+                     char **chains,
+                     size_t nchains,
+                     const char *prefixes,
+                     const char *ifname)
+{
+    size_t i;
+
+    /* flush all chains first so that none is referenced by the time
+     * it gets deleted */
+    for (i = 0; i < nchains; i++) {
+        if (nftablesChainIsIface(chains[i], prefixes, ifname))
+            virBufferAsprintf(buf, "flush chain %s %s\n",
+                              NFTABLES_TABLE, chains[i]);
+    }
+
+    for (i = 0; i < nchains; i++) {
+        if (nftablesChainIsIface(chains[i], prefixes, ifname))
+            virBufferAsprintf(buf, "delete chain %s %s\n",
+                              NFTABLES_TABLE, chains[i]);
+    }
+}
+
+
+/*
+ * Make the anchor of @ifname jump to the root chain with @chainPrefix,
+ * or to nothing if @chainPrefix is 0. The anchor and its map element
+ * are created as needed; adding them is a no-op if they exist.
+ */
+static void
+nftablesLinkRootChain(virBufferPtr buf,
+                      bool incoming,
+                      char chainPrefix,
+                      const char *ifname)
+{
+    char anchor[MAX_CHAINNAME_LENGTH_NFT];
+    char chain[MAX_CHAINNAME_LENGTH_NFT];
+
+    PRINT_ANCHOR_CHAIN(anchor, incoming, ifname);
+
+    virBufferAsprintf(buf, "add chain %s %s\n", NFTABLES_TABLE, anchor);
+    virBufferAsprintf(buf, "add element %s %s { \"%s\" : jump %s }\n",
+                      NFTABLES_TABLE,
+                      incoming ? NFTABLES_MAP_INCOMING : NFTABLES_MAP_OUTGOING,
+                      ifname, anchor);
+    virBufferAsprintf(buf, "flush chain %s %s\n", NFTABLES_TABLE, anchor);
+
+    if (chainPrefix) {
+        PRINT_ROOT_CHAIN(chain, chainPrefix, ifname);
+        virBufferAsprintf(buf, "add rule %s %s jump %s\n",
+                          NFTABLES_TABLE, anchor, chain);
+    }
+}
+
+
+static void
+nftablesRemoveAnchorChain(virBufferPtr buf,
+                          bool incoming,
+                          const char *ifname)
+{
+    char anchor[MAX_CHAINNAME_LENGTH_NFT];
+
+    PRINT_ANCHOR_CHAIN(anchor, incoming, ifname);
+
+    nftablesLinkRootChain(buf, incoming, 0, ifname);
+    virBufferAsprintf(buf, "delete element %s %s { \"%s\" }\n",
+                      NFTABLES_TABLE,
+                      incoming ? NFTABLES_MAP_INCOMING : NFTABLES_MAP_OUTGOING,
+                      ifname);
+    virBufferAsprintf(buf, "delete chain %s %s\n", NFTABLES_TABLE, anchor);
+}
+
+
+static int
+nftablesApplyScript(virBufferPtr buf)
+{
+    virCommandPtr cmd;
+    char *script;
+    int ret;
+
+    if (virBufferCheckError(buf) < 0)
+        return -1;
+
+    /* nothing to do */
+    if (!(script = virBufferContentAndReset(buf)))
+        return 0;
+
+    cmd = virCommandNewArgList(NFT_PATH, "-f", "-", NULL);
+    virCommandSetInputBuffer(cmd, script);
+    ret = virCommandRun(cmd, NULL);
+
+    virCommandFree(cmd);
+    VIR_FREE(script);
+    return ret;
+}
+
+
+static int
+nftablesCreateBaseChains(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    virBufferAsprintf(&buf, "add table %s\n", NFTABLES_TABLE);
+    virBufferAsprintf(&buf,
+                      "add chain %s %s { type filter hook prerouting "
+                      "priority -300 ; }\n",
+                      NFTABLES_TABLE, NFTABLES_CHAIN_INCOMING);
+    virBufferAsprintf(&buf,
+                      "add chain %s %s { type filter hook postrouting "
+                      "priority 300 ; }\n",
+                      NFTABLES_TABLE, NFTABLES_CHAIN_OUTGOING);
+    virBufferAsprintf(&buf, "add map %s %s { type ifname : verdict ; }\n",
+                      NFTABLES_TABLE, NFTABLES_MAP_INCOMING);
+    virBufferAsprintf(&buf, "add map %s %s { type ifname : verdict ; }\n",
+                      NFTABLES_TABLE, NFTABLES_MAP_OUTGOING);
+
+    /* flushing keeps this idempotent without touching the interfaces */
+    virBufferAsprintf(&buf, "flush chain %s %s\n",
+                      NFTABLES_TABLE, NFTABLES_CHAIN_INCOMING);
+    virBufferAsprintf(&buf, "flush chain %s %s\n",
+                      NFTABLES_TABLE, NFTABLES_CHAIN_OUTGOING);
+    virBufferAsprintf(&buf, "add rule %s %s iifname vmap @%s\n",
+                      NFTABLES_TABLE, NFTABLES_CHAIN_INCOMING,
+                      NFTABLES_MAP_INCOMING);
+    virBufferAsprintf(&buf, "add rule %s %s oifname vmap @%s\n",
+                      NFTABLES_TABLE, NFTABLES_CHAIN_OUTGOING,
+                      NFTABLES_MAP_OUTGOING);
+
+    return nftablesApplyScript(&buf);
+}
+
+
+static int
+nftablesRuleInstSort(const void *a, const void *b)
+{
+    virNWFilterRuleInst * const *insta = a;
+    virNWFilterRuleInst * const *instb = b;
+    const char *root = virNWFilterChainSuffixTypeToString(
+                                     VIR_NWFILTER_CHAINSUFFIX_ROOT);
+    bool root_a = STREQ((*insta)->chainSuffix, root);
+    bool root_b = STREQ((*instb)->chainSuffix, root);
+
+    /* ensure root chain commands appear before all others since
+       we will need them to create the child chains */
+    if (root_a != root_b)
+        return root_a ? -1 : 1;
+
+    /* priorities are limited to range [-1000, 1000] */
+    return (*insta)->priority - (*instb)->priority;
+}
+
+
+struct nftablesSubChainInst {
+    virNWFilterChainPriority priority;
+    bool incoming;
+    size_t protoidx;
+    const char *filtername;
+};
+
+
+static int
+nftablesSubChainInstSort(const void *a, const void *b)
+{
+    const struct nftablesSubChainInst **insta = (const struct nftablesSubChainInst **)a;
+    const struct nftablesSubChainInst **instb = (const struct nftablesSubChainInst **)b;
+
+    /* priorities are limited to range [-1000, 1000] */
+    return (*insta)->priority - (*instb)->priority;
+}
+
+
+static int
+nftablesFilterOrderSort(const virHashKeyValuePair *a,
+                        const virHashKeyValuePair *b)
+{
+    /* elements' values has been limited to range [-1000, 1000] */
+    return *(virNWFilterChainPriority *)a->value -
+           *(virNWFilterChainPriority *)b->value;
+}
+
+
+static int
+nftablesGetSubChainInsts(virHashTablePtr chains,
+                         bool incoming,
+                         struct nftablesSubChainInst ***insts,
+                         size_t *ninsts)
+{
+    virHashKeyValuePairPtr filter_names;
+    size_t i, j;
+    int ret = -1;
+
+    if (!(filter_names = virHashGetItems(chains, nftablesFilterOrderSort)))
+        return -1;
+
+    for (i = 0; filter_names[i].key; i++) {
+        struct nftablesSubChainInst *inst;
+
+        for (j = 0; j < ARRAY_CARDINALITY(nftablesSubChains); j++) {
+            if (STRPREFIX(filter_names[i].key, nftablesSubChains[j].val))
+                break;
+        }
+        if (j == ARRAY_CARDINALITY(nftablesSubChains))
+            continue;
+
+        if (VIR_ALLOC(inst) < 0)
+            goto cleanup;
+        inst->priority = *(const virNWFilterChainPriority *)filter_names[i].value;
+        inst->incoming = incoming;
+        inst->protoidx = j;
+        inst->filtername = filter_names[i].key;
+
+        if (VIR_APPEND_ELEMENT(*insts, *ninsts, inst) < 0) {
+            VIR_FREE(inst);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(filter_names);
+    return ret;
+}
+
+
+static void
+nftablesCreateTmpSubChain(virBufferPtr buf,
+                          struct nftablesSubChainInst *inst,
+                          const char *ifname)
+{
+    char rootchain[MAX_CHAINNAME_LENGTH_NFT], chain[MAX_CHAINNAME_LENGTH_NFT];
+    char chainPrefix = inst->incoming ? CHAINPREFIX_HOST_IN_TEMP
+                                      : CHAINPREFIX_HOST_OUT_TEMP;
+    const char *match = nftablesSubChains[inst->protoidx].match;
+
+    PRINT_ROOT_CHAIN(rootchain, chainPrefix, ifname);
+    PRINT_CHAIN(chain, chainPrefix, ifname, inst->filtername);
+
+    virBufferAsprintf(buf, "add chain %s %s\n", NFTABLES_TABLE, chain);
+    virBufferAsprintf(buf, "add rule %s %s%s%s jump %s\n",
+                      NFTABLES_TABLE, rootchain,
+                      match ? " " : "", match ? match : "", chain);
+}
+
+
+static int
+nftablesApplyNewRulesNft(const char *ifname,
+                         virNWFilterRuleInstPtr *rules,
+                         size_t nrules)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virHashTablePtr chains_in_set  = virHashCreate(10, NULL);
+    virHashTablePtr chains_out_set = virHashCreate(10, NULL);
+    struct nftablesSubChainInst **subchains = NULL;
+    size_t nsubchains = 0;
+    char **chains = NULL;
+    size_t nchains = 0;
+    char chain[MAX_CHAINNAME_LENGTH_NFT];
+    size_t i, j;
+    int ret = -1;
+
+    if (!chains_in_set || !chains_out_set)
+        goto cleanup;
+
+    if (nftablesGetChains(&chains, &nchains) < 0)
+        goto cleanup;
+
+    if (nrules)
+        qsort(rules, nrules, sizeof(rules[0]), nftablesRuleInstSort);
+
+    /* cleanup whatever may exist */
+    nftablesRemoveChains(&buf, chains, nchains,
+                         chainprefixes_host_temp, ifname);
+
+    /* raise the priority of rules below the priority of their chain
+     * so that the chain is created before any of its rules, as done
+     * by the ebtables driver */
+    for (i = 0; i < nrules; i++) {
+        if (rules[i]->chainPriority > rules[i]->priority &&
+            !strstr("root", rules[i]->chainSuffix))
+            rules[i]->priority = rules[i]->chainPriority;
+    }
+
+    /* scan the rules to see which chains need to be created */
+    for (i = 0; i < nrules; i++) {
+        const char *name = rules[i]->chainSuffix;
+
+        if (rules[i]->def->tt == VIR_NWFILTER_RULE_DIRECTION_OUT ||
+            rules[i]->def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+            if (virHashUpdateEntry(chains_in_set, name,
+                                   &rules[i]->chainPriority) < 0)
+                goto cleanup;
+        }
+        if (rules[i]->def->tt == VIR_NWFILTER_RULE_DIRECTION_IN ||
+            rules[i]->def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+            if (virHashUpdateEntry(chains_out_set, name,
+                                   &rules[i]->chainPriority) < 0)
+                goto cleanup;
+        }
+    }
+
+    /* create needed chains */
+    if (virHashSize(chains_in_set) > 0) {
+        PRINT_ROOT_CHAIN(chain, CHAINPREFIX_HOST_IN_TEMP, ifname);
+        virBufferAsprintf(&buf, "add chain %s %s\n", NFTABLES_TABLE, chain);
+        if (nftablesGetSubChainInsts(chains_in_set, true,
+                                     &subchains, &nsubchains) < 0)
+            goto cleanup;
+    }
+    if (virHashSize(chains_out_set) > 0) {
+        PRINT_ROOT_CHAIN(chain, CHAINPREFIX_HOST_OUT_TEMP, ifname);
+        virBufferAsprintf(&buf, "add chain %s %s\n", NFTABLES_TABLE, chain);
+        if (nftablesGetSubChainInsts(chains_out_set, false,
+                                     &subchains, &nsubchains) < 0)
+            goto cleanup;
+    }
+
+    if (nsubchains > 0)
+        qsort(subchains, nsubchains, sizeof(subchains[0]),
+              nftablesSubChainInstSort);
+
+    for (i = 0, j = 0; i < nrules; i++) {
+        while (j < nsubchains &&
+               subchains[j]->priority <= rules[i]->priority)
+            nftablesCreateTmpSubChain(&buf, subchains[j++], ifname);
+
+        if (nftablesRuleInstCommand(&buf, ifname, rules[i]) < 0)
+            goto cleanup;
+    }
+    while (j < nsubchains)
+        nftablesCreateTmpSubChain(&buf, subchains[j++], ifname);
+
+    /* switch the interface over to the new chains in the same batch */
+    if (virHashSize(chains_in_set) > 0)
+        nftablesLinkRootChain(&buf, true, CHAINPREFIX_HOST_IN_TEMP, ifname);
+    if (virHashSize(chains_out_set) > 0)
+        nftablesLinkRootChain(&buf, false, CHAINPREFIX_HOST_OUT_TEMP, ifname);
+
+    if (nftablesApplyScript(&buf) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    for (i = 0; i < nsubchains; i++)
+        VIR_FREE(subchains[i]);
+    VIR_FREE(subchains);
+    nftablesFreeChains(chains, nchains);
+    virHashFree(chains_in_set);
+    virHashFree(chains_out_set);
+    return ret;
+}
+
+
+static int
+nftablesTearNewRulesNft(const char *ifname)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char **chains = NULL;
+    size_t nchains = 0;
+    int ret;
+
+    if (nftablesGetChains(&chains, &nchains) < 0)
+        return -1;
+
+    /* point the anchors back to the old chains, if the new ones
+     * had been linked */
+    if (nftablesHaveRootChain(chains, nchains,
+                              CHAINPREFIX_HOST_IN_TEMP, ifname))
+        nftablesLinkRootChain(&buf, true,
+                              nftablesHaveRootChain(chains, nchains,
+                                                    CHAINPREFIX_HOST_IN,
+                                                    ifname) ?
+                              CHAINPREFIX_HOST_IN : 0, ifname);
+    if (nftablesHaveRootChain(chains, nchains,
+                              CHAINPREFIX_HOST_OUT_TEMP, ifname))
+        nftablesLinkRootChain(&buf, false,
+                              nftablesHaveRootChain(chains, nchains,
+                                                    CHAINPREFIX_HOST_OUT,
+                                                    ifname) ?
+                              CHAINPREFIX_HOST_OUT : 0, ifname);
+
+    nftablesRemoveChains(&buf, chains, nchains,
+                         chainprefixes_host_temp, ifname);
+
+    ret = nftablesApplyScript(&buf);
+    nftablesFreeChains(chains, nchains);
+    return ret;
+}
+
+
+static int
+nftablesTearOldRulesNft(const char *ifname)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char **chains = NULL;
+    size_t nchains = 0;
+    size_t i;
+    int ret = -1;
+
+    if (nftablesGetChains(&chains, &nchains) < 0)
+        return -1;
+
+    /* anchors still pointing to old chains have no new ones replacing
+     * them and must be cleared before the old chains can go */
+    if (!nftablesHaveRootChain(chains, nchains,
+                               CHAINPREFIX_HOST_IN_TEMP, ifname) &&
+        nftablesHaveRootChain(chains, nchains,
+                              CHAINPREFIX_HOST_IN, ifname))
+        nftablesLinkRootChain(&buf, true, 0, ifname);
+    if (!nftablesHaveRootChain(chains, nchains,
+                               CHAINPREFIX_HOST_OUT_TEMP, ifname) &&
+        nftablesHaveRootChain(chains, nchains,
+                              CHAINPREFIX_HOST_OUT, ifname))
+        nftablesLinkRootChain(&buf, false, 0, ifname);
+
+    nftablesRemoveChains(&buf, chains, nchains, chainprefixes_host, ifname);
+
+    if (nftablesApplyScript(&buf) < 0)
+        goto cleanup;
+
+    /* the old names are only free once the deletion is committed */
+    for (i = 0; i < nchains; i++) {
+        if (nftablesChainIsIface(chains[i], chainprefixes_host_temp, ifname))
+            virBufferAsprintf(&buf, "rename chain %s %s %c%s\n",
+                              NFTABLES_TABLE, chains[i],
+                              chains[i][0] == CHAINPREFIX_HOST_IN_TEMP ?
+                              CHAINPREFIX_HOST_IN : CHAINPREFIX_HOST_OUT,
+                              chains[i] + 1);
+    }
+
+    if (nftablesApplyScript(&buf) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    nftablesFreeChains(chains, nchains);
+    return ret;
+}
+
+
+static int
+nftablesAllTeardownNft(const char *ifname)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char **chains = NULL;
+    size_t nchains = 0;
+    int ret;
+
+    if (nftablesGetChains(&chains, &nchains) < 0)
+        return -1;
+
+    nftablesRemoveAnchorChain(&buf, true, ifname);
+    nftablesRemoveAnchorChain(&buf, false, ifname);
+    nftablesRemoveChains(&buf, chains, nchains, chainprefixes_all, ifname);
+
+    ret = nftablesApplyScript(&buf);
+    nftablesFreeChains(chains, nchains);
+    return ret;
+}
+
+
+/*
+ * Look up the bookkeeping of @ifname. Must be called with
+ * nftablesIfacesLock held. Returns NULL if there is none and
+ * @create is false, or on OOM.
+ */
+static nftablesIfacePtr
+nftablesIfaceGet(const char *ifname, bool create)
+{
+    nftablesIfacePtr iface;
+
+    if (!nftablesIfaces)
+        return NULL;
+
+    if ((iface = virHashLookup(nftablesIfaces, ifname)) || !create)
+        return iface;
+
+    if (VIR_ALLOC(iface) < 0)
+        return NULL;
+
+    if (virHashAddEntry(nftablesIfaces, ifname, iface) < 0) {
+        VIR_FREE(iface);
+        return NULL;
+    }
+
+    return iface;
+}
+
+
+static int
+nftablesApplyNewRules(const char *ifname,
+                      virNWFilterRuleInstPtr *rules,
+                      size_t nrules)
+{
+    virNWFilterTechDriverPtr drv = &nftables_driver;
+    nftablesIfacePtr iface;
+    int ret;
+
+    if (nftablesRulesAreSupported(ifname, rules, nrules)) {
+        ret = nftablesApplyNewRulesNft(ifname, rules, nrules);
+    } else {
+        VIR_DEBUG("Filter of %s not supported by nftables, "
+                  "falling back to ebiptables", ifname);
+        drv = &ebiptables_driver;
+        ret = ebiptables_driver.applyNewRules(ifname, rules, nrules);
+    }
+
+    if (ret < 0)
+        return -1;
+
+    virMutexLock(&nftablesIfacesLock);
+    if ((iface = nftablesIfaceGet(ifname, true)))
+        iface->pending = drv;
+    virMutexUnlock(&nftablesIfacesLock);
+
+    return 0;
+}
+
+
+static int
+nftablesTearNewRules(const char *ifname)
+{
+    virNWFilterTechDriverPtr pending = NULL;
+    nftablesIfacePtr iface;
+    int ret = 0;
+
+    virMutexLock(&nftablesIfacesLock);
+    if ((iface = nftablesIfaceGet(ifname, false))) {
+        pending = iface->pending;
+        iface->pending = NULL;
+    }
+    virMutexUnlock(&nftablesIfacesLock);
+
+    if (pending != &ebiptables_driver &&
+        nftablesTearNewRulesNft(ifname) < 0)
+        ret = -1;
+    if (pending != &nftables_driver &&
+        ebiptables_driver.tearNewRules(ifname) < 0)
+        ret = -1;
+
+    return ret;
+}
+
+
+static int
+nftablesTearOldRules(const char *ifname)
+{
+    virNWFilterTechDriverPtr pending = NULL;
+    virNWFilterTechDriverPtr active = NULL;
+    nftablesIfacePtr iface;
+    int ret = 0;
+
+    virMutexLock(&nftablesIfacesLock);
+    if ((iface = nftablesIfaceGet(ifname, false))) {
+        pending = iface->pending;
+        active = iface->active;
+        if (pending)
+            iface->active = pending;
+        iface->pending = NULL;
+    }
+    virMutexUnlock(&nftablesIfacesLock);
+
+    /* the old rules may have been instantiated by the other driver */
+    if (pending == &nftables_driver) {
+        if (active != &nftables_driver)
+            ignore_value(ebiptables_driver.allTeardown(ifname));
+        return nftablesTearOldRulesNft(ifname);
+    }
+
+    if (pending == &ebiptables_driver) {
+        if (active != &ebiptables_driver)
+            ignore_value(nftablesAllTeardownNft(ifname));
+        return ebiptables_driver.tearOldRules(ifname);
+    }
+
+    if (nftablesTearOldRulesNft(ifname) < 0)
+        ret = -1;
+    if (ebiptables_driver.tearOldRules(ifname) < 0)
+        ret = -1;
+
+    return ret;
+}
+
+
+static int
+nftablesAllTeardown(const char *ifname)
+{
+    virNWFilterTechDriverPtr pending = NULL;
+    virNWFilterTechDriverPtr active = NULL;
+    nftablesIfacePtr iface;
+    int ret = 0;
+
+    virMutexLock(&nftablesIfacesLock);
+    if ((iface = nftablesIfaceGet(ifname, false))) {
+        pending = iface->pending;
+        active = iface->active;
+        virHashRemoveEntry(nftablesIfaces, ifname);
+    }
+    virMutexUnlock(&nftablesIfacesLock);
+
+    if ((active != &ebiptables_driver || pending == &nftables_driver) &&
+        nftablesAllTeardownNft(ifname) < 0)
+        ret = -1;
+    if ((active != &nftables_driver || pending == &ebiptables_driver) &&
+        ebiptables_driver.allTeardown(ifname) < 0)
+        ret = -1;
+
+    return ret;
+}
+
+
+/* The basic rules are ebtables rules, make sure they are cleaned up
+ * together with the old rules of the interface later on */
+static void
+nftablesIfaceForget(const char *ifname)
+{
+    nftablesIfacePtr iface;
+
+    virMutexLock(&nftablesIfacesLock);
+    if ((iface = nftablesIfaceGet(ifname, false)))
+        iface->active = NULL;
+    virMutexUnlock(&nftablesIfacesLock);
+}
+
+
+static int
+nftablesCanApplyBasicRules(void)
+{
+    return ebiptables_driver.canApplyBasicRules();
+}
+
+
+static int
+nftablesApplyBasicRules(const char *ifname,
+                        const virMacAddr *macaddr)
+{
+    nftablesIfaceForget(ifname);
+    return ebiptables_driver.applyBasicRules(ifname, macaddr);
+}
+
+
+static int
+nftablesApplyDHCPOnlyRules(const char *ifname,
+                           const virMacAddr *macaddr,
+                           virNWFilterVarValuePtr dhcpsrvrs,
+                           bool leaveTemporary)
+{
+    nftablesIfaceForget(ifname);
+    return ebiptables_driver.applyDHCPOnlyRules(ifname, macaddr,
+                                                dhcpsrvrs, leaveTemporary);
+}
+
+
+static int
+nftablesApplyDropAllRules(const char *ifname)
+{
+    nftablesIfaceForget(ifname);
+    return ebiptables_driver.applyDropAllRules(ifname);
+}
+
+
+static int
+nftablesRemoveBasicRules(const char *ifname)
+{
+    return ebiptables_driver.removeBasicRules(ifname);
+}
+
+
+static int
+nftablesDriverInit(bool privileged)
+{
+    if (!privileged)
+        return 0;
+
+    /* rules nft cannot express as well as the basic rules are left
+     * to the ebiptables driver */
+    if (!(ebiptables_driver.flags & TECHDRV_FLAG_INITIALIZED)) {
+        VIR_INFO("ebiptables driver unavailable, not using nftables");
+        return 0;
+    }
+
+    if (!virFileIsExecutable(NFT_PATH)) {
+        VIR_INFO("%s not available, not using nftables", NFT_PATH);
+        return 0;
+    }
+
+    if (virMutexInit(&nftablesIfacesLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize mutex"));
+        return -1;
+    }
+
+    if (!(nftablesIfaces = virHashCreate(10, virHashValueFree)))
+        goto error;
+
+    if (nftablesCreateBaseChains() < 0) {
+        VIR_WARN("Failed to create nftables base chains: %s",
+                 virGetLastErrorMessage());
+        virResetLastError();
+        goto error;
+    }
+
+    nftables_driver.flags = TECHDRV_FLAG_INITIALIZED;
+
+    return 0;
+
+ error:
+    virHashFree(nftablesIfaces);
+    nftablesIfaces = NULL;
+    virMutexDestroy(&nftablesIfacesLock);
+    return 0;
+}
+
+
+static void
+nftablesDriverShutdown(void)
+{
+    if (!(nftables_driver.flags & TECHDRV_FLAG_INITIALIZED))
+        return;
+
+    virHashFree(nftablesIfaces);
+    nftablesIfaces = NULL;
+    virMutexDestroy(&nftablesIfacesLock);
+    nftables_driver.flags = 0;
+}
+
+
+virNWFilterTechDriver nftables_driver = {
+    .name = NFTABLES_DRIVER_ID,
+    .flags = 0,
+
+    .init     = nftablesDriverInit,
+    .shutdown = nftablesDriverShutdown,
+
+    .applyNewRules       = nftablesApplyNewRules,
+    .tearNewRules        = nftablesTearNewRules,
+    .tearOldRules        = nftablesTearOldRules,
+    .allTeardown         = nftablesAllTeardown,
+
+    .canApplyBasicRules  = nftablesCanApplyBasicRules,
+    .applyBasicRules     = nftablesApplyBasicRules,
+    .applyDHCPOnlyRules  = nftablesApplyDHCPOnlyRules,
+    .applyDropAllRules   = nftablesApplyDropAllRules,
+    .removeBasicRules    = nftablesRemoveBasicRules,
+};
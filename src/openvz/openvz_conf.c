@@ -51,12 +51,13 @@
 #include "vircommand.h"
 #include "virstring.h"
 #include "virhostcpu.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_OPENVZ
 
 static char *openvzLocateConfDir(void);
 static int openvzGetVPSUUID(int vpsid, char *uuidstr, size_t len);
-static int openvzAssignUUIDs(void);
+static int openvzSetUUID(int vpsid);
 static int openvzLocateConfFileDefault(int vpsid, char **conffile, const char *ext);
 
 openvzLocateConfFileFunc openvzLocateConfFile = openvzLocateConfFileDefault;
@@ -499,136 +500,545 @@ openvzFreeDriver(struct openvz_driver *driver)
     virObjectUnref(driver->xmlopt);
     virObjectUnref(driver->domains);
     virObjectUnref(driver->caps);
+    openvzInventoryEntriesFree(driver->inventory, driver->ninventory);
+    virHashFree(driver->confStamps);
+    virMutexDestroy(&driver->inventoryLock);
     VIR_FREE(driver);
 }
 
 
+void
+openvzInventoryEntriesFree(openvzInventoryEntryPtr entries,
+                           size_t nentries)
+{
+    size_t i;
 
-int openvzLoadDomains(struct openvz_driver *driver)
+    if (!entries)
+        return;
+
+    for (i = 0; i < nentries; i++)
+        VIR_FREE(entries[i].hostname);
+    VIR_FREE(entries);
+}
+
+
+/**
+ * openvzParseInventory:
+ * @output: output of 'vzlist -a -H -ovpsid,status,hostname'
+ * @entries: filled with the listed containers
+ * @nentries: filled with the number of items in @entries
+ *
+ * Returns 0 on success, -1 with an error reported otherwise.
+ */
+int
+openvzParseInventory(const char *output,
+                     openvzInventoryEntryPtr *entries,
+                     size_t *nentries)
 {
-    int veid, ret;
-    char *status;
-    char uuidstr[VIR_UUID_STRING_BUFLEN];
-    virDomainObjPtr dom = NULL;
-    virDomainDefPtr def = NULL;
-    char *temp = NULL;
-    char *outbuf = NULL;
-    char *line;
+    openvzInventoryEntryPtr list = NULL;
+    size_t nlist = 0;
+    char **lines = NULL;
+    size_t i;
+    int ret = -1;
+
+    *entries = NULL;
+    *nentries = 0;
+
+    if (!(lines = virStringSplit(output, "\n", 0)))
+        goto cleanup;
+
+    for (i = 0; lines[i]; i++) {
+        openvzInventoryEntry entry = { 0 };
+        char *saveptr = NULL;
+        char *status;
+        char *hostname;
+
+        if (virStringIsEmpty(lines[i]))
+            continue;
+
+        if (virStrToLong_i(lines[i], &status, 10, &entry.veid) < 0 ||
+            !(status = strtok_r(status, " \t", &saveptr)) ||
+            !(hostname = strtok_r(NULL, " \t", &saveptr)) ||
+            strtok_r(NULL, " \t", &saveptr)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Failed to parse vzlist output '%s'"), lines[i]);
+            goto cleanup;
+        }
+
+        entry.active = STRNEQ(status, "stopped");
+        if (VIR_STRDUP(entry.hostname, hostname) < 0 ||
+            VIR_APPEND_ELEMENT(list, nlist, entry) < 0) {
+            VIR_FREE(entry.hostname);
+            goto cleanup;
+        }
+    }
+
+    *entries = list;
+    *nentries = nlist;
+    list = NULL;
+    nlist = 0;
+    ret = 0;
+
+ cleanup:
+    openvzInventoryEntriesFree(list, nlist);
+    virStringListFree(lines);
+    return ret;
+}
+
+
+/* Run vzlist unless the inventory is younger than OPENVZ_INVENTORY_TTL.
+ * Must be called with driver->inventoryLock held. */
+static int
+openvzInventoryRefreshLocked(struct openvz_driver *driver)
+{
+    unsigned long long now;
     virCommandPtr cmd = NULL;
-    unsigned int vcpus = 0;
+    char *outbuf = NULL;
+    openvzInventoryEntryPtr entries = NULL;
+    size_t nentries = 0;
+    int ret = -1;
 
-    if (openvzAssignUUIDs() < 0)
+    if (virTimeMillisNow(&now) < 0)
         return -1;
 
-    cmd = virCommandNewArgList(VZLIST, "-a", "-ovpsid,status", "-H", NULL);
+    if (driver->inventoryTime &&
+        now - driver->inventoryTime < OPENVZ_INVENTORY_TTL)
+        return 0;
+
+    cmd = virCommandNewArgList(VZLIST, "-a", "-H",
+                               "-ovpsid,status,hostname", NULL);
     virCommandSetOutputBuffer(cmd, &outbuf);
     if (virCommandRun(cmd, NULL) < 0)
         goto cleanup;
 
-    line = outbuf;
-    while (line[0] != '\0') {
-        unsigned int flags = 0;
-        if (virStrToLong_i(line, &status, 10, &veid) < 0 ||
-            *status++ != ' ' ||
-            (line = strchr(status, '\n')) == NULL) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Failed to parse vzlist output"));
-            goto cleanup;
-        }
-        *line++ = '\0';
+    if (openvzParseInventory(outbuf, &entries, &nentries) < 0)
+        goto cleanup;
 
-        if (!(def = virDomainDefNew()))
-            goto cleanup;
+    openvzInventoryEntriesFree(driver->inventory, driver->ninventory);
+    driver->inventory = entries;
+    driver->ninventory = nentries;
+    driver->inventoryTime = now;
+    driver->inventoryGen++;
+    ret = 0;
 
-        def->virtType = VIR_DOMAIN_VIRT_OPENVZ;
+ cleanup:
+    virCommandFree(cmd);
+    VIR_FREE(outbuf);
+    return ret;
+}
+
+
+static openvzInventoryEntryPtr
+openvzInventoryFindLocked(struct openvz_driver *driver,
+                          int veid)
+{
+    size_t i;
+
+    for (i = 0; i < driver->ninventory; i++) {
+        if (driver->inventory[i].veid == veid)
+            return &driver->inventory[i];
+    }
+
+    virReportError(VIR_ERR_NO_DOMAIN,
+                   _("no container with id %d"), veid);
+    return NULL;
+}
 
-        if (STREQ(status, "stopped"))
-            def->id = -1;
-        else
-            def->id = veid;
-        if (virAsprintf(&def->name, "%i", veid) < 0)
-            goto cleanup;
 
+/**
+ * openvzInventoryInvalidate:
+ * @driver: the driver
+ *
+ * Make the next inventory query run vzlist again. To be called
+ * after containers were started, stopped, created or removed.
+ */
+void
+openvzInventoryInvalidate(struct openvz_driver *driver)
+{
+    virMutexLock(&driver->inventoryLock);
+    driver->inventoryTime = 0;
+    virMutexUnlock(&driver->inventoryLock);
+}
+
+
+/**
+ * openvzInventoryGetState:
+ * @driver: the driver
+ * @veid: container ID
+ * @active: set to whether the container is running
+ *
+ * Returns 0 on success, -1 with an error reported otherwise.
+ */
+int
+openvzInventoryGetState(struct openvz_driver *driver,
+                        int veid,
+                        bool *active)
+{
+    openvzInventoryEntryPtr entry;
+    int ret = -1;
+
+    virMutexLock(&driver->inventoryLock);
+
+    if (openvzInventoryRefreshLocked(driver) < 0 ||
+        !(entry = openvzInventoryFindLocked(driver, veid)))
+        goto cleanup;
+
+    *active = entry->active;
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&driver->inventoryLock);
+    return ret;
+}
+
+
+/**
+ * openvzInventoryGetHostname:
+ * @driver: the driver
+ * @veid: container ID
+ *
+ * Returns the hostname of the container as printed by vzlist, which
+ * is '-' if it is unset, or NULL with an error reported. The caller
+ * must free the returned string.
+ */
+char *
+openvzInventoryGetHostname(struct openvz_driver *driver,
+                           int veid)
+{
+    openvzInventoryEntryPtr entry;
+    char *ret = NULL;
+
+    virMutexLock(&driver->inventoryLock);
+
+    if (openvzInventoryRefreshLocked(driver) < 0 ||
+        !(entry = openvzInventoryFindLocked(driver, veid)))
+        goto cleanup;
+
+    ignore_value(VIR_STRDUP(ret, entry->hostname));
+
+ cleanup:
+    virMutexUnlock(&driver->inventoryLock);
+    return ret;
+}
+
+
+/* Stat data of a container config, telling whether it has to be
+ * parsed again */
+typedef struct _openvzConfStamp openvzConfStamp;
+typedef openvzConfStamp *openvzConfStampPtr;
+struct _openvzConfStamp {
+    time_t mtime;
+    off_t size;
+    ino_t ino;
+};
+
+static int
+openvzGetConfStamp(int veid, openvzConfStampPtr stamp)
+{
+    char *conf_file;
+    struct stat sb;
+
+    memset(stamp, 0, sizeof(*stamp));
+
+    if (openvzLocateConfFile(veid, &conf_file, "conf") < 0)
+        return -1;
+
+    /* A vanished config is simply reported as changed */
+    if (stat(conf_file, &sb) == 0) {
+        stamp->mtime = sb.st_mtime;
+        stamp->size = sb.st_size;
+        stamp->ino = sb.st_ino;
+    }
+
+    VIR_FREE(conf_file);
+    return 0;
+}
+
+
+static virDomainDefPtr
+openvzLoadDomainDef(struct openvz_driver *driver,
+                    int veid,
+                    bool active)
+{
+    virDomainDefPtr def = NULL;
+    char uuidstr[VIR_UUID_STRING_BUFLEN] = "";
+    char *temp = NULL;
+    unsigned int vcpus = 0;
+    int ret;
+
+    if (!(def = virDomainDefNew()))
+        goto error;
+
+    def->virtType = VIR_DOMAIN_VIRT_OPENVZ;
+
+    if (active)
+        def->id = veid;
+    else
+        def->id = -1;
+    if (virAsprintf(&def->name, "%i", veid) < 0)
+        goto error;
+
+    /* Assign a UUID to containers which don't have one yet. It's
+     * appended to the config file as a comment so that the OpenVZ
+     * tools ignore it. */
+    openvzGetVPSUUID(veid, uuidstr, sizeof(uuidstr));
+    if (uuidstr[0] == 0 && openvzSetUUID(veid) == 0)
         openvzGetVPSUUID(veid, uuidstr, sizeof(uuidstr));
-        ret = virUUIDParse(uuidstr, def->uuid);
+    ret = virUUIDParse(uuidstr, def->uuid);
 
-        if (ret == -1) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("UUID in config file malformed"));
-            goto cleanup;
-        }
+    if (ret == -1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("UUID in config file malformed"));
+        goto error;
+    }
 
-        def->os.type = VIR_DOMAIN_OSTYPE_EXE;
-        if (VIR_STRDUP(def->os.init, "/sbin/init") < 0)
-            goto cleanup;
+    def->os.type = VIR_DOMAIN_OSTYPE_EXE;
+    if (VIR_STRDUP(def->os.init, "/sbin/init") < 0)
+        goto error;
 
-        ret = openvzReadVPSConfigParam(veid, "CPUS", &temp);
-        if (ret < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Could not read config for container %d"),
-                           veid);
-            goto cleanup;
-        } else if (ret > 0) {
-            vcpus = strtoI(temp);
-        }
+    ret = openvzReadVPSConfigParam(veid, "CPUS", &temp);
+    if (ret < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Could not read config for container %d"),
+                       veid);
+        goto error;
+    } else if (ret > 0) {
+        vcpus = strtoI(temp);
+    }
 
-        if (ret == 0 || vcpus == 0)
-            vcpus = virHostCPUGetCount();
+    if (ret == 0 || vcpus == 0)
+        vcpus = virHostCPUGetCount();
 
-        if (virDomainDefSetVcpusMax(def, vcpus, driver->xmlopt) < 0)
-            goto cleanup;
+    if (virDomainDefSetVcpusMax(def, vcpus, driver->xmlopt) < 0)
+        goto error;
 
-        if (virDomainDefSetVcpus(def, vcpus) < 0)
-            goto cleanup;
+    if (virDomainDefSetVcpus(def, vcpus) < 0)
+        goto error;
 
-        /* XXX load rest of VM config data .... */
+    /* XXX load rest of VM config data .... */
 
-        openvzReadNetworkConf(def, veid);
-        openvzReadFSConf(def, veid);
-        openvzReadMemConf(def, veid);
+    openvzReadNetworkConf(def, veid);
+    openvzReadFSConf(def, veid);
+    openvzReadMemConf(def, veid);
 
-        virUUIDFormat(def->uuid, uuidstr);
-        flags = VIR_DOMAIN_OBJ_LIST_ADD_CHECK_LIVE;
-        if (STRNEQ(status, "stopped"))
-            flags |= VIR_DOMAIN_OBJ_LIST_ADD_LIVE;
+    VIR_FREE(temp);
+    return def;
 
-        if (!(dom = virDomainObjListAdd(driver->domains,
-                                        def,
-                                        driver->xmlopt,
-                                        flags,
-                                        NULL)))
-            goto cleanup;
+ error:
+    VIR_FREE(temp);
+    virDomainDefFree(def);
+    return NULL;
+}
 
-        if (STREQ(status, "stopped")) {
-            virDomainObjSetState(dom, VIR_DOMAIN_SHUTOFF,
-                                 VIR_DOMAIN_SHUTOFF_UNKNOWN);
-            dom->pid = -1;
-        } else {
+
+/* Bring the state of @dom in line with what vzlist reports. A paused
+ * container is listed as running, so keep it paused. */
+static void
+openvzSyncDomainState(virDomainObjPtr dom,
+                      int veid,
+                      bool active)
+{
+    int state = virDomainObjGetState(dom, NULL);
+
+    if (active) {
+        if (state == VIR_DOMAIN_NOSTATE || state == VIR_DOMAIN_SHUTOFF)
             virDomainObjSetState(dom, VIR_DOMAIN_RUNNING,
                                  VIR_DOMAIN_RUNNING_UNKNOWN);
-            dom->pid = veid;
-        }
-        /* XXX OpenVZ doesn't appear to have concept of a transient domain */
-        dom->persistent = 1;
+        dom->def->id = veid;
+        dom->pid = veid;
+    } else {
+        if (state != VIR_DOMAIN_SHUTOFF)
+            virDomainObjSetState(dom, VIR_DOMAIN_SHUTOFF,
+                                 VIR_DOMAIN_SHUTOFF_UNKNOWN);
+        dom->def->id = -1;
+        dom->pid = -1;
+    }
+}
 
-        virObjectUnlock(dom);
-        dom = NULL;
-        def = NULL;
+
+/* Make @driver->domains reflect one container listed by vzlist. Its
+ * config is only parsed if the domain is new or the file changed
+ * since it was last loaded. */
+static int
+openvzSyncDomain(struct openvz_driver *driver,
+                 const char *name,
+                 int veid,
+                 bool active)
+{
+    openvzConfStamp stamp;
+    openvzConfStampPtr oldStamp;
+    virDomainObjPtr dom = NULL;
+    virDomainDefPtr def = NULL;
+    unsigned int flags = 0;
+    bool isnew;
+
+    if (openvzGetConfStamp(veid, &stamp) < 0)
+        return -1;
+
+    dom = virDomainObjListFindByName(driver->domains, name);
+    isnew = !dom;
+    oldStamp = virHashLookup(driver->confStamps, name);
+
+    if (dom && oldStamp &&
+        oldStamp->mtime == stamp.mtime &&
+        oldStamp->size == stamp.size &&
+        oldStamp->ino == stamp.ino) {
+        openvzSyncDomainState(dom, veid, active);
+        virDomainObjEndAPI(&dom);
+        return 0;
     }
+    virDomainObjEndAPI(&dom);
 
-    virCommandFree(cmd);
-    VIR_FREE(temp);
-    VIR_FREE(outbuf);
+    if (!(def = openvzLoadDomainDef(driver, veid, active)))
+        return -1;
+
+    if (isnew)
+        flags |= VIR_DOMAIN_OBJ_LIST_ADD_CHECK_LIVE;
+    if (active)
+        flags |= VIR_DOMAIN_OBJ_LIST_ADD_LIVE;
+
+    if (!(dom = virDomainObjListAdd(driver->domains,
+                                    def,
+                                    driver->xmlopt,
+                                    flags,
+                                    NULL))) {
+        virDomainDefFree(def);
+        return -1;
+    }
+
+    openvzSyncDomainState(dom, veid, active);
+    /* XXX OpenVZ doesn't appear to have concept of a transient domain */
+    dom->persistent = 1;
+    virObjectUnlock(dom);
+
+    /* Assigning a UUID may have touched the config, stat it again */
+    if (openvzGetConfStamp(veid, &stamp) < 0)
+        return -1;
+
+    if (!(oldStamp = virHashLookup(driver->confStamps, name))) {
+        if (VIR_ALLOC(oldStamp) < 0)
+            return -1;
+
+        if (virHashAddEntry(driver->confStamps, name, oldStamp) < 0) {
+            VIR_FREE(oldStamp);
+            return -1;
+        }
+    }
+    *oldStamp = stamp;
 
     return 0;
+}
+
+
+/* Update @driver->domains from the inventory. Containers missing in
+ * vzlist output are dropped, new ones are loaded. Does nothing if
+ * vzlist was not run since the last call. Must be called with
+ * driver->lock held. */
+static int
+openvzSyncDomains(struct openvz_driver *driver)
+{
+    openvzInventoryEntry *entries = NULL;
+    size_t nentries = 0;
+    unsigned long long gen;
+    virHashTablePtr seen = NULL;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    char name[32];
+    size_t i;
+    int ret = -1;
+
+    /* Copy the inventory so that no domain gets locked while holding
+     * inventoryLock: openvzInventoryGetState() is called with the
+     * domain locked. */
+    virMutexLock(&driver->inventoryLock);
+    if (openvzInventoryRefreshLocked(driver) < 0) {
+        virMutexUnlock(&driver->inventoryLock);
+        return -1;
+    }
+    gen = driver->inventoryGen;
+    if (gen != driver->domainsGen &&
+        VIR_ALLOC_N(entries, driver->ninventory) == 0) {
+        nentries = driver->ninventory;
+        for (i = 0; i < nentries; i++) {
+            entries[i].veid = driver->inventory[i].veid;
+            entries[i].active = driver->inventory[i].active;
+        }
+    }
+    virMutexUnlock(&driver->inventoryLock);
+
+    if (gen == driver->domainsGen)
+        return 0;
+    if (!entries)
+        return -1;
+
+    if (!(seen = virHashCreate(nentries + 1, NULL)))
+        goto cleanup;
+
+    for (i = 0; i < nentries; i++) {
+        snprintf(name, sizeof(name), "%d", entries[i].veid);
+        if (virHashAddEntry(seen, name, &entries[i]) < 0 ||
+            openvzSyncDomain(driver, name, entries[i].veid,
+                             entries[i].active) < 0)
+            goto cleanup;
+    }
+
+    if (virDomainObjListCollect(driver->domains, NULL,
+                                &vms, &nvms, NULL, 0) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nvms; i++) {
+        virDomainObjPtr vm = vms[i];
+
+        virObjectLock(vm);
+        if (vm->removing || virHashLookup(seen, vm->def->name)) {
+            virObjectUnlock(vm);
+            continue;
+        }
+
+        virHashRemoveEntry(driver->confStamps, vm->def->name);
+        /* Leaves @vm unlocked */
+        virDomainObjListRemove(driver->domains, vm);
+    }
+
+    driver->domainsGen = gen;
+    ret = 0;
 
  cleanup:
-    virCommandFree(cmd);
-    VIR_FREE(temp);
-    VIR_FREE(outbuf);
-    virObjectUnref(dom);
-    virDomainDefFree(def);
-    return -1;
+    virObjectListFreeCount(vms, nvms);
+    virHashFree(seen);
+    VIR_FREE(entries);
+    return ret;
+}
+
+
+/**
+ * openvzLoadDomains:
+ * @driver: the driver
+ *
+ * Load all containers into @driver->domains running vzlist anew.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int openvzLoadDomains(struct openvz_driver *driver)
+{
+    openvzInventoryInvalidate(driver);
+    return openvzSyncDomains(driver);
+}
+
+
+/**
+ * openvzRefreshDomains:
+ * @driver: the driver
+ *
+ * Like openvzLoadDomains(), but only runs vzlist once the inventory
+ * expired, and only parses the configs that changed since they were
+ * last loaded. Must be called with driver->lock held.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int openvzRefreshDomains(struct openvz_driver *driver)
+{
+    return openvzSyncDomains(driver);
 }
 
 static int
@@ -1029,46 +1439,6 @@ openvzSetUUID(int vpsid)
     return openvzSetDefinedUUID(vpsid, uuid);
 }
 
-/*
- * Scan VPS config files and see if they have a UUID.
- * If not, assign one. Just append one to the config
- * file as comment so that the OpenVZ tools ignore it.
- *
- */
-
-static int openvzAssignUUIDs(void)
-{
-    DIR *dp;
-    struct dirent *dent;
-    char *conf_dir;
-    int vpsid;
-    char *ext;
-    int ret = 0;
-
-    conf_dir = openvzLocateConfDir();
-    if (conf_dir == NULL)
-        return -1;
-
-    if (virDirOpenQuiet(&dp, conf_dir) < 0) {
-        VIR_FREE(conf_dir);
-        return 0;
-    }
-
-    while ((ret = virDirRead(dp, &dent, conf_dir)) > 0) {
-        if (virStrToLong_i(dent->d_name, &ext, 10, &vpsid) < 0 ||
-            *ext++ != '.' ||
-            STRNEQ(ext, "conf"))
-            continue;
-        if (vpsid > 0) /* '0.conf' belongs to the host, ignore it */
-            openvzSetUUID(vpsid);
-    }
-
-    VIR_DIR_CLOSE(dp);
-    VIR_FREE(conf_dir);
-    return ret;
-}
-
-
 /*
  * Return CTID from name
  *
@@ -32,6 +32,7 @@
 # include "internal.h"
 # include "virdomainobjlist.h"
 # include "virthread.h"
+# include "virhash.h"
 
 
 /* OpenVZ commands - Replace with wrapper scripts later? */
@@ -42,6 +43,18 @@
 
 # define VZCTL_BRIDGE_MIN_VERSION ((3 * 1000 * 1000) + (0 * 1000) + 22 + 1)
 
+/* How long the container list obtained from vzlist is trusted */
+# define OPENVZ_INVENTORY_TTL 2000 /* milliseconds */
+
+/* One container as listed by vzlist */
+typedef struct _openvzInventoryEntry openvzInventoryEntry;
+typedef openvzInventoryEntry *openvzInventoryEntryPtr;
+struct _openvzInventoryEntry {
+    int veid;
+    bool active;
+    char *hostname; /* as printed by vzlist, '-' if unset */
+};
+
 struct openvz_driver {
     virMutex lock;
 
@@ -49,6 +62,20 @@ struct openvz_driver {
     virDomainXMLOptionPtr xmlopt;
     virDomainObjListPtr domains;
     int version;
+
+    /* Containers listed by the last vzlist run. Guarded by
+     * inventoryLock rather than lock, since it is queried with domain
+     * objects locked. */
+    virMutex inventoryLock;
+    openvzInventoryEntryPtr inventory;
+    size_t ninventory;
+    unsigned long long inventoryTime; /* 0 forces a new vzlist run */
+    unsigned long long inventoryGen;  /* bumped on every vzlist run */
+
+    /* Guarded by lock */
+    unsigned long long domainsGen;    /* inventoryGen @domains match */
+    virHashTablePtr confStamps;       /* name -> openvzConfStamp of the
+                                       * config @domains were loaded from */
 };
 
 typedef int (*openvzLocateConfFileFunc)(int vpsid, char **conffile, const char *ext);
@@ -64,6 +91,18 @@ int openvzReadConfigParam(const char *conf_file, const char *param, char **value
 int openvzCopyDefaultConfig(int vpsid);
 virCapsPtr openvzCapsInit(void);
 int openvzLoadDomains(struct openvz_driver *driver);
+int openvzRefreshDomains(struct openvz_driver *driver);
+int openvzParseInventory(const char *output,
+                         openvzInventoryEntryPtr *entries,
+                         size_t *nentries);
+void openvzInventoryEntriesFree(openvzInventoryEntryPtr entries,
+                                size_t nentries);
+void openvzInventoryInvalidate(struct openvz_driver *driver);
+int openvzInventoryGetState(struct openvz_driver *driver,
+                            int veid,
+                            bool *active);
+char *openvzInventoryGetHostname(struct openvz_driver *driver,
+                                 int veid);
 void openvzFreeDriver(struct openvz_driver *driver);
 int strtoI(const char *str);
 int openvzSetDefinedUUID(int vpsid, unsigned char *uuid);
@@ -73,7 +73,10 @@ static int openvzDomainSetVcpusInternal(virDomainObjPtr vm,
                                         virDomainXMLOptionPtr xmlopt);
 static int openvzDomainSetMemoryInternal(virDomainObjPtr vm,
                                          unsigned long long memory);
-static int openvzGetVEStatus(virDomainObjPtr vm, int *status, int *reason);
+static int openvzGetVEStatus(struct openvz_driver *driver,
+                             virDomainObjPtr vm,
+                             int *status,
+                             int *reason);
 
 static void openvzDriverLock(struct openvz_driver *driver)
 {
@@ -291,7 +294,7 @@ openvzDomainGetHostname(virDomainPtr dom, unsigned int flags)
         goto cleanup;
     }
 
-    hostname = openvzVEGetStringParam(dom, "hostname");
+    hostname = openvzInventoryGetHostname(driver, strtoI(vm->def->name));
     if (hostname == NULL)
         goto error;
 
@@ -442,7 +445,7 @@ static int openvzDomainGetInfo(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (openvzGetVEStatus(vm, &state, NULL) == -1)
+    if (openvzGetVEStatus(driver, vm, &state, NULL) == -1)
         goto cleanup;
     info->state = state;
 
@@ -490,7 +493,7 @@ openvzDomainGetState(virDomainPtr dom,
         goto cleanup;
     }
 
-    ret = openvzGetVEStatus(vm, state, reason);
+    ret = openvzGetVEStatus(driver, vm, state, reason);
 
  cleanup:
     if (vm)
@@ -691,7 +694,7 @@ openvzDomainShutdownFlags(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (openvzGetVEStatus(vm, &status, NULL) == -1)
+    if (openvzGetVEStatus(driver, vm, &status, NULL) == -1)
         goto cleanup;
 
     openvzSetProgramSentinal(prog, vm->def->name);
@@ -701,6 +704,7 @@ openvzDomainShutdownFlags(virDomainPtr dom,
         goto cleanup;
     }
 
+    openvzInventoryInvalidate(driver);
     if (virRun(prog, NULL) < 0)
         goto cleanup;
 
@@ -754,7 +758,7 @@ static int openvzDomainReboot(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (openvzGetVEStatus(vm, &status, NULL) == -1)
+    if (openvzGetVEStatus(driver, vm, &status, NULL) == -1)
         goto cleanup;
 
     openvzSetProgramSentinal(prog, vm->def->name);
@@ -1007,6 +1011,7 @@ openvzDomainDefineXMLFlags(virConnectPtr conn, const char *xml, unsigned int fla
         VIR_ERROR(_("Error creating initial configuration"));
         goto cleanup;
     }
+    openvzInventoryInvalidate(driver);
 
     if (vm->def->nfss == 1) {
         if (openvzSetDiskQuota(vm->def, vm->def->fss[0], true) < 0) {
@@ -1100,6 +1105,7 @@ openvzDomainCreateXML(virConnectPtr conn, const char *xml,
         VIR_ERROR(_("Error creating initial configuration"));
         goto cleanup;
     }
+    openvzInventoryInvalidate(driver);
 
     if (vm->def->nfss == 1) {
         if (openvzSetDiskQuota(vm->def, vm->def->fss[0], true) < 0) {
@@ -1120,6 +1126,7 @@ openvzDomainCreateXML(virConnectPtr conn, const char *xml,
 
     openvzSetProgramSentinal(progstart, vm->def->name);
 
+    openvzInventoryInvalidate(driver);
     if (virRun(progstart, NULL) < 0)
         goto cleanup;
 
@@ -1167,7 +1174,7 @@ openvzDomainCreateWithFlags(virDomainPtr dom, unsigned int flags)
         goto cleanup;
     }
 
-    if (openvzGetVEStatus(vm, &status, NULL) == -1)
+    if (openvzGetVEStatus(driver, vm, &status, NULL) == -1)
         goto cleanup;
 
     if (status != VIR_DOMAIN_SHUTOFF) {
@@ -1177,6 +1184,7 @@ openvzDomainCreateWithFlags(virDomainPtr dom, unsigned int flags)
     }
 
     openvzSetProgramSentinal(prog, vm->def->name);
+    openvzInventoryInvalidate(driver);
     if (virRun(prog, NULL) < 0)
         goto cleanup;
 
@@ -1217,10 +1225,11 @@ openvzDomainUndefineFlags(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (openvzGetVEStatus(vm, &status, NULL) == -1)
+    if (openvzGetVEStatus(driver, vm, &status, NULL) == -1)
         goto cleanup;
 
     openvzSetProgramSentinal(prog, vm->def->name);
+    openvzInventoryInvalidate(driver);
     if (virRun(prog, NULL) < 0)
         goto cleanup;
 
@@ -1476,9 +1485,19 @@ static virDrvOpenStatus openvzConnectOpen(virConnectPtr conn,
     if (VIR_ALLOC(driver) < 0)
         return VIR_DRV_OPEN_ERROR;
 
+    if (virMutexInit(&driver->inventoryLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(driver);
+        return VIR_DRV_OPEN_ERROR;
+    }
+
     if (!(driver->domains = virDomainObjListNew()))
         goto cleanup;
 
+    if (!(driver->confStamps = virHashCreate(50, virHashValueFree)))
+        goto cleanup;
+
     if (!(driver->caps = openvzCapsInit()))
         goto cleanup;
 
@@ -1544,110 +1563,46 @@ static char *openvzConnectGetCapabilities(virConnectPtr conn) {
     return ret;
 }
 
-static int openvzConnectListDomains(virConnectPtr conn ATTRIBUTE_UNUSED,
+static int openvzConnectListDomains(virConnectPtr conn,
                                     int *ids, int nids)
 {
-    int got = 0;
-    int veid;
-    int outfd = -1;
-    int rc = -1;
-    int ret;
-    char buf[32];
-    char *endptr;
-    virCommandPtr cmd = virCommandNewArgList(VZLIST, "-ovpsid", "-H", NULL);
-
-    virCommandSetOutputFD(cmd, &outfd);
-    if (virCommandRunAsync(cmd, NULL) < 0)
-        goto cleanup;
-
-    while (got < nids) {
-        ret = openvz_readline(outfd, buf, 32);
-        if (!ret)
-            break;
-        if (virStrToLong_i(buf, &endptr, 10, &veid) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Could not parse VPS ID %s"), buf);
-            continue;
-        }
-        ids[got] = veid;
-        got ++;
-    }
-
-    if (virCommandWait(cmd, NULL) < 0)
-        goto cleanup;
+    struct openvz_driver *driver = conn->privateData;
+    int n = -1;
 
-    if (VIR_CLOSE(outfd) < 0) {
-        virReportSystemError(errno, "%s", _("failed to close file"));
-        goto cleanup;
-    }
+    openvzDriverLock(driver);
+    if (openvzRefreshDomains(driver) == 0)
+        n = virDomainObjListGetActiveIDs(driver->domains, ids, nids,
+                                         NULL, NULL);
+    openvzDriverUnlock(driver);
 
-    rc = got;
- cleanup:
-    VIR_FORCE_CLOSE(outfd);
-    virCommandFree(cmd);
-    return rc;
+    return n;
 }
 
 static int openvzConnectNumOfDomains(virConnectPtr conn)
 {
     struct openvz_driver *driver = conn->privateData;
-    int n;
+    int n = -1;
 
     openvzDriverLock(driver);
-    n = virDomainObjListNumOfDomains(driver->domains, true, NULL, NULL);
+    if (openvzRefreshDomains(driver) == 0)
+        n = virDomainObjListNumOfDomains(driver->domains, true, NULL, NULL);
     openvzDriverUnlock(driver);
 
     return n;
 }
 
-static int openvzConnectListDefinedDomains(virConnectPtr conn ATTRIBUTE_UNUSED,
+static int openvzConnectListDefinedDomains(virConnectPtr conn,
                                            char **const names, int nnames) {
-    int got = 0;
-    int veid, outfd = -1, ret;
-    int rc = -1;
-    char vpsname[32];
-    char buf[32];
-    char *endptr;
-    virCommandPtr cmd = virCommandNewArgList(VZLIST,
-                                             "-ovpsid", "-H", "-S", NULL);
-
-    /* the -S options lists only stopped domains */
-    virCommandSetOutputFD(cmd, &outfd);
-    if (virCommandRunAsync(cmd, NULL) < 0)
-        goto out;
-
-    while (got < nnames) {
-        ret = openvz_readline(outfd, buf, 32);
-        if (!ret)
-            break;
-        if (virStrToLong_i(buf, &endptr, 10, &veid) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Could not parse VPS ID %s"), buf);
-            continue;
-        }
-        snprintf(vpsname, sizeof(vpsname), "%d", veid);
-        if (VIR_STRDUP(names[got], vpsname) < 0)
-            goto out;
-        got ++;
-    }
-
-    if (virCommandWait(cmd, NULL) < 0)
-        goto out;
+    struct openvz_driver *driver = conn->privateData;
+    int n = -1;
 
-    if (VIR_CLOSE(outfd) < 0) {
-        virReportSystemError(errno, "%s", _("failed to close file"));
-        goto out;
-    }
+    openvzDriverLock(driver);
+    if (openvzRefreshDomains(driver) == 0)
+        n = virDomainObjListGetInactiveNames(driver->domains, names, nnames,
+                                             NULL, NULL);
+    openvzDriverUnlock(driver);
 
-    rc = got;
- out:
-    VIR_FORCE_CLOSE(outfd);
-    virCommandFree(cmd);
-    if (rc < 0) {
-        for (; got >= 0; got--)
-            VIR_FREE(names[got]);
-    }
-    return rc;
+    return n;
 }
 
 static int openvzGetProcessInfo(unsigned long long *cpuTime, int vpsid)
@@ -1704,10 +1659,11 @@ Version: 2.2
 static int openvzConnectNumOfDefinedDomains(virConnectPtr conn)
 {
     struct openvz_driver *driver =  conn->privateData;
-    int n;
+    int n = -1;
 
     openvzDriverLock(driver);
-    n = virDomainObjListNumOfDomains(driver->domains, false, NULL, NULL);
+    if (openvzRefreshDomains(driver) == 0)
+        n = virDomainObjListNumOfDomains(driver->domains, false, NULL, NULL);
     openvzDriverUnlock(driver);
 
     return n;
@@ -1937,29 +1893,20 @@ openvzDomainSetMemoryParameters(virDomainPtr domain,
 
 
 static int
-openvzGetVEStatus(virDomainObjPtr vm, int *status, int *reason)
+openvzGetVEStatus(struct openvz_driver *driver,
+                  virDomainObjPtr vm,
+                  int *status,
+                  int *reason)
 {
-    virCommandPtr cmd;
-    char *outbuf;
-    char *line;
+    bool active;
     int state;
-    int ret = -1;
 
-    cmd = virCommandNewArgList(VZLIST, vm->def->name, "-ostatus", "-H", NULL);
-    virCommandSetOutputBuffer(cmd, &outbuf);
-    if (virCommandRun(cmd, NULL) < 0)
-        goto cleanup;
-
-    if ((line = strchr(outbuf, '\n')) == NULL) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Failed to parse vzlist output"));
-        goto cleanup;
-    }
-    *line++ = '\0';
+    if (openvzInventoryGetState(driver, strtoI(vm->def->name), &active) < 0)
+        return -1;
 
     state = virDomainObjGetState(vm, reason);
 
-    if (STREQ(outbuf, "running")) {
+    if (active) {
         /* There is no way to detect whether a domain is paused or not
          * with vzlist */
         if (state == VIR_DOMAIN_PAUSED)
@@ -1970,12 +1917,7 @@ openvzGetVEStatus(virDomainObjPtr vm, int *status, int *reason)
         *status = VIR_DOMAIN_SHUTOFF;
     }
 
-    ret = 0;
-
- cleanup:
-    virCommandFree(cmd);
-    VIR_FREE(outbuf);
-    return ret;
+    return 0;
 }
 
 static int
@@ -2138,8 +2080,9 @@ openvzConnectListAllDomains(virConnectPtr conn,
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
 
     openvzDriverLock(driver);
-    ret = virDomainObjListExport(driver->domains, conn, domains,
-                                 NULL, flags);
+    if (openvzRefreshDomains(driver) == 0)
+        ret = virDomainObjListExport(driver->domains, conn, domains,
+                                     NULL, flags);
     openvzDriverUnlock(driver);
 
     return ret;
@@ -2253,7 +2196,7 @@ openvzDomainMigrateBegin3Params(virDomainPtr domain,
         goto cleanup;
     }
 
-    if (openvzGetVEStatus(vm, &status, NULL) == -1)
+    if (openvzGetVEStatus(driver, vm, &status, NULL) == -1)
         goto cleanup;
 
     if (status != VIR_DOMAIN_RUNNING) {
@@ -2422,6 +2365,7 @@ openvzDomainMigratePerform3Params(virDomainPtr domain,
     virCommandAddArg(cmd, uri->server);
     virCommandAddArg(cmd, vm->def->name);
 
+    openvzInventoryInvalidate(driver);
     if (virCommandRun(cmd, NULL) < 0)
         goto cleanup;
 
@@ -2474,7 +2418,9 @@ openvzDomainMigrateFinish3Params(virConnectPtr dconn,
         goto cleanup;
     }
 
-    if (openvzGetVEStatus(vm, &status, NULL) == -1)
+    /* The container was just moved here by vzmigrate */
+    openvzInventoryInvalidate(driver);
+    if (openvzGetVEStatus(driver, vm, &status, NULL) == -1)
         goto cleanup;
 
     if (status != VIR_DOMAIN_RUNNING) {
@@ -2522,7 +2468,7 @@ openvzDomainMigrateConfirm3Params(virDomainPtr domain,
     }
 
     if (cancelled) {
-        if (openvzGetVEStatus(vm, &status, NULL) == -1)
+        if (openvzGetVEStatus(driver, vm, &status, NULL) == -1)
             goto cleanup;
 
         if (status == VIR_DOMAIN_RUNNING) {
@@ -57,6 +57,7 @@
 #include "interface_conf.h"
 #include "phyp_driver.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_PHYP
 
@@ -86,6 +87,16 @@ struct _uuid_table {
     lparPtr *lpars;
 };
 
+/* An LPAR as listed by lssyscfg, see phypInventoryRefresh
+ * */
+typedef struct _phypLpar phypLpar;
+typedef phypLpar *phypLparPtr;
+struct _phypLpar {
+    int id;
+    char *name;
+    char *state;
+};
+
 /* This is the main structure of the driver
  * */
 typedef struct _phyp_driver phyp_driver_t;
@@ -94,6 +105,20 @@ struct _phyp_driver {
     LIBSSH2_SESSION *session;
     int sock;
 
+    /* Serializes the use of @session */
+    virMutex lock;
+    /* Persistent shell the commands are run in, see phypExec */
+    LIBSSH2_CHANNEL *shell;
+    bool shell_failed;
+    unsigned long long shell_seq;
+
+    /* Cached lssyscfg output, see phypInventoryRefresh. The lock may be
+     * held while running commands, but not the other way around. */
+    virMutex inventory_lock;
+    phypLparPtr inventory;
+    size_t ninventory;
+    unsigned long long inventory_expires;
+
     uuid_tablePtr uuid_table;
     virCapsPtr caps;
     virDomainXMLOptionPtr xmlopt;
@@ -118,7 +143,7 @@ enum {
 };
 
 static int
-waitsocket(int socket_fd, LIBSSH2_SESSION * session)
+waitsocketTimeout(int socket_fd, LIBSSH2_SESSION * session, int timeout)
 {
     struct pollfd fds[1];
     int dir;
@@ -135,17 +160,44 @@ waitsocket(int socket_fd, LIBSSH2_SESSION * session)
     if (dir & LIBSSH2_SESSION_BLOCK_OUTBOUND)
         fds[0].events |= POLLOUT;
 
-    return poll(fds, ARRAY_CARDINALITY(fds), -1);
+    return poll(fds, ARRAY_CARDINALITY(fds), timeout);
 }
 
-/* this function is the layer that manipulates the ssh channel itself
- * and executes the commands on the remote machine */
-static char *phypExec(LIBSSH2_SESSION *, const char *, int *, virConnectPtr)
-    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
-    ATTRIBUTE_NONNULL(4);
+static int
+waitsocket(int socket_fd, LIBSSH2_SESSION * session)
+{
+    return waitsocketTimeout(socket_fd, session, -1);
+}
+
+/* For how long the list of LPARs is trusted, unless we change them
+ * ourselves; changes made on the HMC directly show up with this delay */
+#define PHYP_INVENTORY_TTL (5 * 1000)
+
+static void
+phypInventoryFree(phypLparPtr inventory, size_t ninventory)
+{
+    size_t i;
+
+    for (i = 0; i < ninventory; i++) {
+        VIR_FREE(inventory[i].name);
+        VIR_FREE(inventory[i].state);
+    }
+    VIR_FREE(inventory);
+}
+
+static void
+phypInventoryInvalidate(phyp_driverPtr phyp_driver)
+{
+    virMutexLock(&phyp_driver->inventory_lock);
+    phyp_driver->inventory_expires = 0;
+    virMutexUnlock(&phyp_driver->inventory_lock);
+}
+
+/* Runs @cmd in a channel of its own, the way the driver always did. This
+ * is the fallback for when the persistent shell is not available. */
 static char *
-phypExec(LIBSSH2_SESSION *session, const char *cmd, int *exit_status,
-         virConnectPtr conn)
+phypExecChannel(LIBSSH2_SESSION *session, const char *cmd, int *exit_status,
+                virConnectPtr conn)
 {
     phyp_driverPtr phyp_driver = conn->privateData;
     LIBSSH2_CHANNEL *channel;
@@ -192,7 +244,7 @@ phypExec(LIBSSH2_SESSION *session, const char *cmd, int *exit_status,
             rc = libssh2_channel_read(channel, buffer, buffer_size);
             if (rc > 0) {
                 bytecount += rc;
-                virBufferAdd(&tex_ret, buffer, -1);
+                virBufferAdd(&tex_ret, buffer, rc);
             }
         }
         while (rc > 0);
@@ -239,6 +291,281 @@ phypExec(LIBSSH2_SESSION *session, const char *cmd, int *exit_status,
     return NULL;
 }
 
+
+/*
+ * Opening a channel and exec'ing a command costs several round trips
+ * on top of running it, which is what most of the time is spent on for
+ * the short commands we run. So we keep a single shell around and feed
+ * it the commands one per line, each followed by
+ *
+ *   echo "PHYP_SHELL_EOC <seq> $?"
+ *
+ * whose output marks the end of the command's output and tells us its
+ * exit status. The shell is opened on first use; if it can't be, or
+ * breaks, we go back to a channel per command for good.
+ */
+#define PHYP_SHELL_EOC "__LIBVIRT_PHYP_EOC__"
+#define PHYP_SHELL_OPEN_TIMEOUT (10 * 1000)
+
+static void
+phypShellClose(phyp_driverPtr phyp_driver)
+{
+    if (!phyp_driver->shell)
+        return;
+
+    /* Don't wait for the shell to go away, the session is still fine */
+    libssh2_channel_free(phyp_driver->shell);
+    phyp_driver->shell = NULL;
+    phyp_driver->shell_failed = true;
+}
+
+/* Wait for up to @timeout milliseconds, forever if negative */
+static int
+phypShellWait(phyp_driverPtr phyp_driver, int timeout)
+{
+    int rc = waitsocketTimeout(phyp_driver->sock, phyp_driver->session,
+                               timeout);
+
+    if (rc < 0 && errno != EINTR) {
+        virReportSystemError(errno, "%s",
+                             _("unable to wait on libssh2 socket"));
+        return -1;
+    }
+
+    if (rc == 0) {
+        virReportError(VIR_ERR_OPERATION_TIMEOUT, "%s",
+                       _("timed out waiting for the remote shell"));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+phypShellWrite(phyp_driverPtr phyp_driver, const char *data, size_t len)
+{
+    ssize_t rc;
+
+    while (len) {
+        rc = libssh2_channel_write(phyp_driver->shell, data, len);
+        if (rc == LIBSSH2_ERROR_EAGAIN) {
+            if (phypShellWait(phyp_driver, -1) < 0)
+                return -1;
+            continue;
+        }
+        if (rc < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("unable to write to the remote shell"));
+            return -1;
+        }
+        data += rc;
+        len -= rc;
+    }
+
+    return 0;
+}
+
+/* Runs @cmd (or nothing if NULL) in the shell, waiting for up to
+ * @timeout milliseconds between bits of output. @sent tells whether
+ * it may have been run in case of failure. */
+static char *
+phypShellExec(phyp_driverPtr phyp_driver, const char *cmd, int timeout,
+              int *exit_status, bool *sent)
+{
+    virBuffer line = VIR_BUFFER_INITIALIZER;
+    char *marker = NULL;
+    char *linestr = NULL;
+    char *data = NULL;
+    size_t len = 0;
+    size_t alloc = 0;
+    char tmp[1024];
+    char *eoc;
+    char *nl;
+    char *ret = NULL;
+    ssize_t rc;
+
+    *sent = false;
+    *exit_status = SSH_CMD_ERR;
+
+    phyp_driver->shell_seq++;
+    if (virAsprintf(&marker, PHYP_SHELL_EOC " %llu ",
+                    phyp_driver->shell_seq) < 0)
+        goto cleanup;
+
+    if (cmd)
+        virBufferAsprintf(&line, "%s\n", cmd);
+    virBufferAsprintf(&line, "echo \"%s$?\"\n", marker);
+    if (virBufferCheckError(&line) < 0)
+        goto cleanup;
+    linestr = virBufferContentAndReset(&line);
+
+    *sent = true;
+    if (phypShellWrite(phyp_driver, linestr, strlen(linestr)) < 0)
+        goto cleanup;
+
+    for (;;) {
+        bool blocked = true;
+
+        if (VIR_RESIZE_N(data, alloc, len, sizeof(tmp) + 1) < 0)
+            goto cleanup;
+
+        rc = libssh2_channel_read(phyp_driver->shell, data + len,
+                                  alloc - len - 1);
+        if (rc > 0) {
+            len += rc;
+            data[len] = '\0';
+            blocked = false;
+
+            if ((eoc = strstr(data, marker)) &&
+                (nl = strchr(eoc, '\n'))) {
+                *nl = '\0';
+                if (virStrToLong_i(eoc + strlen(marker), NULL, 10,
+                                   exit_status) < 0) {
+                    virReportError(VIR_ERR_INTERNAL_ERROR,
+                                   _("malformed end of command output '%s'"),
+                                   eoc);
+                    *exit_status = SSH_CMD_ERR;
+                    goto cleanup;
+                }
+
+                /* Empty output is reported as NULL, as phypExecChannel
+                 * does */
+                *eoc = '\0';
+                if (eoc != data) {
+                    ret = data;
+                    data = NULL;
+                }
+                goto cleanup;
+            }
+        } else if (rc != LIBSSH2_ERROR_EAGAIN) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("unable to read from the remote shell"));
+            goto cleanup;
+        }
+
+        /* Nobody reads it, but unless we consume stderr the channel
+         * window fills up eventually */
+        while ((rc = libssh2_channel_read_stderr(phyp_driver->shell, tmp,
+                                                 sizeof(tmp))) > 0)
+            blocked = false;
+
+        if (libssh2_channel_eof(phyp_driver->shell)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("remote shell exited unexpectedly"));
+            goto cleanup;
+        }
+
+        if (blocked && phypShellWait(phyp_driver, timeout) < 0)
+            goto cleanup;
+    }
+
+ cleanup:
+    virBufferFreeAndReset(&line);
+    VIR_FREE(linestr);
+    VIR_FREE(marker);
+    VIR_FREE(data);
+    return ret;
+}
+
+/* Must be called with phyp_driver->lock held */
+static int
+phypShellOpen(phyp_driverPtr phyp_driver)
+{
+    LIBSSH2_SESSION *session = phyp_driver->session;
+    LIBSSH2_CHANNEL *channel;
+    int exit_status;
+    bool sent;
+    char *out;
+    int rc;
+
+    while ((channel = libssh2_channel_open_session(session)) == NULL &&
+           libssh2_session_last_error(session, NULL, NULL, 0) ==
+           LIBSSH2_ERROR_EAGAIN) {
+        if (phypShellWait(phyp_driver, -1) < 0)
+            return -1;
+    }
+
+    if (channel == NULL)
+        return -1;
+
+    while ((rc = libssh2_channel_shell(channel)) == LIBSSH2_ERROR_EAGAIN) {
+        if (phypShellWait(phyp_driver, -1) < 0) {
+            libssh2_channel_free(channel);
+            return -1;
+        }
+    }
+
+    if (rc != 0) {
+        libssh2_channel_free(channel);
+        return -1;
+    }
+
+    phyp_driver->shell = channel;
+
+    /* Skip whatever the shell prints before reading commands, which
+     * also tells whether it understands our framing at all */
+    out = phypShellExec(phyp_driver, NULL, PHYP_SHELL_OPEN_TIMEOUT,
+                        &exit_status, &sent);
+    VIR_FREE(out);
+    if (exit_status == SSH_CMD_ERR) {
+        phypShellClose(phyp_driver);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* this function is the layer that manipulates the ssh channel itself
+ * and executes the commands on the remote machine */
+static char *phypExec(LIBSSH2_SESSION *, const char *, int *, virConnectPtr)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+    ATTRIBUTE_NONNULL(4);
+static char *
+phypExec(LIBSSH2_SESSION *session, const char *cmd, int *exit_status,
+         virConnectPtr conn)
+{
+    phyp_driverPtr phyp_driver = conn->privateData;
+    char *ret = NULL;
+    bool sent = false;
+
+    virMutexLock(&phyp_driver->lock);
+
+    if (!phyp_driver->shell && !phyp_driver->shell_failed &&
+        phypShellOpen(phyp_driver) < 0) {
+        VIR_WARN("Unable to open a remote shell, running every "
+                 "command in a channel of its own");
+        virResetLastError();
+        phyp_driver->shell_failed = true;
+    }
+
+    if (phyp_driver->shell) {
+        ret = phypShellExec(phyp_driver, cmd, -1, exit_status, &sent);
+
+        if (*exit_status == SSH_CMD_ERR) {
+            phypShellClose(phyp_driver);
+
+            /* Never risk running a command twice */
+            if (sent)
+                goto cleanup;
+            virResetLastError();
+        } else {
+            goto cleanup;
+        }
+    }
+
+    ret = phypExecChannel(session, cmd, exit_status, conn);
+
+ cleanup:
+    virMutexUnlock(&phyp_driver->lock);
+
+    /* Anything but the "ls*" family may change the LPARs */
+    if (!STRPREFIX(cmd, "ls"))
+        phypInventoryInvalidate(phyp_driver);
+
+    return ret;
+}
+
 /* Convenience wrapper function */
 static char *phypExecBuffer(LIBSSH2_SESSION *, virBufferPtr buf, int *,
                             virConnectPtr, bool) ATTRIBUTE_NONNULL(1)
@@ -286,6 +613,100 @@ phypExecInt(LIBSSH2_SESSION *session, virBufferPtr buf, virConnectPtr conn,
     return ret;
 }
 
+/*
+ * Listing the LPARs used to take a lssyscfg call per LPAR and attribute,
+ * so instead we fetch all of those we care about at once and serve
+ * lookups from that for a few seconds.
+ *
+ * Must be called with phyp_driver->inventory_lock held.
+ */
+static int
+phypInventoryRefresh(virConnectPtr conn)
+{
+    phyp_driverPtr phyp_driver = conn->privateData;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    phypLparPtr inventory = NULL;
+    size_t ninventory = 0;
+    unsigned long long now;
+    int exit_status = 0;
+    char *ret = NULL;
+    char *line;
+    char *next_line;
+    int result = -1;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (now < phyp_driver->inventory_expires)
+        return 0;
+
+    /* The name goes last as it's the only field that may contain commas */
+    virBufferAddLit(&buf, "lssyscfg -r lpar");
+    if (phyp_driver->system_type == HMC)
+        virBufferAsprintf(&buf, " -m %s", phyp_driver->managed_system);
+    virBufferAddLit(&buf, " -F lpar_id,state,name");
+    ret = phypExecBuffer(phyp_driver->session, &buf, &exit_status, conn,
+                         false);
+
+    if (exit_status != 0)
+        goto cleanup;
+
+    for (line = ret; line && *line; line = next_line) {
+        phypLpar lpar = { 0 };
+        char *state;
+        char *name;
+
+        if ((next_line = strchr(line, '\n')))
+            *next_line++ = '\0';
+        else
+            next_line = line + strlen(line);
+
+        if (virStrToLong_i(line, &state, 10, &lpar.id) < 0 ||
+            *state != ',' || !(name = strchr(++state, ','))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Cannot parse LPAR from '%s'"), line);
+            goto cleanup;
+        }
+        *name++ = '\0';
+
+        if (VIR_STRDUP(lpar.name, name) < 0 ||
+            VIR_STRDUP(lpar.state, state) < 0 ||
+            VIR_APPEND_ELEMENT(inventory, ninventory, lpar) < 0) {
+            VIR_FREE(lpar.name);
+            VIR_FREE(lpar.state);
+            goto cleanup;
+        }
+    }
+
+    phypInventoryFree(phyp_driver->inventory, phyp_driver->ninventory);
+    phyp_driver->inventory = inventory;
+    phyp_driver->ninventory = ninventory;
+    phyp_driver->inventory_expires = now + PHYP_INVENTORY_TTL;
+    inventory = NULL;
+    ninventory = 0;
+
+    result = 0;
+
+ cleanup:
+    phypInventoryFree(inventory, ninventory);
+    VIR_FREE(ret);
+    return result;
+}
+
+/* Must be called with phyp_driver->inventory_lock held */
+static phypLparPtr
+phypInventoryFindByID(phyp_driverPtr phyp_driver, int lpar_id)
+{
+    size_t i;
+
+    for (i = 0; i < phyp_driver->ninventory; i++) {
+        if (phyp_driver->inventory[i].id == lpar_id)
+            return &phyp_driver->inventory[i];
+    }
+
+    return NULL;
+}
+
 static int
 phypGetSystemType(virConnectPtr conn)
 {
@@ -372,31 +793,36 @@ static int
 phypConnectNumOfDomainsGeneric(virConnectPtr conn, unsigned int type)
 {
     phyp_driverPtr phyp_driver = conn->privateData;
-    LIBSSH2_SESSION *session = phyp_driver->session;
     int system_type = phyp_driver->system_type;
     int ndom = -1;
-    char *managed_system = phyp_driver->managed_system;
     const char *state;
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
 
     if (type == 0) {
-        state = "|grep Running";
+        state = "Running";
     } else if (type == 1) {
         if (system_type == HMC) {
-            state = "|grep \"Not Activated\"";
+            state = "Not Activated";
         } else {
-            state = "|grep \"Open Firmware\"";
+            state = "Open Firmware";
         }
     } else {
-        state = " ";
+        state = NULL;
     }
 
-    virBufferAddLit(&buf, "lssyscfg -r lpar");
-    if (system_type == HMC)
-        virBufferAsprintf(&buf, " -m %s", managed_system);
-    virBufferAsprintf(&buf, " -F lpar_id,state %s |grep -c '^[0-9][0-9]*'",
-                      state);
-    phypExecInt(session, &buf, conn, &ndom);
+    virMutexLock(&phyp_driver->inventory_lock);
+
+    if (phypInventoryRefresh(conn) < 0)
+        goto cleanup;
+
+    ndom = 0;
+    for (i = 0; i < phyp_driver->ninventory; i++) {
+        if (!state || strstr(phyp_driver->inventory[i].state, state))
+            ndom++;
+    }
+
+ cleanup:
+    virMutexUnlock(&phyp_driver->inventory_lock);
     return ndom;
 }
 
@@ -412,48 +838,26 @@ phypConnectListDomainsGeneric(virConnectPtr conn, int *ids, int nids,
                               unsigned int type)
 {
     phyp_driverPtr phyp_driver = conn->privateData;
-    LIBSSH2_SESSION *session = phyp_driver->session;
-    int system_type = phyp_driver->system_type;
-    char *managed_system = phyp_driver->managed_system;
-    int exit_status = 0;
     int got = -1;
-    char *ret = NULL;
-    char *line, *next_line;
-    const char *state;
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
-
-    if (type == 0)
-        state = "|grep Running";
-    else
-        state = " ";
+    size_t i;
 
-    virBufferAddLit(&buf, "lssyscfg -r lpar");
-    if (system_type == HMC)
-        virBufferAsprintf(&buf, " -m %s", managed_system);
-    virBufferAsprintf(&buf, " -F lpar_id,state %s | sed -e 's/,.*$//'",
-                      state);
-    ret = phypExecBuffer(session, &buf, &exit_status, conn, false);
+    virMutexLock(&phyp_driver->inventory_lock);
 
-    if (exit_status < 0 || ret == NULL)
+    if (phypInventoryRefresh(conn) < 0)
         goto cleanup;
 
-    /* I need to parse the textual return in order to get the ids */
-    line = ret;
     got = 0;
-    while (*line && got < nids) {
-        if (virStrToLong_i(line, &next_line, 10, &ids[got]) == -1) {
-            VIR_ERROR(_("Cannot parse number from '%s'"), line);
-            got = -1;
-            goto cleanup;
-        }
-        got++;
-        line = next_line;
-        while (*line == '\n')
-            line++; /* skip \n */
+    for (i = 0; i < phyp_driver->ninventory && got < nids; i++) {
+        phypLparPtr lpar = &phyp_driver->inventory[i];
+
+        if (type == 0 && !strstr(lpar->state, "Running"))
+            continue;
+
+        ids[got++] = lpar->id;
     }
 
  cleanup:
-    VIR_FREE(ret);
+    virMutexUnlock(&phyp_driver->inventory_lock);
     return got;
 }
 
@@ -1157,6 +1561,13 @@ phypConnectOpen(virConnectPtr conn,
 
     phyp_driver->sock = -1;
 
+    if (virMutexInit(&phyp_driver->lock) < 0 ||
+        virMutexInit(&phyp_driver->inventory_lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        goto failure;
+    }
+
     if (VIR_ALLOC(uuid_table) < 0)
         goto failure;
 
@@ -1224,6 +1635,11 @@ phypConnectOpen(virConnectPtr conn,
     VIR_FREE(managed_system);
 
     if (phyp_driver != NULL) {
+        if (phyp_driver->shell)
+            libssh2_channel_free(phyp_driver->shell);
+        phypInventoryFree(phyp_driver->inventory, phyp_driver->ninventory);
+        virMutexDestroy(&phyp_driver->lock);
+        virMutexDestroy(&phyp_driver->inventory_lock);
         virObjectUnref(phyp_driver->caps);
         virObjectUnref(phyp_driver->xmlopt);
         VIR_FREE(phyp_driver);
@@ -1247,9 +1663,14 @@ phypConnectClose(virConnectPtr conn)
     phyp_driverPtr phyp_driver = conn->privateData;
     LIBSSH2_SESSION *session = phyp_driver->session;
 
+    if (phyp_driver->shell)
+        libssh2_channel_free(phyp_driver->shell);
     libssh2_session_disconnect(session, "Disconnecting...");
     libssh2_session_free(session);
 
+    phypInventoryFree(phyp_driver->inventory, phyp_driver->ninventory);
+    virMutexDestroy(&phyp_driver->lock);
+    virMutexDestroy(&phyp_driver->inventory_lock);
     virObjectUnref(phyp_driver->caps);
     virObjectUnref(phyp_driver->xmlopt);
     phypUUIDTable_Free(phyp_driver->uuid_table);
@@ -1299,41 +1720,51 @@ phypDomainIsUpdated(virDomainPtr conn ATTRIBUTE_UNUSED)
 
 /* return the lpar_id given a name and a managed system name */
 static int
-phypGetLparID(LIBSSH2_SESSION * session, const char *managed_system,
+phypGetLparID(LIBSSH2_SESSION * session ATTRIBUTE_UNUSED,
+              const char *managed_system ATTRIBUTE_UNUSED,
               const char *name, virConnectPtr conn)
 {
     phyp_driverPtr phyp_driver = conn->privateData;
-    int system_type = phyp_driver->system_type;
     int lpar_id = -1;
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
 
-    virBufferAddLit(&buf, "lssyscfg -r lpar");
-    if (system_type == HMC)
-        virBufferAsprintf(&buf, " -m %s", managed_system);
-    virBufferAsprintf(&buf, " --filter lpar_names=%s -F lpar_id", name);
-    phypExecInt(session, &buf, conn, &lpar_id);
+    virMutexLock(&phyp_driver->inventory_lock);
+
+    if (phypInventoryRefresh(conn) < 0)
+        goto cleanup;
+
+    for (i = 0; i < phyp_driver->ninventory; i++) {
+        if (STREQ(phyp_driver->inventory[i].name, name)) {
+            lpar_id = phyp_driver->inventory[i].id;
+            break;
+        }
+    }
+
+ cleanup:
+    virMutexUnlock(&phyp_driver->inventory_lock);
     return lpar_id;
 }
 
 /* return the lpar name given a lpar_id and a managed system name */
 static char *
-phypGetLparNAME(LIBSSH2_SESSION * session, const char *managed_system,
+phypGetLparNAME(LIBSSH2_SESSION * session ATTRIBUTE_UNUSED,
+                const char *managed_system ATTRIBUTE_UNUSED,
                 unsigned int lpar_id, virConnectPtr conn)
 {
     phyp_driverPtr phyp_driver = conn->privateData;
-    int system_type = phyp_driver->system_type;
+    phypLparPtr lpar;
     char *ret = NULL;
-    int exit_status = 0;
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
 
-    virBufferAddLit(&buf, "lssyscfg -r lpar");
-    if (system_type == HMC)
-        virBufferAsprintf(&buf, " -m %s", managed_system);
-    virBufferAsprintf(&buf, " --filter lpar_ids=%d -F name", lpar_id);
-    ret = phypExecBuffer(session, &buf, &exit_status, conn, true);
+    virMutexLock(&phyp_driver->inventory_lock);
 
-    if (exit_status < 0)
-        VIR_FREE(ret);
+    if (phypInventoryRefresh(conn) < 0)
+        goto cleanup;
+
+    if ((lpar = phypInventoryFindByID(phyp_driver, lpar_id)))
+        ignore_value(VIR_STRDUP(ret, lpar->name));
+
+ cleanup:
+    virMutexUnlock(&phyp_driver->inventory_lock);
     return ret;
 }
 
@@ -3060,32 +3491,24 @@ static int
 phypGetLparState(virConnectPtr conn, unsigned int lpar_id)
 {
     phyp_driverPtr phyp_driver = conn->privateData;
-    LIBSSH2_SESSION *session = phyp_driver->session;
-    int system_type = phyp_driver->system_type;
-    char *ret = NULL;
-    int exit_status = 0;
-    char *managed_system = phyp_driver->managed_system;
     int state = VIR_DOMAIN_NOSTATE;
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    phypLparPtr lpar;
 
-    virBufferAddLit(&buf, "lssyscfg -r lpar");
-    if (system_type == HMC)
-        virBufferAsprintf(&buf, " -m %s", managed_system);
-    virBufferAsprintf(&buf, " -F state --filter lpar_ids=%d", lpar_id);
-    ret = phypExecBuffer(session, &buf, &exit_status, conn, true);
+    virMutexLock(&phyp_driver->inventory_lock);
 
-    if (exit_status < 0 || ret == NULL)
+    if (phypInventoryRefresh(conn) < 0 ||
+        !(lpar = phypInventoryFindByID(phyp_driver, lpar_id)))
         goto cleanup;
 
-    if (STREQ(ret, "Running"))
+    if (STREQ(lpar->state, "Running"))
         state = VIR_DOMAIN_RUNNING;
-    else if (STREQ(ret, "Not Activated"))
+    else if (STREQ(lpar->state, "Not Activated"))
         state = VIR_DOMAIN_SHUTOFF;
-    else if (STREQ(ret, "Shutting Down"))
+    else if (STREQ(lpar->state, "Shutting Down"))
         state = VIR_DOMAIN_SHUTDOWN;
 
  cleanup:
-    VIR_FREE(ret);
+    virMutexUnlock(&phyp_driver->inventory_lock);
     return state;
 }
 
@@ -3146,58 +3569,34 @@ phypConnectListDomains(virConnectPtr conn, int *ids, int nids)
 static int
 phypConnectListDefinedDomains(virConnectPtr conn, char **const names, int nnames)
 {
-    bool success = false;
     phyp_driverPtr phyp_driver = conn->privateData;
-    LIBSSH2_SESSION *session = phyp_driver->session;
-    int system_type = phyp_driver->system_type;
-    char *managed_system = phyp_driver->managed_system;
-    int exit_status = 0;
     int got = 0;
     size_t i;
-    char *ret = NULL;
-    char *domains = NULL;
-    char *char_ptr = NULL;
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
 
-    virBufferAddLit(&buf, "lssyscfg -r lpar");
-    if (system_type == HMC)
-        virBufferAsprintf(&buf, " -m %s", managed_system);
-    virBufferAddLit(&buf, " -F name,state"
-                      "|sed -n '/Not Activated/ {\n s/,.*$//\n p\n}'");
-    ret = phypExecBuffer(session, &buf, &exit_status, conn, false);
-
-    /* I need to parse the textual return in order to get the domains */
-    if (exit_status < 0 || ret == NULL) {
-        goto cleanup;
-    } else {
-        domains = ret;
+    virMutexLock(&phyp_driver->inventory_lock);
 
-        while (got < nnames) {
-            char_ptr = strchr(domains, '\n');
-
-            if (char_ptr) {
-                *char_ptr = '\0';
-                if (VIR_STRDUP(names[got++], domains) < 0)
-                    goto cleanup;
-                char_ptr++;
-                domains = char_ptr;
-            } else {
-                break;
-            }
-        }
-    }
+    if (phypInventoryRefresh(conn) < 0)
+        goto error;
 
-    success = true;
+    for (i = 0; i < phyp_driver->ninventory && got < nnames; i++) {
+        phypLparPtr lpar = &phyp_driver->inventory[i];
 
- cleanup:
-    if (!success) {
-        for (i = 0; i < got; i++)
-            VIR_FREE(names[i]);
+        if (!strstr(lpar->state, "Not Activated"))
+            continue;
 
-        got = -1;
+        if (VIR_STRDUP(names[got], lpar->name) < 0)
+            goto error;
+        got++;
     }
-    VIR_FREE(ret);
+
+    virMutexUnlock(&phyp_driver->inventory_lock);
     return got;
+
+ error:
+    virMutexUnlock(&phyp_driver->inventory_lock);
+    for (i = 0; i < got; i++)
+        VIR_FREE(names[i]);
+    return -1;
 }
 
 static virDomainPtr
@@ -42,6 +42,7 @@
 #include "virtime.h"
 #include "virobject.h"
 #include "virstring.h"
+#include "virevent.h"
 #include "base64.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
@@ -77,6 +78,12 @@ struct _qemuAgentMessage {
     int rxLength;
     void *rxObject;
 
+    /* If non-zero, @txBuffer holds this many commands whose replies
+     * are collected in @rxObjects instead of @rxObject */
+    size_t nreplies;
+    virJSONValuePtr *rxObjects;
+    size_t nrxObjects;
+
     /* True if rxBuffer / rxObject are ready, or a
      * fatal error occurred on the monitor channel
      */
@@ -100,6 +107,12 @@ struct _qemuAgent {
     bool connectPending;
     bool running;
 
+    /* True if the last guest-sync succeeded and no reply could have
+     * been left behind since then, so commands don't need another */
+    bool inSync;
+    /* When the last message was answered, in milliseconds */
+    unsigned long long lastReply;
+
     virDomainObjPtr vm;
 
     qemuAgentCallbacksPtr cb;
@@ -339,7 +352,7 @@ qemuAgentIOProcessLine(qemuAgentPtr mon,
         ret = qemuAgentIOProcessEvent(mon, obj);
     } else if (virJSONValueObjectHasKey(obj, "error") == 1 ||
                virJSONValueObjectHasKey(obj, "return") == 1) {
-        if (msg) {
+        if (msg && !msg->finished) {
             if (msg->sync) {
                 unsigned long long id;
 
@@ -358,12 +371,19 @@ qemuAgentIOProcessLine(qemuAgentPtr mon,
                     goto cleanup;
                 }
             }
-            msg->rxObject = obj;
-            msg->finished = 1;
+            if (msg->nreplies) {
+                msg->rxObjects[msg->nrxObjects++] = obj;
+                if (msg->nrxObjects == msg->nreplies)
+                    msg->finished = 1;
+            } else {
+                msg->rxObject = obj;
+                msg->finished = 1;
+            }
             obj = NULL;
         } else {
             /* we are out of sync */
             VIR_DEBUG("Ignoring delayed reply");
+            mon->inSync = false;
         }
         ret = 0;
     } else {
@@ -423,9 +443,11 @@ qemuAgentIOProcess(qemuAgentPtr mon)
     qemuAgentMessagePtr msg = NULL;
 
     /* See if there's a message ready for reply; that is,
-     * one that has completed writing all its data.
+     * one that has completed writing all its data. The replies
+     * to the first commands of a pipeline may arrive earlier.
      */
-    if (mon->msg && mon->msg->txOffset == mon->msg->txLength)
+    if (mon->msg &&
+        (mon->msg->txOffset == mon->msg->txLength || mon->msg->nreplies))
         msg = mon->msg;
 
 #if DEBUG_IO
@@ -687,7 +709,7 @@ qemuAgentIO(int watch, int fd, int events, void *opaque)
          * then wakeup that waiter */
         if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+            virCondBroadcast(&mon->notify);
         }
     }
 
@@ -702,7 +724,7 @@ qemuAgentIO(int watch, int fd, int events, void *opaque)
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         virObjectUnref(mon);
         VIR_DEBUG("Triggering EOF callback");
@@ -713,7 +735,7 @@ qemuAgentIO(int watch, int fd, int events, void *opaque)
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         virObjectUnref(mon);
         VIR_DEBUG("Triggering error callback");
@@ -775,16 +797,17 @@ qemuAgentOpen(virDomainObjPtr vm,
         goto cleanup;
 
     virObjectRef(mon);
-    if ((mon->watch = virEventAddHandle(mon->fd,
-                                        VIR_EVENT_HANDLE_HANGUP |
-                                        VIR_EVENT_HANDLE_ERROR |
-                                        VIR_EVENT_HANDLE_READABLE |
-                                        (mon->connectPending ?
-                                         VIR_EVENT_HANDLE_WRITABLE :
-                                         0),
-                                        qemuAgentIO,
-                                        mon,
-                                        virObjectFreeCallback)) < 0) {
+    if ((mon->watch = virEventAddHandleKey(mon->fd,
+                                           VIR_EVENT_HANDLE_HANGUP |
+                                           VIR_EVENT_HANDLE_ERROR |
+                                           VIR_EVENT_HANDLE_READABLE |
+                                           (mon->connectPending ?
+                                            VIR_EVENT_HANDLE_WRITABLE :
+                                            0),
+                                           qemuAgentIO,
+                                           mon,
+                                           virObjectFreeCallback,
+                                           vm->def ? vm->def->id : 0)) < 0) {
         virObjectUnref(mon);
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("unable to register monitor events"));
@@ -818,7 +841,7 @@ qemuAgentNotifyCloseLocked(qemuAgentPtr mon)
          * wake him up. No message will arrive anyway. */
         if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+            virCondBroadcast(&mon->notify);
         }
     }
 }
@@ -838,6 +861,26 @@ qemuAgentNotifyClose(qemuAgentPtr mon)
 }
 
 
+/**
+ * qemuAgentGetBufferSize:
+ * @mon: agent object
+ *
+ * Returns the number of bytes allocated for messages received from the
+ * guest agent.
+ */
+size_t
+qemuAgentGetBufferSize(qemuAgentPtr mon)
+{
+    size_t ret;
+
+    virObjectLock(mon);
+    ret = mon->bufferLength;
+    virObjectUnlock(mon);
+
+    return ret;
+}
+
+
 void qemuAgentClose(qemuAgentPtr mon)
 {
     if (!mon)
@@ -861,6 +904,11 @@ void qemuAgentClose(qemuAgentPtr mon)
 
 #define QEMU_AGENT_WAIT_TIME 5
 
+/* Most commands are sent without a timeout, guest-sync is what detects
+ * an agent which stopped answering. It is only skipped if the agent
+ * answered within this many seconds. */
+#define QEMU_AGENT_SYNC_VALID_TIME 3
+
 /**
  * qemuAgentSend:
  * @mon: Monitor
@@ -904,6 +952,28 @@ static int qemuAgentSend(qemuAgentPtr mon,
         then = now + seconds * 1000ull;
     }
 
+    /* Threads sharing a query job take turns, the agent handles one
+     * message at a time */
+    while (mon->msg && mon->lastError.code == VIR_ERR_OK) {
+        if ((then && virCondWaitUntil(&mon->notify, &mon->parent.lock, then) < 0) ||
+            (!then && virCondWait(&mon->notify, &mon->parent.lock) < 0)) {
+            if (errno == ETIMEDOUT) {
+                virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
+                               _("Guest agent not available for now"));
+                return -2;
+            }
+            virReportSystemError(errno, "%s",
+                                 _("Unable to wait on agent monitor "
+                                   "condition"));
+            return -1;
+        }
+    }
+
+    if (mon->lastError.code != VIR_ERR_OK) {
+        virSetError(&mon->lastError);
+        return -1;
+    }
+
     mon->msg = msg;
     qemuAgentUpdateWatch(mon);
 
@@ -933,13 +1003,38 @@ static int qemuAgentSend(qemuAgentPtr mon,
     ret = 0;
 
  cleanup:
+    /* A reply may still come after a timeout */
+    if (ret < 0)
+        mon->inSync = false;
+    else if (virTimeMillisNow(&mon->lastReply) < 0)
+        mon->lastReply = 0;
     mon->msg = NULL;
     qemuAgentUpdateWatch(mon);
+    virCondBroadcast(&mon->notify);
 
     return ret;
 }
 
 
+/**
+ * qemuAgentNeedsSync:
+ * @mon: Monitor
+ *
+ * Returns true if a guest-sync has to precede the next command, which
+ * is the case unless the agent is in sync and answered recently.
+ */
+static bool
+qemuAgentNeedsSync(qemuAgentPtr mon)
+{
+    unsigned long long now;
+
+    if (!mon->inSync || virTimeMillisNow(&now) < 0)
+        return true;
+
+    return now - mon->lastReply >= QEMU_AGENT_SYNC_VALID_TIME * 1000ull;
+}
+
+
 /**
  * qemuAgentGuestSync:
  * @mon: Monitor
@@ -1002,6 +1097,7 @@ qemuAgentGuestSync(qemuAgentPtr mon)
         }
     }
 
+    mon->inSync = true;
     ret = 0;
 
  cleanup:
@@ -1139,7 +1235,7 @@ qemuAgentCommand(qemuAgentPtr mon,
         return -1;
     }
 
-    if (qemuAgentGuestSync(mon) < 0)
+    if (qemuAgentNeedsSync(mon) && qemuAgentGuestSync(mon) < 0)
         return -1;
 
     memset(&msg, 0, sizeof(msg));
@@ -1157,6 +1253,11 @@ qemuAgentCommand(qemuAgentPtr mon,
     VIR_DEBUG("Receive command reply ret=%d rxObject=%p",
               ret, msg.rxObject);
 
+    /* The agent may be restarted by the command, or reply after
+     * the event woke us up */
+    if (await_event)
+        mon->inSync = false;
+
     if (ret == 0) {
         /* If we haven't obtained any reply but we wait for an
          * event, then don't report this as error */
@@ -1170,6 +1271,7 @@ qemuAgentCommand(qemuAgentPtr mon,
                 else
                     virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
                                    _("Guest agent disappeared while executing command"));
+                mon->inSync = false;
                 ret = -1;
             }
         } else {
@@ -1185,6 +1287,96 @@ qemuAgentCommand(qemuAgentPtr mon,
     return ret;
 }
 
+/**
+ * qemuAgentCommands:
+ * @mon: agent handle
+ * @cmds: commands to run
+ * @ncmds: number of @cmds
+ * @replies: filled with an array of @ncmds replies
+ * @seconds: timeout for all of them together, see qemuAgentSend()
+ *
+ * Send all @cmds to the agent at once and collect their replies, which
+ * come back in the same order. Unlike qemuAgentCommand() this doesn't
+ * look into the replies; callers check each of them with
+ * qemuAgentCheckError(), so that one command failing doesn't lose the
+ * results of the others. None of @cmds may make the agent skip its
+ * reply.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuAgentCommands(qemuAgentPtr mon,
+                  virJSONValuePtr *cmds,
+                  size_t ncmds,
+                  virJSONValuePtr **replies,
+                  int seconds)
+{
+    int ret = -1;
+    qemuAgentMessage msg;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *cmdstr = NULL;
+    size_t i;
+
+    *replies = NULL;
+
+    if (!mon->running) {
+        virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
+                       _("Guest agent disappeared while executing command"));
+        return -1;
+    }
+
+    if (qemuAgentNeedsSync(mon) && qemuAgentGuestSync(mon) < 0)
+        return -1;
+
+    memset(&msg, 0, sizeof(msg));
+
+    for (i = 0; i < ncmds; i++) {
+        if (!(cmdstr = virJSONValueToString(cmds[i], false)))
+            goto cleanup;
+        virBufferAsprintf(&buf, "%s" LINE_ENDING, cmdstr);
+        VIR_FREE(cmdstr);
+    }
+
+    if (virBufferCheckError(&buf) < 0 ||
+        VIR_ALLOC_N(msg.rxObjects, ncmds) < 0)
+        goto cleanup;
+
+    msg.txBuffer = virBufferContentAndReset(&buf);
+    msg.txLength = strlen(msg.txBuffer);
+    msg.nreplies = ncmds;
+
+    VIR_DEBUG("Send %zu commands for write, seconds = %d", ncmds, seconds);
+
+    if (qemuAgentSend(mon, &msg, seconds) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Received %zu of %zu replies", msg.nrxObjects, ncmds);
+
+    if (msg.nrxObjects != ncmds) {
+        if (mon->running)
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Missing monitor reply object"));
+        else
+            virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
+                           _("Guest agent disappeared while executing command"));
+        mon->inSync = false;
+        goto cleanup;
+    }
+
+    VIR_STEAL_PTR(*replies, msg.rxObjects);
+    ret = 0;
+
+ cleanup:
+    if (msg.rxObjects) {
+        for (i = 0; i < msg.nrxObjects; i++)
+            virJSONValueFree(msg.rxObjects[i]);
+        VIR_FREE(msg.rxObjects);
+    }
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(msg.txBuffer);
+    return ret;
+}
+
 static virJSONValuePtr ATTRIBUTE_SENTINEL
 qemuAgentMakeCommand(const char *cmdname,
                      ...)
@@ -1251,12 +1443,16 @@ void qemuAgentNotifyEvent(qemuAgentPtr mon,
     virObjectLock(mon);
 
     VIR_DEBUG("mon=%p event=%d await_event=%d", mon, event, mon->await_event);
+
+    /* The agent will start over as well */
+    mon->inSync = false;
+
     if (mon->await_event == event) {
         mon->await_event = QEMU_AGENT_EVENT_NONE;
         /* somebody waiting for this event, wake him up. */
         if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+            virCondBroadcast(&mon->notify);
         }
     }
 
@@ -1435,7 +1631,10 @@ qemuAgentArbitraryCommand(qemuAgentPtr mon,
     if (!(cmd = virJSONValueFromString(cmd_str)))
         goto cleanup;
 
-    if ((ret = qemuAgentCommand(mon, cmd, &reply, true, timeout)) < 0)
+    /* The command may leave anything behind */
+    ret = qemuAgentCommand(mon, cmd, &reply, true, timeout);
+    mon->inSync = false;
+    if (ret < 0)
         goto cleanup;
 
     if (!(*result = virJSONValueToString(reply, false)))
@@ -1745,13 +1944,33 @@ qemuAgentUpdateCPUInfo(unsigned int nvcpus,
 }
 
 
+static int
+qemuAgentParseTime(virJSONValuePtr reply,
+                   long long *seconds,
+                   unsigned int *nseconds)
+{
+    unsigned long long json_time;
+
+    if (virJSONValueObjectGetNumberUlong(reply, "return", &json_time) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed return value"));
+        return -1;
+    }
+
+    /* guest agent returns time in nanoseconds,
+     * we need it in seconds here */
+    *seconds = json_time / 1000000000LL;
+    *nseconds = json_time % 1000000000LL;
+    return 0;
+}
+
+
 int
 qemuAgentGetTime(qemuAgentPtr mon,
                  long long *seconds,
                  unsigned int *nseconds)
 {
     int ret = -1;
-    unsigned long long json_time;
     virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
 
@@ -1764,17 +1983,7 @@ qemuAgentGetTime(qemuAgentPtr mon,
                          VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0)
         goto cleanup;
 
-    if (virJSONValueObjectGetNumberUlong(reply, "return", &json_time) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("malformed return value"));
-        goto cleanup;
-    }
-
-    /* guest agent returns time in nanoseconds,
-     * we need it in seconds here */
-    *seconds = json_time / 1000000000LL;
-    *nseconds = json_time % 1000000000LL;
-    ret = 0;
+    ret = qemuAgentParseTime(reply, seconds, nseconds);
 
  cleanup:
     virJSONValueFree(cmd);
@@ -1838,28 +2047,19 @@ qemuAgentSetTime(qemuAgentPtr mon,
 }
 
 
-int
-qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
-                   virDomainDefPtr vmdef)
+static int
+qemuAgentParseFSInfo(virJSONValuePtr reply,
+                     virDomainFSInfoPtr **info,
+                     virDomainDefPtr vmdef)
 {
     size_t i, j, k;
     int ret = -1;
     ssize_t ndata = 0, ndisk;
     char **alias;
-    virJSONValuePtr cmd;
-    virJSONValuePtr reply = NULL;
     virJSONValuePtr data;
     virDomainFSInfoPtr *info_ret = NULL;
     virPCIDeviceAddress pci_address;
 
-    cmd = qemuAgentMakeCommand("guest-get-fsinfo", NULL);
-    if (!cmd)
-        return ret;
-
-    if (qemuAgentCommand(mon, cmd, &reply, true,
-                         VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0)
-        goto cleanup;
-
     if (!(data = virJSONValueObjectGet(reply, "return"))) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("guest-get-fsinfo reply was missing return data"));
@@ -2010,31 +2210,41 @@ qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
             virDomainFSInfoFree(info_ret[i]);
         VIR_FREE(info_ret);
     }
+    return ret;
+}
+
+
+int
+qemuAgentGetFSInfo(qemuAgentPtr mon, virDomainFSInfoPtr **info,
+                   virDomainDefPtr vmdef)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    cmd = qemuAgentMakeCommand("guest-get-fsinfo", NULL);
+    if (!cmd)
+        return ret;
+
+    if (qemuAgentCommand(mon, cmd, &reply, true,
+                         VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0)
+        goto cleanup;
+
+    ret = qemuAgentParseFSInfo(reply, info, vmdef);
+
+ cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
 }
 
-/*
- * qemuAgentGetInterfaces:
- * @mon: Agent monitor
- * @ifaces: pointer to an array of pointers pointing to interface objects
- *
- * Issue guest-network-get-interfaces to guest agent, which returns a
- * list of interfaces of a running domain along with their IP and MAC
- * addresses.
- *
- * Returns: number of interfaces on success, -1 on error.
- */
-int
-qemuAgentGetInterfaces(qemuAgentPtr mon,
-                       virDomainInterfacePtr **ifaces)
+static int
+qemuAgentParseInterfaces(virJSONValuePtr reply,
+                         virDomainInterfacePtr **ifaces)
 {
     int ret = -1;
     size_t i, j;
     ssize_t size = -1;
-    virJSONValuePtr cmd = NULL;
-    virJSONValuePtr reply = NULL;
     virJSONValuePtr ret_array = NULL;
     size_t ifaces_count = 0;
     size_t addrs_count = 0;
@@ -2048,14 +2258,6 @@ qemuAgentGetInterfaces(qemuAgentPtr mon,
         return -1;
     }
 
-    if (!(cmd = qemuAgentMakeCommand("guest-network-get-interfaces", NULL)))
-        goto cleanup;
-
-    if (qemuAgentCommand(mon, cmd, &reply, false, VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0 ||
-        qemuAgentCheckError(cmd, reply) < 0) {
-        goto cleanup;
-    }
-
     if (!(ret_array = virJSONValueObjectGet(reply, "return"))) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("qemu agent didn't provide 'return' field"));
@@ -2195,8 +2397,6 @@ qemuAgentGetInterfaces(qemuAgentPtr mon,
     ret = ifaces_count;
 
  cleanup:
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
     virHashFree(ifaces_store);
     return ret;
 
@@ -2212,6 +2412,42 @@ qemuAgentGetInterfaces(qemuAgentPtr mon,
 }
 
 
+/*
+ * qemuAgentGetInterfaces:
+ * @mon: Agent monitor
+ * @ifaces: pointer to an array of pointers pointing to interface objects
+ *
+ * Issue guest-network-get-interfaces to guest agent, which returns a
+ * list of interfaces of a running domain along with their IP and MAC
+ * addresses.
+ *
+ * Returns: number of interfaces on success, -1 on error.
+ */
+int
+qemuAgentGetInterfaces(qemuAgentPtr mon,
+                       virDomainInterfacePtr **ifaces)
+{
+    int ret = -1;
+    virJSONValuePtr cmd = NULL;
+    virJSONValuePtr reply = NULL;
+
+    if (!(cmd = qemuAgentMakeCommand("guest-network-get-interfaces", NULL)))
+        goto cleanup;
+
+    if (qemuAgentCommand(mon, cmd, &reply, false, VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK) < 0 ||
+        qemuAgentCheckError(cmd, reply) < 0) {
+        goto cleanup;
+    }
+
+    ret = qemuAgentParseInterfaces(reply, ifaces);
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
 int
 qemuAgentSetUserPassword(qemuAgentPtr mon,
                          const char *user,
@@ -2246,3 +2482,146 @@ qemuAgentSetUserPassword(qemuAgentPtr mon,
     VIR_FREE(password64);
     return ret;
 }
+
+
+static int
+qemuAgentParseHostname(virJSONValuePtr reply,
+                       char **hostname)
+{
+    virJSONValuePtr data;
+    const char *result;
+
+    if (!(data = virJSONValueObjectGetObject(reply, "return")) ||
+        !(result = virJSONValueObjectGetString(data, "host-name"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed return value"));
+        return -1;
+    }
+
+    return VIR_STRDUP(*hostname, result);
+}
+
+
+typedef enum {
+    QEMU_AGENT_GUEST_INFO_TIME,
+    QEMU_AGENT_GUEST_INFO_HOSTNAME,
+    QEMU_AGENT_GUEST_INFO_FSINFO,
+    QEMU_AGENT_GUEST_INFO_INTERFACES,
+
+    QEMU_AGENT_GUEST_INFO_LAST
+} qemuAgentGuestInfoItem;
+
+static const char *qemuAgentGuestInfoCommands[QEMU_AGENT_GUEST_INFO_LAST] = {
+    "guest-get-time",
+    "guest-get-host-name",
+    "guest-get-fsinfo",
+    "guest-network-get-interfaces",
+};
+
+
+/**
+ * qemuAgentGetGuestInfo:
+ * @mon: agent handle
+ * @vmdef: domain definition used to map guest disks to aliases
+ * @info: filled with what the agent was able to tell
+ *
+ * Ask the agent for the guest time, host name, file systems and
+ * network interfaces in a single round trip. Items the agent doesn't
+ * support or fails to report are left unset in @info rather than
+ * failing the whole call; @info must be cleared with
+ * qemuAgentGuestInfoClear() either way. Since this is used for
+ * statistics, the agent is only waited for QEMU_AGENT_WAIT_TIME
+ * seconds.
+ *
+ * Returns 0 on success, -1 if the agent couldn't be talked to.
+ */
+int
+qemuAgentGetGuestInfo(qemuAgentPtr mon,
+                      virDomainDefPtr vmdef,
+                      qemuAgentGuestInfoPtr info)
+{
+    virJSONValuePtr cmds[QEMU_AGENT_GUEST_INFO_LAST] = { NULL };
+    virJSONValuePtr *replies = NULL;
+    int rc = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(info, 0, sizeof(*info));
+    info->nfs = -1;
+    info->nifaces = -1;
+
+    for (i = 0; i < QEMU_AGENT_GUEST_INFO_LAST; i++) {
+        if (!(cmds[i] = qemuAgentMakeCommand(qemuAgentGuestInfoCommands[i],
+                                             NULL)))
+            goto cleanup;
+    }
+
+    if (qemuAgentCommands(mon, cmds, QEMU_AGENT_GUEST_INFO_LAST, &replies,
+                          VIR_DOMAIN_QEMU_AGENT_COMMAND_DEFAULT) < 0)
+        goto cleanup;
+
+    for (i = 0; i < QEMU_AGENT_GUEST_INFO_LAST; i++) {
+        if (qemuAgentCheckError(cmds[i], replies[i]) < 0) {
+            rc = -1;
+        } else {
+            switch ((qemuAgentGuestInfoItem) i) {
+            case QEMU_AGENT_GUEST_INFO_TIME:
+                if ((rc = qemuAgentParseTime(replies[i], &info->seconds,
+                                             &info->nseconds)) == 0)
+                    info->haveTime = true;
+                break;
+
+            case QEMU_AGENT_GUEST_INFO_HOSTNAME:
+                rc = qemuAgentParseHostname(replies[i], &info->hostname);
+                break;
+
+            case QEMU_AGENT_GUEST_INFO_FSINFO:
+                rc = info->nfs = qemuAgentParseFSInfo(replies[i], &info->fs,
+                                                      vmdef);
+                break;
+
+            case QEMU_AGENT_GUEST_INFO_INTERFACES:
+                rc = info->nifaces = qemuAgentParseInterfaces(replies[i],
+                                                              &info->ifaces);
+                break;
+
+            case QEMU_AGENT_GUEST_INFO_LAST:
+                break;
+            }
+        }
+
+        if (rc < 0) {
+            VIR_DEBUG("Skipping %s: %s", qemuAgentGuestInfoCommands[i],
+                      virGetLastErrorMessage());
+            virResetLastError();
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < QEMU_AGENT_GUEST_INFO_LAST; i++) {
+        virJSONValueFree(cmds[i]);
+        if (replies)
+            virJSONValueFree(replies[i]);
+    }
+    VIR_FREE(replies);
+    return ret;
+}
+
+
+void
+qemuAgentGuestInfoClear(qemuAgentGuestInfoPtr info)
+{
+    ssize_t i;
+
+    VIR_FREE(info->hostname);
+    for (i = 0; i < info->nfs; i++)
+        virDomainFSInfoFree(info->fs[i]);
+    VIR_FREE(info->fs);
+    for (i = 0; i < info->nifaces; i++)
+        virDomainInterfaceFree(info->ifaces[i]);
+    VIR_FREE(info->ifaces);
+    info->nfs = -1;
+    info->nifaces = -1;
+}
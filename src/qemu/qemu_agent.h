@@ -51,6 +51,9 @@ void qemuAgentClose(qemuAgentPtr mon);
 
 void qemuAgentNotifyClose(qemuAgentPtr mon);
 
+size_t qemuAgentGetBufferSize(qemuAgentPtr mon)
+    ATTRIBUTE_NONNULL(1);
+
 typedef enum {
     QEMU_AGENT_EVENT_NONE = 0,
     QEMU_AGENT_EVENT_SHUTDOWN,
@@ -120,4 +123,25 @@ int qemuAgentSetUserPassword(qemuAgentPtr mon,
                              const char *user,
                              const char *password,
                              bool crypted);
+
+typedef struct _qemuAgentGuestInfo qemuAgentGuestInfo;
+typedef qemuAgentGuestInfo *qemuAgentGuestInfoPtr;
+struct _qemuAgentGuestInfo {
+    bool haveTime;
+    long long seconds;
+    unsigned int nseconds;
+
+    char *hostname;
+
+    virDomainFSInfoPtr *fs;
+    int nfs;        /* -1 if unknown */
+
+    virDomainInterfacePtr *ifaces;
+    int nifaces;    /* -1 if unknown */
+};
+
+int qemuAgentGetGuestInfo(qemuAgentPtr mon,
+                          virDomainDefPtr vmdef,
+                          qemuAgentGuestInfoPtr info);
+void qemuAgentGuestInfoClear(qemuAgentGuestInfoPtr info);
 #endif /* __QEMU_AGENT_H__ */
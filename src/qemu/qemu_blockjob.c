@@ -72,6 +72,29 @@ qemuBlockJobUpdate(virQEMUDriverPtr driver,
 }
 
 
+/**
+ * qemuBlockJobMirrorRelease:
+ * @driver: qemu driver
+ * @vm: domain
+ * @disk: domain disk
+ *
+ * Drop the access of @vm to the mirror of @disk, which is no longer
+ * used.  The target of a backup job is revoked entirely since qemu
+ * never writes to it again; for the other jobs only the lock is
+ * released, as the mirror may share backing files with the source.
+ */
+static void
+qemuBlockJobMirrorRelease(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm,
+                          virDomainDiskDefPtr disk)
+{
+    if (disk->mirrorJob == VIR_DOMAIN_BLOCK_JOB_TYPE_BACKUP)
+        qemuDomainDiskChainElementRevoke(driver, vm, disk->mirror);
+    else
+        virDomainLockImageDetach(driver->lockManager, vm, disk->mirror);
+}
+
+
 /**
  * qemuBlockJobEventProcess:
  * @driver: qemu driver
@@ -154,7 +177,7 @@ qemuBlockJobEventProcess(virQEMUDriverPtr driver,
             disk->src = disk->mirror;
         } else {
             if (disk->mirror) {
-                virDomainLockImageDetach(driver->lockManager, vm, disk->mirror);
+                qemuBlockJobMirrorRelease(driver, vm, disk);
                 virStorageSourceFree(disk->mirror);
             }
         }
@@ -181,7 +204,7 @@ qemuBlockJobEventProcess(virQEMUDriverPtr driver,
     case VIR_DOMAIN_BLOCK_JOB_FAILED:
     case VIR_DOMAIN_BLOCK_JOB_CANCELED:
         if (disk->mirror) {
-            virDomainLockImageDetach(driver->lockManager, vm, disk->mirror);
+            qemuBlockJobMirrorRelease(driver, vm, disk);
             virStorageSourceFree(disk->mirror);
             disk->mirror = NULL;
         }
@@ -213,6 +236,79 @@ qemuBlockJobEventProcess(virQEMUDriverPtr driver,
 }
 
 
+/**
+ * qemuBlockJobStarted:
+ * @disk: domain disk
+ *
+ * Mark @disk as having a block job started by libvirt. Its progress
+ * has to be asked from qemu until an event says otherwise.
+ */
+void
+qemuBlockJobStarted(virDomainDiskDefPtr disk)
+{
+    qemuDomainDiskPrivatePtr diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
+
+    diskPriv->blockjob = true;
+    diskPriv->blockJobState = QEMU_BLOCKJOB_STATE_RUNNING;
+}
+
+
+/**
+ * qemuBlockJobTrack:
+ * @disk: domain disk
+ * @status: block job status from the event
+ * @info: progress reported along with the event, or NULL
+ *
+ * Update the tracked state of the block job on @disk as soon as an
+ * event arrives, even if the rest of its processing is deferred.
+ */
+void
+qemuBlockJobTrack(virDomainDiskDefPtr disk,
+                  int status,
+                  qemuMonitorBlockJobInfoPtr info)
+{
+    qemuDomainDiskPrivatePtr diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
+
+    switch ((virConnectDomainEventBlockJobStatus) status) {
+    case VIR_DOMAIN_BLOCK_JOB_COMPLETED:
+    case VIR_DOMAIN_BLOCK_JOB_FAILED:
+    case VIR_DOMAIN_BLOCK_JOB_CANCELED:
+        diskPriv->blockJobState = QEMU_BLOCKJOB_STATE_NONE;
+        break;
+
+    case VIR_DOMAIN_BLOCK_JOB_READY:
+        if (info) {
+            diskPriv->blockJobInfo = *info;
+            diskPriv->blockJobState = QEMU_BLOCKJOB_STATE_READY;
+        } else {
+            diskPriv->blockJobState = QEMU_BLOCKJOB_STATE_RUNNING;
+        }
+        break;
+
+    case VIR_DOMAIN_BLOCK_JOB_LAST:
+        break;
+    }
+}
+
+
+/**
+ * qemuBlockJobForget:
+ * @vm: domain
+ *
+ * Forget the tracked state of the block jobs of all disks of @vm, for
+ * example because jobs might have been started behind our back.
+ */
+void
+qemuBlockJobForget(virDomainObjPtr vm)
+{
+    size_t i;
+
+    for (i = 0; i < vm->def->ndisks; i++)
+        QEMU_DOMAIN_DISK_PRIVATE(vm->def->disks[i])->blockJobState =
+            QEMU_BLOCKJOB_STATE_UNKNOWN;
+}
+
+
 /**
  * qemuBlockJobSyncBegin:
  * @disk: domain disk
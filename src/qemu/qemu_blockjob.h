@@ -37,6 +37,12 @@ void qemuBlockJobEventProcess(virQEMUDriverPtr driver,
                               int type,
                               int status);
 
+void qemuBlockJobStarted(virDomainDiskDefPtr disk);
+void qemuBlockJobTrack(virDomainDiskDefPtr disk,
+                       int status,
+                       qemuMonitorBlockJobInfoPtr info);
+void qemuBlockJobForget(virDomainObjPtr vm);
+
 void qemuBlockJobSyncBegin(virDomainDiskDefPtr disk);
 void qemuBlockJobSyncEnd(virQEMUDriverPtr driver,
                          virDomainObjPtr vm,
@@ -43,10 +43,13 @@
 #include "virstring.h"
 #include "qemu_hostdev.h"
 #include "qemu_domain.h"
+#include "virthreadpool.h"
 #define __QEMU_CAPSPRIV_H_ALLOW__
 #include "qemu_capspriv.h"
+#include "stat-time.h"
 
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/wait.h>
@@ -366,6 +369,10 @@ VIR_ENUM_IMPL(virQEMUCaps, QEMU_CAPS_LAST,
               "query-named-block-nodes",
               "cpu-cache",
               "qemu-xhci",
+              "query-cpus-fast", /* 255 */
+              "memory-backend-prealloc-threads",
+              "calc-dirty-rate",
+              "bitmap-persistent",
     );
 
 
@@ -406,6 +413,10 @@ struct _virQEMUCapsHostCPUData {
 struct _virQEMUCaps {
     virObject object;
 
+    /* Outdated, but still handed out by the cache until new
+     * capabilities are probed in the background */
+    bool stale;
+
     bool usedQMP;
 
     char *binary;
@@ -1507,7 +1518,9 @@ struct virQEMUCapsStringFlags virQEMUCapsCommands[] = {
     { "query-qmp-schema", QEMU_CAPS_QUERY_QMP_SCHEMA },
     { "query-cpu-model-expansion", QEMU_CAPS_QUERY_CPU_MODEL_EXPANSION},
     { "query-cpu-definitions", QEMU_CAPS_QUERY_CPU_DEFINITIONS},
-    { "query-named-block-nodes", QEMU_CAPS_QUERY_NAMED_BLOCK_NODES}
+    { "query-named-block-nodes", QEMU_CAPS_QUERY_NAMED_BLOCK_NODES},
+    { "query-cpus-fast", QEMU_CAPS_QUERY_CPUS_FAST },
+    { "calc-dirty-rate", QEMU_CAPS_CALC_DIRTY_RATE },
 };
 
 struct virQEMUCapsStringFlags virQEMUCapsMigration[] = {
@@ -1724,6 +1737,8 @@ static struct virQEMUCapsStringFlags virQEMUCapsObjectPropsUSBNECXHCI[] = {
 static struct virQEMUCapsStringFlags virQEMUCapsQMPSchemaQueries[] = {
     { "blockdev-add/arg-type/options/+gluster/debug-level", QEMU_CAPS_GLUSTER_DEBUG_LEVEL},
     { "blockdev-add/arg-type/+gluster/debug", QEMU_CAPS_GLUSTER_DEBUG_LEVEL},
+    { "object-add/arg-type/+memory-backend-file/prealloc-threads", QEMU_CAPS_OBJECT_MEMORY_PREALLOC_THREADS},
+    { "block-dirty-bitmap-add/arg-type/persistent", QEMU_CAPS_BITMAP_PERSISTENT},
 };
 
 struct virQEMUCapsObjectTypeProps {
@@ -2180,6 +2195,7 @@ virQEMUCapsPtr virQEMUCapsNewCopy(virQEMUCapsPtr qemuCaps)
     if (!ret)
         return NULL;
 
+    ret->stale = qemuCaps->stale;
     ret->usedQMP = qemuCaps->usedQMP;
 
     if (VIR_STRDUP(ret->binary, qemuCaps->binary) < 0)
@@ -4135,256 +4151,978 @@ virQEMUCapsSaveCache(virQEMUCapsPtr qemuCaps, const char *filename)
     return ret;
 }
 
-static int
-virQEMUCapsRememberCached(virQEMUCapsPtr qemuCaps, const char *cacheDir)
-{
-    char *capsdir = NULL;
-    char *capsfile = NULL;
-    int ret = -1;
-    char *binaryhash = NULL;
-
-    if (virAsprintf(&capsdir, "%s/capabilities", cacheDir) < 0)
-        goto cleanup;
+/*
+ * Binary variant of the capabilities cache. The XML cache is still
+ * written as it is easy to inspect, but virQEMUCapsInitCached tries
+ * the binary one first as decoding it is much cheaper than parsing
+ * the XML.
+ *
+ * The file is mapped into memory and starts with a fixed size header
+ * holding all the timestamps needed to tell whether the cache is
+ * outdated, so a stale file is dropped without decoding the rest of
+ * it. Values are stored in host byte order, the cache is never shared
+ * between hosts and the layout does not have to be stable either as
+ * the cache is discarded whenever libvirtd changes.
+ */
+#define QEMU_CAPS_BINARY_CACHE_MAGIC "LVQEMUCP"
+#define QEMU_CAPS_BINARY_CACHE_VERSION 1
+#define QEMU_CAPS_BINARY_CACHE_NULL_STRING UINT32_MAX
+
+typedef struct _virQEMUCapsBinaryHeader virQEMUCapsBinaryHeader;
+struct _virQEMUCapsBinaryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    int64_t qemuctime;
+    int64_t selfctime;
+    uint64_t selfvers;
+};
 
-    if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256,
-                            qemuCaps->binary,
-                            &binaryhash) < 0)
-        goto cleanup;
+typedef struct _virQEMUCapsBinaryReader virQEMUCapsBinaryReader;
+typedef virQEMUCapsBinaryReader *virQEMUCapsBinaryReaderPtr;
+struct _virQEMUCapsBinaryReader {
+    const char *data;
+    size_t len;
+    size_t pos;
+};
 
-    if (virAsprintf(&capsfile, "%s/%s.xml", capsdir, binaryhash) < 0)
-        goto cleanup;
 
-    if (virFileMakePath(capsdir) < 0) {
-        virReportSystemError(errno,
-                             _("Unable to create directory '%s'"),
-                             capsdir);
-        goto cleanup;
-    }
+static void
+virQEMUCapsBinaryWriteU32(virBufferPtr buf, uint32_t val)
+{
+    virBufferAdd(buf, (const char *) &val, sizeof(val));
+}
 
-    if (virQEMUCapsSaveCache(qemuCaps, capsfile) < 0)
-        goto cleanup;
 
-    ret = 0;
- cleanup:
-    VIR_FREE(binaryhash);
-    VIR_FREE(capsfile);
-    VIR_FREE(capsdir);
-    return ret;
+static void
+virQEMUCapsBinaryWriteI64(virBufferPtr buf, int64_t val)
+{
+    virBufferAdd(buf, (const char *) &val, sizeof(val));
 }
 
 
 static void
-virQEMUCapsReset(virQEMUCapsPtr qemuCaps)
+virQEMUCapsBinaryWriteBool(virBufferPtr buf, bool val)
 {
-    size_t i;
+    uint8_t byte = val;
 
-    virBitmapClearAll(qemuCaps->flags);
-    qemuCaps->version = qemuCaps->kvmVersion = 0;
-    VIR_FREE(qemuCaps->package);
-    qemuCaps->arch = VIR_ARCH_NONE;
-    qemuCaps->usedQMP = false;
+    virBufferAdd(buf, (const char *) &byte, sizeof(byte));
+}
 
-    virObjectUnref(qemuCaps->kvmCPUModels);
-    qemuCaps->kvmCPUModels = NULL;
-    virObjectUnref(qemuCaps->tcgCPUModels);
-    qemuCaps->tcgCPUModels = NULL;
 
-    for (i = 0; i < qemuCaps->nmachineTypes; i++) {
-        VIR_FREE(qemuCaps->machineTypes[i].name);
-        VIR_FREE(qemuCaps->machineTypes[i].alias);
+static void
+virQEMUCapsBinaryWriteString(virBufferPtr buf, const char *str)
+{
+    if (!str) {
+        virQEMUCapsBinaryWriteU32(buf, QEMU_CAPS_BINARY_CACHE_NULL_STRING);
+        return;
     }
-    VIR_FREE(qemuCaps->machineTypes);
-    qemuCaps->nmachineTypes = 0;
 
-    VIR_FREE(qemuCaps->gicCapabilities);
-    qemuCaps->ngicCapabilities = 0;
-
-    virQEMUCapsHostCPUDataClear(&qemuCaps->kvmCPU);
-    virQEMUCapsHostCPUDataClear(&qemuCaps->tcgCPU);
+    virQEMUCapsBinaryWriteU32(buf, strlen(str));
+    virBufferAdd(buf, str, strlen(str));
 }
 
 
 static int
-virQEMUCapsInitCached(virCapsPtr caps,
-                      virQEMUCapsPtr qemuCaps,
-                      const char *cacheDir,
-                      uid_t runUid,
-                      gid_t runGid)
+virQEMUCapsBinaryRead(virQEMUCapsBinaryReaderPtr rd,
+                      void *val,
+                      size_t size)
 {
-    char *capsdir = NULL;
-    char *capsfile = NULL;
-    int ret = -1;
-    char *binaryhash = NULL;
-    struct stat sb;
-    time_t qemuctime = qemuCaps->ctime;
-    time_t selfctime;
-    unsigned long selfvers;
+    if (size > rd->len - rd->pos) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("truncated binary QEMU capabilities cache"));
+        return -1;
+    }
 
-    if (virAsprintf(&capsdir, "%s/capabilities", cacheDir) < 0)
-        goto cleanup;
+    memcpy(val, rd->data + rd->pos, size);
+    rd->pos += size;
+    return 0;
+}
 
-    if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256,
-                            qemuCaps->binary,
-                            &binaryhash) < 0)
-        goto cleanup;
 
-    if (virAsprintf(&capsfile, "%s/%s.xml", capsdir, binaryhash) < 0)
-        goto cleanup;
+static int
+virQEMUCapsBinaryReadU32(virQEMUCapsBinaryReaderPtr rd, uint32_t *val)
+{
+    return virQEMUCapsBinaryRead(rd, val, sizeof(*val));
+}
 
-    if (virFileMakePath(capsdir) < 0) {
-        virReportSystemError(errno,
-                             _("Unable to create directory '%s'"),
-                             capsdir);
-        goto cleanup;
-    }
 
-    if (stat(capsfile, &sb) < 0) {
-        if (errno == ENOENT) {
-            VIR_DEBUG("No cached capabilities '%s' for '%s'",
-                      capsfile, qemuCaps->binary);
-            ret = 0;
-            goto cleanup;
-        }
-        virReportSystemError(errno,
-                             _("Unable to access cache '%s' for '%s'"),
-                             capsfile, qemuCaps->binary);
-        goto cleanup;
-    }
+static int
+virQEMUCapsBinaryReadUInt(virQEMUCapsBinaryReaderPtr rd, unsigned int *val)
+{
+    uint32_t tmp;
 
-    if (virQEMUCapsLoadCache(caps, qemuCaps, capsfile,
-                             &selfctime, &selfvers) < 0) {
-        VIR_WARN("Failed to load cached caps from '%s' for '%s': %s",
-                 capsfile, qemuCaps->binary, virGetLastErrorMessage());
-        virResetLastError();
-        goto discard;
-    }
+    if (virQEMUCapsBinaryReadU32(rd, &tmp) < 0)
+        return -1;
 
-    if (!virQEMUCapsIsValid(qemuCaps, qemuctime, runUid, runGid))
-        goto discard;
+    *val = tmp;
+    return 0;
+}
 
-    /* Discard cache if QEMU binary or libvirtd changed */
-    if (selfctime != virGetSelfLastChanged() ||
-        selfvers != LIBVIR_VERSION_NUMBER) {
-        VIR_DEBUG("Outdated capabilities for '%s': libvirt changed "
-                  "(%lld vs %lld, %lu vs %lu)",
-                  qemuCaps->binary,
-                  (long long)selfctime, (long long)virGetSelfLastChanged(),
-                  selfvers, (unsigned long)LIBVIR_VERSION_NUMBER);
-        goto discard;
-    }
 
-    VIR_DEBUG("Loaded '%s' for '%s' ctime %lld usedQMP=%d",
-              capsfile, qemuCaps->binary,
-              (long long)qemuCaps->ctime, qemuCaps->usedQMP);
+static int
+virQEMUCapsBinaryReadBool(virQEMUCapsBinaryReaderPtr rd, bool *val)
+{
+    uint8_t byte;
 
-    ret = 1;
- cleanup:
-    qemuCaps->ctime = qemuctime;
-    VIR_FREE(binaryhash);
-    VIR_FREE(capsfile);
-    VIR_FREE(capsdir);
-    return ret;
+    if (virQEMUCapsBinaryRead(rd, &byte, sizeof(byte)) < 0)
+        return -1;
 
- discard:
-    VIR_DEBUG("Dropping cached capabilities '%s' for '%s'",
-              capsfile, qemuCaps->binary);
-    ignore_value(unlink(capsfile));
-    virQEMUCapsReset(qemuCaps);
-    ret = 0;
-    goto cleanup;
+    *val = !!byte;
+    return 0;
 }
 
 
-#define QEMU_SYSTEM_PREFIX "qemu-system-"
-
 static int
-virQEMUCapsInitHelp(virQEMUCapsPtr qemuCaps, uid_t runUid, gid_t runGid, const char *qmperr)
+virQEMUCapsBinaryReadString(virQEMUCapsBinaryReaderPtr rd, char **str)
 {
-    virCommandPtr cmd = NULL;
-    bool is_kvm;
-    char *help = NULL;
-    int ret = -1;
-    const char *tmp;
+    uint32_t len;
 
-    VIR_DEBUG("qemuCaps=%p", qemuCaps);
+    *str = NULL;
 
-    tmp = strstr(qemuCaps->binary, QEMU_SYSTEM_PREFIX);
-    if (tmp) {
-        tmp += strlen(QEMU_SYSTEM_PREFIX);
+    if (virQEMUCapsBinaryReadU32(rd, &len) < 0)
+        return -1;
 
-        qemuCaps->arch = virQEMUCapsArchFromString(tmp);
-    } else {
-        qemuCaps->arch = virArchFromHost();
+    if (len == QEMU_CAPS_BINARY_CACHE_NULL_STRING)
+        return 0;
+
+    if (len > rd->len - rd->pos) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("truncated binary QEMU capabilities cache"));
+        return -1;
     }
 
-    cmd = virQEMUCapsProbeCommand(qemuCaps->binary, NULL, runUid, runGid);
-    virCommandAddArgList(cmd, "-help", NULL);
-    virCommandSetOutputBuffer(cmd, &help);
+    if (VIR_STRNDUP(*str, rd->data + rd->pos, len) < 0)
+        return -1;
 
-    if (virCommandRun(cmd, NULL) < 0)
-        goto cleanup;
+    rd->pos += len;
+    return 0;
+}
 
-    if (virQEMUCapsParseHelpStr(qemuCaps->binary,
-                                help, qemuCaps,
-                                &qemuCaps->version,
-                                &is_kvm,
-                                &qemuCaps->kvmVersion,
-                                false,
-                                qmperr) < 0)
-        goto cleanup;
 
-    /* Older QEMU versions reported -no-acpi in the output of -help even
-     * though it was not supported by the architecture. The issue has since
-     * been fixed, but to maintain compatibility with all release we still
-     * need to filter out the capability for architectures that we know
-     * don't support the feature, eg. anything but x86 and aarch64 */
-    if (!ARCH_IS_X86(qemuCaps->arch) &&
-        qemuCaps->arch != VIR_ARCH_AARCH64) {
-        virQEMUCapsClear(qemuCaps, QEMU_CAPS_NO_ACPI);
-    }
+static void
+virQEMUCapsFormatBinaryHostCPUModelInfo(virQEMUCapsPtr qemuCaps,
+                                        virBufferPtr buf,
+                                        virDomainVirtType type)
+{
+    virQEMUCapsHostCPUDataPtr cpuData = virQEMUCapsGetHostCPUData(qemuCaps, type);
+    qemuMonitorCPUModelInfoPtr model = cpuData->info;
+    size_t i;
 
-    /* virQEMUCapsExtractDeviceStr will only set additional caps if qemu
-     * understands the 0.13.0+ notion of "-device driver,".  */
-    if (strstr(help, "-device driver,?") &&
-        virQEMUCapsExtractDeviceStr(qemuCaps->binary,
-                                    qemuCaps, runUid, runGid) < 0) {
-        goto cleanup;
-    }
+    virQEMUCapsBinaryWriteBool(buf, !!model);
+    if (!model)
+        return;
 
-    if (virQEMUCapsProbeCPUModels(qemuCaps, runUid, runGid) < 0)
-        goto cleanup;
+    virQEMUCapsBinaryWriteString(buf, model->name);
+    virQEMUCapsBinaryWriteBool(buf, model->migratability);
+    virQEMUCapsBinaryWriteU32(buf, model->nprops);
 
-    if (virQEMUCapsProbeMachineTypes(qemuCaps, runUid, runGid) < 0)
-        goto cleanup;
+    for (i = 0; i < model->nprops; i++) {
+        qemuMonitorCPUPropertyPtr prop = model->props + i;
 
-    ret = 0;
- cleanup:
-    virCommandFree(cmd);
-    VIR_FREE(help);
-    return ret;
-}
+        virQEMUCapsBinaryWriteString(buf, prop->name);
+        virQEMUCapsBinaryWriteU32(buf, prop->type);
 
+        switch (prop->type) {
+        case QEMU_MONITOR_CPU_PROPERTY_BOOLEAN:
+            virQEMUCapsBinaryWriteBool(buf, prop->value.boolean);
+            break;
 
-static void virQEMUCapsMonitorNotify(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
-                                     virDomainObjPtr vm ATTRIBUTE_UNUSED,
-                                     void *opaque ATTRIBUTE_UNUSED)
-{
-}
+        case QEMU_MONITOR_CPU_PROPERTY_STRING:
+            virQEMUCapsBinaryWriteString(buf, prop->value.string);
+            break;
 
-static qemuMonitorCallbacks callbacks = {
-    .eofNotify = virQEMUCapsMonitorNotify,
-    .errorNotify = virQEMUCapsMonitorNotify,
-};
+        case QEMU_MONITOR_CPU_PROPERTY_NUMBER:
+            virQEMUCapsBinaryWriteI64(buf, prop->value.number);
+            break;
+
+        case QEMU_MONITOR_CPU_PROPERTY_LAST:
+            break;
+        }
+
+        virQEMUCapsBinaryWriteU32(buf, prop->migratable);
+    }
+}
 
 
-/* Capabilities that we assume are always enabled
- * for QEMU >= 1.2.0
- */
 static void
-virQEMUCapsInitQMPBasic(virQEMUCapsPtr qemuCaps)
+virQEMUCapsFormatBinaryCPUModels(virQEMUCapsPtr qemuCaps,
+                                 virBufferPtr buf,
+                                 virDomainVirtType type)
 {
-    virQEMUCapsSet(qemuCaps, QEMU_CAPS_MEM_PATH);
-    virQEMUCapsSet(qemuCaps, QEMU_CAPS_DRIVE_SERIAL);
+    virDomainCapsCPUModelsPtr cpus;
+    size_t i;
+
+    if (type == VIR_DOMAIN_VIRT_KVM)
+        cpus = qemuCaps->kvmCPUModels;
+    else
+        cpus = qemuCaps->tcgCPUModels;
+
+    virQEMUCapsBinaryWriteU32(buf, cpus ? cpus->nmodels : 0);
+    if (!cpus)
+        return;
+
+    for (i = 0; i < cpus->nmodels; i++) {
+        virQEMUCapsBinaryWriteString(buf, cpus->models[i].name);
+        virQEMUCapsBinaryWriteU32(buf, cpus->models[i].usable);
+    }
+}
+
+
+static char *
+virQEMUCapsFormatBinaryCache(virQEMUCapsPtr qemuCaps,
+                             time_t selfCTime,
+                             unsigned long selfVersion,
+                             size_t *len)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virQEMUCapsBinaryHeader header;
+    size_t i;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, QEMU_CAPS_BINARY_CACHE_MAGIC, sizeof(header.magic));
+    header.version = QEMU_CAPS_BINARY_CACHE_VERSION;
+    header.headerSize = sizeof(header);
+    header.qemuctime = qemuCaps->ctime;
+    header.selfctime = selfCTime;
+    header.selfvers = selfVersion;
+    virBufferAdd(&buf, (const char *) &header, sizeof(header));
+
+    virQEMUCapsBinaryWriteBool(&buf, qemuCaps->usedQMP);
+
+    virQEMUCapsBinaryWriteU32(&buf, virBitmapCountBits(qemuCaps->flags));
+    for (i = 0; i < QEMU_CAPS_LAST; i++) {
+        if (virQEMUCapsGet(qemuCaps, i))
+            virQEMUCapsBinaryWriteU32(&buf, i);
+    }
+
+    virQEMUCapsBinaryWriteU32(&buf, qemuCaps->version);
+    virQEMUCapsBinaryWriteU32(&buf, qemuCaps->kvmVersion);
+    virQEMUCapsBinaryWriteString(&buf, qemuCaps->package);
+    virQEMUCapsBinaryWriteU32(&buf, qemuCaps->arch);
+
+    virQEMUCapsFormatBinaryHostCPUModelInfo(qemuCaps, &buf, VIR_DOMAIN_VIRT_KVM);
+    virQEMUCapsFormatBinaryHostCPUModelInfo(qemuCaps, &buf, VIR_DOMAIN_VIRT_QEMU);
+
+    virQEMUCapsFormatBinaryCPUModels(qemuCaps, &buf, VIR_DOMAIN_VIRT_KVM);
+    virQEMUCapsFormatBinaryCPUModels(qemuCaps, &buf, VIR_DOMAIN_VIRT_QEMU);
+
+    virQEMUCapsBinaryWriteU32(&buf, qemuCaps->nmachineTypes);
+    for (i = 0; i < qemuCaps->nmachineTypes; i++) {
+        virQEMUCapsBinaryWriteString(&buf, qemuCaps->machineTypes[i].name);
+        virQEMUCapsBinaryWriteString(&buf, qemuCaps->machineTypes[i].alias);
+        virQEMUCapsBinaryWriteU32(&buf, qemuCaps->machineTypes[i].maxCpus);
+        virQEMUCapsBinaryWriteBool(&buf, qemuCaps->machineTypes[i].hotplugCpus);
+    }
+
+    virQEMUCapsBinaryWriteU32(&buf, qemuCaps->ngicCapabilities);
+    for (i = 0; i < qemuCaps->ngicCapabilities; i++) {
+        virQEMUCapsBinaryWriteU32(&buf, qemuCaps->gicCapabilities[i].version);
+        virQEMUCapsBinaryWriteU32(&buf,
+                                  qemuCaps->gicCapabilities[i].implementation);
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    *len = virBufferUse(&buf);
+    return virBufferContentAndReset(&buf);
+}
+
+
+struct virQEMUCapsBinaryCacheData {
+    const char *data;
+    size_t len;
+};
+
+
+static int
+virQEMUCapsWriteBinaryCache(int fd, const void *opaque)
+{
+    const struct virQEMUCapsBinaryCacheData *data = opaque;
+
+    if (safewrite(fd, data->data, data->len) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+int
+virQEMUCapsSaveBinaryCache(virQEMUCapsPtr qemuCaps,
+                           const char *filename,
+                           time_t selfCTime,
+                           unsigned long selfVersion)
+{
+    struct virQEMUCapsBinaryCacheData data = { NULL, 0 };
+    char *content = NULL;
+    int ret = -1;
+
+    if (!(content = virQEMUCapsFormatBinaryCache(qemuCaps, selfCTime,
+                                                 selfVersion, &data.len)))
+        goto cleanup;
+    data.data = content;
+
+    /* Written to a temporary file first so that nobody ever maps
+     * a partially written cache */
+    if (virFileRewrite(filename, S_IRUSR | S_IWUSR,
+                       virQEMUCapsWriteBinaryCache, &data) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Saved binary caps '%s' for '%s' with (%lld, %lld)",
+              filename, NULLSTR(qemuCaps->binary),
+              (long long)qemuCaps->ctime, (long long)selfCTime);
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(content);
+    return ret;
+}
+
+
+static int
+virQEMUCapsLoadBinaryHostCPUModelInfo(virQEMUCapsPtr qemuCaps,
+                                      virQEMUCapsBinaryReaderPtr rd,
+                                      virDomainVirtType virtType)
+{
+    qemuMonitorCPUModelInfoPtr hostCPU = NULL;
+    bool present;
+    uint32_t n;
+    unsigned int val;
+    int ret = -1;
+    size_t i;
+
+    if (virQEMUCapsBinaryReadBool(rd, &present) < 0)
+        return -1;
+
+    if (!present)
+        return 0;
+
+    if (VIR_ALLOC(hostCPU) < 0)
+        goto cleanup;
+
+    if (virQEMUCapsBinaryReadString(rd, &hostCPU->name) < 0 ||
+        virQEMUCapsBinaryReadBool(rd, &hostCPU->migratability) < 0 ||
+        virQEMUCapsBinaryReadU32(rd, &n) < 0)
+        goto cleanup;
+
+    if (!hostCPU->name) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("missing host CPU model name in QEMU "
+                         "capabilities cache"));
+        goto cleanup;
+    }
+
+    if (n > 0) {
+        if (VIR_ALLOC_N(hostCPU->props, n) < 0)
+            goto cleanup;
+        hostCPU->nprops = n;
+    }
+
+    for (i = 0; i < hostCPU->nprops; i++) {
+        qemuMonitorCPUPropertyPtr prop = hostCPU->props + i;
+        int64_t number;
+
+        if (virQEMUCapsBinaryReadString(rd, &prop->name) < 0 ||
+            virQEMUCapsBinaryReadUInt(rd, &val) < 0)
+            goto cleanup;
+
+        if (!prop->name || val >= QEMU_MONITOR_CPU_PROPERTY_LAST) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed host CPU model property "
+                             "in QEMU capabilities cache"));
+            goto cleanup;
+        }
+        prop->type = val;
+
+        switch (prop->type) {
+        case QEMU_MONITOR_CPU_PROPERTY_BOOLEAN:
+            if (virQEMUCapsBinaryReadBool(rd, &prop->value.boolean) < 0)
+                goto cleanup;
+            break;
+
+        case QEMU_MONITOR_CPU_PROPERTY_STRING:
+            if (virQEMUCapsBinaryReadString(rd, &prop->value.string) < 0)
+                goto cleanup;
+            if (!prop->value.string) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("invalid string value for '%s' host CPU "
+                                 "model property in QEMU capabilities cache"),
+                               prop->name);
+                goto cleanup;
+            }
+            break;
+
+        case QEMU_MONITOR_CPU_PROPERTY_NUMBER:
+            if (virQEMUCapsBinaryRead(rd, &number, sizeof(number)) < 0)
+                goto cleanup;
+            prop->value.number = number;
+            break;
+
+        case QEMU_MONITOR_CPU_PROPERTY_LAST:
+            break;
+        }
+
+        if (virQEMUCapsBinaryReadUInt(rd, &val) < 0)
+            goto cleanup;
+        if (val >= VIR_TRISTATE_BOOL_LAST) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("invalid migratable value for '%s' host CPU "
+                             "model property in QEMU capabilities cache"),
+                           prop->name);
+            goto cleanup;
+        }
+        prop->migratable = val;
+    }
+
+    virQEMUCapsSetCPUModelInfo(qemuCaps, virtType, hostCPU);
+    hostCPU = NULL;
+    ret = 0;
+
+ cleanup:
+    qemuMonitorCPUModelInfoFree(hostCPU);
+    return ret;
+}
+
+
+static int
+virQEMUCapsLoadBinaryCPUModels(virQEMUCapsPtr qemuCaps,
+                               virQEMUCapsBinaryReaderPtr rd,
+                               virDomainVirtType type)
+{
+    virDomainCapsCPUModelsPtr cpus = NULL;
+    char *name = NULL;
+    unsigned int usable;
+    uint32_t n;
+    size_t i;
+    int ret = -1;
+
+    if (virQEMUCapsBinaryReadU32(rd, &n) < 0)
+        return -1;
+
+    if (n == 0)
+        return 0;
+
+    if (!(cpus = virDomainCapsCPUModelsNew(n)))
+        return -1;
+
+    if (type == VIR_DOMAIN_VIRT_KVM)
+        qemuCaps->kvmCPUModels = cpus;
+    else
+        qemuCaps->tcgCPUModels = cpus;
+
+    for (i = 0; i < n; i++) {
+        if (virQEMUCapsBinaryReadString(rd, &name) < 0 ||
+            virQEMUCapsBinaryReadUInt(rd, &usable) < 0)
+            goto cleanup;
+
+        if (!name || usable >= VIR_DOMCAPS_CPU_USABLE_LAST) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed cpu model in QEMU capabilities cache"));
+            goto cleanup;
+        }
+
+        if (virDomainCapsCPUModelsAddSteal(cpus, &name, usable) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(name);
+    return ret;
+}
+
+
+static int
+virQEMUCapsLoadBinaryCacheData(virCapsPtr caps,
+                               virQEMUCapsPtr qemuCaps,
+                               virQEMUCapsBinaryReaderPtr rd)
+{
+    unsigned int val;
+    uint32_t n;
+    size_t i;
+
+    if (virQEMUCapsBinaryReadBool(rd, &qemuCaps->usedQMP) < 0 ||
+        virQEMUCapsBinaryReadU32(rd, &n) < 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        if (virQEMUCapsBinaryReadUInt(rd, &val) < 0)
+            return -1;
+        if (val >= QEMU_CAPS_LAST) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unknown qemu capabilities flag %u"), val);
+            return -1;
+        }
+        virQEMUCapsSet(qemuCaps, val);
+    }
+
+    if (virQEMUCapsBinaryReadUInt(rd, &qemuCaps->version) < 0 ||
+        virQEMUCapsBinaryReadUInt(rd, &qemuCaps->kvmVersion) < 0 ||
+        virQEMUCapsBinaryReadString(rd, &qemuCaps->package) < 0 ||
+        virQEMUCapsBinaryReadUInt(rd, &val) < 0)
+        return -1;
+
+    if (val == VIR_ARCH_NONE || val >= VIR_ARCH_LAST) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unknown arch %u in QEMU capabilities cache"), val);
+        return -1;
+    }
+    qemuCaps->arch = val;
+
+    if (virQEMUCapsLoadBinaryHostCPUModelInfo(qemuCaps, rd, VIR_DOMAIN_VIRT_KVM) < 0 ||
+        virQEMUCapsLoadBinaryHostCPUModelInfo(qemuCaps, rd, VIR_DOMAIN_VIRT_QEMU) < 0)
+        return -1;
+
+    if (virQEMUCapsLoadBinaryCPUModels(qemuCaps, rd, VIR_DOMAIN_VIRT_KVM) < 0 ||
+        virQEMUCapsLoadBinaryCPUModels(qemuCaps, rd, VIR_DOMAIN_VIRT_QEMU) < 0)
+        return -1;
+
+    if (virQEMUCapsBinaryReadU32(rd, &n) < 0)
+        return -1;
+    if (n > 0) {
+        if (VIR_ALLOC_N(qemuCaps->machineTypes, n) < 0)
+            return -1;
+        qemuCaps->nmachineTypes = n;
+    }
+
+    for (i = 0; i < qemuCaps->nmachineTypes; i++) {
+        struct virQEMUCapsMachineType *machine = qemuCaps->machineTypes + i;
+
+        if (virQEMUCapsBinaryReadString(rd, &machine->name) < 0 ||
+            virQEMUCapsBinaryReadString(rd, &machine->alias) < 0 ||
+            virQEMUCapsBinaryReadUInt(rd, &machine->maxCpus) < 0 ||
+            virQEMUCapsBinaryReadBool(rd, &machine->hotplugCpus) < 0)
+            return -1;
+
+        if (!machine->name) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("missing machine name in QEMU capabilities cache"));
+            return -1;
+        }
+    }
+
+    if (virQEMUCapsBinaryReadU32(rd, &n) < 0)
+        return -1;
+    if (n > 0) {
+        if (VIR_ALLOC_N(qemuCaps->gicCapabilities, n) < 0)
+            return -1;
+        qemuCaps->ngicCapabilities = n;
+    }
+
+    for (i = 0; i < qemuCaps->ngicCapabilities; i++) {
+        virGICCapabilityPtr cap = &qemuCaps->gicCapabilities[i];
+
+        if (virQEMUCapsBinaryReadUInt(rd, &val) < 0)
+            return -1;
+        cap->version = val;
+
+        if (virQEMUCapsBinaryReadUInt(rd, &val) < 0)
+            return -1;
+        cap->implementation = val;
+    }
+
+    if (rd->pos != rd->len) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("trailing data in binary QEMU capabilities cache"));
+        return -1;
+    }
+
+    virQEMUCapsInitHostCPUModel(qemuCaps, caps, VIR_DOMAIN_VIRT_KVM);
+    virQEMUCapsInitHostCPUModel(qemuCaps, caps, VIR_DOMAIN_VIRT_QEMU);
+
+    return 0;
+}
+
+
+/*
+ * Load the binary capabilities cache from @filename into @qemuCaps
+ * unless it was written for a different QEMU binary ctime (taken from
+ * @qemuCaps), libvirtd ctime or libvirt version.
+ *
+ * Returns 1 if the cache was loaded, 0 if it does not exist or is
+ * outdated and -1 on error. @qemuCaps is only partially filled in
+ * on error.
+ */
+int
+virQEMUCapsLoadBinaryCache(virCapsPtr caps,
+                           virQEMUCapsPtr qemuCaps,
+                           const char *filename,
+                           time_t selfCTime,
+                           unsigned long selfVersion)
+{
+    virQEMUCapsBinaryReader rd = { NULL, 0, 0 };
+    virQEMUCapsBinaryHeader header;
+    void *map = MAP_FAILED;
+    struct stat sb;
+    int fd = -1;
+    int ret = -1;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        if (errno == ENOENT) {
+            VIR_DEBUG("No binary cached capabilities '%s'", filename);
+            return 0;
+        }
+        virReportSystemError(errno, _("Unable to open '%s'"), filename);
+        return -1;
+    }
+
+    if (fstat(fd, &sb) < 0) {
+        virReportSystemError(errno, _("Unable to stat '%s'"), filename);
+        goto cleanup;
+    }
+
+    if (sb.st_size < (off_t) sizeof(header)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("binary QEMU capabilities cache '%s' is truncated"),
+                       filename);
+        goto cleanup;
+    }
+
+    if ((map = mmap(NULL, sb.st_size, PROT_READ,
+                    MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        virReportSystemError(errno, _("Unable to map '%s'"), filename);
+        goto cleanup;
+    }
+
+    rd.data = map;
+    rd.len = sb.st_size;
+
+    ignore_value(virQEMUCapsBinaryRead(&rd, &header, sizeof(header)));
+
+    if (memcmp(header.magic, QEMU_CAPS_BINARY_CACHE_MAGIC,
+               sizeof(header.magic)) != 0 ||
+        header.version != QEMU_CAPS_BINARY_CACHE_VERSION ||
+        header.headerSize != sizeof(header)) {
+        VIR_DEBUG("Unsupported binary cache format in '%s'", filename);
+        ret = 0;
+        goto cleanup;
+    }
+
+    /* Only the header has been looked at so far, which is all we
+     * need to throw the cache away if it is outdated */
+    if (header.qemuctime != qemuCaps->ctime ||
+        header.selfctime != selfCTime ||
+        header.selfvers != selfVersion) {
+        VIR_DEBUG("Outdated binary capabilities '%s' "
+                  "(%lld vs %lld, %lld vs %lld, %llu vs %lu)",
+                  filename,
+                  (long long)header.qemuctime, (long long)qemuCaps->ctime,
+                  (long long)header.selfctime, (long long)selfCTime,
+                  (unsigned long long)header.selfvers, selfVersion);
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virQEMUCapsLoadBinaryCacheData(caps, qemuCaps, &rd) < 0)
+        goto cleanup;
+
+    ret = 1;
+
+ cleanup:
+    if (map != MAP_FAILED)
+        munmap(map, sb.st_size);
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+
+static int
+virQEMUCapsRememberCached(virQEMUCapsPtr qemuCaps, const char *cacheDir)
+{
+    char *capsdir = NULL;
+    char *capsfile = NULL;
+    char *binfile = NULL;
+    int ret = -1;
+    char *binaryhash = NULL;
+
+    if (virAsprintf(&capsdir, "%s/capabilities", cacheDir) < 0)
+        goto cleanup;
+
+    if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256,
+                            qemuCaps->binary,
+                            &binaryhash) < 0)
+        goto cleanup;
+
+    if (virAsprintf(&capsfile, "%s/%s.xml", capsdir, binaryhash) < 0 ||
+        virAsprintf(&binfile, "%s/%s.bin", capsdir, binaryhash) < 0)
+        goto cleanup;
+
+    if (virFileMakePath(capsdir) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to create directory '%s'"),
+                             capsdir);
+        goto cleanup;
+    }
+
+    if (virQEMUCapsSaveCache(qemuCaps, capsfile) < 0)
+        goto cleanup;
+
+    /* The XML cache is enough to avoid probing QEMU again */
+    if (virQEMUCapsSaveBinaryCache(qemuCaps, binfile,
+                                   virGetSelfLastChanged(),
+                                   LIBVIR_VERSION_NUMBER) < 0) {
+        VIR_WARN("Failed to save binary caps '%s' for '%s': %s",
+                 binfile, qemuCaps->binary, virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(binaryhash);
+    VIR_FREE(binfile);
+    VIR_FREE(capsfile);
+    VIR_FREE(capsdir);
+    return ret;
+}
+
+
+static void
+virQEMUCapsReset(virQEMUCapsPtr qemuCaps)
+{
+    size_t i;
+
+    virBitmapClearAll(qemuCaps->flags);
+    qemuCaps->version = qemuCaps->kvmVersion = 0;
+    VIR_FREE(qemuCaps->package);
+    qemuCaps->arch = VIR_ARCH_NONE;
+    qemuCaps->usedQMP = false;
+
+    virObjectUnref(qemuCaps->kvmCPUModels);
+    qemuCaps->kvmCPUModels = NULL;
+    virObjectUnref(qemuCaps->tcgCPUModels);
+    qemuCaps->tcgCPUModels = NULL;
+
+    for (i = 0; i < qemuCaps->nmachineTypes; i++) {
+        VIR_FREE(qemuCaps->machineTypes[i].name);
+        VIR_FREE(qemuCaps->machineTypes[i].alias);
+    }
+    VIR_FREE(qemuCaps->machineTypes);
+    qemuCaps->nmachineTypes = 0;
+
+    VIR_FREE(qemuCaps->gicCapabilities);
+    qemuCaps->ngicCapabilities = 0;
+
+    virQEMUCapsHostCPUDataClear(&qemuCaps->kvmCPU);
+    virQEMUCapsHostCPUDataClear(&qemuCaps->tcgCPU);
+}
+
+
+static int
+virQEMUCapsInitCached(virCapsPtr caps,
+                      virQEMUCapsPtr qemuCaps,
+                      const char *cacheDir,
+                      uid_t runUid,
+                      gid_t runGid)
+{
+    char *capsdir = NULL;
+    char *capsfile = NULL;
+    char *binfile = NULL;
+    int ret = -1;
+    char *binaryhash = NULL;
+    struct stat sb;
+    time_t qemuctime = qemuCaps->ctime;
+    time_t selfctime;
+    unsigned long selfvers;
+    int rc;
+
+    if (virAsprintf(&capsdir, "%s/capabilities", cacheDir) < 0)
+        goto cleanup;
+
+    if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256,
+                            qemuCaps->binary,
+                            &binaryhash) < 0)
+        goto cleanup;
+
+    if (virAsprintf(&capsfile, "%s/%s.xml", capsdir, binaryhash) < 0 ||
+        virAsprintf(&binfile, "%s/%s.bin", capsdir, binaryhash) < 0)
+        goto cleanup;
+
+    if (virFileMakePath(capsdir) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to create directory '%s'"),
+                             capsdir);
+        goto cleanup;
+    }
+
+    if ((rc = virQEMUCapsLoadBinaryCache(caps, qemuCaps, binfile,
+                                         virGetSelfLastChanged(),
+                                         LIBVIR_VERSION_NUMBER)) > 0) {
+        if (!virQEMUCapsIsValid(qemuCaps, qemuctime, runUid, runGid))
+            goto discard;
+
+        VIR_DEBUG("Loaded '%s' for '%s' ctime %lld usedQMP=%d",
+                  binfile, qemuCaps->binary,
+                  (long long)qemuCaps->ctime, qemuCaps->usedQMP);
+        ret = 1;
+        goto cleanup;
+    }
+
+    if (rc < 0) {
+        VIR_WARN("Failed to load binary cached caps from '%s' for '%s': %s",
+                 binfile, qemuCaps->binary, virGetLastErrorMessage());
+        virResetLastError();
+        virQEMUCapsReset(qemuCaps);
+    }
+
+    if (stat(capsfile, &sb) < 0) {
+        if (errno == ENOENT) {
+            VIR_DEBUG("No cached capabilities '%s' for '%s'",
+                      capsfile, qemuCaps->binary);
+            ret = 0;
+            goto cleanup;
+        }
+        virReportSystemError(errno,
+                             _("Unable to access cache '%s' for '%s'"),
+                             capsfile, qemuCaps->binary);
+        goto cleanup;
+    }
+
+    if (virQEMUCapsLoadCache(caps, qemuCaps, capsfile,
+                             &selfctime, &selfvers) < 0) {
+        VIR_WARN("Failed to load cached caps from '%s' for '%s': %s",
+                 capsfile, qemuCaps->binary, virGetLastErrorMessage());
+        virResetLastError();
+        goto discard;
+    }
+
+    if (!virQEMUCapsIsValid(qemuCaps, qemuctime, runUid, runGid))
+        goto discard;
+
+    /* Discard cache if QEMU binary or libvirtd changed */
+    if (selfctime != virGetSelfLastChanged() ||
+        selfvers != LIBVIR_VERSION_NUMBER) {
+        VIR_DEBUG("Outdated capabilities for '%s': libvirt changed "
+                  "(%lld vs %lld, %lu vs %lu)",
+                  qemuCaps->binary,
+                  (long long)selfctime, (long long)virGetSelfLastChanged(),
+                  selfvers, (unsigned long)LIBVIR_VERSION_NUMBER);
+        goto discard;
+    }
+
+    VIR_DEBUG("Loaded '%s' for '%s' ctime %lld usedQMP=%d",
+              capsfile, qemuCaps->binary,
+              (long long)qemuCaps->ctime, qemuCaps->usedQMP);
+
+    /* Replace the missing or outdated binary cache so that the XML
+     * does not have to be parsed again next time */
+    if (virQEMUCapsSaveBinaryCache(qemuCaps, binfile, selfctime, selfvers) < 0) {
+        VIR_WARN("Failed to save binary caps '%s' for '%s': %s",
+                 binfile, qemuCaps->binary, virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    ret = 1;
+ cleanup:
+    qemuCaps->ctime = qemuctime;
+    VIR_FREE(binaryhash);
+    VIR_FREE(binfile);
+    VIR_FREE(capsfile);
+    VIR_FREE(capsdir);
+    return ret;
+
+ discard:
+    VIR_DEBUG("Dropping cached capabilities '%s' for '%s'",
+              capsfile, qemuCaps->binary);
+    ignore_value(unlink(binfile));
+    ignore_value(unlink(capsfile));
+    virQEMUCapsReset(qemuCaps);
+    ret = 0;
+    goto cleanup;
+}
+
+
+#define QEMU_SYSTEM_PREFIX "qemu-system-"
+
+static int
+virQEMUCapsInitHelp(virQEMUCapsPtr qemuCaps, uid_t runUid, gid_t runGid, const char *qmperr)
+{
+    virCommandPtr cmd = NULL;
+    bool is_kvm;
+    char *help = NULL;
+    int ret = -1;
+    const char *tmp;
+
+    VIR_DEBUG("qemuCaps=%p", qemuCaps);
+
+    tmp = strstr(qemuCaps->binary, QEMU_SYSTEM_PREFIX);
+    if (tmp) {
+        tmp += strlen(QEMU_SYSTEM_PREFIX);
+
+        qemuCaps->arch = virQEMUCapsArchFromString(tmp);
+    } else {
+        qemuCaps->arch = virArchFromHost();
+    }
+
+    cmd = virQEMUCapsProbeCommand(qemuCaps->binary, NULL, runUid, runGid);
+    virCommandAddArgList(cmd, "-help", NULL);
+    virCommandSetOutputBuffer(cmd, &help);
+
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
+
+    if (virQEMUCapsParseHelpStr(qemuCaps->binary,
+                                help, qemuCaps,
+                                &qemuCaps->version,
+                                &is_kvm,
+                                &qemuCaps->kvmVersion,
+                                false,
+                                qmperr) < 0)
+        goto cleanup;
+
+    /* Older QEMU versions reported -no-acpi in the output of -help even
+     * though it was not supported by the architecture. The issue has since
+     * been fixed, but to maintain compatibility with all release we still
+     * need to filter out the capability for architectures that we know
+     * don't support the feature, eg. anything but x86 and aarch64 */
+    if (!ARCH_IS_X86(qemuCaps->arch) &&
+        qemuCaps->arch != VIR_ARCH_AARCH64) {
+        virQEMUCapsClear(qemuCaps, QEMU_CAPS_NO_ACPI);
+    }
+
+    /* virQEMUCapsExtractDeviceStr will only set additional caps if qemu
+     * understands the 0.13.0+ notion of "-device driver,".  */
+    if (strstr(help, "-device driver,?") &&
+        virQEMUCapsExtractDeviceStr(qemuCaps->binary,
+                                    qemuCaps, runUid, runGid) < 0) {
+        goto cleanup;
+    }
+
+    if (virQEMUCapsProbeCPUModels(qemuCaps, runUid, runGid) < 0)
+        goto cleanup;
+
+    if (virQEMUCapsProbeMachineTypes(qemuCaps, runUid, runGid) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virCommandFree(cmd);
+    VIR_FREE(help);
+    return ret;
+}
+
+
+static void virQEMUCapsMonitorNotify(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
+                                     virDomainObjPtr vm ATTRIBUTE_UNUSED,
+                                     void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+static qemuMonitorCallbacks callbacks = {
+    .eofNotify = virQEMUCapsMonitorNotify,
+    .errorNotify = virQEMUCapsMonitorNotify,
+};
+
+
+/* Capabilities that we assume are always enabled
+ * for QEMU >= 1.2.0
+ */
+static void
+virQEMUCapsInitQMPBasic(virQEMUCapsPtr qemuCaps)
+{
+    virQEMUCapsSet(qemuCaps, QEMU_CAPS_MEM_PATH);
+    virQEMUCapsSet(qemuCaps, QEMU_CAPS_DRIVE_SERIAL);
     virQEMUCapsSet(qemuCaps, QEMU_CAPS_CHARDEV);
     virQEMUCapsSet(qemuCaps, QEMU_CAPS_MONITOR_JSON);
     virQEMUCapsSet(qemuCaps, QEMU_CAPS_SDL);
@@ -5287,6 +6025,98 @@ virQEMUCapsFilterByMachineType(virQEMUCapsPtr qemuCaps,
 }
 
 
+/* Upper bound of QEMU binaries probed in parallel in background */
+#define QEMU_CAPS_CACHE_PROBE_WORKERS 4
+
+typedef struct _virQEMUCapsCacheProbe virQEMUCapsCacheProbe;
+typedef virQEMUCapsCacheProbe *virQEMUCapsCacheProbePtr;
+struct _virQEMUCapsCacheProbe {
+    char *binary;
+    virCapsPtr caps;
+};
+
+
+static void
+virQEMUCapsCacheProbeFree(virQEMUCapsCacheProbePtr probe)
+{
+    if (!probe)
+        return;
+
+    VIR_FREE(probe->binary);
+    virObjectUnref(probe->caps);
+    VIR_FREE(probe);
+}
+
+
+static void
+virQEMUCapsCacheProbeHashFree(void *payload,
+                              const void *name ATTRIBUTE_UNUSED)
+{
+    virQEMUCapsCacheProbeFree(payload);
+}
+
+
+typedef struct _virQEMUCapsCacheMachine virQEMUCapsCacheMachine;
+typedef virQEMUCapsCacheMachine *virQEMUCapsCacheMachinePtr;
+struct _virQEMUCapsCacheMachine {
+    virQEMUCapsPtr origin; /* capabilities of the binary they come from */
+    virQEMUCapsPtr qemuCaps; /* filtered by machine type */
+};
+
+
+static void
+virQEMUCapsCacheMachineHashFree(void *payload,
+                                const void *name ATTRIBUTE_UNUSED)
+{
+    virQEMUCapsCacheMachinePtr machine = payload;
+
+    virObjectUnref(machine->origin);
+    virObjectUnref(machine->qemuCaps);
+    VIR_FREE(machine);
+}
+
+
+static void
+virQEMUCapsCacheProbeWorker(void *jobdata,
+                            void *opaque)
+{
+    virQEMUCapsCacheProbePtr probe = jobdata;
+    virQEMUCapsCachePtr cache = opaque;
+    virQEMUCapsPtr qemuCaps;
+
+    VIR_DEBUG("Probing capabilities for %s in background", probe->binary);
+
+    qemuCaps = virQEMUCapsNewForBinary(probe->caps, probe->binary,
+                                       cache->libDir, cache->cacheDir,
+                                       cache->runUid, cache->runGid);
+
+    virMutexLock(&cache->lock);
+
+    if (qemuCaps) {
+        VIR_DEBUG("Replacing stale capabilities for %s with %p",
+                  probe->binary, qemuCaps);
+        if (virHashUpdateEntry(cache->binaries, probe->binary, qemuCaps) < 0)
+            virObjectUnref(qemuCaps);
+        else
+            cache->generation++;
+    } else {
+        /* The binary may be gone, let the next lookup probe it again
+         * and report the error to its caller */
+        VIR_WARN("Failed to probe capabilities for %s: %s",
+                 probe->binary, virGetLastErrorMessage());
+        virResetLastError();
+        if (virHashRemoveEntry(cache->binaries, probe->binary) == 0)
+            cache->generation++;
+    }
+
+    ignore_value(virHashSteal(cache->probes, probe->binary));
+
+    virMutexUnlock(&cache->lock);
+
+    virQEMUCapsCacheProbeFree(probe);
+}
+
+
 virQEMUCapsCachePtr
 virQEMUCapsCacheNew(const char *libDir,
                     const char *cacheDir,
@@ -5307,6 +6137,14 @@ virQEMUCapsCacheNew(const char *libDir,
 
     if (!(cache->binaries = virHashCreate(10, virObjectFreeHashData)))
         goto error;
+    if (!(cache->probes = virHashCreate(10, virQEMUCapsCacheProbeHashFree)))
+        goto error;
+    if (!(cache->machines = virHashCreate(10, virQEMUCapsCacheMachineHashFree)))
+        goto error;
+    if (!(cache->probePool = virThreadPoolNew(0, QEMU_CAPS_CACHE_PROBE_WORKERS,
+                                              0, virQEMUCapsCacheProbeWorker,
+                                              cache)))
+        goto error;
     if (VIR_STRDUP(cache->libDir, libDir) < 0)
         goto error;
     if (VIR_STRDUP(cache->cacheDir, cacheDir) < 0)
@@ -5323,6 +6161,39 @@ virQEMUCapsCacheNew(const char *libDir,
 }
 
 
+/* Queue a background probe of @binary unless one is already pending.
+ * Must be called with the cache lock held. */
+static void
+virQEMUCapsCacheProbeQueue(virQEMUCapsCachePtr cache,
+                           const char *binary,
+                           virCapsPtr caps)
+{
+    virQEMUCapsCacheProbePtr probe = NULL;
+
+    if (virHashLookup(cache->probes, binary))
+        return;
+
+    if (VIR_ALLOC(probe) < 0 ||
+        VIR_STRDUP(probe->binary, binary) < 0)
+        goto error;
+    probe->caps = virObjectRef(caps);
+
+    if (virHashAddEntry(cache->probes, binary, probe) < 0)
+        goto error;
+
+    if (virThreadPoolSendJob(cache->probePool, 0, probe) < 0) {
+        virHashRemoveEntry(cache->probes, binary);
+        return;
+    }
+
+    VIR_DEBUG("Queued background probe of %s", binary);
+    return;
+
+ error:
+    virQEMUCapsCacheProbeFree(probe);
+}
+
+
 static void ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
 virQEMUCapsCacheValidate(virQEMUCapsCachePtr cache,
                          const char *binary,
@@ -5330,11 +6201,16 @@ virQEMUCapsCacheValidate(virQEMUCapsCachePtr cache,
                          virQEMUCapsPtr *qemuCaps)
 {
     if (*qemuCaps &&
-        !virQEMUCapsIsValid(*qemuCaps, 0, cache->runUid, cache->runGid)) {
-        VIR_DEBUG("Cached capabilities %p no longer valid for %s",
-                  *qemuCaps, binary);
-        virHashRemoveEntry(cache->binaries, binary);
-        *qemuCaps = NULL;
+        ((*qemuCaps)->stale ||
+         !virQEMUCapsIsValid(*qemuCaps, 0, cache->runUid, cache->runGid))) {
+        /* Probing QEMU takes a while, hand out the capabilities we
+         * already have until it's done rather than blocking everyone
+         * who needs them */
+        VIR_DEBUG("Cached capabilities %p no longer valid for %s, "
+                  "keeping them until probing finishes", *qemuCaps, binary);
+        (*qemuCaps)->stale = true;
+        virQEMUCapsCacheProbeQueue(cache, binary, caps);
+        return;
     }
 
     if (!*qemuCaps) {
@@ -5347,6 +6223,8 @@ virQEMUCapsCacheValidate(virQEMUCapsCachePtr cache,
             if (virHashAddEntry(cache->binaries, binary, *qemuCaps) < 0) {
                 virObjectUnref(*qemuCaps);
                 *qemuCaps = NULL;
+            } else {
+                cache->generation++;
             }
         }
     }
@@ -5373,25 +6251,70 @@ virQEMUCapsCacheLookup(virCapsPtr caps,
 }
 
 
+/**
+ * virQEMUCapsCacheLookupMachine:
+ * @caps: host capabilities
+ * @cache: QEMU capabilities cache
+ * @binary: QEMU binary
+ * @machineType: machine type to filter the capabilities by
+ *
+ * Look up the capabilities of @binary filtered by @machineType, as
+ * used by a running domain. All domains using the same binary and
+ * machine type share the same object, which therefore must not be
+ * modified; use virQEMUCapsNewCopy to get a private one first.
+ *
+ * Returns a reference the caller has to release, or NULL on error.
+ */
 virQEMUCapsPtr
-virQEMUCapsCacheLookupCopy(virCapsPtr caps,
-                           virQEMUCapsCachePtr cache,
-                           const char *binary,
-                           const char *machineType)
+virQEMUCapsCacheLookupMachine(virCapsPtr caps,
+                              virQEMUCapsCachePtr cache,
+                              const char *binary,
+                              const char *machineType)
 {
     virQEMUCapsPtr qemuCaps = virQEMUCapsCacheLookup(caps, cache, binary);
-    virQEMUCapsPtr ret;
+    virQEMUCapsCacheMachinePtr machine = NULL;
+    virQEMUCapsPtr ret = NULL;
+    char *key = NULL;
 
     if (!qemuCaps)
         return NULL;
 
-    ret = virQEMUCapsNewCopy(qemuCaps);
-    virObjectUnref(qemuCaps);
+    if (virAsprintf(&key, "%s:%s", EMPTYSTR(machineType), binary) < 0)
+        goto cleanup;
 
-    if (!ret)
-        return NULL;
+    virMutexLock(&cache->lock);
+    if ((machine = virHashLookup(cache->machines, key)) &&
+        machine->origin == qemuCaps)
+        ret = virObjectRef(machine->qemuCaps);
+    virMutexUnlock(&cache->lock);
+    machine = NULL;
+
+    if (ret)
+        goto cleanup;
+
+    if (!(ret = virQEMUCapsNewCopy(qemuCaps)))
+        goto cleanup;
 
     virQEMUCapsFilterByMachineType(ret, machineType);
+
+    /* Failing to share the capabilities is not fatal */
+    if (VIR_ALLOC_QUIET(machine) < 0)
+        goto cleanup;
+    machine->origin = virObjectRef(qemuCaps);
+    machine->qemuCaps = virObjectRef(ret);
+
+    virMutexLock(&cache->lock);
+    if (virHashUpdateEntry(cache->machines, key, machine) == 0)
+        machine = NULL;
+    else
+        virResetLastError();
+    virMutexUnlock(&cache->lock);
+
+ cleanup:
+    if (machine)
+        virQEMUCapsCacheMachineHashFree(machine, NULL);
+    virObjectUnref(qemuCaps);
+    VIR_FREE(key);
     return ret;
 }
 
@@ -5453,12 +6376,126 @@ virQEMUCapsCacheLookupByArch(virCapsPtr caps,
 }
 
 
+struct virQEMUCapsCacheRevalidateData {
+    virQEMUCapsCachePtr cache;
+    virCapsPtr caps;
+};
+
+
+static int
+virQEMUCapsCacheRevalidateOne(void *payload,
+                              const void *name,
+                              void *opaque)
+{
+    struct virQEMUCapsCacheRevalidateData *data = opaque;
+    virQEMUCapsPtr qemuCaps = payload;
+
+    virQEMUCapsCacheValidate(data->cache, name, data->caps, &qemuCaps);
+    return 0;
+}
+
+
+/**
+ * virQEMUCapsCacheRevalidate:
+ * @caps: host capabilities
+ * @cache: QEMU capabilities cache
+ *
+ * Check all cached capabilities against their binaries and queue
+ * outdated ones for probing, as if each of them was looked up. Once
+ * probing finishes, the generation of @cache changes.
+ */
+void
+virQEMUCapsCacheRevalidate(virCapsPtr caps,
+                           virQEMUCapsCachePtr cache)
+{
+    struct virQEMUCapsCacheRevalidateData data = { cache, caps };
+
+    virMutexLock(&cache->lock);
+    virHashForEach(cache->binaries, virQEMUCapsCacheRevalidateOne, &data);
+    virMutexUnlock(&cache->lock);
+}
+
+
+/**
+ * virQEMUCapsCacheGetGeneration:
+ * @cache: QEMU capabilities cache
+ *
+ * Returns a counter which changes whenever capabilities of a binary
+ * are added to @cache, replaced or dropped from it.
+ */
+unsigned int
+virQEMUCapsCacheGetGeneration(virQEMUCapsCachePtr cache)
+{
+    unsigned int ret;
+
+    virMutexLock(&cache->lock);
+    ret = cache->generation;
+    virMutexUnlock(&cache->lock);
+
+    return ret;
+}
+
+
+static void
+virQEMUCapsSearchPathStampDir(const char *dir,
+                              unsigned long long *stamp)
+{
+    struct stat sb;
+    struct timespec mtime;
+
+    if (stat(dir, &sb) < 0)
+        return;
+
+    mtime = get_stat_mtime(&sb);
+    *stamp = MAX(*stamp, mtime.tv_sec * 1000000000ull + mtime.tv_nsec);
+}
+
+
+/**
+ * virQEMUCapsSearchPathStamp:
+ *
+ * Returns the newest modification time, in nanoseconds, of the
+ * directories searched for QEMU binaries. It changes whenever a binary
+ * is installed in or removed from any of them, which the capabilities
+ * cache itself cannot notice.
+ */
+unsigned long long
+virQEMUCapsSearchPathStamp(void)
+{
+    const char *path = virGetEnvBlockSUID("PATH");
+    char **dirs = NULL;
+    unsigned long long stamp = 0;
+    size_t i;
+
+    if (!path)
+        path = "/bin:/usr/bin";
+
+    if (!(dirs = virStringSplit(path, ":", 0))) {
+        virResetLastError();
+        return 0;
+    }
+
+    for (i = 0; dirs[i]; i++)
+        virQEMUCapsSearchPathStampDir(dirs[i], &stamp);
+
+    /* qemu-kvm lives outside of $PATH on some distros */
+    virQEMUCapsSearchPathStampDir("/usr/libexec", &stamp);
+
+    virStringListFree(dirs);
+    return stamp;
+}
+
+
 void
 virQEMUCapsCacheFree(virQEMUCapsCachePtr cache)
 {
     if (!cache)
         return;
 
+    /* Waits for running probes, those still queued are just dropped */
+    virThreadPoolFree(cache->probePool);
+    virHashFree(cache->probes);
+    virHashFree(cache->machines);
     VIR_FREE(cache->libDir);
     VIR_FREE(cache->cacheDir);
     virHashFree(cache->binaries);
@@ -403,6 +403,10 @@ typedef enum {
     QEMU_CAPS_QUERY_NAMED_BLOCK_NODES, /* qmp query-named-block-nodes */
     QEMU_CAPS_CPU_CACHE, /* -cpu supports host-cache-info and l3-cache properties */
     QEMU_CAPS_DEVICE_QEMU_XHCI, /* -device qemu-xhci */
+    QEMU_CAPS_QUERY_CPUS_FAST, /* qmp query-cpus-fast */
+    QEMU_CAPS_OBJECT_MEMORY_PREALLOC_THREADS, /* -object memory-backend-*,prealloc-threads= */
+    QEMU_CAPS_CALC_DIRTY_RATE, /* qmp calc-dirty-rate */
+    QEMU_CAPS_BITMAP_PERSISTENT, /* block-dirty-bitmap-add persistent */
 
     QEMU_CAPS_LAST /* this must always be the last item */
 } virQEMUCapsFlags;
@@ -414,6 +418,7 @@ typedef struct _virQEMUCapsCache virQEMUCapsCache;
 typedef virQEMUCapsCache *virQEMUCapsCachePtr;
 
 virQEMUCapsPtr virQEMUCapsNew(void);
+virQEMUCapsPtr virQEMUCapsNewCopy(virQEMUCapsPtr qemuCaps);
 
 void virQEMUCapsSet(virQEMUCapsPtr qemuCaps,
                     virQEMUCapsFlags flag) ATTRIBUTE_NONNULL(1);
@@ -495,13 +500,17 @@ virQEMUCapsCachePtr virQEMUCapsCacheNew(const char *libDir,
 virQEMUCapsPtr virQEMUCapsCacheLookup(virCapsPtr caps,
                                       virQEMUCapsCachePtr cache,
                                       const char *binary);
-virQEMUCapsPtr virQEMUCapsCacheLookupCopy(virCapsPtr caps,
-                                          virQEMUCapsCachePtr cache,
-                                          const char *binary,
-                                          const char *machineType);
+virQEMUCapsPtr virQEMUCapsCacheLookupMachine(virCapsPtr caps,
+                                             virQEMUCapsCachePtr cache,
+                                             const char *binary,
+                                             const char *machineType);
 virQEMUCapsPtr virQEMUCapsCacheLookupByArch(virCapsPtr caps,
                                             virQEMUCapsCachePtr cache,
                                             virArch arch);
+void virQEMUCapsCacheRevalidate(virCapsPtr caps,
+                                virQEMUCapsCachePtr cache);
+unsigned int virQEMUCapsCacheGetGeneration(virQEMUCapsCachePtr cache);
+unsigned long long virQEMUCapsSearchPathStamp(void);
 void virQEMUCapsCacheFree(virQEMUCapsCachePtr cache);
 
 virCapsPtr virQEMUCapsInit(virQEMUCapsCachePtr cache);
@@ -31,14 +31,20 @@
 struct _virQEMUCapsCache {
     virMutex lock;
     virHashTablePtr binaries;
+    /* binary -> virQEMUCapsCacheProbe being refreshed in background */
+    virHashTablePtr probes;
+    /* "machine:binary" -> virQEMUCapsCacheMachine shared by domains */
+    virHashTablePtr machines;
+    virThreadPoolPtr probePool;
     char *libDir;
     char *cacheDir;
     uid_t runUid;
     gid_t runGid;
+    /* changes whenever an entry of @binaries is added, replaced or
+     * removed */
+    unsigned int generation;
 };
 
-virQEMUCapsPtr virQEMUCapsNewCopy(virQEMUCapsPtr qemuCaps);
-
 virQEMUCapsPtr
 virQEMUCapsNewForBinaryInternal(virCapsPtr caps,
                                 const char *binary,
@@ -57,6 +63,16 @@ char *virQEMUCapsFormatCache(virQEMUCapsPtr qemuCaps,
                              time_t selfCTime,
                              unsigned long selfVersion);
 
+int virQEMUCapsLoadBinaryCache(virCapsPtr caps,
+                               virQEMUCapsPtr qemuCaps,
+                               const char *filename,
+                               time_t selfCTime,
+                               unsigned long selfVersion);
+int virQEMUCapsSaveBinaryCache(virQEMUCapsPtr qemuCaps,
+                               const char *filename,
+                               time_t selfCTime,
+                               unsigned long selfVersion);
+
 int
 virQEMUCapsInitQMPMonitor(virQEMUCapsPtr qemuCaps,
                           qemuMonitorPtr mon);
@@ -37,6 +37,7 @@
 #include "virtypedparam.h"
 #include "virnuma.h"
 #include "virsystemd.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
@@ -813,21 +814,22 @@ qemuSetupCpuCgroup(virQEMUDriverPtr driver,
 }
 
 
+/*
+ * Fill in what's needed to place @vm in a cgroup of its own.
+ *
+ * Returns 1 if it is to get one, 0 if cgroups are not used, -1 on error
+ */
 static int
-qemuInitCgroup(virQEMUDriverPtr driver,
-               virDomainObjPtr vm,
-               size_t nnicindexes,
-               int *nicindexes)
+qemuInitCgroupPrepare(virQEMUDriverPtr driver,
+                      virDomainObjPtr vm)
 {
-    int ret = -1;
     qemuDomainObjPrivatePtr priv = vm->privateData;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     if (!virQEMUDriverIsPrivileged(driver))
-        goto done;
+        return 0;
 
     if (!virCgroupAvailable())
-        goto done;
+        return 0;
 
     virCgroupFree(&priv->cgroup);
 
@@ -835,11 +837,11 @@ qemuInitCgroup(virQEMUDriverPtr driver,
         virDomainResourceDefPtr res;
 
         if (VIR_ALLOC(res) < 0)
-            goto cleanup;
+            return -1;
 
         if (VIR_STRDUP(res->partition, "/machine") < 0) {
             VIR_FREE(res);
-            goto cleanup;
+            return -1;
         }
 
         vm->def->resource = res;
@@ -849,19 +851,87 @@ qemuInitCgroup(virQEMUDriverPtr driver,
         virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                        _("Resource partition '%s' must start with '/'"),
                        vm->def->resource->partition);
-        goto cleanup;
+        return -1;
     }
 
     /*
      * We need to do this because of systemd-machined, because
      * CreateMachine requires the name to be a valid hostname.
      */
+    VIR_FREE(priv->machineName);
     priv->machineName = virSystemdMakeMachineName("qemu",
                                                   vm->def->id,
                                                   vm->def->name,
                                                   virQEMUDriverIsPrivileged(driver));
     if (!priv->machineName)
+        return -1;
+
+    return 1;
+}
+
+
+/**
+ * qemuSetupCgroupPrepare:
+ * @driver: qemu driver
+ * @vm: domain object whose process was just started
+ * @nnicindexes: number of items in @nicindexes
+ * @nicindexes: network interfaces of the domain
+ *
+ * Registering a domain with systemd-machined is a synchronous DBus
+ * call which may take long when systemd is busy. Send it as soon as the
+ * process is known, so that qemuSetupCgroup() only has to wait for the
+ * part of it not overlapping with the rest of the start up. The same
+ * @nicindexes have to be passed to qemuSetupCgroup().
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+qemuSetupCgroupPrepare(virQEMUDriverPtr driver,
+                       virDomainObjPtr vm,
+                       size_t nnicindexes,
+                       int *nicindexes)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int rv;
+
+    virSystemdMachineRequestFree(priv->machineRequest);
+    priv->machineRequest = NULL;
+
+    if ((rv = qemuInitCgroupPrepare(driver, vm)) <= 0)
+        return rv;
+
+    if (!(priv->machineRequest =
+          virSystemdCreateMachineStart(priv->machineName,
+                                       "qemu",
+                                       vm->def->uuid,
+                                       NULL,
+                                       vm->pid,
+                                       false,
+                                       nnicindexes, nicindexes,
+                                       vm->def->resource->partition)))
+        return -1;
+
+    return 0;
+}
+
+
+static int
+qemuInitCgroup(virQEMUDriverPtr driver,
+               virDomainObjPtr vm,
+               size_t nnicindexes,
+               int *nicindexes)
+{
+    int ret = -1;
+    int rv;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+
+    /* qemuSetupCgroupPrepare did the preparation already */
+    if (!priv->machineRequest &&
+        (rv = qemuInitCgroupPrepare(driver, vm)) <= 0) {
+        ret = rv;
         goto cleanup;
+    }
 
     if (virCgroupNewMachine(priv->machineName,
                             "qemu",
@@ -872,6 +942,7 @@ qemuInitCgroup(virQEMUDriverPtr driver,
                             nnicindexes, nicindexes,
                             vm->def->resource->partition,
                             cfg->cgroupControllers,
+                            priv->machineRequest,
                             &priv->cgroup) < 0) {
         if (virCgroupNewIgnoreError())
             goto done;
@@ -882,6 +953,8 @@ qemuInitCgroup(virQEMUDriverPtr driver,
  done:
     ret = 0;
  cleanup:
+    virSystemdMachineRequestFree(priv->machineRequest);
+    priv->machineRequest = NULL;
     virObjectUnref(cfg);
     return ret;
 }
@@ -1002,6 +1075,25 @@ qemuConnectCgroup(virQEMUDriverPtr driver,
     return ret;
 }
 
+static void
+qemuSetupCgroupPhaseDone(virDomainObjPtr vm,
+                         const char *phase,
+                         unsigned long long *start,
+                         size_t *nwrites)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long now = 0;
+    size_t writes = virCgroupBatchGetWrites(priv->cgroup);
+
+    ignore_value(virTimeMillisNow(&now));
+    VIR_DEBUG("Setup of %s cgroup of domain %s took %llu ms and %zu writes",
+              phase, vm->def->name, now - *start, writes - *nwrites);
+
+    *start = now;
+    *nwrites = writes;
+}
+
+
 int
 qemuSetupCgroup(virQEMUDriverPtr driver,
                 virDomainObjPtr vm,
@@ -1009,6 +1101,8 @@ qemuSetupCgroup(virQEMUDriverPtr driver,
                 int *nicindexes)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long start = 0;
+    size_t nwrites = 0;
     int ret = -1;
 
     if (!vm->pid) {
@@ -1023,23 +1117,36 @@ qemuSetupCgroup(virQEMUDriverPtr driver,
     if (!priv->cgroup)
         return 0;
 
+    /* resolve the directory of each controller just once for the many
+     * device ACL entries and limits written below */
+    if (virCgroupBatchBegin(priv->cgroup) < 0)
+        return -1;
+
+    ignore_value(virTimeMillisNow(&start));
+
     if (qemuSetupDevicesCgroup(driver, vm) < 0)
         goto cleanup;
+    qemuSetupCgroupPhaseDone(vm, "devices", &start, &nwrites);
 
     if (qemuSetupBlkioCgroup(vm) < 0)
         goto cleanup;
+    qemuSetupCgroupPhaseDone(vm, "blkio", &start, &nwrites);
 
     if (qemuSetupMemoryCgroup(vm) < 0)
         goto cleanup;
+    qemuSetupCgroupPhaseDone(vm, "memory", &start, &nwrites);
 
     if (qemuSetupCpuCgroup(driver, vm) < 0)
         goto cleanup;
+    qemuSetupCgroupPhaseDone(vm, "cpu", &start, &nwrites);
 
     if (qemuSetupCpusetCgroup(vm) < 0)
         goto cleanup;
+    qemuSetupCgroupPhaseDone(vm, "cpuset", &start, &nwrites);
 
     ret = 0;
  cleanup:
+    virCgroupBatchEnd(priv->cgroup);
     return ret;
 }
 
@@ -1156,6 +1263,18 @@ qemuRemoveCgroup(virDomainObjPtr vm)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
 
+    if (priv->machineRequest) {
+        /* The start up failed before the cgroup was set up, make sure
+         * systemd-machined doesn't keep a registration made meanwhile */
+        virSystemdMachineRequestFree(priv->machineRequest);
+        priv->machineRequest = NULL;
+
+        if (!priv->cgroup &&
+            virCgroupTerminateMachine(priv->machineName) < 0 &&
+            !virCgroupNewIgnoreError())
+            VIR_DEBUG("Failed to terminate machine for %s", vm->def->name);
+    }
+
     if (priv->cgroup == NULL)
         return 0; /* Not supported, so claim success */
 
@@ -57,6 +57,10 @@ int qemuTeardownChardevCgroup(virDomainObjPtr vm,
                               virDomainChrDefPtr dev);
 int qemuConnectCgroup(virQEMUDriverPtr driver,
                       virDomainObjPtr vm);
+int qemuSetupCgroupPrepare(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           size_t nnicindexes,
+                           int *nicindexes);
 int qemuSetupCgroup(virQEMUDriverPtr driver,
                     virDomainObjPtr vm,
                     size_t nnicindexes,
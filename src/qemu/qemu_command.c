@@ -305,8 +305,8 @@ qemuBuildDeviceAddressStr(virBufferPtr buf,
     if (info->type == VIR_DOMAIN_DEVICE_ADDRESS_TYPE_PCI) {
         size_t i;
 
-        if (!(devStr = virDomainPCIAddressAsString(&info->addr.pci)))
-            goto cleanup;
+        /* the address is only formatted for error messages, this is
+         * done for every device on the command line */
         for (i = 0; i < domainDef->ncontrollers; i++) {
             virDomainControllerDefPtr cont = domainDef->controllers[i];
 
@@ -314,22 +314,24 @@ qemuBuildDeviceAddressStr(virBufferPtr buf,
                 cont->idx == info->addr.pci.bus) {
                 contAlias = cont->info.alias;
                 if (!contAlias) {
+                    devStr = virDomainPCIAddressAsString(&info->addr.pci);
                     virReportError(VIR_ERR_INTERNAL_ERROR,
                                    _("Device alias was not set for PCI "
                                      "controller with index %u required "
                                      "for device at address %s"),
-                                   info->addr.pci.bus, devStr);
+                                   info->addr.pci.bus, NULLSTR(devStr));
                     goto cleanup;
                 }
                 break;
             }
         }
         if (!contAlias) {
+            devStr = virDomainPCIAddressAsString(&info->addr.pci);
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("Could not find PCI "
                              "controller with index %u required "
                              "for device at address %s"),
-                           info->addr.pci.bus, devStr);
+                           info->addr.pci.bus, NULLSTR(devStr));
             goto cleanup;
         }
 
@@ -3420,6 +3422,21 @@ qemuBuildMemoryBackendStr(virJSONValuePtr *backendProps,
     if (virJSONValueObjectAdd(props, "U:size", mem->size * 1024, NULL) < 0)
         goto cleanup;
 
+    if (def->mem.allocation_threads) {
+        if (!virQEMUCapsGet(qemuCaps, QEMU_CAPS_OBJECT_MEMORY_PREALLOC_THREADS)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("memory preallocation threads are not "
+                             "supported by this QEMU binary"));
+            goto cleanup;
+        }
+
+        if (virJSONValueObjectAdd(props,
+                                  "u:prealloc-threads",
+                                  def->mem.allocation_threads,
+                                  NULL) < 0)
+            goto cleanup;
+    }
+
     if (mem->sourceNodes) {
         nodemask = mem->sourceNodes;
     } else {
@@ -3440,7 +3457,7 @@ qemuBuildMemoryBackendStr(virJSONValuePtr *backendProps,
 
     /* If none of the following is requested... */
     if (!needHugepage && !mem->sourceNodes && !nodeSpecified &&
-        !mem->nvdimmPath &&
+        !mem->nvdimmPath && !def->mem.allocation_threads &&
         memAccess == VIR_DOMAIN_MEMORY_ACCESS_DEFAULT &&
         def->mem.source != VIR_DOMAIN_MEMORY_SOURCE_FILE && !force) {
         /* report back that using the new backend is not necessary
@@ -7551,6 +7568,16 @@ qemuBuildMemCommandLine(virCommandPtr cmd,
     if (def->mem.allocation == VIR_DOMAIN_MEMORY_ALLOCATION_IMMEDIATE)
         virCommandAddArgList(cmd, "-mem-prealloc", NULL);
 
+    /* The number of preallocation threads is a property of the memory
+     * objects, which are used only with guest NUMA nodes. */
+    if (def->mem.allocation_threads &&
+        !virDomainNumaGetNodeCount(def->numa)) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("memory preallocation threads require "
+                         "guest NUMA topology"));
+        return -1;
+    }
+
     /*
      * Add '-mem-path' (and '-mem-prealloc') parameter here if
      * the hugepages and no numa node is specified.
@@ -311,8 +311,14 @@ virQEMUDriverConfigPtr virQEMUDriverConfigNew(bool privileged)
     cfg->securityDefaultConfined = true;
     cfg->securityRequireConfined = false;
 
+    cfg->statsSampleHistory = 1;
+
+    cfg->reconnectWorkers = 8;
+
     cfg->keepAliveInterval = 5;
     cfg->keepAliveCount = 5;
+    cfg->autoStartParallel = 1;
+    cfg->shutdownSaveParallel = 1;
     cfg->seccompSandbox = -1;
 
     cfg->logTimestamp = true;
@@ -365,6 +371,7 @@ static void virQEMUDriverConfigDispose(void *obj)
     virBitmapFree(cfg->namespaces);
 
     virStringListFree(cfg->cgroupDeviceACL);
+    virStringListFree(cfg->autoStartGroups);
 
     VIR_FREE(cfg->configBaseDir);
     VIR_FREE(cfg->configDir);
@@ -646,6 +653,16 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
         goto cleanup;
     }
 
+    if (virConfGetValueUInt(conf, "max_outgoing_migrations",
+                            &cfg->maxOutgoingMigrations) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "max_incoming_migrations",
+                            &cfg->maxIncomingMigrations) < 0)
+        goto cleanup;
+    if (virConfGetValueULLong(conf, "migration_host_bandwidth",
+                              &cfg->migrationHostBandwidth) < 0)
+        goto cleanup;
+
     if (virConfGetValueString(conf, "user", &user) < 0)
         goto cleanup;
     if (user && virGetUserID(user, &cfg->user) < 0)
@@ -687,6 +704,13 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
         goto cleanup;
     if (virConfGetValueString(conf, "snapshot_image_format", &cfg->snapshotImageFormat) < 0)
         goto cleanup;
+    if (virConfGetValueUInt(conf, "save_image_threads", &cfg->saveImageThreads) < 0)
+        goto cleanup;
+    if (cfg->saveImageThreads > 255) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("save_image_threads must not be greater than 255"));
+        goto cleanup;
+    }
 
     if (virConfGetValueString(conf, "auto_dump_path", &cfg->autoDumpPath) < 0)
         goto cleanup;
@@ -694,6 +718,30 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
         goto cleanup;
     if (virConfGetValueBool(conf, "auto_start_bypass_cache", &cfg->autoStartBypassCache) < 0)
         goto cleanup;
+    if (virConfGetValueUInt(conf, "auto_start_parallel", &cfg->autoStartParallel) < 0)
+        goto cleanup;
+    if (cfg->autoStartParallel == 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("auto_start_parallel must be greater than 0"));
+        goto cleanup;
+    }
+    if (virConfGetValueStringList(conf, "auto_start_groups", false,
+                                  &cfg->autoStartGroups) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "auto_start_io_pressure", &cfg->autoStartIOPressure) < 0)
+        goto cleanup;
+    if (cfg->autoStartIOPressure > 100) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("auto_start_io_pressure must not exceed 100"));
+        goto cleanup;
+    }
+    if (virConfGetValueUInt(conf, "shutdown_save_parallel", &cfg->shutdownSaveParallel) < 0)
+        goto cleanup;
+    if (cfg->shutdownSaveParallel == 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("shutdown_save_parallel must be greater than 0"));
+        goto cleanup;
+    }
 
     if (virConfGetValueStringList(conf, "hugetlbfs_mount", true,
                                   &hugetlbfs) < 0)
@@ -777,6 +825,33 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     if (virConfGetValueUInt(conf, "max_queued", &cfg->maxQueuedJobs) < 0)
         goto cleanup;
 
+    if (virConfGetValueUInt(conf, "stats_workers", &cfg->statsWorkers) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "stats_job_timeout", &cfg->statsJobTimeout) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "block_stats_cache_interval",
+                            &cfg->blockStatsCacheInterval) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "stats_sample_interval",
+                            &cfg->statsSampleInterval) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "stats_sample_history",
+                            &cfg->statsSampleHistory) < 0)
+        goto cleanup;
+    if (cfg->statsSampleHistory == 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("stats_sample_history must be greater than 0"));
+        goto cleanup;
+    }
+
+    if (virConfGetValueUInt(conf, "reconnect_workers", &cfg->reconnectWorkers) < 0)
+        goto cleanup;
+    if (cfg->reconnectWorkers == 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("reconnect_workers must be greater than 0"));
+        goto cleanup;
+    }
+
     if (virConfGetValueInt(conf, "keepalive_interval", &cfg->keepAliveInterval) < 0)
         goto cleanup;
     if (virConfGetValueUInt(conf, "keepalive_count", &cfg->keepAliveCount) < 0)
@@ -989,18 +1064,75 @@ virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver)
  *
  * Returns: a reference to a virCapsPtr instance or NULL
  */
+/* Must be called with the driver lock held */
+static bool
+virQEMUDriverCapsAreCurrent(virQEMUDriverPtr driver,
+                            virHostTopologyPtr topology,
+                            unsigned int generation,
+                            unsigned long long searchStamp)
+{
+    return driver->caps &&
+        topology &&
+        driver->capsTopology == topology &&
+        driver->capsGeneration == generation &&
+        driver->capsSearchStamp == searchStamp;
+}
+
+
+/**
+ * virQEMUDriverGetCapabilities:
+ * @driver: the qemu driver
+ * @refresh: whether the capabilities should be brought up to date
+ *
+ * Get a reference to the host capabilities. With @refresh they are
+ * rebuilt first, unless nothing they were built from changed since:
+ * the capabilities of the QEMU binaries, the set of binaries installed
+ * and the host topology.
+ *
+ * Returns the capabilities the caller has to unref, or NULL on error.
+ */
 virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
                                         bool refresh)
 {
     virCapsPtr ret = NULL;
     if (refresh) {
         virCapsPtr caps = NULL;
-        if ((caps = virQEMUDriverCreateCapabilities(driver)) == NULL)
+        virHostTopologyPtr topology = virHostTopologyGet();
+        unsigned int generation;
+        unsigned long long searchStamp = virQEMUCapsSearchPathStamp();
+
+        /* Makes outdated binaries change the generation once probed */
+        qemuDriverLock(driver);
+        caps = virObjectRef(driver->caps);
+        qemuDriverUnlock(driver);
+        if (caps)
+            virQEMUCapsCacheRevalidate(caps, driver->qemuCapsCache);
+        virObjectUnref(caps);
+
+        generation = virQEMUCapsCacheGetGeneration(driver->qemuCapsCache);
+
+        qemuDriverLock(driver);
+        if (virQEMUDriverCapsAreCurrent(driver, topology, generation,
+                                        searchStamp)) {
+            VIR_DEBUG("Capabilities are up to date");
+            virObjectUnref(topology);
+            goto done;
+        }
+        qemuDriverUnlock(driver);
+
+        if ((caps = virQEMUDriverCreateCapabilities(driver)) == NULL) {
+            virObjectUnref(topology);
             return NULL;
+        }
 
         qemuDriverLock(driver);
         virObjectUnref(driver->caps);
         driver->caps = caps;
+        virObjectUnref(driver->capsTopology);
+        driver->capsTopology = topology;
+        driver->capsGeneration = generation;
+        driver->capsSearchStamp = searchStamp;
+        VIR_FREE(driver->capsXML);
     } else {
         qemuDriverLock(driver);
     }
@@ -1012,11 +1144,243 @@ virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
         return virQEMUDriverGetCapabilities(driver, true);
     }
 
+ done:
     ret = virObjectRef(driver->caps);
     qemuDriverUnlock(driver);
     return ret;
 }
 
+
+/**
+ * virQEMUDriverGetCapabilitiesXML:
+ * @driver: the qemu driver
+ *
+ * Format the up to date host capabilities. The XML is kept until the
+ * capabilities are rebuilt.
+ *
+ * Returns the XML the caller has to free, or NULL on error.
+ */
+char *
+virQEMUDriverGetCapabilitiesXML(virQEMUDriverPtr driver)
+{
+    virCapsPtr caps;
+    char *xml = NULL;
+    char *ret = NULL;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, true)))
+        return NULL;
+
+    qemuDriverLock(driver);
+    if (driver->caps == caps && driver->capsXML)
+        ignore_value(VIR_STRDUP(ret, driver->capsXML));
+    qemuDriverUnlock(driver);
+
+    if (ret)
+        goto cleanup;
+
+    if (!(xml = virCapabilitiesFormatXML(caps)) ||
+        VIR_STRDUP(ret, xml) < 0)
+        goto cleanup;
+
+    qemuDriverLock(driver);
+    if (driver->caps == caps) {
+        VIR_FREE(driver->capsXML);
+        driver->capsXML = xml;
+        xml = NULL;
+    }
+    qemuDriverUnlock(driver);
+
+ cleanup:
+    VIR_FREE(xml);
+    virObjectUnref(caps);
+    return ret;
+}
+
+
+typedef struct _virQEMUDriverDomainCaps virQEMUDriverDomainCaps;
+typedef virQEMUDriverDomainCaps *virQEMUDriverDomainCapsPtr;
+struct _virQEMUDriverDomainCaps {
+    /* What the XML was built from, referenced so that the pointers
+     * cannot be reused by other objects */
+    virCapsPtr caps;
+    virQEMUCapsPtr qemuCaps;
+    char *xml;
+};
+
+
+static void
+virQEMUDriverDomainCapsFree(void *payload,
+                            const void *name ATTRIBUTE_UNUSED)
+{
+    virQEMUDriverDomainCapsPtr entry = payload;
+
+    virObjectUnref(entry->caps);
+    virObjectUnref(entry->qemuCaps);
+    VIR_FREE(entry->xml);
+    VIR_FREE(entry);
+}
+
+
+virHashTablePtr
+virQEMUDriverDomainCapsCacheNew(void)
+{
+    return virHashCreate(10, virQEMUDriverDomainCapsFree);
+}
+
+
+/**
+ * virQEMUDriverGetDomainCapsXML:
+ * @driver: the qemu driver
+ * @caps: host capabilities
+ * @qemuCaps: capabilities of @emulatorbin
+ * @emulatorbin: path to the emulator
+ * @machine: canonical machine type
+ * @arch: guest architecture
+ * @virttype: virtualization type
+ *
+ * Format the domain capabilities for the given combination. The XML
+ * is kept until either @caps or @qemuCaps are replaced, which is what
+ * happens when the host or the emulator change.
+ *
+ * Returns the XML the caller has to free, or NULL on error.
+ */
+char *
+virQEMUDriverGetDomainCapsXML(virQEMUDriverPtr driver,
+                              virCapsPtr caps,
+                              virQEMUCapsPtr qemuCaps,
+                              const char *emulatorbin,
+                              const char *machine,
+                              virArch arch,
+                              virDomainVirtType virttype)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    virQEMUDriverDomainCapsPtr entry = NULL;
+    virDomainCapsPtr domCaps = NULL;
+    char *key = NULL;
+    char *ret = NULL;
+
+    if (virAsprintf(&key, "%s:%s:%s:%s", emulatorbin,
+                    virArchToString(arch), machine,
+                    virDomainVirtTypeToString(virttype)) < 0)
+        goto cleanup;
+
+    qemuDriverLock(driver);
+    if ((entry = virHashLookup(driver->domCapsCache, key)) &&
+        entry->caps == caps &&
+        entry->qemuCaps == qemuCaps)
+        ignore_value(VIR_STRDUP(ret, entry->xml));
+    qemuDriverUnlock(driver);
+    entry = NULL;
+
+    if (ret)
+        goto cleanup;
+
+    if (!(domCaps = virDomainCapsNew(emulatorbin, machine, arch, virttype)))
+        goto cleanup;
+
+    if (virQEMUCapsFillDomainCaps(caps, domCaps, qemuCaps,
+                                  cfg->firmwares, cfg->nfirmwares) < 0)
+        goto cleanup;
+
+    if (!(ret = virDomainCapsFormat(domCaps)))
+        goto cleanup;
+
+    if (VIR_ALLOC(entry) < 0 ||
+        VIR_STRDUP(entry->xml, ret) < 0) {
+        VIR_FREE(ret);
+        goto cleanup;
+    }
+    entry->caps = virObjectRef(caps);
+    entry->qemuCaps = virObjectRef(qemuCaps);
+
+    qemuDriverLock(driver);
+    if (virHashUpdateEntry(driver->domCapsCache, key, entry) == 0)
+        entry = NULL;
+    qemuDriverUnlock(driver);
+
+ cleanup:
+    if (entry)
+        virQEMUDriverDomainCapsFree(entry, NULL);
+    virObjectUnref(domCaps);
+    virObjectUnref(cfg);
+    VIR_FREE(key);
+    return ret;
+}
+
+
+/**
+ * virQEMUDriverGetNumaLoad:
+ * @driver: the QEMU driver
+ * @node: host NUMA node
+ *
+ * Returns the number of vCPUs of running domains placed on @node.
+ */
+unsigned int
+virQEMUDriverGetNumaLoad(virQEMUDriverPtr driver,
+                         int node)
+{
+    unsigned int ret = 0;
+
+    qemuDriverLock(driver);
+    if (node >= 0 && node < driver->nnumaLoad)
+        ret = driver->numaLoad[node];
+    qemuDriverUnlock(driver);
+
+    return ret;
+}
+
+
+/**
+ * virQEMUDriverAddNumaLoad:
+ * @driver: the QEMU driver
+ * @nodes: host NUMA nodes
+ * @vcpus: vCPUs to account to each of @nodes
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virQEMUDriverAddNumaLoad(virQEMUDriverPtr driver,
+                         virBitmapPtr nodes,
+                         unsigned int vcpus)
+{
+    ssize_t last = virBitmapLastSetBit(nodes);
+    ssize_t node = -1;
+    int ret = -1;
+
+    qemuDriverLock(driver);
+    if (last >= (ssize_t) driver->nnumaLoad &&
+        VIR_EXPAND_N(driver->numaLoad, driver->nnumaLoad,
+                     last + 1 - driver->nnumaLoad) < 0)
+        goto cleanup;
+
+    while ((node = virBitmapNextSetBit(nodes, node)) >= 0)
+        driver->numaLoad[node] += vcpus;
+
+    ret = 0;
+ cleanup:
+    qemuDriverUnlock(driver);
+    return ret;
+}
+
+
+void
+virQEMUDriverRemoveNumaLoad(virQEMUDriverPtr driver,
+                            virBitmapPtr nodes,
+                            unsigned int vcpus)
+{
+    ssize_t node = -1;
+
+    qemuDriverLock(driver);
+    while ((node = virBitmapNextSetBit(nodes, node)) >= 0 &&
+           node < driver->nnumaLoad) {
+        if (driver->numaLoad[node] > vcpus)
+            driver->numaLoad[node] -= vcpus;
+        else
+            driver->numaLoad[node] = 0;
+    }
+    qemuDriverUnlock(driver);
+}
+
 struct _qemuSharedDeviceEntry {
     size_t ref;
     char **domains; /* array of domain names */
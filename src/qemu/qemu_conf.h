@@ -48,6 +48,7 @@
 # include "virclosecallbacks.h"
 # include "virhostdev.h"
 # include "virfile.h"
+# include "virhosttopology.h"
 # include "virfirmware.h"
 
 # ifdef CPU_SETSIZE /* Linux */
@@ -66,6 +67,12 @@ typedef virQEMUDriver *virQEMUDriverPtr;
 typedef struct _virQEMUDriverConfig virQEMUDriverConfig;
 typedef virQEMUDriverConfig *virQEMUDriverConfigPtr;
 
+typedef struct _qemuMigrationScheduler qemuMigrationScheduler;
+typedef qemuMigrationScheduler *qemuMigrationSchedulerPtr;
+
+typedef struct _qemuStatsSampler qemuStatsSampler;
+typedef qemuStatsSampler *qemuStatsSamplerPtr;
+
 /* Main driver config. The data in these object
  * instances is immutable, so can be accessed
  * without locking. Threads must, however, hold
@@ -168,6 +175,14 @@ struct _virQEMUDriverConfig {
 
     unsigned int maxQueuedJobs;
 
+    unsigned int statsWorkers;
+    unsigned int statsJobTimeout;
+    unsigned int blockStatsCacheInterval;
+    unsigned int statsSampleInterval;
+    unsigned int statsSampleHistory;
+
+    unsigned int reconnectWorkers;
+
     char **securityDriverNames;
     bool securityDefaultConfined;
     bool securityRequireConfined;
@@ -175,10 +190,15 @@ struct _virQEMUDriverConfig {
     char *saveImageFormat;
     char *dumpImageFormat;
     char *snapshotImageFormat;
+    unsigned int saveImageThreads;
 
     char *autoDumpPath;
     bool autoDumpBypassCache;
     bool autoStartBypassCache;
+    unsigned int autoStartParallel;
+    char **autoStartGroups;
+    unsigned int autoStartIOPressure;
+    unsigned int shutdownSaveParallel;
 
     char *lockManagerName;
 
@@ -192,6 +212,9 @@ struct _virQEMUDriverConfig {
     char *migrationAddress;
     unsigned int migrationPortMin;
     unsigned int migrationPortMax;
+    unsigned int maxOutgoingMigrations;
+    unsigned int maxIncomingMigrations;
+    unsigned long long migrationHostBandwidth; /* MiB/s, 0 = unlimited */
 
     bool logTimestamp;
     bool stdioLogD;
@@ -214,6 +237,18 @@ struct _virQEMUDriver {
     /* Immutable pointer, self-locking APIs */
     virThreadPoolPtr workerPool;
 
+    /* Immutable pointer, self-locking APIs */
+    virThreadPoolPtr reconnectPool;
+
+    /* Immutable pointer, self-locking APIs */
+    virThreadPoolPtr statsPool;
+
+    /* Atomic inc/dec only */
+    unsigned int reconnectPending;
+
+    /* Immutable value */
+    unsigned long long reconnectStarted;
+
     /* Atomic increment only */
     int lastvmid;
 
@@ -241,6 +276,24 @@ struct _virQEMUDriver {
      */
     virCapsPtr caps;
 
+    /* Require lock to access. What @caps were built from, checked by
+     * virQEMUDriverGetCapabilities before rebuilding them, and their
+     * formatted XML */
+    virHostTopologyPtr capsTopology;
+    unsigned int capsGeneration;
+    unsigned long long capsSearchStamp;
+    char *capsXML;
+
+    /* Require lock to access. Formatted domain capabilities keyed by
+     * emulator, arch, machine and virt type */
+    virHashTablePtr domCapsCache;
+
+    /* Require lock to access. vCPUs of the running domains placed on
+     * each host NUMA node, indexed by node, used by the automatic
+     * NUMA placement */
+    unsigned int *numaLoad;
+    size_t nnumaLoad;
+
     /* Immutable pointer, Immutable object */
     virDomainXMLOptionPtr xmlopt;
 
@@ -278,6 +331,12 @@ struct _virQEMUDriver {
 
     /* Immutable pointer, self-locking APIs */
     virHashAtomicPtr migrationErrors;
+
+    /* Immutable pointer, self-locking APIs */
+    qemuMigrationSchedulerPtr migrationScheduler;
+
+    /* Immutable pointer, self-locking APIs */
+    qemuStatsSamplerPtr statsSampler;
 };
 
 typedef struct _qemuDomainCmdlineDef qemuDomainCmdlineDef;
@@ -307,6 +366,24 @@ bool virQEMUDriverIsPrivileged(virQEMUDriverPtr driver);
 virCapsPtr virQEMUDriverCreateCapabilities(virQEMUDriverPtr driver);
 virCapsPtr virQEMUDriverGetCapabilities(virQEMUDriverPtr driver,
                                         bool refresh);
+char *virQEMUDriverGetCapabilitiesXML(virQEMUDriverPtr driver);
+virHashTablePtr virQEMUDriverDomainCapsCacheNew(void);
+char *virQEMUDriverGetDomainCapsXML(virQEMUDriverPtr driver,
+                                    virCapsPtr caps,
+                                    virQEMUCapsPtr qemuCaps,
+                                    const char *emulatorbin,
+                                    const char *machine,
+                                    virArch arch,
+                                    virDomainVirtType virttype);
+
+unsigned int virQEMUDriverGetNumaLoad(virQEMUDriverPtr driver,
+                                      int node);
+int virQEMUDriverAddNumaLoad(virQEMUDriverPtr driver,
+                             virBitmapPtr nodes,
+                             unsigned int vcpus);
+void virQEMUDriverRemoveNumaLoad(virQEMUDriverPtr driver,
+                                 virBitmapPtr nodes,
+                                 unsigned int vcpus);
 
 typedef struct _qemuSharedDeviceEntry qemuSharedDeviceEntry;
 typedef qemuSharedDeviceEntry *qemuSharedDeviceEntryPtr;
@@ -48,6 +48,7 @@
 #include "virthreadjob.h"
 #include "viratomic.h"
 #include "virprocess.h"
+#include "virhostcpu.h"
 #include "vircrypto.h"
 #include "secret_util.h"
 #include "logging/log_manager.h"
@@ -104,6 +105,19 @@ VIR_ENUM_IMPL(qemuDomainNamespace, QEMU_DOMAIN_NS_LAST,
               "mount",
 );
 
+VIR_ENUM_IMPL(qemuDomainStartPhase, QEMU_DOMAIN_START_PHASE_LAST,
+              "prepare-domain",
+              "prepare-host",
+              "command-line",
+              "spawn",
+              "cgroup",
+              "security",
+              "monitor",
+              "setup",
+              "refresh",
+              "finish",
+);
+
 
 #define PROC_MOUNTS "/proc/mounts"
 #define DEVPREFIX "/dev/"
@@ -305,6 +319,7 @@ qemuDomainObjResetJob(qemuDomainObjPrivatePtr priv)
     job->owner = 0;
     job->ownerAPI = NULL;
     job->started = 0;
+    job->nqueries = 0;
 }
 
 static void
@@ -573,6 +588,22 @@ qemuDomainJobInfoToParams(qemuDomainJobInfoPtr jobInfo,
                              stats->cpu_throttle_percentage) < 0)
         goto error;
 
+    if (jobInfo->parallelConnections &&
+        virTypedParamsAddInt(&par, &npar, &maxpar,
+                             VIR_DOMAIN_JOB_PARALLEL_CONNECTIONS,
+                             jobInfo->parallelConnections) < 0)
+        goto error;
+
+    if (jobInfo->queuePosition &&
+        (virTypedParamsAddUInt(&par, &npar, &maxpar,
+                               VIR_DOMAIN_JOB_QUEUE_POSITION,
+                               jobInfo->queuePosition) < 0 ||
+         (jobInfo->queueTimeRemaining &&
+          virTypedParamsAddULLong(&par, &npar, &maxpar,
+                                  VIR_DOMAIN_JOB_QUEUE_TIME_REMAINING,
+                                  jobInfo->queueTimeRemaining) < 0)))
+        goto error;
+
     *type = jobInfo->type;
     *params = par;
     *nparams = npar;
@@ -1670,6 +1701,8 @@ qemuDomainObjPrivateAlloc(void)
         goto error;
 
     priv->migMaxBandwidth = QEMU_DOMAIN_MIG_BANDWIDTH_MAX;
+    priv->statusSaveTimer = -1;
+    priv->blockStatsCacheTimer = -1;
 
     return priv;
 
@@ -1678,6 +1711,20 @@ qemuDomainObjPrivateAlloc(void)
     return NULL;
 }
 
+
+static void
+qemuDomainXMLCacheClear(qemuDomainObjPrivatePtr priv)
+{
+    size_t i;
+
+    for (i = 0; i < QEMU_DOMAIN_XML_CACHE_SIZE; i++) {
+        VIR_FREE(priv->xmlCache[i].xml);
+        priv->xmlCache[i].def = NULL;
+    }
+    priv->xmlCacheNext = 0;
+}
+
+
 static void
 qemuDomainObjPrivateFree(void *data)
 {
@@ -1694,8 +1741,11 @@ qemuDomainObjPrivateFree(void *data)
     qemuDomainObjFreeJob(priv);
     VIR_FREE(priv->lockState);
     VIR_FREE(priv->origname);
+    virDomainDefFree(priv->migPersistentDef);
+    VIR_FREE(priv->migPersistentDigest);
 
     virStringListFree(priv->qemuDevices);
+    VIR_FREE(priv->unplugDeferred);
     virChrdevFree(priv->devs);
 
     /* This should never be non-NULL if we get here, but just in case... */
@@ -1710,6 +1760,7 @@ qemuDomainObjPrivateFree(void *data)
     VIR_FREE(priv->cleanupCallbacks);
     virBitmapFree(priv->autoNodeset);
     virBitmapFree(priv->autoCpuset);
+    virBitmapFree(priv->placementNodes);
 
     VIR_FREE(priv->libDir);
     VIR_FREE(priv->channelTargetDir);
@@ -1718,6 +1769,11 @@ qemuDomainObjPrivateFree(void *data)
     VIR_FREE(priv->migTLSAlias);
     qemuDomainMasterKeyFree(priv);
 
+    virHashFree(priv->blockStatsCache);
+    virJSONValueFree(priv->blockNodeDataCache);
+
+    qemuDomainXMLCacheClear(priv);
+
     VIR_FREE(priv);
 }
 
@@ -3546,14 +3602,7 @@ virDomainDefParserConfig virQEMUDriverDomainDefParserConfig = {
 static void
 qemuDomainObjSaveJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
 {
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
-
-    if (virDomainObjIsActive(obj)) {
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, obj, driver->caps) < 0)
-            VIR_WARN("Failed to save status on vm %s", obj->def->name);
-    }
-
-    virObjectUnref(cfg);
+    qemuDomainSaveStatusFlush(driver, obj);
 }
 
 void
@@ -3601,6 +3650,8 @@ qemuDomainObjDiscardAsyncJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
 
     if (priv->job.active == QEMU_JOB_ASYNC_NESTED)
         qemuDomainObjResetJob(priv);
+    qemuMigrationSchedulerRelease(driver, obj);
+    virDomainObjBumpGeneration(obj);
     qemuDomainObjResetAsyncJob(priv);
     qemuDomainObjSaveJob(driver, obj);
 }
@@ -3627,10 +3678,71 @@ qemuDomainNestedJobAllowed(qemuDomainObjPrivatePtr priv, qemuDomainJob job)
     return !priv->job.asyncJob || (priv->job.mask & JOB_MASK(job)) != 0;
 }
 
+/*
+ * Query jobs share the job with each other, unless an exclusive job is
+ * waiting: letting further queries in would make it wait forever on a
+ * busy domain.
+ */
+static bool
+qemuDomainObjJobBusy(qemuDomainObjPrivatePtr priv, qemuDomainJob job)
+{
+    if (job != QEMU_JOB_QUERY)
+        return priv->job.active != QEMU_JOB_NONE;
+
+    return priv->job.nwaiters > 0 ||
+           (priv->job.active != QEMU_JOB_NONE &&
+            priv->job.active != QEMU_JOB_QUERY);
+}
+
 bool
 qemuDomainJobAllowed(qemuDomainObjPrivatePtr priv, qemuDomainJob job)
 {
-    return !priv->job.active && qemuDomainNestedJobAllowed(priv, job);
+    return !qemuDomainObjJobBusy(priv, job) &&
+           qemuDomainNestedJobAllowed(priv, job);
+}
+
+
+static void
+qemuDomainObjJobWaitStatsAdd(qemuDomainObjPrivatePtr priv,
+                             qemuDomainJob job,
+                             unsigned long long wait,
+                             bool started)
+{
+    qemuDomainJobWaitStatsPtr stats = &priv->job.waitStats[job];
+    size_t i;
+
+    if (!started) {
+        stats->failures++;
+        return;
+    }
+
+    stats->calls++;
+    stats->time += wait;
+    if (wait > stats->timeMax)
+        stats->timeMax = wait;
+
+    for (i = 0; i < QEMU_MONITOR_LATENCY_BUCKETS - 1; i++) {
+        if (wait <= qemuMonitorLatencyBuckets[i])
+            break;
+    }
+    stats->histogram[i]++;
+}
+
+
+/**
+ * qemuDomainObjGetJobWaitStats:
+ * @obj: domain object
+ * @stats: filled with a copy of the statistics, indexed by qemuDomainJob
+ *
+ * obj must be locked before calling
+ */
+void
+qemuDomainObjGetJobWaitStats(virDomainObjPtr obj,
+                             qemuDomainJobWaitStatsPtr stats)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+
+    memcpy(stats, priv->job.waitStats, sizeof(priv->job.waitStats));
 }
 
 /* Give up waiting for mutex after 30 seconds */
@@ -3643,13 +3755,16 @@ static int ATTRIBUTE_NONNULL(1)
 qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
                               virDomainObjPtr obj,
                               qemuDomainJob job,
-                              qemuDomainAsyncJob asyncJob)
+                              qemuDomainAsyncJob asyncJob,
+                              unsigned long long waitTime)
 {
     qemuDomainObjPrivatePtr priv = obj->privateData;
     unsigned long long now;
     unsigned long long then;
+    unsigned long long queued;
     bool nested = job == QEMU_JOB_ASYNC_NESTED;
     bool async = job == QEMU_JOB_ASYNC;
+    bool shared = job == QEMU_JOB_QUERY;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     const char *blocker = NULL;
     int ret = -1;
@@ -3673,7 +3788,8 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     }
 
     priv->jobs_queued++;
-    then = now + QEMU_JOB_WAIT_TIME;
+    queued = now;
+    then = now + waitTime;
 
  retry:
     if (cfg->maxQueuedJobs &&
@@ -3687,20 +3803,39 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
             goto error;
     }
 
-    while (priv->job.active) {
+    if (!shared)
+        priv->job.nwaiters++;
+    while (qemuDomainObjJobBusy(priv, job)) {
         VIR_DEBUG("Waiting for job (vm=%p name=%s)", obj, obj->def->name);
-        if (virCondWaitUntil(&priv->job.cond, &obj->parent.lock, then) < 0)
+        if (virCondWaitUntil(&priv->job.cond, &obj->parent.lock, then) < 0) {
+            if (!shared && --priv->job.nwaiters == 0)
+                virCondBroadcast(&priv->job.cond);
             goto error;
+        }
     }
+    if (!shared)
+        priv->job.nwaiters--;
 
     /* No job is active but a new async job could have been started while obj
      * was unlocked, so we need to recheck it. */
     if (!nested && !qemuDomainNestedJobAllowed(priv, job))
         goto retry;
 
-    qemuDomainObjResetJob(priv);
-
     ignore_value(virTimeMillisNow(&now));
+    qemuDomainObjJobWaitStatsAdd(priv, job, now - queued, true);
+
+    if (shared && priv->job.active == QEMU_JOB_QUERY) {
+        /* The owner stays the thread which started the query job first */
+        priv->job.nqueries++;
+        VIR_DEBUG("Joined job: %s (async=%s vm=%p name=%s queries=%u)",
+                  qemuDomainJobTypeToString(job),
+                  qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                  obj, obj->def->name, priv->job.nqueries);
+        virObjectUnref(cfg);
+        return 0;
+    }
+
+    qemuDomainObjResetJob(priv);
 
     if (job != QEMU_JOB_ASYNC) {
         VIR_DEBUG("Started job: %s (async=%s vm=%p name=%s)",
@@ -3711,6 +3846,8 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
         priv->job.owner = virThreadSelfID();
         priv->job.ownerAPI = virThreadJobGet();
         priv->job.started = now;
+        if (shared)
+            priv->job.nqueries = 1;
     } else {
         VIR_DEBUG("Started async job: %s (vm=%p name=%s)",
                   qemuDomainAsyncJobTypeToString(asyncJob),
@@ -3733,6 +3870,7 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
 
  error:
     ignore_value(virTimeMillisNow(&now));
+    qemuDomainObjJobWaitStatsAdd(priv, job, now - queued, false);
     if (priv->job.active && priv->job.started)
         duration = now - priv->job.started;
     if (priv->job.asyncJob && priv->job.asyncStarted)
@@ -3802,7 +3940,33 @@ int qemuDomainObjBeginJob(virQEMUDriverPtr driver,
                           qemuDomainJob job)
 {
     if (qemuDomainObjBeginJobInternal(driver, obj, job,
-                                      QEMU_ASYNC_JOB_NONE) < 0)
+                                      QEMU_ASYNC_JOB_NONE,
+                                      QEMU_JOB_WAIT_TIME) < 0)
+        return -1;
+    else
+        return 0;
+}
+
+/*
+ * obj must be locked before calling
+ *
+ * Same as qemuDomainObjBeginJob() except that the caller gives up
+ * waiting for the job after @timeout milliseconds rather than after
+ * the default job wait time. A @timeout of 0 picks the default.
+ *
+ * Successful calls must be followed by EndJob eventually
+ */
+int
+qemuDomainObjBeginJobWithTimeout(virQEMUDriverPtr driver,
+                                 virDomainObjPtr obj,
+                                 qemuDomainJob job,
+                                 unsigned long long timeout)
+{
+    if (timeout == 0)
+        timeout = QEMU_JOB_WAIT_TIME;
+
+    if (qemuDomainObjBeginJobInternal(driver, obj, job,
+                                      QEMU_ASYNC_JOB_NONE, timeout) < 0)
         return -1;
     else
         return 0;
@@ -3816,7 +3980,7 @@ int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
     qemuDomainObjPrivatePtr priv;
 
     if (qemuDomainObjBeginJobInternal(driver, obj, QEMU_JOB_ASYNC,
-                                      asyncJob) < 0)
+                                      asyncJob, QEMU_JOB_WAIT_TIME) < 0)
         return -1;
 
     priv = obj->privateData;
@@ -3844,7 +4008,8 @@ qemuDomainObjBeginNestedJob(virQEMUDriverPtr driver,
 
     return qemuDomainObjBeginJobInternal(driver, obj,
                                          QEMU_JOB_ASYNC_NESTED,
-                                         QEMU_ASYNC_JOB_NONE);
+                                         QEMU_ASYNC_JOB_NONE,
+                                         QEMU_JOB_WAIT_TIME);
 }
 
 
@@ -3862,15 +4027,29 @@ qemuDomainObjEndJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
 
     priv->jobs_queued--;
 
+    if (job == QEMU_JOB_QUERY && priv->job.nqueries > 1) {
+        priv->job.nqueries--;
+        VIR_DEBUG("Leaving job: %s (async=%s vm=%p name=%s queries=%u)",
+                  qemuDomainJobTypeToString(job),
+                  qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                  obj, obj->def->name, priv->job.nqueries);
+        return;
+    }
+
     VIR_DEBUG("Stopping job: %s (async=%s vm=%p name=%s)",
               qemuDomainJobTypeToString(job),
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
               obj, obj->def->name);
 
+    /* Anything but a query may have modified the definition */
+    if (job != QEMU_JOB_QUERY)
+        virDomainObjBumpGeneration(obj);
+
     qemuDomainObjResetJob(priv);
     if (qemuDomainTrackJob(job))
         qemuDomainObjSaveJob(driver, obj);
-    virCondSignal(&priv->job.cond);
+    /* Several query jobs may be waiting to start together */
+    virCondBroadcast(&priv->job.cond);
 }
 
 void
@@ -3884,6 +4063,7 @@ qemuDomainObjEndAsyncJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
               obj, obj->def->name);
 
+    qemuMigrationSchedulerRelease(driver, obj);
     qemuDomainObjResetAsyncJob(priv);
     qemuDomainObjSaveJob(driver, obj);
     virCondBroadcast(&priv->job.asyncCond);
@@ -4261,11 +4441,29 @@ char *qemuDomainDefFormatXML(virQEMUDriverPtr driver,
     return virBufferContentAndReset(&buf);
 }
 
+/**
+ * qemuDomainFormatXML:
+ * @driver: qemu driver data
+ * @vm: domain object, must be locked
+ * @flags: VIR_DOMAIN_XML_* flags
+ *
+ * Format the XML description of @vm.  Descriptions are remembered per
+ * @flags and reused until the generation of @vm changes, which saves
+ * clients polling the XML of idle domains from formatting it over and
+ * over again.
+ *
+ * Returns the XML the caller has to free, or NULL on error.
+ */
 char *qemuDomainFormatXML(virQEMUDriverPtr driver,
                           virDomainObjPtr vm,
                           unsigned int flags)
 {
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainXMLCacheEntryPtr entry;
     virDomainDefPtr def;
+    char *xml;
+    char *ret = NULL;
+    size_t i;
 
     if ((flags & VIR_DOMAIN_XML_INACTIVE) && vm->newDef) {
         def = vm->newDef;
@@ -4275,7 +4473,36 @@ char *qemuDomainFormatXML(virQEMUDriverPtr driver,
             flags &= ~VIR_DOMAIN_XML_UPDATE_CPU;
     }
 
-    return qemuDomainDefFormatXML(driver, def, flags);
+    for (i = 0; i < QEMU_DOMAIN_XML_CACHE_SIZE; i++) {
+        entry = &priv->xmlCache[i];
+
+        if (entry->xml &&
+            entry->def == def &&
+            entry->flags == flags &&
+            entry->generation == vm->generation) {
+            ignore_value(VIR_STRDUP(ret, entry->xml));
+            return ret;
+        }
+    }
+
+    if (!(xml = qemuDomainDefFormatXML(driver, def, flags)))
+        return NULL;
+
+    if (VIR_STRDUP(ret, xml) < 0) {
+        VIR_FREE(xml);
+        return NULL;
+    }
+
+    entry = &priv->xmlCache[priv->xmlCacheNext];
+    priv->xmlCacheNext = (priv->xmlCacheNext + 1) % QEMU_DOMAIN_XML_CACHE_SIZE;
+
+    VIR_FREE(entry->xml);
+    entry->xml = xml;
+    entry->def = def;
+    entry->flags = flags;
+    entry->generation = vm->generation;
+
+    return ret;
 }
 
 char *
@@ -4718,27 +4945,282 @@ qemuFindQemuImgBinary(virQEMUDriverPtr driver)
     return driver->qemuImgBinary;
 }
 
+/* The metadata of all snapshots of a domain lives in a single log,
+ * QEMU_DOMAIN_SNAPSHOT_LOG in its snapshot directory, rather than in
+ * one file per snapshot. Every change appends a record
+ *
+ *   put <name length> <XML length>\n<name>\n<snapshot XML>\n
+ *   del <name length> 0\n<name>\n\n
+ *
+ * and the last record for a name wins when the log is loaded. Once
+ * the log has grown well past the number of snapshots it describes,
+ * it is rewritten with just one record per snapshot. */
+
+static char *
+qemuDomainSnapshotLogPath(virDomainObjPtr vm,
+                          const char *snapshotDir)
+{
+    char *path = NULL;
+
+    ignore_value(virAsprintf(&path, "%s/%s/%s", snapshotDir, vm->def->name,
+                             QEMU_DOMAIN_SNAPSHOT_LOG));
+    return path;
+}
+
+
+/**
+ * qemuDomainSnapshotLogParse:
+ * @content: the log, split in place
+ * @len: length of @content
+ * @path: where the log was read from, for messages
+ * @records: filled with the last record for every name
+ * @goodLen: set to the length of the well formed records
+ *
+ * The XML is stored in @records as is, empty for deleted snapshots.
+ * Anything after @goodLen is a partial record, most likely left by a
+ * crash in the middle of an append, which the caller should cut off.
+ *
+ * Returns the number of records, or -1 on error.
+ */
+ssize_t
+qemuDomainSnapshotLogParse(char *content,
+                           size_t len,
+                           const char *path,
+                           virHashTablePtr records,
+                           size_t *goodLen)
+{
+    char *p = content;
+    char *end = content + len;
+    ssize_t nrecords = 0;
+
+    while (p < end) {
+        char *nl = memchr(p, '\n', end - p);
+        char *tmp;
+        char *name;
+        char *xml;
+        unsigned long namelen;
+        unsigned long xmllen;
+        bool deleted;
+
+        if (!nl)
+            goto torn;
+        *nl = '\0';
+
+        if (STRPREFIX(p, "put "))
+            deleted = false;
+        else if (STRPREFIX(p, "del "))
+            deleted = true;
+        else
+            goto torn;
+
+        if (virStrToLong_ul(p + 4, &tmp, 10, &namelen) < 0 || *tmp != ' ' ||
+            virStrToLong_ul(tmp + 1, &tmp, 10, &xmllen) < 0 || *tmp ||
+            namelen == 0 || (deleted && xmllen != 0) ||
+            namelen >= end - nl || xmllen >= end - nl - namelen - 1)
+            goto torn;
+
+        name = nl + 1;
+        xml = name + namelen + 1;
+        if (name[namelen] != '\n' || xml + xmllen >= end ||
+            xml[xmllen] != '\n')
+            goto torn;
+        name[namelen] = '\0';
+        xml[xmllen] = '\0';
+
+        if (virHashUpdateEntry(records, name, xml) < 0)
+            return -1;
+
+        nrecords++;
+        p = xml + xmllen + 1;
+    }
+
+    *goodLen = len;
+    return nrecords;
+
+ torn:
+    VIR_WARN("Ignoring partial record at offset %zu of %s",
+             (size_t) (p - content), path);
+    *goodLen = p - content;
+    return nrecords;
+}
+
+
+static int
+qemuDomainSnapshotLogFormat(virBufferPtr buf,
+                            virDomainObjPtr vm,
+                            virDomainSnapshotObjPtr snapshot,
+                            virCapsPtr caps,
+                            bool deleted)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    char *xml = NULL;
+    const char *name = snapshot->def->name;
+
+    if (!deleted) {
+        virUUIDFormat(vm->def->uuid, uuidstr);
+        if (!(xml = virDomainSnapshotDefFormat(uuidstr, snapshot->def, caps,
+                                               virDomainDefFormatConvertXMLFlags(QEMU_DOMAIN_FORMAT_LIVE_FLAGS),
+                                               1)))
+            return -1;
+    }
+
+    virBufferAsprintf(buf, "%s %zu %zu\n%s\n%s\n",
+                      deleted ? "del" : "put", strlen(name),
+                      xml ? strlen(xml) : 0, name, xml ? xml : "");
+    VIR_FREE(xml);
+
+    return virBufferCheckError(buf);
+}
+
+
+static int
+qemuDomainSnapshotLogAppend(virDomainObjPtr vm,
+                            virDomainSnapshotObjPtr snapshot,
+                            virCapsPtr caps,
+                            const char *snapshotDir,
+                            bool deleted)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *snapDir = NULL;
+    char *path = NULL;
+    char *record = NULL;
+    int fd = -1;
+    int ret = -1;
+
+    if (qemuDomainSnapshotLogFormat(&buf, vm, snapshot, caps, deleted) < 0)
+        goto cleanup;
+    record = virBufferContentAndReset(&buf);
+
+    if (virAsprintf(&snapDir, "%s/%s", snapshotDir, vm->def->name) < 0 ||
+        !(path = qemuDomainSnapshotLogPath(vm, snapshotDir)))
+        goto cleanup;
+    if (virFileMakePath(snapDir) < 0) {
+        virReportSystemError(errno, _("cannot create snapshot directory '%s'"),
+                             snapDir);
+        goto cleanup;
+    }
+
+    if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR)) < 0) {
+        virReportSystemError(errno, _("cannot open '%s'"), path);
+        goto cleanup;
+    }
+
+    if (safewrite(fd, record, strlen(record)) < 0 || fsync(fd) < 0 ||
+        VIR_CLOSE(fd) < 0) {
+        virReportSystemError(errno, _("cannot write '%s'"), path);
+        goto cleanup;
+    }
+    priv->nsnapshotLogRecords++;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(record);
+    VIR_FREE(path);
+    VIR_FREE(snapDir);
+    return ret;
+}
+
+
+/* Failing to compact the log is not fatal, the next change will try
+ * again.  */
+static void
+qemuDomainSnapshotLogMaybeCompact(virDomainObjPtr vm,
+                                  virCapsPtr caps,
+                                  const char *snapshotDir)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    size_t nsnapshots = virDomainSnapshotObjListNum(vm->snapshots, NULL, 0);
+
+    if (priv->snapshotLogIncomplete ||
+        priv->nsnapshotLogRecords <= QEMU_DOMAIN_SNAPSHOT_LOG_SLACK +
+                                     2 * nsnapshots)
+        return;
+
+    if (qemuDomainSnapshotCompactLog(vm, caps, snapshotDir) < 0)
+        VIR_WARN("Failed to compact snapshot metadata of domain %s",
+                 vm->def->name);
+}
+
+
 int
 qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
                                 virDomainSnapshotObjPtr snapshot,
                                 virCapsPtr caps,
                                 char *snapshotDir)
 {
-    char *newxml = NULL;
-    int ret = -1;
+    if (qemuDomainSnapshotLogAppend(vm, snapshot, caps, snapshotDir,
+                                    false) < 0)
+        return -1;
+
+    qemuDomainSnapshotLogMaybeCompact(vm, caps, snapshotDir);
+    return 0;
+}
+
+
+struct qemuDomainSnapshotCompactData {
+    virDomainObjPtr vm;
+    virCapsPtr caps;
+    virBuffer buf;
+    size_t count;
+    int err;
+};
+
+static int
+qemuDomainSnapshotCompactOne(void *payload,
+                             const void *name ATTRIBUTE_UNUSED,
+                             void *opaque)
+{
+    struct qemuDomainSnapshotCompactData *data = opaque;
+
+    if (data->err < 0)
+        return 0;
+
+    data->err = qemuDomainSnapshotLogFormat(&data->buf, data->vm, payload,
+                                            data->caps, false);
+    data->count++;
+    return 0;
+}
+
+
+/* Rewrite the snapshot metadata log of @vm with a single record for
+ * each of its snapshots.  */
+int
+qemuDomainSnapshotCompactLog(virDomainObjPtr vm,
+                             virCapsPtr caps,
+                             const char *snapshotDir)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    struct qemuDomainSnapshotCompactData data = {
+        vm, caps, VIR_BUFFER_INITIALIZER, 0, 0
+    };
     char *snapDir = NULL;
-    char *snapFile = NULL;
-    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    char *path = NULL;
+    char *content = NULL;
+    int ret = -1;
 
-    virUUIDFormat(vm->def->uuid, uuidstr);
-    newxml = virDomainSnapshotDefFormat(
-        uuidstr, snapshot->def, caps,
-        virDomainDefFormatConvertXMLFlags(QEMU_DOMAIN_FORMAT_LIVE_FLAGS),
-        1);
-    if (newxml == NULL)
+    if (priv->snapshotLogIncomplete) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("snapshot metadata of domain %s has unloaded "
+                         "records"), vm->def->name);
         return -1;
+    }
+
+    virDomainSnapshotForEach(vm->snapshots, qemuDomainSnapshotCompactOne,
+                             &data);
+    if (data.err < 0)
+        goto cleanup;
+
+    /* The buffer stays empty for a domain without snapshots */
+    if (!(content = virBufferContentAndReset(&data.buf)) &&
+        VIR_STRDUP(content, "") < 0)
+        goto cleanup;
 
-    if (virAsprintf(&snapDir, "%s/%s", snapshotDir, vm->def->name) < 0)
+    if (virAsprintf(&snapDir, "%s/%s", snapshotDir, vm->def->name) < 0 ||
+        !(path = qemuDomainSnapshotLogPath(vm, snapshotDir)))
         goto cleanup;
     if (virFileMakePath(snapDir) < 0) {
         virReportSystemError(errno, _("cannot create snapshot directory '%s'"),
@@ -4746,18 +5228,34 @@ qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
         goto cleanup;
     }
 
-    if (virAsprintf(&snapFile, "%s/%s.xml", snapDir, snapshot->def->name) < 0)
+    if (virFileRewriteStr(path, S_IRUSR | S_IWUSR, content) < 0)
         goto cleanup;
 
-    ret = virXMLSaveFile(snapFile, NULL, "snapshot-edit", newxml);
+    VIR_DEBUG("Compacted %zu snapshot metadata records of domain %s into %zu",
+              priv->nsnapshotLogRecords, vm->def->name, data.count);
+    priv->nsnapshotLogRecords = data.count;
+    ret = 0;
 
  cleanup:
-    VIR_FREE(snapFile);
+    virBufferFreeAndReset(&data.buf);
+    VIR_FREE(content);
+    VIR_FREE(path);
     VIR_FREE(snapDir);
-    VIR_FREE(newxml);
     return ret;
 }
 
+
+/* Snapshots are loaded with VIR_DOMAIN_SNAPSHOT_PARSE_DEFER_DOMAIN, so
+ * their domain definition has to be parsed before it is used.  */
+int
+qemuDomainSnapshotParseDomain(virQEMUDriverPtr driver,
+                              virDomainSnapshotObjPtr snap)
+{
+    return virDomainSnapshotDefParseDomain(snap->def, driver->caps,
+                                           driver->xmlopt,
+                                           VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL);
+}
+
 /* The domain is expected to be locked and inactive. Return -1 on normal
  * failure, 1 if we skipped a disk due to try_all.  */
 static int
@@ -4842,9 +5340,12 @@ qemuDomainSnapshotForEachQcow2(virQEMUDriverPtr driver,
     /* Prefer action on the disks in use at the time the snapshot was
      * created; but fall back to current definition if dealing with a
      * snapshot created prior to libvirt 0.9.5.  */
-    virDomainDefPtr def = snap->def->dom;
+    virDomainDefPtr def;
+
+    if (qemuDomainSnapshotParseDomain(driver, snap) < 0)
+        return -1;
 
-    if (!def)
+    if (!(def = snap->def->dom))
         def = vm->def;
     return qemuDomainSnapshotForEachQcow2Raw(driver, def, snap->def->name,
                                              op, try_all, def->ndisks);
@@ -4904,9 +5405,15 @@ qemuDomainSnapshotDiscard(virQEMUDriverPtr driver,
         vm->current_snapshot = parentsnap;
     }
 
-    if (unlink(snapFile) < 0)
+    if (qemuDomainSnapshotLogAppend(vm, snap, driver->caps, cfg->snapshotDir,
+                                    true) < 0)
+        VIR_WARN("Failed to record deletion of snapshot %s",
+                 snap->def->name);
+    /* Snapshots are only kept in separate files by older libvirt */
+    if (unlink(snapFile) < 0 && errno != ENOENT)
         VIR_WARN("Failed to unlink %s", snapFile);
     virDomainSnapshotObjListRemove(vm->snapshots, snap);
+    qemuDomainSnapshotLogMaybeCompact(vm, driver->caps, cfg->snapshotDir);
 
     ret = 0;
 
@@ -4934,32 +5441,83 @@ int qemuDomainSnapshotDiscardAll(void *payload,
     return 0;
 }
 
-int
-qemuDomainSnapshotDiscardAllMetadata(virQEMUDriverPtr driver,
-                                     virDomainObjPtr vm)
+struct qemuDomainSnapshotForgetData {
+    virDomainObjPtr vm;
+    const char *snapshotDir;
+};
+
+/* Hash iterator callback to drop a snapshot from the domain without
+ * recording that in the log, which is going away as a whole.  */
+static int
+qemuDomainSnapshotForget(void *payload,
+                         const void *name ATTRIBUTE_UNUSED,
+                         void *opaque)
 {
-    virQEMUSnapRemove rem;
+    virDomainSnapshotObjPtr snap = payload;
+    struct qemuDomainSnapshotForgetData *data = opaque;
+    char *snapFile = NULL;
+    size_t i;
+
+    if (virAsprintf(&snapFile, "%s/%s/%s.xml", data->snapshotDir,
+                    data->vm->def->name, snap->def->name) == 0 &&
+        unlink(snapFile) < 0 && errno != ENOENT)
+        VIR_WARN("Failed to unlink %s", snapFile);
+    VIR_FREE(snapFile);
 
-    rem.driver = driver;
-    rem.vm = vm;
-    rem.metadata_only = true;
-    rem.err = 0;
-    virDomainSnapshotForEach(vm->snapshots, qemuDomainSnapshotDiscardAll,
-                             &rem);
+    /* Snapshots visited earlier are gone already, so detach from
+     * those still around in both directions */
+    for (i = 0; i < snap->nchildren; i++)
+        snap->children[i]->parent = NULL;
+    virDomainSnapshotDropParent(snap);
+    virDomainSnapshotDropChildren(snap);
 
-    return rem.err;
+    virDomainSnapshotObjListRemove(data->vm->snapshots, snap);
+    return 0;
 }
 
-/*
- * The caller must hold a lock the vm.
- */
-void
-qemuDomainRemoveInactive(virQEMUDriverPtr driver,
-                         virDomainObjPtr vm)
-{
-    bool haveJob = true;
-    char *snapDir;
-    virQEMUDriverConfigPtr cfg;
+
+int
+qemuDomainSnapshotDiscardAllMetadata(virQEMUDriverPtr driver,
+                                     virDomainObjPtr vm)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    struct qemuDomainSnapshotForgetData data = { vm, cfg->snapshotDir };
+    char *path = NULL;
+    int ret = -1;
+
+    if (!(path = qemuDomainSnapshotLogPath(vm, cfg->snapshotDir)))
+        goto cleanup;
+
+    if (unlink(path) < 0 && errno != ENOENT) {
+        virReportSystemError(errno,
+                             _("failed to remove snapshot metadata '%s'"),
+                             path);
+        goto cleanup;
+    }
+    priv->nsnapshotLogRecords = 0;
+    priv->snapshotLogIncomplete = false;
+
+    vm->current_snapshot = NULL;
+    virDomainSnapshotForEach(vm->snapshots, qemuDomainSnapshotForget, &data);
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(path);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+/*
+ * The caller must hold a lock the vm.
+ */
+void
+qemuDomainRemoveInactive(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm)
+{
+    bool haveJob = true;
+    char *snapDir;
+    virQEMUDriverConfigPtr cfg;
 
     if (vm->persistent) {
         /* Short-circuit, we don't want to remove a persistent domain */
@@ -5010,6 +5568,352 @@ qemuDomainRemoveInactive(virQEMUDriverPtr driver,
     virObjectUnref(vm);
 }
 
+/* Delay in milliseconds between a lazily recorded status change and
+ * the write of the status XML which makes it persistent */
+#define QEMU_DOMAIN_STATUS_SAVE_DELAY 1000
+
+typedef struct _qemuDomainTimerData qemuDomainTimerData;
+typedef qemuDomainTimerData *qemuDomainTimerDataPtr;
+struct _qemuDomainTimerData {
+    virQEMUDriverPtr driver;
+    virDomainObjPtr vm;
+};
+
+static void
+qemuDomainTimerDataFree(void *opaque)
+{
+    qemuDomainTimerDataPtr data = opaque;
+
+    virObjectUnref(data->vm);
+    VIR_FREE(data);
+}
+
+static void
+qemuDomainSaveStatusTimer(int timer ATTRIBUTE_UNUSED,
+                          void *opaque)
+{
+    qemuDomainTimerDataPtr data = opaque;
+    virDomainObjPtr vm = data->vm;
+    qemuDomainObjPrivatePtr priv;
+
+    virObjectLock(vm);
+    priv = vm->privateData;
+
+    if (priv->statusSaveTimer != -1) {
+        VIR_DEBUG("Flushing lazily saved status of domain %s", vm->def->name);
+        qemuDomainSaveStatusFlush(data->driver, vm);
+    }
+
+    virObjectUnlock(vm);
+}
+
+
+/**
+ * qemuDomainSaveStatusLazy:
+ * @driver: qemu driver data
+ * @vm: domain object, must be locked
+ *
+ * Record that the status XML of @vm is out of date without writing it
+ * right away.  The status is written at most once per
+ * QEMU_DOMAIN_STATUS_SAVE_DELAY milliseconds, or earlier by
+ * qemuDomainSaveStatusFlush.  This is meant for frequent, merely
+ * informative changes (balloon size, RTC offset) where losing the last
+ * update on a daemon crash is harmless; changes that the daemon relies
+ * on when reconnecting to the domain must be saved immediately.
+ */
+void
+qemuDomainSaveStatusLazy(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainTimerDataPtr data = NULL;
+
+    priv->statusDirty = true;
+    virDomainObjBumpGeneration(vm);
+
+    if (priv->statusSaveTimer != -1)
+        return;
+
+    if (VIR_ALLOC(data) < 0)
+        goto error;
+
+    data->driver = driver;
+    data->vm = virObjectRef(vm);
+
+    if ((priv->statusSaveTimer =
+         virEventAddTimeout(QEMU_DOMAIN_STATUS_SAVE_DELAY,
+                            qemuDomainSaveStatusTimer,
+                            data, qemuDomainTimerDataFree)) < 0) {
+        qemuDomainTimerDataFree(data);
+        goto error;
+    }
+
+    return;
+
+ error:
+    priv->statusSaveTimer = -1;
+    VIR_WARN("Unable to schedule status save of domain %s, saving it now",
+             vm->def->name);
+    qemuDomainSaveStatusFlush(driver, vm);
+}
+
+
+/**
+ * qemuDomainSaveStatusFlush:
+ * @driver: qemu driver data
+ * @vm: domain object, must be locked
+ *
+ * Write the status XML of an active @vm now, including any changes
+ * recorded by qemuDomainSaveStatusLazy, and cancel the pending
+ * delayed write.
+ */
+void
+qemuDomainSaveStatusFlush(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+
+    if (priv->statusSaveTimer != -1) {
+        virEventRemoveTimeout(priv->statusSaveTimer);
+        priv->statusSaveTimer = -1;
+    }
+    priv->statusDirty = false;
+
+    if (virDomainObjIsActive(vm)) {
+        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+            VIR_WARN("Failed to save status on vm %s", vm->def->name);
+    }
+
+    virObjectUnref(cfg);
+}
+
+
+static void
+qemuDomainBlockStatsCacheTimer(int timer ATTRIBUTE_UNUSED,
+                               void *opaque)
+{
+    qemuDomainTimerDataPtr data = opaque;
+    virDomainObjPtr vm = data->vm;
+    qemuDomainObjPrivatePtr priv;
+    struct qemuProcessEvent *processEvent = NULL;
+
+    virObjectLock(vm);
+    priv = vm->privateData;
+
+    /* the previous refresh is still queued or waiting for the job */
+    if (priv->blockStatsCacheTimer == -1 ||
+        priv->blockStatsCacheRefreshing ||
+        !virDomainObjIsActive(vm))
+        goto cleanup;
+
+    if (VIR_ALLOC(processEvent) < 0)
+        goto cleanup;
+
+    processEvent->eventType = QEMU_PROCESS_EVENT_BLOCK_STATS;
+    processEvent->vm = virObjectRef(vm);
+
+    if (virThreadPoolSendJob(data->driver->workerPool, 0, processEvent) < 0) {
+        ignore_value(virObjectUnref(vm));
+        VIR_FREE(processEvent);
+        goto cleanup;
+    }
+
+    priv->blockStatsCacheRefreshing = true;
+
+ cleanup:
+    virObjectUnlock(vm);
+}
+
+
+/**
+ * qemuDomainBlockStatsCacheStart:
+ * @driver: qemu driver data
+ * @vm: domain object, must be locked
+ *
+ * Start sampling the block statistics of @vm every
+ * block_stats_cache_interval seconds, if configured.  The samples are
+ * taken by the worker pool in a QEMU_JOB_QUERY job so that the block
+ * stats APIs can answer from qemuDomainObjPrivate without a job.
+ */
+void
+qemuDomainBlockStatsCacheStart(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainTimerDataPtr data = NULL;
+
+    if (cfg->blockStatsCacheInterval == 0 ||
+        priv->blockStatsCacheTimer != -1)
+        goto cleanup;
+
+    if (VIR_ALLOC(data) < 0)
+        goto error;
+
+    data->driver = driver;
+    data->vm = virObjectRef(vm);
+
+    if ((priv->blockStatsCacheTimer =
+         virEventAddTimeout(cfg->blockStatsCacheInterval * 1000,
+                            qemuDomainBlockStatsCacheTimer,
+                            data, qemuDomainTimerDataFree)) < 0) {
+        qemuDomainTimerDataFree(data);
+        goto error;
+    }
+
+ cleanup:
+    virObjectUnref(cfg);
+    return;
+
+ error:
+    priv->blockStatsCacheTimer = -1;
+    VIR_WARN("Unable to schedule block stats sampling of domain %s",
+             vm->def->name);
+    goto cleanup;
+}
+
+
+/**
+ * qemuDomainBlockStatsCacheStop:
+ * @vm: domain object, must be locked
+ *
+ * Stop sampling the block statistics of @vm and drop the last sample.
+ */
+void
+qemuDomainBlockStatsCacheStop(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (priv->blockStatsCacheTimer != -1) {
+        virEventRemoveTimeout(priv->blockStatsCacheTimer);
+        priv->blockStatsCacheTimer = -1;
+    }
+
+    qemuDomainBlockStatsCacheInvalidate(vm);
+}
+
+
+/**
+ * qemuDomainBlockStatsCacheInvalidate:
+ * @vm: domain object, must be locked
+ *
+ * Drop the sampled block statistics of @vm because the set of disks or
+ * their images changed.  A refresh which is in flight while this is
+ * called discards its result.
+ */
+void
+qemuDomainBlockStatsCacheInvalidate(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    priv->blockStatsCacheGen++;
+    priv->blockStatsCacheTime = 0;
+    priv->blockStatsCacheCount = 0;
+
+    virHashFree(priv->blockStatsCache);
+    priv->blockStatsCache = NULL;
+    virJSONValueFree(priv->blockNodeDataCache);
+    priv->blockNodeDataCache = NULL;
+}
+
+
+/**
+ * qemuDomainBlockStatsCacheValid:
+ * @driver: qemu driver data
+ * @vm: domain object, must be locked
+ *
+ * Returns true if the sampled block statistics of @vm can be used
+ * instead of querying the monitor.  A sample is considered stale once
+ * it is older than two sampling intervals, e.g. because the refresh
+ * couldn't get the job.
+ */
+bool
+qemuDomainBlockStatsCacheValid(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg;
+    unsigned long long now;
+    bool ret = false;
+
+    if (!priv->blockStatsCache || !virDomainObjIsActive(vm))
+        return false;
+
+    cfg = virQEMUDriverGetConfig(driver);
+
+    if (cfg->blockStatsCacheInterval &&
+        virTimeMillisNow(&now) == 0 &&
+        now - priv->blockStatsCacheTime <=
+        cfg->blockStatsCacheInterval * 2000ULL)
+        ret = true;
+
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+/**
+ * qemuDomainBlockStatsCacheRefresh:
+ * @driver: qemu driver data
+ * @vm: domain object, must be locked and have a job
+ *
+ * Replace the sampled block statistics of @vm by fresh data from the
+ * monitor.  Backing chain members are not sampled.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainBlockStatsCacheRefresh(virQEMUDriverPtr driver,
+                                 virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virHashTablePtr stats = NULL;
+    virJSONValuePtr nodedata = NULL;
+    bool fetchnodedata = virQEMUCapsGet(priv->qemuCaps,
+                                        QEMU_CAPS_QUERY_NAMED_BLOCK_NODES);
+    unsigned int gen = priv->blockStatsCacheGen;
+    unsigned long long now;
+    int nstats;
+    int ret = -1;
+
+    if (!virDomainObjIsActive(vm))
+        return 0;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    nstats = qemuMonitorGetAllBlockStatsInfoBatch(priv->mon, &stats, false,
+                                                  fetchnodedata ? &nodedata :
+                                                  NULL);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || nstats < 0)
+        goto cleanup;
+
+    /* disks changed while the monitor was unlocked */
+    if (gen != priv->blockStatsCacheGen) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    virHashFree(priv->blockStatsCache);
+    virJSONValueFree(priv->blockNodeDataCache);
+    priv->blockStatsCache = stats;
+    priv->blockNodeDataCache = nodedata;
+    priv->blockStatsCacheCount = nstats;
+    priv->blockStatsCacheTime = now;
+    stats = NULL;
+    nodedata = NULL;
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(stats);
+    virJSONValueFree(nodedata);
+    return ret;
+}
+
+
 void
 qemuDomainSetFakeReboot(virQEMUDriverPtr driver,
                         virDomainObjPtr vm,
@@ -5106,6 +6010,29 @@ qemuDomainCheckDiskStartupPolicy(virQEMUDriverPtr driver,
 }
 
 
+/* Whether the backing chain of @disk has to be probed when checking the
+ * presence of disks on domain startup */
+static bool
+qemuDomainDiskNeedsChain(virDomainDiskDefPtr disk)
+{
+    virStorageFileFormat format = virDomainDiskGetFormat(disk);
+
+    if (virStorageSourceIsEmpty(disk->src))
+        return false;
+
+    /* There is no need to check the backing chain for disks
+     * without backing support, the fact that the file exists is
+     * more than enough */
+    if (virStorageSourceIsLocalStorage(disk->src) &&
+        format > VIR_STORAGE_FILE_NONE &&
+        format < VIR_STORAGE_FILE_BACKING &&
+        virFileExists(virDomainDiskGetSource(disk)))
+        return false;
+
+    return true;
+}
+
+
 int
 qemuDomainCheckDiskPresence(virConnectPtr conn,
                             virQEMUDriverPtr driver,
@@ -5119,29 +6046,24 @@ qemuDomainCheckDiskPresence(virConnectPtr conn,
     VIR_DEBUG("Checking for disk presence");
     for (i = vm->def->ndisks; i > 0; i--) {
         size_t idx = i - 1;
-        virDomainDiskDefPtr disk = vm->def->disks[idx];
-        virStorageFileFormat format = virDomainDiskGetFormat(disk);
 
         if (virStorageTranslateDiskSourcePool(conn, vm->def->disks[idx]) < 0) {
             if (pretend ||
                 qemuDomainCheckDiskStartupPolicy(driver, vm, idx, cold_boot) < 0)
                 return -1;
-            continue;
         }
+    }
 
-        if (pretend)
-            continue;
+    if (pretend)
+        return 0;
 
-        if (virStorageSourceIsEmpty(disk->src))
-            continue;
+    qemuDomainPrefetchDiskChains(driver, vm);
 
-        /* There is no need to check the backing chain for disks
-         * without backing support, the fact that the file exists is
-         * more than enough */
-        if (virStorageSourceIsLocalStorage(disk->src) &&
-            format > VIR_STORAGE_FILE_NONE &&
-            format < VIR_STORAGE_FILE_BACKING &&
-            virFileExists(virDomainDiskGetSource(disk)))
+    for (i = vm->def->ndisks; i > 0; i--) {
+        size_t idx = i - 1;
+        virDomainDiskDefPtr disk = vm->def->disks[idx];
+
+        if (!qemuDomainDiskNeedsChain(disk))
             continue;
 
         if (qemuDomainDetermineDiskChain(driver, vm, disk, true, true) >= 0)
@@ -5254,7 +6176,56 @@ qemuDomainGetImageIds(virQEMUDriverConfigPtr cfg,
         virParseOwnershipIds(disklabel->label, uid, gid);
 }
 
-
+
+/**
+ * qemuDomainPrefetchDiskChains:
+ * @driver: qemu driver data
+ * @vm: domain object
+ *
+ * Read the backing chain images of all disks of @vm concurrently ahead of
+ * qemuDomainDetermineDiskChain being called for each of them so that
+ * independent disks, especially ones on network storage, don't have to
+ * wait for each other. Disks which need no backing chain probing are
+ * skipped.
+ */
+void
+qemuDomainPrefetchDiskChains(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    virStorageSourcePtr *srcs = NULL;
+    uid_t *uids = NULL;
+    gid_t *gids = NULL;
+    size_t nsrcs = 0;
+    size_t i;
+
+    if (VIR_ALLOC_N(srcs, vm->def->ndisks) < 0 ||
+        VIR_ALLOC_N(uids, vm->def->ndisks) < 0 ||
+        VIR_ALLOC_N(gids, vm->def->ndisks) < 0) {
+        virResetLastError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < vm->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = vm->def->disks[i];
+
+        if (!qemuDomainDiskNeedsChain(disk))
+            continue;
+
+        qemuDomainGetImageIds(cfg, vm, disk->src, &uids[nsrcs], &gids[nsrcs]);
+        srcs[nsrcs++] = disk->src;
+    }
+
+    virStorageFilePrefetchMetadata(srcs, uids, gids, nsrcs,
+                                   cfg->allowDiskFormatProbing);
+
+ cleanup:
+    VIR_FREE(srcs);
+    VIR_FREE(uids);
+    VIR_FREE(gids);
+    virObjectUnref(cfg);
+}
+
 int
 qemuDomainStorageFileInit(virQEMUDriverPtr driver,
                           virDomainObjPtr vm,
@@ -6330,6 +7301,20 @@ qemuDomainMachineHasBuiltinIDE(const char *machine)
 }
 
 
+/* Updated outside of modify jobs, so the generation has to be bumped
+ * explicitly */
+static void
+qemuDomainSetCurrentMemorySize(virDomainObjPtr vm,
+                               unsigned long long balloon)
+{
+    if (vm->def->mem.cur_balloon == balloon)
+        return;
+
+    vm->def->mem.cur_balloon = balloon;
+    virDomainObjBumpGeneration(vm);
+}
+
+
 /**
  * qemuDomainUpdateCurrentMemorySize:
  *
@@ -6355,7 +7340,7 @@ qemuDomainUpdateCurrentMemorySize(virQEMUDriverPtr driver,
     /* if no balloning is available, the current size equals to the current
      * full memory size */
     if (!virDomainDefHasMemballoon(vm->def)) {
-        vm->def->mem.cur_balloon = virDomainDefGetMemoryTotal(vm->def);
+        qemuDomainSetCurrentMemorySize(vm, virDomainDefGetMemoryTotal(vm->def));
         return 0;
     }
 
@@ -6388,7 +7373,7 @@ qemuDomainUpdateCurrentMemorySize(virQEMUDriverPtr driver,
         if (ret < 0)
             return -1;
 
-        vm->def->mem.cur_balloon = balloon;
+        qemuDomainSetCurrentMemorySize(vm, balloon);
     }
 
     return 0;
@@ -6703,15 +7688,19 @@ qemuDomainRefreshVcpuInfo(virQEMUDriverPtr driver,
     size_t maxvcpus = virDomainDefGetVcpusMax(vm->def);
     size_t i;
     bool hotplug;
+    bool fast;
     int rc;
     int ret = -1;
 
     hotplug = qemuDomainSupportsNewVcpuHotplug(vm);
+    fast = virQEMUCapsGet(QEMU_DOMAIN_PRIVATE(vm)->qemuCaps,
+                          QEMU_CAPS_QUERY_CPUS_FAST);
 
     if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
         return -1;
 
-    rc = qemuMonitorGetCPUInfo(qemuDomainGetMonitor(vm), &info, maxvcpus, hotplug);
+    rc = qemuMonitorGetCPUInfo(qemuDomainGetMonitor(vm), &info, maxvcpus,
+                               hotplug, fast);
 
     if (qemuDomainObjExitMonitor(driver, vm) < 0)
         goto cleanup;
@@ -6804,43 +7793,114 @@ qemuDomainGetVcpuHalted(virDomainObjPtr vm,
  *
  * Updates vCPU halted state in the private data of @vm.
  *
- * Returns 0 on success and -1 on error
+ * Only query-cpus, which interrupts every vCPU, reports the halted state
+ * outside of s390, so it is not refreshed when qemu has query-cpus-fast:
+ * doing so would make collecting statistics visible to the guest.
+ *
+ * Returns 1 if the halted state was refreshed, 0 if it is not available
+ * and -1 on error
  */
 int
 qemuDomainRefreshVcpuHalted(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
                             int asyncJob)
 {
-    virDomainVcpuDefPtr vcpu;
-    qemuDomainVcpuPrivatePtr vcpupriv;
-    size_t maxvcpus = virDomainDefGetVcpusMax(vm->def);
     virBitmapPtr haltedmap = NULL;
-    size_t i;
-    int ret = -1;
+    int rc;
 
+    if (!qemuDomainHasVcpuHalted(vm))
+        return 0;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        return -1;
+
+    rc = qemuDomainRefreshVcpuHaltedMonitor(vm, &haltedmap);
+
+    if (qemuDomainObjExitMonitor(driver, vm) < 0) {
+        virBitmapFree(haltedmap);
+        return -1;
+    }
+
+    if (rc <= 0) {
+        virBitmapFree(haltedmap);
+        return rc;
+    }
+
+    qemuDomainSetVcpuHalted(vm, haltedmap);
+    virBitmapFree(haltedmap);
+    return 1;
+}
+
+/**
+ * qemuDomainHasVcpuHalted:
+ * @vm: domain object
+ *
+ * Returns true if qemuDomainRefreshVcpuHalted would query the monitor
+ * for the halted state of the vCPUs of @vm.
+ */
+bool
+qemuDomainHasVcpuHalted(virDomainObjPtr vm)
+{
     /* Not supported currently for TCG, see qemuDomainRefreshVcpuInfo */
     if (vm->def->virtType == VIR_DOMAIN_VIRT_QEMU)
+        return false;
+
+    if (virQEMUCapsGet(QEMU_DOMAIN_PRIVATE(vm)->qemuCaps,
+                       QEMU_CAPS_QUERY_CPUS_FAST) &&
+        !ARCH_IS_S390(vm->def->os.arch))
+        return false;
+
+    return true;
+}
+
+/**
+ * qemuDomainRefreshVcpuHaltedMonitor:
+ * @vm: domain object, the caller must have entered its monitor
+ * @haltedmap: filled with the bitmap of halted vCPUs
+ *
+ * The monitor part of qemuDomainRefreshVcpuHalted for callers issuing
+ * several queries in one monitor session. Once the monitor is left,
+ * @haltedmap is to be stored by qemuDomainSetVcpuHalted and freed.
+ *
+ * Returns 1 if @haltedmap was filled, 0 if the halted state is not
+ * available and -1 on error
+ */
+int
+qemuDomainRefreshVcpuHaltedMonitor(virDomainObjPtr vm,
+                                   virBitmapPtr *haltedmap)
+{
+    bool fast;
+
+    *haltedmap = NULL;
+
+    if (!qemuDomainHasVcpuHalted(vm))
         return 0;
 
-    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+    fast = virQEMUCapsGet(QEMU_DOMAIN_PRIVATE(vm)->qemuCaps,
+                          QEMU_CAPS_QUERY_CPUS_FAST);
+
+    if (!(*haltedmap = qemuMonitorGetCpuHalted(qemuDomainGetMonitor(vm),
+                                               virDomainDefGetVcpusMax(vm->def),
+                                               fast)))
         return -1;
 
-    haltedmap = qemuMonitorGetCpuHalted(qemuDomainGetMonitor(vm), maxvcpus);
+    return 1;
+}
 
-    if (qemuDomainObjExitMonitor(driver, vm) < 0 || !haltedmap)
-        goto cleanup;
+void
+qemuDomainSetVcpuHalted(virDomainObjPtr vm,
+                        virBitmapPtr haltedmap)
+{
+    virDomainVcpuDefPtr vcpu;
+    qemuDomainVcpuPrivatePtr vcpupriv;
+    size_t maxvcpus = virDomainDefGetVcpusMax(vm->def);
+    size_t i;
 
     for (i = 0; i < maxvcpus; i++) {
         vcpu = virDomainDefGetVcpu(vm->def, i);
         vcpupriv = QEMU_DOMAIN_VCPU_PRIVATE(vcpu);
         vcpupriv->halted = virBitmapIsBitSet(haltedmap, vcpupriv->qemu_id);
     }
-
-    ret = 0;
-
- cleanup:
-    virBitmapFree(haltedmap);
-    return ret;
 }
 
 bool
@@ -6897,6 +7957,69 @@ qemuDomainNetVLAN(virDomainNetDefPtr def)
 }
 
 
+/* Both TAP and macvtap devices support at most this many queues */
+#define QEMU_DOMAIN_NET_QUEUES_MAX 256
+
+/**
+ * qemuDomainNetResolveAutoQueues:
+ * @def: domain definition
+ * @net: network interface definition
+ *
+ * If the interface has queues='auto', replace it by the number of queues
+ * to use, which is the number of guest vCPUs limited by the host CPU count.
+ * Interfaces that do not support multiqueue get a single queue. Once
+ * resolved, the value stays fixed for the lifetime of the device so that
+ * the guest ABI does not change on migration.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainNetResolveAutoQueues(const virDomainDef *def,
+                               virDomainNetDefPtr net)
+{
+    unsigned int queues = 0;
+    int hostcpus;
+
+    if (!net->driver.virtio.queues_auto)
+        return 0;
+
+    switch (virDomainNetGetActualType(net)) {
+    case VIR_DOMAIN_NET_TYPE_NETWORK:
+    case VIR_DOMAIN_NET_TYPE_BRIDGE:
+    case VIR_DOMAIN_NET_TYPE_DIRECT:
+    case VIR_DOMAIN_NET_TYPE_ETHERNET:
+        if (!net->model || STRNEQ(net->model, "virtio"))
+            break;
+
+        if ((hostcpus = virHostCPUGetCount()) < 0)
+            return -1;
+
+        queues = MIN(virDomainDefGetVcpus(def), (unsigned int) hostcpus);
+        queues = MIN(queues, QEMU_DOMAIN_NET_QUEUES_MAX);
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_VHOSTUSER:
+        /* the queues have to match the vhost-user backend */
+    case VIR_DOMAIN_NET_TYPE_USER:
+    case VIR_DOMAIN_NET_TYPE_SERVER:
+    case VIR_DOMAIN_NET_TYPE_CLIENT:
+    case VIR_DOMAIN_NET_TYPE_MCAST:
+    case VIR_DOMAIN_NET_TYPE_INTERNAL:
+    case VIR_DOMAIN_NET_TYPE_HOSTDEV:
+    case VIR_DOMAIN_NET_TYPE_UDP:
+    case VIR_DOMAIN_NET_TYPE_LAST:
+        break;
+    }
+
+    VIR_DEBUG("Using %u queues for interface %s",
+              queues, NULLSTR(net->info.alias));
+
+    net->driver.virtio.queues = queues > 1 ? queues : 0;
+    net->driver.virtio.queues_auto = false;
+    return 0;
+}
+
+
 virDomainDiskDefPtr
 qemuDomainDiskByName(virDomainDefPtr def,
                      const char *name)
@@ -8210,52 +9333,66 @@ qemuDomainNamespaceAvailable(qemuDomainNamespace ns ATTRIBUTE_UNUSED)
 }
 
 
-struct qemuDomainAttachDeviceMknodData {
-    virQEMUDriverPtr driver;
-    virDomainObjPtr vm;
-    const char *file;
-    const char *target;
+struct qemuDomainAttachDeviceMknodItem {
+    char *file;
+    char *target;
     struct stat sb;
     void *acl;
 #ifdef WITH_SELINUX
     char *tcon;
 #endif
+    bool created;
 };
 
 
-static int
-qemuDomainAttachDeviceMknodHelper(pid_t pid ATTRIBUTE_UNUSED,
-                                  void *opaque)
+struct qemuDomainAttachDeviceMknodData {
+    virQEMUDriverPtr driver;
+    virDomainObjPtr vm;
+    struct qemuDomainAttachDeviceMknodItem *items;
+    size_t nitems;
+};
+
+
+static void
+qemuDomainAttachDeviceMknodItemClear(struct qemuDomainAttachDeviceMknodItem *item)
 {
-    struct qemuDomainAttachDeviceMknodData *data = opaque;
-    int ret = -1;
-    bool delDevice = false;
-    bool isLink = S_ISLNK(data->sb.st_mode);
+    VIR_FREE(item->file);
+    VIR_FREE(item->target);
+#ifdef WITH_SELINUX
+    freecon(item->tcon);
+    item->tcon = NULL;
+#endif
+    virFileFreeACLs(&item->acl);
+}
 
-    qemuSecurityPostFork(data->driver->securityManager);
 
-    if (virFileMakeParentPath(data->file) < 0) {
+static int
+qemuDomainAttachDeviceMknodOne(struct qemuDomainAttachDeviceMknodItem *item)
+{
+    bool isLink = S_ISLNK(item->sb.st_mode);
+
+    if (virFileMakeParentPath(item->file) < 0) {
         virReportSystemError(errno,
-                             _("Unable to create %s"), data->file);
-        goto cleanup;
+                             _("Unable to create %s"), item->file);
+        return -1;
     }
 
     if (isLink) {
-        VIR_DEBUG("Creating symlink %s -> %s", data->file, data->target);
-        if (symlink(data->target, data->file) < 0) {
+        VIR_DEBUG("Creating symlink %s -> %s", item->file, item->target);
+        if (symlink(item->target, item->file) < 0) {
             if (errno != EEXIST) {
                 virReportSystemError(errno,
                                      _("Unable to create symlink %s"),
-                                     data->target);
-                goto cleanup;
+                                     item->target);
+                return -1;
             }
         } else {
-            delDevice = true;
+            item->created = true;
         }
     } else {
         VIR_DEBUG("Creating dev %s (%d,%d)",
-                  data->file, major(data->sb.st_rdev), minor(data->sb.st_rdev));
-        if (mknod(data->file, data->sb.st_mode, data->sb.st_rdev) < 0) {
+                  item->file, major(item->sb.st_rdev), minor(item->sb.st_rdev));
+        if (mknod(item->file, item->sb.st_mode, item->sb.st_rdev) < 0) {
             /* Because we are not removing devices on hotunplug, or
              * we might be creating part of backing chain that
              * already exist due to a different disk plugged to
@@ -8263,68 +9400,94 @@ qemuDomainAttachDeviceMknodHelper(pid_t pid ATTRIBUTE_UNUSED,
             if (errno != EEXIST) {
                 virReportSystemError(errno,
                                      _("Unable to create device %s"),
-                                     data->file);
-                goto cleanup;
+                                     item->file);
+                return -1;
             }
         } else {
-            delDevice = true;
+            item->created = true;
         }
     }
 
-    if (lchown(data->file, data->sb.st_uid, data->sb.st_gid) < 0) {
+    if (lchown(item->file, item->sb.st_uid, item->sb.st_gid) < 0) {
         virReportSystemError(errno,
                              _("Failed to chown device %s"),
-                             data->file);
-        goto cleanup;
+                             item->file);
+        return -1;
     }
 
     /* Symlinks don't have ACLs. */
     if (!isLink &&
-        virFileSetACLs(data->file, data->acl) < 0 &&
+        virFileSetACLs(item->file, item->acl) < 0 &&
         errno != ENOTSUP) {
         virReportSystemError(errno,
-                             _("Unable to set ACLs on %s"), data->file);
-        goto cleanup;
+                             _("Unable to set ACLs on %s"), item->file);
+        return -1;
     }
 
 #ifdef WITH_SELINUX
-    if (data->tcon &&
-        lsetfilecon_raw(data->file, (VIR_SELINUX_CTX_CONST char *) data->tcon) < 0) {
+    if (item->tcon &&
+        lsetfilecon_raw(item->file, (VIR_SELINUX_CTX_CONST char *) item->tcon) < 0) {
         VIR_WARNINGS_NO_WLOGICALOP_EQUAL_EXPR
         if (errno != EOPNOTSUPP && errno != ENOTSUP) {
         VIR_WARNINGS_RESET
             virReportSystemError(errno,
                                  _("Unable to set SELinux label on %s"),
-                                 data->file);
-            goto cleanup;
+                                 item->file);
+            return -1;
         }
     }
 #endif
 
+    return 0;
+}
+
+
+static int
+qemuDomainAttachDeviceMknodHelper(pid_t pid ATTRIBUTE_UNUSED,
+                                  void *opaque)
+{
+    struct qemuDomainAttachDeviceMknodData *data = opaque;
+    size_t i;
+    int ret = -1;
+
+    qemuSecurityPostFork(data->driver->securityManager);
+
+    for (i = 0; i < data->nitems; i++) {
+        if (qemuDomainAttachDeviceMknodOne(&data->items[i]) < 0)
+            goto cleanup;
+    }
+
     ret = 0;
  cleanup:
-    if (ret < 0 && delDevice)
-        unlink(data->file);
-#ifdef WITH_SELINUX
-    freecon(data->tcon);
-#endif
-    virFileFreeACLs(&data->acl);
+    if (ret < 0) {
+        for (i = 0; i < data->nitems; i++) {
+            if (data->items[i].created)
+                unlink(data->items[i].file);
+        }
+    }
     return ret;
 }
 
 
+/**
+ * qemuDomainAttachDeviceMknodRecursive:
+ *
+ * Gathers everything needed to create @file (and the files it links to)
+ * in the domain's namespace and appends it to @data. Nothing is created
+ * yet; qemuDomainAttachDeviceMknod does that for all the files at once.
+ */
 static int
-qemuDomainAttachDeviceMknodRecursive(virQEMUDriverPtr driver,
-                                     virDomainObjPtr vm,
-                                     const char *file,
+qemuDomainAttachDeviceMknodRecursive(const char *file,
                                      char * const *devMountsPath,
                                      size_t ndevMountsPath,
-                                     unsigned int ttl)
+                                     unsigned int ttl,
+                                     struct qemuDomainAttachDeviceMknodData *data)
 {
-    struct qemuDomainAttachDeviceMknodData data;
+    struct qemuDomainAttachDeviceMknodItem item;
+    const char *target = NULL;
     int ret = -1;
-    char *target = NULL;
     bool isLink;
+    size_t i;
 
     if (!ttl) {
         virReportSystemError(ELOOP,
@@ -8333,29 +9496,35 @@ qemuDomainAttachDeviceMknodRecursive(virQEMUDriverPtr driver,
         return ret;
     }
 
-    memset(&data, 0, sizeof(data));
+    /* Backing chains of different disks and symlinks often lead to the
+     * same device. */
+    for (i = 0; i < data->nitems; i++) {
+        if (STREQ(data->items[i].file, file))
+            return 0;
+    }
 
-    data.driver = driver;
-    data.vm = vm;
-    data.file = file;
+    memset(&item, 0, sizeof(item));
+
+    if (VIR_STRDUP(item.file, file) < 0)
+        return ret;
 
-    if (lstat(file, &data.sb) < 0) {
+    if (lstat(file, &item.sb) < 0) {
         virReportSystemError(errno,
                              _("Unable to access %s"), file);
-        return ret;
+        goto cleanup;
     }
 
-    isLink = S_ISLNK(data.sb.st_mode);
+    isLink = S_ISLNK(item.sb.st_mode);
 
     if (isLink) {
-        if (virFileReadLink(file, &target) < 0) {
+        if (virFileReadLink(file, &item.target) < 0) {
             virReportSystemError(errno,
                                  _("unable to resolve symlink %s"),
                                  file);
-            return ret;
+            goto cleanup;
         }
 
-        if (IS_RELATIVE_FILE_NAME(target)) {
+        if (IS_RELATIVE_FILE_NAME(item.target)) {
             char *c = NULL, *tmp = NULL, *fileTmp = NULL;
 
             if (VIR_STRDUP(fileTmp, file) < 0)
@@ -8364,22 +9533,22 @@ qemuDomainAttachDeviceMknodRecursive(virQEMUDriverPtr driver,
             if ((c = strrchr(fileTmp, '/')))
                 *(c + 1) = '\0';
 
-            if (virAsprintf(&tmp, "%s%s", fileTmp, target) < 0) {
+            if (virAsprintf(&tmp, "%s%s", fileTmp, item.target) < 0) {
                 VIR_FREE(fileTmp);
                 goto cleanup;
             }
             VIR_FREE(fileTmp);
-            VIR_FREE(target);
-            target = tmp;
+            VIR_FREE(item.target);
+            item.target = tmp;
             tmp = NULL;
         }
 
-        data.target = target;
+        target = item.target;
     }
 
     /* Symlinks don't have ACLs. */
     if (!isLink &&
-        virFileGetACLs(file, &data.acl) < 0 &&
+        virFileGetACLs(file, &item.acl) < 0 &&
         errno != ENOTSUP) {
         virReportSystemError(errno,
                              _("Unable to get ACLs on %s"), file);
@@ -8387,7 +9556,7 @@ qemuDomainAttachDeviceMknodRecursive(virQEMUDriverPtr driver,
     }
 
 #ifdef WITH_SELINUX
-    if (lgetfilecon_raw(file, &data.tcon) < 0 &&
+    if (lgetfilecon_raw(file, &item.tcon) < 0 &&
         (errno != ENOTSUP && errno != ENODATA)) {
         virReportSystemError(errno,
                              _("Unable to get SELinux label from %s"), file);
@@ -8396,8 +9565,6 @@ qemuDomainAttachDeviceMknodRecursive(virQEMUDriverPtr driver,
 #endif
 
     if (STRPREFIX(file, DEVPREFIX)) {
-        size_t i;
-
         for (i = 0; i < ndevMountsPath; i++) {
             if (STREQ(devMountsPath[i], "/dev"))
                 continue;
@@ -8406,16 +9573,9 @@ qemuDomainAttachDeviceMknodRecursive(virQEMUDriverPtr driver,
         }
 
         if (i == ndevMountsPath) {
-            if (qemuSecurityPreFork(driver->securityManager) < 0)
-                goto cleanup;
-
-            if (virProcessRunInMountNamespace(vm->pid,
-                                              qemuDomainAttachDeviceMknodHelper,
-                                              &data) < 0) {
-                qemuSecurityPostFork(driver->securityManager);
+            /* @target stays valid, the string is now owned by @data */
+            if (VIR_APPEND_ELEMENT(data->items, data->nitems, item) < 0)
                 goto cleanup;
-            }
-            qemuSecurityPostFork(driver->securityManager);
         } else {
             VIR_DEBUG("Skipping dev %s because of %s mount point",
                       file, devMountsPath[i]);
@@ -8423,48 +9583,100 @@ qemuDomainAttachDeviceMknodRecursive(virQEMUDriverPtr driver,
     }
 
     if (isLink &&
-        qemuDomainAttachDeviceMknodRecursive(driver, vm, target,
+        qemuDomainAttachDeviceMknodRecursive(target,
                                              devMountsPath, ndevMountsPath,
-                                             ttl -1) < 0)
+                                             ttl - 1, data) < 0)
         goto cleanup;
 
     ret = 0;
  cleanup:
-#ifdef WITH_SELINUX
-    freecon(data.tcon);
-#endif
-    virFileFreeACLs(&data.acl);
-    VIR_FREE(target);
+    qemuDomainAttachDeviceMknodItemClear(&item);
     return ret;
 }
 
 
+/**
+ * qemuDomainAttachDeviceMknod:
+ *
+ * Creates @files in the mount namespace of @vm. All the device nodes and
+ * symlinks are created by a single child process entering the namespace
+ * rather than forking once per file.
+ */
 static int
 qemuDomainAttachDeviceMknod(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
-                            const char *file,
+                            char * const *files,
+                            size_t nfiles,
                             char * const *devMountsPath,
                             size_t ndevMountsPath)
 {
+    struct qemuDomainAttachDeviceMknodData data;
     long symloop_max = sysconf(_SC_SYMLOOP_MAX);
+    size_t i;
+    int ret = -1;
+
+    memset(&data, 0, sizeof(data));
+
+    data.driver = driver;
+    data.vm = vm;
+
+    for (i = 0; i < nfiles; i++) {
+        if (qemuDomainAttachDeviceMknodRecursive(files[i],
+                                                 devMountsPath, ndevMountsPath,
+                                                 symloop_max, &data) < 0)
+            goto cleanup;
+    }
+
+    if (data.nitems == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Creating %zu files in namespace of domain %s",
+              data.nitems, vm->def->name);
+
+    if (qemuSecurityPreFork(driver->securityManager) < 0)
+        goto cleanup;
+
+    if (virProcessRunInMountNamespace(vm->pid,
+                                      qemuDomainAttachDeviceMknodHelper,
+                                      &data) < 0) {
+        qemuSecurityPostFork(driver->securityManager);
+        goto cleanup;
+    }
+    qemuSecurityPostFork(driver->securityManager);
 
-    return qemuDomainAttachDeviceMknodRecursive(driver, vm, file,
-                                                devMountsPath, ndevMountsPath,
-                                                symloop_max);
+    ret = 0;
+ cleanup:
+    for (i = 0; i < data.nitems; i++)
+        qemuDomainAttachDeviceMknodItemClear(&data.items[i]);
+    VIR_FREE(data.items);
+    return ret;
 }
 
 
+struct qemuDomainDetachDeviceUnlinkData {
+    const char **paths;
+    size_t npaths;
+};
+
+
 static int
 qemuDomainDetachDeviceUnlinkHelper(pid_t pid ATTRIBUTE_UNUSED,
                                    void *opaque)
 {
-    const char *path = opaque;
+    struct qemuDomainDetachDeviceUnlinkData *data = opaque;
+    size_t i;
 
-    VIR_DEBUG("Unlinking %s", path);
-    if (unlink(path) < 0 && errno != ENOENT) {
-        virReportSystemError(errno,
-                             _("Unable to remove device %s"), path);
-        return -1;
+    for (i = 0; i < data->npaths; i++) {
+        const char *path = data->paths[i];
+
+        VIR_DEBUG("Unlinking %s", path);
+        if (unlink(path) < 0 && errno != ENOENT) {
+            virReportSystemError(errno,
+                                 _("Unable to remove device %s"), path);
+            return -1;
+        }
     }
 
     return 0;
@@ -8474,31 +9686,44 @@ qemuDomainDetachDeviceUnlinkHelper(pid_t pid ATTRIBUTE_UNUSED,
 static int
 qemuDomainDetachDeviceUnlink(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                              virDomainObjPtr vm,
-                             const char *file,
+                             char * const *files,
+                             size_t nfiles,
                              char * const *devMountsPath,
                              size_t ndevMountsPath)
 {
+    struct qemuDomainDetachDeviceUnlinkData data = { NULL, 0 };
     int ret = -1;
-    size_t i;
+    size_t i, j;
 
-    if (STRPREFIX(file, DEVPREFIX)) {
-        for (i = 0; i < ndevMountsPath; i++) {
-            if (STREQ(devMountsPath[i], "/dev"))
+    if (VIR_ALLOC_N(data.paths, nfiles) < 0)
+        return -1;
+
+    for (i = 0; i < nfiles; i++) {
+        const char *file = files[i];
+
+        if (!STRPREFIX(file, DEVPREFIX))
+            continue;
+
+        for (j = 0; j < ndevMountsPath; j++) {
+            if (STREQ(devMountsPath[j], "/dev"))
                 continue;
-            if (STRPREFIX(file, devMountsPath[i]))
+            if (STRPREFIX(file, devMountsPath[j]))
                 break;
         }
 
-        if (i == ndevMountsPath) {
-            if (virProcessRunInMountNamespace(vm->pid,
-                                              qemuDomainDetachDeviceUnlinkHelper,
-                                              (void *)file) < 0)
-                goto cleanup;
-        }
+        if (j == ndevMountsPath)
+            data.paths[data.npaths++] = file;
     }
 
+    if (data.npaths &&
+        virProcessRunInMountNamespace(vm->pid,
+                                      qemuDomainDetachDeviceUnlinkHelper,
+                                      &data) < 0)
+        goto cleanup;
+
     ret = 0;
  cleanup:
+    VIR_FREE(data.paths);
     return ret;
 }
 
@@ -8512,6 +9737,8 @@ qemuDomainNamespaceSetupDisk(virQEMUDriverPtr driver,
     char **devMountsPath = NULL;
     size_t ndevMountsPath = 0;
     virStorageSourcePtr next;
+    char **paths = NULL;
+    size_t npaths = 0;
     struct stat sb;
     int ret = -1;
 
@@ -8540,15 +9767,17 @@ qemuDomainNamespaceSetupDisk(virQEMUDriverPtr driver,
         if (!S_ISBLK(sb.st_mode))
             continue;
 
-        if (qemuDomainAttachDeviceMknod(driver,
-                                        vm,
-                                        next->path,
-                                        devMountsPath, ndevMountsPath) < 0)
+        if (VIR_APPEND_ELEMENT_COPY(paths, npaths, next->path) < 0)
             goto cleanup;
     }
 
+    if (qemuDomainAttachDeviceMknod(driver, vm, paths, npaths,
+                                    devMountsPath, ndevMountsPath) < 0)
+        goto cleanup;
+
     ret = 0;
  cleanup:
+    VIR_FREE(paths);
     virStringListFreeCount(devMountsPath, ndevMountsPath);
     virObjectUnref(cfg);
     return ret;
@@ -8594,13 +9823,9 @@ qemuDomainNamespaceSetupHostdev(virQEMUDriverPtr driver,
                                      &ndevMountsPath) < 0)
         goto cleanup;
 
-    for (i = 0; i < npaths; i++) {
-        if (qemuDomainAttachDeviceMknod(driver,
-                                        vm,
-                                        path[i],
-                                        devMountsPath, ndevMountsPath) < 0)
+    if (qemuDomainAttachDeviceMknod(driver, vm, path, npaths,
+                                    devMountsPath, ndevMountsPath) < 0)
         goto cleanup;
-    }
 
     ret = 0;
  cleanup:
@@ -8638,11 +9863,9 @@ qemuDomainNamespaceTeardownHostdev(virQEMUDriverPtr driver,
                                      &ndevMountsPath) < 0)
         goto cleanup;
 
-    for (i = 0; i < npaths; i++) {
-        if (qemuDomainDetachDeviceUnlink(driver, vm, path[i],
-                                         devMountsPath, ndevMountsPath) < 0)
-            goto cleanup;
-    }
+    if (qemuDomainDetachDeviceUnlink(driver, vm, path, npaths,
+                                     devMountsPath, ndevMountsPath) < 0)
+        goto cleanup;
 
     ret = 0;
  cleanup:
@@ -8677,7 +9900,7 @@ qemuDomainNamespaceSetupMemory(virQEMUDriverPtr driver,
                                      &ndevMountsPath) < 0)
         goto cleanup;
 
-    if (qemuDomainAttachDeviceMknod(driver, vm, mem->nvdimmPath,
+    if (qemuDomainAttachDeviceMknod(driver, vm, &mem->nvdimmPath, 1,
                                     devMountsPath, ndevMountsPath) < 0)
         goto cleanup;
     ret = 0;
@@ -8710,7 +9933,7 @@ qemuDomainNamespaceTeardownMemory(virQEMUDriverPtr driver,
                                      &ndevMountsPath) < 0)
         goto cleanup;
 
-    if (qemuDomainDetachDeviceUnlink(driver, vm, mem->nvdimmPath,
+    if (qemuDomainDetachDeviceUnlink(driver, vm, &mem->nvdimmPath, 1,
                                      devMountsPath, ndevMountsPath) < 0)
         goto cleanup;
     ret = 0;
@@ -8729,7 +9952,7 @@ qemuDomainNamespaceSetupChardev(virQEMUDriverPtr driver,
     virQEMUDriverConfigPtr cfg = NULL;
     char **devMountsPath = NULL;
     size_t ndevMountsPath = 0;
-    const char *path;
+    char *path;
     int ret = -1;
 
     if (!qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT))
@@ -8746,9 +9969,7 @@ qemuDomainNamespaceSetupChardev(virQEMUDriverPtr driver,
                                      &ndevMountsPath) < 0)
         goto cleanup;
 
-    if (qemuDomainAttachDeviceMknod(driver,
-                                    vm,
-                                    path,
+    if (qemuDomainAttachDeviceMknod(driver, vm, &path, 1,
                                     devMountsPath, ndevMountsPath) < 0)
         goto cleanup;
     ret = 0;
@@ -8768,7 +9989,7 @@ qemuDomainNamespaceTeardownChardev(virQEMUDriverPtr driver,
     char **devMountsPath = NULL;
     size_t ndevMountsPath = 0;
     int ret = -1;
-    const char *path = NULL;
+    char *path = NULL;
 
     if (!qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT))
         return 0;
@@ -8784,7 +10005,7 @@ qemuDomainNamespaceTeardownChardev(virQEMUDriverPtr driver,
                                      &ndevMountsPath) < 0)
         goto cleanup;
 
-    if (qemuDomainDetachDeviceUnlink(driver, vm, path,
+    if (qemuDomainDetachDeviceUnlink(driver, vm, &path, 1,
                                      devMountsPath, ndevMountsPath) < 0)
         goto cleanup;
 
@@ -8804,7 +10025,7 @@ qemuDomainNamespaceSetupRNG(virQEMUDriverPtr driver,
     virQEMUDriverConfigPtr cfg = NULL;
     char **devMountsPath = NULL;
     size_t ndevMountsPath = 0;
-    const char *path = NULL;
+    char *path = NULL;
     int ret = -1;
 
     if (!qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT))
@@ -8827,9 +10048,7 @@ qemuDomainNamespaceSetupRNG(virQEMUDriverPtr driver,
                                      &ndevMountsPath) < 0)
         goto cleanup;
 
-    if (qemuDomainAttachDeviceMknod(driver,
-                                    vm,
-                                    path,
+    if (qemuDomainAttachDeviceMknod(driver, vm, &path, 1,
                                     devMountsPath, ndevMountsPath) < 0)
         goto cleanup;
     ret = 0;
@@ -8849,7 +10068,7 @@ qemuDomainNamespaceTeardownRNG(virQEMUDriverPtr driver,
     char **devMountsPath = NULL;
     size_t ndevMountsPath = 0;
     int ret = -1;
-    const char *path = NULL;
+    char *path = NULL;
 
     if (!qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT))
         return 0;
@@ -8871,7 +10090,7 @@ qemuDomainNamespaceTeardownRNG(virQEMUDriverPtr driver,
                                      &ndevMountsPath) < 0)
         goto cleanup;
 
-    if (qemuDomainDetachDeviceUnlink(driver, vm, path,
+    if (qemuDomainDetachDeviceUnlink(driver, vm, &path, 1,
                                      devMountsPath, ndevMountsPath) < 0)
         goto cleanup;
 
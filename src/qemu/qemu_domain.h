@@ -62,7 +62,8 @@
     (JOB_MASK(QEMU_JOB_DESTROY) |       \
      JOB_MASK(QEMU_JOB_ASYNC))
 
-/* Only 1 job is allowed at any time
+/* Only 1 job is allowed at any time, except for QEMU_JOB_QUERY which may
+ * be held by several threads at once as it doesn't change any state.
  * A job includes *all* monitor commands, even those just querying
  * information, not merely actions */
 typedef enum {
@@ -119,16 +120,36 @@ struct _qemuDomainJobInfo {
                             source and the beginning of Finish phase on the
                             destination. */
     bool timeDeltaSet;
+    int parallelConnections; /* Number of connections used by parallel
+                                migration, 0 if not used */
+    unsigned int queuePosition; /* Position in the migration queue, 0 if the
+                                   migration is not waiting for a slot */
+    unsigned long long queueTimeRemaining; /* Estimated time until the
+                                              migration leaves the queue */
     /* Raw values from QEMU */
     qemuMonitorMigrationStats stats;
 };
 
+typedef struct _qemuDomainJobWaitStats qemuDomainJobWaitStats;
+typedef qemuDomainJobWaitStats *qemuDomainJobWaitStatsPtr;
+struct _qemuDomainJobWaitStats {
+    unsigned long long calls;       /* Jobs which were started */
+    unsigned long long failures;    /* Jobs which timed out or were refused */
+    unsigned long long time;        /* Total time (ms) spent waiting */
+    unsigned long long timeMax;     /* Longest time (ms) spent waiting */
+    unsigned long long histogram[QEMU_MONITOR_LATENCY_BUCKETS];
+};
+
 struct qemuDomainJobObj {
     virCond cond;                       /* Use to coordinate jobs */
     qemuDomainJob active;               /* Currently running job */
     unsigned long long owner;           /* Thread id which set current job */
     const char *ownerAPI;               /* The API which owns the job */
     unsigned long long started;         /* When the current job started */
+    unsigned int nqueries;              /* Threads sharing a QEMU_JOB_QUERY */
+    unsigned int nwaiters;              /* Threads waiting for an exclusive
+                                         * job, which keep new queries from
+                                         * joining the running ones */
 
     virCond asyncCond;                  /* Use to coordinate with async jobs */
     qemuDomainAsyncJob asyncJob;        /* Currently active async job */
@@ -145,6 +166,9 @@ struct qemuDomainJobObj {
                                          * should wait for it to finish */
     bool spiceMigrated;                 /* spice migration completed */
     bool postcopyEnabled;               /* post-copy migration was enabled */
+
+    /* Time spent waiting for each job type */
+    qemuDomainJobWaitStats waitStats[QEMU_JOB_LAST];
 };
 
 typedef void (*qemuDomainCleanupCallback)(virQEMUDriverPtr driver,
@@ -167,6 +191,15 @@ struct _qemuDomainUnpluggingDevice {
     qemuDomainUnpluggingDeviceStatus status;
 };
 
+typedef enum {
+    /* wait for each device to be released by the guest */
+    QEMU_DOMAIN_UNPLUG_WAIT = 0,
+    /* collect the devices for qemuDomainWaitForDeviceRemovals() */
+    QEMU_DOMAIN_UNPLUG_DEFER,
+    /* don't wait, the DEVICE_DELETED handler finishes the removal */
+    QEMU_DOMAIN_UNPLUG_ASYNC,
+} qemuDomainUnplugMode;
+
 
 typedef enum {
     QEMU_DOMAIN_NS_MOUNT = 0,
@@ -177,6 +210,23 @@ VIR_ENUM_DECL(qemuDomainNamespace)
 bool qemuDomainNamespaceEnabled(virDomainObjPtr vm,
                                 qemuDomainNamespace ns);
 
+/* Phases of starting a domain, in the order they are run */
+typedef enum {
+    QEMU_DOMAIN_START_PHASE_PREPARE_DOMAIN = 0,
+    QEMU_DOMAIN_START_PHASE_PREPARE_HOST,
+    QEMU_DOMAIN_START_PHASE_COMMAND_LINE,
+    QEMU_DOMAIN_START_PHASE_SPAWN,
+    QEMU_DOMAIN_START_PHASE_CGROUP,
+    QEMU_DOMAIN_START_PHASE_SECURITY,
+    QEMU_DOMAIN_START_PHASE_MONITOR,
+    QEMU_DOMAIN_START_PHASE_SETUP,
+    QEMU_DOMAIN_START_PHASE_REFRESH,
+    QEMU_DOMAIN_START_PHASE_FINISH,
+
+    QEMU_DOMAIN_START_PHASE_LAST
+} qemuDomainStartPhase;
+VIR_ENUM_DECL(qemuDomainStartPhase)
+
 /* Type of domain secret */
 typedef enum {
     VIR_DOMAIN_SECRET_INFO_TYPE_PLAIN = 0,
@@ -214,6 +264,19 @@ struct _qemuDomainSecretInfo {
     } s;
 };
 
+/* XML descriptions formatted by qemuDomainFormatXML, valid as long as
+ * the generation of the domain object does not change */
+# define QEMU_DOMAIN_XML_CACHE_SIZE 4
+
+typedef struct _qemuDomainXMLCacheEntry qemuDomainXMLCacheEntry;
+typedef qemuDomainXMLCacheEntry *qemuDomainXMLCacheEntryPtr;
+struct _qemuDomainXMLCacheEntry {
+    char *xml;
+    virDomainDefPtr def;
+    unsigned int flags;
+    unsigned long long generation;
+};
+
 typedef struct _qemuDomainObjPrivate qemuDomainObjPrivate;
 typedef qemuDomainObjPrivate *qemuDomainObjPrivatePtr;
 struct _qemuDomainObjPrivate {
@@ -246,6 +309,13 @@ struct _qemuDomainObjPrivate {
 
     unsigned long migMaxBandwidth;
     char *origname;
+    /* Incoming domain definition and its digest kept from Prepare in case
+     * the source does not send the persistent definition in full */
+    virDomainDefPtr migPersistentDef;
+    char *migPersistentDigest;
+    /* Async job whose migration slot is held in the scheduler, if any */
+    qemuDomainAsyncJob migrationSlot;
+    unsigned long long migrationSlotStarted;
     int nbdPort; /* Port used for migration with NBD */
     unsigned short migrationPort;
     int preMigrationState;
@@ -261,6 +331,9 @@ struct _qemuDomainObjPrivate {
     virPerfPtr perf;
 
     qemuDomainUnpluggingDevice unplug;
+    qemuDomainUnplugMode unplugMode;
+    qemuDomainUnpluggingDevicePtr unplugDeferred;
+    size_t nunplugDeferred;
 
     char **qemuDevices; /* NULL-terminated list of devices aliases known to QEMU */
 
@@ -270,11 +343,18 @@ struct _qemuDomainObjPrivate {
     virBitmapPtr autoNodeset;
     virBitmapPtr autoCpuset;
 
+    /* Host NUMA nodes the vCPUs of the domain are accounted to in the
+     * driver's numaLoad, and how many on each of them */
+    virBitmapPtr placementNodes;
+    unsigned int placementShare;
+
     bool signalIOError; /* true if the domain condition should be signalled on
                            I/O error */
     bool signalStop; /* true if the domain condition should be signalled on
                         QMP STOP event */
     char *machineName;
+    /* Registration with systemd-machined still in progress */
+    virSystemdMachineRequestPtr machineRequest;
     char *libDir;            /* base path for per-domain files */
     char *channelTargetDir;  /* base path for per-domain channel targets */
 
@@ -293,6 +373,38 @@ struct _qemuDomainObjPrivate {
     /* Used when fetching/storing the current 'tls-creds' migration setting */
     /* (not to be saved in our private XML). */
     char *migTLSAlias;
+
+    /* Status XML changes not yet written to disk and the timer which
+     * flushes them, see qemuDomainSaveStatusLazy */
+    bool statusDirty;
+    int statusSaveTimer;
+
+    /* Block stats sampled in the background every
+     * block_stats_cache_interval seconds, see
+     * qemuDomainBlockStatsCacheRefresh */
+    virHashTablePtr blockStatsCache;
+    virJSONValuePtr blockNodeDataCache;
+    int blockStatsCacheCount;
+    unsigned long long blockStatsCacheTime;
+    unsigned int blockStatsCacheGen;
+    int blockStatsCacheTimer;
+    bool blockStatsCacheRefreshing;
+
+    /* Time in milliseconds spent in each phase of the last start of
+     * the domain, see qemuProcessStartPhaseDone */
+    unsigned long long startPhases[QEMU_DOMAIN_START_PHASE_LAST];
+    unsigned long long startPhaseStamp;
+    bool startTimed;
+
+    /* Records in the snapshot metadata log, and whether it holds
+     * snapshots which failed to load and must not be compacted away,
+     * see qemuDomainSnapshotWriteMetadata */
+    size_t nsnapshotLogRecords;
+    bool snapshotLogIncomplete;
+
+    /* Recently formatted XML descriptions, see qemuDomainFormatXML */
+    qemuDomainXMLCacheEntry xmlCache[QEMU_DOMAIN_XML_CACHE_SIZE];
+    size_t xmlCacheNext;
 };
 
 # define QEMU_DOMAIN_PRIVATE(vm)	\
@@ -301,6 +413,14 @@ struct _qemuDomainObjPrivate {
 # define QEMU_DOMAIN_DISK_PRIVATE(disk)	\
     ((qemuDomainDiskPrivatePtr) (disk)->privateData)
 
+typedef enum {
+    QEMU_BLOCKJOB_STATE_UNKNOWN = 0, /* qemu has to be asked */
+    QEMU_BLOCKJOB_STATE_NONE, /* there's no job on the disk */
+    QEMU_BLOCKJOB_STATE_RUNNING, /* the progress is only known to qemu */
+    QEMU_BLOCKJOB_STATE_READY, /* the mirror is in sync, nothing changes
+                                  until the job is ended */
+} qemuBlockJobState;
+
 typedef struct _qemuDomainDiskPrivate qemuDomainDiskPrivate;
 typedef qemuDomainDiskPrivate *qemuDomainDiskPrivatePtr;
 struct _qemuDomainDiskPrivate {
@@ -316,8 +436,17 @@ struct _qemuDomainDiskPrivate {
     int blockJobStatus; /* status of the finished block job */
     bool blockJobSync; /* the block job needs synchronized termination */
 
+    /* block job state tracked from the events, so that it can often be
+     * reported without a query-block-jobs round trip */
+    qemuBlockJobState blockJobState;
+    qemuMonitorBlockJobInfo blockJobInfo; /* valid in the READY state */
+
     bool migrating; /* the disk is being migrated */
 
+    /* allocation reported by the last write threshold event of a disk
+     * with a watermark, used to arm the next one */
+    unsigned long long watermarkAllocation;
+
     /* for storage devices using auth/secret
      * NB: *not* to be written to qemu domain object XML */
     qemuDomainSecretInfoPtr secinfo;
@@ -401,6 +530,8 @@ typedef enum {
     QEMU_PROCESS_EVENT_SERIAL_CHANGED,
     QEMU_PROCESS_EVENT_BLOCK_JOB,
     QEMU_PROCESS_EVENT_MONITOR_EOF,
+    QEMU_PROCESS_EVENT_BLOCK_STATS,
+    QEMU_PROCESS_EVENT_BLOCK_THRESHOLD,
 
     QEMU_PROCESS_EVENT_LAST
 } qemuProcessEventType;
@@ -432,6 +563,11 @@ int qemuDomainObjBeginJob(virQEMUDriverPtr driver,
                           virDomainObjPtr obj,
                           qemuDomainJob job)
     ATTRIBUTE_RETURN_CHECK;
+int qemuDomainObjBeginJobWithTimeout(virQEMUDriverPtr driver,
+                                     virDomainObjPtr obj,
+                                     qemuDomainJob job,
+                                     unsigned long long timeout)
+    ATTRIBUTE_RETURN_CHECK;
 int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
                                virDomainObjPtr obj,
                                qemuDomainAsyncJob asyncJob,
@@ -552,10 +688,26 @@ int qemuDomainLogAppendMessage(virQEMUDriverPtr driver,
 
 const char *qemuFindQemuImgBinary(virQEMUDriverPtr driver);
 
+/* Per-domain file holding the metadata of all its snapshots */
+# define QEMU_DOMAIN_SNAPSHOT_LOG "snapshots.log"
+/* Records beyond twice the number of snapshots before the log is
+ * compacted */
+# define QEMU_DOMAIN_SNAPSHOT_LOG_SLACK 64
+
+ssize_t qemuDomainSnapshotLogParse(char *content,
+                                   size_t len,
+                                   const char *path,
+                                   virHashTablePtr records,
+                                   size_t *goodLen);
 int qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
                                     virDomainSnapshotObjPtr snapshot,
                                     virCapsPtr caps,
                                     char *snapshotDir);
+int qemuDomainSnapshotCompactLog(virDomainObjPtr vm,
+                                 virCapsPtr caps,
+                                 const char *snapshotDir);
+int qemuDomainSnapshotParseDomain(virQEMUDriverPtr driver,
+                                  virDomainSnapshotObjPtr snap);
 
 int qemuDomainSnapshotForEachQcow2(virQEMUDriverPtr driver,
                                    virDomainObjPtr vm,
@@ -589,10 +741,27 @@ int qemuDomainSnapshotDiscardAllMetadata(virQEMUDriverPtr driver,
 void qemuDomainRemoveInactive(virQEMUDriverPtr driver,
                               virDomainObjPtr vm);
 
+void qemuDomainSaveStatusLazy(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm);
+void qemuDomainSaveStatusFlush(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm);
+
+void qemuDomainBlockStatsCacheStart(virQEMUDriverPtr driver,
+                                    virDomainObjPtr vm);
+void qemuDomainBlockStatsCacheStop(virDomainObjPtr vm);
+void qemuDomainBlockStatsCacheInvalidate(virDomainObjPtr vm);
+bool qemuDomainBlockStatsCacheValid(virQEMUDriverPtr driver,
+                                    virDomainObjPtr vm);
+int qemuDomainBlockStatsCacheRefresh(virQEMUDriverPtr driver,
+                                     virDomainObjPtr vm);
+
 void qemuDomainSetFakeReboot(virQEMUDriverPtr driver,
                              virDomainObjPtr vm,
                              bool value);
 
+void qemuDomainObjGetJobWaitStats(virDomainObjPtr obj,
+                                  qemuDomainJobWaitStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 bool qemuDomainJobAllowed(qemuDomainObjPrivatePtr priv,
                           qemuDomainJob job);
 
@@ -601,6 +770,9 @@ int qemuDomainCheckDiskPresence(virConnectPtr conn,
                                 virDomainObjPtr vm,
                                 unsigned int flags);
 
+void qemuDomainPrefetchDiskChains(virQEMUDriverPtr driver,
+                                  virDomainObjPtr vm);
+
 int qemuDomainDetermineDiskChain(virQEMUDriverPtr driver,
                                  virDomainObjPtr vm,
                                  virDomainDiskDefPtr disk,
@@ -719,6 +891,11 @@ bool qemuDomainGetVcpuHalted(virDomainObjPtr vm, unsigned int vcpu);
 int qemuDomainRefreshVcpuHalted(virQEMUDriverPtr driver,
                                 virDomainObjPtr vm,
                                 int asyncJob);
+bool qemuDomainHasVcpuHalted(virDomainObjPtr vm);
+int qemuDomainRefreshVcpuHaltedMonitor(virDomainObjPtr vm,
+                                       virBitmapPtr *haltedmap);
+void qemuDomainSetVcpuHalted(virDomainObjPtr vm,
+                             virBitmapPtr haltedmap);
 
 bool qemuDomainSupportsNicdev(virDomainDefPtr def,
                               virDomainNetDefPtr net);
@@ -731,6 +908,9 @@ bool qemuDomainNetSupportsMTU(virDomainNetType type);
 
 int qemuDomainNetVLAN(virDomainNetDefPtr def);
 
+int qemuDomainNetResolveAutoQueues(const virDomainDef *def,
+                                   virDomainNetDefPtr net);
+
 int qemuDomainSetPrivatePaths(virQEMUDriverPtr driver,
                               virDomainObjPtr vm);
 
@@ -41,6 +41,7 @@
 #include <sys/ioctl.h>
 #include <sys/un.h>
 #include <byteswap.h>
+#include <fnmatch.h>
 
 
 #include "qemu_driver.h"
@@ -89,6 +90,8 @@
 #include "virfdstream.h"
 #include "configmake.h"
 #include "virthreadpool.h"
+#include "virthreadjob.h"
+#include "viratomic.h"
 #include "locking/lock_manager.h"
 #include "locking/domain_lock.h"
 #include "virkeycode.h"
@@ -132,6 +135,9 @@ VIR_LOG_INIT("qemu.qemu_driver");
 
 #define QEMU_GUEST_VCPU_MAX_ID 4096
 
+/* QEMU refuses dirty rate calculations longer than a minute */
+#define QEMU_DOMAIN_DIRTYRATE_CALC_MAX 60
+
 #define QEMU_NB_BLKIO_PARAM  6
 
 #define QEMU_NB_BANDWIDTH_PARAM 7
@@ -140,6 +146,11 @@ static void qemuProcessEventHandler(void *data, void *opaque);
 
 static int qemuStateCleanup(void);
 
+static int qemuStatsSamplerInit(virQEMUDriverPtr driver);
+static void qemuStatsSamplerFree(virQEMUDriverPtr driver);
+
+static void qemuConnectGetAllDomainStatsJob(void *jobdata, void *opaque);
+
 static int qemuDomainObjStart(virConnectPtr conn,
                               virQEMUDriverPtr driver,
                               virDomainObjPtr vm,
@@ -185,6 +196,16 @@ static virNWFilterCallbackDriver qemuCallbackDriver = {
 struct qemuAutostartData {
     virQEMUDriverPtr driver;
     virConnectPtr conn;
+
+    virMutex lock;
+    virCond cond; /* signalled whenever a domain finished starting */
+    virDomainObjPtr *vms; /* sorted by group */
+    size_t *groups; /* auto_start_groups index of each of @vms */
+    size_t nvms;
+    size_t next; /* index of the next domain to start */
+    size_t group; /* group currently being started */
+    size_t running; /* domains being started right now */
+    unsigned int ioPressure; /* auto_start_io_pressure */
 };
 
 
@@ -258,6 +279,8 @@ qemuAutostartDomain(virDomainObjPtr vm,
     struct qemuAutostartData *data = opaque;
     int flags = 0;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(data->driver);
+    unsigned long long then = 0;
+    unsigned long long now = 0;
     int ret = -1;
 
     if (cfg->autoStartBypassCache)
@@ -276,11 +299,16 @@ qemuAutostartDomain(virDomainObjPtr vm,
             goto cleanup;
         }
 
+        ignore_value(virTimeMillisNow(&then));
         if (qemuDomainObjStart(data->conn, data->driver, vm, flags,
                                QEMU_ASYNC_JOB_START) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("Failed to autostart VM '%s': %s"),
                            vm->def->name, virGetLastErrorMessage());
+        } else {
+            ignore_value(virTimeMillisNow(&now));
+            VIR_INFO("Autostarted VM '%s' in %llu ms",
+                     vm->def->name, now - then);
         }
 
         qemuProcessEndJob(data->driver, vm);
@@ -294,6 +322,162 @@ qemuAutostartDomain(virDomainObjPtr vm,
 }
 
 
+/*
+ * Returns the share of the last 10 seconds in percent some task of the
+ * host waited for I/O, or -1 if the kernel doesn't report it.
+ */
+static double
+qemuAutostartGetIOPressure(void)
+{
+    char *buf = NULL;
+    char *tmp;
+    char *end;
+    double ret = -1;
+
+    if (virFileReadAllQuiet("/proc/pressure/io", 1024, &buf) < 0)
+        return -1;
+
+    if (!(tmp = STRSKIP(buf, "some avg10=")) ||
+        virStrToDouble(tmp, &end, &ret) < 0)
+        ret = -1;
+
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+/*
+ * Returns the index of the first of @groups listing the domain @name,
+ * or the count of @groups if none does.
+ */
+static size_t
+qemuAutostartGetGroup(char **groups,
+                      const char *name)
+{
+    char **patterns;
+    size_t npatterns;
+    size_t i;
+    size_t j;
+    bool found;
+
+    for (i = 0; groups && groups[i]; i++) {
+        if (!(patterns = virStringSplitCount(groups[i], ",", 0, &npatterns))) {
+            virResetLastError();
+            continue;
+        }
+
+        found = false;
+        for (j = 0; j < npatterns && !found; j++)
+            found = fnmatch(patterns[j], name, 0) == 0;
+
+        virStringListFree(patterns);
+        if (found)
+            break;
+    }
+
+    return i;
+}
+
+
+/*
+ * Order @data->vms by their auto_start_groups entry, keeping the order
+ * of the domains within a group.
+ */
+static int
+qemuAutostartSortGroups(struct qemuAutostartData *data,
+                        char **groups)
+{
+    virDomainObjPtr *vms = NULL;
+    size_t *vmgroups = NULL;
+    size_t ngroups = virStringListLength((const char * const *) groups);
+    size_t g;
+    size_t i;
+    size_t n = 0;
+
+    if (VIR_ALLOC_N(data->groups, data->nvms) < 0)
+        return -1;
+
+    if (ngroups == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(vms, data->nvms) < 0 ||
+        VIR_ALLOC_N(vmgroups, data->nvms) < 0) {
+        VIR_FREE(vms);
+        return -1;
+    }
+
+    for (i = 0; i < data->nvms; i++) {
+        virObjectLock(data->vms[i]);
+        vmgroups[i] = qemuAutostartGetGroup(groups, data->vms[i]->def->name);
+        virObjectUnlock(data->vms[i]);
+    }
+
+    for (g = 0; g <= ngroups; g++) {
+        for (i = 0; i < data->nvms; i++) {
+            if (vmgroups[i] != g)
+                continue;
+            vms[n] = data->vms[i];
+            data->groups[n++] = g;
+        }
+    }
+
+    VIR_FREE(data->vms);
+    data->vms = vms;
+    VIR_FREE(vmgroups);
+    return 0;
+}
+
+
+/*
+ * Runs in each of the auto_start_parallel threads. The domains of one
+ * auto_start_groups entry are only started once all the domains of the
+ * groups before it are done. While the host is short on I/O, no domain
+ * is started unless nothing else is being started.
+ */
+static void
+qemuAutostartWorker(void *opaque)
+{
+    struct qemuAutostartData *data = opaque;
+    virDomainObjPtr vm;
+    unsigned long long now;
+    double pressure;
+
+    virMutexLock(&data->lock);
+    while (data->next < data->nvms) {
+        if (data->groups[data->next] != data->group) {
+            if (data->running > 0) {
+                ignore_value(virCondWait(&data->cond, &data->lock));
+                continue;
+            }
+            data->group = data->groups[data->next];
+            VIR_INFO("Autostarting VMs of group %zu", data->group);
+        }
+
+        if (data->ioPressure && data->running > 0 &&
+            (pressure = qemuAutostartGetIOPressure()) > data->ioPressure) {
+            VIR_DEBUG("I/O pressure %.2f%% above %u%%, "
+                      "delaying autostart", pressure, data->ioPressure);
+            /* re-check the pressure at least every second */
+            if (virTimeMillisNow(&now) < 0 ||
+                virCondWaitUntil(&data->cond, &data->lock, now + 1000) < 0)
+                virResetLastError();
+            continue;
+        }
+
+        vm = data->vms[data->next++];
+        data->running++;
+        virMutexUnlock(&data->lock);
+
+        ignore_value(qemuAutostartDomain(vm, data));
+
+        virMutexLock(&data->lock);
+        data->running--;
+        virCondBroadcast(&data->cond);
+    }
+    virMutexUnlock(&data->lock);
+}
+
+
 static void
 qemuAutostartDomains(virQEMUDriverPtr driver)
 {
@@ -305,10 +489,74 @@ qemuAutostartDomains(virQEMUDriverPtr driver)
      */
     virConnectPtr conn = virConnectOpen(cfg->uri);
     /* Ignoring NULL conn which is mostly harmless here */
-    struct qemuAutostartData data = { driver, conn };
+    struct qemuAutostartData data = { .driver = driver, .conn = conn };
+    virThreadPtr threads = NULL;
+    size_t nthreads = 0;
+    unsigned long long then = 0;
+    unsigned long long now = 0;
+    size_t i;
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize mutex"));
+        goto cleanup;
+    }
+    if (virCondInit(&data.cond) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize condition"));
+        virMutexDestroy(&data.lock);
+        goto cleanup;
+    }
+
+    if (virDomainObjListCollect(driver->domains, NULL, &data.vms, &data.nvms,
+                                NULL, VIR_CONNECT_LIST_DOMAINS_AUTOSTART) < 0)
+        goto destroy;
+
+    if (!data.nvms)
+        goto destroy;
+
+    if (qemuAutostartSortGroups(&data, cfg->autoStartGroups) < 0)
+        goto destroy;
+
+    data.ioPressure = cfg->autoStartIOPressure;
+    if (data.ioPressure && qemuAutostartGetIOPressure() < 0) {
+        VIR_WARN("Host does not report I/O pressure, "
+                 "ignoring auto_start_io_pressure");
+        data.ioPressure = 0;
+    }
+
+    ignore_value(virTimeMillisNow(&then));
+
+    /* The calling thread works through the domains too, so only
+     * the additional threads need to be created */
+    nthreads = MIN(cfg->autoStartParallel, data.nvms);
+    if (nthreads > 1 && VIR_ALLOC_N(threads, nthreads - 1) < 0)
+        nthreads = 1;
+
+    for (i = 0; i + 1 < nthreads; i++) {
+        if (virThreadCreate(&threads[i], true,
+                            qemuAutostartWorker, &data) < 0) {
+            VIR_WARN("Unable to create autostart thread: %s",
+                     virGetLastErrorMessage());
+            break;
+        }
+    }
+    nthreads = i + 1;
+
+    qemuAutostartWorker(&data);
 
-    virDomainObjListForEach(driver->domains, qemuAutostartDomain, &data);
+    for (i = 0; i + 1 < nthreads; i++)
+        virThreadJoin(&threads[i]);
 
+    ignore_value(virTimeMillisNow(&now));
+    VIR_INFO("Autostart of %zu VMs using %zu threads took %llu ms",
+             data.nvms, nthreads, now - then);
+
+ destroy:
+    virObjectListFreeCount(data.vms, data.nvms);
+    VIR_FREE(data.groups);
+    VIR_FREE(threads);
+    virCondDestroy(&data.cond);
+    virMutexDestroy(&data.lock);
+ cleanup:
     virObjectUnref(conn);
     virObjectUnref(cfg);
 }
@@ -448,22 +696,109 @@ qemuSecurityInit(virQEMUDriverPtr driver)
 }
 
 
+/* Largest snapshot metadata log read at startup */
+#define QEMU_DOMAIN_SNAPSHOT_LOG_MAX (256 * 1024 * 1024)
+
+static int
+qemuDomainSnapshotLoadOne(virDomainObjPtr vm,
+                          virCapsPtr caps,
+                          const char *xmlStr,
+                          const char *name,
+                          const char *source,
+                          virDomainSnapshotObjPtr *current)
+{
+    virDomainSnapshotDefPtr def = NULL;
+    virDomainSnapshotObjPtr snap = NULL;
+    unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_DEFER_DOMAIN);
+
+    def = virDomainSnapshotDefParseString(xmlStr, caps,
+                                          qemu_driver->xmlopt,
+                                          flags);
+    if (def == NULL) {
+        /* Nothing we can do here, skip this one */
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to parse snapshot XML from %s"),
+                       source);
+        return -1;
+    }
+
+    if (name && STRNEQ(def->name, name)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Snapshot '%s' from %s is recorded as '%s'"),
+                       def->name, source, name);
+        virDomainSnapshotDefFree(def);
+        return -1;
+    }
+
+    snap = virDomainSnapshotAssignDef(vm->snapshots, def);
+    if (snap == NULL) {
+        virDomainSnapshotDefFree(def);
+        return -1;
+    }
+
+    if (snap->def->current) {
+        *current = snap;
+        if (!vm->current_snapshot)
+            vm->current_snapshot = snap;
+    }
+    return 0;
+}
+
+
+struct qemuDomainSnapshotLoadData {
+    virDomainObjPtr vm;
+    virCapsPtr caps;
+    const char *path;
+    virDomainSnapshotObjPtr current;
+    bool incomplete;
+};
+
+static int
+qemuDomainSnapshotLoadRecord(void *payload,
+                             const void *name,
+                             void *opaque)
+{
+    struct qemuDomainSnapshotLoadData *data = opaque;
+    const char *xmlStr = payload;
+
+    if (!*xmlStr)
+        return 0;
+
+    VIR_INFO("Loading snapshot '%s'", (const char *) name);
+    if (qemuDomainSnapshotLoadOne(data->vm, data->caps, xmlStr, name,
+                                  data->path, &data->current) < 0)
+        data->incomplete = true;
+    return 0;
+}
+
+
 static int
 qemuDomainSnapshotLoad(virDomainObjPtr vm,
                        void *data)
 {
     char *baseDir = (char *)data;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     char *snapDir = NULL;
+    char *logPath = NULL;
+    char *logStr = NULL;
+    ssize_t logLen = 0;
+    ssize_t nrecords = 0;
+    size_t goodLen = 0;
+    char ebuf[1024];
+    virHashTablePtr records = NULL;
+    char **legacy = NULL;
+    size_t nlegacy = 0;
+    bool torn = false;
+    struct qemuDomainSnapshotLoadData load = { vm, NULL, NULL, NULL, false };
     DIR *dir = NULL;
     struct dirent *entry;
     char *xmlStr;
     char *fullpath;
-    virDomainSnapshotDefPtr def = NULL;
-    virDomainSnapshotObjPtr snap = NULL;
-    virDomainSnapshotObjPtr current = NULL;
-    unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
-                          VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
-                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL);
+    char *name;
+    size_t i;
     int ret = -1;
     virCapsPtr caps = NULL;
     int direrr;
@@ -479,6 +814,7 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
 
     if (!(caps = virQEMUDriverGetCapabilities(qemu_driver, false)))
         goto cleanup;
+    load.caps = caps;
 
     VIR_INFO("Scanning for snapshots for domain %s in %s", vm->def->name,
              snapDir);
@@ -486,7 +822,46 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
     if (virDirOpenIfExists(&dir, snapDir) <= 0)
         goto cleanup;
 
+    if (virAsprintf(&logPath, "%s/%s", snapDir, QEMU_DOMAIN_SNAPSHOT_LOG) < 0 ||
+        !(records = virHashCreate(32, NULL)))
+        goto cleanup;
+    load.path = logPath;
+
+    if (virFileExists(logPath)) {
+        if ((logLen = virFileReadAll(logPath, QEMU_DOMAIN_SNAPSHOT_LOG_MAX,
+                                     &logStr)) < 0 ||
+            (nrecords = qemuDomainSnapshotLogParse(logStr, logLen, logPath,
+                                                   records, &goodLen)) < 0) {
+            /* Never compact a log we could not read */
+            load.incomplete = true;
+            nrecords = 0;
+        } else if (goodLen < (size_t) logLen) {
+            /* Drop the partial record now, appending after it would make
+             * the next load throw away everything written from here on */
+            if (truncate(logPath, goodLen) < 0) {
+                VIR_WARN("Failed to truncate %s to %zu bytes: %s",
+                         logPath, goodLen, virStrerror(errno, ebuf, sizeof(ebuf)));
+                torn = true;
+            }
+        }
+        virHashForEach(records, qemuDomainSnapshotLoadRecord, &load);
+    }
+
+    /* Older libvirt kept one file per snapshot, anything the log does
+     * not know about yet is migrated into it below */
     while ((direrr = virDirRead(dir, &entry, NULL)) > 0) {
+        if (!virFileHasSuffix(entry->d_name, ".xml"))
+            continue;
+
+        if (VIR_STRNDUP(name, entry->d_name,
+                        strlen(entry->d_name) - strlen(".xml")) < 0)
+            continue;
+        if (virHashLookup(records, name)) {
+            VIR_FREE(name);
+            continue;
+        }
+        VIR_FREE(name);
+
         /* NB: ignoring errors, so one malformed config doesn't
            kill the whole process */
         VIR_INFO("Loading snapshot file '%s'", entry->d_name);
@@ -494,6 +869,7 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
         if (virAsprintf(&fullpath, "%s/%s", snapDir, entry->d_name) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("Failed to allocate memory for path"));
+            load.incomplete = true;
             continue;
         }
 
@@ -502,41 +878,27 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
             virReportSystemError(errno,
                                  _("Failed to read snapshot file %s"),
                                  fullpath);
+            load.incomplete = true;
             VIR_FREE(fullpath);
             continue;
         }
 
-        def = virDomainSnapshotDefParseString(xmlStr, caps,
-                                              qemu_driver->xmlopt,
-                                              flags);
-        if (def == NULL) {
-            /* Nothing we can do here, skip this one */
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Failed to parse snapshot XML from file '%s'"),
-                           fullpath);
-            VIR_FREE(fullpath);
-            VIR_FREE(xmlStr);
-            continue;
-        }
-
-        snap = virDomainSnapshotAssignDef(vm->snapshots, def);
-        if (snap == NULL) {
-            virDomainSnapshotDefFree(def);
-        } else if (snap->def->current) {
-            current = snap;
-            if (!vm->current_snapshot)
-                vm->current_snapshot = snap;
-        }
+        if (qemuDomainSnapshotLoadOne(vm, caps, xmlStr, NULL, fullpath,
+                                      &load.current) < 0 ||
+            VIR_APPEND_ELEMENT(legacy, nlegacy, fullpath) < 0)
+            load.incomplete = true;
 
         VIR_FREE(fullpath);
         VIR_FREE(xmlStr);
     }
-    if (direrr < 0)
+    if (direrr < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Failed to fully read directory %s"),
                        snapDir);
+        load.incomplete = true;
+    }
 
-    if (vm->current_snapshot != current) {
+    if (vm->current_snapshot != load.current) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Too many snapshots claiming to be current for domain %s"),
                        vm->def->name);
@@ -548,6 +910,26 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
                        _("Snapshots have inconsistent relations for domain %s"),
                        vm->def->name);
 
+    /* Records which failed to load must survive a rewrite of the log.
+     * Otherwise fold legacy files, a partial last record or stale
+     * records into a fresh log right away.  */
+    priv->nsnapshotLogRecords = nrecords;
+    priv->snapshotLogIncomplete = load.incomplete;
+    if (!load.incomplete &&
+        (nlegacy || torn ||
+         nrecords > QEMU_DOMAIN_SNAPSHOT_LOG_SLACK +
+                    2 * virDomainSnapshotObjListNum(vm->snapshots, NULL, 0))) {
+        if (qemuDomainSnapshotCompactLog(vm, caps, baseDir) < 0) {
+            VIR_WARN("Failed to rewrite snapshot metadata of domain %s",
+                     vm->def->name);
+        } else {
+            for (i = 0; i < nlegacy; i++) {
+                if (unlink(legacy[i]) < 0)
+                    VIR_WARN("Failed to unlink %s", legacy[i]);
+            }
+        }
+    }
+
     /* FIXME: qemu keeps internal track of snapshots.  We can get access
      * to this info via the "info snapshots" monitor command for running
      * domains, or via "qemu-img snapshot -l" for shutoff domains.  It would
@@ -562,6 +944,10 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
     ret = 0;
  cleanup:
     VIR_DIR_CLOSE(dir);
+    virHashFree(records);
+    VIR_FREE(logStr);
+    VIR_FREE(logPath);
+    virStringListFreeCount(legacy, nlegacy);
     VIR_FREE(snapDir);
     virObjectUnref(caps);
     virObjectUnlock(vm);
@@ -638,6 +1024,7 @@ qemuStateInitialize(bool privileged,
         VIR_FREE(qemu_driver);
         return -1;
     }
+    virMutexSetName(&qemu_driver->lock, "virQEMUDriver");
 
     qemu_driver->inhibitCallback = callback;
     qemu_driver->inhibitOpaque = opaque;
@@ -750,7 +1137,7 @@ qemuStateInitialize(bool privileged,
          virPortAllocatorNew(_("migration"),
                              cfg->migrationPortMin,
                              cfg->migrationPortMax,
-                             0)) == NULL)
+                             VIR_PORT_ALLOCATOR_ROTATE)) == NULL)
         goto error;
 
     if (qemuSecurityInit(qemu_driver) < 0)
@@ -765,6 +1152,9 @@ qemuStateInitialize(bool privileged,
     if (qemuMigrationErrorInit(qemu_driver) < 0)
         goto error;
 
+    if (qemuMigrationSchedulerInit(qemu_driver) < 0)
+        goto error;
+
     if (privileged) {
         char *channeldir;
 
@@ -845,6 +1235,9 @@ qemuStateInitialize(bool privileged,
     if ((qemu_driver->caps = virQEMUDriverCreateCapabilities(qemu_driver)) == NULL)
         goto error;
 
+    if (!(qemu_driver->domCapsCache = virQEMUDriverDomainCapsCacheNew()))
+        goto error;
+
     if (!(qemu_driver->xmlopt = virQEMUDriverCreateXMLConf(qemu_driver)))
         goto error;
 
@@ -918,6 +1311,17 @@ qemuStateInitialize(bool privileged,
     if (!qemu_driver->workerPool)
         goto error;
 
+    if (cfg->statsWorkers > 1) {
+        qemu_driver->statsPool = virThreadPoolNew(0, cfg->statsWorkers - 1, 0,
+                                                  qemuConnectGetAllDomainStatsJob,
+                                                  qemu_driver);
+        if (!qemu_driver->statsPool)
+            goto error;
+    }
+
+    if (qemuStatsSamplerInit(qemu_driver) < 0)
+        goto error;
+
     virObjectUnref(conn);
 
     virNWFilterRegisterCallbackDriver(&qemuCallbackDriver);
@@ -989,11 +1393,51 @@ qemuStateReload(void)
 }
 
 
+struct qemuStateStopData {
+    virDomainPtr *domains;
+    unsigned int *flags;
+    size_t *order;
+    size_t offset;
+    size_t ndomains;
+    volatile int done;
+    volatile int failed;
+};
+
+
+static void
+qemuStateStopSaveDomain(size_t idx,
+                        void *opaque)
+{
+    struct qemuStateStopData *data = opaque;
+    size_t i = data->order[data->offset + idx];
+    virDomainPtr dom = data->domains[i];
+    unsigned long long then = 0;
+    unsigned long long now = 0;
+
+    ignore_value(virTimeMillisNow(&then));
+
+    if (virDomainManagedSave(dom, data->flags[i]) < 0) {
+        VIR_WARN("Unable to save domain %s: %s",
+                 dom->name, virGetLastErrorMessage());
+        virAtomicIntSet(&data->failed, 1);
+    }
+
+    ignore_value(virTimeMillisNow(&now));
+    VIR_INFO("Saving domain %s took %llu ms, %d of %zu domains done",
+             dom->name, now - then, virAtomicIntInc(&data->done),
+             data->ndomains);
+}
+
+
 /*
  * qemuStateStop:
  *
  * Save any VMs in preparation for shutdown
  *
+ * The domains are saved shutdown_save_parallel at a time, in the
+ * reverse order of auto_start_groups: a group is only saved once all
+ * the domains of the groups listed after it are saved, so that
+ * domains which others depend on keep running the longest.
  */
 static int
 qemuStateStop(void)
@@ -1002,9 +1446,16 @@ qemuStateStop(void)
     virConnectPtr conn;
     int numDomains = 0;
     size_t i;
+    size_t g;
+    size_t n = 0;
+    size_t ngroups;
     int state;
     virDomainPtr *domains = NULL;
     unsigned int *flags = NULL;
+    size_t *groups = NULL;
+    struct qemuStateStopData data = { 0 };
+    unsigned long long then = 0;
+    unsigned long long now = 0;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(qemu_driver);
 
     if (!(conn = virConnectOpen(cfg->uri)))
@@ -1015,7 +1466,9 @@ qemuStateStop(void)
                                                VIR_CONNECT_LIST_DOMAINS_ACTIVE)) < 0)
         goto cleanup;
 
-    if (VIR_ALLOC_N(flags, numDomains) < 0)
+    if (VIR_ALLOC_N(flags, numDomains) < 0 ||
+        VIR_ALLOC_N(groups, numDomains) < 0 ||
+        VIR_ALLOC_N(data.order, numDomains) < 0)
         goto cleanup;
 
     /* First we pause all VMs to make them stop dirtying
@@ -1028,13 +1481,42 @@ qemuStateStop(void)
                 flags[i] = VIR_DOMAIN_SAVE_PAUSED;
         }
         virDomainSuspend(domains[i]);
+        groups[i] = qemuAutostartGetGroup(cfg->autoStartGroups,
+                                          domains[i]->name);
     }
 
-    ret = 0;
+    data.domains = domains;
+    data.flags = flags;
+    data.ndomains = numDomains;
+
+    /* Domains matching no group are saved first */
+    ngroups = virStringListLength((const char * const *) cfg->autoStartGroups);
+    for (g = ngroups + 1; g-- > 0;) {
+        for (i = 0; i < numDomains; i++) {
+            if (groups[i] == g)
+                data.order[n++] = i;
+        }
+    }
+
+    ignore_value(virTimeMillisNow(&then));
+
     /* Then we save the VMs to disk */
-    for (i = 0; i < numDomains; i++)
-        if (virDomainManagedSave(domains[i], flags[i]) < 0)
-            ret = -1;
+    for (i = 0; i < numDomains; i = n) {
+        for (n = i + 1; n < numDomains; n++) {
+            if (groups[data.order[n]] != groups[data.order[i]])
+                break;
+        }
+
+        data.offset = i;
+        virThreadPoolParallelFor(n - i, cfg->shutdownSaveParallel,
+                                 qemuStateStopSaveDomain, &data);
+    }
+
+    ignore_value(virTimeMillisNow(&now));
+    VIR_INFO("Saving %d VMs using up to %u threads took %llu ms",
+             numDomains, cfg->shutdownSaveParallel, now - then);
+
+    ret = data.failed ? -1 : 0;
 
  cleanup:
     if (domains) {
@@ -1043,6 +1525,8 @@ qemuStateStop(void)
         VIR_FREE(domains);
     }
     VIR_FREE(flags);
+    VIR_FREE(groups);
+    VIR_FREE(data.order);
     virObjectUnref(conn);
     virObjectUnref(cfg);
 
@@ -1061,11 +1545,18 @@ qemuStateCleanup(void)
         return -1;
 
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
+    qemuStatsSamplerFree(qemu_driver);
+    virThreadPoolFree(qemu_driver->reconnectPool);
     virThreadPoolFree(qemu_driver->workerPool);
+    virThreadPoolFree(qemu_driver->statsPool);
     virObjectUnref(qemu_driver->config);
     virObjectUnref(qemu_driver->hostdevMgr);
     virHashFree(qemu_driver->sharedDevices);
     virObjectUnref(qemu_driver->caps);
+    virObjectUnref(qemu_driver->capsTopology);
+    VIR_FREE(qemu_driver->capsXML);
+    virHashFree(qemu_driver->domCapsCache);
+    VIR_FREE(qemu_driver->numaLoad);
     virQEMUCapsCacheFree(qemu_driver->qemuCapsCache);
 
     virObjectUnref(qemu_driver->domains);
@@ -1073,6 +1564,7 @@ qemuStateCleanup(void)
     virObjectUnref(qemu_driver->webSocketPorts);
     virObjectUnref(qemu_driver->migrationPorts);
     virObjectUnref(qemu_driver->migrationErrors);
+    qemuMigrationSchedulerFree(qemu_driver);
 
     virObjectUnref(qemu_driver->xmlopt);
 
@@ -1285,21 +1777,11 @@ qemuConnectGetMaxVcpus(virConnectPtr conn ATTRIBUTE_UNUSED, const char *type)
 
 static char *qemuConnectGetCapabilities(virConnectPtr conn) {
     virQEMUDriverPtr driver = conn->privateData;
-    virCapsPtr caps = NULL;
-    char *xml = NULL;
 
     if (virConnectGetCapabilitiesEnsureACL(conn) < 0)
         return NULL;
 
-    if (!(caps = virQEMUDriverGetCapabilities(driver, true)))
-        goto cleanup;
-
-    xml = virCapabilitiesFormatXML(caps);
-    virObjectUnref(caps);
-
- cleanup:
-
-    return xml;
+    return virQEMUDriverGetCapabilitiesXML(driver);
 }
 
 
@@ -2766,6 +3248,10 @@ typedef enum {
      */
     QEMU_SAVE_FORMAT_XZ = 3,
     QEMU_SAVE_FORMAT_LZOP = 4,
+    /* Compressed by QEMU itself, in multiple threads */
+    QEMU_SAVE_FORMAT_PARALLEL = 5,
+    /* Compressed in multiple threads by libvirt_iohelper */
+    QEMU_SAVE_FORMAT_ZLIB = 6,
     /* Note: add new members only at the end.
        These values are used in the on-disk format.
        Do not change or re-use numbers. */
@@ -2779,7 +3265,9 @@ VIR_ENUM_IMPL(qemuSaveCompression, QEMU_SAVE_FORMAT_LAST,
               "gzip",
               "bzip2",
               "xz",
-              "lzop")
+              "lzop",
+              "parallel",
+              "zlib")
 
 VIR_ENUM_DECL(qemuDumpFormat)
 VIR_ENUM_IMPL(qemuDumpFormat, VIR_DOMAIN_CORE_DUMP_FORMAT_LAST,
@@ -2840,6 +3328,7 @@ qemuCompressGetCommand(virQEMUSaveFormat compression)
 {
     virCommandPtr ret = NULL;
     const char *prog = qemuSaveCompressionTypeToString(compression);
+    char *iohelper_path = NULL;
 
     if (!prog) {
         virReportError(VIR_ERR_OPERATION_FAILED,
@@ -2848,8 +3337,17 @@ qemuCompressGetCommand(virQEMUSaveFormat compression)
         return NULL;
     }
 
+    if (compression == QEMU_SAVE_FORMAT_ZLIB) {
+        if (!(iohelper_path = virFileFindResource("libvirt_iohelper",
+                                                  abs_topbuilddir "/src",
+                                                  LIBEXECDIR)))
+            return NULL;
+        prog = iohelper_path;
+    }
+
     ret = virCommandNew(prog);
     virCommandAddArg(ret, "-dc");
+    VIR_FREE(iohelper_path);
 
     switch (compression) {
     case QEMU_SAVE_FORMAT_LZOP:
@@ -3080,7 +3578,9 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
         goto cleanup;
 
     /* Perform the migration */
-    if (qemuMigrationToFile(driver, vm, fd, compressedpath, asyncJob) < 0)
+    if (qemuMigrationToFile(driver, vm, fd, compressedpath,
+                            compressed == QEMU_SAVE_FORMAT_PARALLEL,
+                            asyncJob) < 0)
         goto cleanup;
 
     /* Touch up file header to mark image complete. */
@@ -3285,6 +3785,19 @@ qemuGetCompressionProgram(const char *imageFormat,
     if (ret == QEMU_SAVE_FORMAT_RAW)
         return QEMU_SAVE_FORMAT_RAW;
 
+    /* QEMU compresses the stream itself, no program is needed */
+    if (ret == QEMU_SAVE_FORMAT_PARALLEL)
+        return QEMU_SAVE_FORMAT_PARALLEL;
+
+    /* libvirt_iohelper compresses the stream itself */
+    if (ret == QEMU_SAVE_FORMAT_ZLIB) {
+        if (!(*compresspath = virFileFindResource("libvirt_iohelper",
+                                                  abs_topbuilddir "/src",
+                                                  LIBEXECDIR)))
+            goto error;
+        return ret;
+    }
+
     if (!(*compresspath = virFindFileInPath(imageFormat)))
         goto error;
 
@@ -3634,7 +4147,7 @@ doCoreDump(virQEMUDriverPtr driver,
         if (!qemuMigrationIsAllowed(driver, vm, false, 0))
             goto cleanup;
 
-        ret = qemuMigrationToFile(driver, vm, fd, compressedpath,
+        ret = qemuMigrationToFile(driver, vm, fd, compressedpath, false,
                                   QEMU_ASYNC_JOB_DUMP);
     }
 
@@ -4573,43 +5086,110 @@ processMonitorEOFEvent(virQEMUDriverPtr driver,
 }
 
 
-static void qemuProcessEventHandler(void *data, void *opaque)
+static void
+processBlockStatsCacheEvent(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm)
 {
-    struct qemuProcessEvent *processEvent = data;
-    virDomainObjPtr vm = processEvent->vm;
-    virQEMUDriverPtr driver = opaque;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
-    VIR_DEBUG("vm=%p, event=%d", vm, processEvent->eventType);
+    priv->blockStatsCacheRefreshing = false;
 
-    virObjectLock(vm);
+    /* don't wait for the job longer than until the next sample */
+    if (qemuDomainObjBeginJobWithTimeout(driver, vm, QEMU_JOB_QUERY,
+                                         cfg->blockStatsCacheInterval *
+                                         1000ULL) < 0) {
+        virResetLastError();
+        goto cleanup;
+    }
 
-    switch (processEvent->eventType) {
-    case QEMU_PROCESS_EVENT_WATCHDOG:
-        processWatchdogEvent(driver, vm, processEvent->action);
-        break;
-    case QEMU_PROCESS_EVENT_GUESTPANIC:
-        processGuestPanicEvent(driver, vm, processEvent->action,
-                               processEvent->data);
-        break;
-    case QEMU_PROCESS_EVENT_DEVICE_DELETED:
-        processDeviceDeletedEvent(driver, vm, processEvent->data);
-        break;
-    case QEMU_PROCESS_EVENT_NIC_RX_FILTER_CHANGED:
-        processNicRxFilterChangedEvent(driver, vm, processEvent->data);
-        break;
-    case QEMU_PROCESS_EVENT_SERIAL_CHANGED:
-        processSerialChangedEvent(driver, vm, processEvent->data,
-                                  processEvent->action);
-        break;
-    case QEMU_PROCESS_EVENT_BLOCK_JOB:
-        processBlockJobEvent(driver, vm,
-                             processEvent->data,
-                             processEvent->action,
+    if (qemuDomainBlockStatsCacheRefresh(driver, vm) < 0) {
+        VIR_DEBUG("Failed to sample block stats of domain %s",
+                  vm->def->name);
+        virResetLastError();
+    }
+
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virObjectUnref(cfg);
+}
+
+
+static void
+processBlockThresholdEvent(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           char *diskAlias)
+{
+    virDomainDiskDefPtr disk;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        VIR_DEBUG("Domain is not running");
+        goto endjob;
+    }
+
+    if ((disk = qemuProcessFindDomainDiskByAlias(vm, diskAlias)) &&
+        qemuProcessArmDiskWatermark(driver, vm, disk,
+                                    QEMU_DOMAIN_DISK_PRIVATE(disk)->watermarkAllocation,
+                                    QEMU_ASYNC_JOB_NONE) < 0) {
+        VIR_WARN("Unable to re-arm watermark of disk %s in domain %s",
+                 disk->dst, vm->def->name);
+        virResetLastError();
+    }
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+ cleanup:
+    VIR_FREE(diskAlias);
+}
+
+
+static void qemuProcessEventHandler(void *data, void *opaque)
+{
+    struct qemuProcessEvent *processEvent = data;
+    virDomainObjPtr vm = processEvent->vm;
+    virQEMUDriverPtr driver = opaque;
+
+    VIR_DEBUG("vm=%p, event=%d", vm, processEvent->eventType);
+
+    virObjectLock(vm);
+
+    switch (processEvent->eventType) {
+    case QEMU_PROCESS_EVENT_WATCHDOG:
+        processWatchdogEvent(driver, vm, processEvent->action);
+        break;
+    case QEMU_PROCESS_EVENT_GUESTPANIC:
+        processGuestPanicEvent(driver, vm, processEvent->action,
+                               processEvent->data);
+        break;
+    case QEMU_PROCESS_EVENT_DEVICE_DELETED:
+        processDeviceDeletedEvent(driver, vm, processEvent->data);
+        break;
+    case QEMU_PROCESS_EVENT_NIC_RX_FILTER_CHANGED:
+        processNicRxFilterChangedEvent(driver, vm, processEvent->data);
+        break;
+    case QEMU_PROCESS_EVENT_SERIAL_CHANGED:
+        processSerialChangedEvent(driver, vm, processEvent->data,
+                                  processEvent->action);
+        break;
+    case QEMU_PROCESS_EVENT_BLOCK_JOB:
+        processBlockJobEvent(driver, vm,
+                             processEvent->data,
+                             processEvent->action,
                              processEvent->status);
         break;
     case QEMU_PROCESS_EVENT_MONITOR_EOF:
         processMonitorEOFEvent(driver, vm);
         break;
+    case QEMU_PROCESS_EVENT_BLOCK_STATS:
+        processBlockStatsCacheEvent(driver, vm);
+        break;
+    case QEMU_PROCESS_EVENT_BLOCK_THRESHOLD:
+        processBlockThresholdEvent(driver, vm, processEvent->data);
+        break;
     case QEMU_PROCESS_EVENT_LAST:
         break;
     }
@@ -6304,9 +6884,14 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     virCommandPtr cmd = NULL;
     char *errbuf = NULL;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    unsigned int startFlags = VIR_QEMU_PROCESS_START_PAUSED;
 
     if ((header->version == 2) &&
-        (header->compressed != QEMU_SAVE_FORMAT_RAW)) {
+        (header->compressed == QEMU_SAVE_FORMAT_PARALLEL)) {
+        /* QEMU decompresses the stream itself */
+        startFlags |= VIR_QEMU_PROCESS_START_PARALLEL;
+    } else if ((header->version == 2) &&
+               (header->compressed != QEMU_SAVE_FORMAT_RAW)) {
         if (!(cmd = qemuCompressGetCommand(header->compressed)))
             goto cleanup;
 
@@ -6327,7 +6912,7 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     if (qemuProcessStart(conn, driver, vm, asyncJob,
                          "stdio", *fd, path, NULL,
                          VIR_NETDEV_VPORT_PROFILE_OP_RESTORE,
-                         VIR_QEMU_PROCESS_START_PAUSED) == 0)
+                         startFlags) == 0)
         restored = true;
 
     if (intermediatefd != -1) {
@@ -7089,6 +7674,7 @@ qemuDomainDefineXMLFlags(virConnectPtr conn,
                 vm->newDef = oldDef;
             else
                 vm->def = oldDef;
+            virDomainObjBumpGeneration(vm);
             oldDef = NULL;
         } else {
             /* Brand new domain. Remove it */
@@ -7372,9 +7958,6 @@ qemuDomainAttachDeviceLive(virDomainObjPtr vm,
         qemuDomainEventQueue(driver, event);
     }
 
-    if (ret == 0)
-        ret = qemuDomainUpdateDeviceList(driver, vm, QEMU_ASYNC_JOB_NONE);
-
     return ret;
 }
 
@@ -7456,9 +8039,6 @@ qemuDomainDetachDeviceLive(virDomainObjPtr vm,
         break;
     }
 
-    if (ret == 0)
-        ret = qemuDomainUpdateDeviceList(driver, vm, QEMU_ASYNC_JOB_NONE);
-
     return ret;
 }
 
@@ -8006,6 +8586,54 @@ qemuDomainUpdateDeviceConfig(virDomainDefPtr vmdef,
     return 0;
 }
 
+/*
+ * Detach the first @ndevs devices of @devs again after attaching a
+ * later one of the same request failed. The original error is kept.
+ */
+static void
+qemuDomainAttachDeviceRollback(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm,
+                               virDomainDeviceDefPtr *devs,
+                               size_t ndevs)
+{
+    virQEMUDriverConfigPtr cfg;
+    virErrorPtr orig_err;
+
+    if (ndevs == 0)
+        return;
+
+    orig_err = virSaveLastError();
+    cfg = virQEMUDriverGetConfig(driver);
+
+    while (ndevs-- > 0 && virDomainObjIsActive(vm)) {
+        if (qemuDomainDetachDeviceLive(vm, devs[ndevs], driver) < 0)
+            VIR_WARN("Unable to detach %s device of domain %s again",
+                     virDomainDeviceTypeToString(devs[ndevs]->type),
+                     vm->def->name);
+    }
+
+    if (virDomainObjIsActive(vm)) {
+        ignore_value(qemuDomainUpdateDeviceList(driver, vm,
+                                                QEMU_ASYNC_JOB_NONE));
+        ignore_value(virDomainSaveStatus(driver->xmlopt, cfg->stateDir,
+                                         vm, driver->caps));
+    }
+
+    virObjectUnref(cfg);
+    if (orig_err) {
+        virSetError(orig_err);
+        virFreeError(orig_err);
+    }
+}
+
+/*
+ * @xml is either a single device, or several of them wrapped in a
+ * <devices> element. All of them are attached within the current job:
+ * the persistent definition is only replaced and status and config
+ * are only saved once for the whole set, and if attaching one of the
+ * devices to the running domain fails, the ones attached before it
+ * are detached again.
+ */
 static int
 qemuDomainAttachDeviceLiveAndConfig(virConnectPtr conn,
                                     virDomainObjPtr vm,
@@ -8015,7 +8643,11 @@ qemuDomainAttachDeviceLiveAndConfig(virConnectPtr conn,
 {
     virDomainDefPtr vmdef = NULL;
     virQEMUDriverConfigPtr cfg = NULL;
-    virDomainDeviceDefPtr dev = NULL, dev_copy = NULL;
+    virDomainDeviceDefPtr *devs = NULL;
+    virDomainDeviceDefPtr *undo = NULL;
+    virDomainDeviceDefPtr dev, dev_copy = NULL;
+    size_t ndevs = 0;
+    size_t i;
     int ret = -1;
     virCapsPtr caps = NULL;
     unsigned int parse_flags = VIR_DOMAIN_DEF_PARSE_INACTIVE |
@@ -8029,70 +8661,101 @@ qemuDomainAttachDeviceLiveAndConfig(virConnectPtr conn,
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
         goto cleanup;
 
-    dev = dev_copy = virDomainDeviceDefParse(xml, vm->def,
-                                             caps, driver->xmlopt,
-                                             parse_flags);
-    if (dev == NULL)
+    if (virDomainDeviceDefParseList(xml, vm->def, caps, driver->xmlopt,
+                                    parse_flags, &devs, &ndevs) < 0)
         goto cleanup;
 
-    if (flags & VIR_DOMAIN_AFFECT_CONFIG &&
-        flags & VIR_DOMAIN_AFFECT_LIVE) {
-        /* If we are affecting both CONFIG and LIVE
-         * create a deep copy of device as adding
-         * to CONFIG takes one instance.
-         */
-        dev_copy = virDomainDeviceDefCopy(dev, vm->def, caps, driver->xmlopt);
-        if (!dev_copy)
-            goto cleanup;
-    }
-
     if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
         /* Make a copy for updated domain. */
         vmdef = virDomainObjCopyPersistentDef(vm, caps, driver->xmlopt);
         if (!vmdef)
             goto cleanup;
 
-        if (virDomainDefCompatibleDevice(vmdef, dev,
-                                         VIR_DOMAIN_DEVICE_ACTION_ATTACH) < 0)
-            goto cleanup;
-        if ((ret = qemuDomainAttachDeviceConfig(vmdef, dev, conn, caps,
-                                                parse_flags,
-                                                driver->xmlopt)) < 0)
-            goto cleanup;
+        for (i = 0; i < ndevs; i++) {
+            dev = devs[i];
+
+            /* If we are affecting both CONFIG and LIVE
+             * create a deep copy of device as adding
+             * to CONFIG takes one instance.
+             */
+            if (flags & VIR_DOMAIN_AFFECT_LIVE) {
+                if (!(dev = dev_copy = virDomainDeviceDefCopy(devs[i], vm->def,
+                                                              caps,
+                                                              driver->xmlopt)))
+                    goto cleanup;
+            }
+
+            if (virDomainDefCompatibleDevice(vmdef, dev,
+                                             VIR_DOMAIN_DEVICE_ACTION_ATTACH) < 0)
+                goto cleanup;
+            if (qemuDomainAttachDeviceConfig(vmdef, dev, conn, caps,
+                                             parse_flags,
+                                             driver->xmlopt) < 0)
+                goto cleanup;
+
+            virDomainDeviceDefFree(dev_copy);
+            dev_copy = NULL;
+        }
     }
 
     if (flags & VIR_DOMAIN_AFFECT_LIVE) {
-        if (virDomainDefCompatibleDevice(vm->def, dev_copy,
-                                         VIR_DOMAIN_DEVICE_ACTION_ATTACH) < 0)
+        /* Attaching to the live domain takes the device too, so keep
+         * what it takes to detach it again if a later one fails */
+        if (ndevs > 1 && VIR_ALLOC_N(undo, ndevs) < 0)
+            goto cleanup;
+
+        for (i = 0; i < ndevs; i++) {
+            if (virDomainDefCompatibleDevice(vm->def, devs[i],
+                                             VIR_DOMAIN_DEVICE_ACTION_ATTACH) < 0)
+                break;
+
+            if (undo &&
+                !(undo[i] = virDomainDeviceDefCopy(devs[i], vm->def, caps,
+                                                   driver->xmlopt)))
+                break;
+
+            if (qemuDomainAttachDeviceLive(vm, devs[i], conn, driver) < 0)
+                break;
+        }
+
+        if (i < ndevs) {
+            qemuDomainAttachDeviceRollback(driver, vm, undo, i);
             goto cleanup;
+        }
 
-        if ((ret = qemuDomainAttachDeviceLive(vm, dev_copy, conn, driver)) < 0)
+        if (qemuDomainUpdateDeviceList(driver, vm, QEMU_ASYNC_JOB_NONE) < 0)
             goto cleanup;
+
         /*
          * update domain status forcibly because the domain status may be
          * changed even if we failed to attach the device. For example,
          * a new controller may be created.
          */
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
-            ret = -1;
+        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
             goto cleanup;
-        }
     }
 
     /* Finally, if no error until here, we can save config. */
     if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
-        ret = virDomainSaveConfig(cfg->configDir, driver->caps, vmdef);
-        if (!ret) {
-            virDomainObjAssignDef(vm, vmdef, false, NULL);
-            vmdef = NULL;
-        }
+        if (virDomainSaveConfig(cfg->configDir, driver->caps, vmdef) < 0)
+            goto cleanup;
+
+        virDomainObjAssignDef(vm, vmdef, false, NULL);
+        vmdef = NULL;
     }
 
+    ret = 0;
+
  cleanup:
     virDomainDefFree(vmdef);
-    if (dev != dev_copy)
-        virDomainDeviceDefFree(dev_copy);
-    virDomainDeviceDefFree(dev);
+    virDomainDeviceDefFree(dev_copy);
+    for (i = 0; i < ndevs; i++) {
+        virDomainDeviceDefFree(devs[i]);
+        if (undo)
+            virDomainDeviceDefFree(undo[i]);
+    }
+    VIR_FREE(devs);
+    VIR_FREE(undo);
     virObjectUnref(cfg);
     virObjectUnref(caps);
 
@@ -8266,21 +8929,38 @@ static int qemuDomainUpdateDeviceFlags(virDomainPtr dom,
     return ret;
 }
 
+/*
+ * Like for attaching, @xml may list several devices in a <devices>
+ * element. Unplugging cannot be undone, so all of them are checked
+ * before the first one is detached from the running domain. The
+ * unplug of all of them is requested before waiting for the guest to
+ * release any, so that they all share one timeout. With
+ * VIR_DOMAIN_DEVICE_MODIFY_ASYNC, nothing is waited for and the
+ * removal is finished once QEMU reports it.
+ */
 static int
 qemuDomainDetachDeviceLiveAndConfig(virQEMUDriverPtr driver,
                                     virDomainObjPtr vm,
                                     const char *xml,
                                     unsigned int flags)
 {
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     virCapsPtr caps = NULL;
     virQEMUDriverConfigPtr cfg = NULL;
-    virDomainDeviceDefPtr dev = NULL, dev_copy = NULL;
+    virDomainDeviceDefPtr *devs = NULL;
+    virDomainDeviceDefPtr dev, dev_copy = NULL;
     unsigned int parse_flags = VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE;
     virDomainDefPtr vmdef = NULL;
+    size_t ndevs = 0;
+    size_t ndetached = 0;
+    size_t i;
+    bool failed = false;
+    virErrorPtr orig_err = NULL;
     int ret = -1;
 
     virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
-                  VIR_DOMAIN_AFFECT_CONFIG, -1);
+                  VIR_DOMAIN_AFFECT_CONFIG |
+                  VIR_DOMAIN_DEVICE_MODIFY_ASYNC, -1);
 
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
         goto cleanup;
@@ -8291,72 +8971,118 @@ qemuDomainDetachDeviceLiveAndConfig(virQEMUDriverPtr driver,
         !(flags & VIR_DOMAIN_AFFECT_LIVE))
         parse_flags |= VIR_DOMAIN_DEF_PARSE_INACTIVE;
 
-    dev = dev_copy = virDomainDeviceDefParse(xml, vm->def,
-                                             caps, driver->xmlopt,
-                                             parse_flags);
-    if (dev == NULL)
+    if (virDomainDeviceDefParseList(xml, vm->def, caps, driver->xmlopt,
+                                    parse_flags, &devs, &ndevs) < 0)
         goto cleanup;
 
-    if (flags & VIR_DOMAIN_AFFECT_CONFIG &&
-        flags & VIR_DOMAIN_AFFECT_LIVE) {
-        /* If we are affecting both CONFIG and LIVE
-         * create a deep copy of device as adding
-         * to CONFIG takes one instance.
-         */
-        dev_copy = virDomainDeviceDefCopy(dev, vm->def, caps, driver->xmlopt);
-        if (!dev_copy)
-            goto cleanup;
-    }
-
     if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
         /* Make a copy for updated domain. */
         vmdef = virDomainObjCopyPersistentDef(vm, caps, driver->xmlopt);
         if (!vmdef)
             goto cleanup;
 
-        if (virDomainDefCompatibleDevice(vmdef, dev,
-                                         VIR_DOMAIN_DEVICE_ACTION_DETACH) < 0)
-            goto cleanup;
+        for (i = 0; i < ndevs; i++) {
+            dev = devs[i];
 
-        if ((ret = qemuDomainDetachDeviceConfig(vmdef, dev, caps,
-                                                parse_flags,
-                                                driver->xmlopt)) < 0)
-            goto cleanup;
+            /* If we are affecting both CONFIG and LIVE
+             * create a deep copy of device as removing
+             * from CONFIG may free parts of it.
+             */
+            if (flags & VIR_DOMAIN_AFFECT_LIVE) {
+                if (!(dev = dev_copy = virDomainDeviceDefCopy(devs[i], vm->def,
+                                                              caps,
+                                                              driver->xmlopt)))
+                    goto cleanup;
+            }
+
+            if (virDomainDefCompatibleDevice(vmdef, dev,
+                                             VIR_DOMAIN_DEVICE_ACTION_DETACH) < 0)
+                goto cleanup;
+
+            if (qemuDomainDetachDeviceConfig(vmdef, dev, caps,
+                                             parse_flags,
+                                             driver->xmlopt) < 0)
+                goto cleanup;
+
+            virDomainDeviceDefFree(dev_copy);
+            dev_copy = NULL;
+        }
     }
 
     if (flags & VIR_DOMAIN_AFFECT_LIVE) {
-        if (virDomainDefCompatibleDevice(vm->def, dev_copy,
-                                         VIR_DOMAIN_DEVICE_ACTION_DETACH) < 0)
+        for (i = 0; i < ndevs; i++) {
+            if (virDomainDefCompatibleDevice(vm->def, devs[i],
+                                             VIR_DOMAIN_DEVICE_ACTION_DETACH) < 0)
+                goto cleanup;
+        }
+
+        if (flags & VIR_DOMAIN_DEVICE_MODIFY_ASYNC)
+            priv->unplugMode = QEMU_DOMAIN_UNPLUG_ASYNC;
+        else if (ndevs > 1)
+            priv->unplugMode = QEMU_DOMAIN_UNPLUG_DEFER;
+
+        for (ndetached = 0; ndetached < ndevs; ndetached++) {
+            if (qemuDomainDetachDeviceLive(vm, devs[ndetached], driver) < 0)
+                break;
+        }
+
+        if (ndetached < ndevs) {
+            failed = true;
+            orig_err = virSaveLastError();
+        }
+
+        if (priv->unplugMode == QEMU_DOMAIN_UNPLUG_DEFER &&
+            qemuDomainWaitForDeviceRemovals(driver, vm) < 0)
+            failed = true;
+        priv->unplugMode = QEMU_DOMAIN_UNPLUG_WAIT;
+
+        if (failed) {
+            /* Those detached so far are gone nevertheless */
+            if (ndetached > 0) {
+                if (!orig_err)
+                    orig_err = virSaveLastError();
+                ignore_value(qemuDomainUpdateDeviceList(driver, vm,
+                                                        QEMU_ASYNC_JOB_NONE));
+                ignore_value(virDomainSaveStatus(driver->xmlopt, cfg->stateDir,
+                                                 vm, driver->caps));
+            }
+            if (orig_err) {
+                virSetError(orig_err);
+                virFreeError(orig_err);
+            }
             goto cleanup;
+        }
 
-        if ((ret = qemuDomainDetachDeviceLive(vm, dev_copy, driver)) < 0)
+        if (qemuDomainUpdateDeviceList(driver, vm, QEMU_ASYNC_JOB_NONE) < 0)
             goto cleanup;
+
         /*
          * update domain status forcibly because the domain status may be
          * changed even if we failed to attach the device. For example,
          * a new controller may be created.
          */
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
-            ret = -1;
+        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
             goto cleanup;
-        }
     }
 
     /* Finally, if no error until here, we can save config. */
     if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
-        ret = virDomainSaveConfig(cfg->configDir, driver->caps, vmdef);
-        if (!ret) {
-            virDomainObjAssignDef(vm, vmdef, false, NULL);
-            vmdef = NULL;
-        }
+        if (virDomainSaveConfig(cfg->configDir, driver->caps, vmdef) < 0)
+            goto cleanup;
+
+        virDomainObjAssignDef(vm, vmdef, false, NULL);
+        vmdef = NULL;
     }
 
+    ret = 0;
+
  cleanup:
     virObjectUnref(caps);
     virObjectUnref(cfg);
-    if (dev != dev_copy)
-        virDomainDeviceDefFree(dev_copy);
-    virDomainDeviceDefFree(dev);
+    virDomainDeviceDefFree(dev_copy);
+    for (i = 0; i < ndevs; i++)
+        virDomainDeviceDefFree(devs[i]);
+    VIR_FREE(devs);
     virDomainDefFree(vmdef);
     return ret;
 }
@@ -10509,9 +11235,12 @@ qemuDomainBlockStatsGatherTotals(void *payload,
  * @driver: driver object
  * @vm: domain object
  * @path: to gather the statistics for
+ * @cached: use the sampled statistics instead of the monitor
  * @retstats: returns pointer to structure holding the stats
  *
  * Gathers the block statistics for use in qemuDomainBlockStats* APIs.
+ * Unless @cached is true (see qemuDomainBlockStatsCacheValid) the
+ * caller must hold a job.
  *
  * Returns -1 on error; number of filled block statistics on success.
  */
@@ -10519,11 +11248,13 @@ static int
 qemuDomainBlocksStatsGather(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
                             const char *path,
+                            bool cached,
                             qemuBlockStatsPtr *retstats)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     virDomainDiskDefPtr disk;
     virHashTablePtr blockstats = NULL;
+    virHashTablePtr lookup;
     qemuBlockStatsPtr stats;
     int nstats;
     char *diskAlias = NULL;
@@ -10545,16 +11276,22 @@ qemuDomainBlocksStatsGather(virQEMUDriverPtr driver,
             goto cleanup;
     }
 
-    qemuDomainObjEnterMonitor(driver, vm);
-    nstats = qemuMonitorGetAllBlockStatsInfo(priv->mon, &blockstats, false);
-    if (qemuDomainObjExitMonitor(driver, vm) < 0 || nstats < 0)
-        goto cleanup;
+    if (cached) {
+        lookup = priv->blockStatsCache;
+        nstats = priv->blockStatsCacheCount;
+    } else {
+        qemuDomainObjEnterMonitor(driver, vm);
+        nstats = qemuMonitorGetAllBlockStatsInfo(priv->mon, &blockstats, false);
+        if (qemuDomainObjExitMonitor(driver, vm) < 0 || nstats < 0)
+            goto cleanup;
+        lookup = blockstats;
+    }
 
     if (VIR_ALLOC(*retstats) < 0)
         goto cleanup;
 
     if (diskAlias) {
-        if (!(stats = virHashLookup(blockstats, diskAlias))) {
+        if (!(stats = virHashLookup(lookup, diskAlias))) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("cannot find statistics for device '%s'"), diskAlias);
             goto cleanup;
@@ -10562,7 +11299,7 @@ qemuDomainBlocksStatsGather(virQEMUDriverPtr driver,
 
         **retstats = *stats;
     } else {
-        virHashForEach(blockstats, qemuDomainBlockStatsGatherTotals, *retstats);
+        virHashForEach(lookup, qemuDomainBlockStatsGatherTotals, *retstats);
     }
 
     ret = nstats;
@@ -10587,6 +11324,7 @@ qemuDomainBlockStats(virDomainPtr dom,
     qemuBlockStatsPtr blockstats = NULL;
     int ret = -1;
     virDomainObjPtr vm;
+    bool cached;
 
     if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
@@ -10594,7 +11332,9 @@ qemuDomainBlockStats(virDomainPtr dom,
     if (virDomainBlockStatsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    cached = qemuDomainBlockStatsCacheValid(driver, vm);
+
+    if (!cached && qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
@@ -10603,7 +11343,7 @@ qemuDomainBlockStats(virDomainPtr dom,
         goto endjob;
     }
 
-    if (qemuDomainBlocksStatsGather(driver, vm, path, &blockstats) < 0)
+    if (qemuDomainBlocksStatsGather(driver, vm, path, cached, &blockstats) < 0)
         goto endjob;
 
     stats->rd_req = blockstats->rd_req;
@@ -10616,7 +11356,8 @@ qemuDomainBlockStats(virDomainPtr dom,
     ret = 0;
 
  endjob:
-    qemuDomainObjEndJob(driver, vm);
+    if (!cached)
+        qemuDomainObjEndJob(driver, vm);
 
  cleanup:
     virDomainObjEndAPI(&vm);
@@ -10637,6 +11378,7 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
     qemuBlockStatsPtr blockstats = NULL;
     int nstats;
     int ret = -1;
+    bool cached;
 
     VIR_DEBUG("params=%p, flags=%x", params, flags);
 
@@ -10651,7 +11393,9 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
     if (virDomainBlockStatsFlagsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    cached = qemuDomainBlockStatsCacheValid(driver, vm);
+
+    if (!cached && qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
@@ -10660,7 +11404,7 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
         goto endjob;
     }
 
-    if ((nstats = qemuDomainBlocksStatsGather(driver, vm, path,
+    if ((nstats = qemuDomainBlocksStatsGather(driver, vm, path, cached,
                                               &blockstats)) < 0)
         goto endjob;
 
@@ -10701,7 +11445,8 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
     *nparams = nstats;
 
  endjob:
-    qemuDomainObjEndJob(driver, vm);
+    if (!cached)
+        qemuDomainObjEndJob(driver, vm);
 
  cleanup:
     VIR_FREE(blockstats);
@@ -11069,46 +11814,85 @@ qemuDomainGetInterfaceParameters(virDomainPtr dom,
 }
 
 /* This functions assumes that job QEMU_JOB_QUERY is started by a caller */
+static bool
+qemuDomainMemoryStatsHasMonitor(virDomainObjPtr vm)
+{
+    return vm->def->memballoon &&
+           vm->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO;
+}
+
+
+/*
+ * The balloon driver part of qemuDomainMemoryStatsInternal, for callers
+ * which issue several queries in one monitor session. The caller must
+ * have entered the monitor of @vm.
+ */
 static int
-qemuDomainMemoryStatsInternal(virQEMUDriverPtr driver,
-                              virDomainObjPtr vm,
-                              virDomainMemoryStatPtr stats,
-                              unsigned int nr_stats)
+qemuDomainMemoryStatsMonitor(virDomainObjPtr vm,
+                             virDomainMemoryStatPtr stats,
+                             unsigned int nr_stats)
+{
+    return qemuMonitorGetMemoryStats(qemuDomainGetMonitor(vm),
+                                     vm->def->memballoon, stats, nr_stats);
+}
+
 
+/*
+ * Append the RSS of @vm to the @nstats entries already filled in @stats.
+ * Returns the new count of entries.
+ */
+static int
+qemuDomainMemoryStatsAddRSS(virDomainObjPtr vm,
+                            virDomainMemoryStatPtr stats,
+                            unsigned int nr_stats,
+                            int nstats)
 {
-    int ret = -1;
     long rss;
 
+    if (nstats >= nr_stats)
+        return nstats;
+
+    if (qemuGetProcessInfo(NULL, NULL, &rss, vm->pid, 0) < 0) {
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                       _("cannot get RSS for domain"));
+    } else {
+        stats[nstats].tag = VIR_DOMAIN_MEMORY_STAT_RSS;
+        stats[nstats].val = rss;
+        nstats++;
+    }
+
+    return nstats;
+}
+
+
+static int
+qemuDomainMemoryStatsInternal(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm,
+                              virDomainMemoryStatPtr stats,
+                              unsigned int nr_stats)
+
+{
+    int ret = -1;
+
     if (!virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID,
                        "%s", _("domain is not running"));
         return -1;
     }
 
-    if (vm->def->memballoon &&
-        vm->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO) {
+    if (qemuDomainMemoryStatsHasMonitor(vm)) {
         qemuDomainObjEnterMonitor(driver, vm);
-        ret = qemuMonitorGetMemoryStats(qemuDomainGetMonitor(vm),
-                                        vm->def->memballoon, stats, nr_stats);
+        ret = qemuDomainMemoryStatsMonitor(vm, stats, nr_stats);
         if (qemuDomainObjExitMonitor(driver, vm) < 0)
             ret = -1;
 
-        if (ret < 0 || ret >= nr_stats)
+        if (ret < 0)
             return ret;
     } else {
         ret = 0;
     }
 
-    if (qemuGetProcessInfo(NULL, NULL, &rss, vm->pid, 0) < 0) {
-        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
-                       _("cannot get RSS for domain"));
-    } else {
-        stats[ret].tag = VIR_DOMAIN_MEMORY_STAT_RSS;
-        stats[ret].val = rss;
-        ret++;
-    }
-
-    return ret;
+    return qemuDomainMemoryStatsAddRSS(vm, stats, nr_stats, ret);
 }
 
 static int
@@ -11855,7 +12639,8 @@ qemuDomainMigratePerform(virDomainPtr dom,
      */
     ret = qemuMigrationPerform(driver, dom->conn, vm, NULL,
                                NULL, dconnuri, uri, NULL, NULL, 0, NULL, 0,
-                               compression, &migParams, cookie, cookielen,
+                               compression, &migParams, NULL, NULL,
+                               cookie, cookielen,
                                NULL, NULL, /* No output cookies in v2 */
                                flags, dname, resource, false);
 
@@ -11934,7 +12719,7 @@ qemuDomainMigrateBegin3(virDomainPtr domain,
     }
 
     return qemuMigrationBegin(domain->conn, vm, xmlin, dname,
-                              cookieout, cookieoutlen, 0, NULL, flags);
+                              cookieout, cookieoutlen, 0, NULL, 0, flags);
 }
 
 static char *
@@ -11949,6 +12734,7 @@ qemuDomainMigrateBegin3Params(virDomainPtr domain,
     const char *dname = NULL;
     const char **migrate_disks = NULL;
     int nmigrate_disks;
+    int nparallel = 0;
     char *ret = NULL;
     virDomainObjPtr vm;
 
@@ -11961,7 +12747,10 @@ qemuDomainMigrateBegin3Params(virDomainPtr domain,
                                 &xmlin) < 0 ||
         virTypedParamsGetString(params, nparams,
                                 VIR_MIGRATE_PARAM_DEST_NAME,
-                                &dname) < 0)
+                                &dname) < 0 ||
+        virTypedParamsGetInt(params, nparams,
+                             VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS,
+                             &nparallel) < 0)
         goto cleanup;
 
     nmigrate_disks = virTypedParamsGetStringList(params, nparams,
@@ -11981,7 +12770,8 @@ qemuDomainMigrateBegin3Params(virDomainPtr domain,
 
     ret = qemuMigrationBegin(domain->conn, vm, xmlin, dname,
                              cookieout, cookieoutlen,
-                             nmigrate_disks, migrate_disks, flags);
+                             nmigrate_disks, migrate_disks,
+                             nparallel, flags);
 
  cleanup:
     VIR_FREE(migrate_disks);
@@ -12263,7 +13053,7 @@ qemuDomainMigratePerform3(virDomainPtr dom,
 
     ret = qemuMigrationPerform(driver, dom->conn, vm, xmlin, NULL,
                                dconnuri, uri, NULL, NULL, 0, NULL, 0,
-                               compression, &migParams,
+                               compression, &migParams, NULL, NULL,
                                cookiein, cookieinlen,
                                cookieout, cookieoutlen,
                                flags, dname, resource, true);
@@ -12299,6 +13089,8 @@ qemuDomainMigratePerform3Params(virDomainPtr dom,
     int nbdPort = 0;
     qemuMigrationCompressionPtr compression = NULL;
     qemuMonitorMigrationParamsPtr migParams = NULL;
+    qemuMigrationMirrorPtr mirror = NULL;
+    qemuMigrationPolicyPtr policy = NULL;
     int ret = -1;
 
     virCheckFlags(QEMU_MIGRATION_FLAGS, -1);
@@ -12344,6 +13136,12 @@ qemuDomainMigratePerform3Params(virDomainPtr dom,
     if (!(compression = qemuMigrationCompressionParse(params, nparams, flags)))
         goto cleanup;
 
+    if (!(mirror = qemuMigrationMirrorParse(params, nparams, flags)))
+        goto cleanup;
+
+    if (!(policy = qemuMigrationPolicyParse(params, nparams, flags)))
+        goto cleanup;
+
     if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
 
@@ -12355,11 +13153,13 @@ qemuDomainMigratePerform3Params(virDomainPtr dom,
     ret = qemuMigrationPerform(driver, dom->conn, vm, dom_xml, persist_xml,
                                dconnuri, uri, graphicsuri, listenAddress,
                                nmigrate_disks, migrate_disks, nbdPort,
-                               compression, migParams,
+                               compression, migParams, mirror, policy,
                                cookiein, cookieinlen, cookieout, cookieoutlen,
                                flags, dname, bandwidth, true);
  cleanup:
     VIR_FREE(compression);
+    VIR_FREE(mirror);
+    VIR_FREE(policy);
     qemuMigrationParamsFree(&migParams);
     VIR_FREE(migrate_disks);
     return ret;
@@ -12762,6 +13562,7 @@ qemuDomainGetJobStatsInternal(virQEMUDriverPtr driver,
     qemuDomainObjPrivatePtr priv = vm->privateData;
     qemuDomainJobInfoPtr info;
     bool fetch = virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_MIGRATION_EVENT);
+    bool queued = false;
     int ret = -1;
 
     if (completed)
@@ -12803,9 +13604,16 @@ qemuDomainGetJobStatsInternal(virQEMUDriverPtr driver,
     }
     *jobInfo = *info;
 
+    /* A queued migration has not started in QEMU yet */
+    if (!completed &&
+        priv->job.asyncJob == QEMU_ASYNC_JOB_MIGRATION_OUT)
+        queued = qemuMigrationSchedulerGetPosition(driver, vm,
+                                                   &jobInfo->queuePosition,
+                                                   &jobInfo->queueTimeRemaining);
+
     if (jobInfo->type == VIR_DOMAIN_JOB_BOUNDED ||
         jobInfo->type == VIR_DOMAIN_JOB_UNBOUNDED) {
-        if (fetch)
+        if (fetch && !queued)
             ret = qemuMigrationFetchJobStatus(driver, vm, QEMU_ASYNC_JOB_NONE,
                                               jobInfo);
         else
@@ -12946,6 +13754,13 @@ static int qemuDomainAbortJob(virDomainPtr dom)
         goto endjob;
     }
 
+    if (priv->job.asyncJob == QEMU_ASYNC_JOB_MIGRATION_OUT &&
+        qemuMigrationSchedulerAbort(driver, vm)) {
+        VIR_DEBUG("Cancelling queued migration at client request");
+        ret = 0;
+        goto endjob;
+    }
+
     VIR_DEBUG("Cancelling job at client request");
     qemuDomainObjAbortAsyncJob(vm);
     qemuDomainObjEnterMonitor(driver, vm);
@@ -14067,6 +14882,134 @@ qemuDomainSnapshotUpdateDiskSources(qemuDomainSnapshotDiskDataPtr dd,
 }
 
 
+/* Maximum number of threads creating external snapshot images at once */
+#define QEMU_SNAPSHOT_CREATE_WORKERS 8
+
+struct qemuDomainSnapshotCreateImagesData {
+    qemuDomainSnapshotDiskDataPtr diskdata;
+    size_t ndiskdata;
+
+    virMutex lock;
+    size_t next;
+    bool failed;
+    virErrorPtr err;
+};
+
+
+static bool
+qemuDomainSnapshotDiskNeedsImage(qemuDomainSnapshotDiskDataPtr dd)
+{
+    return dd->src && !dd->created &&
+           dd->src->type != VIR_STORAGE_TYPE_BLOCK;
+}
+
+
+static void
+qemuDomainSnapshotCreateImagesWorker(void *opaque)
+{
+    struct qemuDomainSnapshotCreateImagesData *data = opaque;
+
+    while (true) {
+        qemuDomainSnapshotDiskDataPtr dd;
+        int rc;
+
+        virMutexLock(&data->lock);
+        while (data->next < data->ndiskdata &&
+               !qemuDomainSnapshotDiskNeedsImage(&data->diskdata[data->next]))
+            data->next++;
+        if (data->failed || data->next == data->ndiskdata) {
+            virMutexUnlock(&data->lock);
+            return;
+        }
+        dd = &data->diskdata[data->next++];
+        virMutexUnlock(&data->lock);
+
+        if ((rc = virStorageFileCreate(dd->src)) < 0)
+            virReportSystemError(errno, _("failed to create image file '%s'"),
+                                 NULLSTR(dd->src->path));
+
+        virMutexLock(&data->lock);
+        if (rc < 0) {
+            if (!data->failed)
+                data->err = virSaveLastError();
+            data->failed = true;
+        } else {
+            dd->created = true;
+        }
+        virMutexUnlock(&data->lock);
+    }
+}
+
+
+/*
+ * Pre-create the overlay images of all disks so that they can be
+ * labelled before handing them to qemu.  Depending on the storage that
+ * takes a few round trips per image, so for domains with many disks
+ * they are created from a few threads at once.  Labelling them stays
+ * sequential as it modifies the domain's namespace, cgroup and locks.
+ */
+static int
+qemuDomainSnapshotCreateImages(qemuDomainSnapshotDiskDataPtr diskdata,
+                               size_t ndiskdata)
+{
+    struct qemuDomainSnapshotCreateImagesData data;
+    virThread workers[QEMU_SNAPSHOT_CREATE_WORKERS - 1];
+    size_t nworkers = 0;
+    size_t npending = 0;
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; i < ndiskdata; i++) {
+        if (qemuDomainSnapshotDiskNeedsImage(&diskdata[i]))
+            npending++;
+    }
+
+    if (npending == 0)
+        return 0;
+
+    VIR_DEBUG("Creating %zu snapshot images", npending);
+
+    memset(&data, 0, sizeof(data));
+    data.diskdata = diskdata;
+    data.ndiskdata = ndiskdata;
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    /* The calling thread takes its share of the work as well */
+    for (i = 0; i < MIN(npending, QEMU_SNAPSHOT_CREATE_WORKERS) - 1; i++) {
+        /* Fewer threads just means less parallelism */
+        if (virThreadCreate(&workers[nworkers], true,
+                            qemuDomainSnapshotCreateImagesWorker, &data) < 0)
+            break;
+        nworkers++;
+    }
+
+    qemuDomainSnapshotCreateImagesWorker(&data);
+
+    for (i = 0; i < nworkers; i++)
+        virThreadJoin(&workers[i]);
+
+    if (data.failed) {
+        if (data.err)
+            virSetError(data.err);
+        else
+            virReportOOMError();
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virFreeError(data.err);
+    virMutexDestroy(&data.lock);
+    return ret;
+}
+
+
 /* The domain is expected to hold monitor lock.  */
 static int
 qemuDomainSnapshotCreateSingleDiskActive(virQEMUDriverPtr driver,
@@ -14088,15 +15031,8 @@ qemuDomainSnapshotCreateSingleDiskActive(virQEMUDriverPtr driver,
     if (qemuGetDriveSourceString(dd->src, NULL, &source) < 0)
         goto cleanup;
 
-    /* pre-create the image file so that we can label it before handing it to qemu */
-    if (!reuse && dd->src->type != VIR_STORAGE_TYPE_BLOCK) {
-        if (virStorageFileCreate(dd->src) < 0) {
-            virReportSystemError(errno, _("failed to create image file '%s'"),
-                                 source);
-            goto cleanup;
-        }
-        dd->created = true;
-    }
+    /* unless reused, the image was pre-created by
+     * qemuDomainSnapshotCreateImages */
 
     /* set correct security, cgroup and locking options on the new image */
     if (qemuDomainDiskChainElementPrepare(driver, vm, dd->src, false) < 0) {
@@ -14174,6 +15110,12 @@ qemuDomainSnapshotCreateDiskActive(virQEMUDriverPtr driver,
 
     cfg = virQEMUDriverGetConfig(driver);
 
+    if (!reuse &&
+        qemuDomainSnapshotCreateImages(diskdata, snap->def->ndisks) < 0) {
+        ret = -1;
+        goto error;
+    }
+
      /* Based on earlier qemuDomainSnapshotPrepare, all disks in this list are
       * now either VIR_DOMAIN_SNAPSHOT_LOCATION_NONE, or
       * VIR_DOMAIN_SNAPSHOT_LOCATION_EXTERNAL with a valid file name and
@@ -14575,6 +15517,11 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
     qemuDomainObjSetAsyncJobMask(vm, QEMU_JOB_NONE);
 
     if (redefine) {
+        /* The domain definition of a replaced snapshot may be reused */
+        if ((other = virDomainSnapshotFindByName(vm->snapshots, def->name)) &&
+            qemuDomainSnapshotParseDomain(driver, other) < 0)
+            goto endjob;
+
         if (virDomainSnapshotRedefinePrep(domain, vm, &def, &snap,
                                           &update_current, flags) < 0)
             goto endjob;
@@ -14696,14 +15643,15 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
                            snap->def->name);
             virDomainSnapshotObjListRemove(vm->snapshots, snap);
         } else {
-            if (update_current)
-                vm->current_snapshot = snap;
             other = virDomainSnapshotFindByName(vm->snapshots,
                                                 snap->def->parent);
-            snap->parent = other;
-            other->nchildren++;
-            snap->sibling = other->first_child;
-            other->first_child = snap;
+            if (virDomainSnapshotSetParent(snap, other) < 0) {
+                virObjectUnref(snapshot);
+                snapshot = NULL;
+                virDomainSnapshotObjListRemove(vm->snapshots, snap);
+            } else if (update_current) {
+                vm->current_snapshot = snap;
+            }
         }
     } else if (snap) {
         virDomainSnapshotObjListRemove(vm->snapshots, snap);
@@ -15021,6 +15969,9 @@ qemuDomainSnapshotGetXMLDesc(virDomainSnapshotPtr snapshot,
     if (!(snap = qemuSnapObjFromSnapshot(vm, snapshot)))
         goto cleanup;
 
+    if (qemuDomainSnapshotParseDomain(driver, snap) < 0)
+        goto cleanup;
+
     virUUIDFormat(snapshot->domain->uuid, uuidstr);
 
     xml = virDomainSnapshotDefFormat(uuidstr, snap->def, driver->caps,
@@ -15183,6 +16134,9 @@ qemuDomainRevertToSnapshot(virDomainSnapshotPtr snapshot,
         goto endjob;
     }
 
+    if (qemuDomainSnapshotParseDomain(driver, snap) < 0)
+        goto endjob;
+
     if (!(flags & VIR_DOMAIN_SNAPSHOT_REVERT_FORCE)) {
         if (!snap->def->dom) {
             virReportError(VIR_ERR_SNAPSHOT_REVERT_RISKY,
@@ -15482,7 +16436,6 @@ struct _virQEMUSnapReparent {
     virDomainObjPtr vm;
     virCapsPtr caps;
     int err;
-    virDomainSnapshotObjPtr last;
 };
 
 
@@ -15498,7 +16451,6 @@ qemuDomainSnapshotReparentChildren(void *payload,
         return 0;
 
     VIR_FREE(snap->def->parent);
-    snap->parent = rep->parent;
 
     if (rep->parent->def &&
         VIR_STRDUP(snap->def->parent, rep->parent->def->name) < 0) {
@@ -15506,9 +16458,6 @@ qemuDomainSnapshotReparentChildren(void *payload,
         return 0;
     }
 
-    if (!snap->sibling)
-        rep->last = snap;
-
     rep->err = qemuDomainSnapshotWriteMetadata(rep->vm, snap, rep->caps,
                                                rep->cfg->snapshotDir);
     return 0;
@@ -15595,22 +16544,17 @@ qemuDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
         rep.parent = snap->parent;
         rep.vm = vm;
         rep.err = 0;
-        rep.last = NULL;
         rep.caps = driver->caps;
         virDomainSnapshotForEachChild(snap,
                                       qemuDomainSnapshotReparentChildren,
                                       &rep);
-        if (rep.err < 0)
+        if (rep.err < 0 ||
+            virDomainSnapshotMoveChildren(snap, snap->parent) < 0)
             goto endjob;
-        /* Can't modify siblings during ForEachChild, so do it now.  */
-        snap->parent->nchildren += snap->nchildren;
-        rep.last->sibling = snap->parent->first_child;
-        snap->parent->first_child = snap->first_child;
     }
 
     if (flags & VIR_DOMAIN_SNAPSHOT_DELETE_CHILDREN_ONLY) {
-        snap->nchildren = 0;
-        snap->first_child = NULL;
+        virDomainSnapshotDropChildren(snap);
         ret = 0;
     } else {
         virDomainSnapshotDropParent(snap);
@@ -15663,6 +16607,9 @@ static int qemuDomainQemuMonitorCommand(virDomainPtr domain, const char *cmd,
     if (qemuDomainObjExitMonitor(driver, vm) < 0)
         ret = -1;
 
+    /* the command might have started or ended block jobs */
+    qemuBlockJobForget(vm);
+
  endjob:
     qemuDomainObjEndJob(driver, vm);
 
@@ -16142,7 +17089,7 @@ qemuDomainBlockPullCommon(virQEMUDriverPtr driver,
     if (ret < 0)
         goto endjob;
 
-    QEMU_DOMAIN_DISK_PRIVATE(disk)->blockjob = true;
+    qemuBlockJobStarted(disk);
 
  endjob:
     qemuDomainObjEndJob(driver, vm);
@@ -16331,6 +17278,8 @@ qemuDomainGetBlockJobInfo(virDomainPtr dom,
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
     virDomainDiskDefPtr disk;
+    qemuDomainDiskPrivatePtr diskPriv;
+    qemuBlockJobState state;
     int ret = -1;
     qemuMonitorBlockJobInfo rawInfo;
 
@@ -16360,12 +17309,39 @@ qemuDomainGetBlockJobInfo(virDomainPtr dom,
                        _("disk %s not found in the domain"), path);
         goto endjob;
     }
+    diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
 
-    qemuDomainObjEnterMonitor(driver, vm);
-    ret = qemuMonitorGetBlockJobInfo(qemuDomainGetMonitor(vm),
-                                     disk->info.alias, &rawInfo);
-    if (qemuDomainObjExitMonitor(driver, vm) < 0)
-        ret = -1;
+    /* Unless the job is still making progress, the events told us all
+     * there is to know. Migration runs its own mirror jobs which aren't
+     * tracked. */
+    state = diskPriv->migrating ? QEMU_BLOCKJOB_STATE_UNKNOWN :
+                                  diskPriv->blockJobState;
+    if (state == QEMU_BLOCKJOB_STATE_NONE) {
+        ret = 0;
+        goto endjob;
+    } else if (state == QEMU_BLOCKJOB_STATE_READY) {
+        rawInfo = diskPriv->blockJobInfo;
+        ret = 1;
+    } else {
+        qemuDomainObjEnterMonitor(driver, vm);
+        ret = qemuMonitorGetBlockJobInfo(qemuDomainGetMonitor(vm),
+                                         disk->info.alias, &rawInfo);
+        if (qemuDomainObjExitMonitor(driver, vm) < 0)
+            ret = -1;
+
+        /* Remember the answer unless an event arrived meanwhile */
+        if (ret >= 0 && !diskPriv->migrating &&
+            diskPriv->blockJobState == state) {
+            if (ret == 0) {
+                diskPriv->blockJobState = QEMU_BLOCKJOB_STATE_NONE;
+            } else if (rawInfo.ready == 1) {
+                diskPriv->blockJobInfo = rawInfo;
+                diskPriv->blockJobState = QEMU_BLOCKJOB_STATE_READY;
+            } else {
+                diskPriv->blockJobState = QEMU_BLOCKJOB_STATE_RUNNING;
+            }
+        }
+    }
     if (ret <= 0)
         goto endjob;
 
@@ -16457,6 +17433,9 @@ qemuDomainBlockJobSetSpeed(virDomainPtr dom,
     if (qemuDomainObjExitMonitor(driver, vm) < 0)
         ret = -1;
 
+    if (ret == 0)
+        QEMU_DOMAIN_DISK_PRIVATE(disk)->blockJobInfo.bandwidth = speed;
+
  endjob:
     qemuDomainObjEndJob(driver, vm);
 
@@ -16648,7 +17627,7 @@ qemuDomainBlockCopyCommon(virDomainObjPtr vm,
     disk->mirror = mirror;
     mirror = NULL;
     disk->mirrorJob = VIR_DOMAIN_BLOCK_JOB_TYPE_COPY;
-    QEMU_DOMAIN_DISK_PRIVATE(disk)->blockjob = true;
+    qemuBlockJobStarted(disk);
 
     if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
         VIR_WARN("Unable to save status on vm %s after state change",
@@ -16820,121 +17799,344 @@ qemuDomainBlockCopy(virDomainPtr dom, const char *disk, const char *destxml,
 }
 
 
+/* Name of the persistent dirty bitmap tracking the changes of a disk
+ * since its last backup */
+#define QEMU_DOMAIN_BACKUP_BITMAP "libvirt-backup"
+
 static int
-qemuDomainBlockPull(virDomainPtr dom, const char *path, unsigned long bandwidth,
-                    unsigned int flags)
+qemuDomainBlockBackup(virDomainPtr dom, const char *path, const char *destxml,
+                      virTypedParameterPtr params, int nparams,
+                      unsigned int flags)
 {
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virQEMUDriverConfigPtr cfg = NULL;
+    qemuDomainObjPrivatePtr priv;
     virDomainObjPtr vm;
-    virCheckFlags(VIR_DOMAIN_BLOCK_PULL_BANDWIDTH_BYTES, -1);
+    virDomainDiskDefPtr disk = NULL;
+    virStorageSourcePtr dest = NULL;
+    virJSONValuePtr actions = NULL;
+    virErrorPtr monitor_error = NULL;
+    char *device = NULL;
+    const char *format = NULL;
+    unsigned long long bandwidth = 0;
+    bool incremental = !!(flags & VIR_DOMAIN_BLOCK_BACKUP_INCREMENTAL);
+    bool reuse = !!(flags & VIR_DOMAIN_BLOCK_BACKUP_REUSE_EXT);
+    bool need_unlink = false;
+    struct stat st;
+    int exists;
+    int rc;
+    int ret = -1;
 
-    if (!(vm = qemuDomObjFromDomain(dom)))
+    virCheckFlags(VIR_DOMAIN_BLOCK_BACKUP_INCREMENTAL |
+                  VIR_DOMAIN_BLOCK_BACKUP_REUSE_EXT, -1);
+    if (virTypedParamsValidate(params, nparams,
+                               VIR_DOMAIN_BLOCK_BACKUP_BANDWIDTH,
+                               VIR_TYPED_PARAM_ULLONG,
+                               NULL) < 0)
         return -1;
 
-    if (virDomainBlockPullEnsureACL(dom->conn, vm->def) < 0) {
-        virDomainObjEndAPI(&vm);
+    if (virTypedParamsGetULLong(params, nparams,
+                                VIR_DOMAIN_BLOCK_BACKUP_BANDWIDTH,
+                                &bandwidth) < 0)
         return -1;
-    }
 
-    return qemuDomainBlockPullCommon(dom->conn->privateData,
-                                     vm, path, NULL, bandwidth, flags);
-}
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        return -1;
 
+    priv = vm->privateData;
+    cfg = virQEMUDriverGetConfig(driver);
 
-static int
-qemuDomainBlockCommit(virDomainPtr dom,
-                      const char *path,
-                      const char *base,
-                      const char *top,
-                      unsigned long bandwidth,
-                      unsigned int flags)
-{
-    virQEMUDriverPtr driver = dom->conn->privateData;
-    qemuDomainObjPrivatePtr priv;
-    virDomainObjPtr vm = NULL;
-    char *device = NULL;
-    int ret = -1;
-    virDomainDiskDefPtr disk = NULL;
-    virStorageSourcePtr topSource;
-    unsigned int topIndex = 0;
-    virStorageSourcePtr baseSource = NULL;
-    unsigned int baseIndex = 0;
-    virStorageSourcePtr top_parent = NULL;
-    bool clean_access = false;
-    char *topPath = NULL;
-    char *basePath = NULL;
-    char *backingPath = NULL;
-    virStorageSourcePtr mirror = NULL;
-    unsigned long long speed = bandwidth;
+    if (virDomainBlockBackupEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
 
-    /* XXX Add support for COMMIT_DELETE */
-    virCheckFlags(VIR_DOMAIN_BLOCK_COMMIT_SHALLOW |
-                  VIR_DOMAIN_BLOCK_COMMIT_ACTIVE |
-                  VIR_DOMAIN_BLOCK_COMMIT_RELATIVE |
-                  VIR_DOMAIN_BLOCK_COMMIT_BANDWIDTH_BYTES, -1);
+    if (!(dest = virDomainDiskDefSourceParse(destxml, vm->def, driver->xmlopt,
+                                             VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+        goto cleanup;
 
-    if (!(vm = qemuDomObjFromDomain(dom)))
+    if (virStorageSourceIsRelative(dest)) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("absolute path must be used as block backup target"));
         goto cleanup;
-    priv = vm->privateData;
+    }
 
-    if (virDomainBlockCommitEnsureACL(dom->conn, vm->def) < 0)
+    /* XXX Allow non-file backup destinations */
+    if (!virStorageSourceIsLocalStorage(dest)) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
+                       _("non-file destination not supported yet"));
         goto cleanup;
+    }
 
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
         goto cleanup;
 
     if (!virDomainObjIsActive(vm)) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       "%s", _("domain is not running"));
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("domain is not running"));
         goto endjob;
     }
-    /* Ensure that no one backports commit to RHEL 6.2, where cancel
-     * behaved differently */
-    if (!(virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BLOCK_COMMIT) &&
+
+    if (!(virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BITMAP_PERSISTENT) &&
           virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BLOCKJOB_ASYNC))) {
         virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
-                       _("online commit not supported with this QEMU binary"));
+                       _("block backup is not supported with this QEMU binary"));
         goto endjob;
     }
 
-    /* Convert bandwidth MiB to bytes, if necessary */
-    if (!(flags & VIR_DOMAIN_BLOCK_COMMIT_BANDWIDTH_BYTES)) {
-        if (speed > LLONG_MAX >> 20) {
-            virReportError(VIR_ERR_OVERFLOW,
-                           _("bandwidth must be less than %llu"),
-                           LLONG_MAX >> 20);
-            goto endjob;
-        }
-        speed <<= 20;
-    }
-
     if (!(disk = qemuDomainDiskByName(vm->def, path)))
         goto endjob;
 
     if (!(device = qemuAliasFromDisk(disk)))
         goto endjob;
 
-    if (!disk->src->path) {
+    if (qemuDomainDiskBlockJobIsActive(disk))
+        goto endjob;
+
+    /* the dirty bitmap has to survive restarts of the domain and is
+     * therefore stored in the image itself */
+    if (disk->src->format != VIR_STORAGE_FILE_QCOW2) {
         virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
-                       _("disk %s has no source file to be committed"),
+                       _("block backup of disk '%s' requires a qcow2 image"),
                        disk->dst);
         goto endjob;
     }
 
-    if (qemuDomainDiskBlockJobIsActive(disk))
+    if (stat(dest->path, &st) < 0) {
+        if (errno != ENOENT || reuse) {
+            virReportSystemError(errno,
+                                 _("unable to stat backup target for disk %s: %s"),
+                                 disk->dst, dest->path);
+            goto endjob;
+        }
+    } else if (!S_ISBLK(st.st_mode) && st.st_size && !reuse) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("external destination file for disk %s already "
+                         "exists and is not a block device: %s"),
+                       disk->dst, dest->path);
         goto endjob;
+    }
 
-    if (!top)
-        topSource = disk->src;
-    else if (virStorageFileParseChainIndex(disk->dst, top, &topIndex) < 0 ||
-             !(topSource = virStorageFileChainLookup(disk->src, NULL,
-                                                     top, topIndex,
-                                                     &top_parent)))
-        goto endjob;
+    if (!dest->format) {
+        if (!reuse)
+            dest->format = disk->src->format;
+        else
+            dest->format = virStorageFileProbeFormat(dest->path, cfg->user,
+                                                     cfg->group);
+    }
 
-    if (topSource == disk->src) {
-        if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_ACTIVE_COMMIT)) {
-            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
-                           _("active commit not supported with this QEMU binary"));
+    if (!reuse) {
+        int fd = qemuOpenFile(driver, vm, dest->path,
+                              O_WRONLY | O_TRUNC | O_CREAT,
+                              &need_unlink, NULL);
+        if (fd < 0)
+            goto endjob;
+        VIR_FORCE_CLOSE(fd);
+    }
+
+    if (dest->format > 0)
+        format = virStorageFileFormatTypeToString(dest->format);
+
+    if (virStorageSourceInitChainElement(dest, disk->src, false) < 0)
+        goto endjob;
+
+    if (qemuDomainDiskChainElementPrepare(driver, vm, dest, false) < 0) {
+        qemuDomainDiskChainElementRevoke(driver, vm, dest);
+        goto endjob;
+    }
+
+    if (!(actions = virJSONValueNewArray()))
+        goto revoke;
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    exists = qemuMonitorBlockDirtyBitmapExists(priv->mon, device,
+                                               QEMU_DOMAIN_BACKUP_BITMAP);
+    if (exists < 0)
+        goto exit_monitor;
+
+    if (incremental && !exists) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("no previous backup of disk '%s' is known"),
+                       disk->dst);
+        goto exit_monitor;
+    }
+
+    /* A full backup restarts the tracking of changes at its point in
+     * time; an incremental one makes qemu clear the bitmap by itself
+     * once it completes and fold it back if the job fails. */
+    if (!incremental) {
+        if (exists)
+            rc = qemuMonitorBlockDirtyBitmapClear(priv->mon, actions, device,
+                                                  QEMU_DOMAIN_BACKUP_BITMAP);
+        else
+            rc = qemuMonitorBlockDirtyBitmapAdd(priv->mon, actions, device,
+                                                QEMU_DOMAIN_BACKUP_BITMAP,
+                                                true);
+        if (rc < 0)
+            goto exit_monitor;
+    }
+
+    if (qemuMonitorDriveBackup(priv->mon, actions, device, dest->path, format,
+                               incremental ? QEMU_DOMAIN_BACKUP_BITMAP : NULL,
+                               bandwidth, reuse) < 0)
+        goto exit_monitor;
+
+    ret = qemuMonitorTransaction(priv->mon, actions);
+
+ exit_monitor:
+    virDomainAuditDisk(vm, NULL, dest, "backup", ret >= 0);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0)
+        ret = -1;
+    if (ret < 0)
+        goto revoke;
+
+    need_unlink = false;
+    disk->mirror = dest;
+    dest = NULL;
+    disk->mirrorJob = VIR_DOMAIN_BLOCK_JOB_TYPE_BACKUP;
+    qemuBlockJobStarted(disk);
+
+    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        VIR_WARN("Unable to save status on vm %s after state change",
+                 vm->def->name);
+    goto endjob;
+
+ revoke:
+    monitor_error = virSaveLastError();
+    qemuDomainDiskChainElementRevoke(driver, vm, dest);
+
+ endjob:
+    if (need_unlink && unlink(dest->path))
+        VIR_WARN("unable to unlink just-created %s", dest->path);
+    qemuDomainObjEndJob(driver, vm);
+    if (monitor_error) {
+        virSetError(monitor_error);
+        virFreeError(monitor_error);
+    }
+
+ cleanup:
+    virJSONValueFree(actions);
+    virStorageSourceFree(dest);
+    VIR_FREE(device);
+    virObjectUnref(cfg);
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
+
+
+static int
+qemuDomainBlockPull(virDomainPtr dom, const char *path, unsigned long bandwidth,
+                    unsigned int flags)
+{
+    virDomainObjPtr vm;
+    virCheckFlags(VIR_DOMAIN_BLOCK_PULL_BANDWIDTH_BYTES, -1);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        return -1;
+
+    if (virDomainBlockPullEnsureACL(dom->conn, vm->def) < 0) {
+        virDomainObjEndAPI(&vm);
+        return -1;
+    }
+
+    return qemuDomainBlockPullCommon(dom->conn->privateData,
+                                     vm, path, NULL, bandwidth, flags);
+}
+
+
+static int
+qemuDomainBlockCommit(virDomainPtr dom,
+                      const char *path,
+                      const char *base,
+                      const char *top,
+                      unsigned long bandwidth,
+                      unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    qemuDomainObjPrivatePtr priv;
+    virDomainObjPtr vm = NULL;
+    char *device = NULL;
+    int ret = -1;
+    virDomainDiskDefPtr disk = NULL;
+    virStorageSourcePtr topSource;
+    unsigned int topIndex = 0;
+    virStorageSourcePtr baseSource = NULL;
+    unsigned int baseIndex = 0;
+    virStorageSourcePtr top_parent = NULL;
+    bool clean_access = false;
+    char *topPath = NULL;
+    char *basePath = NULL;
+    char *backingPath = NULL;
+    virStorageSourcePtr mirror = NULL;
+    unsigned long long speed = bandwidth;
+
+    /* XXX Add support for COMMIT_DELETE */
+    virCheckFlags(VIR_DOMAIN_BLOCK_COMMIT_SHALLOW |
+                  VIR_DOMAIN_BLOCK_COMMIT_ACTIVE |
+                  VIR_DOMAIN_BLOCK_COMMIT_RELATIVE |
+                  VIR_DOMAIN_BLOCK_COMMIT_BANDWIDTH_BYTES, -1);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+    priv = vm->privateData;
+
+    if (virDomainBlockCommitEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto endjob;
+    }
+    /* Ensure that no one backports commit to RHEL 6.2, where cancel
+     * behaved differently */
+    if (!(virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BLOCK_COMMIT) &&
+          virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BLOCKJOB_ASYNC))) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("online commit not supported with this QEMU binary"));
+        goto endjob;
+    }
+
+    /* Convert bandwidth MiB to bytes, if necessary */
+    if (!(flags & VIR_DOMAIN_BLOCK_COMMIT_BANDWIDTH_BYTES)) {
+        if (speed > LLONG_MAX >> 20) {
+            virReportError(VIR_ERR_OVERFLOW,
+                           _("bandwidth must be less than %llu"),
+                           LLONG_MAX >> 20);
+            goto endjob;
+        }
+        speed <<= 20;
+    }
+
+    if (!(disk = qemuDomainDiskByName(vm->def, path)))
+        goto endjob;
+
+    if (!(device = qemuAliasFromDisk(disk)))
+        goto endjob;
+
+    if (!disk->src->path) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("disk %s has no source file to be committed"),
+                       disk->dst);
+        goto endjob;
+    }
+
+    if (qemuDomainDiskBlockJobIsActive(disk))
+        goto endjob;
+
+    if (!top)
+        topSource = disk->src;
+    else if (virStorageFileParseChainIndex(disk->dst, top, &topIndex) < 0 ||
+             !(topSource = virStorageFileChainLookup(disk->src, NULL,
+                                                     top, topIndex,
+                                                     &top_parent)))
+        goto endjob;
+
+    if (topSource == disk->src) {
+        if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_ACTIVE_COMMIT)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("active commit not supported with this QEMU binary"));
             goto endjob;
         }
         /* XXX Should we auto-pivot when COMMIT_ACTIVE is not specified? */
@@ -17042,7 +18244,7 @@ qemuDomainBlockCommit(virDomainPtr dom,
     }
 
     if (ret == 0)
-        QEMU_DOMAIN_DISK_PRIVATE(disk)->blockjob = true;
+        qemuBlockJobStarted(disk);
 
     if (mirror) {
         if (ret == 0) {
@@ -18688,9 +19890,7 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
     virQEMUCapsPtr qemuCaps = NULL;
     int virttype = VIR_DOMAIN_VIRT_NONE;
     virDomainVirtType capsType;
-    virDomainCapsPtr domCaps = NULL;
     int arch = virArchFromHost(); /* virArch */
-    virQEMUDriverConfigPtr cfg = NULL;
     virCapsPtr caps = NULL;
 
     virCheckFlags(0, ret);
@@ -18698,8 +19898,6 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
     if (virConnectGetDomainCapabilitiesEnsureACL(conn) < 0)
         return ret;
 
-    cfg = virQEMUDriverGetConfig(driver);
-
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
         goto cleanup;
 
@@ -18778,42 +19976,78 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
         goto cleanup;
     }
 
-    if (!(domCaps = virDomainCapsNew(emulatorbin, machine, arch, virttype)))
-        goto cleanup;
-
-    if (virQEMUCapsFillDomainCaps(caps, domCaps, qemuCaps,
-                                  cfg->firmwares, cfg->nfirmwares) < 0)
-        goto cleanup;
-
-    ret = virDomainCapsFormat(domCaps);
+    ret = virQEMUDriverGetDomainCapsXML(driver, caps, qemuCaps, emulatorbin,
+                                        machine, arch, virttype);
  cleanup:
-    virObjectUnref(cfg);
     virObjectUnref(caps);
-    virObjectUnref(domCaps);
     virObjectUnref(qemuCaps);
     return ret;
 }
 
 
+typedef struct _qemuDomainGetStatsShared qemuDomainGetStatsShared;
+typedef qemuDomainGetStatsShared *qemuDomainGetStatsSharedPtr;
+/* Host data read once for all domains of a bulk stats call */
+struct _qemuDomainGetStatsShared {
+    /* virDomainInterfaceStats of all host interfaces keyed by name, or
+     * NULL if they are to be read per interface */
+    virHashTablePtr ifstats;
+};
+
+
+static void
+qemuDomainGetStatsSharedInit(qemuDomainGetStatsSharedPtr shared,
+                             unsigned int stats)
+{
+    memset(shared, 0, sizeof(*shared));
+
+    if (stats & VIR_DOMAIN_STATS_INTERFACE &&
+        !(shared->ifstats = virNetDevTapInterfaceStatsAll())) {
+        VIR_DEBUG("Falling back to per interface stats: %s",
+                  virGetLastErrorMessage());
+        virResetLastError();
+    }
+}
+
+
+static void
+qemuDomainGetStatsSharedClear(qemuDomainGetStatsSharedPtr shared)
+{
+    virHashFree(shared->ifstats);
+    shared->ifstats = NULL;
+}
+
+
+typedef struct _qemuDomainGetStatsMonitorData qemuDomainGetStatsMonitorData;
+typedef qemuDomainGetStatsMonitorData *qemuDomainGetStatsMonitorDataPtr;
+/* Data of the balloon and vcpu groups of one domain, queried in a single
+ * monitor session by qemuDomainGetStatsMonitorPrefetch */
+struct _qemuDomainGetStatsMonitorData {
+    bool memstatsDone;
+    int nmemstats; /* -1 if the monitor failed */
+    virDomainMemoryStatStruct memstats[VIR_DOMAIN_MEMORY_STAT_NR];
+
+    bool haltedDone;
+    int haltedRet; /* as returned by qemuDomainRefreshVcpuHalted */
+};
+
+
 static int
 qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                         virDomainObjPtr dom,
-                        virDomainStatsRecordPtr record,
-                        int *maxparams,
-                        unsigned int privflags ATTRIBUTE_UNUSED)
-{
-    if (virTypedParamsAddInt(&record->params,
-                             &record->nparams,
-                             maxparams,
-                             "state.state",
-                             dom->state.state) < 0)
+                        virTypedParamListPtr params,
+                        unsigned int privflags ATTRIBUTE_UNUSED,
+                        qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                        qemuDomainGetStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED)
+{
+    if (virTypedParamListAddInt(params, dom->state.state, "state.state") < 0)
+        return -1;
+
+    if (virTypedParamListAddInt(params, dom->state.reason, "state.reason") < 0)
         return -1;
 
-    if (virTypedParamsAddInt(&record->params,
-                             &record->nparams,
-                             maxparams,
-                             "state.reason",
-                             dom->state.reason) < 0)
+    if (virTypedParamListAddULLong(params, dom->generation,
+                                   "state.generation") < 0)
         return -1;
 
     return 0;
@@ -18831,12 +20065,66 @@ typedef enum {
 #define HAVE_JOB(flags) ((flags) & QEMU_DOMAIN_STATS_HAVE_JOB)
 
 
+/*
+ * The balloon and vcpu groups both need the monitor of @dom. Instead of
+ * each of them entering it on their own, query everything they need in
+ * a single monitor session; the groups then only format @mondata.
+ */
+static void
+qemuDomainGetStatsMonitorPrefetch(virQEMUDriverPtr driver,
+                                  virDomainObjPtr dom,
+                                  unsigned int stats,
+                                  unsigned int privflags,
+                                  qemuDomainGetStatsMonitorDataPtr mondata)
+{
+    virBitmapPtr haltedmap = NULL;
+    bool memstats;
+    bool halted;
+
+    memset(mondata, 0, sizeof(*mondata));
+
+    if (!HAVE_JOB(privflags) || !virDomainObjIsActive(dom))
+        return;
+
+    memstats = stats & VIR_DOMAIN_STATS_BALLOON &&
+               qemuDomainMemoryStatsHasMonitor(dom);
+    halted = stats & VIR_DOMAIN_STATS_VCPU && qemuDomainHasVcpuHalted(dom);
+
+    /* a single group is best left doing its own thing */
+    if (!memstats || !halted)
+        return;
+
+    qemuDomainObjEnterMonitor(driver, dom);
+
+    mondata->nmemstats = qemuDomainMemoryStatsMonitor(dom, mondata->memstats,
+                                                      VIR_DOMAIN_MEMORY_STAT_NR);
+    mondata->haltedRet = qemuDomainRefreshVcpuHaltedMonitor(dom, &haltedmap);
+
+    /* Both groups are fine with the data missing, the errors would
+     * only leak into the result of the API. */
+    virResetLastError();
+
+    if (qemuDomainObjExitMonitor(driver, dom) < 0) {
+        virResetLastError();
+        mondata->nmemstats = -1;
+        mondata->haltedRet = -1;
+    } else if (mondata->haltedRet > 0) {
+        qemuDomainSetVcpuHalted(dom, haltedmap);
+    }
+
+    mondata->memstatsDone = true;
+    mondata->haltedDone = true;
+    virBitmapFree(haltedmap);
+}
+
+
 static int
 qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                       virDomainObjPtr dom,
-                      virDomainStatsRecordPtr record,
-                      int *maxparams,
-                      unsigned int privflags ATTRIBUTE_UNUSED)
+                      virTypedParamListPtr params,
+                      unsigned int privflags ATTRIBUTE_UNUSED,
+                      qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                      qemuDomainGetStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
     unsigned long long cpu_time = 0;
@@ -18848,25 +20136,13 @@ qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
         return 0;
 
     err = virCgroupGetCpuacctUsage(priv->cgroup, &cpu_time);
-    if (!err && virTypedParamsAddULLong(&record->params,
-                                        &record->nparams,
-                                        maxparams,
-                                        "cpu.time",
-                                        cpu_time) < 0)
+    if (!err && virTypedParamListAddULLong(params, cpu_time, "cpu.time") < 0)
         return -1;
 
     err = virCgroupGetCpuacctStat(priv->cgroup, &user_time, &sys_time);
-    if (!err && virTypedParamsAddULLong(&record->params,
-                                        &record->nparams,
-                                        maxparams,
-                                        "cpu.user",
-                                        user_time) < 0)
+    if (!err && virTypedParamListAddULLong(params, user_time, "cpu.user") < 0)
         return -1;
-    if (!err && virTypedParamsAddULLong(&record->params,
-                                        &record->nparams,
-                                        maxparams,
-                                        "cpu.system",
-                                        sys_time) < 0)
+    if (!err && virTypedParamListAddULLong(params, sys_time, "cpu.system") < 0)
         return -1;
 
     return 0;
@@ -18875,9 +20151,10 @@ qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
 static int
 qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
                           virDomainObjPtr dom,
-                          virDomainStatsRecordPtr record,
-                          int *maxparams,
-                          unsigned int privflags)
+                          virTypedParamListPtr params,
+                          unsigned int privflags,
+                          qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                          qemuDomainGetStatsMonitorDataPtr mondata)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
     virDomainMemoryStatStruct stats[VIR_DOMAIN_MEMORY_STAT_NR];
@@ -18894,35 +20171,36 @@ qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
         err = -1;
     }
 
-    if (!err && virTypedParamsAddULLong(&record->params,
-                                        &record->nparams,
-                                        maxparams,
-                                        "balloon.current",
-                                        cur_balloon) < 0)
+    if (!err &&
+        virTypedParamListAddULLong(params, cur_balloon, "balloon.current") < 0)
         return -1;
 
-    if (virTypedParamsAddULLong(&record->params,
-                                &record->nparams,
-                                maxparams,
-                                "balloon.maximum",
-                                virDomainDefGetMemoryTotal(dom->def)) < 0)
+    if (virTypedParamListAddULLong(params, virDomainDefGetMemoryTotal(dom->def),
+                                   "balloon.maximum") < 0)
         return -1;
 
     if (!HAVE_JOB(privflags) || !virDomainObjIsActive(dom))
         return 0;
 
-    nr_stats = qemuDomainMemoryStatsInternal(driver, dom, stats,
-                                             VIR_DOMAIN_MEMORY_STAT_NR);
+    if (mondata && mondata->memstatsDone) {
+        if (mondata->nmemstats < 0)
+            return 0;
+        memcpy(stats, mondata->memstats,
+               sizeof(stats[0]) * mondata->nmemstats);
+        nr_stats = qemuDomainMemoryStatsAddRSS(dom, stats,
+                                               VIR_DOMAIN_MEMORY_STAT_NR,
+                                               mondata->nmemstats);
+    } else {
+        nr_stats = qemuDomainMemoryStatsInternal(driver, dom, stats,
+                                                 VIR_DOMAIN_MEMORY_STAT_NR);
+    }
     if (nr_stats < 0)
         return 0;
 
 #define STORE_MEM_RECORD(TAG, NAME)                                             \
     if (stats[i].tag == VIR_DOMAIN_MEMORY_STAT_ ##TAG)                          \
-        if (virTypedParamsAddULLong(&record->params,                            \
-                                    &record->nparams,                           \
-                                    maxparams,                                  \
-                                    "balloon." NAME,                            \
-                                    stats[i].val) < 0)                          \
+        if (virTypedParamListAddULLong(params, stats[i].val,                    \
+                                       "balloon." NAME) < 0)                    \
             return -1;
 
     for (i = 0; i < nr_stats; i++) {
@@ -18946,29 +20224,23 @@ qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
 static int
 qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
                        virDomainObjPtr dom,
-                       virDomainStatsRecordPtr record,
-                       int *maxparams,
-                       unsigned int privflags)
+                       virTypedParamListPtr params,
+                       unsigned int privflags,
+                       qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                       qemuDomainGetStatsMonitorDataPtr mondata)
 {
     size_t i;
     int ret = -1;
-    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
     virVcpuInfoPtr cpuinfo = NULL;
     unsigned long long *cpuwait = NULL;
     bool *cpuhalted = NULL;
 
-    if (virTypedParamsAddUInt(&record->params,
-                              &record->nparams,
-                              maxparams,
-                              "vcpu.current",
-                              virDomainDefGetVcpus(dom->def)) < 0)
+    if (virTypedParamListAddUInt(params, virDomainDefGetVcpus(dom->def),
+                                 "vcpu.current") < 0)
         return -1;
 
-    if (virTypedParamsAddUInt(&record->params,
-                              &record->nparams,
-                              maxparams,
-                              "vcpu.maximum",
-                              virDomainDefGetVcpusMax(dom->def)) < 0)
+    if (virTypedParamListAddUInt(params, virDomainDefGetVcpusMax(dom->def),
+                                 "vcpu.maximum") < 0)
         return -1;
 
     if (VIR_ALLOC_N(cpuinfo, virDomainDefGetVcpus(dom->def)) < 0 ||
@@ -18976,12 +20248,19 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
         goto cleanup;
 
     if (HAVE_JOB(privflags) && virDomainObjIsActive(dom)) {
-        if (qemuDomainRefreshVcpuHalted(driver, dom,
-                                        QEMU_ASYNC_JOB_NONE) < 0) {
+        int rc;
+
+        if (mondata && mondata->haltedDone)
+            rc = mondata->haltedRet;
+        else
+            rc = qemuDomainRefreshVcpuHalted(driver, dom, QEMU_ASYNC_JOB_NONE);
+
+        if (rc < 0) {
             /* it's ok to be silent and go ahead, because halted vcpu info
              * wasn't here from the beginning */
             virResetLastError();
-        } else if (VIR_ALLOC_N(cpuhalted, virDomainDefGetVcpus(dom->def)) < 0) {
+        } else if (rc > 0 &&
+                   VIR_ALLOC_N(cpuhalted, virDomainDefGetVcpus(dom->def)) < 0) {
             goto cleanup;
         }
     }
@@ -18995,44 +20274,25 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
     }
 
     for (i = 0; i < virDomainDefGetVcpus(dom->def); i++) {
-        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
-                 "vcpu.%u.state", cpuinfo[i].number);
-        if (virTypedParamsAddInt(&record->params,
-                                 &record->nparams,
-                                 maxparams,
-                                 param_name,
-                                 cpuinfo[i].state) < 0)
+        if (virTypedParamListAddInt(params, cpuinfo[i].state,
+                                    "vcpu.%u.state", cpuinfo[i].number) < 0)
             goto cleanup;
 
         /* stats below are available only if the VM is alive */
         if (!virDomainObjIsActive(dom))
             continue;
 
-        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
-                 "vcpu.%u.time", cpuinfo[i].number);
-        if (virTypedParamsAddULLong(&record->params,
-                                    &record->nparams,
-                                    maxparams,
-                                    param_name,
-                                    cpuinfo[i].cpuTime) < 0)
+        if (virTypedParamListAddULLong(params, cpuinfo[i].cpuTime,
+                                       "vcpu.%u.time", cpuinfo[i].number) < 0)
             goto cleanup;
-        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
-                 "vcpu.%u.wait", cpuinfo[i].number);
-        if (virTypedParamsAddULLong(&record->params,
-                                    &record->nparams,
-                                    maxparams,
-                                    param_name,
-                                    cpuwait[i]) < 0)
+        if (virTypedParamListAddULLong(params, cpuwait[i],
+                                       "vcpu.%u.wait", cpuinfo[i].number) < 0)
             goto cleanup;
 
         if (cpuhalted) {
-            snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,
-                     "vcpu.%u.halted", cpuinfo[i].number);
-            if (virTypedParamsAddBoolean(&record->params,
-                                         &record->nparams,
-                                         maxparams,
-                                         param_name,
-                                         cpuhalted[i]) < 0)
+            if (virTypedParamListAddBoolean(params, cpuhalted[i],
+                                            "vcpu.%u.halted",
+                                            cpuinfo[i].number) < 0)
                 goto cleanup;
         }
     }
@@ -19046,50 +20306,33 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
     return ret;
 }
 
-#define QEMU_ADD_COUNT_PARAM(record, maxparams, type, count) \
+#define QEMU_ADD_COUNT_PARAM(params, type, count) \
 do { \
-    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
-    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "%s.count", type); \
-    if (virTypedParamsAddUInt(&(record)->params, \
-                              &(record)->nparams, \
-                              maxparams, \
-                              param_name, \
-                              count) < 0) \
+    if (virTypedParamListAddUInt(params, count, "%s.count", type) < 0) \
         goto cleanup; \
 } while (0)
 
-#define QEMU_ADD_NAME_PARAM(record, maxparams, type, subtype, num, name) \
+#define QEMU_ADD_NAME_PARAM(params, type, subtype, num, name) \
 do { \
-    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
-    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
-             "%s.%zu.%s", type, num, subtype); \
-    if (virTypedParamsAddString(&(record)->params, \
-                                &(record)->nparams, \
-                                maxparams, \
-                                param_name, \
-                                name) < 0) \
+    if (virTypedParamListAddString(params, name, \
+                                   "%s.%zu.%s", type, num, subtype) < 0) \
         goto cleanup; \
 } while (0)
 
-#define QEMU_ADD_NET_PARAM(record, maxparams, num, name, value) \
+#define QEMU_ADD_NET_PARAM(params, num, name, value) \
 do { \
-    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
-    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
-             "net.%zu.%s", num, name); \
-    if (value >= 0 && virTypedParamsAddULLong(&(record)->params, \
-                                              &(record)->nparams, \
-                                              maxparams, \
-                                              param_name, \
-                                              value) < 0) \
+    if (value >= 0 && \
+        virTypedParamListAddULLong(params, value, "net.%zu.%s", num, name) < 0) \
         return -1; \
 } while (0)
 
 static int
 qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                             virDomainObjPtr dom,
-                            virDomainStatsRecordPtr record,
-                            int *maxparams,
-                            unsigned int privflags ATTRIBUTE_UNUSED)
+                            virTypedParamListPtr params,
+                            unsigned int privflags ATTRIBUTE_UNUSED,
+                            qemuDomainGetStatsSharedPtr shared,
+                            qemuDomainGetStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED)
 {
     size_t i;
     struct _virDomainInterfaceStats tmp;
@@ -19098,7 +20341,7 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
     if (!virDomainObjIsActive(dom))
         return 0;
 
-    QEMU_ADD_COUNT_PARAM(record, maxparams, "net", dom->def->nnets);
+    QEMU_ADD_COUNT_PARAM(params, "net", dom->def->nnets);
 
     /* Check the path is one of the domain's network interfaces. */
     for (i = 0; i < dom->def->nnets; i++) {
@@ -19107,7 +20350,7 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
 
         memset(&tmp, 0, sizeof(tmp));
 
-        QEMU_ADD_NAME_PARAM(record, maxparams,
+        QEMU_ADD_NAME_PARAM(params,
                             "net", "name", i, dom->def->nets[i]->ifname);
 
         if (dom->def->nets[i]->type == VIR_DOMAIN_NET_TYPE_VHOSTUSER) {
@@ -19116,6 +20359,13 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                 virResetLastError();
                 continue;
             }
+        } else if (shared->ifstats) {
+            virDomainInterfaceStatsPtr found;
+
+            if (!(found = virHashLookup(shared->ifstats,
+                                        dom->def->nets[i]->ifname)))
+                continue;
+            tmp = *found;
         } else {
             if (virNetDevTapInterfaceStats(dom->def->nets[i]->ifname, &tmp) < 0) {
                 virResetLastError();
@@ -19123,21 +20373,21 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
             }
         }
 
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "rx.bytes", tmp.rx_bytes);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "rx.pkts", tmp.rx_packets);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "rx.errs", tmp.rx_errs);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "rx.drop", tmp.rx_drop);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "tx.bytes", tmp.tx_bytes);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "tx.pkts", tmp.tx_packets);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "tx.errs", tmp.tx_errs);
-        QEMU_ADD_NET_PARAM(record, maxparams, i,
+        QEMU_ADD_NET_PARAM(params, i,
                            "tx.drop", tmp.tx_drop);
     }
 
@@ -19148,43 +20398,26 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
 
 #undef QEMU_ADD_NET_PARAM
 
-#define QEMU_ADD_BLOCK_PARAM_UI(record, maxparams, num, name, value) \
+#define QEMU_ADD_BLOCK_PARAM_UI(params, num, name, value)            \
     do {                                                             \
-        char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];               \
-        snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH,           \
-                 "block.%zu.%s", num, name);                         \
-        if (virTypedParamsAddUInt(&(record)->params,                 \
-                                  &(record)->nparams,                \
-                                  maxparams,                         \
-                                  param_name,                        \
-                                  value) < 0)                        \
+        if (virTypedParamListAddUInt(params, value,                  \
+                                     "block.%zu.%s", num, name) < 0) \
             goto cleanup;                                            \
     } while (0)
 
 /* expects a LL, but typed parameter must be ULL */
-#define QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, num, name, value) \
+#define QEMU_ADD_BLOCK_PARAM_LL(params, num, name, value) \
 do { \
-    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
-    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
-             "block.%zu.%s", num, name); \
-    if (value >= 0 && virTypedParamsAddULLong(&(record)->params, \
-                                              &(record)->nparams, \
-                                              maxparams, \
-                                              param_name, \
-                                              value) < 0) \
+    if (value >= 0 && \
+        virTypedParamListAddULLong(params, value, \
+                                   "block.%zu.%s", num, name) < 0) \
         goto cleanup; \
 } while (0)
 
-#define QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, num, name, value) \
+#define QEMU_ADD_BLOCK_PARAM_ULL(params, num, name, value) \
 do { \
-    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH]; \
-    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, \
-             "block.%zu.%s", num, name); \
-    if (virTypedParamsAddULLong(&(record)->params, \
-                                &(record)->nparams, \
-                                maxparams, \
-                                param_name, \
-                                value) < 0) \
+    if (virTypedParamListAddULLong(params, value, \
+                                   "block.%zu.%s", num, name) < 0) \
         goto cleanup; \
 } while (0)
 
@@ -19193,8 +20426,7 @@ static int
 qemuDomainGetStatsOneBlockFallback(virQEMUDriverPtr driver,
                                    virQEMUDriverConfigPtr cfg,
                                    virDomainObjPtr dom,
-                                   virDomainStatsRecordPtr record,
-                                   int *maxparams,
+                                   virTypedParamListPtr params,
                                    virStorageSourcePtr src,
                                    size_t block_idx)
 {
@@ -19209,13 +20441,13 @@ qemuDomainGetStatsOneBlockFallback(virQEMUDriverPtr driver,
     }
 
     if (src->allocation)
-        QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+        QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                                  "allocation", src->allocation);
     if (src->capacity)
-        QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+        QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                                  "capacity", src->capacity);
     if (src->physical)
-        QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+        QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                                  "physical", src->physical);
     ret = 0;
  cleanup:
@@ -19224,8 +20456,7 @@ qemuDomainGetStatsOneBlockFallback(virQEMUDriverPtr driver,
 
 
 static int
-qemuDomainGetStatsOneBlockNode(virDomainStatsRecordPtr record,
-                               int *maxparams,
+qemuDomainGetStatsOneBlockNode(virTypedParamListPtr params,
                                virStorageSourcePtr src,
                                size_t block_idx,
                                virHashTablePtr nodedata)
@@ -19238,7 +20469,7 @@ qemuDomainGetStatsOneBlockNode(virDomainStatsRecordPtr record,
         (data = virHashLookup(nodedata, src->nodebacking))) {
         if (virJSONValueObjectGetNumberUlong(data, "write_threshold", &tmp) == 0 &&
             tmp > 0)
-            QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+            QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                                      "threshold", tmp);
     }
 
@@ -19253,8 +20484,7 @@ static int
 qemuDomainGetStatsOneBlock(virQEMUDriverPtr driver,
                            virQEMUDriverConfigPtr cfg,
                            virDomainObjPtr dom,
-                           virDomainStatsRecordPtr record,
-                           int *maxparams,
+                           virTypedParamListPtr params,
                            virDomainDiskDefPtr disk,
                            virStorageSourcePtr src,
                            size_t block_idx,
@@ -19269,20 +20499,20 @@ qemuDomainGetStatsOneBlock(virQEMUDriverPtr driver,
     if (disk->info.alias)
         alias = qemuDomainStorageAlias(disk->info.alias, backing_idx);
 
-    QEMU_ADD_NAME_PARAM(record, maxparams, "block", "name", block_idx,
+    QEMU_ADD_NAME_PARAM(params, "block", "name", block_idx,
                         disk->dst);
     if (virStorageSourceIsLocalStorage(src) && src->path)
-        QEMU_ADD_NAME_PARAM(record, maxparams, "block", "path",
+        QEMU_ADD_NAME_PARAM(params, "block", "path",
                             block_idx, src->path);
     if (backing_idx)
-        QEMU_ADD_BLOCK_PARAM_UI(record, maxparams, block_idx, "backingIndex",
+        QEMU_ADD_BLOCK_PARAM_UI(params, block_idx, "backingIndex",
                                 backing_idx);
 
     /* the VM is offline so we have to go and load the stast from the disk by
      * ourselves */
     if (!virDomainObjIsActive(dom)) {
-        ret = qemuDomainGetStatsOneBlockFallback(driver, cfg, dom, record,
-                                                 maxparams, src, block_idx);
+        ret = qemuDomainGetStatsOneBlockFallback(driver, cfg, dom, params,
+                                                 src, block_idx);
         goto cleanup;
     }
 
@@ -19294,42 +20524,42 @@ qemuDomainGetStatsOneBlock(virQEMUDriverPtr driver,
         goto cleanup;
     }
 
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "rd.reqs", entry->rd_req);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "rd.bytes", entry->rd_bytes);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "rd.times", entry->rd_total_times);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "wr.reqs", entry->wr_req);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "wr.bytes", entry->wr_bytes);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "wr.times", entry->wr_total_times);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "fl.reqs", entry->flush_req);
-    QEMU_ADD_BLOCK_PARAM_LL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_LL(params, block_idx,
                             "fl.times", entry->flush_total_times);
 
-    QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+    QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                              "allocation", entry->wr_highest_offset);
 
     if (entry->capacity)
-        QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+        QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                                  "capacity", entry->capacity);
     if (entry->physical) {
-        QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+        QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                                  "physical", entry->physical);
     } else {
         if (qemuDomainStorageUpdatePhysical(driver, cfg, dom, src) == 0) {
-            QEMU_ADD_BLOCK_PARAM_ULL(record, maxparams, block_idx,
+            QEMU_ADD_BLOCK_PARAM_ULL(params, block_idx,
                                      "physical", src->physical);
         } else {
             virResetLastError();
         }
     }
 
-    if (qemuDomainGetStatsOneBlockNode(record, maxparams, src, block_idx,
+    if (qemuDomainGetStatsOneBlockNode(params, src, block_idx,
                                        nodedata) < 0)
         goto cleanup;
 
@@ -19343,9 +20573,10 @@ qemuDomainGetStatsOneBlock(virQEMUDriverPtr driver,
 static int
 qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
                         virDomainObjPtr dom,
-                        virDomainStatsRecordPtr record,
-                        int *maxparams,
-                        unsigned int privflags)
+                        virTypedParamListPtr params,
+                        unsigned int privflags,
+                        qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                        qemuDomainGetStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED)
 {
     size_t i;
     int ret = -1;
@@ -19360,17 +20591,18 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
     int count_index = -1;
     size_t visited = 0;
     bool visitBacking = !!(privflags & QEMU_DOMAIN_STATS_BACKING);
+    bool cached = !visitBacking && qemuDomainBlockStatsCacheValid(driver, dom);
 
-    if (HAVE_JOB(privflags) && virDomainObjIsActive(dom)) {
+    if (cached) {
+        /* borrowed from the domain private data, must not be freed */
+        stats = priv->blockStatsCache;
+        nodedata = priv->blockNodeDataCache;
+    } else if (HAVE_JOB(privflags) && virDomainObjIsActive(dom)) {
         qemuDomainObjEnterMonitor(driver, dom);
-        rc = qemuMonitorGetAllBlockStatsInfo(priv->mon, &stats,
-                                             visitBacking);
-        if (rc >= 0)
-            ignore_value(qemuMonitorBlockStatsUpdateCapacity(priv->mon, stats,
-                                                             visitBacking));
-
-        if (fetchnodedata)
-            nodedata = qemuMonitorQueryNamedBlockNodes(priv->mon);
+        rc = qemuMonitorGetAllBlockStatsInfoBatch(priv->mon, &stats,
+                                                  visitBacking,
+                                                  fetchnodedata ? &nodedata :
+                                                  NULL);
 
         if (qemuDomainObjExitMonitor(driver, dom) < 0)
             goto cleanup;
@@ -19387,8 +20619,8 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
     /* When listing backing chains, it's easier to fix up the count
      * after the iteration than it is to iterate twice; but we still
      * want count listed first.  */
-    count_index = record->nparams;
-    QEMU_ADD_COUNT_PARAM(record, maxparams, "block", 0);
+    count_index = params->npar;
+    QEMU_ADD_COUNT_PARAM(params, "block", 0);
 
     for (i = 0; i < dom->def->ndisks; i++) {
         virDomainDiskDefPtr disk = dom->def->disks[i];
@@ -19396,7 +20628,7 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
         unsigned int backing_idx = 0;
 
         while (src && (backing_idx == 0 || visitBacking)) {
-            if (qemuDomainGetStatsOneBlock(driver, cfg, dom, record, maxparams,
+            if (qemuDomainGetStatsOneBlock(driver, cfg, dom, params,
                                            disk, src, visited, backing_idx,
                                            stats, nodestats) < 0)
                 goto cleanup;
@@ -19406,13 +20638,15 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
         }
     }
 
-    record->params[count_index].value.ui = visited;
+    params->par[count_index].value.ui = visited;
     ret = 0;
 
  cleanup:
-    virHashFree(stats);
+    if (!cached) {
+        virHashFree(stats);
+        virJSONValueFree(nodedata);
+    }
     virHashFree(nodestats);
-    virJSONValueFree(nodedata);
     virObjectUnref(cfg);
     return ret;
 }
@@ -19425,161 +20659,1410 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
 
 #undef QEMU_ADD_COUNT_PARAM
 
-static int
-qemuDomainGetStatsPerfOneEvent(virPerfPtr perf,
-                               virPerfEventType type,
-                               virDomainStatsRecordPtr record,
-                               int *maxparams)
-{
-    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
-    uint64_t value = 0;
-
-    if (virPerfReadEvent(perf, type, &value) < 0)
-        return -1;
-
-    snprintf(param_name, VIR_TYPED_PARAM_FIELD_LENGTH, "perf.%s",
-             virPerfEventTypeToString(type));
-
-    if (virTypedParamsAddULLong(&record->params,
-                                &record->nparams,
-                                maxparams,
-                                param_name,
-                                value) < 0)
-        return -1;
-
-    return 0;
-}
-
 static int
 qemuDomainGetStatsPerf(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                        virDomainObjPtr dom,
-                       virDomainStatsRecordPtr record,
-                       int *maxparams,
-                       unsigned int privflags ATTRIBUTE_UNUSED)
+                       virTypedParamListPtr params,
+                       unsigned int privflags ATTRIBUTE_UNUSED,
+                       qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                       qemuDomainGetStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED)
 {
     size_t i;
     qemuDomainObjPrivatePtr priv = dom->privateData;
+    uint64_t values[VIR_PERF_EVENT_LAST] = { 0 };
     int ret = -1;
 
-    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
-        if (!virPerfEventIsEnabled(priv->perf, i))
-             continue;
+    if (!priv->perf)
+        return 0;
 
-        if (qemuDomainGetStatsPerfOneEvent(priv->perf, i,
-                                           record, maxparams) < 0)
-            goto cleanup;
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+        if (virPerfEventIsEnabled(priv->perf, i))
+            break;
+    }
+    if (i == VIR_PERF_EVENT_LAST)
+        return 0;
+
+    /* grouped events come in one read per group */
+    if (virPerfReadEvents(priv->perf, values) < 0)
+        goto cleanup;
+
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+        if (!virPerfEventIsEnabled(priv->perf, i))
+            continue;
+
+        if (virTypedParamListAddULLong(params, values[i], "perf.%s",
+                                       virPerfEventTypeToString(i)) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    return ret;
+}
+
+#define QEMU_ADD_MONITOR_PARAM(params, value, ...) \
+do { \
+    if (virTypedParamListAddULLong(params, value, __VA_ARGS__) < 0) \
+        goto cleanup; \
+} while (0)
+
+static int
+qemuDomainGetStatsMonitorCommand(qemuMonitorCommandStatsPtr cmd,
+                                 size_t num,
+                                 virTypedParamListPtr params)
+{
+    size_t i;
+    int ret = -1;
+
+    if (virTypedParamListAddString(params, cmd->name,
+                                   "monitor.command.%zu.name", num) < 0)
+        goto cleanup;
+
+    QEMU_ADD_MONITOR_PARAM(params, cmd->calls,
+                           "monitor.command.%zu.calls", num);
+    QEMU_ADD_MONITOR_PARAM(params, cmd->latency,
+                           "monitor.command.%zu.time", num);
+    QEMU_ADD_MONITOR_PARAM(params, cmd->latencyMax,
+                           "monitor.command.%zu.time.max", num);
+
+    for (i = 0; i < QEMU_MONITOR_LATENCY_BUCKETS; i++) {
+        if (i < QEMU_MONITOR_LATENCY_BUCKETS - 1)
+            QEMU_ADD_MONITOR_PARAM(params, cmd->histogram[i],
+                                   "monitor.command.%zu.latency.%llu", num,
+                                   qemuMonitorLatencyBuckets[i]);
+        else
+            QEMU_ADD_MONITOR_PARAM(params, cmd->histogram[i],
+                                   "monitor.command.%zu.latency.inf", num);
+    }
+
+    ret = 0;
+
+ cleanup:
+    return ret;
+}
+
+static int
+qemuDomainGetStatsMonitor(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                          virDomainObjPtr dom,
+                          virTypedParamListPtr params,
+                          unsigned int privflags ATTRIBUTE_UNUSED,
+                          qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                          qemuDomainGetStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    qemuMonitorIOStats stats = { 0 };
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    if (!virDomainObjIsActive(dom) || !priv->mon)
+        return 0;
+
+    /* The counters are kept by the monitor itself, there's no need to
+     * start a job and talk to qemu to read them */
+    virObjectLock(priv->mon);
+    rc = qemuMonitorGetIOStats(priv->mon, &stats);
+    virObjectUnlock(priv->mon);
+    if (rc < 0)
+        goto cleanup;
+
+    QEMU_ADD_MONITOR_PARAM(params, stats.rxBytes, "monitor.bytes.read");
+    QEMU_ADD_MONITOR_PARAM(params, stats.txBytes, "monitor.bytes.written");
+    QEMU_ADD_MONITOR_PARAM(params, stats.events, "monitor.events");
+    QEMU_ADD_MONITOR_PARAM(params, stats.replies, "monitor.replies");
+    QEMU_ADD_MONITOR_PARAM(params, stats.latency, "monitor.time");
+    QEMU_ADD_MONITOR_PARAM(params, stats.latencyMax, "monitor.time.max");
+
+    if (virTypedParamListAddUInt(params, stats.ncommands,
+                                 "monitor.command.count") < 0)
+        goto cleanup;
+
+    for (i = 0; i < stats.ncommands; i++) {
+        if (qemuDomainGetStatsMonitorCommand(&stats.commands[i], i,
+                                             params) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorIOStatsClear(&stats);
+    return ret;
+}
+
+static int
+qemuDomainGetStatsJob(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                      virDomainObjPtr dom,
+                      virTypedParamListPtr params,
+                      unsigned int privflags ATTRIBUTE_UNUSED,
+                      qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                      qemuDomainGetStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    qemuDomainJobWaitStats stats[QEMU_JOB_LAST];
+    size_t count = 0;
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    qemuDomainObjGetJobWaitStats(dom, stats);
+
+    if (virTypedParamListAddUInt(params, priv->job.nqueries,
+                                 "job.query.count") < 0)
+        goto cleanup;
+
+    for (i = QEMU_JOB_NONE + 1; i < QEMU_JOB_LAST; i++) {
+        if (stats[i].calls || stats[i].failures)
+            count++;
+    }
+
+    if (virTypedParamListAddUInt(params, count, "job.wait.count") < 0)
+        goto cleanup;
+
+    count = 0;
+    for (i = QEMU_JOB_NONE + 1; i < QEMU_JOB_LAST; i++) {
+        if (!stats[i].calls && !stats[i].failures)
+            continue;
+
+        if (virTypedParamListAddString(params, qemuDomainJobTypeToString(i),
+                                       "job.wait.%zu.name", count) < 0)
+            goto cleanup;
+
+        QEMU_ADD_MONITOR_PARAM(params, stats[i].calls,
+                               "job.wait.%zu.calls", count);
+        QEMU_ADD_MONITOR_PARAM(params, stats[i].failures,
+                               "job.wait.%zu.failures", count);
+        QEMU_ADD_MONITOR_PARAM(params, stats[i].time,
+                               "job.wait.%zu.time", count);
+        QEMU_ADD_MONITOR_PARAM(params, stats[i].timeMax,
+                               "job.wait.%zu.time.max", count);
+
+        for (j = 0; j < QEMU_MONITOR_LATENCY_BUCKETS; j++) {
+            if (j < QEMU_MONITOR_LATENCY_BUCKETS - 1)
+                QEMU_ADD_MONITOR_PARAM(params, stats[i].histogram[j],
+                                       "job.wait.%zu.latency.%llu", count,
+                                       qemuMonitorLatencyBuckets[j]);
+            else
+                QEMU_ADD_MONITOR_PARAM(params, stats[i].histogram[j],
+                                       "job.wait.%zu.latency.inf", count);
+        }
+
+        count++;
+    }
+
+    ret = 0;
+
+ cleanup:
+    return ret;
+}
+
+static int
+qemuDomainGetStatsFootprint(virQEMUDriverPtr driver,
+                            virDomainObjPtr dom,
+                            virTypedParamListPtr params,
+                            unsigned int privflags ATTRIBUTE_UNUSED,
+                            qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                            qemuDomainGetStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    unsigned long long cached = 0;
+    char *xml = NULL;
+    size_t i;
+    int ret = -1;
+
+    /* Formatted definitions are cached, so measuring them is cheap
+     * unless the domain keeps changing */
+    if (!(xml = qemuDomainFormatXML(driver, dom, VIR_DOMAIN_XML_SECURE)))
+        goto cleanup;
+    QEMU_ADD_MONITOR_PARAM(params, strlen(xml), "footprint.def.live");
+    VIR_FREE(xml);
+
+    if (dom->newDef) {
+        if (!(xml = qemuDomainFormatXML(driver, dom,
+                                        VIR_DOMAIN_XML_SECURE |
+                                        VIR_DOMAIN_XML_INACTIVE)))
+            goto cleanup;
+        QEMU_ADD_MONITOR_PARAM(params, strlen(xml), "footprint.def.persistent");
+        VIR_FREE(xml);
+    }
+
+    for (i = 0; i < QEMU_DOMAIN_XML_CACHE_SIZE; i++) {
+        if (priv->xmlCache[i].xml)
+            cached += strlen(priv->xmlCache[i].xml) + 1;
+    }
+    QEMU_ADD_MONITOR_PARAM(params, cached, "footprint.xml.cache");
+
+    if (priv->mon) {
+        size_t size;
+
+        virObjectLock(priv->mon);
+        size = qemuMonitorGetBufferSize(priv->mon);
+        virObjectUnlock(priv->mon);
+
+        QEMU_ADD_MONITOR_PARAM(params, size, "footprint.monitor.buffer");
+    }
+
+    if (priv->agent)
+        QEMU_ADD_MONITOR_PARAM(params, qemuAgentGetBufferSize(priv->agent),
+                               "footprint.agent.buffer");
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(xml);
+    return ret;
+}
+
+#undef QEMU_ADD_MONITOR_PARAM
+
+static int
+qemuDomainGetStatsDirtyRate(virQEMUDriverPtr driver,
+                            virDomainObjPtr dom,
+                            virTypedParamListPtr params,
+                            unsigned int privflags,
+                            qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                            qemuDomainGetStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    qemuMonitorDirtyRateInfo info;
+    int rc;
+
+    if (!HAVE_JOB(privflags) || !virDomainObjIsActive(dom) ||
+        !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_CALC_DIRTY_RATE))
+        return 0;
+
+    qemuDomainObjEnterMonitor(driver, dom);
+    rc = qemuMonitorQueryDirtyRate(priv->mon, &info);
+    if (qemuDomainObjExitMonitor(driver, dom) < 0)
+        return -1;
+
+    /* failure to retrieve the rate is not fatal for the whole call */
+    if (rc < 0) {
+        virResetLastError();
+        return 0;
+    }
+
+    if (virTypedParamListAddInt(params, info.status,
+                                "dirtyrate.calc_status") < 0 ||
+        virTypedParamListAddLLong(params, info.startTime,
+                                  "dirtyrate.calc_start_time") < 0 ||
+        virTypedParamListAddInt(params, info.calcTime,
+                                "dirtyrate.calc_period") < 0)
+        return -1;
+
+    if (info.status == VIR_DOMAIN_DIRTYRATE_MEASURED &&
+        info.dirtyRate >= 0 &&
+        virTypedParamListAddLLong(params, info.dirtyRate,
+                                  "dirtyrate.megabytes_per_second") < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+qemuDomainGetStatsStartup(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                          virDomainObjPtr dom,
+                          virTypedParamListPtr params,
+                          unsigned int privflags ATTRIBUTE_UNUSED,
+                          qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                          qemuDomainGetStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    unsigned long long total = 0;
+    size_t i;
+
+    if (!virDomainObjIsActive(dom) || !priv->startTimed)
+        return 0;
+
+    for (i = 0; i < QEMU_DOMAIN_START_PHASE_LAST; i++)
+        total += priv->startPhases[i];
+
+    if (virTypedParamListAddULLong(params, total, "startup.time") < 0)
+        return -1;
+
+    for (i = 0; i < QEMU_DOMAIN_START_PHASE_LAST; i++) {
+        if (virTypedParamListAddULLong(params, priv->startPhases[i],
+                                       "startup.%s.time",
+                                       qemuDomainStartPhaseTypeToString(i)) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsMetadata(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                           virDomainObjPtr dom,
+                           virTypedParamListPtr params,
+                           unsigned int privflags ATTRIBUTE_UNUSED,
+                           qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                           qemuDomainGetStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED)
+{
+    virDomainDefPtr def = dom->def;
+    xmlNodePtr node;
+    char *xml = NULL;
+    size_t count = 0;
+    int ret = -1;
+
+    if (def->title &&
+        virTypedParamListAddString(params, def->title, "metadata.title") < 0)
+        goto cleanup;
+
+    if (def->description &&
+        virTypedParamListAddString(params, def->description,
+                                   "metadata.description") < 0)
+        goto cleanup;
+
+    if (!def->metadata) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    for (node = def->metadata->children; node; node = node->next) {
+        if (node->type == XML_ELEMENT_NODE && node->ns && node->ns->href)
+            count++;
+    }
+
+    if (virTypedParamListAddUInt(params, count, "metadata.element.count") < 0)
+        goto cleanup;
+
+    count = 0;
+    for (node = def->metadata->children; node; node = node->next) {
+        const char *uri;
+
+        if (node->type != XML_ELEMENT_NODE || !node->ns || !node->ns->href)
+            continue;
+
+        uri = (const char *) node->ns->href;
+
+        if (virTypedParamListAddString(params, uri,
+                                       "metadata.element.%zu.uri", count) < 0)
+            goto cleanup;
+
+        if (virXMLExtractNamespaceXML(def->metadata, uri, &xml) < 0)
+            goto cleanup;
+
+        if (xml &&
+            virTypedParamListAddString(params, xml,
+                                       "metadata.element.%zu.xml", count) < 0)
+            goto cleanup;
+
+        VIR_FREE(xml);
+        count++;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static int
+qemuDomainGetStatsAgent(virQEMUDriverPtr driver,
+                        virDomainObjPtr dom,
+                        virTypedParamListPtr params,
+                        unsigned int privflags,
+                        qemuDomainGetStatsSharedPtr shared ATTRIBUTE_UNUSED,
+                        qemuDomainGetStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED)
+{
+    qemuAgentGuestInfo info;
+    qemuAgentPtr agent;
+    virCapsPtr caps = NULL;
+    virDomainDefPtr def = NULL;
+    size_t i, j;
+    int rc;
+    int ret = -1;
+
+    memset(&info, 0, sizeof(info));
+    info.nfs = -1;
+    info.nifaces = -1;
+
+    /* the agent is optional, so don't fail the whole record without it */
+    if (!HAVE_JOB(privflags) || !virDomainObjIsActive(dom) ||
+        !qemuDomainAgentAvailable(dom, false))
+        return 0;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, false)) ||
+        !(def = virDomainDefCopy(dom->def, caps, driver->xmlopt, NULL, false)))
+        goto cleanup;
+
+    agent = qemuDomainObjEnterAgent(dom);
+    rc = qemuAgentGetGuestInfo(agent, def, &info);
+    qemuDomainObjExitAgent(dom, agent);
+
+    if (rc < 0) {
+        virResetLastError();
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (info.haveTime &&
+        (virTypedParamListAddLLong(params, info.seconds,
+                                   "agent.time.seconds") < 0 ||
+         virTypedParamListAddUInt(params, info.nseconds,
+                                  "agent.time.nseconds") < 0))
+        goto cleanup;
+
+    if (info.hostname &&
+        virTypedParamListAddString(params, info.hostname,
+                                   "agent.hostname") < 0)
+        goto cleanup;
+
+    if (info.nfs >= 0) {
+        if (virTypedParamListAddUInt(params, info.nfs, "agent.fs.count") < 0)
+            goto cleanup;
+
+        for (i = 0; i < info.nfs; i++) {
+            virDomainFSInfoPtr fs = info.fs[i];
+
+            if (virTypedParamListAddString(params, fs->mountpoint,
+                                           "agent.fs.%zu.mountpoint", i) < 0 ||
+                virTypedParamListAddString(params, fs->name,
+                                           "agent.fs.%zu.name", i) < 0 ||
+                virTypedParamListAddString(params, fs->fstype,
+                                           "agent.fs.%zu.fstype", i) < 0 ||
+                virTypedParamListAddUInt(params, fs->ndevAlias,
+                                         "agent.fs.%zu.disk.count", i) < 0)
+                goto cleanup;
+
+            for (j = 0; j < fs->ndevAlias; j++) {
+                if (virTypedParamListAddString(params, fs->devAlias[j],
+                                               "agent.fs.%zu.disk.%zu.alias",
+                                               i, j) < 0)
+                    goto cleanup;
+            }
+        }
+    }
+
+    if (info.nifaces >= 0) {
+        if (virTypedParamListAddUInt(params, info.nifaces, "agent.if.count") < 0)
+            goto cleanup;
+
+        for (i = 0; i < info.nifaces; i++) {
+            virDomainInterfacePtr iface = info.ifaces[i];
+
+            if (virTypedParamListAddString(params, iface->name,
+                                           "agent.if.%zu.name", i) < 0 ||
+                (iface->hwaddr &&
+                 virTypedParamListAddString(params, iface->hwaddr,
+                                            "agent.if.%zu.hwaddr", i) < 0) ||
+                virTypedParamListAddUInt(params, iface->naddrs,
+                                         "agent.if.%zu.addr.count", i) < 0)
+                goto cleanup;
+
+            for (j = 0; j < iface->naddrs; j++) {
+                virDomainIPAddressPtr addr = &iface->addrs[j];
+                const char *type = addr->type == VIR_IP_ADDR_TYPE_IPV6 ?
+                                   "ipv6" : "ipv4";
+
+                if (virTypedParamListAddString(params, type,
+                                               "agent.if.%zu.addr.%zu.type",
+                                               i, j) < 0 ||
+                    virTypedParamListAddString(params, addr->addr,
+                                               "agent.if.%zu.addr.%zu.addr",
+                                               i, j) < 0 ||
+                    virTypedParamListAddUInt(params, addr->prefix,
+                                             "agent.if.%zu.addr.%zu.prefix",
+                                             i, j) < 0)
+                    goto cleanup;
+            }
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuAgentGuestInfoClear(&info);
+    virDomainDefFree(def);
+    virObjectUnref(caps);
+    return ret;
+}
+
+typedef int
+(*qemuDomainGetStatsFunc)(virQEMUDriverPtr driver,
+                          virDomainObjPtr dom,
+                          virTypedParamListPtr params,
+                          unsigned int flags,
+                          qemuDomainGetStatsSharedPtr shared,
+                          qemuDomainGetStatsMonitorDataPtr mondata);
+
+struct qemuDomainGetStatsWorker {
+    qemuDomainGetStatsFunc func;
+    unsigned int stats;
+    bool monitor;
+};
+
+static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
+    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE, false },
+    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL, false },
+    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON, true },
+    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU, true },
+    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false },
+    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true },
+    { qemuDomainGetStatsPerf, VIR_DOMAIN_STATS_PERF, false },
+    { qemuDomainGetStatsMonitor, VIR_DOMAIN_STATS_MONITOR, false },
+    { qemuDomainGetStatsStartup, VIR_DOMAIN_STATS_STARTUP, false },
+    { qemuDomainGetStatsMetadata, VIR_DOMAIN_STATS_METADATA, false },
+    { qemuDomainGetStatsAgent, VIR_DOMAIN_STATS_AGENT, true },
+    { qemuDomainGetStatsJob, VIR_DOMAIN_STATS_JOB, false },
+    { qemuDomainGetStatsFootprint, VIR_DOMAIN_STATS_FOOTPRINT, false },
+    { qemuDomainGetStatsDirtyRate, VIR_DOMAIN_STATS_DIRTYRATE, true },
+    { NULL, 0, false }
+};
+
+
+static int
+qemuDomainGetStatsCheckSupport(unsigned int *stats,
+                               bool enforce)
+{
+    unsigned int supportedstats = 0;
+    size_t i;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
+        supportedstats |= qemuDomainGetStatsWorkers[i].stats;
+
+    if (*stats == 0) {
+        /* talking to the guest agent has to be asked for explicitly */
+        *stats = supportedstats & ~VIR_DOMAIN_STATS_AGENT;
+        return 0;
+    }
+
+    if (enforce &&
+        *stats & ~supportedstats) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                       _("Stats types bits 0x%x are not supported by this daemon"),
+                       *stats & ~supportedstats);
+        return -1;
+    }
+
+    *stats &= supportedstats;
+    return 0;
+}
+
+
+static bool
+qemuDomainGetStatsNeedMonitor(unsigned int stats)
+{
+    size_t i;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
+        if (stats & qemuDomainGetStatsWorkers[i].stats &&
+            qemuDomainGetStatsWorkers[i].monitor)
+            return true;
+
+    return false;
+}
+
+
+static int
+qemuDomainGetStats(virConnectPtr conn,
+                   virDomainObjPtr dom,
+                   unsigned int stats,
+                   virDomainStatsRecordPtr *record,
+                   unsigned int flags,
+                   qemuDomainGetStatsSharedPtr shared,
+                   unsigned long long deadline)
+{
+    virDomainStatsRecordPtr tmp;
+    virTypedParamListPtr params = NULL;
+    qemuDomainGetStatsMonitorData mondata;
+    unsigned long long now;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC(tmp) < 0 ||
+        VIR_ALLOC(params) < 0)
+        goto cleanup;
+
+    qemuDomainGetStatsMonitorPrefetch(conn->privateData, dom, stats, flags,
+                                      &mondata);
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
+        if (stats & qemuDomainGetStatsWorkers[i].stats) {
+            /* Once the time budget of the domain is used up, skip the
+             * remaining groups talking to the monitor and report what
+             * was gathered so far. */
+            if (deadline && HAVE_JOB(flags) &&
+                qemuDomainGetStatsWorkers[i].monitor &&
+                virTimeMillisNow(&now) == 0 && now >= deadline) {
+                VIR_DEBUG("Stats deadline of domain %s exceeded, "
+                          "skipping stats group 0x%x",
+                          dom->def->name, qemuDomainGetStatsWorkers[i].stats);
+                continue;
+            }
+            if (qemuDomainGetStatsWorkers[i].func(conn->privateData, dom,
+                                                  params, flags, shared,
+                                                  &mondata) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (!(tmp->dom = virGetDomain(conn, dom->def->name,
+                                  dom->def->uuid, dom->def->id)))
+        goto cleanup;
+
+    tmp->nparams = virTypedParamListStealParams(params, &tmp->params);
+    *record = tmp;
+    tmp = NULL;
+    ret = 0;
+
+ cleanup:
+    if (tmp) {
+        virObjectUnref(tmp->dom);
+        VIR_FREE(tmp);
+    }
+    virTypedParamListFree(params);
+
+    return ret;
+}
+
+
+/*
+ * Acquire the job of the locked @vm for gathering @stats if @privflags
+ * ask for it, waiting at most @jobTimeout milliseconds. Returns the
+ * flags to pass to the stats workers; if the job can't be acquired,
+ * only the stats not requiring the monitor are gathered. The caller
+ * must end the job if the returned flags have it.
+ */
+static unsigned int
+qemuDomainGetStatsBeginJob(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           unsigned int stats,
+                           unsigned int privflags,
+                           unsigned long long jobTimeout)
+{
+    unsigned int domflags = privflags & ~QEMU_DOMAIN_STATS_HAVE_JOB;
+
+    /* the block group can be answered from the sampled block stats */
+    if (HAVE_JOB(privflags) &&
+        !(privflags & QEMU_DOMAIN_STATS_BACKING) &&
+        !qemuDomainGetStatsNeedMonitor(stats & ~VIR_DOMAIN_STATS_BLOCK) &&
+        qemuDomainBlockStatsCacheValid(driver, vm))
+        privflags &= ~QEMU_DOMAIN_STATS_HAVE_JOB;
+
+    if (HAVE_JOB(privflags)) {
+        if (qemuDomainObjBeginJobWithTimeout(driver, vm, QEMU_JOB_QUERY,
+                                             jobTimeout) == 0)
+            domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+        else
+            virResetLastError();
+    }
+    /* else: without a job it's still possible to gather some data */
+
+    return domflags;
+}
+
+
+/*
+ * Gather the stats of a single domain for qemuConnectGetAllDomainStats.
+ * If @jobTimeout is non-zero, it is the time budget in milliseconds for
+ * the whole domain: it bounds the wait for the domain job, and once it
+ * passes, the stats groups which still need the monitor are skipped so
+ * a partial record is returned. A monitor command already in progress
+ * is not interrupted though; it is bounded by the monitor alone.
+ */
+static int
+qemuConnectGetAllDomainStatsOne(virConnectPtr conn,
+                                virDomainObjPtr vm,
+                                unsigned int stats,
+                                unsigned int privflags,
+                                unsigned long long jobTimeout,
+                                qemuDomainGetStatsSharedPtr shared,
+                                virDomainStatsRecordPtr *record)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    unsigned long long deadline = 0;
+    unsigned int domflags;
+    int ret;
+
+    if (jobTimeout && virTimeMillisNow(&deadline) == 0)
+        deadline += jobTimeout;
+
+    virObjectLock(vm);
+
+    domflags = qemuDomainGetStatsBeginJob(driver, vm, stats, privflags,
+                                          jobTimeout);
+
+    ret = qemuDomainGetStats(conn, vm, stats, record, domflags, shared,
+                             deadline);
+
+    if (HAVE_JOB(domflags))
+        qemuDomainObjEndJob(driver, vm);
+
+    virObjectUnlock(vm);
+    return ret;
+}
+
+
+typedef struct _qemuConnectGetAllDomainStatsData qemuConnectGetAllDomainStatsData;
+typedef qemuConnectGetAllDomainStatsData *qemuConnectGetAllDomainStatsDataPtr;
+struct _qemuConnectGetAllDomainStatsData {
+    virConnectPtr conn;
+    virDomainObjPtr *vms;
+    size_t nvms;
+    unsigned int stats;
+    unsigned int privflags;
+    unsigned long long jobTimeout;
+    qemuDomainGetStatsSharedPtr shared;
+
+    /* one slot per entry in @vms, so the result keeps the order of @vms */
+    virDomainStatsRecordPtr *records;
+
+    int next; /* atomic: index of the next domain to process */
+    int failed; /* atomic: set once any worker hits an error */
+
+    virMutex lock; /* protects @err and @pending */
+    virCond cond; /* signalled when @pending drops to zero */
+    virErrorPtr err;
+    size_t pending; /* jobs queued to the stats pool not finished yet */
+};
+
+
+static void
+qemuConnectGetAllDomainStatsWorker(qemuConnectGetAllDomainStatsDataPtr data)
+{
+    int i;
+
+    while (!virAtomicIntGet(&data->failed) &&
+           (i = virAtomicIntInc(&data->next) - 1) < data->nvms) {
+        if (qemuConnectGetAllDomainStatsOne(data->conn, data->vms[i],
+                                            data->stats, data->privflags,
+                                            data->jobTimeout, data->shared,
+                                            &data->records[i]) < 0) {
+            virMutexLock(&data->lock);
+            if (!data->err)
+                data->err = virSaveLastError();
+            virMutexUnlock(&data->lock);
+            virAtomicIntSet(&data->failed, 1);
+        }
+    }
+}
+
+
+/* Job of the driver->statsPool thread pool */
+static void
+qemuConnectGetAllDomainStatsJob(void *jobdata,
+                                void *opaque ATTRIBUTE_UNUSED)
+{
+    qemuConnectGetAllDomainStatsDataPtr data = jobdata;
+
+    qemuConnectGetAllDomainStatsWorker(data);
+
+    virMutexLock(&data->lock);
+    if (--data->pending == 0)
+        virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+/*
+ * Gather the stats of all @nvms domains using up to @nworkers threads
+ * of the driver stats pool alongside the calling thread. The records
+ * are stored into @records at the same index as the corresponding
+ * domain in @vms.
+ */
+static int
+qemuConnectGetAllDomainStatsParallel(virConnectPtr conn,
+                                     virDomainObjPtr *vms,
+                                     size_t nvms,
+                                     unsigned int stats,
+                                     unsigned int privflags,
+                                     unsigned long long jobTimeout,
+                                     qemuDomainGetStatsSharedPtr shared,
+                                     size_t nworkers,
+                                     virDomainStatsRecordPtr *records)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    qemuConnectGetAllDomainStatsData data;
+    size_t i;
+    int ret = -1;
+
+    memset(&data, 0, sizeof(data));
+    data.conn = conn;
+    data.vms = vms;
+    data.nvms = nvms;
+    data.stats = stats;
+    data.privflags = privflags;
+    data.jobTimeout = jobTimeout;
+    data.shared = shared;
+    data.records = records;
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        return -1;
+    }
+    if (virCondInit(&data.cond) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init cond"));
+        virMutexDestroy(&data.lock);
+        return -1;
+    }
+
+    if (nworkers > nvms)
+        nworkers = nvms;
+
+    /* The calling thread does its share of the work too, which also
+     * guarantees progress while the pool is busy with other callers. */
+    virMutexLock(&data.lock);
+    for (i = 1; driver->statsPool && i < nworkers; i++) {
+        if (virThreadPoolSendJob(driver->statsPool, 0, &data) < 0) {
+            VIR_WARN("Failed to queue domain stats job");
+            virResetLastError();
+            break;
+        }
+        data.pending++;
+    }
+    virMutexUnlock(&data.lock);
+
+    qemuConnectGetAllDomainStatsWorker(&data);
+
+    /* @data lives on our stack, wait for all jobs still using it */
+    virMutexLock(&data.lock);
+    while (data.pending > 0)
+        ignore_value(virCondWait(&data.cond, &data.lock));
+    virMutexUnlock(&data.lock);
+
+    if (data.failed) {
+        if (data.err)
+            virSetError(data.err);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virFreeError(data.err);
+    virCondDestroy(&data.cond);
+    virMutexDestroy(&data.lock);
+    return ret;
+}
+
+
+/* Stats groups collected by the background sampler */
+#define QEMU_STATS_SAMPLER_GROUPS \
+    (VIR_DOMAIN_STATS_STATE | VIR_DOMAIN_STATS_CPU_TOTAL | \
+     VIR_DOMAIN_STATS_BALLOON | VIR_DOMAIN_STATS_VCPU | \
+     VIR_DOMAIN_STATS_INTERFACE | VIR_DOMAIN_STATS_BLOCK)
+
+#define QEMU_STATS_WORKERS_COUNT ARRAY_CARDINALITY(qemuDomainGetStatsWorkers)
+
+typedef struct _qemuStatsSampleDomain qemuStatsSampleDomain;
+typedef qemuStatsSampleDomain *qemuStatsSampleDomainPtr;
+struct _qemuStatsSampleDomain {
+    char *name;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    int id;
+
+    /* indexed like qemuDomainGetStatsWorkers */
+    virTypedParameterPtr params[QEMU_STATS_WORKERS_COUNT];
+    int nparams[QEMU_STATS_WORKERS_COUNT];
+};
+
+typedef struct _qemuStatsSample qemuStatsSample;
+typedef qemuStatsSample *qemuStatsSamplePtr;
+struct _qemuStatsSample {
+    int refs; /* atomic */
+    unsigned long long timestamp;
+    virHashTablePtr domains; /* qemuStatsSampleDomain keyed by UUID */
+};
+
+struct _qemuStatsSampler {
+    virMutex lock;
+    virCond cond;
+    virThread thread;
+    int quit; /* atomic, also checked between domains */
+
+    unsigned int interval;
+    unsigned long long jobTimeout;
+
+    /* Ring of the latest samples, the oldest one at @first */
+    qemuStatsSamplePtr *samples;
+    size_t nsamples;
+    size_t first;
+    size_t count;
+};
+
+
+static void
+qemuStatsSampleDomainFree(void *payload,
+                          const void *name ATTRIBUTE_UNUSED)
+{
+    qemuStatsSampleDomainPtr entry = payload;
+    size_t i;
+
+    if (!entry)
+        return;
+
+    for (i = 0; i < QEMU_STATS_WORKERS_COUNT; i++)
+        virTypedParamsFree(entry->params[i], entry->nparams[i]);
+    VIR_FREE(entry->name);
+    VIR_FREE(entry);
+}
+
+
+static void
+qemuStatsSampleUnref(qemuStatsSamplePtr sample)
+{
+    if (!sample || !virAtomicIntDecAndTest(&sample->refs))
+        return;
+
+    virHashFree(sample->domains);
+    VIR_FREE(sample);
+}
+
+
+/*
+ * Sample the stats of the locked @vm into @domains. The sampler waits
+ * at most @jobTimeout milliseconds for the domain job, in which case
+ * only the stats not requiring the monitor are part of the sample.
+ */
+static int
+qemuStatsSamplerCollectOne(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           unsigned long long jobTimeout,
+                           qemuDomainGetStatsSharedPtr shared,
+                           virHashTablePtr domains)
+{
+    qemuStatsSampleDomainPtr entry = NULL;
+    virTypedParamListPtr params = NULL;
+    qemuDomainGetStatsMonitorData mondata;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    unsigned int domflags;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC(entry) < 0 ||
+        VIR_ALLOC(params) < 0 ||
+        VIR_STRDUP(entry->name, vm->def->name) < 0)
+        goto cleanup;
+
+    memcpy(entry->uuid, vm->def->uuid, VIR_UUID_BUFLEN);
+    entry->id = vm->def->id;
+
+    domflags = qemuDomainGetStatsBeginJob(driver, vm,
+                                          QEMU_STATS_SAMPLER_GROUPS,
+                                          QEMU_DOMAIN_STATS_HAVE_JOB,
+                                          jobTimeout);
+
+    qemuDomainGetStatsMonitorPrefetch(driver, vm, QEMU_STATS_SAMPLER_GROUPS,
+                                      domflags, &mondata);
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
+        if (!(QEMU_STATS_SAMPLER_GROUPS & qemuDomainGetStatsWorkers[i].stats))
+            continue;
+
+        if (qemuDomainGetStatsWorkers[i].func(driver, vm, params, domflags,
+                                              shared, &mondata) < 0)
+            break;
+
+        entry->nparams[i] = virTypedParamListStealParams(params,
+                                                         &entry->params[i]);
+    }
+
+    if (HAVE_JOB(domflags))
+        qemuDomainObjEndJob(driver, vm);
+
+    if (qemuDomainGetStatsWorkers[i].func)
+        goto cleanup;
+
+    virUUIDFormat(entry->uuid, uuidstr);
+    if (virHashAddEntry(domains, uuidstr, entry) < 0)
+        goto cleanup;
+    entry = NULL;
+
+    ret = 0;
+
+ cleanup:
+    qemuStatsSampleDomainFree(entry, NULL);
+    virTypedParamListFree(params);
+    return ret;
+}
+
+
+static qemuStatsSamplePtr
+qemuStatsSamplerCollect(virQEMUDriverPtr driver,
+                        qemuStatsSamplerPtr sampler,
+                        unsigned long long timestamp)
+{
+    qemuStatsSamplePtr sample = NULL;
+    qemuDomainGetStatsShared shared;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    size_t i;
+
+    if (virDomainObjListCollect(driver->domains, NULL, &vms, &nvms,
+                                NULL, 0) < 0)
+        return NULL;
+
+    if (VIR_ALLOC(sample) < 0 ||
+        !(sample->domains = virHashCreate(MAX(nvms, 1),
+                                          qemuStatsSampleDomainFree)))
+        goto error;
+
+    sample->refs = 1;
+    sample->timestamp = timestamp;
+
+    qemuDomainGetStatsSharedInit(&shared, QEMU_STATS_SAMPLER_GROUPS);
+
+    for (i = 0; i < nvms && !virAtomicIntGet(&sampler->quit); i++) {
+        virObjectLock(vms[i]);
+        /* a domain failing to provide its stats is left out */
+        if (qemuStatsSamplerCollectOne(driver, vms[i], sampler->jobTimeout,
+                                       &shared, sample->domains) < 0) {
+            VIR_DEBUG("Failed to sample stats of domain %s: %s",
+                      vms[i]->def->name, virGetLastErrorMessage());
+            virResetLastError();
+        }
+        virObjectUnlock(vms[i]);
     }
 
-    ret = 0;
+    qemuDomainGetStatsSharedClear(&shared);
+    virObjectListFreeCount(vms, nvms);
+    return sample;
 
- cleanup:
-    return ret;
+ error:
+    virObjectListFreeCount(vms, nvms);
+    if (sample) {
+        virHashFree(sample->domains);
+        VIR_FREE(sample);
+    }
+    return NULL;
 }
 
-typedef int
-(*qemuDomainGetStatsFunc)(virQEMUDriverPtr driver,
-                          virDomainObjPtr dom,
-                          virDomainStatsRecordPtr record,
-                          int *maxparams,
-                          unsigned int flags);
 
-struct qemuDomainGetStatsWorker {
-    qemuDomainGetStatsFunc func;
-    unsigned int stats;
-    bool monitor;
-};
+static void
+qemuStatsSamplerThread(void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    qemuStatsSamplerPtr sampler = driver->statsSampler;
+    qemuStatsSamplePtr sample;
+    qemuStatsSamplePtr old = NULL;
+    unsigned long long start;
 
-static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
-    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE, false },
-    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL, false },
-    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON, true },
-    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU, true },
-    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false },
-    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true },
-    { qemuDomainGetStatsPerf, VIR_DOMAIN_STATS_PERF, false },
-    { NULL, 0, false }
-};
+    virThreadJobSetWorker("qemuStatsSampler");
 
+    while (!virAtomicIntGet(&sampler->quit)) {
+        if (virTimeMillisNow(&start) < 0)
+            break;
+
+        if ((sample = qemuStatsSamplerCollect(driver, sampler, start))) {
+            virMutexLock(&sampler->lock);
+            if (sampler->count == sampler->nsamples) {
+                old = sampler->samples[sampler->first];
+                sampler->samples[sampler->first] = sample;
+                sampler->first = (sampler->first + 1) % sampler->nsamples;
+            } else {
+                sampler->samples[(sampler->first + sampler->count++) %
+                                 sampler->nsamples] = sample;
+            }
+            virMutexUnlock(&sampler->lock);
+
+            qemuStatsSampleUnref(old);
+            old = NULL;
+        } else {
+            VIR_WARN("Failed to sample domain stats: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
+        }
 
+        /* intervals are counted from the start of a sample, a sample
+         * taking longer than that is followed by the next one directly */
+        virMutexLock(&sampler->lock);
+        while (!virAtomicIntGet(&sampler->quit)) {
+            if (virCondWaitUntil(&sampler->cond, &sampler->lock,
+                                 start + sampler->interval * 1000ULL) < 0)
+                break;
+        }
+        virMutexUnlock(&sampler->lock);
+    }
+
+    virThreadJobClear(0);
+}
+
+
+/*
+ * Start sampling the stats of all domains every stats_sample_interval
+ * seconds, if configured.
+ */
 static int
-qemuDomainGetStatsCheckSupport(unsigned int *stats,
-                               bool enforce)
+qemuStatsSamplerInit(virQEMUDriverPtr driver)
 {
-    unsigned int supportedstats = 0;
-    size_t i;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuStatsSamplerPtr sampler = NULL;
+    int ret = -1;
 
-    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
-        supportedstats |= qemuDomainGetStatsWorkers[i].stats;
+    if (cfg->statsSampleInterval == 0) {
+        ret = 0;
+        goto cleanup;
+    }
 
-    if (*stats == 0) {
-        *stats = supportedstats;
-        return 0;
+    if (VIR_ALLOC(sampler) < 0 ||
+        VIR_ALLOC_N(sampler->samples, cfg->statsSampleHistory) < 0)
+        goto error;
+
+    sampler->nsamples = cfg->statsSampleHistory;
+    sampler->interval = cfg->statsSampleInterval;
+    /* don't wait for a domain job longer than until the next sample */
+    sampler->jobTimeout = cfg->statsSampleInterval * 1000ULL;
+    if (cfg->statsJobTimeout)
+        sampler->jobTimeout = MIN(sampler->jobTimeout, cfg->statsJobTimeout);
+
+    if (virMutexInit(&sampler->lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        goto error;
     }
 
-    if (enforce &&
-        *stats & ~supportedstats) {
-        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
-                       _("Stats types bits 0x%x are not supported by this daemon"),
-                       *stats & ~supportedstats);
-        return -1;
+    if (virCondInit(&sampler->cond) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init condition"));
+        virMutexDestroy(&sampler->lock);
+        goto error;
     }
 
-    *stats &= supportedstats;
-    return 0;
+    driver->statsSampler = sampler;
+
+    if (virThreadCreate(&sampler->thread, true,
+                        qemuStatsSamplerThread, driver) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create domain stats sampler thread"));
+        driver->statsSampler = NULL;
+        virCondDestroy(&sampler->cond);
+        virMutexDestroy(&sampler->lock);
+        goto error;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(cfg);
+    return ret;
+
+ error:
+    if (sampler)
+        VIR_FREE(sampler->samples);
+    VIR_FREE(sampler);
+    goto cleanup;
 }
 
 
-static bool
-qemuDomainGetStatsNeedMonitor(unsigned int stats)
+static void
+qemuStatsSamplerFree(virQEMUDriverPtr driver)
 {
+    qemuStatsSamplerPtr sampler = driver->statsSampler;
     size_t i;
 
-    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
-        if (stats & qemuDomainGetStatsWorkers[i].stats &&
-            qemuDomainGetStatsWorkers[i].monitor)
-            return true;
+    if (!sampler)
+        return;
 
-    return false;
+    virMutexLock(&sampler->lock);
+    virAtomicIntSet(&sampler->quit, 1);
+    virCondSignal(&sampler->cond);
+    virMutexUnlock(&sampler->lock);
+
+    virThreadJoin(&sampler->thread);
+    driver->statsSampler = NULL;
+
+    for (i = 0; i < sampler->count; i++)
+        qemuStatsSampleUnref(sampler->samples[(sampler->first + i) %
+                                              sampler->nsamples]);
+    VIR_FREE(sampler->samples);
+    virCondDestroy(&sampler->cond);
+    virMutexDestroy(&sampler->lock);
+    VIR_FREE(sampler);
 }
 
 
+/*
+ * Turn the entry of a domain in a sample into a record holding the
+ * @stats groups.
+ */
 static int
-qemuDomainGetStats(virConnectPtr conn,
-                   virDomainObjPtr dom,
-                   unsigned int stats,
-                   virDomainStatsRecordPtr *record,
-                   unsigned int flags)
-{
-    int maxparams = 0;
-    virDomainStatsRecordPtr tmp;
+qemuStatsSampleGetRecord(virConnectPtr conn,
+                         qemuStatsSamplePtr sample,
+                         qemuStatsSampleDomainPtr entry,
+                         unsigned int stats,
+                         virDomainStatsRecordPtr *record)
+{
+    virDomainStatsRecordPtr tmp = NULL;
+    virTypedParamListPtr params = NULL;
+    virTypedParameterPtr src;
     size_t i;
+    int j;
     int ret = -1;
 
-    if (VIR_ALLOC(tmp) < 0)
+    if (VIR_ALLOC(tmp) < 0 ||
+        VIR_ALLOC(params) < 0)
+        goto cleanup;
+
+    if (virTypedParamListAddULLong(params, sample->timestamp,
+                                   "sample.time") < 0)
         goto cleanup;
 
     for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
-        if (stats & qemuDomainGetStatsWorkers[i].stats) {
-            if (qemuDomainGetStatsWorkers[i].func(conn->privateData, dom, tmp,
-                                                  &maxparams, flags) < 0)
-                goto cleanup;
+        if (!(stats & qemuDomainGetStatsWorkers[i].stats))
+            continue;
+
+        for (j = 0; j < entry->nparams[i]; j++) {
+            src = &entry->params[i][j];
+
+            switch ((virTypedParameterType) src->type) {
+            case VIR_TYPED_PARAM_INT:
+                if (virTypedParamListAddInt(params, src->value.i,
+                                            "%s", src->field) < 0)
+                    goto cleanup;
+                break;
+            case VIR_TYPED_PARAM_UINT:
+                if (virTypedParamListAddUInt(params, src->value.ui,
+                                             "%s", src->field) < 0)
+                    goto cleanup;
+                break;
+            case VIR_TYPED_PARAM_LLONG:
+                if (virTypedParamListAddLLong(params, src->value.l,
+                                              "%s", src->field) < 0)
+                    goto cleanup;
+                break;
+            case VIR_TYPED_PARAM_ULLONG:
+                if (virTypedParamListAddULLong(params, src->value.ul,
+                                               "%s", src->field) < 0)
+                    goto cleanup;
+                break;
+            case VIR_TYPED_PARAM_DOUBLE:
+                if (virTypedParamListAddDouble(params, src->value.d,
+                                               "%s", src->field) < 0)
+                    goto cleanup;
+                break;
+            case VIR_TYPED_PARAM_BOOLEAN:
+                if (virTypedParamListAddBoolean(params, src->value.b,
+                                                "%s", src->field) < 0)
+                    goto cleanup;
+                break;
+            case VIR_TYPED_PARAM_STRING:
+                if (virTypedParamListAddString(params, src->value.s,
+                                               "%s", src->field) < 0)
+                    goto cleanup;
+                break;
+            case VIR_TYPED_PARAM_LAST:
+                break;
+            }
         }
     }
 
-    if (!(tmp->dom = virGetDomain(conn, dom->def->name,
-                                  dom->def->uuid, dom->def->id)))
+    if (!(tmp->dom = virGetDomain(conn, entry->name, entry->uuid, entry->id)))
         goto cleanup;
 
+    tmp->nparams = virTypedParamListStealParams(params, &tmp->params);
     *record = tmp;
     tmp = NULL;
     ret = 0;
 
  cleanup:
     if (tmp) {
-        virTypedParamsFree(tmp->params, tmp->nparams);
+        virObjectUnref(tmp->dom);
         VIR_FREE(tmp);
     }
+    virTypedParamListFree(params);
+    return ret;
+}
+
+
+/*
+ * Answer qemuConnectGetAllDomainStats for @vms from the latest sample
+ * or, with @history, from all kept samples.
+ */
+static int
+qemuConnectGetAllDomainStatsSampled(virConnectPtr conn,
+                                    virDomainObjPtr *vms,
+                                    size_t nvms,
+                                    unsigned int stats,
+                                    bool enforce,
+                                    bool history,
+                                    virDomainStatsRecordPtr **retStats)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    qemuStatsSamplerPtr sampler = driver->statsSampler;
+    qemuStatsSamplePtr *samples = NULL;
+    size_t nsamples = 0;
+    char (*uuids)[VIR_UUID_STRING_BUFLEN] = NULL;
+    qemuStatsSampleDomainPtr entry;
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    size_t nstats = 0;
+    size_t i, j;
+    int ret = -1;
+
+    if (!sampler) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("domain stats sampling is not enabled"));
+        return -1;
+    }
+
+    if (enforce && stats & ~QEMU_STATS_SAMPLER_GROUPS) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                       _("Stats types bits 0x%x are not sampled by this daemon"),
+                       stats & ~QEMU_STATS_SAMPLER_GROUPS);
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(samples, sampler->nsamples) < 0)
+        return -1;
+
+    /* the samples are immutable, so they can be read without the lock
+     * once referenced */
+    virMutexLock(&sampler->lock);
+    for (i = history || !sampler->count ? 0 : sampler->count - 1;
+         i < sampler->count; i++) {
+        samples[nsamples] = sampler->samples[(sampler->first + i) %
+                                             sampler->nsamples];
+        virAtomicIntInc(&samples[nsamples++]->refs);
+    }
+    virMutexUnlock(&sampler->lock);
+
+    if (nsamples == 0) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("no domain stats sample has been taken yet"));
+        goto cleanup;
+    }
 
+    if (VIR_ALLOC_N(uuids, nvms) < 0 ||
+        VIR_ALLOC_N(tmpstats, nvms * nsamples + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nvms; i++) {
+        virObjectLock(vms[i]);
+        virUUIDFormat(vms[i]->def->uuid, uuids[i]);
+        virObjectUnlock(vms[i]);
+    }
+
+    for (i = 0; i < nsamples; i++) {
+        for (j = 0; j < nvms; j++) {
+            if (!(entry = virHashLookup(samples[i]->domains, uuids[j])))
+                continue;
+
+            if (qemuStatsSampleGetRecord(conn, samples[i], entry, stats,
+                                         &tmpstats[nstats]) < 0)
+                goto cleanup;
+            nstats++;
+        }
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+    ret = nstats;
+
+ cleanup:
+    if (tmpstats) {
+        for (i = 0; i < nstats; i++) {
+            virObjectUnref(tmpstats[i]->dom);
+            virTypedParamsFree(tmpstats[i]->params, tmpstats[i]->nparams);
+            VIR_FREE(tmpstats[i]);
+        }
+        VIR_FREE(tmpstats);
+    }
+    for (i = 0; i < nsamples; i++)
+        qemuStatsSampleUnref(samples[i]);
+    VIR_FREE(samples);
+    VIR_FREE(uuids);
     return ret;
 }
 
@@ -19593,25 +22076,38 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
                              unsigned int flags)
 {
     virQEMUDriverPtr driver = conn->privateData;
+    virQEMUDriverConfigPtr cfg = NULL;
     virDomainObjPtr *vms = NULL;
-    virDomainObjPtr vm;
     size_t nvms;
     virDomainStatsRecordPtr *tmpstats = NULL;
+    qemuDomainGetStatsShared shared;
     bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
+    bool history = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLE_HISTORY);
+    bool sampled = history ||
+                   !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED);
     int nstats = 0;
     size_t i;
     int ret = -1;
     unsigned int privflags = 0;
-    unsigned int domflags = 0;
     unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
                                    VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
                                    VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
 
+    memset(&shared, 0, sizeof(shared));
+
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
                   VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
                   VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
                   VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING |
-                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLE_HISTORY, -1);
+
+    VIR_EXCLUSIVE_FLAGS_RET(VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING,
+                            VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED, -1);
+    VIR_EXCLUSIVE_FLAGS_RET(VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING,
+                            VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLE_HISTORY,
+                            -1);
 
     if (virConnectGetAllDomainStatsEnsureACL(conn) < 0)
         return -1;
@@ -19631,42 +22127,53 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
             return -1;
     }
 
+    if (sampled) {
+        ret = qemuConnectGetAllDomainStatsSampled(conn, vms, nvms, stats,
+                                                  enforce, history, retStats);
+        goto cleanup;
+    }
+
+    cfg = virQEMUDriverGetConfig(driver);
+
     if (VIR_ALLOC_N(tmpstats, nvms + 1) < 0)
-        return -1;
+        goto cleanup;
 
     if (qemuDomainGetStatsNeedMonitor(stats))
         privflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
-
-    for (i = 0; i < nvms; i++) {
-        virDomainStatsRecordPtr tmp = NULL;
-        domflags = 0;
-        vm = vms[i];
-
-        virObjectLock(vm);
-
-        if (HAVE_JOB(privflags) &&
-            qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) == 0)
-            domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
-        /* else: without a job it's still possible to gather some data */
-
-        if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING)
-            domflags |= QEMU_DOMAIN_STATS_BACKING;
-        if (qemuDomainGetStats(conn, vm, stats, &tmp, domflags) < 0) {
-            if (HAVE_JOB(domflags) && vm)
-                qemuDomainObjEndJob(driver, vm);
-
-            virObjectUnlock(vm);
+    if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING)
+        privflags |= QEMU_DOMAIN_STATS_BACKING;
+
+    /* the interfaces of a single domain are cheaper to look up one by one */
+    if (nvms > 1)
+        qemuDomainGetStatsSharedInit(&shared, stats);
+
+    if (cfg->statsWorkers > 1 && nvms > 1) {
+        if (qemuConnectGetAllDomainStatsParallel(conn, vms, nvms, stats,
+                                                 privflags,
+                                                 cfg->statsJobTimeout,
+                                                 &shared,
+                                                 cfg->statsWorkers,
+                                                 tmpstats) < 0)
             goto cleanup;
+    } else {
+        for (i = 0; i < nvms; i++) {
+            if (qemuConnectGetAllDomainStatsOne(conn, vms[i], stats,
+                                                privflags,
+                                                cfg->statsJobTimeout,
+                                                &shared,
+                                                &tmpstats[i]) < 0)
+                goto cleanup;
         }
+    }
 
-        if (tmp)
-            tmpstats[nstats++] = tmp;
-
-        if (HAVE_JOB(domflags))
-            qemuDomainObjEndJob(driver, vm);
-
-        virObjectUnlock(vm);
+    /* Squash the holes left by domains which produced no record while
+     * keeping the records in the order of @vms. */
+    for (i = 0; i < nvms; i++) {
+        if (tmpstats[i])
+            tmpstats[nstats++] = tmpstats[i];
     }
+    for (i = nstats; i < nvms; i++)
+        tmpstats[i] = NULL;
 
     *retStats = tmpstats;
     tmpstats = NULL;
@@ -19674,8 +22181,19 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     ret = nstats;
 
  cleanup:
-    virDomainStatsRecordListFree(tmpstats);
+    if (tmpstats) {
+        for (i = 0; i < nvms; i++) {
+            if (!tmpstats[i])
+                continue;
+            virObjectUnref(tmpstats[i]->dom);
+            virTypedParamsFree(tmpstats[i]->params, tmpstats[i]->nparams);
+            VIR_FREE(tmpstats[i]);
+        }
+        VIR_FREE(tmpstats);
+    }
+    qemuDomainGetStatsSharedClear(&shared);
     virObjectListFreeCount(vms, nvms);
+    virObjectUnref(cfg);
 
     return ret;
 }
@@ -20449,6 +22967,67 @@ qemuDomainSetBlockThreshold(virDomainPtr dom,
 }
 
 
+static int
+qemuDomainStartDirtyRateCalc(virDomainPtr dom,
+                             int seconds,
+                             unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    qemuDomainObjPrivatePtr priv;
+    virDomainObjPtr vm = NULL;
+    int rc;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (seconds < 1 || seconds > QEMU_DOMAIN_DIRTYRATE_CALC_MAX) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("seconds must be between 1 and %d"),
+                       QEMU_DOMAIN_DIRTYRATE_CALC_MAX);
+        return -1;
+    }
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    priv = vm->privateData;
+
+    if (virDomainStartDirtyRateCalcEnsureACL(dom->conn, vm->def) < 0)
+        goto cleanup;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("domain is not running"));
+        goto endjob;
+    }
+
+    if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_CALC_DIRTY_RATE)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("this qemu does not support calculating dirty rate"));
+        goto endjob;
+    }
+
+    VIR_DEBUG("Calculate dirty rate in next %d seconds", seconds);
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    rc = qemuMonitorStartDirtyRateCalc(priv->mon, seconds);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+        goto endjob;
+
+    ret = 0;
+
+ endjob:
+    qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
+
+
 static virHypervisorDriver qemuHypervisorDriver = {
     .name = QEMU_DRIVER_NAME,
     .connectOpen = qemuConnectOpen, /* 0.2.0 */
@@ -20663,7 +23242,9 @@ static virHypervisorDriver qemuHypervisorDriver = {
     .domainGetGuestVcpus = qemuDomainGetGuestVcpus, /* 2.0.0 */
     .domainSetGuestVcpus = qemuDomainSetGuestVcpus, /* 2.0.0 */
     .domainSetVcpu = qemuDomainSetVcpu, /* 3.1.0 */
-    .domainSetBlockThreshold = qemuDomainSetBlockThreshold /* 3.2.0 */
+    .domainSetBlockThreshold = qemuDomainSetBlockThreshold, /* 3.2.0 */
+    .domainStartDirtyRateCalc = qemuDomainStartDirtyRateCalc, /* 3.4.0 */
+    .domainBlockBackup = qemuDomainBlockBackup, /* 3.4.0 */
 };
 
 
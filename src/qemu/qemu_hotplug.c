@@ -287,6 +287,7 @@ qemuDomainChangeEjectableMedia(virQEMUDriverPtr driver,
     virStorageSourceFree(disk->src);
     disk->src = newsrc;
     newsrc = NULL;
+    qemuDomainBlockStatsCacheInvalidate(vm);
     ret = 0;
 
  cleanup:
@@ -419,6 +420,7 @@ qemuDomainAttachVirtioDiskDevice(virConnectPtr conn,
     virDomainAuditDisk(vm, NULL, disk->src, "attach", true);
 
     virDomainDiskInsertPreAlloced(vm->def, disk);
+    qemuDomainBlockStatsCacheInvalidate(vm);
     ret = 0;
 
  cleanup:
@@ -706,6 +708,7 @@ qemuDomainAttachSCSIDisk(virConnectPtr conn,
     virDomainAuditDisk(vm, NULL, disk->src, "attach", true);
 
     virDomainDiskInsertPreAlloced(vm->def, disk);
+    qemuDomainBlockStatsCacheInvalidate(vm);
     ret = 0;
 
  cleanup:
@@ -804,6 +807,7 @@ qemuDomainAttachUSBMassStorageDevice(virQEMUDriverPtr driver,
     virDomainAuditDisk(vm, NULL, disk->src, "attach", true);
 
     virDomainDiskInsertPreAlloced(vm->def, disk);
+    qemuDomainBlockStatsCacheInvalidate(vm);
     ret = 0;
 
  cleanup:
@@ -842,6 +846,7 @@ qemuDomainAttachDeviceDiskLive(virConnectPtr conn,
                                virDomainDeviceDefPtr dev)
 {
     size_t i;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     virDomainDiskDefPtr disk = dev->data.disk;
     virDomainDiskDefPtr orig_disk = NULL;
     int ret = -1;
@@ -895,6 +900,14 @@ qemuDomainAttachDeviceDiskLive(virConnectPtr conn,
                 goto cleanup;
         }
 
+        if (disk->watermark &&
+            !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BLOCK_WRITE_THRESHOLD)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("disk watermark is not supported with this "
+                             "QEMU binary"));
+            goto cleanup;
+        }
+
         switch ((virDomainDiskBus) disk->bus) {
         case VIR_DOMAIN_DISK_BUS_USB:
             if (disk->device == VIR_DOMAIN_DISK_DEVICE_LUN) {
@@ -924,6 +937,14 @@ qemuDomainAttachDeviceDiskLive(virConnectPtr conn,
                            _("disk bus '%s' cannot be hotplugged."),
                            virDomainDiskBusTypeToString(disk->bus));
         }
+
+        /* the disk is in use by the guest already, so don't fail */
+        if (ret == 0 &&
+            qemuProcessArmDiskWatermark(driver, vm, disk, 0,
+                                        QEMU_ASYNC_JOB_NONE) < 0) {
+            VIR_WARN("Unable to arm watermark of disk %s", disk->dst);
+            virResetLastError();
+        }
         break;
 
     case VIR_DOMAIN_DISK_DEVICE_LAST:
@@ -983,6 +1004,9 @@ qemuDomainAttachNetDevice(virQEMUDriverPtr driver,
 
     actualType = virDomainNetGetActualType(net);
 
+    if (qemuDomainNetResolveAutoQueues(vm->def, net) < 0)
+        goto cleanup;
+
     /* Currently only TAP/macvtap devices supports multiqueue. */
     if (net->driver.virtio.queues > 0 &&
         !(actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
@@ -3035,6 +3059,13 @@ qemuDomainChangeNet(virQEMUDriverPtr driver,
         goto cleanup;
     }
 
+    /* queues='auto' was resolved when the device was started and the
+     * number of queues of a live device cannot change anyway */
+    if (newdev->driver.virtio.queues_auto) {
+        newdev->driver.virtio.queues = olddev->driver.virtio.queues;
+        newdev->driver.virtio.queues_auto = false;
+    }
+
     if (olddev->model && STREQ(olddev->model, "virtio") &&
         (olddev->driver.virtio.name != newdev->driver.virtio.name ||
          olddev->driver.virtio.txmode != newdev->driver.virtio.txmode ||
@@ -3669,6 +3700,7 @@ qemuDomainRemoveDiskDevice(virQEMUDriverPtr driver,
             break;
         }
     }
+    qemuDomainBlockStatsCacheInvalidate(vm);
 
     qemuDomainReleaseDeviceAddress(vm, &disk->info, src);
 
@@ -4347,7 +4379,8 @@ qemuDomainResetDeviceRemoval(virDomainObjPtr vm)
  *  -1 Unplug of the device failed
  *
  *   0 DEVICE_DELETED event is supported and removal of the device did not
- *     finish in qemuDomainRemoveDeviceWaitTime
+ *     finish in qemuDomainRemoveDeviceWaitTime, or priv->unplugMode says
+ *     not to wait for it here
  *
  *   1 when the caller is responsible for finishing the device removal:
  *      - DEVICE_DELETED event is unsupported
@@ -4358,12 +4391,32 @@ static int
 qemuDomainWaitForDeviceRemoval(virDomainObjPtr vm)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainUnpluggingDevice deferred;
     unsigned long long until;
     int rc;
 
     if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_DEVICE_DEL_EVENT))
         return 1;
 
+    /* If the event already arrived, the caller has to finish the
+     * removal whatever the mode is */
+    if (priv->unplug.alias) {
+        switch (priv->unplugMode) {
+        case QEMU_DOMAIN_UNPLUG_WAIT:
+            break;
+
+        case QEMU_DOMAIN_UNPLUG_DEFER:
+            deferred = priv->unplug;
+            if (VIR_APPEND_ELEMENT(priv->unplugDeferred,
+                                   priv->nunplugDeferred, deferred) < 0)
+                break;
+            return 0;
+
+        case QEMU_DOMAIN_UNPLUG_ASYNC:
+            return 0;
+        }
+    }
+
     if (virTimeMillisNow(&until) < 0)
         return 1;
     until += qemuDomainRemoveDeviceWaitTime;
@@ -4400,6 +4453,7 @@ qemuDomainSignalDeviceRemoval(virDomainObjPtr vm,
                               qemuDomainUnpluggingDeviceStatus status)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    size_t i;
 
     if (STREQ_NULLABLE(priv->unplug.alias, devAlias)) {
         VIR_DEBUG("Removal of device '%s' continues in waiting thread", devAlias);
@@ -4408,10 +4462,117 @@ qemuDomainSignalDeviceRemoval(virDomainObjPtr vm,
         virDomainObjBroadcast(vm);
         return true;
     }
+
+    for (i = 0; i < priv->nunplugDeferred; i++) {
+        qemuDomainUnpluggingDevicePtr unplug = &priv->unplugDeferred[i];
+
+        if (unplug->status == QEMU_DOMAIN_UNPLUGGING_DEVICE_STATUS_NONE &&
+            STREQ(unplug->alias, devAlias)) {
+            VIR_DEBUG("Removal of device '%s' continues in waiting thread",
+                      devAlias);
+            unplug->status = status;
+            virDomainObjBroadcast(vm);
+            return true;
+        }
+    }
+
     return false;
 }
 
 
+static bool
+qemuDomainHasDeferredRemoval(qemuDomainObjPrivatePtr priv)
+{
+    size_t i;
+
+    for (i = 0; i < priv->nunplugDeferred; i++) {
+        if (priv->unplugDeferred[i].status ==
+            QEMU_DOMAIN_UNPLUGGING_DEVICE_STATUS_NONE)
+            return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * qemuDomainWaitForDeviceRemovals:
+ * @driver: qemu driver
+ * @vm: domain object
+ *
+ * Waits for the guest to release all devices whose unplug was requested
+ * in QEMU_DOMAIN_UNPLUG_DEFER mode, all of them sharing a single
+ * qemuDomainRemoveDeviceWaitTime, and finishes the removal of those it
+ * released. The removal of the remaining ones is finished by the
+ * DEVICE_DELETED handler. Switches @vm back to QEMU_DOMAIN_UNPLUG_WAIT.
+ *
+ * Returns 0 on success, -1 if the guest rejected the unplug of a device
+ * or finishing its removal failed.
+ */
+int
+qemuDomainWaitForDeviceRemovals(virQEMUDriverPtr driver,
+                                virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainUnpluggingDevicePtr unplug = NULL;
+    size_t nunplug = 0;
+    virDomainDeviceDef dev;
+    unsigned long long until;
+    size_t i;
+    int rc;
+    int ret = 0;
+
+    priv->unplugMode = QEMU_DOMAIN_UNPLUG_WAIT;
+
+    if (virTimeMillisNow(&until) < 0)
+        until = 0;
+    until += qemuDomainRemoveDeviceWaitTime;
+
+    while (qemuDomainHasDeferredRemoval(priv)) {
+        if ((rc = virDomainObjWaitUntil(vm, until)) == 1)
+            break;
+
+        if (rc < 0) {
+            VIR_WARN("Failed to wait on unplug condition for domain '%s'",
+                     vm->def->name);
+            break;
+        }
+    }
+
+    /* Anything arriving from now on goes to the DEVICE_DELETED handler,
+     * removing the devices below unlocks @vm in the monitor */
+    VIR_STEAL_PTR(unplug, priv->unplugDeferred);
+    nunplug = priv->nunplugDeferred;
+    priv->nunplugDeferred = 0;
+
+    for (i = 0; i < nunplug && virDomainObjIsActive(vm); i++) {
+        switch (unplug[i].status) {
+        case QEMU_DOMAIN_UNPLUGGING_DEVICE_STATUS_NONE:
+            VIR_DEBUG("Removal of device '%s' did not finish in time",
+                      unplug[i].alias);
+            break;
+
+        case QEMU_DOMAIN_UNPLUGGING_DEVICE_STATUS_GUEST_REJECTED:
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("unplug of device '%s' was rejected by the guest"),
+                           unplug[i].alias);
+            ret = -1;
+            break;
+
+        case QEMU_DOMAIN_UNPLUGGING_DEVICE_STATUS_OK:
+            if (virDomainDefFindDevice(vm->def, unplug[i].alias,
+                                       &dev, true) < 0 ||
+                qemuDomainRemoveDevice(driver, vm, &dev) < 0)
+                ret = -1;
+            break;
+        }
+    }
+
+    VIR_FREE(unplug);
+    return ret;
+}
+
+
 static int
 qemuDomainDetachVirtioDiskDevice(virQEMUDriverPtr driver,
                                  virDomainObjPtr vm,
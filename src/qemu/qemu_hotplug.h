@@ -158,6 +158,8 @@ int qemuDomainRemoveDevice(virQEMUDriverPtr driver,
 bool qemuDomainSignalDeviceRemoval(virDomainObjPtr vm,
                                    const char *devAlias,
                                    qemuDomainUnpluggingDeviceStatus status);
+int qemuDomainWaitForDeviceRemovals(virQEMUDriverPtr driver,
+                                    virDomainObjPtr vm);
 
 int qemuDomainSetVcpusInternal(virQEMUDriverPtr driver,
                                virDomainObjPtr vm,
@@ -51,6 +51,7 @@
 #include "virtime.h"
 #include "locking/domain_lock.h"
 #include "rpc/virnetsocket.h"
+#include "rpc/virnetprotocol.h"
 #include "virstoragefile.h"
 #include "viruri.h"
 #include "virhook.h"
@@ -723,22 +724,18 @@ qemuMigrationDriveMirrorCancelled(virQEMUDriverPtr driver,
 
 
 /*
- * Returns 0 on success,
+ * Returns 0 when the job is still running and needs to be cancelled,
  *         1 when job is already completed or it failed and failNoJob is false,
  *         -1 on error or when job failed and failNoJob is true.
  */
 static int
-qemuMigrationCancelOneDriveMirror(virQEMUDriverPtr driver,
-                                  virDomainObjPtr vm,
-                                  virDomainDiskDefPtr disk,
-                                  bool failNoJob,
-                                  qemuDomainAsyncJob asyncJob)
+qemuMigrationCheckOneDriveMirror(virQEMUDriverPtr driver,
+                                 virDomainObjPtr vm,
+                                 virDomainDiskDefPtr disk,
+                                 bool failNoJob,
+                                 qemuDomainAsyncJob asyncJob)
 {
-    qemuDomainObjPrivatePtr priv = vm->privateData;
-    char *diskAlias = NULL;
-    int ret = -1;
     int status;
-    int rv;
 
     status = qemuBlockJobUpdate(driver, vm, asyncJob, disk);
     switch (status) {
@@ -756,22 +753,7 @@ qemuMigrationCancelOneDriveMirror(virQEMUDriverPtr driver,
         return 1;
     }
 
-    if (!(diskAlias = qemuAliasFromDisk(disk)))
-        return -1;
-
-    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
-        goto cleanup;
-
-    rv = qemuMonitorBlockJobCancel(priv->mon, diskAlias, true);
-
-    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rv < 0)
-        goto cleanup;
-
-    ret = 0;
-
- cleanup:
-    VIR_FREE(diskAlias);
-    return ret;
+    return 0;
 }
 
 
@@ -783,7 +765,8 @@ qemuMigrationCancelOneDriveMirror(virQEMUDriverPtr driver,
  *
  * Cancel all drive-mirrors started by qemuMigrationDriveMirror.
  * Any pending block job events for the affected disks will be
- * processed.
+ * processed. The mirrors which are still running are all cancelled
+ * within a single monitor session.
  *
  * Returns 0 on success, -1 otherwise.
  */
@@ -794,7 +777,12 @@ qemuMigrationCancelDriveMirror(virQEMUDriverPtr driver,
                                qemuDomainAsyncJob asyncJob,
                                virConnectPtr dconn)
 {
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     virErrorPtr err = NULL;
+    virDomainDiskDefPtr *disks = NULL;
+    char **diskAliases = NULL;
+    bool *cancelFailed = NULL;
+    size_t ndisks = 0;
     int ret = -1;
     size_t i;
     int rv;
@@ -802,6 +790,12 @@ qemuMigrationCancelDriveMirror(virQEMUDriverPtr driver,
 
     VIR_DEBUG("Cancelling drive mirrors for domain %s", vm->def->name);
 
+    if (vm->def->ndisks &&
+        (VIR_ALLOC_N(disks, vm->def->ndisks) < 0 ||
+         VIR_ALLOC_N(diskAliases, vm->def->ndisks) < 0 ||
+         VIR_ALLOC_N(cancelFailed, vm->def->ndisks) < 0))
+        goto cleanup;
+
     for (i = 0; i < vm->def->ndisks; i++) {
         virDomainDiskDefPtr disk = vm->def->disks[i];
         qemuDomainDiskPrivatePtr diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
@@ -809,8 +803,12 @@ qemuMigrationCancelDriveMirror(virQEMUDriverPtr driver,
         if (!diskPriv->migrating)
             continue;
 
-        rv = qemuMigrationCancelOneDriveMirror(driver, vm, disk,
-                                               check, asyncJob);
+        rv = qemuMigrationCheckOneDriveMirror(driver, vm, disk,
+                                              check, asyncJob);
+        if (rv == 0 &&
+            !(diskAliases[ndisks] = qemuAliasFromDisk(disk)))
+            rv = -1;
+
         if (rv != 0) {
             if (rv < 0) {
                 if (!err)
@@ -819,6 +817,43 @@ qemuMigrationCancelDriveMirror(virQEMUDriverPtr driver,
             }
             qemuBlockJobSyncEnd(driver, vm, asyncJob, disk);
             diskPriv->migrating = false;
+        } else {
+            disks[ndisks++] = disk;
+        }
+    }
+
+    if (ndisks) {
+        if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0) {
+            if (!err)
+                err = virSaveLastError();
+            failed = true;
+            for (i = 0; i < ndisks; i++)
+                cancelFailed[i] = true;
+        } else {
+            for (i = 0; i < ndisks; i++) {
+                if (qemuMonitorBlockJobCancel(priv->mon,
+                                              diskAliases[i], true) < 0) {
+                    if (!err)
+                        err = virSaveLastError();
+                    cancelFailed[i] = true;
+                    failed = true;
+                }
+            }
+
+            if (qemuDomainObjExitMonitor(driver, vm) < 0) {
+                if (!err)
+                    err = virSaveLastError();
+                failed = true;
+                for (i = 0; i < ndisks; i++)
+                    cancelFailed[i] = true;
+            }
+        }
+
+        for (i = 0; i < ndisks; i++) {
+            if (!cancelFailed[i])
+                continue;
+            qemuBlockJobSyncEnd(driver, vm, asyncJob, disks[i]);
+            QEMU_DOMAIN_DISK_PRIVATE(disks[i])->migrating = false;
         }
     }
 
@@ -847,6 +882,13 @@ qemuMigrationCancelDriveMirror(virQEMUDriverPtr driver,
     ret = failed ? -1 : 0;
 
  cleanup:
+    if (diskAliases) {
+        for (i = 0; i < ndisks; i++)
+            VIR_FREE(diskAliases[i]);
+    }
+    VIR_FREE(diskAliases);
+    VIR_FREE(disks);
+    VIR_FREE(cancelFailed);
     if (err) {
         virSetError(err);
         virFreeError(err);
@@ -862,15 +904,17 @@ qemuMigrationCancelDriveMirror(virQEMUDriverPtr driver,
  * @mig: migration cookie
  * @host: where are we migrating to
  * @speed: bandwidth limit in MiB/s
+ * @mirror: drive-mirror tuning (may be NULL)
  * @migrate_flags: migrate monitor command flags
  *
  * Run drive-mirror to feed NBD server running on dst and wait
  * till the process switches into another phase where writes go
- * simultaneously to both source and destination. On success,
- * update @migrate_flags so we don't tell 'migrate' command
- * to do the very same operation. On failure, the caller is
- * expected to call qemuMigrationCancelDriveMirror to stop all
- * running mirrors.
+ * simultaneously to both source and destination. All mirrors are
+ * started at once and their readiness is then awaited as the block
+ * job events come in. On success, update @migrate_flags so we don't
+ * tell 'migrate' command to do the very same operation. On failure,
+ * the caller is expected to call qemuMigrationCancelDriveMirror to
+ * stop all running mirrors.
  *
  * Returns 0 on success (@migrate_flags updated),
  *        -1 otherwise.
@@ -881,6 +925,7 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
                          qemuMigrationCookiePtr mig,
                          const char *host,
                          unsigned long speed,
+                         qemuMigrationMirrorPtr mirror,
                          unsigned int *migrate_flags,
                          size_t nmigrate_disks,
                          const char **migrate_disks,
@@ -890,16 +935,53 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
     int ret = -1;
     int port;
     size_t i;
-    char *diskAlias = NULL;
-    char *nbd_dest = NULL;
+    char **diskAliases = NULL;
+    char **nbd_dests = NULL;
+    virDomainDiskDefPtr *disks = NULL;
+    size_t ndisks = 0;
+    size_t nstarted = 0;
     char *hoststr = NULL;
     unsigned long long mirror_speed = speed;
+    unsigned int granularity = 0;
+    unsigned long long buf_size = 0;
     unsigned int mirror_flags = VIR_DOMAIN_BLOCK_REBASE_REUSE_EXT;
+    int mon_ret = 0;
     int rv;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     VIR_DEBUG("Starting drive mirrors for domain %s", vm->def->name);
 
+    if (vm->def->ndisks &&
+        (VIR_ALLOC_N(disks, vm->def->ndisks) < 0 ||
+         VIR_ALLOC_N(diskAliases, vm->def->ndisks) < 0 ||
+         VIR_ALLOC_N(nbd_dests, vm->def->ndisks) < 0))
+        goto cleanup;
+
+    for (i = 0; i < vm->def->ndisks; i++) {
+        /* check whether disk should be migrated */
+        if (qemuMigrateDisk(vm->def->disks[i], nmigrate_disks, migrate_disks))
+            disks[ndisks++] = vm->def->disks[i];
+    }
+
+    if (mirror) {
+        if (mirror->bandwidth_set)
+            mirror_speed = mirror->bandwidth;
+
+        /* Split the total bandwidth evenly, but don't let any disk
+         * exceed its own limit */
+        if (mirror->totalBandwidth_set && mirror->totalBandwidth && ndisks) {
+            unsigned long long share = mirror->totalBandwidth / ndisks;
+
+            if (share == 0)
+                share = 1;
+            if (!mirror_speed || share < mirror_speed)
+                mirror_speed = share;
+        }
+
+        granularity = mirror->granularity;
+        buf_size = mirror->bufSize;
+    }
+
     if (mirror_speed > LLONG_MAX >> 20) {
         virReportError(VIR_ERR_OVERFLOW,
                        _("bandwidth must be less than %llu"),
@@ -908,6 +990,9 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
     }
     mirror_speed <<= 20;
 
+    VIR_DEBUG("Mirroring %zu disks at %llu B/s each, granularity=%u "
+              "buf_size=%llu", ndisks, mirror_speed, granularity, buf_size);
+
     /* steal NBD port and thus prevent its propagation back to destination */
     port = mig->nbd->port;
     mig->nbd->port = 0;
@@ -923,41 +1008,49 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
     if (*migrate_flags & QEMU_MONITOR_MIGRATE_NON_SHARED_INC)
         mirror_flags |= VIR_DOMAIN_BLOCK_REBASE_SHALLOW;
 
-    for (i = 0; i < vm->def->ndisks; i++) {
-        virDomainDiskDefPtr disk = vm->def->disks[i];
-        qemuDomainDiskPrivatePtr diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
-        int mon_ret;
-
-        /* check whether disk should be migrated */
-        if (!qemuMigrateDisk(disk, nmigrate_disks, migrate_disks))
-            continue;
-
-        if (!(diskAlias = qemuAliasFromDisk(disk)) ||
-            (virAsprintf(&nbd_dest, "nbd:%s:%d:exportname=%s",
-                         hoststr, port, diskAlias) < 0))
+    for (i = 0; i < ndisks; i++) {
+        if (!(diskAliases[i] = qemuAliasFromDisk(disks[i])) ||
+            (virAsprintf(&nbd_dests[i], "nbd:%s:%d:exportname=%s",
+                         hoststr, port, diskAliases[i]) < 0))
             goto cleanup;
+    }
 
+    /* Start all the mirrors within a single monitor session rather than
+     * going through the job machinery for every disk */
+    if (ndisks) {
         if (qemuDomainObjEnterMonitorAsync(driver, vm,
                                            QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
             goto cleanup;
 
-        qemuBlockJobSyncBegin(disk);
-        /* Force "raw" format for NBD export */
-        mon_ret = qemuMonitorDriveMirror(priv->mon, diskAlias, nbd_dest,
-                                         "raw", mirror_speed, 0, 0, mirror_flags);
-        VIR_FREE(diskAlias);
-        VIR_FREE(nbd_dest);
-
-        if (qemuDomainObjExitMonitor(driver, vm) < 0 || mon_ret < 0) {
-            qemuBlockJobSyncEnd(driver, vm, QEMU_ASYNC_JOB_MIGRATION_OUT, disk);
-            goto cleanup;
+        for (nstarted = 0; nstarted < ndisks; nstarted++) {
+            qemuBlockJobSyncBegin(disks[nstarted]);
+            /* Force "raw" format for NBD export */
+            mon_ret = qemuMonitorDriveMirror(priv->mon,
+                                             diskAliases[nstarted],
+                                             nbd_dests[nstarted], "raw",
+                                             mirror_speed, granularity,
+                                             buf_size, mirror_flags);
+            if (mon_ret < 0)
+                break;
         }
-        diskPriv->migrating = true;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        rv = qemuDomainObjExitMonitor(driver, vm);
+
+        for (i = 0; i < nstarted; i++)
+            QEMU_DOMAIN_DISK_PRIVATE(disks[i])->migrating = true;
+
+        if (mon_ret < 0)
+            qemuBlockJobSyncEnd(driver, vm, QEMU_ASYNC_JOB_MIGRATION_OUT,
+                                disks[nstarted]);
+
+        if (nstarted &&
+            virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
             VIR_WARN("Failed to save status on vm %s", vm->def->name);
             goto cleanup;
         }
+
+        if (rv < 0 || mon_ret < 0)
+            goto cleanup;
     }
 
     while ((rv = qemuMigrationDriveMirrorReady(driver, vm,
@@ -990,8 +1083,15 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
 
  cleanup:
     virObjectUnref(cfg);
-    VIR_FREE(diskAlias);
-    VIR_FREE(nbd_dest);
+    if (diskAliases) {
+        for (i = 0; i < ndisks; i++) {
+            VIR_FREE(diskAliases[i]);
+            VIR_FREE(nbd_dests[i]);
+        }
+    }
+    VIR_FREE(diskAliases);
+    VIR_FREE(nbd_dests);
+    VIR_FREE(disks);
     VIR_FREE(hoststr);
     return ret;
 }
@@ -1501,6 +1601,7 @@ qemuMigrationCompleted(virQEMUDriverPtr driver,
     qemuDomainJobInfoPtr jobInfo = priv->job.current;
     int pauseReason;
     bool updateStats = !!(flags & QEMU_MIGRATION_COMPLETED_UPDATE_STATS);
+    bool events = virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_MIGRATION_EVENT);
 
     if (qemuMigrationCheckJobStatus(driver, vm, asyncJob, updateStats) < 0)
         goto error;
@@ -1531,7 +1632,9 @@ qemuMigrationCompleted(virQEMUDriverPtr driver,
         jobInfo->type == VIR_DOMAIN_JOB_UNBOUNDED &&
         jobInfo->stats.status == QEMU_MONITOR_MIGRATION_STATUS_POSTCOPY) {
         VIR_DEBUG("Migration switched to post-copy");
-        if (updateStats &&
+        /* Without events the statistics were just fetched by
+         * qemuMigrationCheckJobStatus. */
+        if (events && updateStats &&
             qemuMigrationUpdateJobStatus(driver, vm, asyncJob) < 0)
             goto error;
         return 1;
@@ -1556,6 +1659,137 @@ qemuMigrationCompleted(virQEMUDriverPtr driver,
 }
 
 
+/* How often the convergence policy looks at migration statistics (ms) */
+#define QEMU_MIGRATION_POLICY_INTERVAL 1000
+
+/* Downtime QEMU allows unless told otherwise (ms) */
+#define QEMU_MIGRATION_DOWNTIME_DEFAULT 300
+
+typedef struct _qemuMigrationPolicyState qemuMigrationPolicyState;
+typedef qemuMigrationPolicyState *qemuMigrationPolicyStatePtr;
+struct _qemuMigrationPolicyState {
+    unsigned long long nextCheck;   /* when to look at the statistics again */
+    unsigned long long remaining;   /* RAM remaining at the previous check */
+    unsigned long long downtime;    /* downtime currently allowed, ms */
+    bool timedOut;                  /* the total time limit was reached */
+    bool postcopy;                  /* switch to post-copy was requested */
+};
+
+
+/**
+ * qemuMigrationApplyPolicy:
+ *
+ * Samples the dirty page rate and remaining RAM of an outgoing migration
+ * and, when it does not converge, raises the allowed downtime towards
+ * policy->maxDowntime. If even that is not enough or the migration runs
+ * longer than policy->maxTime, migration is switched to post-copy if it
+ * was enabled; otherwise the downtime is given the full limit.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuMigrationApplyPolicy(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm,
+                         qemuDomainAsyncJob asyncJob,
+                         qemuMigrationPolicyPtr policy,
+                         qemuMigrationPolicyStatePtr state)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainJobInfoPtr jobInfo = priv->job.current;
+    qemuMonitorMigrationStatsPtr stats = &jobInfo->stats;
+    unsigned long long now;
+    unsigned long long pageSize;
+    unsigned long long needed;
+    unsigned long long downtime = 0;
+    bool postcopy = false;
+    int rc;
+
+    if (state->postcopy)
+        return 0;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (now < state->nextCheck)
+        return 0;
+    state->nextCheck = now + QEMU_MIGRATION_POLICY_INTERVAL;
+
+    /* With migration events the statistics are not refreshed for us */
+    if (virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_MIGRATION_EVENT) &&
+        qemuMigrationUpdateJobStatus(driver, vm, asyncJob) < 0)
+        return -1;
+
+    if (stats->status != QEMU_MONITOR_MIGRATION_STATUS_ACTIVE)
+        return 0;
+
+    if (policy->maxTime && !state->timedOut &&
+        now - jobInfo->started >= policy->maxTime * 1000) {
+        VIR_DEBUG("Migration is running longer than %llu s", policy->maxTime);
+        state->timedOut = true;
+        if (priv->job.postcopyEnabled)
+            postcopy = true;
+        else if (policy->maxDowntime > state->downtime)
+            downtime = policy->maxDowntime;
+    } else if (policy->maxDowntime && stats->ram_bps &&
+               stats->ram_iteration > 1) {
+        /* QEMU reports the dirty rate in pages per second */
+        if (stats->ram_normal)
+            pageSize = stats->ram_normal_bytes / stats->ram_normal;
+        else
+            pageSize = virGetSystemPageSize();
+
+        VIR_DEBUG("remaining=%llu bps=%llu dirty_bps=%llu",
+                  stats->ram_remaining, stats->ram_bps,
+                  stats->ram_dirty_rate * pageSize);
+
+        /* The migration is not converging when the guest dirties memory
+         * faster than we can send it or the remaining RAM stopped
+         * shrinking since the previous check. */
+        if (stats->ram_dirty_rate * pageSize >= stats->ram_bps ||
+            (state->remaining && stats->ram_remaining >= state->remaining)) {
+            if (stats->downtime_set && stats->downtime)
+                needed = stats->downtime;
+            else
+                needed = stats->ram_remaining * 1000 / stats->ram_bps + 1;
+
+            if (needed > policy->maxDowntime) {
+                if (priv->job.postcopyEnabled)
+                    postcopy = true;
+                needed = policy->maxDowntime;
+            }
+
+            if (!postcopy && needed > state->downtime)
+                downtime = needed;
+        }
+    }
+    state->remaining = stats->ram_remaining;
+
+    if (!downtime && !postcopy)
+        return 0;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        return -1;
+
+    if (postcopy) {
+        VIR_DEBUG("Switching migration to post-copy");
+        rc = qemuMonitorMigrateStartPostCopy(priv->mon);
+    } else {
+        VIR_DEBUG("Raising migration downtime to %llu ms", downtime);
+        rc = qemuMonitorSetMigrationDowntime(priv->mon, downtime);
+    }
+
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+        return -1;
+
+    if (postcopy)
+        state->postcopy = true;
+    else
+        state->downtime = downtime;
+
+    return 0;
+}
+
+
 /* Returns 0 on success, -2 when migration needs to be cancelled, or -1 when
  * QEMU reports failed migration.
  */
@@ -1564,13 +1798,20 @@ qemuMigrationWaitForCompletion(virQEMUDriverPtr driver,
                                virDomainObjPtr vm,
                                qemuDomainAsyncJob asyncJob,
                                virConnectPtr dconn,
+                               qemuMigrationPolicyPtr policy,
                                unsigned int flags)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     qemuDomainJobInfoPtr jobInfo = priv->job.current;
     bool events = virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_MIGRATION_EVENT);
+    qemuMigrationPolicyState state = {
+        .downtime = QEMU_MIGRATION_DOWNTIME_DEFAULT,
+    };
     int rv;
 
+    if (policy && !policy->maxDowntime && !policy->maxTime)
+        policy = NULL;
+
     flags |= QEMU_MIGRATION_COMPLETED_UPDATE_STATS;
 
     jobInfo->type = VIR_DOMAIN_JOB_UNBOUNDED;
@@ -1579,8 +1820,20 @@ qemuMigrationWaitForCompletion(virQEMUDriverPtr driver,
         if (rv < 0)
             return rv;
 
+        if (policy &&
+            qemuMigrationApplyPolicy(driver, vm, asyncJob,
+                                     policy, &state) < 0) {
+            jobInfo->type = VIR_DOMAIN_JOB_FAILED;
+            return -2;
+        }
+
         if (events) {
-            if (virDomainObjWait(vm) < 0) {
+            if (policy)
+                rv = virDomainObjWaitUntil(vm, state.nextCheck);
+            else
+                rv = virDomainObjWait(vm);
+
+            if (rv < 0) {
                 jobInfo->type = VIR_DOMAIN_JOB_FAILED;
                 return -2;
             }
@@ -1916,6 +2169,7 @@ qemuMigrationBeginPhase(virQEMUDriverPtr driver,
                         int *cookieoutlen,
                         size_t nmigrate_disks,
                         const char **migrate_disks,
+                        int nparallel,
                         unsigned long flags)
 {
     char *rv = NULL;
@@ -1927,10 +2181,11 @@ qemuMigrationBeginPhase(virQEMUDriverPtr driver,
 
     VIR_DEBUG("driver=%p, vm=%p, xmlin=%s, dname=%s,"
               " cookieout=%p, cookieoutlen=%p,"
-              " nmigrate_disks=%zu, migrate_disks=%p, flags=%lx",
+              " nmigrate_disks=%zu, migrate_disks=%p, nparallel=%d,"
+              " flags=%lx",
               driver, vm, NULLSTR(xmlin), NULLSTR(dname),
               cookieout, cookieoutlen, nmigrate_disks,
-              migrate_disks, flags);
+              migrate_disks, nparallel, flags);
 
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
         goto cleanup;
@@ -1964,6 +2219,13 @@ qemuMigrationBeginPhase(virQEMUDriverPtr driver,
         goto cleanup;
     }
 
+    if (flags & VIR_MIGRATE_PARALLEL && flags & VIR_MIGRATE_TUNNELLED) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
+                       _("parallel migration is not supported with tunnelled "
+                         "migration"));
+        goto cleanup;
+    }
+
     if (flags & (VIR_MIGRATE_NON_SHARED_DISK | VIR_MIGRATE_NON_SHARED_INC)) {
         bool has_drive_mirror =  virQEMUCapsGet(priv->qemuCaps,
                                                 QEMU_CAPS_DRIVE_MIRROR);
@@ -2023,6 +2285,17 @@ qemuMigrationBeginPhase(virQEMUDriverPtr driver,
     if (!(mig = qemuMigrationEatCookie(driver, vm, NULL, 0, 0)))
         goto cleanup;
 
+    /* The destination QEMU has to know how many connections to expect
+     * before the source starts migrating. An old daemon on the destination
+     * will refuse the cookie as the feature is marked mandatory. */
+    if (flags & VIR_MIGRATE_PARALLEL) {
+        if (nparallel <= 0)
+            nparallel = QEMU_MIGRATION_PARALLEL_CONNECTIONS_DEFAULT;
+
+        if (qemuMigrationCookieAddMultiFD(mig, nparallel) < 0)
+            goto cleanup;
+    }
+
     if (qemuMigrationBakeCookie(mig, driver, vm,
                                 cookieout, cookieoutlen,
                                 cookieFlags) < 0)
@@ -2080,6 +2353,7 @@ qemuMigrationBegin(virConnectPtr conn,
                    int *cookieoutlen,
                    size_t nmigrate_disks,
                    const char **migrate_disks,
+                   int nparallel,
                    unsigned long flags)
 {
     virQEMUDriverPtr driver = conn->privateData;
@@ -2114,7 +2388,8 @@ qemuMigrationBegin(virConnectPtr conn,
 
     if (!(xml = qemuMigrationBeginPhase(driver, vm, xmlin, dname,
                                         cookieout, cookieoutlen,
-                                        nmigrate_disks, migrate_disks, flags)))
+                                        nmigrate_disks, migrate_disks,
+                                        nparallel, flags)))
         goto endjob;
 
     if (flags & VIR_MIGRATE_TLS) {
@@ -2155,6 +2430,52 @@ qemuMigrationBegin(virConnectPtr conn,
 /* Prepare is the first step, and it runs on the destination host.
  */
 
+static void
+qemuMigrationClearPersistentDef(qemuDomainObjPrivatePtr priv)
+{
+    virDomainDefFree(priv->migPersistentDef);
+    priv->migPersistentDef = NULL;
+    VIR_FREE(priv->migPersistentDigest);
+}
+
+
+/*
+ * Keep a copy of the incoming definition of @vm so that the source can
+ * refer to it by its digest instead of sending the persistent definition
+ * in the Finish cookie when both are the same.
+ */
+static int
+qemuMigrationPrepareRememberDef(virQEMUDriverPtr driver,
+                                virCapsPtr caps,
+                                virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    char *xml = NULL;
+    int ret = -1;
+
+    qemuMigrationClearPersistentDef(priv);
+
+    if (!(priv->migPersistentDigest =
+          qemuMigrationCookiePersistentDigest(driver, vm->def, &xml)))
+        goto cleanup;
+
+    if (!(priv->migPersistentDef =
+          virDomainDefParseString(xml, caps, driver->xmlopt, NULL,
+                                  VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                                  VIR_DOMAIN_DEF_PARSE_ABI_UPDATE_MIGRATION |
+                                  VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0)
+        qemuMigrationClearPersistentDef(priv);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
 static void
 qemuMigrationPrepareCleanup(virQEMUDriverPtr driver,
                             virDomainObjPtr vm)
@@ -2169,6 +2490,7 @@ qemuMigrationPrepareCleanup(virQEMUDriverPtr driver,
 
     virPortAllocatorRelease(driver->migrationPorts, priv->migrationPort);
     priv->migrationPort = 0;
+    qemuMigrationClearPersistentDef(priv);
 
     if (!qemuMigrationJobIsActive(vm, QEMU_ASYNC_JOB_MIGRATION_IN))
         return;
@@ -2389,6 +2711,7 @@ qemuMigrationParams(virTypedParameterPtr params,
 
     GET(AUTO_CONVERGE_INITIAL, cpuThrottleInitial);
     GET(AUTO_CONVERGE_INCREMENT, cpuThrottleIncrement);
+    GET(PARALLEL_CONNECTIONS, multifdChannels);
 
 #undef GET
 
@@ -2400,6 +2723,21 @@ qemuMigrationParams(virTypedParameterPtr params,
         goto error;
     }
 
+    if (migParams->multifdChannels_set) {
+        if (!(flags & VIR_MIGRATE_PARALLEL)) {
+            virReportError(VIR_ERR_INVALID_ARG, "%s",
+                           _("Turn parallel migration on to tune it"));
+            goto error;
+        }
+
+        if (migParams->multifdChannels < 1) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("invalid number of parallel connections: %d"),
+                           migParams->multifdChannels);
+            goto error;
+        }
+    }
+
     return migParams;
 
  error:
@@ -2487,6 +2825,25 @@ qemuMigrationResetTLS(virQEMUDriverPtr driver,
 }
 
 
+/* Size of the pipe between QEMU and the migration tunnel */
+#define TUNNEL_PIPE_SIZE (1024 * 1024)
+
+/* Let the writer get ahead of the reader by more than the default 64KiB,
+ * which also allows whole stream packets to be read from the pipe at once.
+ * Failing to do so is not fatal. */
+static void
+qemuMigrationResizeTunnelPipe(int fd ATTRIBUTE_UNUSED)
+{
+#ifdef F_SETPIPE_SZ
+    char ebuf[1024];
+
+    if (fcntl(fd, F_SETPIPE_SZ, TUNNEL_PIPE_SIZE) < 0)
+        VIR_DEBUG("Unable to resize migration pipe: %s",
+                  virStrerror(errno, ebuf, sizeof(ebuf)));
+#endif
+}
+
+
 static int
 qemuMigrationPrepareAny(virQEMUDriverPtr driver,
                         virConnectPtr dconn,
@@ -2569,6 +2926,13 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         goto cleanup;
     }
 
+    if (flags & VIR_MIGRATE_PARALLEL && flags & VIR_MIGRATE_TUNNELLED) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
+                       _("parallel migration is not supported with tunnelled "
+                         "migration"));
+        goto cleanup;
+    }
+
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
         goto cleanup;
 
@@ -2634,6 +2998,11 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
     if (VIR_STRDUP(priv->origname, origname) < 0)
         goto cleanup;
 
+    if (flags & VIR_MIGRATE_PERSIST_DEST &&
+        !(flags & VIR_MIGRATE_OFFLINE) &&
+        qemuMigrationPrepareRememberDef(driver, caps, vm) < 0)
+        goto cleanup;
+
     if (taint_hook) {
         /* Domain XML has been altered by a hook script. */
         priv->hookRun = true;
@@ -2643,8 +3012,16 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
                                        QEMU_MIGRATION_COOKIE_LOCKSTATE |
                                        QEMU_MIGRATION_COOKIE_NBD |
                                        QEMU_MIGRATION_COOKIE_MEMORY_HOTPLUG |
-                                       QEMU_MIGRATION_COOKIE_CPU_HOTPLUG)))
+                                       QEMU_MIGRATION_COOKIE_CPU_HOTPLUG |
+                                       QEMU_MIGRATION_COOKIE_MULTIFD)))
+        goto cleanup;
+
+    if (flags & VIR_MIGRATE_PARALLEL && !mig->multifd) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("missing parallel migration data in migration "
+                         "cookie"));
         goto cleanup;
+    }
 
     if (STREQ_NULLABLE(protocol, "rdma") &&
         !virMemoryLimitIsSet(vm->def->mem.hard_limit)) {
@@ -2676,6 +3053,9 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         goto stopjob;
     }
 
+    if (tunnel)
+        qemuMigrationResizeTunnelPipe(dataFD[1]);
+
     if (qemuProcessInit(driver, vm, QEMU_ASYNC_JOB_MIGRATION_IN,
                         true, VIR_QEMU_PROCESS_START_AUTODESTROY) < 0)
         goto stopjob;
@@ -2758,10 +3138,26 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
                                  QEMU_ASYNC_JOB_MIGRATION_IN) < 0)
         goto stopjob;
 
+    if (qemuMigrationSetOption(driver, vm,
+                               QEMU_MONITOR_MIGRATION_CAPS_MULTIFD,
+                               flags & VIR_MIGRATE_PARALLEL,
+                               QEMU_ASYNC_JOB_MIGRATION_IN) < 0)
+        goto stopjob;
+
+    if (flags & VIR_MIGRATE_PARALLEL) {
+        migParams.multifdChannels_set = true;
+        migParams.multifdChannels = mig->multifd->channels;
+    }
+
     if (qemuMigrationSetParams(driver, vm, QEMU_ASYNC_JOB_MIGRATION_IN,
                                &migParams) < 0)
         goto stopjob;
 
+    /* Let the source know we are ready to accept parallel connections */
+    if (flags & VIR_MIGRATE_PARALLEL &&
+        qemuMigrationCookieAddMultiFD(mig, mig->multifd->channels) < 0)
+        goto stopjob;
+
     if (mig->nbd &&
         flags & (VIR_MIGRATE_NON_SHARED_DISK | VIR_MIGRATE_NON_SHARED_INC) &&
         virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_NBD_SERVER)) {
@@ -2792,7 +3188,10 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         goto stopjob;
 
  done:
-    if (qemuMigrationBakeCookie(mig, driver, vm, cookieout,
+    if ((priv->migPersistentDigest &&
+         qemuMigrationCookieAddPersistentDigest(mig,
+                                                priv->migPersistentDigest) < 0) ||
+        qemuMigrationBakeCookie(mig, driver, vm, cookieout,
                                 cookieoutlen, cookieFlags) < 0) {
         /* We could tear down the whole guest here, but
          * cookie data is (so far) non-critical, so that
@@ -2838,6 +3237,7 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         /* priv is set right after vm is added to the list of domains
          * and there is no 'goto cleanup;' in the middle of those */
         VIR_FREE(priv->origname);
+        qemuMigrationClearPersistentDef(priv);
         /* release if port is auto selected which is not the case if
          * it is given in parameters
          */
@@ -3330,7 +3730,19 @@ struct _qemuMigrationSpec {
     } fwd;
 };
 
-#define TUNNEL_SEND_BUF_SIZE 65536
+/* Each chunk read from QEMU is sent as a single stream packet. Keep it
+ * within the payload limit that even old daemons accept. */
+#define TUNNEL_SEND_BUF_SIZE VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX
+
+/* Number of chunks which may be queued between reading from QEMU and
+ * sending them to the destination */
+#define TUNNEL_SEND_BUF_COUNT 8
+
+typedef struct _qemuMigrationIOBuffer qemuMigrationIOBuffer;
+struct _qemuMigrationIOBuffer {
+    char *data;
+    size_t len;
+};
 
 typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
 typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
@@ -3341,21 +3753,141 @@ struct _qemuMigrationIOThread {
     virError err;
     int wakeupRecvFD;
     int wakeupSendFD;
+
+    /* Ring of chunks read from @sock waiting to be sent to @st by the
+     * sender thread. Protected by @lock. */
+    virMutex lock;
+    virCond cond;
+    qemuMigrationIOBuffer bufs[TUNNEL_SEND_BUF_COUNT];
+    size_t head;
+    size_t count;
+    bool eof;           /* no more chunks will be queued */
+    bool quit;          /* the sender thread has to stop right away */
+    bool sendFailed;    /* virStreamSend failed, see @sendErr */
+    virError sendErr;
 };
 
+
+/* Sends queued chunks to the stream so that reading the next chunk from
+ * QEMU overlaps with sending the previous one to the destination. */
+static void
+qemuMigrationIOSendFunc(void *arg)
+{
+    qemuMigrationIOThreadPtr data = arg;
+    qemuMigrationIOBuffer *buf;
+
+    virMutexLock(&data->lock);
+    for (;;) {
+        while (!data->count && !data->eof && !data->quit)
+            virCondWait(&data->cond, &data->lock);
+
+        if (data->quit || !data->count)
+            break;
+
+        /* The slot is released only after the chunk is sent */
+        buf = &data->bufs[data->head];
+        virMutexUnlock(&data->lock);
+
+        if (virStreamSend(data->st, buf->data, buf->len) < 0) {
+            virMutexLock(&data->lock);
+            virCopyLastError(&data->sendErr);
+            virResetLastError();
+            data->sendFailed = true;
+            virCondBroadcast(&data->cond);
+            break;
+        }
+
+        virMutexLock(&data->lock);
+        data->head = (data->head + 1) % TUNNEL_SEND_BUF_COUNT;
+        data->count--;
+        virCondBroadcast(&data->cond);
+    }
+    virMutexUnlock(&data->lock);
+}
+
+
+/* Waits for a free slot in the send queue. Returns NULL if the sender
+ * thread gave up. */
+static qemuMigrationIOBuffer *
+qemuMigrationIOGetBuffer(qemuMigrationIOThreadPtr data)
+{
+    qemuMigrationIOBuffer *buf = NULL;
+
+    virMutexLock(&data->lock);
+    while (data->count == TUNNEL_SEND_BUF_COUNT && !data->sendFailed)
+        virCondWait(&data->cond, &data->lock);
+
+    if (!data->sendFailed)
+        buf = &data->bufs[(data->head + data->count) % TUNNEL_SEND_BUF_COUNT];
+    virMutexUnlock(&data->lock);
+
+    return buf;
+}
+
+
+static void
+qemuMigrationIOPutBuffer(qemuMigrationIOThreadPtr data)
+{
+    virMutexLock(&data->lock);
+    data->count++;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+/* Stops the sender thread, either after it sent everything that was
+ * queued (@graceful) or right away. Returns -1 and sets the error if
+ * sending data failed. */
+static int
+qemuMigrationIOStopSender(qemuMigrationIOThreadPtr data,
+                          virThreadPtr sender,
+                          bool graceful)
+{
+    virMutexLock(&data->lock);
+    if (graceful)
+        data->eof = true;
+    else
+        data->quit = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+
+    virThreadJoin(sender);
+
+    if (data->sendFailed) {
+        virSetError(&data->sendErr);
+        virResetError(&data->sendErr);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static void qemuMigrationIOFunc(void *arg)
 {
     qemuMigrationIOThreadPtr data = arg;
-    char *buffer = NULL;
+    qemuMigrationIOBuffer *buf;
+    virThread sender;
+    bool senderRunning = false;
     struct pollfd fds[2];
     int timeout = -1;
     virErrorPtr err = NULL;
+    size_t i;
 
     VIR_DEBUG("Running migration tunnel; stream=%p, sock=%d",
               data->st, data->sock);
 
-    if (VIR_ALLOC_N(buffer, TUNNEL_SEND_BUF_SIZE) < 0)
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++) {
+        if (VIR_ALLOC_N(data->bufs[i].data, TUNNEL_SEND_BUF_SIZE) < 0)
+            goto abrt;
+    }
+
+    if (virThreadCreate(&sender, true, qemuMigrationIOSendFunc, data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create migration tunnel thread"));
         goto abrt;
+    }
+    senderRunning = true;
 
     fds[0].fd = data->sock;
     fds[1].fd = data->wakeupRecvFD;
@@ -3406,10 +3938,17 @@ static void qemuMigrationIOFunc(void *arg)
         if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
             int nbytes;
 
-            nbytes = saferead(data->sock, buffer, TUNNEL_SEND_BUF_SIZE);
-            if (nbytes > 0) {
-                if (virStreamSend(data->st, buffer, nbytes) < 0)
-                    goto error;
+            if (!(buf = qemuMigrationIOGetBuffer(data))) {
+                /* Sending failed, pick up the error from the sender */
+                senderRunning = false;
+                ignore_value(qemuMigrationIOStopSender(data, &sender, false));
+                goto error;
+            }
+
+            nbytes = saferead(data->sock, buf->data, TUNNEL_SEND_BUF_SIZE);
+            if (nbytes > 0) {
+                buf->len = nbytes;
+                qemuMigrationIOPutBuffer(data);
             } else if (nbytes < 0) {
                 virReportSystemError(errno, "%s",
                         _("tunnelled migration failed to read from qemu"));
@@ -3421,11 +3960,16 @@ static void qemuMigrationIOFunc(void *arg)
         }
     }
 
+    senderRunning = false;
+    if (qemuMigrationIOStopSender(data, &sender, true) < 0)
+        goto error;
+
     if (virStreamFinish(data->st) < 0)
         goto error;
 
     VIR_FORCE_CLOSE(data->sock);
-    VIR_FREE(buffer);
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++)
+        VIR_FREE(data->bufs[i].data);
 
     return;
 
@@ -3435,6 +3979,11 @@ static void qemuMigrationIOFunc(void *arg)
         virFreeError(err);
         err = NULL;
     }
+    /* The stream must not be used by the sender thread while aborting */
+    if (senderRunning) {
+        senderRunning = false;
+        ignore_value(qemuMigrationIOStopSender(data, &sender, false));
+    }
     virStreamAbort(data->st);
     if (err) {
         virSetError(err);
@@ -3448,7 +3997,8 @@ static void qemuMigrationIOFunc(void *arg)
     if (!virLastErrorIsSystemErrno(EPIPE))
         virCopyLastError(&data->err);
     virResetLastError();
-    VIR_FREE(buffer);
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++)
+        VIR_FREE(data->bufs[i].data);
 }
 
 
@@ -3468,6 +4018,19 @@ qemuMigrationStartTunnel(virStreamPtr st,
     if (VIR_ALLOC(io) < 0)
         goto error;
 
+    if (virMutexInit(&io->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        goto error;
+    }
+
+    if (virCondInit(&io->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition variable"));
+        virMutexDestroy(&io->lock);
+        goto error;
+    }
+
     io->st = st;
     io->sock = sock;
     io->wakeupRecvFD = wakeupFD[0];
@@ -3478,6 +4041,8 @@ qemuMigrationStartTunnel(virStreamPtr st,
                         io) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to create migration thread"));
+        virCondDestroy(&io->cond);
+        virMutexDestroy(&io->lock);
         goto error;
     }
 
@@ -3520,6 +4085,8 @@ qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
  cleanup:
     VIR_FORCE_CLOSE(io->wakeupSendFD);
     VIR_FORCE_CLOSE(io->wakeupRecvFD);
+    virCondDestroy(&io->cond);
+    virMutexDestroy(&io->lock);
     VIR_FREE(io);
     return rv;
 }
@@ -3569,6 +4136,326 @@ qemuMigrationConnect(virQEMUDriverPtr driver,
     return ret;
 }
 
+typedef struct _qemuMigrationSchedulerEntry qemuMigrationSchedulerEntry;
+typedef qemuMigrationSchedulerEntry *qemuMigrationSchedulerEntryPtr;
+struct _qemuMigrationSchedulerEntry {
+    virDomainObjPtr vm;
+    bool aborted;
+};
+
+struct _qemuMigrationScheduler {
+    virMutex lock;
+    virCond cond;
+
+    size_t nout; /* outgoing migrations holding a slot */
+    size_t nin; /* incoming migrations holding a slot */
+
+    /* Outgoing migrations waiting for a slot, oldest first. The entries
+     * live on the stack of the threads waiting in
+     * qemuMigrationSchedulerAcquire. */
+    qemuMigrationSchedulerEntryPtr *queue;
+    size_t nqueue;
+
+    /* Moving average of the time an outgoing migration holds its slot */
+    unsigned long long avgDuration;
+};
+
+
+int
+qemuMigrationSchedulerInit(virQEMUDriverPtr driver)
+{
+    qemuMigrationSchedulerPtr sched;
+
+    if (VIR_ALLOC(sched) < 0)
+        return -1;
+
+    if (virMutexInit(&sched->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize migration scheduler mutex"));
+        VIR_FREE(sched);
+        return -1;
+    }
+
+    if (virCondInit(&sched->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize migration scheduler condition"));
+        virMutexDestroy(&sched->lock);
+        VIR_FREE(sched);
+        return -1;
+    }
+
+    driver->migrationScheduler = sched;
+    return 0;
+}
+
+
+void
+qemuMigrationSchedulerFree(virQEMUDriverPtr driver)
+{
+    qemuMigrationSchedulerPtr sched = driver->migrationScheduler;
+
+    if (!sched)
+        return;
+
+    ignore_value(virCondDestroy(&sched->cond));
+    virMutexDestroy(&sched->lock);
+    VIR_FREE(sched->queue);
+    VIR_FREE(sched);
+    driver->migrationScheduler = NULL;
+}
+
+
+static void
+qemuMigrationSchedulerDequeue(qemuMigrationSchedulerPtr sched,
+                              qemuMigrationSchedulerEntryPtr entry)
+{
+    size_t i;
+
+    for (i = 0; i < sched->nqueue; i++) {
+        if (sched->queue[i] == entry) {
+            VIR_DELETE_ELEMENT(sched->queue, i, sched->nqueue);
+            break;
+        }
+    }
+}
+
+
+/**
+ * qemuMigrationSchedulerAcquire:
+ *
+ * Reserves a migration slot for @vm. Incoming migrations beyond
+ * max_incoming_migrations are refused rather than queued since the source
+ * may itself be holding an outgoing slot and two hosts migrating to each
+ * other would otherwise wait forever. Outgoing migrations wait in FIFO
+ * order for a slot to become available. The domain object is unlocked
+ * while waiting.
+ *
+ * Returns 0 once a slot was acquired, -1 on error or when the queued
+ * migration was aborted.
+ */
+static int
+qemuMigrationSchedulerAcquire(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm,
+                              qemuDomainAsyncJob job)
+{
+    qemuMigrationSchedulerPtr sched = driver->migrationScheduler;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuMigrationSchedulerEntry entry = { .vm = vm, .aborted = false };
+    qemuMigrationSchedulerEntryPtr ptr = &entry;
+    bool queued = false;
+    int ret = -1;
+
+    virMutexLock(&sched->lock);
+
+    if (job == QEMU_ASYNC_JOB_MIGRATION_IN) {
+        if (cfg->maxIncomingMigrations &&
+            sched->nin >= cfg->maxIncomingMigrations) {
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("too many incoming migrations, the limit is %u"),
+                           cfg->maxIncomingMigrations);
+            goto cleanup;
+        }
+        sched->nin++;
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (cfg->maxOutgoingMigrations &&
+        (sched->nqueue > 0 || sched->nout >= cfg->maxOutgoingMigrations)) {
+        if (VIR_APPEND_ELEMENT_COPY(sched->queue, sched->nqueue, ptr) < 0)
+            goto cleanup;
+
+        VIR_DEBUG("Migration of domain %s queued at position %zu",
+                  vm->def->name, sched->nqueue);
+        queued = true;
+        virObjectUnlock(vm);
+
+        while (!entry.aborted &&
+               (sched->queue[0] != &entry ||
+                sched->nout >= cfg->maxOutgoingMigrations)) {
+            if (virCondWait(&sched->cond, &sched->lock) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("failed to wait for migration slot"));
+                qemuMigrationSchedulerDequeue(sched, &entry);
+                virCondBroadcast(&sched->cond);
+                goto cleanup;
+            }
+        }
+
+        qemuMigrationSchedulerDequeue(sched, &entry);
+        /* let the next migration in line re-evaluate its position */
+        virCondBroadcast(&sched->cond);
+
+        if (entry.aborted) {
+            virReportError(VIR_ERR_OPERATION_ABORTED, _("%s: %s"),
+                           qemuDomainAsyncJobTypeToString(job),
+                           _("canceled by client"));
+            goto cleanup;
+        }
+    }
+
+    sched->nout++;
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&sched->lock);
+    if (queued)
+        virObjectLock(vm);
+    if (ret == 0) {
+        priv->migrationSlot = job;
+        if (virTimeMillisNow(&priv->migrationSlotStarted) < 0)
+            priv->migrationSlotStarted = 0;
+    }
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+/**
+ * qemuMigrationSchedulerRelease:
+ *
+ * Returns the migration slot held by @vm, if any, and wakes up queued
+ * migrations. Safe to call more than once.
+ */
+void
+qemuMigrationSchedulerRelease(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm)
+{
+    qemuMigrationSchedulerPtr sched = driver->migrationScheduler;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long now;
+
+    if (!sched || priv->migrationSlot == QEMU_ASYNC_JOB_NONE)
+        return;
+
+    virMutexLock(&sched->lock);
+
+    if (priv->migrationSlot == QEMU_ASYNC_JOB_MIGRATION_IN) {
+        sched->nin--;
+    } else {
+        sched->nout--;
+        if (priv->migrationSlotStarted &&
+            virTimeMillisNow(&now) == 0 &&
+            now > priv->migrationSlotStarted) {
+            unsigned long long duration = now - priv->migrationSlotStarted;
+
+            if (sched->avgDuration)
+                sched->avgDuration = (3 * sched->avgDuration + duration) / 4;
+            else
+                sched->avgDuration = duration;
+        }
+        virCondBroadcast(&sched->cond);
+    }
+
+    virMutexUnlock(&sched->lock);
+
+    priv->migrationSlot = QEMU_ASYNC_JOB_NONE;
+    priv->migrationSlotStarted = 0;
+}
+
+
+/**
+ * qemuMigrationSchedulerAbort:
+ *
+ * Aborts the outgoing migration of @vm if it is still waiting in the queue.
+ *
+ * Returns true if the migration was queued, false otherwise.
+ */
+bool
+qemuMigrationSchedulerAbort(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm)
+{
+    qemuMigrationSchedulerPtr sched = driver->migrationScheduler;
+    bool ret = false;
+    size_t i;
+
+    virMutexLock(&sched->lock);
+    for (i = 0; i < sched->nqueue; i++) {
+        if (sched->queue[i]->vm == vm) {
+            sched->queue[i]->aborted = true;
+            virCondBroadcast(&sched->cond);
+            ret = true;
+            break;
+        }
+    }
+    virMutexUnlock(&sched->lock);
+
+    return ret;
+}
+
+
+/**
+ * qemuMigrationSchedulerGetPosition:
+ *
+ * Fills in the position of @vm in the queue of outgoing migrations and an
+ * estimation of the time (in milliseconds) it will spend waiting there.
+ * The estimation is 0 if it cannot be computed yet.
+ *
+ * Returns true if the migration of @vm is queued, false otherwise.
+ */
+bool
+qemuMigrationSchedulerGetPosition(virQEMUDriverPtr driver,
+                                  virDomainObjPtr vm,
+                                  unsigned int *position,
+                                  unsigned long long *remaining)
+{
+    qemuMigrationSchedulerPtr sched = driver->migrationScheduler;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    bool ret = false;
+    size_t i;
+
+    virMutexLock(&sched->lock);
+    for (i = 0; i < sched->nqueue; i++) {
+        if (sched->queue[i]->vm == vm) {
+            unsigned int slots = MAX(cfg->maxOutgoingMigrations, 1);
+
+            *position = i + 1;
+            *remaining = sched->avgDuration * (i / slots + 1);
+            ret = true;
+            break;
+        }
+    }
+    virMutexUnlock(&sched->lock);
+
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+/**
+ * qemuMigrationSchedulerBandwidth:
+ *
+ * Returns the share (in MiB/s) of migration_host_bandwidth a newly started
+ * outgoing migration may use, or 0 if the bandwidth is not limited.
+ */
+static unsigned long
+qemuMigrationSchedulerBandwidth(virQEMUDriverPtr driver)
+{
+    qemuMigrationSchedulerPtr sched = driver->migrationScheduler;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    unsigned long long share = 0;
+    size_t slots;
+
+    if (cfg->migrationHostBandwidth) {
+        if (cfg->maxOutgoingMigrations) {
+            slots = cfg->maxOutgoingMigrations;
+        } else {
+            virMutexLock(&sched->lock);
+            slots = MAX(sched->nout, 1);
+            virMutexUnlock(&sched->lock);
+        }
+
+        share = MAX(cfg->migrationHostBandwidth / slots, 1);
+        if (share > QEMU_DOMAIN_MIG_BANDWIDTH_MAX)
+            share = QEMU_DOMAIN_MIG_BANDWIDTH_MAX;
+    }
+
+    virObjectUnref(cfg);
+    return share;
+}
+
+
 static int
 qemuMigrationRun(virQEMUDriverPtr driver,
                  virDomainObjPtr vm,
@@ -3585,7 +4472,9 @@ qemuMigrationRun(virQEMUDriverPtr driver,
                  size_t nmigrate_disks,
                  const char **migrate_disks,
                  qemuMigrationCompressionPtr compression,
-                 qemuMonitorMigrationParamsPtr migParams)
+                 qemuMonitorMigrationParamsPtr migParams,
+                 qemuMigrationMirrorPtr mirror,
+                 qemuMigrationPolicyPtr policy)
 {
     int ret = -1;
     unsigned int migrate_flags = QEMU_MONITOR_MIGRATE_BACKGROUND;
@@ -3597,6 +4486,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     qemuMigrationIOThreadPtr iothread = NULL;
     int fd = -1;
     unsigned long migrate_speed = resource ? resource : priv->migMaxBandwidth;
+    unsigned long share;
     virErrorPtr orig_err = NULL;
     unsigned int cookieFlags = 0;
     bool abort_on_error = !!(flags & VIR_MIGRATE_ABORT_ON_ERROR);
@@ -3616,6 +4506,12 @@ qemuMigrationRun(virQEMUDriverPtr driver,
               spec, spec->destType, spec->fwdType, dconn,
               NULLSTR(graphicsuri), nmigrate_disks, migrate_disks);
 
+    if ((share = qemuMigrationSchedulerBandwidth(driver)) &&
+        migrate_speed > share) {
+        VIR_DEBUG("Limiting migration bandwidth to %lu MiB/s", share);
+        migrate_speed = share;
+    }
+
     if (flags & VIR_MIGRATE_NON_SHARED_DISK) {
         migrate_flags |= QEMU_MONITOR_MIGRATE_NON_SHARED_DISK;
         cookieFlags |= QEMU_MIGRATION_COOKIE_NBD;
@@ -3626,6 +4522,9 @@ qemuMigrationRun(virQEMUDriverPtr driver,
         cookieFlags |= QEMU_MIGRATION_COOKIE_NBD;
     }
 
+    if (flags & VIR_MIGRATE_PARALLEL)
+        cookieFlags |= QEMU_MIGRATION_COOKIE_MULTIFD;
+
     if (virLockManagerPluginUsesState(driver->lockManager) &&
         !cookieout) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -3652,13 +4551,60 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     }
 
     mig = qemuMigrationEatCookie(driver, vm, cookiein, cookieinlen,
-                                 cookieFlags | QEMU_MIGRATION_COOKIE_GRAPHICS);
+                                 cookieFlags |
+                                 QEMU_MIGRATION_COOKIE_GRAPHICS |
+                                 QEMU_MIGRATION_COOKIE_PERSISTENT_DIGEST);
     if (!mig)
         goto cleanup;
 
+    /* The destination remembers the definition it got in Prepare. If it is
+     * the same as the persistent definition, we can just refer to it rather
+     * than formatting and sending it again while the domain is paused. */
+    if (persistDef && mig->persistentDigest) {
+        char *digest;
+
+        if (!(digest = qemuMigrationCookiePersistentDigest(driver, persistDef,
+                                                           NULL)))
+            goto cleanup;
+
+        if (STREQ(digest, mig->persistentDigest)) {
+            VIR_DEBUG("Persistent definition matches the one on destination");
+            if (qemuMigrationCookieAddPersistentDigest(mig, digest) < 0) {
+                VIR_FREE(digest);
+                goto cleanup;
+            }
+            virDomainDefFree(persistDef);
+            persistDef = NULL;
+        }
+        VIR_FREE(digest);
+    }
+
     if (qemuDomainMigrateGraphicsRelocate(driver, vm, mig, graphicsuri) < 0)
         VIR_WARN("unable to provide data for graphics client relocation");
 
+    if (flags & VIR_MIGRATE_PARALLEL) {
+        if (!mig->multifd) {
+            virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                           _("destination did not enable parallel migration"));
+            goto cleanup;
+        }
+
+        /* Both sides have to agree on the number of connections */
+        if (migParams->multifdChannels_set &&
+            migParams->multifdChannels != mig->multifd->channels) {
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("destination expects %d parallel connections "
+                             "but %d were requested"),
+                           mig->multifd->channels,
+                           migParams->multifdChannels);
+            goto cleanup;
+        }
+
+        migParams->multifdChannels_set = true;
+        migParams->multifdChannels = mig->multifd->channels;
+        priv->job.current->parallelConnections = mig->multifd->channels;
+    }
+
     if (flags & VIR_MIGRATE_TLS) {
         cfg = virQEMUDriverGetConfig(driver);
 
@@ -3695,6 +4641,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
             if (qemuMigrationDriveMirror(driver, vm, mig,
                                          spec->dest.host.name,
                                          migrate_speed,
+                                         mirror,
                                          &migrate_flags,
                                          nmigrate_disks,
                                          migrate_disks,
@@ -3737,6 +4684,12 @@ qemuMigrationRun(virQEMUDriverPtr driver,
                                  QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
         goto cleanup;
 
+    if (qemuMigrationSetOption(driver, vm,
+                               QEMU_MONITOR_MIGRATION_CAPS_MULTIFD,
+                               flags & VIR_MIGRATE_PARALLEL,
+                               QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+        goto cleanup;
+
     if (qemuMigrationSetParams(driver, vm, QEMU_ASYNC_JOB_MIGRATION_OUT,
                                migParams) < 0)
         goto cleanup;
@@ -3826,7 +4779,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
 
     rc = qemuMigrationWaitForCompletion(driver, vm,
                                         QEMU_ASYNC_JOB_MIGRATION_OUT,
-                                        dconn, waitFlags);
+                                        dconn, policy, waitFlags);
     if (rc == -2)
         goto cancel;
     else if (rc == -1)
@@ -3952,7 +4905,9 @@ static int doNativeMigrate(virQEMUDriverPtr driver,
                            size_t nmigrate_disks,
                            const char **migrate_disks,
                            qemuMigrationCompressionPtr compression,
-                           qemuMonitorMigrationParamsPtr migParams)
+                           qemuMonitorMigrationParamsPtr migParams,
+                           qemuMigrationMirrorPtr mirror,
+                           qemuMigrationPolicyPtr policy)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     virURIPtr uribits = NULL;
@@ -3991,7 +4946,8 @@ static int doNativeMigrate(virQEMUDriverPtr driver,
         }
     }
 
-    if (STRNEQ(uribits->scheme, "rdma"))
+    /* Parallel migration needs QEMU to open all the connections itself */
+    if (STRNEQ(uribits->scheme, "rdma") && !(flags & VIR_MIGRATE_PARALLEL))
         spec.destType = MIGRATION_DEST_CONNECT_HOST;
     else
         spec.destType = MIGRATION_DEST_HOST;
@@ -4003,7 +4959,7 @@ static int doNativeMigrate(virQEMUDriverPtr driver,
     ret = qemuMigrationRun(driver, vm, persist_xml, cookiein, cookieinlen, cookieout,
                            cookieoutlen, flags, resource, &spec, dconn,
                            graphicsuri, nmigrate_disks, migrate_disks,
-                           compression, migParams);
+                           compression, migParams, mirror, policy);
 
     if (spec.destType == MIGRATION_DEST_FD)
         VIR_FORCE_CLOSE(spec.dest.fd.qemu);
@@ -4030,7 +4986,8 @@ static int doTunnelMigrate(virQEMUDriverPtr driver,
                            size_t nmigrate_disks,
                            const char **migrate_disks,
                            qemuMigrationCompressionPtr compression,
-                           qemuMonitorMigrationParamsPtr migParams)
+                           qemuMonitorMigrationParamsPtr migParams,
+                           qemuMigrationPolicyPtr policy)
 {
     int ret = -1;
     qemuMigrationSpec spec;
@@ -4055,6 +5012,7 @@ static int doTunnelMigrate(virQEMUDriverPtr driver,
     if (pipe2(fds, O_CLOEXEC) == 0) {
         spec.dest.fd.qemu = fds[1];
         spec.dest.fd.local = fds[0];
+        qemuMigrationResizeTunnelPipe(fds[0]);
     }
     if (spec.dest.fd.qemu == -1 ||
         qemuSecuritySetImageFDLabel(driver->securityManager, vm->def,
@@ -4067,7 +5025,7 @@ static int doTunnelMigrate(virQEMUDriverPtr driver,
     ret = qemuMigrationRun(driver, vm, persist_xml, cookiein, cookieinlen,
                            cookieout, cookieoutlen, flags, resource, &spec,
                            dconn, graphicsuri, nmigrate_disks, migrate_disks,
-                           compression, migParams);
+                           compression, migParams, NULL, policy);
 
  cleanup:
     VIR_FORCE_CLOSE(spec.dest.fd.qemu);
@@ -4178,13 +5136,13 @@ static int doPeer2PeerMigrate2(virQEMUDriverPtr driver,
         ret = doTunnelMigrate(driver, vm, st, NULL,
                               NULL, 0, NULL, NULL,
                               flags, resource, dconn,
-                              NULL, 0, NULL, compression, &migParams);
+                              NULL, 0, NULL, compression, &migParams, NULL);
     else
         ret = doNativeMigrate(driver, vm, NULL, uri_out,
                               cookie, cookielen,
                               NULL, NULL, /* No out cookie with v2 migration */
                               flags, resource, dconn, NULL, 0, NULL,
-                              compression, &migParams);
+                              compression, &migParams, NULL, NULL);
 
     /* Perform failed. Make sure Finish doesn't overwrite the error */
     if (ret < 0)
@@ -4254,6 +5212,8 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
                     int nbdPort,
                     qemuMigrationCompressionPtr compression,
                     qemuMonitorMigrationParamsPtr migParams,
+                    qemuMigrationMirrorPtr mirror,
+                    qemuMigrationPolicyPtr policy,
                     unsigned long long bandwidth,
                     bool useParams,
                     unsigned long flags)
@@ -4291,7 +5251,10 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
 
     dom_xml = qemuMigrationBeginPhase(driver, vm, xmlin, dname,
                                       &cookieout, &cookieoutlen,
-                                      nmigrate_disks, migrate_disks, flags);
+                                      nmigrate_disks, migrate_disks,
+                                      migParams->multifdChannels_set ?
+                                      migParams->multifdChannels : 0,
+                                      flags);
     if (!dom_xml)
         goto cleanup;
 
@@ -4426,14 +5389,14 @@ doPeer2PeerMigrate3(virQEMUDriverPtr driver,
                               &cookieout, &cookieoutlen,
                               flags, bandwidth, dconn, graphicsuri,
                               nmigrate_disks, migrate_disks, compression,
-                              migParams);
+                              migParams, policy);
     } else {
         ret = doNativeMigrate(driver, vm, persist_xml, uri,
                               cookiein, cookieinlen,
                               &cookieout, &cookieoutlen,
                               flags, bandwidth, dconn, graphicsuri,
                               nmigrate_disks, migrate_disks, compression,
-                              migParams);
+                              migParams, mirror, policy);
     }
 
     /* Perform failed. Make sure Finish doesn't overwrite the error */
@@ -4612,6 +5575,8 @@ static int doPeer2PeerMigrate(virQEMUDriverPtr driver,
                               int nbdPort,
                               qemuMigrationCompressionPtr compression,
                               qemuMonitorMigrationParamsPtr migParams,
+                              qemuMigrationMirrorPtr mirror,
+                              qemuMigrationPolicyPtr policy,
                               unsigned long flags,
                               const char *dname,
                               unsigned long resource,
@@ -4735,8 +5700,8 @@ static int doPeer2PeerMigrate(virQEMUDriverPtr driver,
         ret = doPeer2PeerMigrate3(driver, sconn, dconn, dconnuri, vm, xmlin,
                                   persist_xml, dname, uri, graphicsuri,
                                   listenAddress, nmigrate_disks, migrate_disks,
-                                  nbdPort, compression, migParams, resource,
-                                  useParams, flags);
+                                  nbdPort, compression, migParams, mirror,
+                                  policy, resource, useParams, flags);
     } else {
         ret = doPeer2PeerMigrate2(driver, sconn, dconn, vm,
                                   dconnuri, flags, dname, resource);
@@ -4777,6 +5742,8 @@ qemuMigrationPerformJob(virQEMUDriverPtr driver,
                         int nbdPort,
                         qemuMigrationCompressionPtr compression,
                         qemuMonitorMigrationParamsPtr migParams,
+                        qemuMigrationMirrorPtr mirror,
+                        qemuMigrationPolicyPtr policy,
                         const char *cookiein,
                         int cookieinlen,
                         char **cookieout,
@@ -4813,14 +5780,15 @@ qemuMigrationPerformJob(virQEMUDriverPtr driver,
         ret = doPeer2PeerMigrate(driver, conn, vm, xmlin, persist_xml,
                                  dconnuri, uri, graphicsuri, listenAddress,
                                  nmigrate_disks, migrate_disks, nbdPort,
-                                 compression, migParams, flags, dname, resource,
-                                 &v3proto);
+                                 compression, migParams, mirror, policy,
+                                 flags, dname,
+                                 resource, &v3proto);
     } else {
         qemuMigrationJobSetPhase(driver, vm, QEMU_MIGRATION_PHASE_PERFORM2);
         ret = doNativeMigrate(driver, vm, persist_xml, uri, cookiein, cookieinlen,
                               cookieout, cookieoutlen,
                               flags, resource, NULL, NULL, 0, NULL,
-                              compression, migParams);
+                              compression, migParams, mirror, policy);
     }
     if (ret < 0)
         goto endjob;
@@ -4890,6 +5858,8 @@ qemuMigrationPerformPhase(virQEMUDriverPtr driver,
                           const char **migrate_disks,
                           qemuMigrationCompressionPtr compression,
                           qemuMonitorMigrationParamsPtr migParams,
+                          qemuMigrationMirrorPtr mirror,
+                          qemuMigrationPolicyPtr policy,
                           const char *cookiein,
                           int cookieinlen,
                           char **cookieout,
@@ -4915,7 +5885,8 @@ qemuMigrationPerformPhase(virQEMUDriverPtr driver,
     ret = doNativeMigrate(driver, vm, persist_xml, uri, cookiein, cookieinlen,
                           cookieout, cookieoutlen,
                           flags, resource, NULL, graphicsuri,
-                          nmigrate_disks, migrate_disks, compression, migParams);
+                          nmigrate_disks, migrate_disks, compression, migParams,
+                          mirror, policy);
 
     if (ret < 0) {
         if (qemuMigrationRestoreDomainState(conn, vm)) {
@@ -4964,6 +5935,8 @@ qemuMigrationPerform(virQEMUDriverPtr driver,
                      int nbdPort,
                      qemuMigrationCompressionPtr compression,
                      qemuMonitorMigrationParamsPtr migParams,
+                     qemuMigrationMirrorPtr mirror,
+                     qemuMigrationPolicyPtr policy,
                      const char *cookiein,
                      int cookieinlen,
                      char **cookieout,
@@ -4994,7 +5967,7 @@ qemuMigrationPerform(virQEMUDriverPtr driver,
         return qemuMigrationPerformJob(driver, conn, vm, xmlin, persist_xml, dconnuri, uri,
                                        graphicsuri, listenAddress,
                                        nmigrate_disks, migrate_disks, nbdPort,
-                                       compression, migParams,
+                                       compression, migParams, mirror, policy,
                                        cookiein, cookieinlen,
                                        cookieout, cookieoutlen,
                                        flags, dname, resource, v3proto);
@@ -5009,16 +5982,16 @@ qemuMigrationPerform(virQEMUDriverPtr driver,
             return qemuMigrationPerformPhase(driver, conn, vm, persist_xml, uri,
                                              graphicsuri,
                                              nmigrate_disks, migrate_disks,
-                                             compression, migParams,
-                                             cookiein, cookieinlen,
+                                             compression, migParams, mirror,
+                                             policy, cookiein, cookieinlen,
                                              cookieout, cookieoutlen,
                                              flags, resource);
         } else {
             return qemuMigrationPerformJob(driver, conn, vm, xmlin, persist_xml, NULL,
                                            uri, graphicsuri, listenAddress,
                                            nmigrate_disks, migrate_disks, nbdPort,
-                                           compression, migParams,
-                                           cookiein, cookieinlen,
+                                           compression, migParams, mirror,
+                                           policy, cookiein, cookieinlen,
                                            cookieout, cookieoutlen, flags,
                                            dname, resource, v3proto);
         }
@@ -5181,12 +6154,27 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
                    QEMU_MIGRATION_COOKIE_NBD;
     /* Some older versions of libvirt always send persistent XML in the cookie
      * even though VIR_MIGRATE_PERSIST_DEST was not used. */
-    cookie_flags |= QEMU_MIGRATION_COOKIE_PERSISTENT;
+    cookie_flags |= QEMU_MIGRATION_COOKIE_PERSISTENT |
+                    QEMU_MIGRATION_COOKIE_PERSISTENT_DIGEST;
 
     if (!(mig = qemuMigrationEatCookie(driver, vm, cookiein,
                                        cookieinlen, cookie_flags)))
         goto endjob;
 
+    /* The source referred to the definition we remembered in Prepare */
+    if (!mig->persistent && mig->persistentDigest) {
+        if (STRNEQ_NULLABLE(mig->persistentDigest,
+                            priv->migPersistentDigest)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("persistent domain definition referenced by "
+                             "migration cookie is not available"));
+            goto endjob;
+        }
+
+        if (qemuMigrationCookieAddPersistent(mig, &priv->migPersistentDef) < 0)
+            goto endjob;
+    }
+
     if (flags & VIR_MIGRATE_OFFLINE) {
         if (retcode == 0 &&
             qemuMigrationPersist(driver, vm, mig, false) == 0)
@@ -5390,6 +6378,7 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
     if (priv->mon)
         qemuMonitorSetDomainLog(priv->mon, NULL, NULL, NULL);
     VIR_FREE(priv->origname);
+    qemuMigrationClearPersistentDef(priv);
     virDomainObjEndAPI(&vm);
     qemuMigrationCookieFree(mig);
     if (orig_err) {
@@ -5407,11 +6396,67 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
 }
 
 
+/*
+ * qemuMigrationSetParallelCompression:
+ *
+ * Toggle QEMU's multithread compression of the migration stream which is
+ * used by the "parallel" save image format.  When enabling it, the number
+ * of compression and decompression threads is set from the
+ * save_image_threads option of qemu.conf, QEMU's defaults are used if it
+ * is unset.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuMigrationSetParallelCompression(virQEMUDriverPtr driver,
+                                    virDomainObjPtr vm,
+                                    bool state,
+                                    qemuDomainAsyncJob asyncJob)
+{
+    virQEMUDriverConfigPtr cfg = NULL;
+    qemuMigrationCompression compression;
+    qemuMonitorMigrationParams migParams;
+    int ret = -1;
+
+    if (!state)
+        return qemuMigrationSetOption(driver, vm,
+                                      QEMU_MONITOR_MIGRATION_CAPS_COMPRESS,
+                                      false, asyncJob);
+
+    cfg = virQEMUDriverGetConfig(driver);
+
+    memset(&compression, 0, sizeof(compression));
+    memset(&migParams, 0, sizeof(migParams));
+
+    compression.methods = 1ULL << QEMU_MIGRATION_COMPRESS_MT;
+    if (cfg->saveImageThreads) {
+        compression.threads_set = true;
+        compression.threads = cfg->saveImageThreads;
+        compression.dthreads_set = true;
+        compression.dthreads = cfg->saveImageThreads;
+    }
+
+    if (qemuMigrationSetCompression(driver, vm, asyncJob,
+                                    &compression, &migParams) < 0)
+        goto cleanup;
+
+    if (qemuMigrationSetParams(driver, vm, asyncJob, &migParams) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
 /* Helper function called while vm is active.  */
 int
 qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
                     int fd,
                     const char *compressor,
+                    bool parallel,
                     qemuDomainAsyncJob asyncJob)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
@@ -5446,6 +6491,11 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
         return -1;
     }
 
+    /* Let QEMU compress guest memory in several threads on its own */
+    if (parallel &&
+        qemuMigrationSetParallelCompression(driver, vm, true, asyncJob) < 0)
+        goto cleanup;
+
     /* All right! We can use fd migration, which means that qemu
      * doesn't have to open() the file, so while we still have to
      * grant SELinux access, we can do it on fd and avoid cleanup
@@ -5496,7 +6546,7 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
     if (rc < 0)
         goto cleanup;
 
-    rc = qemuMigrationWaitForCompletion(driver, vm, asyncJob, NULL, 0);
+    rc = qemuMigrationWaitForCompletion(driver, vm, asyncJob, NULL, NULL, 0);
 
     if (rc < 0) {
         if (rc == -2) {
@@ -5529,6 +6579,10 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
         ignore_value(qemuDomainObjExitMonitor(driver, vm));
     }
 
+    if (parallel && virDomainObjIsActive(vm))
+        ignore_value(qemuMigrationSetParallelCompression(driver, vm, false,
+                                                         asyncJob));
+
     VIR_FORCE_CLOSE(pipeFD[0]);
     VIR_FORCE_CLOSE(pipeFD[1]);
     if (cmd) {
@@ -5648,6 +6702,11 @@ qemuMigrationJobStart(virQEMUDriverPtr driver,
     qemuDomainObjSetAsyncJobMask(vm, mask);
     priv->job.current->type = VIR_DOMAIN_JOB_UNBOUNDED;
 
+    if (qemuMigrationSchedulerAcquire(driver, vm, job) < 0) {
+        qemuDomainObjEndAsyncJob(driver, vm);
+        return -1;
+    }
+
     return 0;
 }
 
@@ -5847,6 +6906,108 @@ qemuMigrationCompressionParse(virTypedParameterPtr params,
     return NULL;
 }
 
+
+/* don't ever pass NULL params with non zero nparams */
+qemuMigrationMirrorPtr
+qemuMigrationMirrorParse(virTypedParameterPtr params,
+                         int nparams,
+                         unsigned long flags)
+{
+    qemuMigrationMirrorPtr mirror = NULL;
+    int rc;
+
+    if (VIR_ALLOC(mirror) < 0)
+        return NULL;
+
+    if (!params)
+        return mirror;
+
+    if ((rc = virTypedParamsGetULLong(params, nparams,
+                                      VIR_MIGRATE_PARAM_DISKS_BANDWIDTH,
+                                      &mirror->bandwidth)) < 0)
+        goto error;
+    mirror->bandwidth_set = rc == 1;
+
+    if ((rc = virTypedParamsGetULLong(params, nparams,
+                                      VIR_MIGRATE_PARAM_DISKS_TOTAL_BANDWIDTH,
+                                      &mirror->totalBandwidth)) < 0)
+        goto error;
+    mirror->totalBandwidth_set = rc == 1;
+
+    if (virTypedParamsGetULLong(params, nparams,
+                                VIR_MIGRATE_PARAM_DISKS_BUF_SIZE,
+                                &mirror->bufSize) < 0 ||
+        virTypedParamsGetUInt(params, nparams,
+                              VIR_MIGRATE_PARAM_DISKS_GRANULARITY,
+                              &mirror->granularity) < 0)
+        goto error;
+
+    if ((mirror->bandwidth_set || mirror->totalBandwidth_set ||
+         mirror->bufSize || mirror->granularity) &&
+        !(flags & (VIR_MIGRATE_NON_SHARED_DISK | VIR_MIGRATE_NON_SHARED_INC))) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("Turn migration of non-shared storage on to tune it"));
+        goto error;
+    }
+
+    if (mirror->granularity &&
+        mirror->granularity != VIR_ROUND_UP_POWER_OF_TWO(mirror->granularity)) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("granularity must be power of 2"));
+        goto error;
+    }
+
+    return mirror;
+
+ error:
+    VIR_FREE(mirror);
+    return NULL;
+}
+
+/* don't ever pass NULL params with non zero nparams */
+qemuMigrationPolicyPtr
+qemuMigrationPolicyParse(virTypedParameterPtr params,
+                         int nparams,
+                         unsigned long flags)
+{
+    qemuMigrationPolicyPtr policy = NULL;
+
+    if (VIR_ALLOC(policy) < 0)
+        return NULL;
+
+    if (!params)
+        return policy;
+
+    if (virTypedParamsGetULLong(params, nparams,
+                                VIR_MIGRATE_PARAM_CONVERGE_MAX_DOWNTIME,
+                                &policy->maxDowntime) < 0 ||
+        virTypedParamsGetULLong(params, nparams,
+                                VIR_MIGRATE_PARAM_CONVERGE_MAX_TIME,
+                                &policy->maxTime) < 0)
+        goto error;
+
+    if ((policy->maxDowntime || policy->maxTime) &&
+        !(flags & VIR_MIGRATE_LIVE)) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("convergence limits can only be used with "
+                         "live migration"));
+        goto error;
+    }
+
+    if (policy->maxTime > ULLONG_MAX / 1000) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("migration time limit must not exceed %llu seconds"),
+                       ULLONG_MAX / 1000);
+        goto error;
+    }
+
+    return policy;
+
+ error:
+    VIR_FREE(policy);
+    return NULL;
+}
+
 int
 qemuMigrationCompressionDump(qemuMigrationCompressionPtr compression,
                              virTypedParameterPtr *params,
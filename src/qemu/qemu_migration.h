@@ -28,6 +28,12 @@
 typedef struct _qemuMigrationCompression qemuMigrationCompression;
 typedef qemuMigrationCompression *qemuMigrationCompressionPtr;
 
+typedef struct _qemuMigrationMirror qemuMigrationMirror;
+typedef qemuMigrationMirror *qemuMigrationMirrorPtr;
+
+typedef struct _qemuMigrationPolicy qemuMigrationPolicy;
+typedef qemuMigrationPolicy *qemuMigrationPolicyPtr;
+
 /* All supported qemu migration flags.  */
 # define QEMU_MIGRATION_FLAGS                   \
     (VIR_MIGRATE_LIVE |                         \
@@ -46,7 +52,12 @@ typedef qemuMigrationCompression *qemuMigrationCompressionPtr;
      VIR_MIGRATE_AUTO_CONVERGE |                \
      VIR_MIGRATE_RDMA_PIN_ALL |                 \
      VIR_MIGRATE_POSTCOPY |                     \
-     VIR_MIGRATE_TLS)
+     VIR_MIGRATE_TLS |                          \
+     VIR_MIGRATE_PARALLEL)
+
+/* Number of parallel migration connections used unless specified by
+ * VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS */
+# define QEMU_MIGRATION_PARALLEL_CONNECTIONS_DEFAULT 2
 
 /* All supported migration parameters and their types. */
 # define QEMU_MIGRATION_PARAMETERS                                \
@@ -68,6 +79,13 @@ typedef qemuMigrationCompression *qemuMigrationCompressionPtr;
     VIR_MIGRATE_PARAM_PERSIST_XML,      VIR_TYPED_PARAM_STRING,   \
     VIR_MIGRATE_PARAM_AUTO_CONVERGE_INITIAL,        VIR_TYPED_PARAM_INT,    \
     VIR_MIGRATE_PARAM_AUTO_CONVERGE_INCREMENT,      VIR_TYPED_PARAM_INT,    \
+    VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS,         VIR_TYPED_PARAM_INT,    \
+    VIR_MIGRATE_PARAM_DISKS_BANDWIDTH,              VIR_TYPED_PARAM_ULLONG, \
+    VIR_MIGRATE_PARAM_DISKS_TOTAL_BANDWIDTH,        VIR_TYPED_PARAM_ULLONG, \
+    VIR_MIGRATE_PARAM_DISKS_BUF_SIZE,               VIR_TYPED_PARAM_ULLONG, \
+    VIR_MIGRATE_PARAM_DISKS_GRANULARITY,            VIR_TYPED_PARAM_UINT,   \
+    VIR_MIGRATE_PARAM_CONVERGE_MAX_DOWNTIME,        VIR_TYPED_PARAM_ULLONG, \
+    VIR_MIGRATE_PARAM_CONVERGE_MAX_TIME,            VIR_TYPED_PARAM_ULLONG, \
     NULL
 
 
@@ -122,6 +140,34 @@ qemuMigrationCompressionDump(qemuMigrationCompressionPtr compression,
                              int *maxparams,
                              unsigned long *flags);
 
+/* Tuning of drive-mirror jobs used for non-shared storage migration */
+struct _qemuMigrationMirror {
+    bool bandwidth_set;
+    unsigned long long bandwidth;       /* per disk, MiB/s */
+
+    bool totalBandwidth_set;
+    unsigned long long totalBandwidth;  /* all disks together, MiB/s */
+
+    unsigned long long bufSize;         /* bytes, 0 for QEMU's default */
+    unsigned int granularity;           /* bytes, 0 for QEMU's default */
+};
+
+qemuMigrationMirrorPtr
+qemuMigrationMirrorParse(virTypedParameterPtr params,
+                         int nparams,
+                         unsigned long flags);
+
+/* Limits watched by the convergence policy during outgoing migration */
+struct _qemuMigrationPolicy {
+    unsigned long long maxDowntime;     /* ms, 0 when not set */
+    unsigned long long maxTime;         /* seconds, 0 when not set */
+};
+
+qemuMigrationPolicyPtr
+qemuMigrationPolicyParse(virTypedParameterPtr params,
+                         int nparams,
+                         unsigned long flags);
+
 void
 qemuMigrationParamsClear(qemuMonitorMigrationParamsPtr migParams);
 
@@ -178,6 +224,7 @@ qemuMigrationBegin(virConnectPtr conn,
                    int *cookieoutlen,
                    size_t nmigrate_disks,
                    const char **migrate_disks,
+                   int nparallel,
                    unsigned long flags);
 
 virDomainDefPtr
@@ -231,6 +278,8 @@ qemuMigrationPerform(virQEMUDriverPtr driver,
                      int nbdPort,
                      qemuMigrationCompressionPtr compression,
                      qemuMonitorMigrationParamsPtr migParams,
+                     qemuMigrationMirrorPtr mirror,
+                     qemuMigrationPolicyPtr policy,
                      const char *cookiein,
                      int cookieinlen,
                      char **cookieout,
@@ -271,9 +320,17 @@ qemuMigrationToFile(virQEMUDriverPtr driver,
                     virDomainObjPtr vm,
                     int fd,
                     const char *compressor,
+                    bool parallel,
                     qemuDomainAsyncJob asyncJob)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
+int
+qemuMigrationSetParallelCompression(virQEMUDriverPtr driver,
+                                    virDomainObjPtr vm,
+                                    bool state,
+                                    qemuDomainAsyncJob asyncJob)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
 int
 qemuMigrationCancel(virQEMUDriverPtr driver,
                     virDomainObjPtr vm);
@@ -284,6 +341,26 @@ qemuMigrationFetchJobStatus(virQEMUDriverPtr driver,
                             qemuDomainAsyncJob asyncJob,
                             qemuDomainJobInfoPtr jobInfo);
 
+int
+qemuMigrationSchedulerInit(virQEMUDriverPtr driver);
+
+void
+qemuMigrationSchedulerFree(virQEMUDriverPtr driver);
+
+void
+qemuMigrationSchedulerRelease(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm);
+
+bool
+qemuMigrationSchedulerAbort(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm);
+
+bool
+qemuMigrationSchedulerGetPosition(virQEMUDriverPtr driver,
+                                  virDomainObjPtr vm,
+                                  unsigned int *position,
+                                  unsigned long long *remaining);
+
 int
 qemuMigrationErrorInit(virQEMUDriverPtr driver);
 
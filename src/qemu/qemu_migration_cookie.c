@@ -25,6 +25,7 @@
 
 #include "locking/domain_lock.h"
 #include "viralloc.h"
+#include "vircrypto.h"
 #include "virerror.h"
 #include "virlog.h"
 #include "virnetdevopenvswitch.h"
@@ -48,7 +49,9 @@ VIR_ENUM_IMPL(qemuMigrationCookieFlag,
               "nbd",
               "statistics",
               "memory-hotplug",
-              "cpu-hotplug");
+              "cpu-hotplug",
+              "multifd",
+              "persistent-digest");
 
 
 static void
@@ -102,6 +105,8 @@ qemuMigrationCookieFree(qemuMigrationCookiePtr mig)
     virDomainDefFree(mig->persistent);
     qemuMigrationCookieNetworkFree(mig->network);
     qemuMigrationCookieNBDFree(mig->nbd);
+    VIR_FREE(mig->multifd);
+    VIR_FREE(mig->persistentDigest);
 
     VIR_FREE(mig->localHostname);
     VIR_FREE(mig->remoteHostname);
@@ -418,6 +423,75 @@ qemuMigrationCookieGetPersistent(qemuMigrationCookiePtr mig)
 }
 
 
+int
+qemuMigrationCookieAddMultiFD(qemuMigrationCookiePtr mig,
+                              int channels)
+{
+    if (!mig->multifd && VIR_ALLOC(mig->multifd) < 0)
+        return -1;
+
+    mig->multifd->channels = channels;
+    mig->flags |= QEMU_MIGRATION_COOKIE_MULTIFD;
+    mig->flagsMandatory |= QEMU_MIGRATION_COOKIE_MULTIFD;
+    return 0;
+}
+
+
+/**
+ * qemuMigrationCookiePersistentDigest:
+ * @driver: qemu driver
+ * @def: persistent domain definition
+ * @xml: filled with the formatted definition unless NULL
+ *
+ * Computes a digest of @def formatted the same way it would be sent as
+ * persistent data in a migration cookie. Comparing digests lets both
+ * sides find out whether the definition needs to be sent at all.
+ *
+ * Returns the digest or NULL on error.
+ */
+char *
+qemuMigrationCookiePersistentDigest(virQEMUDriverPtr driver,
+                                    virDomainDefPtr def,
+                                    char **xml)
+{
+    char *str;
+    char *digest = NULL;
+
+    if (!(str = qemuDomainDefFormatXML(driver, def,
+                                       VIR_DOMAIN_XML_INACTIVE |
+                                       VIR_DOMAIN_XML_SECURE |
+                                       VIR_DOMAIN_XML_MIGRATABLE)))
+        return NULL;
+
+    if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256, str, &digest) < 0) {
+        VIR_FREE(str);
+        return NULL;
+    }
+
+    if (xml)
+        *xml = str;
+    else
+        VIR_FREE(str);
+
+    return digest;
+}
+
+
+int
+qemuMigrationCookieAddPersistentDigest(qemuMigrationCookiePtr mig,
+                                       const char *digest)
+{
+    if (mig->persistentDigest != digest) {
+        VIR_FREE(mig->persistentDigest);
+        if (VIR_STRDUP(mig->persistentDigest, digest) < 0)
+            return -1;
+    }
+
+    mig->flags |= QEMU_MIGRATION_COOKIE_PERSISTENT_DIGEST;
+    return 0;
+}
+
+
 static int
 qemuMigrationCookieAddNetwork(qemuMigrationCookiePtr mig,
                               virQEMUDriverPtr driver,
@@ -673,6 +747,11 @@ qemuMigrationCookieStatisticsXMLFormat(virBufferPtr buf,
                       VIR_DOMAIN_JOB_AUTO_CONVERGE_THROTTLE,
                       stats->cpu_throttle_percentage);
 
+    if (jobInfo->parallelConnections)
+        virBufferAsprintf(buf, "<%1$s>%2$d</%1$s>\n",
+                          VIR_DOMAIN_JOB_PARALLEL_CONNECTIONS,
+                          jobInfo->parallelConnections);
+
     virBufferAdjustIndent(buf, -2);
     virBufferAddLit(buf, "</statistics>\n");
 }
@@ -755,6 +834,15 @@ qemuMigrationCookieXMLFormat(virQEMUDriverPtr driver,
     if (mig->flags & QEMU_MIGRATION_COOKIE_STATS && mig->jobInfo)
         qemuMigrationCookieStatisticsXMLFormat(buf, mig->jobInfo);
 
+    if ((mig->flags & QEMU_MIGRATION_COOKIE_MULTIFD) && mig->multifd)
+        virBufferAsprintf(buf, "<multifd channels='%d'/>\n",
+                          mig->multifd->channels);
+
+    if ((mig->flags & QEMU_MIGRATION_COOKIE_PERSISTENT_DIGEST) &&
+        mig->persistentDigest)
+        virBufferEscapeString(buf, "<persistent-digest>%s</persistent-digest>\n",
+                              mig->persistentDigest);
+
     virBufferAdjustIndent(buf, -2);
     virBufferAddLit(buf, "</qemu-migration>\n");
     return 0;
@@ -942,6 +1030,27 @@ qemuMigrationCookieNBDXMLParse(xmlXPathContextPtr ctxt)
 }
 
 
+static qemuMigrationCookieMultiFDPtr
+qemuMigrationCookieMultiFDXMLParse(xmlXPathContextPtr ctxt)
+{
+    qemuMigrationCookieMultiFDPtr ret = NULL;
+    int channels;
+
+    if (virXPathInt("string(./multifd/@channels)", ctxt, &channels) < 0 ||
+        channels < 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Malformed multifd channels in migration cookie"));
+        return NULL;
+    }
+
+    if (VIR_ALLOC(ret) < 0)
+        return NULL;
+
+    ret->channels = channels;
+    return ret;
+}
+
+
 static qemuDomainJobInfoPtr
 qemuMigrationCookieStatisticsXMLParse(xmlXPathContextPtr ctxt)
 {
@@ -1021,6 +1130,8 @@ qemuMigrationCookieStatisticsXMLParse(xmlXPathContextPtr ctxt)
 
     virXPathInt("string(./" VIR_DOMAIN_JOB_AUTO_CONVERGE_THROTTLE "[1])",
                 ctxt, &stats->cpu_throttle_percentage);
+    virXPathInt("string(./" VIR_DOMAIN_JOB_PARALLEL_CONNECTIONS "[1])",
+                ctxt, &jobInfo->parallelConnections);
  cleanup:
     ctxt->node = save_ctxt;
     return jobInfo;
@@ -1198,6 +1309,18 @@ qemuMigrationCookieXMLParse(qemuMigrationCookiePtr mig,
         (!(mig->jobInfo = qemuMigrationCookieStatisticsXMLParse(ctxt))))
         goto error;
 
+    if (flags & QEMU_MIGRATION_COOKIE_MULTIFD &&
+        virXPathBoolean("boolean(./multifd)", ctxt) &&
+        (!(mig->multifd = qemuMigrationCookieMultiFDXMLParse(ctxt))))
+        goto error;
+
+    if (flags & QEMU_MIGRATION_COOKIE_PERSISTENT_DIGEST) {
+        mig->persistentDigest = virXPathString("string(./persistent-digest[1])",
+                                               ctxt);
+        if (mig->persistentDigest && STREQ(mig->persistentDigest, ""))
+            VIR_FREE(mig->persistentDigest);
+    }
+
     virObjectUnref(caps);
     return 0;
 
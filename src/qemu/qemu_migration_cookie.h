@@ -28,6 +28,8 @@ typedef enum {
     QEMU_MIGRATION_COOKIE_FLAG_STATS,
     QEMU_MIGRATION_COOKIE_FLAG_MEMORY_HOTPLUG,
     QEMU_MIGRATION_COOKIE_FLAG_CPU_HOTPLUG,
+    QEMU_MIGRATION_COOKIE_FLAG_MULTIFD,
+    QEMU_MIGRATION_COOKIE_FLAG_PERSISTENT_DIGEST,
 
     QEMU_MIGRATION_COOKIE_FLAG_LAST
 } qemuMigrationCookieFlags;
@@ -43,6 +45,8 @@ typedef enum {
     QEMU_MIGRATION_COOKIE_STATS = (1 << QEMU_MIGRATION_COOKIE_FLAG_STATS),
     QEMU_MIGRATION_COOKIE_MEMORY_HOTPLUG = (1 << QEMU_MIGRATION_COOKIE_FLAG_MEMORY_HOTPLUG),
     QEMU_MIGRATION_COOKIE_CPU_HOTPLUG = (1 << QEMU_MIGRATION_COOKIE_FLAG_CPU_HOTPLUG),
+    QEMU_MIGRATION_COOKIE_MULTIFD = (1 << QEMU_MIGRATION_COOKIE_FLAG_MULTIFD),
+    QEMU_MIGRATION_COOKIE_PERSISTENT_DIGEST = (1 << QEMU_MIGRATION_COOKIE_FLAG_PERSISTENT_DIGEST),
 } qemuMigrationCookieFeatures;
 
 typedef struct _qemuMigrationCookieGraphics qemuMigrationCookieGraphics;
@@ -88,6 +92,12 @@ struct _qemuMigrationCookieNBD {
     } *disks;
 };
 
+typedef struct _qemuMigrationCookieMultiFD qemuMigrationCookieMultiFD;
+typedef qemuMigrationCookieMultiFD *qemuMigrationCookieMultiFDPtr;
+struct _qemuMigrationCookieMultiFD {
+    int channels; /* number of parallel migration connections */
+};
+
 typedef struct _qemuMigrationCookie qemuMigrationCookie;
 typedef qemuMigrationCookie *qemuMigrationCookiePtr;
 struct _qemuMigrationCookie {
@@ -122,6 +132,12 @@ struct _qemuMigrationCookie {
 
     /* If (flags & QEMU_MIGRATION_COOKIE_STATS) */
     qemuDomainJobInfoPtr jobInfo;
+
+    /* If (flags & QEMU_MIGRATION_COOKIE_MULTIFD) */
+    qemuMigrationCookieMultiFDPtr multifd;
+
+    /* If (flags & QEMU_MIGRATION_COOKIE_PERSISTENT_DIGEST) */
+    char *persistentDigest;
 };
 
 
@@ -150,4 +166,17 @@ qemuMigrationCookieAddPersistent(qemuMigrationCookiePtr mig,
 virDomainDefPtr
 qemuMigrationCookieGetPersistent(qemuMigrationCookiePtr mig);
 
+int
+qemuMigrationCookieAddMultiFD(qemuMigrationCookiePtr mig,
+                              int channels);
+
+char *
+qemuMigrationCookiePersistentDigest(virQEMUDriverPtr driver,
+                                    virDomainDefPtr def,
+                                    char **xml);
+
+int
+qemuMigrationCookieAddPersistentDigest(qemuMigrationCookiePtr mig,
+                                       const char *digest);
+
 #endif /* __QEMU_MIGRATION_COOKIE_H__ */
@@ -43,6 +43,7 @@
 #include "virprobe.h"
 #include "virstring.h"
 #include "virtime.h"
+#include "virevent.h"
 
 #ifdef WITH_DTRACE_PROBES
 # include "libvirt_qemu_probes.h"
@@ -55,6 +56,14 @@ VIR_LOG_INIT("qemu.qemu_monitor");
 #define DEBUG_IO 0
 #define DEBUG_RAW_IO 0
 
+/* Minimum free space in the buffer before reading from the monitor and
+ * the maximum amount of data read at once */
+#define QEMU_MONITOR_READ_MIN 4096
+#define QEMU_MONITOR_READ_MAX (1024 * 1024)
+
+/* Buffers bigger than this are freed once their data is processed */
+#define QEMU_MONITOR_BUFFER_KEEP (64 * 1024)
+
 struct _qemuMonitor {
     virObjectLockable parent;
 
@@ -78,6 +87,10 @@ struct _qemuMonitor {
     size_t bufferOffset;
     size_t bufferLength;
     char *buffer;
+    /* Leading bytes of buffer known not to hold a complete QMP line */
+    size_t bufferScanned;
+
+    qemuMonitorIOStats stats;
 
     /* If anything went wrong, this will be fed back
      * the next monitor msg */
@@ -172,7 +185,7 @@ VIR_ENUM_IMPL(qemuMonitorMigrationStatus,
 VIR_ENUM_IMPL(qemuMonitorMigrationCaps,
               QEMU_MONITOR_MIGRATION_CAPS_LAST,
               "xbzrle", "auto-converge", "rdma-pin-all", "events",
-              "postcopy-ram", "compress")
+              "postcopy-ram", "compress", "x-multifd")
 
 VIR_ENUM_IMPL(qemuMonitorVMStatus,
               QEMU_MONITOR_VM_STATUS_LAST,
@@ -321,6 +334,7 @@ qemuMonitorDispose(void *obj)
     virResetError(&mon->lastError);
     virCondDestroy(&mon->notify);
     VIR_FREE(mon->buffer);
+    qemuMonitorIOStatsClear(&mon->stats);
     virJSONValueFree(mon->options);
     VIR_FREE(mon->balloonpath);
 }
@@ -411,8 +425,12 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
     qemuMonitorMessagePtr msg = NULL;
 
     /* See if there's a message & whether its ready for its reply
-     * ie whether its completed writing all its data */
-    if (mon->msg && mon->msg->txOffset == mon->msg->txLength)
+     * ie whether its completed writing all its data. The replies to
+     * pipelined commands may arrive while the rest of the batch is
+     * still being written though. */
+    if (mon->msg &&
+        (mon->msg->txOffset == mon->msg->txLength ||
+         mon->msg->nrxObjects))
         msg = mon->msg;
 
 #if DEBUG_IO
@@ -430,6 +448,15 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
     PROBE(QEMU_MONITOR_IO_PROCESS,
           "mon=%p buf=%s len=%zu", mon, mon->buffer, mon->bufferOffset);
 
+    /* Large replies arrive in many reads, don't rescan their beginning
+     * every time only to find out that they are still incomplete */
+    if (mon->json &&
+        !memchr(mon->buffer + mon->bufferScanned, '\n',
+                mon->bufferOffset - mon->bufferScanned)) {
+        mon->bufferScanned = mon->bufferOffset;
+        return 0;
+    }
+
     if (mon->json)
         len = qemuMonitorJSONIOProcess(mon,
                                        mon->buffer, mon->bufferOffset,
@@ -445,13 +472,25 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
     if (len && mon->waitGreeting)
         mon->waitGreeting = false;
 
-    if (len < mon->bufferOffset) {
+    if (len >= mon->bufferOffset) {
+        /* Keep a small buffer around instead of allocating a new one
+         * for every reply, but don't hold on to big ones */
+        if (mon->bufferLength > QEMU_MONITOR_BUFFER_KEEP) {
+            VIR_FREE(mon->buffer);
+            mon->bufferLength = 0;
+        } else if (mon->buffer) {
+            mon->buffer[0] = '\0';
+        }
+        mon->bufferOffset = 0;
+    } else if (len > 0) {
         memmove(mon->buffer, mon->buffer + len, mon->bufferOffset - len);
         mon->bufferOffset -= len;
-    } else {
-        VIR_FREE(mon->buffer);
-        mon->bufferOffset = mon->bufferLength = 0;
+        mon->buffer[mon->bufferOffset] = '\0';
     }
+
+    /* The JSON monitor consumes every complete line, whatever is left
+     * is the beginning of a reply which is still being received */
+    mon->bufferScanned = mon->bufferOffset;
 #if DEBUG_IO
     VIR_DEBUG("Process done %d used %d", (int)mon->bufferOffset, len);
 #endif
@@ -550,6 +589,7 @@ qemuMonitorIOWrite(qemuMonitorPtr mon)
         return -1;
     }
     mon->msg->txOffset += done;
+    mon->stats.txBytes += done;
     return done;
 }
 
@@ -563,21 +603,25 @@ qemuMonitorIOWrite(qemuMonitorPtr mon)
 static int
 qemuMonitorIORead(qemuMonitorPtr mon)
 {
-    size_t avail = mon->bufferLength - mon->bufferOffset;
     int ret = 0;
 
-    if (avail < 1024) {
-        if (VIR_REALLOC_N(mon->buffer,
-                          mon->bufferLength + 1024) < 0)
-            return -1;
-        mon->bufferLength += 1024;
-        avail += 1024;
-    }
-
-    /* Read as much as we can get into our buffer,
-       until we block on EAGAIN, or hit EOF */
-    while (avail > 1) {
+    /* Read as much as we can get into our buffer, until we block on
+       EAGAIN, hit EOF or have read enough for one go. The buffer grows
+       along with the reply so that large ones need few reads */
+    while (ret < QEMU_MONITOR_READ_MAX) {
+        size_t avail = mon->bufferLength - mon->bufferOffset;
+        size_t grow;
         int got;
+
+        if (avail < QEMU_MONITOR_READ_MIN) {
+            grow = MIN(MAX(mon->bufferLength, QEMU_MONITOR_READ_MIN),
+                       QEMU_MONITOR_READ_MAX);
+            if (VIR_REALLOC_N(mon->buffer, mon->bufferLength + grow) < 0)
+                return -1;
+            mon->bufferLength += grow;
+            avail += grow;
+        }
+
         got = read(mon->fd,
                    mon->buffer + mon->bufferOffset,
                    avail - 1);
@@ -593,9 +637,9 @@ qemuMonitorIORead(qemuMonitorPtr mon)
             break;
 
         ret += got;
-        avail -= got;
         mon->bufferOffset += got;
         mon->buffer[mon->bufferOffset] = '\0';
+        mon->stats.rxBytes += got;
     }
 
 #if DEBUG_IO
@@ -747,7 +791,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
          * then wakeup that waiter */
         if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+            virCondBroadcast(&mon->notify);
         }
     }
 
@@ -761,7 +805,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         VIR_DEBUG("Triggering EOF callback");
         (eofNotify)(mon, vm, mon->callbackOpaque);
@@ -771,7 +815,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         VIR_DEBUG("Triggering error callback");
         (errorNotify)(mon, vm, mon->callbackOpaque);
@@ -949,13 +993,17 @@ bool
 qemuMonitorRegister(qemuMonitorPtr mon)
 {
     virObjectRef(mon);
-    if ((mon->watch = virEventAddHandle(mon->fd,
-                                        VIR_EVENT_HANDLE_HANGUP |
-                                        VIR_EVENT_HANDLE_ERROR |
-                                        VIR_EVENT_HANDLE_READABLE,
-                                        qemuMonitorIO,
-                                        mon,
-                                        virObjectFreeCallback)) < 0) {
+    /* Keep all handles of a domain on the same event loop thread. The
+     * tests talk to a monitor of a domain without any definition. */
+    if ((mon->watch = virEventAddHandleKey(mon->fd,
+                                           VIR_EVENT_HANDLE_HANGUP |
+                                           VIR_EVENT_HANDLE_ERROR |
+                                           VIR_EVENT_HANDLE_READABLE,
+                                           qemuMonitorIO,
+                                           mon,
+                                           virObjectFreeCallback,
+                                           mon->vm->def ?
+                                           mon->vm->def->id : 0)) < 0) {
         virObjectUnref(mon);
         return false;
     }
@@ -983,6 +1031,10 @@ qemuMonitorClose(qemuMonitorPtr mon)
     PROBE(QEMU_MONITOR_CLOSE,
           "mon=%p refs=%d", mon, mon->parent.parent.u.s.refs);
 
+    VIR_DEBUG("mon=%p rx=%llu tx=%llu replies=%llu latency=%llums max=%llums",
+              mon, mon->stats.rxBytes, mon->stats.txBytes,
+              mon->stats.replies, mon->stats.latency, mon->stats.latencyMax);
+
     qemuMonitorSetDomainLogLocked(mon, NULL, NULL, NULL);
 
     if (mon->fd >= 0) {
@@ -1008,7 +1060,7 @@ qemuMonitorClose(qemuMonitorPtr mon)
             }
         }
         mon->msg->finished = 1;
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
     }
 
     /* Propagate existing monitor error in case the current thread has no
@@ -1032,12 +1084,94 @@ qemuMonitorNextCommandID(qemuMonitorPtr mon)
 }
 
 
+const unsigned long long qemuMonitorLatencyBuckets[] = {
+    1, 10, 100, 1000, 10000,
+};
+verify(ARRAY_CARDINALITY(qemuMonitorLatencyBuckets) ==
+       QEMU_MONITOR_LATENCY_BUCKETS - 1);
+
+
+void
+qemuMonitorIOStatsClear(qemuMonitorIOStatsPtr stats)
+{
+    size_t i;
+
+    for (i = 0; i < stats->ncommands; i++)
+        VIR_FREE(stats->commands[i].name);
+    VIR_FREE(stats->commands);
+
+    memset(stats, 0, sizeof(*stats));
+}
+
+
+static void
+qemuMonitorCommandStatsAdd(qemuMonitorCommandStatsPtr stats,
+                           unsigned long long latency)
+{
+    size_t i;
+
+    stats->calls++;
+    stats->latency += latency;
+    stats->latencyMax = MAX(stats->latencyMax, latency);
+
+    for (i = 0; i < QEMU_MONITOR_LATENCY_BUCKETS - 1; i++) {
+        if (latency <= qemuMonitorLatencyBuckets[i])
+            break;
+    }
+    stats->histogram[i]++;
+}
+
+
+/* Account a reply to the command @name which took @latency ms */
+static void
+qemuMonitorIOStatsAdd(qemuMonitorIOStatsPtr stats,
+                      const char *name,
+                      unsigned long long latency)
+{
+    qemuMonitorCommandStats cmd = { 0 };
+    size_t i;
+
+    stats->replies++;
+    stats->latency += latency;
+    stats->latencyMax = MAX(stats->latencyMax, latency);
+
+    if (!name)
+        return;
+
+    for (i = 0; i < stats->ncommands; i++) {
+        if (STREQ(stats->commands[i].name, name)) {
+            qemuMonitorCommandStatsAdd(&stats->commands[i], latency);
+            return;
+        }
+    }
+
+    /* Statistics are best effort, don't fail the command over them */
+    if (VIR_STRDUP_QUIET(cmd.name, name) < 0)
+        return;
+    qemuMonitorCommandStatsAdd(&cmd, latency);
+    if (VIR_APPEND_ELEMENT_QUIET(stats->commands, stats->ncommands, cmd) < 0)
+        VIR_FREE(cmd.name);
+}
+
+
 int
 qemuMonitorSend(qemuMonitorPtr mon,
                 qemuMonitorMessagePtr msg)
 {
+    unsigned long long start = 0;
+    unsigned long long now;
     int ret = -1;
 
+    /* Threads sharing a query job take turns, the monitor handles
+     * one message at a time */
+    while (mon->msg && mon->lastError.code == VIR_ERR_OK) {
+        if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to wait on monitor condition"));
+            return -1;
+        }
+    }
+
     /* Check whether qemu quit unexpectedly */
     if (mon->lastError.code != VIR_ERR_OK) {
         VIR_DEBUG("Attempt to send command while error is set %s",
@@ -1046,6 +1180,8 @@ qemuMonitorSend(qemuMonitorPtr mon,
         return -1;
     }
 
+    ignore_value(virTimeMillisNow(&start));
+
     mon->msg = msg;
     qemuMonitorUpdateWatch(mon);
 
@@ -1068,11 +1204,15 @@ qemuMonitorSend(qemuMonitorPtr mon,
         goto cleanup;
     }
 
+    if (start && virTimeMillisNow(&now) == 0)
+        qemuMonitorIOStatsAdd(&mon->stats, msg->cmdName, now - start);
+
     ret = 0;
 
  cleanup:
     mon->msg = NULL;
     qemuMonitorUpdateWatch(mon);
+    virCondBroadcast(&mon->notify);
 
     return ret;
 }
@@ -1106,6 +1246,58 @@ qemuMonitorSetOptions(qemuMonitorPtr mon, virJSONValuePtr options)
 }
 
 
+/**
+ * qemuMonitorGetIOStats:
+ * @mon: monitor object, locked
+ * @stats: filled with the I/O statistics of @mon
+ *
+ * Report how much data went through the monitor since it was opened and
+ * how long the callers of qemuMonitorSend had to wait for the replies.
+ * The caller has to release @stats with qemuMonitorIOStatsClear.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuMonitorGetIOStats(qemuMonitorPtr mon,
+                      qemuMonitorIOStatsPtr stats)
+{
+    size_t i;
+
+    *stats = mon->stats;
+    stats->ncommands = 0;
+    stats->commands = NULL;
+
+    if (mon->stats.ncommands &&
+        VIR_ALLOC_N(stats->commands, mon->stats.ncommands) < 0)
+        return -1;
+
+    for (i = 0; i < mon->stats.ncommands; i++) {
+        stats->commands[i] = mon->stats.commands[i];
+        if (VIR_STRDUP(stats->commands[i].name,
+                       mon->stats.commands[i].name) < 0) {
+            qemuMonitorIOStatsClear(stats);
+            return -1;
+        }
+        stats->ncommands++;
+    }
+
+    return 0;
+}
+
+
+/**
+ * qemuMonitorGetBufferSize:
+ * @mon: monitor object, must be locked
+ *
+ * Returns the number of bytes allocated for messages received from QEMU.
+ */
+size_t
+qemuMonitorGetBufferSize(qemuMonitorPtr mon)
+{
+    return mon->bufferLength;
+}
+
+
 /**
  * Search the qom objects for the balloon driver object by its known names
  * of "virtio-balloon-pci" or "virtio-balloon-ccw". The entry for the driver
@@ -1316,6 +1508,8 @@ qemuMonitorEmitEvent(qemuMonitorPtr mon, const char *event,
     int ret = -1;
     VIR_DEBUG("mon=%p event=%s", mon, event);
 
+    mon->stats.events++;
+
     QEMU_MONITOR_CALLBACK(mon, ret, domainEvent, mon->vm, event, seconds,
                           micros, details);
     return ret;
@@ -1500,17 +1694,23 @@ qemuMonitorEmitPMSuspendDisk(qemuMonitorPtr mon)
 }
 
 
+/**
+ * qemuMonitorEmitBlockJob:
+ * @info: progress of the job carried by the event, or NULL if the
+ *        event didn't have all of it
+ */
 int
 qemuMonitorEmitBlockJob(qemuMonitorPtr mon,
                         const char *diskAlias,
                         int type,
-                        int status)
+                        int status,
+                        qemuMonitorBlockJobInfoPtr info)
 {
     int ret = -1;
     VIR_DEBUG("mon=%p", mon);
 
     QEMU_MONITOR_CALLBACK(mon, ret, domainBlockJob, mon->vm,
-                          diskAlias, type, status);
+                          diskAlias, type, status, info);
     return ret;
 }
 
@@ -1947,6 +2147,7 @@ qemuMonitorGetCPUInfoHotplug(struct qemuMonitorQueryHotpluggableCpusEntry *hotpl
  * @vcpus: pointer filled by array of qemuMonitorCPUInfo structures
  * @maxvcpus: total possible number of vcpus
  * @hotplug: query data relevant for hotplug support
+ * @fast: use QMP query-cpus-fast, which doesn't interrupt the vcpus
  *
  * Detects VCPU information. If qemu doesn't support or fails reporting
  * information this function will return success as other parts of libvirt
@@ -1959,7 +2160,8 @@ int
 qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
                       qemuMonitorCPUInfoPtr *vcpus,
                       size_t maxvcpus,
-                      bool hotplug)
+                      bool hotplug,
+                      bool fast)
 {
     struct qemuMonitorQueryHotpluggableCpusEntry *hotplugcpus = NULL;
     size_t nhotplugcpus = 0;
@@ -1985,7 +2187,8 @@ qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
         goto cleanup;
 
     if (mon->json)
-        rc = qemuMonitorJSONQueryCPUs(mon, &cpuentries, &ncpuentries, hotplug);
+        rc = qemuMonitorJSONQueryCPUs(mon, &cpuentries, &ncpuentries, hotplug,
+                                      fast);
     else
         rc = qemuMonitorTextQueryCPUs(mon, &cpuentries, &ncpuentries);
 
@@ -2023,11 +2226,13 @@ qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
  * qemuMonitorGetCpuHalted:
  *
  * Returns a bitmap of vcpu id's that are halted. The id's correspond to the
- * 'CPU' field as reported by query-cpus'.
+ * 'CPU' field as reported by query-cpus'. With @fast, the state comes from
+ * query-cpus-fast, which reports it only on s390.
  */
 virBitmapPtr
 qemuMonitorGetCpuHalted(qemuMonitorPtr mon,
-                        size_t maxvcpus)
+                        size_t maxvcpus,
+                        bool fast)
 {
     struct qemuMonitorQueryCpusEntry *cpuentries = NULL;
     size_t ncpuentries = 0;
@@ -2038,7 +2243,8 @@ qemuMonitorGetCpuHalted(qemuMonitorPtr mon,
     QEMU_CHECK_MONITOR_NULL(mon);
 
     if (mon->json)
-        rc = qemuMonitorJSONQueryCPUs(mon, &cpuentries, &ncpuentries, false);
+        rc = qemuMonitorJSONQueryCPUs(mon, &cpuentries, &ncpuentries, false,
+                                      fast);
     else
         rc = qemuMonitorTextQueryCPUs(mon, &cpuentries, &ncpuentries);
 
@@ -2294,6 +2500,52 @@ qemuMonitorBlockStatsUpdateCapacity(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorGetAllBlockStatsInfoBatch:
+ * @mon: monitor object
+ * @ret_stats: pointer that is filled with a hash table containing the stats
+ * @backingChain: recurse into the backing chain of devices
+ * @nodedata: if non-NULL, filled with the reply of query-named-block-nodes
+ *
+ * Combines qemuMonitorGetAllBlockStatsInfo, qemuMonitorBlockStatsUpdateCapacity
+ * and optionally qemuMonitorQueryNamedBlockNodes into a single round-trip
+ * to the monitor by pipelining the commands. Failure to fill in the
+ * capacity or @nodedata is not fatal; @nodedata is NULL in the latter case.
+ *
+ * Returns < 0 on error, count of supported block stats fields on success.
+ */
+int
+qemuMonitorGetAllBlockStatsInfoBatch(qemuMonitorPtr mon,
+                                     virHashTablePtr *ret_stats,
+                                     bool backingChain,
+                                     virJSONValuePtr *nodedata)
+{
+    int ret = -1;
+    VIR_DEBUG("ret_stats=%p, backing=%d, nodedata=%p",
+              ret_stats, backingChain, nodedata);
+
+    if (nodedata)
+        *nodedata = NULL;
+
+    QEMU_CHECK_MONITOR(mon);
+
+    if (!mon->json)
+        return qemuMonitorGetAllBlockStatsInfo(mon, ret_stats, backingChain);
+
+    if (!(*ret_stats = virHashCreate(10, virHashValueFree)))
+        return -1;
+
+    if ((ret = qemuMonitorJSONGetAllBlockStatsInfoBatch(mon, *ret_stats,
+                                                        backingChain,
+                                                        nodedata)) < 0) {
+        virHashFree(*ret_stats);
+        *ret_stats = NULL;
+    }
+
+    return ret;
+}
+
+
 int
 qemuMonitorBlockResize(qemuMonitorPtr mon,
                        const char *device,
@@ -2578,13 +2830,14 @@ qemuMonitorSetMigrationParams(qemuMonitorPtr mon,
 {
     VIR_DEBUG("compressLevel=%d:%d compressThreads=%d:%d "
               "decompressThreads=%d:%d cpuThrottleInitial=%d:%d "
-              "cpuThrottleIncrement=%d:%d tlsAlias=%s "
+              "cpuThrottleIncrement=%d:%d multifdChannels=%d:%d tlsAlias=%s "
               "tlsHostname=%s",
               params->compressLevel_set, params->compressLevel,
               params->compressThreads_set, params->compressThreads,
               params->decompressThreads_set, params->decompressThreads,
               params->cpuThrottleInitial_set, params->cpuThrottleInitial,
               params->cpuThrottleIncrement_set, params->cpuThrottleIncrement,
+              params->multifdChannels_set, params->multifdChannels,
               NULLSTR(params->migrateTLSAlias),
               NULLSTR(params->migrateTLSHostname));
 
@@ -2595,6 +2848,7 @@ qemuMonitorSetMigrationParams(qemuMonitorPtr mon,
         !params->decompressThreads_set &&
         !params->cpuThrottleInitial_set &&
         !params->cpuThrottleIncrement_set &&
+        !params->multifdChannels_set &&
         !params->migrateTLSAlias &&
         !params->migrateTLSHostname)
         return 0;
@@ -3294,6 +3548,74 @@ qemuMonitorDiskSnapshot(qemuMonitorPtr mon, virJSONValuePtr actions,
 }
 
 
+int
+qemuMonitorBlockDirtyBitmapAdd(qemuMonitorPtr mon,
+                               virJSONValuePtr actions,
+                               const char *device,
+                               const char *name,
+                               bool persistent)
+{
+    VIR_DEBUG("actions=%p, device=%s, name=%s, persistent=%d",
+              actions, device, name, persistent);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONBlockDirtyBitmapAdd(mon, actions, device, name,
+                                              persistent);
+}
+
+
+int
+qemuMonitorBlockDirtyBitmapClear(qemuMonitorPtr mon,
+                                 virJSONValuePtr actions,
+                                 const char *device,
+                                 const char *name)
+{
+    VIR_DEBUG("actions=%p, device=%s, name=%s", actions, device, name);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONBlockDirtyBitmapClear(mon, actions, device, name);
+}
+
+
+int
+qemuMonitorBlockDirtyBitmapExists(qemuMonitorPtr mon,
+                                  const char *device,
+                                  const char *name)
+{
+    VIR_DEBUG("device=%s, name=%s", device, name);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONBlockDirtyBitmapExists(mon, device, name);
+}
+
+
+/* Start a drive-backup block job, copying only the clusters recorded
+ * in @bitmap if it's given.  bandwidth is in bytes/sec.  */
+int
+qemuMonitorDriveBackup(qemuMonitorPtr mon,
+                       virJSONValuePtr actions,
+                       const char *device,
+                       const char *file,
+                       const char *format,
+                       const char *bitmap,
+                       unsigned long long bandwidth,
+                       bool reuse)
+{
+    VIR_DEBUG("actions=%p, device=%s, file=%s, format=%s, bitmap=%s, "
+              "bandwidth=%lld, reuse=%d",
+              actions, device, file, NULLSTR(format), NULLSTR(bitmap),
+              bandwidth, reuse);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONDriveBackup(mon, actions, device, file, format,
+                                      bitmap, bandwidth, reuse);
+}
+
+
 /* Start a drive-mirror block job.  bandwidth is in bytes/sec.  */
 int
 qemuMonitorDriveMirror(qemuMonitorPtr mon,
@@ -4275,6 +4597,30 @@ qemuMonitorSetBlockThreshold(qemuMonitorPtr mon,
 }
 
 
+int
+qemuMonitorStartDirtyRateCalc(qemuMonitorPtr mon,
+                              int seconds)
+{
+    VIR_DEBUG("seconds=%d", seconds);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONStartDirtyRateCalc(mon, seconds);
+}
+
+
+int
+qemuMonitorQueryDirtyRate(qemuMonitorPtr mon,
+                          qemuMonitorDirtyRateInfoPtr info)
+{
+    VIR_DEBUG("info=%p", info);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    return qemuMonitorJSONQueryDirtyRate(mon, info);
+}
+
+
 virJSONValuePtr
 qemuMonitorQueryNamedBlockNodes(qemuMonitorPtr mon)
 {
@@ -42,6 +42,9 @@ typedef qemuMonitor *qemuMonitorPtr;
 typedef struct _qemuMonitorMessage qemuMonitorMessage;
 typedef qemuMonitorMessage *qemuMonitorMessagePtr;
 
+typedef struct _qemuMonitorBlockJobInfo qemuMonitorBlockJobInfo;
+typedef qemuMonitorBlockJobInfo *qemuMonitorBlockJobInfoPtr;
+
 typedef int (*qemuMonitorPasswordHandler)(qemuMonitorPtr mon,
                                           qemuMonitorMessagePtr msg,
                                           const char *data,
@@ -60,6 +63,18 @@ struct _qemuMonitorMessage {
     int rxLength;
     /* Used by the JSON monitor to hold reply / error */
     void *rxObject;
+    /* Used by the JSON monitor to skip unneeded parts of the reply */
+    virJSONValueFilter rxFilter;
+
+    /* Name of the command, used for statistics only */
+    const char *cmdName;
+
+    /* Used by the JSON monitor when several commands are pipelined in
+     * txBuffer: the ids of the commands and the matching replies */
+    char **rxIds;
+    void **rxObjects;
+    size_t nrxObjects;
+    size_t nrxReceived;
 
     /* True if rxBuffer / rxObject are ready, or a
      * fatal error occurred on the monitor channel
@@ -70,6 +85,38 @@ struct _qemuMonitorMessage {
     void *passwordOpaque;
 };
 
+/* Upper bounds (in ms) of the command latency histogram buckets, the
+ * last bucket collects everything slower */
+# define QEMU_MONITOR_LATENCY_BUCKETS 6
+extern const unsigned long long qemuMonitorLatencyBuckets[QEMU_MONITOR_LATENCY_BUCKETS - 1];
+
+typedef struct _qemuMonitorCommandStats qemuMonitorCommandStats;
+typedef qemuMonitorCommandStats *qemuMonitorCommandStatsPtr;
+struct _qemuMonitorCommandStats {
+    char *name;
+    unsigned long long calls; /* replies received */
+    unsigned long long latency; /* total time spent waiting (ms) */
+    unsigned long long latencyMax; /* longest wait for a single reply (ms) */
+    unsigned long long histogram[QEMU_MONITOR_LATENCY_BUCKETS];
+};
+
+typedef struct _qemuMonitorIOStats qemuMonitorIOStats;
+typedef qemuMonitorIOStats *qemuMonitorIOStatsPtr;
+struct _qemuMonitorIOStats {
+    unsigned long long rxBytes; /* bytes read from the monitor */
+    unsigned long long txBytes; /* bytes written to the monitor */
+    unsigned long long events; /* asynchronous events received */
+    unsigned long long replies; /* commands which got a reply */
+    unsigned long long latency; /* total time spent waiting for replies (ms) */
+    unsigned long long latencyMax; /* longest wait for a single reply (ms) */
+
+    /* per command name breakdown of the above */
+    size_t ncommands;
+    qemuMonitorCommandStatsPtr commands;
+};
+
+void qemuMonitorIOStatsClear(qemuMonitorIOStatsPtr stats);
+
 typedef enum {
     QEMU_MONITOR_EVENT_PANIC_INFO_TYPE_NONE = 0,
     QEMU_MONITOR_EVENT_PANIC_INFO_TYPE_HYPERV,
@@ -175,6 +222,7 @@ typedef int (*qemuMonitorDomainBlockJobCallback)(qemuMonitorPtr mon,
                                                  const char *diskAlias,
                                                  int type,
                                                  int status,
+                                                 qemuMonitorBlockJobInfoPtr info,
                                                  void *opaque);
 typedef int (*qemuMonitorDomainTrayChangeCallback)(qemuMonitorPtr mon,
                                                    virDomainObjPtr vm,
@@ -319,6 +367,11 @@ virJSONValuePtr qemuMonitorGetOptions(qemuMonitorPtr mon)
     ATTRIBUTE_NONNULL(1);
 void qemuMonitorSetOptions(qemuMonitorPtr mon, virJSONValuePtr options)
     ATTRIBUTE_NONNULL(1);
+int qemuMonitorGetIOStats(qemuMonitorPtr mon,
+                          qemuMonitorIOStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+size_t qemuMonitorGetBufferSize(qemuMonitorPtr mon)
+    ATTRIBUTE_NONNULL(1);
 int qemuMonitorUpdateVideoMemorySize(qemuMonitorPtr mon,
                                      virDomainVideoDefPtr video,
                                      const char *videoName)
@@ -374,7 +427,8 @@ int qemuMonitorEmitPMSuspend(qemuMonitorPtr mon);
 int qemuMonitorEmitBlockJob(qemuMonitorPtr mon,
                             const char *diskAlias,
                             int type,
-                            int status);
+                            int status,
+                            qemuMonitorBlockJobInfoPtr info);
 int qemuMonitorEmitBalloonChange(qemuMonitorPtr mon,
                                  unsigned long long actual);
 int qemuMonitorEmitPMSuspendDisk(qemuMonitorPtr mon);
@@ -503,8 +557,11 @@ void qemuMonitorCPUInfoFree(qemuMonitorCPUInfoPtr list,
 int qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
                           qemuMonitorCPUInfoPtr *vcpus,
                           size_t maxvcpus,
-                          bool hotplug);
-virBitmapPtr qemuMonitorGetCpuHalted(qemuMonitorPtr mon, size_t maxvcpus);
+                          bool hotplug,
+                          bool fast);
+virBitmapPtr qemuMonitorGetCpuHalted(qemuMonitorPtr mon,
+                                     size_t maxvcpus,
+                                     bool fast);
 
 int qemuMonitorGetVirtType(qemuMonitorPtr mon,
                            virDomainVirtType *virtType);
@@ -550,6 +607,11 @@ int qemuMonitorBlockStatsUpdateCapacity(qemuMonitorPtr mon,
                                         virHashTablePtr stats,
                                         bool backingChain)
     ATTRIBUTE_NONNULL(2);
+int qemuMonitorGetAllBlockStatsInfoBatch(qemuMonitorPtr mon,
+                                         virHashTablePtr *ret_stats,
+                                         bool backingChain,
+                                         virJSONValuePtr *nodedata)
+    ATTRIBUTE_NONNULL(2);
 
 int qemuMonitorBlockResize(qemuMonitorPtr mon,
                            const char *dev_name,
@@ -619,6 +681,9 @@ struct _qemuMonitorMigrationParams {
     bool cpuThrottleIncrement_set;
     int cpuThrottleIncrement;
 
+    bool multifdChannels_set;
+    int multifdChannels;
+
     /* Value is either NULL, "", or some string. NULL indicates no support;
      * whereas, some string value indicates we can support setting/clearing */
     char *migrateTLSAlias;
@@ -697,6 +762,7 @@ typedef enum {
     QEMU_MONITOR_MIGRATION_CAPS_EVENTS,
     QEMU_MONITOR_MIGRATION_CAPS_POSTCOPY,
     QEMU_MONITOR_MIGRATION_CAPS_COMPRESS,
+    QEMU_MONITOR_MIGRATION_CAPS_MULTIFD,
 
     QEMU_MONITOR_MIGRATION_CAPS_LAST
 } qemuMonitorMigrationCaps;
@@ -841,6 +907,30 @@ int qemuMonitorDiskSnapshot(qemuMonitorPtr mon,
                             const char *file,
                             const char *format,
                             bool reuse);
+int qemuMonitorBlockDirtyBitmapAdd(qemuMonitorPtr mon,
+                                   virJSONValuePtr actions,
+                                   const char *device,
+                                   const char *name,
+                                   bool persistent)
+    ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+int qemuMonitorBlockDirtyBitmapClear(qemuMonitorPtr mon,
+                                     virJSONValuePtr actions,
+                                     const char *device,
+                                     const char *name)
+    ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+int qemuMonitorBlockDirtyBitmapExists(qemuMonitorPtr mon,
+                                      const char *device,
+                                      const char *name)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+int qemuMonitorDriveBackup(qemuMonitorPtr mon,
+                           virJSONValuePtr actions,
+                           const char *device,
+                           const char *file,
+                           const char *format,
+                           const char *bitmap,
+                           unsigned long long bandwidth,
+                           bool reuse)
+    ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
 int qemuMonitorTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
     ATTRIBUTE_NONNULL(2);
 int qemuMonitorDriveMirror(qemuMonitorPtr mon,
@@ -903,8 +993,6 @@ int qemuMonitorBlockJobSetSpeed(qemuMonitorPtr mon,
                                 unsigned long long bandwidth,
                                 bool modern);
 
-typedef struct _qemuMonitorBlockJobInfo qemuMonitorBlockJobInfo;
-typedef qemuMonitorBlockJobInfo *qemuMonitorBlockJobInfoPtr;
 struct _qemuMonitorBlockJobInfo {
     int type; /* virDomainBlockJobType */
     unsigned long long bandwidth; /* in bytes/s */
@@ -1125,4 +1213,20 @@ int qemuMonitorSetBlockThreshold(qemuMonitorPtr mon,
 
 virJSONValuePtr qemuMonitorQueryNamedBlockNodes(qemuMonitorPtr mon);
 
+int qemuMonitorStartDirtyRateCalc(qemuMonitorPtr mon,
+                                  int seconds);
+
+typedef struct _qemuMonitorDirtyRateInfo qemuMonitorDirtyRateInfo;
+typedef qemuMonitorDirtyRateInfo *qemuMonitorDirtyRateInfoPtr;
+
+struct _qemuMonitorDirtyRateInfo {
+    int status;             /* virDomainDirtyRateStatus */
+    int calcTime;           /* the period of the calculation in seconds */
+    long long startTime;    /* the start time of the calculation */
+    long long dirtyRate;    /* the dirty rate in MiB/s, -1 if unknown */
+};
+
+int qemuMonitorQueryDirtyRate(qemuMonitorPtr mon,
+                              qemuMonitorDirtyRateInfoPtr info);
+
 #endif /* QEMU_MONITOR_H */
@@ -182,6 +182,36 @@ qemuMonitorJSONIOProcessEvent(qemuMonitorPtr mon,
     return 0;
 }
 
+/* Store @obj as the reply to the pipelined command it belongs to. */
+static int
+qemuMonitorJSONIOProcessBatchReply(qemuMonitorMessagePtr msg,
+                                   virJSONValuePtr obj,
+                                   const char *line)
+{
+    const char *id = virJSONValueObjectGetString(obj, "id");
+    size_t i;
+
+    /* QEMU echoes the id of every command. A reply which doesn't match
+     * any of the outstanding commands means we've lost track of the
+     * conversation, which is fatal for the whole batch. */
+    for (i = 0; id && i < msg->nrxObjects; i++) {
+        if (!msg->rxObjects[i] && STREQ_NULLABLE(msg->rxIds[i], id))
+            break;
+    }
+
+    if (!id || i == msg->nrxObjects) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected JSON reply '%s'"), line);
+        return -1;
+    }
+
+    msg->rxObjects[i] = obj;
+    if (++msg->nrxReceived == msg->nrxObjects)
+        msg->finished = 1;
+
+    return 0;
+}
+
 int
 qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                              const char *line,
@@ -192,7 +222,9 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
 
     VIR_DEBUG("Line [%s]", line);
 
-    if (!(obj = virJSONValueFromString(line)))
+    if (!(obj = virJSONValueFromStringFiltered(line,
+                                               msg ? msg->rxFilter : NULL,
+                                               NULL)))
         goto cleanup;
 
     if (obj->type != VIR_JSON_TYPE_OBJECT) {
@@ -211,7 +243,10 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                virJSONValueObjectHasKey(obj, "return") == 1) {
         PROBE(QEMU_MONITOR_RECV_REPLY,
               "mon=%p reply=%s", mon, line);
-        if (msg) {
+        if (msg && msg->nrxObjects) {
+            if ((ret = qemuMonitorJSONIOProcessBatchReply(msg, obj, line)) == 0)
+                obj = NULL;
+        } else if (msg) {
             msg->rxObject = obj;
             msg->finished = 1;
             obj = NULL;
@@ -264,14 +299,16 @@ int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
 }
 
 static int
-qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
-                             virJSONValuePtr cmd,
-                             int scm_fd,
-                             virJSONValuePtr *reply)
+qemuMonitorJSONCommandFull(qemuMonitorPtr mon,
+                           virJSONValuePtr cmd,
+                           int scm_fd,
+                           virJSONValueFilter filter,
+                           virJSONValuePtr *reply)
 {
     int ret = -1;
     qemuMonitorMessage msg;
-    char *cmdstr = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
     char *id = NULL;
 
     *reply = NULL;
@@ -288,14 +325,23 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
         }
     }
 
-    if (!(cmdstr = virJSONValueToString(cmd, false)))
+    /* Format the command right into the message buffer */
+    virJSONWriterInit(&writer, &buf);
+    virJSONWriterValue(&writer, cmd);
+    if (virJSONWriterFinish(&writer) < 0)
         goto cleanup;
-    if (virAsprintf(&msg.txBuffer, "%s\r\n", cmdstr) < 0)
+
+    VIR_DEBUG("Send command '%s' for write with FD %d",
+              virBufferCurrentContent(&buf), scm_fd);
+
+    virBufferAddLit(&buf, "\r\n");
+    if (virBufferCheckError(&buf) < 0)
         goto cleanup;
-    msg.txLength = strlen(msg.txBuffer);
+    msg.txLength = virBufferUse(&buf);
+    msg.txBuffer = virBufferContentAndReset(&buf);
     msg.txFD = scm_fd;
-
-    VIR_DEBUG("Send command '%s' for write with FD %d", cmdstr, scm_fd);
+    msg.rxFilter = filter;
+    msg.cmdName = virJSONValueObjectGetString(cmd, "execute");
 
     ret = qemuMonitorSend(mon, &msg);
 
@@ -315,13 +361,23 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
 
  cleanup:
     VIR_FREE(id);
-    VIR_FREE(cmdstr);
     VIR_FREE(msg.txBuffer);
+    virBufferFreeAndReset(&buf);
 
     return ret;
 }
 
 
+static int
+qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
+                             virJSONValuePtr cmd,
+                             int scm_fd,
+                             virJSONValuePtr *reply)
+{
+    return qemuMonitorJSONCommandFull(mon, cmd, scm_fd, NULL, reply);
+}
+
+
 static int
 qemuMonitorJSONCommand(qemuMonitorPtr mon,
                        virJSONValuePtr cmd,
@@ -330,6 +386,99 @@ qemuMonitorJSONCommand(qemuMonitorPtr mon,
     return qemuMonitorJSONCommandWithFd(mon, cmd, -1, reply);
 }
 
+
+/**
+ * qemuMonitorJSONCommandBatch:
+ * @mon: monitor object
+ * @cmds: array of @ncmds commands
+ * @ncmds: number of commands in @cmds
+ * @replies: array of @ncmds pointers filled with the replies
+ *
+ * Writes all @cmds to the monitor at once without waiting for the reply
+ * to each of them in turn and collects the replies, which are matched
+ * to the commands by their id. It's up to the caller to check each of
+ * the replies for errors and to free them.
+ *
+ * Returns 0 once all replies were received, -1 on error.
+ */
+static int
+qemuMonitorJSONCommandBatch(qemuMonitorPtr mon,
+                            virJSONValuePtr *cmds,
+                            size_t ncmds,
+                            virJSONValuePtr *replies)
+{
+    int ret = -1;
+    qemuMonitorMessage msg;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
+    size_t i;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(replies, 0, sizeof(*replies) * ncmds);
+
+    if (VIR_ALLOC_N(msg.rxIds, ncmds) < 0 ||
+        VIR_ALLOC_N(msg.rxObjects, ncmds) < 0)
+        goto cleanup;
+    msg.nrxObjects = ncmds;
+
+    for (i = 0; i < ncmds; i++) {
+        if (!(msg.rxIds[i] = qemuMonitorNextCommandID(mon)))
+            goto cleanup;
+        if (virJSONValueObjectAppendString(cmds[i], "id", msg.rxIds[i]) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to append command 'id' string"));
+            goto cleanup;
+        }
+
+        virJSONWriterInit(&writer, &buf);
+        virJSONWriterValue(&writer, cmds[i]);
+        if (virJSONWriterFinish(&writer) < 0)
+            goto cleanup;
+        virBufferAddLit(&buf, "\r\n");
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Queue commands '%s' in batch", virBufferCurrentContent(&buf));
+
+    msg.txLength = virBufferUse(&buf);
+    msg.txBuffer = virBufferContentAndReset(&buf);
+    msg.txFD = -1;
+
+    VIR_DEBUG("Send batch of %zu commands", ncmds);
+
+    if (qemuMonitorSend(mon, &msg) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Received %zu replies to batch of %zu commands",
+              msg.nrxReceived, ncmds);
+
+    if (msg.nrxReceived != ncmds) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing monitor reply object"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < ncmds; i++) {
+        replies[i] = msg.rxObjects[i];
+        msg.rxObjects[i] = NULL;
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < msg.nrxObjects; i++) {
+        VIR_FREE(msg.rxIds[i]);
+        virJSONValueFree(msg.rxObjects[i]);
+    }
+    VIR_FREE(msg.rxIds);
+    VIR_FREE(msg.rxObjects);
+    VIR_FREE(msg.txBuffer);
+    virBufferFreeAndReset(&buf);
+    return ret;
+}
+
 /* Ignoring OOM in this method, since we're already reporting
  * a more important error
  *
@@ -364,13 +513,14 @@ qemuMonitorJSONCommandName(virJSONValuePtr cmd)
         return "<unknown>";
 }
 
+/* @cmdstr is the formatted command, only used for logging */
 static int
-qemuMonitorJSONCheckError(virJSONValuePtr cmd,
+qemuMonitorJSONCheckReply(const char *cmdname,
+                          const char *cmdstr,
                           virJSONValuePtr reply)
 {
     if (virJSONValueObjectHasKey(reply, "error")) {
         virJSONValuePtr error = virJSONValueObjectGet(reply, "error");
-        char *cmdstr = virJSONValueToString(cmd, false);
         char *replystr = virJSONValueToString(reply, false);
 
         /* Log the full JSON formatted command & error */
@@ -381,32 +531,137 @@ qemuMonitorJSONCheckError(virJSONValuePtr cmd,
         if (!error)
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("unable to execute QEMU command '%s'"),
-                           qemuMonitorJSONCommandName(cmd));
+                           cmdname);
         else
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("unable to execute QEMU command '%s': %s"),
-                           qemuMonitorJSONCommandName(cmd),
+                           cmdname,
                            qemuMonitorJSONStringifyError(error));
 
-        VIR_FREE(cmdstr);
         VIR_FREE(replystr);
         return -1;
     } else if (!virJSONValueObjectHasKey(reply, "return")) {
-        char *cmdstr = virJSONValueToString(cmd, false);
         char *replystr = virJSONValueToString(reply, false);
 
         VIR_DEBUG("Neither 'return' nor 'error' is set in the JSON reply %s: %s",
                   NULLSTR(cmdstr), NULLSTR(replystr));
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("unable to execute QEMU command '%s'"),
-                       qemuMonitorJSONCommandName(cmd));
-        VIR_FREE(cmdstr);
+                       cmdname);
         VIR_FREE(replystr);
         return -1;
     }
     return 0;
 }
 
+static int
+qemuMonitorJSONCheckError(virJSONValuePtr cmd,
+                          virJSONValuePtr reply)
+{
+    char *cmdstr;
+    int ret;
+
+    /* The command is only formatted again for logging a failure */
+    if (virJSONValueObjectHasKey(reply, "error") == 0 &&
+        virJSONValueObjectHasKey(reply, "return") == 1)
+        return 0;
+
+    cmdstr = virJSONValueToString(cmd, false);
+    ret = qemuMonitorJSONCheckReply(qemuMonitorJSONCommandName(cmd),
+                                    cmdstr, reply);
+    VIR_FREE(cmdstr);
+    return ret;
+}
+
+
+/**
+ * qemuMonitorJSONWriterCommandStart:
+ * @writer: the writer to initialize
+ * @buf: buffer to write the command into
+ * @cmdname: name of the QMP command
+ *
+ * Starts writing the command @cmdname straight into @buf, without
+ * building a virJSONValue tree for it. The caller then writes the
+ * members of the "arguments" of the command to @writer and passes it
+ * to qemuMonitorJSONWriterCommandRun.
+ */
+static void
+qemuMonitorJSONWriterCommandStart(virJSONWriterPtr writer,
+                                  virBufferPtr buf,
+                                  const char *cmdname)
+{
+    virJSONWriterInit(writer, buf);
+    virJSONWriterObjectStart(writer);
+    virJSONWriterObjectAppendString(writer, "execute", cmdname);
+    virJSONWriterKey(writer, "arguments");
+    virJSONWriterObjectStart(writer);
+}
+
+
+/**
+ * qemuMonitorJSONWriterCommandRun:
+ * @mon: monitor object
+ * @writer: the writer passed to qemuMonitorJSONWriterCommandStart
+ * @cmdname: name of the QMP command
+ *
+ * Completes the command written to @writer, whose buffer then becomes
+ * the outgoing message as it is, sends it and checks the reply for
+ * errors. The buffer is emptied in any case.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuMonitorJSONWriterCommandRun(qemuMonitorPtr mon,
+                                virJSONWriterPtr writer,
+                                const char *cmdname)
+{
+    int ret = -1;
+    qemuMonitorMessage msg;
+    char *id = NULL;
+
+    memset(&msg, 0, sizeof(msg));
+
+    if (!(id = qemuMonitorNextCommandID(mon)))
+        goto cleanup;
+
+    virJSONWriterObjectEnd(writer);
+    virJSONWriterObjectAppendString(writer, "id", id);
+    virJSONWriterObjectEnd(writer);
+    if (virJSONWriterFinish(writer) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Send command '%s' for write",
+              virBufferCurrentContent(writer->buf));
+
+    virBufferAddLit(writer->buf, "\r\n");
+    if (virBufferCheckError(writer->buf) < 0)
+        goto cleanup;
+    msg.txLength = virBufferUse(writer->buf);
+    msg.txBuffer = virBufferContentAndReset(writer->buf);
+    msg.txFD = -1;
+    msg.cmdName = cmdname;
+
+    if (qemuMonitorSend(mon, &msg) < 0)
+        goto cleanup;
+
+    if (!msg.rxObject) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing monitor reply object"));
+        goto cleanup;
+    }
+
+    /* The message is sent, reuse it for logging its failure */
+    msg.txBuffer[msg.txLength - 2] = '\0';
+    ret = qemuMonitorJSONCheckReply(cmdname, msg.txBuffer, msg.rxObject);
+
+ cleanup:
+    virJSONValueFree(msg.rxObject);
+    VIR_FREE(msg.txBuffer);
+    VIR_FREE(id);
+    virBufferFreeAndReset(writer->buf);
+    return ret;
+}
+
 
 static bool
 qemuMonitorJSONErrorIsClass(virJSONValuePtr error,
@@ -480,46 +735,55 @@ qemuFreeKeywords(int nkeywords, char **keywords, char **values)
     VIR_FREE(values);
 }
 
-static virJSONValuePtr
-qemuMonitorJSONKeywordStringToJSON(const char *str, const char *firstkeyword)
+/* Writes the keywords of @str as members of the current object of
+ * @writer, the leading value without a keyword as @firstkeyword */
+static int
+qemuMonitorJSONWriteKeywordString(virJSONWriterPtr writer,
+                                  const char *str,
+                                  const char *firstkeyword)
 {
-    virJSONValuePtr ret = NULL;
+    int ret = -1;
     char **keywords = NULL;
     char **values = NULL;
     int nkeywords = 0;
     size_t i;
-
-    if (!(ret = virJSONValueNewObject()))
-        return NULL;
+    size_t j;
 
     if (qemuParseKeywords(str, &keywords, &values, &nkeywords, 1) < 0)
-        goto error;
+        return -1;
 
     for (i = 0; i < nkeywords; i++) {
         if (values[i] == NULL) {
             if (i != 0) {
                 virReportError(VIR_ERR_INTERNAL_ERROR,
                                _("unexpected empty keyword in %s"), str);
-                goto error;
-            } else {
-                /* This 3rd arg isn't a typo - the way the parser works is
-                 * that the value ended up in the keyword field */
-                if (virJSONValueObjectAppendString(ret, firstkeyword, keywords[i]) < 0)
-                    goto error;
+                goto cleanup;
+            }
+
+            /* This 3rd arg isn't a typo - the way the parser works is
+             * that the value ended up in the keyword field */
+            virJSONWriterObjectAppendString(writer, firstkeyword, keywords[i]);
+            continue;
+        }
+
+        for (j = 0; j < i; j++) {
+            if (STREQ(keywords[i], j == 0 && !values[j] ? firstkeyword :
+                                                          keywords[j])) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("duplicate keyword '%s' in %s"),
+                               keywords[i], str);
+                goto cleanup;
             }
-        } else {
-            if (virJSONValueObjectAppendString(ret, keywords[i], values[i]) < 0)
-                goto error;
         }
+
+        virJSONWriterObjectAppendString(writer, keywords[i], values[i]);
     }
 
-    qemuFreeKeywords(nkeywords, keywords, values);
-    return ret;
+    ret = 0;
 
- error:
+ cleanup:
     qemuFreeKeywords(nkeywords, keywords, values);
-    virJSONValueFree(ret);
-    return NULL;
+    return ret;
 }
 
 
@@ -857,7 +1121,9 @@ qemuMonitorJSONHandleBlockJobImpl(qemuMonitorPtr mon,
     const char *device;
     const char *type_str;
     int type = VIR_DOMAIN_BLOCK_JOB_TYPE_UNKNOWN;
-    unsigned long long offset, len;
+    unsigned long long offset, len, speed;
+    qemuMonitorBlockJobInfo info;
+    qemuMonitorBlockJobInfoPtr infop = NULL;
 
     if ((device = virJSONValueObjectGetString(data, "device")) == NULL) {
         VIR_WARN("missing device in block job event");
@@ -885,6 +1151,8 @@ qemuMonitorJSONHandleBlockJobImpl(qemuMonitorPtr mon,
         type = VIR_DOMAIN_BLOCK_JOB_TYPE_COMMIT;
     else if (STREQ(type_str, "mirror"))
         type = VIR_DOMAIN_BLOCK_JOB_TYPE_COPY;
+    else if (STREQ(type_str, "backup"))
+        type = VIR_DOMAIN_BLOCK_JOB_TYPE_BACKUP;
 
     switch ((virConnectDomainEventBlockJobStatus) event) {
     case VIR_DOMAIN_BLOCK_JOB_COMPLETED:
@@ -901,8 +1169,19 @@ qemuMonitorJSONHandleBlockJobImpl(qemuMonitorPtr mon,
         break;
     }
 
+    /* Older qemu doesn't report the speed */
+    if (virJSONValueObjectGetNumberUlong(data, "speed", &speed) == 0) {
+        memset(&info, 0, sizeof(info));
+        info.type = type;
+        info.bandwidth = speed;
+        info.cur = offset;
+        info.end = len;
+        info.ready = event == VIR_DOMAIN_BLOCK_JOB_READY;
+        infop = &info;
+    }
+
  out:
-    qemuMonitorEmitBlockJob(mon, device, type, event);
+    qemuMonitorEmitBlockJob(mon, device, type, event, infop);
 }
 
 static void
@@ -1393,6 +1672,7 @@ int qemuMonitorJSONSystemReset(qemuMonitorPtr mon)
 
 
 /*
+ * query-cpus:
  *
  * [{ "arch": "x86",
  *    "current": true,
@@ -1403,11 +1683,24 @@ int qemuMonitorJSONSystemReset(qemuMonitorPtr mon)
  *    "thread_id": 2631237},
  *    {...}
  *  ]
+ *
+ * query-cpus-fast, which doesn't interrupt the vcpus and hence can't
+ * report whether they are halted, except on s390 where the state is
+ * tracked by qemu itself:
+ *
+ * [{ "arch": "x86",
+ *    "cpu-index": 0,
+ *    "qom-path": "/machine/unattached/device[0]",
+ *    "props": {...},
+ *    "thread-id": 2631237},
+ *    {...}
+ *  ]
  */
 static int
 qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
                               struct qemuMonitorQueryCpusEntry **entries,
-                              size_t *nentries)
+                              size_t *nentries,
+                              bool fast)
 {
     struct qemuMonitorQueryCpusEntry *cpus = NULL;
     int ret = -1;
@@ -1433,10 +1726,19 @@ qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
 
         /* Some older qemu versions don't report the thread_id so treat this as
          * non-fatal, simply returning no data */
-        ignore_value(virJSONValueObjectGetNumberInt(entry, "CPU", &cpuid));
-        ignore_value(virJSONValueObjectGetNumberInt(entry, "thread_id", &thread));
-        ignore_value(virJSONValueObjectGetBoolean(entry, "halted", &halted));
-        qom_path = virJSONValueObjectGetString(entry, "qom_path");
+        if (fast) {
+            const char *state = virJSONValueObjectGetString(entry, "cpu-state");
+
+            ignore_value(virJSONValueObjectGetNumberInt(entry, "cpu-index", &cpuid));
+            ignore_value(virJSONValueObjectGetNumberInt(entry, "thread-id", &thread));
+            halted = STREQ_NULLABLE(state, "stopped");
+            qom_path = virJSONValueObjectGetString(entry, "qom-path");
+        } else {
+            ignore_value(virJSONValueObjectGetNumberInt(entry, "CPU", &cpuid));
+            ignore_value(virJSONValueObjectGetNumberInt(entry, "thread_id", &thread));
+            ignore_value(virJSONValueObjectGetBoolean(entry, "halted", &halted));
+            qom_path = virJSONValueObjectGetString(entry, "qom_path");
+        }
 
         cpus[i].qemu_id = cpuid;
         cpus[i].tid = thread;
@@ -1461,11 +1763,16 @@ qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
  * @mon: monitor object
  * @entries: filled with detected entries on success
  * @nentries: number of entries returned
+ * @force: report an error if the command fails
+ * @fast: use query-cpus-fast instead of query-cpus
  *
  * Queries qemu for cpu-related information. Failure to execute the command or
  * extract results does not produce an error as libvirt can continue without
  * this information.
  *
+ * query-cpus interrupts every vcpu to collect its state, which guests with
+ * many vcpus notice; query-cpus-fast only reports what qemu already knows.
+ *
  * Returns 0 on success, -1 on a fatal error (oom ...) and -2 if the
  * query failed gracefully.
  */
@@ -1473,13 +1780,19 @@ int
 qemuMonitorJSONQueryCPUs(qemuMonitorPtr mon,
                          struct qemuMonitorQueryCpusEntry **entries,
                          size_t *nentries,
-                         bool force)
+                         bool force,
+                         bool fast)
 {
     int ret = -1;
-    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-cpus", NULL);
+    virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
     virJSONValuePtr data;
 
+    if (fast)
+        cmd = qemuMonitorJSONMakeCommand("query-cpus-fast", NULL);
+    else
+        cmd = qemuMonitorJSONMakeCommand("query-cpus", NULL);
+
     if (!cmd)
         return -1;
 
@@ -1494,7 +1807,7 @@ qemuMonitorJSONQueryCPUs(qemuMonitorPtr mon,
         goto cleanup;
     }
 
-    ret = qemuMonitorJSONExtractCPUInfo(data, entries, nentries);
+    ret = qemuMonitorJSONExtractCPUInfo(data, entries, nentries, fast);
 
  cleanup:
     virJSONValueFree(cmd);
@@ -1655,46 +1968,57 @@ qemuMonitorJSONUpdateVideoVram64Size(qemuMonitorPtr mon,
 }
 
 
-int
-qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
-                              unsigned long long *currmem)
+static int
+qemuMonitorJSONGetBalloonInfoReply(virJSONValuePtr cmd,
+                                   virJSONValuePtr reply,
+                                   unsigned long long *currmem)
 {
-    int ret = -1;
     virJSONValuePtr data;
     unsigned long long mem;
-    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-balloon",
-                                                     NULL);
-    virJSONValuePtr reply = NULL;
 
     *currmem = 0;
 
-    if (!cmd)
-        return -1;
-
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
-        goto cleanup;
-
     /* See if balloon soft-failed */
     if (qemuMonitorJSONHasError(reply, "DeviceNotActive") ||
-        qemuMonitorJSONHasError(reply, "KVMMissingCap")) {
-        ret = 0;
-        goto cleanup;
-    }
+        qemuMonitorJSONHasError(reply, "KVMMissingCap"))
+        return 0;
 
     /* See if any other fatal error occurred */
     if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
+        return -1;
 
     data = virJSONValueObjectGetObject(reply, "return");
 
     if (virJSONValueObjectGetNumberUlong(data, "actual", &mem) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("info balloon reply was missing balloon data"));
-        goto cleanup;
+        return -1;
     }
 
     *currmem = (mem/1024);
-    ret = 1;
+    return 1;
+}
+
+
+int
+qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
+                              unsigned long long *currmem)
+{
+    int ret = -1;
+    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-balloon",
+                                                     NULL);
+    virJSONValuePtr reply = NULL;
+
+    *currmem = 0;
+
+    if (!cmd)
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    ret = qemuMonitorJSONGetBalloonInfoReply(cmd, reply, currmem);
+
  cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
@@ -1723,6 +2047,27 @@ qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
  * rates and/or whether data has been collected since a previous cycle.
  * It's currently unused.
  */
+/* Only the current balloon size is available without the balloon path */
+static int
+qemuMonitorJSONGetActualBalloon(qemuMonitorPtr mon,
+                                virDomainMemoryStatPtr stats,
+                                unsigned int nr_stats)
+{
+    unsigned long long mem;
+    int rc;
+
+    if ((rc = qemuMonitorJSONGetBalloonInfo(mon, &mem)) < 0)
+        return -1;
+
+    if (rc == 0 || nr_stats == 0)
+        return 0;
+
+    stats[0].tag = VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON;
+    stats[0].val = mem;
+    return 1;
+}
+
+
 #define GET_BALLOON_STATS(OBJECT, FIELD, TAG, DIVISOR)                        \
     if (virJSONValueObjectHasKey(OBJECT, FIELD) &&                            \
        (got < nr_stats)) {                                                    \
@@ -1745,32 +2090,41 @@ int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
                                   unsigned int nr_stats)
 {
     int ret = -1;
-    virJSONValuePtr cmd = NULL;
-    virJSONValuePtr reply = NULL;
+    virJSONValuePtr cmds[2] = { NULL, NULL };
+    virJSONValuePtr replies[2] = { NULL, NULL };
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply;
     virJSONValuePtr data;
     virJSONValuePtr statsdata;
     unsigned long long mem;
     int got = 0;
-
-    ret = qemuMonitorJSONGetBalloonInfo(mon, &mem);
-    if (ret == 1 && (got < nr_stats)) {
-        stats[got].tag = VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON;
-        stats[got].val = mem;
-        got++;
-    }
+    size_t i;
 
     if (!balloonpath)
-        goto cleanup;
+        return qemuMonitorJSONGetActualBalloon(mon, stats, nr_stats);
 
-    if (!(cmd = qemuMonitorJSONMakeCommand("qom-get",
-                                           "s:path", balloonpath,
-                                           "s:property", "guest-stats",
-                                           NULL)))
+    /* Both queries are independent, so send them in one round-trip */
+    if (!(cmds[0] = qemuMonitorJSONMakeCommand("query-balloon", NULL)) ||
+        !(cmds[1] = qemuMonitorJSONMakeCommand("qom-get",
+                                               "s:path", balloonpath,
+                                               "s:property", "guest-stats",
+                                               NULL)))
         goto cleanup;
 
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+    if (qemuMonitorJSONCommandBatch(mon, cmds, 2, replies) < 0)
         goto cleanup;
 
+    /* failure to get the actual balloon size is not fatal here */
+    if (qemuMonitorJSONGetBalloonInfoReply(cmds[0], replies[0], &mem) == 1 &&
+        got < nr_stats) {
+        stats[got].tag = VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON;
+        stats[got].val = mem;
+        got++;
+    }
+
+    cmd = cmds[1];
+    reply = replies[1];
+
     if ((data = virJSONValueObjectGetObject(reply, "error"))) {
         const char *klass = virJSONValueObjectGetString(data, "class");
         const char *desc = virJSONValueObjectGetString(data, "desc");
@@ -1811,8 +2165,10 @@ int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
                       VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE, 1);
     ret = got;
  cleanup:
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
+    for (i = 0; i < ARRAY_CARDINALITY(cmds); i++) {
+        virJSONValueFree(cmds[i]);
+        virJSONValueFree(replies[i]);
+    }
     return ret;
 }
 #undef GET_BALLOON_STATS
@@ -1842,25 +2198,48 @@ qemuMonitorJSONSetMemoryStatsPeriod(qemuMonitorPtr mon,
 }
 
 
+/* Drop the "image" part of the "inserted" medium of every device in a
+ * "query-block" reply. With long backing chains it makes up most of the
+ * reply while being useless to callers interested in the device state. */
+static bool
+qemuMonitorJSONQueryBlockFilterImage(const char *const *path,
+                                     size_t npath,
+                                     void *opaque ATTRIBUTE_UNUSED)
+{
+    return !(npath == 4 &&
+             STREQ_NULLABLE(path[0], "return") &&
+             !path[1] &&
+             STREQ_NULLABLE(path[2], "inserted") &&
+             STREQ(path[3], "image"));
+}
+
+
 /* qemuMonitorJSONQueryBlock:
  * @mon: Monitor pointer
+ * @images: whether the caller needs the backing chain of the media
  *
  * This helper will attempt to make a "query-block" call and check for
- * errors before returning with the reply.
+ * errors before returning with the reply. Unless @images is true the
+ * "image" member of "inserted" is not parsed at all.
  *
  * Returns: NULL on error, reply on success
  */
 static virJSONValuePtr
-qemuMonitorJSONQueryBlock(qemuMonitorPtr mon)
+qemuMonitorJSONQueryBlock(qemuMonitorPtr mon,
+                          bool images)
 {
     virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
     virJSONValuePtr devices = NULL;
+    virJSONValueFilter filter = NULL;
+
+    if (!images)
+        filter = qemuMonitorJSONQueryBlockFilterImage;
 
     if (!(cmd = qemuMonitorJSONMakeCommand("query-block", NULL)))
         return NULL;
 
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0 ||
+    if (qemuMonitorJSONCommandFull(mon, cmd, -1, filter, &reply) < 0 ||
         qemuMonitorJSONCheckError(cmd, reply) < 0)
         goto cleanup;
 
@@ -1915,7 +2294,7 @@ int qemuMonitorJSONGetBlockInfo(qemuMonitorPtr mon,
 
     virJSONValuePtr devices;
 
-    if (!(devices = qemuMonitorJSONQueryBlock(mon)))
+    if (!(devices = qemuMonitorJSONQueryBlock(mon, false)))
         return -1;
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
@@ -2055,32 +2434,24 @@ qemuMonitorJSONGetOneBlockStatsInfo(virJSONValuePtr dev,
 }
 
 
-int
-qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
-                                    virHashTablePtr hash,
-                                    bool backingChain)
+static int
+qemuMonitorJSONGetAllBlockStatsInfoReply(virJSONValuePtr cmd,
+                                         virJSONValuePtr reply,
+                                         virHashTablePtr hash,
+                                         bool backingChain)
 {
-    int ret = -1;
     int nstats = 0;
     int rc;
     size_t i;
-    virJSONValuePtr cmd;
-    virJSONValuePtr reply = NULL;
     virJSONValuePtr devices;
 
-    if (!(cmd = qemuMonitorJSONMakeCommand("query-blockstats", NULL)))
-        return -1;
-
-    if ((rc = qemuMonitorJSONCommand(mon, cmd, &reply)) < 0)
-        goto cleanup;
-
     if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
+        return -1;
 
     if (!(devices = virJSONValueObjectGetArray(reply, "return"))) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("blockstats reply was missing device list"));
-        goto cleanup;
+        return -1;
     }
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
@@ -2091,27 +2462,47 @@ qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("blockstats device entry was not "
                              "in expected format"));
-            goto cleanup;
+            return -1;
         }
 
         if (!(dev_name = virJSONValueObjectGetString(dev, "device"))) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("blockstats device entry was not "
                              "in expected format"));
-            goto cleanup;
+            return -1;
         }
 
         rc = qemuMonitorJSONGetOneBlockStatsInfo(dev, dev_name, 0, hash,
                                                  backingChain);
 
         if (rc < 0)
-            goto cleanup;
+            return -1;
 
         if (rc > nstats)
             nstats = rc;
     }
 
-    ret = nstats;
+    return nstats;
+}
+
+
+int
+qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                    virHashTablePtr hash,
+                                    bool backingChain)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("query-blockstats", NULL)))
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    ret = qemuMonitorJSONGetAllBlockStatsInfoReply(cmd, reply, hash,
+                                                   backingChain);
 
  cleanup:
     virJSONValueFree(cmd);
@@ -2169,17 +2560,12 @@ qemuMonitorJSONBlockStatsUpdateCapacityOne(virJSONValuePtr image,
 }
 
 
-int
-qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
-                                        virHashTablePtr stats,
-                                        bool backingChain)
+static int
+qemuMonitorJSONBlockStatsUpdateCapacityDevices(virJSONValuePtr devices,
+                                               virHashTablePtr stats,
+                                               bool backingChain)
 {
-    int ret = -1;
     size_t i;
-    virJSONValuePtr devices;
-
-    if (!(devices = qemuMonitorJSONQueryBlock(mon)))
-        return -1;
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
         virJSONValuePtr dev;
@@ -2188,10 +2574,10 @@ qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
         const char *dev_name;
 
         if (!(dev = qemuMonitorJSONGetBlockDev(devices, i)))
-            goto cleanup;
+            return -1;
 
         if (!(dev_name = qemuMonitorJSONGetBlockDevDevice(dev)))
-            goto cleanup;
+            return -1;
 
         /* drive may be empty */
         if (!(inserted = virJSONValueObjectGetObject(dev, "inserted")) ||
@@ -2201,17 +2587,84 @@ qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
         if (qemuMonitorJSONBlockStatsUpdateCapacityOne(image, dev_name, 0,
                                                        stats,
                                                        backingChain) < 0)
-            goto cleanup;
+            return -1;
     }
 
-    ret = 0;
+    return 0;
+}
+
+
+int
+qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
+                                        virHashTablePtr stats,
+                                        bool backingChain)
+{
+    int ret;
+    virJSONValuePtr devices;
+
+    if (!(devices = qemuMonitorJSONQueryBlock(mon, true)))
+        return -1;
+
+    ret = qemuMonitorJSONBlockStatsUpdateCapacityDevices(devices, stats,
+                                                         backingChain);
 
- cleanup:
     virJSONValueFree(devices);
     return ret;
 }
 
 
+/*
+ * Pipelines query-blockstats, query-block and optionally
+ * query-named-block-nodes. See qemuMonitorGetAllBlockStatsInfoBatch.
+ */
+int
+qemuMonitorJSONGetAllBlockStatsInfoBatch(qemuMonitorPtr mon,
+                                         virHashTablePtr hash,
+                                         bool backingChain,
+                                         virJSONValuePtr *nodedata)
+{
+    int ret = -1;
+    virJSONValuePtr cmds[3] = { NULL, NULL, NULL };
+    virJSONValuePtr replies[3] = { NULL, NULL, NULL };
+    virJSONValuePtr devices;
+    size_t ncmds = nodedata ? 3 : 2;
+    size_t i;
+
+    if (!(cmds[0] = qemuMonitorJSONMakeCommand("query-blockstats", NULL)) ||
+        !(cmds[1] = qemuMonitorJSONMakeCommand("query-block", NULL)) ||
+        (nodedata &&
+         !(cmds[2] = qemuMonitorJSONMakeCommand("query-named-block-nodes",
+                                                NULL))))
+        goto cleanup;
+
+    if (qemuMonitorJSONCommandBatch(mon, cmds, ncmds, replies) < 0)
+        goto cleanup;
+
+    if ((ret = qemuMonitorJSONGetAllBlockStatsInfoReply(cmds[0], replies[0],
+                                                        hash,
+                                                        backingChain)) < 0)
+        goto cleanup;
+
+    /* Missing capacity data is not fatal, the fields stay zeroed. */
+    if (qemuMonitorJSONCheckError(cmds[1], replies[1]) < 0 ||
+        !(devices = virJSONValueObjectGetArray(replies[1], "return")) ||
+        qemuMonitorJSONBlockStatsUpdateCapacityDevices(devices, hash,
+                                                       backingChain) < 0)
+        VIR_DEBUG("failed to update block capacity stats");
+
+    if (nodedata &&
+        qemuMonitorJSONCheckError(cmds[2], replies[2]) == 0)
+        *nodedata = virJSONValueObjectStealArray(replies[2], "return");
+
+ cleanup:
+    for (i = 0; i < ARRAY_CARDINALITY(cmds); i++) {
+        virJSONValueFree(cmds[i]);
+        virJSONValueFree(replies[i]);
+    }
+    return ret;
+}
+
+
 /* Return 0 on success, -1 on failure, or -2 if not supported.  Size
  * is in bytes.  */
 int qemuMonitorJSONBlockResize(qemuMonitorPtr mon,
@@ -2682,6 +3135,7 @@ qemuMonitorJSONGetMigrationParams(qemuMonitorPtr mon,
     PARSE(decompressThreads, "decompress-threads");
     PARSE(cpuThrottleInitial, "cpu-throttle-initial");
     PARSE(cpuThrottleIncrement, "cpu-throttle-increment");
+    PARSE(multifdChannels, "x-multifd-channels");
 
 #undef PARSE
 
@@ -2734,6 +3188,7 @@ qemuMonitorJSONSetMigrationParams(qemuMonitorPtr mon,
     APPEND(decompressThreads, "decompress-threads");
     APPEND(cpuThrottleInitial, "cpu-throttle-initial");
     APPEND(cpuThrottleIncrement, "cpu-throttle-increment");
+    APPEND(multifdChannels, "x-multifd-channels");
 
 #undef APPEND
 
@@ -3281,43 +3736,9 @@ qemuMonitorJSONRemoveFd(qemuMonitorPtr mon, int fdset, int fd)
                                                      "i:fdset-id", fdset,
                                                      fd < 0 ? NULL : "i:fd",
                                                      fd, NULL);
-    virJSONValuePtr reply = NULL;
-    if (!cmd)
-        return -1;
-
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
-        goto cleanup;
-
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
-
-    ret = 0;
- cleanup:
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
-    return ret;
-}
-
-
-int qemuMonitorJSONAddNetdev(qemuMonitorPtr mon,
-                             const char *netdevstr)
-{
-    int ret = -1;
-    virJSONValuePtr cmd = NULL;
-    virJSONValuePtr reply = NULL;
-    virJSONValuePtr args = NULL;
-
-    cmd = qemuMonitorJSONMakeCommand("netdev_add", NULL);
-    if (!cmd)
-        return -1;
-
-    args = qemuMonitorJSONKeywordStringToJSON(netdevstr, "type");
-    if (!args)
-        goto cleanup;
-
-    if (virJSONValueObjectAppend(cmd, "arguments", args) < 0)
-        goto cleanup;
-    args = NULL; /* obj owns reference to args now */
+    virJSONValuePtr reply = NULL;
+    if (!cmd)
+        return -1;
 
     if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
         goto cleanup;
@@ -3327,13 +3748,29 @@ int qemuMonitorJSONAddNetdev(qemuMonitorPtr mon,
 
     ret = 0;
  cleanup:
-    virJSONValueFree(args);
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
 }
 
 
+int qemuMonitorJSONAddNetdev(qemuMonitorPtr mon,
+                             const char *netdevstr)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
+
+    qemuMonitorJSONWriterCommandStart(&writer, &buf, "netdev_add");
+
+    if (qemuMonitorJSONWriteKeywordString(&writer, netdevstr, "type") < 0) {
+        virBufferFreeAndReset(&buf);
+        return -1;
+    }
+
+    return qemuMonitorJSONWriterCommandRun(mon, &writer, "netdev_add");
+}
+
+
 int qemuMonitorJSONRemoveNetdev(qemuMonitorPtr mon,
                                 const char *alias)
 {
@@ -3707,33 +4144,34 @@ int qemuMonitorJSONDelDevice(qemuMonitorPtr mon,
 }
 
 
-int
-qemuMonitorJSONAddDeviceArgs(qemuMonitorPtr mon,
-                             virJSONValuePtr args)
+/* Writes the members of the object @args as the arguments of the
+ * command started with qemuMonitorJSONWriterCommandStart */
+static void
+qemuMonitorJSONWriteArguments(virJSONWriterPtr writer,
+                              virJSONValuePtr args)
 {
-    int ret = -1;
-    virJSONValuePtr cmd = NULL;
-    virJSONValuePtr reply = NULL;
-
-    if (!(cmd = qemuMonitorJSONMakeCommand("device_add", NULL)))
-        goto cleanup;
+    size_t n = virJSONValueObjectKeysNumber(args);
+    size_t i;
 
-    if (virJSONValueObjectAppend(cmd, "arguments", args) < 0)
-        goto cleanup;
-    args = NULL; /* obj owns reference to args now */
+    for (i = 0; i < n; i++)
+        virJSONWriterObjectAppend(writer,
+                                  virJSONValueObjectGetKey(args, i),
+                                  virJSONValueObjectGetValue(args, i));
+}
 
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
-        goto cleanup;
 
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
+int
+qemuMonitorJSONAddDeviceArgs(qemuMonitorPtr mon,
+                             virJSONValuePtr args)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
 
-    ret = 0;
- cleanup:
+    qemuMonitorJSONWriterCommandStart(&writer, &buf, "device_add");
+    qemuMonitorJSONWriteArguments(&writer, args);
     virJSONValueFree(args);
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
-    return ret;
+
+    return qemuMonitorJSONWriterCommandRun(mon, &writer, "device_add");
 }
 
 
@@ -3741,12 +4179,17 @@ int
 qemuMonitorJSONAddDevice(qemuMonitorPtr mon,
                          const char *devicestr)
 {
-    virJSONValuePtr args;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
 
-    if (!(args = qemuMonitorJSONKeywordStringToJSON(devicestr, "driver")))
+    qemuMonitorJSONWriterCommandStart(&writer, &buf, "device_add");
+
+    if (qemuMonitorJSONWriteKeywordString(&writer, devicestr, "driver") < 0) {
+        virBufferFreeAndReset(&buf);
         return -1;
+    }
 
-    return qemuMonitorJSONAddDeviceArgs(mon, args);
+    return qemuMonitorJSONWriterCommandRun(mon, &writer, "device_add");
 }
 
 
@@ -3755,33 +4198,18 @@ int qemuMonitorJSONAddObject(qemuMonitorPtr mon,
                              const char *objalias,
                              virJSONValuePtr props)
 {
-    int ret = -1;
-    virJSONValuePtr cmd;
-    virJSONValuePtr reply = NULL;
-
-    cmd = qemuMonitorJSONMakeCommand("object-add",
-                                     "s:qom-type", type,
-                                     "s:id", objalias,
-                                     "A:props", props,
-                                     NULL);
-    if (!cmd)
-        goto cleanup;
-
-    /* @props is part of @cmd now. Avoid double free */
-    props = NULL;
-
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
-        goto cleanup;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
 
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
+    qemuMonitorJSONWriterCommandStart(&writer, &buf, "object-add");
+    virJSONWriterObjectAppendString(&writer, "qom-type", type);
+    virJSONWriterObjectAppendString(&writer, "id", objalias);
+    if (props) {
+        virJSONWriterObjectAppend(&writer, "props", props);
+        virJSONValueFree(props);
+    }
 
-    ret = 0;
- cleanup:
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
-    virJSONValueFree(props);
-    return ret;
+    return qemuMonitorJSONWriterCommandRun(mon, &writer, "object-add");
 }
 
 
@@ -3939,36 +4367,180 @@ qemuMonitorJSONDriveMirror(qemuMonitorPtr mon,
     return ret;
 }
 
-int
-qemuMonitorJSONTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
+/* Either append @cmd to the transaction @actions, or run it right away
+ * if @actions is NULL. @cmd is consumed in both cases. */
+static int
+qemuMonitorJSONActionCommand(qemuMonitorPtr mon,
+                             virJSONValuePtr actions,
+                             virJSONValuePtr cmd)
 {
     int ret = -1;
-    virJSONValuePtr cmd;
     virJSONValuePtr reply = NULL;
-    bool protect = actions->protect;
 
-    /* We do NOT want to free actions when recursively freeing cmd.  */
-    actions->protect = true;
-    cmd = qemuMonitorJSONMakeCommand("transaction",
-                                     "a:actions", actions,
-                                     NULL);
+    if (actions) {
+        if (virJSONValueArrayAppend(actions, cmd) == 0) {
+            ret = 0;
+            cmd = NULL;
+        }
+    } else {
+        if ((ret = qemuMonitorJSONCommand(mon, cmd, &reply)) < 0)
+            goto cleanup;
+
+        ret = qemuMonitorJSONCheckError(cmd, reply);
+    }
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+int
+qemuMonitorJSONBlockDirtyBitmapAdd(qemuMonitorPtr mon,
+                                   virJSONValuePtr actions,
+                                   const char *device,
+                                   const char *name,
+                                   bool persistent)
+{
+    virJSONValuePtr cmd;
+
+    cmd = qemuMonitorJSONMakeCommandRaw(actions != NULL,
+                                        "block-dirty-bitmap-add",
+                                        "s:node", device,
+                                        "s:name", name,
+                                        "B:persistent", persistent,
+                                        NULL);
     if (!cmd)
-        goto cleanup;
+        return -1;
 
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
-        goto cleanup;
+    return qemuMonitorJSONActionCommand(mon, actions, cmd);
+}
 
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+
+int
+qemuMonitorJSONBlockDirtyBitmapClear(qemuMonitorPtr mon,
+                                     virJSONValuePtr actions,
+                                     const char *device,
+                                     const char *name)
+{
+    virJSONValuePtr cmd;
+
+    cmd = qemuMonitorJSONMakeCommandRaw(actions != NULL,
+                                        "block-dirty-bitmap-clear",
+                                        "s:node", device,
+                                        "s:name", name,
+                                        NULL);
+    if (!cmd)
+        return -1;
+
+    return qemuMonitorJSONActionCommand(mon, actions, cmd);
+}
+
+
+/* speed is in bytes/sec */
+int
+qemuMonitorJSONDriveBackup(qemuMonitorPtr mon,
+                           virJSONValuePtr actions,
+                           const char *device,
+                           const char *file,
+                           const char *format,
+                           const char *bitmap,
+                           unsigned long long speed,
+                           bool reuse)
+{
+    virJSONValuePtr cmd;
+
+    cmd = qemuMonitorJSONMakeCommandRaw(actions != NULL,
+                                        "drive-backup",
+                                        "s:device", device,
+                                        "s:target", file,
+                                        "S:format", format,
+                                        "s:sync", bitmap ? "incremental" : "full",
+                                        "S:bitmap", bitmap,
+                                        "P:speed", speed,
+                                        "S:mode", reuse ? "existing" : NULL,
+                                        NULL);
+    if (!cmd)
+        return -1;
+
+    return qemuMonitorJSONActionCommand(mon, actions, cmd);
+}
+
+
+/**
+ * qemuMonitorJSONBlockDirtyBitmapExists:
+ * @mon: monitor object
+ * @device: drive alias of the disk
+ * @name: name of the dirty bitmap
+ *
+ * Returns 1 if a dirty bitmap called @name is attached to @device, 0 if
+ * it is not and -1 on error.
+ */
+int
+qemuMonitorJSONBlockDirtyBitmapExists(qemuMonitorPtr mon,
+                                      const char *device,
+                                      const char *name)
+{
+    int ret = -1;
+    virJSONValuePtr devices;
+    virJSONValuePtr bitmaps;
+    size_t i;
+    size_t j;
+
+    if (!(devices = qemuMonitorJSONQueryBlock(mon, false)))
+        return -1;
+
+    for (i = 0; i < virJSONValueArraySize(devices); i++) {
+        virJSONValuePtr dev;
+        const char *thisdev;
+
+        if (!(dev = qemuMonitorJSONGetBlockDev(devices, i)) ||
+            !(thisdev = qemuMonitorJSONGetBlockDevDevice(dev)))
+            goto cleanup;
+
+        if (STRNEQ(thisdev, device))
+            continue;
+
+        ret = 0;
+        if (!(bitmaps = virJSONValueObjectGetArray(dev, "dirty-bitmaps")))
+            goto cleanup;
+
+        for (j = 0; j < virJSONValueArraySize(bitmaps); j++) {
+            virJSONValuePtr bitmap = virJSONValueArrayGet(bitmaps, j);
+            const char *thisname;
+
+            if ((thisname = virJSONValueObjectGetString(bitmap, "name")) &&
+                STREQ(thisname, name)) {
+                ret = 1;
+                break;
+            }
+        }
         goto cleanup;
+    }
+
+    virReportError(VIR_ERR_INTERNAL_ERROR,
+                   _("cannot find info for device '%s'"), device);
 
-    ret = 0;
  cleanup:
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
-    actions->protect = protect;
+    virJSONValueFree(devices);
     return ret;
 }
 
+
+int
+qemuMonitorJSONTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
+
+    /* @actions stays owned by the caller */
+    qemuMonitorJSONWriterCommandStart(&writer, &buf, "transaction");
+    virJSONWriterObjectAppend(&writer, "actions", actions);
+
+    return qemuMonitorJSONWriterCommandRun(mon, &writer, "transaction");
+}
+
 /* speed is in bytes/sec. Returns 0 on success, -1 with error message
  * emitted on failure.
  *
@@ -4098,7 +4670,7 @@ qemuMonitorJSONDiskNameLookup(qemuMonitorPtr mon,
     virJSONValuePtr devices;
     size_t i;
 
-    if (!(devices = qemuMonitorJSONQueryBlock(mon)))
+    if (!(devices = qemuMonitorJSONQueryBlock(mon, true)))
         return NULL;
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
@@ -4330,6 +4902,8 @@ qemuMonitorJSONParseBlockJobInfo(virHashTablePtr blockJobs,
         info->type = VIR_DOMAIN_BLOCK_JOB_TYPE_COMMIT;
     else if (STREQ(type, "mirror"))
         info->type = VIR_DOMAIN_BLOCK_JOB_TYPE_COPY;
+    else if (STREQ(type, "backup"))
+        info->type = VIR_DOMAIN_BLOCK_JOB_TYPE_BACKUP;
     else
         info->type = VIR_DOMAIN_BLOCK_JOB_TYPE_UNKNOWN;
 
@@ -7649,3 +8223,116 @@ qemuMonitorJSONQueryNamedBlockNodes(qemuMonitorPtr mon)
 
     return ret;
 }
+
+
+int
+qemuMonitorJSONStartDirtyRateCalc(qemuMonitorPtr mon,
+                                  int seconds)
+{
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+    int ret = -1;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("calc-dirty-rate",
+                                           "i:calc-time", seconds,
+                                           NULL)))
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+
+    return ret;
+}
+
+
+VIR_ENUM_DECL(qemuMonitorDirtyRateStatus)
+VIR_ENUM_IMPL(qemuMonitorDirtyRateStatus,
+              VIR_DOMAIN_DIRTYRATE_LAST,
+              "unstarted",
+              "measuring",
+              "measured")
+
+static int
+qemuMonitorJSONExtractDirtyRateInfo(virJSONValuePtr data,
+                                    qemuMonitorDirtyRateInfoPtr info)
+{
+    const char *statusstr;
+    int status;
+
+    if (!(statusstr = virJSONValueObjectGetString(data, "status"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-dirty-rate reply was missing 'status' data"));
+        return -1;
+    }
+
+    if ((status = qemuMonitorDirtyRateStatusTypeFromString(statusstr)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unknown dirty rate status: %s"), statusstr);
+        return -1;
+    }
+    info->status = status;
+
+    if (virJSONValueObjectGetNumberLong(data, "start-time",
+                                        &info->startTime) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-dirty-rate reply was missing 'start-time' data"));
+        return -1;
+    }
+
+    if (virJSONValueObjectGetNumberInt(data, "calc-time",
+                                       &info->calcTime) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-dirty-rate reply was missing 'calc-time' data"));
+        return -1;
+    }
+
+    /* the rate is reported only once the calculation is done */
+    if (virJSONValueObjectGetNumberLong(data, "dirty-rate",
+                                        &info->dirtyRate) < 0)
+        info->dirtyRate = -1;
+
+    return 0;
+}
+
+
+int
+qemuMonitorJSONQueryDirtyRate(qemuMonitorPtr mon,
+                              qemuMonitorDirtyRateInfoPtr info)
+{
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr data = NULL;
+    int ret = -1;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("query-dirty-rate", NULL)))
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        goto cleanup;
+
+    if (!(data = virJSONValueObjectGetObject(reply, "return"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-dirty-rate reply was missing 'return' data"));
+        goto cleanup;
+    }
+
+    ret = qemuMonitorJSONExtractDirtyRateInfo(data, info);
+
+ cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+
+    return ret;
+}
@@ -61,7 +61,8 @@ int qemuMonitorJSONSystemReset(qemuMonitorPtr mon);
 int qemuMonitorJSONQueryCPUs(qemuMonitorPtr mon,
                              struct qemuMonitorQueryCpusEntry **entries,
                              size_t *nentries,
-                             bool force);
+                             bool force,
+                             bool fast);
 int qemuMonitorJSONGetVirtType(qemuMonitorPtr mon,
                                virDomainVirtType *virtType);
 int qemuMonitorJSONUpdateVideoMemorySize(qemuMonitorPtr mon,
@@ -87,6 +88,10 @@ int qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
 int qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
                                             virHashTablePtr stats,
                                             bool backingChain);
+int qemuMonitorJSONGetAllBlockStatsInfoBatch(qemuMonitorPtr mon,
+                                             virHashTablePtr hash,
+                                             bool backingChain,
+                                             virJSONValuePtr *nodedata);
 int qemuMonitorJSONBlockResize(qemuMonitorPtr mon,
                                const char *devce,
                                unsigned long long size);
@@ -249,6 +254,30 @@ int qemuMonitorJSONDiskSnapshot(qemuMonitorPtr mon,
                                 bool reuse)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3)
     ATTRIBUTE_NONNULL(4) ATTRIBUTE_NONNULL(5);
+int qemuMonitorJSONBlockDirtyBitmapAdd(qemuMonitorPtr mon,
+                                       virJSONValuePtr actions,
+                                       const char *device,
+                                       const char *name,
+                                       bool persistent)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+int qemuMonitorJSONBlockDirtyBitmapClear(qemuMonitorPtr mon,
+                                         virJSONValuePtr actions,
+                                         const char *device,
+                                         const char *name)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+int qemuMonitorJSONBlockDirtyBitmapExists(qemuMonitorPtr mon,
+                                          const char *device,
+                                          const char *name)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+int qemuMonitorJSONDriveBackup(qemuMonitorPtr mon,
+                               virJSONValuePtr actions,
+                               const char *device,
+                               const char *file,
+                               const char *format,
+                               const char *bitmap,
+                               unsigned long long speed,
+                               bool reuse)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
 int qemuMonitorJSONTransaction(qemuMonitorPtr mon, virJSONValuePtr actions)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 int qemuMonitorJSONDriveMirror(qemuMonitorPtr mon,
@@ -522,4 +551,12 @@ int qemuMonitorJSONSetBlockThreshold(qemuMonitorPtr mon,
 virJSONValuePtr qemuMonitorJSONQueryNamedBlockNodes(qemuMonitorPtr mon)
     ATTRIBUTE_NONNULL(1);
 
+int qemuMonitorJSONStartDirtyRateCalc(qemuMonitorPtr mon,
+                                      int seconds)
+    ATTRIBUTE_NONNULL(1);
+
+int qemuMonitorJSONQueryDirtyRate(qemuMonitorPtr mon,
+                                  qemuMonitorDirtyRateInfoPtr info)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 #endif /* QEMU_MONITOR_JSON_H */
@@ -36,6 +36,7 @@
 #include "qemu_processpriv.h"
 #include "qemu_alias.h"
 #include "qemu_block.h"
+#include "qemu_blockjob.h"
 #include "qemu_domain.h"
 #include "qemu_domain_address.h"
 #include "qemu_cgroup.h"
@@ -77,6 +78,11 @@
 #include "configmake.h"
 #include "nwfilter_conf.h"
 #include "netdev_bandwidth_conf.h"
+#include "virprobe.h"
+
+#ifdef WITH_DTRACE_PROBES
+# include "libvirt_qemu_probes.h"
+#endif
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
@@ -798,7 +804,6 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 {
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
 
@@ -821,8 +826,7 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         offset += vm->def->clock.data.variable.adjustment0;
         vm->def->clock.data.variable.adjustment = offset;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
-           VIR_WARN("unable to save domain status with RTC change");
+        qemuDomainSaveStatusLazy(driver, vm);
     }
 
     event = virDomainEventRTCChangeNewFromObj(vm, offset);
@@ -830,7 +834,6 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virObjectUnlock(vm);
 
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -965,6 +968,7 @@ qemuProcessHandleBlockJob(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                           const char *diskAlias,
                           int type,
                           int status,
+                          qemuMonitorBlockJobInfoPtr info,
                           void *opaque)
 {
     virQEMUDriverPtr driver = opaque;
@@ -978,10 +982,15 @@ qemuProcessHandleBlockJob(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     VIR_DEBUG("Block job for device %s (domain: %p,%s) type %d status %d",
               diskAlias, vm, vm->def->name, type, status);
 
+    /* the job may have changed the images backing the disk */
+    qemuDomainBlockStatsCacheInvalidate(vm);
+
     if (!(disk = qemuProcessFindDomainDiskByAlias(vm, diskAlias)))
         goto error;
     diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
 
+    qemuBlockJobTrack(disk, status, info);
+
     if (diskPriv->blockJobSync) {
         /* We have a SYNC API waiting for this event, dispatch it back */
         diskPriv->blockJobType = type;
@@ -1232,7 +1241,6 @@ qemuProcessHandleBalloonChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 {
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     virObjectLock(vm);
     event = virDomainEventBalloonChangeNewFromObj(vm, actual);
@@ -1241,13 +1249,11 @@ qemuProcessHandleBalloonChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
               vm->def->mem.cur_balloon, actual);
     vm->def->mem.cur_balloon = actual;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
-        VIR_WARN("unable to save domain status with balloon change");
+    qemuDomainSaveStatusLazy(driver, vm);
 
     virObjectUnlock(vm);
 
     qemuDomainEventQueue(driver, event);
-    virObjectUnref(cfg);
     return 0;
 }
 
@@ -1345,6 +1351,8 @@ qemuProcessHandleDeviceDeleted(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     VIR_DEBUG("Device %s removed from domain %p %s",
               devAlias, vm, vm->def->name);
 
+    qemuDomainBlockStatsCacheInvalidate(vm);
+
     if (qemuDomainSignalDeviceRemoval(vm, devAlias,
                                       QEMU_DOMAIN_UNPLUGGING_DEVICE_STATUS_OK))
         goto cleanup;
@@ -1453,10 +1461,12 @@ qemuProcessHandleBlockThreshold(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 {
     virQEMUDriverPtr driver = opaque;
     virObjectEventPtr event = NULL;
+    struct qemuProcessEvent *processEvent = NULL;
     virDomainDiskDefPtr disk;
     virStorageSourcePtr src;
     unsigned int idx;
     char *dev = NULL;
+    char *data = NULL;
     const char *path = NULL;
 
     virObjectLock(vm);
@@ -1474,12 +1484,39 @@ qemuProcessHandleBlockThreshold(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                                            threshold, excess);
             VIR_FREE(dev);
         }
+
+        /* qemu disarms the threshold once it fires, the next one for the
+         * watermark is armed from the worker as it needs a job */
+        if (idx == 0 && disk->watermark) {
+            QEMU_DOMAIN_DISK_PRIVATE(disk)->watermarkAllocation = threshold + excess;
+
+            if (VIR_ALLOC(processEvent) < 0)
+                goto cleanup;
+
+            processEvent->eventType = QEMU_PROCESS_EVENT_BLOCK_THRESHOLD;
+            if (VIR_STRDUP(data, disk->info.alias) < 0)
+                goto error;
+            processEvent->data = data;
+            processEvent->vm = virObjectRef(vm);
+
+            if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+                ignore_value(virObjectUnref(vm));
+                goto error;
+            }
+        }
     }
 
+ cleanup:
     virObjectUnlock(vm);
     qemuDomainEventQueue(driver, event);
 
     return 0;
+
+ error:
+    if (processEvent)
+        VIR_FREE(processEvent->data);
+    VIR_FREE(processEvent);
+    goto cleanup;
 }
 
 
@@ -1770,7 +1807,14 @@ qemuConnectMonitor(virQEMUDriverPtr driver, virDomainObjPtr vm, int asyncJob,
         qemuMonitorSetMigrationCapability(priv->mon,
                                           QEMU_MONITOR_MIGRATION_CAPS_EVENTS,
                                           true) < 0) {
+        virQEMUCapsPtr qemuCaps;
+
         VIR_DEBUG("Cannot enable migration events; clearing capability");
+        /* The capabilities may be shared with other domains */
+        if (!(qemuCaps = virQEMUCapsNewCopy(priv->qemuCaps)))
+            goto cleanup;
+        virObjectUnref(priv->qemuCaps);
+        priv->qemuCaps = qemuCaps;
         virQEMUCapsClear(priv->qemuCaps, QEMU_CAPS_MIGRATION_EVENT);
     }
 
@@ -1779,6 +1823,10 @@ qemuConnectMonitor(virQEMUDriverPtr driver, virDomainObjPtr vm, int asyncJob,
  cleanup:
     if (qemuDomainObjExitMonitor(driver, vm) < 0)
         ret = -1;
+
+    if (ret == 0)
+        qemuDomainBlockStatsCacheStart(driver, vm);
+
     return ret;
 }
 
@@ -2390,7 +2438,8 @@ qemuProcessSetupPid(virDomainObjPtr vm,
                                                 &mem_mask, -1) < 0)
             goto cleanup;
 
-        if (virCgroupNewThread(priv->cgroup, nameval, id, true, &cgroup) < 0)
+        if (virCgroupNewThread(priv->cgroup, nameval, id, true, &cgroup) < 0 ||
+            virCgroupBatchBegin(cgroup) < 0)
             goto cleanup;
 
         if (virCgroupHasController(priv->cgroup, VIR_CGROUP_CONTROLLER_CPUSET)) {
@@ -2417,6 +2466,7 @@ qemuProcessSetupPid(virDomainObjPtr vm,
         if (virCgroupAddTask(cgroup, pid) < 0)
             goto cleanup;
 
+        virCgroupBatchEnd(cgroup);
     }
 
     /* Setup legacy affinity. */
@@ -2432,6 +2482,7 @@ qemuProcessSetupPid(virDomainObjPtr vm,
  cleanup:
     VIR_FREE(mem_mask);
     if (cgroup) {
+        virCgroupBatchEnd(cgroup);
         if (ret < 0)
             virCgroupRemove(cgroup);
         virCgroupFree(&cgroup);
@@ -3314,23 +3365,232 @@ qemuProcessBuildDestroyHugepagesPath(virQEMUDriverPtr driver,
 }
 
 
+/* Free memory on host NUMA node @node in KiB, counting only the free
+ * huge pages of @pageSize if it is not 0 */
+static unsigned long long
+qemuProcessGetNodeMemFree(virCapsHostNUMACellPtr cell,
+                          unsigned long long pageSize)
+{
+    unsigned long long memFree;
+    unsigned int pageFree;
+
+    if (pageSize) {
+        if (virNumaGetPageInfo(cell->num, pageSize, 0, NULL, &pageFree) == 0)
+            return pageFree * pageSize;
+    } else {
+        if (virNumaGetNodeMemory(cell->num, NULL, &memFree) == 0)
+            return memFree / 1024;
+    }
+
+    virResetLastError();
+    return cell->mem;
+}
+
+
+/**
+ * qemuProcessGetPlacementAdvice:
+ *
+ * Pick the host NUMA nodes for a domain with automatic placement from
+ * the host topology in @caps, the free memory of the nodes and the
+ * vCPUs of the domains already running on them.
+ *
+ * Returns the nodeset on success, NULL on error.
+ */
+static virBitmapPtr
+qemuProcessGetPlacementAdvice(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm,
+                              virCapsPtr caps)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    size_t nnodes = caps->host.nnumaCell;
+    virNumaPlacementNodePtr nodes = NULL;
+    unsigned int *distances = NULL;
+    unsigned long long pageSize = 0;
+    virBitmapPtr ret = NULL;
+    size_t i, j;
+    int k;
+
+    if (vm->def->mem.nhugepages) {
+        pageSize = vm->def->mem.hugepages[0].size;
+        for (i = 0; !pageSize && i < cfg->nhugetlbfs; i++) {
+            if (cfg->hugetlbfs[i].deflt)
+                pageSize = cfg->hugetlbfs[i].size;
+        }
+    }
+
+    if (VIR_ALLOC_N(nodes, nnodes) < 0 ||
+        VIR_ALLOC_N(distances, nnodes * nnodes) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nnodes; i++) {
+        virCapsHostNUMACellPtr cell = caps->host.numaCell[i];
+
+        nodes[i].id = cell->num;
+        nodes[i].ncpus = cell->ncpus;
+        nodes[i].load = virQEMUDriverGetNumaLoad(driver, cell->num);
+        nodes[i].memFree = qemuProcessGetNodeMemFree(cell, pageSize);
+        nodes[i].distances = distances + i * nnodes;
+
+        for (j = 0; j < nnodes; j++)
+            nodes[i].distances[j] = i == j ? 10 : 20;
+
+        for (k = 0; k < cell->nsiblings; k++) {
+            for (j = 0; j < nnodes; j++) {
+                if (caps->host.numaCell[j]->num == cell->siblings[k].node) {
+                    nodes[i].distances[j] = cell->siblings[k].distance;
+                    break;
+                }
+            }
+        }
+    }
+
+    ret = virNumaPlacementChoose(nodes, nnodes,
+                                 virDomainDefGetVcpus(vm->def),
+                                 virDomainDefGetMemoryTotal(vm->def));
+
+ cleanup:
+    VIR_FREE(distances);
+    VIR_FREE(nodes);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+/**
+ * qemuProcessAddPlacementLoad:
+ *
+ * Account the vCPUs of @vm to the host NUMA nodes they run on, so that
+ * the automatic placement of the domains started later avoids them.
+ * These are the nodes picked by the automatic placement or the ones
+ * covered by the <vcpu cpuset/>. A failure only makes the placement
+ * less accurate and is therefore not fatal.
+ */
+static void
+qemuProcessAddPlacementLoad(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm,
+                            virCapsPtr caps)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virBitmapPtr nodes = NULL;
+    unsigned int share;
+    size_t count;
+    size_t i;
+    int j;
+
+    if (priv->placementNodes)
+        return;
+
+    if (priv->autoNodeset) {
+        if (!(nodes = virBitmapNewCopy(priv->autoNodeset)))
+            goto error;
+    } else if (vm->def->cpumask) {
+        if (!(nodes = virBitmapNew(VIR_DOMAIN_CPUMASK_LEN)))
+            goto error;
+
+        for (i = 0; i < caps->host.nnumaCell; i++) {
+            virCapsHostNUMACellPtr cell = caps->host.numaCell[i];
+
+            for (j = 0; j < cell->ncpus; j++) {
+                if (virBitmapIsBitSet(vm->def->cpumask, cell->cpus[j].id)) {
+                    ignore_value(virBitmapSetBit(nodes, cell->num));
+                    break;
+                }
+            }
+        }
+    } else {
+        return;
+    }
+
+    if (!(count = virBitmapCountBits(nodes))) {
+        virBitmapFree(nodes);
+        return;
+    }
+
+    share = VIR_DIV_UP(virDomainDefGetVcpus(vm->def), count);
+    if (virQEMUDriverAddNumaLoad(driver, nodes, share) < 0)
+        goto error;
+
+    priv->placementNodes = nodes;
+    priv->placementShare = share;
+    return;
+
+ error:
+    VIR_WARN("Unable to account NUMA placement of domain %s: %s",
+             vm->def->name, virGetLastErrorMessage());
+    virResetLastError();
+    virBitmapFree(nodes);
+}
+
+
+static void
+qemuProcessRemovePlacementLoad(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (!priv->placementNodes)
+        return;
+
+    virQEMUDriverRemoveNumaLoad(driver, priv->placementNodes,
+                                priv->placementShare);
+    virBitmapFree(priv->placementNodes);
+    priv->placementNodes = NULL;
+    priv->placementShare = 0;
+}
+
+
 struct qemuProcessReconnectData {
     virConnectPtr conn;
     virQEMUDriverPtr driver;
     virDomainObjPtr obj;
+    struct qemuDomainJobObj oldjob;
 };
+
+
+/* Called once for every domain handed over to the reconnect pool and
+ * once by qemuProcessReconnectAll after it has queued all of them. */
+static void
+qemuProcessReconnectDone(virQEMUDriverPtr driver)
+{
+    unsigned long long now;
+
+    if (!virAtomicIntDecAndTest(&driver->reconnectPending))
+        return;
+
+    if (virTimeMillisNow(&now) == 0)
+        VIR_INFO("Reconnecting to running domains finished in %llu ms",
+                 now - driver->reconnectStarted);
+
+    /* Nothing else is ever queued, let the workers go away */
+    if (driver->reconnectPool)
+        ignore_value(virThreadPoolSetParameters(driver->reconnectPool,
+                                                -1, 0, -1));
+}
+
+
+static const char *
+qemuProcessResctrlMachineName(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    return priv->machineName ? priv->machineName : vm->def->name;
+}
+
+
 /*
  * Open an existing VM's monitor, re-detect VCPU threads
  * and re-reserve the security labels in use
  *
- * We own the virConnectPtr we are passed here - whoever started
- * this thread function has increased the reference counter to it
- * so that we now have to close it.
+ * We own the virConnectPtr we are passed here - whoever queued
+ * this job has increased the reference counter to it so that we
+ * now have to close it.
  *
- * This function also inherits a locked and ref'd domain object.
+ * This function also inherits a ref'd domain object, unlocked, for
+ * which the QEMU_JOB_MODIFY job was already acquired by
+ * qemuProcessReconnectHelper. Thus APIs not needing a job can be
+ * served while the domain is waiting for a free worker.
  *
  * This function needs to:
- * 1. Enter job
  * 1. just before monitor reconnect do lightweight MonitorEnter
  *    (increase VM refcount and unlock VM)
  * 2. reconnect to monitor
@@ -3342,37 +3602,44 @@ struct qemuProcessReconnectData {
  * monitor lock, which does not exists in this early phase.
  */
 static void
-qemuProcessReconnect(void *opaque)
+qemuProcessReconnect(void *jobdata,
+                     void *opaque ATTRIBUTE_UNUSED)
 {
-    struct qemuProcessReconnectData *data = opaque;
+    struct qemuProcessReconnectData *data = jobdata;
     virQEMUDriverPtr driver = data->driver;
     virDomainObjPtr obj = data->obj;
     qemuDomainObjPrivatePtr priv;
     virConnectPtr conn = data->conn;
-    struct qemuDomainJobObj oldjob;
+    struct qemuDomainJobObj oldjob = data->oldjob;
     int state;
     int reason;
     virQEMUDriverConfigPtr cfg;
     size_t i;
     unsigned int stopFlags = 0;
-    bool jobStarted = false;
+    bool jobStarted = true;
     virCapsPtr caps = NULL;
+    unsigned long long then = 0;
+    unsigned long long now;
 
     VIR_FREE(data);
 
-    qemuDomainObjRestoreJob(obj, &oldjob);
+    ignore_value(virTimeMillisNow(&then));
+
+    virObjectLock(obj);
+
     if (oldjob.asyncJob == QEMU_ASYNC_JOB_MIGRATION_IN)
         stopFlags |= VIR_QEMU_PROCESS_STOP_MIGRATED;
 
     cfg = virQEMUDriverGetConfig(driver);
     priv = obj->privateData;
 
+    /* The job was started on our behalf by another thread */
+    priv->job.owner = virThreadSelfID();
+
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
         goto error;
 
-    if (qemuDomainObjBeginJob(driver, obj, QEMU_JOB_MODIFY) < 0)
-        goto error;
-    jobStarted = true;
+    qemuProcessAddPlacementLoad(driver, obj, caps);
 
     /* XXX If we ever gonna change pid file pattern, come up with
      * some intelligence here to deal with old paths. */
@@ -3397,6 +3664,12 @@ qemuProcessReconnect(void *opaque)
     if (qemuConnectCgroup(driver, obj) < 0)
         goto error;
 
+    for (i = 0; i < obj->def->nresctrls; i++) {
+        if (virResctrlAllocDeterminePath(obj->def->resctrls[i]->alloc,
+                                         qemuProcessResctrlMachineName(obj)) < 0)
+            goto error;
+    }
+
     if (qemuDomainPerfRestart(obj) < 0)
         goto error;
 
@@ -3404,10 +3677,14 @@ qemuProcessReconnect(void *opaque)
      * qemu_driver->sharedDevices.
      */
     for (i = 0; i < obj->def->ndisks; i++) {
-        virDomainDeviceDef dev;
-
         if (virStorageTranslateDiskSourcePool(conn, obj->def->disks[i]) < 0)
             goto error;
+    }
+
+    qemuDomainPrefetchDiskChains(driver, obj);
+
+    for (i = 0; i < obj->def->ndisks; i++) {
+        virDomainDeviceDef dev;
 
         /* XXX we should be able to restore all data from XML in the future.
          * This should be the only place that calls qemuDomainDetermineDiskChain
@@ -3439,10 +3716,10 @@ qemuProcessReconnect(void *opaque)
      * caps in the domain status, so re-query them
      */
     if (!priv->qemuCaps &&
-        !(priv->qemuCaps = virQEMUCapsCacheLookupCopy(caps,
-                                                      driver->qemuCapsCache,
-                                                      obj->def->emulator,
-                                                      obj->def->os.machine)))
+        !(priv->qemuCaps = virQEMUCapsCacheLookupMachine(caps,
+                                                         driver->qemuCapsCache,
+                                                         obj->def->emulator,
+                                                         obj->def->os.machine)))
         goto error;
 
     /* In case the domain shutdown while we were not running,
@@ -3536,6 +3813,9 @@ qemuProcessReconnect(void *opaque)
  cleanup:
     if (jobStarted)
         qemuDomainObjEndJob(driver, obj);
+    if (virTimeMillisNow(&now) == 0)
+        VIR_DEBUG("Reconnect to domain '%s' took %llu ms",
+                  obj->def->name, now - then);
     if (!virDomainObjIsActive(obj))
         qemuDomainRemoveInactive(driver, obj);
     virDomainObjEndAPI(&obj);
@@ -3543,6 +3823,7 @@ qemuProcessReconnect(void *opaque)
     virObjectUnref(cfg);
     virObjectUnref(caps);
     virNWFilterUnlockFilterUpdates();
+    qemuProcessReconnectDone(driver);
     return;
 
  error:
@@ -3574,9 +3855,9 @@ static int
 qemuProcessReconnectHelper(virDomainObjPtr obj,
                            void *opaque)
 {
-    virThread thread;
     struct qemuProcessReconnectData *src = opaque;
     struct qemuProcessReconnectData *data;
+    virQEMUDriverPtr driver = src->driver;
 
     /* If the VM was inactive, we don't need to reconnect */
     if (!obj->pid)
@@ -3588,50 +3869,86 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
     memcpy(data, src, sizeof(*data));
     data->obj = obj;
 
-    /* this lock and reference will be eventually transferred to the thread
+    /* this reference will be eventually transferred to the worker
      * that handles the reconnect */
     virObjectLock(obj);
     virObjectRef(obj);
 
     /* Since we close the connection later on, we have to make sure that the
-     * threads we start see a valid connection throughout their lifetime. We
+     * workers see a valid connection throughout their lifetime. We
      * simply increase the reference counter here.
      */
     virObjectRef(data->conn);
 
-    if (virThreadCreate(&thread, false, qemuProcessReconnect, data) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Could not create thread. QEMU initialization "
-                         "might be incomplete"));
-        /* We can't spawn a thread and thus connect to monitor. Kill qemu.
-         * It's safe to call qemuProcessStop without a job here since there
-         * is no thread that could be doing anything else with the same domain
-         * object.
-         */
-        qemuProcessStop(src->driver, obj, VIR_DOMAIN_SHUTOFF_FAILED,
-                        QEMU_ASYNC_JOB_NONE, 0);
-        qemuDomainRemoveInactive(src->driver, obj);
+    /* Nothing else can be using the domain this early, so acquiring
+     * the job can't block. Holding it instead of the domain lock
+     * until a worker is free keeps the domain visible to APIs. */
+    qemuDomainObjRestoreJob(obj, &data->oldjob);
+    if (qemuDomainObjBeginJob(driver, obj, QEMU_JOB_MODIFY) < 0)
+        goto error;
 
-        virDomainObjEndAPI(&obj);
-        virObjectUnref(data->conn);
-        VIR_FREE(data);
-        return -1;
+    virAtomicIntInc(&driver->reconnectPending);
+
+    if (!driver->reconnectPool ||
+        virThreadPoolSendJob(driver->reconnectPool, 0, data) < 0) {
+        ignore_value(virAtomicIntDecAndTest(&driver->reconnectPending));
+        qemuDomainObjEndJob(driver, obj);
+        goto error;
     }
 
+    virObjectUnlock(obj);
     return 0;
+
+ error:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("Could not queue domain reconnect. QEMU initialization "
+                     "might be incomplete"));
+    /* We can't connect to monitor. Kill qemu. It's safe to call
+     * qemuProcessStop without a job here since there is no thread
+     * that could be doing anything else with the same domain object.
+     */
+    qemuProcessStop(driver, obj, VIR_DOMAIN_SHUTOFF_FAILED,
+                    QEMU_ASYNC_JOB_NONE, 0);
+    qemuDomainRemoveInactive(driver, obj);
+
+    virDomainObjEndAPI(&obj);
+    virObjectUnref(data->conn);
+    VIR_FREE(data);
+    return -1;
 }
 
 /**
  * qemuProcessReconnectAll
  *
  * Try to re-open the resources for live VMs that we care
- * about.
+ * about. The domains are handed over to a pool of at most
+ * reconnect_workers threads and this function does not wait
+ * for them to be done.
  */
 void
 qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver)
 {
     struct qemuProcessReconnectData data = {.conn = conn, .driver = driver};
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+
+    ignore_value(virTimeMillisNow(&driver->reconnectStarted));
+
+    /* Domains for which the pool can't be used are killed by
+     * qemuProcessReconnectHelper the same way as if it failed to
+     * queue them */
+    driver->reconnectPool = virThreadPoolNew(0, cfg->reconnectWorkers, 0,
+                                             qemuProcessReconnect, NULL);
+
+    /* Hold a reference so that the workers can't declare the
+     * reconnect done before every domain has been queued */
+    driver->reconnectPending = 1;
     virDomainObjListForEach(driver->domains, qemuProcessReconnectHelper, &data);
+
+    VIR_DEBUG("Queued %u domains for reconnect",
+              virAtomicIntGet(&driver->reconnectPending) - 1);
+
+    qemuProcessReconnectDone(driver);
+    virObjectUnref(cfg);
 }
 
 static int
@@ -4731,6 +5048,28 @@ qemuProcessStartValidateShmem(virDomainObjPtr vm)
 }
 
 
+static int
+qemuProcessStartValidateDisks(virDomainObjPtr vm,
+                              virQEMUCapsPtr qemuCaps)
+{
+    size_t i;
+
+    for (i = 0; i < vm->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = vm->def->disks[i];
+
+        if (disk->watermark &&
+            !virQEMUCapsGet(qemuCaps, QEMU_CAPS_BLOCK_WRITE_THRESHOLD)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("disk watermark is not supported with this "
+                             "QEMU binary"));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 static int
 qemuProcessStartValidateXML(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
@@ -4813,6 +5152,9 @@ qemuProcessStartValidate(virQEMUDriverPtr driver,
     if (qemuProcessStartValidateShmem(vm) < 0)
         return -1;
 
+    if (qemuProcessStartValidateDisks(vm, qemuCaps) < 0)
+        return -1;
+
     VIR_DEBUG("Checking for any possible (non-fatal) issues");
 
     qemuProcessStartWarnShmem(vm);
@@ -4833,6 +5175,47 @@ qemuProcessStartValidate(virQEMUDriverPtr driver,
  *
  * Returns 0 on success, -1 on error.
  */
+static void
+qemuProcessStartPhaseReset(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    memset(priv->startPhases, 0, sizeof(priv->startPhases));
+    priv->startTimed = false;
+    ignore_value(virTimeMillisNow(&priv->startPhaseStamp));
+}
+
+
+/*
+ * Account the time since the end of the previous phase of starting
+ * @vm to @phase.  The result is reported by the startup domain stats
+ * group once the start completes.
+ */
+static void
+qemuProcessStartPhaseDone(virDomainObjPtr vm,
+                          qemuDomainStartPhase phase)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long now;
+    unsigned long long ms;
+
+    if (virTimeMillisNow(&now) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    ms = now - priv->startPhaseStamp;
+    priv->startPhases[phase] += ms;
+    priv->startPhaseStamp = now;
+
+    VIR_DEBUG("Start phase %s of domain %s took %llu ms",
+              qemuDomainStartPhaseTypeToString(phase), vm->def->name, ms);
+    PROBE(QEMU_PROCESS_START_PHASE,
+          "vm=%p name=%s phase=%s ms=%llu",
+          vm, vm->def->name, qemuDomainStartPhaseTypeToString(phase), ms);
+}
+
+
 int
 qemuProcessInit(virQEMUDriverPtr driver,
                 virDomainObjPtr vm,
@@ -4850,6 +5233,7 @@ qemuProcessInit(virQEMUDriverPtr driver,
               vm, vm->def->name, vm->def->id, migration);
 
     VIR_DEBUG("Beginning VM startup process");
+    qemuProcessStartPhaseReset(vm);
 
     if (virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID, "%s",
@@ -4862,12 +5246,24 @@ qemuProcessInit(virQEMUDriverPtr driver,
 
     VIR_DEBUG("Determining emulator version");
     virObjectUnref(priv->qemuCaps);
-    if (!(priv->qemuCaps = virQEMUCapsCacheLookupCopy(caps,
-                                                      driver->qemuCapsCache,
-                                                      vm->def->emulator,
-                                                      vm->def->os.machine)))
+    if (!(priv->qemuCaps = virQEMUCapsCacheLookupMachine(caps,
+                                                         driver->qemuCapsCache,
+                                                         vm->def->emulator,
+                                                         vm->def->os.machine)))
         goto cleanup;
 
+    /* The capabilities are shared with other domains, but building the
+     * command line of a TCG domain clears QEMU_CAPS_DRIVE_BOOT in them */
+    if (virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_KVM) &&
+        vm->def->virtType == VIR_DOMAIN_VIRT_QEMU) {
+        virQEMUCapsPtr qemuCaps;
+
+        if (!(qemuCaps = virQEMUCapsNewCopy(priv->qemuCaps)))
+            goto cleanup;
+        virObjectUnref(priv->qemuCaps);
+        priv->qemuCaps = qemuCaps;
+    }
+
     if (qemuProcessStartValidate(driver, vm, priv->qemuCaps, caps, flags) < 0)
         goto cleanup;
 
@@ -4976,8 +5372,8 @@ qemuProcessNetworkPrepareDevices(virDomainDefPtr def)
  * @vm: domain object
  * @vcpuid: id of VCPU to set defaults
  *
- * This function sets resource properties (cgroups, affinity, scheduler) for a
- * vCPU. This function expects that the vCPU is online and the vCPU pids were
+ * This function sets resource properties (cgroups, affinity, scheduler,
+ * cache and memory bandwidth allocation) for a vCPU. This function expects that the vCPU is online and the vCPU pids were
  * correctly detected at the point when it's called.
  *
  * Returns 0 on success, -1 on error.
@@ -4988,12 +5384,23 @@ qemuProcessSetupVcpu(virDomainObjPtr vm,
 {
     pid_t vcpupid = qemuDomainGetVcpuPid(vm, vcpuid);
     virDomainVcpuDefPtr vcpu = virDomainDefGetVcpu(vm->def, vcpuid);
+    size_t i;
+
+    if (qemuProcessSetupPid(vm, vcpupid, VIR_CGROUP_THREAD_VCPU,
+                            vcpuid, vcpu->cpumask,
+                            vm->def->cputune.period,
+                            vm->def->cputune.quota,
+                            &vcpu->sched) < 0)
+        return -1;
+
+    for (i = 0; i < vm->def->nresctrls; i++) {
+        virDomainResctrlDefPtr resctrl = vm->def->resctrls[i];
+
+        if (virBitmapIsBitSet(resctrl->vcpus, vcpuid))
+            return virResctrlAllocAddPID(resctrl->alloc, vcpupid);
+    }
 
-    return qemuProcessSetupPid(vm, vcpupid, VIR_CGROUP_THREAD_VCPU,
-                               vcpuid, vcpu->cpumask,
-                               vm->def->cputune.period,
-                               vm->def->cputune.quota,
-                               &vcpu->sched);
+    return 0;
 }
 
 
@@ -5365,25 +5772,25 @@ qemuProcessPrepareDomain(virConnectPtr conn,
         }
         virDomainAuditSecurityLabel(vm, true);
 
-        /* Get the advisory nodeset from numad if 'placement' of
-         * either <vcpu> or <numatune> is 'auto'.
+        /* Get the advisory nodeset if 'placement' of either <vcpu> or
+         * <numatune> is 'auto'.
          */
         if (virDomainDefNeedsPlacementAdvice(vm->def)) {
-            nodeset = virNumaGetAutoPlacementAdvice(virDomainDefGetVcpus(vm->def),
-                                                    virDomainDefGetMemoryTotal(vm->def));
-            if (!nodeset)
+            if (!(priv->autoNodeset = qemuProcessGetPlacementAdvice(driver, vm,
+                                                                    caps)))
                 goto cleanup;
 
-            VIR_DEBUG("Nodeset returned from numad: %s", nodeset);
-
-            if (virBitmapParse(nodeset, &priv->autoNodeset,
-                               VIR_DOMAIN_CPUMASK_LEN) < 0)
+            if (!(nodeset = virBitmapFormat(priv->autoNodeset)))
                 goto cleanup;
 
+            VIR_DEBUG("Automatic placement nodeset: %s", nodeset);
+
             if (!(priv->autoCpuset = virCapabilitiesGetCpusForNodemask(caps,
                                                                        priv->autoNodeset)))
                 goto cleanup;
         }
+
+        qemuProcessAddPlacementLoad(driver, vm, caps);
     }
 
     /*
@@ -5429,6 +5836,12 @@ qemuProcessPrepareDomain(virConnectPtr conn,
             goto cleanup;
     }
 
+    VIR_DEBUG("Sizing automatic network interface queues");
+    for (i = 0; i < vm->def->nnets; i++) {
+        if (qemuDomainNetResolveAutoQueues(vm->def, vm->def->nets[i]) < 0)
+            goto cleanup;
+    }
+
     if (VIR_ALLOC(priv->monConfig) < 0)
         goto cleanup;
 
@@ -5445,6 +5858,7 @@ qemuProcessPrepareDomain(virConnectPtr conn,
     if (qemuProcessUpdateGuestCPU(vm->def, priv->qemuCaps, caps, flags) < 0)
         goto cleanup;
 
+    qemuProcessStartPhaseDone(vm, QEMU_DOMAIN_START_PHASE_PREPARE_DOMAIN);
     ret = 0;
  cleanup:
     VIR_FREE(nodeset);
@@ -5542,6 +5956,7 @@ qemuProcessPrepareHost(virQEMUDriverPtr driver,
     if (qemuDomainWriteMasterKeyFile(driver, vm) < 0)
         goto cleanup;
 
+    qemuProcessStartPhaseDone(vm, QEMU_DOMAIN_START_PHASE_PREPARE_HOST);
     ret = 0;
  cleanup:
     virObjectUnref(cfg);
@@ -5549,6 +5964,34 @@ qemuProcessPrepareHost(virQEMUDriverPtr driver,
 }
 
 
+static int
+qemuProcessResctrlCreate(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm)
+{
+    virCapsPtr caps = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (!vm->def->nresctrls)
+        return 0;
+
+    if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
+        return -1;
+
+    for (i = 0; i < vm->def->nresctrls; i++) {
+        if (virResctrlAllocCreate(caps->host.resctrl,
+                                  vm->def->resctrls[i]->alloc,
+                                  qemuProcessResctrlMachineName(vm)) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(caps);
+    return ret;
+}
+
+
 /**
  * qemuProcessLaunch:
  *
@@ -5634,6 +6077,8 @@ qemuProcessLaunch(virConnectPtr conn,
                                      priv->libDir)))
         goto cleanup;
 
+    qemuProcessStartPhaseDone(vm, QEMU_DOMAIN_START_PHASE_COMMAND_LINE);
+
     if (incoming && incoming->fd != -1)
         virCommandPassFD(cmd, incoming->fd, 0);
 
@@ -5700,6 +6145,11 @@ qemuProcessLaunch(virConnectPtr conn,
                   vm, vm->def->name);
     }
 
+    /* Let systemd-machined work while the child gets ready */
+    if (rv == 0 &&
+        qemuSetupCgroupPrepare(driver, vm, nnicindexes, nicindexes) < 0)
+        goto cleanup;
+
     VIR_DEBUG("Writing early domain status to disk");
     if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
         goto cleanup;
@@ -5712,6 +6162,8 @@ qemuProcessLaunch(virConnectPtr conn,
         goto cleanup;
     }
 
+    qemuProcessStartPhaseDone(vm, QEMU_DOMAIN_START_PHASE_SPAWN);
+
     VIR_DEBUG("Setting up domain cgroup (if required)");
     if (qemuSetupCgroup(driver, vm, nnicindexes, nicindexes) < 0)
         goto cleanup;
@@ -5735,6 +6187,12 @@ qemuProcessLaunch(virConnectPtr conn,
     if (qemuProcessSetupEmulator(vm) < 0)
         goto cleanup;
 
+    VIR_DEBUG("Setting up resctrlfs");
+    if (qemuProcessResctrlCreate(driver, vm) < 0)
+        goto cleanup;
+
+    qemuProcessStartPhaseDone(vm, QEMU_DOMAIN_START_PHASE_CGROUP);
+
     VIR_DEBUG("Setting domain security labels");
     if (qemuSecuritySetAllLabel(driver,
                                 vm,
@@ -5771,6 +6229,8 @@ qemuProcessLaunch(virConnectPtr conn,
         goto cleanup;
     VIR_DEBUG("Handshake complete, child running");
 
+    qemuProcessStartPhaseDone(vm, QEMU_DOMAIN_START_PHASE_SECURITY);
+
     if (rv == -1) /* The VM failed to start; tear filters before taps */
         virDomainConfVMNWFilterTeardown(vm);
 
@@ -5784,6 +6244,8 @@ qemuProcessLaunch(virConnectPtr conn,
     if (qemuConnectAgent(driver, vm) < 0)
         goto cleanup;
 
+    qemuProcessStartPhaseDone(vm, QEMU_DOMAIN_START_PHASE_MONITOR);
+
     VIR_DEBUG("Verifying and updating provided guest CPU");
     if (qemuProcessUpdateLiveGuestCPU(driver, vm, asyncJob) < 0)
         goto cleanup;
@@ -5829,6 +6291,8 @@ qemuProcessLaunch(virConnectPtr conn,
     if (qemuProcessSetupIOThreads(vm) < 0)
         goto cleanup;
 
+    qemuProcessStartPhaseDone(vm, QEMU_DOMAIN_START_PHASE_SETUP);
+
     VIR_DEBUG("Setting any required VM passwords");
     if (qemuProcessInitPasswords(conn, driver, vm, asyncJob) < 0)
         goto cleanup;
@@ -5867,10 +6331,18 @@ qemuProcessLaunch(virConnectPtr conn,
     if (qemuProcessRefreshDisks(driver, vm, asyncJob) < 0)
         goto cleanup;
 
+    VIR_DEBUG("Arming disk watermarks");
+    for (i = 0; i < vm->def->ndisks; i++) {
+        if (qemuProcessArmDiskWatermark(driver, vm, vm->def->disks[i], 0,
+                                        asyncJob) < 0)
+            goto cleanup;
+    }
+
     if (flags & VIR_QEMU_PROCESS_START_AUTODESTROY &&
         qemuProcessAutoDestroyAdd(driver, vm, conn) < 0)
         goto cleanup;
 
+    qemuProcessStartPhaseDone(vm, QEMU_DOMAIN_START_PHASE_REFRESH);
     ret = 0;
 
  cleanup:
@@ -5898,6 +6370,7 @@ qemuProcessFinishStartup(virConnectPtr conn,
                          virDomainPausedReason pausedReason)
 {
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     int ret = -1;
 
     if (startCPUs) {
@@ -5923,6 +6396,8 @@ qemuProcessFinishStartup(virConnectPtr conn,
                              VIR_HOOK_SUBOP_BEGIN) < 0)
         goto cleanup;
 
+    qemuProcessStartPhaseDone(vm, QEMU_DOMAIN_START_PHASE_FINISH);
+    priv->startTimed = true;
     ret = 0;
 
  cleanup:
@@ -5947,6 +6422,7 @@ qemuProcessStart(virConnectPtr conn,
     qemuProcessIncomingDefPtr incoming = NULL;
     unsigned int stopFlags;
     bool relabel = false;
+    bool parallel;
     int ret = -1;
     int rv;
 
@@ -5960,7 +6436,11 @@ qemuProcessStart(virConnectPtr conn,
 
     virCheckFlagsGoto(VIR_QEMU_PROCESS_START_COLD |
                       VIR_QEMU_PROCESS_START_PAUSED |
-                      VIR_QEMU_PROCESS_START_AUTODESTROY, cleanup);
+                      VIR_QEMU_PROCESS_START_AUTODESTROY |
+                      VIR_QEMU_PROCESS_START_PARALLEL, cleanup);
+
+    parallel = !!(flags & VIR_QEMU_PROCESS_START_PARALLEL);
+    flags &= ~VIR_QEMU_PROCESS_START_PARALLEL;
 
     if (!migrateFrom && !snapshot)
         flags |= VIR_QEMU_PROCESS_START_NEW;
@@ -5973,6 +6453,15 @@ qemuProcessStart(virConnectPtr conn,
                                              migrateFd, migratePath);
         if (!incoming)
             goto stop;
+
+        /* Compression has to be set up before the migration starts */
+        if (parallel && !incoming->deferredURI) {
+            virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                           _("this QEMU binary does not support deferred "
+                             "incoming migration needed to restore "
+                             "a parallel save image"));
+            goto stop;
+        }
     }
 
     if (qemuProcessPrepareDomain(conn, driver, vm, flags) < 0)
@@ -5989,6 +6478,10 @@ qemuProcessStart(virConnectPtr conn,
     }
     relabel = true;
 
+    if (incoming && parallel &&
+        qemuMigrationSetParallelCompression(driver, vm, true, asyncJob) < 0)
+        goto stop;
+
     if (incoming &&
         incoming->deferredURI &&
         qemuMigrationRunIncoming(driver, vm, incoming->deferredURI, asyncJob) < 0)
@@ -6227,6 +6720,8 @@ void qemuProcessStop(virQEMUDriverPtr driver,
     }
     priv->agentError = false;
 
+    qemuDomainBlockStatsCacheStop(vm);
+
     if (priv->mon) {
         qemuMonitorClose(priv->mon);
         priv->mon = NULL;
@@ -6370,6 +6865,9 @@ void qemuProcessStop(virQEMUDriverPtr driver,
     }
     virCgroupFree(&priv->cgroup);
 
+    for (i = 0; i < vm->def->nresctrls; i++)
+        virResctrlAllocRemove(vm->def->resctrls[i]->alloc);
+
     virPerfFree(priv->perf);
     priv->perf = NULL;
 
@@ -6435,6 +6933,7 @@ void qemuProcessStop(virQEMUDriverPtr driver,
     VIR_FREE(priv->pidfile);
 
     /* remove automatic pinning data */
+    qemuProcessRemovePlacementLoad(driver, vm);
     virBitmapFree(priv->autoNodeset);
     priv->autoNodeset = NULL;
     virBitmapFree(priv->autoCpuset);
@@ -6587,10 +7086,10 @@ int qemuProcessAttach(virConnectPtr conn ATTRIBUTE_UNUSED,
 
     VIR_DEBUG("Determining emulator version");
     virObjectUnref(priv->qemuCaps);
-    if (!(priv->qemuCaps = virQEMUCapsCacheLookupCopy(caps,
-                                                      driver->qemuCapsCache,
-                                                      vm->def->emulator,
-                                                      vm->def->os.machine)))
+    if (!(priv->qemuCaps = virQEMUCapsCacheLookupMachine(caps,
+                                                         driver->qemuCapsCache,
+                                                         vm->def->emulator,
+                                                         vm->def->os.machine)))
         goto error;
 
     VIR_DEBUG("Preparing monitor state");
@@ -6845,3 +7344,69 @@ qemuProcessRefreshDisks(virQEMUDriverPtr driver,
     virHashFree(table);
     return ret;
 }
+
+
+/**
+ * qemuProcessArmDiskWatermark:
+ * @driver: qemu driver data
+ * @vm: domain object
+ * @disk: disk definition
+ * @allocation: current allocation of @disk in bytes
+ * @asyncJob: async job type
+ *
+ * Arm the write threshold of @disk so that qemu emits an event once the
+ * guest writes @disk->watermark bytes past @allocation.  Nothing is done
+ * if @disk has no watermark configured.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuProcessArmDiskWatermark(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm,
+                            virDomainDiskDefPtr disk,
+                            unsigned long long allocation,
+                            qemuDomainAsyncJob asyncJob)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long threshold;
+    char *nodename = NULL;
+    int rc;
+    int ret = -1;
+
+    if (!disk->watermark)
+        return 0;
+
+    if (!disk->src->nodebacking &&
+        qemuBlockNodeNamesDetect(driver, vm, asyncJob) < 0)
+        goto cleanup;
+
+    if (!disk->src->nodebacking) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED,
+                       _("watermark currently can't be set for disk '%s'"),
+                       disk->dst);
+        goto cleanup;
+    }
+
+    if (VIR_STRDUP(nodename, disk->src->nodebacking) < 0)
+        goto cleanup;
+
+    if (allocation > ULLONG_MAX - disk->watermark)
+        threshold = ULLONG_MAX;
+    else
+        threshold = allocation + disk->watermark;
+
+    VIR_DEBUG("Arming write threshold of disk %s at %llu",
+              disk->dst, threshold);
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        goto cleanup;
+    rc = qemuMonitorSetBlockThreshold(priv->mon, nodename, threshold);
+    if (qemuDomainObjExitMonitor(driver, vm) < 0 || rc < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(nodename);
+    return ret;
+}
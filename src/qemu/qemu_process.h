@@ -70,6 +70,8 @@ typedef enum {
     VIR_QEMU_PROCESS_START_AUTODESTROY  = 1 << 2,
     VIR_QEMU_PROCESS_START_PRETEND      = 1 << 3,
     VIR_QEMU_PROCESS_START_NEW          = 1 << 4, /* internal, new VM is starting */
+    VIR_QEMU_PROCESS_START_PARALLEL     = 1 << 5, /* incoming stream is compressed
+                                                     by multiple QEMU threads */
 } qemuProcessStartFlags;
 
 int qemuProcessStart(virConnectPtr conn,
@@ -192,4 +194,10 @@ int qemuProcessRefreshDisks(virQEMUDriverPtr driver,
                             virDomainObjPtr vm,
                             qemuDomainAsyncJob asyncJob);
 
+int qemuProcessArmDiskWatermark(virQEMUDriverPtr driver,
+                                virDomainObjPtr vm,
+                                virDomainDiskDefPtr disk,
+                                unsigned long long allocation,
+                                qemuDomainAsyncJob asyncJob);
+
 #endif /* __QEMU_PROCESS_H__ */
@@ -26,6 +26,7 @@
 #include "qemu_domain.h"
 #include "qemu_security.h"
 #include "virlog.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
@@ -37,8 +38,12 @@ qemuSecuritySetAllLabel(virQEMUDriverPtr driver,
                         virDomainObjPtr vm,
                         const char *stdin_path)
 {
+    unsigned long long then = 0;
+    unsigned long long now;
     int ret = -1;
 
+    ignore_value(virTimeMillisNow(&then));
+
     if (qemuDomainNamespaceEnabled(vm, QEMU_DOMAIN_NS_MOUNT) &&
         virSecurityManagerTransactionStart(driver->securityManager) < 0)
         goto cleanup;
@@ -53,6 +58,10 @@ qemuSecuritySetAllLabel(virQEMUDriverPtr driver,
                                             vm->pid) < 0)
         goto cleanup;
 
+    if (then && virTimeMillisNow(&now) == 0)
+        VIR_INFO("Setting security labels of domain %s took %llu ms",
+                 vm->def->name, now - then);
+
     ret = 0;
  cleanup:
     virSecurityManagerTransactionAbort(driver->securityManager);
@@ -98,6 +98,7 @@ struct private_data {
     bool serverKeepAlive;       /* Does server support keepalive protocol? */
     bool serverEventFilter;     /* Does server support modern event filtering */
     bool serverCloseCallback;   /* Does server support driver close callback */
+    bool serverCompactStats;    /* Does server support compact bulk stats */
 
     virObjectEventStatePtr eventState;
     virConnectCloseCallbackDataPtr closeCallback;
@@ -130,6 +131,9 @@ static int callFull(virConnectPtr conn, struct private_data *priv,
                     int proc_nr,
                     xdrproc_t args_filter, char *args,
                     xdrproc_t ret_filter, char *ret);
+static int callBatch(virConnectPtr conn, struct private_data *priv,
+                     unsigned int flags,
+                     virNetClientProgramBatchCallPtr calls, size_t ncalls);
 static int remoteAuthenticate(virConnectPtr conn, struct private_data *priv,
                               virConnectAuthPtr auth, const char *authtype);
 #if WITH_SASL
@@ -813,6 +817,8 @@ doRemoteOpen(virConnectPtr conn,
     char *pkipath = NULL, *keyfile = NULL, *sshauth = NULL;
 
     char *knownHostsVerify = NULL,  *knownHosts = NULL;
+    int compress = 0;
+    unsigned int sendBuffer = 0, recvBuffer = 0;
 
     /* Return code from this function, and the private data. */
     int retcode = VIR_DRV_OPEN_ERROR;
@@ -863,6 +869,34 @@ doRemoteOpen(virConnectPtr conn,
             EXTRACT_URI_ARG_BOOL("no_verify", verify);
             EXTRACT_URI_ARG_BOOL("no_tty", tty);
 
+            if (STRCASEEQ(var->name, "compress")) {
+                if (virStrToLong_i(var->value, NULL, 10, &compress) < 0 ||
+                    compress < 0 || compress > 9) {
+                    virReportError(VIR_ERR_INVALID_ARG,
+                                   _("Failed to parse value of URI component %s"),
+                                   var->name);
+                    goto failed;
+                }
+                var->ignore = 1;
+                continue;
+            }
+
+            if (STRCASEEQ(var->name, "socket_send_buffer") ||
+                STRCASEEQ(var->name, "socket_recv_buffer")) {
+                unsigned int *size = STRCASEEQ(var->name, "socket_send_buffer") ?
+                    &sendBuffer : &recvBuffer;
+
+                if (virStrToLong_ui(var->value, NULL, 10, size) < 0 ||
+                    *size > UINT_MAX / 1024) {
+                    virReportError(VIR_ERR_INVALID_ARG,
+                                   _("Failed to parse value of URI component %s"),
+                                   var->name);
+                    goto failed;
+                }
+                var->ignore = 1;
+                continue;
+            }
+
             if (STRCASEEQ(var->name, "authfile")) {
                 /* Strip this param, used by virauth.c */
                 var->ignore = 1;
@@ -1189,6 +1223,25 @@ doRemoteOpen(virConnectPtr conn,
         }
     }
 
+    if ((sendBuffer || recvBuffer) &&
+        virNetClientSetSocketBufferSizes(priv->client, sendBuffer * 1024,
+                                         recvBuffer * 1024) < 0)
+        goto failed;
+
+    /* Ask early so that the bulky replies to opening the connection
+     * already benefit from it */
+    if (compress > 0) {
+        if (remoteConnectSupportsFeatureUnlocked(conn, priv,
+                                                 VIR_DRV_FEATURE_COMPRESSION)) {
+            virNetClientSetCompressionLevel(priv->client, compress);
+        } else {
+            /* Older servers fail the query since no connection is open */
+            virResetLastError();
+            VIR_INFO("Not compressing messages since the server does not"
+                     " allow it");
+        }
+    }
+
     /* Finally we can call the remote side's open function. */
     {
         remote_connect_open_args args = { &name, flags };
@@ -1200,43 +1253,83 @@ doRemoteOpen(virConnectPtr conn,
             goto failed;
     }
 
-    /* Now try and find out what URI the daemon used */
-    if (conn->uri == NULL) {
+    /* Now query the features we care about and find out what URI the
+     * daemon used, all in one round trip. The URI query goes last so
+     * that its error is the one reported if more calls fail. */
+    {
+        remote_connect_supports_feature_args eventArgs = {
+            VIR_DRV_FEATURE_REMOTE_EVENT_CALLBACK
+        };
+        remote_connect_supports_feature_ret eventRet = { 0 };
+        remote_connect_supports_feature_args closeArgs = {
+            VIR_DRV_FEATURE_REMOTE_CLOSE_CALLBACK
+        };
+        remote_connect_supports_feature_ret closeRet = { 0 };
+        remote_connect_supports_feature_args statsArgs = {
+            VIR_DRV_FEATURE_REMOTE_COMPACT_STATS
+        };
+        remote_connect_supports_feature_ret statsRet = { 0 };
         remote_connect_get_uri_ret uriret;
-
-        VIR_DEBUG("Trying to query remote URI");
+        virNetClientProgramBatchCall calls[] = {
+            { 0, REMOTE_PROC_CONNECT_SUPPORTS_FEATURE,
+              (xdrproc_t) xdr_remote_connect_supports_feature_args, &eventArgs,
+              (xdrproc_t) xdr_remote_connect_supports_feature_ret, &eventRet,
+              -1 },
+            { 0, REMOTE_PROC_CONNECT_SUPPORTS_FEATURE,
+              (xdrproc_t) xdr_remote_connect_supports_feature_args, &closeArgs,
+              (xdrproc_t) xdr_remote_connect_supports_feature_ret, &closeRet,
+              -1 },
+            { 0, REMOTE_PROC_CONNECT_SUPPORTS_FEATURE,
+              (xdrproc_t) xdr_remote_connect_supports_feature_args, &statsArgs,
+              (xdrproc_t) xdr_remote_connect_supports_feature_ret, &statsRet,
+              -1 },
+            { 0, REMOTE_PROC_CONNECT_GET_URI,
+              (xdrproc_t) xdr_void, NULL,
+              (xdrproc_t) xdr_remote_connect_get_uri_ret, &uriret,
+              -1 },
+        };
+        size_t ncalls = ARRAY_CARDINALITY(calls);
+
+        /* No need to ask for the URI if we know it */
+        if (conn->uri)
+            ncalls--;
+
+        VIR_DEBUG("Querying remote features%s",
+                  conn->uri ? "" : " and URI");
         memset(&uriret, 0, sizeof(uriret));
-        if (call(conn, priv, 0,
-                 REMOTE_PROC_CONNECT_GET_URI,
-                 (xdrproc_t) xdr_void, (char *) NULL,
-                 (xdrproc_t) xdr_remote_connect_get_uri_ret, (char *) &uriret) < 0)
+        if (callBatch(conn, priv, 0, calls, ncalls) < 0)
             goto failed;
 
-        VIR_DEBUG("Auto-probed URI is %s", uriret.uri);
-        conn->uri = virURIParse(uriret.uri);
-        VIR_FREE(uriret.uri);
-        if (!conn->uri)
-            goto failed;
+        if (!conn->uri) {
+            if (calls[3].rv < 0)
+                goto failed;
+
+            VIR_DEBUG("Auto-probed URI is %s", uriret.uri);
+            conn->uri = virURIParse(uriret.uri);
+            VIR_FREE(uriret.uri);
+            if (!conn->uri)
+                goto failed;
+        }
+
+        priv->serverEventFilter = calls[0].rv == 0 && eventRet.supported;
+        if (!priv->serverEventFilter) {
+            VIR_INFO("Avoiding server event filtering since it is not "
+                     "supported by the server");
+        }
+
+        priv->serverCloseCallback = calls[1].rv == 0 && closeRet.supported;
+        if (!priv->serverCloseCallback) {
+            VIR_INFO("Close callback registering isn't supported "
+                     "by the remote side.");
+        }
+
+        priv->serverCompactStats = calls[2].rv == 0 && statsRet.supported;
     }
 
     /* Set up events */
     if (!(priv->eventState = virObjectEventStateNew()))
         goto failed;
 
-    priv->serverEventFilter = remoteConnectSupportsFeatureUnlocked(conn,
-                                priv, VIR_DRV_FEATURE_REMOTE_EVENT_CALLBACK);
-    if (!priv->serverEventFilter) {
-        VIR_INFO("Avoiding server event filtering since it is not "
-                 "supported by the server");
-    }
-
-    priv->serverCloseCallback = remoteConnectSupportsFeatureUnlocked(conn,
-                                    priv, VIR_DRV_FEATURE_REMOTE_CLOSE_CALLBACK);
-    if (!priv->serverCloseCallback) {
-        VIR_INFO("Close callback registering isn't supported "
-                 "by the remote side.");
-    }
-
     /* Successful. */
     retcode = VIR_DRV_OPEN_SUCCESS;
 
@@ -5641,15 +5734,19 @@ remoteStreamSend(virStreamPtr st,
 
 
 static int
-remoteStreamRecv(virStreamPtr st,
-                 char *data,
-                 size_t nbytes)
+remoteStreamRecvFlags(virStreamPtr st,
+                      char *data,
+                      size_t nbytes,
+                      unsigned int flags)
 {
-    VIR_DEBUG("st=%p data=%p nbytes=%zu", st, data, nbytes);
+    VIR_DEBUG("st=%p data=%p nbytes=%zu flags=%x",
+              st, data, nbytes, flags);
     struct private_data *priv = st->conn->privateData;
     virNetClientStreamPtr privst = st->privateData;
     int rv;
 
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     if (virNetClientStreamRaiseError(privst))
         return -1;
 
@@ -5661,7 +5758,8 @@ remoteStreamRecv(virStreamPtr st,
                                       priv->client,
                                       data,
                                       nbytes,
-                                      (st->flags & VIR_STREAM_NONBLOCK));
+                                      (st->flags & VIR_STREAM_NONBLOCK),
+                                      flags);
 
     VIR_DEBUG("Done %d", rv);
 
@@ -5671,6 +5769,77 @@ remoteStreamRecv(virStreamPtr st,
     return rv;
 }
 
+static int
+remoteStreamRecv(virStreamPtr st,
+                 char *data,
+                 size_t nbytes)
+{
+    return remoteStreamRecvFlags(st, data, nbytes, 0);
+}
+
+
+static int
+remoteStreamSendHole(virStreamPtr st,
+                     long long length,
+                     unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%lld flags=%x",
+              st, length, flags);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    virCheckFlags(0, -1);
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamSendHole(privst,
+                                    priv->client,
+                                    length,
+                                    flags);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteStreamRecvHole(virStreamPtr st,
+                     long long *length,
+                     unsigned int flags)
+{
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    VIR_DEBUG("st=%p length=%p flags=%x",
+              st, length, flags);
+
+    virCheckFlags(0, -1);
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamRecvHole(priv->client, privst, length);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
 struct remoteStreamCallbackData {
     virStreamPtr st;
     virStreamEventCallback cb;
@@ -5843,7 +6012,10 @@ remoteStreamAbort(virStreamPtr st)
 
 static virStreamDriver remoteStreamDrv = {
     .streamRecv = remoteStreamRecv,
+    .streamRecvFlags = remoteStreamRecvFlags,
     .streamSend = remoteStreamSend,
+    .streamSendHole = remoteStreamSendHole,
+    .streamRecvHole = remoteStreamRecvHole,
     .streamFinish = remoteStreamFinish,
     .streamAbort = remoteStreamAbort,
     .streamEventAddCallback = remoteStreamEventAddCallback,
@@ -6159,7 +6331,8 @@ remoteDomainMigratePrepareTunnel3(virConnectPtr dconn,
 
     if (!(netst = virNetClientStreamNew(priv->remoteProgram,
                                         REMOTE_PROC_DOMAIN_MIGRATE_PREPARE_TUNNEL3,
-                                        priv->counter)))
+                                        priv->counter,
+                                        false)))
         goto done;
 
     if (virNetClientAddStream(priv->client, netst) < 0) {
@@ -6668,6 +6841,42 @@ call(virConnectPtr conn,
 }
 
 
+/*
+ * Makes all @calls in a single round trip; the serials of @calls are
+ * filled in here. See virNetClientProgramCallBatch.
+ */
+static int
+callBatch(virConnectPtr conn ATTRIBUTE_UNUSED,
+          struct private_data *priv,
+          unsigned int flags,
+          virNetClientProgramBatchCallPtr calls,
+          size_t ncalls)
+{
+    int rv;
+    virNetClientProgramPtr prog;
+    virNetClientPtr client = priv->client;
+    size_t i;
+
+    for (i = 0; i < ncalls; i++)
+        calls[i].serial = priv->counter++;
+    priv->localUses++;
+
+    if (flags & REMOTE_CALL_QEMU)
+        prog = priv->qemuProgram;
+    else if (flags & REMOTE_CALL_LXC)
+        prog = priv->lxcProgram;
+    else
+        prog = priv->remoteProgram;
+
+    remoteDriverUnlock(priv);
+    rv = virNetClientProgramCallBatch(prog, client, calls, ncalls);
+    remoteDriverLock(priv);
+    priv->localUses--;
+
+    return rv;
+}
+
+
 static int
 remoteDomainGetInterfaceParameters(virDomainPtr domain,
                                    const char *device,
@@ -7083,7 +7292,8 @@ remoteDomainMigratePrepareTunnel3Params(virConnectPtr dconn,
 
     if (!(netst = virNetClientStreamNew(priv->remoteProgram,
                                         REMOTE_PROC_DOMAIN_MIGRATE_PREPARE_TUNNEL3_PARAMS,
-                                        priv->counter)))
+                                        priv->counter,
+                                        false)))
         goto cleanup;
 
     if (virNetClientAddStream(priv->client, netst) < 0) {
@@ -7602,6 +7812,130 @@ remoteNetworkGetDHCPLeases(virNetworkPtr net,
 }
 
 
+/* Expands the names sent once per reply back into every record */
+static int
+remoteConnectGetAllDomainStatsCompact(virConnectPtr conn,
+                                      virDomainPtr *doms,
+                                      unsigned int ndoms,
+                                      unsigned int stats,
+                                      virDomainStatsRecordPtr **retStats,
+                                      unsigned int flags)
+{
+    struct private_data *priv = conn->privateData;
+    int rv = -1;
+    size_t i, j;
+    remote_connect_get_all_domain_stats_compact_args args;
+    remote_connect_get_all_domain_stats_compact_ret ret;
+    virDomainStatsRecordPtr elem = NULL;
+    virDomainStatsRecordPtr *tmpret = NULL;
+
+    memset(&args, 0, sizeof(args));
+
+    if (ndoms) {
+        if (VIR_ALLOC_N(args.doms.doms_val, ndoms) < 0)
+            goto cleanup;
+
+        for (i = 0; i < ndoms; i++)
+            make_nonnull_domain(args.doms.doms_val + i, doms[i]);
+    }
+    args.doms.doms_len = ndoms;
+
+    args.stats = stats;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+
+    remoteDriverLock(priv);
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS_COMPACT,
+             (xdrproc_t)xdr_remote_connect_get_all_domain_stats_compact_args, (char *)&args,
+             (xdrproc_t)xdr_remote_connect_get_all_domain_stats_compact_ret, (char *)&ret) == -1) {
+        remoteDriverUnlock(priv);
+        goto cleanup;
+    }
+    remoteDriverUnlock(priv);
+
+    if (ret.retStats.retStats_len > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of stats entries is %d, which exceeds max limit: %d"),
+                       ret.retStats.retStats_len, REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    *retStats = NULL;
+
+    if (VIR_ALLOC_N(tmpret, ret.retStats.retStats_len + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ret.retStats.retStats_len; i++) {
+        remote_domain_stats_compact_record *rec = ret.retStats.retStats_val + i;
+
+        if (rec->fields.fields_len != rec->values.values_len ||
+            rec->values.values_len > REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX) {
+            virReportError(VIR_ERR_RPC,
+                           _("malformed stats record with %u names "
+                             "and %u values"),
+                           rec->fields.fields_len, rec->values.values_len);
+            goto cleanup;
+        }
+
+        if (VIR_ALLOC(elem) < 0)
+            goto cleanup;
+
+        if (!(elem->dom = get_nonnull_domain(conn, rec->dom)))
+            goto cleanup;
+
+        if (rec->values.values_len &&
+            VIR_ALLOC_N(elem->params, rec->values.values_len) < 0)
+            goto cleanup;
+
+        for (j = 0; j < rec->values.values_len; j++) {
+            virTypedParameterPtr param = elem->params + j;
+            unsigned int idx = rec->fields.fields_val[j];
+
+            if (idx >= ret.names.names_len) {
+                virReportError(VIR_ERR_RPC,
+                               _("stats parameter name %u out of range"), idx);
+                goto cleanup;
+            }
+
+            if (virStrcpyStatic(param->field, ret.names.names_val[idx]) == NULL) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("parameter %s too big for destination"),
+                               ret.names.names_val[idx]);
+                goto cleanup;
+            }
+
+            if (virTypedParameterDeserializeValue((virTypedParameterRemoteValuePtr)
+                                                  &rec->values.values_val[j],
+                                                  param) < 0)
+                goto cleanup;
+
+            elem->nparams++;
+        }
+
+        tmpret[i] = elem;
+        elem = NULL;
+    }
+
+    *retStats = tmpret;
+    tmpret = NULL;
+    rv = ret.retStats.retStats_len;
+
+ cleanup:
+    if (elem) {
+        virObjectUnref(elem->dom);
+        virTypedParamsFree(elem->params, elem->nparams);
+        VIR_FREE(elem);
+    }
+    virDomainStatsRecordListFree(tmpret);
+    VIR_FREE(args.doms.doms_val);
+    xdr_free((xdrproc_t)xdr_remote_connect_get_all_domain_stats_compact_ret,
+             (char *) &ret);
+
+    return rv;
+}
+
+
 static int
 remoteConnectGetAllDomainStats(virConnectPtr conn,
                                virDomainPtr *doms,
@@ -7618,6 +7952,10 @@ remoteConnectGetAllDomainStats(virConnectPtr conn,
     virDomainStatsRecordPtr elem = NULL;
     virDomainStatsRecordPtr *tmpret = NULL;
 
+    if (priv->serverCompactStats)
+        return remoteConnectGetAllDomainStatsCompact(conn, doms, ndoms, stats,
+                                                     retStats, flags);
+
     memset(&args, 0, sizeof(args));
 
     if (ndoms) {
@@ -8434,6 +8772,8 @@ static virHypervisorDriver hypervisor_driver = {
     .domainSetGuestVcpus = remoteDomainSetGuestVcpus, /* 2.0.0 */
     .domainSetVcpu = remoteDomainSetVcpu, /* 3.1.0 */
     .domainSetBlockThreshold = remoteDomainSetBlockThreshold, /* 3.2.0 */
+    .domainStartDirtyRateCalc = remoteDomainStartDirtyRateCalc, /* 3.4.0 */
+    .domainBlockBackup = remoteDomainBlockBackup, /* 3.4.0 */
 };
 
 static virNetworkDriver network_driver = {
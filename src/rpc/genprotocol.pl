@@ -30,6 +30,89 @@ use strict;
 
 my $in_function = 0;
 my @function = ();
+my $function_name;
+
+# XDR routines for scalars which always occupy the given number of
+# XDR units on the wire, and whether they are signed.  The routines
+# for the enums of the protocol are added as they are generated.
+my %fixed_scalars = (
+    xdr_int => [1, 1],
+    xdr_u_int => [1, 0],
+    xdr_short => [1, 1],
+    xdr_u_short => [1, 0],
+    xdr_char => [1, 1],
+    xdr_u_char => [1, 0],
+    xdr_bool => [1, 0],
+    xdr_int64_t => [2, 1],
+    xdr_uint64_t => [2, 0],
+);
+
+# Structs made only of fixed size scalars, like the return values of
+# virDomainGetInfo or virNodeGetCPUStats, are encoded and decoded
+# field by field, each field going through a separate call and bounds
+# check on the XDR stream.  Reserve the whole struct with a single
+# XDR_INLINE instead, and keep the original code as the slow path
+# for streams which can't provide it.
+sub fixed_layout_fast_path {
+    my @body = @_;
+    my @fields = ();
+    my $units = 0;
+
+    while (@body) {
+        my $line = shift @body;
+        next if $line =~ m/^\s*register int32_t \*buf;$/ || $line =~ m/^\s*$/;
+        last if $line =~ m/^\s*return TRUE;$/;
+
+        return () unless $line =~ m/^\s*if \(!(xdr_\w+) \(xdrs, \&objp->(\w+)\)\)$/;
+        my ($proc, $field) = ($1, $2);
+        return () unless exists $fixed_scalars{$proc};
+
+        $line = shift @body;
+        return () unless defined $line && $line =~ m/^\s*return FALSE;$/;
+
+        push @fields, [$proc, $field];
+        $units += $fixed_scalars{$proc}->[0];
+    }
+    return () if @body || @fields < 2;
+
+    my $in = " " x 8;
+    my @encode = ();
+    my @decode = ();
+    foreach (@fields) {
+        my ($proc, $field) = @$_;
+        my ($size, $signed) = @{$fixed_scalars{$proc}};
+
+        if ($size == 2) {
+            push @encode,
+                "(void)IXDR_PUT_U_INT32(buf, (uint32_t) ((uint64_t) objp->$field >> 32));\n",
+                "(void)IXDR_PUT_U_INT32(buf, (uint32_t) objp->$field);\n";
+            my $cast = $signed ? "(int64_t) " : "";
+            push @decode,
+                "objp->$field = $cast((uint64_t) IXDR_GET_U_INT32(buf) << 32);\n",
+                "objp->$field |= IXDR_GET_U_INT32(buf);\n";
+        } elsif ($proc eq "xdr_bool") {
+            push @encode, "(void)IXDR_PUT_INT32(buf, objp->$field);\n";
+            push @decode, "objp->$field = IXDR_GET_INT32(buf) ? TRUE : FALSE;\n";
+        } elsif ($signed) {
+            push @encode, "(void)IXDR_PUT_INT32(buf, objp->$field);\n";
+            push @decode, "objp->$field = IXDR_GET_INT32(buf);\n";
+        } else {
+            push @encode, "(void)IXDR_PUT_U_INT32(buf, objp->$field);\n";
+            push @decode, "objp->$field = IXDR_GET_U_INT32(buf);\n";
+        }
+    }
+
+    return ("${in}if (xdrs->x_op == XDR_ENCODE || xdrs->x_op == XDR_DECODE) {\n",
+            "${in}${in}buf = XDR_INLINE (xdrs, $units * BYTES_PER_XDR_UNIT);\n",
+            "${in}${in}if (buf != NULL && xdrs->x_op == XDR_ENCODE) {\n",
+            (map { "${in}${in}${in}$_" } @encode),
+            "${in}${in}${in}return TRUE;\n",
+            "${in}${in}} else if (buf != NULL) {\n",
+            (map { "${in}${in}${in}$_" } @decode),
+            "${in}${in}${in}return TRUE;\n",
+            "${in}${in}}\n",
+            "${in}}\n");
+}
 
 my $rpcgen = shift;
 my $mode = shift;
@@ -60,6 +143,8 @@ while (<RPCGEN>) {
         next;
     }
 
+    $function_name = $1 if m/^(xdr_\w+) \(/;
+
     if (m/^{/) {
         $in_function = 1;
         print TARGET;
@@ -83,6 +168,18 @@ while (<RPCGEN>) {
 
         # Note: The body of the function is in @function.
 
+        if (defined $function_name &&
+            grep(/^\s*if \(!xdr_enum \(xdrs, \(enum_t \*\) objp\)\)$/, @function) &&
+            grep(/^\s*if \(/, @function) == 1) {
+            $fixed_scalars{$function_name} = [1, 1];
+        }
+
+        my @fast_path = fixed_layout_fast_path(@function);
+        if (@fast_path) {
+            my $decl = shift @function;
+            unshift @function, $decl, "\n", @fast_path;
+        }
+
         # Remove decl of buf, if buf isn't used in the function.
         my @uses = grep /[^.>]\bbuf\b/, @function;
         @function = grep !/[^.>]\bbuf\b/, @function if @uses == 1;
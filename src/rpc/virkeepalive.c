@@ -31,6 +31,7 @@
 #include "virkeepaliveprotocol.h"
 #include "virkeepalive.h"
 #include "virprobe.h"
+#include "virtimerwheel.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -44,7 +45,7 @@ struct _virKeepAlive {
     unsigned int countToDeath;
     time_t lastPacketReceived;
     time_t intervalStart;
-    int timer;
+    virTimerWheelEntryPtr timer;
 
     virKeepAliveSendFunc sendCB;
     virKeepAliveDeadFunc deadCB;
@@ -56,6 +57,9 @@ struct _virKeepAlive {
 static virClassPtr virKeepAliveClass;
 static void virKeepAliveDispose(void *obj);
 
+/* All the keepalive timers share a single event loop timeout */
+static virTimerWheelPtr virKeepAliveWheel;
+
 static int virKeepAliveOnceInit(void)
 {
     if (!(virKeepAliveClass = virClassNew(virClassForObjectLockable(),
@@ -64,6 +68,9 @@ static int virKeepAliveOnceInit(void)
                                           virKeepAliveDispose)))
         return -1;
 
+    if (!(virKeepAliveWheel = virTimerWheelNew()))
+        return -1;
+
     return 0;
 }
 
@@ -114,6 +121,15 @@ virKeepAliveMessage(virKeepAlivePtr ka, int proc)
 }
 
 
+static void
+virKeepAliveUpdateTimer(virKeepAlivePtr ka,
+                        int timeout)
+{
+    if (ka->timer)
+        virTimerWheelUpdate(virKeepAliveWheel, ka->timer, timeout);
+}
+
+
 static bool
 virKeepAliveTimerInternal(virKeepAlivePtr ka,
                           virNetMessagePtr *msg)
@@ -126,7 +142,7 @@ virKeepAliveTimerInternal(virKeepAlivePtr ka,
 
     if (now - ka->intervalStart < ka->interval) {
         timeval = ka->interval - (now - ka->intervalStart);
-        virEventUpdateTimeout(ka->timer, timeval * 1000);
+        virKeepAliveUpdateTimer(ka, timeval * 1000);
         return false;
     }
 
@@ -146,14 +162,14 @@ virKeepAliveTimerInternal(virKeepAlivePtr ka,
         ka->countToDeath--;
         ka->intervalStart = now;
         *msg = virKeepAliveMessage(ka, KEEPALIVE_PROC_PING);
-        virEventUpdateTimeout(ka->timer, ka->interval * 1000);
+        virKeepAliveUpdateTimer(ka, ka->interval * 1000);
         return false;
     }
 }
 
 
 static void
-virKeepAliveTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
+virKeepAliveTimer(virTimerWheelEntryPtr entry ATTRIBUTE_UNUSED, void *opaque)
 {
     virKeepAlivePtr ka = opaque;
     virNetMessagePtr msg = NULL;
@@ -204,7 +220,6 @@ virKeepAliveNew(int interval,
     ka->interval = interval;
     ka->count = count;
     ka->countToDeath = count;
-    ka->timer = -1;
     ka->client = client;
     ka->sendCB = sendCB;
     ka->deadCB = deadCB;
@@ -242,7 +257,7 @@ virKeepAliveStart(virKeepAlivePtr ka,
 
     virObjectLock(ka);
 
-    if (ka->timer >= 0) {
+    if (ka->timer) {
         VIR_DEBUG("Keepalive messages already enabled");
         ret = 0;
         goto cleanup;
@@ -282,9 +297,9 @@ virKeepAliveStart(virKeepAlivePtr ka,
     else
         timeout = ka->interval - delay;
     ka->intervalStart = now - (ka->interval - timeout);
-    ka->timer = virEventAddTimeout(timeout * 1000, virKeepAliveTimer,
-                                   ka, virObjectFreeCallback);
-    if (ka->timer < 0)
+    ka->timer = virTimerWheelAdd(virKeepAliveWheel, timeout * 1000,
+                                 virKeepAliveTimer, ka, virObjectFreeCallback);
+    if (!ka->timer)
         goto cleanup;
 
     /* the timer now has another reference to this object */
@@ -306,9 +321,9 @@ virKeepAliveStop(virKeepAlivePtr ka)
           "ka=%p client=%p",
           ka, ka->client);
 
-    if (ka->timer > 0) {
-        virEventRemoveTimeout(ka->timer);
-        ka->timer = -1;
+    if (ka->timer) {
+        virTimerWheelRemove(virKeepAliveWheel, ka->timer);
+        ka->timer = NULL;
     }
 
     virObjectUnlock(ka);
@@ -406,8 +421,7 @@ virKeepAliveCheckMessage(virKeepAlivePtr ka,
         }
     }
 
-    if (ka->timer >= 0)
-        virEventUpdateTimeout(ka->timer, ka->interval * 1000);
+    virKeepAliveUpdateTimer(ka, ka->interval * 1000);
 
     virObjectUnlock(ka);
 
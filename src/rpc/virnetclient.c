@@ -59,6 +59,7 @@ struct _virNetClientCall {
     bool expectReply;
     bool nonBlock;
     bool haveThread;
+    bool batched; /* owned by virNetClientSendWithReplyBatch */
 
     virCond cond;
 
@@ -109,6 +110,9 @@ struct _virNetClient {
     int closeReason;
     virErrorPtr error;
 
+    /* zlib level of outgoing messages, 0 if not compressing */
+    int compressionLevel;
+
     virNetClientCloseFunc closeCb;
     void *closeOpaque;
     virFreeCallback closeFf;
@@ -257,6 +261,46 @@ virNetClientKeepAliveIsSupported(virNetClientPtr client)
     return supported;
 }
 
+/**
+ * virNetClientSetCompressionLevel:
+ * @client: the client
+ * @level: zlib compression level, 0 to stop compressing
+ *
+ * Compress the messages sent from now on. The server has to agree to
+ * accept compressed messages before this is called.
+ */
+void
+virNetClientSetCompressionLevel(virNetClientPtr client,
+                                int level)
+{
+    virObjectLock(client);
+    client->compressionLevel = level;
+    virObjectUnlock(client);
+}
+
+/**
+ * virNetClientSetSocketBufferSizes:
+ * @client: the client
+ * @sendSize: size in bytes of the kernel send buffer, 0 for the default
+ * @recvSize: size in bytes of the kernel receive buffer, 0 for the default
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virNetClientSetSocketBufferSizes(virNetClientPtr client,
+                                 unsigned int sendSize,
+                                 unsigned int recvSize)
+{
+    int ret = 0;
+
+    virObjectLock(client);
+    if (client->sock)
+        ret = virNetSocketSetBufferSizes(client->sock, sendSize, recvSize);
+    virObjectUnlock(client);
+
+    return ret;
+}
+
 int
 virNetClientKeepAliveStart(virNetClientPtr client,
                            int interval,
@@ -1124,7 +1168,7 @@ virNetClientCallDispatchReply(virNetClientPtr client)
         return -1;
     }
 
-    if (VIR_REALLOC_N(thecall->msg->buffer, client->msg.bufferLength) < 0)
+    if (virNetMessageGrowBuffer(thecall->msg, client->msg.bufferLength, 0) < 0)
         return -1;
 
     memcpy(thecall->msg->buffer, client->msg.buffer, client->msg.bufferLength);
@@ -1284,6 +1328,7 @@ virNetClientCallDispatch(virNetClientPtr client)
         return virNetClientCallDispatchMessage(client);
 
     case VIR_NET_STREAM: /* Stream protocol */
+    case VIR_NET_STREAM_HOLE: /* Sparse stream protocol */
         return virNetClientCallDispatchStream(client);
 
     default:
@@ -1296,70 +1341,114 @@ virNetClientCallDispatch(virNetClientPtr client)
 }
 
 
-static ssize_t
-virNetClientIOWriteMessage(virNetClientPtr client,
-                           virNetClientCallPtr thecall)
-{
-    ssize_t ret = 0;
-
-    if (thecall->msg->bufferOffset < thecall->msg->bufferLength) {
-        ret = virNetSocketWrite(client->sock,
-                                thecall->msg->buffer + thecall->msg->bufferOffset,
-                                thecall->msg->bufferLength - thecall->msg->bufferOffset);
-        if (ret <= 0)
-            return ret;
+/*
+ * Upper bound on the number of queued calls handed to the
+ * socket in a single write
+ */
+#define VIR_NET_CLIENT_WRITE_BATCH 16
 
-        thecall->msg->bufferOffset += ret;
-    }
+/*
+ * Pass the FDs of @thecall once all its data is sent and move it to
+ * its next state
+ *
+ * Returns 1 when done, 0 if it would block, -1 on error
+ */
+static int
+virNetClientIOFinishMessage(virNetClientPtr client,
+                            virNetClientCallPtr thecall)
+{
+    size_t i;
 
-    if (thecall->msg->bufferOffset == thecall->msg->bufferLength) {
-        size_t i;
-        for (i = thecall->msg->donefds; i < thecall->msg->nfds; i++) {
-            int rv;
-            if ((rv = virNetSocketSendFD(client->sock, thecall->msg->fds[i])) < 0)
-                return -1;
-            if (rv == 0) /* Blocking */
-                return 0;
-            thecall->msg->donefds++;
-        }
-        virNetMessageClearPayload(thecall->msg);
-        if (thecall->expectReply)
-            thecall->mode = VIR_NET_CLIENT_MODE_WAIT_RX;
-        else
-            thecall->mode = VIR_NET_CLIENT_MODE_COMPLETE;
+    for (i = thecall->msg->donefds; i < thecall->msg->nfds; i++) {
+        int rv;
+        if ((rv = virNetSocketSendFD(client->sock, thecall->msg->fds[i])) < 0)
+            return -1;
+        if (rv == 0) /* Blocking */
+            return 0;
+        thecall->msg->donefds++;
     }
+    virNetMessageClearPayload(thecall->msg);
+    if (thecall->expectReply)
+        thecall->mode = VIR_NET_CLIENT_MODE_WAIT_RX;
+    else
+        thecall->mode = VIR_NET_CLIENT_MODE_COMPLETE;
 
-    return ret;
+    return 1;
 }
 
 
 static ssize_t
 virNetClientIOHandleOutput(virNetClientPtr client)
 {
-    virNetClientCallPtr thecall = client->waitDispatch;
+    struct iovec iov[VIR_NET_CLIENT_WRITE_BATCH];
+    virNetClientCallPtr thecall;
+    virNetClientCallPtr call;
+    size_t niov;
+    size_t done;
+    ssize_t ret;
+    int rv;
 
-    while (thecall &&
-           thecall->mode != VIR_NET_CLIENT_MODE_WAIT_TX)
-        thecall = thecall->next;
+    for (;;) {
+        thecall = client->waitDispatch;
+        while (thecall &&
+               thecall->mode != VIR_NET_CLIENT_MODE_WAIT_TX)
+            thecall = thecall->next;
+
+        if (!thecall)
+            return 0; /* This can happen if another thread raced with us and
+                       * completed the call between the time this thread woke
+                       * up from poll()ing and the time we locked the client
+                       */
+
+        /* Let the socket coalesce the calls waiting to be sent.
+         * Batching stops at a call carrying FDs, since those must be
+         * passed before anything that follows it */
+        niov = 0;
+        for (call = thecall;
+             call && niov < VIR_NET_CLIENT_WRITE_BATCH;
+             call = call->next) {
+            if (call->mode != VIR_NET_CLIENT_MODE_WAIT_TX)
+                continue;
+
+            if (call->msg->bufferOffset < call->msg->bufferLength) {
+                iov[niov].iov_base = call->msg->buffer + call->msg->bufferOffset;
+                iov[niov].iov_len = call->msg->bufferLength - call->msg->bufferOffset;
+                niov++;
+            }
 
-    if (!thecall)
-        return 0; /* This can happen if another thread raced with us and
-                   * completed the call between the time this thread woke
-                   * up from poll()ing and the time we locked the client
-                   */
+            if (call->msg->nfds)
+                break;
+        }
 
-    while (thecall) {
-        ssize_t ret = virNetClientIOWriteMessage(client, thecall);
-        if (ret < 0)
-            return ret;
+        if (niov > 0) {
+            if ((ret = virNetSocketWritev(client->sock, iov, niov)) <= 0)
+                return ret; /* -1 error, 0 = blocking */
 
-        if (thecall->mode == VIR_NET_CLIENT_MODE_WAIT_TX)
-            return 0; /* Blocking write, to back to event loop */
+            /* Account the written data against each call in turn */
+            done = ret;
+            for (call = thecall; call && done > 0; call = call->next) {
+                size_t len;
 
-        thecall = thecall->next;
-    }
+                if (call->mode != VIR_NET_CLIENT_MODE_WAIT_TX)
+                    continue;
+
+                len = MIN(done, call->msg->bufferLength - call->msg->bufferOffset);
+                call->msg->bufferOffset += len;
+                done -= len;
+            }
+        }
+
+        for (call = thecall; call; call = call->next) {
+            if (call->mode != VIR_NET_CLIENT_MODE_WAIT_TX)
+                continue;
 
-    return 0; /* No more calls to send, all done */
+            if (call->msg->bufferOffset < call->msg->bufferLength)
+                return 0; /* Partial write, back to event loop */
+
+            if ((rv = virNetClientIOFinishMessage(client, call)) <= 0)
+                return rv;
+        }
+    }
 }
 
 static ssize_t
@@ -1371,7 +1460,7 @@ virNetClientIOReadMessage(virNetClientPtr client)
     /* Start by reading length word */
     if (client->msg.bufferLength == 0) {
         client->msg.bufferLength = 4;
-        if (VIR_ALLOC_N(client->msg.buffer, client->msg.bufferLength) < 0)
+        if (virNetMessageGrowBuffer(&client->msg, client->msg.bufferLength, 0) < 0)
             return -ENOMEM;
     }
 
@@ -1516,6 +1605,8 @@ static bool virNetClientIOEventLoopRemoveDone(virNetClientCallPtr call,
     if (call->haveThread) {
         VIR_DEBUG("Waking up sleep %p", call);
         virCondSignal(&call->cond);
+    } else if (call->batched) {
+        VIR_DEBUG("Completed batched call %p", call);
     } else {
         VIR_DEBUG("Removing completed call %p", call);
         if (call->expectReply)
@@ -1547,6 +1638,9 @@ virNetClientIOEventLoopRemoveAll(virNetClientCallPtr call,
         return false;
 
     VIR_DEBUG("Removing call %p", call);
+    /* The batch will notice the call was dropped and free it */
+    if (call->batched)
+        return true;
     virCondDestroy(&call->cond);
     VIR_FREE(call->msg);
     VIR_FREE(call);
@@ -1863,10 +1957,12 @@ static void virNetClientIOUpdateCallback(virNetClientPtr client,
  * Returns 1 if the call was queued and will be completed later (only
  * for nonBlock == true), 0 if the call was completed and -1 on error.
  */
+static int virNetClientIOWait(virNetClientPtr client,
+                              virNetClientCallPtr thiscall);
+
 static int virNetClientIO(virNetClientPtr client,
                           virNetClientCallPtr thiscall)
 {
-    int rv = -1;
 
     VIR_DEBUG("Outgoing message prog=%u version=%u serial=%u proc=%d type=%d length=%zu dispatch=%p",
               thiscall->msg->header.prog,
@@ -1880,6 +1976,23 @@ static int virNetClientIO(virNetClientPtr client,
     /* Stick ourselves on the end of the wait queue */
     virNetClientCallQueue(&client->waitDispatch, thiscall);
 
+    return virNetClientIOWait(client, thiscall);
+}
+
+
+/*
+ * Waits until @thiscall, which is already in the wait queue, is
+ * completed, either by another thread holding the buck or by this
+ * thread taking the buck.
+ *
+ * Returns 1 if the call was queued and will be completed later (only
+ * for nonBlock == true), 0 if the call was completed and -1 on error.
+ */
+static int virNetClientIOWait(virNetClientPtr client,
+                              virNetClientCallPtr thiscall)
+{
+    int rv = -1;
+
     /* Check to see if another thread is dispatching */
     if (client->haveTheBuck) {
         char ignore = 1;
@@ -2028,7 +2141,8 @@ void virNetClientIncomingEvent(virNetSocketPtr sock,
 
 
 static virNetClientCallPtr
-virNetClientCallNew(virNetMessagePtr msg,
+virNetClientCallNew(virNetClientPtr client,
+                    virNetMessagePtr msg,
                     bool expectReply,
                     bool nonBlock)
 {
@@ -2050,6 +2164,10 @@ virNetClientCallNew(virNetMessagePtr msg,
         goto error;
     }
 
+    if (msg->bufferLength &&
+        virNetMessageCompress(msg, client->compressionLevel) < 0)
+        goto error;
+
     if (VIR_ALLOC(call) < 0)
         goto error;
 
@@ -2092,7 +2210,7 @@ virNetClientQueueNonBlocking(virNetClientPtr client,
           msg->header.prog, msg->header.vers, msg->header.proc,
           msg->header.type, msg->header.status, msg->header.serial);
 
-    if (!(call = virNetClientCallNew(msg, false, true)))
+    if (!(call = virNetClientCallNew(client, msg, false, true)))
         return -1;
 
     virNetClientCallQueue(&client->waitDispatch, call);
@@ -2124,7 +2242,7 @@ static int virNetClientSendInternal(virNetClientPtr client,
         return -1;
     }
 
-    if (!(call = virNetClientCallNew(msg, expectReply, nonBlock)))
+    if (!(call = virNetClientCallNew(client, msg, expectReply, nonBlock)))
         return -1;
 
     call->haveThread = true;
@@ -2164,6 +2282,116 @@ int virNetClientSendWithReply(virNetClientPtr client,
 }
 
 
+static bool
+virNetClientCallIsSame(virNetClientCallPtr call,
+                       void *opaque)
+{
+    return call == opaque;
+}
+
+
+/*
+ * @msgs: messages allocated on heap or stack
+ * @nmsgs: number of messages in @msgs
+ *
+ * Send all messages without waiting for a reply between them and then
+ * wait until the replies to all of them arrive, so that a batch of
+ * calls only costs a single round trip. The replies may arrive in any
+ * order.
+ *
+ * The caller is responsible for free'ing @msgs if they were allocated
+ * on the heap
+ *
+ * Returns 0 when all replies were received, -1 on failure
+ */
+int virNetClientSendWithReplyBatch(virNetClientPtr client,
+                                   virNetMessagePtr *msgs,
+                                   size_t nmsgs)
+{
+    virNetClientCallPtr *calls = NULL;
+    size_t ncalls = 0;
+    bool broken = false;
+    size_t i;
+    int ret = -1;
+
+    virObjectLock(client);
+
+    if (!client->sock || client->wantClose) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(calls, nmsgs) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nmsgs; i++) {
+        virNetMessagePtr msg = msgs[i];
+
+        PROBE(RPC_CLIENT_MSG_TX_QUEUE,
+              "client=%p len=%zu prog=%u vers=%u proc=%u type=%u status=%u serial=%u",
+              client, msg->bufferLength,
+              msg->header.prog, msg->header.vers, msg->header.proc,
+              msg->header.type, msg->header.status, msg->header.serial);
+
+        if (!(calls[i] = virNetClientCallNew(client, msg, true, false)))
+            goto cleanup;
+        ncalls++;
+
+        /* No thread waits for the call until we get to it below */
+        calls[i]->batched = true;
+        virNetClientCallQueue(&client->waitDispatch, calls[i]);
+    }
+
+    VIR_DEBUG("Queued %zu batched calls", ncalls);
+
+    for (i = 0; i < ncalls; i++) {
+        virNetClientCallPtr call = calls[i];
+
+        /* Completed while we were waiting for a previous one */
+        if (call->mode == VIR_NET_CLIENT_MODE_COMPLETE)
+            continue;
+
+        if (!virNetClientCallMatchPredicate(client->waitDispatch,
+                                            virNetClientCallIsSame, call)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("client socket is closed"));
+            goto cleanup;
+        }
+
+        call->batched = false;
+        call->haveThread = true;
+        if (virNetClientIOWait(client, call) < 0 &&
+            call->mode != VIR_NET_CLIENT_MODE_COMPLETE)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < ncalls; i++) {
+        virNetClientCallPtr call = calls[i];
+
+        /* Leaving a partially sent message behind would corrupt the
+         * stream, the connection is not usable anymore */
+        if (call->mode == VIR_NET_CLIENT_MODE_WAIT_TX &&
+            call->msg->bufferOffset > 0)
+            broken = true;
+
+        virNetClientCallRemove(&client->waitDispatch, call);
+        virCondDestroy(&call->cond);
+        VIR_FREE(call);
+    }
+    VIR_FREE(calls);
+
+    if (broken && client->sock && !client->wantClose)
+        virNetClientMarkClose(client, VIR_CONNECT_CLOSE_REASON_ERROR);
+
+    virObjectUnlock(client);
+    return ret;
+}
+
+
 /*
  * @msg: a message allocated on heap or stack
  *
@@ -111,6 +111,10 @@ void virNetClientRemoveStream(virNetClientPtr client,
 int virNetClientSendWithReply(virNetClientPtr client,
                               virNetMessagePtr msg);
 
+int virNetClientSendWithReplyBatch(virNetClientPtr client,
+                                   virNetMessagePtr *msgs,
+                                   size_t nmsgs);
+
 int virNetClientSendNoReply(virNetClientPtr client,
                             virNetMessagePtr msg);
 
@@ -143,6 +147,12 @@ int virNetClientGetTLSKeySize(virNetClientPtr client);
 
 void virNetClientClose(virNetClientPtr client);
 
+void virNetClientSetCompressionLevel(virNetClientPtr client,
+                                     int level);
+int virNetClientSetSocketBufferSizes(virNetClientPtr client,
+                                     unsigned int sendSize,
+                                     unsigned int recvSize);
+
 bool virNetClientKeepAliveIsSupported(virNetClientPtr client);
 int virNetClientKeepAliveStart(virNetClientPtr client,
                                int interval,
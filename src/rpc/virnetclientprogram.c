@@ -268,27 +268,19 @@ int virNetClientProgramDispatch(virNetClientProgramPtr prog,
 }
 
 
-int virNetClientProgramCall(virNetClientProgramPtr prog,
-                            virNetClientPtr client,
-                            unsigned serial,
-                            int proc,
-                            size_t noutfds,
-                            int *outfds,
-                            size_t *ninfds,
-                            int **infds,
-                            xdrproc_t args_filter, void *args,
-                            xdrproc_t ret_filter, void *ret)
+static virNetMessagePtr
+virNetClientProgramEncodeCall(virNetClientProgramPtr prog,
+                              unsigned serial,
+                              int proc,
+                              size_t noutfds,
+                              int *outfds,
+                              xdrproc_t args_filter, void *args)
 {
     virNetMessagePtr msg;
     size_t i;
 
-    if (infds)
-        *infds = NULL;
-    if (ninfds)
-        *ninfds = 0;
-
     if (!(msg = virNetMessageNew(false)))
-        return -1;
+        return NULL;
 
     msg->header.prog = prog->program;
     msg->header.vers = prog->version;
@@ -326,8 +318,24 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
     if (virNetMessageEncodePayload(msg, args_filter, args) < 0)
         goto error;
 
-    if (virNetClientSendWithReply(client, msg) < 0)
-        goto error;
+    return msg;
+
+ error:
+    virNetMessageFree(msg);
+    return NULL;
+}
+
+
+static int
+virNetClientProgramDecodeReply(virNetClientProgramPtr prog,
+                               virNetMessagePtr msg,
+                               unsigned serial,
+                               int proc,
+                               size_t *ninfds,
+                               int **infds,
+                               xdrproc_t ret_filter, void *ret)
+{
+    size_t i;
 
     /* None of these 3 should ever happen here, because
      * virNetClientSend should have validated the reply,
@@ -390,15 +398,107 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
         goto error;
     }
 
-    virNetMessageFree(msg);
-
     return 0;
 
  error:
-    virNetMessageFree(msg);
     if (infds && ninfds) {
         for (i = 0; i < *ninfds; i++)
             VIR_FORCE_CLOSE((*infds)[i]);
     }
     return -1;
 }
+
+
+int virNetClientProgramCall(virNetClientProgramPtr prog,
+                            virNetClientPtr client,
+                            unsigned serial,
+                            int proc,
+                            size_t noutfds,
+                            int *outfds,
+                            size_t *ninfds,
+                            int **infds,
+                            xdrproc_t args_filter, void *args,
+                            xdrproc_t ret_filter, void *ret)
+{
+    virNetMessagePtr msg;
+    int rv = -1;
+
+    if (infds)
+        *infds = NULL;
+    if (ninfds)
+        *ninfds = 0;
+
+    if (!(msg = virNetClientProgramEncodeCall(prog, serial, proc,
+                                              noutfds, outfds,
+                                              args_filter, args)))
+        return -1;
+
+    if (virNetClientSendWithReply(client, msg) < 0)
+        goto cleanup;
+
+    rv = virNetClientProgramDecodeReply(prog, msg, serial, proc,
+                                        ninfds, infds, ret_filter, ret);
+
+ cleanup:
+    virNetMessageFree(msg);
+    return rv;
+}
+
+
+/**
+ * virNetClientProgramCallBatch:
+ * @prog: the program
+ * @client: the client to send the calls over
+ * @calls: the calls to make
+ * @ncalls: number of items in @calls
+ *
+ * Sends all @calls at once and waits for all their replies, saving a
+ * round trip per call compared to virNetClientProgramCall. The result
+ * of each call is stored in its @rv member; an error in one call does
+ * not affect the others. If more calls fail, the error of the last one
+ * is the one reported.
+ *
+ * Returns 0 if the calls were made (even if some of them failed), -1 if
+ * they could not be sent or their replies could not be received.
+ */
+int virNetClientProgramCallBatch(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 virNetClientProgramBatchCallPtr calls,
+                                 size_t ncalls)
+{
+    virNetMessagePtr *msgs = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(msgs, ncalls) < 0)
+        return -1;
+
+    for (i = 0; i < ncalls; i++) {
+        calls[i].rv = -1;
+        if (!(msgs[i] = virNetClientProgramEncodeCall(prog, calls[i].serial,
+                                                      calls[i].proc, 0, NULL,
+                                                      calls[i].args_filter,
+                                                      calls[i].args)))
+            goto cleanup;
+    }
+
+    if (virNetClientSendWithReplyBatch(client, msgs, ncalls) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncalls; i++) {
+        calls[i].rv = virNetClientProgramDecodeReply(prog, msgs[i],
+                                                     calls[i].serial,
+                                                     calls[i].proc,
+                                                     NULL, NULL,
+                                                     calls[i].ret_filter,
+                                                     calls[i].ret);
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < ncalls; i++)
+        virNetMessageFree(msgs[i]);
+    VIR_FREE(msgs);
+    return ret;
+}
@@ -81,6 +81,23 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
                             xdrproc_t args_filter, void *args,
                             xdrproc_t ret_filter, void *ret);
 
+typedef struct _virNetClientProgramBatchCall virNetClientProgramBatchCall;
+typedef virNetClientProgramBatchCall *virNetClientProgramBatchCallPtr;
+struct _virNetClientProgramBatchCall {
+    unsigned serial;
+    int proc;
+    xdrproc_t args_filter;
+    void *args;
+    xdrproc_t ret_filter;
+    void *ret;
+    int rv; /* filled in: 0 on success, -1 if the call failed */
+};
+
+int virNetClientProgramCallBatch(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 virNetClientProgramBatchCallPtr calls,
+                                 size_t ncalls);
+
 
 
 #endif /* __VIR_NET_CLIENT_PROGRAM_H__ */
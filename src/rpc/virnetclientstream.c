@@ -52,6 +52,9 @@ struct _virNetClientStream {
     virNetMessagePtr rx;
     bool incomingEOF;
 
+    bool allowSkip;
+    long long holeLength;  /* Size of incoming hole in stream. */
+
     virNetClientStreamEventCallback cb;
     void *cbOpaque;
     virFreeCallback cbFree;
@@ -86,7 +89,7 @@ virNetClientStreamEventTimerUpdate(virNetClientStreamPtr st)
 
     VIR_DEBUG("Check timer rx=%p cbEvents=%d", st->rx, st->cbEvents);
 
-    if (((st->rx || st->incomingEOF) &&
+    if (((st->rx || st->incomingEOF || st->holeLength) &&
          (st->cbEvents & VIR_STREAM_EVENT_READABLE)) ||
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE)) {
         VIR_DEBUG("Enabling event timer");
@@ -108,7 +111,7 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_READABLE) &&
-        (st->rx || st->incomingEOF))
+        (st->rx || st->incomingEOF || st->holeLength))
         events |= VIR_STREAM_EVENT_READABLE;
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE))
@@ -135,7 +138,8 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
 virNetClientStreamPtr virNetClientStreamNew(virNetClientProgramPtr prog,
                                             int proc,
-                                            unsigned serial)
+                                            unsigned serial,
+                                            bool allowSkip)
 {
     virNetClientStreamPtr st;
 
@@ -148,6 +152,7 @@ virNetClientStreamPtr virNetClientStreamNew(virNetClientProgramPtr prog,
     st->prog = virObjectRef(prog);
     st->proc = proc;
     st->serial = serial;
+    st->allowSkip = allowSkip;
 
     return st;
 }
@@ -279,10 +284,11 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
 
     /* Steal message buffer */
     tmp_msg->buffer = msg->buffer;
+    tmp_msg->bufferSize = msg->bufferSize;
     tmp_msg->bufferLength = msg->bufferLength;
     tmp_msg->bufferOffset = msg->bufferOffset;
     msg->buffer = NULL;
-    msg->bufferLength = msg->bufferOffset = 0;
+    msg->bufferSize = msg->bufferLength = msg->bufferOffset = 0;
 
     virObjectLock(st);
 
@@ -348,19 +354,73 @@ int virNetClientStreamSendPacket(virNetClientStreamPtr st,
     return -1;
 }
 
+/*
+ * Decode the hole packet at the head of the incoming queue of @st
+ * and account for it in @st->holeLength. Called with @st locked.
+ */
+static int
+virNetClientStreamHandleHole(virNetClientStreamPtr st)
+{
+    virNetMessagePtr msg = st->rx;
+    virNetStreamHole data;
+    int ret = -1;
+
+    VIR_DEBUG("st=%p msg=%p", st, msg);
+
+    memset(&data, 0, sizeof(data));
+
+    if (!st->allowSkip) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unexpected stream hole"));
+        goto cleanup;
+    }
+
+    if (virNetMessageDecodePayload(msg,
+                                   (xdrproc_t) xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto cleanup;
+
+    if (data.flags) {
+        virReportError(VIR_ERR_RPC,
+                       _("Unsupported stream hole flags %x"),
+                       data.flags);
+        goto cleanup;
+    }
+
+    if (data.length < 0) {
+        virReportError(VIR_ERR_RPC,
+                       _("Invalid stream hole length %lld"),
+                       (long long) data.length);
+        goto cleanup;
+    }
+
+    st->holeLength += data.length;
+    ret = 0;
+
+ cleanup:
+    virNetMessageQueueServe(&st->rx);
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
 int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  char *data,
                                  size_t nbytes,
-                                 bool nonblock)
+                                 bool nonblock,
+                                 unsigned int flags)
 {
     int rv = -1;
     size_t want;
 
-    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d",
-              st, client, data, nbytes, nonblock);
+    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d flags=%x",
+              st, client, data, nbytes, nonblock, flags);
+
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     virObjectLock(st);
-    if (!st->rx && !st->incomingEOF) {
+    if (!st->rx && !st->incomingEOF && !st->holeLength) {
         virNetMessagePtr msg;
         int ret;
 
@@ -390,12 +450,32 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
             goto cleanup;
     }
 
-    VIR_DEBUG("After IO rx=%p", st->rx);
+    VIR_DEBUG("After IO rx=%p holeLength=%lld", st->rx, st->holeLength);
     want = nbytes;
-    while (want && st->rx) {
+    while (want && (st->rx || st->holeLength)) {
         virNetMessagePtr msg = st->rx;
         size_t len = want;
 
+        if (msg && msg->header.type == VIR_NET_STREAM_HOLE) {
+            if (virNetClientStreamHandleHole(st) < 0)
+                goto cleanup;
+            continue;
+        }
+
+        if (st->holeLength) {
+            if (flags & VIR_STREAM_RECV_STOP_AT_HOLE)
+                break;
+
+            /* Pretend holeLength zeroes was read from stream. */
+            if (len > st->holeLength)
+                len = st->holeLength;
+
+            memset(data + (nbytes - want), 0, len);
+            want -= len;
+            st->holeLength -= len;
+            continue;
+        }
+
         if (len > msg->bufferLength - msg->bufferOffset)
             len = msg->bufferLength - msg->bufferOffset;
 
@@ -413,6 +493,9 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
     }
     rv = nbytes - want;
 
+    if (rv == 0 && st->holeLength)
+        rv = -3; /* Stopped at a hole */
+
     virNetClientStreamEventTimerUpdate(st);
 
  cleanup:
@@ -421,6 +504,92 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
 }
 
 
+int virNetClientStreamSendHole(virNetClientStreamPtr st,
+                               virNetClientPtr client,
+                               long long length,
+                               unsigned int flags)
+{
+    virNetMessagePtr msg = NULL;
+    virNetStreamHole data;
+    int ret = -1;
+
+    VIR_DEBUG("st=%p length=%lld", st, length);
+
+    if (!st->allowSkip) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Skipping is not supported with this stream"));
+        return -1;
+    }
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+    data.flags = flags;
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+
+    virObjectLock(st);
+
+    msg->header.prog = virNetClientProgramGetProgram(st->prog);
+    msg->header.vers = virNetClientProgramGetVersion(st->prog);
+    msg->header.status = VIR_NET_CONTINUE;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = st->serial;
+    msg->header.proc = st->proc;
+
+    virObjectUnlock(st);
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg,
+                                   (xdrproc_t) xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto cleanup;
+
+    if (virNetClientSendNoReply(client, msg) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+int virNetClientStreamRecvHole(virNetClientPtr client ATTRIBUTE_UNUSED,
+                               virNetClientStreamPtr st,
+                               long long *length)
+{
+    int ret = -1;
+
+    VIR_DEBUG("st=%p length=%p", st, length);
+
+    virObjectLock(st);
+
+    if (!st->holeLength &&
+        st->rx && st->rx->header.type == VIR_NET_STREAM_HOLE &&
+        virNetClientStreamHandleHole(st) < 0)
+        goto cleanup;
+
+    if (!st->holeLength) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("no stream hole"));
+        goto cleanup;
+    }
+
+    *length = st->holeLength;
+    st->holeLength = 0;
+
+    virNetClientStreamEventTimerUpdate(st);
+
+    ret = 0;
+ cleanup:
+    virObjectUnlock(st);
+    return ret;
+}
+
+
 int virNetClientStreamEventAddCallback(virNetClientStreamPtr st,
                                        int events,
                                        virNetClientStreamEventCallback cb,
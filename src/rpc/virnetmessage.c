@@ -22,6 +22,9 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#if WITH_ZLIB
+# include <zlib.h>
+#endif
 
 #include "virnetmessage.h"
 #include "viralloc.h"
@@ -30,11 +33,196 @@
 #include "virfile.h"
 #include "virutil.h"
 #include "virstring.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
 VIR_LOG_INIT("rpc.netmessage");
 
+/* Message buffers are taken from a pool of idle buffers split into
+ * size classes, the first one VIR_NET_MESSAGE_INITIAL long and each
+ * following one twice as long as the previous, up to
+ * VIR_NET_MESSAGE_MAX. Every class also includes the length word. */
+#define VIR_NET_MESSAGE_POOL_CLASSES 9
+#define VIR_NET_MESSAGE_POOL_MAX_BYTES_DEFAULT (32 * 1024 * 1024)
+
+/* Messages shorter than this are not worth deflating */
+#define VIR_NET_MESSAGE_COMPRESS_MIN 1024
+
+verify(((size_t) VIR_NET_MESSAGE_INITIAL << (VIR_NET_MESSAGE_POOL_CLASSES - 1)) ==
+       VIR_NET_MESSAGE_MAX);
+
+/* An idle buffer stores the link to the next one in its first bytes */
+typedef struct _virNetMessagePoolBuffer virNetMessagePoolBuffer;
+typedef virNetMessagePoolBuffer *virNetMessagePoolBufferPtr;
+struct _virNetMessagePoolBuffer {
+    virNetMessagePoolBufferPtr next;
+};
+
+static virMutex virNetMessagePoolLock = VIR_MUTEX_INITIALIZER;
+static virNetMessagePoolBufferPtr virNetMessagePool[VIR_NET_MESSAGE_POOL_CLASSES];
+static virNetMessagePoolStats virNetMessagePoolStatistics = {
+    .maxBytes = VIR_NET_MESSAGE_POOL_MAX_BYTES_DEFAULT,
+};
+
+
+static size_t
+virNetMessagePoolClassSize(size_t cls)
+{
+    return ((size_t) VIR_NET_MESSAGE_INITIAL << cls) + VIR_NET_MESSAGE_LEN_MAX;
+}
+
+
+/* Returns a buffer of at least @len bytes and stores its real size in
+ * @size, or NULL if @len exceeds the largest possible message. */
+static char *
+virNetMessagePoolGet(size_t len,
+                     size_t *size)
+{
+    size_t cls = 0;
+    char *buffer = NULL;
+
+    while (virNetMessagePoolClassSize(cls) < len) {
+        if (++cls == VIR_NET_MESSAGE_POOL_CLASSES) {
+            virReportError(VIR_ERR_RPC,
+                           _("message buffer of %zu bytes is too large"), len);
+            return NULL;
+        }
+    }
+    *size = virNetMessagePoolClassSize(cls);
+
+    virMutexLock(&virNetMessagePoolLock);
+    if (virNetMessagePool[cls]) {
+        buffer = (char *) virNetMessagePool[cls];
+        virNetMessagePool[cls] = virNetMessagePool[cls]->next;
+        virNetMessagePoolStatistics.hits++;
+        virNetMessagePoolStatistics.buffers--;
+        virNetMessagePoolStatistics.bytes -= *size;
+    } else {
+        virNetMessagePoolStatistics.misses++;
+    }
+    virMutexUnlock(&virNetMessagePoolLock);
+
+    if (!buffer)
+        ignore_value(VIR_ALLOC_N(buffer, *size));
+
+    return buffer;
+}
+
+
+static void
+virNetMessagePoolPut(char *buffer,
+                     size_t size)
+{
+    virNetMessagePoolBufferPtr idle = (virNetMessagePoolBufferPtr) buffer;
+    size_t cls = 0;
+
+    while (cls < VIR_NET_MESSAGE_POOL_CLASSES &&
+           virNetMessagePoolClassSize(cls) != size)
+        cls++;
+
+    virMutexLock(&virNetMessagePoolLock);
+    if (cls < VIR_NET_MESSAGE_POOL_CLASSES &&
+        virNetMessagePoolStatistics.bytes + size <=
+        virNetMessagePoolStatistics.maxBytes) {
+        idle->next = virNetMessagePool[cls];
+        virNetMessagePool[cls] = idle;
+        virNetMessagePoolStatistics.buffers++;
+        virNetMessagePoolStatistics.bytes += size;
+        buffer = NULL;
+    } else {
+        virNetMessagePoolStatistics.discards++;
+    }
+    virMutexUnlock(&virNetMessagePoolLock);
+
+    VIR_FREE(buffer);
+}
+
+
+/**
+ * virNetMessagePoolGetStats:
+ * @stats: filled with the current counters
+ *
+ * Report the usage of the process wide pool of message buffers shared
+ * by all RPC servers and clients.
+ */
+void
+virNetMessagePoolGetStats(virNetMessagePoolStatsPtr stats)
+{
+    virMutexLock(&virNetMessagePoolLock);
+    *stats = virNetMessagePoolStatistics;
+    virMutexUnlock(&virNetMessagePoolLock);
+}
+
+
+/**
+ * virNetMessagePoolSetMaxBytes:
+ * @maxBytes: limit on memory held by idle buffers, 0 disables the pool
+ *
+ * Idle buffers exceeding the new limit are released immediately.
+ */
+void
+virNetMessagePoolSetMaxBytes(size_t maxBytes)
+{
+    virNetMessagePoolBufferPtr idle;
+    ssize_t cls;
+
+    virMutexLock(&virNetMessagePoolLock);
+    virNetMessagePoolStatistics.maxBytes = maxBytes;
+
+    /* Give back the largest buffers first */
+    for (cls = VIR_NET_MESSAGE_POOL_CLASSES - 1; cls >= 0; cls--) {
+        while (virNetMessagePoolStatistics.bytes > maxBytes &&
+               (idle = virNetMessagePool[cls])) {
+            virNetMessagePool[cls] = idle->next;
+            virNetMessagePoolStatistics.buffers--;
+            virNetMessagePoolStatistics.bytes -= virNetMessagePoolClassSize(cls);
+            VIR_FREE(idle);
+        }
+    }
+    virMutexUnlock(&virNetMessagePoolLock);
+}
+
+
+/**
+ * virNetMessageGrowBuffer:
+ * @msg: the message
+ * @len: minimum size of the buffer
+ * @keep: number of leading bytes of the current buffer to preserve
+ *
+ * Make sure the buffer of @msg can hold at least @len bytes. A new
+ * buffer is taken from the message pool if needed. The declared
+ * length of the message is not changed.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virNetMessageGrowBuffer(virNetMessagePtr msg,
+                        size_t len,
+                        size_t keep)
+{
+    char *buffer;
+    size_t size;
+
+    if (msg->buffer && msg->bufferSize >= len)
+        return 0;
+
+    if (!(buffer = virNetMessagePoolGet(len, &size)))
+        return -1;
+
+    if (msg->buffer) {
+        memcpy(buffer, msg->buffer, keep);
+        if (msg->bufferSize)
+            virNetMessagePoolPut(msg->buffer, msg->bufferSize);
+        else
+            VIR_FREE(msg->buffer);
+    }
+
+    msg->buffer = buffer;
+    msg->bufferSize = size;
+    return 0;
+}
+
 virNetMessagePtr virNetMessageNew(bool tracked)
 {
     virNetMessagePtr msg;
@@ -63,7 +251,12 @@ virNetMessageClearPayload(virNetMessagePtr msg)
 
     msg->bufferOffset = 0;
     msg->bufferLength = 0;
-    VIR_FREE(msg->buffer);
+    if (msg->bufferSize)
+        virNetMessagePoolPut(msg->buffer, msg->bufferSize);
+    else
+        VIR_FREE(msg->buffer);
+    msg->buffer = NULL;
+    msg->bufferSize = 0;
 }
 
 
@@ -134,6 +327,9 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
     }
     msg->bufferOffset = xdr_getpos(&xdr);
 
+    msg->compressed = !!(len & VIR_NET_MESSAGE_LEN_COMPRESSED);
+    len &= ~VIR_NET_MESSAGE_LEN_COMPRESSED;
+
     if (len < VIR_NET_MESSAGE_LEN_MAX) {
         virReportError(VIR_ERR_RPC,
                        _("packet %d bytes received from server too small, want %d"),
@@ -153,9 +349,10 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
 
     /* Extend our declared buffer length and carry
        on reading the header + payload */
-    msg->bufferLength += len;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageGrowBuffer(msg, msg->bufferLength + len,
+                                msg->bufferLength) < 0)
         goto cleanup;
+    msg->bufferLength += len;
 
     VIR_DEBUG("Got length, now need %zu total (%u more)",
               msg->bufferLength, len);
@@ -168,6 +365,88 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
 }
 
 
+/* Replace the deflated header and payload of @msg with the inflated
+ * ones, so that decoding can carry on as for any other message. */
+static int
+virNetMessageDecompress(virNetMessagePtr msg)
+{
+#if WITH_ZLIB
+    XDR xdr;
+    unsigned int len;
+    uLongf rawlen;
+    char *buffer = NULL;
+    size_t size;
+    int rc;
+    int ret = -1;
+
+    xdrmem_create(&xdr, msg->buffer + VIR_NET_MESSAGE_LEN_MAX,
+                  msg->bufferLength - VIR_NET_MESSAGE_LEN_MAX, XDR_DECODE);
+
+    if (!xdr_u_int(&xdr, &len)) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unable to decode compressed message length"));
+        goto cleanup;
+    }
+
+    if (len > VIR_NET_MESSAGE_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("compressed packet %u bytes long too large, want %d"),
+                       len, VIR_NET_MESSAGE_MAX);
+        goto cleanup;
+    }
+
+    if (!(buffer = virNetMessagePoolGet(len + VIR_NET_MESSAGE_LEN_MAX, &size)))
+        goto cleanup;
+
+    rawlen = len;
+    rc = uncompress((Bytef *) buffer + VIR_NET_MESSAGE_LEN_MAX, &rawlen,
+                    (Bytef *) msg->buffer + 2 * VIR_NET_MESSAGE_LEN_MAX,
+                    msg->bufferLength - 2 * VIR_NET_MESSAGE_LEN_MAX);
+    if (rc != Z_OK || rawlen != len) {
+        virReportError(VIR_ERR_RPC,
+                       _("Unable to decompress message: %s"),
+                       rc != Z_OK ? zError(rc) : _("length mismatch"));
+        goto cleanup;
+    }
+
+    /* Keep the length word in line with the inflated message */
+    xdr_destroy(&xdr);
+    xdrmem_create(&xdr, buffer, VIR_NET_MESSAGE_LEN_MAX, XDR_ENCODE);
+    len += VIR_NET_MESSAGE_LEN_MAX;
+    if (!xdr_u_int(&xdr, &len)) {
+        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message length"));
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Decompressed message from %zu to %u bytes",
+              msg->bufferLength, len);
+
+    if (msg->bufferSize)
+        virNetMessagePoolPut(msg->buffer, msg->bufferSize);
+    else
+        VIR_FREE(msg->buffer);
+    msg->buffer = buffer;
+    msg->bufferSize = size;
+    msg->bufferLength = len;
+    msg->compressed = false;
+    buffer = NULL;
+
+    ret = 0;
+
+ cleanup:
+    xdr_destroy(&xdr);
+    if (buffer)
+        virNetMessagePoolPut(buffer, size);
+    return ret;
+#else /* !WITH_ZLIB */
+    virReportError(VIR_ERR_RPC, "%s",
+                   _("received a compressed message, but compression "
+                     "is not supported by this build"));
+    return -1;
+#endif /* !WITH_ZLIB */
+}
+
+
 /*
  * @msg: the complete incoming message, whose header to decode
  *
@@ -190,6 +469,17 @@ int virNetMessageDecodeHeader(virNetMessagePtr msg)
         return -1;
     }
 
+    if (msg->compressed) {
+        if (msg->bufferLength < 2 * VIR_NET_MESSAGE_LEN_MAX) {
+            virReportError(VIR_ERR_RPC, "%s",
+                           _("compressed packet too small"));
+            return -1;
+        }
+
+        if (virNetMessageDecompress(msg) < 0)
+            return -1;
+    }
+
     msg->bufferOffset = VIR_NET_MESSAGE_LEN_MAX;
 
     /* Parse the header. */
@@ -230,9 +520,10 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     int ret = -1;
     unsigned int len = 0;
 
-    msg->bufferLength = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageGrowBuffer(msg, VIR_NET_MESSAGE_INITIAL +
+                                VIR_NET_MESSAGE_LEN_MAX, 0) < 0)
         return ret;
+    msg->bufferLength = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
     msg->bufferOffset = 0;
 
     /* Format the header. */
@@ -273,6 +564,103 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
 }
 
 
+/**
+ * virNetMessageCompress:
+ * @msg: the fully encoded outgoing message
+ * @level: zlib compression level, 0 leaves @msg as it is
+ *
+ * Deflate the header and payload of @msg and flag that in its length
+ * word. Stream data, which is usually compressed already, small
+ * messages and messages that would not shrink are left as they are,
+ * as is everything when built without zlib.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virNetMessageCompress(virNetMessagePtr msg,
+                      int level)
+{
+#if WITH_ZLIB
+    size_t rawlen;
+    uLongf zlen;
+    char *buffer;
+    size_t size;
+    unsigned int len;
+    XDR xdr;
+    int rc;
+    int ret = -1;
+
+    if (level <= 0 || msg->compressed || msg->bufferOffset != 0 ||
+        msg->bufferLength < VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_COMPRESS_MIN ||
+        msg->header.type == VIR_NET_STREAM ||
+        msg->header.type == VIR_NET_STREAM_HOLE)
+        return 0;
+
+    rawlen = msg->bufferLength - VIR_NET_MESSAGE_LEN_MAX;
+
+    /* Only worth it if the whole frame ends up shorter than now */
+    zlen = rawlen - VIR_NET_MESSAGE_LEN_MAX - 1;
+    if (!(buffer = virNetMessagePoolGet(2 * VIR_NET_MESSAGE_LEN_MAX + zlen, &size)))
+        return -1;
+
+    rc = compress2((Bytef *) buffer + 2 * VIR_NET_MESSAGE_LEN_MAX, &zlen,
+                   (Bytef *) msg->buffer + VIR_NET_MESSAGE_LEN_MAX, rawlen,
+                   level);
+    if (rc == Z_BUF_ERROR) {
+        VIR_DEBUG("Message of %zu bytes does not compress", rawlen);
+        virNetMessagePoolPut(buffer, size);
+        return 0;
+    }
+    if (rc != Z_OK) {
+        virReportError(VIR_ERR_RPC,
+                       _("Unable to compress message: %s"), zError(rc));
+        virNetMessagePoolPut(buffer, size);
+        return -1;
+    }
+
+    xdrmem_create(&xdr, buffer, 2 * VIR_NET_MESSAGE_LEN_MAX, XDR_ENCODE);
+
+    len = (2 * VIR_NET_MESSAGE_LEN_MAX + zlen) | VIR_NET_MESSAGE_LEN_COMPRESSED;
+    if (!xdr_u_int(&xdr, &len)) {
+        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message length"));
+        goto cleanup;
+    }
+
+    len = rawlen;
+    if (!xdr_u_int(&xdr, &len)) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unable to encode compressed message length"));
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Compressed message from %zu to %zu bytes",
+              msg->bufferLength, (size_t) (2 * VIR_NET_MESSAGE_LEN_MAX + zlen));
+
+    if (msg->bufferSize)
+        virNetMessagePoolPut(msg->buffer, msg->bufferSize);
+    else
+        VIR_FREE(msg->buffer);
+    msg->buffer = buffer;
+    msg->bufferSize = size;
+    msg->bufferLength = 2 * VIR_NET_MESSAGE_LEN_MAX + zlen;
+    msg->compressed = true;
+    buffer = NULL;
+
+    ret = 0;
+
+ cleanup:
+    xdr_destroy(&xdr);
+    if (buffer)
+        virNetMessagePoolPut(buffer, size);
+    return ret;
+#else /* !WITH_ZLIB */
+    if (level > 0)
+        VIR_DEBUG("Not compressing message, built without zlib");
+    return 0;
+#endif /* !WITH_ZLIB */
+}
+
+
 int virNetMessageEncodeNumFDs(virNetMessagePtr msg)
 {
     XDR xdr;
@@ -367,10 +755,10 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 
         xdr_destroy(&xdr);
 
-        msg->bufferLength = newlen + VIR_NET_MESSAGE_LEN_MAX;
-
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageGrowBuffer(msg, newlen + VIR_NET_MESSAGE_LEN_MAX,
+                                    msg->bufferOffset) < 0)
             goto error;
+        msg->bufferLength = newlen + VIR_NET_MESSAGE_LEN_MAX;
 
         xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
                       msg->bufferLength - msg->bufferOffset, XDR_ENCODE);
@@ -430,13 +818,22 @@ int virNetMessageDecodePayload(virNetMessagePtr msg,
 }
 
 
-int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
-                                  const char *data,
-                                  size_t len)
+/**
+ * virNetMessageEncodePayloadRawBegin:
+ * @msg: message with an already encoded header
+ * @len: maximum number of payload bytes
+ *
+ * Make room for @len bytes of raw payload right after the header of
+ * @msg so that the caller can fill them in place, for example by
+ * reading straight from a stream, instead of handing over a separate
+ * buffer to be copied. The message must be completed with
+ * virNetMessageEncodePayloadRawEnd.
+ *
+ * Returns pointer to the payload area, NULL on error
+ */
+char *virNetMessageEncodePayloadRawBegin(virNetMessagePtr msg,
+                                         size_t len)
 {
-    XDR xdr;
-    unsigned int msglen;
-
     /* If the message buffer is too small for the payload increase it accordingly. */
     if ((msg->bufferLength - msg->bufferOffset) < len) {
         if ((msg->bufferOffset + len) >
@@ -448,18 +845,43 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
                            VIR_NET_MESSAGE_MAX +
                            VIR_NET_MESSAGE_LEN_MAX -
                            msg->bufferOffset);
-            return -1;
+            return NULL;
         }
 
+        if (virNetMessageGrowBuffer(msg, msg->bufferOffset + len,
+                                    msg->bufferOffset) < 0)
+            return NULL;
         msg->bufferLength = msg->bufferOffset + len;
 
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
-            return -1;
-
         VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
     }
 
-    memcpy(msg->buffer + msg->bufferOffset, data, len);
+    return msg->buffer + msg->bufferOffset;
+}
+
+
+/**
+ * virNetMessageEncodePayloadRawEnd:
+ * @msg: message prepared by virNetMessageEncodePayloadRawBegin
+ * @len: number of payload bytes actually filled in
+ *
+ * Finish encoding of a raw payload written in place.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetMessageEncodePayloadRawEnd(virNetMessagePtr msg,
+                                     size_t len)
+{
+    XDR xdr;
+    unsigned int msglen;
+
+    if ((msg->bufferLength - msg->bufferOffset) < len) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Raw payload of %zu bytes exceeds reserved space"),
+                       len);
+        return -1;
+    }
+
     msg->bufferOffset += len;
 
     /* Re-encode the length word. */
@@ -482,6 +904,22 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
 }
 
 
+int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
+                                  const char *data,
+                                  size_t len)
+{
+    char *payload;
+
+    if (!(payload = virNetMessageEncodePayloadRawBegin(msg, len)))
+        return -1;
+
+    if (len)
+        memcpy(payload, data, len);
+
+    return virNetMessageEncodePayloadRawEnd(msg, len);
+}
+
+
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
 {
     XDR xdr;
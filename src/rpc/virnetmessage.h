@@ -36,8 +36,11 @@ struct _virNetMessage {
 
     char *buffer; /* Initially VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX */
                   /* Maximum   VIR_NET_MESSAGE_MAX     + VIR_NET_MESSAGE_LEN_MAX */
+    size_t bufferSize; /* Allocated size of a pooled @buffer, 0 otherwise */
     size_t bufferLength;
     size_t bufferOffset;
+    bool compressed; /* @buffer holds a deflated header and payload */
+    unsigned long long queued; /* When the call was queued for a worker, in us */
 
     virNetMessageHeader header;
 
@@ -52,8 +55,28 @@ struct _virNetMessage {
 };
 
 
+typedef struct _virNetMessagePoolStats virNetMessagePoolStats;
+typedef virNetMessagePoolStats *virNetMessagePoolStatsPtr;
+struct _virNetMessagePoolStats {
+    unsigned long long hits;     /* buffers reused from the pool */
+    unsigned long long misses;   /* buffers allocated as the pool was empty */
+    unsigned long long discards; /* released buffers not kept in the pool */
+    size_t buffers;              /* idle buffers in the pool */
+    size_t bytes;                /* memory held by idle buffers */
+    size_t maxBytes;             /* limit on @bytes */
+};
+
+void virNetMessagePoolGetStats(virNetMessagePoolStatsPtr stats)
+    ATTRIBUTE_NONNULL(1);
+void virNetMessagePoolSetMaxBytes(size_t maxBytes);
+
 virNetMessagePtr virNetMessageNew(bool tracked);
 
+int virNetMessageGrowBuffer(virNetMessagePtr msg,
+                            size_t len,
+                            size_t keep)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
 void virNetMessageClearPayload(virNetMessagePtr msg);
 
 void virNetMessageClear(virNetMessagePtr);
@@ -73,6 +96,10 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
 int virNetMessageDecodeHeader(virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
+int virNetMessageCompress(virNetMessagePtr msg,
+                          int level)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
 int virNetMessageEncodePayload(virNetMessagePtr msg,
                                xdrproc_t filter,
                                void *data)
@@ -89,6 +116,12 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
                                   const char *buf,
                                   size_t len)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+char *virNetMessageEncodePayloadRawBegin(virNetMessagePtr msg,
+                                         size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageEncodePayloadRawEnd(virNetMessagePtr msg,
+                                     size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
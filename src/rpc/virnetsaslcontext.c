@@ -35,6 +35,12 @@
 
 VIR_LOG_INIT("rpc.netsaslcontext");
 
+/* Amount of data we are willing to decode from a single block.
+ * The peer's own limit, negotiated as SASL_MAXOUTBUF, bounds what
+ * we encode, so a larger value only helps peers that ask for it,
+ * letting them wrap bulk data such as streams in fewer blocks */
+#define VIR_NET_SASL_MAX_BUFSIZE (1 << 20)
+
 struct _virNetSASLContext {
     virObjectLockable parent;
 
@@ -186,8 +192,7 @@ virNetSASLSessionPtr virNetSASLSessionNewClient(virNetSASLContextPtr ctxt ATTRIB
     if (!(sasl = virObjectLockableNew(virNetSASLSessionClass)))
         return NULL;
 
-    /* Arbitrary size for amount of data we can encode in a single block */
-    sasl->maxbufsize = 1 << 16;
+    sasl->maxbufsize = VIR_NET_SASL_MAX_BUFSIZE;
 
     err = sasl_client_new(service,
                           hostname,
@@ -222,8 +227,7 @@ virNetSASLSessionPtr virNetSASLSessionNewServer(virNetSASLContextPtr ctxt ATTRIB
     if (!(sasl = virObjectLockableNew(virNetSASLSessionClass)))
         return NULL;
 
-    /* Arbitrary size for amount of data we can encode in a single block */
-    sasl->maxbufsize = 1 << 16;
+    sasl->maxbufsize = VIR_NET_SASL_MAX_BUFSIZE;
 
     err = sasl_server_new(service,
                           NULL,
@@ -31,6 +31,10 @@
 #include "virthreadpool.h"
 #include "virnetservermdns.h"
 #include "virstring.h"
+#include "virhash.h"
+#include "virhashcode.h"
+#include "virtime.h"
+#include "virevent.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -44,6 +48,33 @@ struct _virNetServerJob {
     virNetServerClientPtr client;
     virNetMessagePtr msg;
     virNetServerProgramPtr prog;
+
+    bool scheduled;             /* Counted in nactiveJobs */
+    unsigned long long start;   /* Virtual start time for fair queueing */
+    unsigned long long release; /* Rate limited until then, in microseconds */
+};
+
+/* Advance of the virtual clock for one request of a client
+ * with weight 1 */
+#define VIR_NET_SERVER_SCHED_QUANTUM 1000
+
+typedef struct _virNetServerClientSched virNetServerClientSched;
+typedef virNetServerClientSched *virNetServerClientSchedPtr;
+
+typedef struct _virNetServerAcceptJob virNetServerAcceptJob;
+typedef virNetServerAcceptJob *virNetServerAcceptJobPtr;
+
+struct _virNetServerAcceptJob {
+    virNetServerServicePtr svc;
+    virNetSocketPtr sock;
+};
+
+struct _virNetServerClientSched {
+    bool readonly;
+    unsigned long long finish;      /* Virtual finish time of last request */
+    unsigned long long tat;         /* Theoretical arrival time, microseconds */
+    size_t queued;                  /* Requests waiting for dispatch */
+    unsigned long long throttled;   /* Requests delayed by the rate limit */
 };
 
 struct _virNetServer {
@@ -64,15 +95,45 @@ struct _virNetServer {
     virNetServerProgramPtr *programs;
 
     size_t nclients;                    /* Current clients count */
-    virNetServerClientPtr *clients;     /* Clients */
+    virNetServerClientPtr *clients;     /* Clients, sorted by ID */
+    size_t nclients_transport[VIR_CLIENT_TRANS_LAST];
+    size_t nclients_readonly;
     unsigned long long next_client_id;  /* next client ID */
     size_t nclients_max;                /* Max allowed clients count */
     size_t nclients_unauth;             /* Unauthenticated clients count */
     size_t nclients_unauth_max;         /* Max allowed unauth clients count */
 
+    /* When set, new connections are turned into clients by these
+     * threads rather than in the event loop, see
+     * virNetServerSetAcceptWorkers */
+    virThreadPoolPtr acceptors;
+    size_t nclients_pending;            /* Accepted, not yet added */
+    size_t nclients_pending_max;        /* Max allowed pending clients */
+
     int keepaliveInterval;
     unsigned int keepaliveCount;
 
+    int compressionLevel;
+
+    /* Kernel socket buffer sizes in bytes of new clients, 0 for the
+     * system default */
+    unsigned int socketSendBuffer;
+    unsigned int socketRecvBuffer;
+
+    /* Ordinary requests are handed to the workers no faster than
+     * they can serve them, picking the waiting request of the client
+     * with the least service so far and holding back clients over
+     * their rate limit, see virNetServerScheduleJobsLocked */
+    virHashTablePtr clientSched;        /* Client -> virNetServerClientSched */
+    virNetServerJobPtr *pendingJobs;    /* In arrival order */
+    size_t npendingJobs;
+    size_t nactiveJobs;
+    unsigned long long vtime;
+    unsigned int clientRateLimit;       /* Requests per second, 0 for none */
+    unsigned int clientRateBurst;
+    unsigned int clientRWWeight;        /* Share of read-write clients */
+    int schedTimer;
+
 #ifdef WITH_GNUTLS
     virNetTLSContextPtr tls;
 #endif
@@ -158,10 +219,210 @@ static int virNetServerProcessMsg(virNetServerPtr srv,
     return ret;
 }
 
+static void
+virNetServerJobFree(virNetServerJobPtr job)
+{
+    virObjectUnref(job->prog);
+    virNetMessageFree(job->msg);
+    virObjectUnref(job->client);
+    VIR_FREE(job);
+}
+
+
+static uint32_t
+virNetServerClientSchedCode(const void *name, uint32_t seed)
+{
+    return virHashCodeGen(&name, sizeof(name), seed);
+}
+
+
+static bool
+virNetServerClientSchedEqual(const void *namea, const void *nameb)
+{
+    return namea == nameb;
+}
+
+
+static void *
+virNetServerClientSchedCopy(const void *name)
+{
+    return (void *)name;
+}
+
+
+static void virNetServerScheduleJobsLocked(virNetServerPtr srv);
+
+static void
+virNetServerScheduleTimer(int timer ATTRIBUTE_UNUSED,
+                          void *opaque)
+{
+    virNetServerPtr srv = opaque;
+
+    virObjectLock(srv);
+    virNetServerScheduleJobsLocked(srv);
+    virObjectUnlock(srv);
+}
+
+
+/*
+ * Arm the timer to run the scheduler again in @delay milliseconds,
+ * or disarm it if @delay is -1.
+ */
+static void
+virNetServerScheduleTimerUpdate(virNetServerPtr srv,
+                                int delay)
+{
+    if (srv->schedTimer >= 0) {
+        virEventUpdateTimeout(srv->schedTimer, delay);
+        return;
+    }
+
+    if (delay < 0)
+        return;
+
+    if ((srv->schedTimer = virEventAddTimeout(delay,
+                                              virNetServerScheduleTimer,
+                                              virObjectRef(srv),
+                                              virObjectFreeCallback)) < 0) {
+        size_t i;
+
+        /* Without a timer rate limited requests are not held back */
+        VIR_WARN("Unable to register client rate limit timer");
+        virObjectUnref(srv);
+        srv->clientRateLimit = 0;
+        for (i = 0; i < srv->npendingJobs; i++)
+            srv->pendingJobs[i]->release = 0;
+    }
+}
+
+
+/*
+ * Hand waiting requests to the workers while some are idle.
+ *
+ * This is start time fair queueing: every request is stamped with
+ * the later of the server's virtual time and the virtual finish
+ * time of its client's previous request, and the one with the
+ * lowest stamp goes first. A client keeping many requests in flight
+ * therefore gets only its share of the workers, proportional to its
+ * weight, while an occasional caller never waits behind the backlog
+ * of a busy one.
+ */
+static void
+virNetServerScheduleJobsLocked(virNetServerPtr srv)
+{
+    size_t maxActive = MAX(virThreadPoolGetMaxWorkers(srv->workers), 1);
+    unsigned long long now;
+    unsigned long long wakeup = 0;
+
+    if (virTimeMillisNowRaw(&now) < 0)
+        now = ULLONG_MAX / 1000;
+    now *= 1000;
+
+    while (srv->npendingJobs && srv->nactiveJobs < maxActive) {
+        virNetServerClientSchedPtr sched;
+        virNetServerJobPtr job = NULL;
+        size_t pick = 0;
+        size_t i;
+
+        wakeup = 0;
+        for (i = 0; i < srv->npendingJobs; i++) {
+            virNetServerJobPtr tmp = srv->pendingJobs[i];
+
+            if (tmp->release > now) {
+                if (!wakeup || tmp->release < wakeup)
+                    wakeup = tmp->release;
+                continue;
+            }
+
+            if (!job || tmp->start < job->start) {
+                job = tmp;
+                pick = i;
+            }
+        }
+
+        if (!job)
+            break;
+
+        job->scheduled = true;
+        if (virThreadPoolSendJob(srv->workers, 0, job) < 0) {
+            job->scheduled = false;
+            break;
+        }
+
+        VIR_DELETE_ELEMENT(srv->pendingJobs, pick, srv->npendingJobs);
+        srv->nactiveJobs++;
+        if (job->start > srv->vtime)
+            srv->vtime = job->start;
+
+        if ((sched = virHashLookup(srv->clientSched, job->client)))
+            sched->queued--;
+    }
+
+    if (srv->npendingJobs && srv->nactiveJobs < maxActive && wakeup)
+        virNetServerScheduleTimerUpdate(srv, (wakeup - now + 999) / 1000);
+    else
+        virNetServerScheduleTimerUpdate(srv, -1);
+}
+
+
+/*
+ * Stamp @job for fair queueing and rate limiting and append it
+ * to the pending requests.
+ */
+static int
+virNetServerQueueJobLocked(virNetServerPtr srv,
+                           virNetServerJobPtr job)
+{
+    virNetServerClientSchedPtr sched;
+    unsigned int weight = 1;
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+    now *= 1000;
+
+    job->start = srv->vtime;
+    job->release = now;
+
+    if (!(sched = virHashLookup(srv->clientSched, job->client)))
+        return VIR_APPEND_ELEMENT_COPY(srv->pendingJobs,
+                                       srv->npendingJobs, job);
+
+    if (!sched->readonly)
+        weight = srv->clientRWWeight;
+
+    if (sched->finish > job->start)
+        job->start = sched->finish;
+
+    /* Generic cell rate algorithm: every request moves the client's
+     * theoretical arrival time by one interval, and a request that
+     * comes in more than the burst allowance ahead of it waits */
+    if (srv->clientRateLimit) {
+        unsigned long long interval = 1000000 / srv->clientRateLimit;
+        unsigned long long tolerance = interval * (srv->clientRateBurst - 1);
+        unsigned long long tat = MAX(sched->tat, now);
+
+        if (tat > now + tolerance) {
+            job->release = tat - tolerance;
+            sched->throttled++;
+        }
+        sched->tat = tat + interval;
+    }
+
+    if (VIR_APPEND_ELEMENT_COPY(srv->pendingJobs, srv->npendingJobs, job) < 0)
+        return -1;
+
+    sched->finish = job->start + VIR_NET_SERVER_SCHED_QUANTUM / weight;
+    sched->queued++;
+    return 0;
+}
+
+
 static void virNetServerHandleJob(void *jobOpaque, void *opaque)
 {
     virNetServerPtr srv = opaque;
     virNetServerJobPtr job = jobOpaque;
+    bool scheduled = job->scheduled;
 
     VIR_DEBUG("server=%p client=%p message=%p prog=%p",
               srv, job->client, job->msg, job->prog);
@@ -172,14 +433,19 @@ static void virNetServerHandleJob(void *jobOpaque, void *opaque)
     virObjectUnref(job->prog);
     virObjectUnref(job->client);
     VIR_FREE(job);
-    return;
+    goto done;
 
  error:
-    virObjectUnref(job->prog);
-    virNetMessageFree(job->msg);
     virNetServerClientClose(job->client);
-    virObjectUnref(job->client);
-    VIR_FREE(job);
+    virNetServerJobFree(job);
+
+ done:
+    if (scheduled) {
+        virObjectLock(srv);
+        srv->nactiveJobs--;
+        virNetServerScheduleJobsLocked(srv);
+        virObjectUnlock(srv);
+    }
 }
 
 static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
@@ -211,13 +477,20 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
 
         job->client = client;
         job->msg = msg;
+        ignore_value(virTimeMicrosNowRaw(&msg->queued));
 
         if (prog) {
             job->prog = virObjectRef(prog);
             priority = virNetServerProgramGetPriority(prog, msg->header.proc);
         }
 
-        ret = virThreadPoolSendJob(srv->workers, priority, job);
+        /* High priority requests have workers of their own and
+         * must never be held back */
+        if (priority) {
+            ret = virThreadPoolSendJob(srv->workers, priority, job);
+        } else if ((ret = virNetServerQueueJobLocked(srv, job)) == 0) {
+            virNetServerScheduleJobsLocked(srv);
+        }
 
         if (ret < 0) {
             VIR_FREE(job);
@@ -247,9 +520,11 @@ virNetServerCheckLimits(virNetServerPtr srv)
 {
     VIR_DEBUG("Checking client-related limits to re-enable or temporarily "
               "suspend services: nclients=%zu nclients_max=%zu "
-              "nclients_unauth=%zu nclients_unauth_max=%zu",
+              "nclients_unauth=%zu nclients_unauth_max=%zu "
+              "nclients_pending=%zu nclients_pending_max=%zu",
               srv->nclients, srv->nclients_max,
-              srv->nclients_unauth, srv->nclients_unauth_max);
+              srv->nclients_unauth, srv->nclients_unauth_max,
+              srv->nclients_pending, srv->nclients_pending_max);
 
     /* Check the max_anonymous_clients and max_clients limits so that we can
      * decide whether the services should be temporarily suspended, thus not
@@ -257,33 +532,86 @@ virNetServerCheckLimits(virNetServerPtr srv)
      * suspended services in order to accept new clients again.
      * A new client can only be accepted if both max_clients and
      * max_anonymous_clients wouldn't get overcommitted by accepting it.
+     * Connections still waiting for an accept worker count as clients,
+     * and there may be no more than max_pending_clients of them.
      */
-    if (srv->nclients >= srv->nclients_max ||
+    if (srv->nclients + srv->nclients_pending >= srv->nclients_max ||
         (srv->nclients_unauth_max &&
-         srv->nclients_unauth >= srv->nclients_unauth_max)) {
+         srv->nclients_unauth >= srv->nclients_unauth_max) ||
+        (srv->nclients_pending_max &&
+         srv->nclients_pending >= srv->nclients_pending_max)) {
         /* Temporarily stop accepting new clients */
         VIR_INFO("Temporarily suspending services");
         virNetServerUpdateServicesLocked(srv, false);
-    } else if (srv->nclients < srv->nclients_max &&
-               (!srv->nclients_unauth_max ||
-                srv->nclients_unauth < srv->nclients_unauth_max)) {
+    } else {
         /* Now it makes sense to accept() a new client. */
         VIR_INFO("Re-enabling services");
         virNetServerUpdateServicesLocked(srv, true);
     }
 }
 
+/*
+ * Returns the index of the first client in srv->clients with an ID
+ * of at least @id, or srv->nclients if there is none.
+ */
+static size_t
+virNetServerFindClientLocked(virNetServerPtr srv,
+                             unsigned long long id)
+{
+    size_t lo = 0;
+    size_t hi = srv->nclients;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (virNetServerClientGetID(srv->clients[mid]) < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+static void
+virNetServerTrackClientLocked(virNetServerPtr srv,
+                              virNetServerClientPtr client,
+                              bool added)
+{
+    int transport = virNetServerClientGetTransport(client);
+    bool readonly = virNetServerClientGetReadonly(client);
+
+    if (added) {
+        srv->nclients_transport[transport]++;
+        if (readonly)
+            srv->nclients_readonly++;
+    } else {
+        srv->nclients_transport[transport]--;
+        if (readonly)
+            srv->nclients_readonly--;
+    }
+}
+
+
 int virNetServerAddClient(virNetServerPtr srv,
                           virNetServerClientPtr client)
 {
+    size_t pos;
+
     virObjectLock(srv);
 
     if (virNetServerClientInit(client) < 0)
         goto error;
 
-    if (VIR_EXPAND_N(srv->clients, srv->nclients, 1) < 0)
+    /* IDs are handed out in increasing order, but clients set up by
+     * the accept workers may be added out of order, so keep the list
+     * sorted for the ID lookups */
+    pos = virNetServerFindClientLocked(srv, virNetServerClientGetID(client));
+    if (VIR_INSERT_ELEMENT_COPY(srv->clients, pos, srv->nclients, client) < 0)
         goto error;
-    srv->clients[srv->nclients-1] = virObjectRef(client);
+    virObjectRef(client);
+    virNetServerTrackClientLocked(srv, client, true);
 
     if (virNetServerClientNeedAuth(client))
         virNetServerTrackPendingAuthLocked(srv);
@@ -297,6 +625,30 @@ int virNetServerAddClient(virNetServerPtr srv,
     virNetServerClientInitKeepAlive(client, srv->keepaliveInterval,
                                     srv->keepaliveCount);
 
+    virNetServerClientSetCompressionLevel(client, srv->compressionLevel);
+
+    if ((srv->socketSendBuffer || srv->socketRecvBuffer) &&
+        virNetServerClientSetSocketBufferSizes(client, srv->socketSendBuffer,
+                                               srv->socketRecvBuffer) < 0) {
+        VIR_WARN("Unable to set socket buffer sizes of client %p: %s",
+                 client, virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    if (srv->workers) {
+        virNetServerClientSchedPtr sched;
+
+        if (VIR_ALLOC(sched) < 0)
+            goto error;
+        sched->readonly = virNetServerClientGetReadonly(client);
+        sched->finish = srv->vtime;
+
+        if (virHashAddEntry(srv->clientSched, client, sched) < 0) {
+            VIR_FREE(sched);
+            goto error;
+        }
+    }
+
     virObjectUnlock(srv);
     return 0;
 
@@ -305,11 +657,11 @@ int virNetServerAddClient(virNetServerPtr srv,
     return -1;
 }
 
-static int virNetServerDispatchNewClient(virNetServerServicePtr svc,
-                                         virNetSocketPtr clientsock,
-                                         void *opaque)
+static int
+virNetServerSetupClient(virNetServerPtr srv,
+                        virNetServerServicePtr svc,
+                        virNetSocketPtr clientsock)
 {
-    virNetServerPtr srv = opaque;
     virNetServerClientPtr client;
 
     if (!(client = virNetServerClientNew(virNetServerNextClientID(srv),
@@ -336,6 +688,66 @@ static int virNetServerDispatchNewClient(virNetServerServicePtr svc,
 }
 
 
+static void
+virNetServerHandleAcceptJob(void *jobOpaque,
+                            void *opaque)
+{
+    virNetServerPtr srv = opaque;
+    virNetServerAcceptJobPtr job = jobOpaque;
+
+    if (virNetServerSetupClient(srv, job->svc, job->sock) < 0) {
+        VIR_WARN("Unable to set up new client: %s",
+                 virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    virObjectLock(srv);
+    srv->nclients_pending--;
+    virNetServerCheckLimits(srv);
+    virObjectUnlock(srv);
+
+    virObjectUnref(job->svc);
+    virObjectUnref(job->sock);
+    VIR_FREE(job);
+}
+
+
+static int virNetServerDispatchNewClient(virNetServerServicePtr svc,
+                                         virNetSocketPtr clientsock,
+                                         void *opaque)
+{
+    virNetServerPtr srv = opaque;
+    virNetServerAcceptJobPtr job;
+
+    if (!srv->acceptors)
+        return virNetServerSetupClient(srv, svc, clientsock);
+
+    if (VIR_ALLOC(job) < 0)
+        return -1;
+    job->svc = virObjectRef(svc);
+    job->sock = virObjectRef(clientsock);
+
+    virObjectLock(srv);
+    srv->nclients_pending++;
+    virNetServerCheckLimits(srv);
+    virObjectUnlock(srv);
+
+    if (virThreadPoolSendJob(srv->acceptors, 0, job) < 0) {
+        virObjectLock(srv);
+        srv->nclients_pending--;
+        virNetServerCheckLimits(srv);
+        virObjectUnlock(srv);
+
+        virObjectUnref(job->svc);
+        virObjectUnref(job->sock);
+        VIR_FREE(job);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 virNetServerPtr virNetServerNew(const char *name,
                                 unsigned long long next_client_id,
                                 size_t min_workers,
@@ -369,11 +781,22 @@ virNetServerPtr virNetServerNew(const char *name,
     if (VIR_STRDUP(srv->name, name) < 0)
         goto error;
 
+    if (!(srv->clientSched = virHashCreateFull(0,
+                                               virHashValueFree,
+                                               virNetServerClientSchedCode,
+                                               virNetServerClientSchedEqual,
+                                               virNetServerClientSchedCopy,
+                                               NULL)))
+        goto error;
+
     srv->next_client_id = next_client_id;
     srv->nclients_max = max_clients;
     srv->nclients_unauth_max = max_anonymous_clients;
     srv->keepaliveInterval = keepaliveInterval;
     srv->keepaliveCount = keepaliveCount;
+    srv->clientRateBurst = 1;
+    srv->clientRWWeight = 1;
+    srv->schedTimer = -1;
     srv->clientPrivNew = clientPrivNew;
     srv->clientPrivPreExecRestart = clientPrivPreExecRestart;
     srv->clientPrivFree = clientPrivFree;
@@ -764,8 +1187,14 @@ void virNetServerDispose(void *obj)
     for (i = 0; i < srv->nservices; i++)
         virNetServerServiceToggle(srv->services[i], false);
 
+    virThreadPoolFree(srv->acceptors);
     virThreadPoolFree(srv->workers);
 
+    for (i = 0; i < srv->npendingJobs; i++)
+        virNetServerJobFree(srv->pendingJobs[i]);
+    VIR_FREE(srv->pendingJobs);
+    virHashFree(srv->clientSched);
+
     for (i = 0; i < srv->nservices; i++)
         virObjectUnref(srv->services[i]);
     VIR_FREE(srv->services);
@@ -796,6 +1225,11 @@ void virNetServerClose(virNetServerPtr srv)
     for (i = 0; i < srv->nservices; i++)
         virNetServerServiceClose(srv->services[i]);
 
+    if (srv->schedTimer >= 0) {
+        virEventRemoveTimeout(srv->schedTimer);
+        srv->schedTimer = -1;
+    }
+
     virObjectUnlock(srv);
 }
 
@@ -860,6 +1294,8 @@ virNetServerProcessClients(virNetServerPtr srv)
             virNetServerClientPtr client = srv->clients[i];
 
             VIR_DELETE_ELEMENT(srv->clients, i, srv->nclients);
+            virHashRemoveEntry(srv->clientSched, client);
+            virNetServerTrackClientLocked(srv, client, false);
 
             if (virNetServerClientNeedAuth(client))
                 virNetServerTrackCompletedAuthLocked(srv);
@@ -911,7 +1347,8 @@ virNetServerGetThreadPoolParameters(virNetServerPtr srv,
     *freeWorkers = virThreadPoolGetFreeWorkers(srv->workers);
     *nWorkers = virThreadPoolGetCurrentWorkers(srv->workers);
     *nPrioWorkers = virThreadPoolGetPriorityWorkers(srv->workers);
-    *jobQueueDepth = virThreadPoolGetJobQueueDepth(srv->workers);
+    *jobQueueDepth = virThreadPoolGetJobQueueDepth(srv->workers) +
+        srv->npendingJobs;
 
     virObjectUnlock(srv);
     return 0;
@@ -1010,6 +1447,134 @@ virNetServerGetClients(virNetServerPtr srv,
     return ret;
 }
 
+/* Most clients checked against the criteria for one page */
+#define VIR_NET_SERVER_CLIENT_SCAN_MAX 4096
+
+/**
+ * virNetServerGetClientsPage:
+ * @srv: the server
+ * @start: lowest client ID to consider
+ * @limit: maximum number of clients to return
+ * @match: criteria the clients must satisfy, or NULL
+ * @clts: filled with the matching clients
+ * @next: filled with the ID to resume the listing from, or 0
+ *
+ * Collects up to @limit clients with an ID of at least @start which
+ * satisfy @match. Since the clients are kept sorted by their ID, the
+ * listing starts at @start directly and stops as soon as the page is
+ * full. To bound the time the server lock is held when few clients
+ * match, no more than MAX(@limit, VIR_NET_SERVER_CLIENT_SCAN_MAX)
+ * clients are checked, so a page may come back short or even empty.
+ * If there may be more clients to list, @next is set to the ID to
+ * pass as @start to get the following page, otherwise it is set to 0.
+ *
+ * Returns the number of clients in @clts or -1 on error.
+ */
+int
+virNetServerGetClientsPage(virNetServerPtr srv,
+                           unsigned long long start,
+                           size_t limit,
+                           virNetServerClientMatchPtr match,
+                           virNetServerClientPtr **clts,
+                           unsigned long long *next)
+{
+    int ret = -1;
+    size_t i;
+    size_t nscanned = 0;
+    size_t nclients = 0;
+    virNetServerClientPtr *list = NULL;
+
+    *next = 0;
+
+    if (limit == 0)
+        limit = 1;
+
+    virObjectLock(srv);
+
+    if (VIR_ALLOC_N(list, MIN(limit, srv->nclients) + 1) < 0)
+        goto cleanup;
+
+    for (i = virNetServerFindClientLocked(srv, start);
+         i < srv->nclients; i++) {
+        virNetServerClientPtr client = srv->clients[i];
+
+        if (nclients == limit ||
+            nscanned++ == MAX(limit, VIR_NET_SERVER_CLIENT_SCAN_MAX)) {
+            *next = virNetServerClientGetID(client);
+            break;
+        }
+
+        if (match && !virNetServerClientMatches(client, match))
+            continue;
+
+        list[nclients++] = virObjectRef(client);
+    }
+
+    *clts = list;
+    list = NULL;
+    ret = nclients;
+
+ cleanup:
+    virObjectListFreeCount(list, nclients);
+    virObjectUnlock(srv);
+    return ret;
+}
+
+/**
+ * virNetServerGetClientStats:
+ * @srv: the server
+ * @stats: filled with the client counters
+ *
+ * Reads the counters of the clients connected to @srv, which are
+ * maintained as clients come and go, without looking at any of them.
+ */
+void
+virNetServerGetClientStats(virNetServerPtr srv,
+                           virNetServerClientStatsPtr stats)
+{
+    size_t i;
+
+    virObjectLock(srv);
+
+    stats->nclients = srv->nclients;
+    for (i = 0; i < VIR_CLIENT_TRANS_LAST; i++)
+        stats->ntransport[i] = srv->nclients_transport[i];
+    stats->nreadonly = srv->nclients_readonly;
+    stats->nunauth = srv->nclients_unauth;
+    stats->npending = srv->nclients_pending;
+
+    virObjectUnlock(srv);
+}
+
+int
+virNetServerGetPrograms(virNetServerPtr srv,
+                        virNetServerProgramPtr **progs)
+{
+    int ret = -1;
+    size_t i;
+    size_t nprogs = 0;
+    virNetServerProgramPtr *list = NULL;
+
+    virObjectLock(srv);
+
+    for (i = 0; i < srv->nprograms; i++) {
+        virNetServerProgramPtr prog = virObjectRef(srv->programs[i]);
+        if (VIR_APPEND_ELEMENT(list, nprogs, prog) < 0) {
+            virObjectUnref(prog);
+            goto cleanup;
+        }
+    }
+
+    *progs = list;
+    list = NULL;
+    ret = nprogs;
+
+ cleanup:
+    virObjectListFreeCount(list, nprogs);
+    virObjectUnlock(srv);
+    return ret;
+}
+
 virNetServerClientPtr
 virNetServerGetClient(virNetServerPtr srv,
                       unsigned long long id)
@@ -1019,11 +1584,10 @@ virNetServerGetClient(virNetServerPtr srv,
 
     virObjectLock(srv);
 
-    for (i = 0; i < srv->nclients; i++) {
-        virNetServerClientPtr client = srv->clients[i];
-        if (virNetServerClientGetID(client) == id)
-            ret = virObjectRef(client);
-    }
+    i = virNetServerFindClientLocked(srv, id);
+    if (i < srv->nclients &&
+        virNetServerClientGetID(srv->clients[i]) == id)
+        ret = virObjectRef(srv->clients[i]);
 
     virObjectUnlock(srv);
 
@@ -1068,3 +1632,185 @@ virNetServerSetClientLimits(virNetServerPtr srv,
     virObjectUnlock(srv);
     return ret;
 }
+
+
+/**
+ * virNetServerSetCompressionLevel:
+ * @srv: the server
+ * @level: zlib compression level, 0 to disable compression
+ *
+ * Set the level at which messages are compressed for clients added
+ * from now on which asked for compression.
+ */
+void
+virNetServerSetCompressionLevel(virNetServerPtr srv,
+                                int level)
+{
+    virObjectLock(srv);
+    srv->compressionLevel = level;
+    virObjectUnlock(srv);
+}
+
+
+/**
+ * virNetServerSetSocketBufferSizes:
+ * @srv: the server
+ * @sendSize: size in bytes of the kernel send buffer, 0 for the default
+ * @recvSize: size in bytes of the kernel receive buffer, 0 for the default
+ *
+ * Set the socket buffer sizes of clients added from now on.
+ */
+void
+virNetServerSetSocketBufferSizes(virNetServerPtr srv,
+                                 unsigned int sendSize,
+                                 unsigned int recvSize)
+{
+    virObjectLock(srv);
+    srv->socketSendBuffer = sendSize;
+    srv->socketRecvBuffer = recvSize;
+    virObjectUnlock(srv);
+}
+
+
+/**
+ * virNetServerSetClientRateLimits:
+ * @srv: the server
+ * @rateLimit: requests per second allowed to each client, 0 for no limit
+ * @rateBurst: requests a client may issue at once above the rate
+ * @rwWeight: share of the workers given to a read-write client
+ *            relative to a read-only one
+ *
+ * Any of the values can be -1 to leave it unchanged.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNetServerSetClientRateLimits(virNetServerPtr srv,
+                                long long int rateLimit,
+                                long long int rateBurst,
+                                long long int rwWeight)
+{
+    int ret = -1;
+
+    virObjectLock(srv);
+
+    if (rateBurst == 0 || rwWeight == 0 ||
+        rwWeight > VIR_NET_SERVER_SCHED_QUANTUM) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("client rate burst and weight must be in the "
+                         "range 1 to %u"), VIR_NET_SERVER_SCHED_QUANTUM);
+        goto cleanup;
+    }
+
+    if (rateLimit > 1000000) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("client rate limit %lld requests per second "
+                         "is out of range"), rateLimit);
+        goto cleanup;
+    }
+
+    if (rateLimit >= 0)
+        srv->clientRateLimit = rateLimit;
+    if (rateBurst > 0)
+        srv->clientRateBurst = rateBurst;
+    if (rwWeight > 0)
+        srv->clientRWWeight = rwWeight;
+
+    /* Release whatever is no longer held back */
+    if (srv->workers)
+        virNetServerScheduleJobsLocked(srv);
+
+    ret = 0;
+ cleanup:
+    virObjectUnlock(srv);
+    return ret;
+}
+
+
+void
+virNetServerGetClientRateLimits(virNetServerPtr srv,
+                                unsigned int *rateLimit,
+                                unsigned int *rateBurst,
+                                unsigned int *rwWeight)
+{
+    virObjectLock(srv);
+    *rateLimit = srv->clientRateLimit;
+    *rateBurst = srv->clientRateBurst;
+    *rwWeight = srv->clientRWWeight;
+    virObjectUnlock(srv);
+}
+
+
+/**
+ * virNetServerGetClientSchedStats:
+ * @srv: the server
+ * @client: a client of @srv
+ * @queued: filled with the requests of @client waiting for a worker
+ * @throttled: filled with the requests of @client ever delayed
+ *             by the rate limit
+ */
+void
+virNetServerGetClientSchedStats(virNetServerPtr srv,
+                                virNetServerClientPtr client,
+                                size_t *queued,
+                                unsigned long long *throttled)
+{
+    virNetServerClientSchedPtr sched;
+
+    *queued = 0;
+    *throttled = 0;
+
+    virObjectLock(srv);
+    if ((sched = virHashLookup(srv->clientSched, client))) {
+        *queued = sched->queued;
+        *throttled = sched->throttled;
+    }
+    virObjectUnlock(srv);
+}
+
+
+/**
+ * virNetServerSetAcceptWorkers:
+ * @srv: the server
+ * @workers: number of threads setting up new clients
+ * @maxPending: limit on connections waiting for them, 0 for none
+ *
+ * Move the creation of clients for new connections, including the
+ * setup of their TLS session, out of the event loop to @workers
+ * dedicated threads, so that a storm of reconnecting clients does
+ * not hold up the existing ones. Services are suspended while
+ * @maxPending connections wait to be set up. Must be called before
+ * the services are enabled.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNetServerSetAcceptWorkers(virNetServerPtr srv,
+                             size_t workers,
+                             size_t maxPending)
+{
+    int ret = -1;
+
+    virObjectLock(srv);
+
+    if (srv->acceptors) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("accept workers of server '%s' are already set"),
+                       srv->name);
+        goto cleanup;
+    }
+
+    srv->nclients_pending_max = maxPending;
+
+    if (workers &&
+        !(srv->acceptors = virThreadPoolNew(workers, workers, 0,
+                                            virNetServerHandleAcceptJob,
+                                            srv)))
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(srv);
+    return ret;
+}
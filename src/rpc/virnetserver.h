@@ -111,6 +111,29 @@ virNetServerClientPtr virNetServerGetClient(virNetServerPtr srv,
 int virNetServerGetClients(virNetServerPtr srv,
                            virNetServerClientPtr **clients);
 
+int virNetServerGetClientsPage(virNetServerPtr srv,
+                               unsigned long long start,
+                               size_t limit,
+                               virNetServerClientMatchPtr match,
+                               virNetServerClientPtr **clients,
+                               unsigned long long *next);
+
+typedef struct _virNetServerClientStats virNetServerClientStats;
+typedef virNetServerClientStats *virNetServerClientStatsPtr;
+struct _virNetServerClientStats {
+    size_t nclients;
+    size_t ntransport[VIR_CLIENT_TRANS_LAST]; /* indexed by virClientTransport */
+    size_t nreadonly;
+    size_t nunauth;
+    size_t npending;    /* accepted, not set up yet */
+};
+
+void virNetServerGetClientStats(virNetServerPtr srv,
+                                virNetServerClientStatsPtr stats);
+
+int virNetServerGetPrograms(virNetServerPtr srv,
+                            virNetServerProgramPtr **progs);
+
 size_t virNetServerGetMaxClients(virNetServerPtr srv);
 size_t virNetServerGetCurrentClients(virNetServerPtr srv);
 size_t virNetServerGetMaxUnauthClients(virNetServerPtr srv);
@@ -120,4 +143,30 @@ int virNetServerSetClientLimits(virNetServerPtr srv,
                                 long long int maxClients,
                                 long long int maxClientsUnauth);
 
+int virNetServerSetClientRateLimits(virNetServerPtr srv,
+                                    long long int rateLimit,
+                                    long long int rateBurst,
+                                    long long int rwWeight);
+
+void virNetServerGetClientRateLimits(virNetServerPtr srv,
+                                     unsigned int *rateLimit,
+                                     unsigned int *rateBurst,
+                                     unsigned int *rwWeight);
+
+void virNetServerGetClientSchedStats(virNetServerPtr srv,
+                                     virNetServerClientPtr client,
+                                     size_t *queued,
+                                     unsigned long long *throttled);
+
+void virNetServerSetCompressionLevel(virNetServerPtr srv,
+                                     int level);
+
+void virNetServerSetSocketBufferSizes(virNetServerPtr srv,
+                                      unsigned int sendSize,
+                                      unsigned int recvSize);
+
+int virNetServerSetAcceptWorkers(virNetServerPtr srv,
+                                 size_t workers,
+                                 size_t maxPending);
+
 #endif /* __VIR_NET_SERVER_H__ */
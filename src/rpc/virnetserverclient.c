@@ -92,6 +92,14 @@ struct _virNetServerClient
      */
     long long conn_time;
 
+    /* Time at which the last RPC call other than a keepalive was
+     * received (UTC), used to find idle clients. */
+    long long last_activity;
+
+    /* virClientTransport, fixed when the client is created so that it
+     * can be queried without the lock and after the client closed */
+    int transport;
+
     /* Count of messages in the 'tx' queue,
      * and the server worker pool queue
      * ie RPC calls in progress. Does not count
@@ -120,6 +128,11 @@ struct _virNetServerClient
     virNetServerClientCloseFunc privateDataCloseFunc;
 
     virKeepAlivePtr keepalive;
+
+    /* zlib level allowed by the server, 0 if compression is disabled */
+    int compressionLevel;
+    /* Whether the client agreed to receive compressed messages */
+    bool compress;
 };
 
 
@@ -382,6 +395,16 @@ virNetServerClientNewInternal(unsigned long long id,
 #endif
     client->nrequests_max = nrequests_max;
     client->conn_time = timestamp;
+    client->last_activity = time(NULL);
+
+    if (virNetSocketIsLocal(sock))
+        client->transport = VIR_CLIENT_TRANS_UNIX;
+    else
+        client->transport = VIR_CLIENT_TRANS_TCP;
+#ifdef WITH_GNUTLS
+    if (tls)
+        client->transport = VIR_CLIENT_TRANS_TLS;
+#endif
 
     client->sockTimer = virEventAddTimeout(-1, virNetServerClientSockTimerFunc,
                                            client, NULL);
@@ -392,7 +415,7 @@ virNetServerClientNewInternal(unsigned long long id,
     if (!(client->rx = virNetMessageNew(true)))
         goto error;
     client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_ALLOC_N(client->rx->buffer, client->rx->bufferLength) < 0)
+    if (virNetMessageGrowBuffer(client->rx, client->rx->bufferLength, 0) < 0)
         goto error;
     client->nrequests = 1;
 
@@ -648,6 +671,15 @@ long long virNetServerClientGetTimestamp(virNetServerClientPtr client)
     return client->conn_time;
 }
 
+long long virNetServerClientGetLastActivity(virNetServerClientPtr client)
+{
+    long long ret;
+    virObjectLock(client);
+    ret = client->last_activity;
+    virObjectUnlock(client);
+    return ret;
+}
+
 #ifdef WITH_GNUTLS
 bool virNetServerClientHasTLSSession(virNetServerClientPtr client)
 {
@@ -1240,6 +1272,9 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
                 virNetMessageFree(response);
         }
 
+        if (msg)
+            client->last_activity = time(NULL);
+
         /* Maybe send off for queue against a filter */
         if (msg) {
             filter = client->filters;
@@ -1279,8 +1314,8 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
                 client->wantClose = true;
             } else {
                 client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                if (VIR_ALLOC_N(client->rx->buffer,
-                                client->rx->bufferLength) < 0) {
+                if (virNetMessageGrowBuffer(client->rx,
+                                            client->rx->bufferLength, 0) < 0) {
                     client->wantClose = true;
                 } else {
                     client->nrequests++;
@@ -1300,9 +1335,19 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
  *    0 on EAGAIN
  *    n number of bytes
  */
+/*
+ * Upper bound on the number of queued messages handed to
+ * the socket in a single write
+ */
+#define VIR_NET_SERVER_CLIENT_WRITE_BATCH 16
+
 static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
 {
+    struct iovec iov[VIR_NET_SERVER_CLIENT_WRITE_BATCH];
+    virNetMessagePtr msg;
+    size_t niov = 0;
     ssize_t ret;
+    size_t done;
 
     if (client->tx->bufferLength < client->tx->bufferOffset) {
         virReportError(VIR_ERR_RPC,
@@ -1315,13 +1360,38 @@ static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
     if (client->tx->bufferLength == client->tx->bufferOffset)
         return 1;
 
-    ret = virNetSocketWrite(client->sock,
-                            client->tx->buffer + client->tx->bufferOffset,
-                            client->tx->bufferLength - client->tx->bufferOffset);
+    /* Let the socket coalesce the messages queued behind the head
+     * one. Batching stops at a message carrying FDs, since those
+     * must be passed before anything that follows it, and while a
+     * SASL layer is waiting to be enabled after the current reply */
+    for (msg = client->tx;
+         msg && niov < VIR_NET_SERVER_CLIENT_WRITE_BATCH;
+         msg = msg->next) {
+        iov[niov].iov_base = msg->buffer + msg->bufferOffset;
+        iov[niov].iov_len = msg->bufferLength - msg->bufferOffset;
+        niov++;
+
+        if (msg->nfds)
+            break;
+#if WITH_SASL
+        if (client->sasl)
+            break;
+#endif
+    }
+
+    ret = virNetSocketWritev(client->sock, iov, niov);
     if (ret <= 0)
         return ret; /* -1 error, 0 = egain */
 
-    client->tx->bufferOffset += ret;
+    /* Account the written data against each message in turn, the
+     * ones completed behind the head are served by the caller */
+    done = ret;
+    for (msg = client->tx; msg && done > 0; msg = msg->next) {
+        size_t len = MIN(done, msg->bufferLength - msg->bufferOffset);
+        msg->bufferOffset += len;
+        done -= len;
+    }
+
     return ret;
 }
 
@@ -1382,7 +1452,7 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                     /* Ready to recv more messages */
                     virNetMessageClear(msg);
                     msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                    if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
+                    if (virNetMessageGrowBuffer(msg, msg->bufferLength, 0) < 0) {
                         virNetMessageFree(msg);
                         return;
                     }
@@ -1481,6 +1551,10 @@ virNetServerClientSendMessageLocked(virNetServerClientPtr client,
 
     msg->donefds = 0;
     if (client->sock && !client->wantClose) {
+        if (client->compress &&
+            virNetMessageCompress(msg, client->compressionLevel) < 0)
+            return -1;
+
         PROBE(RPC_SERVER_CLIENT_MSG_TX_QUEUE,
               "client=%p len=%zu prog=%u vers=%u proc=%u type=%u status=%u serial=%u",
               client, msg->bufferLength,
@@ -1582,26 +1656,60 @@ virNetServerClientStartKeepAlive(virNetServerClientPtr client)
     return ret;
 }
 
+void
+virNetServerClientSetCompressionLevel(virNetServerClientPtr client,
+                                      int level)
+{
+    virObjectLock(client);
+    client->compressionLevel = level;
+    virObjectUnlock(client);
+}
+
 int
-virNetServerClientGetTransport(virNetServerClientPtr client)
+virNetServerClientSetSocketBufferSizes(virNetServerClientPtr client,
+                                       unsigned int sendSize,
+                                       unsigned int recvSize)
 {
-    int ret = -1;
+    int ret = 0;
 
     virObjectLock(client);
+    if (client->sock)
+        ret = virNetSocketSetBufferSizes(client->sock, sendSize, recvSize);
+    virObjectUnlock(client);
 
-    if (client->sock && virNetSocketIsLocal(client->sock))
-        ret = VIR_CLIENT_TRANS_UNIX;
-    else
-        ret = VIR_CLIENT_TRANS_TCP;
+    return ret;
+}
 
-#ifdef WITH_GNUTLS
-    if (client->tls)
-        ret = VIR_CLIENT_TRANS_TLS;
-#endif
+/**
+ * virNetServerClientEnableCompression:
+ * @client: the client
+ *
+ * Called when the client asks whether it may compress its messages,
+ * which also tells us it can inflate ours.
+ *
+ * Returns true if the server allows compression, false otherwise
+ */
+bool
+virNetServerClientEnableCompression(virNetServerClientPtr client)
+{
+    bool enabled;
 
+    virObjectLock(client);
+    enabled = client->compressionLevel > 0;
+    if (enabled) {
+        VIR_DEBUG("Compressing messages to client=%p at level %d",
+                  client, client->compressionLevel);
+        client->compress = true;
+    }
     virObjectUnlock(client);
 
-    return ret;
+    return enabled;
+}
+
+int
+virNetServerClientGetTransport(virNetServerClientPtr client)
+{
+    return client->transport;
 }
 
 int
@@ -1639,6 +1747,75 @@ virNetServerClientGetInfo(virNetServerClientPtr client,
 }
 
 
+static bool
+virNetServerClientMatchIdentity(virIdentityPtr identity,
+                                const char *name)
+{
+    const char *attr;
+
+    if (!identity)
+        return false;
+
+    if (virIdentityGetUNIXUserName(identity, &attr) == 0 &&
+        STREQ_NULLABLE(attr, name))
+        return true;
+
+    if (virIdentityGetSASLUserName(identity, &attr) == 0 &&
+        STREQ_NULLABLE(attr, name))
+        return true;
+
+    if (virIdentityGetX509DName(identity, &attr) == 0 &&
+        STREQ_NULLABLE(attr, name))
+        return true;
+
+    return false;
+}
+
+
+/**
+ * virNetServerClientMatches:
+ * @client: the client
+ * @match: the criteria to check
+ *
+ * Checks whether @client satisfies all criteria in @match. Clients
+ * restored after a daemon re-exec without a connection timestamp
+ * never match a minimal age. Clients which have not been assigned
+ * an identity yet never match an identity.
+ *
+ * Returns true if @client matches, false otherwise.
+ */
+bool
+virNetServerClientMatches(virNetServerClientPtr client,
+                          virNetServerClientMatchPtr match)
+{
+    bool ret = false;
+
+    if (match->transport >= 0 &&
+        virNetServerClientGetTransport(client) != match->transport)
+        return false;
+
+    virObjectLock(client);
+
+    if (match->minAge > 0 &&
+        (client->conn_time == 0 ||
+         match->now - client->conn_time < match->minAge))
+        goto cleanup;
+
+    if (match->minIdle > 0 &&
+        match->now - client->last_activity < match->minIdle)
+        goto cleanup;
+
+    if (match->identity &&
+        !virNetServerClientMatchIdentity(client->identity, match->identity))
+        goto cleanup;
+
+    ret = true;
+ cleanup:
+    virObjectUnlock(client);
+    return ret;
+}
+
+
 /**
  * virNetServerClientSetQuietEOF:
  *
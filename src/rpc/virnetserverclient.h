@@ -138,6 +138,13 @@ bool virNetServerClientCheckKeepAlive(virNetServerClientPtr client,
                                       virNetMessagePtr msg);
 int virNetServerClientStartKeepAlive(virNetServerClientPtr client);
 
+void virNetServerClientSetCompressionLevel(virNetServerClientPtr client,
+                                           int level);
+int virNetServerClientSetSocketBufferSizes(virNetServerClientPtr client,
+                                           unsigned int sendSize,
+                                           unsigned int recvSize);
+bool virNetServerClientEnableCompression(virNetServerClientPtr client);
+
 const char *virNetServerClientLocalAddrStringSASL(virNetServerClientPtr client);
 const char *virNetServerClientRemoteAddrStringSASL(virNetServerClientPtr client);
 const char *virNetServerClientRemoteAddrStringURI(virNetServerClientPtr client);
@@ -152,6 +159,20 @@ int virNetServerClientGetInfo(virNetServerClientPtr client,
                               bool *readonly, char **sock_addr,
                               virIdentityPtr *identity);
 
+typedef struct _virNetServerClientMatch virNetServerClientMatch;
+typedef virNetServerClientMatch *virNetServerClientMatchPtr;
+struct _virNetServerClientMatch {
+    int transport;          /* virClientTransport, or -1 for any */
+    const char *identity;   /* UNIX, SASL or x509 user name, NULL for any */
+    long long minAge;       /* seconds since the client connected */
+    long long minIdle;      /* seconds since the last request */
+    long long now;          /* reference time for @minAge and @minIdle */
+};
+
+long long virNetServerClientGetLastActivity(virNetServerClientPtr client);
+bool virNetServerClientMatches(virNetServerClientPtr client,
+                               virNetServerClientMatchPtr match);
+
 void virNetServerClientSetQuietEOF(virNetServerClientPtr client);
 
 #endif /* __VIR_NET_SERVER_CLIENT_H__ */
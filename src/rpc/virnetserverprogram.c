@@ -31,18 +31,22 @@
 #include "virlog.h"
 #include "virfile.h"
 #include "virthread.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
 VIR_LOG_INIT("rpc.netserverprogram");
 
 struct _virNetServerProgram {
-    virObject object;
+    virObjectLockable parent;
 
     unsigned program;
     unsigned version;
     virNetServerProgramProcPtr procs;
     size_t nprocs;
+
+    /* One entry per procedure, protected by the object lock */
+    virNetServerProgramProcStatsPtr stats;
 };
 
 
@@ -51,7 +55,7 @@ static void virNetServerProgramDispose(void *obj);
 
 static int virNetServerProgramOnceInit(void)
 {
-    if (!(virNetServerProgramClass = virClassNew(virClassForObject(),
+    if (!(virNetServerProgramClass = virClassNew(virClassForObjectLockable(),
                                                  "virNetServerProgram",
                                                  sizeof(virNetServerProgram),
                                                  virNetServerProgramDispose)))
@@ -73,8 +77,13 @@ virNetServerProgramPtr virNetServerProgramNew(unsigned program,
     if (virNetServerProgramInitialize() < 0)
         return NULL;
 
-    if (!(prog = virObjectNew(virNetServerProgramClass)))
+    if (!(prog = virObjectLockableNew(virNetServerProgramClass)))
+        return NULL;
+
+    if (VIR_ALLOC_N(prog->stats, nprocs) < 0) {
+        virObjectUnref(prog);
         return NULL;
+    }
 
     prog->program = program;
     prog->version = version;
@@ -207,7 +216,9 @@ virNetServerProgramSendReplyError(virNetServerProgramPtr prog,
                                         msg,
                                         rerr,
                                         req->proc,
-                                        req->type == VIR_NET_STREAM ? VIR_NET_STREAM : VIR_NET_REPLY,
+                                        req->type == VIR_NET_STREAM ||
+                                        req->type == VIR_NET_STREAM_HOLE ?
+                                        VIR_NET_STREAM : VIR_NET_REPLY,
                                         req->serial);
 }
 
@@ -308,6 +319,7 @@ int virNetServerProgramDispatch(virNetServerProgramPtr prog,
         break;
 
     case VIR_NET_STREAM:
+    case VIR_NET_STREAM_HOLE:
         /* Since stream data is non-acked, async, we may continue to receive
          * stream packets after we closed down a stream. Just drop & ignore
          * these.
@@ -353,6 +365,84 @@ int virNetServerProgramDispatch(virNetServerProgramPtr prog,
 }
 
 
+static size_t
+virNetServerProgramHistogramBucket(unsigned long long usecs)
+{
+    size_t i = 0;
+
+    while ((usecs >>= 1) && i < VIR_NET_SERVER_PROGRAM_HISTOGRAM_BUCKETS - 1)
+        i++;
+
+    return i;
+}
+
+
+static void
+virNetServerProgramRecordCall(virNetServerProgramPtr prog,
+                              int procedure,
+                              unsigned long long queued,
+                              unsigned long long start,
+                              unsigned long long end,
+                              bool failed)
+{
+    virNetServerProgramProcStatsPtr stats = &prog->stats[procedure];
+    unsigned long long wait = queued && start > queued ? start - queued : 0;
+    unsigned long long exec = end > start ? end - start : 0;
+
+    virObjectLock(prog);
+    stats->calls++;
+    if (failed)
+        stats->errors++;
+    stats->waitTotal += wait;
+    stats->execTotal += exec;
+    stats->wait[virNetServerProgramHistogramBucket(wait)]++;
+    stats->exec[virNetServerProgramHistogramBucket(exec)]++;
+    virObjectUnlock(prog);
+}
+
+
+/**
+ * virNetServerProgramGetStats:
+ * @prog: the program
+ * @stats: filled with a copy of the statistics of every procedure
+ *
+ * Procedure numbers index @stats, entries of procedures which were never
+ * called are all zero.
+ *
+ * Returns the number of entries in @stats, -1 on error.
+ */
+ssize_t
+virNetServerProgramGetStats(virNetServerProgramPtr prog,
+                            virNetServerProgramProcStatsPtr *stats)
+{
+    ssize_t ret = -1;
+
+    virObjectLock(prog);
+    if (VIR_ALLOC_N(*stats, prog->nprocs) < 0)
+        goto cleanup;
+
+    memcpy(*stats, prog->stats, sizeof(**stats) * prog->nprocs);
+    ret = prog->nprocs;
+
+ cleanup:
+    virObjectUnlock(prog);
+    return ret;
+}
+
+
+const char *
+virNetServerProgramGetProcName(virNetServerProgramPtr prog,
+                               int procedure)
+{
+    virNetServerProgramProcPtr proc = virNetServerProgramGetProc(prog, procedure);
+
+    if (!proc)
+        return NULL;
+
+    return proc->name;
+}
+
+
 /*
  * @server: the unlocked server object
  * @client: the unlocked client object
@@ -378,6 +468,8 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     virNetMessageError rerr;
     size_t i;
     virIdentityPtr identity = NULL;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
 
     memset(&rerr, 0, sizeof(rerr));
 
@@ -434,7 +526,12 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
      *
      *   'args and 'ret'
      */
+    ignore_value(virTimeMicrosNowRaw(&start));
     rv = (dispatcher->func)(server, client, msg, &rerr, arg, ret);
+    ignore_value(virTimeMicrosNowRaw(&end));
+
+    virNetServerProgramRecordCall(prog, msg->header.proc, msg->queued,
+                                  start, end, rv < 0);
 
     if (virIdentitySetCurrent(NULL) < 0)
         goto error;
@@ -506,32 +603,47 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
 }
 
 
-int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
-                                      virNetServerClientPtr client,
+static int
+virNetServerProgramEncodeStreamHeader(virNetServerProgramPtr prog,
                                       virNetMessagePtr msg,
                                       int procedure,
                                       unsigned int serial,
-                                      const char *data,
-                                      size_t len)
+                                      int type,
+                                      int status)
 {
-    VIR_DEBUG("client=%p msg=%p data=%p len=%zu", client, msg, data, len);
-
     /* Return header. We're reusing same message object, so
      * only need to tweak type/status fields */
     msg->header.prog = prog->program;
     msg->header.vers = prog->version;
     msg->header.proc = procedure;
-    msg->header.type = VIR_NET_STREAM;
+    msg->header.type = type;
     msg->header.serial = serial;
+    msg->header.status = status;
+
+    return virNetMessageEncodeHeader(msg);
+}
+
+
+int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      unsigned int serial,
+                                      const char *data,
+                                      size_t len)
+{
+    VIR_DEBUG("client=%p msg=%p data=%p len=%zu", client, msg, data, len);
+
     /*
      * NB
      *   data != NULL + len > 0    => VIR_NET_CONTINUE   (Sending back data)
      *   data != NULL + len == 0   => VIR_NET_CONTINUE   (Sending read EOF)
      *   data == NULL              => VIR_NET_OK         (Sending finish handshake confirmation)
      */
-    msg->header.status = data ? VIR_NET_CONTINUE : VIR_NET_OK;
-
-    if (virNetMessageEncodeHeader(msg) < 0)
+    if (virNetServerProgramEncodeStreamHeader(prog, msg, procedure, serial,
+                                              VIR_NET_STREAM,
+                                              data ? VIR_NET_CONTINUE :
+                                              VIR_NET_OK) < 0)
         return -1;
 
     if (data && len) {
@@ -548,6 +660,94 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
 }
 
 
-void virNetServerProgramDispose(void *obj ATTRIBUTE_UNUSED)
+/**
+ * virNetServerProgramStreamDataBegin:
+ *
+ * Encode the header of a stream data packet into @msg and return
+ * a buffer of @len bytes inside the message for the caller to read
+ * the data into. This avoids a bounce buffer and an extra copy of
+ * every chunk compared to virNetServerProgramSendStreamData. The
+ * packet is sent by virNetServerProgramSendStreamDataEnd.
+ *
+ * Returns pointer to the payload area, NULL on error
+ */
+char *virNetServerProgramStreamDataBegin(virNetServerProgramPtr prog,
+                                         virNetMessagePtr msg,
+                                         int procedure,
+                                         unsigned int serial,
+                                         size_t len)
+{
+    VIR_DEBUG("msg=%p len=%zu", msg, len);
+
+    if (virNetServerProgramEncodeStreamHeader(prog, msg, procedure, serial,
+                                              VIR_NET_STREAM,
+                                              VIR_NET_CONTINUE) < 0)
+        return NULL;
+
+    return virNetMessageEncodePayloadRawBegin(msg, len);
+}
+
+
+/**
+ * virNetServerProgramSendStreamDataEnd:
+ *
+ * Send the stream data packet prepared by
+ * virNetServerProgramStreamDataBegin carrying the first @len bytes
+ * of its payload area; @len of 0 signals read EOF.
+ */
+int virNetServerProgramSendStreamDataEnd(virNetServerClientPtr client,
+                                         virNetMessagePtr msg,
+                                         size_t len)
+{
+    VIR_DEBUG("client=%p msg=%p len=%zu", client, msg, len);
+
+    if (virNetMessageEncodePayloadRawEnd(msg, len) < 0)
+        return -1;
+    VIR_DEBUG("Total %zu", msg->bufferLength);
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
+/**
+ * virNetServerProgramSendStreamHole:
+ *
+ * Send a stream hole packet telling the client to skip @length
+ * bytes of the stream.
+ */
+int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      unsigned int serial,
+                                      long long length,
+                                      unsigned int flags)
 {
+    virNetStreamHole data;
+
+    VIR_DEBUG("client=%p msg=%p length=%lld", client, msg, length);
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+    data.flags = flags;
+
+    if (virNetServerProgramEncodeStreamHeader(prog, msg, procedure, serial,
+                                              VIR_NET_STREAM_HOLE,
+                                              VIR_NET_CONTINUE) < 0)
+        return -1;
+
+    if (virNetMessageEncodePayload(msg,
+                                   (xdrproc_t) xdr_virNetStreamHole,
+                                   &data) < 0)
+        return -1;
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
+void virNetServerProgramDispose(void *obj)
+{
+    virNetServerProgramPtr prog = obj;
+
+    VIR_FREE(prog->stats);
 }
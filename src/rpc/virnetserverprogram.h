@@ -58,6 +58,24 @@ struct _virNetServerProgramProc {
     xdrproc_t ret_filter;
     bool needAuth;
     unsigned int priority;
+    const char *name;
+};
+
+/* Bucket i of a histogram counts durations of less than 2^(i+1)
+ * microseconds not counted by a lower bucket, the last one takes
+ * everything longer */
+# define VIR_NET_SERVER_PROGRAM_HISTOGRAM_BUCKETS 24
+
+typedef struct _virNetServerProgramProcStats virNetServerProgramProcStats;
+typedef virNetServerProgramProcStats *virNetServerProgramProcStatsPtr;
+
+struct _virNetServerProgramProcStats {
+    unsigned long long calls;
+    unsigned long long errors;
+    unsigned long long waitTotal;       /* Microseconds queued for a worker */
+    unsigned long long execTotal;       /* Microseconds being processed */
+    unsigned long long wait[VIR_NET_SERVER_PROGRAM_HISTOGRAM_BUCKETS];
+    unsigned long long exec[VIR_NET_SERVER_PROGRAM_HISTOGRAM_BUCKETS];
 };
 
 virNetServerProgramPtr virNetServerProgramNew(unsigned program,
@@ -71,6 +89,12 @@ int virNetServerProgramGetVersion(virNetServerProgramPtr prog);
 unsigned int virNetServerProgramGetPriority(virNetServerProgramPtr prog,
                                             int procedure);
 
+const char *virNetServerProgramGetProcName(virNetServerProgramPtr prog,
+                                          int procedure);
+
+ssize_t virNetServerProgramGetStats(virNetServerProgramPtr prog,
+                                    virNetServerProgramProcStatsPtr *stats);
+
 int virNetServerProgramMatches(virNetServerProgramPtr prog,
                                virNetMessagePtr msg);
 
@@ -104,4 +128,22 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
                                       const char *data,
                                       size_t len);
 
+char *virNetServerProgramStreamDataBegin(virNetServerProgramPtr prog,
+                                         virNetMessagePtr msg,
+                                         int procedure,
+                                         unsigned int serial,
+                                         size_t len);
+
+int virNetServerProgramSendStreamDataEnd(virNetServerClientPtr client,
+                                         virNetMessagePtr msg,
+                                         size_t len);
+
+int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      unsigned int serial,
+                                      long long length,
+                                      unsigned int flags);
+
 #endif /* __VIR_NET_SERVER_PROGRAM_H__ */
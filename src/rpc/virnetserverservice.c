@@ -33,11 +33,17 @@
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+/* Connections accepted in one go when a socket becomes readable, so
+ * that a storm of reconnecting clients does not cost an event loop
+ * iteration per client */
+#define VIR_NET_SERVER_SERVICE_ACCEPT_BATCH 16
+
 struct _virNetServerService {
     virObject object;
 
     size_t nsocks;
     virNetSocketPtr *socks;
+    bool enabled;
 
     int auth;
     bool readonly;
@@ -75,20 +81,23 @@ static void virNetServerServiceAccept(virNetSocketPtr sock,
 {
     virNetServerServicePtr svc = opaque;
     virNetSocketPtr clientsock = NULL;
+    size_t i;
 
-    if (virNetSocketAccept(sock, &clientsock) < 0)
-        goto cleanup;
-
-    if (!clientsock) /* Connection already went away */
-        goto cleanup;
+    /* Dispatching a client may suspend the service when the server
+     * reached one of its limits */
+    for (i = 0; i < VIR_NET_SERVER_SERVICE_ACCEPT_BATCH && svc->enabled; i++) {
+        if (virNetSocketAccept(sock, &clientsock) < 0)
+            break;
 
-    if (!svc->dispatchFunc)
-        goto cleanup;
+        if (!clientsock) /* Connection already went away */
+            break;
 
-    svc->dispatchFunc(svc, clientsock, svc->dispatchOpaque);
+        if (svc->dispatchFunc)
+            svc->dispatchFunc(svc, clientsock, svc->dispatchOpaque);
 
- cleanup:
-    virObjectUnref(clientsock);
+        virObjectUnref(clientsock);
+        clientsock = NULL;
+    }
 }
 
 
@@ -506,6 +515,7 @@ void virNetServerServiceToggle(virNetServerServicePtr svc,
 {
     size_t i;
 
+    svc->enabled = enabled;
     for (i = 0; i < svc->nsocks; i++)
         virNetSocketUpdateIOCallback(svc->socks[i],
                                      enabled ?
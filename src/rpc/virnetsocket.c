@@ -25,6 +25,7 @@
 
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <signal.h>
@@ -58,6 +59,7 @@
 #include "virprobe.h"
 #include "virprocess.h"
 #include "virstring.h"
+#include "virevent.h"
 #include "dirname.h"
 #include "passfd.h"
 
@@ -108,6 +110,11 @@ struct _virNetSocket {
     const char *saslEncoded;
     size_t saslEncodedLength;
     size_t saslEncodedOffset;
+    size_t saslEncodedRawLength;
+
+    /* Scratch space for one block of wire data or batched raw data */
+    char *saslBuffer;
+    size_t saslBufferLength;
 #endif
 #if WITH_SSH2
     virNetSSHSessionPtr sshSession;
@@ -1343,6 +1350,7 @@ void virNetSocketDispose(void *obj)
 #endif
 #if WITH_SASL
     virObjectUnref(sock->saslSession);
+    VIR_FREE(sock->saslBuffer);
 #endif
 
 #if WITH_SSH2
@@ -1613,6 +1621,52 @@ int virNetSocketSetBlocking(virNetSocketPtr sock,
 }
 
 
+/**
+ * virNetSocketSetBufferSizes:
+ * @sock: the socket
+ * @sendSize: size in bytes of the kernel send buffer, 0 for the default
+ * @recvSize: size in bytes of the kernel receive buffer, 0 for the default
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetSocketSetBufferSizes(virNetSocketPtr sock,
+                               unsigned int sendSize,
+                               unsigned int recvSize)
+{
+    int size;
+    int ret = -1;
+
+    virObjectLock(sock);
+    if (sendSize) {
+        size = MIN(sendSize, INT_MAX);
+        if (setsockopt(sock->fd, SOL_SOCKET, SO_SNDBUF,
+                       &size, sizeof(size)) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to set socket send buffer size to %u"),
+                                 sendSize);
+            goto cleanup;
+        }
+    }
+
+    if (recvSize) {
+        size = MIN(recvSize, INT_MAX);
+        if (setsockopt(sock->fd, SOL_SOCKET, SO_RCVBUF,
+                       &size, sizeof(size)) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to set socket receive buffer size to %u"),
+                                 recvSize);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(sock);
+    return ret;
+}
+
+
 const char *virNetSocketLocalAddrStringSASL(virNetSocketPtr sock)
 {
     return sock->localAddrStrSASL;
@@ -1862,7 +1916,70 @@ static ssize_t virNetSocketWriteWire(virNetSocketPtr sock, const char *buf, size
 }
 
 
+/*
+ * Write as much of the buffers as a plain socket takes in a single
+ * system call. TLS and SSH sessions frame the data themselves, so
+ * only the first buffer is written through them.
+ */
+static ssize_t virNetSocketWritevWire(virNetSocketPtr sock,
+                                      const struct iovec *iov,
+                                      size_t niov)
+{
+    ssize_t ret;
+    bool plain = true;
+
+#if WITH_SSH2
+    if (sock->sshSession)
+        plain = false;
+#endif
+#if WITH_LIBSSH
+    if (sock->libsshSession)
+        plain = false;
+#endif
+#if WITH_GNUTLS
+    if (sock->tlsSession)
+        plain = false;
+#endif
+
+    if (niov == 1 || !plain)
+        return virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+
+ rewrite:
+    ret = writev(sock->fd, iov, niov);
+
+    if (ret < 0) {
+        if (errno == EINTR)
+            goto rewrite;
+        if (errno == EAGAIN)
+            return 0;
+
+        virReportSystemError(errno, "%s",
+                             _("Cannot write data"));
+        return -1;
+    }
+    if (ret == 0) {
+        virReportSystemError(EIO, "%s",
+                             _("End of file while writing data"));
+        return -1;
+    }
+
+    return ret;
+}
+
+
 #if WITH_SASL
+static char *virNetSocketGetSASLBuffer(virNetSocketPtr sock, size_t len)
+{
+    if (sock->saslBufferLength < len) {
+        if (VIR_REALLOC_N(sock->saslBuffer, len) < 0)
+            return NULL;
+        sock->saslBufferLength = len;
+    }
+
+    return sock->saslBuffer;
+}
+
+
 static ssize_t virNetSocketReadSASL(virNetSocketPtr sock, char *buf, size_t len)
 {
     ssize_t got;
@@ -1871,22 +1988,17 @@ static ssize_t virNetSocketReadSASL(virNetSocketPtr sock, char *buf, size_t len)
     if (sock->saslDecoded == NULL) {
         ssize_t encodedLen = virNetSASLSessionGetMaxBufSize(sock->saslSession);
         char *encoded;
-        if (VIR_ALLOC_N(encoded, encodedLen) < 0)
+        if (!(encoded = virNetSocketGetSASLBuffer(sock, encodedLen)))
             return -1;
         encodedLen = virNetSocketReadWire(sock, encoded, encodedLen);
 
-        if (encodedLen <= 0) {
-            VIR_FREE(encoded);
+        if (encodedLen <= 0)
             return encodedLen;
-        }
 
         if (virNetSASLSessionDecode(sock->saslSession,
                                     encoded, encodedLen,
-                                    &sock->saslDecoded, &sock->saslDecodedLength) < 0) {
-            VIR_FREE(encoded);
+                                    &sock->saslDecoded, &sock->saslDecodedLength) < 0)
             return -1;
-        }
-        VIR_FREE(encoded);
 
         sock->saslDecodedOffset = 0;
     }
@@ -1909,25 +2021,49 @@ static ssize_t virNetSocketReadSASL(virNetSocketPtr sock, char *buf, size_t len)
 }
 
 
-static ssize_t virNetSocketWriteSASL(virNetSocketPtr sock, const char *buf, size_t len)
+static ssize_t virNetSocketWriteSASL(virNetSocketPtr sock,
+                                     const struct iovec *iov,
+                                     size_t niov)
 {
     int ret;
-    size_t tosend = virNetSASLSessionGetMaxBufSize(sock->saslSession);
-
-    /* SASL doesn't necessarily let us send the whole
-       buffer at once */
-    if (tosend > len)
-        tosend = len;
 
     /* Not got any pending encoded data, so we need to encode raw stuff */
     if (sock->saslEncoded == NULL) {
+        size_t maxbufsize = virNetSASLSessionGetMaxBufSize(sock->saslSession);
+        const char *raw = iov[0].iov_base;
+        size_t tosend = iov[0].iov_len;
+        size_t i;
+
+        /* SASL doesn't necessarily let us send the whole
+           buffer at once */
+        if (tosend > maxbufsize)
+            tosend = maxbufsize;
+
+        /* Fill the rest of the block with whatever else is queued,
+         * so that many small messages cost one encode and one write */
+        if (tosend < maxbufsize && niov > 1) {
+            char *batch;
+
+            if (!(batch = virNetSocketGetSASLBuffer(sock, maxbufsize)))
+                return -1;
+
+            memcpy(batch, raw, tosend);
+            for (i = 1; i < niov && tosend < maxbufsize; i++) {
+                size_t len = MIN(iov[i].iov_len, maxbufsize - tosend);
+                memcpy(batch + tosend, iov[i].iov_base, len);
+                tosend += len;
+            }
+            raw = batch;
+        }
+
         if (virNetSASLSessionEncode(sock->saslSession,
-                                    buf, tosend,
+                                    raw, tosend,
                                     &sock->saslEncoded,
                                     &sock->saslEncodedLength) < 0)
             return -1;
 
         sock->saslEncodedOffset = 0;
+        sock->saslEncodedRawLength = tosend;
     }
 
     /* Send some of the encoded stuff out on the wire */
@@ -1943,11 +2079,14 @@ static ssize_t virNetSocketWriteSASL(virNetSocketPtr sock, const char *buf, size
 
     /* Sent all encoded, so update raw buffer to indicate completion */
     if (sock->saslEncodedOffset == sock->saslEncodedLength) {
+        size_t done = sock->saslEncodedRawLength;
+
         sock->saslEncoded = NULL;
         sock->saslEncodedOffset = sock->saslEncodedLength = 0;
+        sock->saslEncodedRawLength = 0;
 
         /* Mark as complete, so caller detects completion */
-        return tosend;
+        return done;
     } else {
         /* Still have stuff pending in saslEncoded buffer.
          * Pretend to caller that we didn't send any yet.
@@ -1977,13 +2116,44 @@ ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len)
 {
     ssize_t ret;
 
+    virObjectLock(sock);
+#if WITH_SASL
+    if (sock->saslSession) {
+        struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+        ret = virNetSocketWriteSASL(sock, &iov, 1);
+    } else
+#endif
+        ret = virNetSocketWriteWire(sock, buf, len);
+    virObjectUnlock(sock);
+    return ret;
+}
+
+
+/*
+ * Write data gathered from several buffers, such as a queue of
+ * messages. Like virNetSocketWrite, the return value is the number
+ * of bytes consumed from the front of @iov, 0 if the write would
+ * block and -1 on error. A SASL security layer encodes as many of
+ * the buffers as fit in one block and plain sockets take them all
+ * in one system call, while TLS and SSH sessions write only the
+ * first buffer.
+ */
+ssize_t virNetSocketWritev(virNetSocketPtr sock,
+                           const struct iovec *iov,
+                           size_t niov)
+{
+    ssize_t ret;
+
+    if (niov == 0)
+        return 0;
+
     virObjectLock(sock);
 #if WITH_SASL
     if (sock->saslSession)
-        ret = virNetSocketWriteSASL(sock, buf, len);
+        ret = virNetSocketWriteSASL(sock, iov, niov);
     else
 #endif
-        ret = virNetSocketWriteWire(sock, buf, len);
+        ret = virNetSocketWritevWire(sock, iov, niov);
     virObjectUnlock(sock);
     return ret;
 }
@@ -2169,11 +2339,13 @@ int virNetSocketAddIOCallback(virNetSocketPtr sock,
         goto cleanup;
     }
 
-    if ((sock->watch = virEventAddHandle(sock->fd,
-                                         events,
-                                         virNetSocketEventHandle,
-                                         sock,
-                                         virNetSocketEventFree)) < 0) {
+    /* Spread sockets, and thus clients, across event loop threads */
+    if ((sock->watch = virEventAddHandleKey(sock->fd,
+                                            events,
+                                            virNetSocketEventHandle,
+                                            sock,
+                                            virNetSocketEventFree,
+                                            sock->fd)) < 0) {
         VIR_DEBUG("Failed to register watch on socket %p", sock);
         goto cleanup;
     }
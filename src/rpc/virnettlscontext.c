@@ -34,6 +34,8 @@
 #include "virstring.h"
 
 #include "viralloc.h"
+#include "virbuffer.h"
+#include "virhash.h"
 #include "virerror.h"
 #include "virfile.h"
 #include "virutil.h"
@@ -44,6 +46,10 @@
 
 #define DH_BITS 2048
 
+/* Seconds for which TLS sessions can be resumed and validated peer
+ * certificates are trusted without checking them again */
+#define VIR_NET_TLS_CACHE_LIFETIME_DEFAULT 300
+
 #define LIBVIRT_PKI_DIR SYSCONFDIR "/pki"
 #define LIBVIRT_CACERT LIBVIRT_PKI_DIR "/CA/cacert.pem"
 #define LIBVIRT_CACRL LIBVIRT_PKI_DIR "/CA/cacrl.pem"
@@ -66,6 +72,13 @@ struct _virNetTLSContext {
     bool requireValidCert;
     const char *const*x509dnWhitelist;
     char *priority;
+
+    /* Identifies the credentials and checks of this context in the
+     * session and certificate caches */
+    char *cacheKey;
+#if HAVE_GNUTLS_SESSION_TICKET_ENABLE_SERVER
+    gnutls_datum_t ticketKey;
+#endif
 };
 
 struct _virNetTLSSession {
@@ -80,14 +93,41 @@ struct _virNetTLSSession {
     virNetTLSSessionReadFunc readFunc;
     void *opaque;
     char *x509dname;
+    char *cacheKey; /* of the client session in virNetTLSSessionCache */
+};
+
+typedef struct _virNetTLSCacheEntry virNetTLSCacheEntry;
+typedef virNetTLSCacheEntry *virNetTLSCacheEntryPtr;
+struct _virNetTLSCacheEntry {
+    time_t expires;
+    size_t len;
+    char *data; /* session data, or DN of the validated peer */
 };
 
+/* Clients create a new context for each connection, so the caches are
+ * shared by all contexts of the process */
+static virMutex virNetTLSCacheLock = VIR_MUTEX_INITIALIZER;
+static unsigned int virNetTLSCacheLifetime = VIR_NET_TLS_CACHE_LIFETIME_DEFAULT;
+static virHashTablePtr virNetTLSSessionCache; /* sessions to resume */
+static virHashTablePtr virNetTLSCertCache; /* peers which passed checks */
+
 static virClassPtr virNetTLSContextClass;
 static virClassPtr virNetTLSSessionClass;
 static void virNetTLSContextDispose(void *obj);
 static void virNetTLSSessionDispose(void *obj);
 
 
+static void
+virNetTLSCacheEntryFree(void *payload,
+                        const void *name ATTRIBUTE_UNUSED)
+{
+    virNetTLSCacheEntryPtr entry = payload;
+
+    VIR_FREE(entry->data);
+    VIR_FREE(entry);
+}
+
+
 static int virNetTLSContextOnceInit(void)
 {
     if (!(virNetTLSContextClass = virClassNew(virClassForObjectLockable(),
@@ -102,12 +142,119 @@ static int virNetTLSContextOnceInit(void)
                                               virNetTLSSessionDispose)))
         return -1;
 
+    if (!(virNetTLSSessionCache = virHashCreate(16, virNetTLSCacheEntryFree)) ||
+        !(virNetTLSCertCache = virHashCreate(16, virNetTLSCacheEntryFree)))
+        return -1;
+
     return 0;
 }
 
 VIR_ONCE_GLOBAL_INIT(virNetTLSContext)
 
 
+static int
+virNetTLSCacheEntryExpired(const void *payload,
+                           const void *name ATTRIBUTE_UNUSED,
+                           const void *opaque)
+{
+    const virNetTLSCacheEntry *entry = payload;
+    const time_t *now = opaque;
+
+    return entry->expires <= *now;
+}
+
+
+/* Must be called with virNetTLSCacheLock held */
+static virNetTLSCacheEntryPtr
+virNetTLSCacheLookup(virHashTablePtr cache,
+                     const char *key,
+                     time_t now)
+{
+    virNetTLSCacheEntryPtr entry;
+
+    if (!(entry = virHashLookup(cache, key)))
+        return NULL;
+
+    if (entry->expires <= now) {
+        virHashRemoveEntry(cache, key);
+        return NULL;
+    }
+
+    return entry;
+}
+
+
+/* Must be called with virNetTLSCacheLock held */
+static int
+virNetTLSCacheStore(virHashTablePtr cache,
+                    const char *key,
+                    const void *data,
+                    size_t len,
+                    time_t now,
+                    time_t expires)
+{
+    virNetTLSCacheEntryPtr entry;
+
+    /* Keep peers we stopped talking to from piling up */
+    virHashRemoveSet(cache, virNetTLSCacheEntryExpired, &now);
+
+    if (VIR_ALLOC(entry) < 0)
+        return -1;
+
+    if (VIR_ALLOC_N(entry->data, len + 1) < 0) {
+        VIR_FREE(entry);
+        return -1;
+    }
+    memcpy(entry->data, data, len);
+    entry->len = len;
+    entry->expires = expires;
+
+    if (virHashUpdateEntry(cache, key, entry) < 0) {
+        virNetTLSCacheEntryFree(entry, NULL);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static unsigned int
+virNetTLSGetCacheLifetime(void)
+{
+    unsigned int lifetime;
+
+    virMutexLock(&virNetTLSCacheLock);
+    lifetime = virNetTLSCacheLifetime;
+    virMutexUnlock(&virNetTLSCacheLock);
+
+    return lifetime;
+}
+
+
+/**
+ * virNetTLSSetCacheLifetime:
+ * @lifetime: seconds, 0 to disable the caches
+ *
+ * Set for how long TLS sessions can be resumed, and for how long a
+ * peer certificate chain which passed validation is trusted without
+ * checking it again. Applies to sessions created from now on.
+ */
+void
+virNetTLSSetCacheLifetime(unsigned int lifetime)
+{
+    if (virNetTLSContextInitialize() < 0)
+        return;
+
+    virMutexLock(&virNetTLSCacheLock);
+    virNetTLSCacheLifetime = lifetime;
+    if (lifetime == 0) {
+        virHashRemoveAll(virNetTLSSessionCache);
+        virHashRemoveAll(virNetTLSCertCache);
+    }
+    virMutexUnlock(&virNetTLSCacheLock);
+}
+
+
 static int
 virNetTLSContextCheckCertFile(const char *type, const char *file, bool allowMissing)
 {
@@ -703,6 +850,8 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
                                                bool isServer)
 {
     virNetTLSContextPtr ctxt;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
     int err;
 
     if (virNetTLSContextInitialize() < 0)
@@ -714,6 +863,14 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
     if (VIR_STRDUP(ctxt->priority, priority) < 0)
         goto error;
 
+    virBufferAsprintf(&buf, "%d|%s|%s|%s", isServer,
+                      NULLSTR(cacert), NULLSTR(cacrl), NULLSTR(cert));
+    for (i = 0; x509dnWhitelist && x509dnWhitelist[i]; i++)
+        virBufferAsprintf(&buf, "|%s", x509dnWhitelist[i]);
+    if (virBufferCheckError(&buf) < 0)
+        goto error;
+    ctxt->cacheKey = virBufferContentAndReset(&buf);
+
     err = gnutls_certificate_allocate_credentials(&ctxt->x509cred);
     if (err) {
         virReportError(VIR_ERR_SYSTEM_ERROR,
@@ -752,6 +909,17 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
 
         gnutls_certificate_set_dh_params(ctxt->x509cred,
                                          ctxt->dhParams);
+
+#if HAVE_GNUTLS_SESSION_TICKET_ENABLE_SERVER
+        /* Lets clients resume sessions without a full handshake */
+        err = gnutls_session_ticket_key_generate(&ctxt->ticketKey);
+        if (err < 0) {
+            virReportError(VIR_ERR_SYSTEM_ERROR,
+                           _("Unable to generate TLS session ticket key: %s"),
+                           gnutls_strerror(err));
+            goto error;
+        }
+#endif
     }
 
     ctxt->requireValidCert = requireValidCert;
@@ -768,6 +936,7 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
     if (isServer)
         gnutls_dh_params_deinit(ctxt->dhParams);
     gnutls_certificate_free_credentials(ctxt->x509cred);
+    VIR_FREE(ctxt->cacheKey);
     VIR_FREE(ctxt);
     return NULL;
 }
@@ -974,6 +1143,47 @@ virNetTLSContextPtr virNetTLSContextNewClient(const char *cacert,
 }
 
 
+/* Key of the peer certificate chain of @sess in virNetTLSCertCache, or
+ * NULL if it cannot be cached */
+static char *
+virNetTLSContextCertCacheKey(virNetTLSContextPtr ctxt,
+                             virNetTLSSessionPtr sess)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    const gnutls_datum_t *certs;
+    unsigned int nCerts;
+    unsigned char digest[32];
+    size_t digestlen;
+    size_t i;
+    size_t j;
+
+    if (gnutls_certificate_type_get(sess->session) != GNUTLS_CRT_X509 ||
+        !(certs = gnutls_certificate_get_peers(sess->session, &nCerts)))
+        return NULL;
+
+    virBufferAsprintf(&buf, "%s|%s", ctxt->cacheKey,
+                      sess->hostname ? sess->hostname : "");
+
+    for (i = 0; i < nCerts; i++) {
+        digestlen = sizeof(digest);
+        if (gnutls_fingerprint(GNUTLS_DIG_SHA256, &certs[i],
+                               digest, &digestlen) < 0) {
+            virBufferFreeAndReset(&buf);
+            return NULL;
+        }
+
+        virBufferAddChar(&buf, '|');
+        for (j = 0; j < digestlen; j++)
+            virBufferAsprintf(&buf, "%02x", digest[j]);
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
 static int virNetTLSContextValidCertificate(virNetTLSContextPtr ctxt,
                                             virNetTLSSessionPtr sess)
 {
@@ -985,9 +1195,33 @@ static int virNetTLSContextValidCertificate(virNetTLSContextPtr ctxt,
     char dname[256];
     char *dnameptr = dname;
     size_t dnamesize = sizeof(dname);
+    unsigned int lifetime = virNetTLSGetCacheLifetime();
+    char *cacheKey = NULL;
+    time_t now = time(NULL);
+    time_t expires = now + lifetime;
+    virNetTLSCacheEntryPtr entry;
 
     memset(dname, 0, dnamesize);
 
+    if (lifetime > 0 &&
+        (cacheKey = virNetTLSContextCertCacheKey(ctxt, sess))) {
+        virMutexLock(&virNetTLSCacheLock);
+        if ((entry = virNetTLSCacheLookup(virNetTLSCertCache, cacheKey, now))) {
+            ret = VIR_STRDUP(sess->x509dname, entry->data);
+            virMutexUnlock(&virNetTLSCacheLock);
+            VIR_FREE(cacheKey);
+            if (ret < 0)
+                goto authfail;
+
+            VIR_DEBUG("Peer DN %s was validated before", sess->x509dname);
+            PROBE(RPC_TLS_CONTEXT_SESSION_ALLOW,
+                  "ctxt=%p sess=%p dname=%s",
+                  ctxt, sess, sess->x509dname);
+            return 0;
+        }
+        virMutexUnlock(&virNetTLSCacheLock);
+    }
+
     if ((ret = gnutls_certificate_verify_peers2(sess->session, &status)) < 0) {
         virReportError(VIR_ERR_SYSTEM_ERROR,
                        _("Unable to verify TLS peer: %s"),
@@ -1030,6 +1264,7 @@ static int virNetTLSContextValidCertificate(virNetTLSContextPtr ctxt,
 
     for (i = 0; i < nCerts; i++) {
         gnutls_x509_crt_t cert;
+        time_t certExpires;
 
         if (gnutls_x509_crt_init(&cert) < 0) {
             virReportError(VIR_ERR_SYSTEM_ERROR, "%s",
@@ -1050,6 +1285,11 @@ static int virNetTLSContextValidCertificate(virNetTLSContextPtr ctxt,
             goto authdeny;
         }
 
+        /* Never trust a cached result past the end of the chain */
+        certExpires = gnutls_x509_crt_get_expiration_time(cert);
+        if (certExpires != (time_t) -1 && certExpires < expires)
+            expires = certExpires;
+
         if (i == 0) {
             ret = gnutls_x509_crt_get_dn(cert, dname, &dnamesize);
             if (ret != 0) {
@@ -1093,6 +1333,15 @@ static int virNetTLSContextValidCertificate(virNetTLSContextPtr ctxt,
         gnutls_x509_crt_deinit(cert);
     }
 
+    if (cacheKey) {
+        virMutexLock(&virNetTLSCacheLock);
+        if (virNetTLSCacheStore(virNetTLSCertCache, cacheKey,
+                                dname, strlen(dname), now, expires) < 0)
+            virResetLastError();
+        virMutexUnlock(&virNetTLSCacheLock);
+        VIR_FREE(cacheKey);
+    }
+
     PROBE(RPC_TLS_CONTEXT_SESSION_ALLOW,
           "ctxt=%p sess=%p dname=%s",
           ctxt, sess, dnameptr);
@@ -1104,6 +1353,7 @@ static int virNetTLSContextValidCertificate(virNetTLSContextPtr ctxt,
           "ctxt=%p sess=%p dname=%s",
           ctxt, sess, dnameptr);
 
+    VIR_FREE(cacheKey);
     return -1;
 
  authfail:
@@ -1111,9 +1361,70 @@ static int virNetTLSContextValidCertificate(virNetTLSContextPtr ctxt,
           "ctxt=%p sess=%p",
           ctxt, sess);
 
+    VIR_FREE(cacheKey);
     return -1;
 }
 
+/* Remember the session of a client, so that the next connection
+ * to the same server can resume it */
+static void
+virNetTLSSessionSave(virNetTLSSessionPtr sess)
+{
+    gnutls_datum_t data = { NULL, 0 };
+    unsigned int lifetime = virNetTLSGetCacheLifetime();
+    time_t now = time(NULL);
+    int err;
+
+    if (!sess->cacheKey || lifetime == 0)
+        return;
+
+    /* Keep the expiry of the session it was resumed from */
+    if (gnutls_session_is_resumed(sess->session)) {
+        VIR_DEBUG("Resumed TLS session with %s", sess->hostname);
+        return;
+    }
+
+    if ((err = gnutls_session_get_data2(sess->session, &data)) < 0) {
+        VIR_DEBUG("Unable to get TLS session data: %s", gnutls_strerror(err));
+        return;
+    }
+
+    virMutexLock(&virNetTLSCacheLock);
+    if (virNetTLSCacheStore(virNetTLSSessionCache, sess->cacheKey,
+                            data.data, data.size, now, now + lifetime) < 0)
+        virResetLastError();
+    virMutexUnlock(&virNetTLSCacheLock);
+
+    gnutls_free(data.data);
+}
+
+
+/* Offer the server a session to resume if we have one */
+static int
+virNetTLSSessionRestore(virNetTLSSessionPtr sess)
+{
+    virNetTLSCacheEntryPtr entry;
+    int err = 0;
+
+    virMutexLock(&virNetTLSCacheLock);
+    if ((entry = virNetTLSCacheLookup(virNetTLSSessionCache,
+                                      sess->cacheKey, time(NULL)))) {
+        VIR_DEBUG("Trying to resume TLS session with %s", sess->hostname);
+        err = gnutls_session_set_data(sess->session, entry->data, entry->len);
+    }
+    virMutexUnlock(&virNetTLSCacheLock);
+
+    if (err < 0) {
+        virReportError(VIR_ERR_SYSTEM_ERROR,
+                       _("Unable to set TLS session data: %s"),
+                       gnutls_strerror(err));
+        return -1;
+    }
+
+    return 0;
+}
+
+
 int virNetTLSContextCheckCertificate(virNetTLSContextPtr ctxt,
                                      virNetTLSSessionPtr sess)
 {
@@ -1130,6 +1441,9 @@ int virNetTLSContextCheckCertificate(virNetTLSContextPtr ctxt,
         }
         virResetLastError();
         VIR_INFO("Ignoring bad certificate at user request");
+    } else {
+        /* Only resume sessions with servers we trust */
+        virNetTLSSessionSave(sess);
     }
 
     ret = 0;
@@ -1149,6 +1463,13 @@ void virNetTLSContextDispose(void *obj)
           "ctxt=%p", ctxt);
 
     VIR_FREE(ctxt->priority);
+    VIR_FREE(ctxt->cacheKey);
+#if HAVE_GNUTLS_SESSION_TICKET_ENABLE_SERVER
+    if (ctxt->ticketKey.data) {
+        memset(ctxt->ticketKey.data, 0, ctxt->ticketKey.size);
+        gnutls_free(ctxt->ticketKey.data);
+    }
+#endif
     gnutls_dh_params_deinit(ctxt->dhParams);
     gnutls_certificate_free_credentials(ctxt->x509cred);
 }
@@ -1188,6 +1509,7 @@ virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
     virNetTLSSessionPtr sess;
     int err;
     const char *priority;
+    unsigned int lifetime = virNetTLSGetCacheLifetime();
 
     VIR_DEBUG("ctxt=%p hostname=%s isServer=%d",
               ctxt, NULLSTR(hostname), ctxt->isServer);
@@ -1237,6 +1559,32 @@ virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
         gnutls_dh_set_prime_bits(sess->session, DH_BITS);
     }
 
+    if (lifetime > 0) {
+#if HAVE_GNUTLS_SESSION_TICKET_ENABLE_SERVER
+        if (ctxt->isServer)
+            err = gnutls_session_ticket_enable_server(sess->session,
+                                                      &ctxt->ticketKey);
+        else
+            err = gnutls_session_ticket_enable_client(sess->session);
+        if (err < 0) {
+            virReportError(VIR_ERR_SYSTEM_ERROR,
+                           _("Failed to enable TLS session tickets: %s"),
+                           gnutls_strerror(err));
+            goto error;
+        }
+#endif
+        gnutls_db_set_cache_expiration(sess->session, lifetime);
+
+        if (!ctxt->isServer && hostname) {
+            if (virAsprintf(&sess->cacheKey, "%s|%s",
+                            ctxt->cacheKey, hostname) < 0)
+                goto error;
+
+            if (virNetTLSSessionRestore(sess) < 0)
+                goto error;
+        }
+    }
+
     gnutls_transport_set_ptr(sess->session, sess);
     gnutls_transport_set_push_function(sess->session,
                                        virNetTLSSessionPush);
@@ -1420,6 +1768,7 @@ void virNetTLSSessionDispose(void *obj)
 
     VIR_FREE(sess->x509dname);
     VIR_FREE(sess->hostname);
+    VIR_FREE(sess->cacheKey);
     gnutls_deinit(sess->session);
 }
 
@@ -33,6 +33,8 @@ typedef virNetTLSSession *virNetTLSSessionPtr;
 
 void virNetTLSInit(void);
 
+void virNetTLSSetCacheLifetime(unsigned int lifetime);
+
 virNetTLSContextPtr virNetTLSContextNewServerPath(const char *pkipath,
                                                   bool tryUserPkiPath,
                                                   const char *const*x509dnWhitelist,
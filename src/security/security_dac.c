@@ -99,6 +99,22 @@ virSecurityDACChownListAppend(virSecurityDACChownListPtr list,
     int ret = -1;
     char *tmp = NULL;
     virSecurityDACChownItemPtr item = NULL;
+    size_t i;
+
+    /* Backing images are often shared between disks. Chown each path
+     * only once; the last requested owner wins just like it would if the
+     * chown()-s were done one after another. */
+    for (i = 0; i < list->nItems; i++) {
+        virSecurityDACChownItemPtr old = list->items[i];
+
+        if (path ? STREQ_NULLABLE(old->path, path) :
+                   (!old->path && old->src == src)) {
+            old->src = src;
+            old->uid = uid;
+            old->gid = gid;
+            return 0;
+        }
+    }
 
     if (VIR_ALLOC(item) < 0)
         return -1;
@@ -503,6 +519,14 @@ virSecurityDACTransactionCommit(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
         goto cleanup;
     }
 
+    if (list->nItems == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Relabelling %zu paths in namespace of pid %lld",
+              list->nItems, (long long) pid);
+
     if (virProcessRunInMountNamespace(pid,
                                       virSecurityDACTransactionRun,
                                       list) < 0)
@@ -126,6 +126,23 @@ virSecuritySELinuxContextListAppend(virSecuritySELinuxContextListPtr list,
 {
     int ret = -1;
     virSecuritySELinuxContextItemPtr item = NULL;
+    size_t i;
+
+    /* Label each path only once, the last requested context wins. */
+    for (i = 0; i < list->nItems; i++) {
+        virSecuritySELinuxContextItemPtr old = list->items[i];
+        char *tmp;
+
+        if (STRNEQ(old->path, path))
+            continue;
+
+        if (VIR_STRDUP(tmp, tcon) < 0)
+            return -1;
+        VIR_FREE(old->tcon);
+        old->tcon = tmp;
+        old->optional = optional;
+        return 0;
+    }
 
     if (VIR_ALLOC(item) < 0)
         return -1;
@@ -1066,6 +1083,12 @@ virSecuritySELinuxTransactionCommit(virSecurityManagerPtr mgr ATTRIBUTE_UNUSED,
         goto cleanup;
     }
 
+    if (list->nItems == 0)
+        goto cleanup;
+
+    VIR_DEBUG("Relabelling %zu paths in namespace of pid %lld",
+              list->nItems, (long long) pid);
+
     if (virProcessRunInMountNamespace(pid,
                                       virSecuritySELinuxTransactionRun,
                                       list) < 0)
@@ -1153,6 +1176,19 @@ virSecuritySELinuxSetFileconHelper(const char *path, const char *tcon,
     else if (rc > 0)
         return 0;
 
+    /* Skip the relabel (and the audit record it generates) if the file
+     * already has the context, which is common for shared backing
+     * images and on domain restart. */
+    if (getfilecon_raw(path, &econ) >= 0) {
+        bool same = STREQ_NULLABLE(tcon, econ);
+
+        freecon(econ);
+        if (same) {
+            VIR_DEBUG("SELinux context on '%s' is already '%s'", path, tcon);
+            return 0;
+        }
+    }
+
     VIR_INFO("Setting SELinux context on '%s' to '%s'", path, tcon);
 
     if (setfilecon_raw(path, (VIR_SELINUX_CTX_CONST char *) tcon) < 0) {
@@ -26,10 +26,14 @@
 #include "storage_backend_gluster.h"
 #include "storage_conf.h"
 #include "viralloc.h"
+#include "virbuffer.h"
 #include "virerror.h"
+#include "virevent.h"
 #include "virlog.h"
 #include "virstoragefile.h"
 #include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
 #include "viruri.h"
 #include "storage_util.h"
 
@@ -37,6 +41,297 @@
 
 VIR_LOG_INIT("storage.storage_backend_gluster");
 
+/* Bringing up a gluster client takes a noticeable time, so connections
+ * are shared by everything accessing the same volume through the same
+ * servers, and kept for this long, in milliseconds, once unused. */
+#define VIR_STORAGE_GLUSTER_CONN_IDLE_TIMEOUT (30 * 1000)
+
+typedef struct _virStorageBackendGlusterServer virStorageBackendGlusterServer;
+typedef virStorageBackendGlusterServer *virStorageBackendGlusterServerPtr;
+struct _virStorageBackendGlusterServer {
+    const char *transport;
+    const char *host; /* host name, or socket path for unix transport */
+    int port;
+};
+
+typedef struct _virStorageBackendGlusterConn virStorageBackendGlusterConn;
+typedef virStorageBackendGlusterConn *virStorageBackendGlusterConnPtr;
+struct _virStorageBackendGlusterConn {
+    char *key; /* volume and servers the connection was made to */
+    glfs_t *vol;
+    size_t refs;
+    unsigned long long lastUsed; /* when refs dropped to 0 */
+};
+
+static virMutex virStorageBackendGlusterConnLock = VIR_MUTEX_INITIALIZER;
+static virStorageBackendGlusterConnPtr *virStorageBackendGlusterConns;
+static size_t virStorageBackendGlusterNConns;
+static int virStorageBackendGlusterConnTimer = -1;
+
+
+static void
+virStorageBackendGlusterConnFree(virStorageBackendGlusterConnPtr conn)
+{
+    if (!conn)
+        return;
+
+    VIR_DEBUG("closing gluster connection %s", NULLSTR(conn->key));
+
+    /* Yuck - glusterfs-api-3.4.1 appears to always return -1 for
+     * glfs_fini, with errno containing random data, so there's no way
+     * to tell if it succeeded. 3.4.2 is supposed to fix this.*/
+    if (conn->vol && glfs_fini(conn->vol) < 0)
+        VIR_DEBUG("shutdown of gluster connection %s failed with errno %d",
+                  NULLSTR(conn->key), errno);
+
+    VIR_FREE(conn->key);
+    VIR_FREE(conn);
+}
+
+
+/* Must be called with virStorageBackendGlusterConnLock held. Moves
+ * connections unused for long enough, or all unused ones if @all, to
+ * @expired so that they can be closed without the lock. */
+static void
+virStorageBackendGlusterConnExpire(bool all,
+                                   virStorageBackendGlusterConnPtr **expired,
+                                   size_t *nexpired)
+{
+    unsigned long long now = 0;
+    bool idle = false;
+    size_t i = 0;
+
+    if (!all && virTimeMillisNow(&now) < 0)
+        all = true;
+
+    while (i < virStorageBackendGlusterNConns) {
+        virStorageBackendGlusterConnPtr conn = virStorageBackendGlusterConns[i];
+
+        if (conn->refs > 0) {
+            i++;
+            continue;
+        }
+
+        if (!all &&
+            now - conn->lastUsed < VIR_STORAGE_GLUSTER_CONN_IDLE_TIMEOUT) {
+            idle = true;
+            i++;
+            continue;
+        }
+
+        if (VIR_APPEND_ELEMENT_QUIET(*expired, *nexpired, conn) < 0) {
+            i++;
+            continue;
+        }
+        VIR_DELETE_ELEMENT(virStorageBackendGlusterConns, i,
+                           virStorageBackendGlusterNConns);
+    }
+
+    if (!idle && virStorageBackendGlusterConnTimer >= 0) {
+        virEventRemoveTimeout(virStorageBackendGlusterConnTimer);
+        virStorageBackendGlusterConnTimer = -1;
+    }
+}
+
+
+static void
+virStorageBackendGlusterConnCloseAll(virStorageBackendGlusterConnPtr *conns,
+                                     size_t nconns)
+{
+    size_t i;
+
+    for (i = 0; i < nconns; i++)
+        virStorageBackendGlusterConnFree(conns[i]);
+    VIR_FREE(conns);
+}
+
+
+static void
+virStorageBackendGlusterConnTimeout(int timer ATTRIBUTE_UNUSED,
+                                    void *opaque ATTRIBUTE_UNUSED)
+{
+    virStorageBackendGlusterConnPtr *expired = NULL;
+    size_t nexpired = 0;
+
+    virMutexLock(&virStorageBackendGlusterConnLock);
+    virStorageBackendGlusterConnExpire(false, &expired, &nexpired);
+    virMutexUnlock(&virStorageBackendGlusterConnLock);
+
+    virStorageBackendGlusterConnCloseAll(expired, nexpired);
+}
+
+
+static char *
+virStorageBackendGlusterConnKey(const char *volume,
+                                size_t nservers,
+                                virStorageBackendGlusterServerPtr servers)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    virBufferAdd(&buf, volume, -1);
+    for (i = 0; i < nservers; i++)
+        virBufferAsprintf(&buf, " %s:%s:%d", servers[i].transport,
+                          servers[i].host, servers[i].port);
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/* Must be called with virStorageBackendGlusterConnLock held */
+static glfs_t *
+virStorageBackendGlusterConnLookup(const char *key)
+{
+    size_t i;
+
+    for (i = 0; i < virStorageBackendGlusterNConns; i++) {
+        if (STREQ(virStorageBackendGlusterConns[i]->key, key)) {
+            virStorageBackendGlusterConns[i]->refs++;
+            return virStorageBackendGlusterConns[i]->vol;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * virStorageBackendGlusterConnAcquire:
+ * @volume: name of the gluster volume
+ * @nservers: number of items in @servers
+ * @servers: the servers to fetch the volume file from
+ *
+ * Returns a connection to @volume, reusing an existing one if there's
+ * any for the same servers. The connection must be handed back with
+ * virStorageBackendGlusterConnRelease() rather than closed, and its
+ * working directory must not be changed. NULL is returned on error.
+ */
+static glfs_t *
+virStorageBackendGlusterConnAcquire(const char *volume,
+                                    size_t nservers,
+                                    virStorageBackendGlusterServerPtr servers)
+{
+    virStorageBackendGlusterConnPtr conn = NULL;
+    glfs_t *ret = NULL;
+    char *key;
+    size_t i;
+
+    if (!(key = virStorageBackendGlusterConnKey(volume, nservers, servers)))
+        return NULL;
+
+    virMutexLock(&virStorageBackendGlusterConnLock);
+    ret = virStorageBackendGlusterConnLookup(key);
+    virMutexUnlock(&virStorageBackendGlusterConnLock);
+
+    if (ret) {
+        VIR_DEBUG("reusing gluster connection %s", key);
+        goto cleanup;
+    }
+
+    /* Connecting may take a while, don't block other volumes meanwhile */
+    if (VIR_ALLOC(conn) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("opening gluster connection %s", key);
+
+    if (!(conn->vol = glfs_new(volume))) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < nservers; i++) {
+        if (glfs_set_volfile_server(conn->vol, servers[i].transport,
+                                    servers[i].host, servers[i].port) < 0) {
+            virReportSystemError(errno,
+                                 _("failed to set gluster volfile server '%s'"),
+                                 servers[i].host);
+            goto cleanup;
+        }
+    }
+
+    if (glfs_init(conn->vol) < 0) {
+        virReportSystemError(errno,
+                             _("failed to initialize gluster connection "
+                               "to volume '%s'"), volume);
+        goto cleanup;
+    }
+
+    virMutexLock(&virStorageBackendGlusterConnLock);
+    /* Somebody might have been faster */
+    if (!(ret = virStorageBackendGlusterConnLookup(key))) {
+        conn->refs = 1;
+        conn->key = key;
+        ret = conn->vol;
+        if (VIR_APPEND_ELEMENT(virStorageBackendGlusterConns,
+                               virStorageBackendGlusterNConns, conn) < 0) {
+            conn->key = NULL;
+            ret = NULL;
+        } else {
+            key = NULL;
+        }
+    }
+    virMutexUnlock(&virStorageBackendGlusterConnLock);
+
+ cleanup:
+    virStorageBackendGlusterConnFree(conn);
+    VIR_FREE(key);
+    return ret;
+}
+
+
+/**
+ * virStorageBackendGlusterConnRelease:
+ * @vol: connection returned by virStorageBackendGlusterConnAcquire()
+ *
+ * Hand back @vol. Once unused, the connection is kept open for a while
+ * for the next users, unless there's no event loop to close it later.
+ */
+static void
+virStorageBackendGlusterConnRelease(glfs_t *vol)
+{
+    virStorageBackendGlusterConnPtr *expired = NULL;
+    size_t nexpired = 0;
+    size_t i;
+
+    if (!vol)
+        return;
+
+    virMutexLock(&virStorageBackendGlusterConnLock);
+
+    for (i = 0; i < virStorageBackendGlusterNConns; i++) {
+        virStorageBackendGlusterConnPtr conn = virStorageBackendGlusterConns[i];
+
+        if (conn->vol != vol)
+            continue;
+
+        if (--conn->refs > 0)
+            break;
+
+        if (virTimeMillisNow(&conn->lastUsed) < 0)
+            conn->lastUsed = 0;
+
+        if (virStorageBackendGlusterConnTimer < 0)
+            virStorageBackendGlusterConnTimer =
+                virEventAddTimeout(VIR_STORAGE_GLUSTER_CONN_IDLE_TIMEOUT,
+                                   virStorageBackendGlusterConnTimeout,
+                                   NULL, NULL);
+        break;
+    }
+
+    /* Either drop what has been idle long enough, or everything
+     * unused if it can't be taken care of later */
+    virStorageBackendGlusterConnExpire(virStorageBackendGlusterConnTimer < 0,
+                                       &expired, &nexpired);
+
+    virMutexUnlock(&virStorageBackendGlusterConnLock);
+
+    virStorageBackendGlusterConnCloseAll(expired, nexpired);
+}
+
+
 struct _virStorageBackendGlusterState {
     glfs_t *vol;
 
@@ -57,12 +352,7 @@ virStorageBackendGlusterClose(virStorageBackendGlusterStatePtr state)
     if (!state)
         return;
 
-    /* Yuck - glusterfs-api-3.4.1 appears to always return -1 for
-     * glfs_fini, with errno containing random data, so there's no way
-     * to tell if it succeeded. 3.4.2 is supposed to fix this.*/
-    if (state->vol && glfs_fini(state->vol) < 0)
-        VIR_DEBUG("shutdown of gluster volume %s failed with errno %d",
-                  state->volname, errno);
+    virStorageBackendGlusterConnRelease(state->vol);
 
     virURIFree(state->uri);
     VIR_FREE(state->volname);
@@ -74,6 +364,7 @@ static virStorageBackendGlusterStatePtr
 virStorageBackendGlusterOpen(virStoragePoolObjPtr pool)
 {
     virStorageBackendGlusterStatePtr ret = NULL;
+    virStorageBackendGlusterServer server;
     const char *name = pool->def->source.name;
     const char *dir = pool->def->source.dir;
     bool trailing_slash = true;
@@ -119,25 +410,19 @@ virStorageBackendGlusterOpen(virStoragePoolObjPtr pool)
     ret->uri->port = pool->def->source.hosts[0].port;
 
     /* Actually connect to glfs */
-    if (!(ret->vol = glfs_new(ret->volname))) {
-        virReportOOMError();
-        goto error;
-    }
+    server.transport = "tcp";
+    server.host = ret->uri->server;
+    server.port = ret->uri->port;
 
-    if (glfs_set_volfile_server(ret->vol, "tcp",
-                                ret->uri->server, ret->uri->port) < 0 ||
-        glfs_init(ret->vol) < 0) {
-        char *uri = virURIFormat(ret->uri);
-
-        virReportSystemError(errno, _("failed to connect to %s"),
-                             NULLSTR(uri));
-        VIR_FREE(uri);
+    if (!(ret->vol = virStorageBackendGlusterConnAcquire(ret->volname,
+                                                         1, &server)))
         goto error;
-    }
 
-    if (glfs_chdir(ret->vol, ret->dir) < 0) {
+    /* The connection may be shared, so rather than changing to the
+     * pool directory, names are looked up relative to ret->dir */
+    if (glfs_access(ret->vol, ret->dir, F_OK) < 0) {
         virReportSystemError(errno,
-                             _("failed to change to directory '%s' in '%s'"),
+                             _("failed to access directory '%s' in '%s'"),
                              ret->dir, ret->volname);
         goto error;
     }
@@ -248,6 +533,7 @@ virStorageBackendGlusterRefreshVol(virStorageBackendGlusterStatePtr state,
     char *header = NULL;
     ssize_t len = VIR_STORAGE_MAX_HEADER;
     int backingFormat;
+    char *path = NULL;
 
     *volptr = NULL;
 
@@ -255,15 +541,18 @@ virStorageBackendGlusterRefreshVol(virStorageBackendGlusterStatePtr state,
     if (STREQ(name, ".") || STREQ(name, ".."))
         return 0;
 
+    if (virAsprintf(&path, "%s%s", state->dir, name) < 0)
+        return -1;
+
     /* Follow symlinks; silently skip broken links and loops.  */
-    if (S_ISLNK(st->st_mode) && glfs_stat(state->vol, name, st) < 0) {
+    if (S_ISLNK(st->st_mode) && glfs_stat(state->vol, path, st) < 0) {
         if (errno == ENOENT || errno == ELOOP) {
             VIR_WARN("ignoring dangling symlink '%s'", name);
             ret = 0;
         } else {
             virReportSystemError(errno, _("cannot stat '%s'"), name);
         }
-        return ret;
+        goto cleanup;
     }
 
     if (VIR_ALLOC(vol) < 0)
@@ -286,7 +575,7 @@ virStorageBackendGlusterRefreshVol(virStorageBackendGlusterStatePtr state,
 
     /* No need to worry about O_NONBLOCK - gluster doesn't allow creation
      * of fifos, so there's nothing it would protect us from. */
-    if (!(fd = glfs_open(state->vol, name, O_RDONLY | O_NOCTTY))) {
+    if (!(fd = glfs_open(state->vol, path, O_RDONLY | O_NOCTTY))) {
         /* A dangling symlink now implies a TOCTTOU race; report it.  */
         virReportSystemError(errno, _("cannot open volume '%s'"), name);
         goto cleanup;
@@ -334,6 +623,7 @@ virStorageBackendGlusterRefreshVol(virStorageBackendGlusterStatePtr state,
     if (fd)
         glfs_close(fd);
     VIR_FREE(header);
+    VIR_FREE(path);
     return ret;
 }
 
@@ -385,9 +675,10 @@ virStorageBackendGlusterRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
 
         if (okay < 0)
             goto cleanup;
-        if (vol && VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count,
-                                      vol) < 0)
+        if (vol && virStoragePoolObjAddVol(pool, vol) < 0) {
+            virStorageVolDefFree(vol);
             goto cleanup;
+        }
     }
     if (errno) {
         virReportSystemError(errno, _("failed to read directory '%s' in '%s'"),
@@ -425,6 +716,7 @@ virStorageBackendGlusterVolDelete(virConnectPtr conn ATTRIBUTE_UNUSED,
                                   unsigned int flags)
 {
     virStorageBackendGlusterStatePtr state = NULL;
+    char *path = NULL;
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -447,7 +739,10 @@ virStorageBackendGlusterVolDelete(virConnectPtr conn ATTRIBUTE_UNUSED,
         if (!(state = virStorageBackendGlusterOpen(pool)))
             goto cleanup;
 
-        if (glfs_unlink(state->vol, vol->name) < 0) {
+        if (virAsprintf(&path, "%s%s", state->dir, vol->name) < 0)
+            goto cleanup;
+
+        if (glfs_unlink(state->vol, path) < 0) {
             if (errno != ENOENT) {
                 virReportSystemError(errno,
                                      _("cannot remove gluster volume file '%s'"),
@@ -476,6 +771,7 @@ virStorageBackendGlusterVolDelete(virConnectPtr conn ATTRIBUTE_UNUSED,
 
  cleanup:
     virStorageBackendGlusterClose(state);
+    VIR_FREE(path);
     return ret;
 }
 
@@ -578,8 +874,7 @@ virStorageFileBackendGlusterDeinit(virStorageSourcePtr src)
               src, src->hosts->name, src->hosts->port ? src->hosts->port : "0",
               src->volume, src->path);
 
-    if (priv->vol)
-        glfs_fini(priv->vol);
+    virStorageBackendGlusterConnRelease(priv->vol);
     VIR_FREE(priv->canonpath);
 
     VIR_FREE(priv);
@@ -587,20 +882,19 @@ virStorageFileBackendGlusterDeinit(virStorageSourcePtr src)
 }
 
 static int
-virStorageFileBackendGlusterInitServer(virStorageFileBackendGlusterPrivPtr priv,
+virStorageFileBackendGlusterInitServer(virStorageBackendGlusterServerPtr server,
                                        virStorageNetHostDefPtr host)
 {
-    const char *transport = virStorageNetHostTransportTypeToString(host->transport);
-    const char *hoststr = NULL;
-    int port = 0;
+    memset(server, 0, sizeof(*server));
+    server->transport = virStorageNetHostTransportTypeToString(host->transport);
 
     switch ((virStorageNetHostTransport) host->transport) {
     case VIR_STORAGE_NET_HOST_TRANS_RDMA:
     case VIR_STORAGE_NET_HOST_TRANS_TCP:
-        hoststr = host->name;
+        server->host = host->name;
 
         if (host->port &&
-            virStrToLong_i(host->port, NULL, 10, &port) < 0) {
+            virStrToLong_i(host->port, NULL, 10, &server->port) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("failed to parse port number '%s'"),
                            host->port);
@@ -610,22 +904,15 @@ virStorageFileBackendGlusterInitServer(virStorageFileBackendGlusterPrivPtr priv,
         break;
 
     case VIR_STORAGE_NET_HOST_TRANS_UNIX:
-        hoststr = host->socket;
+        server->host = host->socket;
         break;
 
     case VIR_STORAGE_NET_HOST_TRANS_LAST:
         break;
     }
 
-    VIR_DEBUG("adding gluster host for %p: transport=%s host=%s port=%d",
-              priv, transport, hoststr, port);
-
-    if (glfs_set_volfile_server(priv->vol, transport, hoststr, port) < 0) {
-        virReportSystemError(errno,
-                             _("failed to set gluster volfile server '%s'"),
-                             hoststr);
-        return -1;
-    }
+    VIR_DEBUG("adding gluster host: transport=%s host=%s port=%d",
+              server->transport, server->host, server->port);
 
     return 0;
 }
@@ -635,7 +922,9 @@ static int
 virStorageFileBackendGlusterInit(virStorageSourcePtr src)
 {
     virStorageFileBackendGlusterPrivPtr priv = NULL;
+    virStorageBackendGlusterServerPtr servers = NULL;
     size_t i;
+    int ret = -1;
 
     if (!src->volume) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -644,41 +933,34 @@ virStorageFileBackendGlusterInit(virStorageSourcePtr src)
         return -1;
     }
 
-    if (VIR_ALLOC(priv) < 0)
-        return -1;
+    if (VIR_ALLOC(priv) < 0 ||
+        VIR_ALLOC_N(servers, src->nhosts) < 0)
+        goto cleanup;
 
     VIR_DEBUG("initializing gluster storage file %p "
               "(priv='%p' volume='%s' path='%s') as [%u:%u]",
               src, priv, src->volume, src->path,
               (unsigned int)src->drv->uid, (unsigned int)src->drv->gid);
 
-    if (!(priv->vol = glfs_new(src->volume))) {
-        virReportOOMError();
-        goto error;
-    }
-
     for (i = 0; i < src->nhosts; i++) {
-        if (virStorageFileBackendGlusterInitServer(priv, src->hosts + i) < 0)
-            goto error;
+        if (virStorageFileBackendGlusterInitServer(servers + i,
+                                                   src->hosts + i) < 0)
+            goto cleanup;
     }
 
-    if (glfs_init(priv->vol) < 0) {
-        virReportSystemError(errno,
-                             _("failed to initialize gluster connection "
-                               "(src=%p priv=%p)"), src, priv);
-        goto error;
-    }
+    if (!(priv->vol = virStorageBackendGlusterConnAcquire(src->volume,
+                                                          src->nhosts,
+                                                          servers)))
+        goto cleanup;
 
     src->drv->priv = priv;
+    priv = NULL;
+    ret = 0;
 
-    return 0;
-
- error:
-    if (priv->vol)
-        glfs_fini(priv->vol);
+ cleanup:
+    VIR_FREE(servers);
     VIR_FREE(priv);
-
-    return -1;
+    return ret;
 }
 
 
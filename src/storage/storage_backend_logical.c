@@ -33,9 +33,12 @@
 
 #include "virerror.h"
 #include "storage_backend_logical.h"
+#include "storage_backend_logical_priv.h"
 #include "storage_conf.h"
 #include "vircommand.h"
 #include "viralloc.h"
+#include "virhash.h"
+#include "virjson.h"
 #include "virlog.h"
 #include "virfile.h"
 #include "virstring.h"
@@ -127,6 +130,8 @@ virStorageBackendLogicalInitializeDevice(const char *path)
 struct virStorageBackendLogicalPoolVolData {
     virStoragePoolObjPtr pool;
     virStorageVolDefPtr vol;
+    virHashTablePtr vols;   /* volumes found so far, by name */
+    bool vginfo;            /* the VG size was reported along the LVs */
 };
 
 static int
@@ -291,8 +296,12 @@ virStorageBackendLogicalMakeVol(char **const groups,
     }
 
     /* Or filling in more data on an existing volume */
-    if (vol == NULL)
-        vol = virStorageVolDefFindByName(pool, groups[0]);
+    if (vol == NULL) {
+        if (data->vols)
+            vol = virHashLookup(data->vols, groups[0]);
+        else
+            vol = virStorageVolDefFindByName(pool, groups[0]);
+    }
 
     /* Or a completely new volume */
     if (vol == NULL) {
@@ -356,9 +365,18 @@ virStorageBackendLogicalMakeVol(char **const groups,
     if (virStorageBackendLogicalParseVolExtents(vol, groups) < 0)
         goto cleanup;
 
-    if (is_new_vol &&
-        VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0)
-        goto cleanup;
+    if (is_new_vol) {
+        if (data->vols &&
+            virHashAddEntry(data->vols, vol->name, vol) < 0)
+            goto cleanup;
+
+        if (virStoragePoolObjAddVol(pool, vol) < 0) {
+            if (data->vols)
+                virHashSteal(data->vols, groups[0]);
+            goto cleanup;
+        }
+        vol = NULL;
+    }
 
     ret = 0;
 
@@ -396,6 +414,188 @@ virStorageBackendLogicalMakeVol(char **const groups,
            VIR_STORAGE_VOL_LOGICAL_LV_ATTR_REGEX \
            VIR_STORAGE_VOL_LOGICAL_SUFFIX_REGEX
 
+static const char *virStorageBackendLogicalLVFields[] = {
+    [VIR_STORAGE_BACKEND_LOGICAL_LV_NAME] = "lv_name",
+    [VIR_STORAGE_BACKEND_LOGICAL_LV_ORIGIN] = "origin",
+    [VIR_STORAGE_BACKEND_LOGICAL_LV_UUID] = "uuid",
+    [VIR_STORAGE_BACKEND_LOGICAL_LV_DEVICES] = "devices",
+    [VIR_STORAGE_BACKEND_LOGICAL_LV_SEGTYPE] = "segtype",
+    [VIR_STORAGE_BACKEND_LOGICAL_LV_STRIPES] = "stripes",
+    [VIR_STORAGE_BACKEND_LOGICAL_LV_SEG_SIZE] = "seg_size",
+    [VIR_STORAGE_BACKEND_LOGICAL_LV_VG_EXTENT_SIZE] = "vg_extent_size",
+    [VIR_STORAGE_BACKEND_LOGICAL_LV_SIZE] = "size",
+    [VIR_STORAGE_BACKEND_LOGICAL_LV_ATTR] = "lv_attr",
+    [VIR_STORAGE_BACKEND_LOGICAL_LV_VG_SIZE] = "vg_size",
+    [VIR_STORAGE_BACKEND_LOGICAL_LV_VG_FREE] = "vg_free",
+};
+verify(ARRAY_CARDINALITY(virStorageBackendLogicalLVFields) ==
+       VIR_STORAGE_BACKEND_LOGICAL_LV_LAST);
+
+
+/*
+ * virStorageBackendLogicalParseLVs:
+ * @output: output of 'lvs --reportformat json'
+ * @func: callback run for each row of the report
+ * @opaque: data for @func
+ *
+ * The report looks like
+ *
+ *   {"report": [{"lv": [{"lv_name": "RootLV", "origin": "", ...}, ...]}]}
+ *
+ * and @func gets the fields of each row in the order listed by
+ * virStorageBackendLogicalLVFields, as writable strings.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virStorageBackendLogicalParseLVs(const char *output,
+                                 virStorageBackendLogicalLVFunc func,
+                                 void *opaque)
+{
+    virJSONValuePtr root = NULL;
+    virJSONValuePtr report;
+    char *groups[VIR_STORAGE_BACKEND_LOGICAL_LV_LAST] = { NULL };
+    size_t i, j, k;
+    int ret = -1;
+
+    if (!(root = virJSONValueFromString(output)))
+        goto cleanup;
+
+    if (!(report = virJSONValueObjectGetArray(root, "report"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("missing report in lvs output"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < virJSONValueArraySize(report); i++) {
+        virJSONValuePtr lvs;
+
+        if (!(lvs = virJSONValueObjectGetArray(virJSONValueArrayGet(report, i),
+                                               "lv")))
+            continue;
+
+        for (j = 0; j < virJSONValueArraySize(lvs); j++) {
+            virJSONValuePtr lv = virJSONValueArrayGet(lvs, j);
+
+            for (k = 0; k < VIR_STORAGE_BACKEND_LOGICAL_LV_LAST; k++) {
+                const char *field = virStorageBackendLogicalLVFields[k];
+                const char *val = virJSONValueObjectGetString(lv, field);
+
+                if (!val) {
+                    virReportError(VIR_ERR_INTERNAL_ERROR,
+                                   _("missing field '%s' in lvs output"),
+                                   field);
+                    goto cleanup;
+                }
+
+                VIR_FREE(groups[k]);
+                if (VIR_STRDUP(groups[k], val) < 0)
+                    goto cleanup;
+            }
+
+            if (func(groups, opaque) < 0)
+                goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (k = 0; k < VIR_STORAGE_BACKEND_LOGICAL_LV_LAST; k++)
+        VIR_FREE(groups[k]);
+    virJSONValueFree(root);
+    return ret;
+}
+
+
+static int
+virStorageBackendLogicalMakeVolJSON(char **const groups,
+                                    void *opaque)
+{
+    struct virStorageBackendLogicalPoolVolData *data = opaque;
+    virStoragePoolDefPtr def = data->pool->def;
+
+    /* Every row carries the size of the VG, so the separate vgs call
+     * isn't needed when there is at least one. When refreshing a single
+     * volume the caller keeps track of the pool size itself. */
+    if (!data->vol && !data->vginfo) {
+        if (virStrToLong_ull(groups[VIR_STORAGE_BACKEND_LOGICAL_LV_VG_SIZE],
+                             NULL, 10, &def->capacity) < 0 ||
+            virStrToLong_ull(groups[VIR_STORAGE_BACKEND_LOGICAL_LV_VG_FREE],
+                             NULL, 10, &def->available) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed volume group size value"));
+            return -1;
+        }
+        def->allocation = def->capacity - def->available;
+        data->vginfo = true;
+    }
+
+    return virStorageBackendLogicalMakeVol(groups, opaque);
+}
+
+
+/* Whether lvs supports --reportformat json, which needs LVM 2.02.158
+ * or later: -1 until the first time it is run, then 0 or 1 */
+static int virStorageBackendLogicalHaveJSON = -1;
+
+/*
+ * Run lvs with JSON output for @target, which is either the VG or
+ * a single LV in it. Returns 0 on success, -1 on error and -2 if lvs
+ * might not support JSON output. */
+static int
+virStorageBackendLogicalFindLVsJSON(const char *target,
+                                    char *fields,
+                                    struct virStorageBackendLogicalPoolVolData *cbdata)
+{
+    virCommandPtr cmd;
+    char *output = NULL;
+    char *errbuf = NULL;
+    int exitstatus;
+    int ret = -1;
+
+    cmd = virCommandNewArgList(LVS,
+                               "--reportformat", "json",
+                               "--units", "b",
+                               "--unbuffered",
+                               "--nosuffix",
+                               "--options", fields,
+                               target,
+                               NULL);
+    virCommandSetOutputBuffer(cmd, &output);
+    virCommandSetErrorBuffer(cmd, &errbuf);
+
+    if (virCommandRun(cmd, &exitstatus) < 0)
+        goto cleanup;
+
+    if (exitstatus != 0) {
+        if (virStorageBackendLogicalHaveJSON < 0) {
+            ret = -2;
+        } else {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("lvs failed with status %d: %s"),
+                           exitstatus, NULLSTR(errbuf));
+        }
+        goto cleanup;
+    }
+    virStorageBackendLogicalHaveJSON = 1;
+
+    ret = virStorageBackendLogicalParseLVs(output,
+                                           virStorageBackendLogicalMakeVolJSON,
+                                           cbdata);
+
+ cleanup:
+    VIR_FREE(output);
+    VIR_FREE(errbuf);
+    virCommandFree(cmd);
+    return ret;
+}
+
+
+/*
+ * Find all the LVs of @pool, or only @vol if given. Returns 1 if the
+ * size of the VG was filled in along, 0 if not, -1 on error.
+ */
 static int
 virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
                                 virStorageVolDefPtr vol)
@@ -424,6 +624,9 @@ virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
      *
      * NB "devices" field has multiple device paths and "," if the volume is
      *    striped, so "," is not a suitable separator either (rhbz 727474).
+     *
+     * Newer LVM can report the same fields as JSON, which avoids all the
+     * above, and also give the size of the VG in the same run.
      */
     const char *regexes[] = {
         VIR_STORAGE_VOL_LOGICAL_REGEX
@@ -432,12 +635,49 @@ virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
         VIR_STORAGE_VOL_LOGICAL_REGEX_COUNT
     };
     int ret = -1;
-    virCommandPtr cmd;
+    int rc;
+    size_t i;
+    virCommandPtr cmd = NULL;
+    char *target = NULL;
+    char *fields = NULL;
     struct virStorageBackendLogicalPoolVolData cbdata = {
         .pool = pool,
         .vol = vol,
     };
 
+    /* Only ask about the LV we're interested in */
+    if (vol) {
+        if (virAsprintf(&target, "%s/%s",
+                        pool->def->source.name, vol->name) < 0)
+            goto cleanup;
+    } else {
+        if (VIR_STRDUP(target, pool->def->source.name) < 0)
+            goto cleanup;
+
+        if (!(cbdata.vols = virHashCreate(MAX(pool->volumes.count, 32), NULL)))
+            goto cleanup;
+        for (i = 0; i < pool->volumes.count; i++) {
+            if (virHashAddEntry(cbdata.vols, pool->volumes.objs[i]->name,
+                                pool->volumes.objs[i]) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (virStorageBackendLogicalHaveJSON != 0) {
+        if (!(fields = virStringListJoin(virStorageBackendLogicalLVFields,
+                                         ",")))
+            goto cleanup;
+
+        rc = virStorageBackendLogicalFindLVsJSON(target, fields, &cbdata);
+        if (rc == 0) {
+            ret = cbdata.vginfo ? 1 : 0;
+            goto cleanup;
+        }
+        if (rc == -1)
+            goto cleanup;
+        /* Fall back to the plain output below */
+    }
+
     cmd = virCommandNewArgList(LVS,
                                "--separator", "#",
                                "--noheadings",
@@ -446,7 +686,7 @@ virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
                                "--nosuffix",
                                "--options",
                                "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,lv_attr",
-                               pool->def->source.name,
+                               target,
                                NULL);
     if (virCommandRunRegex(cmd,
                            1,
@@ -458,8 +698,16 @@ virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
                            NULL) < 0)
         goto cleanup;
 
+    if (virStorageBackendLogicalHaveJSON < 0) {
+        VIR_DEBUG("lvs doesn't support JSON output");
+        virStorageBackendLogicalHaveJSON = 0;
+    }
+
     ret = 0;
  cleanup:
+    virHashFree(cbdata.vols);
+    VIR_FREE(target);
+    VIR_FREE(fields);
     virCommandFree(cmd);
     return ret;
 }
@@ -808,13 +1056,20 @@ virStorageBackendLogicalRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
     };
     virCommandPtr cmd = NULL;
     int ret = -1;
+    int rc;
 
     virWaitForDevices();
 
     /* Get list of all logical volumes */
-    if (virStorageBackendLogicalFindLVs(pool, NULL) < 0)
+    if ((rc = virStorageBackendLogicalFindLVs(pool, NULL)) < 0)
         goto cleanup;
 
+    /* The VG size came along with the volumes */
+    if (rc > 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
     cmd = virCommandNewArgList(VGS,
                                "--separator", ":",
                                "--noheadings",
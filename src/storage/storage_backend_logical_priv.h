@@ -0,0 +1,50 @@
+/*
+ * storage_backend_logical_priv.h: header for functions necessary in tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_STORAGE_BACKEND_LOGICAL_PRIV_H__
+# define __VIR_STORAGE_BACKEND_LOGICAL_PRIV_H__
+
+# include "internal.h"
+
+/* Fields of each row reported by lvs, in the order they are
+ * passed to virStorageBackendLogicalLVFunc */
+enum {
+    VIR_STORAGE_BACKEND_LOGICAL_LV_NAME,
+    VIR_STORAGE_BACKEND_LOGICAL_LV_ORIGIN,
+    VIR_STORAGE_BACKEND_LOGICAL_LV_UUID,
+    VIR_STORAGE_BACKEND_LOGICAL_LV_DEVICES,
+    VIR_STORAGE_BACKEND_LOGICAL_LV_SEGTYPE,
+    VIR_STORAGE_BACKEND_LOGICAL_LV_STRIPES,
+    VIR_STORAGE_BACKEND_LOGICAL_LV_SEG_SIZE,
+    VIR_STORAGE_BACKEND_LOGICAL_LV_VG_EXTENT_SIZE,
+    VIR_STORAGE_BACKEND_LOGICAL_LV_SIZE,
+    VIR_STORAGE_BACKEND_LOGICAL_LV_ATTR,
+    VIR_STORAGE_BACKEND_LOGICAL_LV_VG_SIZE,
+    VIR_STORAGE_BACKEND_LOGICAL_LV_VG_FREE,
+
+    VIR_STORAGE_BACKEND_LOGICAL_LV_LAST
+};
+
+typedef int (*virStorageBackendLogicalLVFunc)(char **const groups,
+                                              void *opaque);
+
+int virStorageBackendLogicalParseLVs(const char *output,
+                                     virStorageBackendLogicalLVFunc func,
+                                     void *opaque);
+
+#endif /* __VIR_STORAGE_BACKEND_LOGICAL_PRIV_H__ */
@@ -29,7 +29,9 @@
 #include "storage_backend_rbd.h"
 #include "storage_conf.h"
 #include "viralloc.h"
+#include "virhash.h"
 #include "virlog.h"
+#include "virthread.h"
 #include "base64.h"
 #include "viruuid.h"
 #include "virstring.h"
@@ -43,15 +45,35 @@
 
 VIR_LOG_INIT("storage.storage_backend_rbd");
 
+/* How long an unused connection is kept open */
+#define VIR_STORAGE_BACKEND_RBD_IDLE_TIMEOUT 300
+
+/* How long a connection may be unused before it is checked again
+ * with a round trip to the monitors when it's picked up */
+#define VIR_STORAGE_BACKEND_RBD_CHECK_INTERVAL 30
+
+/* How many images are looked at in parallel when refreshing a pool */
+#define VIR_STORAGE_BACKEND_RBD_REFRESH_WORKERS 8
+
 struct _virStorageBackendRBDState {
     rados_t cluster;
     rados_ioctx_t ioctx;
     time_t starttime;
+
+    /* Protected by virStorageBackendRBDStatesLock */
+    size_t users;
+    time_t lastused;
+    bool cached;
 };
 
 typedef struct _virStorageBackendRBDState virStorageBackendRBDState;
 typedef virStorageBackendRBDState *virStorageBackendRBDStatePtr;
 
+/* The connections of the running pools, by pool UUID. Each is shared by
+ * all operations on its pool, as librados handles are thread safe. */
+static virMutex virStorageBackendRBDStatesLock;
+static virHashTablePtr virStorageBackendRBDStates;
+
 static int
 virStorageBackendRBDRADOSConfSet(rados_t cluster,
                                  const char *option,
@@ -273,6 +295,157 @@ virStorageBackendRBDNewState(virConnectPtr conn,
 }
 
 
+/* Called with virStorageBackendRBDStatesLock held when a connection is
+ * dropped from the cache; it is closed once its last user is done */
+static void
+virStorageBackendRBDStatesEntryFree(void *payload,
+                                    const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageBackendRBDStatePtr ptr = payload;
+
+    ptr->cached = false;
+    if (ptr->users == 0)
+        virStorageBackendRBDFreeState(&ptr);
+}
+
+
+static int
+virStorageBackendRBDStatesOnceInit(void)
+{
+    if (virMutexInit(&virStorageBackendRBDStatesLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to init RADOS connection cache mutex"));
+        return -1;
+    }
+
+    if (!(virStorageBackendRBDStates =
+          virHashCreate(8, virStorageBackendRBDStatesEntryFree)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virStorageBackendRBDStates)
+
+
+static int
+virStorageBackendRBDStateIsIdle(const void *payload,
+                                const void *name ATTRIBUTE_UNUSED,
+                                const void *opaque)
+{
+    const virStorageBackendRBDState *ptr = payload;
+    const time_t *now = opaque;
+
+    return ptr->users == 0 &&
+        *now - ptr->lastused >= VIR_STORAGE_BACKEND_RBD_IDLE_TIMEOUT;
+}
+
+
+/* Drop @ptr from the cache, unless it was already replaced */
+static void
+virStorageBackendRBDStateUncache(virStorageBackendRBDStatePtr ptr,
+                                 const char *uuidstr)
+{
+    virMutexLock(&virStorageBackendRBDStatesLock);
+    if (virHashLookup(virStorageBackendRBDStates, uuidstr) == ptr)
+        virHashRemoveEntry(virStorageBackendRBDStates, uuidstr);
+    virMutexUnlock(&virStorageBackendRBDStatesLock);
+}
+
+
+static void
+virStorageBackendRBDReleaseState(virStorageBackendRBDStatePtr *ptr)
+{
+    bool unused;
+
+    if (!*ptr)
+        return;
+
+    virMutexLock(&virStorageBackendRBDStatesLock);
+    (*ptr)->users--;
+    (*ptr)->lastused = time(NULL);
+    unused = !(*ptr)->cached && (*ptr)->users == 0;
+    virMutexUnlock(&virStorageBackendRBDStatesLock);
+
+    if (unused)
+        virStorageBackendRBDFreeState(ptr);
+    *ptr = NULL;
+}
+
+
+/**
+ * virStorageBackendRBDAcquireState:
+ * @conn: connection used to look up the cephx secret
+ * @pool: the pool
+ *
+ * Get the RADOS connection for @pool, reusing the one from the previous
+ * operation if it's still there and working. Connections which haven't
+ * been used for a while are closed on the way. The result has to be
+ * given back with virStorageBackendRBDReleaseState.
+ *
+ * Returns the connection, or NULL on error.
+ */
+static virStorageBackendRBDStatePtr
+virStorageBackendRBDAcquireState(virConnectPtr conn,
+                                 virStoragePoolObjPtr pool)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    virStorageBackendRBDStatePtr ptr;
+    struct rados_cluster_stat_t clusterstat;
+    time_t now = time(NULL);
+    bool check = false;
+    int r;
+
+    if (virStorageBackendRBDStatesInitialize() < 0)
+        return NULL;
+
+    virUUIDFormat(pool->def->uuid, uuidstr);
+
+    virMutexLock(&virStorageBackendRBDStatesLock);
+    virHashRemoveSet(virStorageBackendRBDStates,
+                     virStorageBackendRBDStateIsIdle, &now);
+    if ((ptr = virHashLookup(virStorageBackendRBDStates, uuidstr))) {
+        check = now - ptr->lastused >= VIR_STORAGE_BACKEND_RBD_CHECK_INTERVAL;
+        ptr->users++;
+        ptr->lastused = now;
+    }
+    virMutexUnlock(&virStorageBackendRBDStatesLock);
+
+    if (ptr) {
+        if (!check)
+            return ptr;
+
+        if ((r = rados_cluster_stat(ptr->cluster, &clusterstat)) == 0)
+            return ptr;
+
+        VIR_DEBUG("Dropping broken RADOS connection for pool %s: %d",
+                  pool->def->name, r);
+        virStorageBackendRBDStateUncache(ptr, uuidstr);
+        virStorageBackendRBDReleaseState(&ptr);
+    }
+
+    /* Connecting takes a while, don't block the other pools meanwhile */
+    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+        return NULL;
+
+    ptr->users = 1;
+    ptr->lastused = now;
+
+    /* If another operation connected in the meantime, use ours just
+     * once and keep theirs. Failing to cache it isn't fatal either. */
+    virMutexLock(&virStorageBackendRBDStatesLock);
+    if (!virHashLookup(virStorageBackendRBDStates, uuidstr)) {
+        if (virHashAddEntry(virStorageBackendRBDStates, uuidstr, ptr) < 0)
+            virResetLastError();
+        else
+            ptr->cached = true;
+    }
+    virMutexUnlock(&virStorageBackendRBDStatesLock);
+
+    return ptr;
+}
+
+
 static int
 volStorageBackendRBDGetFeatures(rbd_image_t image,
                                 const char *volname,
@@ -353,8 +526,16 @@ virStorageBackendRBDSetAllocation(virStorageVolDefPtr vol ATTRIBUTE_UNUSED,
 }
 #endif
 
+/*
+ * Fill in the details of @vol. If @old is the definition found by an
+ * earlier refresh of the pool, its allocation is reused if still fresh.
+ *
+ * Returns 0 on success, the negative librbd error code if the image
+ * couldn't be opened or queried, -1 on other errors.
+ */
 static int
 volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
+                                   const virStorageVolDef *old,
                                    virStoragePoolObjPtr pool,
                                    virStorageBackendRBDStatePtr ptr)
 {
@@ -363,16 +544,17 @@ volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
     rbd_image_t image = NULL;
     rbd_image_info_t info;
     uint64_t features;
+    time_t now;
 
     if ((r = rbd_open_read_only(ptr->ioctx, vol->name, &image, NULL)) < 0) {
-        ret = -r;
+        ret = r;
         virReportSystemError(-r, _("failed to open the RBD image '%s'"),
                              vol->name);
         goto cleanup;
     }
 
     if ((r = rbd_stat(image, &info, sizeof(info))) < 0) {
-        ret = -r;
+        ret = r;
         virReportSystemError(-r, _("failed to stat the RBD image '%s'"),
                              vol->name);
         goto cleanup;
@@ -386,12 +568,25 @@ volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
     vol->target.format = VIR_STORAGE_FILE_RAW;
 
     if (volStorageBackendRBDUseFastDiff(features)) {
-        VIR_DEBUG("RBD image %s/%s has fast-diff feature enabled. "
-                  "Querying for actual allocation",
-                  pool->def->source.name, vol->name);
+        now = time(NULL);
+
+        if (old && old->allocationTime &&
+            old->target.capacity == vol->target.capacity &&
+            now - old->allocationTime < pool->def->allocationMaxAge) {
+            VIR_DEBUG("Reusing allocation of RBD image %s/%s computed "
+                      "%lld seconds ago", pool->def->source.name, vol->name,
+                      (long long) (now - old->allocationTime));
+            vol->target.allocation = old->target.allocation;
+            vol->allocationTime = old->allocationTime;
+        } else {
+            VIR_DEBUG("RBD image %s/%s has fast-diff feature enabled. "
+                      "Querying for actual allocation",
+                      pool->def->source.name, vol->name);
 
-        if (virStorageBackendRBDSetAllocation(vol, image, &info) < 0)
-            goto cleanup;
+            if (virStorageBackendRBDSetAllocation(vol, image, &info) < 0)
+                goto cleanup;
+            vol->allocationTime = now;
+        }
     } else {
         vol->target.allocation = info.obj_size * info.num_objs;
     }
@@ -421,6 +616,64 @@ volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
     return ret;
 }
 
+struct virStorageBackendRBDRefreshData {
+    virMutex lock;
+    virStoragePoolObjPtr pool;
+    virStorageBackendRBDStatePtr ptr;
+    virHashTablePtr old;            /* volumes of the previous refresh */
+
+    virStorageVolDefPtr *vols;
+    int *results;
+    size_t nvols;
+    size_t next;                    /* first image nobody picked yet */
+    virErrorPtr error;              /* first error hit by a worker */
+};
+
+
+static void
+virStorageBackendRBDRefreshWorker(void *opaque)
+{
+    struct virStorageBackendRBDRefreshData *data = opaque;
+    virStorageVolDefPtr vol;
+    size_t i;
+    int r;
+
+    while (true) {
+        virMutexLock(&data->lock);
+        if (data->error || data->next >= data->nvols) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+        i = data->next++;
+        virMutexUnlock(&data->lock);
+
+        vol = data->vols[i];
+        r = volStorageBackendRBDRefreshVolInfo(vol,
+                                               virHashLookup(data->old,
+                                                             vol->name),
+                                               data->pool, data->ptr);
+
+        /* It could be that a volume has been deleted through a different route
+         * then libvirt and that will cause a -ENOENT to be returned.
+         *
+         * Another possibility is that there is something wrong with the placement
+         * group (PG) that RBD image's header is in and that causes -ETIMEDOUT
+         * to be returned.
+         *
+         * Do not error out and simply ignore the volume
+         */
+        if (r == -ENOENT || r == -ETIMEDOUT)
+            virResetLastError();
+
+        virMutexLock(&data->lock);
+        data->results[i] = r;
+        if (r < 0 && r != -ENOENT && r != -ETIMEDOUT && !data->error)
+            data->error = virSaveLastError();
+        virMutexUnlock(&data->lock);
+    }
+}
+
+
 static int
 virStorageBackendRBDRefreshPool(virConnectPtr conn,
                                 virStoragePoolObjPtr pool)
@@ -433,9 +686,19 @@ virStorageBackendRBDRefreshPool(virConnectPtr conn,
     virStorageBackendRBDStatePtr ptr = NULL;
     struct rados_cluster_stat_t clusterstat;
     struct rados_pool_stat_t poolstat;
+    struct virStorageBackendRBDRefreshData data = { .pool = pool };
+    virThread workers[VIR_STORAGE_BACKEND_RBD_REFRESH_WORKERS - 1];
+    size_t nworkers = 0;
+    size_t i;
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (virMutexInit(&data.lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        return -1;
+    }
+
+    if (!(ptr = virStorageBackendRBDAcquireState(conn, pool)))
         goto cleanup;
+    data.ptr = ptr;
 
     if ((r = rados_cluster_stat(ptr->cluster, &clusterstat)) < 0) {
         virReportSystemError(-r, "%s", _("failed to stat the RADOS cluster"));
@@ -480,37 +743,62 @@ virStorageBackendRBDRefreshPool(virConnectPtr conn,
         if (VIR_ALLOC(vol) < 0)
             goto cleanup;
 
-        if (VIR_STRDUP(vol->name, name) < 0) {
-            VIR_FREE(vol);
+        if (VIR_STRDUP(vol->name, name) < 0 ||
+            VIR_APPEND_ELEMENT(data.vols, data.nvols, vol) < 0) {
+            virStorageVolDefFree(vol);
             goto cleanup;
         }
 
         name += strlen(name) + 1;
+    }
 
-        r = volStorageBackendRBDRefreshVolInfo(vol, pool, ptr);
+    /* Allocations computed by the previous refresh may be reused */
+    if (!(data.old = virHashCreate(MAX(pool->staleVolumes.count, 1), NULL)))
+        goto cleanup;
+    if (pool->def->allocationMaxAge) {
+        for (i = 0; i < pool->staleVolumes.count; i++) {
+            if (virHashAddEntry(data.old, pool->staleVolumes.objs[i]->name,
+                                pool->staleVolumes.objs[i]) < 0)
+                goto cleanup;
+        }
+    }
 
-        /* It could be that a volume has been deleted through a different route
-         * then libvirt and that will cause a -ENOENT to be returned.
-         *
-         * Another possibility is that there is something wrong with the placement
-         * group (PG) that RBD image's header is in and that causes -ETIMEDOUT
-         * to be returned.
-         *
-         * Do not error out and simply ignore the volume
-         */
-        if (r < 0) {
-            if (r == -ENOENT || r == -ETIMEDOUT)
-                continue;
+    if (VIR_ALLOC_N(data.results, data.nvols) < 0)
+        goto cleanup;
 
-            virStorageVolDefFree(vol);
-            goto cleanup;
+    /* librbd has no asynchronous variant of rbd_diff_iterate2, so have
+     * a few threads query the images, this one included */
+    while (nworkers < ARRAY_CARDINALITY(workers) &&
+           nworkers + 1 < data.nvols) {
+        if (virThreadCreate(&workers[nworkers], true,
+                            virStorageBackendRBDRefreshWorker, &data) < 0) {
+            VIR_WARN("Failed to start RBD refresh worker: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
+            break;
         }
+        nworkers++;
+    }
 
-        if (VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0) {
-            virStorageVolDefFree(vol);
+    virStorageBackendRBDRefreshWorker(&data);
+
+    for (i = 0; i < nworkers; i++)
+        virThreadJoin(&workers[i]);
+
+    if (data.error) {
+        virSetError(data.error);
+        goto cleanup;
+    }
+
+    for (i = 0; i < data.nvols; i++) {
+        if (data.results[i] < 0)
+            continue;
+
+        if (virStoragePoolObjAddVol(pool, data.vols[i]) < 0) {
             virStoragePoolObjClearVols(pool);
             goto cleanup;
         }
+        data.vols[i] = NULL;
     }
 
     VIR_DEBUG("Found %zu images in RBD pool %s",
@@ -519,8 +807,15 @@ virStorageBackendRBDRefreshPool(virConnectPtr conn,
     ret = 0;
 
  cleanup:
+    for (i = 0; i < data.nvols; i++)
+        virStorageVolDefFree(data.vols[i]);
+    VIR_FREE(data.vols);
+    VIR_FREE(data.results);
+    virHashFree(data.old);
+    virFreeError(data.error);
+    virMutexDestroy(&data.lock);
     VIR_FREE(names);
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDReleaseState(&ptr);
     return ret;
 }
 
@@ -620,7 +915,7 @@ virStorageBackendRBDDeleteVol(virConnectPtr conn,
     if (flags & VIR_STORAGE_VOL_DELETE_ZEROED)
         VIR_WARN("%s", "This storage backend does not support zeroed removal of volumes");
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDAcquireState(conn, pool)))
         goto cleanup;
 
     if (flags & VIR_STORAGE_VOL_DELETE_WITH_SNAPSHOTS) {
@@ -641,7 +936,7 @@ virStorageBackendRBDDeleteVol(virConnectPtr conn,
     ret = 0;
 
  cleanup:
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDReleaseState(&ptr);
     return ret;
 }
 
@@ -715,7 +1010,7 @@ virStorageBackendRBDBuildVol(virConnectPtr conn,
         goto cleanup;
     }
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDAcquireState(conn, pool)))
         goto cleanup;
 
     if ((r = virStorageBackendRBDCreateImage(ptr->ioctx, vol->name,
@@ -729,7 +1024,7 @@ virStorageBackendRBDBuildVol(virConnectPtr conn,
     ret = 0;
 
  cleanup:
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDReleaseState(&ptr);
     return ret;
 }
 
@@ -1053,7 +1348,7 @@ virStorageBackendRBDBuildVolFrom(virConnectPtr conn,
 
     virCheckFlags(0, -1);
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDAcquireState(conn, pool)))
         goto cleanup;
 
     if ((virStorageBackendRBDCloneImage(ptr->ioctx, origvol->name,
@@ -1063,7 +1358,7 @@ virStorageBackendRBDBuildVolFrom(virConnectPtr conn,
     ret = 0;
 
  cleanup:
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDReleaseState(&ptr);
     return ret;
 }
 
@@ -1075,16 +1370,16 @@ virStorageBackendRBDRefreshVol(virConnectPtr conn,
     virStorageBackendRBDStatePtr ptr = NULL;
     int ret = -1;
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDAcquireState(conn, pool)))
         goto cleanup;
 
-    if (volStorageBackendRBDRefreshVolInfo(vol, pool, ptr) < 0)
+    if (volStorageBackendRBDRefreshVolInfo(vol, NULL, pool, ptr) < 0)
         goto cleanup;
 
     ret = 0;
 
  cleanup:
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDReleaseState(&ptr);
     return ret;
 }
 
@@ -1102,7 +1397,7 @@ virStorageBackendRBDResizeVol(virConnectPtr conn ATTRIBUTE_UNUSED,
 
     virCheckFlags(0, -1);
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDAcquireState(conn, pool)))
         goto cleanup;
 
     if ((r = rbd_open(ptr->ioctx, vol->name, &image, NULL)) < 0) {
@@ -1122,7 +1417,7 @@ virStorageBackendRBDResizeVol(virConnectPtr conn ATTRIBUTE_UNUSED,
  cleanup:
     if (image != NULL)
        rbd_close(image);
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDReleaseState(&ptr);
     return ret;
 }
 
@@ -1218,7 +1513,7 @@ virStorageBackendRBDVolWipe(virConnectPtr conn,
 
     VIR_DEBUG("Wiping RBD image %s/%s", pool->def->source.name, vol->name);
 
-    if (!(ptr = virStorageBackendRBDNewState(conn, pool)))
+    if (!(ptr = virStorageBackendRBDAcquireState(conn, pool)))
         goto cleanup;
 
     if ((r = rbd_open(ptr->ioctx, vol->name, &image, NULL)) < 0) {
@@ -1277,15 +1572,35 @@ virStorageBackendRBDVolWipe(virConnectPtr conn,
     if (image)
         rbd_close(image);
 
-    virStorageBackendRBDFreeState(&ptr);
+    virStorageBackendRBDReleaseState(&ptr);
 
     return ret;
 }
 
+static int
+virStorageBackendRBDStopPool(virConnectPtr conn ATTRIBUTE_UNUSED,
+                             virStoragePoolObjPtr pool)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    if (virStorageBackendRBDStatesInitialize() < 0)
+        return -1;
+
+    /* The pool's definition may change before it's started again */
+    virUUIDFormat(pool->def->uuid, uuidstr);
+    virMutexLock(&virStorageBackendRBDStatesLock);
+    virHashRemoveEntry(virStorageBackendRBDStates, uuidstr);
+    virMutexUnlock(&virStorageBackendRBDStatesLock);
+
+    return 0;
+}
+
+
 virStorageBackend virStorageBackendRBD = {
     .type = VIR_STORAGE_POOL_RBD,
 
     .refreshPool = virStorageBackendRBDRefreshPool,
+    .stopPool = virStorageBackendRBDStopPool,
     .createVol = virStorageBackendRBDCreateVol,
     .buildVol = virStorageBackendRBDBuildVol,
     .buildVolFrom = virStorageBackendRBDBuildVolFrom,
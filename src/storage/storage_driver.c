@@ -33,6 +33,9 @@
 #if HAVE_PWD_H
 # include <pwd.h>
 #endif
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
 #include <errno.h>
 #include <string.h>
 
@@ -52,11 +55,18 @@
 #include "viraccessapicheck.h"
 #include "dirname.h"
 #include "storage_util.h"
+#include "stat-time.h"
+#include "virtime.h"
+#include "virevent.h"
+#include "virthreadpool.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
 VIR_LOG_INIT("storage.storage_driver");
 
+/* Upper limit of pools started or refreshed concurrently */
+#define STORAGE_DRIVER_STARTUP_MAX_WORKERS 8
+
 static virStorageDriverStatePtr driver;
 
 static int storageStateCleanup(void);
@@ -78,6 +88,219 @@ static void storageDriverUnlock(void)
 }
 
 
+#if HAVE_SYS_INOTIFY_H
+typedef struct _virStoragePoolWatchData virStoragePoolWatchData;
+typedef virStoragePoolWatchData *virStoragePoolWatchDataPtr;
+struct _virStoragePoolWatchData {
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    int fd;
+};
+
+
+static void
+storagePoolWatchDataFree(void *opaque)
+{
+    virStoragePoolWatchDataPtr data = opaque;
+
+    VIR_FORCE_CLOSE(data->fd);
+    VIR_FREE(data);
+}
+
+
+static void
+storagePoolWatchStop(virStoragePoolObjPtr pool)
+{
+    if (pool->watch < 0)
+        return;
+
+    virEventRemoveHandle(pool->watch);
+    pool->watch = -1;
+}
+
+
+/* Rescan the whole pool, after the kernel dropped some of its events */
+static void
+storagePoolWatchRescan(virStoragePoolObjPtr pool)
+{
+    virStorageBackendPtr backend;
+
+    if (pool->asyncjobs > 0) {
+        VIR_WARN("Missed changes to storage pool '%s' while it has "
+                 "asynchronous jobs running, refresh it later",
+                 pool->def->name);
+        return;
+    }
+
+    if (!(backend = virStorageBackendForType(pool->def->type)))
+        return;
+
+    virStoragePoolObjStashVols(pool);
+    if (backend->refreshPool(NULL, pool) < 0)
+        VIR_WARN("Failed to refresh storage pool '%s': %s",
+                 pool->def->name, virGetLastErrorMessage());
+    virStoragePoolObjClearStaleVols(pool);
+}
+
+
+static void
+storagePoolWatchEvent(int watch,
+                      int fd,
+                      int events ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    virStoragePoolWatchDataPtr data = opaque;
+    virStoragePoolObjPtr pool;
+    virObjectEventPtr event = NULL;
+    char buf[4096];
+    struct inotify_event e;
+    bool changed = false;
+    bool rescan = false;
+    ssize_t got;
+
+    storageDriverLock();
+    pool = virStoragePoolObjFindByUUID(&driver->pools, data->uuid);
+    storageDriverUnlock();
+
+    if (!pool)
+        return;
+
+    if (pool->watch != watch || !virStoragePoolObjIsActive(pool))
+        goto cleanup;
+
+    while ((got = read(fd, buf, sizeof(buf))) != 0) {
+        char *tmp = buf;
+
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                VIR_WARN("Failed to read inotify events of storage pool '%s'",
+                         pool->def->name);
+            break;
+        }
+
+        while (got >= sizeof(e)) {
+            char *name;
+
+            memcpy(&e, tmp, sizeof(e));
+            if (got < sizeof(e) + e.len)
+                break;
+            name = tmp + sizeof(e);
+            tmp += sizeof(e) + e.len;
+            got -= sizeof(e) + e.len;
+
+            if (e.mask & IN_Q_OVERFLOW) {
+                rescan = true;
+            } else if (e.mask & (IN_DELETE_SELF | IN_MOVE_SELF |
+                                 IN_UNMOUNT | IN_IGNORED)) {
+                VIR_WARN("Target of storage pool '%s' went away, "
+                         "no longer watching it", pool->def->name);
+                storagePoolWatchStop(pool);
+                goto cleanup;
+            } else if (e.len && name[0] && !rescan) {
+                int rc;
+
+                if ((rc = virStorageBackendRefreshLocalFile(pool, name)) < 0) {
+                    VIR_WARN("Failed to refresh '%s' in storage pool '%s': %s",
+                             name, pool->def->name, virGetLastErrorMessage());
+                    rescan = true;
+                } else if (rc > 0) {
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    if (rescan) {
+        storagePoolWatchRescan(pool);
+        changed = true;
+    }
+
+    if (changed)
+        event = virStoragePoolEventRefreshNew(pool->def->name,
+                                              pool->def->uuid);
+
+ cleanup:
+    virStoragePoolObjUnlock(pool);
+    if (event)
+        virObjectEventStateQueue(driver->storageEventState, event);
+}
+
+
+/**
+ * storagePoolWatchStart:
+ * @pool: the active pool object
+ *
+ * Follow changes to the files of @pool with inotify if the pool asks
+ * for it, so that its volume list stays current between refreshes.
+ *
+ * Returns 0 on success, -1 on error
+ */
+static int
+storagePoolWatchStart(virStoragePoolObjPtr pool)
+{
+    virStoragePoolWatchDataPtr data = NULL;
+
+    if (pool->def->refreshMode != VIR_STORAGE_POOL_REFRESH_WATCH ||
+        pool->watch >= 0)
+        return 0;
+
+    if (VIR_ALLOC(data) < 0)
+        return -1;
+    memcpy(data->uuid, pool->def->uuid, VIR_UUID_BUFLEN);
+
+    if ((data->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize inotify"));
+        goto error;
+    }
+
+    if (inotify_add_watch(data->fd, pool->def->target.path,
+                          IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                          IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB |
+                          IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR) < 0) {
+        virReportSystemError(errno,
+                             _("cannot watch storage pool target '%s'"),
+                             pool->def->target.path);
+        goto error;
+    }
+
+    if ((pool->watch = virEventAddHandle(data->fd, VIR_EVENT_HANDLE_READABLE,
+                                         storagePoolWatchEvent, data,
+                                         storagePoolWatchDataFree)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot register inotify watch for storage pool '%s'"),
+                       pool->def->name);
+        goto error;
+    }
+
+    return 0;
+
+ error:
+    storagePoolWatchDataFree(data);
+    return -1;
+}
+
+#else /* !HAVE_SYS_INOTIFY_H */
+
+static void
+storagePoolWatchStop(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED)
+{
+}
+
+
+static int
+storagePoolWatchStart(virStoragePoolObjPtr pool)
+{
+    if (pool->def->refreshMode != VIR_STORAGE_POOL_REFRESH_WATCH)
+        return 0;
+
+    virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                   _("watching storage pools is not supported on this platform"));
+    return -1;
+}
+#endif /* !HAVE_SYS_INOTIFY_H */
+
+
 /**
  * virStoragePoolUpdateInactive:
  * @poolptr: pointer to a variable holding the pool object pointer
@@ -135,7 +358,8 @@ storagePoolUpdateState(virStoragePoolObjPtr pool)
      */
     if (active) {
         virStoragePoolObjClearVols(pool);
-        if (backend->refreshPool(NULL, pool) < 0) {
+        if (backend->refreshPool(NULL, pool) < 0 ||
+            storagePoolWatchStart(pool) < 0) {
             if (backend->stopPool)
                 backend->stopPool(NULL, pool);
             virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -147,9 +371,6 @@ storagePoolUpdateState(virStoragePoolObjPtr pool)
 
     pool->active = active;
 
-    if (!pool->active)
-        virStoragePoolUpdateInactive(&pool);
-
  cleanup:
     if (!active && stateFile)
         ignore_value(unlink(stateFile));
@@ -158,82 +379,139 @@ storagePoolUpdateState(virStoragePoolObjPtr pool)
     return;
 }
 
+static void
+storagePoolUpdateStateOne(size_t idx,
+                          void *opaque)
+{
+    virStoragePoolObjPtr *pools = opaque;
+    virStoragePoolObjPtr pool = pools[idx];
+
+    virStoragePoolObjLock(pool);
+    storagePoolUpdateState(pool);
+    virStoragePoolObjUnlock(pool);
+}
+
+
+/* Must be called with the driver lock held, which keeps the pool list
+ * stable while the pools are checked and refreshed in parallel */
 static void
 storagePoolUpdateAllState(void)
 {
     size_t i;
 
-    for (i = 0; i < driver->pools.count; i++) {
-        virStoragePoolObjPtr pool = driver->pools.objs[i];
+    virThreadPoolParallelFor(driver->pools.count,
+                             STORAGE_DRIVER_STARTUP_MAX_WORKERS,
+                             storagePoolUpdateStateOne,
+                             driver->pools.objs);
+
+    /* Dropping inactive transient pools modifies the list, so do it
+     * from this thread only, walking backwards over the removals */
+    for (i = driver->pools.count; i > 0; i--) {
+        virStoragePoolObjPtr pool = driver->pools.objs[i - 1];
 
         virStoragePoolObjLock(pool);
-        storagePoolUpdateState(pool);
-        virStoragePoolObjUnlock(pool);
+        if (!virStoragePoolObjIsActive(pool))
+            virStoragePoolUpdateInactive(&pool);
+        if (pool)
+            virStoragePoolObjUnlock(pool);
+    }
+}
+
+
+typedef struct _virStoragePoolAutostartData virStoragePoolAutostartData;
+typedef virStoragePoolAutostartData *virStoragePoolAutostartDataPtr;
+struct _virStoragePoolAutostartData {
+    virConnectPtr conn;
+    virStoragePoolObjPtr *pools;
+};
+
+
+static void
+storagePoolAutostartOne(size_t idx,
+                        void *opaque)
+{
+    virStoragePoolAutostartDataPtr data = opaque;
+    virStoragePoolObjPtr pool = data->pools[idx];
+    virConnectPtr conn = data->conn;
+    virStorageBackendPtr backend;
+    char *stateFile = NULL;
+
+    virStoragePoolObjLock(pool);
+    if (!pool->autostart ||
+        virStoragePoolObjIsActive(pool) ||
+        !(backend = virStorageBackendForType(pool->def->type)))
+        goto cleanup;
+
+    if (backend->startPool &&
+        backend->startPool(conn, pool) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to autostart storage pool '%s': %s"),
+                       pool->def->name, virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    virStoragePoolObjClearVols(pool);
+    stateFile = virFileBuildPath(driver->stateDir,
+                                 pool->def->name, ".xml");
+    if (!stateFile ||
+        virStoragePoolSaveState(stateFile, pool->def) < 0 ||
+        backend->refreshPool(conn, pool) < 0 ||
+        storagePoolWatchStart(pool) < 0) {
+        if (stateFile)
+            unlink(stateFile);
+        if (backend->stopPool)
+            backend->stopPool(conn, pool);
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to autostart storage pool '%s': %s"),
+                       pool->def->name, virGetLastErrorMessage());
+    } else {
+        pool->active = true;
     }
+
+ cleanup:
+    VIR_FREE(stateFile);
+    virStoragePoolObjUnlock(pool);
 }
 
+
+/* Must be called with the driver lock held, see storagePoolUpdateAllState */
 static void
 storageDriverAutostart(void)
 {
+    virStoragePoolAutostartData data = { NULL, NULL };
+    size_t npools = 0;
     size_t i;
-    virConnectPtr conn = NULL;
-
-    /* XXX Remove hardcoding of QEMU URI */
-    if (driver->privileged)
-        conn = virConnectOpen("qemu:///system");
-    else
-        conn = virConnectOpen("qemu:///session");
-    /* Ignoring NULL conn - let backends decide */
 
     for (i = 0; i < driver->pools.count; i++) {
         virStoragePoolObjPtr pool = driver->pools.objs[i];
-        virStorageBackendPtr backend;
-        bool started = false;
+        bool wanted;
 
         virStoragePoolObjLock(pool);
-        if ((backend = virStorageBackendForType(pool->def->type)) == NULL) {
-            virStoragePoolObjUnlock(pool);
-            continue;
-        }
-
-        if (pool->autostart &&
-            !virStoragePoolObjIsActive(pool)) {
-            if (backend->startPool &&
-                backend->startPool(conn, pool) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Failed to autostart storage pool '%s': %s"),
-                               pool->def->name, virGetLastErrorMessage());
-                virStoragePoolObjUnlock(pool);
-                continue;
-            }
-            started = true;
-        }
-
-        if (started) {
-            char *stateFile;
-
-            virStoragePoolObjClearVols(pool);
-            stateFile = virFileBuildPath(driver->stateDir,
-                                         pool->def->name, ".xml");
-            if (!stateFile ||
-                virStoragePoolSaveState(stateFile, pool->def) < 0 ||
-                backend->refreshPool(conn, pool) < 0) {
-                if (stateFile)
-                    unlink(stateFile);
-                if (backend->stopPool)
-                    backend->stopPool(conn, pool);
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Failed to autostart storage pool '%s': %s"),
-                               pool->def->name, virGetLastErrorMessage());
-            } else {
-                pool->active = true;
-            }
-            VIR_FREE(stateFile);
-        }
+        wanted = pool->autostart && !virStoragePoolObjIsActive(pool);
         virStoragePoolObjUnlock(pool);
+
+        if (wanted && VIR_APPEND_ELEMENT(data.pools, npools, pool) < 0)
+            goto cleanup;
     }
 
-    virObjectUnref(conn);
+    if (npools == 0)
+        return;
+
+    /* XXX Remove hardcoding of QEMU URI */
+    if (driver->privileged)
+        data.conn = virConnectOpen("qemu:///system");
+    else
+        data.conn = virConnectOpen("qemu:///session");
+    /* Ignoring NULL conn - let backends decide */
+
+    /* Starting a pool may mean an iSCSI login, a mount or a full scan
+     * of the target, so do them concurrently rather than one by one */
+    virThreadPoolParallelFor(npools, STORAGE_DRIVER_STARTUP_MAX_WORKERS,
+                             storagePoolAutostartOne, &data);
+
+ cleanup:
+    virObjectUnref(data.conn);
+    VIR_FREE(data.pools);
 }
 
 /**
@@ -366,6 +644,8 @@ storageStateReload(void)
 static int
 storageStateCleanup(void)
 {
+    size_t i;
+
     if (!driver)
         return -1;
 
@@ -373,6 +653,9 @@ storageStateCleanup(void)
 
     virObjectUnref(driver->storageEventState);
 
+    for (i = 0; i < driver->pools.count; i++)
+        storagePoolWatchStop(driver->pools.objs[i]);
+
     /* free inactive pools */
     virStoragePoolObjListFree(&driver->pools);
 
@@ -718,7 +1001,8 @@ storagePoolCreateXML(virConnectPtr conn,
 
     virStoragePoolObjClearVols(pool);
     if (!stateFile || virStoragePoolSaveState(stateFile, pool->def) < 0 ||
-        backend->refreshPool(conn, pool) < 0) {
+        backend->refreshPool(conn, pool) < 0 ||
+        storagePoolWatchStart(pool) < 0) {
         if (stateFile)
             unlink(stateFile);
         if (backend->stopPool)
@@ -929,7 +1213,8 @@ storagePoolCreate(virStoragePoolPtr obj,
 
     virStoragePoolObjClearVols(pool);
     if (!stateFile || virStoragePoolSaveState(stateFile, pool->def) < 0 ||
-        backend->refreshPool(obj->conn, pool) < 0) {
+        backend->refreshPool(obj->conn, pool) < 0 ||
+        storagePoolWatchStart(pool) < 0) {
         if (stateFile)
             unlink(stateFile);
         if (backend->stopPool)
@@ -1035,6 +1320,7 @@ storagePoolDestroy(virStoragePoolPtr obj)
         backend->stopPool(obj->conn, pool) < 0)
         goto cleanup;
 
+    storagePoolWatchStop(pool);
     virStoragePoolObjClearVols(pool);
 
     event = virStoragePoolEventLifecycleNew(pool->def->name,
@@ -1149,8 +1435,10 @@ storagePoolRefresh(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    virStoragePoolObjClearVols(pool);
+    virStoragePoolObjStashVols(pool);
     if (backend->refreshPool(obj->conn, pool) < 0) {
+        virStoragePoolObjClearStaleVols(pool);
+        storagePoolWatchStop(pool);
         if (backend->stopPool)
             backend->stopPool(obj->conn, pool);
 
@@ -1164,6 +1452,7 @@ storagePoolRefresh(virStoragePoolPtr obj,
 
         goto cleanup;
     }
+    virStoragePoolObjClearStaleVols(pool);
 
     event = virStoragePoolEventRefreshNew(pool->def->name,
                                           pool->def->uuid);
@@ -1630,18 +1919,10 @@ static void
 storageVolRemoveFromPool(virStoragePoolObjPtr pool,
                          virStorageVolDefPtr vol)
 {
-    size_t i;
-
-    for (i = 0; i < pool->volumes.count; i++) {
-        if (pool->volumes.objs[i] == vol) {
-            VIR_INFO("Deleting volume '%s' from storage pool '%s'",
-                     vol->name, pool->def->name);
-            virStorageVolDefFree(vol);
-
-            VIR_DELETE_ELEMENT(pool->volumes.objs, i, pool->volumes.count);
-            break;
-        }
-    }
+    VIR_INFO("Deleting volume '%s' from storage pool '%s'",
+             vol->name, pool->def->name);
+    virStoragePoolObjRemoveVol(pool, vol);
+    virStorageVolDefFree(vol);
 }
 
 
@@ -1815,21 +2096,18 @@ storageVolCreateXML(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0)
-        goto cleanup;
-
     /* Wipe any key the user may have suggested, as volume creation
      * will generate the canonical key.  */
     VIR_FREE(voldef->key);
     if (backend->createVol(obj->conn, pool, voldef) < 0)
         goto cleanup;
 
-    pool->volumes.objs[pool->volumes.count++] = voldef;
+    if (virStoragePoolObjAddVol(pool, voldef) < 0)
+        goto cleanup;
     volobj = virGetStorageVol(obj->conn, pool->def->name, voldef->name,
                               voldef->key, NULL, NULL);
     if (!volobj) {
-        pool->volumes.count--;
+        virStoragePoolObjRemoveVol(pool, voldef);
         goto cleanup;
     }
 
@@ -2014,10 +2292,6 @@ storageVolCreateXMLFrom(virStoragePoolPtr obj,
         backend->refreshVol(obj->conn, pool, origvol) < 0)
         goto cleanup;
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0)
-        goto cleanup;
-
     /* 'Define' the new volume so we get async progress reporting.
      * Wipe any key the user may have suggested, as volume creation
      * will generate the canonical key.  */
@@ -2034,11 +2308,12 @@ storageVolCreateXMLFrom(virStoragePoolPtr obj,
 
     memcpy(shadowvol, newvol, sizeof(*newvol));
 
-    pool->volumes.objs[pool->volumes.count++] = newvol;
+    if (virStoragePoolObjAddVol(pool, newvol) < 0)
+        goto cleanup;
     volobj = virGetStorageVol(obj->conn, pool->def->name, newvol->name,
                               newvol->key, NULL, NULL);
     if (!volobj) {
-        pool->volumes.count--;
+        virStoragePoolObjRemoveVol(pool, newvol);
         goto cleanup;
     }
 
@@ -2117,7 +2392,7 @@ storageVolDownload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
 
     if (!(vol = virStorageVolDefFromVol(obj, &pool, &backend)))
         return -1;
@@ -2231,9 +2506,10 @@ virStorageVolPoolRefreshThread(void *opaque)
     if (!(backend = virStorageBackendForType(pool->def->type)))
         goto cleanup;
 
-    virStoragePoolObjClearVols(pool);
+    virStoragePoolObjStashVols(pool);
     if (backend->refreshPool(NULL, pool) < 0)
         VIR_DEBUG("Failed to refresh storage pool");
+    virStoragePoolObjClearStaleVols(pool);
 
     event = virStoragePoolEventRefreshNew(pool->def->name,
                                           pool->def->uuid);
@@ -2285,7 +2561,7 @@ storageVolUpload(virStorageVolPtr obj,
     virStorageVolStreamInfoPtr cbdata = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
 
     if (!(vol = virStorageVolDefFromVol(obj, &pool, &backend)))
         return -1;
@@ -3108,6 +3384,170 @@ virStorageFileChown(const virStorageSource *src,
 }
 
 
+/*
+ * Image headers read while walking backing chains are cached so that
+ * base images shared by many domains, or probed again on every start,
+ * hotplug and reconnect, do not have to be opened and read each time.
+ * Entries are keyed by the identity of the image and of the user it
+ * was read as and are only used while the size, inode and modification
+ * time of the image stay the same. Images modified less than
+ * VIR_STORAGE_HEADER_CACHE_RACY seconds ago are not cached at all as
+ * their timestamp may not change on a following write.
+ */
+#define VIR_STORAGE_HEADER_CACHE_MAX 256
+#define VIR_STORAGE_HEADER_CACHE_RACY 2
+
+typedef struct _virStorageFileHeaderCacheEntry virStorageFileHeaderCacheEntry;
+typedef virStorageFileHeaderCacheEntry *virStorageFileHeaderCacheEntryPtr;
+struct _virStorageFileHeaderCacheEntry {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+
+    char *buf;
+    ssize_t len;
+};
+
+static virMutex virStorageFileHeaderCacheLock;
+static virHashTablePtr virStorageFileHeaderCache;
+
+static void
+virStorageFileHeaderCacheEntryFree(void *payload,
+                                   const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageFileHeaderCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    VIR_FREE(entry->buf);
+    VIR_FREE(entry);
+}
+
+
+static int
+virStorageFileHeaderCacheOnceInit(void)
+{
+    if (virMutexInit(&virStorageFileHeaderCacheLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to init image header cache mutex"));
+        return -1;
+    }
+
+    if (!(virStorageFileHeaderCache =
+          virHashCreate(32, virStorageFileHeaderCacheEntryFree)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virStorageFileHeaderCache)
+
+
+static bool
+virStorageFileHeaderCacheEntryMatch(virStorageFileHeaderCacheEntryPtr entry,
+                                    const struct stat *st)
+{
+    struct timespec mtime = get_stat_mtime(st);
+
+    return entry->dev == st->st_dev &&
+        entry->ino == st->st_ino &&
+        entry->size == st->st_size &&
+        entry->mtime.tv_sec == mtime.tv_sec &&
+        entry->mtime.tv_nsec == mtime.tv_nsec;
+}
+
+
+/**
+ * virStorageFileReadHeaderCached:
+ * @src: initialized storage source to read the header of
+ * @uniqueName: unique identifier of @src
+ * @uid: user the header is read as
+ * @gid: group the header is read as
+ * @buf: filled with the header
+ *
+ * Same as virStorageFileReadHeader, but serves the header from the image
+ * header cache if @src was not modified since it was last read.
+ *
+ * Returns the length of @buf or -1 on error.
+ */
+static ssize_t
+virStorageFileReadHeaderCached(virStorageSourcePtr src,
+                               const char *uniqueName,
+                               uid_t uid, gid_t gid,
+                               char **buf)
+{
+    virStorageFileHeaderCacheEntryPtr entry;
+    struct stat st;
+    char *key = NULL;
+    unsigned long long now;
+    ssize_t ret = -1;
+
+    if (virStorageFileHeaderCacheInitialize() < 0 ||
+        virAsprintf(&key, "%u:%u:%s",
+                    (unsigned int)uid, (unsigned int)gid, uniqueName) < 0)
+        return -1;
+
+    /* without a way to tell whether the image changed there's nothing
+     * the cache can be validated against */
+    if (virStorageFileStat(src, &st) < 0) {
+        ret = virStorageFileReadHeader(src, VIR_STORAGE_MAX_HEADER, buf);
+        goto cleanup;
+    }
+
+    virMutexLock(&virStorageFileHeaderCacheLock);
+    if ((entry = virHashLookup(virStorageFileHeaderCache, key)) &&
+        virStorageFileHeaderCacheEntryMatch(entry, &st)) {
+        if (VIR_ALLOC_N(*buf, entry->len) == 0) {
+            memcpy(*buf, entry->buf, entry->len);
+            ret = entry->len;
+        }
+        virMutexUnlock(&virStorageFileHeaderCacheLock);
+        VIR_DEBUG("using cached header of '%s'", NULLSTR(src->path));
+        goto cleanup;
+    }
+    virMutexUnlock(&virStorageFileHeaderCacheLock);
+
+    if ((ret = virStorageFileReadHeader(src, VIR_STORAGE_MAX_HEADER, buf)) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&now) < 0 ||
+        get_stat_mtime(&st).tv_sec + VIR_STORAGE_HEADER_CACHE_RACY >
+        now / 1000) {
+        virResetLastError();
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC(entry) < 0 ||
+        VIR_ALLOC_N(entry->buf, ret) < 0) {
+        virStorageFileHeaderCacheEntryFree(entry, NULL);
+        virResetLastError();
+        goto cleanup;
+    }
+
+    memcpy(entry->buf, *buf, ret);
+    entry->len = ret;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->size = st.st_size;
+    entry->mtime = get_stat_mtime(&st);
+
+    virMutexLock(&virStorageFileHeaderCacheLock);
+    if (virHashSize(virStorageFileHeaderCache) >= VIR_STORAGE_HEADER_CACHE_MAX)
+        virHashRemoveAll(virStorageFileHeaderCache);
+    if (virHashUpdateEntry(virStorageFileHeaderCache, key, entry) < 0) {
+        virStorageFileHeaderCacheEntryFree(entry, NULL);
+        virResetLastError();
+    }
+    virMutexUnlock(&virStorageFileHeaderCacheLock);
+
+ cleanup:
+    VIR_FREE(key);
+    return ret;
+}
+
+
 /* Recursive workhorse for virStorageFileGetMetadata.  */
 static int
 virStorageFileGetMetadataRecurse(virStorageSourcePtr src,
@@ -3166,8 +3606,8 @@ virStorageFileGetMetadataRecurse(virStorageSourcePtr src,
     if (virHashAddEntry(cycle, uniqueName, (void *)1) < 0)
         goto cleanup;
 
-    if ((headerLen = virStorageFileReadHeader(src, VIR_STORAGE_MAX_HEADER,
-                                              &buf)) < 0)
+    if ((headerLen = virStorageFileReadHeaderCached(src, uniqueName,
+                                                    uid, gid, &buf)) < 0)
         goto cleanup;
 
     if (virStorageFileGetMetadataInternal(src, buf, headerLen,
@@ -3263,6 +3703,104 @@ virStorageFileGetMetadata(virStorageSourcePtr src,
 }
 
 
+#define VIR_STORAGE_PREFETCH_THREADS 8
+
+typedef struct _virStorageFilePrefetchData virStorageFilePrefetchData;
+typedef virStorageFilePrefetchData *virStorageFilePrefetchDataPtr;
+struct _virStorageFilePrefetchData {
+    virMutex lock;
+    virStorageSourcePtr *srcs;
+    uid_t *uids;
+    gid_t *gids;
+    size_t nsrcs;
+    size_t next;
+    bool allow_probe;
+};
+
+
+static void
+virStorageFilePrefetchMetadataWorker(void *opaque)
+{
+    virStorageFilePrefetchDataPtr data = opaque;
+    virStorageSourcePtr copy;
+    size_t i;
+
+    while (true) {
+        virMutexLock(&data->lock);
+        i = data->next++;
+        virMutexUnlock(&data->lock);
+
+        if (i >= data->nsrcs)
+            break;
+
+        /* walk a private copy, the result is only kept in the image
+         * header cache */
+        if ((copy = virStorageSourceCopy(data->srcs[i], false))) {
+            ignore_value(virStorageFileGetMetadata(copy,
+                                                   data->uids[i],
+                                                   data->gids[i],
+                                                   data->allow_probe,
+                                                   false));
+            virStorageSourceFree(copy);
+        }
+        virResetLastError();
+    }
+}
+
+
+/**
+ * virStorageFilePrefetchMetadata:
+ * @srcs: storage sources to prefetch
+ * @uids: user to access each of @srcs as
+ * @gids: group to access each of @srcs as
+ * @nsrcs: number of items in the arrays
+ * @allow_probe: whether format probing of backing files is allowed
+ *
+ * Read the headers of the backing chains of @srcs concurrently so that
+ * a following virStorageFileGetMetadata on each of them, which is still
+ * the only way to get the metadata and errors, is served from the image
+ * header cache. @srcs are not modified. This is a best effort operation
+ * and no errors are reported.
+ */
+void
+virStorageFilePrefetchMetadata(virStorageSourcePtr *srcs,
+                               uid_t *uids,
+                               gid_t *gids,
+                               size_t nsrcs,
+                               bool allow_probe)
+{
+    virStorageFilePrefetchData data = {
+        .srcs = srcs, .uids = uids, .gids = gids,
+        .nsrcs = nsrcs, .allow_probe = allow_probe,
+    };
+    virThread threads[VIR_STORAGE_PREFETCH_THREADS];
+    size_t nthreads = MIN(nsrcs, VIR_STORAGE_PREFETCH_THREADS);
+    size_t i;
+
+    if (nsrcs < 2)
+        return;
+
+    if (virMutexInit(&data.lock) < 0)
+        return;
+
+    VIR_DEBUG("prefetching metadata of %zu images using %zu threads",
+              nsrcs, nthreads);
+
+    for (i = 0; i < nthreads; i++) {
+        if (virThreadCreate(&threads[i], true,
+                            virStorageFilePrefetchMetadataWorker, &data) < 0)
+            break;
+    }
+    nthreads = i;
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    virMutexDestroy(&data.lock);
+    virResetLastError();
+}
+
+
 static int
 virStorageAddISCSIPoolSourceHost(virDomainDiskDefPtr def,
                                  virStoragePoolDefPtr pooldef)
@@ -53,6 +53,11 @@ int virStorageFileGetMetadata(virStorageSourcePtr src,
                               bool allow_probe,
                               bool report_broken)
     ATTRIBUTE_NONNULL(1);
+void virStorageFilePrefetchMetadata(virStorageSourcePtr *srcs,
+                                    uid_t *uids,
+                                    gid_t *gids,
+                                    size_t nsrcs,
+                                    bool allow_probe);
 
 int virStorageTranslateDiskSourcePool(virConnectPtr conn,
                                       virDomainDiskDefPtr def);
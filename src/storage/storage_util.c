@@ -50,6 +50,10 @@
 # include <linux/btrfs.h>
 #endif
 
+#if HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+
 #include "datatypes.h"
 #include "virerror.h"
 #include "viralloc.h"
@@ -68,6 +72,9 @@
 #include "virstring.h"
 #include "virxml.h"
 #include "virfdstream.h"
+#include "virhash.h"
+#include "virthread.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -77,10 +84,17 @@ VIR_LOG_INIT("storage.storage_util");
 #define WRITE_BLOCK_SIZE_DEFAULT (4 * 1024)
 
 /*
- * Perform the O(1) btrfs clone operation, if possible.
+ * Perform the O(1) reflink clone operation, if possible. FICLONE is
+ * the generic name of BTRFS_IOC_CLONE, also implemented by XFS.
  * Upon success, return 0.  Otherwise, return -1 and set errno.
  */
-#if HAVE_LINUX_BTRFS_H
+#if defined(__linux__) && defined(FICLONE)
+static inline int
+btrfsCloneFile(int dest_fd, int src_fd)
+{
+    return ioctl(dest_fd, FICLONE, src_fd);
+}
+#elif HAVE_LINUX_BTRFS_H
 static inline int
 btrfsCloneFile(int dest_fd, int src_fd)
 {
@@ -96,6 +110,105 @@ btrfsCloneFile(int dest_fd ATTRIBUTE_UNUSED,
 }
 #endif
 
+#if HAVE_COPY_FILE_RANGE
+static ssize_t
+storageCopyFileRange(int in_fd, int out_fd, size_t len)
+{
+    return copy_file_range(in_fd, NULL, out_fd, NULL, len, 0);
+}
+#elif HAVE_SYS_SYSCALL_H && defined(SYS_copy_file_range)
+static ssize_t
+storageCopyFileRange(int in_fd, int out_fd, size_t len)
+{
+    return syscall(SYS_copy_file_range, in_fd, NULL, out_fd, NULL, len, 0);
+}
+#else
+static ssize_t
+storageCopyFileRange(int in_fd ATTRIBUTE_UNUSED,
+                     int out_fd ATTRIBUTE_UNUSED,
+                     size_t len ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+#endif
+
+
+/*
+ * Copy up to @total bytes from the current position of @inputfd to the
+ * current position of @fd within the kernel, skipping over the holes
+ * of the input, and advancing both positions and @total by the amount
+ * copied. The kernel may share the blocks between the files rather
+ * than copying them.
+ *
+ * Returns 0 once @total reached 0 or the end of the input, 1 if the
+ * rest has to be copied through a buffer, or -errno on error.
+ */
+static int
+storageBackendCopyRangeToFD(virStorageVolDefPtr vol,
+                            virStorageVolDefPtr inputvol,
+                            int inputfd,
+                            int fd,
+                            unsigned long long *total)
+{
+    int inData;
+    long long len;
+    ssize_t copied;
+
+    while (*total > 0) {
+        if (virFileInData(inputfd, &inData, &len) < 0) {
+            virResetLastError();
+            return 1;
+        }
+
+        if (len == 0)
+            break;
+        if (len > *total)
+            len = *total;
+
+        if (!inData) {
+            if (lseek(inputfd, len, SEEK_CUR) < 0 ||
+                lseek(fd, len, SEEK_CUR) < 0) {
+                virReportSystemError(errno,
+                                     _("cannot skip hole in file '%s'"),
+                                     vol->target.path);
+                return -errno;
+            }
+            *total -= len;
+            continue;
+        }
+
+        while (len > 0) {
+            if ((copied = storageCopyFileRange(inputfd, fd, len)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                    errno == EOPNOTSUPP || errno == ENOTSUP ||
+                    errno == EBADF) {
+                    VIR_DEBUG("copy_file_range from '%s' not possible, "
+                              "copying through a buffer",
+                              inputvol->target.path);
+                    return 1;
+                }
+                virReportSystemError(errno,
+                                     _("failed to copy from '%s' to '%s'"),
+                                     inputvol->target.path, vol->target.path);
+                return -errno;
+            }
+
+            /* The input shrunk under our hands */
+            if (copied == 0)
+                return 0;
+
+            len -= copied;
+            *total -= copied;
+        }
+    }
+
+    return 0;
+}
+
+
 static int ATTRIBUTE_NONNULL(2)
 virStorageBackendCopyToFD(virStorageVolDefPtr vol,
                           virStorageVolDefPtr inputvol,
@@ -154,6 +267,17 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
         }
     }
 
+    /* Holes can only be preserved if we are allowed to leave them */
+    if (want_sparse &&
+        fstat(inputfd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if ((ret = storageBackendCopyRangeToFD(vol, inputvol, inputfd, fd,
+                                               total)) < 0)
+            goto cleanup;
+        if (ret == 0)
+            amtread = 0;
+        ret = 0;
+    }
+
     while (amtread != 0) {
         int amtleft;
 
@@ -322,6 +446,22 @@ createRawFile(int fd, virStorageVolDefPtr vol,
         vol->target.allocation < inputvol->target.capacity)
         need_alloc = false;
 
+    /* A sparse clone may as well share all of its blocks with the original
+     * until they are written to, if the filesystem can do that */
+    if (inputvol && !need_alloc && !reflink_copy &&
+        inputvol->type == VIR_STORAGE_VOL_FILE) {
+        int inputfd;
+
+        if ((inputfd = open(inputvol->target.path, O_RDONLY)) >= 0) {
+            if (btrfsCloneFile(fd, inputfd) == 0) {
+                VIR_DEBUG("Cloned '%s' to '%s' by reflink",
+                          inputvol->target.path, vol->target.path);
+                inputvol = NULL;
+            }
+            VIR_FORCE_CLOSE(inputfd);
+        }
+    }
+
     /* Seek to the final size, so the capacity is available upfront
      * for progress reporting */
     if (ftruncate(fd, vol->target.capacity) < 0) {
@@ -2401,8 +2541,9 @@ virStorageBackendVolUploadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     char *target_path = vol->target.path;
     int ret = -1;
     int has_snap = 0;
+    bool sparse = flags & VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
     /* if volume has target format VIR_STORAGE_FILE_PLOOP
      * we need to restore DiskDescriptor.xml, according to
      * new contents of volume. This operation will be perfomed
@@ -2427,7 +2568,7 @@ virStorageBackendVolUploadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     /* Not using O_CREAT because the file is required to already exist at
      * this point */
     ret = virFDStreamOpenBlockDevice(stream, target_path,
-                                     offset, len, O_WRONLY);
+                                     offset, len, sparse, O_WRONLY);
 
  cleanup:
     VIR_FREE(path);
@@ -2447,8 +2588,9 @@ virStorageBackendVolDownloadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     char *target_path = vol->target.path;
     int ret = -1;
     int has_snap = 0;
+    bool sparse = flags & VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
     if (vol->target.format == VIR_STORAGE_FILE_PLOOP) {
         has_snap = storageBackendPloopHasSnapshots(vol->target.path);
         if (has_snap < 0) {
@@ -2465,7 +2607,7 @@ virStorageBackendVolDownloadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     }
 
     ret = virFDStreamOpenBlockDevice(stream, target_path,
-                                     offset, len, O_RDONLY);
+                                     offset, len, sparse, O_RDONLY);
 
  cleanup:
     VIR_FREE(path);
@@ -2512,6 +2654,222 @@ storageBackendVolZeroSparseFileLocal(const char *path,
 }
 
 
+/* Ways of zeroing a range without writing the zeroes ourselves, in the
+ * order they are tried */
+typedef enum {
+    STORAGE_WIPE_FAST_ZEROOUT,      /* BLKZEROOUT on block devices */
+    STORAGE_WIPE_FAST_ZERO_RANGE,   /* FALLOC_FL_ZERO_RANGE on files */
+    STORAGE_WIPE_FAST_PUNCH_HOLE,   /* FALLOC_FL_PUNCH_HOLE on files */
+
+    STORAGE_WIPE_FAST_LAST
+} storageWipeFastMethod;
+
+static const char *storageWipeFastMethodNames[] = {
+    [STORAGE_WIPE_FAST_ZEROOUT] = "BLKZEROOUT",
+    [STORAGE_WIPE_FAST_ZERO_RANGE] = "FALLOC_FL_ZERO_RANGE",
+    [STORAGE_WIPE_FAST_PUNCH_HOLE] = "FALLOC_FL_PUNCH_HOLE",
+};
+verify(ARRAY_CARDINALITY(storageWipeFastMethodNames) ==
+       STORAGE_WIPE_FAST_LAST);
+
+/* The range is handed out to the threads in pieces of this size */
+#define STORAGE_WIPE_FAST_CHUNK (1024ULL * 1024 * 1024)
+#define STORAGE_WIPE_FAST_THREADS 4
+
+
+/* Returns 0 on success, -1 with errno set on failure */
+static int
+storageBackendWipeFastRange(int fd,
+                            storageWipeFastMethod method,
+                            off_t offset,
+                            off_t len)
+{
+    switch (method) {
+    case STORAGE_WIPE_FAST_ZEROOUT: {
+#ifdef BLKZEROOUT
+        uint64_t range[2] = { offset, len };
+
+        return ioctl(fd, BLKZEROOUT, range);
+#else
+        break;
+#endif
+    }
+
+    case STORAGE_WIPE_FAST_ZERO_RANGE:
+#if HAVE_FALLOCATE - 0 && defined(FALLOC_FL_ZERO_RANGE)
+        return fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+                         offset, len);
+#else
+        break;
+#endif
+
+    case STORAGE_WIPE_FAST_PUNCH_HOLE:
+#if HAVE_FALLOCATE - 0 && defined(FALLOC_FL_PUNCH_HOLE)
+        return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                         offset, len);
+#else
+        break;
+#endif
+
+    case STORAGE_WIPE_FAST_LAST:
+        break;
+    }
+
+    errno = ENOTSUP;
+    return -1;
+}
+
+
+struct storageBackendWipeFastData {
+    virMutex lock;
+    int fd;
+    storageWipeFastMethod method;
+    off_t next;     /* start of the first piece nobody took yet */
+    off_t end;
+    int err;        /* errno of the first failure */
+};
+
+
+static void
+storageBackendWipeFastWorker(void *opaque)
+{
+    struct storageBackendWipeFastData *data = opaque;
+    off_t offset;
+    off_t len;
+
+    while (true) {
+        virMutexLock(&data->lock);
+        if (data->err || data->next >= data->end) {
+            virMutexUnlock(&data->lock);
+            return;
+        }
+        offset = data->next;
+        len = MIN(STORAGE_WIPE_FAST_CHUNK, data->end - offset);
+        data->next += len;
+        virMutexUnlock(&data->lock);
+
+        if (storageBackendWipeFastRange(data->fd, data->method,
+                                        offset, len) < 0) {
+            virMutexLock(&data->lock);
+            if (!data->err)
+                data->err = errno;
+            virMutexUnlock(&data->lock);
+            return;
+        }
+    }
+}
+
+
+/*
+ * Zero @wipe_len bytes at the start, or the end if @zero_end is true,
+ * of the file or block device @fd without writing the zeroes through
+ * a buffer, which for thin provisioned or SSD backed storage takes just
+ * a fraction of the time. The range is split between a few threads.
+ *
+ * Returns 1 if the range was zeroed, 0 if no such method is available
+ * for @fd, -1 on error.
+ */
+static int
+storageBackendWipeLocalFast(const char *path,
+                            int fd,
+                            const struct stat *st,
+                            unsigned long long wipe_len,
+                            bool zero_end)
+{
+    struct storageBackendWipeFastData data = { .fd = fd };
+    virThread threads[STORAGE_WIPE_FAST_THREADS - 1];
+    size_t nthreads = 0;
+    off_t size;
+    off_t start;
+    off_t len;
+    size_t i;
+    int ret = -1;
+    char ebuf[1024];
+
+    if (S_ISBLK(st->st_mode))
+        data.method = STORAGE_WIPE_FAST_ZEROOUT;
+    else if (S_ISREG(st->st_mode))
+        data.method = STORAGE_WIPE_FAST_ZERO_RANGE;
+    else
+        return 0;
+
+    if (wipe_len == 0 ||
+        (size = lseek(fd, 0, SEEK_END)) < 0 ||
+        wipe_len > size)
+        return 0;
+
+    start = zero_end ? size - wipe_len : 0;
+    data.end = start + wipe_len;
+
+    /* The first piece tells which method works */
+    len = MIN(STORAGE_WIPE_FAST_CHUNK, wipe_len);
+    while (storageBackendWipeFastRange(fd, data.method, start, len) < 0) {
+        if (errno != EOPNOTSUPP && errno != ENOTSUP && errno != ENOSYS &&
+            errno != ENOTTY && errno != EINVAL) {
+            virReportSystemError(errno,
+                                 _("Failed to zero storage volume with "
+                                   "path '%s' using %s"),
+                                 path, storageWipeFastMethodNames[data.method]);
+            return -1;
+        }
+
+        VIR_DEBUG("%s not supported for '%s': %s",
+                  storageWipeFastMethodNames[data.method], path,
+                  virStrerror(errno, ebuf, sizeof(ebuf)));
+
+        if (data.method == STORAGE_WIPE_FAST_ZEROOUT ||
+            ++data.method == STORAGE_WIPE_FAST_LAST)
+            return 0;
+    }
+    data.next = start + len;
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        return -1;
+    }
+
+    while (nthreads < ARRAY_CARDINALITY(threads) &&
+           data.end - data.next > nthreads * STORAGE_WIPE_FAST_CHUNK) {
+        if (virThreadCreate(&threads[nthreads], true,
+                            storageBackendWipeFastWorker, &data) < 0) {
+            VIR_WARN("Failed to start wipe thread: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
+            break;
+        }
+        nthreads++;
+    }
+
+    storageBackendWipeFastWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    if (data.err) {
+        virReportSystemError(data.err,
+                             _("Failed to zero storage volume with "
+                               "path '%s' using %s"),
+                             path, storageWipeFastMethodNames[data.method]);
+        goto cleanup;
+    }
+
+    if (fdatasync(fd) < 0) {
+        virReportSystemError(errno,
+                             _("cannot sync data to volume with path '%s'"),
+                             path);
+        goto cleanup;
+    }
+
+    VIR_INFO("Zeroed %llu bytes of volume with path '%s' using %s",
+             wipe_len, path, storageWipeFastMethodNames[data.method]);
+    ret = 1;
+
+ cleanup:
+    virMutexDestroy(&data.lock);
+    return ret;
+}
+
+
 static int
 storageBackendWipeLocal(const char *path,
                         int fd,
@@ -2572,7 +2930,8 @@ storageBackendWipeLocal(const char *path,
         goto cleanup;
     }
 
-    VIR_DEBUG("Wrote %llu bytes to volume with path '%s'", wipe_len, path);
+    VIR_INFO("Zeroed %llu bytes of volume with path '%s' by writing zeroes",
+             wipe_len, path);
 
     ret = 0;
 
@@ -2660,12 +3019,14 @@ storageBackendVolWipeLocalFile(const char *path,
     } else {
         if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE)) {
             ret = storageBackendVolZeroSparseFileLocal(path, st.st_size, fd);
-        } else {
+        } else if ((ret = storageBackendWipeLocalFast(path, fd, &st, allocation,
+                                                      zero_end)) == 0) {
             ret = storageBackendWipeLocal(path, fd, allocation, st.st_blksize,
                                           zero_end);
         }
         if (ret < 0)
             goto cleanup;
+        ret = 0;
     }
 
  cleanup:
@@ -3514,94 +3875,199 @@ storageBackendProbeTarget(virStorageSourcePtr target,
 }
 
 
-/**
- * Iterate over the pool's directory and enumerate all disk images
- * within it. This is non-recursive.
+/* Files modified within this many seconds of being probed don't get a
+ * fingerprint, as their timestamp may not change on the next write. */
+#define VIR_STORAGE_VOL_FINGERPRINT_MIN_AGE 2
+
+static void
+storageBackendVolFingerprintFill(virStorageVolFingerprintPtr fp,
+                                 const struct stat *sb)
+{
+    unsigned long long now;
+
+    memset(fp, 0, sizeof(*fp));
+
+    if (virTimeMillisNow(&now) < 0 ||
+        get_stat_mtime(sb).tv_sec + VIR_STORAGE_VOL_FINGERPRINT_MIN_AGE >
+        now / 1000 ||
+        get_stat_ctime(sb).tv_sec + VIR_STORAGE_VOL_FINGERPRINT_MIN_AGE >
+        now / 1000)
+        return;
+
+    fp->valid = true;
+    fp->dev = sb->st_dev;
+    fp->ino = sb->st_ino;
+    fp->size = sb->st_size;
+    fp->mtime = get_stat_mtime(sb);
+    fp->ctime = get_stat_ctime(sb);
+}
+
+
+static bool
+storageBackendVolFingerprintEqual(const virStorageVolFingerprint *a,
+                                  const virStorageVolFingerprint *b)
+{
+    return a->valid && b->valid &&
+        a->dev == b->dev &&
+        a->ino == b->ino &&
+        a->size == b->size &&
+        a->mtime.tv_sec == b->mtime.tv_sec &&
+        a->mtime.tv_nsec == b->mtime.tv_nsec &&
+        a->ctime.tv_sec == b->ctime.tv_sec &&
+        a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
+
+
+/*
+ * storageBackendRefreshLocalVol:
+ * @pool: storage pool object
+ * @name: name of the file in the pool directory
+ * @prev: volume previously found for @name, or NULL
+ * @vol: filled in with the volume
+ *
+ * Returns 1 if @name is a volume, which is @prev itself if the file has
+ * not changed since @prev was probed. Returns 0 if @name is not a volume
+ * and -1 on error.
  */
-int
-virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
-                              virStoragePoolObjPtr pool)
+static int
+storageBackendRefreshLocalVol(virStoragePoolObjPtr pool,
+                              const char *name,
+                              virStorageVolDefPtr prev,
+                              virStorageVolDefPtr *vol)
 {
-    DIR *dir;
-    struct dirent *ent;
-    struct statvfs sb;
-    struct stat statbuf;
-    virStorageVolDefPtr vol = NULL;
-    virStorageSourcePtr target = NULL;
-    int direrr;
-    int fd = -1, ret = -1;
+    virStorageVolDefPtr def = NULL;
+    virStorageVolFingerprint fp;
+    struct stat sb;
+    int err;
+    int ret = -1;
 
-    if (virDirOpen(&dir, pool->def->target.path) < 0)
+    *vol = NULL;
+
+    if (VIR_ALLOC(def) < 0)
+        return -1;
+
+    if (VIR_STRDUP(def->name, name) < 0)
         goto cleanup;
 
-    while ((direrr = virDirRead(dir, &ent, pool->def->target.path)) > 0) {
-        int err;
+    def->type = VIR_STORAGE_VOL_FILE;
+    def->target.format = VIR_STORAGE_FILE_RAW; /* Real value is filled in during probe */
+    if (virAsprintf(&def->target.path, "%s/%s",
+                    pool->def->target.path,
+                    def->name) == -1)
+        goto cleanup;
 
-        if (virStringHasControlChars(ent->d_name)) {
-            VIR_WARN("Ignoring file with control characters under '%s'",
-                     pool->def->target.path);
-            continue;
-        }
+    /* A file which can't be stat()ed is left for the probe to reject */
+    if (stat(def->target.path, &sb) == 0)
+        storageBackendVolFingerprintFill(&fp, &sb);
+    else
+        memset(&fp, 0, sizeof(fp));
 
-        if (VIR_ALLOC(vol) < 0)
-            goto cleanup;
+    if (prev &&
+        storageBackendVolFingerprintEqual(&prev->fingerprint, &fp)) {
+        virStorageVolDefFree(def);
+        def = prev;
+        goto backing;
+    }
 
-        if (VIR_STRDUP(vol->name, ent->d_name) < 0)
-            goto cleanup;
+    if (VIR_STRDUP(def->key, def->target.path) < 0)
+        goto cleanup;
 
-        vol->type = VIR_STORAGE_VOL_FILE;
-        vol->target.format = VIR_STORAGE_FILE_RAW; /* Real value is filled in during probe */
-        if (virAsprintf(&vol->target.path, "%s/%s",
-                        pool->def->target.path,
-                        vol->name) == -1)
+    if ((err = storageBackendProbeTarget(&def->target,
+                                         &def->target.encryption)) < 0) {
+        if (err == -2) {
+            /* Silently ignore non-regular files,
+             * eg 'lost+found', dangling symbolic link */
+            ret = 0;
             goto cleanup;
-
-        if (VIR_STRDUP(vol->key, vol->target.path) < 0)
+        } else if (err == -3) {
+            /* The backing file is currently unavailable, its format is not
+             * explicitly specified, the probe to auto detect the format
+             * failed: continue with faked RAW format, since AUTO will
+             * break virStorageVolTargetDefFormat() generating the line
+             * <format type='...'/>. */
+        } else {
             goto cleanup;
-
-        if ((err = storageBackendProbeTarget(&vol->target,
-                                             &vol->target.encryption)) < 0) {
-            if (err == -2) {
-                /* Silently ignore non-regular files,
-                 * eg 'lost+found', dangling symbolic link */
-                virStorageVolDefFree(vol);
-                vol = NULL;
-                continue;
-            } else if (err == -3) {
-                /* The backing file is currently unavailable, its format is not
-                 * explicitly specified, the probe to auto detect the format
-                 * failed: continue with faked RAW format, since AUTO will
-                 * break virStorageVolTargetDefFormat() generating the line
-                 * <format type='...'/>. */
-            } else {
-                goto cleanup;
-            }
         }
+    }
 
-        /* directory based volume */
-        if (vol->target.format == VIR_STORAGE_FILE_DIR)
-            vol->type = VIR_STORAGE_VOL_DIR;
-
-        if (vol->target.format == VIR_STORAGE_FILE_PLOOP)
-            vol->type = VIR_STORAGE_VOL_PLOOP;
-
-        if (vol->target.backingStore) {
-            ignore_value(storageBackendUpdateVolTargetInfo(VIR_STORAGE_VOL_FILE,
-                                                           vol->target.backingStore,
-                                                           false,
-                                                           VIR_STORAGE_VOL_OPEN_DEFAULT, 0));
-            /* If this failed, the backing file is currently unavailable,
-             * the capacity, allocation, owner, group and mode are unknown.
-             * An error message was raised, but we just continue. */
-        }
+    def->fingerprint = fp;
 
-        if (VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0)
-            goto cleanup;
+    /* directory based volume */
+    if (def->target.format == VIR_STORAGE_FILE_DIR)
+        def->type = VIR_STORAGE_VOL_DIR;
+
+    if (def->target.format == VIR_STORAGE_FILE_PLOOP)
+        def->type = VIR_STORAGE_VOL_PLOOP;
+
+ backing:
+    if (def->target.backingStore) {
+        ignore_value(storageBackendUpdateVolTargetInfo(VIR_STORAGE_VOL_FILE,
+                                                       def->target.backingStore,
+                                                       false,
+                                                       VIR_STORAGE_VOL_OPEN_DEFAULT, 0));
+        /* If this failed, the backing file is currently unavailable,
+         * the capacity, allocation, owner, group and mode are unknown.
+         * An error message was raised, but we just continue. */
     }
-    if (direrr < 0)
-        goto cleanup;
-    VIR_DIR_CLOSE(dir);
-    vol = NULL;
+
+    *vol = def;
+    def = NULL;
+    ret = 1;
+
+ cleanup:
+    if (def != prev)
+        virStorageVolDefFree(def);
+    return ret;
+}
+
+
+static void
+storageBackendStaleVolFree(void *payload,
+                           const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageVolDefFree(payload);
+}
+
+
+/* Index the stale volumes of @pool by name, taking them over */
+static virHashTablePtr
+storageBackendStaleVolsTake(virStoragePoolObjPtr pool)
+{
+    virHashTablePtr stale;
+    size_t i;
+
+    if (!(stale = virHashCreate(MAX(pool->staleVolumes.count, 1),
+                                storageBackendStaleVolFree)))
+        return NULL;
+
+    for (i = 0; i < pool->staleVolumes.count; i++) {
+        virStorageVolDefPtr vol = pool->staleVolumes.objs[i];
+
+        if (vol->building || vol->in_use)
+            continue;
+
+        if (virHashAddEntry(stale, vol->name, vol) < 0) {
+            virHashFree(stale);
+            return NULL;
+        }
+        pool->staleVolumes.objs[i] = NULL;
+    }
+
+    virStoragePoolObjClearStaleVols(pool);
+
+    return stale;
+}
+
+
+/* Update the allocation, capacity and permissions of the pool itself */
+static int
+storageBackendRefreshLocalTarget(virStoragePoolObjPtr pool)
+{
+    struct statvfs sb;
+    struct stat statbuf;
+    virStorageSourcePtr target = NULL;
+    int fd = -1;
+    int ret = -1;
 
     if (VIR_ALLOC(target))
         goto cleanup;
@@ -3646,16 +4112,126 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
 
     ret = 0;
  cleanup:
-    VIR_DIR_CLOSE(dir);
     VIR_FORCE_CLOSE(fd);
-    virStorageVolDefFree(vol);
     virStorageSourceFree(target);
+    return ret;
+}
+
+
+/**
+ * Iterate over the pool's directory and enumerate all disk images
+ * within it. This is non-recursive.
+ *
+ * Volumes stashed by virStoragePoolObjStashVols are reused for files
+ * whose fingerprint shows they have not changed, so that only new and
+ * modified files get probed.
+ */
+int
+virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
+                              virStoragePoolObjPtr pool)
+{
+    DIR *dir = NULL;
+    struct dirent *ent;
+    virStorageVolDefPtr vol = NULL;
+    virHashTablePtr stale = NULL;
+    int direrr;
+    int ret = -1;
+
+    if (!(stale = storageBackendStaleVolsTake(pool)))
+        goto cleanup;
+
+    if (virDirOpen(&dir, pool->def->target.path) < 0)
+        goto cleanup;
+
+    while ((direrr = virDirRead(dir, &ent, pool->def->target.path)) > 0) {
+        virStorageVolDefPtr prev;
+        int rc;
+
+        if (virStringHasControlChars(ent->d_name)) {
+            VIR_WARN("Ignoring file with control characters under '%s'",
+                     pool->def->target.path);
+            continue;
+        }
+
+        prev = virHashSteal(stale, ent->d_name);
+        rc = storageBackendRefreshLocalVol(pool, ent->d_name, prev, &vol);
+        if (vol != prev)
+            virStorageVolDefFree(prev);
+        if (rc < 0)
+            goto cleanup;
+        if (rc == 0)
+            continue;
+
+        if (virStoragePoolObjAddVol(pool, vol) < 0)
+            goto cleanup;
+        vol = NULL;
+    }
+    if (direrr < 0)
+        goto cleanup;
+
+    if (storageBackendRefreshLocalTarget(pool) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_DIR_CLOSE(dir);
+    virStorageVolDefFree(vol);
+    virHashFree(stale);
     if (ret < 0)
         virStoragePoolObjClearVols(pool);
     return ret;
 }
 
 
+/**
+ * virStorageBackendRefreshLocalFile:
+ * @pool: storage pool object
+ * @name: name of a file in the pool directory which may have changed
+ *
+ * Bring the volume list of @pool up to date for the file @name only,
+ * without rescanning the whole pool.
+ *
+ * Returns 1 if the volume list changed, 0 if not, -1 on error.
+ */
+int
+virStorageBackendRefreshLocalFile(virStoragePoolObjPtr pool,
+                                  const char *name)
+{
+    virStorageVolDefPtr prev = NULL;
+    virStorageVolDefPtr vol = NULL;
+
+    if (virStringHasControlChars(name))
+        return 0;
+
+    prev = virStorageVolDefFindByName(pool, name);
+
+    /* Leave volumes the driver is working on alone */
+    if (prev && (prev->building || prev->in_use))
+        return 0;
+
+    if (storageBackendRefreshLocalVol(pool, name, prev, &vol) < 0)
+        return -1;
+
+    if (vol == prev)
+        return 0;
+
+    if (prev) {
+        virStoragePoolObjRemoveVol(pool, prev);
+        virStorageVolDefFree(prev);
+    }
+
+    if (vol && virStoragePoolObjAddVol(pool, vol) < 0) {
+        virStorageVolDefFree(vol);
+        return -1;
+    }
+
+    if (storageBackendRefreshLocalTarget(pool) < 0)
+        return -1;
+
+    return 1;
+}
+
+
 static char *
 virStorageBackendSCSISerial(const char *dev)
 {
@@ -3783,7 +4359,7 @@ virStorageBackendSCSINewLun(virStoragePoolObjPtr pool,
     pool->def->capacity += vol->target.capacity;
     pool->def->allocation += vol->target.allocation;
 
-    if (VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0)
+    if (virStoragePoolObjAddVol(pool, vol) < 0)
         goto cleanup;
 
     vol = NULL;
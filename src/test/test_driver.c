@@ -101,7 +101,7 @@ struct _testDriver {
     bool transaction_running;
     virInterfaceObjList backupIfaces;
     virStoragePoolObjList pools;
-    virNodeDeviceObjList devs;
+    virNodeDeviceObjListPtr devs;
     int numCells;
     testCell cells[MAX_CELLS];
     size_t numAuths;
@@ -129,6 +129,15 @@ static testDriverPtr defaultConn;
 static int defaultConnections;
 static virMutex defaultLock = VIR_MUTEX_INITIALIZER;
 
+/* test:///scale connections share their state like test:///default
+ * does, as long as they ask for the same population. Protected by
+ * defaultLock as well. */
+static testDriverPtr scaleConn;
+static int scaleConnections;
+static char *scaleQuery;
+
+#define TEST_SCALE_MAX_OBJECTS (1000 * 1000)
+
 #define TEST_MODEL "i686"
 #define TEST_EMULATOR "/usr/bin/test-hv"
 
@@ -152,7 +161,7 @@ testDriverFree(testDriverPtr driver)
     virObjectUnref(driver->caps);
     virObjectUnref(driver->xmlopt);
     virObjectUnref(driver->domains);
-    virNodeDeviceObjListFree(&driver->devs);
+    virNodeDeviceObjListFree(driver->devs);
     virObjectUnref(driver->networks);
     virInterfaceObjListFree(&driver->ifaces);
     virStoragePoolObjListFree(&driver->pools);
@@ -417,7 +426,8 @@ testDriverNew(void)
     if (!(ret->xmlopt = virDomainXMLOptionNew(NULL, NULL, &ns)) ||
         !(ret->eventState = virObjectEventStateNew()) ||
         !(ret->domains = virDomainObjListNew()) ||
-        !(ret->networks = virNetworkObjListNew()))
+        !(ret->networks = virNetworkObjListNew()) ||
+        !(ret->devs = virNodeDeviceObjListNew()))
         goto error;
 
     virAtomicIntSet(&ret->nextDomID, 1);
@@ -1075,7 +1085,7 @@ testOpenVolumesForPool(const char *file,
 
         if (!def->key && VIR_STRDUP(def->key, def->target.path) < 0)
             goto error;
-        if (VIR_APPEND_ELEMENT_COPY(pool->volumes.objs, pool->volumes.count, def) < 0)
+        if (virStoragePoolObjAddVol(pool, def) < 0)
             goto error;
 
         pool->def->allocation += def->target.allocation;
@@ -1168,7 +1178,7 @@ testParseNodedevs(testDriverPtr privconn,
         if (!def)
             goto error;
 
-        if (!(obj = virNodeDeviceObjAssignDef(&privconn->devs, def))) {
+        if (!(obj = virNodeDeviceObjAssignDef(privconn->devs, def))) {
             virNodeDeviceDefFree(def);
             goto error;
         }
@@ -1365,6 +1375,272 @@ testOpenDefault(virConnectPtr conn)
     return VIR_DRV_OPEN_ERROR;
 }
 
+typedef struct _testScaleParams testScaleParams;
+struct _testScaleParams {
+    unsigned int domains;
+    unsigned int networks;
+    unsigned int pools;
+};
+
+
+static int
+testOpenScaleParseParams(virURIPtr uri,
+                         testScaleParams *params)
+{
+    size_t i;
+
+    params->domains = 1;
+    params->networks = 1;
+    params->pools = 1;
+
+    for (i = 0; i < uri->paramsCount; i++) {
+        virURIParamPtr param = uri->params + i;
+        unsigned int *value;
+
+        if (STREQ(param->name, "domains")) {
+            value = &params->domains;
+        } else if (STREQ(param->name, "networks")) {
+            value = &params->networks;
+        } else if (STREQ(param->name, "pools")) {
+            value = &params->pools;
+        } else {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unknown test:///scale parameter '%s'"),
+                           param->name);
+            return -1;
+        }
+
+        if (virStrToLong_uip(param->value, NULL, 10, value) < 0 ||
+            *value > TEST_SCALE_MAX_OBJECTS) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("invalid value '%s' of test:///scale "
+                             "parameter '%s'"),
+                           NULLSTR(param->value), param->name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* Objects of a scale connection get UUIDs derived from their kind and
+ * index, so that they are the same in every process. */
+static void
+testOpenScaleUUID(char *uuidstr,
+                  unsigned int kind,
+                  unsigned int idx)
+{
+    snprintf(uuidstr, VIR_UUID_STRING_BUFLEN,
+             "%08x-0000-4000-8000-%012x", kind, idx);
+}
+
+
+static int
+testOpenScaleDomains(testDriverPtr privconn,
+                     unsigned int count)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    char *xml = NULL;
+    virDomainDefPtr def = NULL;
+    virDomainObjPtr obj;
+    unsigned int i;
+    int ret = -1;
+
+    for (i = 0; i < count; i++) {
+        testOpenScaleUUID(uuidstr, 1, i);
+        if (virAsprintf(&xml,
+                        "<domain type='test'>"
+                        "  <name>scale-%u</name>"
+                        "  <uuid>%s</uuid>"
+                        "  <memory>1048576</memory>"
+                        "  <vcpu>%u</vcpu>"
+                        "  <os><type>hvm</type></os>"
+                        "</domain>",
+                        i, uuidstr, 1 + i % 4) < 0)
+            goto cleanup;
+
+        if (!(def = virDomainDefParseString(xml, privconn->caps,
+                                            privconn->xmlopt, NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+            goto cleanup;
+
+        if (!(obj = virDomainObjListAdd(privconn->domains, def,
+                                        privconn->xmlopt, 0, NULL)))
+            goto cleanup;
+        def = NULL;
+        obj->persistent = 1;
+
+        /* Every other domain is running, so that filtered listing has
+         * something to filter */
+        if (i % 2 == 0) {
+            if (testDomainStartState(privconn, obj,
+                                     VIR_DOMAIN_RUNNING_BOOTED) < 0) {
+                virObjectUnlock(obj);
+                goto cleanup;
+            }
+        } else {
+            testDomainShutdownState(NULL, obj, VIR_DOMAIN_SHUTOFF_UNKNOWN);
+        }
+
+        virObjectUnlock(obj);
+        VIR_FREE(xml);
+    }
+
+    ret = 0;
+ cleanup:
+    virDomainDefFree(def);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static int
+testOpenScaleNetworks(testDriverPtr privconn,
+                      unsigned int count)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    char *xml = NULL;
+    virNetworkDefPtr def = NULL;
+    virNetworkObjPtr obj;
+    unsigned int i;
+    int ret = -1;
+
+    for (i = 0; i < count; i++) {
+        testOpenScaleUUID(uuidstr, 2, i);
+        if (virAsprintf(&xml,
+                        "<network>"
+                        "  <name>scale-net-%u</name>"
+                        "  <uuid>%s</uuid>"
+                        "  <bridge name='scbr%u'/>"
+                        "</network>",
+                        i, uuidstr, i) < 0)
+            goto cleanup;
+
+        if (!(def = virNetworkDefParseString(xml)))
+            goto cleanup;
+
+        if (!(obj = virNetworkObjAssignDef(privconn->networks, def, 0)))
+            goto cleanup;
+        def = NULL;
+
+        obj->active = 1;
+        virNetworkObjEndAPI(&obj);
+        VIR_FREE(xml);
+    }
+
+    ret = 0;
+ cleanup:
+    virNetworkDefFree(def);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static int
+testOpenScalePools(testDriverPtr privconn,
+                   unsigned int count)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    char *xml = NULL;
+    virStoragePoolDefPtr def = NULL;
+    virStoragePoolObjPtr obj;
+    unsigned int i;
+    int ret = -1;
+
+    for (i = 0; i < count; i++) {
+        testOpenScaleUUID(uuidstr, 3, i);
+        if (virAsprintf(&xml,
+                        "<pool type='dir'>"
+                        "  <name>scale-pool-%u</name>"
+                        "  <uuid>%s</uuid>"
+                        "  <target><path>/scale-pool-%u</path></target>"
+                        "</pool>",
+                        i, uuidstr, i) < 0)
+            goto cleanup;
+
+        if (!(def = virStoragePoolDefParseString(xml)))
+            goto cleanup;
+
+        if (!(obj = virStoragePoolObjAssignDef(&privconn->pools, def)))
+            goto cleanup;
+        def = NULL;
+
+        if (testStoragePoolObjSetDefaults(obj) < 0) {
+            virStoragePoolObjUnlock(obj);
+            goto cleanup;
+        }
+        obj->active = 1;
+
+        virStoragePoolObjUnlock(obj);
+        VIR_FREE(xml);
+    }
+
+    ret = 0;
+ cleanup:
+    virStoragePoolDefFree(def);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+/* test:///scale?domains=N&networks=M&pools=K synthesizes large object
+ * populations for benchmarking the layers above the driver, instead of
+ * loading them from XML fixtures. */
+static int
+testOpenScale(virConnectPtr conn)
+{
+    testDriverPtr privconn = NULL;
+    testScaleParams params;
+    const char *query = conn->uri->query ? conn->uri->query : "";
+
+    virMutexLock(&defaultLock);
+    if (scaleConnections) {
+        if (STRNEQ(scaleQuery, query)) {
+            virReportError(VIR_ERR_OPERATION_INVALID,
+                           _("test:///scale is already open with "
+                             "parameters '%s'"), scaleQuery);
+            goto error;
+        }
+        scaleConnections++;
+        conn->privateData = scaleConn;
+        virMutexUnlock(&defaultLock);
+        return VIR_DRV_OPEN_SUCCESS;
+    }
+
+    if (testOpenScaleParseParams(conn->uri, &params) < 0)
+        goto error;
+
+    if (!(privconn = testDriverNew()))
+        goto error;
+
+    conn->privateData = privconn;
+    memmove(&privconn->nodeInfo, &defaultNodeInfo, sizeof(defaultNodeInfo));
+
+    if (!(privconn->caps = testBuildCapabilities(conn)))
+        goto error;
+
+    if (testOpenScaleDomains(privconn, params.domains) < 0 ||
+        testOpenScaleNetworks(privconn, params.networks) < 0 ||
+        testOpenScalePools(privconn, params.pools) < 0)
+        goto error;
+
+    if (VIR_STRDUP(scaleQuery, query) < 0)
+        goto error;
+
+    scaleConn = privconn;
+    scaleConnections = 1;
+    virMutexUnlock(&defaultLock);
+
+    return VIR_DRV_OPEN_SUCCESS;
+
+ error:
+    testDriverFree(privconn);
+    conn->privateData = NULL;
+    virMutexUnlock(&defaultLock);
+    return VIR_DRV_OPEN_ERROR;
+}
+
 static int
 testConnectAuthenticate(virConnectPtr conn,
                         virConnectAuthPtr auth)
@@ -1450,6 +1726,8 @@ static virDrvOpenStatus testConnectOpen(virConnectPtr conn,
 
     if (STREQ(conn->uri->path, "/default"))
         ret = testOpenDefault(conn);
+    else if (STREQ(conn->uri->path, "/scale"))
+        ret = testOpenScale(conn);
     else
         ret = testOpenFromFile(conn,
                                conn->uri->path);
@@ -1468,23 +1746,36 @@ static int testConnectClose(virConnectPtr conn)
 {
     testDriverPtr privconn = conn->privateData;
     bool dflt = false;
+    bool scale = false;
 
+    virMutexLock(&defaultLock);
     if (privconn == defaultConn) {
         dflt = true;
-        virMutexLock(&defaultLock);
         if (--defaultConnections) {
             virMutexUnlock(&defaultLock);
             return 0;
         }
+    } else if (privconn == scaleConn) {
+        scale = true;
+        if (--scaleConnections) {
+            virMutexUnlock(&defaultLock);
+            return 0;
+        }
+    } else {
+        virMutexUnlock(&defaultLock);
     }
 
     testDriverLock(privconn);
     testDriverFree(privconn);
 
-    if (dflt) {
+    if (dflt)
         defaultConn = NULL;
-        virMutexUnlock(&defaultLock);
+    if (scale) {
+        scaleConn = NULL;
+        VIR_FREE(scaleQuery);
     }
+    if (dflt || scale)
+        virMutexUnlock(&defaultLock);
 
     conn->privateData = NULL;
     return 0;
@@ -4523,7 +4814,7 @@ testDestroyVport(testDriverPtr privconn,
      *
      * Reaching across the boundaries of space and time into the
      * Node Device in order to remove */
-    if (!(obj = virNodeDeviceObjFindByName(&privconn->devs, "scsi_host12"))) {
+    if (!(obj = virNodeDeviceObjFindByName(privconn->devs, "scsi_host12"))) {
         virReportError(VIR_ERR_NO_NODE_DEVICE, "%s",
                        _("no node device with matching name 'scsi_host12'"));
         goto cleanup;
@@ -4533,7 +4824,7 @@ testDestroyVport(testDriverPtr privconn,
                                            VIR_NODE_DEVICE_EVENT_DELETED,
                                            0);
 
-    virNodeDeviceObjRemove(&privconn->devs, &obj);
+    virNodeDeviceObjRemove(privconn->devs, &obj);
 
     ret = 0;
 
@@ -4987,8 +5278,7 @@ testStorageVolCreateXML(virStoragePoolPtr pool,
         goto cleanup;
 
     if (VIR_STRDUP(privvol->key, privvol->target.path) < 0 ||
-        VIR_APPEND_ELEMENT_COPY(privpool->volumes.objs,
-                                privpool->volumes.count, privvol) < 0)
+        virStoragePoolObjAddVol(privpool, privvol) < 0)
         goto cleanup;
 
     privpool->def->allocation += privvol->target.allocation;
@@ -5064,8 +5354,7 @@ testStorageVolCreateXMLFrom(virStoragePoolPtr pool,
         goto cleanup;
 
     if (VIR_STRDUP(privvol->key, privvol->target.path) < 0 ||
-        VIR_APPEND_ELEMENT_COPY(privpool->volumes.objs,
-                                privpool->volumes.count, privvol) < 0)
+        virStoragePoolObjAddVol(privpool, privvol) < 0)
         goto cleanup;
 
     privpool->def->allocation += privvol->target.allocation;
@@ -5091,7 +5380,6 @@ testStorageVolDelete(virStorageVolPtr vol,
     testDriverPtr privconn = vol->conn->privateData;
     virStoragePoolObjPtr privpool;
     virStorageVolDefPtr privvol;
-    size_t i;
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -5119,14 +5407,8 @@ testStorageVolDelete(virStorageVolPtr vol,
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    for (i = 0; i < privpool->volumes.count; i++) {
-        if (privpool->volumes.objs[i] == privvol) {
-            virStorageVolDefFree(privvol);
-
-            VIR_DELETE_ELEMENT(privpool->volumes.objs, i, privpool->volumes.count);
-            break;
-        }
-    }
+    virStoragePoolObjRemoveVol(privpool, privvol);
+    virStorageVolDefFree(privvol);
     ret = 0;
 
  cleanup:
@@ -5269,7 +5551,7 @@ testNodeDeviceObjFindByName(testDriverPtr driver,
     virNodeDeviceObjPtr obj;
 
     testDriverLock(driver);
-    obj = virNodeDeviceObjFindByName(&driver->devs, name);
+    obj = virNodeDeviceObjFindByName(driver->devs, name);
     testDriverUnlock(driver);
 
     if (!obj)
@@ -5292,7 +5574,7 @@ testNodeNumOfDevices(virConnectPtr conn,
     virCheckFlags(0, -1);
 
     testDriverLock(driver);
-    ndevs = virNodeDeviceObjNumOfDevices(&driver->devs, conn, cap, NULL);
+    ndevs = virNodeDeviceObjNumOfDevices(driver->devs, conn, cap, NULL);
     testDriverUnlock(driver);
 
     return ndevs;
@@ -5312,7 +5594,7 @@ testNodeListDevices(virConnectPtr conn,
     virCheckFlags(0, -1);
 
     testDriverLock(driver);
-    nnames = virNodeDeviceObjGetNames(&driver->devs, conn, NULL,
+    nnames = virNodeDeviceObjGetNames(driver->devs, conn, NULL,
                                      cap, names, maxnames);
     testDriverUnlock(driver);
 
@@ -5459,7 +5741,7 @@ testNodeDeviceMockCreateVport(testDriverPtr driver,
      * using the scsi_host11 definition, changing the name and the
      * scsi_host capability fields before calling virNodeDeviceAssignDef
      * to add the def to the node device objects list. */
-    if (!(objcopy = virNodeDeviceObjFindByName(&driver->devs, "scsi_host11")))
+    if (!(objcopy = virNodeDeviceObjFindByName(driver->devs, "scsi_host11")))
         goto cleanup;
 
     xml = virNodeDeviceDefFormat(objcopy->def);
@@ -5499,7 +5781,7 @@ testNodeDeviceMockCreateVport(testDriverPtr driver,
         caps = caps->next;
     }
 
-    if (!(obj = virNodeDeviceObjAssignDef(&driver->devs, def)))
+    if (!(obj = virNodeDeviceObjAssignDef(driver->devs, def)))
         goto cleanup;
     def = NULL;
 
@@ -5542,7 +5824,7 @@ testNodeDeviceCreateXML(virConnectPtr conn,
     /* Unlike the "real" code we don't need the parent_host in order to
      * call virVHBAManageVport, but still let's make sure the code finds
      * something valid and no one messed up the mock environment. */
-    if (virNodeDeviceObjGetParentHost(&driver->devs, def, CREATE_DEVICE) < 0)
+    if (virNodeDeviceObjGetParentHost(driver->devs, def, CREATE_DEVICE) < 0)
         goto cleanup;
 
     /* In the real code, we'd call virVHBAManageVport followed by
@@ -5600,7 +5882,7 @@ testNodeDeviceDestroy(virNodeDevicePtr dev)
 
     /* We do this just for basic validation, but also avoid finding a
      * vport capable HBA if for some reason our vHBA doesn't exist */
-    if (virNodeDeviceObjGetParentHost(&driver->devs, obj->def,
+    if (virNodeDeviceObjGetParentHost(driver->devs, obj->def,
                                       EXISTING_DEVICE) < 0) {
         obj = NULL;
         goto out;
@@ -5611,7 +5893,7 @@ testNodeDeviceDestroy(virNodeDevicePtr dev)
                                            0);
 
     virNodeDeviceObjLock(obj);
-    virNodeDeviceObjRemove(&driver->devs, &obj);
+    virNodeDeviceObjRemove(driver->devs, &obj);
 
  out:
     if (obj)
@@ -6401,14 +6683,15 @@ testDomainSnapshotCreateXML(virDomainPtr domain,
     if (vm) {
         if (snapshot) {
             virDomainSnapshotObjPtr other;
-            if (update_current)
-                vm->current_snapshot = snap;
             other = virDomainSnapshotFindByName(vm->snapshots,
                                                 snap->def->parent);
-            snap->parent = other;
-            other->nchildren++;
-            snap->sibling = other->first_child;
-            other->first_child = snap;
+            if (virDomainSnapshotSetParent(snap, other) < 0) {
+                virObjectUnref(snapshot);
+                snapshot = NULL;
+                virDomainSnapshotObjListRemove(vm->snapshots, snap);
+            } else if (update_current) {
+                vm->current_snapshot = snap;
+            }
         }
         virDomainObjEndAPI(&vm);
     }
@@ -6445,7 +6728,6 @@ struct _testSnapReparentData {
     virDomainSnapshotObjPtr parent;
     virDomainObjPtr vm;
     int err;
-    virDomainSnapshotObjPtr last;
 };
 
 static int
@@ -6460,16 +6742,11 @@ testDomainSnapshotReparentChildren(void *payload,
         return 0;
 
     VIR_FREE(snap->def->parent);
-    snap->parent = rep->parent;
 
     if (rep->parent->def &&
-        VIR_STRDUP(snap->def->parent, rep->parent->def->name) < 0) {
+        VIR_STRDUP(snap->def->parent, rep->parent->def->name) < 0)
         rep->err = -1;
-        return 0;
-    }
 
-    if (!snap->sibling)
-        rep->last = snap;
     return 0;
 }
 
@@ -6509,22 +6786,16 @@ testDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
         rep.parent = snap->parent;
         rep.vm = vm;
         rep.err = 0;
-        rep.last = NULL;
         virDomainSnapshotForEachChild(snap,
                                       testDomainSnapshotReparentChildren,
                                       &rep);
-        if (rep.err < 0)
+        if (rep.err < 0 ||
+            virDomainSnapshotMoveChildren(snap, snap->parent) < 0)
             goto cleanup;
-
-        /* Can't modify siblings during ForEachChild, so do it now.  */
-        snap->parent->nchildren += snap->nchildren;
-        rep.last->sibling = snap->parent->first_child;
-        snap->parent->first_child = snap->first_child;
     }
 
     if (flags & VIR_DOMAIN_SNAPSHOT_DELETE_CHILDREN_ONLY) {
-        snap->nchildren = 0;
-        snap->first_child = NULL;
+        virDomainSnapshotDropChildren(snap);
     } else {
         virDomainSnapshotDropParent(snap);
         if (snap == vm->current_snapshot) {
@@ -29,8 +29,12 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
+#if WITH_ZLIB
+# include <zlib.h>
+#endif
 
 #include "virutil.h"
 #include "virthread.h"
@@ -43,33 +47,201 @@
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
+#define IO_HELPER_BUFLEN (1024 * 1024)
+#define IO_HELPER_QUEUE_DEPTH 8
+#define IO_HELPER_QUEUE_DEPTH_MAX 64
+
+/*
+ * The copy is split into blocks of @buflen bytes, numbered in the
+ * order they appear in the stream.  The main thread does the
+ * sequential I/O on the stdin/stdout pipe, while a pool of worker
+ * threads does the I/O on the file.  When the file is seekable the
+ * workers use positional I/O, so up to @depth blocks are in flight
+ * on it at once; otherwise a single worker processes blocks in order.
+ */
+typedef struct _runIOSlot runIOSlot;
+struct _runIOSlot {
+    void *base;     /* location to be freed */
+    char *buf;      /* aligned location within @base */
+    size_t len;     /* bytes of valid data in @buf */
+    bool busy;      /* owned by a worker, or holding unconsumed data */
+};
+
+typedef struct _runIOEngine runIOEngine;
+struct _runIOEngine {
+    virMutex lock;
+    virCond cond;
+
+    int fd;
+    bool reading;       /* true if @fd is read, false if written */
+    bool positional;    /* true if @fd can be accessed with pread/pwrite */
+    off_t start;        /* offset in @fd of the first block */
+    size_t buflen;
+    size_t depth;
+    runIOSlot *slots;
+
+    unsigned long long next;    /* next block for a worker to pick up */
+    unsigned long long avail;   /* blocks the workers may process */
+    unsigned long long done;    /* blocks consumed by the main thread */
+    bool eof;                   /* no more blocks will become available */
+    bool quit;
+    int err;                    /* errno of the first worker failure */
+};
+
+
+static ssize_t
+runIOReadFull(runIOEngine *eng, char *buf, size_t len, off_t offset)
+{
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t r;
+
+        if (eng->positional)
+            r = pread(eng->fd, buf + got, len - got, offset + got);
+        else
+            r = read(eng->fd, buf + got, len - got);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (r == 0)
+            break;
+        got += r;
+    }
+
+    return got;
+}
+
+
+static int
+runIOWriteFull(runIOEngine *eng, const char *buf, size_t len, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t r;
+
+        if (eng->positional)
+            r = pwrite(eng->fd, buf + done, len - done, offset + done);
+        else
+            r = write(eng->fd, buf + done, len - done);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += r;
+    }
+
+    return 0;
+}
+
+
+static void
+runIOWorker(void *opaque)
+{
+    runIOEngine *eng = opaque;
+
+    virMutexLock(&eng->lock);
+
+    while (1) {
+        unsigned long long seq;
+        runIOSlot *slot;
+        off_t offset;
+        ssize_t got = 0;
+        int rc = 0;
+
+        /* When reading the file, a slot can be refilled only after
+         * the main thread consumed the block it held before. */
+        while (!eng->quit &&
+               !(eng->next < eng->avail &&
+                 (!eng->reading || eng->next < eng->done + eng->depth)) &&
+               !(eng->eof && eng->next >= eng->avail))
+            ignore_value(virCondWait(&eng->cond, &eng->lock));
+
+        if (eng->quit || eng->next >= eng->avail)
+            break;
+
+        seq = eng->next++;
+        slot = &eng->slots[seq % eng->depth];
+        offset = eng->start + seq * eng->buflen;
+        virMutexUnlock(&eng->lock);
+
+        if (eng->reading) {
+            got = runIOReadFull(eng, slot->buf, slot->len, offset);
+            if (got < 0)
+                rc = -1;
+        } else {
+            rc = runIOWriteFull(eng, slot->buf, slot->len, offset);
+        }
+
+        virMutexLock(&eng->lock);
+        if (rc < 0) {
+            if (!eng->err)
+                eng->err = errno;
+            eng->quit = true;
+        } else if (eng->reading) {
+            slot->len = got;
+            slot->busy = true;
+            /* A short read marks the end of the file, nothing
+             * after this block has any data */
+            if (got < eng->buflen && seq + 1 < eng->avail)
+                eng->avail = seq + 1;
+        } else {
+            slot->busy = false;
+        }
+        virCondBroadcast(&eng->cond);
+    }
+
+    virMutexUnlock(&eng->lock);
+}
+
+
 static int
-runIO(const char *path, int fd, int oflags, unsigned long long length)
+runIO(const char *path, int fd, int oflags, unsigned long long length,
+      size_t buflen, size_t depth)
 {
-    void *base = NULL; /* Location to be freed */
-    char *buf = NULL; /* Aligned location within base */
-    size_t buflen = 1024*1024;
     intptr_t alignMask = 64*1024 - 1;
     int ret = -1;
     int fdin, fdout;
     const char *fdinname, *fdoutname;
     unsigned long long total = 0;
     bool direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
-    bool shortRead = false; /* true if we hit a short read */
     off_t end = 0;
+    runIOEngine eng;
+    virThreadPtr workers = NULL;
+    size_t nworkers = 0;
+    size_t nstarted = 0;
+    size_t nslots = 0;
+    size_t i;
+    unsigned long long seq;
+    bool locked = false;
 
-#if HAVE_POSIX_MEMALIGN
-    if (posix_memalign(&base, alignMask + 1, buflen)) {
-        virReportOOMError();
-        goto cleanup;
+    memset(&eng, 0, sizeof(eng));
+    eng.fd = fd;
+    eng.buflen = buflen;
+
+    if (virMutexInit(&eng.lock) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to init mutex"));
+        return -1;
     }
-    buf = base;
-#else
-    if (VIR_ALLOC_N(buf, buflen + alignMask) < 0)
+    if (virCondInit(&eng.cond) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to init condition"));
+        virMutexDestroy(&eng.lock);
+        return -1;
+    }
+
+    if (direct && (buflen & alignMask)) {
+        virReportSystemError(EINVAL,
+                             _("Block size %zu is not a multiple of %zu "
+                               "required for O_DIRECT"),
+                             buflen, (size_t) alignMask + 1);
         goto cleanup;
-    base = buf;
-    buf = (char *) (((intptr_t) base + alignMask) & ~alignMask);
-#endif
+    }
 
     switch (oflags & O_ACCMODE) {
     case O_RDONLY:
@@ -77,6 +249,7 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         fdinname = path;
         fdout = STDOUT_FILENO;
         fdoutname = "stdout";
+        eng.reading = true;
         /* To make the implementation simpler, we give up on any
          * attempt to use O_DIRECT in a non-trivial manner.  */
         if (direct && ((end = lseek(fd, 0, SEEK_CUR)) != 0 || length)) {
@@ -106,48 +279,181 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
                              (oflags & O_ACCMODE));
         goto cleanup;
     }
+    end = 0;
 
-    while (1) {
-        ssize_t got;
+    /* Files opened on pipes or sockets can only be processed
+     * sequentially, by a single worker */
+    if ((eng.start = lseek(fd, 0, SEEK_CUR)) < 0) {
+        eng.start = 0;
+        eng.positional = false;
+        nworkers = 1;
+    } else {
+        eng.positional = true;
+        nworkers = depth;
+    }
+    eng.depth = depth;
 
-        if (length &&
-            (length - total) < buflen)
-            buflen = length - total;
+    if (VIR_ALLOC_N(eng.slots, depth) < 0 ||
+        VIR_ALLOC_N(workers, nworkers) < 0)
+        goto cleanup;
 
-        if (buflen == 0)
-            break; /* End of requested data from client */
+    for (nslots = 0; nslots < depth; nslots++) {
+        runIOSlot *slot = &eng.slots[nslots];
 
-        if ((got = saferead(fdin, buf, buflen)) < 0) {
-            virReportSystemError(errno, _("Unable to read %s"), fdinname);
+#if HAVE_POSIX_MEMALIGN
+        if (posix_memalign(&slot->base, alignMask + 1, buflen)) {
+            virReportOOMError();
             goto cleanup;
         }
-        if (got == 0)
-            break; /* End of file before end of requested data */
-        if (got < buflen || (buflen & alignMask)) {
-            /* O_DIRECT can handle at most one short read, at end of file */
-            if (direct && shortRead) {
-                virReportSystemError(EINVAL, "%s",
-                                     _("Too many short reads for O_DIRECT"));
-            }
-            shortRead = true;
-        }
+        slot->buf = slot->base;
+#else
+        if (VIR_ALLOC_N(slot->buf, buflen + alignMask) < 0)
+            goto cleanup;
+        slot->base = slot->buf;
+        slot->buf = (char *) (((intptr_t) slot->base + alignMask) & ~alignMask);
+#endif
+    }
 
-        total += got;
-        if (fdout == fd && direct && shortRead) {
-            end = total;
-            memset(buf + got, 0, buflen - got);
-            got = (got + alignMask) & ~alignMask;
+    if (eng.reading) {
+        /* Workers may read blocks up to @length, or up to EOF */
+        if (length)
+            eng.avail = (length + buflen - 1) / buflen;
+        else
+            eng.avail = ULLONG_MAX;
+        eng.eof = true;
+        for (i = 0; i < depth; i++) {
+            unsigned long long off = (unsigned long long) i * buflen;
+            eng.slots[i].len = buflen;
+            if (length && off < length && length - off < buflen)
+                eng.slots[i].len = length - off;
         }
-        if (safewrite(fdout, buf, got) < 0) {
-            virReportSystemError(errno, _("Unable to write %s"), fdoutname);
+    }
+
+    for (nstarted = 0; nstarted < nworkers; nstarted++) {
+        if (virThreadCreate(&workers[nstarted], true, runIOWorker, &eng) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create I/O thread"));
             goto cleanup;
         }
-        if (end && ftruncate(fd, end) < 0) {
-            virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
-            goto cleanup;
+    }
+
+    for (seq = 0; ; seq++) {
+        runIOSlot *slot = &eng.slots[seq % depth];
+        ssize_t got;
+
+        virMutexLock(&eng.lock);
+        locked = true;
+
+        if (eng.reading) {
+            while (!eng.quit && !slot->busy && seq < eng.avail)
+                ignore_value(virCondWait(&eng.cond, &eng.lock));
+            if (eng.quit)
+                break;
+            if (!slot->busy)
+                break; /* End of file, or of requested data */
+            virMutexUnlock(&eng.lock);
+            locked = false;
+
+            got = slot->len;
+            total += got;
+            if (got && safewrite(fdout, slot->buf, got) < 0) {
+                virReportSystemError(errno, _("Unable to write %s"),
+                                     fdoutname);
+                goto cleanup;
+            }
+
+            /* Hand the slot over to the block @depth further on */
+            virMutexLock(&eng.lock);
+            slot->busy = false;
+            slot->len = buflen;
+            if (length) {
+                unsigned long long off = (seq + depth) * buflen;
+                if (off < length && length - off < buflen)
+                    slot->len = length - off;
+            }
+            eng.done = seq + 1;
+            virCondBroadcast(&eng.cond);
+            virMutexUnlock(&eng.lock);
+
+            if (got < buflen)
+                break;
+        } else {
+            size_t want = buflen;
+
+            while (!eng.quit && slot->busy)
+                ignore_value(virCondWait(&eng.cond, &eng.lock));
+            if (eng.quit)
+                break;
+            virMutexUnlock(&eng.lock);
+            locked = false;
+
+            if (length && (length - total) < want)
+                want = length - total;
+
+            if (want == 0)
+                break; /* End of requested data from client */
+
+            if ((got = saferead(fdin, slot->buf, want)) < 0) {
+                virReportSystemError(errno, _("Unable to read %s"), fdinname);
+                goto cleanup;
+            }
+            if (got == 0)
+                break; /* End of file before end of requested data */
+
+            total += got;
+            slot->len = got;
+            if (direct && (got & alignMask)) {
+                /* O_DIRECT can only write whole blocks, so pad the
+                 * last one and truncate the file to size afterwards */
+                end = total;
+                memset(slot->buf + got, 0, buflen - got);
+                slot->len = (got + alignMask) & ~alignMask;
+            }
+
+            virMutexLock(&eng.lock);
+            slot->busy = true;
+            eng.avail = seq + 1;
+            virCondBroadcast(&eng.cond);
+            virMutexUnlock(&eng.lock);
+
+            if (got < want)
+                break; /* Short read means end of file */
         }
     }
 
+    if (!locked) {
+        virMutexLock(&eng.lock);
+        locked = true;
+    }
+
+    /* Let the workers drain what has been queued for writing */
+    eng.eof = true;
+    virCondBroadcast(&eng.cond);
+    if (!eng.reading) {
+        for (i = 0; i < depth && !eng.quit; i++) {
+            while (!eng.quit && eng.slots[i].busy)
+                ignore_value(virCondWait(&eng.cond, &eng.lock));
+        }
+    }
+
+    if (eng.err) {
+        virReportSystemError(eng.err,
+                             eng.reading ? _("Unable to read %s") :
+                                           _("Unable to write %s"),
+                             path);
+        goto cleanup;
+    }
+    if (eng.quit)
+        goto cleanup;
+
+    virMutexUnlock(&eng.lock);
+    locked = false;
+
+    if (end && ftruncate(fd, end) < 0) {
+        virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
+        goto cleanup;
+    }
+
     /* Ensure all data is written */
     if (fdatasync(fdout) < 0) {
         if (errno != EINVAL && errno != EROFS) {
@@ -160,16 +466,501 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
     ret = 0;
 
  cleanup:
+    if (!locked)
+        virMutexLock(&eng.lock);
+    eng.quit = true;
+    virCondBroadcast(&eng.cond);
+    virMutexUnlock(&eng.lock);
+
+    for (i = 0; i < nstarted; i++)
+        virThreadJoin(&workers[i]);
+    VIR_FREE(workers);
+
     if (VIR_CLOSE(fd) < 0 &&
         ret == 0) {
         virReportSystemError(errno, _("Unable to close %s"), path);
         ret = -1;
     }
 
-    VIR_FREE(base);
+    for (i = 0; i < nslots; i++)
+        VIR_FREE(eng.slots[i].base);
+    VIR_FREE(eng.slots);
+    virCondDestroy(&eng.cond);
+    virMutexDestroy(&eng.lock);
+    return ret;
+}
+
+#if WITH_ZLIB
+/*
+ * Built-in compression, used by the "zlib" save image format in place
+ * of an external compression program.  The input is split into blocks
+ * which are compressed independently, so a pool of worker threads can
+ * compress and decompress them in parallel.  The stream is made of
+ * frames, each holding one block:
+ *
+ *   frame   := "LVZ1" clen:u32 ulen:u32 data[clen]
+ *
+ * and ends with a frame with both lengths zero, followed by an index
+ * with the offset from the start of the stream of each frame, so that
+ * a reader can seek to any block without scanning the stream:
+ *
+ *   index   := offset:u64 * nframes
+ *   trailer := nframes:u64 "LVZI"
+ *
+ * All integers are big endian.
+ */
+# define CODEC_FRAME_MAGIC "LVZ1"
+# define CODEC_INDEX_MAGIC "LVZI"
+# define CODEC_MAGIC_LEN 4
+# define CODEC_FRAME_HEADER_LEN (CODEC_MAGIC_LEN + 8)
+# define CODEC_BLOCK_MAX (64 * 1024 * 1024)
+
+typedef enum {
+    CODEC_SLOT_FREE,        /* may be filled by the reader */
+    CODEC_SLOT_FILLED,      /* holds input waiting for a worker */
+    CODEC_SLOT_BUSY,        /* being processed by a worker */
+    CODEC_SLOT_DONE,        /* holds output waiting for the writer */
+} runCodecSlotState;
+
+typedef struct _runCodecSlot runCodecSlot;
+struct _runCodecSlot {
+    int state;
+    char *in;
+    size_t inlen;
+    size_t insize;
+    char *out;
+    size_t outlen;
+    size_t outsize;
+};
+
+typedef struct _runCodecCtx runCodecCtx;
+struct _runCodecCtx {
+    virMutex lock;
+    virCond cond;
+
+    bool compress;
+    size_t buflen;
+    size_t depth;
+    runCodecSlot *slots;
+
+    unsigned long long filled;  /* blocks handed over by the reader */
+    unsigned long long next;    /* next block for a worker to pick up */
+    bool eof;                   /* the reader hit the end of the input */
+    bool readerDone;            /* the reader thread has finished */
+    bool quit;
+    int err;                    /* errno of the first failure */
+    bool corrupt;               /* the input is not a valid stream */
+};
+
+
+static void
+runCodecPutU32(char *buf, uint32_t val)
+{
+    buf[0] = val >> 24;
+    buf[1] = val >> 16;
+    buf[2] = val >> 8;
+    buf[3] = val;
+}
+
+
+static uint32_t
+runCodecGetU32(const char *buf)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+           ((uint32_t) p[2] << 8) | p[3];
+}
+
+
+static void
+runCodecPutU64(char *buf, uint64_t val)
+{
+    runCodecPutU32(buf, val >> 32);
+    runCodecPutU32(buf + 4, val);
+}
+
+
+/* Record the first failure and tell all threads to stop.
+ * Must be called with the lock held. */
+static void
+runCodecFail(runCodecCtx *codec, int err, bool corrupt)
+{
+    if (!codec->err && !codec->corrupt) {
+        codec->err = err;
+        codec->corrupt = corrupt;
+    }
+    codec->quit = true;
+    virCondBroadcast(&codec->cond);
+}
+
+
+/* Read the next block (or frame) from stdin into @slot.
+ * Returns 1 if a block was read, 0 at the end of the input,
+ * -1 on failure with either @err or @corrupt set. */
+static int
+runCodecReadBlock(runCodecCtx *codec, runCodecSlot *slot,
+                  int *err, bool *corrupt)
+{
+    char hdr[CODEC_FRAME_HEADER_LEN];
+    uint32_t clen, ulen;
+    ssize_t got;
+
+    if (codec->compress) {
+        if ((got = saferead(STDIN_FILENO, slot->in, codec->buflen)) < 0) {
+            *err = errno;
+            return -1;
+        }
+        slot->inlen = got;
+        return got ? 1 : 0;
+    }
+
+    if ((got = saferead(STDIN_FILENO, hdr, sizeof(hdr))) < 0) {
+        *err = errno;
+        return -1;
+    }
+    if (got != sizeof(hdr) ||
+        memcmp(hdr, CODEC_FRAME_MAGIC, CODEC_MAGIC_LEN) != 0) {
+        *corrupt = true;
+        return -1;
+    }
+
+    clen = runCodecGetU32(hdr + CODEC_MAGIC_LEN);
+    ulen = runCodecGetU32(hdr + CODEC_MAGIC_LEN + 4);
+
+    if (clen == 0 && ulen == 0)
+        return 0; /* End of stream, the index is of no use to us */
+
+    if (ulen == 0 || ulen > CODEC_BLOCK_MAX || clen > compressBound(ulen)) {
+        *corrupt = true;
+        return -1;
+    }
+
+    if ((clen > slot->insize &&
+         VIR_REALLOC_N_QUIET(slot->in, clen) < 0) ||
+        (ulen > slot->outsize &&
+         VIR_REALLOC_N_QUIET(slot->out, ulen) < 0)) {
+        *err = ENOMEM;
+        return -1;
+    }
+    slot->insize = MAX(slot->insize, clen);
+    slot->outsize = MAX(slot->outsize, ulen);
+
+    if ((got = saferead(STDIN_FILENO, slot->in, clen)) < 0) {
+        *err = errno;
+        return -1;
+    }
+    if (got != clen) {
+        *corrupt = true;
+        return -1;
+    }
+
+    slot->inlen = clen;
+    slot->outlen = ulen;
+    return 1;
+}
+
+
+static void
+runCodecReader(void *opaque)
+{
+    runCodecCtx *codec = opaque;
+    unsigned long long seq;
+
+    for (seq = 0; ; seq++) {
+        runCodecSlot *slot = &codec->slots[seq % codec->depth];
+        int err = 0;
+        bool corrupt = false;
+        int rc;
+
+        virMutexLock(&codec->lock);
+        while (!codec->quit && slot->state != CODEC_SLOT_FREE)
+            ignore_value(virCondWait(&codec->cond, &codec->lock));
+        if (codec->quit)
+            break;
+        virMutexUnlock(&codec->lock);
+
+        rc = runCodecReadBlock(codec, slot, &err, &corrupt);
+
+        virMutexLock(&codec->lock);
+        if (rc < 0) {
+            runCodecFail(codec, err, corrupt);
+            break;
+        }
+        if (rc == 0) {
+            codec->eof = true;
+            virCondBroadcast(&codec->cond);
+            break;
+        }
+        slot->state = CODEC_SLOT_FILLED;
+        codec->filled = seq + 1;
+        virCondBroadcast(&codec->cond);
+        virMutexUnlock(&codec->lock);
+    }
+
+    codec->readerDone = true;
+    virMutexUnlock(&codec->lock);
+}
+
+
+static void
+runCodecWorker(void *opaque)
+{
+    runCodecCtx *codec = opaque;
+
+    virMutexLock(&codec->lock);
+
+    while (1) {
+        runCodecSlot *slot;
+        uLongf len;
+        int rc;
+
+        while (!codec->quit &&
+               codec->next >= codec->filled &&
+               !codec->eof)
+            ignore_value(virCondWait(&codec->cond, &codec->lock));
+
+        if (codec->quit || codec->next >= codec->filled)
+            break;
+
+        slot = &codec->slots[codec->next++ % codec->depth];
+        slot->state = CODEC_SLOT_BUSY;
+        virMutexUnlock(&codec->lock);
+
+        if (codec->compress) {
+            len = slot->outsize;
+            rc = compress2((Bytef *) slot->out, &len,
+                           (const Bytef *) slot->in, slot->inlen,
+                           Z_BEST_SPEED);
+            slot->outlen = len;
+        } else {
+            len = slot->outlen;
+            rc = uncompress((Bytef *) slot->out, &len,
+                            (const Bytef *) slot->in, slot->inlen);
+            if (rc == Z_OK && len != slot->outlen)
+                rc = Z_DATA_ERROR;
+        }
+
+        virMutexLock(&codec->lock);
+        if (rc == Z_MEM_ERROR) {
+            runCodecFail(codec, ENOMEM, false);
+        } else if (rc != Z_OK) {
+            runCodecFail(codec, 0, true);
+        } else {
+            slot->state = CODEC_SLOT_DONE;
+            virCondBroadcast(&codec->cond);
+        }
+    }
+
+    virMutexUnlock(&codec->lock);
+}
+
+
+/* Write the trailing end marker, index and trailer of a compressed stream */
+static int
+runCodecWriteIndex(const uint64_t *offsets, size_t noffsets)
+{
+    char hdr[CODEC_FRAME_HEADER_LEN];
+    char trailer[8 + CODEC_MAGIC_LEN];
+    char *index = NULL;
+    size_t i;
+    int ret = -1;
+
+    memcpy(hdr, CODEC_FRAME_MAGIC, CODEC_MAGIC_LEN);
+    runCodecPutU32(hdr + CODEC_MAGIC_LEN, 0);
+    runCodecPutU32(hdr + CODEC_MAGIC_LEN + 4, 0);
+
+    if (VIR_ALLOC_N(index, noffsets * 8 + 1) < 0)
+        return -1;
+    for (i = 0; i < noffsets; i++)
+        runCodecPutU64(index + i * 8, offsets[i]);
+
+    runCodecPutU64(trailer, noffsets);
+    memcpy(trailer + 8, CODEC_INDEX_MAGIC, CODEC_MAGIC_LEN);
+
+    if (safewrite(STDOUT_FILENO, hdr, sizeof(hdr)) < 0 ||
+        safewrite(STDOUT_FILENO, index, noffsets * 8) < 0 ||
+        safewrite(STDOUT_FILENO, trailer, sizeof(trailer)) < 0) {
+        virReportSystemError(errno, _("Unable to write %s"), "stdout");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(index);
     return ret;
 }
 
+
+/*
+ * Compress (or decompress) stdin to stdout with @depth worker threads,
+ * using blocks of @buflen bytes when compressing.
+ */
+static int
+runCodec(bool compress, size_t buflen, size_t depth)
+{
+    runCodecCtx *codec = NULL;
+    virThread reader;
+    bool readerStarted = false;
+    virThreadPtr workers = NULL;
+    size_t nstarted = 0;
+    uint64_t *offsets = NULL;
+    size_t noffsets = 0;
+    uint64_t offset = 0;
+    unsigned long long seq;
+    size_t i;
+    int ret = -1;
+
+    if (buflen > CODEC_BLOCK_MAX) {
+        virReportSystemError(EINVAL,
+                             _("Block size %zu is larger than %d"),
+                             buflen, CODEC_BLOCK_MAX);
+        return -1;
+    }
+
+    if (VIR_ALLOC(codec) < 0)
+        return -1;
+
+    codec->compress = compress;
+    codec->buflen = buflen;
+    codec->depth = depth;
+
+    if (virMutexInit(&codec->lock) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to init mutex"));
+        VIR_FREE(codec);
+        return -1;
+    }
+    if (virCondInit(&codec->cond) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to init condition"));
+        virMutexDestroy(&codec->lock);
+        VIR_FREE(codec);
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(codec->slots, depth) < 0 ||
+        VIR_ALLOC_N(workers, depth) < 0)
+        goto cleanup;
+
+    if (compress) {
+        for (i = 0; i < depth; i++) {
+            runCodecSlot *slot = &codec->slots[i];
+
+            slot->insize = buflen;
+            slot->outsize = compressBound(buflen);
+            if (VIR_ALLOC_N(slot->in, slot->insize) < 0 ||
+                VIR_ALLOC_N(slot->out, slot->outsize) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (virThreadCreate(&reader, true, runCodecReader, codec) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to create I/O thread"));
+        goto cleanup;
+    }
+    readerStarted = true;
+
+    for (nstarted = 0; nstarted < depth; nstarted++) {
+        if (virThreadCreate(&workers[nstarted], true,
+                            runCodecWorker, codec) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create I/O thread"));
+            goto cleanup;
+        }
+    }
+
+    for (seq = 0; ; seq++) {
+        runCodecSlot *slot = &codec->slots[seq % depth];
+        char hdr[CODEC_FRAME_HEADER_LEN];
+
+        virMutexLock(&codec->lock);
+        while (!codec->quit &&
+               slot->state != CODEC_SLOT_DONE &&
+               !(codec->eof && seq >= codec->filled))
+            ignore_value(virCondWait(&codec->cond, &codec->lock));
+        if (codec->quit || slot->state != CODEC_SLOT_DONE) {
+            virMutexUnlock(&codec->lock);
+            break;
+        }
+        virMutexUnlock(&codec->lock);
+
+        if (compress) {
+            if (VIR_APPEND_ELEMENT_COPY(offsets, noffsets, offset) < 0)
+                goto cleanup;
+
+            memcpy(hdr, CODEC_FRAME_MAGIC, CODEC_MAGIC_LEN);
+            runCodecPutU32(hdr + CODEC_MAGIC_LEN, slot->outlen);
+            runCodecPutU32(hdr + CODEC_MAGIC_LEN + 4, slot->inlen);
+            if (safewrite(STDOUT_FILENO, hdr, sizeof(hdr)) < 0) {
+                virReportSystemError(errno, _("Unable to write %s"), "stdout");
+                goto cleanup;
+            }
+            offset += sizeof(hdr) + slot->outlen;
+        }
+
+        if (safewrite(STDOUT_FILENO, slot->out, slot->outlen) < 0) {
+            virReportSystemError(errno, _("Unable to write %s"), "stdout");
+            goto cleanup;
+        }
+
+        virMutexLock(&codec->lock);
+        slot->state = CODEC_SLOT_FREE;
+        virCondBroadcast(&codec->cond);
+        virMutexUnlock(&codec->lock);
+    }
+
+    if (codec->err == ENOMEM) {
+        virReportOOMError();
+        goto cleanup;
+    } else if (codec->err) {
+        virReportSystemError(codec->err, _("Unable to read %s"), "stdin");
+        goto cleanup;
+    } else if (codec->corrupt) {
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                       _("Compressed stream is corrupted"));
+        goto cleanup;
+    }
+
+    if (compress && runCodecWriteIndex(offsets, noffsets) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virMutexLock(&codec->lock);
+    codec->quit = true;
+    virCondBroadcast(&codec->cond);
+    virMutexUnlock(&codec->lock);
+
+    for (i = 0; i < nstarted; i++)
+        virThreadJoin(&workers[i]);
+    VIR_FREE(workers);
+    VIR_FREE(offsets);
+
+    /* If writing failed the reader may still be stuck reading stdin,
+     * and the process is about to exit anyway, so leave it be. */
+    if (readerStarted) {
+        virMutexLock(&codec->lock);
+        if (!codec->readerDone) {
+            virMutexUnlock(&codec->lock);
+            return ret;
+        }
+        virMutexUnlock(&codec->lock);
+        virThreadJoin(&reader);
+    }
+
+    for (i = 0; codec->slots && i < depth; i++) {
+        VIR_FREE(codec->slots[i].in);
+        VIR_FREE(codec->slots[i].out);
+    }
+    VIR_FREE(codec->slots);
+    virCondDestroy(&codec->cond);
+    virMutexDestroy(&codec->lock);
+    VIR_FREE(codec);
+    return ret;
+}
+#endif /* WITH_ZLIB */
+
 static const char *program_name;
 
 ATTRIBUTE_NORETURN static void
@@ -178,7 +969,16 @@ usage(int status)
     if (status) {
         fprintf(stderr, _("%s: try --help for more details"), program_name);
     } else {
-        printf(_("Usage: %s FILENAME LENGTH FD\n"), program_name);
+        printf(_("Usage: %s [OPTIONS] FILENAME LENGTH FD\n"
+                 "   or: %s [OPTIONS] -c|-d\n"
+                 "\n"
+                 "  -b, --block-size BYTES  size of each I/O request (default %d)\n"
+                 "  -q, --queue-depth N     number of requests in flight (default %d)\n"
+                 "  -c, --compress          compress stdin to stdout\n"
+                 "  -d, --decompress        decompress stdin to stdout\n"
+                 "  -h, --help              display this help and exit\n"),
+               program_name, program_name,
+               IO_HELPER_BUFLEN, IO_HELPER_QUEUE_DEPTH);
     }
     exit(status);
 }
@@ -190,6 +990,19 @@ main(int argc, char **argv)
     unsigned long long length;
     int oflags = -1;
     int fd = -1;
+    unsigned long buflen = IO_HELPER_BUFLEN;
+    unsigned int depth = IO_HELPER_QUEUE_DEPTH;
+    bool compress = false;
+    bool decompress = false;
+
+    struct option opts[] = {
+        { "block-size", required_argument, NULL, 'b' },
+        { "queue-depth", required_argument, NULL, 'q' },
+        { "compress", no_argument, NULL, 'c' },
+        { "decompress", no_argument, NULL, 'd' },
+        { "help", no_argument, NULL, 'h' },
+        {0, 0, 0, 0}
+    };
 
     program_name = argv[0];
 
@@ -200,20 +1013,83 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    path = argv[1];
+    while (1) {
+        int optidx = 0;
+        int c;
+
+        c = getopt_long(argc, argv, "+b:q:cdh", opts, &optidx);
 
-    if (argc > 1 && STREQ(argv[1], "--help"))
-        usage(EXIT_SUCCESS);
-    if (argc == 4) { /* FILENAME LENGTH FD */
-        if (virStrToLong_ull(argv[2], NULL, 10, &length) < 0) {
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'b':
+            if (virStrToLong_ul(optarg, NULL, 10, &buflen) < 0 ||
+                buflen == 0) {
+                fprintf(stderr, _("%s: malformed block size %s\n"),
+                        program_name, optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'q':
+            if (virStrToLong_ui(optarg, NULL, 10, &depth) < 0 ||
+                depth == 0 || depth > IO_HELPER_QUEUE_DEPTH_MAX) {
+                fprintf(stderr, _("%s: queue depth must be between 1 and %d\n"),
+                        program_name, IO_HELPER_QUEUE_DEPTH_MAX);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'c':
+            compress = true;
+            break;
+
+        case 'd':
+            decompress = true;
+            break;
+
+        case 'h':
+            usage(EXIT_SUCCESS);
+
+        case '?':
+        default:
+            usage(EXIT_FAILURE);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+    path = argv[0];
+
+    /* "-dc" is accepted as well, to match the usual compressors */
+    if (compress || decompress) {
+        if (argc != 0)
+            usage(EXIT_FAILURE);
+#if WITH_ZLIB
+        if (runCodec(!decompress, buflen, depth) < 0) {
+            fprintf(stderr, "%s: %s\n",
+                    program_name, virGetLastErrorMessage());
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+#else
+        fprintf(stderr, _("%s: compression is not supported by this build\n"),
+                program_name);
+        exit(EXIT_FAILURE);
+#endif
+    }
+
+    if (argc == 3) { /* FILENAME LENGTH FD */
+        if (virStrToLong_ull(argv[1], NULL, 10, &length) < 0) {
             fprintf(stderr, _("%s: malformed file length %s"),
-                    program_name, argv[2]);
+                    program_name, argv[1]);
             exit(EXIT_FAILURE);
         }
 
-        if (virStrToLong_i(argv[3], NULL, 10, &fd) < 0) {
+        if (virStrToLong_i(argv[2], NULL, 10, &fd) < 0) {
             fprintf(stderr, _("%s: malformed fd %s"),
-                    program_name, argv[3]);
+                    program_name, argv[2]);
             exit(EXIT_FAILURE);
         }
 #ifdef F_GETFL
@@ -234,7 +1110,7 @@ main(int argc, char **argv)
         usage(EXIT_FAILURE);
     }
 
-    if (fd < 0 || runIO(path, fd, oflags, length) < 0)
+    if (fd < 0 || runIO(path, fd, oflags, length, buflen, depth) < 0)
         goto error;
 
     return 0;
@@ -619,3 +619,224 @@ void virDispose(void *ptrptr,
         *countptr = 0;
     errno = save_errno;
 }
+
+
+/* Alignment of allocations handed out by an arena, good enough for any
+ * scalar type, the same as malloc() guarantees on common platforms */
+#define VIR_ALLOC_ARENA_ALIGN (2 * sizeof(void *))
+#define VIR_ALLOC_ARENA_ROUND(n) \
+    (((n) + VIR_ALLOC_ARENA_ALIGN - 1) & ~(VIR_ALLOC_ARENA_ALIGN - 1))
+
+/* Default size of a single arena chunk */
+#define VIR_ALLOC_ARENA_CHUNK_SIZE (16 * 1024)
+
+typedef struct _virAllocArenaChunk virAllocArenaChunk;
+typedef virAllocArenaChunk *virAllocArenaChunkPtr;
+struct _virAllocArenaChunk {
+    virAllocArenaChunkPtr next;
+    size_t size;
+    size_t used;
+    char *data;
+};
+
+struct _virAllocArena {
+    virAllocArenaChunkPtr chunks;
+    size_t chunkSize;
+};
+
+
+/**
+ * virAllocArenaNew:
+ * @chunkSize: how much memory to request from the system at once,
+ *             0 for the default
+ *
+ * Create a new arena (also known as region) allocator. Memory handed out
+ * by the arena can't be freed individually, all of it is released at
+ * once by virAllocArenaFree, which makes the arena suitable for many
+ * small objects sharing the same, short lifetime.
+ *
+ * Returns the new arena or NULL on error (with OOM error reported)
+ */
+virAllocArenaPtr
+virAllocArenaNew(size_t chunkSize)
+{
+    virAllocArenaPtr arena;
+
+    if (VIR_ALLOC(arena) < 0)
+        return NULL;
+
+    arena->chunkSize = chunkSize ? chunkSize : VIR_ALLOC_ARENA_CHUNK_SIZE;
+    return arena;
+}
+
+
+/**
+ * virAllocArenaAddChunk:
+ * @arena: the arena
+ * @size: minimal size of the chunk
+ *
+ * Add a new chunk to @arena. Chunks big enough to be used for more than
+ * the single allocation they were made for become the current one, any
+ * other chunk is put behind it so that space left in the current chunk
+ * is not wasted.
+ *
+ * Returns the new chunk or NULL on failure
+ */
+static virAllocArenaChunkPtr
+virAllocArenaAddChunk(virAllocArenaPtr arena,
+                      size_t size,
+                      bool report,
+                      int domcode,
+                      const char *filename,
+                      const char *funcname,
+                      size_t linenr)
+{
+    virAllocArenaChunkPtr chunk;
+    size_t hdr = VIR_ALLOC_ARENA_ROUND(sizeof(*chunk));
+    bool dedicated = size > arena->chunkSize / 4;
+
+    if (!dedicated)
+        size = arena->chunkSize;
+
+    if (virAllocVar(&chunk, hdr, 1, size,
+                    report, domcode, filename, funcname, linenr) < 0)
+        return NULL;
+
+    chunk->size = size;
+    chunk->data = (char *) chunk + hdr;
+
+    if (dedicated && arena->chunks) {
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+    } else {
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    return chunk;
+}
+
+
+/**
+ * virAllocArenaAllocN:
+ * @arena: the arena to allocate from
+ * @ptrptr: pointer to pointer for address of allocated memory
+ * @size: number of bytes to allocate
+ * @count: number of elements to allocate
+ * @report: whether to report OOM error, if there is one
+ * @domcode: error domain code
+ * @filename: caller's filename
+ * @funcname: caller's funcname
+ * @linenr: caller's line number
+ *
+ * Allocate an array of memory 'count' elements long, each with 'size'
+ * bytes, from @arena. Return the address of the allocated memory in
+ * 'ptrptr'. The newly allocated memory is filled with zeros. It must
+ * not be passed to VIR_FREE or any reallocation function, it belongs
+ * to @arena and is released by virAllocArenaFree. If @report is true,
+ * OOM errors are reported automatically.
+ *
+ * Returns -1 on failure to allocate, zero on success
+ */
+int
+virAllocArenaAllocN(virAllocArenaPtr arena,
+                    void *ptrptr,
+                    size_t size,
+                    size_t count,
+                    bool report,
+                    int domcode,
+                    const char *filename,
+                    const char *funcname,
+                    size_t linenr)
+{
+    virAllocArenaChunkPtr chunk = arena->chunks;
+    size_t need;
+
+    *(void **)ptrptr = NULL;
+
+    if (xalloc_oversized(count, size) ||
+        size * count > SIZE_MAX - VIR_ALLOC_ARENA_ALIGN) {
+        if (report)
+            virReportOOMErrorFull(domcode, filename, funcname, linenr);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    need = VIR_ALLOC_ARENA_ROUND(size * count);
+
+    if (!chunk || chunk->size - chunk->used < need) {
+        if (!(chunk = virAllocArenaAddChunk(arena, need, report, domcode,
+                                            filename, funcname, linenr)))
+            return -1;
+    }
+
+    /* Memory coming from virAllocVar is zeroed already and the arena
+     * never reuses anything, so there's no need to clear it again */
+    *(void **)ptrptr = chunk->data + chunk->used;
+    chunk->used += need;
+    return 0;
+}
+
+
+/**
+ * virAllocArenaStrdup:
+ * @arena: the arena to allocate from
+ * @dest: where to store duplicated string
+ * @src: the source string to duplicate
+ * @report: whether to report OOM error, if there is one
+ * @domcode: error domain code
+ * @filename: caller's filename
+ * @funcname: caller's funcname
+ * @linenr: caller's line number
+ *
+ * Duplicate @src into memory owned by @arena, see virAllocArenaAllocN.
+ *
+ * Returns -1 on failure, 0 if @src was NULL, 1 if @src was copied
+ */
+int
+virAllocArenaStrdup(virAllocArenaPtr arena,
+                    char **dest,
+                    const char *src,
+                    bool report,
+                    int domcode,
+                    const char *filename,
+                    const char *funcname,
+                    size_t linenr)
+{
+    size_t len;
+
+    *dest = NULL;
+    if (!src)
+        return 0;
+
+    len = strlen(src);
+    if (virAllocArenaAllocN(arena, dest, 1, len + 1, report, domcode,
+                            filename, funcname, linenr) < 0)
+        return -1;
+
+    memcpy(*dest, src, len);
+    return 1;
+}
+
+
+/**
+ * virAllocArenaFree:
+ * @arena: the arena
+ *
+ * Release @arena together with all the memory allocated from it.
+ */
+void
+virAllocArenaFree(virAllocArenaPtr arena)
+{
+    virAllocArenaChunkPtr chunk;
+
+    if (!arena)
+        return;
+
+    while ((chunk = arena->chunks)) {
+        arena->chunks = chunk->next;
+        VIR_FREE(chunk);
+    }
+
+    VIR_FREE(arena);
+}
@@ -592,6 +592,71 @@ void virDispose(void *ptrptr, size_t count, size_t element_size, size_t *countpt
                                      sizeof(*(ptr)), NULL)
 
 
+typedef struct _virAllocArena virAllocArena;
+typedef virAllocArena *virAllocArenaPtr;
+
+virAllocArenaPtr virAllocArenaNew(size_t chunkSize);
+void virAllocArenaFree(virAllocArenaPtr arena);
+
+/* Don't call these directly - use the macros below */
+int virAllocArenaAllocN(virAllocArenaPtr arena, void *ptrptr, size_t size,
+                        size_t count, bool report, int domcode,
+                        const char *filename, const char *funcname,
+                        size_t linenr)
+    ATTRIBUTE_RETURN_CHECK ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int virAllocArenaStrdup(virAllocArenaPtr arena, char **dest, const char *src,
+                        bool report, int domcode, const char *filename,
+                        const char *funcname, size_t linenr)
+    ATTRIBUTE_RETURN_CHECK ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+/**
+ * VIR_ARENA_ALLOC:
+ * @arena: arena to allocate from
+ * @ptr: pointer to hold address of allocated memory
+ *
+ * Allocate sizeof(*ptr) bytes of zeroed memory owned by @arena and store
+ * its address in 'ptr'. The memory must not be freed by VIR_FREE, it is
+ * released together with @arena by virAllocArenaFree.
+ *
+ * Returns -1 on failure (with OOM error reported), 0 on success
+ */
+# define VIR_ARENA_ALLOC(arena, ptr) \
+    virAllocArenaAllocN(arena, &(ptr), sizeof(*(ptr)), 1, true, \
+                        VIR_FROM_THIS, __FILE__, __FUNCTION__, __LINE__)
+
+/**
+ * VIR_ARENA_ALLOC_N:
+ * @arena: arena to allocate from
+ * @ptr: pointer to hold address of allocated memory
+ * @count: number of elements to allocate
+ *
+ * Allocate an array of 'count' zeroed elements, each sizeof(*ptr) bytes
+ * long, owned by @arena and store its address in 'ptr'. See
+ * VIR_ARENA_ALLOC.
+ *
+ * Returns -1 on failure (with OOM error reported), 0 on success
+ */
+# define VIR_ARENA_ALLOC_N(arena, ptr, count) \
+    virAllocArenaAllocN(arena, &(ptr), sizeof(*(ptr)), count, true, \
+                        VIR_FROM_THIS, __FILE__, __FUNCTION__, __LINE__)
+
+/**
+ * VIR_ARENA_STRDUP:
+ * @arena: arena to allocate from
+ * @dst: variable to hold result (char*, not char**)
+ * @src: string to duplicate
+ *
+ * Duplicate @src string into memory owned by @arena. See
+ * VIR_ARENA_ALLOC.
+ *
+ * Returns -1 on failure (with OOM error reported), 0 if @src was NULL,
+ * 1 if @src was copied
+ */
+# define VIR_ARENA_STRDUP(arena, dst, src) \
+    virAllocArenaStrdup(arena, &(dst), src, true, VIR_FROM_THIS, \
+                        __FILE__, __FUNCTION__, __LINE__)
+
+
 void virAllocTestInit(void);
 int virAllocTestCount(void);
 void virAllocTestOOM(int n, int m);
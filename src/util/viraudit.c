@@ -33,6 +33,7 @@
 #include "virfile.h"
 #include "viralloc.h"
 #include "virstring.h"
+#include "virthread.h"
 
 VIR_LOG_INIT("util.audit");
 
@@ -52,9 +53,165 @@ VIR_LOG_INIT("util.audit");
 
 #if WITH_AUDIT
 static int auditfd = -1;
+
+/* Sending a record waits for the kernel to acknowledge it, which takes
+ * a while when auditd has a backlog. Records are therefore handed over
+ * to a thread sending them in order, and callers only wait once this
+ * many records are queued, so that none is ever dropped. */
+# define VIR_AUDIT_QUEUE_MAX 1024
+
+typedef struct _virAuditRecord virAuditRecord;
+typedef virAuditRecord *virAuditRecordPtr;
+struct _virAuditRecord {
+    int type;
+    bool success;
+    char *message;
+    char *clienttty;
+    char *clientaddr;
+
+    virAuditRecordPtr next;
+};
+
+static virMutex auditLock = VIR_MUTEX_INITIALIZER;
+static virCond auditQueueCond; /* signalled when a record is queued */
+static virCond auditSpaceCond; /* signalled when a record is dequeued */
+static virThread auditThread;
+static bool auditThreadRunning;
+static bool auditThreadQuit;
+static virAuditRecordPtr auditQueueHead;
+static virAuditRecordPtr auditQueueTail;
+static size_t auditQueueLen;
+static size_t auditQueueMaxLen;
+static unsigned long long auditQueueWaits;
 #endif
 static bool auditlog;
 
+
+#if WITH_AUDIT
+static void
+virAuditRecordFree(virAuditRecordPtr record)
+{
+    if (!record)
+        return;
+
+    VIR_FREE(record->message);
+    VIR_FREE(record->clienttty);
+    VIR_FREE(record->clientaddr);
+    VIR_FREE(record);
+}
+
+
+static void
+virAuditSendRecord(int type,
+                   const char *message,
+                   const char *clienttty,
+                   const char *clientaddr,
+                   bool success)
+{
+    if (audit_log_user_message(auditfd, type, message, NULL,
+                               clientaddr, clienttty, success) < 0) {
+        char ebuf[1024];
+        VIR_WARN("Failed to send audit message %s: %s",
+                 message, virStrerror(errno, ebuf, sizeof(ebuf)));
+    }
+}
+
+
+static void
+virAuditWorker(void *opaque ATTRIBUTE_UNUSED)
+{
+    virMutexLock(&auditLock);
+
+    for (;;) {
+        virAuditRecordPtr record;
+
+        while (!auditQueueHead && !auditThreadQuit) {
+            if (virCondWait(&auditQueueCond, &auditLock) < 0) {
+                VIR_WARN("Unable to wait for audit records");
+                goto cleanup;
+            }
+        }
+
+        /* Drain the queue before quitting, no record may get lost */
+        if (!(record = auditQueueHead))
+            break;
+
+        if (!(auditQueueHead = record->next))
+            auditQueueTail = NULL;
+        auditQueueLen--;
+        virCondBroadcast(&auditSpaceCond);
+
+        virMutexUnlock(&auditLock);
+        virAuditSendRecord(record->type, record->message,
+                           record->clienttty, record->clientaddr,
+                           record->success);
+        virAuditRecordFree(record);
+        virMutexLock(&auditLock);
+    }
+
+ cleanup:
+    virMutexUnlock(&auditLock);
+}
+
+
+/* Returns 0 if the record was queued, -1 if it has to be sent by the
+ * caller, in which case @message stays owned by the caller */
+static int
+virAuditQueueRecord(int type,
+                    char **message,
+                    const char *clienttty,
+                    const char *clientaddr,
+                    bool success)
+{
+    virAuditRecordPtr record;
+    int ret = -1;
+
+    if (VIR_ALLOC_QUIET(record) < 0 ||
+        VIR_STRDUP_QUIET(record->clienttty, clienttty) < 0 ||
+        VIR_STRDUP_QUIET(record->clientaddr, clientaddr) < 0) {
+        virAuditRecordFree(record);
+        return -1;
+    }
+
+    record->type = type;
+    record->success = success;
+
+    virMutexLock(&auditLock);
+
+    if (!auditThreadRunning)
+        goto cleanup;
+
+    while (auditQueueLen >= VIR_AUDIT_QUEUE_MAX && auditThreadRunning) {
+        auditQueueWaits++;
+        if (virCondWait(&auditSpaceCond, &auditLock) < 0)
+            goto cleanup;
+    }
+
+    if (!auditThreadRunning)
+        goto cleanup;
+
+    record->message = *message;
+    *message = NULL;
+    if (auditQueueTail)
+        auditQueueTail->next = record;
+    else
+        auditQueueHead = record;
+    auditQueueTail = record;
+    record = NULL;
+
+    if (++auditQueueLen > auditQueueMaxLen)
+        auditQueueMaxLen = auditQueueLen;
+    virCondSignal(&auditQueueCond);
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&auditLock);
+    virAuditRecordFree(record);
+    return ret;
+}
+#endif
+
+
 int virAuditOpen(void)
 {
 #if WITH_AUDIT
@@ -63,6 +220,23 @@ int virAuditOpen(void)
         return -1;
     }
 
+    if (virCondInit(&auditQueueCond) < 0 ||
+        virCondInit(&auditSpaceCond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize audit condition"));
+        VIR_FORCE_CLOSE(auditfd);
+        return -1;
+    }
+
+    /* Without the thread, records are simply sent synchronously */
+    if (virThreadCreateFull(&auditThread, true, virAuditWorker,
+                            "audit", false, NULL) < 0) {
+        VIR_WARN("Unable to create audit thread, sending synchronously");
+        virResetLastError();
+    } else {
+        auditThreadRunning = true;
+    }
+
     return 0;
 #else
     return -1;
@@ -124,12 +298,10 @@ void virAuditSend(virLogSourcePtr source,
 
         if (type >= ARRAY_CARDINALITY(record_types) || record_types[type] == 0)
             VIR_WARN("Unknown audit record type %d", type);
-        else if (audit_log_user_message(auditfd, record_types[type], str, NULL,
-                                        clientaddr, clienttty, success) < 0) {
-            char ebuf[1024];
-            VIR_WARN("Failed to send audit message %s: %s",
-                     NULLSTR(str), virStrerror(errno, ebuf, sizeof(ebuf)));
-        }
+        else if (virAuditQueueRecord(record_types[type], &str,
+                                     clienttty, clientaddr, success) < 0)
+            virAuditSendRecord(record_types[type], str,
+                               clienttty, clientaddr, success);
     }
 #endif
     VIR_FREE(str);
@@ -138,6 +310,23 @@ void virAuditSend(virLogSourcePtr source,
 void virAuditClose(void)
 {
 #if WITH_AUDIT
+    bool running;
+
+    virMutexLock(&auditLock);
+    running = auditThreadRunning;
+    auditThreadRunning = false;
+    auditThreadQuit = true;
+    virCondBroadcast(&auditQueueCond);
+    virCondBroadcast(&auditSpaceCond);
+    virMutexUnlock(&auditLock);
+
+    /* Let the thread send whatever is still queued */
+    if (running) {
+        virThreadJoin(&auditThread);
+        VIR_DEBUG("Audit queue peaked at %zu records, senders waited "
+                  "%llu times", auditQueueMaxLen, auditQueueWaits);
+    }
+
     VIR_FORCE_CLOSE(auditfd);
 #endif
 }
@@ -34,6 +34,7 @@
 #include "viralloc.h"
 #include "virbuffer.h"
 #include "c-ctype.h"
+#include "count-leading-zeros.h"
 #include "count-one-bits.h"
 #include "virstring.h"
 #include "virerror.h"
@@ -265,6 +266,76 @@ int virBitmapClearBitExpand(virBitmapPtr bitmap, size_t b)
 }
 
 
+/* Helper function. caller must ensure start <= end < bitmap->max_bit */
+static void
+virBitmapUpdateRange(virBitmapPtr bitmap,
+                     size_t start,
+                     size_t end,
+                     bool set)
+{
+    size_t first = VIR_BITMAP_UNIT_OFFSET(start);
+    size_t last = VIR_BITMAP_UNIT_OFFSET(end);
+    size_t i;
+
+    for (i = first; i <= last; i++) {
+        unsigned long mask = -1UL;
+
+        if (i == first)
+            mask &= -1UL << VIR_BITMAP_BIT_OFFSET(start);
+        if (i == last)
+            mask &= -1UL >> (VIR_BITMAP_BITS_PER_UNIT - 1 -
+                             VIR_BITMAP_BIT_OFFSET(end));
+
+        if (set)
+            bitmap->map[i] |= mask;
+        else
+            bitmap->map[i] &= ~mask;
+    }
+}
+
+
+/**
+ * virBitmapSetBitRange:
+ * @bitmap: Pointer to bitmap
+ * @start: first bit position to set
+ * @end: last bit position to set
+ *
+ * Set bit positions @start to @end, both included, in @bitmap a whole
+ * word at a time.
+ *
+ * Returns 0 if the bits are successfully set, -1 on error.
+ */
+int virBitmapSetBitRange(virBitmapPtr bitmap, size_t start, size_t end)
+{
+    if (start > end || bitmap->max_bit <= end)
+        return -1;
+
+    virBitmapUpdateRange(bitmap, start, end, true);
+    return 0;
+}
+
+
+/**
+ * virBitmapClearBitRange:
+ * @bitmap: Pointer to bitmap
+ * @start: first bit position to clear
+ * @end: last bit position to clear
+ *
+ * Clear bit positions @start to @end, both included, in @bitmap a whole
+ * word at a time.
+ *
+ * Returns 0 if the bits are successfully cleared, -1 on error.
+ */
+int virBitmapClearBitRange(virBitmapPtr bitmap, size_t start, size_t end)
+{
+    if (start > end || bitmap->max_bit <= end)
+        return -1;
+
+    virBitmapUpdateRange(bitmap, start, end, false);
+    return 0;
+}
+
+
 /* Helper function. caller must ensure b < bitmap->max_bit */
 static bool virBitmapIsSet(virBitmapPtr bitmap, size_t b)
 {
@@ -357,37 +428,32 @@ char *virBitmapString(virBitmapPtr bitmap)
 char *virBitmapFormat(virBitmapPtr bitmap)
 {
     virBuffer buf = VIR_BUFFER_INITIALIZER;
-    bool first = true;
-    int start, cur, prev;
+    ssize_t start, end;
 
-    if (!bitmap || (cur = virBitmapNextSetBit(bitmap, -1)) < 0) {
+    if (!bitmap || (start = virBitmapNextSetBit(bitmap, -1)) < 0) {
         char *ret;
         ignore_value(VIR_STRDUP(ret, ""));
         return ret;
     }
 
-    start = prev = cur;
-    while (prev >= 0) {
-        cur = virBitmapNextSetBit(bitmap, prev);
-
-        if (cur == prev + 1) {
-            prev = cur;
-            continue;
-        }
+    /* Look for whole runs of set bits instead of visiting each of them */
+    while (start >= 0) {
+        if ((end = virBitmapNextClearBit(bitmap, start)) < 0)
+            end = bitmap->max_bit;
 
-        /* cur < 0 or cur > prev + 1 */
+        if (virBufferUse(&buf))
+            virBufferAddChar(&buf, ',');
 
-        if (!first)
-            virBufferAddLit(&buf, ",");
-        else
-            first = false;
+        virBufferAddLongLong(&buf, start);
+        if (end - 1 != start) {
+            virBufferAddChar(&buf, '-');
+            virBufferAddLongLong(&buf, end - 1);
+        }
 
-        if (prev == start)
-            virBufferAsprintf(&buf, "%d", start);
-        else
-            virBufferAsprintf(&buf, "%d-%d", start, prev);
+        if (end == bitmap->max_bit)
+            break;
 
-        start = prev = cur;
+        start = virBitmapNextSetBit(bitmap, end);
     }
 
     if (virBufferError(&buf)) {
@@ -430,7 +496,6 @@ virBitmapParseSeparator(const char *str,
     bool neg = false;
     const char *cur = str;
     char *tmp;
-    size_t i;
     int start, last;
 
     if (!(*bitmap = virBitmapNew(bitmapSize)))
@@ -490,10 +555,8 @@ virBitmapParseSeparator(const char *str,
 
             cur = tmp;
 
-            for (i = start; i <= last; i++) {
-                if (virBitmapSetBit(*bitmap, i) < 0)
-                    goto error;
-            }
+            if (virBitmapSetBitRange(*bitmap, start, last) < 0)
+                goto error;
 
             virSkipSpaces(&cur);
         }
@@ -564,7 +627,6 @@ virBitmapParseUnlimited(const char *str)
     bool neg = false;
     const char *cur = str;
     char *tmp;
-    size_t i;
     int start, last;
 
     if (!(bitmap = virBitmapNewEmpty()))
@@ -624,10 +686,10 @@ virBitmapParseUnlimited(const char *str)
 
             cur = tmp;
 
-            for (i = start; i <= last; i++) {
-                if (virBitmapSetBitExpand(bitmap, i) < 0)
-                    goto error;
-            }
+            if ((bitmap->max_bit <= last &&
+                 virBitmapExpand(bitmap, last) < 0) ||
+                virBitmapSetBitRange(bitmap, start, last) < 0)
+                goto error;
 
             virSkipSpaces(&cur);
         }
@@ -947,7 +1009,6 @@ virBitmapNextSetBit(virBitmapPtr bitmap, ssize_t pos)
 ssize_t
 virBitmapLastSetBit(virBitmapPtr bitmap)
 {
-    ssize_t i;
     int unusedBits;
     ssize_t sz;
     unsigned long bits;
@@ -977,12 +1038,8 @@ virBitmapLastSetBit(virBitmapPtr bitmap)
     return -1;
 
  found:
-    for (i = VIR_BITMAP_BITS_PER_UNIT - 1; i >= 0; i--) {
-        if (bits & 1UL << i)
-            return i + sz * VIR_BITMAP_BITS_PER_UNIT;
-    }
-
-    return -1;
+    return sz * VIR_BITMAP_BITS_PER_UNIT + VIR_BITMAP_BITS_PER_UNIT - 1 -
+        count_leading_zeros_l(bits);
 }
 
 /**
@@ -59,6 +59,12 @@ int virBitmapSetBit(virBitmapPtr bitmap, size_t b)
 int virBitmapSetBitExpand(virBitmapPtr bitmap, size_t b)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
+/*
+ * Set bit positions @start to @end, both included, in @bitmap
+ */
+int virBitmapSetBitRange(virBitmapPtr bitmap, size_t start, size_t end)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
 
 /*
  * Clear bit position @b in @bitmap
@@ -69,6 +75,12 @@ int virBitmapClearBit(virBitmapPtr bitmap, size_t b)
 int virBitmapClearBitExpand(virBitmapPtr bitmap, size_t b)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
+/*
+ * Clear bit positions @start to @end, both included, in @bitmap
+ */
+int virBitmapClearBitRange(virBitmapPtr bitmap, size_t start, size_t end)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
 /*
  * Get bit @b in @bitmap. Returns false if b is out of range.
  */
@@ -0,0 +1,444 @@
+/*
+ * virbpf.c: methods for eBPF
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "virbpf.h"
+#include "virlog.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.bpf");
+
+/* All the functions below return -1 with errno set on failure and
+ * leave the error reporting to the caller, which knows what the map
+ * or program is for. */
+
+#if HAVE_DECL_BPF_PROG_QUERY
+static int
+virBPFSyscall(int cmd,
+              union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+/**
+ * virBPFCreateMap:
+ * @mapType: type of the map
+ * @keySize: size of the key in bytes
+ * @valSize: size of the value in bytes
+ * @maxEntries: maximum number of elements of the map
+ *
+ * Returns the file descriptor of the new map, -1 on error.
+ */
+int
+virBPFCreateMap(unsigned int mapType,
+                unsigned int keySize,
+                unsigned int valSize,
+                unsigned int maxEntries)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.map_type = mapType;
+    attr.key_size = keySize;
+    attr.value_size = valSize;
+    attr.max_entries = maxEntries;
+
+    return virBPFSyscall(BPF_MAP_CREATE, &attr);
+}
+
+
+/**
+ * virBPFGetMap:
+ * @id: id of an existing map
+ *
+ * Returns the file descriptor of the map @id, -1 on error.
+ */
+int
+virBPFGetMap(unsigned int id)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.map_id = id;
+
+    return virBPFSyscall(BPF_MAP_GET_FD_BY_ID, &attr);
+}
+
+
+/**
+ * virBPFLoadProg:
+ * @insns: the instructions of the program
+ * @progType: type of the program
+ * @insnCnt: number of items in @insns
+ *
+ * Returns the file descriptor of the loaded program, -1 on error.
+ */
+int
+virBPFLoadProg(struct bpf_insn *insns,
+               int progType,
+               unsigned int insnCnt)
+{
+    union bpf_attr attr;
+    int ret;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.prog_type = progType;
+    attr.insn_cnt = insnCnt;
+    attr.insns = (uint64_t)(uintptr_t)insns;
+    attr.license = (uint64_t)(uintptr_t)"GPL";
+
+    if ((ret = virBPFSyscall(BPF_PROG_LOAD, &attr)) < 0)
+        VIR_DEBUG("Loading %u instructions of type %d failed: errno=%d",
+                  insnCnt, progType, errno);
+
+    return ret;
+}
+
+
+int
+virBPFAttachProg(int progfd,
+                 int targetfd,
+                 int attachType)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.target_fd = targetfd;
+    attr.attach_bpf_fd = progfd;
+    attr.attach_type = attachType;
+
+    return virBPFSyscall(BPF_PROG_ATTACH, &attr);
+}
+
+
+int
+virBPFDetachProg(int progfd,
+                 int targetfd,
+                 int attachType)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.target_fd = targetfd;
+    attr.attach_bpf_fd = progfd;
+    attr.attach_type = attachType;
+
+    return virBPFSyscall(BPF_PROG_DETACH, &attr);
+}
+
+
+/**
+ * virBPFQueryProg:
+ * @targetfd: file descriptor of the target, a cgroup directory
+ * @maxprogids: number of items @progids can hold
+ * @attachType: type of the attachment
+ * @progcnt: returns the number of programs attached
+ * @progids: returns the ids of the programs attached
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virBPFQueryProg(int targetfd,
+                unsigned int maxprogids,
+                int attachType,
+                unsigned int *progcnt,
+                void *progids)
+{
+    union bpf_attr attr;
+    int ret;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.query.target_fd = targetfd;
+    attr.query.attach_type = attachType;
+    attr.query.prog_cnt = maxprogids;
+    attr.query.prog_ids = (uint64_t)(uintptr_t)progids;
+
+    ret = virBPFSyscall(BPF_PROG_QUERY, &attr);
+
+    if (ret >= 0)
+        *progcnt = attr.query.prog_cnt;
+
+    return ret;
+}
+
+
+/**
+ * virBPFGetProg:
+ * @id: id of an existing program
+ *
+ * Returns the file descriptor of the program @id, -1 on error.
+ */
+int
+virBPFGetProg(unsigned int id)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.prog_id = id;
+
+    return virBPFSyscall(BPF_PROG_GET_FD_BY_ID, &attr);
+}
+
+
+/**
+ * virBPFGetProgMapID:
+ * @progfd: file descriptor of a program
+ * @mapID: returns the id of the map used by the program
+ *
+ * Returns 0 on success, -1 on error. A program which uses no map or
+ * several of them is reported with ENOENT.
+ */
+int
+virBPFGetProgMapID(int progfd,
+                   unsigned int *mapID)
+{
+    struct bpf_prog_info info;
+    union bpf_attr attr;
+    unsigned int id = 0;
+
+    memset(&info, 0, sizeof(info));
+    memset(&attr, 0, sizeof(attr));
+
+    info.nr_map_ids = 1;
+    info.map_ids = (uint64_t)(uintptr_t)&id;
+
+    attr.info.bpf_fd = progfd;
+    attr.info.info_len = sizeof(info);
+    attr.info.info = (uint64_t)(uintptr_t)&info;
+
+    if (virBPFSyscall(BPF_OBJ_GET_INFO_BY_FD, &attr) < 0)
+        return -1;
+
+    if (info.nr_map_ids != 1) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    *mapID = id;
+    return 0;
+}
+
+
+int
+virBPFLookupElem(int mapfd,
+                 void *key,
+                 void *val)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.map_fd = mapfd;
+    attr.key = (uint64_t)(uintptr_t)key;
+    attr.value = (uint64_t)(uintptr_t)val;
+
+    return virBPFSyscall(BPF_MAP_LOOKUP_ELEM, &attr);
+}
+
+
+/**
+ * virBPFGetNextElem:
+ * @mapfd: file descriptor of a map
+ * @key: the current key, or NULL for the first one
+ * @nextKey: returns the key following @key
+ *
+ * Returns 0 on success, -1 with errno set to ENOENT after the last
+ * key or to something else on error.
+ */
+int
+virBPFGetNextElem(int mapfd,
+                  void *key,
+                  void *nextKey)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.map_fd = mapfd;
+    attr.key = (uint64_t)(uintptr_t)key;
+    attr.next_key = (uint64_t)(uintptr_t)nextKey;
+
+    return virBPFSyscall(BPF_MAP_GET_NEXT_KEY, &attr);
+}
+
+
+int
+virBPFUpdateElem(int mapfd,
+                 void *key,
+                 void *val)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.map_fd = mapfd;
+    attr.key = (uint64_t)(uintptr_t)key;
+    attr.value = (uint64_t)(uintptr_t)val;
+
+    return virBPFSyscall(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+
+int
+virBPFDeleteElem(int mapfd,
+                 void *key)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+
+    attr.map_fd = mapfd;
+    attr.key = (uint64_t)(uintptr_t)key;
+
+    return virBPFSyscall(BPF_MAP_DELETE_ELEM, &attr);
+}
+#else /* !HAVE_DECL_BPF_PROG_QUERY */
+int
+virBPFCreateMap(unsigned int mapType ATTRIBUTE_UNUSED,
+                unsigned int keySize ATTRIBUTE_UNUSED,
+                unsigned int valSize ATTRIBUTE_UNUSED,
+                unsigned int maxEntries ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int
+virBPFGetMap(unsigned int id ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int
+virBPFLoadProg(struct bpf_insn *insns ATTRIBUTE_UNUSED,
+               int progType ATTRIBUTE_UNUSED,
+               unsigned int insnCnt ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int
+virBPFAttachProg(int progfd ATTRIBUTE_UNUSED,
+                 int targetfd ATTRIBUTE_UNUSED,
+                 int attachType ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int
+virBPFDetachProg(int progfd ATTRIBUTE_UNUSED,
+                 int targetfd ATTRIBUTE_UNUSED,
+                 int attachType ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int
+virBPFQueryProg(int targetfd ATTRIBUTE_UNUSED,
+                unsigned int maxprogids ATTRIBUTE_UNUSED,
+                int attachType ATTRIBUTE_UNUSED,
+                unsigned int *progcnt ATTRIBUTE_UNUSED,
+                void *progids ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int
+virBPFGetProg(unsigned int id ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int
+virBPFGetProgMapID(int progfd ATTRIBUTE_UNUSED,
+                   unsigned int *mapID ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int
+virBPFLookupElem(int mapfd ATTRIBUTE_UNUSED,
+                 void *key ATTRIBUTE_UNUSED,
+                 void *val ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int
+virBPFGetNextElem(int mapfd ATTRIBUTE_UNUSED,
+                  void *key ATTRIBUTE_UNUSED,
+                  void *nextKey ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int
+virBPFUpdateElem(int mapfd ATTRIBUTE_UNUSED,
+                 void *key ATTRIBUTE_UNUSED,
+                 void *val ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+
+int
+virBPFDeleteElem(int mapfd ATTRIBUTE_UNUSED,
+                 void *key ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+#endif /* !HAVE_DECL_BPF_PROG_QUERY */
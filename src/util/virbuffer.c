@@ -27,6 +27,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include "c-ctype.h"
+#include "intprops.h"
 
 #define __VIR_BUFFER_C__
 
@@ -137,7 +138,7 @@ virBufferGetIndent(const virBuffer *buf, bool dynamic)
 static int
 virBufferGrow(virBufferPtr buf, unsigned int len)
 {
-    int size;
+    unsigned int size;
 
     if (buf->error)
         return -1;
@@ -145,8 +146,18 @@ virBufferGrow(virBufferPtr buf, unsigned int len)
     if ((len + buf->use) < buf->size)
         return 0;
 
+    if (len > UINT_MAX - 1000 - buf->use) {
+        virBufferSetError(buf, ENOMEM);
+        return -1;
+    }
+
     size = buf->use + len + 1000;
 
+    /* Grow geometrically so that building a large document out of many
+     * small chunks doesn't reallocate (and copy) it over and over */
+    if (buf->size <= UINT_MAX / 2 && size < buf->size * 2)
+        size = buf->size * 2;
+
     if (VIR_REALLOC_N_QUIET(buf->content, size) < 0) {
         virBufferSetError(buf, errno);
         return -1;
@@ -155,6 +166,31 @@ virBufferGrow(virBufferPtr buf, unsigned int len)
     return 0;
 }
 
+/**
+ * virBufferAddRaw:
+ * @buf: the buffer to append to
+ * @str: the string
+ * @len: the number of bytes to add
+ *
+ * Add a string range to a buffer without applying auto indentation.
+ * The buffer content is allocated even if @len is zero.
+ */
+static void
+virBufferAddRaw(virBufferPtr buf, const char *str, size_t len)
+{
+    if (len >= UINT_MAX) {
+        virBufferSetError(buf, ENOMEM);
+        return;
+    }
+
+    if (virBufferGrow(buf, len + 1) < 0)
+        return;
+
+    memcpy(&buf->content[buf->use], str, len);
+    buf->use += len;
+    buf->content[buf->use] = '\0';
+}
+
 /**
  * virBufferAdd:
  * @buf: the buffer to append to
@@ -242,6 +278,56 @@ virBufferAddChar(virBufferPtr buf, char c)
     virBufferAdd(buf, &c, 1);
 }
 
+/**
+ * virBufferAddULongLong:
+ * @buf: the buffer to append to
+ * @val: the number to add
+ *
+ * Add the decimal representation of @val to a buffer, which is the same
+ * as virBufferAsprintf(buf, "%llu", val) but avoids the printf machinery.
+ * Auto indentation may be applied.
+ */
+void
+virBufferAddULongLong(virBufferPtr buf, unsigned long long val)
+{
+    char str[INT_BUFSIZE_BOUND(val)];
+    char *p = str + sizeof(str);
+
+    do {
+        *--p = '0' + val % 10;
+        val /= 10;
+    } while (val);
+
+    virBufferAdd(buf, p, str + sizeof(str) - p);
+}
+
+/**
+ * virBufferAddLongLong:
+ * @buf: the buffer to append to
+ * @val: the number to add
+ *
+ * Add the decimal representation of @val to a buffer, which is the same
+ * as virBufferAsprintf(buf, "%lld", val) but avoids the printf machinery.
+ * Auto indentation may be applied.
+ */
+void
+virBufferAddLongLong(virBufferPtr buf, long long val)
+{
+    char str[INT_BUFSIZE_BOUND(val)];
+    char *p = str + sizeof(str);
+    unsigned long long uval = val < 0 ? -(unsigned long long) val : val;
+
+    do {
+        *--p = '0' + uval % 10;
+        uval /= 10;
+    } while (uval);
+
+    if (val < 0)
+        *--p = '-';
+
+    virBufferAdd(buf, p, str + sizeof(str) - p);
+}
+
 /**
  * virBufferCurrentContent:
  * @buf: Buffer
@@ -441,6 +527,73 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
 VIR_WARNINGS_NO_WLOGICALOP_STRCHR
 
 
+/* Characters which can't be put into XML verbatim */
+static const char virBufferXMLForbiddenChars[] = {
+    0x01,   0x02,   0x03,   0x04,   0x05,   0x06,   0x07,   0x08,
+    /*\t*/  /*\n*/  0x0B,   0x0C,   /*\r*/  0x0E,   0x0F,   0x10,
+    0x11,   0x12,   0x13,   0x14,   0x15,   0x16,   0x17,   0x18,
+    0x19,   '"',    '&',    '\'',   '<',    '>',
+    '\0'
+};
+
+/**
+ * virBufferEscapeXMLChars:
+ * @out: where to store the escaped string
+ * @str: the string to escape
+ *
+ * Copy @str into @out replacing the characters with a special meaning
+ * in XML by entities and silently dropping the control characters. The
+ * @out array must have room for at least six times the length of @str.
+ * No terminating NUL is written.
+ *
+ * Returns the number of bytes written to @out.
+ */
+static size_t
+virBufferEscapeXMLChars(char *out, const char *str)
+{
+    char *start = out;
+    const char *cur;
+
+    for (cur = str; *cur; cur++) {
+        switch (*cur) {
+        case '<':
+            memcpy(out, "&lt;", 4);
+            out += 4;
+            break;
+        case '>':
+            memcpy(out, "&gt;", 4);
+            out += 4;
+            break;
+        case '&':
+            memcpy(out, "&amp;", 5);
+            out += 5;
+            break;
+        case '"':
+            memcpy(out, "&quot;", 6);
+            out += 6;
+            break;
+        case '\'':
+            memcpy(out, "&apos;", 6);
+            out += 6;
+            break;
+        default:
+            /*
+             * Note that character over 0x80 are likely to give problem
+             * with UTF-8 XML, but since our string don't have an encoding
+             * it's hard to handle properly we have to assume it's UTF-8 too
+             */
+            if ((unsigned char) *cur > 0x19 ||
+                *cur == '\t' || *cur == '\n' || *cur == '\r')
+                *out++ = *cur;
+            /* else silently ignore control characters */
+            break;
+        }
+    }
+
+    return out - start;
+}
+
+
 /**
  * virBufferEscapeString:
  * @buf: the buffer to append to
@@ -455,16 +608,9 @@ VIR_WARNINGS_NO_WLOGICALOP_STRCHR
 void
 virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
 {
-    int len;
-    char *escaped, *out;
-    const char *cur;
-    const char forbidden_characters[] = {
-        0x01,   0x02,   0x03,   0x04,   0x05,   0x06,   0x07,   0x08,
-        /*\t*/  /*\n*/  0x0B,   0x0C,   /*\r*/  0x0E,   0x0F,   0x10,
-        0x11,   0x12,   0x13,   0x14,   0x15,   0x16,   0x17,   0x18,
-        0x19,   '"',    '&',    '\'',   '<',    '>',
-        '\0'
-    };
+    size_t len;
+    char *escaped;
+    const char *arg;
 
     if ((format == NULL) || (buf == NULL) || (str == NULL))
         return;
@@ -473,7 +619,32 @@ virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
         return;
 
     len = strlen(str);
-    if (strcspn(str, forbidden_characters) == len) {
+
+    /* The common case of @format containing just the one %s doesn't need
+     * printf, nor a temporary copy: the pieces are put into @buf directly */
+    if ((arg = strchr(format, '%')) && arg[1] == 's' &&
+        !strchr(arg + 2, '%')) {
+        virBufferAddLit(buf, ""); /* auto-indent */
+        virBufferAddRaw(buf, format, arg - format);
+
+        if (strcspn(str, virBufferXMLForbiddenChars) == len) {
+            virBufferAddRaw(buf, str, len);
+        } else {
+            if (len > (UINT_MAX - 1) / 6) {
+                virBufferSetError(buf, ENOMEM);
+                return;
+            }
+            if (virBufferGrow(buf, 6 * len + 1) < 0)
+                return;
+            buf->use += virBufferEscapeXMLChars(&buf->content[buf->use], str);
+            buf->content[buf->use] = '\0';
+        }
+
+        virBufferAddRaw(buf, arg + 2, strlen(arg + 2));
+        return;
+    }
+
+    if (strcspn(str, virBufferXMLForbiddenChars) == len) {
         virBufferAsprintf(buf, format, str);
         return;
     }
@@ -484,53 +655,7 @@ virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
         return;
     }
 
-    cur = str;
-    out = escaped;
-    while (*cur != 0) {
-        if (*cur == '<') {
-            *out++ = '&';
-            *out++ = 'l';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '>') {
-            *out++ = '&';
-            *out++ = 'g';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '&') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'm';
-            *out++ = 'p';
-            *out++ = ';';
-        } else if (*cur == '"') {
-            *out++ = '&';
-            *out++ = 'q';
-            *out++ = 'u';
-            *out++ = 'o';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '\'') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'p';
-            *out++ = 'o';
-            *out++ = 's';
-            *out++ = ';';
-        } else if (!strchr(forbidden_characters, *cur)) {
-            /*
-             * default case, just copy !
-             * Note that character over 0x80 are likely to give problem
-             * with UTF-8 XML, but since our string don't have an encoding
-             * it's hard to handle properly we have to assume it's UTF-8 too
-             */
-            *out++ = *cur;
-        } else {
-            /* silently ignore control characters */
-        }
-        cur++;
-    }
-    *out = 0;
+    escaped[virBufferEscapeXMLChars(escaped, str)] = '\0';
 
     virBufferAsprintf(buf, format, escaped);
     VIR_FREE(escaped);
@@ -582,6 +707,22 @@ virBufferEscape(virBufferPtr buf, char escape, const char *toescape,
     if (buf->error)
         return;
 
+    /* Without any formatting or indentation involved the string can
+     * go straight into the buffer, which is what most callers do for
+     * each field of a QEMU command line */
+    if (STREQ(format, "%s") && !buf->indent) {
+        while (*str) {
+            len = strcspn(str, toescape);
+            virBufferAdd(buf, str, len);
+            str += len;
+            if (*str) {
+                char pair[2] = { escape, *str++ };
+                virBufferAdd(buf, pair, 2);
+            }
+        }
+        return;
+    }
+
     len = strlen(str);
     if (strcspn(str, toescape) == len) {
         virBufferAsprintf(buf, format, str);
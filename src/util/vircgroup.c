@@ -48,6 +48,7 @@
 
 #define __VIR_CGROUP_ALLOW_INCLUDE_PRIV_H__
 #include "vircgrouppriv.h"
+#include "vircgroupv2devices.h"
 
 #include "virutil.h"
 #include "viralloc.h"
@@ -61,6 +62,9 @@
 #include "virtypedparam.h"
 #include "virhostcpu.h"
 #include "virthread.h"
+#include "viratomic.h"
+#include "virtime.h"
+#include "c-ctype.h"
 
 VIR_LOG_INIT("util.cgroup");
 
@@ -87,6 +91,7 @@ typedef enum {
                                        * before creating subcgroups and
                                        * attaching tasks
                                        */
+    VIR_CGROUP_THREAD = 1 << 1, /* group of threads of one process */
 } virCgroupFlags;
 
 
@@ -145,9 +150,10 @@ virCgroupAvailable(void)
 
     while (getmntent_r(mounts, &entry, buf, sizeof(buf)) != NULL) {
         /* We're looking for at least one 'cgroup' fs mount,
-         * which is *not* a named mount. */
-        if (STREQ(entry.mnt_type, "cgroup") &&
-            !strstr(entry.mnt_opts, "name=")) {
+         * which is *not* a named mount, or the unified hierarchy. */
+        if ((STREQ(entry.mnt_type, "cgroup") &&
+             !strstr(entry.mnt_opts, "name=")) ||
+            STREQ(entry.mnt_type, "cgroup2")) {
             ret = true;
             break;
         }
@@ -353,6 +359,9 @@ virCgroupCopyMounts(virCgroupPtr group,
                     virCgroupPtr parent)
 {
     size_t i;
+
+    group->unified = parent->unified;
+
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         if (!parent->controllers[i].mountPoint)
             continue;
@@ -369,9 +378,26 @@ virCgroupCopyMounts(virCgroupPtr group,
 }
 
 
+/* Controllers which live in the unified hierarchy of cgroup v2, all
+ * of them are backed by the files of the one group directory */
+static const int virCgroupUnifiedControllers[] = {
+    VIR_CGROUP_CONTROLLER_CPU,
+    VIR_CGROUP_CONTROLLER_CPUACCT,
+    VIR_CGROUP_CONTROLLER_CPUSET,
+    VIR_CGROUP_CONTROLLER_MEMORY,
+    VIR_CGROUP_CONTROLLER_DEVICES,
+    VIR_CGROUP_CONTROLLER_FREEZER,
+    VIR_CGROUP_CONTROLLER_BLKIO,
+    VIR_CGROUP_CONTROLLER_SYSTEMD,
+};
+
+
 /*
  * Process /proc/mounts figuring out what controllers are
- * mounted and where
+ * mounted and where.  If no v1 controller is mounted, the
+ * controllers are provided by the cgroup v2 unified hierarchy,
+ * if any.  On hybrid hosts with both the v1 controllers take
+ * precedence and the v2 mount is ignored.
  */
 int
 virCgroupDetectMountsFromFile(virCgroupPtr group,
@@ -382,6 +408,8 @@ virCgroupDetectMountsFromFile(virCgroupPtr group,
     FILE *mounts = NULL;
     struct mntent entry;
     char buf[CGROUP_MAX_VAL];
+    char *unifiedMount = NULL;
+    bool legacy = false;
 
     mounts = fopen(path, "r");
     if (mounts == NULL) {
@@ -390,9 +418,18 @@ virCgroupDetectMountsFromFile(virCgroupPtr group,
     }
 
     while (getmntent_r(mounts, &entry, buf, sizeof(buf)) != NULL) {
+        if (STREQ(entry.mnt_type, "cgroup2")) {
+            if (!unifiedMount &&
+                VIR_STRDUP(unifiedMount, entry.mnt_dir) < 0)
+                goto error;
+            continue;
+        }
+
         if (STRNEQ(entry.mnt_type, "cgroup"))
             continue;
 
+        legacy = true;
+
         for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
             const char *typestr = virCgroupControllerTypeToString(i);
             int typelen = strlen(typestr);
@@ -463,11 +500,24 @@ virCgroupDetectMountsFromFile(virCgroupPtr group,
         }
     }
 
+    if (!legacy && unifiedMount) {
+        for (i = 0; i < ARRAY_CARDINALITY(virCgroupUnifiedControllers); i++) {
+            int type = virCgroupUnifiedControllers[i];
+
+            if (VIR_STRDUP(group->controllers[type].mountPoint,
+                           unifiedMount) < 0)
+                goto error;
+        }
+        group->unified = true;
+    }
+
+    VIR_FREE(unifiedMount);
     VIR_FORCE_FCLOSE(mounts);
 
     return 0;
 
  error:
+    VIR_FREE(unifiedMount);
     VIR_FORCE_FCLOSE(mounts);
     return -1;
 }
@@ -479,6 +529,64 @@ virCgroupDetectMounts(virCgroupPtr group)
 }
 
 
+/* Names of the cgroup v2 controllers providing the virCgroupController
+ * of the same index.  The others are backed by the core files every
+ * group has, or by a BPF program for devices. */
+static const char *const virCgroupUnifiedControllerNames[VIR_CGROUP_CONTROLLER_LAST] = {
+    [VIR_CGROUP_CONTROLLER_CPU] = "cpu",
+    [VIR_CGROUP_CONTROLLER_CPUSET] = "cpuset",
+    [VIR_CGROUP_CONTROLLER_MEMORY] = "memory",
+    [VIR_CGROUP_CONTROLLER_BLKIO] = "io",
+};
+
+
+/*
+ * Drop the controllers of the unified @group which are not listed in
+ * the cgroup.controllers file of the directory @dir.
+ */
+static int
+virCgroupDetectUnifiedControllers(virCgroupPtr group,
+                                  const char *dir)
+{
+    char *path = NULL;
+    char *str = NULL;
+    char **names = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/cgroup.controllers", dir) < 0)
+        goto cleanup;
+
+    if (virFileReadAll(path, 1024, &str) < 0)
+        goto cleanup;
+
+    virStringTrimOptionalNewline(str);
+
+    if (!(names = virStringSplit(str, " ", 0)))
+        goto cleanup;
+
+    for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
+        const char *name = virCgroupUnifiedControllerNames[i];
+
+        if (!name || !group->controllers[i].mountPoint)
+            continue;
+
+        if (!virStringListHasString((const char **) names, name)) {
+            VIR_DEBUG("Controller '%s' is not available in %s", name, dir);
+            VIR_FREE(group->controllers[i].mountPoint);
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStringListFree(names);
+    VIR_FREE(str);
+    VIR_FREE(path);
+    return ret;
+}
+
+
 static int
 virCgroupCopyPlacement(virCgroupPtr group,
                        const char *path,
@@ -582,6 +690,33 @@ virCgroupDetectPlacement(virCgroupPtr group,
         controllers++;
         selfpath++;
 
+        /* The unified hierarchy is listed as "0::/path", where the
+         * path applies to all of its controllers at once */
+        if (group->unified) {
+            if (STRNEQ(controllers, ""))
+                continue;
+
+            for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
+                if (!group->controllers[i].mountPoint ||
+                    group->controllers[i].placement)
+                    continue;
+
+                if (i == VIR_CGROUP_CONTROLLER_SYSTEMD) {
+                    if (VIR_STRDUP(group->controllers[i].placement,
+                                   selfpath) < 0)
+                        goto cleanup;
+                } else {
+                    if (virAsprintf(&group->controllers[i].placement,
+                                    "%s%s%s", selfpath,
+                                    (STREQ(selfpath, "/") ||
+                                     STREQ(path, "") ? "" : "/"),
+                                    path) < 0)
+                        goto cleanup;
+                }
+            }
+            continue;
+        }
+
         for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
             const char *typestr = virCgroupControllerTypeToString(i);
             int typelen = strlen(typestr);
@@ -652,6 +787,18 @@ virCgroupDetect(virCgroupPtr group,
     } else {
         if (virCgroupDetectMounts(group) < 0)
             return -1;
+
+        if (group->unified) {
+            const char *mount = group->controllers[VIR_CGROUP_CONTROLLER_SYSTEMD].mountPoint;
+
+            if (virCgroupDetectUnifiedControllers(group, mount) < 0)
+                return -1;
+
+            if (!virCgroupV2DevicesAvailable(mount)) {
+                VIR_DEBUG("Device control is not available in %s", mount);
+                VIR_FREE(group->controllers[VIR_CGROUP_CONTROLLER_DEVICES].mountPoint);
+            }
+        }
     }
 
     if (controllers >= 0) {
@@ -675,8 +822,9 @@ virCgroupDetect(virCgroupPtr group,
             if (!((1 << i) & controllers) &&
                 group->controllers[i].mountPoint) {
                 /* Check whether a request to disable a controller
-                 * clashes with co-mounting of controllers */
-                for (j = 0; j < VIR_CGROUP_CONTROLLER_LAST; j++) {
+                 * clashes with co-mounting of controllers, the ones
+                 * of the unified hierarchy are enabled one by one */
+                for (j = 0; j < VIR_CGROUP_CONTROLLER_LAST && !group->unified; j++) {
                     if (j == i)
                         continue;
                     if (!((1 << j) & controllers))
@@ -779,6 +927,58 @@ virCgroupGetBlockDevString(const char *path)
 }
 
 
+/*
+ * Write @value to @key relative to the directory descriptor of
+ * @controller which is opened on first use in a batch, so that the
+ * cgroup path is resolved once per controller rather than per write.
+ *
+ * Returns 0 on success, -1 with errno set on a failed write and 1 if
+ * the write has to go through the full path instead.
+ */
+static int
+virCgroupBatchWrite(virCgroupPtr group,
+                    int controller,
+                    const char *key,
+                    const char *value)
+{
+    struct virCgroupBatch *batch = group->batch;
+    char *dirpath = NULL;
+    int fd;
+
+    if (controller < 0 || controller >= VIR_CGROUP_CONTROLLER_LAST)
+        return 1;
+
+    if (batch->dirfds[controller] < 0) {
+        if (virCgroupPathOfController(group, controller, "", &dirpath) < 0) {
+            virResetLastError();
+            return 1;
+        }
+
+        batch->dirfds[controller] = open(dirpath,
+                                         O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        VIR_FREE(dirpath);
+        if (batch->dirfds[controller] < 0)
+            return 1;
+    }
+
+    if ((fd = openat(batch->dirfds[controller], key,
+                     O_WRONLY | O_TRUNC | O_CLOEXEC)) < 0)
+        return -1;
+
+    if (safewrite(fd, value, strlen(value)) < 0) {
+        VIR_FORCE_CLOSE(fd);
+        return -1;
+    }
+
+    /* Use errno from failed close only if there was no write error.  */
+    if (VIR_CLOSE(fd) != 0)
+        return -1;
+
+    batch->nwrites++;
+    return 0;
+}
+
+
 static int
 virCgroupSetValueStr(virCgroupPtr group,
                      int controller,
@@ -786,14 +986,29 @@ virCgroupSetValueStr(virCgroupPtr group,
                      const char *value)
 {
     int ret = -1;
+    int rc = 1;
+    int err;
     char *keypath = NULL;
     char *tmp = NULL;
 
+    if (group->batch &&
+        (rc = virCgroupBatchWrite(group, controller, key, value)) == 0) {
+        VIR_DEBUG("Set value '%s' of controller %d to '%s'",
+                  key, controller, value);
+        return 0;
+    }
+
+    err = errno;
     if (virCgroupPathOfController(group, controller, key, &keypath) < 0)
         return -1;
+    errno = err;
 
-    VIR_DEBUG("Set value '%s' to '%s'", keypath, value);
-    if (virFileWriteStr(keypath, value, 0) < 0) {
+    if (rc > 0) {
+        VIR_DEBUG("Set value '%s' to '%s'", keypath, value);
+        rc = virFileWriteStr(keypath, value, 0);
+    }
+
+    if (rc < 0) {
         if (errno == EINVAL &&
             (tmp = strrchr(keypath, '/'))) {
             virReportSystemError(errno,
@@ -814,6 +1029,184 @@ virCgroupSetValueStr(virCgroupPtr group,
 }
 
 
+/* Files which are read every time the statistics of a domain are
+ * collected.  Their descriptors are kept open in the virCgroup and the
+ * contents are reread with pread(), which makes cgroupfs regenerate
+ * them, instead of resolving the path again on every read. */
+static const char *const virCgroupStatFiles[] = {
+    "cpuacct.usage",
+    "cpuacct.usage_percpu",
+    "cpuacct.stat",
+    "blkio.throttle.io_service_bytes",
+    "blkio.throttle.io_serviced",
+    "cpu.stat",
+    "io.stat",
+};
+
+/* Limit of descriptors kept open by all virCgroup objects together so
+ * that hosts with many large guests don't run out of descriptors;
+ * files beyond the limit are opened on every read. */
+#define VIR_CGROUP_STAT_FILES_MAX 1024
+
+static int virCgroupStatFilesOpen;
+
+#define VIR_CGROUP_STAT_FILE_SIZE_MAX (1024 * 1024)
+
+
+static bool
+virCgroupIsStatFile(const char *key)
+{
+    const char *name = strrchr(key, '/');
+    size_t i;
+
+    name = name ? name + 1 : key;
+
+    for (i = 0; i < ARRAY_CARDINALITY(virCgroupStatFiles); i++) {
+        if (STREQ(name, virCgroupStatFiles[i]))
+            return true;
+    }
+
+    return false;
+}
+
+
+static void
+virCgroupStatFileClose(virCgroupPtr group,
+                       size_t idx)
+{
+    VIR_FORCE_CLOSE(group->statFiles[idx].fd);
+    VIR_FREE(group->statFiles[idx].key);
+    VIR_DELETE_ELEMENT(group->statFiles, idx, group->nstatFiles);
+    virAtomicIntAdd(&virCgroupStatFilesOpen, -1);
+}
+
+
+static void
+virCgroupStatFilesFree(virCgroupPtr group)
+{
+    while (group->nstatFiles)
+        virCgroupStatFileClose(group, group->nstatFiles - 1);
+}
+
+
+/*
+ * Returns the index of the cached descriptor of @key in @group, or -1
+ * if the file is not cached: *@fd is then a descriptor the caller has
+ * to close.  Returns -2 on error.
+ */
+static ssize_t
+virCgroupStatFileOpen(virCgroupPtr group,
+                      int controller,
+                      const char *key,
+                      const char *keypath,
+                      int *fd)
+{
+    struct virCgroupStatFile file = { controller, NULL, -1 };
+    size_t i;
+
+    for (i = 0; i < group->nstatFiles; i++) {
+        if (group->statFiles[i].controller == controller &&
+            STREQ(group->statFiles[i].key, key)) {
+            *fd = group->statFiles[i].fd;
+            return i;
+        }
+    }
+
+    VIR_DEBUG("Opening %s", keypath);
+
+    if ((*fd = open(keypath, O_RDONLY | O_CLOEXEC)) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to read from '%s'"), keypath);
+        return -2;
+    }
+
+    if (virAtomicIntInc(&virCgroupStatFilesOpen) > VIR_CGROUP_STAT_FILES_MAX) {
+        virAtomicIntAdd(&virCgroupStatFilesOpen, -1);
+        return -1;
+    }
+
+    file.fd = *fd;
+    if (VIR_STRDUP(file.key, key) < 0 ||
+        VIR_APPEND_ELEMENT(group->statFiles, group->nstatFiles, file) < 0) {
+        VIR_FREE(file.key);
+        virAtomicIntAdd(&virCgroupStatFilesOpen, -1);
+        return -1;
+    }
+
+    return group->nstatFiles - 1;
+}
+
+
+static int
+virCgroupGetStatFileStr(virCgroupPtr group,
+                        int controller,
+                        const char *key,
+                        const char *keypath,
+                        char **value)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    size_t len = 0;
+    ssize_t idx;
+    ssize_t got;
+    bool retried = false;
+    int fd = -1;
+    int ret = -1;
+
+ reopen:
+    if ((idx = virCgroupStatFileOpen(group, controller, key,
+                                     keypath, &fd)) == -2)
+        goto cleanup;
+
+    len = 0;
+    while (true) {
+        if (size - len < 2) {
+            if (size >= VIR_CGROUP_STAT_FILE_SIZE_MAX) {
+                virReportSystemError(EFBIG,
+                                     _("Unable to read from '%s'"), keypath);
+                goto cleanup;
+            }
+            if (VIR_REALLOC_N(buf, size ? size * 2 : 4096) < 0)
+                goto cleanup;
+            size = size ? size * 2 : 4096;
+        }
+
+        if ((got = pread(fd, buf + len, size - len - 1, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            /* the descriptor may refer to a removed and recreated
+             * cgroup, try again with a fresh one */
+            if (idx >= 0 && !retried) {
+                virCgroupStatFileClose(group, idx);
+                fd = -1;
+                retried = true;
+                goto reopen;
+            }
+            virReportSystemError(errno,
+                                 _("Unable to read from '%s'"), keypath);
+            goto cleanup;
+        }
+
+        len += got;
+
+        /* cgroupfs fills the whole buffer unless it hit the end */
+        if (got == 0 || len < size - 1)
+            break;
+    }
+
+    buf[len] = '\0';
+    *value = buf;
+    buf = NULL;
+    ret = len;
+
+ cleanup:
+    if (idx < 0)
+        VIR_FORCE_CLOSE(fd);
+    VIR_FREE(buf);
+    return ret;
+}
+
+
 static int
 virCgroupGetValueStr(virCgroupPtr group,
                      int controller,
@@ -830,7 +1223,11 @@ virCgroupGetValueStr(virCgroupPtr group,
 
     VIR_DEBUG("Get value %s", keypath);
 
-    if ((rc = virFileReadAll(keypath, 1024*1024, value)) < 0) {
+    if (virCgroupIsStatFile(key)) {
+        if ((rc = virCgroupGetStatFileStr(group, controller, key,
+                                          keypath, value)) < 0)
+            goto cleanup;
+    } else if ((rc = virFileReadAll(keypath, 1024*1024, value)) < 0) {
         virReportSystemError(errno,
                              _("Unable to read from '%s'"), keypath);
         goto cleanup;
@@ -848,6 +1245,55 @@ virCgroupGetValueStr(virCgroupPtr group,
 }
 
 
+/*
+ * Parse the unsigned decimal number at *@pos, skipping leading
+ * whitespace, and advance *@pos past it.  This is a cheaper
+ * replacement of virStrToLong_ull for the long lists of numbers in
+ * the statistics files.
+ *
+ * Returns 0 on success, -1 if there is no number or it overflows.
+ */
+static int
+virCgroupParseU64(char **pos,
+                  unsigned long long *value)
+{
+    char *p = *pos;
+    unsigned long long ret = 0;
+
+    while (*p == ' ' || *p == '\t' || *p == '\n')
+        p++;
+
+    if (!c_isdigit(*p))
+        return -1;
+
+    for (; c_isdigit(*p); p++) {
+        unsigned int digit = *p - '0';
+
+        if (ret > (ULLONG_MAX - digit) / 10)
+            return -1;
+        ret = ret * 10 + digit;
+    }
+
+    *value = ret;
+    *pos = p;
+    return 0;
+}
+
+
+static int
+virCgroupParseI64(char **pos,
+                  long long *value)
+{
+    unsigned long long tmp;
+
+    if (virCgroupParseU64(pos, &tmp) < 0 || tmp > LLONG_MAX)
+        return -1;
+
+    *value = tmp;
+    return 0;
+}
+
+
 static int
 virCgroupGetValueForBlkDev(virCgroupPtr group,
                            int controller,
@@ -1036,6 +1482,112 @@ virCgroupSetMemoryUseHierarchy(virCgroupPtr group)
 }
 
 
+/*
+ * Returns a controller of the unified @group whose placement is the
+ * directory of the group, or -1 if there is none.
+ */
+static int
+virCgroupUnifiedController(virCgroupPtr group)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
+        if (i == VIR_CGROUP_CONTROLLER_SYSTEMD)
+            continue;
+
+        if (group->controllers[i].mountPoint)
+            return i;
+    }
+
+    return -1;
+}
+
+
+/*
+ * The unified hierarchy has a single directory for all controllers of
+ * a group.  The controllers of the group have to be enabled in the
+ * cgroup.subtree_control file of its parent; the ones which can't be,
+ * usually because an ancestor doesn't provide them, are dropped in
+ * the same way as a v1 controller missing on the host.  For threads
+ * the group is made threaded first, which restricts it to the
+ * threaded controllers cpu and cpuset.
+ */
+static int
+virCgroupMakeUnifiedGroup(virCgroupPtr parent,
+                          virCgroupPtr group,
+                          bool create,
+                          unsigned int flags)
+{
+    char *path = NULL;
+    char *subtree = NULL;
+    char *value = NULL;
+    int controller = virCgroupUnifiedController(group);
+    int parentController = virCgroupUnifiedController(parent);
+    size_t i;
+    int ret = -1;
+
+    if (controller < 0) {
+        VIR_DEBUG("No controllers left for group %s", group->path);
+        return 0;
+    }
+
+    if (virCgroupPathOfController(group, controller, "", &path) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Make unified group %s", path);
+    if (!virFileExists(path)) {
+        if (!create) {
+            virReportSystemError(ENOENT, _("Failed to find cgroup %s"), path);
+            goto cleanup;
+        }
+        if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+            virReportSystemError(errno, _("Failed to create cgroup %s"), path);
+            goto cleanup;
+        }
+    }
+
+    if (flags & VIR_CGROUP_THREAD) {
+        if (virCgroupSetValueStr(group, controller,
+                                 "cgroup.type", "threaded") < 0)
+            goto cleanup;
+        group->threaded = true;
+    }
+
+    if (parentController >= 0 &&
+        virCgroupPathOfController(parent, parentController,
+                                  "cgroup.subtree_control", &subtree) < 0)
+        goto cleanup;
+
+    for (i = 0; subtree && i < VIR_CGROUP_CONTROLLER_LAST; i++) {
+        const char *name = virCgroupUnifiedControllerNames[i];
+
+        if (!name || !group->controllers[i].mountPoint)
+            continue;
+
+        if (virAsprintf(&value, "+%s", name) < 0)
+            goto cleanup;
+
+        if (virFileWriteStr(subtree, value, 0) < 0) {
+            VIR_DEBUG("Unable to enable controller '%s' in %s: errno=%d",
+                      name, subtree, errno);
+            VIR_FREE(group->controllers[i].mountPoint);
+        }
+        VIR_FREE(value);
+    }
+
+    if (virCgroupDetectUnifiedControllers(group, path) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(value);
+    VIR_FREE(subtree);
+    VIR_FREE(path);
+    return ret;
+}
+
+
 static int
 virCgroupMakeGroup(virCgroupPtr parent,
                    virCgroupPtr group,
@@ -1046,6 +1598,9 @@ virCgroupMakeGroup(virCgroupPtr parent,
     int ret = -1;
 
     VIR_DEBUG("Make group %s", group->path);
+
+    if (group->unified)
+        return virCgroupMakeUnifiedGroup(parent, group, create, flags);
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         char *path = NULL;
 
@@ -1160,6 +1715,8 @@ virCgroupNew(pid_t pid,
     if (VIR_ALLOC((*group)) < 0)
         goto error;
 
+    (*group)->devicesMapFd = -1;
+
     if (path[0] == '/' || !parent) {
         if (VIR_STRDUP((*group)->path, path) < 0)
             goto error;
@@ -1184,12 +1741,46 @@ virCgroupNew(pid_t pid,
 }
 
 
+/*
+ * Returns the name of the file of @group which tasks are written to
+ * in order to move them into the group, or read from to list the
+ * threads in the group.
+ */
+static const char *
+virCgroupGetTasksFile(virCgroupPtr group,
+                      bool write)
+{
+    if (!group->unified)
+        return "tasks";
+
+    /* Threaded groups take thread IDs, the others move processes,
+     * while cgroup.threads lists the threads of any group */
+    if (write && !group->threaded)
+        return "cgroup.procs";
+    return "cgroup.threads";
+}
+
+
 static int
 virCgroupAddTaskInternal(virCgroupPtr group, pid_t pid, bool withSystemd)
 {
     int ret = -1;
     size_t i;
 
+    /* Adding the task to any controller of the unified hierarchy adds
+     * it to all of them, including systemd's */
+    if (group->unified) {
+        int controller = virCgroupUnifiedController(group);
+
+        if (controller < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("No controllers are mounted"));
+            return -1;
+        }
+
+        return virCgroupAddTaskController(group, pid, controller);
+    }
+
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         /* Skip over controllers not mounted */
         if (!group->controllers[i].mountPoint)
@@ -1270,7 +1861,8 @@ virCgroupAddTaskController(virCgroupPtr group, pid_t pid, int controller)
         return -1;
     }
 
-    return virCgroupSetValueI64(group, controller, "tasks", pid);
+    return virCgroupSetValueI64(group, controller,
+                                virCgroupGetTasksFile(group, true), pid);
 }
 
 
@@ -1506,7 +2098,7 @@ virCgroupNewThread(virCgroupPtr domain,
     if (virCgroupNew(-1, name, domain, controllers, group) < 0)
         goto cleanup;
 
-    if (virCgroupMakeGroup(domain, *group, create, VIR_CGROUP_NONE) < 0) {
+    if (virCgroupMakeGroup(domain, *group, create, VIR_CGROUP_THREAD) < 0) {
         virCgroupRemove(*group);
         virCgroupFree(group);
         goto cleanup;
@@ -1572,6 +2164,7 @@ virCgroupNewMachineSystemd(const char *name,
                            int *nicindexes,
                            const char *partition,
                            int controllers,
+                           virSystemdMachineRequestPtr request,
                            virCgroupPtr *group)
 {
     int ret = -1;
@@ -1581,15 +2174,19 @@ virCgroupNewMachineSystemd(const char *name,
     char *offset;
 
     VIR_DEBUG("Trying to setup machine '%s' via systemd", name);
-    if ((rv = virSystemdCreateMachine(name,
-                                      drivername,
-                                      uuid,
-                                      rootdir,
-                                      pidleader,
-                                      isContainer,
-                                      nnicindexes,
-                                      nicindexes,
-                                      partition)) < 0)
+    if (request)
+        rv = virSystemdCreateMachineWait(request);
+    else
+        rv = virSystemdCreateMachine(name,
+                                     drivername,
+                                     uuid,
+                                     rootdir,
+                                     pidleader,
+                                     isContainer,
+                                     nnicindexes,
+                                     nicindexes,
+                                     partition);
+    if (rv < 0)
         return rv;
 
     if (controllers != -1)
@@ -1724,6 +2321,11 @@ virCgroupNewMachineManual(const char *name,
 }
 
 
+/*
+ * @request is the registration with systemd-machined started earlier by
+ * virSystemdCreateMachineStart() with the same arguments, or NULL to
+ * register the machine right away. It stays owned by the caller.
+ */
 int
 virCgroupNewMachine(const char *name,
                     const char *drivername,
@@ -1735,6 +2337,7 @@ virCgroupNewMachine(const char *name,
                     int *nicindexes,
                     const char *partition,
                     int controllers,
+                    virSystemdMachineRequestPtr request,
                     virCgroupPtr *group)
 {
     int rv;
@@ -1751,6 +2354,7 @@ virCgroupNewMachine(const char *name,
                                          nicindexes,
                                          partition,
                                          controllers,
+                                         request,
                                          group)) == 0)
         return 0;
 
@@ -1793,17 +2397,104 @@ virCgroupFree(virCgroupPtr *group)
     if (*group == NULL)
         return;
 
+    if ((*group)->batch) {
+        (*group)->batch->depth = 1;
+        virCgroupBatchEnd(*group);
+    }
+
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         VIR_FREE((*group)->controllers[i].mountPoint);
         VIR_FREE((*group)->controllers[i].linkPoint);
         VIR_FREE((*group)->controllers[i].placement);
     }
 
+    virCgroupStatFilesFree(*group);
+    virCgroupV2DevicesClose(*group);
     VIR_FREE((*group)->path);
     VIR_FREE(*group);
 }
 
 
+/**
+ * virCgroupBatchBegin:
+ *
+ * @group: The group to write to
+ *
+ * Start a batch of writes to the files of @group, which resolves the
+ * directory of each controller once and opens the files relative to
+ * it.  Writes are still done immediately, so errors are reported by
+ * the setter which caused them.  Batches may be nested, each call
+ * must be paired with virCgroupBatchEnd.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virCgroupBatchBegin(virCgroupPtr group)
+{
+    struct virCgroupBatch *batch;
+    size_t i;
+
+    if (group->batch) {
+        group->batch->depth++;
+        return 0;
+    }
+
+    if (VIR_ALLOC(batch) < 0)
+        return -1;
+
+    batch->depth = 1;
+    for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++)
+        batch->dirfds[i] = -1;
+    ignore_value(virTimeMillisNow(&batch->start));
+
+    group->batch = batch;
+    return 0;
+}
+
+
+/**
+ * virCgroupBatchGetWrites:
+ *
+ * @group: The group to query
+ *
+ * Returns the count of files written since the outermost
+ * virCgroupBatchBegin, or 0 if no batch is in progress.
+ */
+size_t
+virCgroupBatchGetWrites(virCgroupPtr group)
+{
+    return group->batch ? group->batch->nwrites : 0;
+}
+
+
+/**
+ * virCgroupBatchEnd:
+ *
+ * @group: The group to finish the batch of
+ *
+ * Finish a batch of writes started by virCgroupBatchBegin.
+ */
+void
+virCgroupBatchEnd(virCgroupPtr group)
+{
+    struct virCgroupBatch *batch = group->batch;
+    unsigned long long now = 0;
+    size_t i;
+
+    if (!batch || --batch->depth > 0)
+        return;
+
+    ignore_value(virTimeMillisNow(&now));
+    VIR_DEBUG("Batch of %zu writes to cgroup %s took %llu ms",
+              batch->nwrites, group->path, now - batch->start);
+
+    for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++)
+        VIR_FORCE_CLOSE(batch->dirfds[i]);
+
+    VIR_FREE(group->batch);
+}
+
+
 /**
  * virCgroupHasController: query whether a cgroup controller is present
  *
@@ -1875,6 +2566,226 @@ virCgroupPathOfController(virCgroupPtr group,
 }
 
 
+/*
+ * Parse the value of @key in @line, a list of "key=value" pairs as
+ * found in the io.stat and io.max files of cgroup v2.  A missing key
+ * and the value "max" are returned as 0.
+ */
+static int
+virCgroupUnifiedParseIOKey(const char *line,
+                           const char *key,
+                           unsigned long long *value)
+{
+    const char *tmp = line;
+    size_t len = strlen(key);
+
+    *value = 0;
+
+    while ((tmp = strchr(tmp, ' '))) {
+        char *end;
+
+        tmp++;
+        if (!STRPREFIX(tmp, key) || tmp[len] != '=')
+            continue;
+
+        tmp += len + 1;
+        if (STRPREFIX(tmp, "max"))
+            return 0;
+
+        if (virStrToLong_ull(tmp, &end, 10, value) < 0 ||
+            (*end != ' ' && *end != '\0' && *end != '\n')) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unable to parse '%s' of '%s'"), key, line);
+            return -1;
+        }
+        return 0;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Fetch the bytes and requests read and written from a line of the
+ * io.stat file of cgroup v2, "MAJ:MIN rbytes=N wbytes=N rios=N ..."
+ */
+static int
+virCgroupUnifiedParseIOStat(const char *line,
+                            long long *bytes_read,
+                            long long *bytes_write,
+                            long long *requests_read,
+                            long long *requests_write)
+{
+    const char *keys[] = { "rbytes", "wbytes", "rios", "wios" };
+    long long *values[] = { bytes_read, bytes_write,
+                            requests_read, requests_write };
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(keys); i++) {
+        unsigned long long tmp;
+
+        if (virCgroupUnifiedParseIOKey(line, keys[i], &tmp) < 0)
+            return -1;
+
+        if (tmp > LLONG_MAX - *values[i]) {
+            virReportError(VIR_ERR_OVERFLOW,
+                           _("Sum of %s stat overflows"), keys[i]);
+            return -1;
+        }
+        *values[i] += tmp;
+    }
+
+    return 0;
+}
+
+
+static int
+virCgroupUnifiedGetBlkioIoServiced(virCgroupPtr group,
+                                   const char *path,
+                                   long long *bytes_read,
+                                   long long *bytes_write,
+                                   long long *requests_read,
+                                   long long *requests_write)
+{
+    char *str = NULL;
+    char *prefix = NULL;
+    char **lines = NULL;
+    bool found = false;
+    size_t i;
+    int ret = -1;
+
+    *bytes_read = 0;
+    *bytes_write = 0;
+    *requests_read = 0;
+    *requests_write = 0;
+
+    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_BLKIO,
+                             "io.stat", &str) < 0)
+        goto cleanup;
+
+    if (path && !(prefix = virCgroupGetBlockDevString(path)))
+        goto cleanup;
+
+    if (!(lines = virStringSplit(str, "\n", 0)))
+        goto cleanup;
+
+    for (i = 0; lines[i]; i++) {
+        if (prefix && !STRPREFIX(lines[i], prefix))
+            continue;
+
+        if (virCgroupUnifiedParseIOStat(lines[i], bytes_read, bytes_write,
+                                        requests_read, requests_write) < 0)
+            goto cleanup;
+        found = true;
+    }
+
+    if (prefix && !found) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Cannot find stats for block device '%s'"),
+                       prefix);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStringListFree(lines);
+    VIR_FREE(prefix);
+    VIR_FREE(str);
+    return ret;
+}
+
+
+/* Limits of io.max are given as "MAJ:MIN key=value", 0 means no limit */
+static int
+virCgroupUnifiedSetBlkioDeviceMax(virCgroupPtr group,
+                                  const char *path,
+                                  const char *key,
+                                  unsigned long long value)
+{
+    char *str = NULL;
+    char *blkstr = NULL;
+    int ret = -1;
+
+    if (!(blkstr = virCgroupGetBlockDevString(path)))
+        return -1;
+
+    if ((value == 0 &&
+         virAsprintf(&str, "%s%s=max", blkstr, key) < 0) ||
+        (value > 0 &&
+         virAsprintf(&str, "%s%s=%llu", blkstr, key, value) < 0))
+        goto cleanup;
+
+    ret = virCgroupSetValueStr(group, VIR_CGROUP_CONTROLLER_BLKIO,
+                               "io.max", str);
+
+ cleanup:
+    VIR_FREE(blkstr);
+    VIR_FREE(str);
+    return ret;
+}
+
+
+static int
+virCgroupUnifiedGetBlkioDeviceMax(virCgroupPtr group,
+                                  const char *path,
+                                  const char *key,
+                                  unsigned long long *value)
+{
+    char *str = NULL;
+    int ret = -1;
+
+    if (virCgroupGetValueForBlkDev(group, VIR_CGROUP_CONTROLLER_BLKIO,
+                                   "io.max", path, &str) < 0)
+        goto cleanup;
+
+    if (!str)
+        *value = 0;
+    else if (virCgroupUnifiedParseIOKey(str, key, value) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+}
+
+
+static int
+virCgroupUnifiedGetBlkioDeviceMaxUI(virCgroupPtr group,
+                                    const char *path,
+                                    const char *key,
+                                    unsigned int *value)
+{
+    unsigned long long tmp;
+
+    if (virCgroupUnifiedGetBlkioDeviceMax(group, path, key, &tmp) < 0)
+        return -1;
+
+    /* Limits which don't fit are as good as no limit */
+    *value = tmp > UINT_MAX ? 0 : tmp;
+    return 0;
+}
+
+
+/* The io.weight of cgroup v2 ranges 1-10000 with a default of 100, the
+ * blkio.weight of v1 10-1000 with a default of 500.  The weights are
+ * scaled between the two the same way systemd does. */
+static unsigned long long
+virCgroupUnifiedBlkioWeightToIO(unsigned int weight)
+{
+    return MIN(MAX(weight / 5, 1), 10000);
+}
+
+
+static unsigned int
+virCgroupUnifiedIOWeightToBlkio(unsigned long long weight)
+{
+    return MIN(weight * 5, 1000);
+}
+
+
 /**
  * virCgroupGetBlkioIoServiced:
  *
@@ -1911,6 +2822,12 @@ virCgroupGetBlkioIoServiced(virCgroupPtr group,
         requests_write
     };
 
+    if (group->unified)
+        return virCgroupUnifiedGetBlkioIoServiced(group, NULL,
+                                                  bytes_read, bytes_write,
+                                                  requests_read,
+                                                  requests_write);
+
     *bytes_read = 0;
     *bytes_write = 0;
     *requests_read = 0;
@@ -1933,7 +2850,7 @@ virCgroupGetBlkioIoServiced(virCgroupPtr group,
 
         while ((p1 = strstr(p1, value_names[i]))) {
             p1 += strlen(value_names[i]);
-            if (virStrToLong_ll(p1, &p1, 10, &stats_val) < 0) {
+            if (virCgroupParseI64(&p1, &stats_val) < 0) {
                 virReportError(VIR_ERR_INTERNAL_ERROR,
                                _("Cannot parse byte %sstat '%s'"),
                                value_names[i],
@@ -1954,7 +2871,7 @@ virCgroupGetBlkioIoServiced(virCgroupPtr group,
 
         while ((p2 = strstr(p2, value_names[i]))) {
             p2 += strlen(value_names[i]);
-            if (virStrToLong_ll(p2, &p2, 10, &stats_val) < 0) {
+            if (virCgroupParseI64(&p2, &stats_val) < 0) {
                 virReportError(VIR_ERR_INTERNAL_ERROR,
                                _("Cannot parse %srequest stat '%s'"),
                                value_names[i],
@@ -2020,6 +2937,12 @@ virCgroupGetBlkioIoDeviceServiced(virCgroupPtr group,
         requests_write
     };
 
+    if (group->unified)
+        return virCgroupUnifiedGetBlkioIoServiced(group, path,
+                                                  bytes_read, bytes_write,
+                                                  requests_read,
+                                                  requests_write);
+
     if (virCgroupGetValueStr(group,
                              VIR_CGROUP_CONTROLLER_BLKIO,
                              "blkio.throttle.io_service_bytes", &str1) < 0)
@@ -2098,6 +3021,20 @@ virCgroupGetBlkioIoDeviceServiced(virCgroupPtr group,
 int
 virCgroupSetBlkioWeight(virCgroupPtr group, unsigned int weight)
 {
+    if (group->unified) {
+        char *str = NULL;
+        int ret;
+
+        if (virAsprintf(&str, "default %llu",
+                        virCgroupUnifiedBlkioWeightToIO(weight)) < 0)
+            return -1;
+
+        ret = virCgroupSetValueStr(group, VIR_CGROUP_CONTROLLER_BLKIO,
+                                   "io.weight", str);
+        VIR_FREE(str);
+        return ret;
+    }
+
     return virCgroupSetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_BLKIO,
                                 "blkio.weight",
@@ -2118,6 +3055,28 @@ virCgroupGetBlkioWeight(virCgroupPtr group, unsigned int *weight)
 {
     unsigned long long tmp;
     int ret;
+
+    if (group->unified) {
+        char *str = NULL;
+        char *p;
+
+        if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_BLKIO,
+                                 "io.weight", &str) < 0)
+            return -1;
+
+        if (!(p = STRSKIP(str, "default ")) ||
+            virCgroupParseU64(&p, &tmp) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unable to parse io.weight '%s'"), str);
+            VIR_FREE(str);
+            return -1;
+        }
+
+        *weight = virCgroupUnifiedIOWeightToBlkio(tmp);
+        VIR_FREE(str);
+        return 0;
+    }
+
     ret = virCgroupGetValueU64(group,
                                VIR_CGROUP_CONTROLLER_BLKIO,
                                "blkio.weight", &tmp);
@@ -2143,6 +3102,9 @@ virCgroupSetBlkioDeviceReadIops(virCgroupPtr group,
     char *blkstr = NULL;
     int ret = -1;
 
+    if (group->unified)
+        return virCgroupUnifiedSetBlkioDeviceMax(group, path, "riops", riops);
+
     if (!(blkstr = virCgroupGetBlockDevString(path)))
         return -1;
 
@@ -2177,6 +3139,9 @@ virCgroupSetBlkioDeviceWriteIops(virCgroupPtr group,
     char *blkstr = NULL;
     int ret = -1;
 
+    if (group->unified)
+        return virCgroupUnifiedSetBlkioDeviceMax(group, path, "wiops", wiops);
+
     if (!(blkstr = virCgroupGetBlockDevString(path)))
         return -1;
 
@@ -2211,6 +3176,9 @@ virCgroupSetBlkioDeviceReadBps(virCgroupPtr group,
     char *blkstr = NULL;
     int ret = -1;
 
+    if (group->unified)
+        return virCgroupUnifiedSetBlkioDeviceMax(group, path, "rbps", rbps);
+
     if (!(blkstr = virCgroupGetBlockDevString(path)))
         return -1;
 
@@ -2244,6 +3212,9 @@ virCgroupSetBlkioDeviceWriteBps(virCgroupPtr group,
     char *blkstr = NULL;
     int ret = -1;
 
+    if (group->unified)
+        return virCgroupUnifiedSetBlkioDeviceMax(group, path, "wbps", wbps);
+
     if (!(blkstr = virCgroupGetBlockDevString(path)))
         return -1;
 
@@ -2282,6 +3253,21 @@ virCgroupSetBlkioDeviceWeight(virCgroupPtr group,
     if (!(blkstr = virCgroupGetBlockDevString(path)))
         return -1;
 
+    if (group->unified) {
+        if ((weight == 0 &&
+             virAsprintf(&str, "%sdefault", blkstr) < 0) ||
+            (weight > 0 &&
+             virAsprintf(&str, "%s%llu", blkstr,
+                         virCgroupUnifiedBlkioWeightToIO(weight)) < 0))
+            goto error;
+
+        ret = virCgroupSetValueStr(group,
+                                   VIR_CGROUP_CONTROLLER_BLKIO,
+                                   "io.weight",
+                                   str);
+        goto error;
+    }
+
     if (virAsprintf(&str, "%s%d", blkstr, weight) < 0)
         goto error;
 
@@ -2311,6 +3297,9 @@ virCgroupGetBlkioDeviceReadIops(virCgroupPtr group,
     char *str = NULL;
     int ret = -1;
 
+    if (group->unified)
+        return virCgroupUnifiedGetBlkioDeviceMaxUI(group, path, "riops", riops);
+
     if (virCgroupGetValueForBlkDev(group,
                                    VIR_CGROUP_CONTROLLER_BLKIO,
                                    "blkio.throttle.read_iops_device",
@@ -2349,6 +3338,9 @@ virCgroupGetBlkioDeviceWriteIops(virCgroupPtr group,
     char *str = NULL;
     int ret = -1;
 
+    if (group->unified)
+        return virCgroupUnifiedGetBlkioDeviceMaxUI(group, path, "wiops", wiops);
+
     if (virCgroupGetValueForBlkDev(group,
                                    VIR_CGROUP_CONTROLLER_BLKIO,
                                    "blkio.throttle.write_iops_device",
@@ -2387,6 +3379,9 @@ virCgroupGetBlkioDeviceReadBps(virCgroupPtr group,
     char *str = NULL;
     int ret = -1;
 
+    if (group->unified)
+        return virCgroupUnifiedGetBlkioDeviceMax(group, path, "rbps", rbps);
+
     if (virCgroupGetValueForBlkDev(group,
                                    VIR_CGROUP_CONTROLLER_BLKIO,
                                    "blkio.throttle.read_bps_device",
@@ -2425,6 +3420,9 @@ virCgroupGetBlkioDeviceWriteBps(virCgroupPtr group,
     char *str = NULL;
     int ret = -1;
 
+    if (group->unified)
+        return virCgroupUnifiedGetBlkioDeviceMax(group, path, "wbps", wbps);
+
     if (virCgroupGetValueForBlkDev(group,
                                    VIR_CGROUP_CONTROLLER_BLKIO,
                                    "blkio.throttle.write_bps_device",
@@ -2465,6 +3463,7 @@ virCgroupGetBlkioDeviceWeight(virCgroupPtr group,
 
     if (virCgroupGetValueForBlkDev(group,
                                    VIR_CGROUP_CONTROLLER_BLKIO,
+                                   group->unified ? "io.weight" :
                                    "blkio.weight_device",
                                    path,
                                    &str) < 0)
@@ -2472,6 +3471,16 @@ virCgroupGetBlkioDeviceWeight(virCgroupPtr group,
 
     if (!str) {
         *weight = 0;
+    } else if (group->unified) {
+        unsigned long long tmp;
+        char *p = strchr(str, ' ');
+
+        if (!p || virCgroupParseU64(&p, &tmp) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unable to parse io.weight '%s'"), str);
+            goto error;
+        }
+        *weight = virCgroupUnifiedIOWeightToBlkio(tmp);
     } else if (virStrToLong_ui(str, NULL, 10, weight) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Unable to parse '%s' as an integer"),
@@ -2531,6 +3540,55 @@ virCgroupGetMemoryUnlimitedKB(void)
 }
 
 
+/* The limits of cgroup v2 use "max" rather than a huge number to mean
+ * unlimited */
+static int
+virCgroupUnifiedSetMemoryLimit(virCgroupPtr group,
+                               const char *key,
+                               unsigned long long kb)
+{
+    if (kb == VIR_DOMAIN_MEMORY_PARAM_UNLIMITED)
+        return virCgroupSetValueStr(group, VIR_CGROUP_CONTROLLER_MEMORY,
+                                    key, "max");
+
+    return virCgroupSetValueU64(group, VIR_CGROUP_CONTROLLER_MEMORY,
+                                key, kb << 10);
+}
+
+
+static int
+virCgroupUnifiedGetMemoryLimit(virCgroupPtr group,
+                               const char *key,
+                               unsigned long long *kb)
+{
+    char *str = NULL;
+    unsigned long long bytes;
+    int ret = -1;
+
+    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_MEMORY,
+                             key, &str) < 0)
+        return -1;
+
+    if (STREQ(str, "max")) {
+        *kb = VIR_DOMAIN_MEMORY_PARAM_UNLIMITED;
+    } else if (virStrToLong_ull(str, NULL, 10, &bytes) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to parse '%s' as an integer"), str);
+        goto cleanup;
+    } else {
+        *kb = bytes >> 10;
+        if (*kb >= VIR_DOMAIN_MEMORY_PARAM_UNLIMITED)
+            *kb = VIR_DOMAIN_MEMORY_PARAM_UNLIMITED;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+}
+
+
 /**
  * virCgroupSetMemory:
  *
@@ -2551,6 +3609,9 @@ virCgroupSetMemory(virCgroupPtr group, unsigned long long kb)
         return -1;
     }
 
+    if (group->unified)
+        return virCgroupUnifiedSetMemoryLimit(group, "memory.max", kb);
+
     if (kb == maxkb)
         return virCgroupSetValueI64(group,
                                     VIR_CGROUP_CONTROLLER_MEMORY,
@@ -2579,6 +3640,7 @@ virCgroupGetMemoryUsage(virCgroupPtr group, unsigned long *kb)
     int ret;
     ret = virCgroupGetValueU64(group,
                                VIR_CGROUP_CONTROLLER_MEMORY,
+                               group->unified ? "memory.current" :
                                "memory.usage_in_bytes", &usage_in_bytes);
     if (ret == 0)
         *kb = (unsigned long) usage_in_bytes >> 10;
@@ -2614,6 +3676,9 @@ virCgroupGetMemoryHardLimit(virCgroupPtr group, unsigned long long *kb)
 {
     long long unsigned int limit_in_bytes;
 
+    if (group->unified)
+        return virCgroupUnifiedGetMemoryLimit(group, "memory.max", kb);
+
     if (virCgroupGetValueU64(group,
                              VIR_CGROUP_CONTROLLER_MEMORY,
                              "memory.limit_in_bytes", &limit_in_bytes) < 0)
@@ -2647,6 +3712,12 @@ virCgroupSetMemorySoftLimit(virCgroupPtr group, unsigned long long kb)
         return -1;
     }
 
+    /* memory.high throttles and reclaims above the limit rather than
+     * only under global memory pressure, which is the closest cgroup v2
+     * gets to a soft limit */
+    if (group->unified)
+        return virCgroupUnifiedSetMemoryLimit(group, "memory.high", kb);
+
     if (kb == maxkb)
         return virCgroupSetValueI64(group,
                                     VIR_CGROUP_CONTROLLER_MEMORY,
@@ -2673,6 +3744,9 @@ virCgroupGetMemorySoftLimit(virCgroupPtr group, unsigned long long *kb)
 {
     long long unsigned int limit_in_bytes;
 
+    if (group->unified)
+        return virCgroupUnifiedGetMemoryLimit(group, "memory.high", kb);
+
     if (virCgroupGetValueU64(group,
                              VIR_CGROUP_CONTROLLER_MEMORY,
                              "memory.soft_limit_in_bytes", &limit_in_bytes) < 0)
@@ -2706,6 +3780,23 @@ virCgroupSetMemSwapHardLimit(virCgroupPtr group, unsigned long long kb)
         return -1;
     }
 
+    /* cgroup v2 limits the swap alone rather than memory plus swap, so
+     * subtract the memory limit which has to be set first */
+    if (group->unified) {
+        unsigned long long memkb;
+
+        if (kb != maxkb) {
+            if (virCgroupUnifiedGetMemoryLimit(group, "memory.max",
+                                               &memkb) < 0)
+                return -1;
+
+            if (memkb != maxkb)
+                kb = kb > memkb ? kb - memkb : 0;
+        }
+
+        return virCgroupUnifiedSetMemoryLimit(group, "memory.swap.max", kb);
+    }
+
     if (kb == maxkb)
         return virCgroupSetValueI64(group,
                                     VIR_CGROUP_CONTROLLER_MEMORY,
@@ -2732,6 +3823,22 @@ virCgroupGetMemSwapHardLimit(virCgroupPtr group, unsigned long long *kb)
 {
     long long unsigned int limit_in_bytes;
 
+    if (group->unified) {
+        unsigned long long memkb;
+
+        if (virCgroupUnifiedGetMemoryLimit(group, "memory.swap.max", kb) < 0 ||
+            virCgroupUnifiedGetMemoryLimit(group, "memory.max", &memkb) < 0)
+            return -1;
+
+        if (*kb != VIR_DOMAIN_MEMORY_PARAM_UNLIMITED) {
+            if (memkb == VIR_DOMAIN_MEMORY_PARAM_UNLIMITED)
+                *kb = VIR_DOMAIN_MEMORY_PARAM_UNLIMITED;
+            else
+                *kb = MIN(*kb + memkb, VIR_DOMAIN_MEMORY_PARAM_UNLIMITED);
+        }
+        return 0;
+    }
+
     if (virCgroupGetValueU64(group,
                              VIR_CGROUP_CONTROLLER_MEMORY,
                              "memory.memsw.limit_in_bytes", &limit_in_bytes) < 0)
@@ -2758,6 +3865,20 @@ virCgroupGetMemSwapUsage(virCgroupPtr group, unsigned long long *kb)
 {
     long long unsigned int usage_in_bytes;
     int ret;
+
+    if (group->unified) {
+        unsigned long long swap_in_bytes;
+
+        if (virCgroupGetValueU64(group, VIR_CGROUP_CONTROLLER_MEMORY,
+                                 "memory.current", &usage_in_bytes) < 0 ||
+            virCgroupGetValueU64(group, VIR_CGROUP_CONTROLLER_MEMORY,
+                                 "memory.swap.current", &swap_in_bytes) < 0)
+            return -1;
+
+        *kb = (usage_in_bytes + swap_in_bytes) >> 10;
+        return 0;
+    }
+
     ret = virCgroupGetValueU64(group,
                                VIR_CGROUP_CONTROLLER_MEMORY,
                                "memory.memsw.usage_in_bytes", &usage_in_bytes);
@@ -2814,6 +3935,10 @@ virCgroupGetCpusetMems(virCgroupPtr group, char **mems)
 int
 virCgroupSetCpusetMemoryMigrate(virCgroupPtr group, bool migrate)
 {
+    /* cgroup v2 always migrates the memory along with cpuset.mems */
+    if (group->unified)
+        return 0;
+
     return virCgroupSetValueStr(group,
                                 VIR_CGROUP_CONTROLLER_CPUSET,
                                 "cpuset.memory_migrate",
@@ -2833,10 +3958,17 @@ int
 virCgroupGetCpusetMemoryMigrate(virCgroupPtr group, bool *migrate)
 {
     unsigned long long value = 0;
-    int ret = virCgroupGetValueU64(group,
-                                   VIR_CGROUP_CONTROLLER_CPUSET,
-                                   "cpuset.memory_migrate",
-                                   &value);
+    int ret;
+
+    if (group->unified) {
+        *migrate = true;
+        return 0;
+    }
+
+    ret = virCgroupGetValueU64(group,
+                               VIR_CGROUP_CONTROLLER_CPUSET,
+                               "cpuset.memory_migrate",
+                               &value);
     *migrate = !!value;
     return ret;
 }
@@ -2888,6 +4020,9 @@ virCgroupGetCpusetCpus(virCgroupPtr group, char **cpus)
 int
 virCgroupDenyAllDevices(virCgroupPtr group)
 {
+    if (group->unified)
+        return virCgroupV2DevicesDenyAll(group);
+
     return virCgroupSetValueStr(group,
                                 VIR_CGROUP_CONTROLLER_DEVICES,
                                 "devices.deny",
@@ -2946,6 +4081,9 @@ virCgroupAllowDevice(virCgroupPtr group, char type, int major, int minor,
     char *majorstr = NULL;
     char *minorstr = NULL;
 
+    if (group->unified)
+        return virCgroupV2DevicesAllow(group, type, major, minor, perms);
+
     if ((major < 0 && VIR_STRDUP(majorstr, "*") < 0) ||
         (major >= 0 && virAsprintf(&majorstr, "%i", major) < 0))
         goto cleanup;
@@ -3037,6 +4175,9 @@ virCgroupDenyDevice(virCgroupPtr group, char type, int major, int minor,
     char *majorstr = NULL;
     char *minorstr = NULL;
 
+    if (group->unified)
+        return virCgroupV2DevicesDeny(group, type, major, minor, perms);
+
     if ((major < 0 && VIR_STRDUP(majorstr, "*") < 0) ||
         (major >= 0 && virAsprintf(&majorstr, "%i", major) < 0))
         goto cleanup;
@@ -3132,25 +4273,28 @@ virCgroupGetPercpuVcpuSum(virCgroupPtr group,
     int ret = -1;
     ssize_t i = -1;
     char *buf = NULL;
-    virCgroupPtr group_vcpu = NULL;
+    char *key = NULL;
 
+    /* Read the files of the vcpu cgroups through @group rather than
+     * through a virCgroupNewThread object per vcpu, so that their
+     * descriptors are cached along with the other statistics files */
     while ((i = virBitmapNextSetBit(guestvcpus, i)) >= 0) {
         char *pos;
         unsigned long long tmp;
         ssize_t j;
 
-        if (virCgroupNewThread(group, VIR_CGROUP_THREAD_VCPU, i,
-                               false, &group_vcpu) < 0)
+        if (virAsprintf(&key, "vcpu%zd/cpuacct.usage_percpu", i) < 0)
             goto cleanup;
 
-        if (virCgroupGetCpuacctPercpuUsage(group_vcpu, &buf) < 0)
+        if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                                 key, &buf) < 0)
             goto cleanup;
 
         pos = buf;
         for (j = virBitmapNextSetBit(cpumap, -1);
              j >= 0 && j < nsum;
              j = virBitmapNextSetBit(cpumap, j)) {
-            if (virStrToLong_ull(pos, &pos, 10, &tmp) < 0) {
+            if (virCgroupParseU64(&pos, &tmp) < 0) {
                 virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                                _("cpuacct parse error"));
                 goto cleanup;
@@ -3158,13 +4302,13 @@ virCgroupGetPercpuVcpuSum(virCgroupPtr group,
             sum_cpu_time[j] += tmp;
         }
 
-        virCgroupFree(&group_vcpu);
+        VIR_FREE(key);
         VIR_FREE(buf);
     }
 
     ret = 0;
  cleanup:
-    virCgroupFree(&group_vcpu);
+    VIR_FREE(key);
     VIR_FREE(buf);
     return ret;
 }
@@ -3250,7 +4394,7 @@ virCgroupGetPercpuStats(virCgroupPtr group,
     for (i = 0; i < need_cpus; i++) {
         if (!virBitmapIsBitSet(cpumap, i)) {
             cpu_time = 0;
-        } else if (virStrToLong_ull(pos, &pos, 10, &cpu_time) < 0) {
+        } else if (virCgroupParseU64(&pos, &cpu_time) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("cpuacct parse error"));
             goto cleanup;
@@ -3344,9 +4488,111 @@ virCgroupGetDomainTotalCpuStats(virCgroupPtr group,
 }
 
 
+/* The cpu.weight of cgroup v2 ranges 1-10000 with a default of 100,
+ * the cpu.shares of v1 2-262144 with a default of 1024 */
+static unsigned long long
+virCgroupUnifiedSharesToWeight(unsigned long long shares)
+{
+    return MIN(MAX(shares * 100 / 1024, 1), 10000);
+}
+
+
+static unsigned long long
+virCgroupUnifiedWeightToShares(unsigned long long weight)
+{
+    return weight * 1024 / 100;
+}
+
+
+/* cpu.max holds both the quota, or "max", and the period */
+static int
+virCgroupUnifiedGetCpuMax(virCgroupPtr group,
+                          long long *quota,
+                          unsigned long long *period)
+{
+    char *str = NULL;
+    char *p;
+    int ret = -1;
+
+    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPU,
+                             "cpu.max", &str) < 0)
+        return -1;
+
+    if (STRPREFIX(str, "max ")) {
+        *quota = -1;
+        p = str + strlen("max");
+    } else if (virStrToLong_ll(str, &p, 10, quota) < 0 || *p != ' ') {
+        goto error;
+    }
+
+    if (virStrToLong_ull(p + 1, &p, 10, period) < 0 ||
+        (*p != '\0' && *p != '\n'))
+        goto error;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(str);
+    return ret;
+
+ error:
+    virReportError(VIR_ERR_INTERNAL_ERROR,
+                   _("Unable to parse cpu.max '%s'"), str);
+    goto cleanup;
+}
+
+
+/* cpu.stat lists "key value" lines, the times in usecs */
+static int
+virCgroupUnifiedGetCpuStat(virCgroupPtr group,
+                           const char *key,
+                           unsigned long long *value)
+{
+    char *str = NULL;
+    char **lines = NULL;
+    size_t len = strlen(key);
+    size_t i;
+    int ret = -1;
+
+    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPU,
+                             "cpu.stat", &str) < 0)
+        return -1;
+
+    if (!(lines = virStringSplit(str, "\n", 0)))
+        goto cleanup;
+
+    for (i = 0; lines[i]; i++) {
+        if (STRPREFIX(lines[i], key) && lines[i][len] == ' ') {
+            if (virStrToLong_ull(lines[i] + len + 1, NULL, 10, value) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Unable to parse cpu.stat '%s'"),
+                               lines[i]);
+                goto cleanup;
+            }
+            ret = 0;
+            goto cleanup;
+        }
+    }
+
+    virReportError(VIR_ERR_INTERNAL_ERROR,
+                   _("Cannot find '%s' in cpu.stat"), key);
+
+ cleanup:
+    virStringListFree(lines);
+    VIR_FREE(str);
+    return ret;
+}
+
+
 int
 virCgroupSetCpuShares(virCgroupPtr group, unsigned long long shares)
 {
+    if (group->unified)
+        return virCgroupSetValueU64(group,
+                                    VIR_CGROUP_CONTROLLER_CPU,
+                                    "cpu.weight",
+                                    virCgroupUnifiedSharesToWeight(shares));
+
     return virCgroupSetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_CPU,
                                 "cpu.shares", shares);
@@ -3356,6 +4602,18 @@ virCgroupSetCpuShares(virCgroupPtr group, unsigned long long shares)
 int
 virCgroupGetCpuShares(virCgroupPtr group, unsigned long long *shares)
 {
+    if (group->unified) {
+        unsigned long long weight;
+
+        if (virCgroupGetValueU64(group,
+                                 VIR_CGROUP_CONTROLLER_CPU,
+                                 "cpu.weight", &weight) < 0)
+            return -1;
+
+        *shares = virCgroupUnifiedWeightToShares(weight);
+        return 0;
+    }
+
     return virCgroupGetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_CPU,
                                 "cpu.shares", shares);
@@ -3383,6 +4641,27 @@ virCgroupSetCpuCfsPeriod(virCgroupPtr group, unsigned long long cfs_period)
         return -1;
     }
 
+    if (group->unified) {
+        long long quota;
+        unsigned long long period;
+        char *str = NULL;
+        int ret;
+
+        if (virCgroupUnifiedGetCpuMax(group, &quota, &period) < 0)
+            return -1;
+
+        if ((quota < 0 &&
+             virAsprintf(&str, "max %llu", cfs_period) < 0) ||
+            (quota >= 0 &&
+             virAsprintf(&str, "%lld %llu", quota, cfs_period) < 0))
+            return -1;
+
+        ret = virCgroupSetValueStr(group, VIR_CGROUP_CONTROLLER_CPU,
+                                   "cpu.max", str);
+        VIR_FREE(str);
+        return ret;
+    }
+
     return virCgroupSetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_CPU,
                                 "cpu.cfs_period_us", cfs_period);
@@ -3400,6 +4679,12 @@ virCgroupSetCpuCfsPeriod(virCgroupPtr group, unsigned long long cfs_period)
 int
 virCgroupGetCpuCfsPeriod(virCgroupPtr group, unsigned long long *cfs_period)
 {
+    if (group->unified) {
+        long long quota;
+
+        return virCgroupUnifiedGetCpuMax(group, &quota, cfs_period);
+    }
+
     return virCgroupGetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_CPU,
                                 "cpu.cfs_period_us", cfs_period);
@@ -3428,6 +4713,16 @@ virCgroupSetCpuCfsQuota(virCgroupPtr group, long long cfs_quota)
         return -1;
     }
 
+    /* The period is kept when writing only the quota to cpu.max */
+    if (group->unified) {
+        if (cfs_quota < 0)
+            return virCgroupSetValueStr(group, VIR_CGROUP_CONTROLLER_CPU,
+                                        "cpu.max", "max");
+
+        return virCgroupSetValueI64(group, VIR_CGROUP_CONTROLLER_CPU,
+                                    "cpu.max", cfs_quota);
+    }
+
     return virCgroupSetValueI64(group,
                                 VIR_CGROUP_CONTROLLER_CPU,
                                 "cpu.cfs_quota_us", cfs_quota);
@@ -3437,6 +4732,12 @@ virCgroupSetCpuCfsQuota(virCgroupPtr group, long long cfs_quota)
 int
 virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage)
 {
+    if (group->unified) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("per-CPU usage is not available with cgroup v2"));
+        return -1;
+    }
+
     return virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
                                 "cpuacct.usage_percpu", usage);
 }
@@ -3534,6 +4835,10 @@ virCgroupRemove(virCgroupPtr group)
         VIR_DEBUG("Removing cgroup %s and all child cgroups", grppath);
         rc = virCgroupRemoveRecursively(grppath);
         VIR_FREE(grppath);
+
+        /* All controllers of the unified hierarchy share the directory */
+        if (group->unified)
+            break;
     }
     VIR_DEBUG("Done removing cgroup %s", group->path);
 
@@ -3555,7 +4860,9 @@ virCgroupKillInternal(virCgroupPtr group, int signum, virHashTablePtr pids)
     VIR_DEBUG("group=%p path=%s signum=%d pids=%p",
               group, group->path, signum, pids);
 
-    if (virCgroupPathOfController(group, -1, "tasks", &keypath) < 0)
+    if (virCgroupPathOfController(group, -1,
+                                  virCgroupGetTasksFile(group, false),
+                                  &keypath) < 0)
         return -1;
 
     /* PIDs may be forking as we kill them, so loop
@@ -3827,6 +5134,12 @@ virCgroupIdentifyRoot(virCgroupPtr group)
 int
 virCgroupGetCpuCfsQuota(virCgroupPtr group, long long *cfs_quota)
 {
+    if (group->unified) {
+        unsigned long long period;
+
+        return virCgroupUnifiedGetCpuMax(group, cfs_quota, &period);
+    }
+
     return virCgroupGetValueI64(group,
                                 VIR_CGROUP_CONTROLLER_CPU,
                                 "cpu.cfs_quota_us", cfs_quota);
@@ -3836,6 +5149,14 @@ virCgroupGetCpuCfsQuota(virCgroupPtr group, long long *cfs_quota)
 int
 virCgroupGetCpuacctUsage(virCgroupPtr group, unsigned long long *usage)
 {
+    if (group->unified) {
+        if (virCgroupUnifiedGetCpuStat(group, "usage_usec", usage) < 0)
+            return -1;
+
+        *usage *= 1000;
+        return 0;
+    }
+
     return virCgroupGetValueU64(group,
                                 VIR_CGROUP_CONTROLLER_CPUACCT,
                                 "cpuacct.usage", usage);
@@ -3851,19 +5172,29 @@ virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
     int ret = -1;
     static double scale = -1.0;
 
+    if (group->unified) {
+        if (virCgroupUnifiedGetCpuStat(group, "user_usec", user) < 0 ||
+            virCgroupUnifiedGetCpuStat(group, "system_usec", sys) < 0)
+            return -1;
+
+        *user *= 1000;
+        *sys *= 1000;
+        return 0;
+    }
+
     if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
                              "cpuacct.stat", &str) < 0)
         return -1;
 
     if (!(p = STRSKIP(str, "user ")) ||
-        virStrToLong_ull(p, &p, 10, user) < 0) {
+        virCgroupParseU64(&p, user) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Cannot parse user stat '%s'"),
                        p);
         goto cleanup;
     }
     if (!(p = STRSKIP(p, "\nsystem ")) ||
-        virStrToLong_ull(p, NULL, 10, sys) < 0) {
+        virCgroupParseU64(&p, sys) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Cannot parse sys stat '%s'"),
                        p);
@@ -3894,21 +5225,110 @@ virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
 int
 virCgroupSetFreezerState(virCgroupPtr group, const char *state)
 {
+    if (group->unified) {
+        if (STRNEQ(state, "FROZEN") && STRNEQ(state, "THAWED")) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("Unsupported freezer state '%s'"), state);
+            return -1;
+        }
+
+        return virCgroupSetValueStr(group,
+                                    VIR_CGROUP_CONTROLLER_FREEZER,
+                                    "cgroup.freeze",
+                                    STREQ(state, "FROZEN") ? "1" : "0");
+    }
+
     return virCgroupSetValueStr(group,
                                 VIR_CGROUP_CONTROLLER_FREEZER,
                                 "freezer.state", state);
 }
 
 
+/* cgroup.freeze holds the requested state, the "frozen" key of
+ * cgroup.events tells whether it was reached */
+static int
+virCgroupUnifiedGetFreezerState(virCgroupPtr group, char **state)
+{
+    unsigned long long freeze;
+    char *events = NULL;
+    const char *ret;
+
+    if (virCgroupGetValueU64(group, VIR_CGROUP_CONTROLLER_FREEZER,
+                             "cgroup.freeze", &freeze) < 0 ||
+        virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_FREEZER,
+                             "cgroup.events", &events) < 0)
+        return -1;
+
+    if (strstr(events, "frozen 1"))
+        ret = "FROZEN";
+    else if (freeze)
+        ret = "FREEZING";
+    else
+        ret = "THAWED";
+
+    VIR_FREE(events);
+    return VIR_STRDUP(*state, ret);
+}
+
+
 int
 virCgroupGetFreezerState(virCgroupPtr group, char **state)
 {
+    if (group->unified)
+        return virCgroupUnifiedGetFreezerState(group, state);
+
     return virCgroupGetValueStr(group,
                                 VIR_CGROUP_CONTROLLER_FREEZER,
                                 "freezer.state", state);
 }
 
 
+/* All the controllers of cgroup v2 share a single mount, which is bound
+ * in place rather than under a tmpfs of per controller mounts */
+static int
+virCgroupBindMountUnified(virCgroupPtr group, const char *oldroot)
+{
+    const char *mountPoint = NULL;
+    char *src = NULL;
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST && !mountPoint; i++)
+        mountPoint = group->controllers[i].mountPoint;
+
+    if (!mountPoint) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Could not find any mounted controllers"));
+        return -1;
+    }
+
+    if (virAsprintf(&src, "%s%s", oldroot, mountPoint) < 0)
+        return -1;
+
+    VIR_DEBUG("Mounting unified cgroup '%s' at '%s'", src, mountPoint);
+
+    if (virFileMakePath(mountPoint) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to create directory %s"),
+                             mountPoint);
+        goto cleanup;
+    }
+
+    if (mount(src, mountPoint, NULL, MS_BIND, NULL) < 0) {
+        virReportSystemError(errno,
+                             _("Failed to bind cgroup '%s' on '%s'"),
+                             src, mountPoint);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(src);
+    return ret;
+}
+
+
 int
 virCgroupBindMount(virCgroupPtr group, const char *oldroot,
                    const char *mountopts)
@@ -3918,6 +5338,9 @@ virCgroupBindMount(virCgroupPtr group, const char *oldroot,
     char *opts = NULL;
     char *root = NULL;
 
+    if (group->unified)
+        return virCgroupBindMountUnified(group, oldroot);
+
     if (!(root = virCgroupIdentifyRoot(group)))
         return -1;
 
@@ -4078,6 +5501,7 @@ virCgroupSupportsCpuBW(virCgroupPtr cgroup)
         return false;
 
     if (virCgroupPathOfController(cgroup, VIR_CGROUP_CONTROLLER_CPU,
+                                  cgroup->unified ? "cpu.max" :
                                   "cpu.cfs_period_us", &path) < 0) {
         virResetLastError();
         goto cleanup;
@@ -4099,7 +5523,8 @@ virCgroupHasEmptyTasks(virCgroupPtr cgroup, int controller)
     if (!cgroup)
         return -1;
 
-    ret = virCgroupGetValueStr(cgroup, controller, "tasks", &content);
+    ret = virCgroupGetValueStr(cgroup, controller,
+                               virCgroupGetTasksFile(cgroup, false), &content);
 
     if (ret == 0 && content[0] == '\0')
         ret = 1;
@@ -4234,6 +5659,7 @@ virCgroupNewMachine(const char *name ATTRIBUTE_UNUSED,
                     int *nicindexes ATTRIBUTE_UNUSED,
                     const char *partition ATTRIBUTE_UNUSED,
                     int controllers ATTRIBUTE_UNUSED,
+                    virSystemdMachineRequestPtr request ATTRIBUTE_UNUSED,
                     virCgroupPtr *group ATTRIBUTE_UNUSED)
 {
     virReportSystemError(ENXIO, "%s",
@@ -4258,6 +5684,28 @@ virCgroupFree(virCgroupPtr *group ATTRIBUTE_UNUSED)
 }
 
 
+int
+virCgroupBatchBegin(virCgroupPtr group ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENXIO, "%s",
+                         _("Control groups not supported on this platform"));
+    return -1;
+}
+
+
+size_t
+virCgroupBatchGetWrites(virCgroupPtr group ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+
+void
+virCgroupBatchEnd(virCgroupPtr group ATTRIBUTE_UNUSED)
+{
+}
+
+
 bool
 virCgroupHasController(virCgroupPtr cgroup ATTRIBUTE_UNUSED,
                        int controller ATTRIBUTE_UNUSED)
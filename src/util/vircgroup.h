@@ -27,6 +27,7 @@
 
 # include "virutil.h"
 # include "virbitmap.h"
+# include "virsystemd.h"
 
 struct virCgroup;
 typedef struct virCgroup *virCgroupPtr;
@@ -113,6 +114,7 @@ int virCgroupNewMachine(const char *name,
                         int *nicindexes,
                         const char *partition,
                         int controllers,
+                        virSystemdMachineRequestPtr request,
                         virCgroupPtr *group)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2)
     ATTRIBUTE_NONNULL(3);
@@ -124,6 +126,10 @@ bool virCgroupNewIgnoreError(void);
 
 void virCgroupFree(virCgroupPtr *group);
 
+int virCgroupBatchBegin(virCgroupPtr group);
+size_t virCgroupBatchGetWrites(virCgroupPtr group);
+void virCgroupBatchEnd(virCgroupPtr group);
+
 bool virCgroupHasController(virCgroupPtr cgroup, int controller);
 int virCgroupPathOfController(virCgroupPtr group,
                               int controller,
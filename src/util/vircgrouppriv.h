@@ -23,7 +23,7 @@
  */
 
 #ifndef __VIR_CGROUP_ALLOW_INCLUDE_PRIV_H__
-# error "vircgrouppriv.h may only be included by vircgroup.c or its test suite"
+# error "vircgrouppriv.h may only be included by the vircgroup implementation or its test suite"
 #endif
 
 #ifndef __VIR_CGROUP_PRIV_H__
@@ -42,10 +42,38 @@ struct virCgroupController {
     char *placement;
 };
 
+struct virCgroupStatFile {
+    int controller;
+    char *key;
+    int fd;
+};
+
+struct virCgroupBatch {
+    int depth;
+    int dirfds[VIR_CGROUP_CONTROLLER_LAST];
+    size_t nwrites;
+    unsigned long long start;
+};
+
 struct virCgroup {
     char *path;
 
     struct virCgroupController controllers[VIR_CGROUP_CONTROLLER_LAST];
+
+    /* Statistics files kept open across reads, see
+     * virCgroupGetValueStr */
+    struct virCgroupStatFile *statFiles;
+    size_t nstatFiles;
+
+    /* Non-NULL between virCgroupBatchBegin and virCgroupBatchEnd */
+    struct virCgroupBatch *batch;
+
+    /* All controllers share the single cgroup v2 hierarchy */
+    bool unified;
+    /* cgroup v2 group of threads rather than processes */
+    bool threaded;
+    /* Map of the eBPF device program of a cgroup v2 group, or -1 */
+    int devicesMapFd;
 };
 
 int virCgroupDetectMountsFromFile(virCgroupPtr group,
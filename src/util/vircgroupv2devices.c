@@ -0,0 +1,471 @@
+/*
+ * vircgroupv2devices.c: methods for cgroups v2 BPF devices
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <stddef.h>
+
+#include "vircgroupv2devices.h"
+#define __VIR_CGROUP_ALLOW_INCLUDE_PRIV_H__
+#include "vircgrouppriv.h"
+
+#include "viralloc.h"
+#include "virbpf.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+
+VIR_LOG_INIT("util.cgroup");
+
+#define VIR_FROM_THIS VIR_FROM_CGROUP
+
+/*
+ * cgroup v2 has no devices.allow and devices.deny files, the access to
+ * devices is decided by an eBPF program attached to the cgroup.  Ours
+ * looks the device up in a hash map keyed by (major << 32 | minor),
+ * where 0xffffffff stands for '*', trying "major:minor", "major:*"
+ * and "*:*" in turn.  The value holds the allowed BPF_DEVCG_ACC_*
+ * bits of block devices in its low byte and those of char devices in
+ * the byte above, so updating the ACL is a map update and never needs
+ * to load a new program.
+ */
+
+#if HAVE_DECL_BPF_PROG_QUERY
+# define VIR_CGROUP_V2_DEVICES_MAP_SIZE 1024
+# define VIR_CGROUP_V2_DEVICES_CHAR_SHIFT 8
+
+/* Returns from the program with "allow" if the value of the key
+ * stored below the frame pointer grants all the access in r8 */
+# define VIR_CGROUP_V2_DEVICES_CHECK(mapfd) \
+    VIR_BPF_LD_MAP_FD(BPF_REG_1, mapfd), \
+    VIR_BPF_MOV64_REG(BPF_REG_2, BPF_REG_10), \
+    VIR_BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -8), \
+    VIR_BPF_CALL_INSN(BPF_FUNC_map_lookup_elem), \
+    VIR_BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 5), \
+    VIR_BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_0, 0), \
+    VIR_BPF_ALU64_REG(BPF_AND, BPF_REG_1, BPF_REG_8), \
+    VIR_BPF_JMP_REG(BPF_JNE, BPF_REG_1, BPF_REG_8, 2), \
+    VIR_BPF_MOV64_IMM(BPF_REG_0, 1), \
+    VIR_BPF_EXIT_INSN()
+
+
+static uint64_t
+virCgroupV2DevicesGetKey(int major,
+                         int minor)
+{
+    return ((uint64_t)(uint32_t)major << 32) | (uint32_t)minor;
+}
+
+
+static uint32_t
+virCgroupV2DevicesGetPerms(char type,
+                           int perms)
+{
+    uint32_t ret = 0;
+
+    if (perms & VIR_CGROUP_DEVICE_MKNOD)
+        ret |= BPF_DEVCG_ACC_MKNOD;
+    if (perms & VIR_CGROUP_DEVICE_READ)
+        ret |= BPF_DEVCG_ACC_READ;
+    if (perms & VIR_CGROUP_DEVICE_WRITE)
+        ret |= BPF_DEVCG_ACC_WRITE;
+
+    if (type == 'c')
+        ret <<= VIR_CGROUP_V2_DEVICES_CHAR_SHIFT;
+
+    return ret;
+}
+
+
+static int
+virCgroupV2DevicesLoadProg(int mapfd)
+{
+    struct bpf_insn prog[] = {
+        VIR_BPF_MOV64_REG(BPF_REG_6, BPF_REG_1),
+
+        /* r8 = access, shifted to the byte of the device type */
+        VIR_BPF_LDX_MEM(BPF_W, BPF_REG_8, BPF_REG_6,
+                        offsetof(struct bpf_cgroup_dev_ctx, access_type)),
+        VIR_BPF_MOV64_REG(BPF_REG_7, BPF_REG_8),
+        VIR_BPF_ALU64_IMM(BPF_RSH, BPF_REG_8, 16),
+        VIR_BPF_ALU64_IMM(BPF_AND, BPF_REG_7, 0xffff),
+        VIR_BPF_JMP_IMM(BPF_JNE, BPF_REG_7, BPF_DEVCG_DEV_CHAR, 1),
+        VIR_BPF_ALU64_IMM(BPF_LSH, BPF_REG_8,
+                          VIR_CGROUP_V2_DEVICES_CHAR_SHIFT),
+
+        /* r9 = major << 32 */
+        VIR_BPF_LDX_MEM(BPF_W, BPF_REG_9, BPF_REG_6,
+                        offsetof(struct bpf_cgroup_dev_ctx, major)),
+        VIR_BPF_ALU64_IMM(BPF_LSH, BPF_REG_9, 32),
+
+        /* major:minor */
+        VIR_BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_6,
+                        offsetof(struct bpf_cgroup_dev_ctx, minor)),
+        VIR_BPF_ALU64_REG(BPF_OR, BPF_REG_2, BPF_REG_9),
+        VIR_BPF_STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_2, -8),
+        VIR_CGROUP_V2_DEVICES_CHECK(mapfd),
+
+        /* major:* */
+        VIR_BPF_MOV32_IMM(BPF_REG_2, -1),
+        VIR_BPF_ALU64_REG(BPF_OR, BPF_REG_2, BPF_REG_9),
+        VIR_BPF_STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_2, -8),
+        VIR_CGROUP_V2_DEVICES_CHECK(mapfd),
+
+        /* *:* */
+        VIR_BPF_MOV64_IMM(BPF_REG_2, -1),
+        VIR_BPF_STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_2, -8),
+        VIR_CGROUP_V2_DEVICES_CHECK(mapfd),
+
+        VIR_BPF_MOV64_IMM(BPF_REG_0, 0),
+        VIR_BPF_EXIT_INSN(),
+    };
+
+    return virBPFLoadProg(prog, BPF_PROG_TYPE_CGROUP_DEVICE,
+                          ARRAY_CARDINALITY(prog));
+}
+
+
+static int
+virCgroupV2DevicesOpenGroup(virCgroupPtr group)
+{
+    char *path = NULL;
+    int fd;
+
+    if (virCgroupPathOfController(group, VIR_CGROUP_CONTROLLER_DEVICES,
+                                  "", &path) < 0)
+        return -1;
+
+    if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+        virReportSystemError(errno, _("Unable to open '%s'"), path);
+
+    VIR_FREE(path);
+    return fd;
+}
+
+
+/*
+ * Looks up the map of the device program attached to @group.
+ *
+ * Returns 1 if it was found, 0 if @group has no device program of ours
+ * and -1 on error.
+ */
+static int
+virCgroupV2DevicesDetectProg(virCgroupPtr group)
+{
+    int cgroupfd = -1;
+    int progfd = -1;
+    int mapfd;
+    unsigned int progcnt = 0;
+    unsigned int progid;
+    unsigned int mapid;
+    int ret = -1;
+
+    if (group->devicesMapFd >= 0)
+        return 1;
+
+    if ((cgroupfd = virCgroupV2DevicesOpenGroup(group)) < 0)
+        return -1;
+
+    if (virBPFQueryProg(cgroupfd, 1, BPF_CGROUP_DEVICE,
+                        &progcnt, &progid) < 0) {
+        if (errno == ENOSPC) {
+            VIR_DEBUG("Several device programs attached to cgroup %s",
+                      group->path);
+            ret = 0;
+            goto cleanup;
+        }
+        virReportSystemError(errno, "%s",
+                             _("unable to query cgroup BPF program"));
+        goto cleanup;
+    }
+
+    if (progcnt == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if ((progfd = virBPFGetProg(progid)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to get cgroup BPF program"));
+        goto cleanup;
+    }
+
+    if (virBPFGetProgMapID(progfd, &mapid) < 0) {
+        if (errno == ENOENT) {
+            VIR_DEBUG("Device program %u of cgroup %s is not ours",
+                      progid, group->path);
+            ret = 0;
+            goto cleanup;
+        }
+        virReportSystemError(errno, "%s",
+                             _("unable to get cgroup BPF program info"));
+        goto cleanup;
+    }
+
+    if ((mapfd = virBPFGetMap(mapid)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to get cgroup BPF map"));
+        goto cleanup;
+    }
+
+    group->devicesMapFd = mapfd;
+    ret = 1;
+
+ cleanup:
+    VIR_FORCE_CLOSE(progfd);
+    VIR_FORCE_CLOSE(cgroupfd);
+    return ret;
+}
+
+
+/* Attaches a new device program with an empty map, denying all
+ * devices, to @group */
+static int
+virCgroupV2DevicesCreateProg(virCgroupPtr group)
+{
+    int cgroupfd = -1;
+    int progfd = -1;
+    int mapfd = -1;
+    int ret = -1;
+
+    if ((mapfd = virBPFCreateMap(BPF_MAP_TYPE_HASH, sizeof(uint64_t),
+                                 sizeof(uint32_t),
+                                 VIR_CGROUP_V2_DEVICES_MAP_SIZE)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to initialize device BPF map"));
+        goto cleanup;
+    }
+
+    if ((progfd = virCgroupV2DevicesLoadProg(mapfd)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to load cgroup BPF prog"));
+        goto cleanup;
+    }
+
+    if ((cgroupfd = virCgroupV2DevicesOpenGroup(group)) < 0)
+        goto cleanup;
+
+    if (virBPFAttachProg(progfd, cgroupfd, BPF_CGROUP_DEVICE) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to attach cgroup BPF prog"));
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Attached device program to cgroup %s", group->path);
+
+    group->devicesMapFd = mapfd;
+    mapfd = -1;
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(cgroupfd);
+    VIR_FORCE_CLOSE(progfd);
+    VIR_FORCE_CLOSE(mapfd);
+    return ret;
+}
+
+
+bool
+virCgroupV2DevicesAvailable(const char *mountPoint)
+{
+    int cgroupfd;
+    unsigned int progcnt = 0;
+    bool ret = false;
+
+    if ((cgroupfd = open(mountPoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        VIR_DEBUG("Unable to open %s: errno=%d", mountPoint, errno);
+        return false;
+    }
+
+    if (virBPFQueryProg(cgroupfd, 0, BPF_CGROUP_DEVICE, &progcnt, NULL) < 0) {
+        VIR_DEBUG("cgroup BPF device control is not available: errno=%d",
+                  errno);
+        goto cleanup;
+    }
+
+    ret = true;
+
+ cleanup:
+    VIR_FORCE_CLOSE(cgroupfd);
+    return ret;
+}
+
+
+int
+virCgroupV2DevicesDenyAll(virCgroupPtr group)
+{
+    uint64_t key;
+    int rc;
+
+    if ((rc = virCgroupV2DevicesDetectProg(group)) < 0)
+        return -1;
+
+    if (rc == 0)
+        return virCgroupV2DevicesCreateProg(group);
+
+    while (virBPFGetNextElem(group->devicesMapFd, NULL, &key) == 0) {
+        if (virBPFDeleteElem(group->devicesMapFd, &key) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to remove device from BPF map"));
+            return -1;
+        }
+    }
+
+    if (errno != ENOENT) {
+        virReportSystemError(errno, "%s",
+                             _("failed to iterate over device BPF map"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int
+virCgroupV2DevicesAllow(virCgroupPtr group,
+                        char type,
+                        int major,
+                        int minor,
+                        int perms)
+{
+    uint64_t key = virCgroupV2DevicesGetKey(major, minor);
+    uint32_t val = 0;
+    int rc;
+
+    if ((rc = virCgroupV2DevicesDetectProg(group)) <= 0) {
+        if (rc == 0)
+            VIR_DEBUG("No device program in cgroup %s, %c %d:%d is allowed",
+                      group->path, type, major, minor);
+        return rc;
+    }
+
+    if (virBPFLookupElem(group->devicesMapFd, &key, &val) < 0 &&
+        errno != ENOENT) {
+        virReportSystemError(errno, "%s",
+                             _("failed to look up device in BPF map"));
+        return -1;
+    }
+
+    val |= virCgroupV2DevicesGetPerms(type, perms);
+
+    if (virBPFUpdateElem(group->devicesMapFd, &key, &val) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to add device to BPF map"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int
+virCgroupV2DevicesDeny(virCgroupPtr group,
+                       char type,
+                       int major,
+                       int minor,
+                       int perms)
+{
+    uint64_t key = virCgroupV2DevicesGetKey(major, minor);
+    uint32_t val = 0;
+    int rc;
+
+    /* Only the devices granted explicitly can be denied, a group without
+     * a program of ours allows everything and stays that way */
+    if ((rc = virCgroupV2DevicesDetectProg(group)) <= 0) {
+        if (rc == 0)
+            VIR_DEBUG("No device program in cgroup %s, ignoring deny of %c %d:%d",
+                      group->path, type, major, minor);
+        return rc;
+    }
+
+    if (virBPFLookupElem(group->devicesMapFd, &key, &val) < 0) {
+        if (errno == ENOENT)
+            return 0;
+        virReportSystemError(errno, "%s",
+                             _("failed to look up device in BPF map"));
+        return -1;
+    }
+
+    val &= ~virCgroupV2DevicesGetPerms(type, perms);
+
+    if (val == 0)
+        rc = virBPFDeleteElem(group->devicesMapFd, &key);
+    else
+        rc = virBPFUpdateElem(group->devicesMapFd, &key, &val);
+
+    if (rc < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to remove device from BPF map"));
+        return -1;
+    }
+
+    return 0;
+}
+#else /* !HAVE_DECL_BPF_PROG_QUERY */
+bool
+virCgroupV2DevicesAvailable(const char *mountPoint ATTRIBUTE_UNUSED)
+{
+    return false;
+}
+
+
+int
+virCgroupV2DevicesDenyAll(virCgroupPtr group ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("cgroup BPF device control is not available on this platform"));
+    return -1;
+}
+
+
+int
+virCgroupV2DevicesAllow(virCgroupPtr group ATTRIBUTE_UNUSED,
+                        char type ATTRIBUTE_UNUSED,
+                        int major ATTRIBUTE_UNUSED,
+                        int minor ATTRIBUTE_UNUSED,
+                        int perms ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("cgroup BPF device control is not available on this platform"));
+    return -1;
+}
+
+
+int
+virCgroupV2DevicesDeny(virCgroupPtr group ATTRIBUTE_UNUSED,
+                       char type ATTRIBUTE_UNUSED,
+                       int major ATTRIBUTE_UNUSED,
+                       int minor ATTRIBUTE_UNUSED,
+                       int perms ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("cgroup BPF device control is not available on this platform"));
+    return -1;
+}
+#endif /* !HAVE_DECL_BPF_PROG_QUERY */
+
+
+void
+virCgroupV2DevicesClose(virCgroupPtr group)
+{
+    VIR_FORCE_CLOSE(group->devicesMapFd);
+}
@@ -0,0 +1,45 @@
+/*
+ * vircgroupv2devices.h: methods for cgroups v2 BPF devices
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_CGROUP_V2_DEVICES_H__
+# define __VIR_CGROUP_V2_DEVICES_H__
+
+# include "vircgroup.h"
+
+bool virCgroupV2DevicesAvailable(const char *mountPoint);
+
+int virCgroupV2DevicesDenyAll(virCgroupPtr group);
+
+int virCgroupV2DevicesAllow(virCgroupPtr group,
+                            char type,
+                            int major,
+                            int minor,
+                            int perms);
+
+int virCgroupV2DevicesDeny(virCgroupPtr group,
+                           char type,
+                           int major,
+                           int minor,
+                           int perms);
+
+void virCgroupV2DevicesClose(virCgroupPtr group);
+
+#endif /* __VIR_CGROUP_V2_DEVICES_H__ */
@@ -30,6 +30,12 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef HAVE_POSIX_SPAWN
+# include <spawn.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
 
 #if WITH_CAPNG
 # include <cap-ng.h>
@@ -45,6 +51,7 @@
 #define __VIR_COMMAND_PRIV_H_ALLOW__
 #include "vircommandpriv.h"
 #include "viralloc.h"
+#include "virbitmap.h"
 #include "virerror.h"
 #include "virutil.h"
 #include "virlog.h"
@@ -464,6 +471,398 @@ virCommandHandshakeChild(virCommandPtr cmd)
     return 0;
 }
 
+/*
+ * virCommandGetOpenFDs:
+ * @fds: bitmap sized to the limit of open files
+ *
+ * Set the bits of @fds for the descriptors which may be open. Where
+ * the open ones cannot be listed, all of them are set.
+ */
+static void
+virCommandGetOpenFDs(virBitmapPtr fds)
+{
+    DIR *dir = NULL;
+    struct dirent *ent;
+    int fd;
+
+    if (virDirOpenQuiet(&dir, "/proc/self/fd") < 0) {
+        virBitmapSetAll(fds);
+        return;
+    }
+
+    while (virDirRead(dir, &ent, NULL) > 0) {
+        if (virStrToLong_i(ent->d_name, NULL, 10, &fd) < 0)
+            continue;
+        ignore_value(virBitmapSetBit(fds, fd));
+    }
+
+    VIR_DIR_CLOSE(dir);
+}
+
+
+# if defined(HAVE_CLOSE_RANGE)
+#  define virCommandCloseRange(first, last) close_range(first, last, 0)
+# elif defined(__linux__) && defined(SYS_close_range)
+#  define virCommandCloseRange(first, last) \
+    syscall(SYS_close_range, first, last, 0)
+# endif
+
+# ifdef virCommandCloseRange
+static int
+virCommandCompareFDs(const void *a,
+                     const void *b)
+{
+    return *(const int *) a - *(const int *) b;
+}
+
+
+/*
+ * virCommandMassCloseRange:
+ *
+ * Close all descriptors but the standard ones, @childin, @childout,
+ * @childerr and those passed to the child, with one close_range()
+ * call for every gap between the ones kept.
+ *
+ * Returns 0 on success, -1 with errno set on failure, in which case
+ * nothing was closed if errno is ENOSYS.
+ */
+static int
+virCommandMassCloseRange(virCommandPtr cmd,
+                         int childin,
+                         int childout,
+                         int childerr)
+{
+    int *keep = NULL;
+    size_t nkeep = 0;
+    int first = STDERR_FILENO + 1;
+    size_t i;
+    int saved_errno;
+    int ret = -1;
+
+    if (VIR_ALLOC_N_QUIET(keep, cmd->npassfd + 3) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    keep[nkeep++] = childin;
+    keep[nkeep++] = childout;
+    keep[nkeep++] = childerr;
+    for (i = 0; i < cmd->npassfd; i++)
+        keep[nkeep++] = cmd->passfd[i].fd;
+
+    qsort(keep, nkeep, sizeof(*keep), virCommandCompareFDs);
+
+    for (i = 0; i < nkeep; i++) {
+        if (keep[i] < first)
+            continue;
+        if (keep[i] > first &&
+            virCommandCloseRange(first, keep[i] - 1) < 0)
+            goto cleanup;
+        first = keep[i] + 1;
+    }
+
+    if (virCommandCloseRange(first, ~0U) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    saved_errno = errno;
+    VIR_FREE(keep);
+    errno = saved_errno;
+    return ret;
+}
+# endif /* virCommandCloseRange */
+
+
+/*
+ * virCommandMassClose:
+ *
+ * In the child, close every descriptor which is not meant to be
+ * inherited and make sure the passed ones are. Rather than trying
+ * each descriptor up to the limit of open files, which may be very
+ * high, only the open ones are closed.
+ */
+static int
+virCommandMassClose(virCommandPtr cmd,
+                    int childin,
+                    int childout,
+                    int childerr)
+{
+    virBitmapPtr fds = NULL;
+    int openmax;
+    ssize_t fd;
+    int tmpfd;
+    size_t i;
+
+    for (i = 0; i < cmd->npassfd; i++) {
+        if (virSetInherit(cmd->passfd[i].fd, true) < 0) {
+            virReportSystemError(errno, _("failed to preserve fd %d"),
+                                 cmd->passfd[i].fd);
+            return -1;
+        }
+    }
+
+# ifdef virCommandCloseRange
+    if (virCommandMassCloseRange(cmd, childin, childout, childerr) == 0)
+        return 0;
+    if (errno != ENOSYS) {
+        virReportSystemError(errno, "%s",
+                             _("failed to close file descriptors"));
+        return -1;
+    }
+# endif
+
+    if ((openmax = sysconf(_SC_OPEN_MAX)) < 0) {
+        virReportSystemError(errno,  "%s",
+                             _("sysconf(_SC_OPEN_MAX) failed"));
+        return -1;
+    }
+
+    if (!(fds = virBitmapNew(openmax)))
+        return -1;
+
+    virCommandGetOpenFDs(fds);
+
+    fd = STDERR_FILENO;
+    while ((fd = virBitmapNextSetBit(fds, fd)) >= 0) {
+        if (fd == childin || fd == childout || fd == childerr)
+            continue;
+        if (!virCommandFDIsSet(cmd, fd)) {
+            tmpfd = fd;
+            VIR_MASS_CLOSE(tmpfd);
+        }
+    }
+
+    virBitmapFree(fds);
+    return 0;
+}
+
+
+# ifdef HAVE_POSIX_SPAWN
+/*
+ * virExecCanSpawn:
+ *
+ * Commands which need nothing done between fork() and exec() other
+ * than setting up their file descriptors can be started by
+ * posix_spawn(), which avoids copying the page tables of a large,
+ * multi-threaded parent the way fork() has to.
+ */
+static bool
+virExecCanSpawn(virCommandPtr cmd)
+{
+    if (cmd->hook || cmd->handshake)
+        return false;
+
+    if (cmd->flags & (VIR_EXEC_DAEMON | VIR_EXEC_CLEAR_CAPS |
+                      VIR_EXEC_LISTEN_FDS))
+        return false;
+
+    if (cmd->uid != (uid_t)-1 || cmd->gid != (gid_t)-1 ||
+        cmd->capabilities)
+        return false;
+
+    if (cmd->maxMemLock || cmd->maxProcesses || cmd->maxFiles ||
+        cmd->setMaxCore || cmd->mask)
+        return false;
+
+#  ifndef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+    if (cmd->pwd)
+        return false;
+#  endif
+#  if defined(WITH_SECDRIVER_SELINUX)
+    if (cmd->seLinuxLabel)
+        return false;
+#  endif
+#  if defined(WITH_SECDRIVER_APPARMOR)
+    if (cmd->appArmorProfile)
+        return false;
+#  endif
+
+    return true;
+}
+
+
+static int
+virExecSpawnCheckFD(virCommandPtr cmd,
+                    int fd,
+                    int **fds,
+                    size_t *nfds)
+{
+    int flags;
+
+    if (virCommandFDIsSet(cmd, fd))
+        return 0;
+
+    if ((flags = fcntl(fd, F_GETFD)) < 0 || flags & FD_CLOEXEC)
+        return 0;
+
+    return VIR_APPEND_ELEMENT_QUIET(*fds, *nfds, fd);
+}
+
+
+/*
+ * virExecSpawnListFDs:
+ *
+ * Collect the descriptors which would leak into the child, that is
+ * those which are neither passed to it nor close-on-exec, and the
+ * highest descriptor open.
+ */
+static int
+virExecSpawnListFDs(virCommandPtr cmd,
+                    int **fds,
+                    size_t *nfds,
+                    int *maxfd)
+{
+    virBitmapPtr open = NULL;
+    int openmax;
+    ssize_t fd;
+    int ret = -1;
+
+    *maxfd = STDERR_FILENO;
+
+    if ((openmax = sysconf(_SC_OPEN_MAX)) < 0 ||
+        !(open = virBitmapNewQuiet(openmax)))
+        return -1;
+
+    virCommandGetOpenFDs(open);
+
+    fd = STDERR_FILENO;
+    while ((fd = virBitmapNextSetBit(open, fd)) >= 0) {
+        if (virExecSpawnCheckFD(cmd, fd, fds, nfds) < 0)
+            goto cleanup;
+        *maxfd = fd;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBitmapFree(open);
+    return ret;
+}
+
+
+/*
+ * Make @fd available as @target in the child. dup2() onto the same
+ * descriptor would leave FD_CLOEXEC set, so that case goes through
+ * @tmp, a descriptor not open in the parent.
+ */
+static int
+virExecSpawnInherit(posix_spawn_file_actions_t *actions,
+                    int fd,
+                    int target,
+                    int tmp)
+{
+    int rc;
+
+    if (fd != target)
+        return posix_spawn_file_actions_adddup2(actions, fd, target);
+
+    if ((rc = posix_spawn_file_actions_adddup2(actions, fd, tmp)) != 0 ||
+        (rc = posix_spawn_file_actions_adddup2(actions, tmp, target)) != 0)
+        return rc;
+
+    return posix_spawn_file_actions_addclose(actions, tmp);
+}
+
+
+/*
+ * virExecSpawn:
+ *
+ * Start @cmd, which virExecCanSpawn() accepted, using posix_spawn()
+ * with the same descriptors, signal state and environment the child
+ * would get from virExec(). On any failure, including failing to
+ * execute @binary, -1 is returned without reporting an error so that
+ * the caller retries with fork(), which then reports the problem the
+ * usual way.
+ */
+static pid_t
+virExecSpawn(virCommandPtr cmd,
+             const char *binary,
+             int childin,
+             int childout,
+             int childerr)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    int *fds = NULL;
+    size_t nfds = 0;
+    int maxfd;
+    pid_t pid = -1;
+    size_t i;
+    int rc;
+
+    if ((rc = posix_spawn_file_actions_init(&actions)) != 0)
+        goto error;
+    if ((rc = posix_spawnattr_init(&attr)) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        goto error;
+    }
+
+    if (virExecSpawnListFDs(cmd, &fds, &nfds, &maxfd) < 0) {
+        rc = ENOMEM;
+        goto cleanup;
+    }
+
+    /* Like virFork(), reset all signal handlers and unmask signals */
+    sigfillset(&mask);
+    if ((rc = posix_spawnattr_setsigdefault(&attr, &mask)) != 0)
+        goto cleanup;
+    sigemptyset(&mask);
+    if ((rc = posix_spawnattr_setsigmask(&attr, &mask)) != 0 ||
+        (rc = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+                                       POSIX_SPAWN_SETSIGMASK)) != 0)
+        goto cleanup;
+
+    if ((rc = virExecSpawnInherit(&actions, childin,
+                                  STDIN_FILENO, maxfd + 1)) != 0 ||
+        (rc = virExecSpawnInherit(&actions, childout,
+                                  STDOUT_FILENO, maxfd + 1)) != 0 ||
+        (rc = virExecSpawnInherit(&actions, childerr,
+                                  STDERR_FILENO, maxfd + 1)) != 0)
+        goto cleanup;
+
+    for (i = 0; i < cmd->npassfd; i++) {
+        if ((rc = virExecSpawnInherit(&actions, cmd->passfd[i].fd,
+                                      cmd->passfd[i].fd, maxfd + 1)) != 0)
+            goto cleanup;
+    }
+
+    /* Only after the dup2 actions, which may still need these */
+    for (i = 0; i < nfds; i++) {
+        if ((rc = posix_spawn_file_actions_addclose(&actions, fds[i])) != 0)
+            goto cleanup;
+    }
+
+#  ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+    if (cmd->pwd &&
+        (rc = posix_spawn_file_actions_addchdir_np(&actions, cmd->pwd)) != 0)
+        goto cleanup;
+#  endif
+
+    if ((rc = posix_spawn(&pid, binary, &actions, &attr, cmd->args,
+                          cmd->env ? cmd->env : environ)) != 0)
+        pid = -1;
+
+ cleanup:
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    VIR_FREE(fds);
+    if (pid > 0)
+        return pid;
+
+ error:
+    if (rc != 0) {
+        char ebuf[1024];
+        VIR_DEBUG("Unable to spawn %s, falling back to fork: %s",
+                  binary, virStrerror(rc, ebuf, sizeof(ebuf)));
+    }
+    return -1;
+}
+# endif /* HAVE_POSIX_SPAWN */
+
+
 /*
  * virExec:
  * @cmd virCommandPtr containing all information about the program to
@@ -473,13 +872,12 @@ static int
 virExec(virCommandPtr cmd)
 {
     pid_t pid;
-    int null = -1, fd, openmax;
+    int null = -1;
     int pipeout[2] = {-1, -1};
     int pipeerr[2] = {-1, -1};
     int childin = cmd->infd;
     int childout = -1;
     int childerr = -1;
-    int tmpfd;
     char *binarystr = NULL;
     const char *binary = NULL;
     int ret;
@@ -559,7 +957,14 @@ virExec(virCommandPtr cmd)
     if ((ngroups = virGetGroupList(cmd->uid, cmd->gid, &groups)) < 0)
         goto cleanup;
 
-    pid = virFork();
+    pid = -1;
+# ifdef HAVE_POSIX_SPAWN
+    if (virExecCanSpawn(cmd))
+        pid = virExecSpawn(cmd, binary, childin, childout, childerr);
+# endif
+
+    if (pid < 0)
+        pid = virFork();
 
     if (pid < 0)
         goto cleanup;
@@ -588,23 +993,8 @@ virExec(virCommandPtr cmd)
     if (cmd->mask)
         umask(cmd->mask);
     ret = EXIT_CANCELED;
-    openmax = sysconf(_SC_OPEN_MAX);
-    if (openmax < 0) {
-        virReportSystemError(errno,  "%s",
-                             _("sysconf(_SC_OPEN_MAX) failed"));
+    if (virCommandMassClose(cmd, childin, childout, childerr) < 0)
         goto fork_error;
-    }
-    for (fd = 3; fd < openmax; fd++) {
-        if (fd == childin || fd == childout || fd == childerr)
-            continue;
-        if (!virCommandFDIsSet(cmd, fd)) {
-            tmpfd = fd;
-            VIR_MASS_CLOSE(tmpfd);
-        } else if (virSetInherit(fd, true) < 0) {
-            virReportSystemError(errno, _("failed to preserve fd %d"), fd);
-            goto fork_error;
-        }
-    }
 
     if (prepareStdFd(childin, STDIN_FILENO) < 0) {
         virReportSystemError(errno,
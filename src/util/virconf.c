@@ -281,10 +281,10 @@ virConfSaveValue(virBufferPtr buf, virConfValuePtr val)
         case VIR_CONF_NONE:
             return -1;
         case VIR_CONF_LLONG:
-            virBufferAsprintf(buf, "%lld", val->l);
+            virBufferAddLongLong(buf, val->l);
             break;
         case VIR_CONF_ULLONG:
-            virBufferAsprintf(buf, "%llu", val->l);
+            virBufferAddULongLong(buf, val->l);
             break;
         case VIR_CONF_STRING:
             if (val->str) {
@@ -85,6 +85,8 @@ addnhostsFree(dnsmasqAddnHostsfile *addnhostsfile)
         addnhostsfile->nhosts = 0;
     }
 
+    virHashFree(addnhostsfile->ips);
+
     VIR_FREE(addnhostsfile->path);
 
     VIR_FREE(addnhostsfile);
@@ -96,21 +98,16 @@ addnhostsAdd(dnsmasqAddnHostsfile *addnhostsfile,
              const char *name)
 {
     char *ipstr = NULL;
-    int idx = -1;
-    size_t i;
+    size_t idx;
 
     if (!(ipstr = virSocketAddrFormat(ip)))
         return -1;
 
-    for (i = 0; i < addnhostsfile->nhosts; i++) {
-        if (STREQ((const char *)addnhostsfile->hosts[i].ip, (const char *)ipstr)) {
-            idx = i;
-            break;
-        }
-    }
-
-    if (idx < 0) {
-        if (VIR_REALLOC_N(addnhostsfile->hosts, addnhostsfile->nhosts + 1) < 0)
+    if ((idx = (size_t) virHashLookup(addnhostsfile->ips, ipstr)) > 0) {
+        idx--;
+    } else {
+        if (VIR_RESIZE_N(addnhostsfile->hosts, addnhostsfile->nhosts_max,
+                         addnhostsfile->nhosts, 1) < 0)
             goto error;
 
         idx = addnhostsfile->nhosts;
@@ -122,6 +119,10 @@ addnhostsAdd(dnsmasqAddnHostsfile *addnhostsfile,
 
         addnhostsfile->hosts[idx].nhostnames = 0;
         addnhostsfile->nhosts++;
+
+        if (virHashAddEntry(addnhostsfile->ips, ipstr,
+                            (void *) (idx + 1)) < 0)
+            goto error;
     }
 
     if (VIR_REALLOC_N(addnhostsfile->hosts[idx].hostnames, addnhostsfile->hosts[idx].nhostnames + 1) < 0)
@@ -155,6 +156,9 @@ addnhostsNew(const char *name,
     addnhostsfile->hosts = NULL;
     addnhostsfile->nhosts = 0;
 
+    if (!(addnhostsfile->ips = virHashCreate(32, NULL)))
+        goto error;
+
     virBufferAsprintf(&buf, "%s", config_dir);
     virBufferEscapeString(&buf, "/%s", name);
     virBufferAsprintf(&buf, ".%s", DNSMASQ_ADDNHOSTSFILE_SUFFIX);
@@ -173,96 +177,64 @@ addnhostsNew(const char *name,
     return NULL;
 }
 
+/* Write @content into @path unless the file already contains exactly
+ * that, so that dnsmasq doesn't need to be told to reread it.
+ *
+ * Returns 1 if the file was written, 0 if it was up to date and -1 on
+ * error. */
 static int
-addnhostsWrite(const char *path,
-               dnsmasqAddnHost *hosts,
-               unsigned int nhosts)
+dnsmasqFileUpdate(const char *path,
+                  const char *content)
 {
-    char *tmp;
-    FILE *f;
-    bool istmp = true;
-    size_t i, j;
-    int rc = 0;
-
-    /* even if there are 0 hosts, create a 0 length file, to allow
-     * for runtime addition.
-     */
-
-    if (virAsprintf(&tmp, "%s.new", path) < 0)
-        return -ENOMEM;
-
-    if (!(f = fopen(tmp, "w"))) {
-        istmp = false;
-        if (!(f = fopen(path, "w"))) {
-            rc = -errno;
-            goto cleanup;
-        }
-    }
-
-    for (i = 0; i < nhosts; i++) {
-        if (fputs(hosts[i].ip, f) == EOF || fputc('\t', f) == EOF) {
-            rc = -errno;
-            VIR_FORCE_FCLOSE(f);
-
-            if (istmp)
-                unlink(tmp);
-
-            goto cleanup;
-        }
-
-        for (j = 0; j < hosts[i].nhostnames; j++) {
-            if (fputs(hosts[i].hostnames[j], f) == EOF || fputc('\t', f) == EOF) {
-                rc = -errno;
-                VIR_FORCE_FCLOSE(f);
-
-                if (istmp)
-                    unlink(tmp);
-
-                goto cleanup;
-            }
-        }
-
-        if (fputc('\n', f) == EOF) {
-            rc = -errno;
-            VIR_FORCE_FCLOSE(f);
-
-            if (istmp)
-                unlink(tmp);
+    char *old = NULL;
+    int ret = -1;
 
-            goto cleanup;
-        }
-    }
+    if (!content)
+        content = "";
 
-    if (VIR_FCLOSE(f) == EOF) {
-        rc = -errno;
+    /* Anything bigger than the new content can't be equal to it */
+    if (virFileReadAllQuiet(path, strlen(content) + 1, &old) >= 0 &&
+        STREQ(old, content)) {
+        ret = 0;
         goto cleanup;
     }
 
-    if (istmp && rename(tmp, path) < 0) {
-        rc = -errno;
-        unlink(tmp);
+    /* even if there are 0 hosts, create a 0 length file, to allow
+     * for runtime addition.
+     */
+    if (virFileRewriteStr(path, 0644, content) < 0)
         goto cleanup;
-    }
 
+    ret = 1;
  cleanup:
-    VIR_FREE(tmp);
-
-    return rc;
+    VIR_FREE(old);
+    return ret;
 }
 
 static int
 addnhostsSave(dnsmasqAddnHostsfile *addnhostsfile)
 {
-    int err = addnhostsWrite(addnhostsfile->path, addnhostsfile->hosts,
-                             addnhostsfile->nhosts);
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *content = NULL;
+    size_t i, j;
+    int ret;
 
-    if (err < 0) {
-        virReportSystemError(-err, _("cannot write config file '%s'"),
-                             addnhostsfile->path);
-        return -1;
+    for (i = 0; i < addnhostsfile->nhosts; i++) {
+        dnsmasqAddnHost *host = &addnhostsfile->hosts[i];
+
+        virBufferAsprintf(&buf, "%s\t", host->ip);
+        for (j = 0; j < host->nhostnames; j++)
+            virBufferAsprintf(&buf, "%s\t", host->hostnames[j]);
+        virBufferAddChar(&buf, '\n');
     }
 
-    return 0;
+    if (virBufferCheckError(&buf) < 0)
+        return -1;
+
+    content = virBufferContentAndReset(&buf);
+    ret = dnsmasqFileUpdate(addnhostsfile->path, content);
+    VIR_FREE(content);
+    return ret;
 }
 
 static int
@@ -311,7 +283,8 @@ hostsfileAdd(dnsmasqHostsfile *hostsfile,
              bool ipv6)
 {
     char *ipstr = NULL;
-    if (VIR_REALLOC_N(hostsfile->hosts, hostsfile->nhosts + 1) < 0)
+    if (VIR_RESIZE_N(hostsfile->hosts, hostsfile->nhosts_max,
+                     hostsfile->nhosts, 1) < 0)
         goto error;
 
     if (!(ipstr = virSocketAddrFormat(ip)))
@@ -387,73 +360,23 @@ hostsfileNew(const char *name,
 }
 
 static int
-hostsfileWrite(const char *path,
-               dnsmasqDhcpHost *hosts,
-               unsigned int nhosts)
+hostsfileSave(dnsmasqHostsfile *hostsfile)
 {
-    char *tmp;
-    FILE *f;
-    bool istmp = true;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *content = NULL;
     size_t i;
-    int rc = 0;
-
-    /* even if there are 0 hosts, create a 0 length file, to allow
-     * for runtime addition.
-     */
-
-    if (virAsprintf(&tmp, "%s.new", path) < 0)
-        return -ENOMEM;
-
-    if (!(f = fopen(tmp, "w"))) {
-        istmp = false;
-        if (!(f = fopen(path, "w"))) {
-            rc = -errno;
-            goto cleanup;
-        }
-    }
-
-    for (i = 0; i < nhosts; i++) {
-        if (fputs(hosts[i].host, f) == EOF || fputc('\n', f) == EOF) {
-            rc = -errno;
-            VIR_FORCE_FCLOSE(f);
-
-            if (istmp)
-                unlink(tmp);
-
-            goto cleanup;
-        }
-    }
-
-    if (VIR_FCLOSE(f) == EOF) {
-        rc = -errno;
-        goto cleanup;
-    }
-
-    if (istmp && rename(tmp, path) < 0) {
-        rc = -errno;
-        unlink(tmp);
-        goto cleanup;
-    }
+    int ret;
 
- cleanup:
-    VIR_FREE(tmp);
-
-    return rc;
-}
-
-static int
-hostsfileSave(dnsmasqHostsfile *hostsfile)
-{
-    int err = hostsfileWrite(hostsfile->path, hostsfile->hosts,
-                             hostsfile->nhosts);
+    for (i = 0; i < hostsfile->nhosts; i++)
+        virBufferAsprintf(&buf, "%s\n", hostsfile->hosts[i].host);
 
-    if (err < 0) {
-        virReportSystemError(-err, _("cannot write config file '%s'"),
-                             hostsfile->path);
+    if (virBufferCheckError(&buf) < 0)
         return -1;
-    }
 
-    return 0;
+    content = virBufferContentAndReset(&buf);
+    ret = dnsmasqFileUpdate(hostsfile->path, content);
+    VIR_FREE(content);
+    return ret;
 }
 
 /**
@@ -550,12 +473,17 @@ dnsmasqAddHost(dnsmasqContext *ctx,
  * dnsmasqSave:
  * @ctx: pointer to the dnsmasq context for each network
  *
- * Saves all the configurations associated with a context to disk.
+ * Saves all the configurations associated with a context to disk. Files
+ * whose content didn't change are left alone.
+ *
+ * Returns 1 if any file was written, 0 if all of them were already up
+ * to date, -1 on error.
  */
 int
 dnsmasqSave(const dnsmasqContext *ctx)
 {
-    int ret = 0;
+    int changed = 0;
+    int rc;
 
     if (virFileMakePath(ctx->config_dir) < 0) {
         virReportSystemError(errno, _("cannot create config directory '%s'"),
@@ -563,14 +491,19 @@ dnsmasqSave(const dnsmasqContext *ctx)
         return -1;
     }
 
-    if (ctx->hostsfile)
-        ret = hostsfileSave(ctx->hostsfile);
-    if (ret == 0) {
-        if (ctx->addnhostsfile)
-            ret = addnhostsSave(ctx->addnhostsfile);
+    if (ctx->hostsfile) {
+        if ((rc = hostsfileSave(ctx->hostsfile)) < 0)
+            return -1;
+        changed |= rc;
     }
 
-    return ret;
+    if (ctx->addnhostsfile) {
+        if ((rc = addnhostsSave(ctx->addnhostsfile)) < 0)
+            return -1;
+        changed |= rc;
+    }
+
+    return changed;
 }
 
 
@@ -25,6 +25,7 @@
 # define __DNSMASQ_H__
 
 # include "virobject.h"
+# include "virhash.h"
 # include "virsocketaddr.h"
 
 typedef struct
@@ -40,6 +41,7 @@ typedef struct
 typedef struct
 {
     unsigned int     nhosts;
+    size_t           nhosts_max;
     dnsmasqDhcpHost *hosts;
 
     char            *path;  /* Absolute path of dnsmasq's hostsfile. */
@@ -56,7 +58,9 @@ typedef struct
 typedef struct
 {
     unsigned int     nhosts;
+    size_t           nhosts_max;
     dnsmasqAddnHost *hosts;
+    virHashTablePtr  ips;   /* index + 1 of the entry for each IP */
 
     char            *path;  /* Absolute path of dnsmasq's hostsfile. */
 } dnsmasqAddnHostsfile;
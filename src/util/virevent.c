@@ -78,6 +78,37 @@ virEventAddHandle(int fd,
     return addHandleImpl(fd, events, cb, opaque, ff);
 }
 
+/**
+ * virEventAddHandleKey:
+ *
+ * @fd: file handle to monitor for events
+ * @events: bitset of events to watch from virEventHandleType constants
+ * @cb: callback to invoke when an event occurs
+ * @opaque: user data to pass to callback
+ * @ff: callback to free opaque when handle is removed
+ * @key: identifies the object owning the handle
+ *
+ * Same as virEventAddHandle(), but allows the default event loop
+ * implementation to service all handles registered with the same
+ * @key from the same thread. Other implementations ignore @key.
+ *
+ * Returns -1 if the file handle cannot be registered, otherwise a handle
+ * watch number to be used for updating and unregistering for events.
+ */
+int
+virEventAddHandleKey(int fd,
+                     int events,
+                     virEventHandleCallback cb,
+                     void *opaque,
+                     virFreeCallback ff,
+                     unsigned int key)
+{
+    if (addHandleImpl == virEventPollAddHandle)
+        return virEventPollAddHandleKey(fd, events, cb, opaque, ff, key);
+
+    return virEventAddHandle(fd, events, cb, opaque, ff);
+}
+
 /**
  * virEventUpdateHandle:
  *
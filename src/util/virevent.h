@@ -25,4 +25,11 @@
 # define __VIR_EVENT_H__
 # include "internal.h"
 
+int virEventAddHandleKey(int fd,
+                         int events,
+                         virEventHandleCallback cb,
+                         void *opaque,
+                         virFreeCallback ff,
+                         unsigned int key);
+
 #endif /* __VIR_EVENT_H__ */
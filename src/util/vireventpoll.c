@@ -30,6 +30,9 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
 
 #include "virthread.h"
 #include "virlog.h"
@@ -40,6 +43,7 @@
 #include "virerror.h"
 #include "virprobe.h"
 #include "virtime.h"
+#include "viratomic.h"
 
 #define EVENT_DEBUG(fmt, ...) VIR_DEBUG(fmt, __VA_ARGS__)
 
@@ -47,8 +51,6 @@
 
 VIR_LOG_INIT("util.eventpoll");
 
-static int virEventPollInterruptLocked(void);
-
 /* State for a single file handle being monitored */
 struct virEventPollHandle {
     int watch;
@@ -58,6 +60,11 @@ struct virEventPollHandle {
     virFreeCallback ff;
     void *opaque;
     int deleted;
+#if HAVE_SYS_EPOLL_H
+    int epollFD;   /* FD registered with epoll, or -1 if not registered */
+    bool epollDup; /* epollFD is our own duplicate of fd */
+    bool alwaysReady; /* fd can't be polled, see virEventPollBackendUpdate */
+#endif
 };
 
 /* State for a single timer being generated */
@@ -69,106 +76,688 @@ struct virEventPollTimeout {
     virFreeCallback ff;
     void *opaque;
     int deleted;
+    size_t heapIndex; /* position in the timer heap, or HEAP_NONE */
+};
+
+/* A handle which had an event pending when the loop last woke up */
+struct virEventPollReady {
+    struct virEventPollHandle *handle;
+    int revents;
 };
 
 /* Allocate extra slots for virEventPollHandle/virEventPollTimeout
    records in this multiple */
 #define EVENT_ALLOC_EXTENT 10
 
-/* State for the main event loop */
+/* Maximum number of events fetched from epoll at once */
+#define EVENT_EPOLL_BATCH 128
+
+#define HEAP_NONE ((size_t) -1)
+
+/* State for one event loop. The first one is run by the application
+ * via virEventPollRunOnce(), any further shards run in their own
+ * threads started by virEventPollStartShards() */
 struct virEventPollLoop {
     virMutex lock;
     int running;
     virThread leader;
     int wakeupfd[2];
+    size_t shard;
+
+    /* Both lists are kept sorted by watch / timer ID since new
+     * records are only ever appended with increasing IDs */
     size_t handlesCount;
     size_t handlesAlloc;
-    struct virEventPollHandle *handles;
+    size_t handlesDeleted;
+    struct virEventPollHandle **handles;
     size_t timeoutsCount;
     size_t timeoutsAlloc;
-    struct virEventPollTimeout *timeouts;
+    size_t timeoutsDeleted;
+    struct virEventPollTimeout **timeouts;
+
+    /* Min-heap of the enabled timers ordered by expiry time. Both
+     * arrays are always large enough to hold every timer record */
+    size_t heapCount;
+    size_t heapAlloc;
+    struct virEventPollTimeout **heap;
+    size_t expiredAlloc;
+    struct virEventPollTimeout **expired;
+
+    size_t readyCount;
+    size_t readyAlloc;
+    struct virEventPollReady *ready;
+
+#if HAVE_SYS_EPOLL_H
+    int epollfd;
+    struct epoll_event epollEvents[EVENT_EPOLL_BATCH];
+
+    /* Handles whose FD epoll refuses, reported ready on every
+     * iteration of the loop */
+    size_t alwaysReadyCount;
+    struct virEventPollHandle **alwaysReady;
+#else
+    size_t pollfdsCount;
+    size_t pollfdsAlloc;
+    struct pollfd *pollfds;
+    struct virEventPollHandle **pollHandles;
+#endif
 };
 
-/* Only have one event loop */
-static struct virEventPollLoop eventLoop;
+static int virEventPollInterruptLocked(struct virEventPollLoop *loop);
 
-/* Unique ID for the next FD watch to be registered */
-static int nextWatch = 1;
+/* Timers are always handled by the first loop, file handles are
+ * spread across all of them */
+static struct virEventPollLoop eventLoops[VIR_EVENT_POLL_MAX_SHARDS];
+static int eventLoopShards = 1;
+
+/* Sequence number of the last FD watch registered. Watch IDs encode
+ * the shard in their lowest bits, so that a handle can be found
+ * without consulting any shared state. */
+static int lastWatch;
+
+#define EVENT_WATCH_SHARD_BITS 4
+#define EVENT_WATCH(seq, shard) (((seq) << EVENT_WATCH_SHARD_BITS) | (shard))
+#define EVENT_WATCH_SHARD(watch) \
+    ((watch) & ((1 << EVENT_WATCH_SHARD_BITS) - 1))
+
+verify(VIR_EVENT_POLL_MAX_SHARDS <= (1 << EVENT_WATCH_SHARD_BITS));
 
 /* Unique ID for the next timer to be registered */
 static int nextTimer = 1;
 
+
+static int
+virEventPollHandleCompare(const void *key, const void *elem)
+{
+    int watch = *(const int *)key;
+    const struct virEventPollHandle *handle =
+        *(struct virEventPollHandle *const *)elem;
+
+    if (watch < handle->watch)
+        return -1;
+    return watch > handle->watch;
+}
+
+static struct virEventPollHandle *
+virEventPollFindHandle(struct virEventPollLoop *loop, int watch)
+{
+    struct virEventPollHandle **handle;
+
+    handle = bsearch(&watch, loop->handles, loop->handlesCount,
+                     sizeof(*loop->handles), virEventPollHandleCompare);
+    return handle ? *handle : NULL;
+}
+
+static int
+virEventPollTimeoutCompare(const void *key, const void *elem)
+{
+    int timer = *(const int *)key;
+    const struct virEventPollTimeout *timeout =
+        *(struct virEventPollTimeout *const *)elem;
+
+    if (timer < timeout->timer)
+        return -1;
+    return timer > timeout->timer;
+}
+
+static struct virEventPollTimeout *
+virEventPollFindTimeout(struct virEventPollLoop *loop, int timer)
+{
+    struct virEventPollTimeout **timeout;
+
+    timeout = bsearch(&timer, loop->timeouts, loop->timeoutsCount,
+                      sizeof(*loop->timeouts), virEventPollTimeoutCompare);
+    return timeout ? *timeout : NULL;
+}
+
+
+/*
+ * Timer heap. The heap arrays are sized when a timer is added
+ * so none of these operations can fail.
+ */
+static void
+virEventPollHeapSet(struct virEventPollLoop *loop, size_t i,
+                    struct virEventPollTimeout *timeout)
+{
+    loop->heap[i] = timeout;
+    timeout->heapIndex = i;
+}
+
+static void
+virEventPollHeapSiftUp(struct virEventPollLoop *loop, size_t i)
+{
+    struct virEventPollTimeout *timeout = loop->heap[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (loop->heap[parent]->expiresAt <= timeout->expiresAt)
+            break;
+        virEventPollHeapSet(loop, i, loop->heap[parent]);
+        i = parent;
+    }
+    virEventPollHeapSet(loop, i, timeout);
+}
+
+static void
+virEventPollHeapSiftDown(struct virEventPollLoop *loop, size_t i)
+{
+    struct virEventPollTimeout *timeout = loop->heap[i];
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= loop->heapCount)
+            break;
+        if (child + 1 < loop->heapCount &&
+            loop->heap[child + 1]->expiresAt <
+            loop->heap[child]->expiresAt)
+            child++;
+        if (timeout->expiresAt <= loop->heap[child]->expiresAt)
+            break;
+        virEventPollHeapSet(loop, i, loop->heap[child]);
+        i = child;
+    }
+    virEventPollHeapSet(loop, i, timeout);
+}
+
+static void
+virEventPollHeapRemove(struct virEventPollLoop *loop,
+                       struct virEventPollTimeout *timeout)
+{
+    struct virEventPollTimeout *last;
+    size_t i = timeout->heapIndex;
+
+    if (i == HEAP_NONE)
+        return;
+
+    timeout->heapIndex = HEAP_NONE;
+    if (i == --loop->heapCount)
+        return;
+
+    /* Move the last element into the hole and restore the heap order */
+    last = loop->heap[loop->heapCount];
+    virEventPollHeapSet(loop, i, last);
+    virEventPollHeapSiftDown(loop, i);
+    virEventPollHeapSiftUp(loop, last->heapIndex);
+}
+
+/* Put @timeout at the right place in the heap after its expiry
+ * time or frequency changed */
+static void
+virEventPollHeapUpdate(struct virEventPollLoop *loop,
+                       struct virEventPollTimeout *timeout)
+{
+    if (timeout->deleted || timeout->frequency < 0) {
+        virEventPollHeapRemove(loop, timeout);
+        return;
+    }
+
+    if (timeout->heapIndex == HEAP_NONE) {
+        sa_assert(loop->heapCount < loop->heapAlloc);
+        virEventPollHeapSet(loop, loop->heapCount++, timeout);
+        virEventPollHeapSiftUp(loop, timeout->heapIndex);
+    } else {
+        virEventPollHeapSiftDown(loop, timeout->heapIndex);
+        virEventPollHeapSiftUp(loop, timeout->heapIndex);
+    }
+}
+
+
+#if HAVE_SYS_EPOLL_H
+# define EPOLL_DATA(watch, fd) \
+    (((uint64_t)(unsigned int)(fd) << 32) | (unsigned int)(watch))
+# define EPOLL_DATA_WATCH(data) ((int)((data) & 0xffffffff))
+# define EPOLL_DATA_FD(data) ((int)((data) >> 32))
+
+static int
+virEventPollToEpollEvents(int events)
+{
+    int ret = 0;
+    if (events & POLLIN)
+        ret |= EPOLLIN;
+    if (events & POLLOUT)
+        ret |= EPOLLOUT;
+    if (events & POLLERR)
+        ret |= EPOLLERR;
+    if (events & POLLHUP)
+        ret |= EPOLLHUP;
+    return ret;
+}
+
+static int
+virEventPollFromEpollEvents(int events)
+{
+    int ret = 0;
+    if (events & EPOLLIN)
+        ret |= POLLIN;
+    if (events & EPOLLOUT)
+        ret |= POLLOUT;
+    if (events & EPOLLERR)
+        ret |= POLLERR;
+    if (events & EPOLLHUP)
+        ret |= POLLHUP;
+    return ret;
+}
+
+static int
+virEventPollBackendInit(struct virEventPollLoop *loop)
+{
+    if ((loop->epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create epoll instance"));
+        return -1;
+    }
+    return 0;
+}
+
+static void
+virEventPollBackendUnregister(struct virEventPollLoop *loop,
+                              struct virEventPollHandle *handle)
+{
+    size_t i;
+
+    if (handle->alwaysReady) {
+        for (i = 0; i < loop->alwaysReadyCount; i++) {
+            if (loop->alwaysReady[i] == handle) {
+                VIR_DELETE_ELEMENT(loop->alwaysReady, i,
+                                   loop->alwaysReadyCount);
+                break;
+            }
+        }
+        handle->alwaysReady = false;
+        return;
+    }
+
+    if (handle->epollFD < 0)
+        return;
+
+    if (handle->epollDup) {
+        ignore_value(epoll_ctl(loop->epollfd, EPOLL_CTL_DEL,
+                               handle->epollFD, NULL));
+        VIR_FORCE_CLOSE(handle->epollFD);
+        handle->epollDup = false;
+        return;
+    }
+
+    /* If the caller closed the FD before removing the handle, the FD
+     * number may already have been reused and registered by a
+     * different handle whose registration must not be dropped. */
+    for (i = 0; i < loop->handlesCount; i++) {
+        struct virEventPollHandle *other = loop->handles[i];
+        if (other != handle && !other->epollDup &&
+            other->epollFD == handle->epollFD)
+            goto done;
+    }
+
+    if (epoll_ctl(loop->epollfd, EPOLL_CTL_DEL, handle->epollFD, NULL) < 0)
+        EVENT_DEBUG("Unable to unregister fd %d: %d", handle->epollFD, errno);
+
+ done:
+    handle->epollFD = -1;
+}
+
+/*
+ * Keep the epoll registration of @handle in sync with the events
+ * it is interested in. Handles without events or marked as deleted
+ * are not registered at all.
+ *
+ * epoll refuses FDs of regular files and of some character devices
+ * such as /dev/null with EPERM.  poll() reports those as always
+ * readable and writable, so such handles are put on a list which
+ * gets the requested events on every iteration instead.
+ */
+static int
+virEventPollBackendUpdate(struct virEventPollLoop *loop,
+                          struct virEventPollHandle *handle)
+{
+    struct epoll_event ev;
+    int fd;
+
+    if (!handle->events || handle->deleted) {
+        virEventPollBackendUnregister(loop, handle);
+        return 0;
+    }
+
+    if (handle->alwaysReady)
+        return 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = virEventPollToEpollEvents(handle->events);
+
+    if (handle->epollFD >= 0) {
+        ev.data.u64 = EPOLL_DATA(handle->watch, handle->epollFD);
+        if (epoll_ctl(loop->epollfd, EPOLL_CTL_MOD,
+                      handle->epollFD, &ev) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to update epoll events of fd %d"),
+                                 handle->fd);
+            return -1;
+        }
+        return 0;
+    }
+
+    fd = handle->fd;
+    ev.data.u64 = EPOLL_DATA(handle->watch, fd);
+    if (epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        if (errno == EPERM) {
+            EVENT_DEBUG("fd %d can't be polled, treating it as ready", fd);
+            if (VIR_APPEND_ELEMENT_COPY(loop->alwaysReady,
+                                        loop->alwaysReadyCount, handle) < 0)
+                return -1;
+            handle->alwaysReady = true;
+            return 0;
+        }
+
+        if (errno != EEXIST) {
+            virReportSystemError(errno,
+                                 _("Unable to add fd %d to epoll"),
+                                 handle->fd);
+            return -1;
+        }
+
+        /* The same FD is watched by another handle. An FD can be
+         * registered with epoll only once, so use a duplicate. */
+        if ((fd = fcntl(handle->fd, F_DUPFD_CLOEXEC, 0)) >= 0)
+            ev.data.u64 = EPOLL_DATA(handle->watch, fd);
+        if (fd < 0 ||
+            epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to add fd %d to epoll"),
+                                 handle->fd);
+            VIR_FORCE_CLOSE(fd);
+            return -1;
+        }
+        handle->epollDup = true;
+    }
+
+    handle->epollFD = fd;
+    return 0;
+}
+
+static int
+virEventPollBackendPrepare(struct virEventPollLoop *loop ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+static int
+virEventPollBackendWait(struct virEventPollLoop *loop, int timeout)
+{
+    /* Don't wait when there are handles ready right away */
+    if (loop->alwaysReadyCount)
+        timeout = 0;
+
+    return epoll_wait(loop->epollfd, loop->epollEvents,
+                      EVENT_EPOLL_BATCH, timeout);
+}
+
+/*
+ * Registrations are identified by the watch rather than a pointer to
+ * the handle, since epoll keeps reporting events for an FD which was
+ * closed without being removed first for as long as another reference
+ * to the same open file exists (e.g. in a child process).
+ */
+static void
+virEventPollBackendDropStale(struct virEventPollLoop *loop, int watch, int fd)
+{
+    size_t i;
+
+    for (i = 0; i < loop->handlesCount; i++) {
+        if (loop->handles[i]->epollFD == fd)
+            return;
+    }
+
+    EVENT_DEBUG("Dropping stale registration of fd %d watch %d", fd, watch);
+    ignore_value(epoll_ctl(loop->epollfd, EPOLL_CTL_DEL, fd, NULL));
+}
+
+static int
+virEventPollBackendCollect(struct virEventPollLoop *loop, int nevents)
+{
+    size_t i;
+
+    if (VIR_RESIZE_N(loop->ready, loop->readyAlloc,
+                     0, nevents + loop->alwaysReadyCount) < 0)
+        return -1;
+
+    loop->readyCount = 0;
+    for (i = 0; i < loop->alwaysReadyCount; i++) {
+        struct virEventPollHandle *handle = loop->alwaysReady[i];
+
+        loop->ready[loop->readyCount].handle = handle;
+        loop->ready[loop->readyCount].revents =
+            handle->events & (POLLIN | POLLOUT);
+        loop->readyCount++;
+    }
+
+    for (i = 0; i < nevents; i++) {
+        uint64_t data = loop->epollEvents[i].data.u64;
+        int watch = EPOLL_DATA_WATCH(data);
+        struct virEventPollHandle *handle = virEventPollFindHandle(loop, watch);
+
+        if (!handle) {
+            virEventPollBackendDropStale(loop, watch, EPOLL_DATA_FD(data));
+            continue;
+        }
+
+        loop->ready[loop->readyCount].handle = handle;
+        loop->ready[loop->readyCount].revents =
+            virEventPollFromEpollEvents(loop->epollEvents[i].events);
+        loop->readyCount++;
+    }
+
+    return 0;
+}
+
+#else /* !HAVE_SYS_EPOLL_H */
+
+static int
+virEventPollBackendInit(struct virEventPollLoop *loop ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+static void
+virEventPollBackendUnregister(struct virEventPollLoop *loop ATTRIBUTE_UNUSED,
+                              struct virEventPollHandle *handle ATTRIBUTE_UNUSED)
+{
+}
+
+static int
+virEventPollBackendUpdate(struct virEventPollLoop *loop ATTRIBUTE_UNUSED,
+                          struct virEventPollHandle *handle ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+/*
+ * Fill the pollfd array with data for all registered file handles.
+ */
+static int
+virEventPollBackendPrepare(struct virEventPollLoop *loop)
+{
+    size_t i;
+    size_t n = loop->handlesCount;
+
+    if (VIR_RESIZE_N(loop->pollfds, loop->pollfdsAlloc, 0, n) < 0)
+        return -1;
+    if (VIR_REALLOC_N(loop->pollHandles, loop->pollfdsAlloc) < 0)
+        return -1;
+
+    loop->pollfdsCount = 0;
+    for (i = 0; i < loop->handlesCount; i++) {
+        struct virEventPollHandle *handle = loop->handles[i];
+        EVENT_DEBUG("Prepare n=%zu w=%d, f=%d e=%d d=%d", i,
+                    handle->watch, handle->fd,
+                    handle->events, handle->deleted);
+        if (!handle->events || handle->deleted)
+            continue;
+        loop->pollfds[loop->pollfdsCount].fd = handle->fd;
+        loop->pollfds[loop->pollfdsCount].events = handle->events;
+        loop->pollfds[loop->pollfdsCount].revents = 0;
+        loop->pollHandles[loop->pollfdsCount] = handle;
+        loop->pollfdsCount++;
+    }
+
+    return 0;
+}
+
+static int
+virEventPollBackendWait(struct virEventPollLoop *loop, int timeout)
+{
+    return poll(loop->pollfds, loop->pollfdsCount, timeout);
+}
+
+static int
+virEventPollBackendCollect(struct virEventPollLoop *loop, int nevents)
+{
+    size_t i;
+
+    if (VIR_RESIZE_N(loop->ready, loop->readyAlloc,
+                     0, nevents) < 0)
+        return -1;
+
+    loop->readyCount = 0;
+    for (i = 0; i < loop->pollfdsCount &&
+                loop->readyCount < nevents; i++) {
+        if (!loop->pollfds[i].revents)
+            continue;
+        loop->ready[loop->readyCount].handle = loop->pollHandles[i];
+        loop->ready[loop->readyCount].revents =
+            loop->pollfds[i].revents;
+        loop->readyCount++;
+    }
+
+    return 0;
+}
+#endif /* !HAVE_SYS_EPOLL_H */
+
+
+/* Find the loop a watch was registered with */
+static struct virEventPollLoop *
+virEventPollLoopForWatch(int watch)
+{
+    size_t shard = EVENT_WATCH_SHARD(watch);
+
+    if (shard >= virAtomicIntGet(&eventLoopShards))
+        return NULL;
+    return &eventLoops[shard];
+}
+
 /*
  * Register a callback for monitoring file handle events.
  * NB, it *must* be safe to call this from within a callback
  * For this reason we only ever append to existing list.
  */
-int virEventPollAddHandle(int fd, int events,
+static int
+virEventPollAddHandleLoop(struct virEventPollLoop *loop,
+                          int fd, int events,
                           virEventHandleCallback cb,
                           void *opaque,
                           virFreeCallback ff)
 {
+    struct virEventPollHandle *handle;
     int watch;
-    virMutexLock(&eventLoop.lock);
-    if (eventLoop.handlesCount == eventLoop.handlesAlloc) {
+
+    if (VIR_ALLOC(handle) < 0)
+        return -1;
+
+    virMutexLock(&loop->lock);
+    if (loop->handlesCount == loop->handlesAlloc) {
         EVENT_DEBUG("Used %zu handle slots, adding at least %d more",
-                    eventLoop.handlesAlloc, EVENT_ALLOC_EXTENT);
-        if (VIR_RESIZE_N(eventLoop.handles, eventLoop.handlesAlloc,
-                         eventLoop.handlesCount, EVENT_ALLOC_EXTENT) < 0) {
-            virMutexUnlock(&eventLoop.lock);
+                    loop->handlesAlloc, EVENT_ALLOC_EXTENT);
+        if (VIR_RESIZE_N(loop->handles, loop->handlesAlloc,
+                         loop->handlesCount, EVENT_ALLOC_EXTENT) < 0) {
+            virMutexUnlock(&loop->lock);
+            VIR_FREE(handle);
             return -1;
         }
     }
 
-    watch = nextWatch++;
-
-    eventLoop.handles[eventLoop.handlesCount].watch = watch;
-    eventLoop.handles[eventLoop.handlesCount].fd = fd;
-    eventLoop.handles[eventLoop.handlesCount].events =
-                                         virEventPollToNativeEvents(events);
-    eventLoop.handles[eventLoop.handlesCount].cb = cb;
-    eventLoop.handles[eventLoop.handlesCount].ff = ff;
-    eventLoop.handles[eventLoop.handlesCount].opaque = opaque;
-    eventLoop.handles[eventLoop.handlesCount].deleted = 0;
+    /* The ID is allocated with the shard locked so that the list
+     * of handles of each shard stays sorted */
+    handle->watch = EVENT_WATCH(virAtomicIntInc(&lastWatch), loop->shard);
+    handle->fd = fd;
+    handle->events = virEventPollToNativeEvents(events);
+    handle->cb = cb;
+    handle->ff = ff;
+    handle->opaque = opaque;
+    handle->deleted = 0;
+#if HAVE_SYS_EPOLL_H
+    handle->epollFD = -1;
+#endif
+
+    if (virEventPollBackendUpdate(loop, handle) < 0) {
+        virMutexUnlock(&loop->lock);
+        VIR_FREE(handle);
+        return -1;
+    }
 
-    eventLoop.handlesCount++;
+    watch = handle->watch;
+    loop->handles[loop->handlesCount++] = handle;
 
-    virEventPollInterruptLocked();
+#if !HAVE_SYS_EPOLL_H
+    /* epoll picks up the new registration without waking the loop up */
+    virEventPollInterruptLocked(loop);
+#endif
 
     PROBE(EVENT_POLL_ADD_HANDLE,
           "watch=%d fd=%d events=%d cb=%p opaque=%p ff=%p",
           watch, fd, events, cb, opaque, ff);
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
     return watch;
 }
 
+int virEventPollAddHandle(int fd, int events,
+                          virEventHandleCallback cb,
+                          void *opaque,
+                          virFreeCallback ff)
+{
+    return virEventPollAddHandleLoop(&eventLoops[0], fd, events,
+                                     cb, opaque, ff);
+}
+
+/*
+ * Register the handle with the shard picked by @key. Handles
+ * sharing a key are always serviced by the same thread.
+ */
+int virEventPollAddHandleKey(int fd, int events,
+                             virEventHandleCallback cb,
+                             void *opaque,
+                             virFreeCallback ff,
+                             unsigned int key)
+{
+    size_t shard = key % virAtomicIntGet(&eventLoopShards);
+
+    return virEventPollAddHandleLoop(&eventLoops[shard], fd, events,
+                                     cb, opaque, ff);
+}
+
 void virEventPollUpdateHandle(int watch, int events)
 {
-    size_t i;
-    bool found = false;
+    struct virEventPollLoop *loop;
+    struct virEventPollHandle *handle;
     PROBE(EVENT_POLL_UPDATE_HANDLE,
           "watch=%d events=%d",
           watch, events);
 
-    if (watch <= 0) {
+    if (watch <= 0 || !(loop = virEventPollLoopForWatch(watch))) {
         VIR_WARN("Ignoring invalid update watch %d", watch);
         return;
     }
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].watch == watch) {
-            eventLoop.handles[i].events =
-                    virEventPollToNativeEvents(events);
-            virEventPollInterruptLocked();
-            found = true;
-            break;
-        }
+    virMutexLock(&loop->lock);
+    if ((handle = virEventPollFindHandle(loop, watch))) {
+        handle->events = virEventPollToNativeEvents(events);
+        if (virEventPollBackendUpdate(loop, handle) < 0)
+            VIR_WARN("Unable to update events of handle watch %d", watch);
+#if !HAVE_SYS_EPOLL_H
+        virEventPollInterruptLocked(loop);
+#endif
     }
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
-    if (!found)
+    if (!handle)
         VIR_WARN("Got update for non-existent handle watch %d", watch);
 }
 
@@ -180,31 +769,30 @@ void virEventPollUpdateHandle(int watch, int events)
  */
 int virEventPollRemoveHandle(int watch)
 {
-    size_t i;
+    struct virEventPollLoop *loop;
+    struct virEventPollHandle *handle;
     PROBE(EVENT_POLL_REMOVE_HANDLE,
           "watch=%d",
           watch);
 
-    if (watch <= 0) {
+    if (watch <= 0 || !(loop = virEventPollLoopForWatch(watch))) {
         VIR_WARN("Ignoring invalid remove watch %d", watch);
         return -1;
     }
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].deleted)
-            continue;
-
-        if (eventLoop.handles[i].watch == watch) {
-            EVENT_DEBUG("mark delete %zu %d", i, eventLoop.handles[i].fd);
-            eventLoop.handles[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
-        }
+    virMutexLock(&loop->lock);
+    if (!(handle = virEventPollFindHandle(loop, watch)) || handle->deleted) {
+        virMutexUnlock(&loop->lock);
+        return -1;
     }
-    virMutexUnlock(&eventLoop.lock);
-    return -1;
+
+    EVENT_DEBUG("mark delete %d %d", watch, handle->fd);
+    handle->deleted = 1;
+    loop->handlesDeleted++;
+    virEventPollBackendUnregister(loop, handle);
+    virEventPollInterruptLocked(loop);
+    virMutexUnlock(&loop->lock);
+    return 0;
 }
 
 
@@ -218,48 +806,63 @@ int virEventPollAddTimeout(int frequency,
                            void *opaque,
                            virFreeCallback ff)
 {
+    struct virEventPollLoop *loop = &eventLoops[0];
+    struct virEventPollTimeout *timeout;
     unsigned long long now;
     int ret;
 
     if (virTimeMillisNow(&now) < 0)
         return -1;
 
-    virMutexLock(&eventLoop.lock);
-    if (eventLoop.timeoutsCount == eventLoop.timeoutsAlloc) {
+    if (VIR_ALLOC(timeout) < 0)
+        return -1;
+
+    virMutexLock(&loop->lock);
+    if (loop->timeoutsCount == loop->timeoutsAlloc) {
         EVENT_DEBUG("Used %zu timeout slots, adding at least %d more",
-                    eventLoop.timeoutsAlloc, EVENT_ALLOC_EXTENT);
-        if (VIR_RESIZE_N(eventLoop.timeouts, eventLoop.timeoutsAlloc,
-                         eventLoop.timeoutsCount, EVENT_ALLOC_EXTENT) < 0) {
-            virMutexUnlock(&eventLoop.lock);
-            return -1;
-        }
+                    loop->timeoutsAlloc, EVENT_ALLOC_EXTENT);
+        if (VIR_RESIZE_N(loop->timeouts, loop->timeoutsAlloc,
+                         loop->timeoutsCount, EVENT_ALLOC_EXTENT) < 0)
+            goto error;
     }
+    if (loop->heapAlloc < loop->timeoutsAlloc &&
+        (VIR_REALLOC_N(loop->heap, loop->timeoutsAlloc) < 0 ||
+         VIR_REALLOC_N(loop->expired, loop->timeoutsAlloc) < 0))
+        goto error;
+    loop->heapAlloc = loop->expiredAlloc = loop->timeoutsAlloc;
+
+    timeout->timer = nextTimer++;
+    timeout->frequency = frequency;
+    timeout->cb = cb;
+    timeout->ff = ff;
+    timeout->opaque = opaque;
+    timeout->deleted = 0;
+    timeout->expiresAt = frequency >= 0 ? frequency + now : 0;
+    timeout->heapIndex = HEAP_NONE;
 
-    eventLoop.timeouts[eventLoop.timeoutsCount].timer = nextTimer++;
-    eventLoop.timeouts[eventLoop.timeoutsCount].frequency = frequency;
-    eventLoop.timeouts[eventLoop.timeoutsCount].cb = cb;
-    eventLoop.timeouts[eventLoop.timeoutsCount].ff = ff;
-    eventLoop.timeouts[eventLoop.timeoutsCount].opaque = opaque;
-    eventLoop.timeouts[eventLoop.timeoutsCount].deleted = 0;
-    eventLoop.timeouts[eventLoop.timeoutsCount].expiresAt =
-        frequency >= 0 ? frequency + now : 0;
+    loop->timeouts[loop->timeoutsCount++] = timeout;
+    virEventPollHeapUpdate(loop, timeout);
 
-    eventLoop.timeoutsCount++;
-    ret = nextTimer-1;
-    virEventPollInterruptLocked();
+    ret = timeout->timer;
+    virEventPollInterruptLocked(loop);
 
     PROBE(EVENT_POLL_ADD_TIMEOUT,
           "timer=%d frequency=%d cb=%p opaque=%p ff=%p",
           ret, frequency, cb, opaque, ff);
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
     return ret;
+
+ error:
+    virMutexUnlock(&loop->lock);
+    VIR_FREE(timeout);
+    return -1;
 }
 
 void virEventPollUpdateTimeout(int timer, int frequency)
 {
+    struct virEventPollLoop *loop = &eventLoops[0];
+    struct virEventPollTimeout *timeout;
     unsigned long long now;
-    size_t i;
-    bool found = false;
     PROBE(EVENT_POLL_UPDATE_TIMEOUT,
           "timer=%d frequency=%d",
           timer, frequency);
@@ -272,22 +875,18 @@ void virEventPollUpdateTimeout(int timer, int frequency)
     if (virTimeMillisNow(&now) < 0)
         return;
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].frequency = frequency;
-            eventLoop.timeouts[i].expiresAt =
-                frequency >= 0 ? frequency + now : 0;
-            VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
-                      eventLoop.timeouts[i].expiresAt);
-            virEventPollInterruptLocked();
-            found = true;
-            break;
-        }
+    virMutexLock(&loop->lock);
+    if ((timeout = virEventPollFindTimeout(loop, timer))) {
+        timeout->frequency = frequency;
+        timeout->expiresAt = frequency >= 0 ? frequency + now : 0;
+        virEventPollHeapUpdate(loop, timeout);
+        VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
+                  timeout->expiresAt);
+        virEventPollInterruptLocked(loop);
     }
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
-    if (!found)
+    if (!timeout)
         VIR_WARN("Got update for non-existent timer %d", timer);
 }
 
@@ -299,7 +898,8 @@ void virEventPollUpdateTimeout(int timer, int frequency)
  */
 int virEventPollRemoveTimeout(int timer)
 {
-    size_t i;
+    struct virEventPollLoop *loop = &eventLoops[0];
+    struct virEventPollTimeout *timeout;
     PROBE(EVENT_POLL_REMOVE_TIMEOUT,
           "timer=%d",
           timer);
@@ -309,48 +909,39 @@ int virEventPollRemoveTimeout(int timer)
         return -1;
     }
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
-        }
+    virMutexLock(&loop->lock);
+    if (!(timeout = virEventPollFindTimeout(loop, timer)) || timeout->deleted) {
+        virMutexUnlock(&loop->lock);
+        return -1;
     }
-    virMutexUnlock(&eventLoop.lock);
-    return -1;
+
+    timeout->deleted = 1;
+    loop->timeoutsDeleted++;
+    virEventPollHeapRemove(loop, timeout);
+    virEventPollInterruptLocked(loop);
+    virMutexUnlock(&loop->lock);
+    return 0;
 }
 
-/* Iterates over all registered timeouts and determine which
- * will be the first to expire.
+/* Determine when the first of the registered timeouts expires,
+ * which is the one at the top of the heap.
  * @timeout: filled with expiry time of soonest timer, or -1 if
  *           no timeout is pending
  * returns: 0 on success, -1 on error
  */
-static int virEventPollCalculateTimeout(int *timeout)
+static int virEventPollCalculateTimeout(struct virEventPollLoop *loop,
+                                        int *timeout)
 {
     unsigned long long then = 0;
-    size_t i;
-    EVENT_DEBUG("Calculate expiry of %zu timers", eventLoop.timeoutsCount);
+    EVENT_DEBUG("Calculate expiry of %zu timers", loop->heapCount);
     /* Figure out if we need a timeout */
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-        if (eventLoop.timeouts[i].frequency < 0)
-            continue;
-
-        EVENT_DEBUG("Got a timeout scheduled for %llu", eventLoop.timeouts[i].expiresAt);
-        if (then == 0 ||
-            eventLoop.timeouts[i].expiresAt < then)
-            then = eventLoop.timeouts[i].expiresAt;
+    if (loop->heapCount > 0) {
+        then = loop->heap[0]->expiresAt;
+        EVENT_DEBUG("Got a timeout scheduled for %llu", then);
     }
 
     /* Calculate how long we should wait for a timeout if needed */
-    if (then > 0) {
+    if (loop->heapCount > 0) {
         unsigned long long now;
 
         if (virTimeMillisNow(&now) < 0)
@@ -373,46 +964,9 @@ static int virEventPollCalculateTimeout(int *timeout)
     return 0;
 }
 
-/*
- * Allocate a pollfd array containing data for all registered
- * file handles. The caller must free the returned data struct
- * returns: the pollfd array, or NULL on error
- */
-static struct pollfd *virEventPollMakePollFDs(int *nfds) {
-    struct pollfd *fds;
-    size_t i;
-
-    *nfds = 0;
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].events && !eventLoop.handles[i].deleted)
-            (*nfds)++;
-    }
-
-    /* Setup the poll file handle data structs */
-    if (VIR_ALLOC_N(fds, *nfds) < 0)
-        return NULL;
-
-    *nfds = 0;
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        EVENT_DEBUG("Prepare n=%zu w=%d, f=%d e=%d d=%d", i,
-                    eventLoop.handles[i].watch,
-                    eventLoop.handles[i].fd,
-                    eventLoop.handles[i].events,
-                    eventLoop.handles[i].deleted);
-        if (!eventLoop.handles[i].events || eventLoop.handles[i].deleted)
-            continue;
-        fds[*nfds].fd = eventLoop.handles[i].fd;
-        fds[*nfds].events = eventLoop.handles[i].events;
-        fds[*nfds].revents = 0;
-        (*nfds)++;
-    }
-
-    return fds;
-}
-
 
 /*
- * Iterate over all timers and determine if any have expired.
+ * Determine which timers have expired from the top of the heap.
  * Invoke the user supplied callback for each timer whose
  * expiry time is met, and schedule the next timeout. Does
  * not try to 'catch up' on time if the actual expiry time
@@ -423,93 +977,111 @@ static struct pollfd *virEventPollMakePollFDs(int *nfds) {
  *
  * Returns 0 upon success, -1 if an error occurred
  */
-static int virEventPollDispatchTimeouts(void)
+static int virEventPollDispatchTimeouts(struct virEventPollLoop *loop)
 {
     unsigned long long now;
     size_t i;
-    /* Save this now - it may be changed during dispatch */
-    int ntimeouts = eventLoop.timeoutsCount;
-    VIR_DEBUG("Dispatch %d", ntimeouts);
+    size_t nexpired = 0;
 
     if (virTimeMillisNow(&now) < 0)
         return -1;
 
-    for (i = 0; i < ntimeouts; i++) {
-        if (eventLoop.timeouts[i].deleted || eventLoop.timeouts[i].frequency < 0)
+    /* Take all expired timers off the heap before running any of
+     * them, so that a timer rescheduled by a callback can't be run
+     * more than once per iteration.
+     *
+     * Add 20ms fuzz so we don't pointlessly spin doing
+     * <10ms sleeps, particularly on kernels with low HZ
+     * it is fine that a timer expires 20ms earlier than
+     * requested
+     */
+    while (loop->heapCount > 0 &&
+           loop->heap[0]->expiresAt <= (now+20)) {
+        struct virEventPollTimeout *timeout = loop->heap[0];
+        virEventPollHeapRemove(loop, timeout);
+        loop->expired[nexpired++] = timeout;
+    }
+    VIR_DEBUG("Dispatch %zu", nexpired);
+
+    for (i = 0; i < nexpired; i++) {
+        struct virEventPollTimeout *timeout = loop->expired[i];
+        virEventTimeoutCallback cb;
+        int timer;
+        void *opaque;
+
+        /* An earlier callback may have deleted, disabled or
+         * rescheduled this timer */
+        if (timeout->deleted || timeout->frequency < 0 ||
+            timeout->heapIndex != HEAP_NONE)
             continue;
 
-        /* Add 20ms fuzz so we don't pointlessly spin doing
-         * <10ms sleeps, particularly on kernels with low HZ
-         * it is fine that a timer expires 20ms earlier than
-         * requested
-         */
-        if (eventLoop.timeouts[i].expiresAt <= (now+20)) {
-            virEventTimeoutCallback cb = eventLoop.timeouts[i].cb;
-            int timer = eventLoop.timeouts[i].timer;
-            void *opaque = eventLoop.timeouts[i].opaque;
-            eventLoop.timeouts[i].expiresAt =
-                now + eventLoop.timeouts[i].frequency;
-
-            PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
-                  "timer=%d",
-                  timer);
-            virMutexUnlock(&eventLoop.lock);
-            (cb)(timer, opaque);
-            virMutexLock(&eventLoop.lock);
-        }
+        cb = timeout->cb;
+        timer = timeout->timer;
+        opaque = timeout->opaque;
+        timeout->expiresAt = now + timeout->frequency;
+        virEventPollHeapUpdate(loop, timeout);
+
+        PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
+              "timer=%d",
+              timer);
+        virMutexUnlock(&loop->lock);
+        (cb)(timer, opaque);
+        virMutexLock(&loop->lock);
     }
     return 0;
 }
 
 
-/* Iterate over all file handles and dispatch any which
- * have pending events listed in the poll() data. Invoke
- * the user supplied callback for each handle which has
- * pending events
+/* Iterate over the file handles which had pending events
+ * when the loop woke up. Invoke the user supplied callback
+ * for each handle which has pending events
  *
  * This method must cope with new handles being registered
  * by a callback, and must skip any handles marked as deleted.
  *
  * Returns 0 upon success, -1 if an error occurred
  */
-static int virEventPollDispatchHandles(int nfds, struct pollfd *fds)
-{
-    size_t i, n;
-    VIR_DEBUG("Dispatch %d", nfds);
-
-    /* NB, use nfds not eventLoop.handlesCount, because new
-     * fds might be added on end of list, and they're not
-     * in the fds array we've got */
-    for (i = 0, n = 0; n < nfds && i < eventLoop.handlesCount; n++) {
-        while (i < eventLoop.handlesCount &&
-               (eventLoop.handles[i].fd != fds[n].fd ||
-                eventLoop.handles[i].events == 0)) {
-            i++;
-        }
-        if (i == eventLoop.handlesCount)
-            break;
-
-        VIR_DEBUG("i=%zu w=%d", i, eventLoop.handles[i].watch);
-        if (eventLoop.handles[i].deleted) {
+static int virEventPollDispatchHandles(struct virEventPollLoop *loop)
+{
+    size_t i;
+    VIR_DEBUG("Dispatch %zu", loop->readyCount);
+
+    for (i = 0; i < loop->readyCount; i++) {
+        struct virEventPollHandle *handle = loop->ready[i].handle;
+        virEventHandleCallback cb;
+        int watch;
+        int fd;
+        void *opaque;
+        int hEvents;
+
+        VIR_DEBUG("i=%zu w=%d", i, handle->watch);
+        if (handle->deleted) {
             EVENT_DEBUG("Skip deleted n=%zu w=%d f=%d", i,
-                        eventLoop.handles[i].watch, eventLoop.handles[i].fd);
+                        handle->watch, handle->fd);
             continue;
         }
 
-        if (fds[n].revents) {
-            virEventHandleCallback cb = eventLoop.handles[i].cb;
-            int watch = eventLoop.handles[i].watch;
-            void *opaque = eventLoop.handles[i].opaque;
-            int hEvents = virEventPollFromNativeEvents(fds[n].revents);
-            PROBE(EVENT_POLL_DISPATCH_HANDLE,
-                  "watch=%d events=%d",
-                  watch, hEvents);
-            virMutexUnlock(&eventLoop.lock);
-            (cb)(watch, fds[n].fd, hEvents, opaque);
-            virMutexLock(&eventLoop.lock);
-        }
+        /* Another thread may have changed the events we're interested
+         * in since the loop woke up */
+        hEvents = loop->ready[i].revents &
+            (handle->events | POLLERR | POLLHUP | POLLNVAL);
+        if (!handle->events || !hEvents)
+            continue;
+
+        cb = handle->cb;
+        watch = handle->watch;
+        fd = handle->fd;
+        opaque = handle->opaque;
+        hEvents = virEventPollFromNativeEvents(hEvents);
+        PROBE(EVENT_POLL_DISPATCH_HANDLE,
+              "watch=%d events=%d",
+              watch, hEvents);
+        virMutexUnlock(&loop->lock);
+        (cb)(watch, fd, hEvents, opaque);
+        virMutexLock(&loop->lock);
     }
 
+    loop->readyCount = 0;
     return 0;
 }
 
@@ -518,48 +1090,51 @@ static int virEventPollDispatchHandles(int nfds, struct pollfd *fds)
  * were previously marked as deleted. This asynchronous
  * cleanup is needed to make dispatch re-entrant safe.
  */
-static void virEventPollCleanupTimeouts(void)
+static void virEventPollCleanupTimeouts(struct virEventPollLoop *loop)
 {
     size_t i;
+    size_t j;
     size_t gap;
-    VIR_DEBUG("Cleanup %zu", eventLoop.timeoutsCount);
+
+    if (!loop->timeoutsDeleted)
+        return;
+
+    VIR_DEBUG("Cleanup %zu", loop->timeoutsCount);
 
     /* Remove deleted entries, shuffling down remaining
      * entries as needed to form contiguous series
      */
-    for (i = 0; i < eventLoop.timeoutsCount;) {
-        if (!eventLoop.timeouts[i].deleted) {
-            i++;
+    for (i = 0, j = 0; i < loop->timeoutsCount; i++) {
+        struct virEventPollTimeout *timeout = loop->timeouts[i];
+
+        if (!timeout->deleted) {
+            loop->timeouts[j++] = timeout;
             continue;
         }
 
         PROBE(EVENT_POLL_PURGE_TIMEOUT,
               "timer=%d",
-              eventLoop.timeouts[i].timer);
-        if (eventLoop.timeouts[i].ff) {
-            virFreeCallback ff = eventLoop.timeouts[i].ff;
-            void *opaque = eventLoop.timeouts[i].opaque;
-            virMutexUnlock(&eventLoop.lock);
+              timeout->timer);
+        if (timeout->ff) {
+            virFreeCallback ff = timeout->ff;
+            void *opaque = timeout->opaque;
+            virMutexUnlock(&loop->lock);
             ff(opaque);
-            virMutexLock(&eventLoop.lock);
+            virMutexLock(&loop->lock);
         }
 
-        if ((i+1) < eventLoop.timeoutsCount) {
-            memmove(eventLoop.timeouts+i,
-                    eventLoop.timeouts+i+1,
-                    sizeof(struct virEventPollTimeout)*(eventLoop.timeoutsCount
-                                                    -(i+1)));
-        }
-        eventLoop.timeoutsCount--;
+        VIR_FREE(timeout);
     }
+    loop->timeoutsCount = j;
+    loop->timeoutsDeleted = 0;
 
     /* Release some memory if we've got a big chunk free */
-    gap = eventLoop.timeoutsAlloc - eventLoop.timeoutsCount;
-    if (eventLoop.timeoutsCount == 0 ||
-        (gap > eventLoop.timeoutsCount && gap > EVENT_ALLOC_EXTENT)) {
+    gap = loop->timeoutsAlloc - loop->timeoutsCount;
+    if (loop->timeoutsCount == 0 ||
+        (gap > loop->timeoutsCount && gap > EVENT_ALLOC_EXTENT)) {
         EVENT_DEBUG("Found %zu out of %zu timeout slots used, releasing %zu",
-                    eventLoop.timeoutsCount, eventLoop.timeoutsAlloc, gap);
-        VIR_SHRINK_N(eventLoop.timeouts, eventLoop.timeoutsAlloc, gap);
+                    loop->timeoutsCount, loop->timeoutsAlloc, gap);
+        VIR_SHRINK_N(loop->timeouts, loop->timeoutsAlloc, gap);
     }
 }
 
@@ -567,48 +1142,51 @@ static void virEventPollCleanupTimeouts(void)
  * were previously marked as deleted. This asynchronous
  * cleanup is needed to make dispatch re-entrant safe.
  */
-static void virEventPollCleanupHandles(void)
+static void virEventPollCleanupHandles(struct virEventPollLoop *loop)
 {
     size_t i;
+    size_t j;
     size_t gap;
-    VIR_DEBUG("Cleanup %zu", eventLoop.handlesCount);
+
+    if (!loop->handlesDeleted)
+        return;
+
+    VIR_DEBUG("Cleanup %zu", loop->handlesCount);
 
     /* Remove deleted entries, shuffling down remaining
      * entries as needed to form contiguous series
      */
-    for (i = 0; i < eventLoop.handlesCount;) {
-        if (!eventLoop.handles[i].deleted) {
-            i++;
+    for (i = 0, j = 0; i < loop->handlesCount; i++) {
+        struct virEventPollHandle *handle = loop->handles[i];
+
+        if (!handle->deleted) {
+            loop->handles[j++] = handle;
             continue;
         }
 
         PROBE(EVENT_POLL_PURGE_HANDLE,
               "watch=%d",
-              eventLoop.handles[i].watch);
-        if (eventLoop.handles[i].ff) {
-            virFreeCallback ff = eventLoop.handles[i].ff;
-            void *opaque = eventLoop.handles[i].opaque;
-            virMutexUnlock(&eventLoop.lock);
+              handle->watch);
+        if (handle->ff) {
+            virFreeCallback ff = handle->ff;
+            void *opaque = handle->opaque;
+            virMutexUnlock(&loop->lock);
             ff(opaque);
-            virMutexLock(&eventLoop.lock);
+            virMutexLock(&loop->lock);
         }
 
-        if ((i+1) < eventLoop.handlesCount) {
-            memmove(eventLoop.handles+i,
-                    eventLoop.handles+i+1,
-                    sizeof(struct virEventPollHandle)*(eventLoop.handlesCount
-                                                   -(i+1)));
-        }
-        eventLoop.handlesCount--;
+        VIR_FREE(handle);
     }
+    loop->handlesCount = j;
+    loop->handlesDeleted = 0;
 
     /* Release some memory if we've got a big chunk free */
-    gap = eventLoop.handlesAlloc - eventLoop.handlesCount;
-    if (eventLoop.handlesCount == 0 ||
-        (gap > eventLoop.handlesCount && gap > EVENT_ALLOC_EXTENT)) {
+    gap = loop->handlesAlloc - loop->handlesCount;
+    if (loop->handlesCount == 0 ||
+        (gap > loop->handlesCount && gap > EVENT_ALLOC_EXTENT)) {
         EVENT_DEBUG("Found %zu out of %zu handles slots used, releasing %zu",
-                    eventLoop.handlesCount, eventLoop.handlesAlloc, gap);
-        VIR_SHRINK_N(eventLoop.handles, eventLoop.handlesAlloc, gap);
+                    loop->handlesCount, loop->handlesAlloc, gap);
+        VIR_SHRINK_N(loop->handles, loop->handlesAlloc, gap);
     }
 }
 
@@ -616,29 +1194,29 @@ static void virEventPollCleanupHandles(void)
  * Run a single iteration of the event loop, blocking until
  * at least one file handle has an event, or a timer expires
  */
-int virEventPollRunOnce(void)
+static int
+virEventPollRunLoopOnce(struct virEventPollLoop *loop)
 {
-    struct pollfd *fds = NULL;
-    int ret, timeout, nfds;
+    int ret, timeout;
 
-    virMutexLock(&eventLoop.lock);
-    eventLoop.running = 1;
-    virThreadSelf(&eventLoop.leader);
+    virMutexLock(&loop->lock);
+    loop->running = 1;
+    virThreadSelf(&loop->leader);
 
-    virEventPollCleanupTimeouts();
-    virEventPollCleanupHandles();
+    virEventPollCleanupTimeouts(loop);
+    virEventPollCleanupHandles(loop);
 
-    if (!(fds = virEventPollMakePollFDs(&nfds)) ||
-        virEventPollCalculateTimeout(&timeout) < 0)
+    if (virEventPollBackendPrepare(loop) < 0 ||
+        virEventPollCalculateTimeout(loop, &timeout) < 0)
         goto error;
 
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
  retry:
     PROBE(EVENT_POLL_RUN,
-          "nhandles=%d timeout=%d",
-          nfds, timeout);
-    ret = poll(fds, nfds, timeout);
+          "nhandles=%zu timeout=%d",
+          loop->handlesCount, timeout);
+    ret = virEventPollBackendWait(loop, timeout);
     if (ret < 0) {
         EVENT_DEBUG("Poll got error event %d", errno);
         if (errno == EINTR || errno == EAGAIN)
@@ -649,92 +1227,167 @@ int virEventPollRunOnce(void)
     }
     EVENT_DEBUG("Poll got %d event(s)", ret);
 
-    virMutexLock(&eventLoop.lock);
-    if (virEventPollDispatchTimeouts() < 0)
+    virMutexLock(&loop->lock);
+    if (virEventPollBackendCollect(loop, ret) < 0)
+        goto error;
+
+    if (virEventPollDispatchTimeouts(loop) < 0)
         goto error;
 
-    if (ret > 0 &&
-        virEventPollDispatchHandles(nfds, fds) < 0)
+    if (loop->readyCount > 0 &&
+        virEventPollDispatchHandles(loop) < 0)
         goto error;
 
-    virEventPollCleanupTimeouts();
-    virEventPollCleanupHandles();
+    virEventPollCleanupTimeouts(loop);
+    virEventPollCleanupHandles(loop);
 
-    eventLoop.running = 0;
-    virMutexUnlock(&eventLoop.lock);
-    VIR_FREE(fds);
+    loop->running = 0;
+    virMutexUnlock(&loop->lock);
     return 0;
 
  error:
-    virMutexUnlock(&eventLoop.lock);
+    loop->readyCount = 0;
+    virMutexUnlock(&loop->lock);
  error_unlocked:
-    VIR_FREE(fds);
     return -1;
 }
 
+int virEventPollRunOnce(void)
+{
+    return virEventPollRunLoopOnce(&eventLoops[0]);
+}
+
 
 static void virEventPollHandleWakeup(int watch ATTRIBUTE_UNUSED,
                                      int fd,
                                      int events ATTRIBUTE_UNUSED,
-                                     void *opaque ATTRIBUTE_UNUSED)
+                                     void *opaque)
 {
+    struct virEventPollLoop *loop = opaque;
     char c;
-    virMutexLock(&eventLoop.lock);
+    virMutexLock(&loop->lock);
     ignore_value(saferead(fd, &c, sizeof(c)));
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 }
 
-int virEventPollInit(void)
+static int
+virEventPollInitLoop(struct virEventPollLoop *loop, size_t shard)
 {
-    if (virMutexInit(&eventLoop.lock) < 0) {
+    loop->shard = shard;
+
+    if (virMutexInit(&loop->lock) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to initialize mutex"));
         return -1;
     }
+    virMutexSetName(&loop->lock, "virEventPollLoop");
+
+    if (virEventPollBackendInit(loop) < 0)
+        return -1;
 
-    if (pipe2(eventLoop.wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
+    if (pipe2(loop->wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to setup wakeup pipe"));
         return -1;
     }
 
-    if (virEventPollAddHandle(eventLoop.wakeupfd[0],
-                              VIR_EVENT_HANDLE_READABLE,
-                              virEventPollHandleWakeup, NULL, NULL) < 0) {
+    if (virEventPollAddHandleLoop(loop, loop->wakeupfd[0],
+                                  VIR_EVENT_HANDLE_READABLE,
+                                  virEventPollHandleWakeup, loop, NULL) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Unable to add handle %d to event loop"),
-                       eventLoop.wakeupfd[0]);
-        VIR_FORCE_CLOSE(eventLoop.wakeupfd[0]);
-        VIR_FORCE_CLOSE(eventLoop.wakeupfd[1]);
+                       loop->wakeupfd[0]);
+        VIR_FORCE_CLOSE(loop->wakeupfd[0]);
+        VIR_FORCE_CLOSE(loop->wakeupfd[1]);
+        return -1;
+    }
+
+    return 0;
+}
+
+int virEventPollInit(void)
+{
+    return virEventPollInitLoop(&eventLoops[0], 0);
+}
+
+static void virEventPollShardThread(void *opaque)
+{
+    struct virEventPollLoop *loop = opaque;
+
+    while (virEventPollRunLoopOnce(loop) == 0)
+        ;
+
+    VIR_ERROR(_("Event loop shard %zu failed: %s"),
+              loop->shard, virGetLastErrorMessage());
+}
+
+/*
+ * Start @nshards - 1 additional event loop threads which file
+ * handles registered through virEventPollAddHandleKey() are spread
+ * across. Must be called once, before any such handle is added.
+ */
+int virEventPollStartShards(size_t nshards)
+{
+    size_t i;
+
+    if (nshards <= 1)
+        return 0;
+
+    if (nshards > VIR_EVENT_POLL_MAX_SHARDS) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("at most %d event loop threads are supported"),
+                       VIR_EVENT_POLL_MAX_SHARDS);
+        return -1;
+    }
+
+    if (virAtomicIntGet(&eventLoopShards) != 1) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("event loop threads are already running"));
         return -1;
     }
 
+    for (i = 1; i < nshards; i++) {
+        virThread thread;
+
+        if (virEventPollInitLoop(&eventLoops[i], i) < 0)
+            return -1;
+
+        if (virThreadCreate(&thread, false, virEventPollShardThread,
+                            &eventLoops[i]) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create event loop thread"));
+            return -1;
+        }
+    }
+
+    virAtomicIntSet(&eventLoopShards, nshards);
     return 0;
 }
 
-static int virEventPollInterruptLocked(void)
+static int virEventPollInterruptLocked(struct virEventPollLoop *loop)
 {
     char c = '\0';
 
-    if (!eventLoop.running ||
-        virThreadIsSelf(&eventLoop.leader)) {
-        VIR_DEBUG("Skip interrupt, %d %llu", eventLoop.running,
-                  virThreadID(&eventLoop.leader));
+    if (!loop->running ||
+        virThreadIsSelf(&loop->leader)) {
+        VIR_DEBUG("Skip interrupt, %d %llu", loop->running,
+                  virThreadID(&loop->leader));
         return 0;
     }
 
     VIR_DEBUG("Interrupting");
-    if (safewrite(eventLoop.wakeupfd[1], &c, sizeof(c)) != sizeof(c))
+    if (safewrite(loop->wakeupfd[1], &c, sizeof(c)) != sizeof(c))
         return -1;
     return 0;
 }
 
 int virEventPollInterrupt(void)
 {
+    struct virEventPollLoop *loop = &eventLoops[0];
     int ret;
-    virMutexLock(&eventLoop.lock);
-    ret = virEventPollInterruptLocked();
-    virMutexUnlock(&eventLoop.lock);
+    virMutexLock(&loop->lock);
+    ret = virEventPollInterruptLocked(loop);
+    virMutexUnlock(&loop->lock);
     return ret;
 }
 
@@ -26,6 +26,9 @@
 
 # include "internal.h"
 
+/* Upper limit for the number of event loop threads */
+# define VIR_EVENT_POLL_MAX_SHARDS 16
+
 /**
  * virEventPollAddHandle: register a callback for monitoring file handle events
  *
@@ -41,6 +44,27 @@ int virEventPollAddHandle(int fd, int events,
                           void *opaque,
                           virFreeCallback ff);
 
+/**
+ * virEventPollAddHandleKey: register a callback with a given event loop thread
+ *
+ * @fd: file handle to monitor for events
+ * @events: bitset of events to watch from POLLnnn constants
+ * @cb: callback to invoke when an event occurs
+ * @opaque: user data to pass to callback
+ * @key: picks the event loop thread servicing the handle
+ *
+ * Like virEventPollAddHandle(), but the handle is serviced by the
+ * event loop thread picked by @key when more than one was started
+ * by virEventPollStartShards().
+ *
+ * returns -1 if the file handle cannot be registered, the watch otherwise
+ */
+int virEventPollAddHandleKey(int fd, int events,
+                             virEventHandleCallback cb,
+                             void *opaque,
+                             virFreeCallback ff,
+                             unsigned int key);
+
 /**
  * virEventPollUpdateHandle: change event set for a monitored file handle
  *
@@ -107,6 +131,16 @@ int virEventPollRemoveTimeout(int timer);
  */
 int virEventPollInit(void);
 
+/**
+ * virEventPollStartShards: start additional event loop threads
+ *
+ * @nshards: total number of event loops, including the one run
+ *           by virEventPollRunOnce()
+ *
+ * returns -1 if the threads could not be started
+ */
+int virEventPollStartShards(size_t nshards);
+
 /**
  * virEventPollRunOnce: run a single iteration of the event loop.
  *
@@ -44,11 +44,43 @@
 #include "virstring.h"
 #include "virtime.h"
 #include "virprocess.h"
+#include "virthreadpool.h"
 
 #define VIR_FROM_THIS VIR_FROM_STREAMS
 
 VIR_LOG_INIT("fdstream");
 
+/* Files and block devices can't be polled, so the data of streams
+ * using them is copied through a pipe by one of these workers. Streams
+ * opened while all of them are busy wait for one to become free, which
+ * bounds the I/O the daemon does on behalf of its clients. */
+#define VIR_FDSTREAM_WORKERS_MAX 64
+
+/* Size of the copy buffer and, where it can be set, of the pipe */
+#define VIR_FDSTREAM_BUFFER_SIZE (1024 * 1024)
+
+static virThreadPoolPtr virFDStreamPool;
+
+static virMutex virFDStreamStatsLock = VIR_MUTEX_INITIALIZER;
+static virFDStreamStats virFDStreamGlobalStats;
+
+/* With sparse streams, data and holes are passed over the pipe
+ * between the stream and its I/O helper thread as a sequence of
+ * chunks, each of them starting with this header. The header is
+ * smaller than PIPE_BUF, so it is always written and read as a
+ * whole. Data chunks are followed by @length bytes of data, hole
+ * chunks carry no payload. */
+typedef enum {
+    VIR_FDSTREAM_CHUNK_DATA = 0,
+    VIR_FDSTREAM_CHUNK_HOLE,
+} virFDStreamChunkType;
+
+typedef struct _virFDStreamChunk virFDStreamChunk;
+struct _virFDStreamChunk {
+    int type;                   /* virFDStreamChunkType */
+    unsigned long long length;
+};
+
 /* Tunnelled migration stream support */
 typedef struct virFDStreamData virFDStreamData;
 typedef virFDStreamData *virFDStreamDataPtr;
@@ -59,6 +91,12 @@ struct virFDStreamData {
     unsigned long long offset;
     unsigned long long length;
 
+    /* Sparse streams: bytes left in the current data section
+     * and the length of the hole the stream is positioned in */
+    bool sparse;
+    unsigned long long dataLen;
+    long long holeLen;
+
     int watch;
     int events;         /* events the stream callback is subscribed for */
     bool cbRemoved;
@@ -79,19 +117,25 @@ struct virFDStreamData {
     void *icbOpaque;
 
     /* Thread data */
-    virThreadPtr thread;
+    bool thread;        /* the data passes through an I/O worker */
+    bool threadStarted;
+    bool threadRunning;
+    virCond threadCond; /* signalled once the worker is done */
     int threadErr;
     bool threadQuit;
 };
 
 static virClassPtr virFDStreamDataClass;
 
+static void virFDStreamThread(void *jobdata, void *opaque);
+
 static void
 virFDStreamDataDispose(void *obj)
 {
     virFDStreamDataPtr fdst = obj;
 
     VIR_DEBUG("obj=%p", fdst);
+    virCondDestroy(&fdst->threadCond);
 }
 
 static int virFDStreamDataOnceInit(void)
@@ -102,6 +146,10 @@ static int virFDStreamDataOnceInit(void)
                                              virFDStreamDataDispose)))
         return -1;
 
+    if (!(virFDStreamPool = virThreadPoolNew(0, VIR_FDSTREAM_WORKERS_MAX, 0,
+                                             virFDStreamThread, NULL)))
+        return -1;
+
     return 0;
 }
 
@@ -272,7 +320,10 @@ typedef struct _virFDStreamThreadData virFDStreamThreadData;
 typedef virFDStreamThreadData *virFDStreamThreadDataPtr;
 struct _virFDStreamThreadData {
     virStreamPtr st;
+    virFDStreamDataPtr fdst;
     size_t length;
+    bool doRead;    /* data flows from @fdin file to @fdout pipe */
+    bool sparse;
     int fdin;
     char *fdinname;
     int fdout;
@@ -294,25 +345,263 @@ virFDStreamThreadDataFree(virFDStreamThreadDataPtr data)
 
 
 static void
-virFDStreamThread(void *opaque)
+virFDStreamAccount(bool doRead,
+                   size_t bytes)
+{
+    virMutexLock(&virFDStreamStatsLock);
+    if (doRead)
+        virFDStreamGlobalStats.bytesRead += bytes;
+    else
+        virFDStreamGlobalStats.bytesWritten += bytes;
+    virMutexUnlock(&virFDStreamStatsLock);
+}
+
+
+/*
+ * Turn the next @length bytes of @fd, starting at its current
+ * position, into a hole and seek past it. Only the part overlapping
+ * existing data needs to be punched out, anything beyond the end of
+ * a regular file is created by extending it.
+ */
+static int
+virFDStreamWriteHole(int fd,
+                     long long length)
+{
+    struct stat sb;
+    off_t cur, end;
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) == (off_t) -1 ||
+        fstat(fd, &sb) < 0)
+        goto error;
+
+    end = cur + length;
+
+    if (S_ISREG(sb.st_mode) && end > sb.st_size) {
+        if (cur < sb.st_size &&
+            virFilePunchHole(fd, cur, sb.st_size - cur) < 0)
+            goto error;
+
+        if (ftruncate(fd, end) < 0)
+            goto error;
+    } else {
+        if (virFilePunchHole(fd, cur, length) < 0)
+            goto error;
+    }
+
+    if (lseek(fd, end, SEEK_SET) == (off_t) -1)
+        goto error;
+
+    return 0;
+
+ error:
+    virReportSystemError(errno,
+                         _("unable to create hole of %lld bytes in stream"),
+                         length);
+    return -1;
+}
+
+
+static int
+virFDStreamThreadReadSparse(int fdin,
+                            const char *fdinname,
+                            int fdout,
+                            const char *fdoutname,
+                            size_t length,
+                            char *buf,
+                            size_t buflen)
+{
+    virFDStreamChunk chunk;
+    unsigned long long total = 0;
+    long long sectionLen = 0;
+    int inData = 0;
+
+    while (!length || total < length) {
+        size_t want = buflen;
+        ssize_t got;
+
+        if (!sectionLen) {
+            if (virFileInData(fdin, &inData, &sectionLen) < 0)
+                return -1;
+
+            if (!sectionLen)
+                break; /* End of file */
+
+            if (length &&
+                (unsigned long long) sectionLen > length - total)
+                sectionLen = length - total;
+        }
+
+        if (!inData) {
+            if (lseek(fdin, sectionLen, SEEK_CUR) == (off_t) -1) {
+                virReportSystemError(errno,
+                                     _("Unable to seek %s"),
+                                     fdinname);
+                return -1;
+            }
+
+            chunk.type = VIR_FDSTREAM_CHUNK_HOLE;
+            chunk.length = sectionLen;
+            if (safewrite(fdout, &chunk, sizeof(chunk)) < 0) {
+                virReportSystemError(errno,
+                                     _("Unable to write %s"),
+                                     fdoutname);
+                return -1;
+            }
+
+            total += sectionLen;
+            sectionLen = 0;
+            continue;
+        }
+
+        if (want > sectionLen)
+            want = sectionLen;
+
+        if ((got = saferead(fdin, buf, want)) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to read %s"),
+                                 fdinname);
+            return -1;
+        }
+
+        if (got == 0)
+            break;
+
+        chunk.type = VIR_FDSTREAM_CHUNK_DATA;
+        chunk.length = got;
+        if (safewrite(fdout, &chunk, sizeof(chunk)) < 0 ||
+            safewrite(fdout, buf, got) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to write %s"),
+                                 fdoutname);
+            return -1;
+        }
+        virFDStreamAccount(true, got);
+
+        total += got;
+        sectionLen -= got;
+    }
+
+    return 0;
+}
+
+
+static int
+virFDStreamThreadWriteSparse(int fdin,
+                             const char *fdinname,
+                             int fdout,
+                             const char *fdoutname,
+                             char *buf,
+                             size_t buflen)
 {
-    virFDStreamThreadDataPtr data = opaque;
+    virFDStreamChunk chunk;
+    ssize_t got;
+
+    while ((got = saferead(fdin, &chunk, sizeof(chunk))) > 0) {
+        if (got != sizeof(chunk))
+            goto truncated;
+
+        if (chunk.type == VIR_FDSTREAM_CHUNK_HOLE) {
+            if (virFDStreamWriteHole(fdout, chunk.length) < 0)
+                return -1;
+            continue;
+        }
+
+        while (chunk.length) {
+            size_t want = buflen;
+
+            if (want > chunk.length)
+                want = chunk.length;
+
+            if ((got = saferead(fdin, buf, want)) < 0)
+                break;
+
+            if (got == 0)
+                goto truncated;
+
+            if (safewrite(fdout, buf, got) < 0) {
+                virReportSystemError(errno,
+                                     _("Unable to write %s"),
+                                     fdoutname);
+                return -1;
+            }
+            virFDStreamAccount(false, got);
+
+            chunk.length -= got;
+        }
+    }
+
+    if (got < 0) {
+        virReportSystemError(errno,
+                             _("Unable to read %s"),
+                             fdinname);
+        return -1;
+    }
+
+    return 0;
+
+ truncated:
+    virReportError(VIR_ERR_INTERNAL_ERROR,
+                   _("Unexpected end of chunk in %s"),
+                   fdinname);
+    errno = EIO;
+    return -1;
+}
+
+
+static void
+virFDStreamThread(void *jobdata,
+                  void *opaque ATTRIBUTE_UNUSED)
+{
+    virFDStreamThreadDataPtr data = jobdata;
     virStreamPtr st = data->st;
     size_t length = data->length;
     int fdin = data->fdin;
     char *fdinname = data->fdinname;
     int fdout = data->fdout;
     char *fdoutname = data->fdoutname;
-    virFDStreamDataPtr fdst = st->privateData;
+    virFDStreamDataPtr fdst = data->fdst;
     char *buf = NULL;
-    size_t buflen = 256 * 1024;
+    size_t buflen = VIR_FDSTREAM_BUFFER_SIZE;
     size_t total = 0;
+    int err = 0;
 
-    virObjectRef(fdst);
+    virObjectLock(fdst);
+    if (fdst->threadQuit) {
+        /* Closed before it got its turn, there's nothing to do */
+        virObjectUnlock(fdst);
+        goto cleanup;
+    }
+    fdst->threadStarted = true;
+    virObjectUnlock(fdst);
+
+    virMutexLock(&virFDStreamStatsLock);
+    virFDStreamGlobalStats.active++;
+    virMutexUnlock(&virFDStreamStatsLock);
 
     if (VIR_ALLOC_N(buf, buflen) < 0)
         goto error;
 
+#if HAVE_POSIX_FADVISE
+    /* Let the kernel read ahead of us */
+    if (data->doRead)
+        ignore_value(posix_fadvise(fdin, 0, 0, POSIX_FADV_SEQUENTIAL));
+#endif
+
+    if (data->sparse) {
+        if (data->doRead) {
+            if (virFDStreamThreadReadSparse(fdin, fdinname,
+                                            fdout, fdoutname,
+                                            length, buf, buflen) < 0)
+                goto error;
+        } else {
+            if (virFDStreamThreadWriteSparse(fdin, fdinname,
+                                             fdout, fdoutname,
+                                             buf, buflen) < 0)
+                goto error;
+        }
+        goto done;
+    }
+
     while (1) {
         ssize_t got;
 
@@ -341,22 +630,35 @@ virFDStreamThread(void *opaque)
                                  fdoutname);
             goto error;
         }
+        virFDStreamAccount(data->doRead, got);
     }
 
+ done:
+    virMutexLock(&virFDStreamStatsLock);
+    virFDStreamGlobalStats.active--;
+    virMutexUnlock(&virFDStreamStatsLock);
+
  cleanup:
-    if (!virObjectUnref(fdst))
-        st->privateData = NULL;
+    /* The files are closed by the time the stream is */
     VIR_FORCE_CLOSE(fdin);
     VIR_FORCE_CLOSE(fdout);
+
+    virObjectLock(fdst);
+    if (err)
+        fdst->threadErr = err;
+    fdst->threadRunning = false;
+    virCondBroadcast(&fdst->threadCond);
+    virObjectUnlock(fdst);
+
+    if (!virObjectUnref(fdst))
+        st->privateData = NULL;
     virFDStreamThreadDataFree(data);
     VIR_FREE(buf);
     return;
 
  error:
-    virObjectLock(fdst);
-    fdst->threadErr = errno;
-    virObjectUnlock(fdst);
-    goto cleanup;
+    err = errno;
+    goto done;
 }
 
 
@@ -364,24 +666,27 @@ static int
 virFDStreamJoinWorker(virFDStreamDataPtr fdst,
                       bool streamAbort)
 {
-    int ret = -1;
     if (!fdst->thread)
         return 0;
 
-    /* Give the thread a chance to lock the FD stream object. */
-    virObjectUnlock(fdst);
-    virThreadJoin(fdst->thread);
-    virObjectLock(fdst);
+    /* A worker which didn't pick up the stream yet won't touch it */
+    fdst->threadQuit = true;
+    while (fdst->threadRunning && fdst->threadStarted) {
+        if (virCondWait(&fdst->threadCond, &fdst->parent.lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait for stream I/O worker"));
+            return -1;
+        }
+    }
+
+    fdst->thread = false;
 
     if (fdst->threadErr && !streamAbort) {
         /* errors are expected on streamAbort */
-        goto cleanup;
+        return -1;
     }
 
-    ret = 0;
- cleanup:
-    VIR_FREE(fdst->thread);
-    return ret;
+    return 0;
 }
 
 
@@ -465,6 +770,136 @@ virFDStreamAbort(virStreamPtr st)
     return virFDStreamCloseInt(st, true);
 }
 
+/*
+ * Write chunk header @chunk to the pipe to the I/O helper thread.
+ * Returns 0 on success, -2 if the pipe is full, -1 on error.
+ */
+static int
+virFDStreamWriteChunk(virFDStreamDataPtr fdst,
+                      virFDStreamChunk *chunk)
+{
+ retry:
+    if (write(fdst->fd, chunk, sizeof(*chunk)) < 0) {
+        VIR_WARNINGS_NO_WLOGICALOP_EQUAL_EXPR
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        VIR_WARNINGS_RESET
+            return -2;
+        } else if (errno == EINTR) {
+            goto retry;
+        }
+        virReportSystemError(errno, "%s",
+                             _("cannot write to stream"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Read chunk header @chunk from the pipe from the I/O helper thread.
+ * Returns 1 on success, 0 on EOF, -2 if no header is available yet,
+ * -1 on error.
+ */
+static int
+virFDStreamReadChunk(virFDStreamDataPtr fdst,
+                     virFDStreamChunk *chunk)
+{
+    ssize_t got;
+
+ retry:
+    if ((got = read(fdst->fd, chunk, sizeof(*chunk))) < 0) {
+        VIR_WARNINGS_NO_WLOGICALOP_EQUAL_EXPR
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        VIR_WARNINGS_RESET
+            return -2;
+        } else if (errno == EINTR) {
+            goto retry;
+        }
+        virReportSystemError(errno, "%s",
+                             _("cannot read from stream"));
+        return -1;
+    }
+
+    if (got == 0)
+        return 0;
+
+    if (got != sizeof(*chunk)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unexpected end of chunk header in stream"));
+        return -1;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Find out what's next in a sparse stream, either from the chunk
+ * header sent by the I/O helper thread or by looking at the file
+ * directly, and set up @fdst->dataLen or @fdst->holeLen accordingly.
+ *
+ * Returns 1 on success, 0 at the end of the stream, -2 if the
+ * header is not available yet, -1 on error.
+ */
+static int
+virFDStreamNextSection(virFDStreamDataPtr fdst)
+{
+    long long length;
+    int inData;
+
+    if (fdst->thread) {
+        virFDStreamChunk chunk;
+        int rc;
+
+        if ((rc = virFDStreamReadChunk(fdst, &chunk)) <= 0)
+            return rc;
+
+        inData = chunk.type == VIR_FDSTREAM_CHUNK_DATA;
+        length = chunk.length;
+    } else {
+        if (virFileInData(fdst->fd, &inData, &length) < 0)
+            return -1;
+
+        if (fdst->length &&
+            (unsigned long long) length > fdst->length - fdst->offset)
+            length = fdst->length - fdst->offset;
+
+        if (!length)
+            return 0;
+    }
+
+    if (inData)
+        fdst->dataLen = length;
+    else
+        fdst->holeLen = length;
+
+    return 1;
+}
+
+
+/*
+ * Consume @length bytes of the hole the stream is positioned in.
+ */
+static int
+virFDStreamSkipHole(virFDStreamDataPtr fdst,
+                    long long length)
+{
+    if (!fdst->thread &&
+        lseek(fdst->fd, length, SEEK_CUR) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("unable to seek in stream"));
+        return -1;
+    }
+
+    if (fdst->length)
+        fdst->offset += length;
+    fdst->holeLen -= length;
+
+    return 0;
+}
+
+
 static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
 {
     virFDStreamDataPtr fdst = st->privateData;
@@ -496,6 +931,30 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->sparse && fdst->thread) {
+        /* Announce the data to the I/O helper first. If only a part
+         * of it makes it into the pipe, the rest is written without
+         * a header on the following calls. */
+        if (!fdst->dataLen) {
+            virFDStreamChunk chunk = { VIR_FDSTREAM_CHUNK_DATA, nbytes };
+
+            if (nbytes == 0) {
+                virObjectUnlock(fdst);
+                return 0;
+            }
+
+            if ((ret = virFDStreamWriteChunk(fdst, &chunk)) < 0) {
+                virObjectUnlock(fdst);
+                return ret;
+            }
+
+            fdst->dataLen = nbytes;
+        }
+
+        if (nbytes > fdst->dataLen)
+            nbytes = fdst->dataLen;
+    }
+
  retry:
     ret = write(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -510,8 +969,11 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             virReportSystemError(errno, "%s",
                                  _("cannot write to stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else {
+        if (fdst->length)
+            fdst->offset += ret;
+        if (fdst->sparse && fdst->thread)
+            fdst->dataLen -= ret;
     }
 
     virObjectUnlock(fdst);
@@ -519,10 +981,15 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
 }
 
 
-static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+static int virFDStreamRecvFlags(virStreamPtr st,
+                                char *bytes,
+                                size_t nbytes,
+                                unsigned int flags)
 {
     virFDStreamDataPtr fdst = st->privateData;
-    int ret;
+    int ret = -1;
+
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
 
     if (nbytes > INT_MAX) {
         virReportSystemError(ERANGE, "%s",
@@ -540,14 +1007,44 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
 
     if (fdst->length) {
         if (fdst->length == fdst->offset) {
-            virObjectUnlock(fdst);
-            return 0;
+            ret = 0;
+            goto cleanup;
         }
 
         if ((fdst->length - fdst->offset) < nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->sparse) {
+        if (!fdst->dataLen && !fdst->holeLen &&
+            (ret = virFDStreamNextSection(fdst)) <= 0)
+            goto cleanup;
+
+        if (fdst->holeLen) {
+            if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+                ret = -3;
+                goto cleanup;
+            }
+
+            /* The caller is not interested in holes, hand out
+             * the zeroes they stand for */
+            if (nbytes > fdst->holeLen)
+                nbytes = fdst->holeLen;
+
+            if (virFDStreamSkipHole(fdst, nbytes) < 0) {
+                ret = -1;
+                goto cleanup;
+            }
+
+            memset(bytes, 0, nbytes);
+            ret = nbytes;
+            goto cleanup;
+        }
+
+        if (nbytes > fdst->dataLen)
+            nbytes = fdst->dataLen;
+    }
+
  retry:
     ret = read(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -562,10 +1059,114 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             virReportSystemError(errno, "%s",
                                  _("cannot read from stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else {
+        if (fdst->length)
+            fdst->offset += ret;
+        if (fdst->sparse)
+            fdst->dataLen = ret ? fdst->dataLen - ret : 0;
+    }
+
+ cleanup:
+    virObjectUnlock(fdst);
+    return ret;
+}
+
+
+static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+{
+    return virFDStreamRecvFlags(st, bytes, nbytes, 0);
+}
+
+
+static int virFDStreamSendHole(virStreamPtr st,
+                               long long length,
+                               unsigned int flags)
+{
+    virFDStreamDataPtr fdst = st->privateData;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virObjectLock(fdst);
+
+    if (!fdst->sparse) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("holes are not supported by non-sparse stream"));
+        goto cleanup;
+    }
+
+    if (fdst->length &&
+        (unsigned long long) length > fdst->length - fdst->offset) {
+        virReportSystemError(ENOSPC, "%s",
+                             _("cannot write to stream"));
+        goto cleanup;
+    }
+
+    if (fdst->thread) {
+        virFDStreamChunk chunk = { VIR_FDSTREAM_CHUNK_HOLE, length };
+
+        if (fdst->dataLen) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("previous data was not fully written to stream"));
+            goto cleanup;
+        }
+
+        if ((ret = virFDStreamWriteChunk(fdst, &chunk)) < 0)
+            goto cleanup;
+    } else {
+        if (virFDStreamWriteHole(fdst->fd, length) < 0)
+            goto cleanup;
     }
 
+    if (fdst->length)
+        fdst->offset += length;
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(fdst);
+    return ret;
+}
+
+
+static int virFDStreamRecvHole(virStreamPtr st,
+                               long long *length,
+                               unsigned int flags)
+{
+    virFDStreamDataPtr fdst = st->privateData;
+    long long holeLen;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virObjectLock(fdst);
+
+    if (!fdst->holeLen) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("stream is not positioned in a hole"));
+        goto cleanup;
+    }
+
+    holeLen = fdst->holeLen;
+    if (virFDStreamSkipHole(fdst, holeLen) < 0)
+        goto cleanup;
+
+    *length = holeLen;
+    ret = 0;
+
+ cleanup:
     virObjectUnlock(fdst);
     return ret;
 }
@@ -574,6 +1175,9 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
 static virStreamDriver virFDStreamDrv = {
     .streamSend = virFDStreamWrite,
     .streamRecv = virFDStreamRead,
+    .streamRecvFlags = virFDStreamRecvFlags,
+    .streamSendHole = virFDStreamSendHole,
+    .streamRecvHole = virFDStreamRecvHole,
     .streamFinish = virFDStreamClose,
     .streamAbort = virFDStreamAbort,
     .streamEventAddCallback = virFDStreamAddCallback,
@@ -584,12 +1188,13 @@ static virStreamDriver virFDStreamDrv = {
 static int virFDStreamOpenInternal(virStreamPtr st,
                                    int fd,
                                    virFDStreamThreadDataPtr threadData,
-                                   unsigned long long length)
+                                   unsigned long long length,
+                                   bool sparse)
 {
     virFDStreamDataPtr fdst;
 
-    VIR_DEBUG("st=%p fd=%d threadData=%p length=%llu",
-              st, fd, threadData, length);
+    VIR_DEBUG("st=%p fd=%d threadData=%p length=%llu sparse=%d",
+              st, fd, threadData, length, sparse);
 
     if (virFDStreamDataInitialize() < 0)
         return -1;
@@ -605,27 +1210,39 @@ static int virFDStreamOpenInternal(virStreamPtr st,
 
     fdst->fd = fd;
     fdst->length = length;
+    fdst->sparse = sparse;
+
+    if (virCondInit(&fdst->threadCond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize condition variable"));
+        virObjectUnref(fdst);
+        return -1;
+    }
 
     st->driver = &virFDStreamDrv;
     st->privateData = fdst;
 
     if (threadData) {
-        /* Create the thread after fdst and st were initialized.
+        /* Queue the job after fdst and st were initialized.
          * The thread worker expects them to be that way. */
-        if (VIR_ALLOC(fdst->thread) < 0)
-            goto error;
+        threadData->fdst = virObjectRef(fdst);
+        fdst->thread = true;
+        fdst->threadRunning = true;
 
-        if (virThreadCreate(fdst->thread,
-                            true,
-                            virFDStreamThread,
-                            threadData) < 0)
+        if (virThreadPoolSendJob(virFDStreamPool, 0, threadData) < 0) {
+            threadData->fdst = NULL;
+            virObjectUnref(fdst);
             goto error;
+        }
+
+        virMutexLock(&virFDStreamStatsLock);
+        virFDStreamGlobalStats.opened++;
+        virMutexUnlock(&virFDStreamStatsLock);
     }
 
     return 0;
 
  error:
-    VIR_FREE(fdst->thread);
     st->driver = NULL;
     st->privateData = NULL;
     virObjectUnref(fdst);
@@ -636,7 +1253,7 @@ static int virFDStreamOpenInternal(virStreamPtr st,
 int virFDStreamOpen(virStreamPtr st,
                     int fd)
 {
-    return virFDStreamOpenInternal(st, fd, NULL, 0);
+    return virFDStreamOpenInternal(st, fd, NULL, 0, false);
 }
 
 
@@ -682,7 +1299,7 @@ int virFDStreamConnectUNIX(virStreamPtr st,
         goto error;
     }
 
-    if (virFDStreamOpenInternal(st, fd, NULL, 0) < 0)
+    if (virFDStreamOpenInternal(st, fd, NULL, 0, false) < 0)
         goto error;
     return 0;
 
@@ -708,7 +1325,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
                             unsigned long long length,
                             int oflags,
                             int mode,
-                            bool forceIOHelper)
+                            bool forceIOHelper,
+                            bool sparse)
 {
     int fd = -1;
     int pipefds[2] = { -1, -1 };
@@ -716,8 +1334,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
     struct stat sb;
     virFDStreamThreadDataPtr threadData = NULL;
 
-    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o",
-              st, path, oflags, offset, length, mode);
+    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o "
+              "sparse=%d", st, path, oflags, offset, length, mode, sparse);
 
     oflags |= O_NOCTTY | O_BINARY;
 
@@ -770,13 +1388,22 @@ virFDStreamOpenFileInternal(virStreamPtr st,
             goto error;
         }
 
+#ifdef F_SETPIPE_SZ
+        /* Fewer round trips between the stream and the worker, a
+         * smaller pipe works too */
+        ignore_value(fcntl(pipefds[0], F_SETPIPE_SZ,
+                           VIR_FDSTREAM_BUFFER_SIZE));
+#endif
+
         if (VIR_ALLOC(threadData) < 0)
             goto error;
 
         threadData->st = virObjectRef(st);
         threadData->length = length;
+        threadData->sparse = sparse;
 
         if ((oflags & O_ACCMODE) == O_RDONLY) {
+            threadData->doRead = true;
             threadData->fdin = fd;
             threadData->fdout = pipefds[1];
             if (VIR_STRDUP(threadData->fdinname, path) < 0 ||
@@ -791,9 +1418,14 @@ virFDStreamOpenFileInternal(virStreamPtr st,
                 goto error;
             tmpfd = pipefds[1];
         }
+    } else if (sparse && !S_ISREG(sb.st_mode) && !S_ISBLK(sb.st_mode)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED,
+                       _("%s: sparse streams are supported for files and "
+                         "block devices only"), path);
+        goto error;
     }
 
-    if (virFDStreamOpenInternal(st, tmpfd, threadData, length) < 0)
+    if (virFDStreamOpenInternal(st, tmpfd, threadData, length, sparse) < 0)
         goto error;
 
     return 0;
@@ -822,7 +1454,7 @@ int virFDStreamOpenFile(virStreamPtr st,
     }
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0, false);
+                                       oflags, 0, false, false);
 }
 
 int virFDStreamCreateFile(virStreamPtr st,
@@ -835,7 +1467,7 @@ int virFDStreamCreateFile(virStreamPtr st,
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
                                        oflags | O_CREAT, mode,
-                                       false);
+                                       false, false);
 }
 
 #ifdef HAVE_CFMAKERAW
@@ -851,7 +1483,7 @@ int virFDStreamOpenPTY(virStreamPtr st,
     if (virFDStreamOpenFileInternal(st, path,
                                     offset, length,
                                     oflags | O_CREAT, 0,
-                                    false) < 0)
+                                    false, false) < 0)
         return -1;
 
     fdst = st->privateData;
@@ -888,7 +1520,7 @@ int virFDStreamOpenPTY(virStreamPtr st,
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
                                        oflags | O_CREAT, 0,
-                                       false);
+                                       false, false);
 }
 #endif /* !HAVE_CFMAKERAW */
 
@@ -896,11 +1528,12 @@ int virFDStreamOpenBlockDevice(virStreamPtr st,
                                const char *path,
                                unsigned long long offset,
                                unsigned long long length,
+                               bool sparse,
                                int oflags)
 {
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0, true);
+                                       oflags, 0, true, sparse);
 }
 
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
@@ -922,3 +1555,28 @@ int virFDStreamSetInternalCloseCb(virStreamPtr st,
     virObjectUnlock(fdst);
     return 0;
 }
+
+
+/**
+ * virFDStreamGetStats:
+ * @stats: filled with the statistics
+ *
+ * Get the statistics of the streams whose data is copied by the I/O
+ * workers, i.e. the streams of regular files and block devices.
+ */
+void
+virFDStreamGetStats(virFDStreamStatsPtr stats)
+{
+    virMutexLock(&virFDStreamStatsLock);
+    *stats = virFDStreamGlobalStats;
+    virMutexUnlock(&virFDStreamStatsLock);
+
+    /* Nothing was streamed yet if the pool doesn't exist */
+    if (virFDStreamDataInitialize() < 0) {
+        virResetLastError();
+        return;
+    }
+
+    stats->workers = virThreadPoolGetCurrentWorkers(virFDStreamPool);
+    stats->queued = virThreadPoolGetJobQueueDepth(virFDStreamPool);
+}
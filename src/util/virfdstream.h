@@ -59,10 +59,24 @@ int virFDStreamOpenBlockDevice(virStreamPtr st,
                                const char *path,
                                unsigned long long offset,
                                unsigned long long length,
+                               bool sparse,
                                int oflags);
 
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
                                   virFDStreamInternalCloseCb cb,
                                   void *opaque,
                                   virFDStreamInternalCloseCbFreeOpaque fcb);
+
+typedef struct _virFDStreamStats virFDStreamStats;
+typedef virFDStreamStats *virFDStreamStatsPtr;
+struct _virFDStreamStats {
+    unsigned long long opened;       /* streams handed to the I/O workers */
+    unsigned long long bytesRead;    /* bytes read from files into streams */
+    unsigned long long bytesWritten; /* bytes written from streams to files */
+    size_t active;                   /* streams being copied right now */
+    size_t queued;                   /* streams waiting for a worker */
+    size_t workers;                  /* I/O worker threads */
+};
+
+void virFDStreamGetStats(virFDStreamStatsPtr stats);
 #endif /* __VIR_FDSTREAM_H_ */
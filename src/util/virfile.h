@@ -347,5 +347,14 @@ int virFileReadValueScaledInt(unsigned long long *value, const char *format, ...
 int virFileReadValueString(char **value, const char *format, ...)
  ATTRIBUTE_FMT_PRINTF(2, 3);
 
+int virFileInData(int fd,
+                  int *inData,
+                  long long *length)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
+int virFilePunchHole(int fd,
+                     off_t offset,
+                     off_t len);
+
 
 #endif /* __VIR_FILE_H */
@@ -51,6 +51,12 @@ VIR_ENUM_IMPL(virFirewallLayerCommand, VIR_FIREWALL_LAYER_LAST,
               IPTABLES_PATH,
               IP6TABLES_PATH);
 
+VIR_ENUM_DECL(virFirewallLayerRestoreCommand)
+VIR_ENUM_IMPL(virFirewallLayerRestoreCommand, VIR_FIREWALL_LAYER_LAST,
+              EBTABLES_RESTORE_PATH,
+              IPTABLES_RESTORE_PATH,
+              IP6TABLES_RESTORE_PATH);
+
 VIR_ENUM_DECL(virFirewallLayerFirewallD)
 VIR_ENUM_IMPL(virFirewallLayerFirewallD, VIR_FIREWALL_LAYER_LAST,
               "eb", "ipv4", "ipv6")
@@ -107,7 +113,10 @@ VIR_ONCE_GLOBAL_INIT(virFirewall)
 static bool iptablesUseLock;
 static bool ip6tablesUseLock;
 static bool ebtablesUseLock;
-static bool lockOverride; /* true to avoid lock probes */
+static bool lockOverride; /* true to avoid lock and restore probes */
+
+/* Whether rules of a layer can be applied through its *-restore tool */
+static bool restoreSupported[VIR_FIREWALL_LAYER_LAST];
 
 void
 virFirewallSetLockOverride(bool avoid)
@@ -152,9 +161,69 @@ virFirewallCheckUpdateLocking(void)
                                ebtablesArgs);
 }
 
+
+static const char *
+virFirewallLayerLockArg(virFirewallLayer layer)
+{
+    switch (layer) {
+    case VIR_FIREWALL_LAYER_ETHERNET:
+        return ebtablesUseLock ? "--concurrent" : NULL;
+    case VIR_FIREWALL_LAYER_IPV4:
+        return iptablesUseLock ? "-w" : NULL;
+    case VIR_FIREWALL_LAYER_IPV6:
+        return ip6tablesUseLock ? "-w" : NULL;
+    case VIR_FIREWALL_LAYER_LAST:
+        break;
+    }
+    return NULL;
+}
+
+
+/*
+ * The restore tools are only used for a layer if they accept an empty
+ * transaction with the same locking as the plain tool uses, an older
+ * restore tool not supporting the lock would race with other users.
+ */
+static void
+virFirewallCheckUpdateRestore(void)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_FIREWALL_LAYER_LAST; i++) {
+        const char *bin = virFirewallLayerRestoreCommandTypeToString(i);
+        const char *lockArg = virFirewallLayerLockArg(i);
+        virCommandPtr cmd;
+        int status;
+
+        restoreSupported[i] = false;
+
+        if (currentBackend != VIR_FIREWALL_BACKEND_RESTORE)
+            continue;
+
+        if (lockOverride) {
+            restoreSupported[i] = true;
+            continue;
+        }
+
+        cmd = virCommandNewArgList(bin, "--noflush", NULL);
+        if (lockArg)
+            virCommandAddArg(cmd, lockArg);
+        virCommandSetInputBuffer(cmd, "");
+        if (virCommandRun(cmd, &status) < 0 || status) {
+            VIR_INFO("batching not supported by %s", bin);
+        } else {
+            VIR_INFO("using batching for %s", bin);
+            restoreSupported[i] = true;
+        }
+        virCommandFree(cmd);
+    }
+}
+
 static int
 virFirewallValidateBackend(virFirewallBackend backend)
 {
+    bool automatic = backend == VIR_FIREWALL_BACKEND_AUTOMATIC;
+
     VIR_DEBUG("Validating backend %d", backend);
     if (backend == VIR_FIREWALL_BACKEND_AUTOMATIC ||
         backend == VIR_FIREWALL_BACKEND_FIREWALLD) {
@@ -180,7 +249,10 @@ virFirewallValidateBackend(virFirewallBackend backend)
         }
     }
 
-    if (backend == VIR_FIREWALL_BACKEND_DIRECT) {
+    /* The restore backend still runs the plain tools for rules which
+     * can't be batched */
+    if (backend == VIR_FIREWALL_BACKEND_DIRECT ||
+        backend == VIR_FIREWALL_BACKEND_RESTORE) {
         const char *commands[] = {
             IPTABLES_PATH, IP6TABLES_PATH, EBTABLES_PATH
         };
@@ -197,9 +269,38 @@ virFirewallValidateBackend(virFirewallBackend backend)
         VIR_DEBUG("found iptables/ip6tables/ebtables, using direct backend");
     }
 
+    if (backend == VIR_FIREWALL_BACKEND_RESTORE ||
+        (automatic && backend == VIR_FIREWALL_BACKEND_DIRECT &&
+         !lockOverride)) {
+        const char *commands[] = {
+            IPTABLES_RESTORE_PATH, IP6TABLES_RESTORE_PATH, EBTABLES_RESTORE_PATH
+        };
+        size_t i;
+
+        for (i = 0; i < ARRAY_CARDINALITY(commands); i++) {
+            if (!virFileIsExecutable(commands[i]))
+                break;
+        }
+
+        if (i < ARRAY_CARDINALITY(commands)) {
+            if (backend == VIR_FIREWALL_BACKEND_RESTORE) {
+                virReportSystemError(errno,
+                                     _("restore firewall backend requested, but %s is not available"),
+                                     commands[i]);
+                return -1;
+            }
+            VIR_DEBUG("%s not available, staying with direct backend",
+                      commands[i]);
+        } else {
+            VIR_DEBUG("found iptables/ip6tables/ebtables-restore, using restore backend");
+            backend = VIR_FIREWALL_BACKEND_RESTORE;
+        }
+    }
+
     currentBackend = backend;
 
     virFirewallCheckUpdateLocking();
+    virFirewallCheckUpdateRestore();
 
     return 0;
 }
@@ -820,6 +921,7 @@ virFirewallApplyRule(virFirewallPtr firewall,
 
     switch (currentBackend) {
     case VIR_FIREWALL_BACKEND_DIRECT:
+    case VIR_FIREWALL_BACKEND_RESTORE:
         if (virFirewallApplyRuleDirect(rule, ignoreErrors, &output) < 0)
             return -1;
         break;
@@ -860,6 +962,184 @@ virFirewallApplyRule(virFirewallPtr firewall,
     return ret;
 }
 
+/*
+ * Find the table @rule operates on, returning the index of the
+ * table option in @idx or -1 if the rule uses the default table
+ */
+static const char *
+virFirewallRuleGetTable(virFirewallRulePtr rule,
+                        ssize_t *idx)
+{
+    size_t i;
+
+    *idx = -1;
+    for (i = 0; i + 1 < rule->argsLen; i++) {
+        if (STREQ(rule->args[i], "-t") ||
+            STREQ(rule->args[i], "--table")) {
+            *idx = i;
+            return rule->args[i + 1];
+        }
+    }
+
+    return "filter";
+}
+
+
+/*
+ * A rule can be part of a restore transaction unless its output is
+ * needed, its failure has to be ignored, or one of its arguments
+ * can't be represented in the restore format.
+ */
+static bool
+virFirewallRuleCanRestore(virFirewallRulePtr rule,
+                          bool ignoreErrors)
+{
+    size_t i;
+
+    if (!restoreSupported[rule->layer] ||
+        rule->queryCB || rule->ignoreErrors || ignoreErrors ||
+        rule->argsLen == 0)
+        return false;
+
+    for (i = 0; i < rule->argsLen; i++) {
+        const char *arg = rule->args[i];
+
+        if (!*arg || strpbrk(arg, "\"\n"))
+            return false;
+
+        /* ebtables-restore doesn't support quoting */
+        if (rule->layer == VIR_FIREWALL_LAYER_ETHERNET &&
+            strpbrk(arg, " \t"))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Count the rules starting at @rules which can be applied in a single
+ * restore transaction, that is, consecutive rules of the same layer
+ * changing the same table.
+ */
+static size_t
+virFirewallRestoreRunLength(virFirewallRulePtr *rules,
+                            size_t nrules,
+                            bool ignoreErrors)
+{
+    const char *table;
+    ssize_t idx;
+    size_t i;
+
+    if (!virFirewallRuleCanRestore(rules[0], ignoreErrors))
+        return 0;
+
+    table = virFirewallRuleGetTable(rules[0], &idx);
+
+    for (i = 1; i < nrules; i++) {
+        if (rules[i]->layer != rules[0]->layer ||
+            !virFirewallRuleCanRestore(rules[i], ignoreErrors) ||
+            STRNEQ(virFirewallRuleGetTable(rules[i], &idx), table))
+            break;
+    }
+
+    return i;
+}
+
+
+/*
+ * Apply @nrules rules in a single transaction of the restore tool of
+ * their layer. The transaction is committed at once or not at all so a
+ * failure leaves the rules unapplied and they can be retried one at a
+ * time to find and report the failing one, exactly as if they had been
+ * applied one by one in the first place.
+ *
+ * Returns 0 on success, -1 if the transaction failed.
+ */
+static int
+virFirewallApplyRulesRestore(virFirewallRulePtr *rules,
+                             size_t nrules)
+{
+    virFirewallLayer layer = rules[0]->layer;
+    const char *bin = virFirewallLayerRestoreCommandTypeToString(layer);
+    const char *lockArg = virFirewallLayerLockArg(layer);
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virCommandPtr cmd = NULL;
+    char *input = NULL;
+    char *error = NULL;
+    const char *table;
+    ssize_t tableIdx;
+    int status;
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    table = virFirewallRuleGetTable(rules[0], &tableIdx);
+    virBufferAsprintf(&buf, "*%s\n", table);
+
+    for (i = 0; i < nrules; i++) {
+        virFirewallRulePtr rule = rules[i];
+        char *str = virFirewallRuleToString(rule);
+        bool first = true;
+
+        VIR_INFO("Applying rule '%s'", NULLSTR(str));
+        VIR_FREE(str);
+
+        ignore_value(virFirewallRuleGetTable(rule, &tableIdx));
+
+        for (j = 0; j < rule->argsLen; j++) {
+            const char *arg = rule->args[j];
+
+            /* the lock is taken by the restore tool itself */
+            if (j == 0 && lockArg && STREQ(arg, lockArg))
+                continue;
+            if (tableIdx >= 0 && (j == tableIdx || j == tableIdx + 1))
+                continue;
+
+            if (!first)
+                virBufferAddChar(&buf, ' ');
+            first = false;
+
+            if (strpbrk(arg, " \t"))
+                virBufferAsprintf(&buf, "\"%s\"", arg);
+            else
+                virBufferAdd(&buf, arg, -1);
+        }
+        virBufferAddChar(&buf, '\n');
+    }
+    virBufferAddLit(&buf, "COMMIT\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    input = virBufferContentAndReset(&buf);
+
+    cmd = virCommandNewArgList(bin, "--noflush", NULL);
+    if (lockArg)
+        virCommandAddArg(cmd, lockArg);
+    virCommandSetInputBuffer(cmd, input);
+    virCommandSetErrorBuffer(cmd, &error);
+
+    if (virCommandRun(cmd, &status) < 0)
+        goto cleanup;
+
+    if (status != 0) {
+        VIR_DEBUG("Transaction of %zu rules failed: %s",
+                  nrules, NULLSTR(error));
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    if (ret < 0)
+        virResetLastError();
+    virBufferFreeAndReset(&buf);
+    virCommandFree(cmd);
+    VIR_FREE(input);
+    VIR_FREE(error);
+    return ret;
+}
+
+
 static int
 virFirewallApplyGroup(virFirewallPtr firewall,
                       size_t idx)
@@ -867,12 +1147,28 @@ virFirewallApplyGroup(virFirewallPtr firewall,
     virFirewallGroupPtr group = firewall->groups[idx];
     bool ignoreErrors = (group->actionFlags & VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS);
     size_t i;
+    size_t n;
+    size_t end = 0;
 
     VIR_INFO("Starting transaction for firewall=%p group=%p flags=%x",
              firewall, group, group->actionFlags);
     firewall->currentGroup = idx;
     group->addingRollback = false;
     for (i = 0; i < group->naction; i++) {
+        /* Batch as many rules as possible, falling back to applying
+         * them one at a time until the end of a failed batch */
+        if (currentBackend == VIR_FIREWALL_BACKEND_RESTORE && i >= end &&
+            (n = virFirewallRestoreRunLength(group->action + i,
+                                             group->naction - i,
+                                             ignoreErrors)) > 1) {
+            if (virFirewallApplyRulesRestore(group->action + i, n) == 0) {
+                i += n - 1;
+                continue;
+            }
+            VIR_DEBUG("Applying %zu rules one at a time", n);
+            end = i + n;
+        }
+
         if (virFirewallApplyRule(firewall,
                                  group->action[i],
                                  ignoreErrors) < 0)
@@ -1,5 +1,5 @@
 /*
- * virhash.c: chained hash tables
+ * virhash.c: chained and open addressing hash tables
  *
  * Reference: Your favorite introductory book on algorithms
  *
@@ -54,18 +54,32 @@ typedef struct _virHashEntry virHashEntry;
 typedef virHashEntry *virHashEntryPtr;
 struct _virHashEntry {
     struct _virHashEntry *next;
+    uint32_t code; /* cached keyCode() of name */
     void *name;
     void *payload;
 };
 
+/* Marks a slot of an open addressing table whose entry was removed, so
+ * that lookups continue probing past it */
+static char virHashSlotDeleted;
+
+#define VIR_HASH_SLOT_USED(entry) \
+    ((entry)->name && (entry)->name != &virHashSlotDeleted)
+
 /*
  * The entire hash table
  */
 struct _virHashTable {
     virHashEntryPtr *table;
+    /* Used instead of @table by VIR_HASH_OPEN_ADDRESSING tables, @size
+     * is then always a power of two */
+    virHashEntryPtr slots;
+    unsigned int flags;
     uint32_t seed;
     size_t size;
     size_t nbElems;
+    /* Number of slots marked as deleted */
+    size_t nbDeleted;
     /* True iff we are iterating over hash entries. */
     bool iterating;
     /* Pointer to the current entry during iteration. */
@@ -129,35 +143,165 @@ virHashValueFree(void *value, const void *name ATTRIBUTE_UNUSED)
 }
 
 
-static size_t
-virHashComputeKey(const virHashTable *table, const void *name)
+static uint32_t
+virHashComputeCode(const virHashTable *table, const void *name)
 {
-    uint32_t value = table->keyCode(name, table->seed);
-    return value % table->size;
+    return table->keyCode(name, table->seed);
 }
 
+
+/*
+ * Open addressing tables use linear probing, the slots array is never
+ * filled to more than 3/4 (deleted slots included) so there's always
+ * an empty slot to terminate a probe sequence.
+ */
+#define VIR_HASH_OPEN_MIN_SIZE 16
+#define VIR_HASH_OPEN_FULL(size, used) ((used) * 4 >= (size) * 3)
+
+
 /**
- * virHashCreateFull:
+ * virHashOpenFind:
+ * @table: open addressing hash table
+ * @name: key to look up
+ * @code: hash code of @name
+ *
+ * Returns the slot holding @name or NULL if there isn't any
+ */
+static virHashEntryPtr
+virHashOpenFind(const virHashTable *table,
+                const void *name,
+                uint32_t code)
+{
+    size_t mask = table->size - 1;
+    size_t i;
+
+    for (i = code & mask; table->slots[i].name; i = (i + 1) & mask) {
+        virHashEntryPtr entry = &table->slots[i];
+
+        if (entry->code == code && entry->name != &virHashSlotDeleted &&
+            table->keyEqual(entry->name, name))
+            return entry;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * virHashOpenFindFree:
+ * @table: open addressing hash table
+ * @code: hash code of the key to be stored
+ *
+ * Returns the first empty or deleted slot in the probe sequence of @code
+ */
+static virHashEntryPtr
+virHashOpenFindFree(const virHashTable *table,
+                    uint32_t code)
+{
+    size_t mask = table->size - 1;
+    size_t i;
+
+    for (i = code & mask; VIR_HASH_SLOT_USED(&table->slots[i]);
+         i = (i + 1) & mask)
+        ;
+
+    return &table->slots[i];
+}
+
+
+/**
+ * virHashOpenResize:
+ * @table: open addressing hash table
+ * @size: the new number of slots, a power of two
+ *
+ * Move all entries to a new array of @size slots, dropping the ones
+ * marked as deleted on the way. Keys are not hashed again.
+ *
+ * Returns 0 in case of success, -1 in case of failure
+ */
+static int
+virHashOpenResize(virHashTablePtr table, size_t size)
+{
+    virHashEntryPtr oldslots = table->slots;
+    size_t oldsize = table->size;
+    size_t i;
+
+    if (VIR_ALLOC_N(table->slots, size) < 0) {
+        table->slots = oldslots;
+        return -1;
+    }
+    table->size = size;
+    table->nbDeleted = 0;
+
+    for (i = 0; i < oldsize; i++) {
+        if (VIR_HASH_SLOT_USED(&oldslots[i]))
+            *virHashOpenFindFree(table, oldslots[i].code) = oldslots[i];
+    }
+
+    VIR_FREE(oldslots);
+    return 0;
+}
+
+
+/**
+ * virHashOpenRemoveSlot:
+ * @table: open addressing hash table
+ * @entry: used slot of @table
+ *
+ * Free the entry stored in @entry and mark the slot as deleted. If the
+ * table becomes empty and isn't being iterated over, all the slots are
+ * reset, which gets rid of the deleted markers too.
+ */
+static void
+virHashOpenRemoveSlot(virHashTablePtr table, virHashEntryPtr entry)
+{
+    if (table->dataFree)
+        table->dataFree(entry->payload, entry->name);
+    if (table->keyFree)
+        table->keyFree(entry->name);
+
+    entry->name = &virHashSlotDeleted;
+    entry->payload = NULL;
+    table->nbElems--;
+    table->nbDeleted++;
+
+    if (table->nbElems == 0 && !table->iterating) {
+        memset(table->slots, 0, sizeof(*table->slots) * table->size);
+        table->nbDeleted = 0;
+    }
+}
+
+/**
+ * virHashCreateFullFlags:
  * @size: the size of the hash table
  * @dataFree: callback to free data
  * @keyCode: callback to compute hash code
  * @keyEqual: callback to compare hash keys
  * @keyCopy: callback to copy hash keys
  * @keyFree: callback to free keys
+ * @flags: bitwise-OR of virHashFlags
  *
- * Create a new virHashTablePtr.
+ * Create a new virHashTablePtr. By default the table uses chained
+ * buckets and @size is the number of buckets. With
+ * VIR_HASH_OPEN_ADDRESSING the entries are stored directly in an array
+ * of slots which is probed linearly; there's no per entry allocation
+ * and lookups touch less memory, which makes it a better fit for big
+ * tables. @size is then the number of entries expected.
  *
  * Returns the newly created object, or NULL if an error occurred.
  */
-virHashTablePtr virHashCreateFull(ssize_t size,
-                                  virHashDataFree dataFree,
-                                  virHashKeyCode keyCode,
-                                  virHashKeyEqual keyEqual,
-                                  virHashKeyCopy keyCopy,
-                                  virHashKeyFree keyFree)
+virHashTablePtr virHashCreateFullFlags(ssize_t size,
+                                       virHashDataFree dataFree,
+                                       virHashKeyCode keyCode,
+                                       virHashKeyEqual keyEqual,
+                                       virHashKeyCopy keyCopy,
+                                       virHashKeyFree keyFree,
+                                       unsigned int flags)
 {
     virHashTablePtr table = NULL;
 
+    virCheckFlags(VIR_HASH_OPEN_ADDRESSING, NULL);
+
     if (size <= 0)
         size = 256;
 
@@ -165,7 +309,7 @@ virHashTablePtr virHashCreateFull(ssize_t size,
         return NULL;
 
     table->seed = virRandomBits(32);
-    table->size = size;
+    table->flags = flags;
     table->nbElems = 0;
     table->dataFree = dataFree;
     table->keyCode = keyCode;
@@ -173,15 +317,53 @@ virHashTablePtr virHashCreateFull(ssize_t size,
     table->keyCopy = keyCopy;
     table->keyFree = keyFree;
 
-    if (VIR_ALLOC_N(table->table, size) < 0) {
-        VIR_FREE(table);
-        return NULL;
+    if (flags & VIR_HASH_OPEN_ADDRESSING) {
+        table->size = VIR_HASH_OPEN_MIN_SIZE;
+        while (VIR_HASH_OPEN_FULL(table->size, size))
+            table->size *= 2;
+
+        if (VIR_ALLOC_N(table->slots, table->size) < 0) {
+            VIR_FREE(table);
+            return NULL;
+        }
+    } else {
+        table->size = size;
+
+        if (VIR_ALLOC_N(table->table, size) < 0) {
+            VIR_FREE(table);
+            return NULL;
+        }
     }
 
     return table;
 }
 
 
+/**
+ * virHashCreateFull:
+ * @size: the size of the hash table
+ * @dataFree: callback to free data
+ * @keyCode: callback to compute hash code
+ * @keyEqual: callback to compare hash keys
+ * @keyCopy: callback to copy hash keys
+ * @keyFree: callback to free keys
+ *
+ * Create a new virHashTablePtr.
+ *
+ * Returns the newly created object, or NULL if an error occurred.
+ */
+virHashTablePtr virHashCreateFull(ssize_t size,
+                                  virHashDataFree dataFree,
+                                  virHashKeyCode keyCode,
+                                  virHashKeyEqual keyEqual,
+                                  virHashKeyCopy keyCopy,
+                                  virHashKeyFree keyFree)
+{
+    return virHashCreateFullFlags(size, dataFree, keyCode, keyEqual,
+                                  keyCopy, keyFree, 0);
+}
+
+
 /**
  * virHashCreate:
  * @size: the size of the hash table
@@ -193,12 +375,32 @@ virHashTablePtr virHashCreateFull(ssize_t size,
  */
 virHashTablePtr virHashCreate(ssize_t size, virHashDataFree dataFree)
 {
-    return virHashCreateFull(size,
-                             dataFree,
-                             virHashStrCode,
-                             virHashStrEqual,
-                             virHashStrCopy,
-                             virHashStrFree);
+    return virHashCreateFlags(size, dataFree, 0);
+}
+
+
+/**
+ * virHashCreateFlags:
+ * @size: the size of the hash table
+ * @dataFree: callback to free data
+ * @flags: bitwise-OR of virHashFlags
+ *
+ * Create a new virHashTablePtr with string keys, see
+ * virHashCreateFullFlags.
+ *
+ * Returns the newly created object, or NULL if an error occurred.
+ */
+virHashTablePtr virHashCreateFlags(ssize_t size,
+                                   virHashDataFree dataFree,
+                                   unsigned int flags)
+{
+    return virHashCreateFullFlags(size,
+                                  dataFree,
+                                  virHashStrCode,
+                                  virHashStrEqual,
+                                  virHashStrCopy,
+                                  virHashStrFree,
+                                  flags);
 }
 
 
@@ -272,7 +474,7 @@ virHashGrow(virHashTablePtr table, size_t size)
         virHashEntryPtr iter = oldtable[i];
         while (iter) {
             virHashEntryPtr next = iter->next;
-            size_t key = virHashComputeKey(table, iter->name);
+            size_t key = iter->code % table->size;
 
             iter->next = table->table[key];
             table->table[key] = iter;
@@ -309,6 +511,24 @@ virHashFree(virHashTablePtr table)
     if (table == NULL)
         return;
 
+    if (table->flags & VIR_HASH_OPEN_ADDRESSING) {
+        for (i = 0; i < table->size; i++) {
+            virHashEntryPtr entry = &table->slots[i];
+
+            if (!VIR_HASH_SLOT_USED(entry))
+                continue;
+
+            if (table->dataFree)
+                table->dataFree(entry->payload, entry->name);
+            if (table->keyFree)
+                table->keyFree(entry->name);
+        }
+
+        VIR_FREE(table->slots);
+        VIR_FREE(table);
+        return;
+    }
+
     for (i = 0; i < table->size; i++) {
         virHashEntryPtr iter = table->table[i];
         while (iter) {
@@ -327,6 +547,54 @@ virHashFree(virHashTablePtr table)
     VIR_FREE(table);
 }
 
+static int
+virHashOpenAddOrUpdateEntry(virHashTablePtr table, const void *name,
+                            uint32_t code, void *userdata,
+                            bool is_update)
+{
+    virHashEntryPtr entry;
+    void *new_name;
+
+    if ((entry = virHashOpenFind(table, name, code))) {
+        if (is_update) {
+            if (table->dataFree)
+                table->dataFree(entry->payload, entry->name);
+            entry->payload = userdata;
+            return 0;
+        } else {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Duplicate key"));
+            return -1;
+        }
+    }
+
+    if (VIR_HASH_OPEN_FULL(table->size, table->nbElems + table->nbDeleted + 1)) {
+        /* Just get rid of deleted slots if they are what fills the table */
+        size_t size = table->size;
+
+        if (VIR_HASH_OPEN_FULL(size, 2 * (table->nbElems + 1)))
+            size *= 2;
+
+        if (virHashOpenResize(table, size) < 0)
+            return -1;
+    }
+
+    if (!(new_name = table->keyCopy(name)))
+        return -1;
+
+    entry = virHashOpenFindFree(table, code);
+    if (entry->name == &virHashSlotDeleted)
+        table->nbDeleted--;
+
+    entry->code = code;
+    entry->name = new_name;
+    entry->payload = userdata;
+
+    table->nbElems++;
+
+    return 0;
+}
+
 static int
 virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
                         void *userdata,
@@ -335,6 +603,7 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
     size_t key, len = 0;
     virHashEntryPtr entry;
     void *new_name;
+    uint32_t code;
 
     if ((table == NULL) || (name == NULL))
         return -1;
@@ -342,11 +611,17 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
     if (table->iterating)
         virHashIterationError(-1);
 
-    key = virHashComputeKey(table, name);
+    code = virHashComputeCode(table, name);
+
+    if (table->flags & VIR_HASH_OPEN_ADDRESSING)
+        return virHashOpenAddOrUpdateEntry(table, name, code, userdata,
+                                           is_update);
+
+    key = code % table->size;
 
     /* Check for duplicate entry */
     for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
+        if (entry->code == code && table->keyEqual(entry->name, name)) {
             if (is_update) {
                 if (table->dataFree)
                     table->dataFree(entry->payload, entry->name);
@@ -366,6 +641,7 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
         return -1;
     }
 
+    entry->code = code;
     entry->name = new_name;
     entry->payload = userdata;
     entry->next = table->table[key];
@@ -442,15 +718,22 @@ virHashAtomicUpdate(virHashAtomicPtr table,
 void *
 virHashLookup(const virHashTable *table, const void *name)
 {
-    size_t key;
     virHashEntryPtr entry;
+    uint32_t code;
 
     if (!table || !name)
         return NULL;
 
-    key = virHashComputeKey(table, name);
-    for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name))
+    code = virHashComputeCode(table, name);
+
+    if (table->flags & VIR_HASH_OPEN_ADDRESSING) {
+        if ((entry = virHashOpenFind(table, name, code)))
+            return entry->payload;
+        return NULL;
+    }
+
+    for (entry = table->table[code % table->size]; entry; entry = entry->next) {
+        if (entry->code == code && table->keyEqual(entry->name, name))
             return entry->payload;
     }
     return NULL;
@@ -544,13 +827,27 @@ virHashRemoveEntry(virHashTablePtr table, const void *name)
 {
     virHashEntryPtr entry;
     virHashEntryPtr *nextptr;
+    uint32_t code;
 
     if (table == NULL || name == NULL)
         return -1;
 
-    nextptr = table->table + virHashComputeKey(table, name);
+    code = virHashComputeCode(table, name);
+
+    if (table->flags & VIR_HASH_OPEN_ADDRESSING) {
+        if (!(entry = virHashOpenFind(table, name, code)))
+            return -1;
+
+        if (table->iterating && table->current != entry)
+            virHashIterationError(-1);
+
+        virHashOpenRemoveSlot(table, entry);
+        return 0;
+    }
+
+    nextptr = table->table + code % table->size;
     for (entry = *nextptr; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
+        if (entry->code == code && table->keyEqual(entry->name, name)) {
             if (table->iterating && table->current != entry)
                 virHashIterationError(-1);
 
@@ -598,6 +895,24 @@ virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
 
     table->iterating = true;
     table->current = NULL;
+
+    if (table->flags & VIR_HASH_OPEN_ADDRESSING) {
+        for (i = 0; i < table->size; i++) {
+            virHashEntryPtr entry = &table->slots[i];
+
+            if (!VIR_HASH_SLOT_USED(entry))
+                continue;
+
+            table->current = entry;
+            ret = iter(entry->payload, entry->name, data);
+            table->current = NULL;
+
+            if (ret < 0)
+                goto cleanup;
+        }
+        goto done;
+    }
+
     for (i = 0; i < table->size; i++) {
         virHashEntryPtr entry = table->table[i];
         while (entry) {
@@ -613,13 +928,68 @@ virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
         }
     }
 
+ done:
     ret = 0;
  cleanup:
     table->iterating = false;
+    if (table->flags & VIR_HASH_OPEN_ADDRESSING && table->nbElems == 0 &&
+        table->nbDeleted > 0) {
+        memset(table->slots, 0, sizeof(*table->slots) * table->size);
+        table->nbDeleted = 0;
+    }
     return ret;
 }
 
 
+/**
+ * virHashForEachReadOnly
+ * @table: the hash table to process
+ * @iter: callback to process each element
+ * @data: opaque data to pass to the iterator
+ *
+ * Like virHashForEach, but @iter must not modify @table in any way.
+ * In exchange, the table is left untouched by the iteration itself, so
+ * several threads may iterate over it or look up entries at the same
+ * time, e.g. while each holding a read lock protecting @table.
+ *
+ * Returns 0 on success or -1 on failure.
+ */
+int
+virHashForEachReadOnly(const virHashTable *table,
+                       virHashIterator iter,
+                       void *data)
+{
+    size_t i;
+
+    if (table == NULL || iter == NULL)
+        return -1;
+
+    if (table->iterating)
+        virHashIterationError(-1);
+
+    if (table->flags & VIR_HASH_OPEN_ADDRESSING) {
+        for (i = 0; i < table->size; i++) {
+            virHashEntryPtr entry = &table->slots[i];
+
+            if (VIR_HASH_SLOT_USED(entry) &&
+                iter(entry->payload, entry->name, data) < 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    for (i = 0; i < table->size; i++) {
+        virHashEntryPtr entry;
+        for (entry = table->table[i]; entry; entry = entry->next) {
+            if (iter(entry->payload, entry->name, data) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 /**
  * virHashRemoveSet
  * @table: the hash table to process
@@ -648,6 +1018,27 @@ virHashRemoveSet(virHashTablePtr table,
 
     table->iterating = true;
     table->current = NULL;
+
+    if (table->flags & VIR_HASH_OPEN_ADDRESSING) {
+        for (i = 0; i < table->size; i++) {
+            virHashEntryPtr entry = &table->slots[i];
+
+            if (VIR_HASH_SLOT_USED(entry) &&
+                iter(entry->payload, entry->name, data)) {
+                count++;
+                virHashOpenRemoveSlot(table, entry);
+            }
+        }
+        table->iterating = false;
+
+        if (table->nbElems == 0 && table->nbDeleted > 0) {
+            memset(table->slots, 0, sizeof(*table->slots) * table->size);
+            table->nbDeleted = 0;
+        }
+
+        return count;
+    }
+
     for (i = 0; i < table->size; i++) {
         virHashEntryPtr *nextptr = table->table + i;
 
@@ -706,7 +1097,9 @@ virHashRemoveAll(virHashTablePtr table)
  * Iterates over the hash table calling the 'iter' callback
  * for each element. The first element for which the iter
  * returns non-zero will be returned by this function.
- * The elements are processed in a undefined order
+ * The elements are processed in a undefined order. The 'iter'
+ * callback must not modify the table, which makes it safe to
+ * search the table from several threads at the same time.
  */
 void *virHashSearch(const virHashTable *ctable,
                     virHashSearcher iter,
@@ -714,8 +1107,7 @@ void *virHashSearch(const virHashTable *ctable,
 {
     size_t i;
 
-    /* Cast away const for internal detection of misuse.  */
-    virHashTablePtr table = (virHashTablePtr)ctable;
+    const virHashTable *table = ctable;
 
     if (table == NULL || iter == NULL)
         return NULL;
@@ -723,18 +1115,24 @@ void *virHashSearch(const virHashTable *ctable,
     if (table->iterating)
         virHashIterationError(NULL);
 
-    table->iterating = true;
-    table->current = NULL;
+    if (table->flags & VIR_HASH_OPEN_ADDRESSING) {
+        for (i = 0; i < table->size; i++) {
+            virHashEntryPtr entry = &table->slots[i];
+
+            if (VIR_HASH_SLOT_USED(entry) &&
+                iter(entry->payload, entry->name, data))
+                return entry->payload;
+        }
+        return NULL;
+    }
+
     for (i = 0; i < table->size; i++) {
         virHashEntryPtr entry;
         for (entry = table->table[i]; entry; entry = entry->next) {
-            if (iter(entry->payload, entry->name, data)) {
-                table->iterating = false;
+            if (iter(entry->payload, entry->name, data))
                 return entry->payload;
-            }
         }
     }
-    table->iterating = false;
 
     return NULL;
 }
@@ -1,5 +1,5 @@
 /*
- * Summary: Chained hash tables and domain/connections handling
+ * Summary: Chained and open addressing hash tables
  * Description: This module implements the hash table and allocation and
  *              deallocation of domains and connections
  *
@@ -101,11 +101,19 @@ typedef void *(*virHashKeyCopy)(const void *name);
  */
 typedef void (*virHashKeyFree)(void *name);
 
+typedef enum {
+    /* Store entries in a linearly probed array instead of chains */
+    VIR_HASH_OPEN_ADDRESSING = (1 << 0),
+} virHashFlags;
+
 /*
  * Constructor and destructor.
  */
 virHashTablePtr virHashCreate(ssize_t size,
                               virHashDataFree dataFree);
+virHashTablePtr virHashCreateFlags(ssize_t size,
+                                   virHashDataFree dataFree,
+                                   unsigned int flags);
 virHashAtomicPtr virHashAtomicNew(ssize_t size,
                                   virHashDataFree dataFree);
 virHashTablePtr virHashCreateFull(ssize_t size,
@@ -114,6 +122,13 @@ virHashTablePtr virHashCreateFull(ssize_t size,
                                   virHashKeyEqual keyEqual,
                                   virHashKeyCopy keyCopy,
                                   virHashKeyFree keyFree);
+virHashTablePtr virHashCreateFullFlags(ssize_t size,
+                                       virHashDataFree dataFree,
+                                       virHashKeyCode keyCode,
+                                       virHashKeyEqual keyEqual,
+                                       virHashKeyCopy keyCopy,
+                                       virHashKeyFree keyFree,
+                                       unsigned int flags);
 void virHashFree(virHashTablePtr table);
 ssize_t virHashSize(const virHashTable *table);
 ssize_t virHashTableSize(const virHashTable *table);
@@ -192,6 +207,8 @@ bool virHashEqual(const virHashTable *table1,
  * Iterators
  */
 int virHashForEach(virHashTablePtr table, virHashIterator iter, void *data);
+int virHashForEachReadOnly(const virHashTable *table, virHashIterator iter,
+                           void *data);
 ssize_t virHashRemoveSet(virHashTablePtr table, virHashSearcher iter, const void *data);
 void *virHashSearch(const virHashTable *table, virHashSearcher iter,
                     const void *data);
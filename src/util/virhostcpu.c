@@ -54,6 +54,7 @@
 #include "intprops.h"
 #include "virarch.h"
 #include "virfile.h"
+#include "virhosttopology.h"
 #include "virtypedparam.h"
 #include "virstring.h"
 #include "virnuma.h"
@@ -919,12 +920,26 @@ virHostCPUGetInfo(virArch hostarch ATTRIBUTE_UNUSED,
 {
 #ifdef __linux__
     int ret = -1;
-    FILE *cpuinfo = fopen(CPUINFO_PATH, "r");
+    FILE *cpuinfo = NULL;
+    virHostTopologyPtr topo = NULL;
+    virHostTopologyInfo info = { .arch = hostarch };
+
+    if ((topo = virHostTopologyGet()) &&
+        virHostTopologyGetInfo(topo, &info)) {
+        *cpus = info.cpus;
+        *mhz = info.mhz;
+        *nodes = info.nodes;
+        *sockets = info.sockets;
+        *cores = info.cores;
+        *threads = info.threads;
+        ret = 0;
+        goto cleanup;
+    }
 
-    if (!cpuinfo) {
+    if (!(cpuinfo = fopen(CPUINFO_PATH, "r"))) {
         virReportSystemError(errno,
                              _("cannot open %s"), CPUINFO_PATH);
-        return -1;
+        goto cleanup;
     }
 
     ret = virHostCPUGetInfoPopulateLinux(cpuinfo, hostarch,
@@ -933,8 +948,19 @@ virHostCPUGetInfo(virArch hostarch ATTRIBUTE_UNUSED,
     if (ret < 0)
         goto cleanup;
 
+    if (topo) {
+        info.cpus = *cpus;
+        info.mhz = *mhz;
+        info.nodes = *nodes;
+        info.sockets = *sockets;
+        info.cores = *cores;
+        info.threads = *threads;
+        virHostTopologySetInfo(topo, &info);
+    }
+
  cleanup:
     VIR_FORCE_FCLOSE(cpuinfo);
+    virObjectUnref(topo);
     return ret;
 #elif defined(__FreeBSD__) || defined(__APPLE__)
     unsigned long cpu_freq;
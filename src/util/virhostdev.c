@@ -40,6 +40,7 @@
 #include "virlog.h"
 #include "virutil.h"
 #include "virnetdev.h"
+#include "virthread.h"
 #include "configmake.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -604,6 +605,187 @@ virHostdevRestoreNetConfig(virDomainHostdevDefPtr hostdev,
     return ret;
 }
 
+/*
+ * Detaching and resetting a device can take a while: unbinding it from
+ * its host driver may tear down a whole network stack, and a secondary
+ * bus reset alone waits for 400ms. Devices behind different bridges
+ * don't affect each other, so when a domain is given several of them
+ * they are processed by one thread per bus, while the devices sharing
+ * a bus - and with it the bus reset - are still handled one at a time.
+ *
+ * The workers only ever read the active and inactive lists, which the
+ * caller keeps locked throughout; all changes to them are made by the
+ * caller once the workers are done.
+ */
+typedef struct _virHostdevPCIWorker virHostdevPCIWorker;
+typedef virHostdevPCIWorker *virHostdevPCIWorkerPtr;
+struct _virHostdevPCIWorker {
+    virThread thread;
+    bool started;
+
+    virHostdevManagerPtr mgr;
+    virPCIDeviceListPtr pcidevs;
+    bool reset;
+
+    /* Indexes in @pcidevs of the devices handled by this worker */
+    size_t *devs;
+    size_t ndevs;
+
+    /* Shared by all workers, each only sets its own devices */
+    bool *done;
+
+    virErrorPtr err;
+};
+
+
+static void
+virHostdevPCIWorkerRun(void *opaque)
+{
+    virHostdevPCIWorkerPtr worker = opaque;
+    size_t i;
+
+    for (i = 0; i < worker->ndevs; i++) {
+        virPCIDevicePtr pci = virPCIDeviceListGet(worker->pcidevs,
+                                                  worker->devs[i]);
+        int rc;
+
+        if (worker->reset) {
+            /* We can avoid looking up the actual device here, because
+             * performing a PCI reset on a device doesn't require any
+             * information other than the address, which 'pci' already
+             * contains */
+            VIR_DEBUG("Resetting PCI device %s", virPCIDeviceGetName(pci));
+            rc = virPCIDeviceReset(pci, worker->mgr->activePCIHostdevs,
+                                   worker->mgr->inactivePCIHostdevs);
+        } else {
+            /* The caller adds the copy of 'pci' to the inactive list */
+            VIR_DEBUG("Detaching managed PCI device %s",
+                      virPCIDeviceGetName(pci));
+            rc = virPCIDeviceDetach(pci, worker->mgr->activePCIHostdevs,
+                                    NULL);
+        }
+
+        if (rc < 0) {
+            worker->err = virSaveLastError();
+            return;
+        }
+
+        worker->done[worker->devs[i]] = true;
+    }
+}
+
+
+/**
+ * virHostdevProcessPCIDevices:
+ * @mgr: hostdev manager, with both PCI lists locked
+ * @pcidevs: devices to process
+ * @reset: reset all devices rather than detaching the managed ones
+ * @done: array as long as @pcidevs, set for each device processed
+ *
+ * Detach or reset the devices in @pcidevs, in parallel for those on
+ * different buses. Detaching in parallel also requires every device to
+ * support driver_override, because the new_id interface used otherwise
+ * is shared by all devices bound to the same stub driver.
+ *
+ * Returns 0 if all devices were processed, -1 with the error of the
+ * first failure reported otherwise, in which case @done still tells
+ * which devices were processed.
+ */
+static int
+virHostdevProcessPCIDevices(virHostdevManagerPtr mgr,
+                            virPCIDeviceListPtr pcidevs,
+                            bool reset,
+                            bool *done)
+{
+    virHostdevPCIWorkerPtr workers = NULL;
+    size_t nworkers = 0;
+    size_t count = virPCIDeviceListCount(pcidevs);
+    bool parallel = true;
+    size_t i, j;
+    int ret = -1;
+
+    for (i = 0; i < count && !reset; i++) {
+        virPCIDevicePtr pci = virPCIDeviceListGet(pcidevs, i);
+
+        if (virPCIDeviceGetManaged(pci) &&
+            !virPCIDeviceHasDriverOverride(pci)) {
+            parallel = false;
+            break;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        virPCIDevicePtr pci = virPCIDeviceListGet(pcidevs, i);
+        virPCIDeviceAddressPtr addr = virPCIDeviceGetAddress(pci);
+
+        if (!reset && !virPCIDeviceGetManaged(pci))
+            continue;
+
+        for (j = 0; j < nworkers; j++) {
+            virPCIDevicePtr first = virPCIDeviceListGet(pcidevs,
+                                                        workers[j].devs[0]);
+            virPCIDeviceAddressPtr other = virPCIDeviceGetAddress(first);
+
+            if (!parallel ||
+                (other->domain == addr->domain && other->bus == addr->bus))
+                break;
+        }
+
+        if (j == nworkers) {
+            if (VIR_EXPAND_N(workers, nworkers, 1) < 0)
+                goto cleanup;
+            workers[j].mgr = mgr;
+            workers[j].pcidevs = pcidevs;
+            workers[j].reset = reset;
+            workers[j].done = done;
+        }
+
+        if (VIR_APPEND_ELEMENT(workers[j].devs, workers[j].ndevs, i) < 0)
+            goto cleanup;
+    }
+
+    if (nworkers > 1) {
+        VIR_DEBUG("%s PCI devices on %zu buses in parallel",
+                  reset ? "Resetting" : "Detaching", nworkers);
+
+        for (j = 0; j < nworkers; j++) {
+            if (virThreadCreate(&workers[j].thread, true,
+                                virHostdevPCIWorkerRun, &workers[j]) < 0) {
+                VIR_WARN("Unable to create thread for PCI device %s",
+                         virPCIDeviceGetName(virPCIDeviceListGet(pcidevs,
+                                                                 workers[j].devs[0])));
+                continue;
+            }
+            workers[j].started = true;
+        }
+    }
+
+    /* Whatever couldn't be handed to a thread is processed here */
+    for (j = 0; j < nworkers; j++) {
+        if (!workers[j].started)
+            virHostdevPCIWorkerRun(&workers[j]);
+    }
+
+    ret = 0;
+    for (j = 0; j < nworkers; j++) {
+        if (workers[j].started)
+            virThreadJoin(&workers[j].thread);
+        if (workers[j].err && ret == 0) {
+            virSetError(workers[j].err);
+            ret = -1;
+        }
+    }
+
+ cleanup:
+    for (j = 0; j < nworkers; j++) {
+        virFreeError(workers[j].err);
+        VIR_FREE(workers[j].devs);
+    }
+    VIR_FREE(workers);
+    return ret;
+}
+
+
 int
 virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
                             const char *drv_name,
@@ -618,6 +800,8 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
     size_t i;
     int ret = -1;
     virPCIDeviceAddressPtr devAddr = NULL;
+    bool *done = NULL;
+    int rc;
 
     if (!nhostdevs)
         return 0;
@@ -625,7 +809,8 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
     virObjectLock(mgr->activePCIHostdevs);
     virObjectLock(mgr->inactivePCIHostdevs);
 
-    if (!(pcidevs = virHostdevGetPCIHostDeviceList(hostdevs, nhostdevs)))
+    if (!(pcidevs = virHostdevGetPCIHostDeviceList(hostdevs, nhostdevs)) ||
+        VIR_ALLOC_N(done, virPCIDeviceListCount(pcidevs)) < 0)
         goto cleanup;
 
     /* Detaching devices from the host involves several steps; each
@@ -685,24 +870,12 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
             goto cleanup;
     }
 
-    /* Step 2: detach managed devices and make sure unmanaged devices
-     *         have already been taken care of */
+    /* Step 2: make sure unmanaged devices have already been taken care
+     *         of and detach managed devices */
     for (i = 0; i < virPCIDeviceListCount(pcidevs); i++) {
         virPCIDevicePtr pci = virPCIDeviceListGet(pcidevs, i);
 
-        if (virPCIDeviceGetManaged(pci)) {
-
-            /* We can't look up the actual device because it has not been
-             * created yet: virPCIDeviceDetach() will insert a copy of 'pci'
-             * into the list of inactive devices, and that copy will be the
-             * actual device going forward */
-            VIR_DEBUG("Detaching managed PCI device %s",
-                      virPCIDeviceGetName(pci));
-            if (virPCIDeviceDetach(pci,
-                                   mgr->activePCIHostdevs,
-                                   mgr->inactivePCIHostdevs) < 0)
-                goto reattachdevs;
-        } else {
+        if (!virPCIDeviceGetManaged(pci)) {
             char *driverPath;
             char *driverName;
             int stub;
@@ -754,23 +927,36 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
         }
     }
 
-    /* At this point, all devices are attached to the stub driver and have
-     * been marked as inactive */
+    rc = virHostdevProcessPCIDevices(mgr, pcidevs, false, done);
 
-    /* Step 3: Now that all the PCI hostdevs have been detached, we
-     * can safely reset them */
+    /* We can't look up the actual devices because they have not been
+     * created yet: insert a copy of each detached 'pci' into the list of
+     * inactive devices, and that copy will be the actual device going
+     * forward. This is done even if some of them failed, so that the
+     * others get reattached below */
     for (i = 0; i < virPCIDeviceListCount(pcidevs); i++) {
         virPCIDevicePtr pci = virPCIDeviceListGet(pcidevs, i);
 
-        /* We can avoid looking up the actual device here, because performing
-         * a PCI reset on a device doesn't require any information other than
-         * the address, which 'pci' already contains */
-        VIR_DEBUG("Resetting PCI device %s", virPCIDeviceGetName(pci));
-        if (virPCIDeviceReset(pci, mgr->activePCIHostdevs,
-                              mgr->inactivePCIHostdevs) < 0)
-            goto reattachdevs;
+        if (!done[i] || virPCIDeviceListFind(mgr->inactivePCIHostdevs, pci))
+            continue;
+
+        VIR_DEBUG("Adding PCI device %s to inactive list",
+                  virPCIDeviceGetName(pci));
+        if (virPCIDeviceListAddCopy(mgr->inactivePCIHostdevs, pci) < 0)
+            rc = -1;
     }
 
+    if (rc < 0)
+        goto reattachdevs;
+
+    /* At this point, all devices are attached to the stub driver and have
+     * been marked as inactive */
+
+    /* Step 3: Now that all the PCI hostdevs have been detached, we
+     * can safely reset them */
+    if (virHostdevProcessPCIDevices(mgr, pcidevs, true, done) < 0)
+        goto reattachdevs;
+
     /* Step 4: For SRIOV network devices, Now that we have detached the
      * the network device, set the new netdev config */
     for (i = 0; i < nhostdevs; i++) {
@@ -899,6 +1085,7 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr mgr,
 
  cleanup:
     virObjectUnref(pcidevs);
+    VIR_FREE(done);
     virObjectUnlock(mgr->activePCIHostdevs);
     virObjectUnlock(mgr->inactivePCIHostdevs);
 
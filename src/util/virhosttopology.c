@@ -0,0 +1,441 @@
+/*
+ * virhosttopology.c: snapshot of the static host CPU and NUMA topology
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Building the capabilities, starting a domain with NUMA tuning or
+ * answering virNodeGetInfo() all need the host topology, which used
+ * to be read afresh from /proc and sysfs every time although it only
+ * changes when CPUs or memory are hotplugged.
+ *
+ * The snapshot remembers what virHostCPUGetInfo(), virNumaGetNodeCPUs(),
+ * virNumaGetDistances() and virNumaGetPages() found the first time
+ * they successfully read it; those functions consult it before going
+ * to the host. Counters which change at runtime, like free pages or
+ * whether a CPU is online, are never part of it.
+ *
+ * virHostTopologyInvalidate() replaces the current snapshot with an
+ * empty one, which is then filled again on demand. Callers holding a
+ * reference to the old snapshot keep seeing self-consistent data.
+ */
+
+#include <config.h>
+
+#include "virhosttopology.h"
+#include "viralloc.h"
+#include "virlog.h"
+#include "virthread.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.hosttopology");
+
+typedef struct _virHostTopologyNode virHostTopologyNode;
+typedef virHostTopologyNode *virHostTopologyNodePtr;
+struct _virHostTopologyNode {
+    bool haveCPUs;
+    int ncpus; /* -2 if the node has no usable CPU topology */
+    virBitmapPtr cpus;
+
+    bool haveDistances;
+    int *distances;
+    int ndistances;
+
+    bool havePageSizes;
+    unsigned int *pageSizes;
+    size_t npageSizes;
+};
+
+struct _virHostTopology {
+    virObjectLockable parent;
+
+    bool haveInfo;
+    virHostTopologyInfo info;
+
+    /* Indexed by node + 1, so that the first entry covers the whole
+     * host (node -1) */
+    virHostTopologyNodePtr nodes;
+    size_t nnodes;
+};
+
+static virClassPtr virHostTopologyClass;
+static virMutex virHostTopologyLock = VIR_MUTEX_INITIALIZER;
+static virHostTopologyPtr virHostTopologyCurrent;
+
+static void virHostTopologyDispose(void *obj);
+
+static int
+virHostTopologyOnceInit(void)
+{
+    if (!(virHostTopologyClass = virClassNew(virClassForObjectLockable(),
+                                             "virHostTopology",
+                                             sizeof(virHostTopology),
+                                             virHostTopologyDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virHostTopology)
+
+
+static void
+virHostTopologyDispose(void *obj)
+{
+    virHostTopologyPtr topo = obj;
+    size_t i;
+
+    for (i = 0; i < topo->nnodes; i++) {
+        virBitmapFree(topo->nodes[i].cpus);
+        VIR_FREE(topo->nodes[i].distances);
+        VIR_FREE(topo->nodes[i].pageSizes);
+    }
+    VIR_FREE(topo->nodes);
+}
+
+
+/**
+ * virHostTopologyGet:
+ *
+ * Returns a reference to the current snapshot, which the caller must
+ * release with virObjectUnref(), or NULL on error.
+ */
+virHostTopologyPtr
+virHostTopologyGet(void)
+{
+    virHostTopologyPtr topo = NULL;
+
+    if (virHostTopologyInitialize() < 0)
+        return NULL;
+
+    virMutexLock(&virHostTopologyLock);
+    if (!virHostTopologyCurrent)
+        virHostTopologyCurrent = virObjectLockableNew(virHostTopologyClass);
+    if (virHostTopologyCurrent)
+        topo = virObjectRef(virHostTopologyCurrent);
+    virMutexUnlock(&virHostTopologyLock);
+
+    return topo;
+}
+
+
+/**
+ * virHostTopologyInvalidate:
+ *
+ * Forget everything learned about the host topology, for example
+ * because a CPU or memory was hotplugged. The next callers start
+ * from an empty snapshot.
+ */
+void
+virHostTopologyInvalidate(void)
+{
+    virHostTopologyPtr topo;
+
+    virMutexLock(&virHostTopologyLock);
+    topo = virHostTopologyCurrent;
+    virHostTopologyCurrent = NULL;
+    virMutexUnlock(&virHostTopologyLock);
+
+    if (topo)
+        VIR_DEBUG("Invalidating host topology snapshot %p", topo);
+    virObjectUnref(topo);
+}
+
+
+/* Must be called with @topo locked */
+static virHostTopologyNodePtr
+virHostTopologyGetNode(virHostTopologyPtr topo,
+                       int node,
+                       bool add)
+{
+    size_t idx;
+
+    if (node < -1)
+        return NULL;
+
+    idx = node + 1;
+    if (idx >= topo->nnodes) {
+        if (!add ||
+            VIR_EXPAND_N(topo->nodes, topo->nnodes,
+                         idx + 1 - topo->nnodes) < 0)
+            return NULL;
+    }
+
+    return &topo->nodes[idx];
+}
+
+
+/**
+ * virHostTopologyGetInfo:
+ * @topo: snapshot
+ * @info: filled with the cached information
+ *
+ * Returns true if @topo holds the information for @info->arch.
+ */
+bool
+virHostTopologyGetInfo(virHostTopologyPtr topo,
+                       virHostTopologyInfoPtr info)
+{
+    bool ret = false;
+
+    virObjectLock(topo);
+    if (topo->haveInfo && topo->info.arch == info->arch) {
+        *info = topo->info;
+        ret = true;
+    }
+    virObjectUnlock(topo);
+
+    return ret;
+}
+
+
+void
+virHostTopologySetInfo(virHostTopologyPtr topo,
+                       const virHostTopologyInfo *info)
+{
+    virObjectLock(topo);
+    topo->info = *info;
+    topo->haveInfo = true;
+    virObjectUnlock(topo);
+}
+
+
+/**
+ * virHostTopologyGetNodeCPUs:
+ * @topo: snapshot
+ * @node: NUMA node
+ * @cpus: filled with a copy of the CPUs of @node, if any
+ * @ncpus: filled with their count, or -2 if @node has none
+ *
+ * Returns 1 if @topo knows the CPUs of @node, 0 if not and -1 on
+ * error.
+ */
+int
+virHostTopologyGetNodeCPUs(virHostTopologyPtr topo,
+                           int node,
+                           virBitmapPtr *cpus,
+                           int *ncpus)
+{
+    virHostTopologyNodePtr def;
+    int ret = 0;
+
+    *cpus = NULL;
+
+    virObjectLock(topo);
+    if (!(def = virHostTopologyGetNode(topo, node, false)) || !def->haveCPUs)
+        goto cleanup;
+
+    if (def->cpus && !(*cpus = virBitmapNewCopy(def->cpus))) {
+        ret = -1;
+        goto cleanup;
+    }
+    *ncpus = def->ncpus;
+    ret = 1;
+
+ cleanup:
+    virObjectUnlock(topo);
+    return ret;
+}
+
+
+int
+virHostTopologySetNodeCPUs(virHostTopologyPtr topo,
+                           int node,
+                           virBitmapPtr cpus,
+                           int ncpus)
+{
+    virHostTopologyNodePtr def;
+    virBitmapPtr copy = NULL;
+    int ret = -1;
+
+    if (cpus && !(copy = virBitmapNewCopy(cpus)))
+        return -1;
+
+    virObjectLock(topo);
+    if (!(def = virHostTopologyGetNode(topo, node, true)))
+        goto cleanup;
+
+    virBitmapFree(def->cpus);
+    def->cpus = copy;
+    copy = NULL;
+    def->ncpus = ncpus;
+    def->haveCPUs = true;
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(topo);
+    virBitmapFree(copy);
+    return ret;
+}
+
+
+/**
+ * virHostTopologyGetDistances:
+ * @topo: snapshot
+ * @node: NUMA node
+ * @distances: filled with a copy of the distances from @node
+ * @ndistances: filled with their count
+ *
+ * Returns 1 if @topo knows the distances from @node, 0 if not and -1
+ * on error.
+ */
+int
+virHostTopologyGetDistances(virHostTopologyPtr topo,
+                            int node,
+                            int **distances,
+                            int *ndistances)
+{
+    virHostTopologyNodePtr def;
+    int ret = 0;
+
+    *distances = NULL;
+
+    virObjectLock(topo);
+    if (!(def = virHostTopologyGetNode(topo, node, false)) ||
+        !def->haveDistances)
+        goto cleanup;
+
+    if (def->ndistances &&
+        VIR_ALLOC_N(*distances, def->ndistances) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+    if (def->ndistances)
+        memcpy(*distances, def->distances,
+               def->ndistances * sizeof(*def->distances));
+    *ndistances = def->ndistances;
+    ret = 1;
+
+ cleanup:
+    virObjectUnlock(topo);
+    return ret;
+}
+
+
+int
+virHostTopologySetDistances(virHostTopologyPtr topo,
+                            int node,
+                            const int *distances,
+                            int ndistances)
+{
+    virHostTopologyNodePtr def;
+    int *copy = NULL;
+    int ret = -1;
+
+    if (ndistances > 0) {
+        if (VIR_ALLOC_N(copy, ndistances) < 0)
+            return -1;
+        memcpy(copy, distances, ndistances * sizeof(*distances));
+    }
+
+    virObjectLock(topo);
+    if (!(def = virHostTopologyGetNode(topo, node, true)))
+        goto cleanup;
+
+    VIR_FREE(def->distances);
+    def->distances = copy;
+    copy = NULL;
+    def->ndistances = MAX(ndistances, 0);
+    def->haveDistances = true;
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(topo);
+    VIR_FREE(copy);
+    return ret;
+}
+
+
+/**
+ * virHostTopologyGetPageSizes:
+ * @topo: snapshot
+ * @node: NUMA node, or -1 for the whole host
+ * @sizes: filled with a copy of the huge page sizes of @node, in KiB
+ * @nsizes: filled with their count
+ *
+ * Returns 1 if @topo knows the huge page sizes of @node, 0 if not
+ * and -1 on error.
+ */
+int
+virHostTopologyGetPageSizes(virHostTopologyPtr topo,
+                            int node,
+                            unsigned int **sizes,
+                            size_t *nsizes)
+{
+    virHostTopologyNodePtr def;
+    int ret = 0;
+
+    *sizes = NULL;
+
+    virObjectLock(topo);
+    if (!(def = virHostTopologyGetNode(topo, node, false)) ||
+        !def->havePageSizes)
+        goto cleanup;
+
+    if (def->npageSizes &&
+        VIR_ALLOC_N(*sizes, def->npageSizes) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+    if (def->npageSizes)
+        memcpy(*sizes, def->pageSizes,
+               def->npageSizes * sizeof(*def->pageSizes));
+    *nsizes = def->npageSizes;
+    ret = 1;
+
+ cleanup:
+    virObjectUnlock(topo);
+    return ret;
+}
+
+
+int
+virHostTopologySetPageSizes(virHostTopologyPtr topo,
+                            int node,
+                            const unsigned int *sizes,
+                            size_t nsizes)
+{
+    virHostTopologyNodePtr def;
+    unsigned int *copy = NULL;
+    int ret = -1;
+
+    if (nsizes) {
+        if (VIR_ALLOC_N(copy, nsizes) < 0)
+            return -1;
+        memcpy(copy, sizes, nsizes * sizeof(*sizes));
+    }
+
+    virObjectLock(topo);
+    if (!(def = virHostTopologyGetNode(topo, node, true)))
+        goto cleanup;
+
+    VIR_FREE(def->pageSizes);
+    def->pageSizes = copy;
+    copy = NULL;
+    def->npageSizes = nsizes;
+    def->havePageSizes = true;
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(topo);
+    VIR_FREE(copy);
+    return ret;
+}
@@ -0,0 +1,88 @@
+/*
+ * virhosttopology.h: snapshot of the static host CPU and NUMA topology
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_HOST_TOPOLOGY_H__
+# define __VIR_HOST_TOPOLOGY_H__
+
+# include "internal.h"
+# include "virarch.h"
+# include "virbitmap.h"
+# include "virobject.h"
+
+typedef struct _virHostTopology virHostTopology;
+typedef virHostTopology *virHostTopologyPtr;
+
+typedef struct _virHostTopologyInfo virHostTopologyInfo;
+typedef virHostTopologyInfo *virHostTopologyInfoPtr;
+struct _virHostTopologyInfo {
+    virArch arch;
+    unsigned int cpus;
+    unsigned int mhz;
+    unsigned int nodes;
+    unsigned int sockets;
+    unsigned int cores;
+    unsigned int threads;
+};
+
+virHostTopologyPtr virHostTopologyGet(void);
+void virHostTopologyInvalidate(void);
+
+bool virHostTopologyGetInfo(virHostTopologyPtr topo,
+                            virHostTopologyInfoPtr info)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+void virHostTopologySetInfo(virHostTopologyPtr topo,
+                            const virHostTopologyInfo *info)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+int virHostTopologyGetNodeCPUs(virHostTopologyPtr topo,
+                               int node,
+                               virBitmapPtr *cpus,
+                               int *ncpus)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+int virHostTopologySetNodeCPUs(virHostTopologyPtr topo,
+                               int node,
+                               virBitmapPtr cpus,
+                               int ncpus)
+    ATTRIBUTE_NONNULL(1);
+
+int virHostTopologyGetDistances(virHostTopologyPtr topo,
+                                int node,
+                                int **distances,
+                                int *ndistances)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+int virHostTopologySetDistances(virHostTopologyPtr topo,
+                                int node,
+                                const int *distances,
+                                int ndistances)
+    ATTRIBUTE_NONNULL(1);
+
+int virHostTopologyGetPageSizes(virHostTopologyPtr topo,
+                                int node,
+                                unsigned int **sizes,
+                                size_t *nsizes)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
+int virHostTopologySetPageSizes(virHostTopologyPtr topo,
+                                int node,
+                                const unsigned int *sizes,
+                                size_t nsizes)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_HOST_TOPOLOGY_H__ */
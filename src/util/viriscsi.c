@@ -27,6 +27,8 @@
 
 #include "viriscsi.h"
 
+#include "c-ctype.h"
+#include "dirname.h"
 #include "viralloc.h"
 #include "vircommand.h"
 #include "virerror.h"
@@ -34,34 +36,74 @@
 #include "virlog.h"
 #include "virrandom.h"
 #include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
 VIR_LOG_INIT("util.iscsi");
 
 
-struct virISCSISessionData {
+#define SYSFS_ISCSI_SESSION_PATH "/sys/class/iscsi_session"
+#define SYSFS_SCSI_HOST_PATH "/sys/class/scsi_host"
+
+/* How long, in milliseconds, the output of 'iscsiadm --mode session' is
+ * reused before the command is run again. Starting or refreshing a set
+ * of pools looks up a session for each of them within that time. */
+#define VIR_ISCSI_SESSION_CACHE_TTL 2000
+
+struct virISCSISessionEntry {
     char *session;
-    const char *devpath;
+    char *target;
 };
 
+struct virISCSISessionTable {
+    size_t nentries;
+    struct virISCSISessionEntry *entries;
+};
+
+static virMutex virISCSISessionCacheLock = VIR_MUTEX_INITIALIZER;
+static struct virISCSISessionTable virISCSISessionCache;
+/* Time the cache was filled at, 0 if it has to be filled first */
+static unsigned long long virISCSISessionCacheStamp;
+
+
+static void
+virISCSISessionTableClear(struct virISCSISessionTable *table)
+{
+    size_t i;
+
+    for (i = 0; i < table->nentries; i++) {
+        VIR_FREE(table->entries[i].session);
+        VIR_FREE(table->entries[i].target);
+    }
+    VIR_FREE(table->entries);
+    table->nentries = 0;
+}
+
 
 static int
 virISCSIExtractSession(char **const groups,
                        void *opaque)
 {
-    struct virISCSISessionData *data = opaque;
+    struct virISCSISessionTable *table = opaque;
+    struct virISCSISessionEntry entry = { NULL, NULL };
+
+    if (VIR_STRDUP(entry.session, groups[0]) < 0 ||
+        VIR_STRDUP(entry.target, groups[1]) < 0 ||
+        VIR_APPEND_ELEMENT(table->entries, table->nentries, entry) < 0) {
+        VIR_FREE(entry.session);
+        VIR_FREE(entry.target);
+        return -1;
+    }
 
-    if (!data->session &&
-        STREQ(groups[1], data->devpath))
-        return VIR_STRDUP(data->session, groups[0]);
     return 0;
 }
 
 
-char *
-virISCSIGetSession(const char *devpath,
-                   bool probe)
+/* Must be called with virISCSISessionCacheLock held */
+static int
+virISCSISessionCacheFill(char **error)
 {
     /*
      * # iscsiadm --mode session
@@ -76,34 +118,94 @@ virISCSIGetSession(const char *devpath,
     int vars[] = {
         2,
     };
-    struct virISCSISessionData cbdata = {
-        .session = NULL,
-        .devpath = devpath,
-    };
-    char *error = NULL;
+    struct virISCSISessionTable table = { 0, NULL };
+    unsigned long long now;
     int exitstatus = 0;
+    int ret = -1;
+    virCommandPtr cmd = NULL;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (virISCSISessionCacheStamp &&
+        now - virISCSISessionCacheStamp < VIR_ISCSI_SESSION_CACHE_TTL)
+        return 0;
 
-    virCommandPtr cmd = virCommandNewArgList(ISCSIADM, "--mode",
-                                             "session", NULL);
-    virCommandSetErrorBuffer(cmd, &error);
+    cmd = virCommandNewArgList(ISCSIADM, "--mode", "session", NULL);
+    virCommandSetErrorBuffer(cmd, error);
 
     if (virCommandRunRegex(cmd,
                            1,
                            regexes,
                            vars,
                            virISCSIExtractSession,
-                           &cbdata, NULL, &exitstatus) < 0)
+                           &table, NULL, &exitstatus) < 0)
         goto cleanup;
 
-    if (cbdata.session == NULL && !probe)
+    virISCSISessionTableClear(&virISCSISessionCache);
+    virISCSISessionCache = table;
+    table.nentries = 0;
+    table.entries = NULL;
+    virISCSISessionCacheStamp = now;
+    ret = 0;
+
+ cleanup:
+    virISCSISessionTableClear(&table);
+    virCommandFree(cmd);
+    return ret;
+}
+
+
+/**
+ * virISCSISessionCacheFlush:
+ *
+ * Forget about the sessions found by the last 'iscsiadm --mode session'
+ * so that the next virISCSIGetSession() runs it again. This is done
+ * automatically after every login and logout, callers only need it if
+ * they changed the set of sessions by other means.
+ */
+void
+virISCSISessionCacheFlush(void)
+{
+    virMutexLock(&virISCSISessionCacheLock);
+    virISCSISessionTableClear(&virISCSISessionCache);
+    virISCSISessionCacheStamp = 0;
+    virMutexUnlock(&virISCSISessionCacheLock);
+}
+
+
+char *
+virISCSIGetSession(const char *devpath,
+                   bool probe)
+{
+    char *session = NULL;
+    char *error = NULL;
+    size_t i;
+
+    /* Holding the lock while iscsiadm runs makes concurrent callers
+     * wait for its output instead of running it once more each */
+    virMutexLock(&virISCSISessionCacheLock);
+
+    if (virISCSISessionCacheFill(&error) < 0)
+        goto cleanup;
+
+    for (i = 0; i < virISCSISessionCache.nentries; i++) {
+        if (STREQ(virISCSISessionCache.entries[i].target, devpath)) {
+            ignore_value(VIR_STRDUP(session,
+                                    virISCSISessionCache.entries[i].session));
+            goto cleanup;
+        }
+    }
+
+    if (!probe)
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("cannot find iscsiadm session: %s"),
                        NULLSTR(error));
 
  cleanup:
+    virMutexUnlock(&virISCSISessionCacheLock);
     VIR_FREE(error);
-    virCommandFree(cmd);
-    return cbdata.session;
+    return session;
 }
 
 
@@ -319,10 +421,10 @@ virISCSIConnection(const char *portal,
         virCommandAddArgList(cmd, "--interface", ifacename, NULL);
     }
 
-    if (virCommandRun(cmd, NULL) < 0)
-        goto cleanup;
+    ret = virCommandRun(cmd, NULL);
 
-    ret = 0;
+    /* Whether it succeeded or not, the set of sessions may have changed */
+    virISCSISessionCacheFlush();
 
  cleanup:
     virCommandFree(cmd);
@@ -352,15 +454,112 @@ virISCSIConnectionLogout(const char *portal,
 }
 
 
+/* Ask the kernel to rescan the LUNs behind the SCSI host of @session,
+ * which is what 'iscsiadm --mode session -R' does: existing devices
+ * are asked to reread their capacity, then the host scans for new ones.
+ *
+ * Returns 0 on success, 1 if the sysfs layout is not the expected one,
+ * -1 on error. */
+static int
+virISCSIRescanLUNsSysfs(const char *session)
+{
+    char *devpath = NULL;
+    char *sessionpath = NULL;
+    char *hostpath = NULL;
+    char *path = NULL;
+    const char *host;
+    DIR *targetdir = NULL;
+    DIR *lundir = NULL;
+    struct dirent *target;
+    struct dirent *lun;
+    int direrr;
+    int ret = -1;
+
+    if (virAsprintf(&devpath, SYSFS_ISCSI_SESSION_PATH "/session%s/device",
+                    session) < 0)
+        return -1;
+
+    /* .../hostN/sessionM */
+    if (!virFileExists(devpath) ||
+        virFileResolveLink(devpath, &sessionpath) < 0 ||
+        !(hostpath = mdir_name(sessionpath)) ||
+        !STRPREFIX((host = last_component(hostpath)), "host")) {
+        ret = 1;
+        goto cleanup;
+    }
+
+    if (virDirOpen(&targetdir, sessionpath) < 0)
+        goto cleanup;
+
+    while ((direrr = virDirRead(targetdir, &target, sessionpath)) > 0) {
+        if (!STRPREFIX(target->d_name, "target"))
+            continue;
+
+        VIR_FREE(path);
+        if (virAsprintf(&path, "%s/%s", sessionpath, target->d_name) < 0 ||
+            virDirOpen(&lundir, path) < 0)
+            goto cleanup;
+
+        while ((direrr = virDirRead(lundir, &lun, path)) > 0) {
+            char ebuf[1024];
+            char *rescan;
+
+            if (!c_isdigit(lun->d_name[0]))
+                continue;
+
+            if (virAsprintf(&rescan, "%s/%s/rescan", path, lun->d_name) < 0)
+                goto cleanup;
+
+            /* A LUN going away meanwhile is not a reason to fail */
+            if (virFileWriteStr(rescan, "1", 0) < 0)
+                VIR_DEBUG("Cannot rescan '%s': %s",
+                          rescan, virStrerror(errno, ebuf, sizeof(ebuf)));
+            VIR_FREE(rescan);
+        }
+        VIR_DIR_CLOSE(lundir);
+        if (direrr < 0)
+            goto cleanup;
+    }
+    if (direrr < 0)
+        goto cleanup;
+
+    VIR_FREE(path);
+    if (virAsprintf(&path, SYSFS_SCSI_HOST_PATH "/%s/scan", host) < 0)
+        goto cleanup;
+
+    if (virFileWriteStr(path, "- - -", 0) < 0) {
+        virReportSystemError(errno, _("Failed to scan SCSI host '%s'"), host);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_DIR_CLOSE(lundir);
+    VIR_DIR_CLOSE(targetdir);
+    VIR_FREE(path);
+    VIR_FREE(hostpath);
+    VIR_FREE(sessionpath);
+    VIR_FREE(devpath);
+    return ret;
+}
+
+
 int
 virISCSIRescanLUNs(const char *session)
 {
-    virCommandPtr cmd = virCommandNewArgList(ISCSIADM,
-                                             "--mode", "session",
-                                             "-r", session,
-                                             "-R",
-                                             NULL);
-    int ret = virCommandRun(cmd, NULL);
+    virCommandPtr cmd;
+    int ret;
+
+    if ((ret = virISCSIRescanLUNsSysfs(session)) <= 0)
+        return ret;
+
+    cmd = virCommandNewArgList(ISCSIADM,
+                               "--mode", "session",
+                               "-r", session,
+                               "-R",
+                               NULL);
+    ret = virCommandRun(cmd, NULL);
     virCommandFree(cmd);
     return ret;
 }
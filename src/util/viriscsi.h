@@ -29,6 +29,9 @@ virISCSIGetSession(const char *devpath,
                    bool probe)
     ATTRIBUTE_NONNULL(1);
 
+void
+virISCSISessionCacheFlush(void);
+
 int
 virISCSIConnectionLogin(const char *portal,
                         const char *initiatoriqn,
@@ -26,6 +26,7 @@
 #include "virjson.h"
 #include "viralloc.h"
 #include "virerror.h"
+#include "virhashcode.h"
 #include "virlog.h"
 #include "virstring.h"
 #include "virutil.h"
@@ -51,11 +52,16 @@
 
 VIR_LOG_INIT("util.json");
 
+/* Objects with at least this many members get a hash table index so
+ * that key lookups don't have to walk the whole pairs array */
+#define VIR_JSON_OBJECT_INDEX_MIN 16
+
 typedef struct _virJSONParserState virJSONParserState;
 typedef virJSONParserState *virJSONParserStatePtr;
 struct _virJSONParserState {
     virJSONValuePtr value;
     char *key;
+    const char *name; /* key of @value in its parent, NULL in arrays */
 };
 
 typedef struct _virJSONParser virJSONParser;
@@ -65,6 +71,12 @@ struct _virJSONParser {
     virJSONParserStatePtr state;
     size_t nstate;
     int wrap;
+
+    virJSONValueFilter filter;
+    void *opaque;
+    const char **path;
+    size_t npath;
+    size_t skip; /* nesting level + 1 inside a filtered out value */
 };
 
 
@@ -350,6 +362,7 @@ virJSONValueFree(virJSONValuePtr value)
 
     switch ((virJSONType) value->type) {
     case VIR_JSON_TYPE_OBJECT:
+        virHashFree(value->data.object.index);
         for (i = 0; i < value->data.object.npairs; i++) {
             VIR_FREE(value->data.object.pairs[i].key);
             virJSONValueFree(value->data.object.pairs[i].value);
@@ -567,6 +580,124 @@ virJSONValueNewObject(void)
 }
 
 
+static uint32_t
+virJSONObjectIndexCode(const void *name,
+                       uint32_t seed)
+{
+    return virHashCodeGen(name, strlen(name), seed);
+}
+
+
+static bool
+virJSONObjectIndexEqual(const void *namea,
+                        const void *nameb)
+{
+    return STREQ(namea, nameb);
+}
+
+
+/* The index borrows the keys from the pairs array */
+static void *
+virJSONObjectIndexCopy(const void *name)
+{
+    return (void *) name;
+}
+
+
+static int
+virJSONObjectIndexBuild(virJSONObjectPtr object)
+{
+    size_t i;
+
+    if (!(object->index = virHashCreateFullFlags(object->npairs * 2, NULL,
+                                                 virJSONObjectIndexCode,
+                                                 virJSONObjectIndexEqual,
+                                                 virJSONObjectIndexCopy,
+                                                 NULL,
+                                                 VIR_HASH_OPEN_ADDRESSING)))
+        return -1;
+
+    for (i = 0; i < object->npairs; i++) {
+        if (virHashAddEntry(object->index, object->pairs[i].key,
+                            object->pairs[i].value) < 0) {
+            virHashFree(object->index);
+            object->index = NULL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static ssize_t
+virJSONObjectFind(virJSONObjectPtr object,
+                  const char *key)
+{
+    size_t i;
+
+    if (object->index && !virHashLookup(object->index, key))
+        return -1;
+
+    for (i = 0; i < object->npairs; i++) {
+        if (STREQ(object->pairs[i].key, key))
+            return i;
+    }
+
+    return -1;
+}
+
+
+/* Drop the pair at @idx, returning its value and freeing its key */
+static virJSONValuePtr
+virJSONObjectDelete(virJSONObjectPtr object,
+                    size_t idx)
+{
+    virJSONValuePtr value;
+
+    if (object->index)
+        ignore_value(virHashSteal(object->index, object->pairs[idx].key));
+
+    VIR_STEAL_PTR(value, object->pairs[idx].value);
+    VIR_FREE(object->pairs[idx].key);
+    VIR_DELETE_ELEMENT(object->pairs, idx, object->npairs);
+
+    return value;
+}
+
+
+/* Same as virJSONValueObjectAppend, but @key is consumed on success */
+static int
+virJSONValueObjectAppendKey(virJSONValuePtr object,
+                            char **key,
+                            virJSONValuePtr value)
+{
+    virJSONObjectPtr obj = &object->data.object;
+
+    if (object->type != VIR_JSON_TYPE_OBJECT)
+        return -1;
+
+    if (virJSONValueObjectHasKey(object, *key))
+        return -1;
+
+    if (VIR_REALLOC_N(obj->pairs, obj->npairs + 1) < 0)
+        return -1;
+
+    if (!obj->index && obj->npairs + 1 >= VIR_JSON_OBJECT_INDEX_MIN &&
+        virJSONObjectIndexBuild(obj) < 0)
+        return -1;
+
+    if (obj->index && virHashAddEntry(obj->index, *key, value) < 0)
+        return -1;
+
+    VIR_STEAL_PTR(obj->pairs[obj->npairs].key, *key);
+    obj->pairs[obj->npairs].value = value;
+    obj->npairs++;
+
+    return 0;
+}
+
+
 int
 virJSONValueObjectAppend(virJSONValuePtr object,
                          const char *key,
@@ -577,22 +708,14 @@ virJSONValueObjectAppend(virJSONValuePtr object,
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return -1;
 
-    if (virJSONValueObjectHasKey(object, key))
-        return -1;
-
     if (VIR_STRDUP(newkey, key) < 0)
         return -1;
 
-    if (VIR_REALLOC_N(object->data.object.pairs,
-                      object->data.object.npairs + 1) < 0) {
+    if (virJSONValueObjectAppendKey(object, &newkey, value) < 0) {
         VIR_FREE(newkey);
         return -1;
     }
 
-    object->data.object.pairs[object->data.object.npairs].key = newkey;
-    object->data.object.pairs[object->data.object.npairs].value = value;
-    object->data.object.npairs++;
-
     return 0;
 }
 
@@ -746,17 +869,10 @@ int
 virJSONValueObjectHasKey(virJSONValuePtr object,
                          const char *key)
 {
-    size_t i;
-
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return -1;
 
-    for (i = 0; i < object->data.object.npairs; i++) {
-        if (STREQ(object->data.object.pairs[i].key, key))
-            return 1;
-    }
-
-    return 0;
+    return !!virJSONValueObjectGet(object, key);
 }
 
 
@@ -769,6 +885,9 @@ virJSONValueObjectGet(virJSONValuePtr object,
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return NULL;
 
+    if (object->data.object.index)
+        return virHashLookup(object->data.object.index, key);
+
     for (i = 0; i < object->data.object.npairs; i++) {
         if (STREQ(object->data.object.pairs[i].key, key))
             return object->data.object.pairs[i].value;
@@ -782,23 +901,15 @@ static virJSONValuePtr
 virJSONValueObjectSteal(virJSONValuePtr object,
                         const char *key)
 {
-    size_t i;
-    virJSONValuePtr obj = NULL;
+    ssize_t idx;
 
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return NULL;
 
-    for (i = 0; i < object->data.object.npairs; i++) {
-        if (STREQ(object->data.object.pairs[i].key, key)) {
-            VIR_STEAL_PTR(obj, object->data.object.pairs[i].value);
-            VIR_FREE(object->data.object.pairs[i].key);
-            VIR_DELETE_ELEMENT(object->data.object.pairs, i,
-                               object->data.object.npairs);
-            break;
-        }
-    }
+    if ((idx = virJSONObjectFind(&object->data.object, key)) < 0)
+        return NULL;
 
-    return obj;
+    return virJSONObjectDelete(&object->data.object, idx);
 }
 
 
@@ -864,7 +975,8 @@ virJSONValueObjectRemoveKey(virJSONValuePtr object,
                             const char *key,
                             virJSONValuePtr *value)
 {
-    size_t i;
+    ssize_t idx;
+    virJSONValuePtr tmp;
 
     if (value)
         *value = NULL;
@@ -872,21 +984,16 @@ virJSONValueObjectRemoveKey(virJSONValuePtr object,
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return -1;
 
-    for (i = 0; i < object->data.object.npairs; i++) {
-        if (STREQ(object->data.object.pairs[i].key, key)) {
-            if (value) {
-                *value = object->data.object.pairs[i].value;
-                object->data.object.pairs[i].value = NULL;
-            }
-            VIR_FREE(object->data.object.pairs[i].key);
-            virJSONValueFree(object->data.object.pairs[i].value);
-            VIR_DELETE_ELEMENT(object->data.object.pairs, i,
-                               object->data.object.npairs);
-            return 1;
-        }
-    }
+    if ((idx = virJSONObjectFind(&object->data.object, key)) < 0)
+        return 0;
 
-    return 0;
+    tmp = virJSONObjectDelete(&object->data.object, idx);
+    if (value)
+        *value = tmp;
+    else
+        virJSONValueFree(tmp);
+
+    return 1;
 }
 
 
@@ -1413,6 +1520,71 @@ virJSONValueCopy(const virJSONValue *in)
 
 
 #if WITH_YAJL
+/* Account for a value reported by yajl while a filtered out member is
+ * being parsed. @nesting is 1 when a map or array starts, -1 when it
+ * ends and 0 for anything else. Returns true if the value has to be
+ * ignored.  */
+static bool
+virJSONParserSkip(virJSONParserPtr parser,
+                  int nesting)
+{
+    if (!parser->skip)
+        return false;
+
+    parser->skip += nesting;
+    if (parser->skip == 1 && nesting <= 0)
+        parser->skip = 0;
+
+    return true;
+}
+
+
+/* Ask the filter whether the member @key of the innermost object should
+ * be parsed. Returns 1 if it should, 0 if not and -1 on error.  */
+static int
+virJSONParserFilterKey(virJSONParserPtr parser,
+                       const char *key)
+{
+    size_t npath = 0;
+    size_t i;
+
+    if (VIR_RESIZE_N(parser->path, parser->npath, 0, parser->nstate) < 0)
+        return -1;
+
+    for (i = parser->wrap + 1; i < parser->nstate; i++)
+        parser->path[npath++] = parser->state[i].name;
+    parser->path[npath++] = key;
+
+    return parser->filter(parser->path, npath, parser->opaque) ? 1 : 0;
+}
+
+
+/* Make @value, which was just inserted, the innermost container */
+static int
+virJSONParserPushState(virJSONParserPtr parser,
+                       virJSONValuePtr value)
+{
+    virJSONValuePtr parent = NULL;
+    const char *name = NULL;
+
+    if (parser->nstate)
+        parent = parser->state[parser->nstate - 1].value;
+    if (parent && parent->type == VIR_JSON_TYPE_OBJECT)
+        name = parent->data.object.pairs[parent->data.object.npairs - 1].key;
+
+    if (VIR_REALLOC_N(parser->state,
+                      parser->nstate + 1) < 0)
+        return -1;
+
+    parser->state[parser->nstate].value = value;
+    parser->state[parser->nstate].key = NULL;
+    parser->state[parser->nstate].name = name;
+    parser->nstate++;
+
+    return 0;
+}
+
+
 static int
 virJSONParserInsertValue(virJSONParserPtr parser,
                          virJSONValuePtr value)
@@ -1435,12 +1607,10 @@ virJSONParserInsertValue(virJSONParserPtr parser,
                 return -1;
             }
 
-            if (virJSONValueObjectAppend(state->value,
-                                         state->key,
-                                         value) < 0)
+            if (virJSONValueObjectAppendKey(state->value,
+                                            &state->key,
+                                            value) < 0)
                 return -1;
-
-            VIR_FREE(state->key);
         }   break;
 
         case VIR_JSON_TYPE_ARRAY: {
@@ -1468,7 +1638,12 @@ static int
 virJSONParserHandleNull(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewNull();
+    virJSONValuePtr value;
+
+    if (virJSONParserSkip(parser, 0))
+        return 1;
+
+    value = virJSONValueNewNull();
 
     VIR_DEBUG("parser=%p", parser);
 
@@ -1489,7 +1664,12 @@ virJSONParserHandleBoolean(void *ctx,
                            int boolean_)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewBoolean(boolean_);
+    virJSONValuePtr value;
+
+    if (virJSONParserSkip(parser, 0))
+        return 1;
+
+    value = virJSONValueNewBoolean(boolean_);
 
     VIR_DEBUG("parser=%p boolean=%d", parser, boolean_);
 
@@ -1514,6 +1694,9 @@ virJSONParserHandleNumber(void *ctx,
     char *str;
     virJSONValuePtr value;
 
+    if (virJSONParserSkip(parser, 0))
+        return 1;
+
     if (VIR_STRNDUP(str, s, l) < 0)
         return -1;
     value = virJSONValueNewNumber(str);
@@ -1539,8 +1722,12 @@ virJSONParserHandleString(void *ctx,
                           yajl_size_t stringLen)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewStringLen((const char *)stringVal,
-                                                     stringLen);
+    virJSONValuePtr value;
+
+    if (virJSONParserSkip(parser, 0))
+        return 1;
+
+    value = virJSONValueNewStringLen((const char *)stringVal, stringLen);
 
     VIR_DEBUG("parser=%p str=%p", parser, (const char *)stringVal);
 
@@ -1563,9 +1750,13 @@ virJSONParserHandleMapKey(void *ctx,
 {
     virJSONParserPtr parser = ctx;
     virJSONParserStatePtr state;
+    int rc;
 
     VIR_DEBUG("parser=%p key=%p", parser, (const char *)stringVal);
 
+    if (virJSONParserSkip(parser, 0))
+        return 1;
+
     if (!parser->nstate)
         return 0;
 
@@ -1574,6 +1765,16 @@ virJSONParserHandleMapKey(void *ctx,
         return 0;
     if (VIR_STRNDUP(state->key, (const char *)stringVal, stringLen) < 0)
         return 0;
+
+    if (parser->filter) {
+        if ((rc = virJSONParserFilterKey(parser, state->key)) < 0)
+            return 0;
+        if (rc == 0) {
+            VIR_FREE(state->key);
+            parser->skip = 1;
+        }
+    }
+
     return 1;
 }
 
@@ -1582,11 +1783,14 @@ static int
 virJSONParserHandleStartMap(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewObject();
+    virJSONValuePtr value;
 
     VIR_DEBUG("parser=%p", parser);
 
-    if (!value)
+    if (virJSONParserSkip(parser, 1))
+        return 1;
+
+    if (!(value = virJSONValueNewObject()))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -1594,14 +1798,8 @@ virJSONParserHandleStartMap(void *ctx)
         return 0;
     }
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate + 1) < 0) {
+    if (virJSONParserPushState(parser, value) < 0)
         return 0;
-    }
-
-    parser->state[parser->nstate].value = value;
-    parser->state[parser->nstate].key = NULL;
-    parser->nstate++;
 
     return 1;
 }
@@ -1615,6 +1813,9 @@ virJSONParserHandleEndMap(void *ctx)
 
     VIR_DEBUG("parser=%p", parser);
 
+    if (virJSONParserSkip(parser, -1))
+        return 1;
+
     if (!parser->nstate)
         return 0;
 
@@ -1634,11 +1835,14 @@ static int
 virJSONParserHandleStartArray(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewArray();
+    virJSONValuePtr value;
 
     VIR_DEBUG("parser=%p", parser);
 
-    if (!value)
+    if (virJSONParserSkip(parser, 1))
+        return 1;
+
+    if (!(value = virJSONValueNewArray()))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -1646,14 +1850,9 @@ virJSONParserHandleStartArray(void *ctx)
         return 0;
     }
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate + 1) < 0)
+    if (virJSONParserPushState(parser, value) < 0)
         return 0;
 
-    parser->state[parser->nstate].value = value;
-    parser->state[parser->nstate].key = NULL;
-    parser->nstate++;
-
     return 1;
 }
 
@@ -1666,6 +1865,9 @@ virJSONParserHandleEndArray(void *ctx)
 
     VIR_DEBUG("parser=%p", parser);
 
+    if (virJSONParserSkip(parser, -1))
+        return 1;
+
     if (!(parser->nstate - parser->wrap))
         return 0;
 
@@ -1696,12 +1898,26 @@ static const yajl_callbacks parserCallbacks = {
 };
 
 
-/* XXX add an incremental streaming parser - yajl trivially supports it */
+/**
+ * virJSONValueFromStringFiltered:
+ * @jsonstring: JSON document to parse
+ * @filter: callback selecting the object members to parse (may be NULL)
+ * @opaque: opaque data for @filter
+ *
+ * Parse @jsonstring into a virJSONValue tree. The values of members
+ * rejected by @filter are validated by the parser but no memory is
+ * allocated for them, which keeps large QMP replies cheap when the
+ * caller is interested in a few fields only.
+ *
+ * Returns the parsed value or NULL on error.
+ */
 virJSONValuePtr
-virJSONValueFromString(const char *jsonstring)
+virJSONValueFromStringFiltered(const char *jsonstring,
+                               virJSONValueFilter filter,
+                               void *opaque)
 {
     yajl_handle hand;
-    virJSONParser parser = { NULL, NULL, 0, 0 };
+    virJSONParser parser = { .filter = filter, .opaque = opaque };
     virJSONValuePtr ret = NULL;
     int rc;
     size_t len = strlen(jsonstring);
@@ -1784,6 +2000,7 @@ virJSONValueFromString(const char *jsonstring)
             VIR_FREE(parser.state[i].key);
         VIR_FREE(parser.state);
     }
+    VIR_FREE(parser.path);
 
     VIR_DEBUG("result=%p", ret);
 
@@ -1791,6 +2008,13 @@ virJSONValueFromString(const char *jsonstring)
 }
 
 
+virJSONValuePtr
+virJSONValueFromString(const char *jsonstring)
+{
+    return virJSONValueFromStringFiltered(jsonstring, NULL, NULL);
+}
+
+
 static int
 virJSONValueToStringOne(virJSONValuePtr object,
                         yajl_gen g)
@@ -1909,7 +2133,9 @@ virJSONValueToString(virJSONValuePtr object,
 
 #else
 virJSONValuePtr
-virJSONValueFromString(const char *jsonstring ATTRIBUTE_UNUSED)
+virJSONValueFromStringFiltered(const char *jsonstring ATTRIBUTE_UNUSED,
+                               virJSONValueFilter filter ATTRIBUTE_UNUSED,
+                               void *opaque ATTRIBUTE_UNUSED)
 {
     virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                    _("No JSON parser implementation is available"));
@@ -1928,6 +2154,355 @@ virJSONValueToString(virJSONValuePtr object ATTRIBUTE_UNUSED,
 #endif
 
 
+/**
+ * virJSONWriterInit:
+ * @writer: the writer
+ * @buf: buffer to append the document to
+ *
+ * Prepares @writer for writing a single JSON document at the end of
+ * @buf. The writer doesn't need to be freed, @buf remains owned by the
+ * caller.
+ */
+void
+virJSONWriterInit(virJSONWriterPtr writer,
+                  virBufferPtr buf)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->buf = buf;
+}
+
+
+/**
+ * virJSONWriterFinish:
+ * @writer: the writer
+ *
+ * Checks the document written by @writer is complete and valid.
+ *
+ * Returns 0 on success, -1 with an error reported otherwise.
+ */
+int
+virJSONWriterFinish(virJSONWriterPtr writer)
+{
+    if (virBufferCheckError(writer->buf) < 0)
+        return -1;
+
+    if (writer->invalid || writer->depth != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to format invalid JSON document"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Length of the UTF-8 sequence starting at @str, with the same leniency
+ * as the validation of yajl, or 0 if it's invalid */
+static size_t
+virJSONWriterUTF8Length(const unsigned char *str)
+{
+    size_t len;
+    size_t i;
+
+    if (*str < 0x80)
+        return 1;
+    else if ((*str & 0xE0) == 0xC0)
+        len = 2;
+    else if ((*str & 0xF0) == 0xE0)
+        len = 3;
+    else if ((*str & 0xF8) == 0xF0)
+        len = 4;
+    else
+        return 0;
+
+    for (i = 1; i < len; i++) {
+        if ((str[i] & 0xC0) != 0x80)
+            return 0;
+    }
+
+    return len;
+}
+
+
+/* Escaping is done in-line: runs of characters which need none are
+ * copied into the buffer at once */
+static void
+virJSONWriterQuote(virJSONWriterPtr writer,
+                   const char *str)
+{
+    const unsigned char *cur = (const unsigned char *) str;
+    const unsigned char *start = cur;
+
+    virBufferAddChar(writer->buf, '"');
+
+    while (*cur) {
+        const char *escape = NULL;
+        char hex[7];
+        size_t len;
+
+        switch (*cur) {
+        case '"':
+            escape = "\\\"";
+            break;
+        case '\\':
+            escape = "\\\\";
+            break;
+        case '\b':
+            escape = "\\b";
+            break;
+        case '\f':
+            escape = "\\f";
+            break;
+        case '\n':
+            escape = "\\n";
+            break;
+        case '\r':
+            escape = "\\r";
+            break;
+        case '\t':
+            escape = "\\t";
+            break;
+        default:
+            if (*cur < 0x20) {
+                snprintf(hex, sizeof(hex), "\\u%04X", *cur);
+                escape = hex;
+            }
+            break;
+        }
+
+        if (escape) {
+            virBufferAdd(writer->buf, (const char *) start, cur - start);
+            virBufferAdd(writer->buf, escape, -1);
+            start = ++cur;
+            continue;
+        }
+
+        if ((len = virJSONWriterUTF8Length(cur)) == 0) {
+            writer->invalid = true;
+            break;
+        }
+        cur += len;
+    }
+
+    virBufferAdd(writer->buf, (const char *) start, cur - start);
+    virBufferAddChar(writer->buf, '"');
+}
+
+
+static void
+virJSONWriterSeparate(virJSONWriterPtr writer)
+{
+    if (writer->comma)
+        virBufferAddChar(writer->buf, ',');
+    writer->comma = true;
+}
+
+
+void
+virJSONWriterObjectStart(virJSONWriterPtr writer)
+{
+    virJSONWriterSeparate(writer);
+    virBufferAddChar(writer->buf, '{');
+    writer->depth++;
+    writer->comma = false;
+}
+
+
+void
+virJSONWriterObjectEnd(virJSONWriterPtr writer)
+{
+    if (writer->depth == 0)
+        writer->invalid = true;
+    else
+        writer->depth--;
+    virBufferAddChar(writer->buf, '}');
+    writer->comma = true;
+}
+
+
+void
+virJSONWriterArrayStart(virJSONWriterPtr writer)
+{
+    virJSONWriterSeparate(writer);
+    virBufferAddChar(writer->buf, '[');
+    writer->depth++;
+    writer->comma = false;
+}
+
+
+void
+virJSONWriterArrayEnd(virJSONWriterPtr writer)
+{
+    if (writer->depth == 0)
+        writer->invalid = true;
+    else
+        writer->depth--;
+    virBufferAddChar(writer->buf, ']');
+    writer->comma = true;
+}
+
+
+void
+virJSONWriterKey(virJSONWriterPtr writer,
+                 const char *key)
+{
+    virJSONWriterSeparate(writer);
+    virJSONWriterQuote(writer, key);
+    virBufferAddChar(writer->buf, ':');
+    writer->comma = false;
+}
+
+
+void
+virJSONWriterString(virJSONWriterPtr writer,
+                    const char *value)
+{
+    virJSONWriterSeparate(writer);
+    virJSONWriterQuote(writer, value);
+}
+
+
+void
+virJSONWriterNumberLong(virJSONWriterPtr writer,
+                        long long value)
+{
+    virJSONWriterSeparate(writer);
+    virBufferAsprintf(writer->buf, "%lld", value);
+}
+
+
+void
+virJSONWriterNumberUlong(virJSONWriterPtr writer,
+                         unsigned long long value)
+{
+    virJSONWriterSeparate(writer);
+    virBufferAsprintf(writer->buf, "%llu", value);
+}
+
+
+void
+virJSONWriterBoolean(virJSONWriterPtr writer,
+                     bool value)
+{
+    virJSONWriterSeparate(writer);
+    if (value)
+        virBufferAddLit(writer->buf, "true");
+    else
+        virBufferAddLit(writer->buf, "false");
+}
+
+
+void
+virJSONWriterNull(virJSONWriterPtr writer)
+{
+    virJSONWriterSeparate(writer);
+    virBufferAddLit(writer->buf, "null");
+}
+
+
+/**
+ * virJSONWriterValue:
+ * @writer: the writer
+ * @value: the value to write
+ *
+ * Writes the whole tree of @value, which remains owned by the caller.
+ */
+void
+virJSONWriterValue(virJSONWriterPtr writer,
+                   virJSONValuePtr value)
+{
+    size_t i;
+
+    switch (value->type) {
+    case VIR_JSON_TYPE_OBJECT:
+        virJSONWriterObjectStart(writer);
+        for (i = 0; i < value->data.object.npairs; i++) {
+            virJSONWriterKey(writer, value->data.object.pairs[i].key);
+            virJSONWriterValue(writer, value->data.object.pairs[i].value);
+        }
+        virJSONWriterObjectEnd(writer);
+        break;
+
+    case VIR_JSON_TYPE_ARRAY:
+        virJSONWriterArrayStart(writer);
+        for (i = 0; i < value->data.array.nvalues; i++)
+            virJSONWriterValue(writer, value->data.array.values[i]);
+        virJSONWriterArrayEnd(writer);
+        break;
+
+    case VIR_JSON_TYPE_STRING:
+        virJSONWriterString(writer, value->data.string);
+        break;
+
+    case VIR_JSON_TYPE_NUMBER:
+        virJSONWriterSeparate(writer);
+        virBufferAdd(writer->buf, value->data.number, -1);
+        break;
+
+    case VIR_JSON_TYPE_BOOLEAN:
+        virJSONWriterBoolean(writer, value->data.boolean);
+        break;
+
+    case VIR_JSON_TYPE_NULL:
+        virJSONWriterNull(writer);
+        break;
+
+    default:
+        writer->invalid = true;
+    }
+}
+
+
+void
+virJSONWriterObjectAppendString(virJSONWriterPtr writer,
+                                const char *key,
+                                const char *value)
+{
+    virJSONWriterKey(writer, key);
+    virJSONWriterString(writer, value);
+}
+
+
+void
+virJSONWriterObjectAppendNumberLong(virJSONWriterPtr writer,
+                                    const char *key,
+                                    long long value)
+{
+    virJSONWriterKey(writer, key);
+    virJSONWriterNumberLong(writer, value);
+}
+
+
+void
+virJSONWriterObjectAppendNumberUlong(virJSONWriterPtr writer,
+                                     const char *key,
+                                     unsigned long long value)
+{
+    virJSONWriterKey(writer, key);
+    virJSONWriterNumberUlong(writer, value);
+}
+
+
+void
+virJSONWriterObjectAppendBoolean(virJSONWriterPtr writer,
+                                 const char *key,
+                                 bool value)
+{
+    virJSONWriterKey(writer, key);
+    virJSONWriterBoolean(writer, value);
+}
+
+
+void
+virJSONWriterObjectAppend(virJSONWriterPtr writer,
+                          const char *key,
+                          virJSONValuePtr value)
+{
+    virJSONWriterKey(writer, key);
+    virJSONWriterValue(writer, value);
+}
+
+
 /**
  * virJSONStringReformat:
  * @jsonstr: string to reformat
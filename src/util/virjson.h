@@ -26,6 +26,8 @@
 
 # include "internal.h"
 # include "virbitmap.h"
+# include "virbuffer.h"
+# include "virhash.h"
 
 # include <stdarg.h>
 
@@ -60,6 +62,7 @@ struct _virJSONObjectPair {
 struct _virJSONObject {
     size_t npairs;
     virJSONObjectPairPtr pairs;
+    virHashTablePtr index; /* key -> value, built once the object grows large */
 };
 
 struct _virJSONArray {
@@ -169,6 +172,28 @@ int virJSONValueObjectRemoveKey(virJSONValuePtr object, const char *key,
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
 virJSONValuePtr virJSONValueFromString(const char *jsonstring);
+
+/**
+ * virJSONValueFilter:
+ * @path: keys leading to the member being parsed, outermost first
+ * @npath: number of elements in @path
+ * @opaque: opaque data passed to virJSONValueFromStringFiltered
+ *
+ * Called for every object member before its value is parsed. Array
+ * elements are represented by a NULL entry in @path, so the members of
+ * the objects in the "return" array of a QMP reply have paths like
+ * { "return", NULL, "inserted" }.
+ *
+ * Returns true if the member should be kept, false if its value should
+ * be skipped without building any tree for it.
+ */
+typedef bool (*virJSONValueFilter)(const char *const *path,
+                                   size_t npath,
+                                   void *opaque);
+
+virJSONValuePtr virJSONValueFromStringFiltered(const char *jsonstring,
+                                               virJSONValueFilter filter,
+                                               void *opaque);
 char *virJSONValueToString(virJSONValuePtr object,
                            bool pretty);
 
@@ -182,6 +207,63 @@ int virJSONValueObjectForeachKeyValue(virJSONValuePtr object,
 
 virJSONValuePtr virJSONValueCopy(const virJSONValue *in);
 
+/* Writes a JSON document straight into a virBuffer without building a
+ * tree of virJSONValue first. Documents are formatted without any
+ * whitespace, like virJSONValueToString does when not pretty printing.
+ * Errors, e.g. invalid UTF-8 strings, are only reported by
+ * virJSONWriterFinish. */
+typedef struct _virJSONWriter virJSONWriter;
+typedef virJSONWriter *virJSONWriterPtr;
+struct _virJSONWriter {
+    virBufferPtr buf;
+    size_t depth;   /* number of open objects and arrays */
+    bool comma;     /* the next member or element needs a separator */
+    bool invalid;
+};
+
+void virJSONWriterInit(virJSONWriterPtr writer,
+                       virBufferPtr buf)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int virJSONWriterFinish(virJSONWriterPtr writer)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
+void virJSONWriterObjectStart(virJSONWriterPtr writer);
+void virJSONWriterObjectEnd(virJSONWriterPtr writer);
+void virJSONWriterArrayStart(virJSONWriterPtr writer);
+void virJSONWriterArrayEnd(virJSONWriterPtr writer);
+
+/* To be followed by the value of the member in an object */
+void virJSONWriterKey(virJSONWriterPtr writer,
+                      const char *key);
+
+void virJSONWriterString(virJSONWriterPtr writer,
+                         const char *value);
+void virJSONWriterNumberLong(virJSONWriterPtr writer,
+                             long long value);
+void virJSONWriterNumberUlong(virJSONWriterPtr writer,
+                              unsigned long long value);
+void virJSONWriterBoolean(virJSONWriterPtr writer,
+                          bool value);
+void virJSONWriterNull(virJSONWriterPtr writer);
+void virJSONWriterValue(virJSONWriterPtr writer,
+                        virJSONValuePtr value);
+
+void virJSONWriterObjectAppendString(virJSONWriterPtr writer,
+                                     const char *key,
+                                     const char *value);
+void virJSONWriterObjectAppendNumberLong(virJSONWriterPtr writer,
+                                         const char *key,
+                                         long long value);
+void virJSONWriterObjectAppendNumberUlong(virJSONWriterPtr writer,
+                                          const char *key,
+                                          unsigned long long value);
+void virJSONWriterObjectAppendBoolean(virJSONWriterPtr writer,
+                                      const char *key,
+                                      bool value);
+void virJSONWriterObjectAppend(virJSONWriterPtr writer,
+                               const char *key,
+                               virJSONValuePtr value);
+
 char *virJSONStringReformat(const char *jsonstr, bool pretty);
 
 #endif /* __VIR_JSON_H_ */
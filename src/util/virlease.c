@@ -25,8 +25,12 @@
 #include "virlease.h"
 
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "virfile.h"
+#include "virsocketaddr.h"
 #include "virstring.h"
 #include "virerror.h"
 #include "viralloc.h"
@@ -49,6 +53,271 @@
 #define EMPTY_STR(s) ((s) ? (s) : "*")
 
 
+/*
+ * Every DHCP event used to make leaseshelper read, filter and rewrite
+ * the whole lease file. Events are now appended to a journal next to
+ * it instead, one JSON object per line:
+ *
+ *   {"action":"add","lease":{...}}
+ *   {"action":"del","ip-address":"..."}
+ *
+ * Either replaces all leases of the same IP address. The journal is
+ * folded into the lease file, and removed, once it grows past
+ * VIR_LEASE_JOURNAL_COMPACT_SIZE or when dnsmasq restarts.
+ *
+ * The lease file is replaced before the journal is removed, so readers
+ * must read the journal first: at worst they then apply a few events
+ * twice, which is harmless.
+ */
+
+static void
+virLeaseRemoveIP(virJSONValuePtr leases_array,
+                 const char *ip)
+{
+    size_t i = 0;
+
+    while (i < virJSONValueArraySize(leases_array)) {
+        virJSONValuePtr lease = virJSONValueArrayGet(leases_array, i);
+
+        if (lease &&
+            STREQ_NULLABLE(virJSONValueObjectGetString(lease, "ip-address"),
+                           ip)) {
+            virJSONValueFree(virJSONValueArraySteal(leases_array, i));
+            continue;
+        }
+        i++;
+    }
+}
+
+
+/**
+ * virLeaseJournalRead:
+ * @custom_lease_file: lease file the journal belongs to
+ * @entries: filled with the contents of the journal, or NULL if empty
+ *
+ * Returns 0 on success (including a missing journal), -1 otherwise.
+ */
+int
+virLeaseJournalRead(const char *custom_lease_file,
+                    char **entries)
+{
+    char *path = NULL;
+    int len;
+    int ret = -1;
+
+    *entries = NULL;
+
+    if (virAsprintf(&path, "%s" VIR_LEASE_JOURNAL_SUFFIX,
+                    custom_lease_file) < 0)
+        return -1;
+
+    if ((len = virFileReadAllQuiet(path, VIR_NETWORK_DHCP_LEASE_FILE_SIZE_MAX,
+                                   entries)) < 0) {
+        if (len == -ENOENT)
+            ret = 0;
+        else
+            virReportSystemError(-len, _("unable to read '%s'"), path);
+        goto cleanup;
+    }
+
+    if (len == 0)
+        VIR_FREE(*entries);
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(path);
+    return ret;
+}
+
+
+/**
+ * virLeaseJournalReplay:
+ * @leases_array: leases to update
+ * @entries: contents of the journal
+ *
+ * Apply the events of @entries to @leases_array. A last line without
+ * newline is still being written and is ignored, just like lines which
+ * can't be parsed, for example left behind by a helper which crashed.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+virLeaseJournalReplay(virJSONValuePtr leases_array,
+                      const char *entries)
+{
+    const char *line = entries;
+    const char *eol;
+    char *str = NULL;
+    virJSONValuePtr entry = NULL;
+    virJSONValuePtr lease = NULL;
+    int ret = -1;
+
+    while (line && (eol = strchr(line, '\n'))) {
+        const char *action;
+        const char *ip;
+
+        if (VIR_STRNDUP(str, line, eol - line) < 0)
+            goto cleanup;
+        line = eol + 1;
+
+        if (!*str || !(entry = virJSONValueFromString(str))) {
+            virResetLastError();
+            goto next;
+        }
+
+        if (!(action = virJSONValueObjectGetString(entry, "action")))
+            goto next;
+
+        if (STREQ(action, "add")) {
+            if (virJSONValueObjectRemoveKey(entry, "lease", &lease) <= 0 ||
+                !(ip = virJSONValueObjectGetString(lease, "ip-address")))
+                goto next;
+
+            virLeaseRemoveIP(leases_array, ip);
+            if (virJSONValueArrayAppend(leases_array, lease) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("failed to create json"));
+                goto cleanup;
+            }
+            lease = NULL;
+        } else if (STREQ(action, "del")) {
+            if ((ip = virJSONValueObjectGetString(entry, "ip-address")))
+                virLeaseRemoveIP(leases_array, ip);
+        }
+
+ next:
+        virJSONValueFree(lease);
+        lease = NULL;
+        virJSONValueFree(entry);
+        entry = NULL;
+        VIR_FREE(str);
+    }
+
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(lease);
+    virJSONValueFree(entry);
+    VIR_FREE(str);
+    return ret;
+}
+
+
+/**
+ * virLeaseJournalAppend:
+ * @custom_lease_file: lease file the journal belongs to
+ * @lease: lease to add, or NULL
+ * @ip: IP address whose leases to delete if @lease is NULL
+ *
+ * Record the addition of @lease, or the deletion of the leases of @ip,
+ * at the end of the journal. The caller must make sure nobody else is
+ * writing the journal or the lease file at the same time.
+ *
+ * Returns the size of the journal before the append, or -1 on error.
+ */
+off_t
+virLeaseJournalAppend(const char *custom_lease_file,
+                      virJSONValuePtr lease,
+                      const char *ip)
+{
+    char *path = NULL;
+    virJSONValuePtr entry = NULL;
+    virJSONValuePtr copy = NULL;
+    char *str = NULL;
+    char *line = NULL;
+    struct stat sb;
+    char last = '\n';
+    int fd = -1;
+    off_t ret = -1;
+
+    if (virAsprintf(&path, "%s" VIR_LEASE_JOURNAL_SUFFIX,
+                    custom_lease_file) < 0)
+        return -1;
+
+    if (!(entry = virJSONValueNewObject()))
+        goto cleanup;
+
+    if (lease) {
+        if (!(copy = virJSONValueCopy(lease)) ||
+            virJSONValueObjectAppendString(entry, "action", "add") < 0 ||
+            virJSONValueObjectAppend(entry, "lease", copy) < 0)
+            goto cleanup;
+        copy = NULL;
+    } else {
+        if (virJSONValueObjectAppendString(entry, "action", "del") < 0 ||
+            virJSONValueObjectAppendString(entry, "ip-address", ip) < 0)
+            goto cleanup;
+    }
+
+    if (!(str = virJSONValueToString(entry, false)))
+        goto cleanup;
+
+    if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0 ||
+        fstat(fd, &sb) < 0) {
+        virReportSystemError(errno, _("unable to open '%s'"), path);
+        goto cleanup;
+    }
+
+    /* Terminate whatever a crashed helper left behind, so that it
+     * doesn't swallow our entry */
+    if (sb.st_size > 0 &&
+        pread(fd, &last, 1, sb.st_size - 1) != 1)
+        last = '\n';
+
+    if (virAsprintf(&line, "%s%s\n", last == '\n' ? "" : "\n", str) < 0)
+        goto cleanup;
+
+    if (safewrite(fd, line, strlen(line)) < 0 ||
+        VIR_CLOSE(fd) < 0) {
+        virReportSystemError(errno, _("unable to write '%s'"), path);
+        goto cleanup;
+    }
+
+    ret = sb.st_size;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    virJSONValueFree(copy);
+    virJSONValueFree(entry);
+    VIR_FREE(line);
+    VIR_FREE(str);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+/**
+ * virLeaseJournalRemove:
+ * @custom_lease_file: lease file the journal belongs to
+ *
+ * Remove the journal once it has been folded into @custom_lease_file.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+virLeaseJournalRemove(const char *custom_lease_file)
+{
+    char *path = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s" VIR_LEASE_JOURNAL_SUFFIX,
+                    custom_lease_file) < 0)
+        return -1;
+
+    if (unlink(path) < 0 && errno != ENOENT) {
+        virReportSystemError(errno, _("unable to remove '%s'"), path);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(path);
+    return ret;
+}
+
+
 int
 virLeaseReadCustomLeaseFile(virJSONValuePtr leases_array_new,
                             const char *custom_lease_file,
@@ -56,6 +325,7 @@ virLeaseReadCustomLeaseFile(virJSONValuePtr leases_array_new,
                             char **server_duid)
 {
     char *lease_entries = NULL;
+    char *journal_entries = NULL;
     virJSONValuePtr leases_array = NULL;
     long long expirytime;
     int custom_lease_file_len = 0;
@@ -65,6 +335,11 @@ virLeaseReadCustomLeaseFile(virJSONValuePtr leases_array_new,
     size_t i;
     int ret = -1;
 
+    /* The journal has to be read before the lease file it might
+     * already have been folded into */
+    if (virLeaseJournalRead(custom_lease_file, &journal_entries) < 0)
+        goto cleanup;
+
     /* Read entire contents */
     if ((custom_lease_file_len = virFileReadAll(custom_lease_file,
                                                 VIR_NETWORK_DHCP_LEASE_FILE_SIZE_MAX,
@@ -73,17 +348,14 @@ virLeaseReadCustomLeaseFile(virJSONValuePtr leases_array_new,
     }
 
     /* Check for previous leases */
-    if (custom_lease_file_len == 0) {
-        ret = 0;
-        goto cleanup;
-    }
+    if (custom_lease_file_len == 0)
+        goto journal;
 
     if (!(leases_array = virJSONValueFromString(lease_entries))) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("invalid json in file: %s, rewriting it"),
                        custom_lease_file);
-        ret = 0;
-        goto cleanup;
+        goto journal;
     }
 
     if (!virJSONValueIsArray(leases_array)) {
@@ -142,11 +414,20 @@ virLeaseReadCustomLeaseFile(virJSONValuePtr leases_array_new,
         ignore_value(virJSONValueArraySteal(leases_array, i));
     }
 
+ journal:
+    if (journal_entries) {
+        if (virLeaseJournalReplay(leases_array_new, journal_entries) < 0)
+            goto cleanup;
+        if (ip_to_delete)
+            virLeaseRemoveIP(leases_array_new, ip_to_delete);
+    }
+
     ret = 0;
 
  cleanup:
     virJSONValueFree(leases_array);
     VIR_FREE(lease_entries);
+    VIR_FREE(journal_entries);
     return ret;
 }
 
@@ -295,3 +576,426 @@ virLeaseNew(virJSONValuePtr *lease_ret,
     virJSONValueFree(lease_new);
     return ret;
 }
+
+
+/*
+ * Resolving a name in the NSS module used to mean parsing the custom
+ * lease file of every network on each lookup. Next to each of those
+ * files leaseshelper keeps an index which is mapped into memory and
+ * searched in place:
+ *
+ *   header | hostname buckets | MAC buckets | records | strings
+ *
+ * A bucket holds the number (counting from 1, 0 meaning empty) of the
+ * first record whose hostname, respectively MAC address, hashes to it.
+ * Records of a bucket are chained through nextByName and nextByMac in
+ * the order they have in the lease file. Strings are NUL terminated and
+ * referenced by their offset, offset 0 being the empty string which
+ * stands for a missing value.
+ *
+ * The header remembers the inode, size and modification time of the
+ * lease file the index was built from. The lease file is always
+ * replaced by rename, so an index whose lease file has been rewritten
+ * since, for example by an older leaseshelper, no longer matches and
+ * readers fall back to the JSON.
+ */
+
+#define VIR_LEASE_INDEX_MAGIC "LVLIDX01"
+
+typedef struct _virLeaseIndexHeader virLeaseIndexHeader;
+struct _virLeaseIndexHeader {
+    char magic[8];
+    uint32_t nbuckets; /* per table, a power of two */
+    uint32_t nrecords;
+    uint32_t stringsSize;
+    uint32_t unused;
+    uint64_t leaseIno;
+    uint64_t leaseSize;
+    int64_t leaseMtime;
+};
+
+typedef struct _virLeaseIndexRecord virLeaseIndexRecord;
+struct _virLeaseIndexRecord {
+    int64_t expiry;
+    uint32_t nextByName;
+    uint32_t nextByMac;
+    uint32_t hostname;
+    uint32_t mac;
+    uint32_t family;
+    uint32_t unused;
+    unsigned char addr[16];
+};
+
+typedef struct _virLeaseIndexData virLeaseIndexData;
+struct _virLeaseIndexData {
+    virLeaseIndexHeader header;
+    uint32_t *buckets;
+    virLeaseIndexRecord *records;
+    char *strings;
+};
+
+
+/* FNV-1a, which needs neither a seed nor any allocation */
+static uint32_t
+virLeaseIndexHash(const char *str)
+{
+    uint32_t hash = 2166136261U;
+
+    while (*str) {
+        hash ^= (unsigned char) *str++;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+
+static uint32_t
+virLeaseIndexAddString(virLeaseIndexData *data,
+                       const char *str)
+{
+    uint32_t ret = data->header.stringsSize;
+    size_t len;
+
+    if (!str || !*str)
+        return 0;
+
+    len = strlen(str) + 1;
+    memcpy(data->strings + ret, str, len);
+    data->header.stringsSize += len;
+
+    return ret;
+}
+
+
+static int
+virLeaseIndexWriteHelper(int fd, const void *opaque)
+{
+    const virLeaseIndexData *data = opaque;
+    const virLeaseIndexHeader *header = &data->header;
+
+    if (safewrite(fd, header, sizeof(*header)) < 0 ||
+        safewrite(fd, data->buckets,
+                  sizeof(*data->buckets) * 2 * header->nbuckets) < 0 ||
+        safewrite(fd, data->records,
+                  sizeof(*data->records) * header->nrecords) < 0 ||
+        safewrite(fd, data->strings, header->stringsSize) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+/**
+ * virLeaseIndexWrite:
+ * @index_file: path of the index
+ * @custom_lease_file: lease file @leases_array has been read from or
+ *                     written to
+ * @leases_array: leases to index
+ *
+ * Atomically replace @index_file with an index of @leases_array, see
+ * virLeaseIndexOpen(). Leases without a valid IP address or expiry
+ * time are left out.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+virLeaseIndexWrite(const char *index_file,
+                   const char *custom_lease_file,
+                   virJSONValuePtr leases_array)
+{
+    virLeaseIndexData data;
+    virLeaseIndexHeader *header = &data.header;
+    ssize_t nleases = virJSONValueArraySize(leases_array);
+    size_t nstrings = 1;
+    size_t nbuckets = 8;
+    struct stat sb;
+    ssize_t i;
+    int ret = -1;
+
+    memset(&data, 0, sizeof(data));
+
+    if (nleases < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("couldn't fetch array of leases"));
+        return -1;
+    }
+
+    if (stat(custom_lease_file, &sb) < 0) {
+        virReportSystemError(errno, _("cannot stat '%s'"),
+                             custom_lease_file);
+        return -1;
+    }
+
+    for (i = 0; i < nleases; i++) {
+        virJSONValuePtr lease = virJSONValueArrayGet(leases_array, i);
+        const char *str;
+
+        if ((str = virJSONValueObjectGetString(lease, "hostname")))
+            nstrings += strlen(str) + 1;
+        if ((str = virJSONValueObjectGetString(lease, "mac-address")))
+            nstrings += strlen(str) + 1;
+    }
+
+    while (nbuckets < (size_t) nleases * 2)
+        nbuckets *= 2;
+
+    if (nstrings > UINT32_MAX || nbuckets > UINT32_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("too many leases to index"));
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(data.buckets, nbuckets * 2) < 0 ||
+        VIR_ALLOC_N(data.records, nleases + 1) < 0 ||
+        VIR_ALLOC_N(data.strings, nstrings) < 0)
+        goto cleanup;
+
+    memcpy(header->magic, VIR_LEASE_INDEX_MAGIC, sizeof(header->magic));
+    header->nbuckets = nbuckets;
+    header->stringsSize = 1;
+    header->leaseIno = sb.st_ino;
+    header->leaseSize = sb.st_size;
+    header->leaseMtime = sb.st_mtime;
+
+    /* Walk backwards so that prepending to the chains keeps records in
+     * the order of the lease file */
+    for (i = nleases - 1; i >= 0; i--) {
+        virJSONValuePtr lease = virJSONValueArrayGet(leases_array, i);
+        virLeaseIndexRecord *rec = &data.records[header->nrecords];
+        const char *ip;
+        long long expirytime;
+        virSocketAddr sa;
+        uint32_t *bucket;
+
+        if (!lease ||
+            !(ip = virJSONValueObjectGetString(lease, "ip-address")) ||
+            virJSONValueObjectGetNumberLong(lease, "expiry-time",
+                                            &expirytime) < 0 ||
+            virSocketAddrParse(&sa, ip, AF_UNSPEC) < 0)
+            continue;
+
+        rec->expiry = expirytime;
+        rec->family = VIR_SOCKET_ADDR_FAMILY(&sa);
+        if (rec->family == AF_INET)
+            memcpy(rec->addr, &sa.data.inet4.sin_addr.s_addr, 4);
+        else if (rec->family == AF_INET6)
+            memcpy(rec->addr, &sa.data.inet6.sin6_addr.s6_addr, 16);
+        else
+            continue;
+
+        rec->hostname =
+            virLeaseIndexAddString(&data,
+                                   virJSONValueObjectGetString(lease,
+                                                               "hostname"));
+        rec->mac =
+            virLeaseIndexAddString(&data,
+                                   virJSONValueObjectGetString(lease,
+                                                               "mac-address"));
+        header->nrecords++;
+
+        if (rec->hostname) {
+            bucket = &data.buckets[virLeaseIndexHash(data.strings + rec->hostname) &
+                                   (nbuckets - 1)];
+            rec->nextByName = *bucket;
+            *bucket = header->nrecords;
+        }
+
+        if (rec->mac) {
+            bucket = &data.buckets[nbuckets +
+                                   (virLeaseIndexHash(data.strings + rec->mac) &
+                                    (nbuckets - 1))];
+            rec->nextByMac = *bucket;
+            *bucket = header->nrecords;
+        }
+    }
+
+    if (virFileRewrite(index_file, 0644, virLeaseIndexWriteHelper, &data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(data.buckets);
+    VIR_FREE(data.records);
+    VIR_FREE(data.strings);
+    return ret;
+}
+
+
+/**
+ * virLeaseIndexOpen:
+ * @idx: index to initialize
+ * @index_file: path of the index
+ * @custom_lease_file: lease file the index has to describe
+ *
+ * Map @index_file into memory, provided it is well formed, was built
+ * from the current contents of @custom_lease_file and no events are
+ * waiting in its journal. On success
+ * @idx has to be released with virLeaseIndexClose().
+ *
+ * Since a missing or outdated index is expected and simply means the
+ * caller has to parse @custom_lease_file instead, no error is reported.
+ *
+ * Returns 0 on success, -1 if the index can't be used.
+ */
+int
+virLeaseIndexOpen(virLeaseIndexPtr idx,
+                  const char *index_file,
+                  const char *custom_lease_file)
+{
+    const virLeaseIndexHeader *header;
+    const char *strings;
+    struct stat sb;
+    struct stat leaseSb;
+    uint64_t expected;
+    char *journal = NULL;
+    int leaseFd = -1;
+    int fd = -1;
+    int ret = -1;
+
+    idx->map = NULL;
+    idx->size = 0;
+
+    if (virAsprintf(&journal, "%s" VIR_LEASE_JOURNAL_SUFFIX,
+                    custom_lease_file) < 0)
+        goto cleanup;
+
+    if ((fd = open(journal, O_RDONLY)) >= 0) {
+        if (fstat(fd, &sb) < 0 || sb.st_size > 0)
+            goto cleanup;
+        VIR_FORCE_CLOSE(fd);
+    } else if (errno != ENOENT) {
+        goto cleanup;
+    }
+
+    if ((leaseFd = open(custom_lease_file, O_RDONLY)) < 0 ||
+        fstat(leaseFd, &leaseSb) < 0 ||
+        (fd = open(index_file, O_RDONLY)) < 0 ||
+        fstat(fd, &sb) < 0 ||
+        sb.st_size < (off_t) sizeof(*header))
+        goto cleanup;
+
+    idx->size = sb.st_size;
+    if ((idx->map = mmap(NULL, idx->size, PROT_READ,
+                         MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        idx->map = NULL;
+        goto cleanup;
+    }
+    header = idx->map;
+
+    if (memcmp(header->magic, VIR_LEASE_INDEX_MAGIC,
+               sizeof(header->magic)) != 0 ||
+        header->nbuckets == 0 ||
+        (header->nbuckets & (header->nbuckets - 1)) != 0 ||
+        header->stringsSize == 0)
+        goto cleanup;
+
+    expected = sizeof(*header) +
+        (uint64_t) 2 * header->nbuckets * sizeof(uint32_t) +
+        (uint64_t) header->nrecords * sizeof(virLeaseIndexRecord) +
+        header->stringsSize;
+    if (expected != (uint64_t) sb.st_size)
+        goto cleanup;
+
+    /* Make sure every string a lookup may land on is terminated */
+    strings = (const char *) idx->map + idx->size - header->stringsSize;
+    if (strings[0] != '\0' || strings[header->stringsSize - 1] != '\0')
+        goto cleanup;
+
+    if (header->leaseIno != (uint64_t) leaseSb.st_ino ||
+        header->leaseSize != (uint64_t) leaseSb.st_size ||
+        header->leaseMtime != (int64_t) leaseSb.st_mtime)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0)
+        virLeaseIndexClose(idx);
+    VIR_FORCE_CLOSE(fd);
+    VIR_FORCE_CLOSE(leaseFd);
+    VIR_FREE(journal);
+    return ret;
+}
+
+
+void
+virLeaseIndexClose(virLeaseIndexPtr idx)
+{
+    if (idx->map)
+        munmap(idx->map, idx->size);
+    idx->map = NULL;
+    idx->size = 0;
+}
+
+
+/**
+ * virLeaseIndexLookup:
+ * @idx: index opened by virLeaseIndexOpen()
+ * @hostname: hostname to look up
+ * @mac: MAC address to look up, if @hostname is NULL
+ * @now: current time, leases expiring before it are skipped
+ * @iter: called with the family and the address of each lease found
+ * @opaque: passed to @iter
+ *
+ * Find the leases of @hostname, or of @mac, without allocating any
+ * memory. Each of them is passed to @iter in the order of the lease
+ * file; if @iter returns -1 the lookup stops.
+ *
+ * Returns the number of leases found, or -1 if the index is corrupted
+ * or @iter failed.
+ */
+int
+virLeaseIndexLookup(virLeaseIndexPtr idx,
+                    const char *hostname,
+                    const char *mac,
+                    long long now,
+                    virLeaseIndexIterator iter,
+                    void *opaque)
+{
+    const virLeaseIndexHeader *header = idx->map;
+    const uint32_t *buckets = (const uint32_t *) (header + 1);
+    const virLeaseIndexRecord *records;
+    const char *strings;
+    const char *key = hostname ? hostname : mac;
+    uint32_t next;
+    uint32_t steps = 0;
+    int ret = 0;
+
+    if (!key || !*key)
+        return 0;
+
+    records = (const virLeaseIndexRecord *) (buckets + 2 * header->nbuckets);
+    strings = (const char *) (records + header->nrecords);
+
+    next = buckets[(hostname ? 0 : header->nbuckets) +
+                   (virLeaseIndexHash(key) & (header->nbuckets - 1))];
+
+    while (next) {
+        const virLeaseIndexRecord *rec;
+        uint32_t str;
+
+        /* A corrupted chain may point anywhere or loop */
+        if (next > header->nrecords || steps++ == header->nrecords)
+            return -1;
+
+        rec = &records[next - 1];
+        next = hostname ? rec->nextByName : rec->nextByMac;
+        str = hostname ? rec->hostname : rec->mac;
+
+        if (str >= header->stringsSize)
+            return -1;
+
+        if (STRNEQ(strings + str, key) ||
+            rec->expiry < now ||
+            (rec->family != AF_INET && rec->family != AF_INET6))
+            continue;
+
+        ret++;
+        if (iter(rec->family, rec->addr, opaque) < 0)
+            return -1;
+    }
+
+    return ret;
+}
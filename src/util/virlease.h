@@ -25,6 +25,39 @@
 
 # include "virjson.h"
 
+/* Suffix appended to the custom lease file to get its index */
+# define VIR_LEASE_INDEX_SUFFIX ".idx"
+
+/* Suffix appended to the custom lease file to get its journal */
+# define VIR_LEASE_JOURNAL_SUFFIX ".journal"
+
+/* Size past which leaseshelper folds the journal into the lease file */
+# define VIR_LEASE_JOURNAL_COMPACT_SIZE (64 * 1024)
+
+typedef struct _virLeaseIndex virLeaseIndex;
+typedef virLeaseIndex *virLeaseIndexPtr;
+struct _virLeaseIndex {
+    void *map;
+    size_t size;
+};
+
+typedef int (*virLeaseIndexIterator)(int family,
+                                     const unsigned char *addr,
+                                     void *opaque);
+
+int virLeaseJournalRead(const char *custom_lease_file,
+                        char **entries)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int virLeaseJournalReplay(virJSONValuePtr leases_array,
+                          const char *entries)
+    ATTRIBUTE_NONNULL(1);
+off_t virLeaseJournalAppend(const char *custom_lease_file,
+                            virJSONValuePtr lease,
+                            const char *ip)
+    ATTRIBUTE_NONNULL(1);
+int virLeaseJournalRemove(const char *custom_lease_file)
+    ATTRIBUTE_NONNULL(1);
+
 int virLeaseReadCustomLeaseFile(virJSONValuePtr leases_array_new,
                                 const char *custom_lease_file,
                                 const char *ip_to_delete,
@@ -41,4 +74,23 @@ int virLeaseNew(virJSONValuePtr *lease_ret,
                 const char *hostname,
                 const char *iaid,
                 const char *server_duid);
+
+int virLeaseIndexWrite(const char *index_file,
+                       const char *custom_lease_file,
+                       virJSONValuePtr leases_array);
+
+int virLeaseIndexOpen(virLeaseIndexPtr idx,
+                      const char *index_file,
+                      const char *custom_lease_file)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
+void virLeaseIndexClose(virLeaseIndexPtr idx);
+
+int virLeaseIndexLookup(virLeaseIndexPtr idx,
+                        const char *hostname,
+                        const char *mac,
+                        long long now,
+                        virLeaseIndexIterator iter,
+                        void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(5);
 #endif /* __VIR_LEASE_H */
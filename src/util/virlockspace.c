@@ -28,8 +28,11 @@
 #include "virutil.h"
 #include "virfile.h"
 #include "virhash.h"
+#include "virhashcode.h"
+#include "virrandom.h"
 #include "virthread.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -41,6 +44,14 @@ VIR_LOG_INIT("util.lockspace");
 
 #define VIR_LOCKSPACE_TABLE_SIZE 10
 
+/* Resources are spread over this many independently locked tables,
+ * so that acquiring a lock on one resource, which may mean a slow
+ * open() on shared storage, does not hold up all others */
+#define VIR_LOCKSPACE_SHARDS 16
+
+/* Maximum number of threads acquiring a set of resources at once */
+#define VIR_LOCKSPACE_ACQUIRE_WORKERS 8
+
 typedef struct _virLockSpaceResource virLockSpaceResource;
 typedef virLockSpaceResource *virLockSpaceResourcePtr;
 
@@ -54,14 +65,35 @@ struct _virLockSpaceResource {
     pid_t *owners;
 };
 
-struct _virLockSpace {
-    char *dir;
+typedef struct _virLockSpaceShard virLockSpaceShard;
+typedef virLockSpaceShard *virLockSpaceShardPtr;
+
+struct _virLockSpaceShard {
     virMutex lock;
 
     virHashTablePtr resources;
+    virLockSpaceStats stats;
+};
+
+struct _virLockSpace {
+    char *dir;
+    uint32_t seed;
+
+    size_t nshards;
+    virLockSpaceShard shards[VIR_LOCKSPACE_SHARDS];
 };
 
 
+static virLockSpaceShardPtr
+virLockSpaceGetShard(virLockSpacePtr lockspace,
+                     const char *resname)
+{
+    uint32_t hash = virHashCodeGen(resname, strlen(resname), lockspace->seed);
+
+    return &lockspace->shards[hash % VIR_LOCKSPACE_SHARDS];
+}
+
+
 static char *virLockSpaceGetResourcePath(virLockSpacePtr lockspace,
                                          const char *resname)
 {
@@ -239,27 +271,51 @@ static void virLockSpaceResourceDataFree(void *opaque, const void *name ATTRIBUT
 }
 
 
-virLockSpacePtr virLockSpaceNew(const char *directory)
+static virLockSpacePtr virLockSpaceAlloc(void)
 {
     virLockSpacePtr lockspace;
 
-    VIR_DEBUG("directory=%s", NULLSTR(directory));
-
     if (VIR_ALLOC(lockspace) < 0)
         return NULL;
 
-    if (virMutexInit(&lockspace->lock) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Unable to initialize lockspace mutex"));
-        VIR_FREE(lockspace);
-        return NULL;
+    lockspace->seed = virRandomBits(32);
+
+    for (lockspace->nshards = 0;
+         lockspace->nshards < VIR_LOCKSPACE_SHARDS;
+         lockspace->nshards++) {
+        virLockSpaceShardPtr shard = &lockspace->shards[lockspace->nshards];
+
+        if (virMutexInit(&shard->lock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to initialize lockspace mutex"));
+            goto error;
+        }
+
+        if (!(shard->resources = virHashCreate(VIR_LOCKSPACE_TABLE_SIZE,
+                                               virLockSpaceResourceDataFree))) {
+            virMutexDestroy(&shard->lock);
+            goto error;
+        }
     }
 
-    if (VIR_STRDUP(lockspace->dir, directory) < 0)
-        goto error;
+    return lockspace;
+
+ error:
+    virLockSpaceFree(lockspace);
+    return NULL;
+}
+
+
+virLockSpacePtr virLockSpaceNew(const char *directory)
+{
+    virLockSpacePtr lockspace;
+
+    VIR_DEBUG("directory=%s", NULLSTR(directory));
+
+    if (!(lockspace = virLockSpaceAlloc()))
+        return NULL;
 
-    if (!(lockspace->resources = virHashCreate(VIR_LOCKSPACE_TABLE_SIZE,
-                                               virLockSpaceResourceDataFree)))
+    if (VIR_STRDUP(lockspace->dir, directory) < 0)
         goto error;
 
     if (directory) {
@@ -298,19 +354,8 @@ virLockSpacePtr virLockSpaceNewPostExecRestart(virJSONValuePtr object)
 
     VIR_DEBUG("object=%p", object);
 
-    if (VIR_ALLOC(lockspace) < 0)
-        return NULL;
-
-    if (virMutexInit(&lockspace->lock) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Unable to initialize lockspace mutex"));
-        VIR_FREE(lockspace);
+    if (!(lockspace = virLockSpaceAlloc()))
         return NULL;
-    }
-
-    if (!(lockspace->resources = virHashCreate(VIR_LOCKSPACE_TABLE_SIZE,
-                                               virLockSpaceResourceDataFree)))
-        goto error;
 
     if (virJSONValueObjectHasKey(object, "directory")) {
         const char *dir = virJSONValueObjectGetString(object, "directory");
@@ -423,7 +468,8 @@ virLockSpacePtr virLockSpaceNewPostExecRestart(virJSONValuePtr object)
             res->owners[j] = (pid_t)owner;
         }
 
-        if (virHashAddEntry(lockspace->resources, res->name, res) < 0) {
+        if (virHashAddEntry(virLockSpaceGetShard(lockspace, res->name)->resources,
+                            res->name, res) < 0) {
             virLockSpaceResourceFree(res);
             goto error;
         }
@@ -437,16 +483,72 @@ virLockSpacePtr virLockSpaceNewPostExecRestart(virJSONValuePtr object)
 }
 
 
+static int
+virLockSpaceResourcePreExecRestart(virLockSpaceResourcePtr res,
+                                   virJSONValuePtr resources)
+{
+    virJSONValuePtr child = virJSONValueNewObject();
+    virJSONValuePtr owners = NULL;
+    size_t i;
+
+    if (!child)
+        return -1;
+
+    if (virJSONValueArrayAppend(resources, child) < 0) {
+        virJSONValueFree(child);
+        return -1;
+    }
+
+    if (virJSONValueObjectAppendString(child, "name", res->name) < 0 ||
+        virJSONValueObjectAppendString(child, "path", res->path) < 0 ||
+        virJSONValueObjectAppendNumberInt(child, "fd", res->fd) < 0 ||
+        virJSONValueObjectAppendBoolean(child, "lockHeld", res->lockHeld) < 0 ||
+        virJSONValueObjectAppendNumberUint(child, "flags", res->flags) < 0)
+        return -1;
+
+    if (virSetInherit(res->fd, true) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Cannot disable close-on-exec flag"));
+        return -1;
+    }
+
+    if (!(owners = virJSONValueNewArray()))
+        return -1;
+
+    if (virJSONValueObjectAppend(child, "owners", owners) < 0) {
+        virJSONValueFree(owners);
+        return -1;
+    }
+
+    for (i = 0; i < res->nOwners; i++) {
+        virJSONValuePtr owner = virJSONValueNewNumberUlong(res->owners[i]);
+        if (!owner)
+            return -1;
+
+        if (virJSONValueArrayAppend(owners, owner) < 0) {
+            virJSONValueFree(owner);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 virJSONValuePtr virLockSpacePreExecRestart(virLockSpacePtr lockspace)
 {
     virJSONValuePtr object = virJSONValueNewObject();
     virJSONValuePtr resources;
     virHashKeyValuePairPtr pairs = NULL, tmp;
+    size_t i;
 
     if (!object)
         return NULL;
 
-    virMutexLock(&lockspace->lock);
+    /* Shards are always locked in ascending order, while everything
+     * else only ever holds one at a time */
+    for (i = 0; i < lockspace->nshards; i++)
+        virMutexLock(&lockspace->shards[i].lock);
 
     if (lockspace->dir &&
         virJSONValueObjectAppendString(object, "directory", lockspace->dir) < 0)
@@ -460,76 +562,43 @@ virJSONValuePtr virLockSpacePreExecRestart(virLockSpacePtr lockspace)
         goto error;
     }
 
-    tmp = pairs = virHashGetItems(lockspace->resources, NULL);
-    while (tmp && tmp->value) {
-        virLockSpaceResourcePtr res = (virLockSpaceResourcePtr)tmp->value;
-        virJSONValuePtr child = virJSONValueNewObject();
-        virJSONValuePtr owners = NULL;
-        size_t i;
-
-        if (!child)
-            goto error;
-
-        if (virJSONValueArrayAppend(resources, child) < 0) {
-            virJSONValueFree(child);
-            goto error;
-        }
-
-        if (virJSONValueObjectAppendString(child, "name", res->name) < 0 ||
-            virJSONValueObjectAppendString(child, "path", res->path) < 0 ||
-            virJSONValueObjectAppendNumberInt(child, "fd", res->fd) < 0 ||
-            virJSONValueObjectAppendBoolean(child, "lockHeld", res->lockHeld) < 0 ||
-            virJSONValueObjectAppendNumberUint(child, "flags", res->flags) < 0)
-            goto error;
-
-        if (virSetInherit(res->fd, true) < 0) {
-            virReportSystemError(errno, "%s",
-                                 _("Cannot disable close-on-exec flag"));
-            goto error;
-        }
-
-        if (!(owners = virJSONValueNewArray()))
-            goto error;
-
-        if (virJSONValueObjectAppend(child, "owners", owners) < 0) {
-            virJSONValueFree(owners);
-            goto error;
-        }
-
-        for (i = 0; i < res->nOwners; i++) {
-            virJSONValuePtr owner = virJSONValueNewNumberUlong(res->owners[i]);
-            if (!owner)
+    for (i = 0; i < lockspace->nshards; i++) {
+        tmp = pairs = virHashGetItems(lockspace->shards[i].resources, NULL);
+        while (tmp && tmp->value) {
+            if (virLockSpaceResourcePreExecRestart((virLockSpaceResourcePtr)tmp->value,
+                                                   resources) < 0)
                 goto error;
 
-            if (virJSONValueArrayAppend(owners, owner) < 0) {
-                virJSONValueFree(owner);
-                goto error;
-            }
+            tmp++;
         }
-
-        tmp++;
+        VIR_FREE(pairs);
     }
-    VIR_FREE(pairs);
 
-    virMutexUnlock(&lockspace->lock);
+    for (i = 0; i < lockspace->nshards; i++)
+        virMutexUnlock(&lockspace->shards[i].lock);
     return object;
 
  error:
     VIR_FREE(pairs);
     virJSONValueFree(object);
-    virMutexUnlock(&lockspace->lock);
+    for (i = 0; i < lockspace->nshards; i++)
+        virMutexUnlock(&lockspace->shards[i].lock);
     return NULL;
 }
 
 
 void virLockSpaceFree(virLockSpacePtr lockspace)
 {
+    size_t i;
+
     if (!lockspace)
         return;
 
-    virHashFree(lockspace->resources);
+    for (i = 0; i < lockspace->nshards; i++) {
+        virHashFree(lockspace->shards[i].resources);
+        virMutexDestroy(&lockspace->shards[i].lock);
+    }
     VIR_FREE(lockspace->dir);
-    virMutexDestroy(&lockspace->lock);
     VIR_FREE(lockspace);
 }
 
@@ -545,12 +614,13 @@ int virLockSpaceCreateResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     char *respath = NULL;
+    virLockSpaceShardPtr shard = virLockSpaceGetShard(lockspace, resname);
 
     VIR_DEBUG("lockspace=%p resname=%s", lockspace, resname);
 
-    virMutexLock(&lockspace->lock);
+    virMutexLock(&shard->lock);
 
-    if (virHashLookup(lockspace->resources, resname) != NULL) {
+    if (virHashLookup(shard->resources, resname) != NULL) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is locked"),
                        resname);
@@ -566,7 +636,7 @@ int virLockSpaceCreateResource(virLockSpacePtr lockspace,
     ret = 0;
 
  cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virMutexUnlock(&shard->lock);
     VIR_FREE(respath);
     return ret;
 }
@@ -577,12 +647,13 @@ int virLockSpaceDeleteResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     char *respath = NULL;
+    virLockSpaceShardPtr shard = virLockSpaceGetShard(lockspace, resname);
 
     VIR_DEBUG("lockspace=%p resname=%s", lockspace, resname);
 
-    virMutexLock(&lockspace->lock);
+    virMutexLock(&shard->lock);
 
-    if (virHashLookup(lockspace->resources, resname) != NULL) {
+    if (virHashLookup(shard->resources, resname) != NULL) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is locked"),
                        resname);
@@ -603,12 +674,54 @@ int virLockSpaceDeleteResource(virLockSpacePtr lockspace,
     ret = 0;
 
  cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virMutexUnlock(&shard->lock);
     VIR_FREE(respath);
     return ret;
 }
 
 
+static size_t
+virLockSpaceStatsBucket(unsigned long long usecs)
+{
+    size_t i = 0;
+
+    while ((usecs >>= 1) && i < VIR_LOCK_SPACE_HISTOGRAM_BUCKETS - 1)
+        i++;
+
+    return i;
+}
+
+
+/* Must be called with the shard locked */
+static void
+virLockSpaceStatsRecord(virLockSpaceShardPtr shard,
+                        unsigned long long start,
+                        int rc)
+{
+    unsigned long long now;
+    unsigned long long usecs = 0;
+
+    if (rc == 0) {
+        shard->stats.acquired++;
+    } else {
+        virErrorPtr err = virGetLastError();
+
+        if (err && err->code == VIR_ERR_RESOURCE_BUSY)
+            shard->stats.busy++;
+        else
+            shard->stats.errors++;
+    }
+
+    if (start && virTimeMicrosNowRaw(&now) == 0 && now > start)
+        usecs = now - start;
+
+    shard->stats.timeTotal += usecs;
+    if (usecs > shard->stats.timeMax)
+        shard->stats.timeMax = usecs;
+    shard->stats.time[virLockSpaceStatsBucket(usecs)]++;
+}
+
+
 int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
                                 const char *resname,
                                 pid_t owner,
@@ -616,6 +729,8 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     virLockSpaceResourcePtr res;
+    virLockSpaceShardPtr shard = virLockSpaceGetShard(lockspace, resname);
+    unsigned long long start;
 
     VIR_DEBUG("lockspace=%p resname=%s flags=%x owner=%lld",
               lockspace, resname, flags, (unsigned long long)owner);
@@ -623,9 +738,13 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
     virCheckFlags(VIR_LOCK_SPACE_ACQUIRE_SHARED |
                   VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE, -1);
 
-    virMutexLock(&lockspace->lock);
+    /* Time spent waiting for the shard counts too */
+    if (virTimeMicrosNowRaw(&start) < 0)
+        start = 0;
+
+    virMutexLock(&shard->lock);
 
-    if ((res = virHashLookup(lockspace->resources, resname))) {
+    if ((res = virHashLookup(shard->resources, resname))) {
         if ((res->flags & VIR_LOCK_SPACE_ACQUIRE_SHARED) &&
             (flags & VIR_LOCK_SPACE_ACQUIRE_SHARED)) {
 
@@ -644,7 +763,7 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
     if (!(res = virLockSpaceResourceNew(lockspace, resname, flags, owner)))
         goto cleanup;
 
-    if (virHashAddEntry(lockspace->resources, resname, res) < 0) {
+    if (virHashAddEntry(shard->resources, resname, res) < 0) {
         virLockSpaceResourceFree(res);
         goto cleanup;
     }
@@ -653,7 +772,144 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
     ret = 0;
 
  cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virLockSpaceStatsRecord(shard, start, ret);
+    virMutexUnlock(&shard->lock);
+    return ret;
+}
+
+
+struct virLockSpaceAcquireData {
+    virLockSpaceRequestPtr reqs;
+    size_t nreqs;
+    pid_t owner;
+
+    virMutex lock;
+    size_t next;
+    bool *acquired;
+    bool failed;
+    virErrorPtr err;
+};
+
+
+static void
+virLockSpaceAcquireWorker(void *opaque)
+{
+    struct virLockSpaceAcquireData *data = opaque;
+
+    while (true) {
+        virLockSpaceRequestPtr req;
+        size_t i;
+        int rc;
+
+        virMutexLock(&data->lock);
+        if (data->failed || data->next == data->nreqs) {
+            virMutexUnlock(&data->lock);
+            return;
+        }
+        i = data->next++;
+        virMutexUnlock(&data->lock);
+
+        req = &data->reqs[i];
+        rc = virLockSpaceAcquireResource(req->lockspace, req->resname,
+                                         data->owner, req->flags);
+
+        virMutexLock(&data->lock);
+        if (rc < 0) {
+            if (!data->failed)
+                data->err = virSaveLastError();
+            data->failed = true;
+        } else {
+            data->acquired[i] = true;
+        }
+        virMutexUnlock(&data->lock);
+    }
+}
+
+
+/**
+ * virLockSpaceAcquireResources:
+ * @reqs: the resources to acquire
+ * @nreqs: number of entries in @reqs
+ * @owner: process to acquire them on behalf of
+ *
+ * Acquires all resources in @reqs, which may belong to different
+ * lockspaces, or none at all. Since acquiring a resource may block
+ * on the storage holding it, several of them are acquired at
+ * once from a few short lived threads.
+ *
+ * Returns 0 on success, -1 on error, in which case none of the
+ * resources are held
+ */
+int virLockSpaceAcquireResources(virLockSpaceRequestPtr reqs,
+                                 size_t nreqs,
+                                 pid_t owner)
+{
+    struct virLockSpaceAcquireData data;
+    virThreadPtr workers = NULL;
+    size_t nworkers = 0;
+    size_t i;
+    int ret = -1;
+
+    VIR_DEBUG("reqs=%p nreqs=%zu owner=%lld",
+              reqs, nreqs, (unsigned long long)owner);
+
+    if (nreqs == 0)
+        return 0;
+
+    memset(&data, 0, sizeof(data));
+    data.reqs = reqs;
+    data.nreqs = nreqs;
+    data.owner = owner;
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(data.acquired, nreqs) < 0)
+        goto cleanup;
+
+    /* The calling thread takes its share of the work as well */
+    if (nreqs > 1 &&
+        VIR_ALLOC_N(workers, MIN(nreqs, VIR_LOCKSPACE_ACQUIRE_WORKERS) - 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < MIN(nreqs, VIR_LOCKSPACE_ACQUIRE_WORKERS) - 1; i++) {
+        /* Fewer threads just means less parallelism */
+        if (virThreadCreate(&workers[nworkers], true,
+                            virLockSpaceAcquireWorker, &data) < 0)
+            break;
+        nworkers++;
+    }
+
+    virLockSpaceAcquireWorker(&data);
+
+    for (i = 0; i < nworkers; i++)
+        virThreadJoin(&workers[i]);
+
+    if (data.failed) {
+        for (i = nreqs; i > 0; i--) {
+            if (data.acquired[i - 1])
+                ignore_value(virLockSpaceReleaseResource(reqs[i - 1].lockspace,
+                                                         reqs[i - 1].resname,
+                                                         owner));
+        }
+
+        if (data.err)
+            virSetError(data.err);
+        else
+            virReportOOMError();
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virFreeError(data.err);
+    VIR_FREE(data.acquired);
+    VIR_FREE(workers);
+    virMutexDestroy(&data.lock);
     return ret;
 }
 
@@ -664,14 +920,15 @@ int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     virLockSpaceResourcePtr res;
+    virLockSpaceShardPtr shard = virLockSpaceGetShard(lockspace, resname);
     size_t i;
 
     VIR_DEBUG("lockspace=%p resname=%s owner=%lld",
               lockspace, resname, (unsigned long long)owner);
 
-    virMutexLock(&lockspace->lock);
+    virMutexLock(&shard->lock);
 
-    if (!(res = virHashLookup(lockspace->resources, resname))) {
+    if (!(res = virHashLookup(shard->resources, resname))) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is not locked"),
                        resname);
@@ -693,13 +950,13 @@ int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
     VIR_DELETE_ELEMENT(res->owners, i, res->nOwners);
 
     if ((res->nOwners == 0) &&
-        virHashRemoveEntry(lockspace->resources, resname) < 0)
+        virHashRemoveEntry(shard->resources, resname) < 0)
         goto cleanup;
 
     ret = 0;
 
  cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virMutexUnlock(&shard->lock);
     return ret;
 }
 
@@ -746,26 +1003,58 @@ virLockSpaceRemoveResourcesForOwner(const void *payload,
 int virLockSpaceReleaseResourcesForOwner(virLockSpacePtr lockspace,
                                          pid_t owner)
 {
-    int ret = 0;
     struct virLockSpaceRemoveData data = {
         owner, 0
     };
+    size_t i;
 
     VIR_DEBUG("lockspace=%p owner=%lld", lockspace, (unsigned long long)owner);
 
-    virMutexLock(&lockspace->lock);
+    for (i = 0; i < lockspace->nshards; i++) {
+        virLockSpaceShardPtr shard = &lockspace->shards[i];
+        int rc;
 
-    if (virHashRemoveSet(lockspace->resources,
-                         virLockSpaceRemoveResourcesForOwner,
-                         &data) < 0)
-        goto error;
+        virMutexLock(&shard->lock);
+        rc = virHashRemoveSet(shard->resources,
+                              virLockSpaceRemoveResourcesForOwner,
+                              &data);
+        virMutexUnlock(&shard->lock);
 
-    ret = data.count;
+        if (rc < 0)
+            return -1;
+    }
 
-    virMutexUnlock(&lockspace->lock);
-    return ret;
+    return data.count;
+}
 
- error:
-    virMutexUnlock(&lockspace->lock);
-    return -1;
+
+/**
+ * virLockSpaceGetStats:
+ * @lockspace: the lockspace
+ * @stats: filled with the statistics
+ *
+ * Retrieves the number of resource acquisitions and the distribution
+ * of the time they took, accumulated since @lockspace was created
+ */
+void virLockSpaceGetStats(virLockSpacePtr lockspace,
+                          virLockSpaceStatsPtr stats)
+{
+    size_t i, j;
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (i = 0; i < lockspace->nshards; i++) {
+        virLockSpaceShardPtr shard = &lockspace->shards[i];
+
+        virMutexLock(&shard->lock);
+        stats->acquired += shard->stats.acquired;
+        stats->busy += shard->stats.busy;
+        stats->errors += shard->stats.errors;
+        stats->timeTotal += shard->stats.timeTotal;
+        if (shard->stats.timeMax > stats->timeMax)
+            stats->timeMax = shard->stats.timeMax;
+        for (j = 0; j < VIR_LOCK_SPACE_HISTOGRAM_BUCKETS; j++)
+            stats->time[j] += shard->stats.time[j];
+        virMutexUnlock(&shard->lock);
+    }
 }
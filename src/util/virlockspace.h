@@ -52,6 +52,19 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
                                 pid_t owner,
                                 unsigned int flags);
 
+typedef struct _virLockSpaceRequest virLockSpaceRequest;
+typedef virLockSpaceRequest *virLockSpaceRequestPtr;
+
+struct _virLockSpaceRequest {
+    virLockSpacePtr lockspace;
+    const char *resname;
+    unsigned int flags; /* bitwise-OR of virLockSpaceAcquireFlags */
+};
+
+int virLockSpaceAcquireResources(virLockSpaceRequestPtr reqs,
+                                 size_t nreqs,
+                                 pid_t owner);
+
 int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
                                 const char *resname,
                                 pid_t owner);
@@ -59,4 +72,24 @@ int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
 int virLockSpaceReleaseResourcesForOwner(virLockSpacePtr lockspace,
                                          pid_t owner);
 
+/* Bucket i of the histogram counts acquisitions which took less than
+ * 2^(i+1) microseconds not counted by a lower bucket, the last one
+ * takes everything longer */
+# define VIR_LOCK_SPACE_HISTOGRAM_BUCKETS 24
+
+typedef struct _virLockSpaceStats virLockSpaceStats;
+typedef virLockSpaceStats *virLockSpaceStatsPtr;
+
+struct _virLockSpaceStats {
+    unsigned long long acquired;    /* Successful acquisitions */
+    unsigned long long busy;        /* Failed, resource was already held */
+    unsigned long long errors;      /* Failed for any other reason */
+    unsigned long long timeTotal;   /* Microseconds spent acquiring */
+    unsigned long long timeMax;
+    unsigned long long time[VIR_LOCK_SPACE_HISTOGRAM_BUCKETS];
+};
+
+void virLockSpaceGetStats(virLockSpacePtr lockspace,
+                          virLockSpaceStatsPtr stats);
+
 #endif /* __VIR_LOCK_SPACE_H__ */
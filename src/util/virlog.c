@@ -43,6 +43,7 @@
 #include "virerror.h"
 #include "virlog.h"
 #include "viralloc.h"
+#include "viratomic.h"
 #include "virutil.h"
 #include "virbuffer.h"
 #include "virthread.h"
@@ -76,7 +77,7 @@ static regex_t *virLogRegex;
 
 VIR_ENUM_DECL(virLogDestination);
 VIR_ENUM_IMPL(virLogDestination, VIR_LOG_TO_OUTPUT_LAST,
-              "stderr", "syslog", "file", "journald");
+              "stderr", "syslog", "file", "journald", "memory");
 
 /*
  * Filters are used to refine the rules on what to keep or drop
@@ -92,6 +93,13 @@ static int virLogFiltersSerial = 1;
 static virLogFilterPtr *virLogFilters;
 static size_t virLogNbFilters;
 
+/*
+ * Sources which logged at least once, so their cached priority can be
+ * recomputed whenever the filters or the default priority change instead
+ * of on the next message. Protected by virLogLock.
+ */
+static virLogSourcePtr virLogSources;
+
 /*
  * Outputs are used to emit the messages retained
  * after filtering, multiple output can be used simultaneously
@@ -110,13 +118,112 @@ static char *virLogDefaultOutput;
 static virLogOutputPtr *virLogOutputs;
 static size_t virLogNbOutputs;
 
+/* Lowest priority any output other than the memory one accepts, messages
+ * below it are not even formatted unless recorded in memory */
+static virLogPriority virLogOutputsPriority = VIR_LOG_DEBUG;
+
+/*
+ * The memory output records messages in a ring of fixed size entries kept
+ * by every thread, so recording takes neither virLogLock nor any memory
+ * allocation and nothing but the message text is formatted until the
+ * rings are dumped. A ring is protected by its own lock, which is only
+ * ever contended while dumping. Rings of threads which exited are handed
+ * over to new threads, so their messages can still be dumped until they
+ * are overwritten.
+ */
+struct _virLogMemoryEntry {
+    unsigned long long when;          /* microseconds since the epoch */
+    unsigned long long thread;
+    unsigned long long seq;
+    virLogPriority priority;
+    const char *funcname;
+    int linenr;
+    char text[VIR_LOG_MEMORY_TEXT_MAX];
+};
+typedef struct _virLogMemoryEntry virLogMemoryEntry;
+typedef virLogMemoryEntry *virLogMemoryEntryPtr;
+
+struct _virLogMemoryRing {
+    virMutex lock;
+    bool inuse;
+    unsigned long long thread;
+    unsigned long long next;          /* number of entries ever recorded */
+    virLogMemoryEntry entries[VIR_LOG_MEMORY_ENTRIES];
+};
+typedef struct _virLogMemoryRing virLogMemoryRing;
+typedef virLogMemoryRing *virLogMemoryRingPtr;
+
+/* Priority of the memory output, 0 if there is none */
+static int virLogMemoryPriority;
+
+static virMutex virLogMemoryMutex;
+static virThreadLocal virLogMemoryRingLocal;
+static virLogMemoryRingPtr *virLogMemoryRings;
+static size_t virLogMemoryNRings;
+
 /*
  * Default priorities
  */
 static virLogPriority virLogDefaultPriority = VIR_LOG_DEFAULT;
 
+static bool virLogInitMessageStderr = true;
+
+/*
+ * Optionally, debug and info messages are not written by the thread
+ * emitting them, but formatted and pushed to a bounded lock-free queue
+ * from where a dedicated thread writes them to the outputs in batches.
+ * The queue is an array of slots, each carrying a sequence number telling
+ * producers and the consumer whether the slot is free to be claimed or
+ * holds a message ready to be written. Any number of threads may claim
+ * slots, while only the holder of virLogLock consumes them. Messages
+ * which do not fit into a full queue are dropped and counted.
+ */
+struct _virLogQueueEntry {
+    volatile int seq;
+    virLogSourcePtr source;
+    virLogPriority priority;
+    const char *filename;
+    int linenr;
+    const char *funcname;
+    unsigned int flags;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    char *str;
+    char *msg;
+};
+typedef struct _virLogQueueEntry virLogQueueEntry;
+typedef virLogQueueEntry *virLogQueueEntryPtr;
+
+/* Upper limit on the number of slots of the queue */
+#define VIR_LOG_QUEUE_SIZE_MAX (1 << 20)
+
+/* Maximum number of messages written with virLogLock held at once */
+#define VIR_LOG_QUEUE_BATCH 256
+
+static virLogQueueEntryPtr virLogQueue;
+static unsigned int virLogQueueMask;
+static volatile int virLogQueueEnabled;
+static volatile int virLogQueueHead;    /* next slot to be claimed */
+static volatile int virLogQueueTail;    /* next slot to be written */
+static volatile int virLogQueueDropped;
+static unsigned int virLogQueueDroppedReported;
+static unsigned long long virLogQueueWritten;
+
+/* The writer sleeps on this when there is nothing to write */
+static virMutex virLogQueueMutex;
+static virCond virLogQueueCond;
+static volatile int virLogQueueWaiting;
+static virThread virLogQueueThread;
+static pid_t virLogQueuePid;
+
 static void virLogResetFilters(void);
 static void virLogResetOutputs(void);
+static void virLogQueueResetLocked(void);
+static void virLogMemoryRingRelease(void *data);
+static void virLogMemoryRecord(virLogPriority priority,
+                               const char *funcname,
+                               int linenr,
+                               const char *fmt,
+                               va_list vargs);
 static void virLogOutputToFd(virLogSourcePtr src,
                              virLogPriority priority,
                              const char *filename,
@@ -261,6 +368,18 @@ virLogOnceInit(void)
 {
     if (virMutexInit(&virLogMutex) < 0)
         return -1;
+    virMutexSetName(&virLogMutex, "virLog");
+
+    if (virMutexInit(&virLogQueueMutex) < 0 ||
+        virCondInit(&virLogQueueCond) < 0)
+        return -1;
+    virMutexSetName(&virLogQueueMutex, "virLogQueue");
+
+    if (virMutexInit(&virLogMemoryMutex) < 0 ||
+        virThreadLocalInit(&virLogMemoryRingLocal,
+                           virLogMemoryRingRelease) < 0)
+        return -1;
+    virMutexSetName(&virLogMemoryMutex, "virLogMemory");
 
     virLogLock();
     virLogDefaultPriority = VIR_LOG_DEFAULT;
@@ -277,6 +396,45 @@ virLogOnceInit(void)
 VIR_ONCE_GLOBAL_INIT(virLog)
 
 
+static void
+virLogSourceUpdateLocked(virLogSourcePtr source)
+{
+    unsigned int priority = virLogDefaultPriority;
+    unsigned int flags = 0;
+    size_t i;
+
+    for (i = 0; i < virLogNbFilters; i++) {
+        if (strstr(source->name, virLogFilters[i]->match)) {
+            priority = virLogFilters[i]->priority;
+            flags = virLogFilters[i]->flags;
+            break;
+        }
+    }
+
+    /* The priority is read without any locking by VIR_LOG_SOURCE_ENABLED,
+     * set the flags first so that they are in place once it lets messages
+     * through */
+    source->flags = flags;
+    virAtomicIntSet(&source->priority, priority);
+    source->serial = virLogFiltersSerial;
+}
+
+
+/*
+ * Recompute the priority of every source which already logged something,
+ * to be called whenever the filters or the default priority change.
+ */
+static void
+virLogSourcesUpdateLocked(void)
+{
+    virLogSourcePtr source;
+
+    virLogFiltersSerial++;
+    for (source = virLogSources; source; source = source->next)
+        virLogSourceUpdateLocked(source);
+}
+
+
 /**
  * virLogReset:
  *
@@ -291,9 +449,11 @@ virLogReset(void)
         return -1;
 
     virLogLock();
+    virLogQueueResetLocked();
     virLogResetFilters();
     virLogResetOutputs();
     virLogDefaultPriority = VIR_LOG_DEFAULT;
+    virLogSourcesUpdateLocked();
     virLogUnlock();
     return 0;
 }
@@ -320,7 +480,10 @@ virLogSetDefaultPriority(virLogPriority priority)
     if (virLogInitialize() < 0)
         return -1;
 
+    virLogLock();
     virLogDefaultPriority = priority;
+    virLogSourcesUpdateLocked();
+    virLogUnlock();
     return 0;
 }
 
@@ -383,6 +546,8 @@ virLogResetOutputs(void)
     virLogOutputListFree(virLogOutputs, virLogNbOutputs);
     virLogOutputs = NULL;
     virLogNbOutputs = 0;
+    virLogOutputsPriority = VIR_LOG_DEBUG;
+    virAtomicIntSet(&virLogMemoryPriority, 0);
 }
 
 
@@ -491,25 +656,424 @@ virLogSourceUpdate(virLogSourcePtr source)
 {
     virLogLock();
     if (source->serial < virLogFiltersSerial) {
-        unsigned int priority = virLogDefaultPriority;
-        unsigned int flags = 0;
-        size_t i;
-
-        for (i = 0; i < virLogNbFilters; i++) {
-            if (strstr(source->name, virLogFilters[i]->match)) {
-                priority = virLogFilters[i]->priority;
-                flags = virLogFilters[i]->flags;
-                break;
+        /* First message from this source */
+        if (source->serial == 0) {
+            source->next = virLogSources;
+            virLogSources = source;
+        }
+        virLogSourceUpdateLocked(source);
+    }
+    virLogUnlock();
+}
+
+/*
+ * Push a message to every output it is meant for, or to stderr if there
+ * are none. If @batch is not NULL it holds one buffer per output, where
+ * messages for file descriptor outputs are collected to be written at
+ * once by virLogOutputBatchFlush.
+ *
+ * Must be called with virLogLock held.
+ */
+static void
+virLogOutputMessageLocked(virLogSourcePtr source,
+                          virLogPriority priority,
+                          const char *filename,
+                          int linenr,
+                          const char *funcname,
+                          const char *timestamp,
+                          virLogMetadataPtr metadata,
+                          unsigned int filterflags,
+                          const char *str,
+                          const char *msg,
+                          virBufferPtr batch)
+{
+    size_t i;
+
+    for (i = 0; i < virLogNbOutputs; i++) {
+        if (virLogOutputs[i]->dest == VIR_LOG_TO_MEMORY)
+            continue;
+
+        if (priority >= virLogOutputs[i]->priority) {
+            if (virLogOutputs[i]->logInitMessage) {
+                const char *rawinitmsg;
+                char *hoststr = NULL;
+                char *initmsg = NULL;
+                if (virLogVersionString(&rawinitmsg, &initmsg) >= 0)
+                    virLogOutputs[i]->f(&virLogSelf, VIR_LOG_INFO,
+                                       __FILE__, __LINE__, __func__,
+                                       timestamp, NULL, 0, rawinitmsg, initmsg,
+                                       virLogOutputs[i]->data);
+                VIR_FREE(initmsg);
+                if (virLogHostnameString(&hoststr, &initmsg) >= 0)
+                    virLogOutputs[i]->f(&virLogSelf, VIR_LOG_INFO,
+                                       __FILE__, __LINE__, __func__,
+                                       timestamp, NULL, 0, hoststr, initmsg,
+                                       virLogOutputs[i]->data);
+                VIR_FREE(hoststr);
+                VIR_FREE(initmsg);
+                virLogOutputs[i]->logInitMessage = false;
+            }
+            if (batch && virLogOutputs[i]->f == virLogOutputToFd &&
+                !(filterflags & VIR_LOG_STACK_TRACE)) {
+                virBufferAsprintf(&batch[i], "%s: %s", timestamp, msg);
+                continue;
             }
+            virLogOutputs[i]->f(source, priority,
+                               filename, linenr, funcname,
+                               timestamp, metadata, filterflags,
+                               str, msg, virLogOutputs[i]->data);
         }
+    }
+    if (virLogNbOutputs == 0) {
+        if (virLogInitMessageStderr) {
+            const char *rawinitmsg;
+            char *hoststr = NULL;
+            char *initmsg = NULL;
+            if (virLogVersionString(&rawinitmsg, &initmsg) >= 0)
+                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
+                                 __FILE__, __LINE__, __func__,
+                                 timestamp, NULL, 0, rawinitmsg, initmsg,
+                                 (void *) STDERR_FILENO);
+            VIR_FREE(initmsg);
+            if (virLogHostnameString(&hoststr, &initmsg) >= 0)
+                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
+                                 __FILE__, __LINE__, __func__,
+                                 timestamp, NULL, 0, hoststr, initmsg,
+                                 (void *) STDERR_FILENO);
+            VIR_FREE(hoststr);
+            VIR_FREE(initmsg);
+            virLogInitMessageStderr = false;
+        }
+        virLogOutputToFd(source, priority,
+                         filename, linenr, funcname,
+                         timestamp, metadata, filterflags,
+                         str, msg, (void *) STDERR_FILENO);
+    }
+}
+
+
+static void
+virLogOutputBatchFlush(virLogOutputPtr output,
+                       virBufferPtr buf)
+{
+    int fd = (intptr_t) output->data;
+    char *content;
 
-        source->priority = priority;
-        source->flags = flags;
-        source->serial = virLogFiltersSerial;
+    if (virBufferError(buf) || fd < 0) {
+        virBufferFreeAndReset(buf);
+        return;
     }
+
+    if (!(content = virBufferContentAndReset(buf)))
+        return;
+
+    ignore_value(safewrite(fd, content, strlen(content)));
+    VIR_FREE(content);
+}
+
+
+/*
+ * Claim a slot of the queue and hand it the message, stealing @str
+ * and @msg. The message is dropped if the queue is full.
+ *
+ * Returns true if the message was queued or dropped, false if the
+ * queue is not in use and the message has to be written right away.
+ */
+static bool
+virLogQueuePush(virLogSourcePtr source,
+                virLogPriority priority,
+                const char *filename,
+                int linenr,
+                const char *funcname,
+                const char *timestamp,
+                unsigned int flags,
+                char **str,
+                char **msg)
+{
+    virLogQueueEntryPtr entry;
+    unsigned int pos;
+    int diff;
+
+    if (!virAtomicIntGet(&virLogQueueEnabled))
+        return false;
+
+    pos = virAtomicIntGet(&virLogQueueHead);
+    for (;;) {
+        entry = &virLogQueue[pos & virLogQueueMask];
+        diff = (int) ((unsigned int) virAtomicIntGet(&entry->seq) - pos);
+
+        if (diff == 0) {
+            /* The slot is free, try to claim it */
+            if (virAtomicIntCompareExchange(&virLogQueueHead,
+                                            (int) pos, (int) (pos + 1)))
+                break;
+        } else if (diff < 0) {
+            /* The slot still holds a message from the previous lap */
+            virAtomicIntInc(&virLogQueueDropped);
+            return true;
+        }
+
+        /* Another thread claimed the slot first */
+        pos = virAtomicIntGet(&virLogQueueHead);
+    }
+
+    entry->source = source;
+    entry->priority = priority;
+    entry->filename = filename;
+    entry->linenr = linenr;
+    entry->funcname = funcname;
+    entry->flags = flags;
+    memcpy(entry->timestamp, timestamp, sizeof(entry->timestamp));
+    entry->str = *str;
+    entry->msg = *msg;
+    *str = NULL;
+    *msg = NULL;
+
+    /* Publish the message */
+    virAtomicIntSet(&entry->seq, (int) (pos + 1));
+
+    if (virAtomicIntGet(&virLogQueueWaiting)) {
+        virMutexLock(&virLogQueueMutex);
+        virCondSignal(&virLogQueueCond);
+        virMutexUnlock(&virLogQueueMutex);
+    }
+
+    return true;
+}
+
+
+/* Oldest queued message, or NULL if it was not published yet */
+static virLogQueueEntryPtr
+virLogQueuePeek(void)
+{
+    unsigned int pos = virAtomicIntGet(&virLogQueueTail);
+    virLogQueueEntryPtr entry = &virLogQueue[pos & virLogQueueMask];
+
+    if ((int) ((unsigned int) virAtomicIntGet(&entry->seq) - (pos + 1)) < 0)
+        return NULL;
+
+    return entry;
+}
+
+
+/*
+ * Write queued messages to the outputs, at most VIR_LOG_QUEUE_BATCH of
+ * them unless @all is true, and report how many were dropped since the
+ * last time.
+ *
+ * Must be called with virLogLock held.
+ */
+static void
+virLogQueueDrainLocked(bool all)
+{
+    virLogQueueEntryPtr entry = NULL;
+    virBufferPtr batch = NULL;
+    unsigned int dropped;
+    size_t nwritten;
+    size_t i;
+
+    if (!virAtomicIntGet(&virLogQueueEnabled))
+        return;
+
+    if (virLogNbOutputs)
+        ignore_value(VIR_ALLOC_N_QUIET(batch, virLogNbOutputs));
+
+    do {
+        for (nwritten = 0;
+             nwritten < VIR_LOG_QUEUE_BATCH && (entry = virLogQueuePeek());
+             nwritten++) {
+            unsigned int pos = virLogQueueTail;
+
+            virLogOutputMessageLocked(entry->source, entry->priority,
+                                      entry->filename, entry->linenr,
+                                      entry->funcname, entry->timestamp,
+                                      NULL, entry->flags, entry->str,
+                                      entry->msg, batch);
+            VIR_FREE(entry->str);
+            VIR_FREE(entry->msg);
+
+            /* Hand the slot over to producers of the next lap */
+            virAtomicIntSet(&entry->seq, (int) (pos + virLogQueueMask + 1));
+            virAtomicIntSet(&virLogQueueTail, (int) (pos + 1));
+        }
+
+        for (i = 0; batch && i < virLogNbOutputs; i++)
+            virLogOutputBatchFlush(virLogOutputs[i], &batch[i]);
+
+        virLogQueueWritten += nwritten;
+    } while (all && entry);
+
+    VIR_FREE(batch);
+
+    dropped = virAtomicIntGet(&virLogQueueDropped);
+    if (dropped != virLogQueueDroppedReported) {
+        char timestamp[VIR_TIME_STRING_BUFLEN];
+        char *str = NULL;
+        char *msg = NULL;
+
+        if (virTimeStringNowRaw(timestamp) < 0)
+            timestamp[0] = '\0';
+
+        if (virAsprintfQuiet(&str, "log queue is full, dropped %u messages "
+                             "(%u dropped, %llu written in total)",
+                             dropped - virLogQueueDroppedReported, dropped,
+                             virLogQueueWritten) >= 0 &&
+            virLogFormatString(&msg, __LINE__, __func__, VIR_LOG_WARN, str) >= 0)
+            virLogOutputMessageLocked(&virLogSelf, VIR_LOG_WARN,
+                                      __FILE__, __LINE__, __func__,
+                                      timestamp, NULL, 0, str, msg, NULL);
+
+        VIR_FREE(str);
+        VIR_FREE(msg);
+        virLogQueueDroppedReported = dropped;
+    }
+}
+
+
+static void
+virLogQueueWriter(void *opaque ATTRIBUTE_UNUSED)
+{
+    unsigned long long now;
+
+    for (;;) {
+        virLogLock();
+        if (!virAtomicIntGet(&virLogQueueEnabled)) {
+            virLogUnlock();
+            return;
+        }
+        virLogQueueDrainLocked(false);
+        virLogUnlock();
+
+        /* Producers only signal when they see virLogQueueWaiting set,
+         * so check for messages once more after setting it. The timeout
+         * is a mere safety net */
+        virMutexLock(&virLogQueueMutex);
+        virAtomicIntSet(&virLogQueueWaiting, 1);
+        if (!virLogQueuePeek() && virTimeMillisNowRaw(&now) == 0)
+            ignore_value(virCondWaitUntil(&virLogQueueCond,
+                                          &virLogQueueMutex, now + 1000));
+        virAtomicIntSet(&virLogQueueWaiting, 0);
+        virMutexUnlock(&virLogQueueMutex);
+    }
+}
+
+
+/*
+ * Write out everything queued so far.
+ *
+ * In a child process forked while the queue was in use there is no
+ * writer thread, and the queued messages belong to the parent, so the
+ * queue is abandoned and messages are written right away from then on.
+ *
+ * Must be called with virLogLock held.
+ */
+static void
+virLogQueueResetLocked(void)
+{
+    if (!virLogQueue)
+        return;
+
+    if (virLogQueuePid == getpid())
+        virLogQueueDrainLocked(true);
+    else
+        virAtomicIntSet(&virLogQueueEnabled, 0);
+}
+
+
+/**
+ * virLogSetQueueSize:
+ * @size: number of messages the queue can hold, 0 to keep writing
+ *        messages synchronously
+ *
+ * Makes debug and info messages be written by a dedicated thread rather
+ * than by the thread emitting them. Up to @size (rounded up to a power
+ * of two) messages can wait to be written, further ones are dropped and
+ * counted until there is room again. Warnings and errors are always
+ * written synchronously, after any queued messages.
+ *
+ * The queue can be set up only once per process.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLogSetQueueSize(unsigned int size)
+{
+    virLogQueueEntryPtr queue = NULL;
+    unsigned int nslots = 1;
+    size_t i;
+    int saved_errno;
+
+    if (virLogInitialize() < 0)
+        return -1;
+
+    if (size == 0)
+        return 0;
+
+    if (size > VIR_LOG_QUEUE_SIZE_MAX) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("log queue size %u exceeds maximum %u"),
+                       size, VIR_LOG_QUEUE_SIZE_MAX);
+        return -1;
+    }
+
+    while (nslots < size)
+        nslots <<= 1;
+
+    if (VIR_ALLOC_N(queue, nslots) < 0)
+        return -1;
+
+    for (i = 0; i < nslots; i++)
+        queue[i].seq = i;
+
+    /* Errors can only be reported with virLogLock released */
+    virLogLock();
+    if (virLogQueue) {
+        virLogUnlock();
+        VIR_FREE(queue);
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("log queue is already set up"));
+        return -1;
+    }
+
+    virLogQueue = queue;
+    virLogQueueMask = nslots - 1;
+    virLogQueuePid = getpid();
+
+    if (virThreadCreate(&virLogQueueThread, false,
+                        virLogQueueWriter, NULL) < 0) {
+        saved_errno = errno;
+        virLogQueue = NULL;
+        virLogUnlock();
+        VIR_FREE(queue);
+        virReportSystemError(saved_errno, "%s",
+                             _("Unable to create log writer thread"));
+        return -1;
+    }
+
+    virAtomicIntSet(&virLogQueueEnabled, 1);
     virLogUnlock();
+
+    return 0;
 }
 
+
+/**
+ * virLogFlush:
+ *
+ * Write out all messages waiting in the log queue, if it is in use.
+ */
+void
+virLogFlush(void)
+{
+    if (virLogInitialize() < 0)
+        return;
+
+    virLogLock();
+    virLogQueueDrainLocked(true);
+    virLogUnlock();
+}
+
+
 /**
  * virLogMessage:
  * @source: where is that message coming from
@@ -566,14 +1130,13 @@ virLogVMessage(virLogSourcePtr source,
                const char *fmt,
                va_list vargs)
 {
-    static bool logInitMessageStderr = true;
     char *str = NULL;
     char *msg = NULL;
     char timestamp[VIR_TIME_STRING_BUFLEN];
     int ret;
-    size_t i;
     int saved_errno = errno;
     unsigned int filterflags = 0;
+    int memprio;
 
     if (virLogInitialize() < 0)
         return;
@@ -595,6 +1158,20 @@ virLogVMessage(virLogSourcePtr source,
         goto cleanup;
     filterflags = source->flags;
 
+    memprio = virAtomicIntGet(&virLogMemoryPriority);
+    if (memprio && priority >= memprio) {
+        va_list ap;
+
+        va_copy(ap, vargs);
+        virLogMemoryRecord(priority, funcname, linenr, fmt, ap);
+        va_end(ap);
+    }
+
+    /* Same as above, the worst case of reading this while outputs are
+     * being redefined is a message accidentally dropped or emitted */
+    if (priority < virLogOutputsPriority)
+        goto cleanup;
+
     /*
      * serialize the error message, add level and timestamp
      */
@@ -608,64 +1185,23 @@ virLogVMessage(virLogSourcePtr source,
     if (virTimeStringNowRaw(timestamp) < 0)
         timestamp[0] = '\0';
 
+    /* Messages which are likely to matter when something goes wrong
+     * are always written right away */
+    if (priority < VIR_LOG_WARN && !metadata &&
+        !(filterflags & VIR_LOG_STACK_TRACE) &&
+        virLogQueuePush(source, priority, filename, linenr, funcname,
+                        timestamp, filterflags, &str, &msg))
+        goto cleanup;
+
     virLogLock();
 
-    /*
-     * Push the message to the outputs defined, if none exist then
-     * use stderr.
-     */
-    for (i = 0; i < virLogNbOutputs; i++) {
-        if (priority >= virLogOutputs[i]->priority) {
-            if (virLogOutputs[i]->logInitMessage) {
-                const char *rawinitmsg;
-                char *hoststr = NULL;
-                char *initmsg = NULL;
-                if (virLogVersionString(&rawinitmsg, &initmsg) >= 0)
-                    virLogOutputs[i]->f(&virLogSelf, VIR_LOG_INFO,
-                                       __FILE__, __LINE__, __func__,
-                                       timestamp, NULL, 0, rawinitmsg, initmsg,
-                                       virLogOutputs[i]->data);
-                VIR_FREE(initmsg);
-                if (virLogHostnameString(&hoststr, &initmsg) >= 0)
-                    virLogOutputs[i]->f(&virLogSelf, VIR_LOG_INFO,
-                                       __FILE__, __LINE__, __func__,
-                                       timestamp, NULL, 0, hoststr, initmsg,
-                                       virLogOutputs[i]->data);
-                VIR_FREE(hoststr);
-                VIR_FREE(initmsg);
-                virLogOutputs[i]->logInitMessage = false;
-            }
-            virLogOutputs[i]->f(source, priority,
-                               filename, linenr, funcname,
-                               timestamp, metadata, filterflags,
-                               str, msg, virLogOutputs[i]->data);
-        }
-    }
-    if (virLogNbOutputs == 0) {
-        if (logInitMessageStderr) {
-            const char *rawinitmsg;
-            char *hoststr = NULL;
-            char *initmsg = NULL;
-            if (virLogVersionString(&rawinitmsg, &initmsg) >= 0)
-                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
-                                 __FILE__, __LINE__, __func__,
-                                 timestamp, NULL, 0, rawinitmsg, initmsg,
-                                 (void *) STDERR_FILENO);
-            VIR_FREE(initmsg);
-            if (virLogHostnameString(&hoststr, &initmsg) >= 0)
-                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
-                                 __FILE__, __LINE__, __func__,
-                                 timestamp, NULL, 0, hoststr, initmsg,
-                                 (void *) STDERR_FILENO);
-            VIR_FREE(hoststr);
-            VIR_FREE(initmsg);
-            logInitMessageStderr = false;
-        }
-        virLogOutputToFd(source, priority,
-                         filename, linenr, funcname,
-                         timestamp, metadata, filterflags,
-                         str, msg, (void *) STDERR_FILENO);
-    }
+    /* Keep the messages in order by writing the queued ones first */
+    virLogQueueDrainLocked(true);
+
+    virLogOutputMessageLocked(source, priority, filename, linenr, funcname,
+                              timestamp, metadata, filterflags, str, msg,
+                              NULL);
+
     virLogUnlock();
 
  cleanup:
@@ -765,6 +1301,233 @@ virLogNewOutputToFile(virLogPriority priority,
 }
 
 
+static void
+virLogMemoryRingRelease(void *data)
+{
+    virLogMemoryRingPtr ring = data;
+
+    virMutexLock(&virLogMemoryMutex);
+    ring->inuse = false;
+    virMutexUnlock(&virLogMemoryMutex);
+}
+
+
+/* The ring of the calling thread, NULL if it cannot be allocated */
+static virLogMemoryRingPtr
+virLogMemoryGetRing(void)
+{
+    virLogMemoryRingPtr ring;
+    size_t i;
+
+    if ((ring = virThreadLocalGet(&virLogMemoryRingLocal)))
+        return ring;
+
+    virMutexLock(&virLogMemoryMutex);
+    for (i = 0; i < virLogMemoryNRings; i++) {
+        if (!virLogMemoryRings[i]->inuse) {
+            ring = virLogMemoryRings[i];
+            break;
+        }
+    }
+
+    if (!ring) {
+        if (VIR_ALLOC_QUIET(ring) < 0)
+            goto cleanup;
+
+        if (virMutexInit(&ring->lock) < 0) {
+            VIR_FREE(ring);
+            goto cleanup;
+        }
+
+        if (VIR_APPEND_ELEMENT_COPY_QUIET(virLogMemoryRings,
+                                          virLogMemoryNRings, ring) < 0) {
+            virMutexDestroy(&ring->lock);
+            VIR_FREE(ring);
+            goto cleanup;
+        }
+    }
+
+    if (virThreadLocalSet(&virLogMemoryRingLocal, ring) < 0) {
+        ring = NULL;
+        goto cleanup;
+    }
+
+    ring->inuse = true;
+    ring->thread = virThreadSelfID();
+
+ cleanup:
+    virMutexUnlock(&virLogMemoryMutex);
+    return ring;
+}
+
+
+static void
+virLogMemoryRecord(virLogPriority priority,
+                   const char *funcname,
+                   int linenr,
+                   const char *fmt,
+                   va_list vargs)
+{
+    virLogMemoryRingPtr ring;
+    virLogMemoryEntryPtr entry;
+
+    if (!(ring = virLogMemoryGetRing()))
+        return;
+
+    virMutexLock(&ring->lock);
+    entry = &ring->entries[ring->next % VIR_LOG_MEMORY_ENTRIES];
+    if (virTimeMicrosNowRaw(&entry->when) < 0)
+        entry->when = 0;
+    entry->thread = ring->thread;
+    entry->seq = ring->next++;
+    entry->priority = priority;
+    entry->funcname = funcname;
+    entry->linenr = linenr;
+    if (vsnprintf(entry->text, sizeof(entry->text), fmt, vargs) < 0)
+        entry->text[0] = '\0';
+    virMutexUnlock(&ring->lock);
+}
+
+
+static int
+virLogMemoryEntryCompare(const void *a,
+                         const void *b)
+{
+    const virLogMemoryEntry *ea = a;
+    const virLogMemoryEntry *eb = b;
+
+    if (ea->when != eb->when)
+        return ea->when < eb->when ? -1 : 1;
+    if (ea->thread != eb->thread)
+        return ea->thread < eb->thread ? -1 : 1;
+    if (ea->seq != eb->seq)
+        return ea->seq < eb->seq ? -1 : 1;
+    return 0;
+}
+
+
+static int
+virLogMemoryEntryFormat(const virLogMemoryEntry *entry,
+                        char *buf,
+                        size_t buflen)
+{
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+
+    if (virTimeStringThenRaw(entry->when / 1000, timestamp) < 0)
+        timestamp[0] = '\0';
+
+    return snprintf(buf, buflen, "%s: %llu: %s : %s:%d : %s\n",
+                    timestamp, entry->thread,
+                    virLogPriorityString(entry->priority),
+                    NULLSTR(entry->funcname), entry->linenr, entry->text);
+}
+
+
+/**
+ * virLogDumpMemory:
+ * @maxlen: upper limit on the length of the returned string
+ *
+ * Collects the messages recorded by the memory output of all threads,
+ * ordered by the time they were emitted and formatted the same way as
+ * messages written to a file. If they do not fit into @maxlen bytes the
+ * oldest messages are left out.
+ *
+ * Returns the messages, or NULL on error.
+ */
+char *
+virLogDumpMemory(size_t maxlen)
+{
+    virLogMemoryEntryPtr entries = NULL;
+    size_t nentries = 0;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char line[VIR_LOG_MEMORY_TEXT_MAX + 256];
+    char *ret = NULL;
+    size_t len = 0;
+    size_t first;
+    size_t i;
+    int rc;
+
+    if (virLogInitialize() < 0)
+        return NULL;
+
+    /* Errors can only be reported with virLogMemoryMutex released */
+    virMutexLock(&virLogMemoryMutex);
+    if (VIR_ALLOC_N_QUIET(entries,
+                          virLogMemoryNRings * VIR_LOG_MEMORY_ENTRIES) < 0) {
+        virMutexUnlock(&virLogMemoryMutex);
+        virReportOOMError();
+        return NULL;
+    }
+
+    for (i = 0; i < virLogMemoryNRings; i++) {
+        virLogMemoryRingPtr ring = virLogMemoryRings[i];
+        size_t n;
+
+        virMutexLock(&ring->lock);
+        n = MIN(ring->next, VIR_LOG_MEMORY_ENTRIES);
+        memcpy(entries + nentries, ring->entries, n * sizeof(*entries));
+        nentries += n;
+        virMutexUnlock(&ring->lock);
+    }
+    virMutexUnlock(&virLogMemoryMutex);
+
+    qsort(entries, nentries, sizeof(*entries), virLogMemoryEntryCompare);
+
+    /* Find the oldest message which still fits */
+    for (first = nentries; first > 0; first--) {
+        if ((rc = virLogMemoryEntryFormat(&entries[first - 1],
+                                          line, sizeof(line))) < 0)
+            continue;
+        if (len + MIN(rc, sizeof(line) - 1) > maxlen)
+            break;
+        len += MIN(rc, sizeof(line) - 1);
+    }
+
+    for (i = first; i < nentries; i++) {
+        if (virLogMemoryEntryFormat(&entries[i], line, sizeof(line)) >= 0)
+            virBufferAdd(&buf, line, -1);
+    }
+
+    VIR_FREE(entries);
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    if (!virBufferUse(&buf)) {
+        ignore_value(VIR_STRDUP(ret, ""));
+        return ret;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+static void
+virLogOutputToMemory(virLogSourcePtr source ATTRIBUTE_UNUSED,
+                     virLogPriority priority ATTRIBUTE_UNUSED,
+                     const char *filename ATTRIBUTE_UNUSED,
+                     int linenr ATTRIBUTE_UNUSED,
+                     const char *funcname ATTRIBUTE_UNUSED,
+                     const char *timestamp ATTRIBUTE_UNUSED,
+                     virLogMetadataPtr metadata ATTRIBUTE_UNUSED,
+                     unsigned int flags ATTRIBUTE_UNUSED,
+                     const char *rawstr ATTRIBUTE_UNUSED,
+                     const char *str ATTRIBUTE_UNUSED,
+                     void *data ATTRIBUTE_UNUSED)
+{
+    /* Messages are recorded by virLogMemoryRecord before they are
+     * formatted for the other outputs */
+}
+
+
+static virLogOutputPtr
+virLogNewOutputToMemory(virLogPriority priority)
+{
+    return virLogOutputNew(virLogOutputToMemory, NULL, NULL,
+                           priority, VIR_LOG_TO_MEMORY, NULL);
+}
+
+
 #if HAVE_SYSLOG_H || USE_JOURNALD
 
 /* Compat in case we build with journald, but no syslog */
@@ -1456,6 +2219,7 @@ virLogFindOutput(virLogOutputPtr *outputs, size_t noutputs,
 int
 virLogDefineOutputs(virLogOutputPtr *outputs, size_t noutputs)
 {
+    size_t i;
 #if HAVE_SYSLOG_H
     int id;
     char *tmp = NULL;
@@ -1465,6 +2229,7 @@ virLogDefineOutputs(virLogOutputPtr *outputs, size_t noutputs)
         return -1;
 
     virLogLock();
+    virLogQueueResetLocked();
     virLogResetOutputs();
 
 #if HAVE_SYSLOG_H
@@ -1488,6 +2253,15 @@ virLogDefineOutputs(virLogOutputPtr *outputs, size_t noutputs)
     virLogOutputs = outputs;
     virLogNbOutputs = noutputs;
 
+    if (noutputs)
+        virLogOutputsPriority = VIR_LOG_ERROR + 1;
+    for (i = 0; i < noutputs; i++) {
+        if (outputs[i]->dest == VIR_LOG_TO_MEMORY)
+            virAtomicIntSet(&virLogMemoryPriority, outputs[i]->priority);
+        else if (outputs[i]->priority < virLogOutputsPriority)
+            virLogOutputsPriority = outputs[i]->priority;
+    }
+
     virLogUnlock();
     return 0;
 }
@@ -1514,6 +2288,7 @@ virLogDefineFilters(virLogFilterPtr *filters, size_t nfilters)
     virLogResetFilters();
     virLogFilters = filters;
     virLogNbFilters = nfilters;
+    virLogSourcesUpdateLocked();
     virLogUnlock();
 
     return 0;
@@ -1582,7 +2357,8 @@ virLogParseOutput(const char *src)
     }
 
     if (((dest == VIR_LOG_TO_STDERR ||
-          dest == VIR_LOG_TO_JOURNALD) && count != 2) ||
+          dest == VIR_LOG_TO_JOURNALD ||
+          dest == VIR_LOG_TO_MEMORY) && count != 2) ||
         ((dest == VIR_LOG_TO_FILE ||
           dest == VIR_LOG_TO_SYSLOG) && count != 3)) {
         virReportError(VIR_ERR_INVALID_ARG,
@@ -1619,6 +2395,9 @@ virLogParseOutput(const char *src)
         ret = virLogNewOutputToJournald(prio);
 #endif
         break;
+    case VIR_LOG_TO_MEMORY:
+        ret = virLogNewOutputToMemory(prio);
+        break;
     case VIR_LOG_TO_OUTPUT_LAST:
         break;
     }
@@ -55,17 +55,24 @@ typedef enum {
     VIR_LOG_TO_SYSLOG,
     VIR_LOG_TO_FILE,
     VIR_LOG_TO_JOURNALD,
+    VIR_LOG_TO_MEMORY,
     VIR_LOG_TO_OUTPUT_LAST,
 } virLogDestination;
 
+/* Number of messages and their maximum length kept by every thread for
+ * the memory output, longer messages are truncated */
+# define VIR_LOG_MEMORY_ENTRIES 1024
+# define VIR_LOG_MEMORY_TEXT_MAX 256
+
 typedef struct _virLogSource virLogSource;
 typedef virLogSource *virLogSourcePtr;
 
 struct _virLogSource {
     const char *name;
-    unsigned int priority;
+    unsigned int priority; /* 0 until the source logged for the first time */
     unsigned int serial;
     unsigned int flags;
+    virLogSourcePtr next;
 };
 
 /*
@@ -76,11 +83,29 @@ struct _virLogSource {
 # define VIR_LOG_INIT(n)                                \
     static ATTRIBUTE_UNUSED virLogSource virLogSelf = { \
         .name = "" n "",                                \
-        .priority = VIR_LOG_ERROR,                      \
+        .priority = 0,                                  \
         .serial = 0,                                    \
         .flags = 0,                                     \
+        .next = NULL,                                   \
     };
 
+/*
+ * Whether a message of @prio from @src can pass the filters. This is
+ * checked inline before any of the arguments of the message are evaluated
+ * and is intentionally not thread safe, the priority of every source which
+ * logged once is updated as soon as filters change, the worst case is a
+ * message accidentally emitted or dropped while that happens.
+ */
+# define VIR_LOG_SOURCE_ENABLED(src, prio)                              \
+    ((unsigned int) (prio) >= (src)->priority)
+
+# define VIR_LOG_MESSAGE_INT(src, prio, filename, linenr, funcname, ...) \
+    do {                                                                \
+        if (VIR_LOG_SOURCE_ENABLED(src, prio))                          \
+            virLogMessage(src, prio, filename, linenr, funcname, NULL,  \
+                          __VA_ARGS__);                                 \
+    } while (0)
+
 /*
  * If configured with --enable-debug=yes then library calls
  * are printed to stderr for debugging or to an appropriate channel
@@ -88,7 +113,8 @@ struct _virLogSource {
  */
 # ifdef ENABLE_DEBUG
 #  define VIR_DEBUG_INT(src, filename, linenr, funcname, ...)           \
-    virLogMessage(src, VIR_LOG_DEBUG, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_MESSAGE_INT(src, VIR_LOG_DEBUG, filename, linenr, funcname, \
+                        __VA_ARGS__)
 # else
 /**
  * virLogEatParams:
@@ -105,11 +131,14 @@ static inline void virLogEatParams(virLogSourcePtr unused, ...)
 # endif /* !ENABLE_DEBUG */
 
 # define VIR_INFO_INT(src, filename, linenr, funcname, ...)             \
-    virLogMessage(src, VIR_LOG_INFO, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_MESSAGE_INT(src, VIR_LOG_INFO, filename, linenr, funcname,  \
+                        __VA_ARGS__)
 # define VIR_WARN_INT(src, filename, linenr, funcname, ...)             \
-    virLogMessage(src, VIR_LOG_WARN, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_MESSAGE_INT(src, VIR_LOG_WARN, filename, linenr, funcname,  \
+                        __VA_ARGS__)
 # define VIR_ERROR_INT(src, filename, linenr, funcname, ...)            \
-    virLogMessage(src, VIR_LOG_ERROR, filename, linenr, funcname, NULL, __VA_ARGS__)
+    VIR_LOG_MESSAGE_INT(src, VIR_LOG_ERROR, filename, linenr, funcname, \
+                        __VA_ARGS__)
 
 # define VIR_DEBUG(...)                                                 \
     VIR_DEBUG_INT(&virLogSelf, __FILE__, __LINE__, __func__, __VA_ARGS__)
@@ -191,6 +220,9 @@ int virLogSetOutputs(const char *outputs);
 int virLogSetFilters(const char *filters);
 char *virLogGetDefaultOutput(void);
 int virLogSetDefaultOutput(const char *fname, bool godaemon, bool privileged);
+int virLogSetQueueSize(unsigned int size);
+void virLogFlush(void);
+char *virLogDumpMemory(size_t maxlen);
 
 /*
  * Internal logging API
@@ -23,6 +23,7 @@
 #include <config.h>
 
 #include "virnetdev.h"
+#include "virnetdevbridge.h"
 #include "virnetlink.h"
 #include "virmacaddr.h"
 #include "virfile.h"
@@ -995,6 +996,116 @@ virNetDevGetMaster(const char *ifname ATTRIBUTE_UNUSED,
 #endif /* defined(__linux__) && defined(HAVE_LIBNL) */
 
 
+/**
+ * virNetDevSetupLink:
+ * @ifname: name of the interface to configure
+ * @setup: the settings to apply
+ *
+ * Apply all the settings in @setup to @ifname. With netlink, they are
+ * all sent in a single request instead of one ioctl (each needing its
+ * own socket) per setting. The kernel applies the MAC address and MTU
+ * before attaching the interface to @setup->master, so e.g. a bridge
+ * never sees the random MAC address a tap device was created with.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+#if defined(__linux__) && defined(HAVE_LIBNL)
+int
+virNetDevSetupLink(const char *ifname,
+                   const virNetDevLinkSetup *setup)
+{
+    struct nl_msg *nl_msg;
+    struct nlmsghdr *resp = NULL;
+    unsigned int recvbuflen;
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    int masterIndex;
+    int errCode;
+    int ret = -1;
+
+    if (setup->setOnline) {
+        ifinfo.ifi_change = IFF_UP;
+        if (setup->online)
+            ifinfo.ifi_flags = IFF_UP;
+    }
+
+    if (setup->master && virNetDevGetIndex(setup->master, &masterIndex) < 0)
+        return -1;
+
+    if (!(nl_msg = nlmsg_alloc_simple(RTM_SETLINK, NLM_F_REQUEST))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0)
+        goto buffer_too_small;
+
+    if (nla_put(nl_msg, IFLA_IFNAME, strlen(ifname) + 1, ifname) < 0)
+        goto buffer_too_small;
+
+    if (setup->mac &&
+        nla_put(nl_msg, IFLA_ADDRESS, VIR_MAC_BUFLEN, setup->mac) < 0)
+        goto buffer_too_small;
+
+    if (setup->mtu && nla_put_u32(nl_msg, IFLA_MTU, setup->mtu) < 0)
+        goto buffer_too_small;
+
+    if (setup->master && nla_put_u32(nl_msg, IFLA_MASTER, masterIndex) < 0)
+        goto buffer_too_small;
+
+    if (virNetlinkCommand(nl_msg, &resp, &recvbuflen, 0, 0,
+                          NETLINK_ROUTE, 0) < 0)
+        goto cleanup;
+
+    if ((errCode = virNetlinkGetErrorCode(resp, recvbuflen)) < 0) {
+        if (setup->master)
+            virReportSystemError(-errCode,
+                                 _("Unable to set up interface %s on bridge %s"),
+                                 ifname, setup->master);
+        else
+            virReportSystemError(-errCode,
+                                 _("Unable to set up interface %s"), ifname);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    nlmsg_free(nl_msg);
+    VIR_FREE(resp);
+    return ret;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    goto cleanup;
+}
+
+
+#else
+
+
+int
+virNetDevSetupLink(const char *ifname,
+                   const virNetDevLinkSetup *setup)
+{
+    if (setup->mac && virNetDevSetMAC(ifname, setup->mac) < 0)
+        return -1;
+
+    if (setup->mtu && virNetDevSetMTU(ifname, setup->mtu) < 0)
+        return -1;
+
+    if (setup->master && virNetDevBridgeAddPort(setup->master, ifname) < 0)
+        return -1;
+
+    if (setup->setOnline && virNetDevSetOnline(ifname, setup->online) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+#endif /* defined(__linux__) && defined(HAVE_LIBNL) */
+
+
 #if defined(SIOCGIFVLAN) && defined(HAVE_STRUCT_IFREQ) && HAVE_DECL_GET_VLAN_VID_CMD
 int virNetDevGetVLanID(const char *ifname, int *vlanid)
 {
@@ -146,6 +146,17 @@ struct _virNetDevCoalesce {
     uint32_t rate_sample_interval;
 };
 
+/* Link level settings applied together by virNetDevSetupLink */
+typedef struct _virNetDevLinkSetup virNetDevLinkSetup;
+typedef virNetDevLinkSetup *virNetDevLinkSetupPtr;
+struct _virNetDevLinkSetup {
+    const virMacAddr *mac;  /* MAC address to set, NULL to keep */
+    unsigned int mtu;       /* MTU to set, 0 to keep */
+    const char *master;     /* bridge to attach to, NULL for none */
+    bool setOnline;         /* whether to change the link state */
+    bool online;            /* the link state to set if @setOnline */
+};
+
 
 int virNetDevSetupControl(const char *ifname,
                           virIfreq *ifr)
@@ -207,6 +218,10 @@ int virNetDevGetVLanID(const char *ifname, int *vlanid)
 int virNetDevGetMaster(const char *ifname, char **master)
    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
+int virNetDevSetupLink(const char *ifname,
+                       const virNetDevLinkSetup *setup)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
 int virNetDevValidateConfig(const char *ifname,
                             const virMacAddr *macaddr, int ifindex)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2009-2015 Red Hat, Inc.
+ * Copyright (C) 2009-2015, 2017 Red Hat, Inc.
  *
  * This library is free software; you can redistribute it and/or
  * modify it under the terms of the GNU Lesser General Public
@@ -27,11 +27,56 @@
 #include "vircommand.h"
 #include "viralloc.h"
 #include "virerror.h"
+#include "virfile.h"
+#include "virnetdev.h"
+#include "virnetlink.h"
 #include "virstring.h"
+#include "virthread.h"
 #include "virutil.h"
 
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <linux/if_ether.h>
+# include <linux/pkt_cls.h>
+# include <linux/pkt_sched.h>
+# include <linux/rtnetlink.h>
+#endif
+
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+/* Traffic control objects are identified by a 16 bit major and minor
+ * number, written as "major:minor" by tc(8). */
+#define VIR_TC_HANDLE(maj, min) ((((uint32_t) (maj)) << 16) | (min))
+#define VIR_TC_HANDLE_MAJOR(handle) ((handle) >> 16)
+#define VIR_TC_HANDLE_MINOR(handle) ((handle) & 0xffff)
+
+#define VIR_TC_ROOT 0xffffffffU
+#define VIR_TC_INGRESS 0xfffffff1U
+#define VIR_TC_INGRESS_HANDLE VIR_TC_HANDLE(0xffff, 0)
+
+typedef struct _virNetDevBandwidthTCOp virNetDevBandwidthTCOp;
+typedef virNetDevBandwidthTCOp *virNetDevBandwidthTCOpPtr;
+struct _virNetDevBandwidthTCOp {
+#if defined(__linux__) && defined(HAVE_LIBNL)
+    struct nl_msg *msg;
+#else
+    virCommandPtr cmd;
+#endif
+    bool ignoreErrors; /* failure of the operation is not fatal */
+};
+
+/* Traffic control operations to be done on a single interface. They
+ * are queued by the virNetDevBandwidthTC* helpers below and executed
+ * all at once by virNetDevBandwidthTCCommit. */
+typedef struct _virNetDevBandwidthTC virNetDevBandwidthTC;
+typedef virNetDevBandwidthTC *virNetDevBandwidthTCPtr;
+struct _virNetDevBandwidthTC {
+    const char *ifname;
+    int ifindex;
+
+    size_t nops;
+    virNetDevBandwidthTCOpPtr ops;
+};
+
 void
 virNetDevBandwidthFree(virNetDevBandwidthPtr def)
 {
@@ -43,9 +88,8 @@ virNetDevBandwidthFree(virNetDevBandwidthPtr def)
     VIR_FREE(def);
 }
 
-static void
-virNetDevBandwidthCmdAddOptimalQuantum(virCommandPtr cmd,
-                                       const virNetDevBandwidthRate *rate)
+static unsigned long long
+virNetDevBandwidthOptimalQuantum(const virNetDevBandwidthRate *rate)
 {
     const unsigned long long mtu = 1500;
     unsigned long long r2q;
@@ -62,13 +106,887 @@ virNetDevBandwidthCmdAddOptimalQuantum(virCommandPtr cmd,
     if (!r2q)
         r2q = 1;
 
+    return r2q;
+}
+
+static void
+virNetDevBandwidthTCReset(virNetDevBandwidthTCPtr tc)
+{
+    size_t i;
+
+    for (i = 0; i < tc->nops; i++) {
+#if defined(__linux__) && defined(HAVE_LIBNL)
+        nlmsg_free(tc->ops[i].msg);
+#else
+        virCommandFree(tc->ops[i].cmd);
+#endif
+    }
+    VIR_FREE(tc->ops);
+    tc->nops = 0;
+}
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+/* Number of entries in the rate tables passed to the kernel */
+# define VIR_TC_RTAB_SIZE 256
+
+# define VIR_TC_FILTER_INFO(prio, protocol) \
+    ((((uint32_t) (prio)) << 16) | htons(protocol))
+
+/* Burst sizes and rate tables are expressed in packet scheduler
+ * ticks. See virNetDevBandwidthOnceInit. */
+static double tickInUsec;
+static unsigned int clockHz;
+
+static int
+virNetDevBandwidthOnceInit(void)
+{
+    const char *path = "/proc/net/psched";
+    char *buf = NULL;
+    char *tmp;
+    unsigned int t2us;
+    unsigned int us2t;
+    unsigned int clockRes;
+    int ret = -1;
+
+    /* Learn the length of a tick the same way tc(8) does */
+    if (virFileReadAll(path, 1024, &buf) < 0)
+        return -1;
+
+    if (virStrToLong_ui(buf, &tmp, 16, &t2us) < 0 ||
+        virStrToLong_ui(tmp, &tmp, 16, &us2t) < 0 ||
+        virStrToLong_ui(tmp, &tmp, 16, &clockRes) < 0 ||
+        virStrToLong_ui(tmp, &tmp, 16, &clockHz) < 0 ||
+        !us2t || !clockRes) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to parse '%s'"), path);
+        goto cleanup;
+    }
+
+    /* Kernels running at nanosecond resolution advertise a tick
+     * multiplier of 1000 for the sake of old binaries, which really
+     * is 1. */
+    if (clockRes == 1000000000)
+        t2us = us2t;
+
+    tickInUsec = (double) t2us / us2t * clockRes / 1000000;
+
+    if (clockRes != 1000000)
+        clockHz = 100;
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetDevBandwidth)
+
+/* Ticks it takes to send @size bytes at @rate bytes per second */
+static unsigned int
+virNetDevBandwidthXmitTime(unsigned long long rate,
+                           unsigned int size)
+{
+    unsigned int usec = 1000000 * ((double) size / rate);
+
+    return usec * tickInUsec;
+}
+
+static void
+virNetDevBandwidthRateTable(struct tc_ratespec *spec,
+                            uint32_t *rtab,
+                            unsigned long long rate,
+                            unsigned int mtu)
+{
+    int cellLog = 0;
+    size_t i;
+
+    spec->rate = MIN(rate, UINT_MAX);
+
+    while ((mtu >> cellLog) >= VIR_TC_RTAB_SIZE)
+        cellLog++;
+
+    for (i = 0; i < VIR_TC_RTAB_SIZE; i++)
+        rtab[i] = virNetDevBandwidthXmitTime(spec->rate, (i + 1) << cellLog);
+
+    spec->cell_log = cellLog;
+    spec->cell_align = -1;
+# ifdef TC_LINKLAYER_MASK
+    spec->linklayer = TC_LINKLAYER_ETHERNET;
+# endif
+}
+
+static int
+virNetDevBandwidthTCInit(virNetDevBandwidthTCPtr tc,
+                         const char *ifname)
+{
+    memset(tc, 0, sizeof(*tc));
+    tc->ifname = ifname;
+
+    if (virNetDevBandwidthInitialize() < 0 ||
+        virNetDevGetIndex(ifname, &tc->ifindex) < 0)
+        return -1;
+
+    return 0;
+}
+
+static struct nl_msg *
+virNetDevBandwidthTCNewMsg(virNetDevBandwidthTCPtr tc,
+                           int type,
+                           int flags,
+                           uint32_t parent,
+                           uint32_t handle,
+                           uint32_t info,
+                           const char *kind)
+{
+    struct nl_msg *msg;
+    struct tcmsg tcm = {
+        .tcm_family = AF_UNSPEC,
+        .tcm_ifindex = tc->ifindex,
+        .tcm_parent = parent,
+        .tcm_handle = handle,
+        .tcm_info = info,
+    };
+
+    if (!(msg = nlmsg_alloc_simple(type, NLM_F_REQUEST | flags))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (nlmsg_append(msg, &tcm, sizeof(tcm), NLMSG_ALIGNTO) < 0 ||
+        (kind && nla_put_string(msg, TCA_KIND, kind) < 0)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        nlmsg_free(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+static int
+virNetDevBandwidthTCBufferTooSmall(struct nl_msg *msg)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    nlmsg_free(msg);
+    return -1;
+}
+
+static int
+virNetDevBandwidthTCAppend(virNetDevBandwidthTCPtr tc,
+                           struct nl_msg *msg,
+                           bool ignoreErrors)
+{
+    virNetDevBandwidthTCOp op = { .msg = msg, .ignoreErrors = ignoreErrors };
+
+    if (VIR_APPEND_ELEMENT(tc->ops, tc->nops, op) < 0) {
+        nlmsg_free(msg);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * virNetDevBandwidthTCCommit:
+ * @tc: queued operations
+ *
+ * Execute all the operations queued on @tc within one netlink
+ * transaction. The kernel carries on with the remaining requests
+ * when one of them fails, which is what the optional ones (e.g.
+ * removing a qdisc that might not exist) rely on.
+ *
+ * Returns 0 on success, -1 (with error reported) if any of the
+ * operations that are not allowed to fail did.
+ */
+static int
+virNetDevBandwidthTCCommit(virNetDevBandwidthTCPtr tc)
+{
+    struct nl_msg **msgs = NULL;
+    int *errors = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (!tc->nops)
+        return 0;
+
+    if (VIR_ALLOC_N(msgs, tc->nops) < 0 ||
+        VIR_ALLOC_N(errors, tc->nops) < 0)
+        goto cleanup;
+
+    for (i = 0; i < tc->nops; i++)
+        msgs[i] = tc->ops[i].msg;
+
+    if (virNetlinkCommandBatch(msgs, tc->nops, errors, NETLINK_ROUTE) < 0)
+        goto cleanup;
+
+    for (i = 0; i < tc->nops; i++) {
+        if (!errors[i] || tc->ops[i].ignoreErrors)
+            continue;
+
+        switch (nlmsg_hdr(tc->ops[i].msg)->nlmsg_type) {
+        case RTM_NEWQDISC:
+            virReportSystemError(-errors[i],
+                                 _("Unable to set qdisc on interface '%s'"),
+                                 tc->ifname);
+            break;
+        case RTM_NEWTCLASS:
+            virReportSystemError(-errors[i],
+                                 _("Unable to set traffic class "
+                                   "on interface '%s'"),
+                                 tc->ifname);
+            break;
+        default:
+            virReportSystemError(-errors[i],
+                                 _("Unable to set traffic filter "
+                                   "on interface '%s'"),
+                                 tc->ifname);
+            break;
+        }
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(errors);
+    VIR_FREE(msgs);
+    return ret;
+}
+
+static int
+virNetDevBandwidthTCDelQdisc(virNetDevBandwidthTCPtr tc,
+                             uint32_t parent,
+                             uint32_t handle)
+{
+    struct nl_msg *msg;
+
+    if (!(msg = virNetDevBandwidthTCNewMsg(tc, RTM_DELQDISC, 0,
+                                           parent, handle, 0, NULL)))
+        return -1;
+
+    return virNetDevBandwidthTCAppend(tc, msg, true);
+}
+
+static int
+virNetDevBandwidthTCAddHTB(virNetDevBandwidthTCPtr tc,
+                           unsigned int defcls)
+{
+    struct tc_htb_glob glob = {
+        .version = TC_HTB_PROTOVER,
+        .rate2quantum = 10,
+        .defcls = defcls,
+    };
+    struct nl_msg *msg;
+    struct nlattr *opts;
+
+    if (!(msg = virNetDevBandwidthTCNewMsg(tc, RTM_NEWQDISC,
+                                           NLM_F_CREATE | NLM_F_EXCL,
+                                           VIR_TC_ROOT, VIR_TC_HANDLE(1, 0),
+                                           0, "htb")))
+        return -1;
+
+    if (!(opts = nla_nest_start(msg, TCA_OPTIONS)) ||
+        nla_put(msg, TCA_HTB_INIT, sizeof(glob), &glob) < 0)
+        return virNetDevBandwidthTCBufferTooSmall(msg);
+    nla_nest_end(msg, opts);
+
+    return virNetDevBandwidthTCAppend(tc, msg, false);
+}
+
+static int
+virNetDevBandwidthTCAddSFQ(virNetDevBandwidthTCPtr tc,
+                           uint32_t parent,
+                           uint32_t handle)
+{
+    struct tc_sfq_qopt opt = { .perturb_period = 10 };
+    struct nl_msg *msg;
+
+    if (!(msg = virNetDevBandwidthTCNewMsg(tc, RTM_NEWQDISC,
+                                           NLM_F_CREATE | NLM_F_EXCL,
+                                           parent, handle, 0, "sfq")))
+        return -1;
+
+    if (nla_put(msg, TCA_OPTIONS, sizeof(opt), &opt) < 0)
+        return virNetDevBandwidthTCBufferTooSmall(msg);
+
+    return virNetDevBandwidthTCAppend(tc, msg, false);
+}
+
+static int
+virNetDevBandwidthTCAddIngress(virNetDevBandwidthTCPtr tc)
+{
+    struct nl_msg *msg;
+
+    if (!(msg = virNetDevBandwidthTCNewMsg(tc, RTM_NEWQDISC,
+                                           NLM_F_CREATE | NLM_F_EXCL,
+                                           VIR_TC_INGRESS,
+                                           VIR_TC_INGRESS_HANDLE,
+                                           0, "ingress")))
+        return -1;
+
+    return virNetDevBandwidthTCAppend(tc, msg, false);
+}
+
+/**
+ * virNetDevBandwidthTCSetClass:
+ * @tc: queued operations
+ * @create: whether to create a new class or change an existing one
+ * @parent: parent of the class (ignored unless @create is true)
+ * @classid: ID of the class
+ * @rate: guaranteed rate in kbps
+ * @ceil: maximum rate in kbps, 0 meaning the same as @rate
+ * @burst: burst size in kb, 0 for the default
+ * @quantum: class quantum
+ *
+ * Queue creation or update of a HTB class. The parameters are
+ * encoded the way tc(8) encodes "htb rate @rate ceil @ceil burst
+ * @burst quantum @quantum".
+ */
+static int
+virNetDevBandwidthTCSetClass(virNetDevBandwidthTCPtr tc,
+                             bool create,
+                             uint32_t parent,
+                             uint32_t classid,
+                             unsigned long long rate,
+                             unsigned long long ceil,
+                             unsigned long long burst,
+                             unsigned long long quantum)
+{
+    const unsigned int mtu = 1600;
+    unsigned long long rateBytes = rate * 1000;
+    unsigned long long ceilBytes = (ceil ? ceil : rate) * 1000;
+    unsigned int buffer;
+    unsigned int cbuffer;
+    uint32_t rtab[VIR_TC_RTAB_SIZE];
+    uint32_t ctab[VIR_TC_RTAB_SIZE];
+    struct tc_htb_opt opt;
+    struct nl_msg *msg;
+    struct nlattr *opts;
+
+    /* The default burst is the smallest one the rate allows plus some
+     * safeguard space to make sure a whole packet fits */
+    buffer = burst ? burst * 1024 : rateBytes / clockHz + mtu;
+    cbuffer = ceilBytes / clockHz + mtu;
+
+    memset(&opt, 0, sizeof(opt));
+    virNetDevBandwidthRateTable(&opt.rate, rtab, rateBytes, mtu);
+    virNetDevBandwidthRateTable(&opt.ceil, ctab, ceilBytes, mtu);
+    opt.buffer = virNetDevBandwidthXmitTime(rateBytes, buffer);
+    opt.cbuffer = virNetDevBandwidthXmitTime(ceilBytes, cbuffer);
+    opt.quantum = quantum;
+
+    if (!(msg = virNetDevBandwidthTCNewMsg(tc, RTM_NEWTCLASS,
+                                           create ? NLM_F_CREATE | NLM_F_EXCL : 0,
+                                           create ? parent : 0, classid,
+                                           0, "htb")))
+        return -1;
+
+    if (!(opts = nla_nest_start(msg, TCA_OPTIONS)))
+        return virNetDevBandwidthTCBufferTooSmall(msg);
+
+# if HAVE_DECL_TCA_HTB_RATE64
+    if ((rateBytes > UINT_MAX &&
+         nla_put(msg, TCA_HTB_RATE64, sizeof(rateBytes), &rateBytes) < 0) ||
+        (ceilBytes > UINT_MAX &&
+         nla_put(msg, TCA_HTB_CEIL64, sizeof(ceilBytes), &ceilBytes) < 0))
+        return virNetDevBandwidthTCBufferTooSmall(msg);
+# endif
+
+    if (nla_put(msg, TCA_HTB_PARMS, sizeof(opt), &opt) < 0 ||
+        nla_put(msg, TCA_HTB_RTAB, sizeof(rtab), rtab) < 0 ||
+        nla_put(msg, TCA_HTB_CTAB, sizeof(ctab), ctab) < 0)
+        return virNetDevBandwidthTCBufferTooSmall(msg);
+    nla_nest_end(msg, opts);
+
+    return virNetDevBandwidthTCAppend(tc, msg, false);
+}
+
+static int
+virNetDevBandwidthTCDelClass(virNetDevBandwidthTCPtr tc,
+                             uint32_t classid)
+{
+    struct nl_msg *msg;
+
+    if (!(msg = virNetDevBandwidthTCNewMsg(tc, RTM_DELTCLASS, 0,
+                                           0, classid, 0, NULL)))
+        return -1;
+
+    return virNetDevBandwidthTCAppend(tc, msg, true);
+}
+
+static int
+virNetDevBandwidthTCAddFwFilter(virNetDevBandwidthTCPtr tc,
+                                uint32_t parent,
+                                unsigned int prio,
+                                uint32_t handle,
+                                uint32_t classid)
+{
+    struct nl_msg *msg;
+    struct nlattr *opts;
+
+    if (!(msg = virNetDevBandwidthTCNewMsg(tc, RTM_NEWTFILTER,
+                                           NLM_F_CREATE | NLM_F_EXCL,
+                                           parent, handle,
+                                           VIR_TC_FILTER_INFO(prio, ETH_P_ALL),
+                                           "fw")))
+        return -1;
+
+    if (!(opts = nla_nest_start(msg, TCA_OPTIONS)) ||
+        nla_put_u32(msg, TCA_FW_CLASSID, classid) < 0)
+        return virNetDevBandwidthTCBufferTooSmall(msg);
+    nla_nest_end(msg, opts);
+
+    return virNetDevBandwidthTCAppend(tc, msg, false);
+}
+
+/* u32 selector with room for the keys our filters use */
+typedef struct _virNetDevBandwidthU32Sel virNetDevBandwidthU32Sel;
+struct _virNetDevBandwidthU32Sel {
+    struct tc_u32_sel sel;
+    struct tc_u32_key keys[3];
+};
+
+/* Match the 32 bit word of the packet at offset @off (which must be
+ * aligned to 4 bytes) against @val under @mask */
+static void
+virNetDevBandwidthU32AddKey(virNetDevBandwidthU32Sel *u32,
+                            uint32_t val,
+                            uint32_t mask,
+                            int off)
+{
+    struct tc_u32_key *key = &u32->keys[u32->sel.nkeys++];
+
+    key->val = htonl(val & mask);
+    key->mask = htonl(mask);
+    key->off = off;
+    key->offmask = 0;
+}
+
+static int
+virNetDevBandwidthU32Put(struct nl_msg *msg,
+                         virNetDevBandwidthU32Sel *u32,
+                         uint32_t classid)
+{
+    /* Stop looking at other filters once the packet is classified */
+    u32->sel.flags |= TC_U32_TERMINAL;
+
+    if (nla_put(msg, TCA_U32_SEL,
+                sizeof(u32->sel) + u32->sel.nkeys * sizeof(u32->keys[0]),
+                u32) < 0 ||
+        nla_put_u32(msg, TCA_U32_CLASSID, classid) < 0)
+        return -1;
+
+    return 0;
+}
+
+/* The handle of a u32 filter is made of a hash table ID, a bucket
+ * and a node ID. The @id of a filter has always been formatted as
+ * "800::%u" for tc(8) which however parses the node ID as hex. Keep
+ * producing the very same handles so that filters created by older
+ * versions can still be found. */
+static int
+virNetDevBandwidthU32Handle(unsigned int id,
+                            uint32_t *handle)
+{
+    uint32_t node = 0;
+    unsigned int shift = 0;
+    unsigned int tmp;
+
+    for (tmp = id; tmp; tmp /= 10, shift += 4)
+        node |= (tmp % 10) << shift;
+
+    if (node > 0xfff) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid filter ID %u"), id);
+        return -1;
+    }
+
+    *handle = (0x800U << 20) | node;
+    return 0;
+}
+
+static int
+virNetDevBandwidthTCAddMacFilter(virNetDevBandwidthTCPtr tc,
+                                 unsigned int id,
+                                 const virMacAddr *mac,
+                                 uint32_t classid)
+{
+    virNetDevBandwidthU32Sel u32;
+    unsigned char raw[VIR_MAC_BUFLEN];
+    uint32_t handle;
+    struct nl_msg *msg;
+    struct nlattr *opts;
+
+    if (virNetDevBandwidthU32Handle(id, &handle) < 0)
+        return -1;
+
+    virMacAddrGetRaw(mac, raw);
+
+    /* Offsets are relative to the IP header: match the IPv4 ethertype
+     * and the source MAC address that precede it */
+    memset(&u32, 0, sizeof(u32));
+    virNetDevBandwidthU32AddKey(&u32, ETH_P_IP, 0xffff, -4);
+    virNetDevBandwidthU32AddKey(&u32,
+                                ((uint32_t) raw[2] << 24) | (raw[3] << 16) |
+                                (raw[4] << 8) | raw[5],
+                                0xffffffff, -12);
+    virNetDevBandwidthU32AddKey(&u32, (raw[0] << 8) | raw[1], 0xffff, -16);
+
+    if (!(msg = virNetDevBandwidthTCNewMsg(tc, RTM_NEWTFILTER,
+                                           NLM_F_CREATE | NLM_F_EXCL,
+                                           0, handle,
+                                           VIR_TC_FILTER_INFO(2, ETH_P_IP),
+                                           "u32")))
+        return -1;
+
+    if (!(opts = nla_nest_start(msg, TCA_OPTIONS)) ||
+        virNetDevBandwidthU32Put(msg, &u32, classid) < 0)
+        return virNetDevBandwidthTCBufferTooSmall(msg);
+    nla_nest_end(msg, opts);
+
+    return virNetDevBandwidthTCAppend(tc, msg, false);
+}
+
+static int
+virNetDevBandwidthTCDelMacFilter(virNetDevBandwidthTCPtr tc,
+                                 unsigned int id)
+{
+    uint32_t handle;
+    struct nl_msg *msg;
+
+    if (virNetDevBandwidthU32Handle(id, &handle) < 0)
+        return -1;
+
+    if (!(msg = virNetDevBandwidthTCNewMsg(tc, RTM_DELTFILTER, 0,
+                                           0, handle,
+                                           VIR_TC_FILTER_INFO(2, 0),
+                                           "u32")))
+        return -1;
+
+    return virNetDevBandwidthTCAppend(tc, msg, true);
+}
+
+/**
+ * virNetDevBandwidthTCAddPolice:
+ * @tc: queued operations
+ * @rate: rate in kbps
+ * @burst: burst size in kb
+ *
+ * Queue a filter dropping ingress traffic exceeding @rate. This is
+ * the equivalent of the tc(8) "u32 match u32 0 0 police rate @rate
+ * burst @burst mtu 64kb drop flowid :1" filter.
+ */
+static int
+virNetDevBandwidthTCAddPolice(virNetDevBandwidthTCPtr tc,
+                              unsigned long long rate,
+                              unsigned long long burst)
+{
+    const unsigned int mtu = 64 * 1024;
+    unsigned long long rateBytes = rate * 1000;
+    uint32_t rtab[VIR_TC_RTAB_SIZE];
+    virNetDevBandwidthU32Sel u32;
+    struct tc_police police;
+    struct nl_msg *msg;
+    struct nlattr *opts;
+    struct nlattr *policeOpts;
+
+    memset(&police, 0, sizeof(police));
+    police.action = TC_POLICE_SHOT;
+    police.mtu = mtu;
+    virNetDevBandwidthRateTable(&police.rate, rtab, rateBytes, mtu);
+    police.burst = virNetDevBandwidthXmitTime(rateBytes, burst * 1024);
+
+    memset(&u32, 0, sizeof(u32));
+    virNetDevBandwidthU32AddKey(&u32, 0, 0, 0);
+
+    if (!(msg = virNetDevBandwidthTCNewMsg(tc, RTM_NEWTFILTER,
+                                           NLM_F_CREATE | NLM_F_EXCL,
+                                           VIR_TC_INGRESS_HANDLE, 0,
+                                           VIR_TC_FILTER_INFO(0, ETH_P_ALL),
+                                           "u32")))
+        return -1;
+
+    if (!(opts = nla_nest_start(msg, TCA_OPTIONS)) ||
+        virNetDevBandwidthU32Put(msg, &u32, VIR_TC_HANDLE(0, 1)) < 0 ||
+        !(policeOpts = nla_nest_start(msg, TCA_U32_POLICE)))
+        return virNetDevBandwidthTCBufferTooSmall(msg);
+
+# if HAVE_DECL_TCA_POLICE_RATE64
+    if (rateBytes > UINT_MAX &&
+        nla_put(msg, TCA_POLICE_RATE64, sizeof(rateBytes), &rateBytes) < 0)
+        return virNetDevBandwidthTCBufferTooSmall(msg);
+# endif
+
+    if (nla_put(msg, TCA_POLICE_TBF, sizeof(police), &police) < 0 ||
+        nla_put(msg, TCA_POLICE_RATE, sizeof(rtab), rtab) < 0)
+        return virNetDevBandwidthTCBufferTooSmall(msg);
+    nla_nest_end(msg, policeOpts);
+    nla_nest_end(msg, opts);
+
+    return virNetDevBandwidthTCAppend(tc, msg, false);
+}
+
+#else /* !(defined(__linux__) && defined(HAVE_LIBNL)) */
+
+/* Without netlink support fall back to running tc(8), one command
+ * per operation. */
+
+static int
+virNetDevBandwidthTCInit(virNetDevBandwidthTCPtr tc,
+                         const char *ifname)
+{
+    memset(tc, 0, sizeof(*tc));
+    tc->ifname = ifname;
+    return 0;
+}
+
+static virCommandPtr
+virNetDevBandwidthTCNewCmd(virNetDevBandwidthTCPtr tc,
+                           const char *object,
+                           const char *action)
+{
+    return virCommandNewArgList(TC, object, action, "dev", tc->ifname, NULL);
+}
+
+static void
+virNetDevBandwidthTCAddHandle(virCommandPtr cmd,
+                              const char *name,
+                              uint32_t handle)
+{
+    virCommandAddArg(cmd, name);
+    virCommandAddArgFormat(cmd, "%x:%x",
+                           VIR_TC_HANDLE_MAJOR(handle),
+                           VIR_TC_HANDLE_MINOR(handle));
+}
+
+static int
+virNetDevBandwidthTCAppend(virNetDevBandwidthTCPtr tc,
+                           virCommandPtr cmd,
+                           bool ignoreErrors)
+{
+    virNetDevBandwidthTCOp op = { .cmd = cmd, .ignoreErrors = ignoreErrors };
+
+    if (VIR_APPEND_ELEMENT(tc->ops, tc->nops, op) < 0) {
+        virCommandFree(cmd);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+virNetDevBandwidthTCCommit(virNetDevBandwidthTCPtr tc)
+{
+    size_t i;
+
+    for (i = 0; i < tc->nops; i++) {
+        int status; /* for ignoring the exit status */
+
+        if (virCommandRun(tc->ops[i].cmd,
+                          tc->ops[i].ignoreErrors ? &status : NULL) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+virNetDevBandwidthTCDelQdisc(virNetDevBandwidthTCPtr tc,
+                             uint32_t parent,
+                             uint32_t handle)
+{
+    virCommandPtr cmd = virNetDevBandwidthTCNewCmd(tc, "qdisc", "del");
+
+    if (parent == VIR_TC_ROOT) {
+        virCommandAddArg(cmd, "root");
+    } else if (parent == VIR_TC_INGRESS) {
+        virCommandAddArg(cmd, "ingress");
+    } else {
+        virNetDevBandwidthTCAddHandle(cmd, "parent", parent);
+        virCommandAddArg(cmd, "handle");
+        virCommandAddArgFormat(cmd, "%x:", VIR_TC_HANDLE_MAJOR(handle));
+    }
+
+    return virNetDevBandwidthTCAppend(tc, cmd, true);
+}
+
+static int
+virNetDevBandwidthTCAddHTB(virNetDevBandwidthTCPtr tc,
+                           unsigned int defcls)
+{
+    virCommandPtr cmd = virNetDevBandwidthTCNewCmd(tc, "qdisc", "add");
+
+    virCommandAddArgList(cmd, "root", "handle", "1:", "htb", "default", NULL);
+    virCommandAddArgFormat(cmd, "%x", defcls);
+
+    return virNetDevBandwidthTCAppend(tc, cmd, false);
+}
+
+static int
+virNetDevBandwidthTCAddSFQ(virNetDevBandwidthTCPtr tc,
+                           uint32_t parent,
+                           uint32_t handle)
+{
+    virCommandPtr cmd = virNetDevBandwidthTCNewCmd(tc, "qdisc", "add");
+
+    virNetDevBandwidthTCAddHandle(cmd, "parent", parent);
+    virCommandAddArg(cmd, "handle");
+    virCommandAddArgFormat(cmd, "%x:", VIR_TC_HANDLE_MAJOR(handle));
+    virCommandAddArgList(cmd, "sfq", "perturb", "10", NULL);
+
+    return virNetDevBandwidthTCAppend(tc, cmd, false);
+}
+
+static int
+virNetDevBandwidthTCAddIngress(virNetDevBandwidthTCPtr tc)
+{
+    virCommandPtr cmd = virNetDevBandwidthTCNewCmd(tc, "qdisc", "add");
+
+    virCommandAddArg(cmd, "ingress");
+
+    return virNetDevBandwidthTCAppend(tc, cmd, false);
+}
+
+static int
+virNetDevBandwidthTCSetClass(virNetDevBandwidthTCPtr tc,
+                             bool create,
+                             uint32_t parent,
+                             uint32_t classid,
+                             unsigned long long rate,
+                             unsigned long long ceil,
+                             unsigned long long burst,
+                             unsigned long long quantum)
+{
+    virCommandPtr cmd = virNetDevBandwidthTCNewCmd(tc, "class",
+                                                   create ? "add" : "change");
+
+    if (create)
+        virNetDevBandwidthTCAddHandle(cmd, "parent", parent);
+    virNetDevBandwidthTCAddHandle(cmd, "classid", classid);
+    virCommandAddArgList(cmd, "htb", "rate", NULL);
+    virCommandAddArgFormat(cmd, "%llukbps", rate);
+    if (ceil) {
+        virCommandAddArg(cmd, "ceil");
+        virCommandAddArgFormat(cmd, "%llukbps", ceil);
+    }
+    if (burst) {
+        virCommandAddArg(cmd, "burst");
+        virCommandAddArgFormat(cmd, "%llukb", burst);
+    }
     virCommandAddArg(cmd, "quantum");
-    virCommandAddArgFormat(cmd, "%llu", r2q);
+    virCommandAddArgFormat(cmd, "%llu", quantum);
+
+    return virNetDevBandwidthTCAppend(tc, cmd, false);
+}
+
+static int
+virNetDevBandwidthTCDelClass(virNetDevBandwidthTCPtr tc,
+                             uint32_t classid)
+{
+    virCommandPtr cmd = virNetDevBandwidthTCNewCmd(tc, "class", "del");
+
+    virNetDevBandwidthTCAddHandle(cmd, "classid", classid);
+
+    return virNetDevBandwidthTCAppend(tc, cmd, true);
+}
+
+static int
+virNetDevBandwidthTCAddFwFilter(virNetDevBandwidthTCPtr tc,
+                                uint32_t parent,
+                                unsigned int prio,
+                                uint32_t handle,
+                                uint32_t classid)
+{
+    virCommandPtr cmd = virNetDevBandwidthTCNewCmd(tc, "filter", "add");
+
+    virNetDevBandwidthTCAddHandle(cmd, "parent", parent);
+    virCommandAddArgList(cmd, "protocol", "all", "prio", NULL);
+    virCommandAddArgFormat(cmd, "%u", prio);
+    virCommandAddArg(cmd, "handle");
+    virCommandAddArgFormat(cmd, "%u", handle);
+    virCommandAddArg(cmd, "fw");
+    virNetDevBandwidthTCAddHandle(cmd, "flowid", classid);
+
+    return virNetDevBandwidthTCAppend(tc, cmd, false);
+}
+
+static int
+virNetDevBandwidthTCAddMacFilter(virNetDevBandwidthTCPtr tc,
+                                 unsigned int id,
+                                 const virMacAddr *mac,
+                                 uint32_t classid)
+{
+    virCommandPtr cmd = virNetDevBandwidthTCNewCmd(tc, "filter", "add");
+    unsigned char raw[VIR_MAC_BUFLEN];
+
+    virMacAddrGetRaw(mac, raw);
+
+    /* u32 filters must have 800:: prefix. Don't ask. */
+    virCommandAddArgList(cmd, "protocol", "ip", "prio", "2", "handle", NULL);
+    virCommandAddArgFormat(cmd, "800::%u", id);
+    virCommandAddArgList(cmd, "u32", "match", "u16", "0x0800", "0xffff",
+                         "at", "-2", "match", "u32", NULL);
+    virCommandAddArgFormat(cmd, "0x%02x%02x%02x%02x",
+                           raw[2], raw[3], raw[4], raw[5]);
+    virCommandAddArgList(cmd, "0xffffffff", "at", "-12",
+                         "match", "u16", NULL);
+    virCommandAddArgFormat(cmd, "0x%02x%02x", raw[0], raw[1]);
+    virCommandAddArgList(cmd, "0xffff", "at", "-14", NULL);
+    virNetDevBandwidthTCAddHandle(cmd, "flowid", classid);
+
+    return virNetDevBandwidthTCAppend(tc, cmd, false);
+}
+
+static int
+virNetDevBandwidthTCDelMacFilter(virNetDevBandwidthTCPtr tc,
+                                 unsigned int id)
+{
+    virCommandPtr cmd = virNetDevBandwidthTCNewCmd(tc, "filter", "del");
+
+    virCommandAddArgList(cmd, "prio", "2", "handle", NULL);
+    virCommandAddArgFormat(cmd, "800::%u", id);
+    virCommandAddArg(cmd, "u32");
+
+    return virNetDevBandwidthTCAppend(tc, cmd, true);
+}
+
+static int
+virNetDevBandwidthTCAddPolice(virNetDevBandwidthTCPtr tc,
+                              unsigned long long rate,
+                              unsigned long long burst)
+{
+    virCommandPtr cmd = virNetDevBandwidthTCNewCmd(tc, "filter", "add");
+
+    /* Set filter to match all ingress traffic */
+    virCommandAddArgList(cmd, "parent", "ffff:", "protocol", "all", "u32",
+                         "match", "u32", "0", "0", "police", "rate", NULL);
+    virCommandAddArgFormat(cmd, "%llukbps", rate);
+    virCommandAddArg(cmd, "burst");
+    virCommandAddArgFormat(cmd, "%llukb", burst);
+    virCommandAddArgList(cmd, "mtu", "64kb", "drop", "flowid", ":1", NULL);
+
+    return virNetDevBandwidthTCAppend(tc, cmd, false);
+}
+
+#endif /* !(defined(__linux__) && defined(HAVE_LIBNL)) */
+
+/* Queue removal of the root and ingress qdiscs of the interface, and
+ * thus anything hanging off them. Either may not exist. */
+static int
+virNetDevBandwidthTCClear(virNetDevBandwidthTCPtr tc)
+{
+    if (virNetDevBandwidthTCDelQdisc(tc, VIR_TC_ROOT, 0) < 0 ||
+        virNetDevBandwidthTCDelQdisc(tc, VIR_TC_INGRESS,
+                                     VIR_TC_INGRESS_HANDLE) < 0)
+        return -1;
+
+    return 0;
 }
 
 /**
  * virNetDevBandwidthManipulateFilter:
- * @ifname: interface to operate on
+ * @tc: operations on the interface to create the filter on
  * @ifmac_ptr: MAC of the interface to create filter over
  * @id: filter ID
  * @class_id: where to place traffic
@@ -83,7 +1001,7 @@ virNetDevBandwidthCmdAddOptimalQuantum(virCommandPtr cmd,
  * bridge) and filter the traffic into QDiscs based on the
  * originating vNET device.
  *
- * Long story short, @ifname is the interface where the filter
+ * Long story short, @tc is the interface where the filter
  * should be created. The @ifmac_ptr is the MAC address for which
  * the filter should be created (usually different to the MAC
  * address of @ifname). Then, like everything - even filters have
@@ -98,74 +1016,33 @@ virNetDevBandwidthCmdAddOptimalQuantum(virCommandPtr cmd,
  *         -1 otherwise (with error reported).
  */
 static int ATTRIBUTE_NONNULL(1)
-virNetDevBandwidthManipulateFilter(const char *ifname,
+virNetDevBandwidthManipulateFilter(virNetDevBandwidthTCPtr tc,
                                    const virMacAddr *ifmac_ptr,
                                    unsigned int id,
-                                   const char *class_id,
+                                   uint32_t class_id,
                                    bool remove_old,
                                    bool create_new)
 {
-    int ret = -1;
-    char *filter_id = NULL;
-    virCommandPtr cmd = NULL;
-    unsigned char ifmac[VIR_MAC_BUFLEN];
-    char *mac[2] = {NULL, NULL};
-
     if (!(remove_old || create_new)) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("filter creation API error"));
-        goto cleanup;
-    }
-
-    /* u32 filters must have 800:: prefix. Don't ask. */
-    if (virAsprintf(&filter_id, "800::%u", id) < 0)
-        goto cleanup;
-
-    if (remove_old) {
-        int cmd_ret = 0;
-
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "filter", "del", "dev", ifname,
-                             "prio", "2", "handle",  filter_id, "u32", NULL);
-
-        if (virCommandRun(cmd, &cmd_ret) < 0)
-            goto cleanup;
-
+        return -1;
     }
 
-    if (create_new) {
-        virMacAddrGetRaw(ifmac_ptr, ifmac);
-
-        if (virAsprintf(&mac[0], "0x%02x%02x%02x%02x", ifmac[2],
-                        ifmac[3], ifmac[4], ifmac[5]) < 0 ||
-            virAsprintf(&mac[1], "0x%02x%02x", ifmac[0], ifmac[1]) < 0)
-            goto cleanup;
+    if (remove_old &&
+        virNetDevBandwidthTCDelMacFilter(tc, id) < 0)
+        return -1;
 
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        /* Okay, this not nice. But since libvirt does not necessarily track
-         * interface IP address(es), and tc fw filter simply refuse to use
-         * ebtables marks, we need to use u32 selector to match MAC address.
-         * If libvirt will ever know something, remove this FIXME
-         */
-        virCommandAddArgList(cmd, "filter", "add", "dev", ifname, "protocol", "ip",
-                             "prio", "2", "handle", filter_id, "u32",
-                             "match", "u16", "0x0800", "0xffff", "at", "-2",
-                             "match", "u32", mac[0], "0xffffffff", "at", "-12",
-                             "match", "u16", mac[1], "0xffff", "at", "-14",
-                             "flowid", class_id, NULL);
-
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
-    }
+    /* Okay, this not nice. But since libvirt does not necessarily track
+     * interface IP address(es), and tc fw filter simply refuse to use
+     * ebtables marks, we need to use u32 selector to match MAC address.
+     * If libvirt will ever know something, remove this FIXME
+     */
+    if (create_new &&
+        virNetDevBandwidthTCAddMacFilter(tc, id, ifmac_ptr, class_id) < 0)
+        return -1;
 
-    ret = 0;
- cleanup:
-    VIR_FREE(mac[1]);
-    VIR_FREE(mac[0]);
-    VIR_FREE(filter_id);
-    virCommandFree(cmd);
-    return ret;
+    return 0;
 }
 
 
@@ -180,7 +1057,8 @@ virNetDevBandwidthManipulateFilter(const char *ifname,
  * and outgoing traffic. Any previous setting get
  * overwritten. If @hierarchical_class is TRUE, create
  * hierarchical class. It is used to guarantee minimal
- * throughput ('floor' attribute in NIC).
+ * throughput ('floor' attribute in NIC). All the changes
+ * are done in a single transaction.
  *
  * Return 0 on success, -1 otherwise.
  */
@@ -190,15 +1068,11 @@ virNetDevBandwidthSet(const char *ifname,
                       bool hierarchical_class)
 {
     int ret = -1;
-    virCommandPtr cmd = NULL;
-    char *average = NULL;
-    char *peak = NULL;
-    char *burst = NULL;
+    virNetDevBandwidthTC tc;
 
     if (!bandwidth) {
         /* nothing to be enabled */
-        ret = 0;
-        goto cleanup;
+        return 0;
     }
 
     if (geteuid() != 0) {
@@ -215,23 +1089,15 @@ virNetDevBandwidthSet(const char *ifname,
         return -1;
     }
 
-    virNetDevBandwidthClear(ifname);
+    if (virNetDevBandwidthTCInit(&tc, ifname) < 0 ||
+        virNetDevBandwidthTCClear(&tc) < 0)
+        goto cleanup;
 
     if (bandwidth->in && bandwidth->in->average) {
-        if (virAsprintf(&average, "%llukbps", bandwidth->in->average) < 0)
-            goto cleanup;
-        if (bandwidth->in->peak &&
-            (virAsprintf(&peak, "%llukbps", bandwidth->in->peak) < 0))
-            goto cleanup;
-        if (bandwidth->in->burst &&
-            (virAsprintf(&burst, "%llukb", bandwidth->in->burst) < 0))
-            goto cleanup;
+        const virNetDevBandwidthRate *in = bandwidth->in;
+        unsigned long long quantum = virNetDevBandwidthOptimalQuantum(in);
 
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "qdisc", "add", "dev", ifname, "root",
-                             "handle", "1:", "htb", "default",
-                             hierarchical_class ? "2" : "1", NULL);
-        if (virCommandRun(cmd, NULL) < 0)
+        if (virNetDevBandwidthTCAddHTB(&tc, hierarchical_class ? 2 : 1) < 0)
             goto cleanup;
 
         /* If we are creating a hierarchical class, all non guaranteed traffic
@@ -297,91 +1163,44 @@ virNetDevBandwidthSet(const char *ifname,
          * This description is rather long, but it is still a good idea to read
          * it before you dig into the code.
          */
-        if (hierarchical_class) {
-            virCommandFree(cmd);
-            cmd = virCommandNew(TC);
-            virCommandAddArgList(cmd, "class", "add", "dev", ifname, "parent",
-                                 "1:", "classid", "1:1", "htb", "rate", average,
-                                 "ceil", peak ? peak : average, NULL);
-            virNetDevBandwidthCmdAddOptimalQuantum(cmd, bandwidth->in);
-            if (virCommandRun(cmd, NULL) < 0)
-                goto cleanup;
-        }
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "class", "add", "dev", ifname, "parent",
-                             hierarchical_class ? "1:1" : "1:", "classid",
-                             hierarchical_class ? "1:2" : "1:1", "htb",
-                             "rate", average, NULL);
-
-        if (peak)
-            virCommandAddArgList(cmd, "ceil", peak, NULL);
-        if (burst)
-            virCommandAddArgList(cmd, "burst", burst, NULL);
-
-        virNetDevBandwidthCmdAddOptimalQuantum(cmd, bandwidth->in);
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
-
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "qdisc", "add", "dev", ifname, "parent",
-                             hierarchical_class ? "1:2" : "1:1",
-                             "handle", "2:", "sfq", "perturb",
-                             "10", NULL);
 
-        if (virCommandRun(cmd, NULL) < 0)
+        if (hierarchical_class &&
+            virNetDevBandwidthTCSetClass(&tc, true,
+                                         VIR_TC_HANDLE(1, 0),
+                                         VIR_TC_HANDLE(1, 1),
+                                         in->average,
+                                         in->peak ? in->peak : in->average,
+                                         0, quantum) < 0)
             goto cleanup;
 
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "filter", "add", "dev", ifname, "parent",
-                             "1:0", "protocol", "all", "prio", "1", "handle",
-                             "1", "fw", "flowid", "1", NULL);
-
-        if (virCommandRun(cmd, NULL) < 0)
+        if (virNetDevBandwidthTCSetClass(&tc, true,
+                                         hierarchical_class ?
+                                         VIR_TC_HANDLE(1, 1) :
+                                         VIR_TC_HANDLE(1, 0),
+                                         VIR_TC_HANDLE(1, hierarchical_class ? 2 : 1),
+                                         in->average, in->peak, in->burst,
+                                         quantum) < 0 ||
+            virNetDevBandwidthTCAddSFQ(&tc,
+                                       VIR_TC_HANDLE(1, hierarchical_class ? 2 : 1),
+                                       VIR_TC_HANDLE(2, 0)) < 0 ||
+            virNetDevBandwidthTCAddFwFilter(&tc, VIR_TC_HANDLE(1, 0), 1, 1,
+                                            VIR_TC_HANDLE(0, 1)) < 0)
             goto cleanup;
-
-        VIR_FREE(average);
-        VIR_FREE(peak);
-        VIR_FREE(burst);
     }
 
     if (bandwidth->out) {
-        if (virAsprintf(&average, "%llukbps", bandwidth->out->average) < 0)
-            goto cleanup;
-        if (virAsprintf(&burst, "%llukb", bandwidth->out->burst ?
-                        bandwidth->out->burst : bandwidth->out->average) < 0)
-            goto cleanup;
-
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-            virCommandAddArgList(cmd, "qdisc", "add", "dev", ifname,
-                                 "ingress", NULL);
-
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
-
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        /* Set filter to match all ingress traffic */
-        virCommandAddArgList(cmd, "filter", "add", "dev", ifname, "parent",
-                             "ffff:", "protocol", "all", "u32", "match", "u32",
-                             "0", "0", "police", "rate", average,
-                             "burst", burst, "mtu", "64kb", "drop", "flowid",
-                             ":1", NULL);
-
-        if (virCommandRun(cmd, NULL) < 0)
+        if (virNetDevBandwidthTCAddIngress(&tc) < 0 ||
+            virNetDevBandwidthTCAddPolice(&tc, bandwidth->out->average,
+                                          bandwidth->out->burst ?
+                                          bandwidth->out->burst :
+                                          bandwidth->out->average) < 0)
             goto cleanup;
     }
 
-    ret = 0;
+    ret = virNetDevBandwidthTCCommit(&tc);
 
  cleanup:
-    virCommandFree(cmd);
-    VIR_FREE(average);
-    VIR_FREE(peak);
-    VIR_FREE(burst);
+    virNetDevBandwidthTCReset(&tc);
     return ret;
 }
 
@@ -398,29 +1217,25 @@ virNetDevBandwidthSet(const char *ifname,
 int
 virNetDevBandwidthClear(const char *ifname)
 {
-    int ret = 0;
-    int dummy; /* for ignoring the exit status */
-    virCommandPtr cmd = NULL;
+    int ret = -1;
+    int rc;
+    virNetDevBandwidthTC tc;
 
     if (!ifname)
        return 0;
 
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "qdisc", "del", "dev", ifname, "root", NULL);
-
-    if (virCommandRun(cmd, &dummy) < 0)
-        ret = -1;
-
-    virCommandFree(cmd);
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "qdisc",  "del", "dev", ifname, "ingress", NULL);
+    /* Nothing to clear on an interface that is already gone */
+    if ((rc = virNetDevExists(ifname)) <= 0)
+        return rc;
 
-    if (virCommandRun(cmd, &dummy) < 0)
-        ret = -1;
+    if (virNetDevBandwidthTCInit(&tc, ifname) < 0 ||
+        virNetDevBandwidthTCClear(&tc) < 0)
+        goto cleanup;
 
-    virCommandFree(cmd);
+    ret = virNetDevBandwidthTCCommit(&tc);
 
+ cleanup:
+    virNetDevBandwidthTCReset(&tc);
     return ret;
 }
 
@@ -540,11 +1355,7 @@ virNetDevBandwidthPlug(const char *brname,
                        unsigned int id)
 {
     int ret = -1;
-    virCommandPtr cmd = NULL;
-    char *class_id = NULL;
-    char *qdisc_id = NULL;
-    char *floor = NULL;
-    char *ceil = NULL;
+    virNetDevBandwidthTC tc;
     char ifmacStr[VIR_MAC_STRING_BUFLEN];
 
     if (id <= 2) {
@@ -562,44 +1373,27 @@ virNetDevBandwidthPlug(const char *brname,
         return -1;
     }
 
-    if (virAsprintf(&class_id, "1:%x", id) < 0 ||
-        virAsprintf(&qdisc_id, "%x:", id) < 0 ||
-        virAsprintf(&floor, "%llukbps", bandwidth->in->floor) < 0 ||
-        virAsprintf(&ceil, "%llukbps", net_bandwidth->in->peak ?
-                    net_bandwidth->in->peak :
-                    net_bandwidth->in->average) < 0)
-        goto cleanup;
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "class", "add", "dev", brname, "parent", "1:1",
-                         "classid", class_id, "htb", "rate", floor,
-                         "ceil", ceil, NULL);
-    virNetDevBandwidthCmdAddOptimalQuantum(cmd, bandwidth->in);
-
-    if (virCommandRun(cmd, NULL) < 0)
+    if (virNetDevBandwidthTCInit(&tc, brname) < 0 ||
+        virNetDevBandwidthTCSetClass(&tc, true,
+                                     VIR_TC_HANDLE(1, 1),
+                                     VIR_TC_HANDLE(1, id),
+                                     bandwidth->in->floor,
+                                     net_bandwidth->in->peak ?
+                                     net_bandwidth->in->peak :
+                                     net_bandwidth->in->average,
+                                     0,
+                                     virNetDevBandwidthOptimalQuantum(bandwidth->in)) < 0 ||
+        virNetDevBandwidthTCAddSFQ(&tc, VIR_TC_HANDLE(1, id),
+                                   VIR_TC_HANDLE(id, 0)) < 0 ||
+        virNetDevBandwidthManipulateFilter(&tc, ifmac_ptr, id,
+                                           VIR_TC_HANDLE(1, id),
+                                           false, true) < 0)
         goto cleanup;
 
-    virCommandFree(cmd);
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "qdisc", "add", "dev", brname, "parent",
-                         class_id, "handle", qdisc_id, "sfq", "perturb",
-                         "10", NULL);
-
-    if (virCommandRun(cmd, NULL) < 0)
-        goto cleanup;
-
-    if (virNetDevBandwidthManipulateFilter(brname, ifmac_ptr, id,
-                                           class_id, false, true) < 0)
-        goto cleanup;
-
-    ret = 0;
+    ret = virNetDevBandwidthTCCommit(&tc);
 
  cleanup:
-    VIR_FREE(ceil);
-    VIR_FREE(floor);
-    VIR_FREE(qdisc_id);
-    VIR_FREE(class_id);
-    virCommandFree(cmd);
+    virNetDevBandwidthTCReset(&tc);
     return ret;
 }
 
@@ -617,47 +1411,27 @@ virNetDevBandwidthUnplug(const char *brname,
                          unsigned int id)
 {
     int ret = -1;
-    int cmd_ret = 0;
-    virCommandPtr cmd = NULL;
-    char *class_id = NULL;
-    char *qdisc_id = NULL;
+    virNetDevBandwidthTC tc;
 
     if (id <= 2) {
         virReportError(VIR_ERR_INTERNAL_ERROR, _("Invalid class ID %d"), id);
         return -1;
     }
 
-    if (virAsprintf(&class_id, "1:%x", id) < 0 ||
-        virAsprintf(&qdisc_id, "%x:", id) < 0)
-        goto cleanup;
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "qdisc", "del", "dev", brname,
-                         "handle", qdisc_id, NULL);
-
-    /* Don't threat tc errors as fatal, but
+    /* Don't threat errors as fatal, but
      * try to remove as much as possible */
-    if (virCommandRun(cmd, &cmd_ret) < 0)
-        goto cleanup;
-
-    if (virNetDevBandwidthManipulateFilter(brname, NULL, id,
-                                           NULL, true, false) < 0)
+    if (virNetDevBandwidthTCInit(&tc, brname) < 0 ||
+        virNetDevBandwidthTCDelQdisc(&tc, VIR_TC_HANDLE(1, id),
+                                     VIR_TC_HANDLE(id, 0)) < 0 ||
+        virNetDevBandwidthManipulateFilter(&tc, NULL, id, 0,
+                                           true, false) < 0 ||
+        virNetDevBandwidthTCDelClass(&tc, VIR_TC_HANDLE(1, id)) < 0)
         goto cleanup;
 
-    virCommandFree(cmd);
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "class", "del", "dev", brname,
-                         "classid", class_id, NULL);
-
-    if (virCommandRun(cmd, &cmd_ret) < 0)
-        goto cleanup;
-
-    ret = 0;
+    ret = virNetDevBandwidthTCCommit(&tc);
 
  cleanup:
-    VIR_FREE(qdisc_id);
-    VIR_FREE(class_id);
-    virCommandFree(cmd);
+    virNetDevBandwidthTCReset(&tc);
     return ret;
 }
 
@@ -682,34 +1456,22 @@ virNetDevBandwidthUpdateRate(const char *ifname,
                              unsigned long long new_rate)
 {
     int ret = -1;
-    virCommandPtr cmd = NULL;
-    char *class_id = NULL;
-    char *rate = NULL;
-    char *ceil = NULL;
-
-    if (virAsprintf(&class_id, "1:%x", id) < 0 ||
-        virAsprintf(&rate, "%llukbps", new_rate) < 0 ||
-        virAsprintf(&ceil, "%llukbps", bandwidth->in->peak ?
-                    bandwidth->in->peak :
-                    bandwidth->in->average) < 0)
-        goto cleanup;
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "class", "change", "dev", ifname,
-                         "classid", class_id, "htb", "rate", rate,
-                         "ceil", ceil, NULL);
-    virNetDevBandwidthCmdAddOptimalQuantum(cmd, bandwidth->in);
-
-    if (virCommandRun(cmd, NULL) < 0)
+    virNetDevBandwidthTC tc;
+
+    if (virNetDevBandwidthTCInit(&tc, ifname) < 0 ||
+        virNetDevBandwidthTCSetClass(&tc, false, 0, VIR_TC_HANDLE(1, id),
+                                     new_rate,
+                                     bandwidth->in->peak ?
+                                     bandwidth->in->peak :
+                                     bandwidth->in->average,
+                                     0,
+                                     virNetDevBandwidthOptimalQuantum(bandwidth->in)) < 0)
         goto cleanup;
 
-    ret = 0;
+    ret = virNetDevBandwidthTCCommit(&tc);
 
  cleanup:
-    virCommandFree(cmd);
-    VIR_FREE(class_id);
-    VIR_FREE(rate);
-    VIR_FREE(ceil);
+    virNetDevBandwidthTCReset(&tc);
     return ret;
 }
 
@@ -736,17 +1498,17 @@ virNetDevBandwidthUpdateFilter(const char *ifname,
                                unsigned int id)
 {
     int ret = -1;
-    char *class_id = NULL;
+    virNetDevBandwidthTC tc;
 
-    if (virAsprintf(&class_id, "1:%x", id) < 0)
+    if (virNetDevBandwidthTCInit(&tc, ifname) < 0 ||
+        virNetDevBandwidthManipulateFilter(&tc, ifmac_ptr, id,
+                                           VIR_TC_HANDLE(1, id),
+                                           true, true) < 0)
         goto cleanup;
 
-    if (virNetDevBandwidthManipulateFilter(ifname, ifmac_ptr, id,
-                                           class_id, true, true) < 0)
-        goto cleanup;
+    ret = virNetDevBandwidthTCCommit(&tc);
 
-    ret = 0;
  cleanup:
-    VIR_FREE(class_id);
+    virNetDevBandwidthTCReset(&tc);
     return ret;
 }
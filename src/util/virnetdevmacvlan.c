@@ -291,6 +291,7 @@ virNetDevMacVLanReleaseName(const char *name)
  * @macaddress: The MAC address of the device
  * @srcdev: The name of the 'link' device
  * @macvlan_mode: The macvlan mode to use
+ * @online: Whether to bring the device up right away
  * @retry: Pointer to integer that will be '1' upon return if an interface
  *         with the same name already exists and it is worth to try
  *         again with a different name
@@ -305,6 +306,7 @@ virNetDevMacVLanCreate(const char *ifname,
                        const virMacAddr *macaddress,
                        const char *srcdev,
                        uint32_t macvlan_mode,
+                       bool online,
                        int *retry)
 {
     int rc = -1;
@@ -322,6 +324,11 @@ virNetDevMacVLanCreate(const char *ifname,
 
     *retry = 0;
 
+    if (online) {
+        ifinfo.ifi_flags = IFF_UP;
+        ifinfo.ifi_change = IFF_UP;
+    }
+
     nl_msg = nlmsg_alloc_simple(RTM_NEWLINK,
                                 NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL);
     if (!nl_msg) {
@@ -983,6 +990,9 @@ virNetDevMacVLanCreateWithVPortProfile(const char *ifnameRequested,
     const char *ifnameCreated = NULL;
     int vf = -1;
     bool vnet_hdr = flags & VIR_NETDEV_MACVLAN_VNET_HDR;
+    /* Without a port profile to associate first, the device can be
+     * brought up by the very request creating it */
+    bool online = (flags & VIR_NETDEV_MACVLAN_CREATE_IFUP) && !virtPortProfile;
 
     macvtapMode = modeMap[mode];
 
@@ -1044,7 +1054,8 @@ virNetDevMacVLanCreateWithVPortProfile(const char *ifnameRequested,
         }
 
         if (virNetDevMacVLanCreate(ifnameRequested, type, macaddress,
-                                   linkdev, macvtapMode, &do_retry) < 0) {
+                                   linkdev, macvtapMode, online,
+                                   &do_retry) < 0) {
             if (isAutoName) {
                 virNetDevMacVLanReleaseName(ifnameRequested);
                 reservedID = -1;
@@ -1069,7 +1080,7 @@ virNetDevMacVLanCreateWithVPortProfile(const char *ifnameRequested,
         }
         snprintf(ifname, sizeof(ifname), pattern, reservedID);
         if (virNetDevMacVLanCreate(ifname, type, macaddress, linkdev,
-                                   macvtapMode, &do_retry) < 0) {
+                                   macvtapMode, online, &do_retry) < 0) {
             virNetDevMacVLanReleaseID(reservedID, flags);
             virMutexUnlock(&virNetDevMacVLanCreateMutex);
             if (!do_retry)
@@ -1098,7 +1109,7 @@ virNetDevMacVLanCreateWithVPortProfile(const char *ifnameRequested,
                                        vmuuid, vmOp, false) < 0)
         goto link_del_exit;
 
-    if (flags & VIR_NETDEV_MACVLAN_CREATE_IFUP) {
+    if ((flags & VIR_NETDEV_MACVLAN_CREATE_IFUP) && !online) {
         if (virNetDevSetOnline(ifnameCreated, true) < 0)
             goto disassociate_exit;
     }
@@ -1251,6 +1262,7 @@ int virNetDevMacVLanCreate(const char *ifname ATTRIBUTE_UNUSED,
                            const virMacAddr *macaddress ATTRIBUTE_UNUSED,
                            const char *srcdev ATTRIBUTE_UNUSED,
                            uint32_t macvlan_mode ATTRIBUTE_UNUSED,
+                           bool online ATTRIBUTE_UNUSED,
                            int *retry ATTRIBUTE_UNUSED)
 {
     virReportSystemError(ENOSYS, "%s",
@@ -65,6 +65,7 @@ int virNetDevMacVLanCreate(const char *ifname,
                            const virMacAddr *macaddress,
                            const char *srcdev,
                            uint32_t macvlan_mode,
+                           bool online,
                            int *retry)
     ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4)
     ATTRIBUTE_RETURN_CHECK;
@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 
+#include "c-ctype.h"
 #include "virnetdevopenvswitch.h"
 #include "vircommand.h"
 #include "viralloc.h"
@@ -35,11 +36,14 @@
 #include "virmacaddr.h"
 #include "virstring.h"
 #include "virlog.h"
+#include "virovsdb.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
 VIR_LOG_INIT("util.netdevopenvswitch");
 
+#define VIR_NETDEV_OVS_DATABASE "Open_vSwitch"
+
 /*
  * Set openvswitch default timout
  */
@@ -63,6 +67,265 @@ virNetDevOpenvswitchAddTimeout(virCommandPtr cmd)
     virCommandAddArgFormat(cmd, "--timeout=%u", virNetDevOpenvswitchTimeout);
 }
 
+/*
+ * Talking to ovsdb-server directly saves spawning ovs-vsctl, which
+ * has to connect and fetch its view of the database for every single
+ * command. The functions below return -2 whenever the database server
+ * is not reachable so that the callers can fall back to ovs-vsctl.
+ */
+
+static int
+virNetDevOpenvswitchTransact(virBufferPtr ops,
+                             virJSONValuePtr *results)
+{
+    return virOVSDBTransact(VIR_NETDEV_OVS_DATABASE, ops,
+                            virNetDevOpenvswitchTimeout, results);
+}
+
+/*
+ * Look up @column of the row in @table called @name. @value is set
+ * to NULL if there is no such row.
+ */
+static int
+virNetDevOpenvswitchSelect(const char *table,
+                           const char *name,
+                           const char *column,
+                           virJSONValuePtr *value)
+{
+    virBuffer ops = VIR_BUFFER_INITIALIZER;
+    virJSONValuePtr results = NULL;
+    virJSONValuePtr res;
+    virJSONValuePtr rows;
+    virJSONValuePtr row;
+    int ret;
+
+    *value = NULL;
+
+    virBufferAddLit(&ops, "{\"op\":\"select\",\"table\":");
+    virOVSDBBufferAddString(&ops, table);
+    virBufferAddLit(&ops, ",\"where\":[[\"name\",\"==\",");
+    virOVSDBBufferAddString(&ops, name);
+    virBufferAddLit(&ops, "]],\"columns\":[");
+    virOVSDBBufferAddString(&ops, column);
+    virBufferAddLit(&ops, "]}");
+
+    if ((ret = virNetDevOpenvswitchTransact(&ops, &results)) < 0)
+        goto cleanup;
+
+    ret = -1;
+    if (!(res = virJSONValueArrayGet(results, 0)) ||
+        !(rows = virJSONValueObjectGetArray(res, "rows"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Malformed OVSDB select reply"));
+        goto cleanup;
+    }
+
+    if ((row = virJSONValueArrayGet(rows, 0)) &&
+        virJSONValueObjectRemoveKey(row, column, value) <= 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Missing column '%s' in OVSDB select reply"), column);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&ops);
+    virJSONValueFree(results);
+    return ret;
+}
+
+/* Find @key in an OVSDB map, which is encoded as
+ * ["map", [[key1, value1], [key2, value2], ...]] */
+static virJSONValuePtr
+virNetDevOpenvswitchMapGet(virJSONValuePtr map,
+                           const char *key)
+{
+    virJSONValuePtr pairs;
+    ssize_t npairs;
+    ssize_t i;
+
+    if (!map || !virJSONValueIsArray(map) ||
+        !(pairs = virJSONValueArrayGet(map, 1)) ||
+        (npairs = virJSONValueArraySize(pairs)) < 0)
+        return NULL;
+
+    for (i = 0; i < npairs; i++) {
+        virJSONValuePtr pair = virJSONValueArrayGet(pairs, i);
+        virJSONValuePtr k;
+
+        if (virJSONValueArraySize(pair) == 2 &&
+            (k = virJSONValueArrayGet(pair, 0)) &&
+            STREQ_NULLABLE(virJSONValueGetString(k), key))
+            return virJSONValueArrayGet(pair, 1);
+    }
+
+    return NULL;
+}
+
+static int
+virNetDevOpenvswitchGetCount(virJSONValuePtr results,
+                             size_t op,
+                             unsigned int *count)
+{
+    virJSONValuePtr res = virJSONValueArrayGet(results, op);
+
+    if (!res ||
+        virJSONValueObjectGetNumberUint(res, "count", count) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Malformed OVSDB mutate reply"));
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+virNetDevOpenvswitchAddMapPair(virBufferPtr ops,
+                               const char *key,
+                               const char *value)
+{
+    virBufferAddLit(ops, "[");
+    virOVSDBBufferAddString(ops, key);
+    virBufferAddLit(ops, ",");
+    virOVSDBBufferAddString(ops, value);
+    virBufferAddLit(ops, "]");
+}
+
+/*
+ * Queue the removal of the port with UUID @port from whichever bridge
+ * it is attached to. Both the port and its interfaces are garbage
+ * collected by the server once they are not referenced anymore.
+ */
+static int
+virNetDevOpenvswitchAddDelPortOp(virBufferPtr ops,
+                                 virJSONValuePtr port)
+{
+    char *uuid;
+
+    if (!(uuid = virJSONValueToString(port, false)))
+        return -1;
+
+    virBufferAsprintf(ops,
+                      "{\"op\":\"mutate\",\"table\":\"Bridge\","
+                      "\"where\":[[\"ports\",\"includes\",%s]],"
+                      "\"mutations\":[[\"ports\",\"delete\",%s]]}",
+                      uuid, uuid);
+    VIR_FREE(uuid);
+    return 0;
+}
+
+static int
+virNetDevOpenvswitchDBAddPort(const char *brname,
+                              const char *ifname,
+                              const char *macaddrstr,
+                              const char *ifuuidstr,
+                              const char *vmuuidstr,
+                              const char *profileID,
+                              virNetDevVlanPtr virtVlan)
+{
+    virBuffer ops = VIR_BUFFER_INITIALIZER;
+    virJSONValuePtr port = NULL;
+    virJSONValuePtr results = NULL;
+    unsigned int count;
+    size_t i;
+    int ret;
+
+    if ((ret = virNetDevOpenvswitchSelect("Port", ifname, "_uuid", &port)) < 0)
+        goto cleanup;
+
+    ret = -1;
+
+    /* Same as ovs-vsctl --if-exists del-port, add-port would do */
+    if (port) {
+        if (virNetDevOpenvswitchAddDelPortOp(&ops, port) < 0)
+            goto cleanup;
+        virBufferAddLit(&ops, ",");
+    }
+
+    virBufferAddLit(&ops,
+                    "{\"op\":\"insert\",\"table\":\"Interface\","
+                    "\"uuid-name\":\"iface\",\"row\":{\"name\":");
+    virOVSDBBufferAddString(&ops, ifname);
+    virBufferAddLit(&ops, ",\"external_ids\":[\"map\",[");
+    virNetDevOpenvswitchAddMapPair(&ops, "attached-mac", macaddrstr);
+    virBufferAddLit(&ops, ",");
+    virNetDevOpenvswitchAddMapPair(&ops, "iface-id", ifuuidstr);
+    virBufferAddLit(&ops, ",");
+    virNetDevOpenvswitchAddMapPair(&ops, "vm-id", vmuuidstr);
+    virBufferAddLit(&ops, ",");
+    if (profileID[0] != '\0') {
+        virNetDevOpenvswitchAddMapPair(&ops, "port-profile", profileID);
+        virBufferAddLit(&ops, ",");
+    }
+    virNetDevOpenvswitchAddMapPair(&ops, "iface-status", "active");
+    virBufferAddLit(&ops, "]]}},");
+
+    virBufferAddLit(&ops,
+                    "{\"op\":\"insert\",\"table\":\"Port\","
+                    "\"uuid-name\":\"port\",\"row\":{\"name\":");
+    virOVSDBBufferAddString(&ops, ifname);
+    virBufferAddLit(&ops, ",\"interfaces\":[\"named-uuid\",\"iface\"]");
+
+    if (virtVlan && virtVlan->nTags > 0) {
+        switch (virtVlan->nativeMode) {
+        case VIR_NATIVE_VLAN_MODE_TAGGED:
+            virBufferAddLit(&ops, ",\"vlan_mode\":\"native-tagged\"");
+            break;
+        case VIR_NATIVE_VLAN_MODE_UNTAGGED:
+            virBufferAddLit(&ops, ",\"vlan_mode\":\"native-untagged\"");
+            break;
+        case VIR_NATIVE_VLAN_MODE_DEFAULT:
+        default:
+            break;
+        }
+
+        if (virtVlan->trunk) {
+            if (virtVlan->nativeMode != VIR_NATIVE_VLAN_MODE_DEFAULT)
+                virBufferAsprintf(&ops, ",\"tag\":%d", virtVlan->nativeTag);
+
+            virBufferAddLit(&ops, ",\"trunks\":[\"set\",[");
+            for (i = 0; i < virtVlan->nTags; i++) {
+                if (i > 0)
+                    virBufferAddLit(&ops, ",");
+                virBufferAsprintf(&ops, "%d", virtVlan->tag[i]);
+            }
+            virBufferAddLit(&ops, "]]");
+        } else {
+            virBufferAsprintf(&ops, ",\"tag\":%d", virtVlan->tag[0]);
+        }
+    }
+    virBufferAddLit(&ops, "}},");
+
+    virBufferAddLit(&ops,
+                    "{\"op\":\"mutate\",\"table\":\"Bridge\","
+                    "\"where\":[[\"name\",\"==\",");
+    virOVSDBBufferAddString(&ops, brname);
+    virBufferAddLit(&ops,
+                    "]],\"mutations\":[[\"ports\",\"insert\","
+                    "[\"named-uuid\",\"port\"]]]}");
+
+    if (virNetDevOpenvswitchTransact(&ops, &results) < 0)
+        goto cleanup;
+
+    /* Without a bridge to attach to, the new rows are just discarded */
+    if (virNetDevOpenvswitchGetCount(results, port ? 3 : 2, &count) < 0)
+        goto cleanup;
+
+    if (count != 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to add port %s to OVS bridge %s"),
+                       ifname, brname);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&ops);
+    virJSONValueFree(port);
+    virJSONValueFree(results);
+    return ret;
+}
+
 /**
  * virNetDevOpenvswitchAddPort:
  * @brname: the bridge name
@@ -97,6 +360,13 @@ int virNetDevOpenvswitchAddPort(const char *brname, const char *ifname,
     virUUIDFormat(ovsport->interfaceID, ifuuidstr);
     virUUIDFormat(vmuuid, vmuuidstr);
 
+    if ((ret = virNetDevOpenvswitchDBAddPort(brname, ifname, macaddrstr,
+                                             ifuuidstr, vmuuidstr,
+                                             ovsport->profileID,
+                                             virtVlan)) != -2)
+        goto cleanup;
+    ret = -1;
+
     if (virAsprintf(&attachedmac_ex_id, "external-ids:attached-mac=\"%s\"",
                     macaddrstr) < 0)
         goto cleanup;
@@ -194,6 +464,30 @@ int virNetDevOpenvswitchAddPort(const char *brname, const char *ifname,
     return ret;
 }
 
+static int
+virNetDevOpenvswitchDBRemovePort(const char *ifname)
+{
+    virBuffer ops = VIR_BUFFER_INITIALIZER;
+    virJSONValuePtr port = NULL;
+    virJSONValuePtr results = NULL;
+    int ret;
+
+    if ((ret = virNetDevOpenvswitchSelect("Port", ifname, "_uuid", &port)) < 0 ||
+        !port)
+        goto cleanup;
+
+    if ((ret = virNetDevOpenvswitchAddDelPortOp(&ops, port)) < 0)
+        goto cleanup;
+
+    ret = virNetDevOpenvswitchTransact(&ops, &results);
+
+ cleanup:
+    virBufferFreeAndReset(&ops);
+    virJSONValueFree(port);
+    virJSONValueFree(results);
+    return ret;
+}
+
 /**
  * virNetDevOpenvswitchRemovePort:
  * @ifname: the network interface name
@@ -207,6 +501,10 @@ int virNetDevOpenvswitchRemovePort(const char *brname ATTRIBUTE_UNUSED, const ch
     int ret = -1;
     virCommandPtr cmd = NULL;
 
+    if ((ret = virNetDevOpenvswitchDBRemovePort(ifname)) != -2)
+        return ret;
+    ret = -1;
+
     cmd = virCommandNew(OVSVSCTL);
     virNetDevOpenvswitchAddTimeout(cmd);
     virCommandAddArgList(cmd, "--", "--if-exists", "del-port", ifname, NULL);
@@ -223,6 +521,63 @@ int virNetDevOpenvswitchRemovePort(const char *brname ATTRIBUTE_UNUSED, const ch
     return ret;
 }
 
+/*
+ * The migration data used to be passed around in the ovs-vsctl
+ * syntax, which quotes strings that could be mistaken for something
+ * else, stay compatible with other hosts still using ovs-vsctl.
+ */
+static bool
+virNetDevOpenvswitchNeedsQuotes(const char *str)
+{
+    const char *p;
+
+    if (!c_isalpha(*str) && *str != '_')
+        return true;
+
+    for (p = str + 1; *p; p++) {
+        if (!c_isalpha(*p) && *p != '_' && *p != '-' && *p != '.')
+            return true;
+    }
+
+    return STREQ(str, "true") || STREQ(str, "false");
+}
+
+static int
+virNetDevOpenvswitchDBGetMigrateData(char **migrate,
+                                     const char *ifname)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONValuePtr ids = NULL;
+    virJSONValuePtr data;
+    const char *str = NULL;
+    int ret;
+
+    if ((ret = virNetDevOpenvswitchSelect("Interface", ifname,
+                                          "external_ids", &ids)) < 0)
+        goto cleanup;
+
+    if ((data = virNetDevOpenvswitchMapGet(ids, "PortData")))
+        str = virJSONValueGetString(data);
+
+    if (str && virNetDevOpenvswitchNeedsQuotes(str))
+        virOVSDBBufferAddString(&buf, str);
+    else if (str)
+        virBufferAdd(&buf, str, -1);
+
+    if (virBufferCheckError(&buf) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (!(*migrate = virBufferContentAndReset(&buf)))
+        ret = VIR_STRDUP(*migrate, "");
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    virJSONValueFree(ids);
+    return ret;
+}
+
 /**
  * virNetDevOpenvswitchGetMigrateData:
  * @migrate: a pointer to store the data into, allocated by this function
@@ -238,6 +593,10 @@ int virNetDevOpenvswitchGetMigrateData(char **migrate, const char *ifname)
     size_t len;
     int ret = -1;
 
+    if ((ret = virNetDevOpenvswitchDBGetMigrateData(migrate, ifname)) != -2)
+        return ret < 0 ? -1 : 0;
+    ret = -1;
+
     cmd = virCommandNew(OVSVSCTL);
     virNetDevOpenvswitchAddTimeout(cmd);
     virCommandAddArgList(cmd, "--if-exists", "get", "Interface",
@@ -264,6 +623,59 @@ int virNetDevOpenvswitchGetMigrateData(char **migrate, const char *ifname)
     return ret;
 }
 
+static int
+virNetDevOpenvswitchDBSetMigrateData(const char *migrate,
+                                     const char *ifname)
+{
+    virBuffer ops = VIR_BUFFER_INITIALIZER;
+    virJSONValuePtr results = NULL;
+    virJSONValuePtr quoted = NULL;
+    unsigned int count;
+    int ret = -1;
+
+    if (*migrate == '"') {
+        if (!(quoted = virJSONValueFromString(migrate)) ||
+            !(migrate = virJSONValueGetString(quoted))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Malformed OVS port data for interface %s"),
+                           ifname);
+            goto cleanup;
+        }
+    }
+
+    virBufferAddLit(&ops,
+                    "{\"op\":\"mutate\",\"table\":\"Interface\","
+                    "\"where\":[[\"name\",\"==\",");
+    virOVSDBBufferAddString(&ops, ifname);
+    virBufferAddLit(&ops,
+                    "]],\"mutations\":["
+                    "[\"external_ids\",\"delete\",[\"set\",[\"PortData\"]]],"
+                    "[\"external_ids\",\"insert\",[\"map\",[");
+    virNetDevOpenvswitchAddMapPair(&ops, "PortData", migrate);
+    virBufferAddLit(&ops, "]]]]}");
+
+    if ((ret = virNetDevOpenvswitchTransact(&ops, &results)) < 0)
+        goto cleanup;
+
+    ret = -1;
+    if (virNetDevOpenvswitchGetCount(results, 0, &count) < 0)
+        goto cleanup;
+
+    if (count == 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to set OVS port data for interface %s"),
+                       ifname);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&ops);
+    virJSONValueFree(results);
+    virJSONValueFree(quoted);
+    return ret;
+}
+
 /**
  * virNetDevOpenvswitchSetMigrateData:
  * @migrate: the data which was transferred during migration
@@ -283,6 +695,10 @@ int virNetDevOpenvswitchSetMigrateData(char *migrate, const char *ifname)
         return 0;
     }
 
+    if ((ret = virNetDevOpenvswitchDBSetMigrateData(migrate, ifname)) != -2)
+        return ret;
+    ret = -1;
+
     cmd = virCommandNew(OVSVSCTL);
     virNetDevOpenvswitchAddTimeout(cmd);
     virCommandAddArgList(cmd, "set", "Interface", ifname, NULL);
@@ -302,6 +718,73 @@ int virNetDevOpenvswitchSetMigrateData(char *migrate, const char *ifname)
     return ret;
 }
 
+static int
+virNetDevOpenvswitchGetStat(virJSONValuePtr statistics,
+                            const char *name,
+                            long long *value)
+{
+    virJSONValuePtr stat = virNetDevOpenvswitchMapGet(statistics, name);
+
+    if (!stat || virJSONValueGetNumberLong(stat, value) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+virNetDevOpenvswitchDBInterfaceStats(const char *ifname,
+                                     virDomainInterfaceStatsPtr stats)
+{
+    virJSONValuePtr statistics = NULL;
+    int ret;
+
+    if ((ret = virNetDevOpenvswitchSelect("Interface", ifname,
+                                          "statistics", &statistics)) < 0)
+        goto cleanup;
+
+    ret = -1;
+    if (!statistics) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Interface not found"));
+        goto cleanup;
+    }
+
+    /* The TX/RX fields appear to be swapped here
+     * because this is the host view. */
+    if (virNetDevOpenvswitchGetStat(statistics, "rx_bytes",
+                                    &stats->tx_bytes) < 0 ||
+        virNetDevOpenvswitchGetStat(statistics, "rx_packets",
+                                    &stats->tx_packets) < 0 ||
+        virNetDevOpenvswitchGetStat(statistics, "tx_bytes",
+                                    &stats->rx_bytes) < 0 ||
+        virNetDevOpenvswitchGetStat(statistics, "tx_packets",
+                                    &stats->rx_packets) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Interface doesn't have statistics"));
+        goto cleanup;
+    }
+
+    /* Not every interface has errors or dropped, default to 0 */
+    if (virNetDevOpenvswitchGetStat(statistics, "rx_errors",
+                                    &stats->tx_errs) < 0 ||
+        virNetDevOpenvswitchGetStat(statistics, "rx_dropped",
+                                    &stats->tx_drop) < 0 ||
+        virNetDevOpenvswitchGetStat(statistics, "tx_errors",
+                                    &stats->rx_errs) < 0 ||
+        virNetDevOpenvswitchGetStat(statistics, "tx_dropped",
+                                    &stats->rx_drop) < 0) {
+        stats->rx_errs = 0;
+        stats->rx_drop = 0;
+        stats->tx_errs = 0;
+        stats->tx_drop = 0;
+    }
+
+    ret = 0;
+ cleanup:
+    virJSONValueFree(statistics);
+    return ret;
+}
+
 /**
  * virNetDevOpenvswitchInterfaceStats:
  * @ifname: the name of the interface
@@ -327,6 +810,10 @@ virNetDevOpenvswitchInterfaceStats(const char *ifname,
     long long tx_drop;
     int ret = -1;
 
+    if ((ret = virNetDevOpenvswitchDBInterfaceStats(ifname, stats)) != -2)
+        return ret;
+    ret = -1;
+
     /* Just ensure the interface exists in ovs */
     cmd = virCommandNew(OVSVSCTL);
     virNetDevOpenvswitchAddTimeout(cmd);
@@ -425,10 +912,13 @@ virNetDevOpenvswitchGetVhostuserIfname(const char *path,
                                        char **ifname)
 {
     virCommandPtr cmd = NULL;
+    virJSONValuePtr name = NULL;
     char *tmpIfname = NULL;
     char **tokens = NULL;
     size_t ntokens = 0;
+    bool found;
     int status;
+    int rc;
     int ret = -1;
     char *ovs_timeout = NULL;
 
@@ -443,12 +933,19 @@ virNetDevOpenvswitchGetVhostuserIfname(const char *path,
         ret = 0;
         goto cleanup;
     }
+    tmpIfname++;
+
+    if ((rc = virNetDevOpenvswitchSelect("Interface", tmpIfname,
+                                         "name", &name)) == -2) {
+        cmd = virCommandNew(OVSVSCTL);
+        virNetDevOpenvswitchAddTimeout(cmd);
+        virCommandAddArgList(cmd, "get", "Interface", tmpIfname, "name", NULL);
+        found = virCommandRun(cmd, &status) == 0 && status == 0;
+    } else {
+        found = rc == 0 && name;
+    }
 
-    cmd = virCommandNew(OVSVSCTL);
-    virNetDevOpenvswitchAddTimeout(cmd);
-    virCommandAddArgList(cmd, "get", "Interface", tmpIfname, "name", NULL);
-    if (virCommandRun(cmd, &status) < 0 ||
-        status) {
+    if (!found) {
         /* it's not a openvswitch vhostuser interface. */
         ret = 0;
         goto cleanup;
@@ -460,6 +957,7 @@ virNetDevOpenvswitchGetVhostuserIfname(const char *path,
 
  cleanup:
     virStringListFreeCount(tokens, ntokens);
+    virJSONValueFree(name);
     virCommandFree(cmd);
     VIR_FREE(ovs_timeout);
     return ret;
@@ -33,6 +33,7 @@
 #include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virnetlink.h"
 #include "datatypes.h"
 
 #include <stdlib.h>
@@ -53,6 +54,9 @@
 #if defined(HAVE_GETIFADDRS) && defined(AF_LINK)
 # include <ifaddrs.h>
 #endif
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <linux/if_link.h>
+#endif
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -652,16 +656,45 @@ int virNetDevTapCreateInBridgePort(const char *brname,
         tapmac.addr[0] = 0xFE; /* Discourage bridge from using TAP dev MAC */
     }
 
-    if (virNetDevSetMAC(*ifname, &tapmac) < 0)
-        goto error;
+    if (virtPortProfile) {
+        if (virNetDevSetMAC(*ifname, &tapmac) < 0)
+            goto error;
 
-    if (virNetDevTapAttachBridge(*ifname, brname, macaddr, vmuuid,
-                                 virtPortProfile, virtVlan, mtu, actualMTU) < 0) {
-        goto error;
-    }
+        if (virNetDevTapAttachBridge(*ifname, brname, macaddr, vmuuid,
+                                     virtPortProfile, virtVlan,
+                                     mtu, actualMTU) < 0) {
+            goto error;
+        }
 
-    if (virNetDevSetOnline(*ifname, !!(flags & VIR_NETDEV_TAP_CREATE_IFUP)) < 0)
-        goto error;
+        if (virNetDevSetOnline(*ifname,
+                               !!(flags & VIR_NETDEV_TAP_CREATE_IFUP)) < 0)
+            goto error;
+    } else {
+        /* A plain bridge port can be completely set up at once, see
+         * virNetDevTapAttachBridge() for why the MTU of the bridge is
+         * used when none was requested. */
+        virNetDevLinkSetup setup = {
+            .mac = &tapmac,
+            .mtu = mtu,
+            .master = brname,
+            .setOnline = true,
+            .online = !!(flags & VIR_NETDEV_TAP_CREATE_IFUP),
+        };
+
+        if (setup.mtu == 0) {
+            int brMTU = virNetDevGetMTU(brname);
+
+            if (brMTU < 0)
+                goto error;
+            setup.mtu = brMTU;
+        }
+
+        if (virNetDevSetupLink(*ifname, &setup) < 0)
+            goto error;
+
+        if (actualMTU)
+            *actualMTU = setup.mtu;
+    }
 
     if (virNetDevSetCoalesce(*ifname, coalesce) < 0)
         goto error;
@@ -680,7 +713,163 @@ int virNetDevTapCreateInBridgePort(const char *brname,
  * NB. Caller must check that libvirt user is trying to query
  * the interface of a domain they own.  We do no such checking.
  */
-#ifdef __linux__
+#if defined(__linux__) && defined(HAVE_LIBNL)
+/* Fill @stats from the attributes of a RTM_NEWLINK message. The counters
+ * are seen from the point of view of the host, so the bytes transmitted
+ * by the host are the bytes received by the domain and the RX/TX fields
+ * are swapped. The drops include what /proc/net/dev reports in them.
+ */
+static int
+virNetDevTapInterfaceStatsParse(struct nlattr **tb,
+                                virDomainInterfaceStatsPtr stats)
+{
+    if (tb[IFLA_STATS64] &&
+        nla_len(tb[IFLA_STATS64]) >= sizeof(struct rtnl_link_stats64)) {
+        struct rtnl_link_stats64 link;
+
+        /* the attribute payload is only guaranteed to be 4 byte aligned */
+        memcpy(&link, nla_data(tb[IFLA_STATS64]), sizeof(link));
+        stats->rx_bytes = link.tx_bytes;
+        stats->rx_packets = link.tx_packets;
+        stats->rx_errs = link.tx_errors;
+        stats->rx_drop = link.tx_dropped;
+        stats->tx_bytes = link.rx_bytes;
+        stats->tx_packets = link.rx_packets;
+        stats->tx_errs = link.rx_errors;
+        stats->tx_drop = link.rx_dropped + link.rx_missed_errors;
+    } else if (tb[IFLA_STATS] &&
+               nla_len(tb[IFLA_STATS]) >= sizeof(struct rtnl_link_stats)) {
+        struct rtnl_link_stats link;
+
+        memcpy(&link, nla_data(tb[IFLA_STATS]), sizeof(link));
+        stats->rx_bytes = link.tx_bytes;
+        stats->rx_packets = link.tx_packets;
+        stats->rx_errs = link.tx_errors;
+        stats->rx_drop = link.tx_dropped;
+        stats->tx_bytes = link.rx_bytes;
+        stats->tx_packets = link.rx_packets;
+        stats->tx_errs = link.rx_errors;
+        stats->tx_drop = link.rx_dropped + link.rx_missed_errors;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int
+virNetDevTapInterfaceStats(const char *ifname,
+                           virDomainInterfaceStatsPtr stats)
+{
+    struct nlattr *tb[IFLA_MAX + 1] = { NULL, };
+    void *nlData = NULL;
+    int ret = -1;
+
+    if (virNetlinkDumpLink(ifname, -1, &nlData, tb, 0, 0) < 0)
+        return -1;
+
+    if (virNetDevTapInterfaceStatsParse(tb, stats) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("no statistics reported for interface '%s'"),
+                       ifname);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(nlData);
+    return ret;
+}
+
+
+static int
+virNetDevTapInterfaceStatsAllCallback(const struct nlmsghdr *resp,
+                                      void *opaque)
+{
+    virHashTablePtr table = opaque;
+    struct nlattr *tb[IFLA_MAX + 1] = { NULL, };
+    virDomainInterfaceStatsPtr stats = NULL;
+    const char *ifname;
+
+    if (resp->nlmsg_type != RTM_NEWLINK)
+        return 0;
+
+    if (nlmsg_parse((struct nlmsghdr *) resp, sizeof(struct ifinfomsg),
+                    tb, IFLA_MAX, NULL) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed netlink response message"));
+        return -1;
+    }
+
+    if (!tb[IFLA_IFNAME] ||
+        !(ifname = nla_data(tb[IFLA_IFNAME])) ||
+        memchr(ifname, '\0', nla_len(tb[IFLA_IFNAME])) == NULL)
+        return 0;
+
+    if (VIR_ALLOC(stats) < 0)
+        return -1;
+
+    if (virNetDevTapInterfaceStatsParse(tb, stats) < 0) {
+        VIR_FREE(stats);
+        return 0;
+    }
+
+    if (virHashAddEntry(table, ifname, stats) < 0) {
+        VIR_FREE(stats);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virNetDevTapInterfaceStatsAll:
+ *
+ * Read the statistics of all host interfaces at once, as reported by
+ * virNetDevTapInterfaceStats for each of them. This is much cheaper
+ * than looking up many interfaces one by one.
+ *
+ * Returns a hash table of virDomainInterfaceStats keyed by interface
+ * name, or NULL on error.
+ */
+virHashTablePtr
+virNetDevTapInterfaceStatsAll(void)
+{
+    struct nl_msg *nlmsg = NULL;
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    virHashTablePtr table = NULL;
+
+    if (!(table = virHashCreate(64, virHashValueFree)))
+        return NULL;
+
+    if (!(nlmsg = nlmsg_alloc_simple(RTM_GETLINK,
+                                     NLM_F_REQUEST | NLM_F_DUMP))) {
+        virReportOOMError();
+        goto error;
+    }
+
+    if (nlmsg_append(nlmsg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        goto error;
+    }
+
+    if (virNetlinkDumpCommand(nlmsg, virNetDevTapInterfaceStatsAllCallback,
+                              0, 0, NETLINK_ROUTE, 0, table) < 0)
+        goto error;
+
+    nlmsg_free(nlmsg);
+    return table;
+
+ error:
+    nlmsg_free(nlmsg);
+    virHashFree(table);
+    return NULL;
+}
+#elif defined(__linux__)
 int
 virNetDevTapInterfaceStats(const char *ifname,
                            virDomainInterfaceStatsPtr stats)
@@ -811,3 +1000,14 @@ virNetDevTapInterfaceStats(const char *ifname ATTRIBUTE_UNUSED,
 }
 
 #endif /* __linux__ */
+
+#if !defined(__linux__) || !defined(HAVE_LIBNL)
+virHashTablePtr
+virNetDevTapInterfaceStatsAll(void)
+{
+    virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                   _("reading the stats of all interfaces at once is not "
+                     "supported on this platform"));
+    return NULL;
+}
+#endif
@@ -34,6 +34,12 @@
 #include "virstring.h"
 #include "virutil.h"
 #include "virnetdev.h"
+#include "virnetlink.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <linux/rtnetlink.h>
+# include <linux/veth.h>
+#endif
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -83,39 +89,215 @@ static int virNetDevVethGetFreeNum(int startDev)
     return -1;
 }
 
+/* Picks names for the ends of a veth pair the caller did not name,
+ * starting the search at *@vethNum */
+static int
+virNetDevVethAllocNames(char *veth1, char *veth2,
+                        char **veth1auto, char **veth2auto,
+                        int *vethNum)
+{
+    if (!veth1) {
+        int veth1num;
+        if ((veth1num = virNetDevVethGetFreeNum(*vethNum)) < 0)
+            return -1;
+
+        if (virAsprintf(veth1auto, "vnet%d", veth1num) < 0)
+            return -1;
+        *vethNum = veth1num + 1;
+    }
+    if (!veth2) {
+        int veth2num;
+        if ((veth2num = virNetDevVethGetFreeNum(*vethNum)) < 0)
+            return -1;
+
+        if (virAsprintf(veth2auto, "vnet%d", veth2num) < 0)
+            return -1;
+        *vethNum = veth2num + 1;
+    }
+
+    return 0;
+}
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+/* Builds the request equivalent to
+ * ip link add veth1 type veth peer name veth2 */
+static struct nl_msg *
+virNetDevVethNewLinkMsg(const char *veth1, const char *veth2)
+{
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nl_msg *nl_msg;
+    struct nlattr *linkinfo, *info_data, *peer;
+    const char *type = "veth";
+
+    nl_msg = nlmsg_alloc_simple(RTM_NEWLINK,
+                                NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL);
+    if (!nl_msg) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0)
+        goto buffer_too_small;
+
+    if (nla_put(nl_msg, IFLA_IFNAME, strlen(veth1) + 1, veth1) < 0)
+        goto buffer_too_small;
+
+    if (!(linkinfo = nla_nest_start(nl_msg, IFLA_LINKINFO)))
+        goto buffer_too_small;
+
+    if (nla_put(nl_msg, IFLA_INFO_KIND, strlen(type), type) < 0)
+        goto buffer_too_small;
+
+    if (!(info_data = nla_nest_start(nl_msg, IFLA_INFO_DATA)))
+        goto buffer_too_small;
+
+    /* The peer is described like a link of its own */
+    if (!(peer = nla_nest_start(nl_msg, VETH_INFO_PEER)))
+        goto buffer_too_small;
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0)
+        goto buffer_too_small;
+
+    if (nla_put(nl_msg, IFLA_IFNAME, strlen(veth2) + 1, veth2) < 0)
+        goto buffer_too_small;
+
+    nla_nest_end(nl_msg, peer);
+    nla_nest_end(nl_msg, info_data);
+    nla_nest_end(nl_msg, linkinfo);
+
+    return nl_msg;
+
+ buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    nlmsg_free(nl_msg);
+    return NULL;
+}
+
+/* Sends the creation requests of all @npairs pairs at once. Returns
+ * -1 on error, otherwise 0 with @created[i] telling whether pair @i
+ * now exists. Pairs which failed because a name is taken are left for
+ * the caller to retry with other names. */
+static int
+virNetDevVethCreateRound(char **veth1, char **veth2, size_t npairs,
+                         bool *created)
+{
+    int ret = -1;
+    struct nl_msg **msgs = NULL;
+    int *errors = NULL;
+    size_t i;
+
+    if (VIR_ALLOC_N(msgs, npairs) < 0 ||
+        VIR_ALLOC_N(errors, npairs) < 0)
+        goto cleanup;
+
+    for (i = 0; i < npairs; i++) {
+        if (!(msgs[i] = virNetDevVethNewLinkMsg(veth1[i], veth2[i])))
+            goto cleanup;
+    }
+
+    if (virNetlinkCommandBatch(msgs, npairs, errors, NETLINK_ROUTE) < 0)
+        goto cleanup;
+
+    for (i = 0; i < npairs; i++) {
+        created[i] = errors[i] == 0;
+        if (errors[i] == 0 || errors[i] == -EEXIST) {
+            VIR_DEBUG("Create host: %s guest: %s: %d",
+                      veth1[i], veth2[i], errors[i]);
+            continue;
+        }
+
+        virReportSystemError(-errors[i],
+                             _("Failed to create veth host: %s guest: %s"),
+                             veth1[i], veth2[i]);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (msgs) {
+        for (i = 0; i < npairs; i++)
+            nlmsg_free(msgs[i]);
+    }
+    VIR_FREE(msgs);
+    VIR_FREE(errors);
+    return ret;
+}
+#else /* !(defined(__linux__) && defined(HAVE_LIBNL)) */
+static int
+virNetDevVethCreateRound(char **veth1, char **veth2, size_t npairs,
+                         bool *created)
+{
+    virCommandPtr cmd = NULL;
+    size_t i;
+
+    for (i = 0; i < npairs; i++) {
+        int status;
+
+        cmd = virCommandNew("ip");
+        virCommandAddArgList(cmd, "link", "add", veth1[i],
+                             "type", "veth", "peer", "name", veth2[i],
+                             NULL);
+
+        if (virCommandRun(cmd, &status) < 0) {
+            virCommandFree(cmd);
+            return -1;
+        }
+        virCommandFree(cmd);
+
+        VIR_DEBUG("Create host: %s guest: %s: %d",
+                  veth1[i], veth2[i], status);
+        created[i] = status == 0;
+    }
+
+    return 0;
+}
+#endif /* !(defined(__linux__) && defined(HAVE_LIBNL)) */
+
 /**
- * virNetDevVethCreate:
- * @veth1: pointer to name for parent end of veth pair
- * @veth2: pointer to return name for container end of veth pair
+ * virNetDevVethCreateBatch:
+ * @veth1: array of pointers to names for parent ends of veth pairs
+ * @veth2: array of pointers to return names for container ends
+ * @npairs: number of pairs to create
  *
- * Creates a veth device pair using the ip command:
- * ip link add veth1 type veth peer name veth2
- * If veth1 points to NULL on entry, it will be a valid interface on
- * return.  veth2 should point to NULL on entry.
+ * Creates @npairs veth device pairs, as virNetDevVethCreate() would do
+ * for each of @veth1[i] and @veth2[i]. Where netlink is available, the
+ * requests for all the pairs are sent to the kernel at once rather
+ * than running the ip command for every pair.
  *
- * NOTE: If veth1 and veth2 names are not specified, ip will auto assign
- *       names.  There seems to be two problems here -
- *       1) There doesn't seem to be a way to determine the names of the
- *          devices that it creates.  They show up in ip link show and
- *          under /sys/class/net/ however there is no guarantee that they
- *          are the devices that this process just created.
- *       2) Once one of the veth devices is moved to another namespace, it
- *          is no longer visible in the parent namespace.  This seems to
- *          confuse the name assignment causing it to fail with File exists.
- *       Because of these issues, this function currently allocates names
- *       prior to using the ip command, and returns any allocated names
- *       to the caller.
+ * Either all the pairs are created, or none.
  *
  * Returns 0 on success or -1 in case of error
  */
-int virNetDevVethCreate(char** veth1, char** veth2)
+int
+virNetDevVethCreateBatch(char **veth1, char **veth2, size_t npairs)
 {
     int ret = -1;
-    char *veth1auto = NULL;
-    char *veth2auto = NULL;
-    int vethNum = 0;
-    virCommandPtr cmd = NULL;
-    size_t i;
+    char **names1 = NULL;
+    char **names2 = NULL;
+    char **auto1 = NULL;
+    char **auto2 = NULL;
+    bool *created = NULL;
+    bool *done = NULL;
+    size_t *pending = NULL;
+    size_t npending = npairs;
+    size_t i, j;
+
+    if (!npairs)
+        return 0;
+
+    if (VIR_ALLOC_N(names1, npairs) < 0 ||
+        VIR_ALLOC_N(names2, npairs) < 0 ||
+        VIR_ALLOC_N(auto1, npairs) < 0 ||
+        VIR_ALLOC_N(auto2, npairs) < 0 ||
+        VIR_ALLOC_N(created, npairs) < 0 ||
+        VIR_ALLOC_N(done, npairs) < 0 ||
+        VIR_ALLOC_N(pending, npairs) < 0)
+        goto cleanup;
+
+    for (i = 0; i < npairs; i++)
+        pending[i] = i;
 
     /*
      * We might race with other containers, but this is reasonably
@@ -124,73 +306,109 @@ int virNetDevVethCreate(char** veth1, char** veth2)
     virMutexLock(&virNetDevVethCreateMutex);
 #define MAX_VETH_RETRIES 10
 
-    for (i = 0; i < MAX_VETH_RETRIES; i++) {
-        int status;
-        if (!*veth1) {
-            int veth1num;
-            if ((veth1num = virNetDevVethGetFreeNum(vethNum)) < 0)
-                goto cleanup;
-
-            if (virAsprintf(&veth1auto, "vnet%d", veth1num) < 0)
-                goto cleanup;
-            vethNum = veth1num + 1;
-        }
-        if (!*veth2) {
-            int veth2num;
-            if ((veth2num = virNetDevVethGetFreeNum(vethNum)) < 0)
-                goto cleanup;
-
-            if (virAsprintf(&veth2auto, "vnet%d", veth2num) < 0)
-                goto cleanup;
-            vethNum = veth2num + 1;
+    for (i = 0; i < MAX_VETH_RETRIES && npending; i++) {
+        int vethNum = 0;
+        size_t left = 0;
+
+        for (j = 0; j < npending; j++) {
+            size_t idx = pending[j];
+
+            if (virNetDevVethAllocNames(veth1[idx], veth2[idx],
+                                        &auto1[idx], &auto2[idx],
+                                        &vethNum) < 0)
+                goto unlock;
+
+            names1[j] = veth1[idx] ? veth1[idx] : auto1[idx];
+            names2[j] = veth2[idx] ? veth2[idx] : auto2[idx];
         }
 
-        cmd = virCommandNew("ip");
-        virCommandAddArgList(cmd, "link", "add",
-                             *veth1 ? *veth1 : veth1auto,
-                             "type", "veth", "peer", "name",
-                             *veth2 ? *veth2 : veth2auto,
-                             NULL);
+        if (virNetDevVethCreateRound(names1, names2, npending, created) < 0)
+            goto unlock;
 
-        if (virCommandRun(cmd, &status) < 0)
-            goto cleanup;
+        for (j = 0; j < npending; j++) {
+            size_t idx = pending[j];
 
-        if (status == 0) {
-            if (veth1auto) {
-                *veth1 = veth1auto;
-                veth1auto = NULL;
+            if (created[j]) {
+                done[idx] = true;
+            } else {
+                VIR_FREE(auto1[idx]);
+                VIR_FREE(auto2[idx]);
+                pending[left++] = idx;
             }
-            if (veth2auto) {
-                *veth2 = veth2auto;
-                veth2auto = NULL;
-            }
-            VIR_DEBUG("Create Host: %s guest: %s", *veth1, *veth2);
-            ret = 0;
-            goto cleanup;
         }
+        npending = left;
+    }
 
-        VIR_DEBUG("Failed to create veth host: %s guest: %s: %d",
-                  *veth1 ? *veth1 : veth1auto,
-                  *veth2 ? *veth2 : veth2auto,
-                  status);
-        VIR_FREE(veth1auto);
-        VIR_FREE(veth2auto);
-        virCommandFree(cmd);
-        cmd = NULL;
+    if (npending) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to allocate free veth pair after %d attempts"),
+                       MAX_VETH_RETRIES);
+        goto unlock;
     }
 
-    virReportError(VIR_ERR_INTERNAL_ERROR,
-                   _("Failed to allocate free veth pair after %d attempts"),
-                   MAX_VETH_RETRIES);
+    for (i = 0; i < npairs; i++) {
+        if (auto1[i]) {
+            veth1[i] = auto1[i];
+            auto1[i] = NULL;
+        }
+        if (auto2[i]) {
+            veth2[i] = auto2[i];
+            auto2[i] = NULL;
+        }
+    }
 
- cleanup:
+    ret = 0;
+
+ unlock:
     virMutexUnlock(&virNetDevVethCreateMutex);
-    virCommandFree(cmd);
-    VIR_FREE(veth1auto);
-    VIR_FREE(veth2auto);
+
+ cleanup:
+    for (i = 0; done && i < npairs; i++) {
+        if (ret < 0 && done[i])
+            ignore_value(virNetDevVethDelete(veth1[i] ? veth1[i] : auto1[i]));
+        VIR_FREE(auto1[i]);
+        VIR_FREE(auto2[i]);
+    }
+    VIR_FREE(names1);
+    VIR_FREE(names2);
+    VIR_FREE(auto1);
+    VIR_FREE(auto2);
+    VIR_FREE(created);
+    VIR_FREE(done);
+    VIR_FREE(pending);
     return ret;
 }
 
+/**
+ * virNetDevVethCreate:
+ * @veth1: pointer to name for parent end of veth pair
+ * @veth2: pointer to return name for container end of veth pair
+ *
+ * Creates a veth device pair, the way
+ * ip link add veth1 type veth peer name veth2
+ * does. If veth1 points to NULL on entry, it will be a valid interface
+ * on return.  veth2 should point to NULL on entry.
+ *
+ * NOTE: If veth1 and veth2 names are not specified, ip will auto assign
+ *       names.  There seems to be two problems here -
+ *       1) There doesn't seem to be a way to determine the names of the
+ *          devices that it creates.  They show up in ip link show and
+ *          under /sys/class/net/ however there is no guarantee that they
+ *          are the devices that this process just created.
+ *       2) Once one of the veth devices is moved to another namespace, it
+ *          is no longer visible in the parent namespace.  This seems to
+ *          confuse the name assignment causing it to fail with File exists.
+ *       Because of these issues, this function currently allocates names
+ *       prior to creating the devices, and returns any allocated names
+ *       to the caller.
+ *
+ * Returns 0 on success or -1 in case of error
+ */
+int virNetDevVethCreate(char** veth1, char** veth2)
+{
+    return virNetDevVethCreateBatch(veth1, veth2, 1);
+}
+
 /**
  * virNetDevVethDelete:
  * @veth: name for one end of veth pair
@@ -29,6 +29,8 @@
 /* Function declarations */
 int virNetDevVethCreate(char **veth1, char **veth2)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+int virNetDevVethCreateBatch(char **veth1, char **veth2, size_t npairs)
+    ATTRIBUTE_RETURN_CHECK;
 int virNetDevVethDelete(const char *veth)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
@@ -35,7 +35,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 
-#include "virnetlink.h"
+#define __VIR_NETLINK_PRIV_H_ALLOW__
+#include "virnetlinkpriv.h"
 #include "virnetdev.h"
 #include "virlog.h"
 #include "viralloc.h"
@@ -49,6 +50,32 @@ VIR_LOG_INIT("util.netlink");
 
 #define NETLINK_ACK_TIMEOUT_S  (2*1000)
 
+/* See virNetlinkSetDryRun for description for these variables */
+static virNetlinkDryRunCallback dryRunCallback;
+static void *dryRunOpaque;
+
+/**
+ * virNetlinkSetDryRun:
+ * @cb: callback to process messages
+ * @opaque: data passed to @cb
+ *
+ * Unit tests want to see the requests a function would pass to the
+ * kernel without needing the privileges and devices to actually
+ * execute them. Once called, every message handed to
+ * virNetlinkCommandBatch is passed to @cb instead of being sent,
+ * and the value @cb returns (0 or a negative errno value) is used
+ * as the acknowledgement for that message.
+ *
+ * To cancel this effect pass NULL for @cb.
+ */
+void
+virNetlinkSetDryRun(virNetlinkDryRunCallback cb,
+                    void *opaque)
+{
+    dryRunCallback = cb;
+    dryRunOpaque = opaque;
+}
+
 #if defined(__linux__) && defined(HAVE_LIBNL)
 /* State for a single netlink event handle */
 struct virNetlinkEventHandle {
@@ -361,6 +388,16 @@ virNetlinkDumpCommand(struct nl_msg *nl_msg,
 
     while (!end) {
         len = nl_recv(nlhandle, &nladdr, (unsigned char **)&resp, NULL);
+        if (len == 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("nl_recv failed - returned 0 bytes"));
+            goto cleanup;
+        }
+        if (len < 0) {
+            virReportSystemError(errno, "%s", _("nl_recv failed"));
+            goto cleanup;
+        }
+
         VIR_WARNINGS_NO_CAST_ALIGN
         for (msg = resp; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
             VIR_WARNINGS_RESET
@@ -373,11 +410,164 @@ virNetlinkDumpCommand(struct nl_msg *nl_msg,
             if (callback(msg, opaque) < 0)
                 goto cleanup;
         }
+        VIR_FREE(resp);
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(resp);
+    virNetlinkFree(nlhandle);
+    return ret;
+}
+
+/**
+ * virNetlinkCommandBatch:
+ * @msgs: array of netlink messages
+ * @nmsgs: number of messages in @msgs
+ * @errors: array of @nmsgs integers to store per message results into
+ * @protocol: netlink protocol
+ *
+ * Send all @msgs to the kernel at once and collect the acknowledgement
+ * of each of them, so that a series of requests costs a single round
+ * trip rather than one per message. The kernel processes the messages
+ * in order and independently of each other: a failing request does
+ * not prevent the following ones from being executed. On return,
+ * @errors[i] is 0 if @msgs[i] succeeded or a negative errno value
+ * otherwise. It's up to the caller to decide which failures matter.
+ *
+ * Returns 0 if all the messages were acknowledged, -1 (with error
+ * reported) if the batch could not be sent or the acknowledgements
+ * could not be read.
+ */
+int
+virNetlinkCommandBatch(struct nl_msg **msgs,
+                       size_t nmsgs,
+                       int *errors,
+                       unsigned int protocol)
+{
+    int ret = -1;
+    struct sockaddr_nl nladdr = {
+            .nl_family = AF_NETLINK,
+            .nl_pid    = 0,
+            .nl_groups = 0,
+    };
+    virNetlinkHandle *nlhandle = NULL;
+    struct nlmsghdr *resp = NULL;
+    struct nlmsghdr *msg;
+    struct pollfd fds[1];
+    char *buf = NULL;
+    size_t buflen = 0;
+    size_t nacked = 0;
+    size_t i;
+    int len;
+    int fd;
+
+    for (i = 0; i < nmsgs; i++)
+        errors[i] = 0;
+
+    if (dryRunCallback) {
+        for (i = 0; i < nmsgs; i++)
+            errors[i] = dryRunCallback(nlmsg_hdr(msgs[i]), dryRunOpaque);
+        return 0;
+    }
+
+    if (!nmsgs)
+        return 0;
+
+    if (protocol >= MAX_LINKS) {
+        virReportSystemError(EINVAL,
+                             _("invalid protocol argument: %d"), protocol);
+        return -1;
+    }
+
+    if (!(nlhandle = virNetlinkCreateSocket(protocol)))
+        goto cleanup;
+
+    fd = nl_socket_get_fd(nlhandle);
+    if (fd < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot get netlink socket fd"));
+        goto cleanup;
+    }
+
+    /* The sequence number is what ties an acknowledgement to its
+     * request. The socket is private to this call, so the index in
+     * @msgs will do. */
+    for (i = 0; i < nmsgs; i++) {
+        struct nlmsghdr *nlmsg = nlmsg_hdr(msgs[i]);
+        size_t msglen = NLMSG_ALIGN(nlmsg->nlmsg_len);
+
+        nlmsg->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+        nlmsg->nlmsg_seq = i + 1;
+        nlmsg->nlmsg_pid = 0;
+
+        if (VIR_REALLOC_N(buf, buflen + msglen) < 0)
+            goto cleanup;
+        memcpy(buf + buflen, nlmsg, msglen);
+        buflen += msglen;
+    }
+
+    if (sendto(fd, buf, buflen, 0,
+               (struct sockaddr *) &nladdr, sizeof(nladdr)) < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot send to netlink socket"));
+        goto cleanup;
+    }
+
+    memset(fds, 0, sizeof(fds));
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+
+    while (nacked < nmsgs) {
+        int n = poll(fds, ARRAY_CARDINALITY(fds), NETLINK_ACK_TIMEOUT_S);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            virReportSystemError(errno, "%s",
+                                 _("error in poll call"));
+            goto cleanup;
+        }
+        if (n == 0) {
+            virReportSystemError(ETIMEDOUT, "%s",
+                                 _("no valid netlink response was received"));
+            goto cleanup;
+        }
+
+        len = nl_recv(nlhandle, &nladdr, (unsigned char **)&resp, NULL);
+        if (len <= 0) {
+            virReportSystemError(errno, "%s", _("nl_recv failed"));
+            goto cleanup;
+        }
+
+        VIR_WARNINGS_NO_CAST_ALIGN
+        for (msg = resp; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+            VIR_WARNINGS_RESET
+            struct nlmsgerr *err;
+
+            if (msg->nlmsg_type != NLMSG_ERROR ||
+                msg->nlmsg_seq == 0 || msg->nlmsg_seq > nmsgs)
+                continue;
+
+            if (msg->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("malformed netlink response message"));
+                goto cleanup;
+            }
+
+            err = (struct nlmsgerr *)NLMSG_DATA(msg);
+            errors[msg->nlmsg_seq - 1] = err->error;
+            nacked++;
+        }
+        VIR_FREE(resp);
     }
 
     ret = 0;
 
  cleanup:
+    VIR_FREE(resp);
+    VIR_FREE(buf);
     virNetlinkFree(nlhandle);
     return ret;
 }
@@ -1108,6 +1298,16 @@ int virNetlinkCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
     return -1;
 }
 
+int
+virNetlinkCommandBatch(struct nl_msg **msgs ATTRIBUTE_UNUSED,
+                       size_t nmsgs ATTRIBUTE_UNUSED,
+                       int *errors ATTRIBUTE_UNUSED,
+                       unsigned int protocol ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
 int
 virNetlinkDumpCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
                       virNetlinkDumpCallback callback ATTRIBUTE_UNUSED,
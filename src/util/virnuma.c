@@ -36,8 +36,11 @@
 
 #include <sys/types.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "virnuma.h"
+#include "intprops.h"
 #include "vircommand.h"
 #include "virerror.h"
 #include "virlog.h"
@@ -46,6 +49,8 @@
 #include "virstring.h"
 #include "virfile.h"
 #include "virhostmem.h"
+#include "virhosttopology.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -85,6 +90,139 @@ virNumaGetAutoPlacementAdvice(unsigned short vcpus ATTRIBUTE_UNUSED,
 }
 #endif /* !HAVE_NUMAD */
 
+static unsigned int
+virNumaPlacementNodeSpare(virNumaPlacementNodePtr node)
+{
+    return node->load < node->ncpus ? node->ncpus - node->load : 0;
+}
+
+
+/* Whether @a is a better home than @b for a domain with @vcpus vCPUs:
+ * one that has enough spare CPUs wins, then the one with more spare
+ * CPUs and finally the one with more free memory */
+static bool
+virNumaPlacementNodeBetter(virNumaPlacementNodePtr a,
+                           virNumaPlacementNodePtr b,
+                           unsigned int vcpus)
+{
+    unsigned int spareA = virNumaPlacementNodeSpare(a);
+    unsigned int spareB = virNumaPlacementNodeSpare(b);
+
+    if ((spareA >= vcpus) != (spareB >= vcpus))
+        return spareA >= vcpus;
+    if (spareA != spareB)
+        return spareA > spareB;
+    return a->memFree > b->memFree;
+}
+
+
+/**
+ * virNumaPlacementChoose:
+ * @nodes: host NUMA nodes
+ * @nnodes: number of items in @nodes
+ * @vcpus: number of vCPUs of the domain
+ * @memory: memory of the domain in KiB
+ *
+ * Pick the host nodes for a domain with automatic placement, in the
+ * manner of numad but without having to ask it. A single node that
+ * fits the whole domain is preferred, looking at the spare CPUs first,
+ * so that domains started one after another are spread over the host.
+ * When no node has enough free memory, the domain is spread over the
+ * node with the most free memory and the closest ones to it, until it
+ * fits. If it never does, all the nodes are returned.
+ *
+ * Returns the nodeset on success, NULL on error.
+ */
+virBitmapPtr
+virNumaPlacementChoose(virNumaPlacementNodePtr nodes,
+                       size_t nnodes,
+                       unsigned int vcpus,
+                       unsigned long long memory)
+{
+    virBitmapPtr ret = NULL;
+    bool *chosen = NULL;
+    unsigned long long memChosen = 0;
+    unsigned long long spareChosen = 0;
+    ssize_t best = -1;
+    int maxid = 0;
+    size_t i, j;
+
+    if (!nnodes) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("no host NUMA nodes to place the domain on"));
+        return NULL;
+    }
+
+    for (i = 0; i < nnodes; i++)
+        maxid = MAX(maxid, nodes[i].id);
+
+    if (!(ret = virBitmapNew(maxid + 1)))
+        return NULL;
+
+    for (i = 0; i < nnodes; i++) {
+        if (nodes[i].memFree < memory)
+            continue;
+
+        if (best < 0 || virNumaPlacementNodeBetter(&nodes[i], &nodes[best],
+                                                   vcpus))
+            best = i;
+    }
+
+    if (best >= 0) {
+        ignore_value(virBitmapSetBit(ret, nodes[best].id));
+        return ret;
+    }
+
+    if (VIR_ALLOC_N(chosen, nnodes) < 0) {
+        virBitmapFree(ret);
+        return NULL;
+    }
+
+    best = 0;
+    for (i = 1; i < nnodes; i++) {
+        if (nodes[i].memFree > nodes[best].memFree)
+            best = i;
+    }
+
+    while (best >= 0) {
+        unsigned long long bestDistance = 0;
+
+        chosen[best] = true;
+        memChosen += nodes[best].memFree;
+        spareChosen += virNumaPlacementNodeSpare(&nodes[best]);
+        ignore_value(virBitmapSetBit(ret, nodes[best].id));
+
+        if (memChosen >= memory && spareChosen >= vcpus)
+            break;
+
+        /* Grow towards the node closest to the ones picked so far */
+        best = -1;
+        for (i = 0; i < nnodes; i++) {
+            unsigned long long distance = 0;
+
+            if (chosen[i])
+                continue;
+
+            for (j = 0; j < nnodes; j++) {
+                if (!chosen[j])
+                    continue;
+                distance += nodes[j].distances ? nodes[j].distances[i] : 1;
+            }
+
+            if (best < 0 || distance < bestDistance ||
+                (distance == bestDistance &&
+                 nodes[i].memFree > nodes[best].memFree)) {
+                best = i;
+                bestDistance = distance;
+            }
+        }
+    }
+
+    VIR_FREE(chosen);
+    return ret;
+}
+
+
 #if WITH_NUMACTL
 int
 virNumaSetupMemoryPolicy(virDomainNumatuneMemMode mode,
@@ -255,6 +393,8 @@ virNumaGetNodeCPUs(int node,
     unsigned long *mask = NULL;
     unsigned long *allonesmask = NULL;
     virBitmapPtr cpumap = NULL;
+    virHostTopologyPtr topo = NULL;
+    bool cached = false;
     int ncpus = 0;
     int max_n_cpus = virNumaGetMaxCPUs();
     int mask_n_bytes = max_n_cpus / 8;
@@ -263,6 +403,16 @@ virNumaGetNodeCPUs(int node,
 
     *cpus = NULL;
 
+    if ((topo = virHostTopologyGet()) &&
+        (ret = virHostTopologyGetNodeCPUs(topo, node, cpus, &ncpus)) != 0) {
+        if (ret > 0) {
+            cached = true;
+            ret = ncpus;
+        }
+        goto cleanup;
+    }
+    ret = -1;
+
     if (VIR_ALLOC_N(mask, mask_n_bytes / sizeof(*mask)) < 0)
         goto cleanup;
 
@@ -300,6 +450,10 @@ virNumaGetNodeCPUs(int node,
     ret = ncpus;
 
  cleanup:
+    /* The missing topology of a node is remembered too */
+    if (topo && !cached && (ret >= 0 || ret == -2))
+        ignore_value(virHostTopologySetNodeCPUs(topo, node, *cpus, ret));
+    virObjectUnref(topo);
     VIR_FREE(mask);
     VIR_FREE(allonesmask);
     virBitmapFree(cpumap);
@@ -421,7 +575,9 @@ virNumaGetDistances(int node,
                     int **distances,
                     int *ndistances)
 {
+    virHostTopologyPtr topo = NULL;
     int ret = -1;
+    int rc;
     int max_node;
     size_t i;
 
@@ -432,6 +588,14 @@ virNumaGetDistances(int node,
         return 0;
     }
 
+    if ((topo = virHostTopologyGet()) &&
+        (rc = virHostTopologyGetDistances(topo, node,
+                                          distances, ndistances)) != 0) {
+        if (rc > 0)
+            ret = 0;
+        goto cleanup;
+    }
+
     if ((max_node = virNumaGetMaxNode()) < 0)
         goto cleanup;
 
@@ -447,8 +611,13 @@ virNumaGetDistances(int node,
         (*distances)[i] = numa_distance(node, i);
     }
 
+    if (topo)
+        ignore_value(virHostTopologySetDistances(topo, node,
+                                                 *distances, *ndistances));
+
     ret = 0;
  cleanup:
+    virObjectUnref(topo);
     return ret;
 }
 
@@ -542,6 +711,142 @@ virNumaGetHugePageInfoDir(char **path, int node)
     }
 }
 
+typedef enum {
+    VIR_NUMA_HUGEPAGE_NR,
+    VIR_NUMA_HUGEPAGE_FREE,
+
+    VIR_NUMA_HUGEPAGE_LAST
+} virNumaHugePageCounter;
+
+static const char *virNumaHugePageCounterFiles[VIR_NUMA_HUGEPAGE_LAST] = {
+    "nr_hugepages",
+    "free_hugepages",
+};
+
+/*
+ * The counters of huge page pools are read on every capabilities
+ * refresh, virNodeGetFreePages() call and hugepage backed domain
+ * start. Rather than formatting the path, checking it exists and
+ * opening it each time, the sysfs files are kept open, indexed by
+ * node and page size, and re-read at offset 0, which makes the
+ * kernel produce the current value.
+ */
+typedef struct _virNumaHugePagePool virNumaHugePagePool;
+typedef virNumaHugePagePool *virNumaHugePagePoolPtr;
+struct _virNumaHugePagePool {
+    unsigned int page_size;
+    int fds[VIR_NUMA_HUGEPAGE_LAST];
+};
+
+typedef struct _virNumaHugePageNode virNumaHugePageNode;
+typedef virNumaHugePageNode *virNumaHugePageNodePtr;
+struct _virNumaHugePageNode {
+    virNumaHugePagePoolPtr pools;
+    size_t npools;
+};
+
+static virMutex virNumaHugePageLock = VIR_MUTEX_INITIALIZER;
+/* Indexed by node + 1, the first entry is for the whole system */
+static virNumaHugePageNodePtr virNumaHugePageNodes;
+static size_t virNumaHugePageNodesCount;
+
+
+/* Must be called with virNumaHugePageLock held */
+static virNumaHugePagePoolPtr
+virNumaHugePagePoolGet(int node,
+                       unsigned int page_size)
+{
+    virNumaHugePageNodePtr def;
+    virNumaHugePagePool pool = { .page_size = page_size, .fds = { -1, -1 } };
+    size_t idx = node + 1;
+    size_t i;
+
+    if (node < -1) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("NUMA node %d is not available"), node);
+        return NULL;
+    }
+
+    if (idx >= virNumaHugePageNodesCount &&
+        VIR_EXPAND_N(virNumaHugePageNodes, virNumaHugePageNodesCount,
+                     idx + 1 - virNumaHugePageNodesCount) < 0)
+        return NULL;
+
+    def = &virNumaHugePageNodes[idx];
+    for (i = 0; i < def->npools; i++) {
+        if (def->pools[i].page_size == page_size)
+            return &def->pools[i];
+    }
+
+    if (VIR_APPEND_ELEMENT(def->pools, def->npools, pool) < 0)
+        return NULL;
+
+    return &def->pools[def->npools - 1];
+}
+
+
+static int
+virNumaReadHugePageCounter(int node,
+                           unsigned int page_size,
+                           virNumaHugePageCounter counter,
+                           unsigned int *value)
+{
+    virNumaHugePagePoolPtr pool;
+    char *path = NULL;
+    char buf[INT_BUFSIZE_BOUND(*value) + 2];
+    char *end;
+    ssize_t len = -1;
+    bool retried = false;
+    int ret = -1;
+
+    virMutexLock(&virNumaHugePageLock);
+
+    if (!(pool = virNumaHugePagePoolGet(node, page_size)))
+        goto cleanup;
+
+ retry:
+    if (pool->fds[counter] < 0) {
+        VIR_FREE(path);
+        if (virNumaGetHugePageInfoPath(&path, node, page_size,
+                                       virNumaHugePageCounterFiles[counter]) < 0)
+            goto cleanup;
+
+        if ((pool->fds[counter] = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+            virReportSystemError(errno, _("unable to open %s"), path);
+            goto cleanup;
+        }
+    }
+
+    if ((len = pread(pool->fds[counter], buf, sizeof(buf) - 1, 0)) < 0) {
+        /* The pool may have gone away along with its node, in which
+         * case opening it again reports the proper error */
+        VIR_FORCE_CLOSE(pool->fds[counter]);
+        if (!retried) {
+            retried = true;
+            goto retry;
+        }
+        virReportSystemError(errno, _("unable to read %s"), path);
+        goto cleanup;
+    }
+    buf[len] = '\0';
+
+    if (virStrToLong_ui(buf, &end, 10, value) < 0 ||
+        *end != '\n') {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unable to parse: %s"),
+                       buf);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&virNumaHugePageLock);
+    VIR_FREE(path);
+    return ret;
+}
+
+
 /**
  * virNumaGetHugePageInfo:
  * @node: NUMA node id
@@ -566,52 +871,17 @@ virNumaGetHugePageInfo(int node,
                        unsigned int *page_avail,
                        unsigned int *page_free)
 {
-    int ret = -1;
-    char *path = NULL;
-    char *buf = NULL;
-    char *end;
-
-    if (page_avail) {
-        if (virNumaGetHugePageInfoPath(&path, node,
-                                       page_size, "nr_hugepages") < 0)
-            goto cleanup;
-
-        if (virFileReadAll(path, 1024, &buf) < 0)
-            goto cleanup;
-
-        if (virStrToLong_ui(buf, &end, 10, page_avail) < 0 ||
-            *end != '\n') {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("unable to parse: %s"),
-                           buf);
-            goto cleanup;
-        }
-        VIR_FREE(buf);
-        VIR_FREE(path);
-    }
-
-    if (page_free) {
-        if (virNumaGetHugePageInfoPath(&path, node,
-                                       page_size, "free_hugepages") < 0)
-            goto cleanup;
-
-        if (virFileReadAll(path, 1024, &buf) < 0)
-            goto cleanup;
+    if (page_avail &&
+        virNumaReadHugePageCounter(node, page_size,
+                                   VIR_NUMA_HUGEPAGE_NR, page_avail) < 0)
+        return -1;
 
-        if (virStrToLong_ui(buf, &end, 10, page_free) < 0 ||
-            *end != '\n') {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("unable to parse: %s"),
-                           buf);
-            goto cleanup;
-        }
-    }
+    if (page_free &&
+        virNumaReadHugePageCounter(node, page_size,
+                                   VIR_NUMA_HUGEPAGE_FREE, page_free) < 0)
+        return -1;
 
-    ret = 0;
- cleanup:
-    VIR_FREE(buf);
-    VIR_FREE(path);
-    return ret;
+    return 0;
 }
 
 /**
@@ -685,6 +955,87 @@ virNumaGetPageInfo(int node,
 }
 
 
+/*
+ * virNumaGetHugePageSizes:
+ *
+ * List the huge page sizes supported on @node (in KiB). Unlike the
+ * size of their pools, they cannot change at runtime, so the host
+ * topology snapshot keeps them.
+ */
+static int
+virNumaGetHugePageSizes(int node,
+                        unsigned int **sizes,
+                        size_t *nsizes)
+{
+    int ret = -1;
+    char *path = NULL;
+    DIR *dir = NULL;
+    int direrr = 0;
+    struct dirent *entry;
+    virHostTopologyPtr topo = NULL;
+    unsigned int *tmp = NULL;
+    size_t ntmp = 0;
+    int rc;
+
+    if ((topo = virHostTopologyGet()) &&
+        (rc = virHostTopologyGetPageSizes(topo, node, sizes, nsizes)) != 0) {
+        if (rc > 0)
+            ret = 0;
+        goto cleanup;
+    }
+
+    if (virNumaGetHugePageInfoDir(&path, node) < 0)
+        goto cleanup;
+
+    /* It's okay if the @path doesn't exist. Maybe we are running on
+     * system without huge pages support where the path may not exist. */
+    if (virDirOpenIfExists(&dir, path) < 0)
+        goto cleanup;
+
+    while (dir && (direrr = virDirRead(dir, &entry, path)) > 0) {
+        const char *page_name = entry->d_name;
+        unsigned int page_size;
+        char *end;
+
+        /* Just to give you a hint, we're dealing with this:
+         * hugepages-2048kB/  or   hugepages-1048576kB/ */
+        if (!STRPREFIX(entry->d_name, HUGEPAGES_PREFIX))
+            continue;
+
+        page_name += strlen(HUGEPAGES_PREFIX);
+
+        if (virStrToLong_ui(page_name, &end, 10, &page_size) < 0 ||
+            STRCASENEQ(end, "kB")) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("unable to parse %s"),
+                           entry->d_name);
+            goto cleanup;
+        }
+
+        if (VIR_APPEND_ELEMENT(tmp, ntmp, page_size) < 0)
+            goto cleanup;
+    }
+
+    if (direrr < 0)
+        goto cleanup;
+
+    if (topo)
+        ignore_value(virHostTopologySetPageSizes(topo, node, tmp, ntmp));
+
+    *sizes = tmp;
+    *nsizes = ntmp;
+    tmp = NULL;
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(topo);
+    VIR_FREE(tmp);
+    VIR_DIR_CLOSE(dir);
+    VIR_FREE(path);
+    return ret;
+}
+
+
 /**
  * virNumaGetPages:
  * @node: NUMA node id
@@ -714,10 +1065,8 @@ virNumaGetPages(int node,
                 size_t *npages)
 {
     int ret = -1;
-    char *path = NULL;
-    DIR *dir = NULL;
-    int direrr = 0;
-    struct dirent *entry;
+    unsigned int *huge_sizes = NULL;
+    size_t nhuge_sizes = 0;
     unsigned int *tmp_size = NULL, *tmp_avail = NULL, *tmp_free = NULL;
     unsigned int ntmp = 0;
     size_t i;
@@ -734,43 +1083,23 @@ virNumaGetPages(int node,
      * is always shown as used memory. Here, however, we want to report
      * slightly different information. So we take the total memory on a node
      * and subtract memory taken by the huge pages. */
-    if (virNumaGetHugePageInfoDir(&path, node) < 0)
+    if (virNumaGetHugePageSizes(node, &huge_sizes, &nhuge_sizes) < 0)
         goto cleanup;
 
-    /* It's okay if the @path doesn't exist. Maybe we are running on
-     * system without huge pages support where the path may not exist. */
-    if (virDirOpenIfExists(&dir, path) < 0)
+    /* One more for the ordinary system pages */
+    if (VIR_ALLOC_N(tmp_size, nhuge_sizes + 1) < 0 ||
+        VIR_ALLOC_N(tmp_avail, nhuge_sizes + 1) < 0 ||
+        VIR_ALLOC_N(tmp_free, nhuge_sizes + 1) < 0)
         goto cleanup;
 
-    while (dir && (direrr = virDirRead(dir, &entry, path)) > 0) {
-        const char *page_name = entry->d_name;
-        unsigned int page_size, page_avail = 0, page_free = 0;
-        char *end;
-
-        /* Just to give you a hint, we're dealing with this:
-         * hugepages-2048kB/  or   hugepages-1048576kB/ */
-        if (!STRPREFIX(entry->d_name, HUGEPAGES_PREFIX))
-            continue;
-
-        page_name += strlen(HUGEPAGES_PREFIX);
-
-        if (virStrToLong_ui(page_name, &end, 10, &page_size) < 0 ||
-            STRCASENEQ(end, "kB")) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("unable to parse %s"),
-                           entry->d_name);
-            goto cleanup;
-        }
+    for (i = 0; i < nhuge_sizes; i++) {
+        unsigned int page_size = huge_sizes[i];
+        unsigned int page_avail = 0, page_free = 0;
 
         if (virNumaGetHugePageInfo(node, page_size,
                                    &page_avail, &page_free) < 0)
             goto cleanup;
 
-        if (VIR_REALLOC_N(tmp_size, ntmp + 1) < 0 ||
-            VIR_REALLOC_N(tmp_avail, ntmp + 1) < 0 ||
-            VIR_REALLOC_N(tmp_free, ntmp + 1) < 0)
-            goto cleanup;
-
         tmp_size[ntmp] = page_size;
         tmp_avail[ntmp] = page_avail;
         tmp_free[ntmp] = page_free;
@@ -781,15 +1110,7 @@ virNumaGetPages(int node,
         huge_page_sum += 1024 * page_size * page_avail;
     }
 
-    if (direrr < 0)
-        goto cleanup;
-
     /* Now append the ordinary system pages */
-    if (VIR_REALLOC_N(tmp_size, ntmp + 1) < 0 ||
-        VIR_REALLOC_N(tmp_avail, ntmp + 1) < 0 ||
-        VIR_REALLOC_N(tmp_free, ntmp + 1) < 0)
-        goto cleanup;
-
     if (virNumaGetPageInfo(node, system_page_size, huge_page_sum,
                            &tmp_avail[ntmp], &tmp_free[ntmp]) < 0)
         goto cleanup;
@@ -827,8 +1148,7 @@ virNumaGetPages(int node,
     VIR_FREE(tmp_free);
     VIR_FREE(tmp_avail);
     VIR_FREE(tmp_size);
-    VIR_DIR_CLOSE(dir);
-    VIR_FREE(path);
+    VIR_FREE(huge_sizes);
     return ret;
 }
 
@@ -30,6 +30,22 @@
 char *virNumaGetAutoPlacementAdvice(unsigned short vcups,
                                     unsigned long long balloon);
 
+typedef struct _virNumaPlacementNode virNumaPlacementNode;
+typedef virNumaPlacementNode *virNumaPlacementNodePtr;
+struct _virNumaPlacementNode {
+    int id;                     /* host NUMA node */
+    unsigned int ncpus;         /* host CPUs of the node */
+    unsigned int load;          /* vCPUs of domains already placed on it */
+    unsigned long long memFree; /* in KiB */
+    unsigned int *distances;    /* to each of the nodes, by index, or NULL */
+};
+
+virBitmapPtr virNumaPlacementChoose(virNumaPlacementNodePtr nodes,
+                                    size_t nnodes,
+                                    unsigned int vcpus,
+                                    unsigned long long memory)
+    ATTRIBUTE_NONNULL(1);
+
 int virNumaSetupMemoryPolicy(virDomainNumatuneMemMode mode,
                              virBitmapPtr nodeset);
 
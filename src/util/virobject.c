@@ -37,23 +37,74 @@ VIR_LOG_INIT("util.object");
 
 static unsigned int magicCounter = 0xCAFE0000;
 
+/*
+ * Released instances of small classes are not handed back to the
+ * allocator straight away. Each thread keeps a magazine of up to
+ * VIR_OBJECT_MAGAZINE_SIZE poisoned instances per class, from which
+ * virObjectNew() takes before calling malloc(). A thread filling its
+ * magazine parks it in the class depot, where a thread which ran out
+ * picks it up, so that the daemon's typical pattern of allocating in
+ * one worker and releasing in another costs one mutex round trip
+ * per magazine instead of one allocator call per object.
+ */
+#define VIR_OBJECT_MAGAZINE_SIZE 8
+#define VIR_OBJECT_DEPOT_SIZE 4
+#define VIR_OBJECT_CACHE_MAX_SIZE 512
+
+typedef struct _virObjectMagazine virObjectMagazine;
+typedef virObjectMagazine *virObjectMagazinePtr;
+struct _virObjectMagazine {
+    size_t nobjs;
+    void *objs[VIR_OBJECT_MAGAZINE_SIZE];
+};
+
+typedef struct _virObjectMagazines virObjectMagazines;
+typedef virObjectMagazines *virObjectMagazinesPtr;
+struct _virObjectMagazines {
+    virObjectMagazinePtr *mags; /* indexed by virClass->index */
+    size_t nmags;
+};
+
 struct _virClass {
     virClassPtr parent;
 
     unsigned int magic;
     char *name;
     size_t objectSize;
+    size_t index;
 
     virObjectDisposeCallback dispose;
+
+    int live; /* atomic */
+
+    virMutex depotLock;
+    virObjectMagazinePtr depot[VIR_OBJECT_DEPOT_SIZE];
+    size_t ndepot;
 };
 
+static virMutex virClassListLock = VIR_MUTEX_INITIALIZER;
+static virClassPtr *virClassList;
+static size_t virClassListCount;
+
+static virThreadLocal virObjectMagazinesKey;
+
 static virClassPtr virObjectClass;
 static virClassPtr virObjectLockableClass;
+static virClassPtr virObjectRWLockableClass;
 
 static void virObjectLockableDispose(void *anyobj);
+static void virObjectRWLockableDispose(void *anyobj);
+static void virObjectMagazinesFree(void *opaque);
 
 static int virObjectOnceInit(void)
 {
+    if (virThreadLocalInit(&virObjectMagazinesKey,
+                           virObjectMagazinesFree) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize thread local variable"));
+        return -1;
+    }
+
     if (!(virObjectClass = virClassNew(NULL,
                                        "virObject",
                                        sizeof(virObject),
@@ -66,6 +117,12 @@ static int virObjectOnceInit(void)
                                                virObjectLockableDispose)))
         return -1;
 
+    if (!(virObjectRWLockableClass = virClassNew(virObjectClass,
+                                                 "virObjectRWLockable",
+                                                 sizeof(virObjectRWLockable),
+                                                 virObjectRWLockableDispose)))
+        return -1;
+
     return 0;
 }
 
@@ -100,6 +157,20 @@ virClassPtr virClassForObjectLockable(void)
 }
 
 
+/**
+ * virClassForObjectRWLockable:
+ *
+ * Returns the class instance for the virObjectRWLockable type
+ */
+virClassPtr virClassForObjectRWLockable(void)
+{
+    if (virObjectInitialize() < 0)
+        return NULL;
+
+    return virObjectRWLockableClass;
+}
+
+
 /**
  * virClassNew:
  * @parent: the parent class
@@ -145,14 +216,74 @@ virClassPtr virClassNew(virClassPtr parent,
     klass->objectSize = objectSize;
     klass->dispose = dispose;
 
+    if (virMutexInit(&klass->depotLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        goto error;
+    }
+
+    virMutexLock(&virClassListLock);
+    klass->index = virClassListCount;
+    if (VIR_APPEND_ELEMENT_COPY(virClassList, virClassListCount, klass) < 0) {
+        virMutexUnlock(&virClassListLock);
+        virMutexDestroy(&klass->depotLock);
+        goto error;
+    }
+    virMutexUnlock(&virClassListLock);
+
     return klass;
 
  error:
+    if (klass)
+        VIR_FREE(klass->name);
     VIR_FREE(klass);
     return NULL;
 }
 
 
+/**
+ * virClassGetStats:
+ * @stats: filled with an array describing every registered class
+ * @nstats: filled with the number of elements in @stats
+ *
+ * Returns 0 on success, -1 on error. The caller must free @stats
+ * but not the class names it points to.
+ */
+int virClassGetStats(virClassStatsPtr *stats,
+                     size_t *nstats)
+{
+    virClassStatsPtr ret = NULL;
+    size_t n;
+    size_t i;
+
+    virMutexLock(&virClassListLock);
+    n = virClassListCount;
+    if (VIR_ALLOC_N(ret, n) < 0) {
+        virMutexUnlock(&virClassListLock);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        virClassPtr klass = virClassList[i];
+        size_t j;
+
+        ret[i].name = klass->name;
+        ret[i].objectSize = klass->objectSize;
+        ret[i].live = virAtomicIntGet(&klass->live);
+
+        virMutexLock(&klass->depotLock);
+        for (j = 0; j < klass->ndepot; j++)
+            ret[i].cached += klass->depot[j]->nobjs;
+        virMutexUnlock(&klass->depotLock);
+    }
+    virMutexUnlock(&virClassListLock);
+
+    *stats = ret;
+    *nstats = n;
+    return 0;
+}
+
+
 /**
  * virClassIsDerivedFrom:
  * @klass: the klass to check
@@ -174,6 +305,131 @@ bool virClassIsDerivedFrom(virClassPtr klass,
 }
 
 
+static void
+virObjectMagazinesFree(void *opaque)
+{
+    virObjectMagazinesPtr mags = opaque;
+    size_t i;
+    size_t j;
+
+    if (!mags)
+        return;
+
+    for (i = 0; i < mags->nmags; i++) {
+        if (!mags->mags[i])
+            continue;
+        for (j = 0; j < mags->mags[i]->nobjs; j++)
+            VIR_FREE(mags->mags[i]->objs[j]);
+        VIR_FREE(mags->mags[i]);
+    }
+    VIR_FREE(mags->mags);
+    VIR_FREE(mags);
+}
+
+
+/*
+ * Returns the calling thread's magazine for @klass, allocating it if
+ * needed, or NULL if @klass is not cached or memory is short. Never
+ * reports errors, as it is called while releasing objects.
+ */
+static virObjectMagazinePtr
+virObjectMagazineGet(virClassPtr klass)
+{
+    virObjectMagazinesPtr mags;
+
+    if (klass->objectSize > VIR_OBJECT_CACHE_MAX_SIZE)
+        return NULL;
+
+    if (!(mags = virThreadLocalGet(&virObjectMagazinesKey))) {
+        if (VIR_ALLOC_QUIET(mags) < 0)
+            return NULL;
+        if (virThreadLocalSet(&virObjectMagazinesKey, mags) < 0) {
+            VIR_FREE(mags);
+            return NULL;
+        }
+    }
+
+    if (klass->index >= mags->nmags &&
+        VIR_RESIZE_N_QUIET(mags->mags, mags->nmags, mags->nmags,
+                           klass->index + 1 - mags->nmags) < 0)
+        return NULL;
+
+    if (!mags->mags[klass->index] &&
+        VIR_ALLOC_QUIET(mags->mags[klass->index]) < 0)
+        return NULL;
+
+    return mags->mags[klass->index];
+}
+
+
+/* Takes a cached instance of @klass, or returns NULL */
+static void *
+virObjectCacheTake(virClassPtr klass)
+{
+    virObjectMagazinePtr mag;
+    void *obj;
+
+    if (!(mag = virObjectMagazineGet(klass)))
+        return NULL;
+
+    if (mag->nobjs == 0) {
+        virObjectMagazinePtr full = NULL;
+
+        virMutexLock(&klass->depotLock);
+        if (klass->ndepot > 0)
+            full = klass->depot[--klass->ndepot];
+        virMutexUnlock(&klass->depotLock);
+
+        if (!full)
+            return NULL;
+
+        *mag = *full;
+        VIR_FREE(full);
+    }
+
+    obj = mag->objs[--mag->nobjs];
+    memset(obj, 0, klass->objectSize);
+    return obj;
+}
+
+
+/* Returns true if @obj, already disposed of, is kept for reuse */
+static bool
+virObjectCachePut(virClassPtr klass,
+                  void *obj)
+{
+    virObjectMagazinePtr mag;
+
+    if (!(mag = virObjectMagazineGet(klass)))
+        return false;
+
+    if (mag->nobjs == VIR_OBJECT_MAGAZINE_SIZE) {
+        virObjectMagazinePtr full;
+        bool parked = false;
+
+        if (VIR_ALLOC_QUIET(full) < 0)
+            return false;
+        *full = *mag;
+
+        virMutexLock(&klass->depotLock);
+        if (klass->ndepot < VIR_OBJECT_DEPOT_SIZE) {
+            klass->depot[klass->ndepot++] = full;
+            parked = true;
+        }
+        virMutexUnlock(&klass->depotLock);
+
+        if (!parked) {
+            VIR_FREE(full);
+            return false;
+        }
+        mag->nobjs = 0;
+    }
+
+    mag->objs[mag->nobjs++] = obj;
+    return true;
+}
+
+
 /**
  * virObjectNew:
  * @klass: the klass of object to create
@@ -190,11 +446,13 @@ void *virObjectNew(virClassPtr klass)
 {
     virObjectPtr obj = NULL;
 
-    if (VIR_ALLOC_VAR(obj,
+    if (!(obj = virObjectCacheTake(klass)) &&
+        VIR_ALLOC_VAR(obj,
                       char,
                       klass->objectSize - sizeof(virObject)) < 0)
         return NULL;
 
+    virAtomicIntInc(&klass->live);
     obj->u.s.magic = klass->magic;
     obj->klass = klass;
     virAtomicIntSet(&obj->u.s.refs, 1);
@@ -225,6 +483,32 @@ void *virObjectLockableNew(virClassPtr klass)
         virObjectUnref(obj);
         return NULL;
     }
+    virMutexSetName(&obj->lock, klass->name);
+
+    return obj;
+}
+
+
+void *virObjectRWLockableNew(virClassPtr klass)
+{
+    virObjectRWLockablePtr obj;
+
+    if (!virClassIsDerivedFrom(klass, virClassForObjectRWLockable())) {
+        virReportInvalidArg(klass,
+                            _("Class %s must derive from virObjectRWLockable"),
+                            virClassName(klass));
+        return NULL;
+    }
+
+    if (!(obj = virObjectNew(klass)))
+        return NULL;
+
+    if (virRWLockInit(&obj->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize RW lock"));
+        virObjectUnref(obj);
+        return NULL;
+    }
 
     return obj;
 }
@@ -237,6 +521,14 @@ static void virObjectLockableDispose(void *anyobj)
     virMutexDestroy(&obj->lock);
 }
 
+
+static void virObjectRWLockableDispose(void *anyobj)
+{
+    virObjectRWLockablePtr obj = anyobj;
+
+    virRWLockDestroy(&obj->lock);
+}
+
 /**
  * virObjectUnref:
  * @anyobj: any instance of virObjectPtr
@@ -266,11 +558,15 @@ bool virObjectUnref(void *anyobj)
             klass = klass->parent;
         }
 
+        klass = obj->klass;
+        virAtomicIntAdd(&klass->live, -1);
+
         /* Clear & poison object */
-        memset(obj, 0, obj->klass->objectSize);
+        memset(obj, 0, klass->objectSize);
         obj->u.s.magic = 0xDEADBEEF;
         obj->klass = (void*)0xDEADBEEF;
-        VIR_FREE(obj);
+        if (!virObjectCachePut(klass, obj))
+            VIR_FREE(obj);
     }
 
     return !lastRef;
@@ -345,6 +641,80 @@ void virObjectUnlock(void *anyobj)
 }
 
 
+/**
+ * virObjectRWLockRead:
+ * @anyobj: any instance of virObjectRWLockablePtr
+ *
+ * Acquire a read lock on @anyobj. Any number of threads may hold
+ * the read lock at the same time, but none while a write lock is
+ * held. The lock must be released by virObjectRWUnlock.
+ *
+ * The caller is expected to have acquired a reference
+ * on the object before locking it (eg virObjectRef).
+ * The object must be unlocked before releasing this
+ * reference.
+ */
+void virObjectRWLockRead(void *anyobj)
+{
+    virObjectRWLockablePtr obj = anyobj;
+
+    if (!virObjectIsClass(obj, virObjectRWLockableClass)) {
+        VIR_WARN("Object %p (%s) is not a virObjectRWLockable instance",
+                 obj, obj ? obj->parent.klass->name : "(unknown)");
+        return;
+    }
+
+    virRWLockRead(&obj->lock);
+}
+
+
+/**
+ * virObjectRWLockWrite:
+ * @anyobj: any instance of virObjectRWLockablePtr
+ *
+ * Acquire an exclusive write lock on @anyobj. The lock must be
+ * released by virObjectRWUnlock.
+ *
+ * The caller is expected to have acquired a reference
+ * on the object before locking it (eg virObjectRef).
+ * The object must be unlocked before releasing this
+ * reference.
+ */
+void virObjectRWLockWrite(void *anyobj)
+{
+    virObjectRWLockablePtr obj = anyobj;
+
+    if (!virObjectIsClass(obj, virObjectRWLockableClass)) {
+        VIR_WARN("Object %p (%s) is not a virObjectRWLockable instance",
+                 obj, obj ? obj->parent.klass->name : "(unknown)");
+        return;
+    }
+
+    virRWLockWrite(&obj->lock);
+}
+
+
+/**
+ * virObjectRWUnlock:
+ * @anyobj: any instance of virObjectRWLockablePtr
+ *
+ * Release a lock on @anyobj. The lock must have been acquired by
+ * virObjectRWLockRead or virObjectRWLockWrite.
+ */
+void virObjectRWUnlock(void *anyobj)
+{
+    virObjectRWLockablePtr obj = anyobj;
+
+    if (!virObjectIsClass(obj, virObjectRWLockableClass)) {
+        VIR_WARN("Object %p (%s) is not a virObjectRWLockable instance",
+                 obj, obj ? obj->parent.klass->name : "(unknown)");
+        return;
+    }
+
+    virRWLockUnlock(&obj->lock);
+}
+
+
 /**
  * virObjectIsClass:
  * @anyobj: any instance of virObjectPtr
@@ -34,8 +34,20 @@ typedef virObject *virObjectPtr;
 typedef struct _virObjectLockable virObjectLockable;
 typedef virObjectLockable *virObjectLockablePtr;
 
+typedef struct _virObjectRWLockable virObjectRWLockable;
+typedef virObjectRWLockable *virObjectRWLockablePtr;
+
 typedef void (*virObjectDisposeCallback)(void *obj);
 
+typedef struct _virClassStats virClassStats;
+typedef virClassStats *virClassStatsPtr;
+struct _virClassStats {
+    const char *name;
+    size_t objectSize;
+    unsigned int live;   /* instances currently referenced */
+    unsigned int cached; /* released instances parked for reuse */
+};
+
 /* Most code should not play with the contents of this struct; however,
  * the struct itself is public so that it can be embedded as the first
  * field of a subclassed object.  */
@@ -59,9 +71,15 @@ struct _virObjectLockable {
     virMutex lock;
 };
 
+struct _virObjectRWLockable {
+    virObject parent;
+    virRWLock lock;
+};
+
 
 virClassPtr virClassForObject(void);
 virClassPtr virClassForObjectLockable(void);
+virClassPtr virClassForObjectRWLockable(void);
 
 # ifndef VIR_PARENT_REQUIRED
 #  define VIR_PARENT_REQUIRED ATTRIBUTE_NONNULL(1)
@@ -75,6 +93,10 @@ virClassPtr virClassNew(virClassPtr parent,
 const char *virClassName(virClassPtr klass)
     ATTRIBUTE_NONNULL(1);
 
+int virClassGetStats(virClassStatsPtr *stats,
+                     size_t *nstats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 bool virClassIsDerivedFrom(virClassPtr klass,
                            virClassPtr parent)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
@@ -99,6 +121,16 @@ void virObjectLock(void *lockableobj)
 void virObjectUnlock(void *lockableobj)
     ATTRIBUTE_NONNULL(1);
 
+void *virObjectRWLockableNew(virClassPtr klass)
+    ATTRIBUTE_NONNULL(1);
+
+void virObjectRWLockRead(void *lockableobj)
+    ATTRIBUTE_NONNULL(1);
+void virObjectRWLockWrite(void *lockableobj)
+    ATTRIBUTE_NONNULL(1);
+void virObjectRWUnlock(void *lockableobj)
+    ATTRIBUTE_NONNULL(1);
+
 void virObjectListFree(void *list);
 void virObjectListFreeCount(void *list, size_t count);
 
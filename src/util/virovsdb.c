@@ -0,0 +1,513 @@
+/*
+ * virovsdb.c: JSON-RPC client for the Open vSwitch database
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#ifdef HAVE_SYS_UN_H
+# include <sys/un.h>
+#endif
+
+#include "virovsdb.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.ovsdb");
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+
+/**
+ * virOVSDBBufferAddString:
+ * @buf: the buffer to append to
+ * @str: the string
+ *
+ * Append @str to @buf as a JSON string literal, so that it can be
+ * used as a value within the operations passed to virOVSDBTransact().
+ */
+void
+virOVSDBBufferAddString(virBufferPtr buf,
+                        const char *str)
+{
+    virBufferAddChar(buf, '"');
+
+    for (; *str; str++) {
+        unsigned char c = *str;
+
+        if (c == '"' || c == '\\')
+            virBufferAsprintf(buf, "\\%c", c);
+        else if (c < 0x20)
+            virBufferAsprintf(buf, "\\u%04x", c);
+        else
+            virBufferAddChar(buf, c);
+    }
+
+    virBufferAddChar(buf, '"');
+}
+
+
+#if defined(WITH_YAJL) && defined(HAVE_SYS_UN_H)
+
+/* A single connection to ovsdb-server is shared by all the callers
+ * and kept open between the requests, which spares ovsdb-server from
+ * accepting a new client and sending it the database schema for every
+ * port being plugged. Requests are serialized by virOVSDBLock. */
+static virMutex virOVSDBLock = VIR_MUTEX_INITIALIZER;
+static int virOVSDBFd = -1;
+static unsigned long long virOVSDBSerial;
+
+/* Data received past the end of the last message */
+static char *virOVSDBRx;
+static size_t virOVSDBRxLen;
+static size_t virOVSDBRxAlloc;
+
+
+static void
+virOVSDBDisconnect(void)
+{
+    VIR_FORCE_CLOSE(virOVSDBFd);
+    VIR_FREE(virOVSDBRx);
+    virOVSDBRxLen = virOVSDBRxAlloc = 0;
+}
+
+
+/*
+ * Returns 0 on success, -2 if the server could not be reached,
+ * -1 on other errors.
+ */
+static int
+virOVSDBConnect(void)
+{
+    struct sockaddr_un addr;
+    int fd = -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (virStrcpyStatic(addr.sun_path, VIR_OVSDB_SOCKET) == NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("OVSDB socket path '%s' too long"),
+                       VIR_OVSDB_SOCKET);
+        return -1;
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        virReportSystemError(errno, "%s", _("Failed to create socket"));
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        VIR_DEBUG("Unable to connect to %s: %s",
+                  VIR_OVSDB_SOCKET, virStrerror(errno, NULL, 0));
+        VIR_FORCE_CLOSE(fd);
+        return -2;
+    }
+
+    if (virSetCloseExec(fd) < 0 ||
+        virSetNonBlock(fd) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Failed to set up the OVSDB socket"));
+        VIR_FORCE_CLOSE(fd);
+        return -1;
+    }
+
+    virOVSDBFd = fd;
+    return 0;
+}
+
+
+static int
+virOVSDBWait(short events,
+             unsigned long long deadline)
+{
+    struct pollfd fds = { .fd = virOVSDBFd, .events = events };
+    unsigned long long now;
+    int rc;
+
+    do {
+        if (virTimeMillisNow(&now) < 0)
+            return -1;
+
+        if (now >= deadline) {
+            virReportError(VIR_ERR_OPERATION_TIMEOUT, "%s",
+                           _("Timed out waiting for the OVSDB server"));
+            return -1;
+        }
+
+        rc = poll(&fds, 1, deadline - now);
+    } while (rc == 0 || (rc < 0 && errno == EINTR));
+
+    if (rc < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Failed to poll the OVSDB socket"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+virOVSDBSend(const char *msg,
+             unsigned long long deadline)
+{
+    size_t len = strlen(msg);
+
+    while (len > 0) {
+        ssize_t done = send(virOVSDBFd, msg, len, MSG_NOSIGNAL);
+
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (virOVSDBWait(POLLOUT, deadline) < 0)
+                    return -1;
+                continue;
+            }
+            virReportSystemError(errno, "%s",
+                                 _("Failed to send data to the OVSDB server"));
+            return -1;
+        }
+
+        msg += done;
+        len -= done;
+    }
+
+    return 0;
+}
+
+
+/*
+ * The JSON-RPC messages are sent back to back on the stream without
+ * any framing, find where the first one ends.
+ *
+ * Returns the length of the message, or 0 if it is incomplete.
+ */
+static size_t
+virOVSDBMessageLength(const char *data,
+                      size_t len)
+{
+    size_t depth = 0;
+    bool string = false;
+    bool escape = false;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        char c = data[i];
+
+        if (string) {
+            if (escape)
+                escape = false;
+            else if (c == '\\')
+                escape = true;
+            else if (c == '"')
+                string = false;
+            continue;
+        }
+
+        switch (c) {
+        case '"':
+            string = true;
+            break;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            if (depth > 0 && --depth == 0)
+                return i + 1;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+
+static virJSONValuePtr
+virOVSDBRecv(unsigned long long deadline)
+{
+    virJSONValuePtr msg = NULL;
+    char *str = NULL;
+    size_t len;
+
+    while ((len = virOVSDBMessageLength(virOVSDBRx, virOVSDBRxLen)) == 0) {
+        ssize_t got;
+
+        if (VIR_RESIZE_N(virOVSDBRx, virOVSDBRxAlloc, virOVSDBRxLen, 4096) < 0)
+            return NULL;
+
+        got = recv(virOVSDBFd, virOVSDBRx + virOVSDBRxLen,
+                   virOVSDBRxAlloc - virOVSDBRxLen, 0);
+
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (virOVSDBWait(POLLIN, deadline) < 0)
+                    return NULL;
+                continue;
+            }
+            virReportSystemError(errno, "%s",
+                                 _("Failed to read data from the OVSDB server"));
+            return NULL;
+        }
+
+        if (got == 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("OVSDB server closed the connection"));
+            return NULL;
+        }
+
+        virOVSDBRxLen += got;
+    }
+
+    if (VIR_STRNDUP(str, virOVSDBRx, len) < 0)
+        return NULL;
+
+    memmove(virOVSDBRx, virOVSDBRx + len, virOVSDBRxLen - len);
+    virOVSDBRxLen -= len;
+
+    msg = virJSONValueFromString(str);
+    VIR_FREE(str);
+    return msg;
+}
+
+
+/* ovsdb-server may probe idle clients, make sure we don't look dead */
+static int
+virOVSDBReplyEcho(virJSONValuePtr msg,
+                  unsigned long long deadline)
+{
+    char *params = NULL;
+    char *id = NULL;
+    char *reply = NULL;
+    virJSONValuePtr tmp;
+    int ret = -1;
+
+    if (!(tmp = virJSONValueObjectGet(msg, "params")) ||
+        !(params = virJSONValueToString(tmp, false)) ||
+        !(tmp = virJSONValueObjectGet(msg, "id")) ||
+        !(id = virJSONValueToString(tmp, false))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Malformed OVSDB echo request"));
+        goto cleanup;
+    }
+
+    if (virAsprintf(&reply, "{\"id\":%s,\"result\":%s,\"error\":null}",
+                    id, params) < 0)
+        goto cleanup;
+
+    ret = virOVSDBSend(reply, deadline);
+
+ cleanup:
+    VIR_FREE(params);
+    VIR_FREE(id);
+    VIR_FREE(reply);
+    return ret;
+}
+
+
+static virJSONValuePtr
+virOVSDBCall(const char *request,
+             unsigned long long serial,
+             unsigned long long deadline)
+{
+    virJSONValuePtr msg = NULL;
+
+    if (virOVSDBSend(request, deadline) < 0)
+        return NULL;
+
+    while ((msg = virOVSDBRecv(deadline))) {
+        const char *method = virJSONValueObjectGetString(msg, "method");
+        unsigned long long id;
+
+        if (method) {
+            if (STREQ(method, "echo") &&
+                virOVSDBReplyEcho(msg, deadline) < 0)
+                break;
+        } else if (virJSONValueObjectGetNumberUlong(msg, "id", &id) == 0 &&
+                   id == serial) {
+            return msg;
+        }
+
+        VIR_DEBUG("Ignoring unexpected OVSDB message");
+        virJSONValueFree(msg);
+    }
+
+    virJSONValueFree(msg);
+    return NULL;
+}
+
+
+static int
+virOVSDBCheckResults(virJSONValuePtr results)
+{
+    size_t i;
+
+    if (!virJSONValueIsArray(results)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Malformed OVSDB transaction reply"));
+        return -1;
+    }
+
+    for (i = 0; i < virJSONValueArraySize(results); i++) {
+        virJSONValuePtr res = virJSONValueArrayGet(results, i);
+        const char *error;
+
+        if (virJSONValueIsNull(res) ||
+            !(error = virJSONValueObjectGetString(res, "error")))
+            continue;
+
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("OVSDB transaction failed: %s: %s"), error,
+                       NULLSTR(virJSONValueObjectGetString(res, "details")));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virOVSDBTransact:
+ * @database: name of the database
+ * @ops: comma separated list of the operations to perform
+ * @timeout: timeout in seconds
+ * @results: filled with the array of the operation results
+ *
+ * Run the operations in @ops as a single transaction on the OVSDB
+ * server. The connection to the server is established on the first
+ * request and kept open for the next ones.
+ *
+ * Returns 0 on success, -1 on error (with error reported), or -2 if
+ * the OVSDB server cannot be reached, in which case no error is
+ * reported so that the caller can fall back to ovs-vsctl.
+ */
+int
+virOVSDBTransact(const char *database,
+                 virBufferPtr ops,
+                 unsigned int timeout,
+                 virJSONValuePtr *results)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr error;
+    char *request = NULL;
+    unsigned long long deadline;
+    unsigned long long serial;
+    bool fresh = false;
+    int ret = -1;
+
+    *results = NULL;
+
+    if (virBufferCheckError(ops) < 0 ||
+        virTimeMillisNow(&deadline) < 0)
+        return -1;
+    deadline += timeout * 1000ULL;
+
+    virMutexLock(&virOVSDBLock);
+
+    serial = ++virOVSDBSerial;
+    virBufferAddLit(&buf, "{\"method\":\"transact\",\"params\":[");
+    virOVSDBBufferAddString(&buf, database);
+    virBufferAsprintf(&buf, ",%s],\"id\":%llu}",
+                      virBufferCurrentContent(ops), serial);
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    request = virBufferContentAndReset(&buf);
+
+ retry:
+    if (virOVSDBFd < 0) {
+        if ((ret = virOVSDBConnect()) < 0)
+            goto cleanup;
+        ret = -1;
+        fresh = true;
+    }
+
+    if (!(reply = virOVSDBCall(request, serial, deadline))) {
+        virOVSDBDisconnect();
+
+        /* The server might have dropped the connection while it was
+         * idle, try a new one. Our transactions are idempotent, so it
+         * does no harm should the first attempt have made it through. */
+        if (!fresh) {
+            VIR_DEBUG("Reconnecting to the OVSDB server");
+            virResetLastError();
+            goto retry;
+        }
+        goto cleanup;
+    }
+
+    if ((error = virJSONValueObjectGet(reply, "error")) &&
+        !virJSONValueIsNull(error)) {
+        char *str = virJSONValueToString(error, false);
+
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("OVSDB request failed: %s"), NULLSTR(str));
+        VIR_FREE(str);
+        goto cleanup;
+    }
+
+    if (!(*results = virJSONValueObjectStealArray(reply, "result")) ||
+        virOVSDBCheckResults(*results) < 0) {
+        virJSONValueFree(*results);
+        *results = NULL;
+        if (!virGetLastError())
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Malformed OVSDB transaction reply"));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&virOVSDBLock);
+    virBufferFreeAndReset(&buf);
+    virJSONValueFree(reply);
+    VIR_FREE(request);
+    return ret;
+}
+
+#else /* !defined(WITH_YAJL) || !defined(HAVE_SYS_UN_H) */
+
+int
+virOVSDBTransact(const char *database ATTRIBUTE_UNUSED,
+                 virBufferPtr ops ATTRIBUTE_UNUSED,
+                 unsigned int timeout ATTRIBUTE_UNUSED,
+                 virJSONValuePtr *results)
+{
+    *results = NULL;
+    return -2;
+}
+
+#endif /* !defined(WITH_YAJL) || !defined(HAVE_SYS_UN_H) */
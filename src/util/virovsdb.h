@@ -0,0 +1,42 @@
+/*
+ * virovsdb.h: JSON-RPC client for the Open vSwitch database
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_OVSDB_H__
+# define __VIR_OVSDB_H__
+
+# include "internal.h"
+# include "virbuffer.h"
+# include "virjson.h"
+
+# define VIR_OVSDB_SOCKET LOCALSTATEDIR "/run/openvswitch/db.sock"
+
+void virOVSDBBufferAddString(virBufferPtr buf,
+                             const char *str)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+int virOVSDBTransact(const char *database,
+                     virBufferPtr ops,
+                     unsigned int timeout,
+                     virJSONValuePtr *results)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4)
+    ATTRIBUTE_RETURN_CHECK;
+
+#endif /* __VIR_OVSDB_H__ */
@@ -42,8 +42,10 @@
 #include "vircommand.h"
 #include "virerror.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "virkmod.h"
 #include "virstring.h"
+#include "virthread.h"
 #include "virutil.h"
 
 VIR_LOG_INIT("util.pci");
@@ -506,6 +508,383 @@ virPCIDeviceIterDevices(virPCIDeviceIterPredicate predicate,
     return ret;
 }
 
+/*
+ * Host PCI topology cache
+ *
+ * Checking whether a device may be assigned means finding all of its
+ * parent bridges, which used to take a walk over every PCI device of
+ * the host and a read of its config space, repeated for each level.
+ * On hosts with thousands of VFs that dominates starting a guest.
+ *
+ * While something tells us about PCI hotplug - the udev node device
+ * driver does, see virPCITopologyEnableCache() - the bridges with the
+ * buses behind them and whether they enforce ACS, the IOMMU group
+ * members, capability offsets and VFs of every device are only read
+ * from the host once, then looked up in memory until the next
+ * virPCITopologyInvalidate().
+ *
+ * The host is never accessed with virPCITopologyLock held. Whatever is
+ * read is only stored if the cache wasn't invalidated in the meantime,
+ * which the generation of the cache tells.
+ */
+typedef struct _virPCITopologyBridge virPCITopologyBridge;
+typedef virPCITopologyBridge *virPCITopologyBridgePtr;
+struct _virPCITopologyBridge {
+    virPCIDeviceAddress address;
+    uint8_t secondary;
+    uint8_t subordinate;
+    int lacksACS; /* -1 until known */
+};
+
+typedef struct _virPCITopologyDevice virPCITopologyDevice;
+typedef virPCITopologyDevice *virPCITopologyDevicePtr;
+struct _virPCITopologyDevice {
+    bool haveCaps;
+    unsigned int pcie_cap_pos;
+    unsigned int pci_pm_cap_pos;
+    bool has_flr;
+    bool has_pm_reset;
+
+    bool haveGroup;
+    virPCIDeviceAddressPtr group; /* empty without an IOMMU group */
+    size_t ngroup;
+};
+
+typedef struct _virPCITopologyVFs virPCITopologyVFs;
+typedef virPCITopologyVFs *virPCITopologyVFsPtr;
+struct _virPCITopologyVFs {
+    virPCIDeviceAddressPtr vfs;
+    size_t nvfs;
+    unsigned int max;
+};
+
+typedef struct _virPCITopology virPCITopology;
+typedef virPCITopology *virPCITopologyPtr;
+struct _virPCITopology {
+    unsigned long long generation;
+
+    bool haveBridges;
+    virPCITopologyBridgePtr bridges;
+    size_t nbridges;
+
+    virHashTablePtr devices; /* device name -> virPCITopologyDevicePtr */
+    virHashTablePtr vfs; /* PF sysfs path -> virPCITopologyVFsPtr */
+};
+
+static virMutex virPCITopologyLock = VIR_MUTEX_INITIALIZER;
+static bool virPCITopologyEnabled;
+static unsigned long long virPCITopologyLastGeneration;
+static virPCITopologyPtr virPCITopologyCurrent;
+
+
+static void
+virPCITopologyDeviceFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virPCITopologyDevicePtr device = payload;
+
+    if (!device)
+        return;
+
+    VIR_FREE(device->group);
+    VIR_FREE(device);
+}
+
+
+static void
+virPCITopologyVFsFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virPCITopologyVFsPtr vfs = payload;
+
+    if (!vfs)
+        return;
+
+    VIR_FREE(vfs->vfs);
+    VIR_FREE(vfs);
+}
+
+
+static void
+virPCITopologyFree(virPCITopologyPtr topo)
+{
+    if (!topo)
+        return;
+
+    VIR_FREE(topo->bridges);
+    virHashFree(topo->devices);
+    virHashFree(topo->vfs);
+    VIR_FREE(topo);
+}
+
+
+/**
+ * virPCITopologyEnableCache:
+ * @enable: whether to cache the host PCI topology
+ *
+ * Callers enabling the cache promise to call virPCITopologyInvalidate()
+ * whenever a PCI device appears, disappears or changes.
+ */
+void
+virPCITopologyEnableCache(bool enable)
+{
+    virPCITopologyPtr topo;
+
+    virMutexLock(&virPCITopologyLock);
+    virPCITopologyEnabled = enable;
+    topo = virPCITopologyCurrent;
+    virPCITopologyCurrent = NULL;
+    virMutexUnlock(&virPCITopologyLock);
+
+    virPCITopologyFree(topo);
+}
+
+
+/**
+ * virPCITopologyInvalidate:
+ *
+ * Forget everything cached about the host PCI topology.
+ */
+void
+virPCITopologyInvalidate(void)
+{
+    virPCITopologyPtr topo;
+
+    virMutexLock(&virPCITopologyLock);
+    topo = virPCITopologyCurrent;
+    virPCITopologyCurrent = NULL;
+    virMutexUnlock(&virPCITopologyLock);
+
+    if (topo)
+        VIR_DEBUG("Invalidating PCI topology cache %llu", topo->generation);
+    virPCITopologyFree(topo);
+}
+
+
+/* Returns the current cache with virPCITopologyLock held, or NULL with
+ * the lock released if there is none. No error is reported either way,
+ * callers just go to the host without a cache. */
+static virPCITopologyPtr
+virPCITopologyAcquire(void)
+{
+    virPCITopologyPtr topo;
+
+    virMutexLock(&virPCITopologyLock);
+    if (!virPCITopologyEnabled)
+        goto error;
+
+    if (!virPCITopologyCurrent) {
+        if (VIR_ALLOC_QUIET(topo) < 0 ||
+            !(topo->devices = virHashCreate(256, virPCITopologyDeviceFree)) ||
+            !(topo->vfs = virHashCreate(64, virPCITopologyVFsFree))) {
+            virPCITopologyFree(topo);
+            goto error;
+        }
+        topo->generation = ++virPCITopologyLastGeneration;
+        virPCITopologyCurrent = topo;
+    }
+
+    return virPCITopologyCurrent;
+
+ error:
+    virMutexUnlock(&virPCITopologyLock);
+    return NULL;
+}
+
+
+static void
+virPCITopologyRelease(void)
+{
+    virMutexUnlock(&virPCITopologyLock);
+}
+
+
+/* Like virPCITopologyAcquire(), but only returns the cache if it is
+ * still of @generation */
+static virPCITopologyPtr
+virPCITopologyAcquireGeneration(unsigned long long generation)
+{
+    virPCITopologyPtr topo;
+
+    if (!generation || !(topo = virPCITopologyAcquire()))
+        return NULL;
+
+    if (topo->generation != generation) {
+        virPCITopologyRelease();
+        return NULL;
+    }
+
+    return topo;
+}
+
+
+/* Must be called with virPCITopologyLock held */
+static virPCITopologyDevicePtr
+virPCITopologyGetDevice(virPCITopologyPtr topo,
+                        const char *name,
+                        bool add)
+{
+    virPCITopologyDevicePtr device;
+
+    if ((device = virHashLookup(topo->devices, name)) || !add)
+        return device;
+
+    if (VIR_ALLOC_QUIET(device) < 0)
+        return NULL;
+
+    if (virHashAddEntry(topo->devices, name, device) < 0) {
+        virResetLastError();
+        VIR_FREE(device);
+    }
+
+    return device;
+}
+
+
+/* Returns 1 and fills in the buses behind @dev if it is a PCI-PCI
+ * bridge, 0 if it isn't one or can't be accessed and -1 on error */
+static int
+virPCIDeviceIsBridge(virPCIDevicePtr dev,
+                     uint8_t *secondary,
+                     uint8_t *subordinate)
+{
+    uint16_t device_class;
+    uint8_t header_type;
+    int ret;
+    int fd;
+
+    if ((fd = virPCIDeviceConfigOpen(dev, false)) < 0)
+        return 0;
+
+    /* Is it a bridge? */
+    ret = virPCIDeviceReadClass(dev, &device_class);
+    if (ret < 0 || device_class != PCI_CLASS_BRIDGE_PCI)
+        goto cleanup;
+
+    /* Is it a plane? */
+    header_type = virPCIDeviceRead8(dev, fd, PCI_HEADER_TYPE);
+    if ((header_type & PCI_HEADER_TYPE_MASK) != PCI_HEADER_TYPE_BRIDGE)
+        goto cleanup;
+
+    *secondary   = virPCIDeviceRead8(dev, fd, PCI_SECONDARY_BUS);
+    *subordinate = virPCIDeviceRead8(dev, fd, PCI_SUBORDINATE_BUS);
+    ret = 1;
+
+ cleanup:
+    virPCIDeviceConfigClose(dev, fd);
+    return ret;
+}
+
+
+typedef struct {
+    virPCITopologyBridgePtr bridges;
+    size_t nbridges;
+} virPCITopologyBridgeList;
+
+static int
+virPCITopologyAddBridge(virPCIDevicePtr dev ATTRIBUTE_UNUSED,
+                        virPCIDevicePtr check,
+                        void *data)
+{
+    virPCITopologyBridgeList *list = data;
+    virPCITopologyBridge bridge = { .address = check->address,
+                                    .lacksACS = -1 };
+    int rc;
+
+    if ((rc = virPCIDeviceIsBridge(check, &bridge.secondary,
+                                   &bridge.subordinate)) <= 0)
+        return rc;
+
+    return VIR_APPEND_ELEMENT(list->bridges, list->nbridges, bridge);
+}
+
+
+/* Returns the cache with its bridges known and virPCITopologyLock held,
+ * or NULL if they can't be cached. @dev is only used for logging. */
+static virPCITopologyPtr
+virPCITopologyAcquireBridges(virPCIDevicePtr dev)
+{
+    virPCITopologyBridgeList list = { NULL, 0 };
+    virPCITopologyPtr topo;
+    virPCIDevicePtr matched;
+    unsigned long long generation;
+
+    if (!(topo = virPCITopologyAcquire()) || topo->haveBridges)
+        return topo;
+
+    generation = topo->generation;
+    virPCITopologyRelease();
+
+    if (virPCIDeviceIterDevices(virPCITopologyAddBridge, dev,
+                                &matched, &list) < 0) {
+        VIR_FREE(list.bridges);
+        return NULL;
+    }
+
+    if (!(topo = virPCITopologyAcquireGeneration(generation))) {
+        VIR_FREE(list.bridges);
+        return NULL;
+    }
+
+    if (!topo->haveBridges) {
+        VIR_DEBUG("Found %zu PCI bridges", list.nbridges);
+        topo->bridges = list.bridges;
+        topo->nbridges = list.nbridges;
+        topo->haveBridges = true;
+    } else {
+        VIR_FREE(list.bridges);
+    }
+
+    return topo;
+}
+
+
+/* Must be called with virPCITopologyLock held. Same rules as
+ * virPCIDeviceIsParent(), returns the index of the parent bridge of
+ * @addr or -1 if it has none */
+static ssize_t
+virPCITopologyFindParent(virPCITopologyPtr topo,
+                         virPCIDeviceAddressPtr addr)
+{
+    ssize_t best = -1;
+    size_t i;
+
+    for (i = 0; i < topo->nbridges; i++) {
+        virPCITopologyBridgePtr bridge = &topo->bridges[i];
+
+        if (bridge->address.domain != addr->domain)
+            continue;
+
+        if (bridge->secondary == addr->bus)
+            return i;
+
+        if (addr->bus > bridge->secondary &&
+            addr->bus <= bridge->subordinate &&
+            (best < 0 || bridge->secondary > topo->bridges[best].secondary))
+            best = i;
+    }
+
+    return best;
+}
+
+
+/* Must be called with virPCITopologyLock held */
+static virPCITopologyBridgePtr
+virPCITopologyFindBridge(virPCITopologyPtr topo,
+                         virPCIDeviceAddressPtr addr)
+{
+    size_t i;
+
+    for (i = 0; i < topo->nbridges; i++) {
+        virPCIDeviceAddressPtr other = &topo->bridges[i].address;
+
+        if (other->domain == addr->domain && other->bus == addr->bus &&
+            other->slot == addr->slot && other->function == addr->function)
+            return &topo->bridges[i];
+    }
+
+    return NULL;
+}
+
+
 static uint8_t
 virPCIDeviceFindCapabilityOffset(virPCIDevicePtr dev,
                                  int cfgfd,
@@ -687,40 +1066,23 @@ virPCIDeviceBusContainsActiveDevices(virPCIDevicePtr dev,
 static int
 virPCIDeviceIsParent(virPCIDevicePtr dev, virPCIDevicePtr check, void *data)
 {
-    uint16_t device_class;
-    uint8_t header_type, secondary, subordinate;
+    uint8_t secondary, subordinate;
     virPCIDevicePtr *best = data;
-    int ret = 0;
-    int fd;
+    int rc;
 
     if (dev->address.domain != check->address.domain)
         return 0;
 
-    if ((fd = virPCIDeviceConfigOpen(check, false)) < 0)
-        return 0;
-
-    /* Is it a bridge? */
-    ret = virPCIDeviceReadClass(check, &device_class);
-    if (ret < 0 || device_class != PCI_CLASS_BRIDGE_PCI)
-        goto cleanup;
-
-    /* Is it a plane? */
-    header_type = virPCIDeviceRead8(check, fd, PCI_HEADER_TYPE);
-    if ((header_type & PCI_HEADER_TYPE_MASK) != PCI_HEADER_TYPE_BRIDGE)
-        goto cleanup;
-
-    secondary   = virPCIDeviceRead8(check, fd, PCI_SECONDARY_BUS);
-    subordinate = virPCIDeviceRead8(check, fd, PCI_SUBORDINATE_BUS);
+    if ((rc = virPCIDeviceIsBridge(check, &secondary, &subordinate)) <= 0)
+        return rc;
 
     VIR_DEBUG("%s %s: found parent device %s", dev->id, dev->name, check->name);
 
     /* if the secondary bus exactly equals the device's bus, then we found
      * the direct parent.  No further work is necessary
      */
-    if (dev->address.bus == secondary) {
-        ret = 1;
-        goto cleanup;
-    }
+    if (dev->address.bus == secondary)
+        return 1;
 
     /* otherwise, SRIOV allows VFs to be on different buses than their PFs.
      * In this case, what we need to do is look for the "best" match; i.e.
@@ -732,10 +1094,8 @@ virPCIDeviceIsParent(virPCIDevicePtr dev, virPCIDevicePtr check, void *data)
                                     check->address.bus,
                                     check->address.slot,
                                     check->address.function);
-            if (*best == NULL) {
-                ret = -1;
-                goto cleanup;
-            }
+            if (*best == NULL)
+                return -1;
         } else {
             /* OK, we had already recorded a previous "best" match for the
              * parent.  See if the current device is more restrictive than the
@@ -745,7 +1105,7 @@ virPCIDeviceIsParent(virPCIDevicePtr dev, virPCIDevicePtr check, void *data)
             uint8_t best_secondary;
 
             if ((bestfd = virPCIDeviceConfigOpen(*best, false)) < 0)
-                goto cleanup;
+                return 0;
             best_secondary = virPCIDeviceRead8(*best, bestfd, PCI_SECONDARY_BUS);
             virPCIDeviceConfigClose(*best, bestfd);
 
@@ -755,26 +1115,44 @@ virPCIDeviceIsParent(virPCIDevicePtr dev, virPCIDevicePtr check, void *data)
                                         check->address.bus,
                                         check->address.slot,
                                         check->address.function);
-                if (*best == NULL) {
-                    ret = -1;
-                    goto cleanup;
-                }
+                if (*best == NULL)
+                    return -1;
             }
         }
     }
 
- cleanup:
-    virPCIDeviceConfigClose(check, fd);
-    return ret;
+    return 0;
 }
 
 static int
 virPCIDeviceGetParent(virPCIDevicePtr dev, virPCIDevicePtr *parent)
 {
+    virPCITopologyPtr topo;
     virPCIDevicePtr best = NULL;
     int ret;
 
     *parent = NULL;
+
+    if ((topo = virPCITopologyAcquireBridges(dev))) {
+        virPCIDeviceAddress addr;
+        ssize_t idx;
+
+        if ((idx = virPCITopologyFindParent(topo, &dev->address)) >= 0)
+            addr = topo->bridges[idx].address;
+        virPCITopologyRelease();
+
+        if (idx < 0)
+            return 0;
+
+        VIR_DEBUG("%s %s: found cached parent device %.4x:%.2x:%.2x.%.1x",
+                  dev->id, dev->name, addr.domain, addr.bus,
+                  addr.slot, addr.function);
+        if (!(*parent = virPCIDeviceNew(addr.domain, addr.bus,
+                                        addr.slot, addr.function)))
+            return -1;
+        return 0;
+    }
+
     ret = virPCIDeviceIterDevices(virPCIDeviceIsParent, dev, parent, &best);
     if (ret == 1)
         virPCIDeviceFree(best);
@@ -911,8 +1289,25 @@ virPCIDeviceTryPowerManagementReset(virPCIDevicePtr dev, int cfgfd)
 static int
 virPCIDeviceInit(virPCIDevicePtr dev, int cfgfd)
 {
+    virPCITopologyPtr topo;
+    virPCITopologyDevicePtr device;
+    unsigned long long generation = 0;
     int flr;
 
+    if ((topo = virPCITopologyAcquire())) {
+        generation = topo->generation;
+        if ((device = virPCITopologyGetDevice(topo, dev->name, false)) &&
+            device->haveCaps) {
+            dev->pcie_cap_pos = device->pcie_cap_pos;
+            dev->pci_pm_cap_pos = device->pci_pm_cap_pos;
+            dev->has_flr = device->has_flr;
+            dev->has_pm_reset = device->has_pm_reset;
+            virPCITopologyRelease();
+            return 0;
+        }
+        virPCITopologyRelease();
+    }
+
     dev->pcie_cap_pos   = virPCIDeviceFindCapabilityOffset(dev, cfgfd, PCI_CAP_ID_EXP);
     dev->pci_pm_cap_pos = virPCIDeviceFindCapabilityOffset(dev, cfgfd, PCI_CAP_ID_PM);
     flr = virPCIDeviceDetectFunctionLevelReset(dev, cfgfd);
@@ -921,6 +1316,17 @@ virPCIDeviceInit(virPCIDevicePtr dev, int cfgfd)
     dev->has_flr        = !!flr;
     dev->has_pm_reset   = !!virPCIDeviceDetectPowerManagementReset(dev, cfgfd);
 
+    if ((topo = virPCITopologyAcquireGeneration(generation))) {
+        if ((device = virPCITopologyGetDevice(topo, dev->name, true))) {
+            device->pcie_cap_pos = dev->pcie_cap_pos;
+            device->pci_pm_cap_pos = dev->pci_pm_cap_pos;
+            device->has_flr = dev->has_flr;
+            device->has_pm_reset = dev->has_pm_reset;
+            device->haveCaps = true;
+        }
+        virPCITopologyRelease();
+    }
+
     return 0;
 }
 
@@ -1569,6 +1975,28 @@ virPCIDeviceDetach(virPCIDevicePtr dev,
     return 0;
 }
 
+/**
+ * virPCIDeviceHasDriverOverride:
+ * @dev: PCI device
+ *
+ * Returns true if @dev can be bound to a stub driver through its own
+ * driver_override file rather than the driver-wide new_id interface,
+ * which makes binding it independent of any other device.
+ */
+bool
+virPCIDeviceHasDriverOverride(virPCIDevicePtr dev)
+{
+    char *path;
+    bool ret;
+
+    if (!(path = virPCIFile(dev->name, "driver_override")))
+        return false;
+
+    ret = virFileExists(path);
+    VIR_FREE(path);
+    return ret;
+}
+
 int
 virPCIDeviceReattach(virPCIDevicePtr dev,
                      virPCIDeviceListPtr activeDevs,
@@ -2179,6 +2607,102 @@ int virPCIDeviceFileIterate(virPCIDevicePtr dev,
 }
 
 
+/* Fills @group with the addresses of all devices in the same
+ * iommu_group as @orig, including @orig itself, or leaves it empty if
+ * there is no iommu_group for the device */
+static int
+virPCIDeviceAddressGetIOMMUGroup(virPCIDeviceAddressPtr orig,
+                                 virPCIDeviceAddressPtr *group,
+                                 size_t *ngroup)
+{
+    virPCITopologyPtr topo;
+    virPCITopologyDevicePtr device;
+    unsigned long long generation = 0;
+    char name[PCI_ADDR_LEN];
+    char *groupPath = NULL;
+    DIR *groupDir = NULL;
+    int ret = -1;
+    struct dirent *ent;
+    int direrr;
+
+    *group = NULL;
+    *ngroup = 0;
+
+    if (snprintf(name, sizeof(name), "%.4x:%.2x:%.2x.%.1x", orig->domain,
+                 orig->bus, orig->slot, orig->function) >= sizeof(name)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("PCI device name buffer overflow: %.4x:%.2x:%.2x.%.1x"),
+                       orig->domain, orig->bus, orig->slot, orig->function);
+        return -1;
+    }
+
+    if ((topo = virPCITopologyAcquire())) {
+        generation = topo->generation;
+        if ((device = virPCITopologyGetDevice(topo, name, false)) &&
+            device->haveGroup) {
+            if (device->ngroup &&
+                VIR_ALLOC_N(*group, device->ngroup) < 0) {
+                virPCITopologyRelease();
+                return -1;
+            }
+            if (device->ngroup)
+                memcpy(*group, device->group,
+                       device->ngroup * sizeof(*device->group));
+            *ngroup = device->ngroup;
+            virPCITopologyRelease();
+            return 0;
+        }
+        virPCITopologyRelease();
+    }
+
+    if (virAsprintf(&groupPath,
+                    PCI_SYSFS "devices/%s/iommu_group/devices", name) < 0)
+        goto cleanup;
+
+    if (virDirOpenQuiet(&groupDir, groupPath) == 0) {
+        while ((direrr = virDirRead(groupDir, &ent, groupPath)) > 0) {
+            virPCIDeviceAddress newDev;
+
+            if (virPCIDeviceAddressParse(ent->d_name, &newDev) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Found invalid device link '%s' in '%s'"),
+                               ent->d_name, groupPath);
+                goto cleanup;
+            }
+
+            if (VIR_APPEND_ELEMENT(*group, *ngroup, newDev) < 0)
+                goto cleanup;
+        }
+        if (direrr < 0)
+            goto cleanup;
+    }
+
+    if ((topo = virPCITopologyAcquireGeneration(generation))) {
+        if ((device = virPCITopologyGetDevice(topo, name, true)) &&
+            !device->haveGroup &&
+            (*ngroup == 0 ||
+             VIR_ALLOC_N_QUIET(device->group, *ngroup) == 0)) {
+            if (*ngroup)
+                memcpy(device->group, *group, *ngroup * sizeof(**group));
+            device->ngroup = *ngroup;
+            device->haveGroup = true;
+        }
+        virPCITopologyRelease();
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        VIR_FREE(*group);
+        *ngroup = 0;
+    }
+    VIR_FREE(groupPath);
+    VIR_DIR_CLOSE(groupDir);
+    return ret;
+}
+
+
 /* virPCIDeviceAddressIOMMUGroupIterate:
  *   Call @actor for all devices in the same iommu_group as orig
  *   (including orig itself) Even if there is no iommu_group for the
@@ -2189,44 +2713,29 @@ virPCIDeviceAddressIOMMUGroupIterate(virPCIDeviceAddressPtr orig,
                                      virPCIDeviceAddressActor actor,
                                      void *opaque)
 {
-    char *groupPath = NULL;
-    DIR *groupDir = NULL;
+    virPCIDeviceAddressPtr group = NULL;
+    size_t ngroup = 0;
+    size_t i;
     int ret = -1;
-    struct dirent *ent;
-    int direrr;
 
-    if (virAsprintf(&groupPath,
-                    PCI_SYSFS "devices/%04x:%02x:%02x.%x/iommu_group/devices",
-                    orig->domain, orig->bus, orig->slot, orig->function) < 0)
-        goto cleanup;
+    if (virPCIDeviceAddressGetIOMMUGroup(orig, &group, &ngroup) < 0)
+        return -1;
 
-    if (virDirOpenQuiet(&groupDir, groupPath) < 0) {
+    if (!ngroup) {
         /* just process the original device, nothing more */
         ret = (actor)(orig, opaque);
         goto cleanup;
     }
 
-    while ((direrr = virDirRead(groupDir, &ent, groupPath)) > 0) {
-        virPCIDeviceAddress newDev;
-
-        if (virPCIDeviceAddressParse(ent->d_name, &newDev) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Found invalid device link '%s' in '%s'"),
-                           ent->d_name, groupPath);
-            goto cleanup;
-        }
-
-        if ((actor)(&newDev, opaque) < 0)
+    for (i = 0; i < ngroup; i++) {
+        if ((actor)(&group[i], opaque) < 0)
             goto cleanup;
     }
-    if (direrr < 0)
-        goto cleanup;
 
     ret = 0;
 
  cleanup:
-    VIR_FREE(groupPath);
-    VIR_DIR_CLOSE(groupDir);
+    VIR_FREE(group);
     return ret;
 }
 
@@ -2423,6 +2932,9 @@ virPCIDeviceGetIOMMUGroupDev(virPCIDevicePtr dev)
 static int
 virPCIDeviceDownstreamLacksACS(virPCIDevicePtr dev)
 {
+    virPCITopologyPtr topo;
+    virPCITopologyBridgePtr bridge = NULL;
+    unsigned long long generation = 0;
     uint16_t flags;
     uint16_t ctrl;
     unsigned int pos;
@@ -2430,6 +2942,17 @@ virPCIDeviceDownstreamLacksACS(virPCIDevicePtr dev)
     int ret = 0;
     uint16_t device_class;
 
+    if ((topo = virPCITopologyAcquire())) {
+        generation = topo->generation;
+        if ((bridge = virPCITopologyFindBridge(topo, &dev->address)))
+            ret = bridge->lacksACS;
+        virPCITopologyRelease();
+
+        if (ret >= 0 && bridge)
+            return ret;
+        ret = 0;
+    }
+
     if ((fd = virPCIDeviceConfigOpen(dev, true)) < 0)
         return -1;
 
@@ -2466,6 +2989,13 @@ virPCIDeviceDownstreamLacksACS(virPCIDevicePtr dev)
 
  cleanup:
     virPCIDeviceConfigClose(dev, fd);
+
+    if (ret >= 0 && (topo = virPCITopologyAcquireGeneration(generation))) {
+        if ((bridge = virPCITopologyFindBridge(topo, &dev->address)))
+            bridge->lacksACS = ret;
+        virPCITopologyRelease();
+    }
+
     return ret;
 }
 
@@ -2701,11 +3231,38 @@ virPCIGetVirtualFunctions(const char *sysfs_path,
     char *device_link = NULL;
     virPCIDeviceAddressPtr config_addr = NULL;
     char *totalvfs_file = NULL, *totalvfs_str = NULL;
+    virPCITopologyPtr topo;
+    virPCITopologyVFsPtr cached;
+    unsigned long long generation = 0;
 
     *virtual_functions = NULL;
     *num_virtual_functions = 0;
     *max_virtual_functions = 0;
 
+    if ((topo = virPCITopologyAcquire())) {
+        generation = topo->generation;
+        if ((cached = virHashLookup(topo->vfs, sysfs_path))) {
+            for (i = 0; i < cached->nvfs; i++) {
+                if (VIR_ALLOC(config_addr) < 0) {
+                    virPCITopologyRelease();
+                    goto error;
+                }
+                *config_addr = cached->vfs[i];
+                if (VIR_APPEND_ELEMENT(*virtual_functions,
+                                       *num_virtual_functions,
+                                       config_addr) < 0) {
+                    virPCITopologyRelease();
+                    goto error;
+                }
+            }
+            *max_virtual_functions = cached->max;
+            virPCITopologyRelease();
+            ret = 0;
+            goto cleanup;
+        }
+        virPCITopologyRelease();
+    }
+
     if (virAsprintf(&totalvfs_file, "%s/sriov_totalvfs", sysfs_path) < 0)
        goto error;
     if (virFileExists(totalvfs_file)) {
@@ -2745,6 +3302,26 @@ virPCIGetVirtualFunctions(const char *sysfs_path,
 
     VIR_DEBUG("Found %zu virtual functions for %s",
               *num_virtual_functions, sysfs_path);
+
+    if ((topo = virPCITopologyAcquireGeneration(generation))) {
+        if (!virHashLookup(topo->vfs, sysfs_path) &&
+            VIR_ALLOC_QUIET(cached) == 0) {
+            if (*num_virtual_functions == 0 ||
+                VIR_ALLOC_N_QUIET(cached->vfs, *num_virtual_functions) == 0) {
+                for (i = 0; i < *num_virtual_functions; i++)
+                    cached->vfs[i] = *(*virtual_functions)[i];
+                cached->nvfs = *num_virtual_functions;
+                cached->max = *max_virtual_functions;
+                if (virHashAddEntry(topo->vfs, sysfs_path, cached) == 0)
+                    cached = NULL;
+                else
+                    virResetLastError();
+            }
+            virPCITopologyVFsFree(cached, NULL);
+        }
+        virPCITopologyRelease();
+    }
+
     ret = 0;
  cleanup:
     VIR_FREE(device_link);
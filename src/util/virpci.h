@@ -109,6 +109,10 @@ int virPCIDeviceReattach(virPCIDevicePtr dev,
 int virPCIDeviceReset(virPCIDevicePtr dev,
                       virPCIDeviceListPtr activeDevs,
                       virPCIDeviceListPtr inactiveDevs);
+bool virPCIDeviceHasDriverOverride(virPCIDevicePtr dev);
+
+void virPCITopologyEnableCache(bool enable);
+void virPCITopologyInvalidate(void);
 
 void virPCIDeviceSetManaged(virPCIDevice *dev,
                             bool managed);
@@ -49,9 +49,27 @@ VIR_ENUM_IMPL(virPerfEvent, VIR_PERF_EVENT_LAST,
               "page_faults_min", "page_faults_maj",
               "alignment_faults", "emulation_faults");
 
+/* Events of the same kind are opened as one perf group, so that all of
+ * them are read with a single syscall.  The RDT events are served by
+ * their own PMU and can't join a group. */
+typedef enum {
+    VIR_PERF_GROUP_SOFTWARE,
+    VIR_PERF_GROUP_HARDWARE,
+
+    VIR_PERF_GROUP_LAST
+} virPerfGroupType;
+
+/* All the events of a group are scheduled on the PMU together, so a group
+ * with more hardware events than there are counters would never count.
+ * Keep the hardware group within the number of general purpose counters
+ * of the common CPUs and open the extra events on their own. */
+#define VIR_PERF_GROUP_HARDWARE_MAX 4
+
 struct virPerfEvent {
     int fd;
     bool enabled;
+    int group; /* virPerfGroupType or -1 if not in a group */
+    uint64_t id; /* kernel ID used to find the event in group reads */
     union {
         /* cmt */
         struct {
@@ -61,8 +79,15 @@ struct virPerfEvent {
 };
 typedef struct virPerfEvent *virPerfEventPtr;
 
+struct virPerfGroup {
+    int fd; /* leader which only holds the group together */
+    size_t nmembers;
+};
+typedef struct virPerfGroup *virPerfGroupPtr;
+
 struct virPerf {
     struct virPerfEvent events[VIR_PERF_EVENT_LAST];
+    struct virPerfGroup groups[VIR_PERF_GROUP_LAST];
 };
 
 #if defined(__linux__) && defined(HAVE_SYS_SYSCALL_H)
@@ -205,15 +230,119 @@ virPerfRdtAttrInit(void)
 }
 
 
+static int
+virPerfGetGroupType(virPerfPtr perf,
+                    virPerfEventType type)
+{
+    switch (attrs[type].attrType) {
+    case PERF_TYPE_SOFTWARE:
+        return VIR_PERF_GROUP_SOFTWARE;
+
+    case PERF_TYPE_HARDWARE:
+        if (perf->groups[VIR_PERF_GROUP_HARDWARE].nmembers >=
+            VIR_PERF_GROUP_HARDWARE_MAX)
+            return -1;
+        return VIR_PERF_GROUP_HARDWARE;
+    }
+
+    return -1;
+}
+
+
+static int
+virPerfEventOpen(unsigned int attrType,
+                 unsigned long long attrConfig,
+                 pid_t pid,
+                 int group_fd,
+                 bool leader)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.inherit = 1;
+    attr.disabled = !leader;
+    attr.enable_on_exec = 0;
+    attr.type = attrType;
+    attr.config = attrConfig;
+    if (leader)
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+
+    return syscall(__NR_perf_event_open, &attr, pid, -1, group_fd, 0);
+}
+
+
+/*
+ * Open @event as a member of @group, creating the group leader if needed.
+ * Groups are an optimization only, so failures are not reported and the
+ * caller falls back to an event of its own.
+ */
+static int
+virPerfGroupJoin(virPerfPtr perf,
+                 virPerfGroupType group,
+                 virPerfEventType type,
+                 pid_t pid)
+{
+    virPerfGroupPtr grp = &perf->groups[group];
+    virPerfEventPtr event = &perf->events[type];
+
+    if (grp->fd < 0) {
+        grp->fd = virPerfEventOpen(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_DUMMY,
+                                   pid, -1, true);
+        if (grp->fd < 0) {
+            char ebuf[1024];
+            VIR_DEBUG("Unable to open perf group leader: %s",
+                      virStrerror(errno, ebuf, sizeof(ebuf)));
+            return -1;
+        }
+    }
+
+    event->fd = virPerfEventOpen(attrs[type].attrType, attrs[type].attrConfig,
+                                 pid, grp->fd, false);
+    if (event->fd < 0 ||
+        ioctl(event->fd, PERF_EVENT_IOC_ID, &event->id) < 0) {
+        VIR_DEBUG("Unable to add perf event %s to a group",
+                  virPerfEventTypeToString(type));
+        VIR_FORCE_CLOSE(event->fd);
+        if (grp->nmembers == 0)
+            VIR_FORCE_CLOSE(grp->fd);
+        return -1;
+    }
+
+    event->group = group;
+    grp->nmembers++;
+    return 0;
+}
+
+
+static void
+virPerfGroupLeave(virPerfPtr perf,
+                  virPerfEventType type)
+{
+    virPerfEventPtr event = &perf->events[type];
+    virPerfGroupPtr grp;
+
+    if (event->group < 0)
+        return;
+
+    grp = &perf->groups[event->group];
+    event->group = -1;
+    event->id = 0;
+
+    if (--grp->nmembers == 0)
+        VIR_FORCE_CLOSE(grp->fd);
+}
+
+
 int
 virPerfEventEnable(virPerfPtr perf,
                    virPerfEventType type,
                    pid_t pid)
 {
     char *buf = NULL;
-    struct perf_event_attr attr;
     virPerfEventPtr event = &(perf->events[type]);
     virPerfEventAttrPtr event_attr = &attrs[type];
+    int group;
 
     if (event->enabled)
         return 0;
@@ -241,20 +370,17 @@ virPerfEventEnable(virPerfPtr perf,
         VIR_FREE(buf);
     }
 
-    memset(&attr, 0, sizeof(attr));
-    attr.size = sizeof(attr);
-    attr.inherit = 1;
-    attr.disabled = 1;
-    attr.enable_on_exec = 0;
-    attr.type = event_attr->attrType;
-    attr.config = event_attr->attrConfig;
-
-    event->fd = syscall(__NR_perf_event_open, &attr, pid, -1, -1, 0);
-    if (event->fd < 0) {
-        virReportSystemError(errno,
-                             _("unable to open host cpu perf event for %s"),
-                             virPerfEventTypeToString(type));
-        goto error;
+    if ((group = virPerfGetGroupType(perf, type)) < 0 ||
+        virPerfGroupJoin(perf, group, type, pid) < 0) {
+        event->fd = virPerfEventOpen(event_attr->attrType,
+                                     event_attr->attrConfig,
+                                     pid, -1, false);
+        if (event->fd < 0) {
+            virReportSystemError(errno,
+                                 _("unable to open host cpu perf event for %s"),
+                                 virPerfEventTypeToString(type));
+            goto error;
+        }
     }
 
     if (ioctl(event->fd, PERF_EVENT_IOC_ENABLE) < 0) {
@@ -269,6 +395,7 @@ virPerfEventEnable(virPerfPtr perf,
 
  error:
     VIR_FORCE_CLOSE(event->fd);
+    virPerfGroupLeave(perf, type);
     VIR_FREE(buf);
     return -1;
 }
@@ -291,6 +418,7 @@ virPerfEventDisable(virPerfPtr perf,
 
     event->enabled = false;
     VIR_FORCE_CLOSE(event->fd);
+    virPerfGroupLeave(perf, type);
     return 0;
 }
 
@@ -300,15 +428,134 @@ bool virPerfEventIsEnabled(virPerfPtr perf,
     return perf && perf->events[type].enabled;
 }
 
+
+static void
+virPerfEventSetValue(virPerfPtr perf,
+                     virPerfEventType type,
+                     uint64_t value,
+                     uint64_t *values)
+{
+    if (type == VIR_PERF_EVENT_CMT)
+        value *= perf->events[type].efields.cmt.scale;
+
+    values[type] = value;
+}
+
+
+/*
+ * Read all the members of @group at once.  The layout of the data is
+ *
+ *   u64 nr;
+ *   struct { u64 value; u64 id; } values[nr];
+ *
+ * where one of the values belongs to the leader.
+ */
+static int
+virPerfGroupRead(virPerfPtr perf,
+                 virPerfGroupType group,
+                 uint64_t *values)
+{
+    virPerfGroupPtr grp = &perf->groups[group];
+    uint64_t *data = NULL;
+    size_t ndata = 1 + 2 * (grp->nmembers + 1);
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(data, ndata) < 0)
+        return -1;
+
+    if (saferead(grp->fd, data, ndata * sizeof(*data)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to read perf event group"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < data[0] && i < grp->nmembers + 1; i++) {
+        uint64_t value = data[1 + 2 * i];
+        uint64_t id = data[2 + 2 * i];
+
+        for (j = 0; j < VIR_PERF_EVENT_LAST; j++) {
+            virPerfEventPtr event = &perf->events[j];
+
+            if (event->enabled && event->group == group && event->id == id) {
+                virPerfEventSetValue(perf, j, value, values);
+                break;
+            }
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(data);
+    return ret;
+}
+
+
+/**
+ * virPerfReadEvents:
+ * @perf: perf events of a process
+ * @values: array of VIR_PERF_EVENT_LAST elements
+ *
+ * Store the value of every enabled event in its element of @values.
+ * Grouped events are read with one syscall per group, the elements of
+ * disabled events are left untouched.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virPerfReadEvents(virPerfPtr perf,
+                  uint64_t *values)
+{
+    virPerfEventPtr event;
+    uint64_t value;
+    size_t i;
+
+    for (i = 0; i < VIR_PERF_GROUP_LAST; i++) {
+        if (perf->groups[i].fd >= 0 &&
+            virPerfGroupRead(perf, i, values) < 0)
+            return -1;
+    }
+
+    for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
+        event = &perf->events[i];
+
+        if (!event->enabled || event->group >= 0)
+            continue;
+
+        if (saferead(event->fd, &value, sizeof(uint64_t)) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to read perf event %s"),
+                                 virPerfEventTypeToString(i));
+            return -1;
+        }
+
+        virPerfEventSetValue(perf, i, value, values);
+    }
+
+    return 0;
+}
+
 int
 virPerfReadEvent(virPerfPtr perf,
                  virPerfEventType type,
                  uint64_t *value)
 {
     virPerfEventPtr event = &perf->events[type];
+    uint64_t values[VIR_PERF_EVENT_LAST] = { 0 };
+
     if (!event->enabled)
         return -1;
 
+    if (event->group >= 0) {
+        if (virPerfGroupRead(perf, event->group, values) < 0)
+            return -1;
+
+        *value = values[type];
+        return 0;
+    }
+
     if (saferead(event->fd, value, sizeof(uint64_t)) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to read cache data"));
@@ -365,6 +612,15 @@ virPerfReadEvent(virPerfPtr perf ATTRIBUTE_UNUSED,
     return -1;
 }
 
+int
+virPerfReadEvents(virPerfPtr perf ATTRIBUTE_UNUSED,
+                  uint64_t *values ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENXIO, "%s",
+                         _("Perf not supported on this platform"));
+    return -1;
+}
+
 #endif
 
 virPerfPtr
@@ -379,8 +635,12 @@ virPerfNew(void)
     for (i = 0; i < VIR_PERF_EVENT_LAST; i++) {
         perf->events[i].fd = -1;
         perf->events[i].enabled = false;
+        perf->events[i].group = -1;
     }
 
+    for (i = 0; i < VIR_PERF_GROUP_LAST; i++)
+        perf->groups[i].fd = -1;
+
     if (virPerfRdtAttrInit() < 0)
         virResetLastError();
 
@@ -83,4 +83,7 @@ int virPerfReadEvent(virPerfPtr perf,
                      virPerfEventType type,
                      uint64_t *value);
 
+int virPerfReadEvents(virPerfPtr perf,
+                      uint64_t *values);
+
 #endif /* __VIR_PERF_H__ */
@@ -32,18 +32,30 @@
 #include "virerror.h"
 #include "virfile.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+/* How long a port found bound by somebody else is skipped before it
+ * is probed again, in milliseconds */
+#define VIR_PORT_ALLOCATOR_BUSY_TIMEOUT (5 * 1000)
+
 struct _virPortAllocator {
     virObjectLockable parent;
     virBitmapPtr bitmap;
 
+    /* Ports which failed the bind check, i.e. used outside of libvirt */
+    virBitmapPtr busy;
+    unsigned long long busyExpire;
+
     char *name;
 
     unsigned short start;
     unsigned short end;
 
+    /* Offset the next search starts at with VIR_PORT_ALLOCATOR_ROTATE */
+    ssize_t cursor;
+
     unsigned int flags;
 };
 
@@ -55,6 +67,7 @@ virPortAllocatorDispose(void *obj)
     virPortAllocatorPtr pa = obj;
 
     virBitmapFree(pa->bitmap);
+    virBitmapFree(pa->busy);
     VIR_FREE(pa->name);
 }
 
@@ -93,8 +106,10 @@ virPortAllocatorPtr virPortAllocatorNew(const char *name,
     pa->flags = flags;
     pa->start = start;
     pa->end = end;
+    pa->cursor = -1;
 
     if (!(pa->bitmap = virBitmapNew((end-start)+1)) ||
+        !(pa->busy = virBitmapNew((end-start)+1)) ||
         VIR_STRDUP(pa->name, name) < 0) {
         virObjectUnref(pa);
         return NULL;
@@ -172,38 +187,91 @@ static int virPortAllocatorBindToPort(bool *used,
     return ret;
 }
 
+/* Find a port which is neither reserved nor known to be busy, starting
+ * after offset @pos. Returns the offset or -1 if there's none. */
+static ssize_t
+virPortAllocatorFindFree(virPortAllocatorPtr pa,
+                         ssize_t pos)
+{
+    while ((pos = virBitmapNextClearBit(pa->bitmap, pos)) >= 0) {
+        if (!virBitmapIsBitSet(pa->busy, pos))
+            break;
+    }
+
+    return pos;
+}
+
+
+static ssize_t
+virPortAllocatorNext(virPortAllocatorPtr pa,
+                     bool *rechecked)
+{
+    ssize_t pos;
+
+    if (pa->cursor >= 0 &&
+        (pos = virPortAllocatorFindFree(pa, pa->cursor)) >= 0)
+        return pos;
+
+    if ((pos = virPortAllocatorFindFree(pa, -1)) >= 0 ||
+        *rechecked || virBitmapIsAllClear(pa->busy))
+        return pos;
+
+    /* Only ports found busy earlier are left, give them another chance */
+    *rechecked = true;
+    virBitmapClearAll(pa->busy);
+    return virPortAllocatorFindFree(pa, -1);
+}
+
+
 int virPortAllocatorAcquire(virPortAllocatorPtr pa,
                             unsigned short *port)
 {
     int ret = -1;
-    size_t i;
+    ssize_t pos;
+    unsigned long long now;
+    bool rechecked = false;
 
     *port = 0;
     virObjectLock(pa);
 
-    for (i = pa->start; i <= pa->end && !*port; i++) {
+    /* Ports used outside of libvirt are verified lazily: they're skipped
+     * until the timeout expires, instead of being probed every time */
+    if (virTimeMillisNow(&now) == 0 && now >= pa->busyExpire) {
+        virBitmapClearAll(pa->busy);
+        pa->busyExpire = now + VIR_PORT_ALLOCATOR_BUSY_TIMEOUT;
+        rechecked = true;
+    }
+
+    while ((pos = virPortAllocatorNext(pa, &rechecked)) >= 0) {
+        unsigned short i = pa->start + pos;
         bool used = false, v6used = false;
+        int rc = 0;
 
-        if (virBitmapIsBitSet(pa->bitmap, i - pa->start))
-            continue;
+        /* Reserve the port, so that the bind check can be done
+         * without holding the lock */
+        ignore_value(virBitmapSetBit(pa->bitmap, pos));
 
         if (!(pa->flags & VIR_PORT_ALLOCATOR_SKIP_BIND_CHECK)) {
+            virObjectUnlock(pa);
             if (virPortAllocatorBindToPort(&v6used, i, AF_INET6) < 0 ||
                 virPortAllocatorBindToPort(&used, i, AF_INET) < 0)
-                goto cleanup;
+                rc = -1;
+            virObjectLock(pa);
         }
 
-        if (!used && !v6used) {
-            /* Add port to bitmap of reserved ports */
-            if (virBitmapSetBit(pa->bitmap,
-                                i - pa->start) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Failed to reserve port %zu"), i);
+        if (rc < 0 || used || v6used) {
+            ignore_value(virBitmapClearBit(pa->bitmap, pos));
+            if (rc < 0)
                 goto cleanup;
-            }
-            *port = i;
-            ret = 0;
+            ignore_value(virBitmapSetBit(pa->busy, pos));
+            continue;
         }
+
+        if (pa->flags & VIR_PORT_ALLOCATOR_ROTATE)
+            pa->cursor = pos;
+        *port = i;
+        ret = 0;
+        break;
     }
 
     if (*port == 0) {
@@ -30,6 +30,8 @@ typedef virPortAllocator *virPortAllocatorPtr;
 
 typedef enum {
     VIR_PORT_ALLOCATOR_SKIP_BIND_CHECK = (1 << 0),
+    /* Hand out ports round robin rather than the lowest free one */
+    VIR_PORT_ALLOCATOR_ROTATE = (1 << 1),
 } virPortAllocatorFlags;
 
 virPortAllocatorPtr virPortAllocatorNew(const char *name,
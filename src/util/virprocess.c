@@ -409,7 +409,7 @@ virProcessKillPainfully(pid_t pid, bool force)
 
 int virProcessSetAffinity(pid_t pid, virBitmapPtr map)
 {
-    size_t i;
+    ssize_t i;
     VIR_DEBUG("Set process affinity on %lld", (long long)pid);
 # ifdef CPU_ALLOC
     /* New method dynamically allocates cpu mask, allowing unlimted cpus */
@@ -434,10 +434,9 @@ int virProcessSetAffinity(pid_t pid, virBitmapPtr map)
     }
 
     CPU_ZERO_S(masklen, mask);
-    for (i = 0; i < virBitmapSize(map); i++) {
-        if (virBitmapIsBitSet(map, i))
-            CPU_SET_S(i, masklen, mask);
-    }
+    i = -1;
+    while ((i = virBitmapNextSetBit(map, i)) >= 0)
+        CPU_SET_S(i, masklen, mask);
 
     if (sched_setaffinity(pid, masklen, mask) < 0) {
         CPU_FREE(mask);
@@ -456,10 +455,9 @@ int virProcessSetAffinity(pid_t pid, virBitmapPtr map)
     cpu_set_t mask;
 
     CPU_ZERO(&mask);
-    for (i = 0; i < virBitmapSize(map); i++) {
-        if (virBitmapIsBitSet(map, i))
-            CPU_SET(i, &mask);
-    }
+    i = -1;
+    while ((i = virBitmapNextSetBit(map, i)) >= 0)
+        CPU_SET(i, &mask);
 
     if (sched_setaffinity(pid, sizeof(mask), &mask) < 0) {
         virReportSystemError(errno,
@@ -481,6 +479,8 @@ virProcessGetAffinity(pid_t pid)
     virBitmapPtr ret = NULL;
 
 # ifdef CPU_ALLOC
+    int nset;
+
     /* 262144 cpus ought to be enough for anyone */
     ncpus = 1024 << 8;
     masklen = CPU_ALLOC_SIZE(ncpus);
@@ -510,16 +510,23 @@ virProcessGetAffinity(pid_t pid)
     if (!(ret = virBitmapNew(ncpus)))
           goto cleanup;
 
-    for (i = 0; i < ncpus; i++) {
 # ifdef CPU_ALLOC
+    /* The mask is sized for far more CPUs than any host has, so stop
+     * as soon as all the set ones were found */
+    nset = CPU_COUNT_S(masklen, mask);
+    for (i = 0; nset > 0 && i < ncpus; i++) {
          /* coverity[overrun-local] */
-        if (CPU_ISSET_S(i, masklen, mask))
+        if (CPU_ISSET_S(i, masklen, mask)) {
             ignore_value(virBitmapSetBit(ret, i));
+            nset--;
+        }
+    }
 # else
+    for (i = 0; i < ncpus; i++) {
         if (CPU_ISSET(i, mask))
             ignore_value(virBitmapSetBit(ret, i));
-# endif
     }
+# endif
 
  cleanup:
 # ifdef CPU_ALLOC
@@ -536,14 +543,13 @@ virProcessGetAffinity(pid_t pid)
 int virProcessSetAffinity(pid_t pid,
                           virBitmapPtr map)
 {
-    size_t i;
+    ssize_t i;
     cpuset_t mask;
 
     CPU_ZERO(&mask);
-    for (i = 0; i < virBitmapSize(map); i++) {
-        if (virBitmapIsBitSet(map, i))
-            CPU_SET(i, &mask);
-    }
+    i = -1;
+    while ((i = virBitmapNextSetBit(map, i)) >= 0)
+        CPU_SET(i, &mask);
 
     if (cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_PID, pid,
                            sizeof(mask), &mask) != 0) {
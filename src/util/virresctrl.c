@@ -0,0 +1,1349 @@
+/*
+ * virresctrl.c: methods for managing resource control (Intel RDT)
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <sys/file.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#define __VIR_RESCTRL_PRIV_H_ALLOW__
+#include "virresctrlpriv.h"
+#include "count-one-bits.h"
+#include "viralloc.h"
+#include "virbuffer.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_RESCTRL
+
+VIR_LOG_INIT("util.virresctrl")
+
+#define SYSFS_RESCTRL_PATH "/sys/fs/resctrl"
+
+/* Our naming for cache types and scopes */
+VIR_ENUM_IMPL(virCache, VIR_CACHE_TYPE_LAST,
+              "both",
+              "code",
+              "data")
+
+/* Cache name mapping for Linux kernel naming */
+VIR_ENUM_IMPL(virCacheKernel, VIR_CACHE_TYPE_LAST,
+              "Unified",
+              "Instruction",
+              "Data")
+
+/* Cache name mapping for the resctrl file system, e.g. L3CODE */
+VIR_ENUM_DECL(virResctrl);
+VIR_ENUM_IMPL(virResctrl, VIR_CACHE_TYPE_LAST,
+              "",
+              "CODE",
+              "DATA")
+
+
+/*
+ * The masks are kept as plain integers: the capacity bitmasks of all
+ * the existing hardware are way narrower than 64 bits.
+ */
+#define VIR_RESCTRL_MAX_BITS (sizeof(unsigned long long) * CHAR_BIT)
+
+
+/* Host information */
+typedef struct _virResctrlInfoPerType virResctrlInfoPerType;
+typedef virResctrlInfoPerType *virResctrlInfoPerTypePtr;
+struct _virResctrlInfoPerType {
+    /* Data read from the kernel */
+    unsigned int bits; /* width of the capacity bitmask */
+    unsigned int min_cbm_bits;
+
+    /* Size of the cache banks, known once virResctrlInfoGetCache
+     * was called for the level */
+    unsigned long long size;
+
+    virResctrlInfoPerCache control;
+};
+
+typedef struct _virResctrlInfoPerLevel virResctrlInfoPerLevel;
+typedef virResctrlInfoPerLevel *virResctrlInfoPerLevelPtr;
+struct _virResctrlInfoPerLevel {
+    virResctrlInfoPerTypePtr types[VIR_CACHE_TYPE_LAST];
+};
+
+struct _virResctrlInfo {
+    virResctrlInfoPerLevelPtr *levels;
+    size_t nlevels;
+
+    /* NULL if memory bandwidth allocation isn't available */
+    virResctrlInfoMemBWPerNodePtr membw;
+};
+
+
+void
+virResctrlInfoFree(virResctrlInfoPtr resctrl)
+{
+    size_t i;
+    size_t j;
+
+    if (!resctrl)
+        return;
+
+    for (i = 0; i < resctrl->nlevels; i++) {
+        if (!resctrl->levels[i])
+            continue;
+        for (j = 0; j < VIR_CACHE_TYPE_LAST; j++)
+            VIR_FREE(resctrl->levels[i]->types[j]);
+        VIR_FREE(resctrl->levels[i]);
+    }
+    VIR_FREE(resctrl->levels);
+    VIR_FREE(resctrl->membw);
+    VIR_FREE(resctrl);
+}
+
+
+static int
+virResctrlInfoParseCache(virResctrlInfoPtr resctrl,
+                         const char *name)
+{
+    virResctrlInfoPerTypePtr i_type = NULL;
+    unsigned int level;
+    char *suffix = NULL;
+    char *mask = NULL;
+    unsigned long long cbm;
+    int type;
+    int rv;
+    int ret = -1;
+
+    if (virStrToLong_ui(name + 1, &suffix, 10, &level) < 0 ||
+        (type = virResctrlTypeFromString(suffix)) < 0) {
+        VIR_DEBUG("Ignoring unknown resctrl resource '%s'", name);
+        return 0;
+    }
+
+    if (VIR_ALLOC(i_type) < 0)
+        goto cleanup;
+
+    i_type->control.scope = type;
+
+    rv = virFileReadValueUint(&i_type->control.max_allocation,
+                              SYSFS_RESCTRL_PATH "/info/%s/num_closids",
+                              name);
+    if (rv == -2)
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Cannot get num_closids from resctrl cache info '%s'"),
+                       name);
+    if (rv < 0)
+        goto cleanup;
+
+    rv = virFileReadValueString(&mask,
+                                SYSFS_RESCTRL_PATH "/info/%s/cbm_mask",
+                                name);
+    if (rv == -2)
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Cannot get cbm_mask from resctrl cache info '%s'"),
+                       name);
+    if (rv < 0)
+        goto cleanup;
+
+    if (virStrToLong_ullp(mask, NULL, 16, &cbm) < 0 || cbm == 0 ||
+        (cbm & (cbm + 1)) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid cbm_mask '%s' in resctrl cache info '%s'"),
+                       mask, name);
+        goto cleanup;
+    }
+    i_type->bits = count_one_bits_ll(cbm);
+
+    rv = virFileReadValueUint(&i_type->min_cbm_bits,
+                              SYSFS_RESCTRL_PATH "/info/%s/min_cbm_bits",
+                              name);
+    if (rv == -2)
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Cannot get min_cbm_bits from resctrl cache info '%s'"),
+                       name);
+    if (rv < 0)
+        goto cleanup;
+
+    if (resctrl->nlevels <= level &&
+        VIR_EXPAND_N(resctrl->levels, resctrl->nlevels,
+                     level - resctrl->nlevels + 1) < 0)
+        goto cleanup;
+
+    if (!resctrl->levels[level] &&
+        VIR_ALLOC(resctrl->levels[level]) < 0)
+        goto cleanup;
+
+    VIR_FREE(resctrl->levels[level]->types[type]);
+    VIR_STEAL_PTR(resctrl->levels[level]->types[type], i_type);
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(mask);
+    VIR_FREE(i_type);
+    return ret;
+}
+
+
+static int
+virResctrlInfoParseMemoryBandwidth(virResctrlInfoPtr resctrl)
+{
+    virResctrlInfoMemBWPerNodePtr membw = NULL;
+    int ret = -1;
+
+    if (VIR_ALLOC(membw) < 0)
+        return -1;
+
+    if (virFileReadValueUint(&membw->granularity,
+                             SYSFS_RESCTRL_PATH "/info/MB/bandwidth_gran") < 0 ||
+        virFileReadValueUint(&membw->min,
+                             SYSFS_RESCTRL_PATH "/info/MB/min_bandwidth") < 0 ||
+        virFileReadValueUint(&membw->max_allocation,
+                             SYSFS_RESCTRL_PATH "/info/MB/num_closids") < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Cannot get memory bandwidth resctrl info"));
+        goto cleanup;
+    }
+
+    VIR_STEAL_PTR(resctrl->membw, membw);
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(membw);
+    return ret;
+}
+
+
+/**
+ * virResctrlInfoNew:
+ *
+ * Read what the resctrl file system of the host allows to allocate.
+ * If it's not mounted, the returned object just has no controls.
+ *
+ * Returns the info object or NULL on error
+ */
+virResctrlInfoPtr
+virResctrlInfoNew(void)
+{
+    virResctrlInfoPtr resctrl = NULL;
+    DIR *dirp = NULL;
+    struct dirent *ent = NULL;
+    int rv;
+
+    if (VIR_ALLOC(resctrl) < 0)
+        return NULL;
+
+    rv = virDirOpenIfExists(&dirp, SYSFS_RESCTRL_PATH "/info");
+    if (rv <= 0)
+        goto cleanup;
+
+    while ((rv = virDirRead(dirp, &ent, SYSFS_RESCTRL_PATH "/info")) > 0) {
+        if (STREQ(ent->d_name, "MB")) {
+            if (virResctrlInfoParseMemoryBandwidth(resctrl) < 0)
+                break;
+            continue;
+        }
+
+        if (ent->d_name[0] != 'L')
+            continue;
+
+        if ((rv = virResctrlInfoParseCache(resctrl, ent->d_name)) < 0)
+            break;
+    }
+
+ cleanup:
+    virDirClose(&dirp);
+    if (rv < 0) {
+        virResctrlInfoFree(resctrl);
+        return NULL;
+    }
+    return resctrl;
+}
+
+
+static bool
+virResctrlInfoIsEmpty(virResctrlInfoPtr resctrl)
+{
+    size_t i;
+    size_t j;
+
+    if (!resctrl)
+        return true;
+
+    if (resctrl->membw)
+        return false;
+
+    for (i = 0; i < resctrl->nlevels; i++) {
+        for (j = 0; resctrl->levels[i] && j < VIR_CACHE_TYPE_LAST; j++) {
+            if (resctrl->levels[i]->types[j])
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+static virResctrlInfoPerTypePtr
+virResctrlInfoGetType(virResctrlInfoPtr resctrl,
+                      unsigned int level,
+                      virCacheType type)
+{
+    if (!resctrl || level >= resctrl->nlevels || !resctrl->levels[level])
+        return NULL;
+
+    return resctrl->levels[level]->types[type];
+}
+
+
+/**
+ * virResctrlInfoGetCache:
+ * @resctrl: host resctrl info
+ * @level: level of the cache
+ * @size: size of the cache banks of @level in bytes
+ * @ncontrols: filled with the count of @controls
+ * @controls: filled with the allocation controls of the cache
+ *
+ * Returns the ways each bank of @level can be allocated. All the banks
+ * of one level must have the same @size. The caller has to free the
+ * elements of @controls as well as the array.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virResctrlInfoGetCache(virResctrlInfoPtr resctrl,
+                       unsigned int level,
+                       unsigned long long size,
+                       size_t *ncontrols,
+                       virResctrlInfoPerCachePtr **controls)
+{
+    virResctrlInfoPerTypePtr i_type;
+    virResctrlInfoPerCachePtr control = NULL;
+    size_t i;
+
+    for (i = 0; i < VIR_CACHE_TYPE_LAST; i++) {
+        if (!(i_type = virResctrlInfoGetType(resctrl, level, i)))
+            continue;
+
+        if (i_type->size && i_type->size != size) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("level %u cache size %llu does not match "
+                             "expected size %llu"),
+                           level, i_type->size, size);
+            goto error;
+        }
+
+        i_type->size = size;
+        i_type->control.granularity = size / i_type->bits;
+        if (i_type->min_cbm_bits != 1)
+            i_type->control.min = i_type->min_cbm_bits *
+                                  i_type->control.granularity;
+
+        if (VIR_ALLOC(control) < 0)
+            goto error;
+        *control = i_type->control;
+
+        if (VIR_APPEND_ELEMENT(*controls, *ncontrols, control) < 0)
+            goto error;
+    }
+
+    return 0;
+
+ error:
+    VIR_FREE(control);
+    while (*ncontrols)
+        VIR_FREE((*controls)[--*ncontrols]);
+    VIR_FREE(*controls);
+    return -1;
+}
+
+
+/**
+ * virResctrlInfoGetMemoryBandwidth:
+ * @resctrl: host resctrl info
+ * @control: filled with the memory bandwidth limits
+ *
+ * Memory bandwidth is controlled per bank of the last level cache.
+ *
+ * Returns 1 if @control was filled, 0 if memory bandwidth allocation
+ * is not supported.
+ */
+int
+virResctrlInfoGetMemoryBandwidth(virResctrlInfoPtr resctrl,
+                                 virResctrlInfoMemBWPerNodePtr control)
+{
+    if (!resctrl || !resctrl->membw)
+        return 0;
+
+    *control = *resctrl->membw;
+    return 1;
+}
+
+
+/* Allocations */
+typedef struct _virResctrlAllocPerType virResctrlAllocPerType;
+typedef virResctrlAllocPerType *virResctrlAllocPerTypePtr;
+struct _virResctrlAllocPerType {
+    /* Requested sizes in bytes indexed by cache id, 0 if not set */
+    unsigned long long *sizes;
+    size_t nsizes;
+
+    /* Capacity bitmasks indexed by cache id, 0 if not assigned */
+    unsigned long long *masks;
+    size_t nmasks;
+};
+
+typedef struct _virResctrlAllocPerLevel virResctrlAllocPerLevel;
+typedef virResctrlAllocPerLevel *virResctrlAllocPerLevelPtr;
+struct _virResctrlAllocPerLevel {
+    virResctrlAllocPerTypePtr types[VIR_CACHE_TYPE_LAST];
+};
+
+struct _virResctrlAlloc {
+    virResctrlAllocPerLevelPtr *levels;
+    size_t nlevels;
+
+    /* Memory bandwidth in percent indexed by node id, 0 if not set */
+    unsigned int *bandwidths;
+    size_t nbandwidths;
+
+    char *id; /* unique within the domain */
+    char *path; /* of the group in the resctrl file system */
+};
+
+
+virResctrlAllocPtr
+virResctrlAllocNew(void)
+{
+    virResctrlAllocPtr alloc;
+
+    ignore_value(VIR_ALLOC(alloc));
+    return alloc;
+}
+
+
+void
+virResctrlAllocFree(virResctrlAllocPtr alloc)
+{
+    size_t i;
+    size_t j;
+
+    if (!alloc)
+        return;
+
+    for (i = 0; i < alloc->nlevels; i++) {
+        if (!alloc->levels[i])
+            continue;
+        for (j = 0; j < VIR_CACHE_TYPE_LAST; j++) {
+            virResctrlAllocPerTypePtr a_type = alloc->levels[i]->types[j];
+
+            if (!a_type)
+                continue;
+            VIR_FREE(a_type->sizes);
+            VIR_FREE(a_type->masks);
+            VIR_FREE(a_type);
+        }
+        VIR_FREE(alloc->levels[i]);
+    }
+    VIR_FREE(alloc->levels);
+    VIR_FREE(alloc->bandwidths);
+    VIR_FREE(alloc->id);
+    VIR_FREE(alloc->path);
+    VIR_FREE(alloc);
+}
+
+
+static virResctrlAllocPerTypePtr
+virResctrlAllocFindType(virResctrlAllocPtr alloc,
+                        unsigned int level,
+                        virCacheType type)
+{
+    if (level >= alloc->nlevels || !alloc->levels[level])
+        return NULL;
+
+    return alloc->levels[level]->types[type];
+}
+
+
+static virResctrlAllocPerTypePtr
+virResctrlAllocGetType(virResctrlAllocPtr alloc,
+                       unsigned int level,
+                       virCacheType type)
+{
+    virResctrlAllocPerLevelPtr a_level;
+
+    if (alloc->nlevels <= level &&
+        VIR_EXPAND_N(alloc->levels, alloc->nlevels,
+                     level - alloc->nlevels + 1) < 0)
+        return NULL;
+
+    if (!alloc->levels[level] &&
+        VIR_ALLOC(alloc->levels[level]) < 0)
+        return NULL;
+
+    a_level = alloc->levels[level];
+
+    if (!a_level->types[type] &&
+        VIR_ALLOC(a_level->types[type]) < 0)
+        return NULL;
+
+    return a_level->types[type];
+}
+
+
+bool
+virResctrlAllocIsEmpty(virResctrlAllocPtr alloc)
+{
+    size_t i;
+    size_t j;
+    size_t k;
+
+    if (!alloc)
+        return true;
+
+    for (i = 0; i < alloc->nbandwidths; i++) {
+        if (alloc->bandwidths[i])
+            return false;
+    }
+
+    for (i = 0; i < alloc->nlevels; i++) {
+        for (j = 0; alloc->levels[i] && j < VIR_CACHE_TYPE_LAST; j++) {
+            virResctrlAllocPerTypePtr a_type = alloc->levels[i]->types[j];
+
+            for (k = 0; a_type && k < a_type->nsizes; k++) {
+                if (a_type->sizes[k])
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+int
+virResctrlAllocSetCacheSize(virResctrlAllocPtr alloc,
+                            unsigned int level,
+                            virCacheType type,
+                            unsigned int cache,
+                            unsigned long long size)
+{
+    virResctrlAllocPerTypePtr a_type;
+
+    if (size == 0) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("Cache allocation of cache id %u level %u "
+                         "must not be empty"), cache, level);
+        return -1;
+    }
+
+    if (!(a_type = virResctrlAllocGetType(alloc, level, type)))
+        return -1;
+
+    if (a_type->nsizes <= cache &&
+        VIR_EXPAND_N(a_type->sizes, a_type->nsizes,
+                     cache - a_type->nsizes + 1) < 0)
+        return -1;
+
+    if (a_type->sizes[cache]) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Collision for cache id %u level %u type '%s'"),
+                       cache, level, virCacheTypeToString(type));
+        return -1;
+    }
+
+    a_type->sizes[cache] = size;
+    return 0;
+}
+
+
+int
+virResctrlAllocForeachCache(virResctrlAllocPtr alloc,
+                            virResctrlAllocForeachCacheCallback cb,
+                            void *opaque)
+{
+    virResctrlAllocPerTypePtr a_type;
+    size_t level;
+    size_t type;
+    size_t cache;
+
+    if (!alloc)
+        return 0;
+
+    for (level = 0; level < alloc->nlevels; level++) {
+        for (type = 0; type < VIR_CACHE_TYPE_LAST; type++) {
+            if (!(a_type = virResctrlAllocFindType(alloc, level, type)))
+                continue;
+
+            for (cache = 0; cache < a_type->nsizes; cache++) {
+                if (!a_type->sizes[cache])
+                    continue;
+
+                if (cb(level, type, cache, a_type->sizes[cache], opaque) < 0)
+                    return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+int
+virResctrlAllocSetMemoryBandwidth(virResctrlAllocPtr alloc,
+                                  unsigned int id,
+                                  unsigned int bandwidth)
+{
+    if (bandwidth == 0 || bandwidth > 100) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("Memory bandwidth of node %u must be between "
+                         "1 and 100, not %u"), id, bandwidth);
+        return -1;
+    }
+
+    if (alloc->nbandwidths <= id &&
+        VIR_EXPAND_N(alloc->bandwidths, alloc->nbandwidths,
+                     id - alloc->nbandwidths + 1) < 0)
+        return -1;
+
+    if (alloc->bandwidths[id]) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Memory bandwidth already defined for node %u"),
+                       id);
+        return -1;
+    }
+
+    alloc->bandwidths[id] = bandwidth;
+    return 0;
+}
+
+
+int
+virResctrlAllocForeachMemory(virResctrlAllocPtr alloc,
+                             virResctrlAllocForeachMemoryCallback cb,
+                             void *opaque)
+{
+    size_t i;
+
+    if (!alloc)
+        return 0;
+
+    for (i = 0; i < alloc->nbandwidths; i++) {
+        if (!alloc->bandwidths[i])
+            continue;
+
+        if (cb(i, alloc->bandwidths[i], opaque) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+int
+virResctrlAllocSetID(virResctrlAllocPtr alloc,
+                     const char *id)
+{
+    if (!id) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Resctrl allocation 'id' cannot be NULL"));
+        return -1;
+    }
+
+    VIR_FREE(alloc->id);
+    return VIR_STRDUP(alloc->id, id);
+}
+
+
+const char *
+virResctrlAllocGetID(virResctrlAllocPtr alloc)
+{
+    return alloc->id;
+}
+
+
+/**
+ * virResctrlAllocFormat:
+ * @alloc: allocation with assigned masks
+ *
+ * Format the schemata file contents for @alloc, e.g.
+ *
+ *   L3:0=fff00;1=ff
+ *   MB:0=50;1=100
+ *
+ * Returns the string or NULL on error
+ */
+char *
+virResctrlAllocFormat(virResctrlAllocPtr alloc)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virResctrlAllocPerTypePtr a_type;
+    size_t level;
+    size_t type;
+    size_t i;
+
+    for (level = 0; level < alloc->nlevels; level++) {
+        for (type = 0; type < VIR_CACHE_TYPE_LAST; type++) {
+            if (!(a_type = virResctrlAllocFindType(alloc, level, type)) ||
+                !a_type->nmasks)
+                continue;
+
+            virBufferAsprintf(&buf, "L%zu%s:", level,
+                              virResctrlTypeToString(type));
+
+            for (i = 0; i < a_type->nmasks; i++) {
+                if (a_type->masks[i])
+                    virBufferAsprintf(&buf, "%zu=%llx;", i, a_type->masks[i]);
+            }
+
+            virBufferTrim(&buf, ";", 1);
+            virBufferAddChar(&buf, '\n');
+        }
+    }
+
+    if (alloc->nbandwidths) {
+        virBufferAddLit(&buf, "MB:");
+        for (i = 0; i < alloc->nbandwidths; i++) {
+            if (alloc->bandwidths[i])
+                virBufferAsprintf(&buf, "%zu=%u;", i, alloc->bandwidths[i]);
+        }
+        virBufferTrim(&buf, ";", 1);
+        virBufferAddChar(&buf, '\n');
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/* Parse one "L3CODE:0=ff;1=f0" or "MB:0=50" line of a schemata file */
+static int
+virResctrlAllocParseLine(virResctrlAllocPtr alloc,
+                         const char *line)
+{
+    virResctrlAllocPerTypePtr a_type = NULL;
+    char **entries = NULL;
+    char *prefix = NULL;
+    char *tmp;
+    const char *sep;
+    unsigned int level = 0;
+    unsigned int id;
+    unsigned long long value;
+    bool membw;
+    int type = VIR_CACHE_TYPE_BOTH;
+    size_t i;
+    int ret = -1;
+
+    while (*line == ' ')
+        line++;
+
+    if (!(sep = strchr(line, ':')))
+        return 0;
+
+    if (VIR_STRNDUP(prefix, line, sep - line) < 0)
+        return -1;
+
+    membw = STREQ(prefix, "MB");
+    if (!membw) {
+        if (prefix[0] != 'L' ||
+            virStrToLong_ui(prefix + 1, &tmp, 10, &level) < 0 ||
+            (type = virResctrlTypeFromString(tmp)) < 0) {
+            VIR_DEBUG("Ignoring unknown schemata line '%s'", line);
+            ret = 0;
+            goto cleanup;
+        }
+
+        if (!(a_type = virResctrlAllocGetType(alloc, level, type)))
+            goto cleanup;
+    }
+
+    if (!(entries = virStringSplit(sep + 1, ";", 0)))
+        goto cleanup;
+
+    for (i = 0; entries[i]; i++) {
+        if (virStrToLong_ui(entries[i], &tmp, 10, &id) < 0 || *tmp != '=' ||
+            virStrToLong_ullp(tmp + 1, NULL, membw ? 10 : 16, &value) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Cannot parse resctrl schema '%s'"), entries[i]);
+            goto cleanup;
+        }
+
+        if (membw) {
+            if (alloc->nbandwidths <= id &&
+                VIR_EXPAND_N(alloc->bandwidths, alloc->nbandwidths,
+                             id - alloc->nbandwidths + 1) < 0)
+                goto cleanup;
+            alloc->bandwidths[id] = value;
+        } else {
+            if (a_type->nmasks <= id &&
+                VIR_EXPAND_N(a_type->masks, a_type->nmasks,
+                             id - a_type->nmasks + 1) < 0)
+                goto cleanup;
+            a_type->masks[id] = value;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStringListFree(entries);
+    VIR_FREE(prefix);
+    return ret;
+}
+
+
+static int
+virResctrlAllocParse(virResctrlAllocPtr alloc,
+                     const char *schemata)
+{
+    char **lines = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (!(lines = virStringSplit(schemata, "\n", 0)))
+        return -1;
+
+    for (i = 0; lines[i]; i++) {
+        if (virResctrlAllocParseLine(alloc, lines[i]) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStringListFree(lines);
+    return ret;
+}
+
+
+static virResctrlAllocPtr
+virResctrlAllocLoad(const char *path)
+{
+    virResctrlAllocPtr alloc = NULL;
+    char *schemata = NULL;
+    int rv;
+
+    if (!(alloc = virResctrlAllocNew()))
+        return NULL;
+
+    rv = virFileReadValueString(&schemata, "%s/schemata", path);
+    if (rv == -2) {
+        VIR_DEBUG("No schemata in '%s'", path);
+        goto cleanup;
+    }
+
+    if (rv < 0 || virResctrlAllocParse(alloc, schemata) < 0) {
+        virResctrlAllocFree(alloc);
+        alloc = NULL;
+    }
+
+ cleanup:
+    VIR_FREE(schemata);
+    return alloc;
+}
+
+
+/*
+ * Compute the capacity bits and the memory bandwidth not used by any
+ * allocation in the resctrl file system other than the default group.
+ */
+static int
+virResctrlAllocGetUnused(virResctrlInfoPtr resctrl,
+                         virResctrlAllocPtr alloc_default,
+                         virResctrlAllocPtr *alloc_free,
+                         unsigned int **bandwidth_used)
+{
+    virResctrlAllocPtr alloc = NULL;
+    virResctrlAllocPerTypePtr a_type;
+    virResctrlAllocPerTypePtr f_type;
+    virResctrlInfoPerTypePtr i_type;
+    DIR *dirp = NULL;
+    struct dirent *ent = NULL;
+    char *path = NULL;
+    size_t level;
+    size_t type;
+    size_t i;
+    int rv;
+    int ret = -1;
+
+    if (!(*alloc_free = virResctrlAllocNew()) ||
+        VIR_ALLOC_N(*bandwidth_used, alloc_default->nbandwidths) < 0)
+        goto cleanup;
+
+    /* start with every bit of every cache the default group knows of */
+    for (level = 0; level < alloc_default->nlevels; level++) {
+        for (type = 0; type < VIR_CACHE_TYPE_LAST; type++) {
+            if (!(a_type = virResctrlAllocFindType(alloc_default, level, type)) ||
+                !(i_type = virResctrlInfoGetType(resctrl, level, type)))
+                continue;
+
+            if (!(f_type = virResctrlAllocGetType(*alloc_free, level, type)) ||
+                VIR_ALLOC_N(f_type->masks, a_type->nmasks) < 0)
+                goto cleanup;
+            f_type->nmasks = a_type->nmasks;
+
+            for (i = 0; i < a_type->nmasks; i++) {
+                if (a_type->masks[i])
+                    f_type->masks[i] = i_type->bits >= VIR_RESCTRL_MAX_BITS ?
+                                       ~0ULL : (1ULL << i_type->bits) - 1;
+            }
+        }
+    }
+
+    if (virDirOpen(&dirp, SYSFS_RESCTRL_PATH) < 0)
+        goto cleanup;
+
+    while ((rv = virDirRead(dirp, &ent, SYSFS_RESCTRL_PATH)) > 0) {
+        if (STREQ(ent->d_name, "info") ||
+            STREQ(ent->d_name, "mon_groups") ||
+            STREQ(ent->d_name, "mon_data") ||
+            ent->d_type != DT_DIR)
+            continue;
+
+        VIR_FREE(path);
+        if (virAsprintf(&path, "%s/%s", SYSFS_RESCTRL_PATH, ent->d_name) < 0)
+            goto cleanup;
+
+        virResctrlAllocFree(alloc);
+        if (!(alloc = virResctrlAllocLoad(path)))
+            goto cleanup;
+
+        for (level = 0; level < alloc->nlevels; level++) {
+            for (type = 0; type < VIR_CACHE_TYPE_LAST; type++) {
+                if (!(a_type = virResctrlAllocFindType(alloc, level, type)) ||
+                    !(f_type = virResctrlAllocFindType(*alloc_free, level, type)))
+                    continue;
+
+                for (i = 0; i < a_type->nmasks && i < f_type->nmasks; i++)
+                    f_type->masks[i] &= ~a_type->masks[i];
+            }
+        }
+
+        for (i = 0; i < alloc->nbandwidths && i < alloc_default->nbandwidths; i++)
+            (*bandwidth_used)[i] += alloc->bandwidths[i];
+    }
+    if (rv < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(path);
+    virDirClose(&dirp);
+    virResctrlAllocFree(alloc);
+    return ret;
+}
+
+
+/* Find the lowest run of @need contiguous bits set in @mask */
+static int
+virResctrlAllocFindMask(unsigned long long mask,
+                        unsigned int bits,
+                        unsigned int need,
+                        unsigned long long *result)
+{
+    unsigned long long candidate;
+    size_t start;
+
+    if (need == 0 || need > bits || need > VIR_RESCTRL_MAX_BITS)
+        return -1;
+
+    candidate = need == VIR_RESCTRL_MAX_BITS ? ~0ULL : (1ULL << need) - 1;
+
+    for (start = 0; start + need <= bits; start++) {
+        if ((mask & (candidate << start)) == candidate << start) {
+            *result = candidate << start;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+
+/**
+ * virResctrlAllocAssign:
+ * @resctrl: host resctrl info
+ * @alloc: the requested allocation
+ *
+ * Pick the capacity bitmasks for all the sizes requested in @alloc among
+ * the ones unused by other allocations and check the requested memory
+ * bandwidth is available. The caches and memory nodes @alloc doesn't
+ * ask for are left as in the default group.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virResctrlAllocAssign(virResctrlInfoPtr resctrl,
+                      virResctrlAllocPtr alloc)
+{
+    virResctrlAllocPtr alloc_default = NULL;
+    virResctrlAllocPtr alloc_free = NULL;
+    virResctrlAllocPerTypePtr a_type;
+    virResctrlAllocPerTypePtr d_type;
+    virResctrlAllocPerTypePtr f_type;
+    virResctrlInfoPerTypePtr i_type;
+    unsigned int *bandwidth_used = NULL;
+    size_t level;
+    size_t type;
+    size_t i;
+    int ret = -1;
+
+    if (virResctrlInfoIsEmpty(resctrl)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("Resource control is not supported on this host"));
+        return -1;
+    }
+
+    if (!(alloc_default = virResctrlAllocLoad(SYSFS_RESCTRL_PATH)) ||
+        virResctrlAllocGetUnused(resctrl, alloc_default,
+                                 &alloc_free, &bandwidth_used) < 0)
+        goto cleanup;
+
+    for (level = 0; level < alloc->nlevels; level++) {
+        for (type = 0; type < VIR_CACHE_TYPE_LAST; type++) {
+            if (!(a_type = virResctrlAllocFindType(alloc, level, type)))
+                continue;
+
+            i_type = virResctrlInfoGetType(resctrl, level, type);
+            d_type = virResctrlAllocFindType(alloc_default, level, type);
+            f_type = virResctrlAllocFindType(alloc_free, level, type);
+
+            if (!i_type || !i_type->size || !d_type || !f_type) {
+                virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                               _("Cache allocation of level %zu type '%s' "
+                                 "is not supported on this host"),
+                               level, virCacheTypeToString(type));
+                goto cleanup;
+            }
+
+            VIR_FREE(a_type->masks);
+            if (VIR_ALLOC_N(a_type->masks, d_type->nmasks) < 0)
+                goto cleanup;
+            a_type->nmasks = d_type->nmasks;
+
+            for (i = 0; i < a_type->nmasks; i++) {
+                unsigned long long size = i < a_type->nsizes ?
+                                          a_type->sizes[i] : 0;
+                unsigned long long granularity = i_type->control.granularity;
+                unsigned int need;
+
+                if (!size) {
+                    a_type->masks[i] = d_type->masks[i];
+                    continue;
+                }
+
+                if (size % granularity) {
+                    virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                                   _("Cache allocation of size %llu is not "
+                                     "divisible by granularity %llu"),
+                                   size, granularity);
+                    goto cleanup;
+                }
+
+                need = size / granularity;
+                if (need < i_type->min_cbm_bits) {
+                    virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                                   _("Cache allocation of size %llu is "
+                                     "smaller than the minimum allowed "
+                                     "allocation %llu"),
+                                   size, granularity * i_type->min_cbm_bits);
+                    goto cleanup;
+                }
+
+                if (virResctrlAllocFindMask(f_type->masks[i], i_type->bits,
+                                            need, &a_type->masks[i]) < 0) {
+                    virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                                   _("Not enough room for allocation of "
+                                     "%llu bytes for level %zu cache %zu "
+                                     "scope type '%s'"),
+                                   size, level, i,
+                                   virCacheTypeToString(type));
+                    goto cleanup;
+                }
+            }
+
+            for (i = a_type->nmasks; i < a_type->nsizes; i++) {
+                if (!a_type->sizes[i])
+                    continue;
+                virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                               _("Cache with id %zu does not exists for "
+                                 "level %zu"), i, level);
+                goto cleanup;
+            }
+        }
+    }
+
+    /* Keep the default masks of the resources not asked for, so the
+     * new group is not restricted more than it has to be. */
+    for (level = 0; level < alloc_default->nlevels; level++) {
+        for (type = 0; type < VIR_CACHE_TYPE_LAST; type++) {
+            if (!(d_type = virResctrlAllocFindType(alloc_default, level, type)) ||
+                virResctrlAllocFindType(alloc, level, type))
+                continue;
+
+            if (!(a_type = virResctrlAllocGetType(alloc, level, type)) ||
+                VIR_ALLOC_N(a_type->masks, d_type->nmasks) < 0)
+                goto cleanup;
+            a_type->nmasks = d_type->nmasks;
+            memcpy(a_type->masks, d_type->masks,
+                   sizeof(*a_type->masks) * d_type->nmasks);
+        }
+    }
+
+    if (alloc->nbandwidths || alloc_default->nbandwidths) {
+        if (alloc->nbandwidths && !resctrl->membw) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("Memory bandwidth allocation is not supported "
+                             "on this host"));
+            goto cleanup;
+        }
+
+        for (i = alloc_default->nbandwidths; i < alloc->nbandwidths; i++) {
+            if (!alloc->bandwidths[i])
+                continue;
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("Memory node %zu does not exist"), i);
+            goto cleanup;
+        }
+
+        if (alloc->nbandwidths < alloc_default->nbandwidths &&
+            VIR_EXPAND_N(alloc->bandwidths, alloc->nbandwidths,
+                         alloc_default->nbandwidths - alloc->nbandwidths) < 0)
+            goto cleanup;
+
+        for (i = 0; i < alloc->nbandwidths; i++) {
+            unsigned int bandwidth = alloc->bandwidths[i];
+
+            if (!bandwidth) {
+                alloc->bandwidths[i] = alloc_default->bandwidths[i];
+                continue;
+            }
+
+            if (bandwidth < resctrl->membw->min ||
+                bandwidth % resctrl->membw->granularity) {
+                virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                               _("Memory bandwidth %u%% of node %zu must be "
+                                 "at least %u%% and a multiple of %u%%"),
+                               bandwidth, i, resctrl->membw->min,
+                               resctrl->membw->granularity);
+                goto cleanup;
+            }
+
+            if (bandwidth_used[i] + bandwidth > 100) {
+                virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                               _("Not enough memory bandwidth on node %zu, "
+                                 "%u%% requested but only %u%% left"),
+                               i, bandwidth, 100 - MIN(bandwidth_used[i], 100));
+                goto cleanup;
+            }
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(bandwidth_used);
+    virResctrlAllocFree(alloc_free);
+    virResctrlAllocFree(alloc_default);
+    return ret;
+}
+
+
+/* All the changes to the resctrl file system are serialized by
+ * an exclusive lock of the root directory, as other tools do. */
+static int
+virResctrlLockWrite(void)
+{
+    int fd = open(SYSFS_RESCTRL_PATH, O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0) {
+        virReportSystemError(errno, "%s", _("Cannot open resctrl"));
+        return -1;
+    }
+
+    if (flock(fd, LOCK_EX) < 0) {
+        virReportSystemError(errno, "%s", _("Cannot lock resctrl"));
+        VIR_FORCE_CLOSE(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static int
+virResctrlUnlock(int fd)
+{
+    if (fd == -1)
+        return 0;
+
+    /* The lock is released with the last descriptor of the file */
+    if (VIR_CLOSE(fd) < 0) {
+        virReportSystemError(errno, "%s", _("Cannot close resctrl"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int
+virResctrlAllocDeterminePath(virResctrlAllocPtr alloc,
+                             const char *machinename)
+{
+    if (!alloc->id) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Resctrl Allocation ID must be set before creation"));
+        return -1;
+    }
+
+    if (alloc->path)
+        return 0;
+
+    return virAsprintf(&alloc->path, "%s/%s-%s",
+                       SYSFS_RESCTRL_PATH, machinename, alloc->id);
+}
+
+
+/**
+ * virResctrlAllocCreate:
+ * @resctrl: host resctrl info
+ * @alloc: the requested allocation
+ * @machinename: name of the machine @alloc belongs to
+ *
+ * Create the group of @alloc in the resctrl file system with the
+ * capacity bitmasks chosen by virResctrlAllocAssign. The tasks are
+ * added to it by virResctrlAllocAddPID.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virResctrlAllocCreate(virResctrlInfoPtr resctrl,
+                      virResctrlAllocPtr alloc,
+                      const char *machinename)
+{
+    char *schemata = NULL;
+    char *path = NULL;
+    int lockfd = -1;
+    int ret = -1;
+
+    if (virResctrlAllocDeterminePath(alloc, machinename) < 0)
+        return -1;
+
+    if (virFileExists(alloc->path)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Path '%s' for resctrl allocation exists"),
+                       alloc->path);
+        return -1;
+    }
+
+    if ((lockfd = virResctrlLockWrite()) < 0)
+        goto cleanup;
+
+    if (virResctrlAllocAssign(resctrl, alloc) < 0)
+        goto cleanup;
+
+    if (!(schemata = virResctrlAllocFormat(alloc)))
+        goto cleanup;
+
+    if (virFileMakePath(alloc->path) < 0) {
+        virReportSystemError(errno,
+                             _("Cannot create resctrl directory '%s'"),
+                             alloc->path);
+        goto cleanup;
+    }
+
+    if (virAsprintf(&path, "%s/schemata", alloc->path) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Writing resctrl schemata '%s' into '%s'", schemata, path);
+    if (virFileWriteStr(path, schemata, 0) < 0) {
+        virReportSystemError(errno,
+                             _("Cannot write into schemata file '%s'"),
+                             path);
+        ignore_value(rmdir(alloc->path));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virResctrlUnlock(lockfd);
+    VIR_FREE(schemata);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+int
+virResctrlAllocAddPID(virResctrlAllocPtr alloc,
+                      pid_t pid)
+{
+    char *tasks = NULL;
+    char *pidstr = NULL;
+    int ret = -1;
+
+    if (!alloc->path) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Cannot add pid to non-existing resctrl allocation"));
+        return -1;
+    }
+
+    if (virAsprintf(&tasks, "%s/tasks", alloc->path) < 0 ||
+        virAsprintf(&pidstr, "%lld", (long long int) pid) < 0)
+        goto cleanup;
+
+    if (virFileWriteStr(tasks, pidstr, 0) < 0) {
+        virReportSystemError(errno,
+                             _("Cannot write pid in tasks file '%s'"),
+                             tasks);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(tasks);
+    VIR_FREE(pidstr);
+    return ret;
+}
+
+
+int
+virResctrlAllocRemove(virResctrlAllocPtr alloc)
+{
+    int ret = 0;
+
+    if (!alloc->path)
+        return 0;
+
+    VIR_DEBUG("Removing resctrl allocation %s", alloc->path);
+    if (rmdir(alloc->path) != 0 && errno != ENOENT) {
+        ret = -errno;
+        VIR_ERROR(_("Unable to remove %s (%d)"), alloc->path, errno);
+    }
+
+    return ret;
+}
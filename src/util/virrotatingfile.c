@@ -24,6 +24,9 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#if WITH_ZLIB
+# include <zlib.h>
+#endif
 
 #include "virrotatingfile.h"
 #include "viralloc.h"
@@ -31,6 +34,7 @@
 #include "virstring.h"
 #include "virfile.h"
 #include "virlog.h"
+#include "virthread.h"
 
 VIR_LOG_INIT("util.rotatingfile");
 
@@ -38,6 +42,20 @@ VIR_LOG_INIT("util.rotatingfile");
 
 #define VIR_MAX_MAX_BACKUP 32
 
+/*
+ * Backups other than the most recent one can be compressed with gzip, in
+ * which case this suffix is appended to their name. The gzip header of
+ * such files records the inode and length of the file they were compressed
+ * from in an extra subfield, so that readers can still seek to positions
+ * obtained from the writer, and find where the last bytes of the data are,
+ * without decompressing anything.
+ */
+#define VIR_ROTATING_FILE_GZIP_SUFFIX ".gz"
+#define VIR_ROTATING_FILE_GZIP_EXTRA_SI1 'L'
+#define VIR_ROTATING_FILE_GZIP_EXTRA_SI2 'V'
+#define VIR_ROTATING_FILE_GZIP_EXTRA_LEN 16
+#define VIR_ROTATING_FILE_GZIP_BUF_LEN (64 * 1024)
+
 typedef struct virRotatingFileWriterEntry virRotatingFileWriterEntry;
 typedef virRotatingFileWriterEntry *virRotatingFileWriterEntryPtr;
 
@@ -46,6 +64,7 @@ typedef virRotatingFileReaderEntry *virRotatingFileReaderEntryPtr;
 
 struct virRotatingFileWriterEntry {
     int fd;
+    int splicefd; /* Opened without O_APPEND, which splice() refuses */
     off_t inode;
     off_t pos;
     off_t len;
@@ -57,13 +76,37 @@ struct virRotatingFileWriter {
     size_t maxbackup;
     mode_t mode;
     size_t maxlen;
+    bool nosplice;
+
+    bool compress;
+    bool compressing; /* @compressor is running */
+    virThread compressor;
+    char *compresspath;
 };
 
 
+#if WITH_ZLIB
+typedef struct virRotatingFileReaderGzip virRotatingFileReaderGzip;
+typedef virRotatingFileReaderGzip *virRotatingFileReaderGzipPtr;
+
+struct virRotatingFileReaderGzip {
+    z_stream strm;
+    gz_header head;
+    unsigned char extra[4 + VIR_ROTATING_FILE_GZIP_EXTRA_LEN];
+    unsigned char buf[VIR_ROTATING_FILE_GZIP_BUF_LEN];
+    bool eof;
+};
+#endif /* WITH_ZLIB */
+
 struct virRotatingFileReaderEntry {
     char *path;
     int fd;
-    off_t inode;
+    off_t inode; /* Of the original file for compressed ones */
+    off_t len;
+    off_t pos; /* Only tracked for compressed files */
+#if WITH_ZLIB
+    virRotatingFileReaderGzipPtr gz; /* NULL unless compressed */
+#endif
 };
 
 struct virRotatingFileReader {
@@ -80,6 +123,7 @@ virRotatingFileWriterEntryFree(virRotatingFileWriterEntryPtr entry)
         return;
 
     VIR_FORCE_CLOSE(entry->fd);
+    VIR_FORCE_CLOSE(entry->splicefd);
     VIR_FREE(entry);
 }
 
@@ -90,12 +134,430 @@ virRotatingFileReaderEntryFree(virRotatingFileReaderEntryPtr entry)
     if (!entry)
         return;
 
+#if WITH_ZLIB
+    if (entry->gz) {
+        inflateEnd(&entry->gz->strm);
+        VIR_FREE(entry->gz);
+    }
+#endif
     VIR_FREE(entry->path);
     VIR_FORCE_CLOSE(entry->fd);
     VIR_FREE(entry);
 }
 
 
+#if WITH_ZLIB
+static void
+virRotatingFileEncodeULL(unsigned char *buf,
+                         unsigned long long val)
+{
+    size_t i;
+
+    for (i = 0; i < 8; i++)
+        buf[i] = (val >> (8 * i)) & 0xff;
+}
+
+
+static unsigned long long
+virRotatingFileDecodeULL(const unsigned char *buf)
+{
+    unsigned long long val = 0;
+    size_t i;
+
+    for (i = 0; i < 8; i++)
+        val |= (unsigned long long)buf[i] << (8 * i);
+
+    return val;
+}
+
+
+/*
+ * Compress @path into @path.gz and remove it, keeping its
+ * inode and length in the gzip header.
+ */
+static int
+virRotatingFileCompress(const char *path)
+{
+    z_stream strm;
+    gz_header head;
+    unsigned char extra[4 + VIR_ROTATING_FILE_GZIP_EXTRA_LEN];
+    char *inbuf = NULL;
+    char *outbuf = NULL;
+    char *gzpath = NULL;
+    char *tmppath = NULL;
+    struct stat sb;
+    bool done = false;
+    int infd = -1;
+    int outfd = -1;
+    int rc;
+    int ret = -1;
+
+    memset(&strm, 0, sizeof(strm));
+    memset(&head, 0, sizeof(head));
+
+    if (virAsprintf(&gzpath, "%s" VIR_ROTATING_FILE_GZIP_SUFFIX, path) < 0 ||
+        virAsprintf(&tmppath, "%s.tmp", gzpath) < 0 ||
+        VIR_ALLOC_N(inbuf, VIR_ROTATING_FILE_GZIP_BUF_LEN) < 0 ||
+        VIR_ALLOC_N(outbuf, VIR_ROTATING_FILE_GZIP_BUF_LEN) < 0)
+        goto cleanup;
+
+    if ((infd = open(path, O_RDONLY|O_CLOEXEC)) < 0) {
+        /* Rotated out of existence already */
+        if (errno == ENOENT) {
+            ret = 0;
+            goto cleanup;
+        }
+        virReportSystemError(errno, _("Unable to open file: %s"), path);
+        goto cleanup;
+    }
+
+    if (fstat(infd, &sb) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to determine current file inode: %s"),
+                             path);
+        goto cleanup;
+    }
+
+    if ((outfd = open(tmppath, O_CREAT|O_TRUNC|O_WRONLY|O_CLOEXEC,
+                      sb.st_mode & 0777)) < 0) {
+        virReportSystemError(errno, _("Unable to open file: %s"), tmppath);
+        goto cleanup;
+    }
+
+    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize compression"));
+        goto cleanup;
+    }
+
+    extra[0] = VIR_ROTATING_FILE_GZIP_EXTRA_SI1;
+    extra[1] = VIR_ROTATING_FILE_GZIP_EXTRA_SI2;
+    extra[2] = VIR_ROTATING_FILE_GZIP_EXTRA_LEN;
+    extra[3] = 0;
+    virRotatingFileEncodeULL(extra + 4, sb.st_ino);
+    virRotatingFileEncodeULL(extra + 12, sb.st_size);
+    head.extra = extra;
+    head.extra_len = sizeof(extra);
+    head.os = 3; /* Unix */
+    if (deflateSetHeader(&strm, &head) != Z_OK)
+        goto zerror;
+
+    while (!done) {
+        ssize_t got;
+
+        if ((got = saferead(infd, inbuf, VIR_ROTATING_FILE_GZIP_BUF_LEN)) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to read from file %s"), path);
+            goto cleanup;
+        }
+
+        strm.next_in = (Bytef *) inbuf;
+        strm.avail_in = got;
+
+        do {
+            size_t len;
+
+            strm.next_out = (Bytef *) outbuf;
+            strm.avail_out = VIR_ROTATING_FILE_GZIP_BUF_LEN;
+
+            rc = deflate(&strm, got ? Z_NO_FLUSH : Z_FINISH);
+            if (rc == Z_STREAM_END)
+                done = true;
+            else if (rc != Z_OK && rc != Z_BUF_ERROR)
+                goto zerror;
+
+            len = VIR_ROTATING_FILE_GZIP_BUF_LEN - strm.avail_out;
+            if (safewrite(outfd, outbuf, len) != len) {
+                virReportSystemError(errno,
+                                     _("Unable to write to file %s"),
+                                     tmppath);
+                goto cleanup;
+            }
+        } while (strm.avail_out == 0);
+    }
+
+    if (VIR_CLOSE(outfd) < 0) {
+        virReportSystemError(errno, _("Unable to close file %s"), tmppath);
+        goto cleanup;
+    }
+
+    /* Readers look for the uncompressed file first, so there's always
+     * one of the two around */
+    if (rename(tmppath, gzpath) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to rename %s to %s"),
+                             tmppath, gzpath);
+        goto cleanup;
+    }
+
+    if (unlink(path) < 0 && errno != ENOENT) {
+        virReportSystemError(errno, _("Unable to delete file %s"), path);
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Compressed %s from %llu to %llu bytes", path,
+              (unsigned long long)sb.st_size,
+              (unsigned long long)strm.total_out);
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0 && tmppath)
+        unlink(tmppath);
+    deflateEnd(&strm);
+    VIR_FORCE_CLOSE(infd);
+    VIR_FORCE_CLOSE(outfd);
+    VIR_FREE(inbuf);
+    VIR_FREE(outbuf);
+    VIR_FREE(gzpath);
+    VIR_FREE(tmppath);
+    return ret;
+
+ zerror:
+    virReportError(VIR_ERR_INTERNAL_ERROR,
+                   _("Unable to compress %s: %s"), path,
+                   NULLSTR(strm.msg));
+    goto cleanup;
+}
+
+
+static void
+virRotatingFileWriterCompressThread(void *opaque)
+{
+    const char *path = opaque;
+
+    if (virRotatingFileCompress(path) < 0)
+        VIR_WARN("Unable to compress log backup %s: %s",
+                 path, virGetLastErrorMessage());
+}
+
+
+/* Parse the gzip header of @entry, whose compressed data starts at
+ * the current offset of its file */
+static int
+virRotatingFileReaderEntryGzipStart(virRotatingFileReaderEntryPtr entry)
+{
+    virRotatingFileReaderGzipPtr gz = entry->gz;
+    unsigned char dummy;
+
+    gz->strm.avail_in = 0;
+    gz->eof = false;
+    entry->pos = 0;
+
+    memset(&gz->head, 0, sizeof(gz->head));
+    gz->head.extra = gz->extra;
+    gz->head.extra_max = sizeof(gz->extra);
+    if (inflateGetHeader(&gz->strm, &gz->head) != Z_OK)
+        goto zerror;
+
+    /* The header is parsed without producing any output */
+    while (gz->head.done == 0) {
+        int rc;
+
+        if (gz->strm.avail_in == 0) {
+            ssize_t got = saferead(entry->fd, gz->buf, sizeof(gz->buf));
+            if (got < 0) {
+                virReportSystemError(errno,
+                                     _("Unable to read from file %s"),
+                                     entry->path);
+                return -1;
+            }
+            if (got == 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Truncated gzip header in %s"),
+                               entry->path);
+                return -1;
+            }
+            gz->strm.next_in = gz->buf;
+            gz->strm.avail_in = got;
+        }
+
+        gz->strm.next_out = &dummy;
+        gz->strm.avail_out = 0;
+        rc = inflate(&gz->strm, Z_NO_FLUSH);
+        if (rc != Z_OK && rc != Z_BUF_ERROR)
+            goto zerror;
+    }
+
+    return 0;
+
+ zerror:
+    virReportError(VIR_ERR_INTERNAL_ERROR,
+                   _("Unable to decompress %s: %s"), entry->path,
+                   NULLSTR(gz->strm.msg));
+    return -1;
+}
+
+
+static int
+virRotatingFileReaderEntryGzipOpen(virRotatingFileReaderEntryPtr entry,
+                                   off_t size)
+{
+    virRotatingFileReaderGzipPtr gz;
+    unsigned char isize[4];
+
+    if (VIR_ALLOC(entry->gz) < 0)
+        return -1;
+    gz = entry->gz;
+
+    if (inflateInit2(&gz->strm, MAX_WBITS + 16) != Z_OK) {
+        VIR_FREE(entry->gz);
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize decompression"));
+        return -1;
+    }
+
+    if (virRotatingFileReaderEntryGzipStart(entry) < 0)
+        return -1;
+
+    if (gz->head.extra_len >= sizeof(gz->extra) &&
+        gz->extra[0] == VIR_ROTATING_FILE_GZIP_EXTRA_SI1 &&
+        gz->extra[1] == VIR_ROTATING_FILE_GZIP_EXTRA_SI2 &&
+        gz->extra[2] == VIR_ROTATING_FILE_GZIP_EXTRA_LEN &&
+        gz->extra[3] == 0) {
+        entry->inode = virRotatingFileDecodeULL(gz->extra + 4);
+        entry->len = virRotatingFileDecodeULL(gz->extra + 12);
+        return 0;
+    }
+
+    /* Not compressed by us, fall back to the length modulo 2^32
+     * kept in the gzip trailer, the inode is lost anyway */
+    VIR_DEBUG("No index in %s", entry->path);
+    entry->inode = 0;
+    if (size < sizeof(isize) ||
+        pread(entry->fd, isize, sizeof(isize),
+              size - sizeof(isize)) != sizeof(isize)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Truncated gzip file %s"), entry->path);
+        return -1;
+    }
+    entry->len = isize[0] | (isize[1] << 8) | (isize[2] << 16) |
+        ((off_t)isize[3] << 24);
+    return 0;
+}
+
+
+static ssize_t
+virRotatingFileReaderEntryGzipRead(virRotatingFileReaderEntryPtr entry,
+                                   char *buf,
+                                   size_t len)
+{
+    virRotatingFileReaderGzipPtr gz = entry->gz;
+
+    gz->strm.next_out = (Bytef *) buf;
+    gz->strm.avail_out = len;
+
+    while (gz->strm.avail_out == len && !gz->eof) {
+        int rc;
+
+        if (gz->strm.avail_in == 0) {
+            ssize_t got = saferead(entry->fd, gz->buf, sizeof(gz->buf));
+            if (got < 0) {
+                virReportSystemError(errno,
+                                     _("Unable to read from file %s"),
+                                     entry->path);
+                return -1;
+            }
+            if (got == 0) {
+                VIR_WARN("Truncated compressed file %s", entry->path);
+                gz->eof = true;
+                break;
+            }
+            gz->strm.next_in = gz->buf;
+            gz->strm.avail_in = got;
+        }
+
+        rc = inflate(&gz->strm, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) {
+            gz->eof = true;
+        } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unable to decompress %s: %s"), entry->path,
+                           NULLSTR(gz->strm.msg));
+            return -1;
+        }
+    }
+
+    entry->pos += len - gz->strm.avail_out;
+    return len - gz->strm.avail_out;
+}
+#endif /* WITH_ZLIB */
+
+
+static ssize_t
+virRotatingFileReaderEntryRead(virRotatingFileReaderEntryPtr entry,
+                               char *buf,
+                               size_t len)
+{
+    ssize_t got;
+
+#if WITH_ZLIB
+    if (entry->gz)
+        return virRotatingFileReaderEntryGzipRead(entry, buf, len);
+#endif
+
+    if ((got = saferead(entry->fd, buf, len)) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to read from file %s"),
+                             entry->path);
+        return -1;
+    }
+
+    return got;
+}
+
+
+static int
+virRotatingFileReaderEntrySeek(virRotatingFileReaderEntryPtr entry,
+                               off_t offset)
+{
+#if WITH_ZLIB
+    if (entry->gz) {
+        char skip[4096];
+
+        /* Data has to be decompressed up to @offset, which only ever
+         * covers a single backup file */
+        if (offset < entry->pos) {
+            if (lseek(entry->fd, 0, SEEK_SET) == (off_t)-1 ||
+                inflateReset(&entry->gz->strm) != Z_OK) {
+                virReportSystemError(errno,
+                                     _("Unable to seek to offset %llu in %s"),
+                                     (unsigned long long)offset, entry->path);
+                return -1;
+            }
+            if (virRotatingFileReaderEntryGzipStart(entry) < 0)
+                return -1;
+        }
+
+        while (entry->pos < offset) {
+            ssize_t got;
+
+            got = virRotatingFileReaderEntryGzipRead(entry, skip,
+                                                     MIN(sizeof(skip),
+                                                         offset - entry->pos));
+            if (got < 0)
+                return -1;
+            if (got == 0)
+                break;
+        }
+
+        return 0;
+    }
+#endif /* WITH_ZLIB */
+
+    if (lseek(entry->fd, offset, SEEK_SET) == (off_t)-1) {
+        virReportSystemError(errno,
+                             _("Unable to seek to inode %llu offset %llu"),
+                             (unsigned long long)entry->inode,
+                             (unsigned long long)offset);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static virRotatingFileWriterEntryPtr
 virRotatingFileWriterEntryNew(const char *path,
                               mode_t mode)
@@ -108,6 +570,8 @@ virRotatingFileWriterEntryNew(const char *path,
     if (VIR_ALLOC(entry) < 0)
         return NULL;
 
+    entry->splicefd = -1;
+
     if ((entry->fd = open(path, O_CREAT|O_APPEND|O_WRONLY|O_CLOEXEC, mode)) < 0) {
         virReportSystemError(errno,
                              _("Unable to open file: %s"), path);
@@ -141,37 +605,66 @@ virRotatingFileWriterEntryNew(const char *path,
 
 
 static virRotatingFileReaderEntryPtr
-virRotatingFileReaderEntryNew(const char *path)
+virRotatingFileReaderEntryNew(const char *path,
+                              bool backup)
 {
     virRotatingFileReaderEntryPtr entry;
     struct stat sb;
+#if WITH_ZLIB
+    bool compressed = false;
+#endif
 
     VIR_DEBUG("Opening %s", path);
 
     if (VIR_ALLOC(entry) < 0)
         return NULL;
 
+    if (VIR_STRDUP(entry->path, path) < 0)
+        goto error;
+
     if ((entry->fd = open(path, O_RDONLY|O_CLOEXEC)) < 0) {
         if (errno != ENOENT) {
             virReportSystemError(errno,
                                  _("Unable to open file: %s"), path);
             goto error;
         }
+
+#if WITH_ZLIB
+        if (backup) {
+            VIR_FREE(entry->path);
+            if (virAsprintf(&entry->path, "%s" VIR_ROTATING_FILE_GZIP_SUFFIX,
+                            path) < 0)
+                goto error;
+
+            if ((entry->fd = open(entry->path, O_RDONLY|O_CLOEXEC)) < 0 &&
+                errno != ENOENT) {
+                virReportSystemError(errno,
+                                     _("Unable to open file: %s"),
+                                     entry->path);
+                goto error;
+            }
+            compressed = true;
+        }
+#endif /* WITH_ZLIB */
     }
 
     if (entry->fd != -1) {
         if (fstat(entry->fd, &sb) < 0) {
             virReportSystemError(errno,
                                  _("Unable to determine current file inode: %s"),
-                                 path);
+                                 entry->path);
             goto error;
         }
 
         entry->inode = sb.st_ino;
-    }
+        entry->len = sb.st_size;
 
-    if (VIR_STRDUP(entry->path, path) < 0)
-        goto error;
+#if WITH_ZLIB
+        if (compressed &&
+            virRotatingFileReaderEntryGzipOpen(entry, sb.st_size) < 0)
+            goto error;
+#endif
+    }
 
     return entry;
 
@@ -181,6 +674,40 @@ virRotatingFileReaderEntryNew(const char *path)
 }
 
 
+/* Delete the backup @path, which may have been compressed */
+static int
+virRotatingFileWriterDeleteBackup(const char *path)
+{
+    char *gzpath = NULL;
+    int ret = -1;
+
+    if (unlink(path) < 0 &&
+        errno != ENOENT) {
+        virReportSystemError(errno,
+                             _("Unable to delete file %s"),
+                             path);
+        goto cleanup;
+    }
+
+    if (virAsprintf(&gzpath, "%s" VIR_ROTATING_FILE_GZIP_SUFFIX, path) < 0)
+        goto cleanup;
+
+    if (unlink(gzpath) < 0 &&
+        errno != ENOENT) {
+        virReportSystemError(errno,
+                             _("Unable to delete file %s"),
+                             gzpath);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(gzpath);
+    return ret;
+}
+
+
 static int
 virRotatingFileWriterDelete(virRotatingFileWriterPtr file)
 {
@@ -199,11 +726,7 @@ virRotatingFileWriterDelete(virRotatingFileWriterPtr file)
         if (virAsprintf(&oldpath, "%s.%zu", file->basepath, i) < 0)
             return -1;
 
-        if (unlink(oldpath) < 0 &&
-            errno != ENOENT) {
-            virReportSystemError(errno,
-                                 _("Unable to delete file %s"),
-                                 oldpath);
+        if (virRotatingFileWriterDeleteBackup(oldpath) < 0) {
             VIR_FREE(oldpath);
             return -1;
         }
@@ -273,6 +796,30 @@ virRotatingFileWriterNew(const char *path,
 }
 
 
+/**
+ * virRotatingFileWriterSetCompress:
+ * @file: the file context
+ * @compress: whether to compress backups
+ *
+ * Compress backup files other than the most recent one
+ * with gzip when rolling over. This is done in the
+ * background, once the first rollover is complete.
+ * The option is ignored when built without zlib.
+ */
+void
+virRotatingFileWriterSetCompress(virRotatingFileWriterPtr file,
+                                 bool compress)
+{
+#if WITH_ZLIB
+    file->compress = compress;
+#else
+    if (compress)
+        VIR_WARN("Not compressing backups of %s, zlib support is missing",
+                 file->basepath);
+#endif
+}
+
+
 /**
  * virRotatingFileReaderNew:
  * @path: the base path for files
@@ -305,7 +852,7 @@ virRotatingFileReaderNew(const char *path,
     if (VIR_ALLOC_N(file->entries, file->nentries) < 0)
         goto error;
 
-    if (!(file->entries[file->nentries - 1] = virRotatingFileReaderEntryNew(path)))
+    if (!(file->entries[file->nentries - 1] = virRotatingFileReaderEntryNew(path, false)))
         goto error;
 
     for (i = 0; i < maxbackup; i++) {
@@ -313,7 +860,7 @@ virRotatingFileReaderNew(const char *path,
         if (virAsprintf(&tmppath, "%s.%zu", path, i) < 0)
             goto error;
 
-        file->entries[file->nentries - (i + 2)] = virRotatingFileReaderEntryNew(tmppath);
+        file->entries[file->nentries - (i + 2)] = virRotatingFileReaderEntryNew(tmppath, true);
         VIR_FREE(tmppath);
         if (!file->entries[file->nentries - (i + 2)])
             goto error;
@@ -366,6 +913,54 @@ virRotatingFileWriterGetOffset(virRotatingFileWriterPtr file)
 }
 
 
+static void
+virRotatingFileWriterCompressWait(virRotatingFileWriterPtr file)
+{
+    if (!file->compressing)
+        return;
+
+    virThreadJoin(&file->compressor);
+    file->compressing = false;
+    VIR_FREE(file->compresspath);
+}
+
+
+static int
+virRotatingFileWriterRename(const char *from,
+                            const char *to,
+                            bool compressed)
+{
+    char *gzfrom = NULL;
+    char *gzto = NULL;
+    int ret = -1;
+
+    if (compressed) {
+        if (virAsprintf(&gzfrom, "%s" VIR_ROTATING_FILE_GZIP_SUFFIX, from) < 0 ||
+            virAsprintf(&gzto, "%s" VIR_ROTATING_FILE_GZIP_SUFFIX, to) < 0)
+            goto cleanup;
+        from = gzfrom;
+        to = gzto;
+    }
+
+    VIR_DEBUG("Rollover %s -> %s", from, to);
+
+    if (rename(from, to) < 0 &&
+        errno != ENOENT) {
+        virReportSystemError(errno,
+                             _("Unable to rename %s to %s"),
+                             from, to);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(gzfrom);
+    VIR_FREE(gzto);
+    return ret;
+}
+
+
 static int
 virRotatingFileWriterRollover(virRotatingFileWriterPtr file)
 {
@@ -375,6 +970,10 @@ virRotatingFileWriterRollover(virRotatingFileWriterPtr file)
     int ret = -1;
 
     VIR_DEBUG("Rollover %s", file->basepath);
+
+    /* The backup being compressed is about to be renamed */
+    virRotatingFileWriterCompressWait(file);
+
     if (file->maxbackup == 0) {
         if (unlink(file->basepath) < 0 &&
             errno != ENOENT) {
@@ -387,6 +986,11 @@ virRotatingFileWriterRollover(virRotatingFileWriterPtr file)
         if (virAsprintf(&nextpath, "%s.%zu", file->basepath, file->maxbackup - 1) < 0)
             return -1;
 
+        /* Whichever form the oldest backup is in, it would otherwise
+         * be left behind if the next one is in the other */
+        if (virRotatingFileWriterDeleteBackup(nextpath) < 0)
+            goto cleanup;
+
         for (i = file->maxbackup; i > 0; i--) {
             if (i == 1) {
                 if (VIR_STRDUP(thispath, file->basepath) < 0)
@@ -395,15 +999,13 @@ virRotatingFileWriterRollover(virRotatingFileWriterPtr file)
                 if (virAsprintf(&thispath, "%s.%zu", file->basepath, i - 2) < 0)
                     goto cleanup;
             }
-            VIR_DEBUG("Rollover %s -> %s", thispath, nextpath);
 
-            if (rename(thispath, nextpath) < 0 &&
-                errno != ENOENT) {
-                virReportSystemError(errno,
-                                     _("Unable to rename %s to %s"),
-                                     thispath, nextpath);
+            /* Any backup may have been compressed, even if compression
+             * is no longer enabled */
+            if (virRotatingFileWriterRename(thispath, nextpath, false) < 0 ||
+                (i > 1 &&
+                 virRotatingFileWriterRename(thispath, nextpath, true) < 0))
                 goto cleanup;
-            }
 
             VIR_FREE(nextpath);
             nextpath = thispath;
@@ -413,6 +1015,25 @@ virRotatingFileWriterRollover(virRotatingFileWriterPtr file)
 
     VIR_DEBUG("Rollover done %s", file->basepath);
 
+#if WITH_ZLIB
+    /* The most recent backup is kept as is since it is the most likely
+     * one to be read, the previous one is now complete */
+    if (file->compress && file->maxbackup > 1) {
+        if (virAsprintf(&file->compresspath, "%s.1", file->basepath) < 0)
+            goto cleanup;
+
+        if (virThreadCreate(&file->compressor, true,
+                            virRotatingFileWriterCompressThread,
+                            file->compresspath) < 0) {
+            VIR_WARN("Unable to create thread compressing %s",
+                     file->compresspath);
+            VIR_FREE(file->compresspath);
+        } else {
+            file->compressing = true;
+        }
+    }
+#endif /* WITH_ZLIB */
+
     ret = 0;
  cleanup:
     VIR_FREE(nextpath);
@@ -503,6 +1124,101 @@ virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
 }
 
 
+/**
+ * virRotatingFileWriterCanSplice:
+ * @file: the file context
+ * @len: the number of bytes to be moved
+ *
+ * Returns true if @len bytes can be moved into the file by
+ * virRotatingFileWriterSplice, i.e. if splicing is supported
+ * and the data fits in the current file without any rollover
+ */
+bool
+virRotatingFileWriterCanSplice(virRotatingFileWriterPtr file,
+                               size_t len)
+{
+    return !file->nosplice && (file->entry->pos + len) <= file->maxlen;
+}
+
+
+/**
+ * virRotatingFileWriterSplice:
+ * @file: the file context
+ * @fd: pipe to read the data from
+ * @len: the maximum number of bytes to move
+ *
+ * Move data from the pipe @fd to the end of the file without
+ * copying it through userspace. The caller must check with
+ * virRotatingFileWriterCanSplice that @len bytes fit in the
+ * current file, as no rollover is performed.
+ *
+ * Returns the number of bytes moved, 0 at the end of the data
+ * in @fd, -1 on error, or -2 if splicing is not possible for
+ * this file, in which case no error is reported and the data
+ * must be read and passed to virRotatingFileWriterAppend.
+ */
+ssize_t
+virRotatingFileWriterSplice(virRotatingFileWriterPtr file,
+                            int fd,
+                            size_t len)
+{
+#if HAVE_SPLICE
+    virRotatingFileWriterEntryPtr entry = file->entry;
+    loff_t off = entry->pos;
+    struct stat sb;
+    ssize_t got;
+
+    if (file->nosplice)
+        return -2;
+
+    if (entry->splicefd < 0) {
+        if ((entry->splicefd = open(file->basepath,
+                                    O_WRONLY|O_CLOEXEC)) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to open file: %s"),
+                                 file->basepath);
+            return -1;
+        }
+
+        /* Somebody else may have replaced the file meanwhile */
+        if (fstat(entry->splicefd, &sb) < 0 || sb.st_ino != entry->inode) {
+            VIR_DEBUG("File %s changed, not splicing into it",
+                      file->basepath);
+            VIR_FORCE_CLOSE(entry->splicefd);
+            file->nosplice = true;
+            return -2;
+        }
+    }
+
+ resplice:
+    got = splice(fd, NULL, entry->splicefd, &off, len, SPLICE_F_MOVE);
+    if (got < 0) {
+        if (errno == EINTR)
+            goto resplice;
+
+        if (errno == EINVAL || errno == ENOSYS) {
+            VIR_DEBUG("Splicing into %s not supported", file->basepath);
+            file->nosplice = true;
+            return -2;
+        }
+
+        virReportSystemError(errno,
+                             _("Unable to write to file %s"),
+                             file->basepath);
+        return -1;
+    }
+
+    entry->pos += got;
+    entry->len += got;
+
+    return got;
+#else /* !HAVE_SPLICE */
+    file->nosplice = true;
+    return -2;
+#endif /* !HAVE_SPLICE */
+}
+
+
 /**
  * virRotatingFileReaderSeek
  * @file: the file context
@@ -513,7 +1229,9 @@ virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
  * If no file with a inode matching @inode currently
  * exists, then seeks to the start of the oldest
  * file, on the basis that the requested file has
- * probably been rotated out of existence
+ * probably been rotated out of existence. Compressed
+ * backups are identified by the inode of the file they
+ * were compressed from.
  */
 int
 virRotatingFileReaderSeek(virRotatingFileReaderPtr file,
@@ -521,7 +1239,6 @@ virRotatingFileReaderSeek(virRotatingFileReaderPtr file,
                           off_t offset)
 {
     size_t i;
-    off_t ret;
 
     for (i = 0; i < file->nentries; i++) {
         virRotatingFileReaderEntryPtr entry = file->entries[i];
@@ -529,26 +1246,58 @@ virRotatingFileReaderSeek(virRotatingFileReaderPtr file,
             entry->fd == -1)
             continue;
 
-        ret = lseek(entry->fd, offset, SEEK_SET);
-        if (ret == (off_t)-1) {
-            virReportSystemError(errno,
-                                 _("Unable to seek to inode %llu offset %llu"),
-                                 (unsigned long long)inode, (unsigned long long)offset);
+        if (virRotatingFileReaderEntrySeek(entry, offset) < 0)
             return -1;
-        }
 
         file->current = i;
         return 0;
     }
 
     file->current = 0;
-    ret = lseek(file->entries[0]->fd, offset, SEEK_SET);
-    if (ret == (off_t)-1) {
-        virReportSystemError(errno,
-                             _("Unable to seek to inode %llu offset %llu"),
-                             (unsigned long long)inode, (unsigned long long)offset);
+    if (file->entries[0]->fd != -1 &&
+        virRotatingFileReaderEntrySeek(file->entries[0], offset) < 0)
         return -1;
+    return 0;
+}
+
+
+/**
+ * virRotatingFileReaderSeekTail:
+ * @file: the file context
+ * @len: the number of bytes to seek back from the end
+ *
+ * Seek so that the last @len bytes of data, possibly
+ * spread over multiple files, are read next. Only the
+ * file where the data starts is accessed, using the
+ * lengths recorded when opening the files.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virRotatingFileReaderSeekTail(virRotatingFileReaderPtr file,
+                              off_t len)
+{
+    size_t i;
+
+    for (i = file->nentries; i > 0; i--) {
+        virRotatingFileReaderEntryPtr entry = file->entries[i - 1];
+
+        if (entry->fd == -1)
+            continue;
+
+        if (entry->len >= len) {
+            if (virRotatingFileReaderEntrySeek(entry, entry->len - len) < 0)
+                return -1;
+            file->current = i - 1;
+            return 0;
+        }
+
+        len -= entry->len;
     }
+
+    /* There's less data than asked for, files were just opened so they
+     * are all at their start already */
+    file->current = 0;
     return 0;
 }
 
@@ -585,13 +1334,9 @@ virRotatingFileReaderConsume(virRotatingFileReaderPtr file,
             continue;
         }
 
-        got = saferead(entry->fd, buf + ret, len);
-        if (got < 0) {
-            virReportSystemError(errno,
-                                 _("Unable to read from file %s"),
-                                 entry->path);
+        got = virRotatingFileReaderEntryRead(entry, buf + ret, len);
+        if (got < 0)
             return -1;
-        }
 
         if (got == 0) {
             file->current++;
@@ -618,6 +1363,7 @@ virRotatingFileWriterFree(virRotatingFileWriterPtr file)
     if (!file)
         return;
 
+    virRotatingFileWriterCompressWait(file);
     virRotatingFileWriterEntryFree(file->entry);
     VIR_FREE(file->basepath);
     VIR_FREE(file);
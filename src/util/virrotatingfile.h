@@ -39,6 +39,9 @@ virRotatingFileWriterPtr virRotatingFileWriterNew(const char *path,
 virRotatingFileReaderPtr virRotatingFileReaderNew(const char *path,
                                                   size_t maxbackup);
 
+void virRotatingFileWriterSetCompress(virRotatingFileWriterPtr file,
+                                      bool compress);
+
 const char *virRotatingFileWriterGetPath(virRotatingFileWriterPtr file);
 
 ino_t virRotatingFileWriterGetINode(virRotatingFileWriterPtr file);
@@ -48,9 +51,17 @@ ssize_t virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
                                     const char *buf,
                                     size_t len);
 
+bool virRotatingFileWriterCanSplice(virRotatingFileWriterPtr file,
+                                    size_t len);
+ssize_t virRotatingFileWriterSplice(virRotatingFileWriterPtr file,
+                                    int fd,
+                                    size_t len);
+
 int virRotatingFileReaderSeek(virRotatingFileReaderPtr file,
                               ino_t inode,
                               off_t offset);
+int virRotatingFileReaderSeekTail(virRotatingFileReaderPtr file,
+                                  off_t len);
 
 ssize_t virRotatingFileReaderConsume(virRotatingFileReaderPtr file,
                                      char *buf,
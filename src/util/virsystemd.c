@@ -39,6 +39,7 @@
 #include "virlog.h"
 #include "virerror.h"
 #include "virfile.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_SYSTEMD
 
@@ -456,6 +457,159 @@ int virSystemdCreateMachine(const char *name,
     return ret;
 }
 
+struct _virSystemdMachineRequest {
+    virThread thread;
+    bool running;
+
+    char *name;
+    char *drivername;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char *rootdir;
+    pid_t pidleader;
+    bool iscontainer;
+    size_t nnicindexes;
+    int *nicindexes;
+    char *partition;
+
+    int rv;
+    virErrorPtr error;
+};
+
+
+static void
+virSystemdCreateMachineWorker(void *opaque)
+{
+    virSystemdMachineRequestPtr req = opaque;
+
+    req->rv = virSystemdCreateMachine(req->name,
+                                      req->drivername,
+                                      req->uuid,
+                                      req->rootdir,
+                                      req->pidleader,
+                                      req->iscontainer,
+                                      req->nnicindexes,
+                                      req->nicindexes,
+                                      req->partition);
+    if (req->rv == -1)
+        req->error = virSaveLastError();
+}
+
+
+/**
+ * virSystemdCreateMachineStart:
+ *
+ * Same as virSystemdCreateMachine(), but the DBus call is made from a
+ * separate thread, leaving the caller free to do other work while
+ * systemd-machined processes the request. The result is collected
+ * with virSystemdCreateMachineWait().
+ *
+ * Returns the pending request, or NULL on error
+ */
+virSystemdMachineRequestPtr
+virSystemdCreateMachineStart(const char *name,
+                             const char *drivername,
+                             const unsigned char *uuid,
+                             const char *rootdir,
+                             pid_t pidleader,
+                             bool iscontainer,
+                             size_t nnicindexes,
+                             int *nicindexes,
+                             const char *partition)
+{
+    virSystemdMachineRequestPtr req;
+
+    if (VIR_ALLOC(req) < 0)
+        return NULL;
+
+    if (VIR_STRDUP(req->name, name) < 0 ||
+        VIR_STRDUP(req->drivername, drivername) < 0 ||
+        VIR_STRDUP(req->rootdir, rootdir) < 0 ||
+        VIR_STRDUP(req->partition, partition) < 0 ||
+        (nnicindexes &&
+         VIR_ALLOC_N(req->nicindexes, nnicindexes) < 0))
+        goto error;
+
+    memcpy(req->uuid, uuid, VIR_UUID_BUFLEN);
+    req->pidleader = pidleader;
+    req->iscontainer = iscontainer;
+    req->nnicindexes = nnicindexes;
+    if (nnicindexes)
+        memcpy(req->nicindexes, nicindexes, nnicindexes * sizeof(*nicindexes));
+
+    if (virThreadCreateFull(&req->thread, true,
+                            virSystemdCreateMachineWorker,
+                            "machined-register", false, req) < 0) {
+        /* Not worth failing, just do it now */
+        VIR_WARN("Cannot create thread to register machine '%s'", name);
+        virResetLastError();
+        virSystemdCreateMachineWorker(req);
+    } else {
+        req->running = true;
+    }
+
+    return req;
+
+ error:
+    virSystemdMachineRequestFree(req);
+    return NULL;
+}
+
+
+/**
+ * virSystemdCreateMachineWait:
+ * @req: request started by virSystemdCreateMachineStart()
+ *
+ * Wait for @req to complete.
+ *
+ * Returns the same values as virSystemdCreateMachine(), with the error
+ * reported in the calling thread
+ */
+int
+virSystemdCreateMachineWait(virSystemdMachineRequestPtr req)
+{
+    if (req->running) {
+        virThreadJoin(&req->thread);
+        req->running = false;
+    }
+
+    if (req->rv == -1) {
+        if (req->error)
+            virSetError(req->error);
+        else
+            virReportOOMError();
+    }
+
+    return req->rv;
+}
+
+
+/**
+ * virSystemdMachineRequestFree:
+ * @req: request started by virSystemdCreateMachineStart()
+ *
+ * Free @req, waiting for it to complete first if needed. Its result is
+ * ignored, so a machine it might have registered has to be terminated
+ * by the caller.
+ */
+void
+virSystemdMachineRequestFree(virSystemdMachineRequestPtr req)
+{
+    if (!req)
+        return;
+
+    if (req->running)
+        virThreadJoin(&req->thread);
+
+    VIR_FREE(req->name);
+    VIR_FREE(req->drivername);
+    VIR_FREE(req->rootdir);
+    VIR_FREE(req->nicindexes);
+    VIR_FREE(req->partition);
+    virFreeError(req->error);
+    VIR_FREE(req);
+}
+
+
 int virSystemdTerminateMachine(const char *name)
 {
     int ret;
@@ -44,6 +44,24 @@ int virSystemdCreateMachine(const char *name,
                             int *nicindexes,
                             const char *partition);
 
+typedef struct _virSystemdMachineRequest virSystemdMachineRequest;
+typedef virSystemdMachineRequest *virSystemdMachineRequestPtr;
+
+virSystemdMachineRequestPtr
+virSystemdCreateMachineStart(const char *name,
+                             const char *drivername,
+                             const unsigned char *uuid,
+                             const char *rootdir,
+                             pid_t pidleader,
+                             bool iscontainer,
+                             size_t nnicindexes,
+                             int *nicindexes,
+                             const char *partition);
+
+int virSystemdCreateMachineWait(virSystemdMachineRequestPtr req);
+
+void virSystemdMachineRequestFree(virSystemdMachineRequestPtr req);
+
 int virSystemdTerminateMachine(const char *name);
 
 void virSystemdNotifyStartup(void);
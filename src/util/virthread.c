@@ -25,17 +25,76 @@
 
 #include <unistd.h>
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #if HAVE_SYS_SYSCALL_H
 # include <sys/syscall.h>
 #endif
 
 #include "viralloc.h"
 #include "virthreadjob.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* The PROBE() macro of virprobe.h also logs the event, which would
+ * take the very mutexes being profiled, so fire the probes directly */
+#if WITH_DTRACE_PROBES
+# ifndef LIBVIRT_PROBES_H
+#  define LIBVIRT_PROBES_H
+#  include "libvirt_probes.h"
+# endif /* LIBVIRT_PROBES_H */
+# define VIR_MUTEX_PROBE(NAME, ...)             \
+    do {                                        \
+        if (LIBVIRT_ ## NAME ## _ENABLED())     \
+            LIBVIRT_ ## NAME(__VA_ARGS__);      \
+    } while (0)
+#else
+# define VIR_MUTEX_PROBE(NAME, ...) do {} while (0)
+#endif
+
+
+/* Statistics of all the mutexes sharing a name. The first one
+ * accounts the mutexes without a name and, should the table ever
+ * fill up, those of any further names. The profiler must not use
+ * virMutex itself. */
+#define VIR_MUTEX_PROFILE_CLASSES_MAX 256
+#define VIR_MUTEX_PROFILE_DEFAULT "virMutex"
+
+typedef struct _virMutexProfileClass virMutexProfileClass;
+typedef virMutexProfileClass *virMutexProfileClassPtr;
+struct _virMutexProfileClass {
+    pthread_mutex_t lock;
+    virMutexStats stats;
+};
+
+static bool virMutexProfiling;
+static pthread_mutex_t virMutexProfileLock = PTHREAD_MUTEX_INITIALIZER;
+static virMutexProfileClass virMutexProfileClasses[VIR_MUTEX_PROFILE_CLASSES_MAX];
+static size_t virMutexProfileNClasses;
 
 
-/* Nothing special required for pthreads */
 int virThreadInitialize(void)
 {
+    const char *profile;
+    size_t i;
+
+    if (virMutexProfiling)
+        return 0;
+
+    if (!(profile = virGetEnvBlockSUID("LIBVIRT_LOCK_PROFILE")) ||
+        STRNEQ(profile, "1"))
+        return 0;
+
+    for (i = 0; i < VIR_MUTEX_PROFILE_CLASSES_MAX; i++) {
+        if (pthread_mutex_init(&virMutexProfileClasses[i].lock, NULL) != 0)
+            return -1;
+    }
+    virMutexProfileClasses[0].stats.name = VIR_MUTEX_PROFILE_DEFAULT;
+    virMutexProfileNClasses = 1;
+
+    virMutexProfiling = true;
     return 0;
 }
 
@@ -61,6 +120,10 @@ int virMutexInit(virMutexPtr m)
         errno = ret;
         return -1;
     }
+    m->name = NULL;
+    m->profileClass = 0;
+    m->depth = 0;
+    m->acquired = 0;
     return 0;
 }
 
@@ -76,6 +139,10 @@ int virMutexInitRecursive(virMutexPtr m)
         errno = ret;
         return -1;
     }
+    m->name = NULL;
+    m->profileClass = 0;
+    m->depth = 0;
+    m->acquired = 0;
     return 0;
 }
 
@@ -84,17 +151,249 @@ void virMutexDestroy(virMutexPtr m)
     pthread_mutex_destroy(&m->lock);
 }
 
+
+/**
+ * virMutexSetName:
+ * @m: the mutex
+ * @name: name of the class of lock @m belongs to
+ *
+ * Set the name under which lock profiling accounts @m. The string
+ * is not copied and must stay valid for the lifetime of the process,
+ * e.g. a string literal or the name of a virClass. Must be called
+ * after virMutexInit and before @m is used.
+ */
+void virMutexSetName(virMutexPtr m, const char *name)
+{
+    m->name = name;
+    m->profileClass = 0;
+}
+
+
+/**
+ * virMutexProfileEnabled:
+ *
+ * Returns true if the process was started with lock profiling enabled.
+ */
+bool virMutexProfileEnabled(void)
+{
+    return virMutexProfiling;
+}
+
+
+static unsigned long long
+virMutexProfileNow(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
+/* Must be called with @m held, which serializes the lookup for it */
+static virMutexProfileClassPtr
+virMutexProfileGetClass(virMutexPtr m)
+{
+    size_t i;
+
+    if (m->profileClass > 0)
+        return &virMutexProfileClasses[m->profileClass - 1];
+
+    i = 0;
+    if (m->name) {
+        pthread_mutex_lock(&virMutexProfileLock);
+        for (i = 1; i < virMutexProfileNClasses; i++) {
+            if (STREQ(virMutexProfileClasses[i].stats.name, m->name))
+                break;
+        }
+        if (i == virMutexProfileNClasses) {
+            if (i < VIR_MUTEX_PROFILE_CLASSES_MAX) {
+                virMutexProfileClasses[i].stats.name = m->name;
+                virMutexProfileNClasses++;
+            } else {
+                i = 0;
+            }
+        }
+        pthread_mutex_unlock(&virMutexProfileLock);
+    }
+
+    m->profileClass = i + 1;
+    return &virMutexProfileClasses[i];
+}
+
+
+static void
+virMutexProfileAdd(unsigned long long *total,
+                   unsigned long long *max,
+                   unsigned long long value)
+{
+    *total += value;
+    if (value > *max)
+        *max = value;
+}
+
+
+static void
+virMutexLockProfiled(virMutexPtr m)
+{
+    virMutexProfileClassPtr klass;
+    unsigned long long start = 0;
+    unsigned long long now;
+    bool contended = false;
+
+    if (pthread_mutex_trylock(&m->lock) != 0) {
+        contended = true;
+        start = virMutexProfileNow();
+        pthread_mutex_lock(&m->lock);
+    }
+    now = virMutexProfileNow();
+
+    if (m->depth++ == 0)
+        m->acquired = now;
+
+    klass = virMutexProfileGetClass(m);
+    pthread_mutex_lock(&klass->lock);
+    klass->stats.acquired++;
+    if (contended) {
+        klass->stats.contended++;
+        virMutexProfileAdd(&klass->stats.waitTime,
+                           &klass->stats.maxWaitTime, now - start);
+    }
+    pthread_mutex_unlock(&klass->lock);
+
+    if (contended)
+        VIR_MUTEX_PROBE(THREAD_MUTEX_CONTENDED, m, klass->stats.name,
+                        now - start);
+}
+
+
+/* Ends the hold period of @m, if it is being tracked */
+static void
+virMutexProfileRelease(virMutexPtr m)
+{
+    virMutexProfileClassPtr klass;
+    unsigned long long held;
+
+    if (m->depth == 0 || --m->depth > 0)
+        return;
+
+    held = virMutexProfileNow() - m->acquired;
+    klass = virMutexProfileGetClass(m);
+
+    pthread_mutex_lock(&klass->lock);
+    virMutexProfileAdd(&klass->stats.holdTime,
+                       &klass->stats.maxHoldTime, held);
+    pthread_mutex_unlock(&klass->lock);
+
+    VIR_MUTEX_PROBE(THREAD_MUTEX_RELEASE, m, klass->stats.name, held);
+}
+
+
 void virMutexLock(virMutexPtr m)
 {
+    if (virMutexProfiling) {
+        virMutexLockProfiled(m);
+        return;
+    }
+
     pthread_mutex_lock(&m->lock);
 }
 
 void virMutexUnlock(virMutexPtr m)
 {
+    if (virMutexProfiling)
+        virMutexProfileRelease(m);
+
     pthread_mutex_unlock(&m->lock);
 }
 
 
+static int
+virMutexStatsCompare(const void *a, const void *b)
+{
+    const virMutexStats *sa = a;
+    const virMutexStats *sb = b;
+
+    if (sa->waitTime != sb->waitTime)
+        return sa->waitTime < sb->waitTime ? 1 : -1;
+    if (sa->acquired != sb->acquired)
+        return sa->acquired < sb->acquired ? 1 : -1;
+    return 0;
+}
+
+
+/**
+ * virMutexGetStats:
+ * @stats: filled with an array describing every class of locks
+ * @nstats: filled with the number of elements in @stats
+ *
+ * Collects the lock profiling statistics, ordered by the time spent
+ * waiting for the locks, longest first. If profiling is disabled
+ * @stats is empty.
+ *
+ * Returns 0 on success, -1 on error. The caller must free @stats
+ * but not the names it points to.
+ */
+int virMutexGetStats(virMutexStatsPtr *stats,
+                     size_t *nstats)
+{
+    virMutexStatsPtr ret = NULL;
+    size_t n;
+    size_t i;
+
+    /* Allocating can log an error, which locks a mutex and might
+     * need to register its class, so don't hold the registry lock */
+    pthread_mutex_lock(&virMutexProfileLock);
+    n = virMutexProfileNClasses;
+    pthread_mutex_unlock(&virMutexProfileLock);
+
+    if (n > 0 && VIR_ALLOC_N(ret, n) < 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        pthread_mutex_lock(&virMutexProfileClasses[i].lock);
+        ret[i] = virMutexProfileClasses[i].stats;
+        pthread_mutex_unlock(&virMutexProfileClasses[i].lock);
+    }
+
+    if (n > 0)
+        qsort(ret, n, sizeof(*ret), virMutexStatsCompare);
+
+    *stats = ret;
+    *nstats = n;
+    return 0;
+}
+
+
+/**
+ * virMutexResetStats:
+ *
+ * Clears the lock profiling statistics of every class of locks.
+ */
+void virMutexResetStats(void)
+{
+    size_t n;
+    size_t i;
+
+    pthread_mutex_lock(&virMutexProfileLock);
+    n = virMutexProfileNClasses;
+    pthread_mutex_unlock(&virMutexProfileLock);
+
+    for (i = 0; i < n; i++) {
+        virMutexProfileClassPtr klass = &virMutexProfileClasses[i];
+        const char *name;
+
+        pthread_mutex_lock(&klass->lock);
+        name = klass->stats.name;
+        memset(&klass->stats, 0, sizeof(klass->stats));
+        klass->stats.name = name;
+        pthread_mutex_unlock(&klass->lock);
+    }
+}
+
+
 int virRWLockInit(virRWLockPtr m)
 {
     int ret;
@@ -148,10 +447,63 @@ int virCondDestroy(virCondPtr c)
     return 0;
 }
 
+
+/* Waiting on a condition releases @m: end the current hold period
+ * and stop tracking it, since other threads may take it meanwhile */
+static unsigned long long
+virMutexProfileCondStart(virMutexPtr m,
+                         unsigned int *depth)
+{
+    *depth = m->depth;
+    if (*depth > 0) {
+        m->depth = 1;
+        virMutexProfileRelease(m);
+    }
+
+    return virMutexProfileNow();
+}
+
+
+static void
+virMutexProfileCondEnd(virCondPtr c,
+                       virMutexPtr m,
+                       unsigned int depth,
+                       unsigned long long start)
+{
+    virMutexProfileClassPtr klass;
+    unsigned long long now = virMutexProfileNow();
+
+    if (depth > 0) {
+        m->depth = depth;
+        m->acquired = now;
+    }
+
+    klass = virMutexProfileGetClass(m);
+    pthread_mutex_lock(&klass->lock);
+    klass->stats.condWaits++;
+    klass->stats.condWaitTime += now - start;
+    pthread_mutex_unlock(&klass->lock);
+
+    VIR_MUTEX_PROBE(THREAD_COND_WAKEUP, c, m, klass->stats.name,
+                    now - start);
+}
+
+
 int virCondWait(virCondPtr c, virMutexPtr m)
 {
     int ret;
-    if ((ret = pthread_cond_wait(&c->cond, &m->lock)) != 0) {
+    unsigned int depth = 0;
+    unsigned long long start = 0;
+
+    if (virMutexProfiling)
+        start = virMutexProfileCondStart(m, &depth);
+
+    ret = pthread_cond_wait(&c->cond, &m->lock);
+
+    if (virMutexProfiling)
+        virMutexProfileCondEnd(c, m, depth, start);
+
+    if (ret != 0) {
         errno = ret;
         return -1;
     }
@@ -162,11 +514,21 @@ int virCondWaitUntil(virCondPtr c, virMutexPtr m, unsigned long long whenms)
 {
     int ret;
     struct timespec ts;
+    unsigned int depth = 0;
+    unsigned long long start = 0;
 
     ts.tv_sec = whenms / 1000;
     ts.tv_nsec = (whenms % 1000) * 1000000;
 
-    if ((ret = pthread_cond_timedwait(&c->cond, &m->lock, &ts)) != 0) {
+    if (virMutexProfiling)
+        start = virMutexProfileCondStart(m, &depth);
+
+    ret = pthread_cond_timedwait(&c->cond, &m->lock, &ts);
+
+    if (virMutexProfiling)
+        virMutexProfileCondEnd(c, m, depth, start);
+
+    if (ret != 0) {
         errno = ret;
         return -1;
     }
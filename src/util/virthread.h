@@ -32,6 +32,12 @@ typedef virMutex *virMutexPtr;
 
 struct virMutex {
     pthread_mutex_t lock;
+
+    /* Only used while lock profiling is enabled, see virMutexSetName */
+    const char *name;
+    int profileClass; /* index + 1 of the class' statistics, 0 if unknown */
+    unsigned int depth; /* recursion level of the holder */
+    unsigned long long acquired; /* microseconds */
 };
 
 typedef struct virRWLock virRWLock;
@@ -134,6 +140,31 @@ void virMutexDestroy(virMutexPtr m);
 void virMutexLock(virMutexPtr m);
 void virMutexUnlock(virMutexPtr m);
 
+/* Lock profiling is enabled by setting LIBVIRT_LOCK_PROFILE=1 in the
+ * environment of the process. All mutexes sharing the same name are
+ * accounted together, mutexes without a name as "virMutex". */
+typedef struct _virMutexStats virMutexStats;
+typedef virMutexStats *virMutexStatsPtr;
+struct _virMutexStats {
+    const char *name;
+    unsigned long long acquired;     /* successful virMutexLock calls */
+    unsigned long long contended;    /* ... which had to wait */
+    unsigned long long waitTime;     /* microseconds spent waiting */
+    unsigned long long maxWaitTime;
+    unsigned long long holdTime;     /* microseconds the mutex was held */
+    unsigned long long maxHoldTime;
+    unsigned long long condWaits;    /* virCondWait* calls on the mutex */
+    unsigned long long condWaitTime; /* microseconds spent in them */
+};
+
+bool virMutexProfileEnabled(void);
+void virMutexSetName(virMutexPtr m, const char *name)
+    ATTRIBUTE_NONNULL(1);
+int virMutexGetStats(virMutexStatsPtr *stats,
+                     size_t *nstats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+void virMutexResetStats(void);
+
 
 int virRWLockInit(virRWLockPtr m) ATTRIBUTE_RETURN_CHECK;
 void virRWLockDestroy(virRWLockPtr m);
@@ -30,16 +30,19 @@
 #include "viralloc.h"
 #include "virthread.h"
 #include "virerror.h"
+#include "viratomic.h"
+#include "virhostcpu.h"
+#include "virlog.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+VIR_LOG_INIT("util.threadpool");
+
 typedef struct _virThreadPoolJob virThreadPoolJob;
 typedef virThreadPoolJob *virThreadPoolJobPtr;
 
 struct _virThreadPoolJob {
-    virThreadPoolJobPtr prev;
     virThreadPoolJobPtr next;
-    unsigned int priority;
 
     void *data;
 };
@@ -50,7 +53,6 @@ typedef virThreadPoolJobList *virThreadPoolJobListPtr;
 struct _virThreadPoolJobList {
     virThreadPoolJobPtr head;
     virThreadPoolJobPtr tail;
-    virThreadPoolJobPtr firstPrio;
 };
 
 
@@ -60,7 +62,8 @@ struct _virThreadPool {
     virThreadPoolJobFunc jobFunc;
     const char *jobFuncName;
     void *jobOpaque;
-    virThreadPoolJobList jobList;
+    /* One FIFO queue per priority class */
+    virThreadPoolJobList jobList[VIR_THREAD_POOL_PRIORITY_LAST];
     size_t jobQueueDepth;
 
     virMutex mutex;
@@ -93,6 +96,33 @@ static inline bool virThreadPoolWorkerQuitHelper(size_t count, size_t limit)
     return count > limit;
 }
 
+/* Take the oldest job of the highest priority class that has any.
+ * Priority workers only serve the high priority classes, while
+ * ordinary workers serve all of them, so high priority jobs never
+ * wait behind a backlog of ordinary ones. */
+static virThreadPoolJobPtr
+virThreadPoolJobListPop(virThreadPoolPtr pool,
+                        bool priority)
+{
+    size_t lowest = priority ? VIR_THREAD_POOL_PRIORITY_HIGH : 0;
+    size_t i = VIR_THREAD_POOL_PRIORITY_LAST;
+    virThreadPoolJobListPtr list;
+    virThreadPoolJobPtr job;
+
+    while (i-- > lowest) {
+        list = &pool->jobList[i];
+        if (!(job = list->head))
+            continue;
+
+        if (!(list->head = job->next))
+            list->tail = NULL;
+        pool->jobQueueDepth--;
+        return job;
+    }
+
+    return NULL;
+}
+
 static void virThreadPoolWorker(void *opaque)
 {
     struct virThreadPoolWorkerData *data = opaque;
@@ -117,8 +147,7 @@ static void virThreadPoolWorker(void *opaque)
         if (virThreadPoolWorkerQuitHelper(*curWorkers, *maxLimit))
             goto out;
         while (!pool->quit &&
-               ((!priority && !pool->jobList.head) ||
-                (priority && !pool->jobList.firstPrio))) {
+               !(job = virThreadPoolJobListPop(pool, priority))) {
             if (!priority)
                 pool->freeWorkers++;
             if (virCondWait(cond, &pool->mutex) < 0) {
@@ -136,33 +165,6 @@ static void virThreadPoolWorker(void *opaque)
         if (pool->quit)
             break;
 
-        if (priority) {
-            job = pool->jobList.firstPrio;
-        } else {
-            job = pool->jobList.head;
-        }
-
-        if (job == pool->jobList.firstPrio) {
-            virThreadPoolJobPtr tmp = job->next;
-            while (tmp) {
-                if (tmp->priority)
-                    break;
-                tmp = tmp->next;
-            }
-            pool->jobList.firstPrio = tmp;
-        }
-
-        if (job->prev)
-            job->prev->next = job->next;
-        else
-            pool->jobList.head = job->next;
-        if (job->next)
-            job->next->prev = job->prev;
-        else
-            pool->jobList.tail = job->prev;
-
-        pool->jobQueueDepth--;
-
         virMutexUnlock(&pool->mutex);
         (pool->jobFunc)(job->data, pool->jobOpaque);
         VIR_FREE(job);
@@ -233,8 +235,6 @@ virThreadPoolNewFull(size_t minWorkers,
     if (VIR_ALLOC(pool) < 0)
         return NULL;
 
-    pool->jobList.tail = pool->jobList.head = NULL;
-
     pool->jobFunc = func;
     pool->jobFuncName = funcName;
     pool->jobOpaque = opaque;
@@ -273,6 +273,7 @@ void virThreadPoolFree(virThreadPoolPtr pool)
 {
     virThreadPoolJobPtr job;
     bool priority = false;
+    size_t i;
 
     if (!pool)
         return;
@@ -289,9 +290,11 @@ void virThreadPoolFree(virThreadPoolPtr pool)
     while (pool->nWorkers > 0 || pool->nPrioWorkers > 0)
         ignore_value(virCondWait(&pool->quit_cond, &pool->mutex));
 
-    while ((job = pool->jobList.head)) {
-        pool->jobList.head = pool->jobList.head->next;
-        VIR_FREE(job);
+    for (i = 0; i < VIR_THREAD_POOL_PRIORITY_LAST; i++) {
+        while ((job = pool->jobList[i].head)) {
+            pool->jobList[i].head = job->next;
+            VIR_FREE(job);
+        }
     }
 
     VIR_FREE(pool->workers);
@@ -374,7 +377,8 @@ size_t virThreadPoolGetJobQueueDepth(virThreadPoolPtr pool)
 }
 
 /*
- * @priority - job priority
+ * @priority - job priority, one of virThreadPoolPriority; larger values
+ *             are treated as the highest priority class
  * Return: 0 on success, -1 otherwise
  */
 int virThreadPoolSendJob(virThreadPoolPtr pool,
@@ -382,37 +386,37 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
                          void *jobData)
 {
     virThreadPoolJobPtr job;
+    virThreadPoolJobListPtr list;
+
+    if (priority >= VIR_THREAD_POOL_PRIORITY_LAST)
+        priority = VIR_THREAD_POOL_PRIORITY_LAST - 1;
+
+    /* Keep the allocation out of the critical section */
+    if (VIR_ALLOC(job) < 0)
+        return -1;
+
+    job->data = jobData;
 
     virMutexLock(&pool->mutex);
     if (pool->quit)
         goto error;
 
-    if (pool->freeWorkers - pool->jobQueueDepth <= 0 &&
+    if (pool->freeWorkers <= pool->jobQueueDepth &&
         pool->nWorkers < pool->maxWorkers &&
         virThreadPoolExpand(pool, 1, false) < 0)
         goto error;
 
-    if (VIR_ALLOC(job) < 0)
-        goto error;
-
-    job->data = jobData;
-    job->priority = priority;
-
-    job->prev = pool->jobList.tail;
-    if (pool->jobList.tail)
-        pool->jobList.tail->next = job;
-    pool->jobList.tail = job;
-
-    if (!pool->jobList.head)
-        pool->jobList.head = job;
-
-    if (priority && !pool->jobList.firstPrio)
-        pool->jobList.firstPrio = job;
+    list = &pool->jobList[priority];
+    if (list->tail)
+        list->tail->next = job;
+    else
+        list->head = job;
+    list->tail = job;
 
     pool->jobQueueDepth++;
 
     virCondSignal(&pool->cond);
-    if (priority)
+    if (priority >= VIR_THREAD_POOL_PRIORITY_HIGH && pool->nPrioWorkers)
         virCondSignal(&pool->prioCond);
 
     virMutexUnlock(&pool->mutex);
@@ -420,6 +424,7 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
 
  error:
     virMutexUnlock(&pool->mutex);
+    VIR_FREE(job);
     return -1;
 }
 
@@ -473,3 +478,85 @@ virThreadPoolSetParameters(virThreadPoolPtr pool,
     virMutexUnlock(&pool->mutex);
     return -1;
 }
+
+
+struct virThreadPoolParallelData {
+    size_t nitems;
+    virThreadPoolParallelFunc func;
+    void *opaque;
+    volatile int next;
+};
+
+
+static void
+virThreadPoolParallelWorker(void *opaque)
+{
+    struct virThreadPoolParallelData *data = opaque;
+    size_t i;
+
+    while ((i = virAtomicIntAdd(&data->next, 1)) < data->nitems)
+        data->func(i, data->opaque);
+}
+
+
+/**
+ * virThreadPoolParallelFor:
+ * @nitems: number of items to process
+ * @maxWorkers: upper limit of threads to use, 0 for one per host CPU
+ * @func: callback invoked once for every item
+ * @opaque: data passed to @func
+ *
+ * Invoke @func for every index in the range [0, @nitems) from a few
+ * short lived threads and wait for all of them to finish. There is no
+ * guarantee in which order, or from which thread, the items are
+ * processed, so @func has to be safe to run concurrently. If no extra
+ * thread can be created the items are processed by the calling thread.
+ */
+void
+virThreadPoolParallelFor(size_t nitems,
+                         size_t maxWorkers,
+                         virThreadPoolParallelFunc func,
+                         void *opaque)
+{
+    struct virThreadPoolParallelData data = {
+        .nitems = nitems, .func = func, .opaque = opaque, .next = 0,
+    };
+    virThreadPtr threads = NULL;
+    size_t nthreads = 0;
+    size_t nworkers = maxWorkers;
+    int ncpus;
+    size_t i;
+
+    if (nworkers == 0) {
+        if ((ncpus = virHostCPUGetCount()) > 0) {
+            nworkers = ncpus;
+        } else {
+            virResetLastError();
+            nworkers = 1;
+        }
+    }
+
+    if (nworkers > nitems)
+        nworkers = nitems;
+
+    /* The calling thread does its share of the work too */
+    if (nworkers > 1 && VIR_ALLOC_N_QUIET(threads, nworkers - 1) == 0) {
+        for (nthreads = 0; nthreads < nworkers - 1; nthreads++) {
+            if (virThreadCreateFull(&threads[nthreads], true,
+                                    virThreadPoolParallelWorker,
+                                    "virThreadPoolParallelWorker",
+                                    false, &data) < 0) {
+                VIR_WARN("Failed to create parallel worker thread, "
+                         "continuing with %zu", nthreads + 1);
+                break;
+            }
+        }
+    }
+
+    virThreadPoolParallelWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    VIR_FREE(threads);
+}
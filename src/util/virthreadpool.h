@@ -33,6 +33,16 @@ typedef virThreadPool *virThreadPoolPtr;
 
 typedef void (*virThreadPoolJobFunc)(void *jobdata, void *opaque);
 
+/* Jobs of a higher class are always started before those of a lower
+ * one; priority workers only run jobs of VIR_THREAD_POOL_PRIORITY_HIGH
+ * and above. */
+typedef enum {
+    VIR_THREAD_POOL_PRIORITY_NORMAL = 0,
+    VIR_THREAD_POOL_PRIORITY_HIGH,
+
+    VIR_THREAD_POOL_PRIORITY_LAST
+} virThreadPoolPriority;
+
 # define virThreadPoolNew(min, max, prio, func, opaque) \
     virThreadPoolNewFull(min, max, prio, func, #func, opaque)
 
@@ -62,4 +72,12 @@ int virThreadPoolSetParameters(virThreadPoolPtr pool,
                                long long int maxWorkers,
                                long long int prioWorkers);
 
+typedef void (*virThreadPoolParallelFunc)(size_t idx, void *opaque);
+
+void virThreadPoolParallelFor(size_t nitems,
+                              size_t maxWorkers,
+                              virThreadPoolParallelFunc func,
+                              void *opaque)
+    ATTRIBUTE_NONNULL(3);
+
 #endif
@@ -0,0 +1,466 @@
+/*
+ * virtimerwheel.c: many timers driven by a single event loop timeout
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * The event loop walks all its timeouts on every iteration, which
+ * gets expensive when each of thousands of objects, such as the
+ * keepalive of every client connection, registers its own timeout.
+ *
+ * A timer wheel keeps its entries in VIR_TIMER_WHEEL_SLOTS lists,
+ * each entry in the list of the VIR_TIMER_WHEEL_TICK milliseconds
+ * long tick it expires in, modulo the number of slots. Adding,
+ * updating and removing an entry thus takes constant time and only
+ * the lists of the ticks which passed need to be looked at when the
+ * single event loop timeout of the wheel fires. Entries expiring
+ * more than a full turn of the wheel ahead simply stay in their list
+ * until their tick really comes.
+ *
+ * The entries behave like event loop timeouts: they are periodic
+ * and a negative frequency disables them. They may however fire up
+ * to one tick late.
+ */
+
+#include <config.h>
+
+#include "virtimerwheelpriv.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virevent.h"
+#include "virlog.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.timerwheel");
+
+struct _virTimerWheelEntry {
+    int frequency;
+    unsigned long long expires; /* tick */
+
+    virTimerWheelCallback cb;
+    void *opaque;
+    virFreeCallback ff;
+
+    bool linked;
+    virTimerWheelEntryPtr prev;
+    virTimerWheelEntryPtr next;
+
+    size_t running;
+    bool deleted;
+    virTimerWheelEntryPtr nextFired;
+};
+
+struct _virTimerWheel {
+    virObjectLockable parent;
+
+    int timer; /* event loop timeout, -1 until the first entry is added */
+    unsigned long long start; /* time of tick 0 */
+    unsigned long long current; /* last tick processed */
+    unsigned long long wakeup; /* tick @timer is armed for, 0 if none */
+
+    size_t nlinked;
+    virTimerWheelEntryPtr slots[VIR_TIMER_WHEEL_SLOTS];
+};
+
+static virClassPtr virTimerWheelClass;
+
+static int
+virTimerWheelOnceInit(void)
+{
+    if (!(virTimerWheelClass = virClassNew(virClassForObjectLockable(),
+                                           "virTimerWheel",
+                                           sizeof(virTimerWheel),
+                                           NULL)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virTimerWheel)
+
+
+static unsigned long long
+virTimerWheelTick(virTimerWheelPtr wheel,
+                  unsigned long long now)
+{
+    if (now < wheel->start)
+        return 0;
+
+    return (now - wheel->start) / VIR_TIMER_WHEEL_TICK;
+}
+
+
+/* Must be called with @wheel locked */
+static void
+virTimerWheelLink(virTimerWheelPtr wheel,
+                  virTimerWheelEntryPtr entry,
+                  unsigned long long now)
+{
+    virTimerWheelEntryPtr *slot;
+
+    entry->expires = virTimerWheelTick(wheel, now + entry->frequency +
+                                       VIR_TIMER_WHEEL_TICK - 1);
+    if (entry->expires <= wheel->current)
+        entry->expires = wheel->current + 1;
+
+    slot = &wheel->slots[entry->expires % VIR_TIMER_WHEEL_SLOTS];
+    entry->prev = NULL;
+    entry->next = *slot;
+    if (*slot)
+        (*slot)->prev = entry;
+    *slot = entry;
+    entry->linked = true;
+    wheel->nlinked++;
+}
+
+
+/* Must be called with @wheel locked */
+static void
+virTimerWheelUnlink(virTimerWheelPtr wheel,
+                    virTimerWheelEntryPtr entry)
+{
+    if (!entry->linked)
+        return;
+
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        wheel->slots[entry->expires % VIR_TIMER_WHEEL_SLOTS] = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+
+    entry->prev = entry->next = NULL;
+    entry->linked = false;
+    wheel->nlinked--;
+}
+
+
+/* Must be called with @wheel locked. Arms the event loop timeout for
+ * the first tick with a non-empty list. */
+static void
+virTimerWheelArm(virTimerWheelPtr wheel,
+                 unsigned long long now)
+{
+    unsigned long long tick = 0;
+    unsigned long long when;
+    size_t i;
+
+    if (wheel->timer < 0)
+        return;
+
+    for (i = 1; wheel->nlinked && i <= VIR_TIMER_WHEEL_SLOTS; i++) {
+        if (wheel->slots[(wheel->current + i) % VIR_TIMER_WHEEL_SLOTS]) {
+            tick = wheel->current + i;
+            break;
+        }
+    }
+
+    if (tick == wheel->wakeup)
+        return;
+    wheel->wakeup = tick;
+
+    if (tick == 0) {
+        virEventUpdateTimeout(wheel->timer, -1);
+        return;
+    }
+
+    when = wheel->start + tick * VIR_TIMER_WHEEL_TICK;
+    virEventUpdateTimeout(wheel->timer, when > now ? when - now : 0);
+}
+
+
+/**
+ * virTimerWheelRunAt:
+ * @wheel: timer wheel
+ * @now: current time in milliseconds
+ *
+ * Calls the callbacks of all entries which expired by @now.
+ */
+void
+virTimerWheelRunAt(virTimerWheelPtr wheel,
+                   unsigned long long now)
+{
+    virTimerWheelEntryPtr fired = NULL;
+    virTimerWheelEntryPtr *last = &fired;
+    virTimerWheelEntryPtr entry;
+    virTimerWheelEntryPtr next;
+    virTimerWheelEntryPtr freed = NULL;
+    unsigned long long target;
+    unsigned long long nticks;
+    size_t i;
+
+    virObjectLock(wheel);
+
+    target = virTimerWheelTick(wheel, now);
+    nticks = target > wheel->current ? target - wheel->current : 0;
+    if (nticks > VIR_TIMER_WHEEL_SLOTS)
+        nticks = VIR_TIMER_WHEEL_SLOTS;
+
+    for (i = 1; i <= nticks; i++) {
+        size_t slot = (wheel->current + i) % VIR_TIMER_WHEEL_SLOTS;
+
+        for (entry = wheel->slots[slot]; entry; entry = next) {
+            next = entry->next;
+            if (entry->expires > target)
+                continue;
+
+            virTimerWheelUnlink(wheel, entry);
+            entry->running++;
+            entry->nextFired = NULL;
+            *last = entry;
+            last = &entry->nextFired;
+        }
+    }
+    if (target > wheel->current)
+        wheel->current = target;
+
+    /* Reschedule the periodic entries before running the callbacks,
+     * so that they can change their frequency */
+    for (entry = fired; entry; entry = entry->nextFired)
+        virTimerWheelLink(wheel, entry, now);
+
+    /* The event loop timeout fired and needs to be rearmed, whatever
+     * it was armed for */
+    wheel->wakeup = ULLONG_MAX;
+    virTimerWheelArm(wheel, now);
+
+    for (entry = fired; entry; entry = next) {
+        next = entry->nextFired;
+
+        if (!entry->deleted) {
+            virObjectUnlock(wheel);
+            (entry->cb)(entry, entry->opaque);
+            virObjectLock(wheel);
+        }
+
+        if (--entry->running == 0 && entry->deleted) {
+            entry->nextFired = freed;
+            freed = entry;
+        }
+    }
+
+    virObjectUnlock(wheel);
+
+    for (entry = freed; entry; entry = next) {
+        next = entry->nextFired;
+        if (entry->ff)
+            (entry->ff)(entry->opaque);
+        VIR_FREE(entry);
+    }
+}
+
+
+static void
+virTimerWheelTimer(int timer ATTRIBUTE_UNUSED,
+                   void *opaque)
+{
+    virTimerWheelPtr wheel = opaque;
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return;
+
+    virTimerWheelRunAt(wheel, now);
+}
+
+
+virTimerWheelPtr
+virTimerWheelNewAt(unsigned long long now)
+{
+    virTimerWheelPtr wheel;
+
+    if (virTimerWheelInitialize() < 0)
+        return NULL;
+
+    if (!(wheel = virObjectLockableNew(virTimerWheelClass)))
+        return NULL;
+
+    wheel->timer = -1;
+    wheel->start = now;
+
+    return wheel;
+}
+
+
+/**
+ * virTimerWheelNew:
+ *
+ * Creates a timer wheel. Its event loop timeout is registered with
+ * the first entry and holds a reference on the wheel.
+ *
+ * Returns the new wheel or NULL on error.
+ */
+virTimerWheelPtr
+virTimerWheelNew(void)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return NULL;
+
+    return virTimerWheelNewAt(now);
+}
+
+
+virTimerWheelEntryPtr
+virTimerWheelAddAt(virTimerWheelPtr wheel,
+                   int frequency,
+                   virTimerWheelCallback cb,
+                   void *opaque,
+                   virFreeCallback ff,
+                   unsigned long long now)
+{
+    virTimerWheelEntryPtr entry;
+
+    if (VIR_ALLOC(entry) < 0)
+        return NULL;
+
+    entry->frequency = frequency;
+    entry->cb = cb;
+    entry->opaque = opaque;
+    entry->ff = ff;
+
+    virObjectLock(wheel);
+
+    if (wheel->timer < 0) {
+        virObjectRef(wheel);
+        wheel->timer = virEventAddTimeout(-1, virTimerWheelTimer, wheel,
+                                          virObjectFreeCallback);
+        if (wheel->timer < 0) {
+            virObjectUnlock(wheel);
+            virObjectUnref(wheel);
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("unable to register timer wheel timeout"));
+            VIR_FREE(entry);
+            return NULL;
+        }
+    }
+
+    if (frequency >= 0) {
+        virTimerWheelLink(wheel, entry, now);
+        virTimerWheelArm(wheel, now);
+    }
+
+    virObjectUnlock(wheel);
+
+    return entry;
+}
+
+
+/**
+ * virTimerWheelAdd:
+ * @wheel: timer wheel
+ * @frequency: time between calls of @cb in milliseconds, -1 to disable
+ * @cb: callback
+ * @opaque: data passed to @cb
+ * @ff: function called to release @opaque once the entry is removed
+ *
+ * Returns an entry which stays valid until it is passed to
+ * virTimerWheelRemove(), or NULL on error.
+ */
+virTimerWheelEntryPtr
+virTimerWheelAdd(virTimerWheelPtr wheel,
+                 int frequency,
+                 virTimerWheelCallback cb,
+                 void *opaque,
+                 virFreeCallback ff)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return NULL;
+
+    return virTimerWheelAddAt(wheel, frequency, cb, opaque, ff, now);
+}
+
+
+void
+virTimerWheelUpdateAt(virTimerWheelPtr wheel,
+                      virTimerWheelEntryPtr entry,
+                      int frequency,
+                      unsigned long long now)
+{
+    virObjectLock(wheel);
+
+    if (!entry->deleted) {
+        virTimerWheelUnlink(wheel, entry);
+        entry->frequency = frequency;
+        if (frequency >= 0)
+            virTimerWheelLink(wheel, entry, now);
+        virTimerWheelArm(wheel, now);
+    }
+
+    virObjectUnlock(wheel);
+}
+
+
+/**
+ * virTimerWheelUpdate:
+ * @wheel: timer wheel
+ * @entry: entry of @wheel
+ * @frequency: new time between calls in milliseconds, -1 to disable
+ *
+ * Restarts the countdown of @entry with @frequency.
+ */
+void
+virTimerWheelUpdate(virTimerWheelPtr wheel,
+                    virTimerWheelEntryPtr entry,
+                    int frequency)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0) {
+        VIR_WARN("Unable to update timer wheel entry %p", entry);
+        return;
+    }
+
+    virTimerWheelUpdateAt(wheel, entry, frequency, now);
+}
+
+
+/**
+ * virTimerWheelRemove:
+ * @wheel: timer wheel
+ * @entry: entry of @wheel
+ *
+ * Removes @entry from @wheel. The callback may still be running in
+ * another thread, in which case the free function of the entry is
+ * only called after it finished.
+ */
+void
+virTimerWheelRemove(virTimerWheelPtr wheel,
+                    virTimerWheelEntryPtr entry)
+{
+    bool release;
+
+    virObjectLock(wheel);
+    virTimerWheelUnlink(wheel, entry);
+    entry->deleted = true;
+    release = entry->running == 0;
+    virObjectUnlock(wheel);
+
+    if (!release)
+        return;
+
+    if (entry->ff)
+        (entry->ff)(entry->opaque);
+    VIR_FREE(entry);
+}
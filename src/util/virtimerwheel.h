@@ -0,0 +1,53 @@
+/*
+ * virtimerwheel.h: many timers driven by a single event loop timeout
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_TIMER_WHEEL_H__
+# define __VIR_TIMER_WHEEL_H__
+
+# include "internal.h"
+# include "virobject.h"
+
+typedef struct _virTimerWheel virTimerWheel;
+typedef virTimerWheel *virTimerWheelPtr;
+
+typedef struct _virTimerWheelEntry virTimerWheelEntry;
+typedef virTimerWheelEntry *virTimerWheelEntryPtr;
+
+typedef void (*virTimerWheelCallback)(virTimerWheelEntryPtr entry,
+                                      void *opaque);
+
+virTimerWheelPtr virTimerWheelNew(void);
+
+virTimerWheelEntryPtr virTimerWheelAdd(virTimerWheelPtr wheel,
+                                       int frequency,
+                                       virTimerWheelCallback cb,
+                                       void *opaque,
+                                       virFreeCallback ff)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3);
+void virTimerWheelUpdate(virTimerWheelPtr wheel,
+                         virTimerWheelEntryPtr entry,
+                         int frequency)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+void virTimerWheelRemove(virTimerWheelPtr wheel,
+                         virTimerWheelEntryPtr entry)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+#endif /* __VIR_TIMER_WHEEL_H__ */
@@ -0,0 +1,47 @@
+/*
+ * virtimerwheelpriv.h: functions for testing virTimerWheel APIs
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_TIMER_WHEEL_PRIV_H__
+# define __VIR_TIMER_WHEEL_PRIV_H__
+
+# include "virtimerwheel.h"
+
+# define VIR_TIMER_WHEEL_TICK 100
+# define VIR_TIMER_WHEEL_SLOTS 512
+
+virTimerWheelPtr virTimerWheelNewAt(unsigned long long now);
+virTimerWheelEntryPtr virTimerWheelAddAt(virTimerWheelPtr wheel,
+                                         int frequency,
+                                         virTimerWheelCallback cb,
+                                         void *opaque,
+                                         virFreeCallback ff,
+                                         unsigned long long now)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3);
+void virTimerWheelUpdateAt(virTimerWheelPtr wheel,
+                           virTimerWheelEntryPtr entry,
+                           int frequency,
+                           unsigned long long now)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+void virTimerWheelRunAt(virTimerWheelPtr wheel,
+                        unsigned long long now)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_TIMER_WHEEL_PRIV_H__ */
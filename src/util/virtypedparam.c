@@ -23,8 +23,10 @@
 #include "virtypedparam.h"
 
 #include <stdarg.h>
+#include <stdio.h>
 
 #include "viralloc.h"
+#include "virhashcode.h"
 #include "virutil.h"
 #include "virerror.h"
 #include "virstring.h"
@@ -1348,6 +1350,103 @@ virTypedParamsRemoteFree(virTypedParameterRemotePtr remote_params_val,
 }
 
 
+/**
+ * virTypedParameterDeserializeValue:
+ * @remote_value: protocol data of a single value (obtained from remote side)
+ * @param: parameter to receive the type and value of @remote_value
+ *
+ * The field name of @param is left untouched, so that protocols which
+ * send the names separately from the values can fill it in themselves.
+ *
+ * Returns 0 on success or -1 in case of an error.
+ */
+int
+virTypedParameterDeserializeValue(const virTypedParameterRemoteValue *remote_value,
+                                  virTypedParameterPtr param)
+{
+    param->type = remote_value->type;
+    switch (param->type) {
+    case VIR_TYPED_PARAM_INT:
+        param->value.i = remote_value->remote_typed_param_value.i;
+        break;
+    case VIR_TYPED_PARAM_UINT:
+        param->value.ui = remote_value->remote_typed_param_value.ui;
+        break;
+    case VIR_TYPED_PARAM_LLONG:
+        param->value.l = remote_value->remote_typed_param_value.l;
+        break;
+    case VIR_TYPED_PARAM_ULLONG:
+        param->value.ul = remote_value->remote_typed_param_value.ul;
+        break;
+    case VIR_TYPED_PARAM_DOUBLE:
+        param->value.d = remote_value->remote_typed_param_value.d;
+        break;
+    case VIR_TYPED_PARAM_BOOLEAN:
+        param->value.b = remote_value->remote_typed_param_value.b;
+        break;
+    case VIR_TYPED_PARAM_STRING:
+        if (VIR_STRDUP(param->value.s,
+                       remote_value->remote_typed_param_value.s) < 0)
+            return -1;
+        break;
+    default:
+        virReportError(VIR_ERR_RPC, _("unknown parameter type: %d"),
+                       param->type);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virTypedParameterSerializeValue:
+ * @param: parameter whose value should be serialized
+ * @remote_value: protocol independent remote representation of the value
+ *
+ * Only the type and value of @param are serialized, not its field name.
+ *
+ * Returns 0 on success or -1 in case of an error.
+ */
+int
+virTypedParameterSerializeValue(virTypedParameterPtr param,
+                                virTypedParameterRemoteValuePtr remote_value)
+{
+    remote_value->type = param->type;
+    switch (param->type) {
+    case VIR_TYPED_PARAM_INT:
+        remote_value->remote_typed_param_value.i = param->value.i;
+        break;
+    case VIR_TYPED_PARAM_UINT:
+        remote_value->remote_typed_param_value.ui = param->value.ui;
+        break;
+    case VIR_TYPED_PARAM_LLONG:
+        remote_value->remote_typed_param_value.l = param->value.l;
+        break;
+    case VIR_TYPED_PARAM_ULLONG:
+        remote_value->remote_typed_param_value.ul = param->value.ul;
+        break;
+    case VIR_TYPED_PARAM_DOUBLE:
+        remote_value->remote_typed_param_value.d = param->value.d;
+        break;
+    case VIR_TYPED_PARAM_BOOLEAN:
+        remote_value->remote_typed_param_value.b = param->value.b;
+        break;
+    case VIR_TYPED_PARAM_STRING:
+        if (VIR_STRDUP(remote_value->remote_typed_param_value.s,
+                       param->value.s) < 0)
+            return -1;
+        break;
+    default:
+        virReportError(VIR_ERR_RPC, _("unknown parameter type: %d"),
+                       param->type);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 /**
  * virTypedParamsDeserialize:
  * @remote_params: protocol data to be deserialized (obtained from remote side)
@@ -1420,42 +1519,9 @@ virTypedParamsDeserialize(virTypedParameterRemotePtr remote_params,
             goto cleanup;
         }
 
-        param->type = remote_param->value.type;
-        switch (param->type) {
-        case VIR_TYPED_PARAM_INT:
-            param->value.i =
-                remote_param->value.remote_typed_param_value.i;
-            break;
-        case VIR_TYPED_PARAM_UINT:
-            param->value.ui =
-                remote_param->value.remote_typed_param_value.ui;
-            break;
-        case VIR_TYPED_PARAM_LLONG:
-            param->value.l =
-                remote_param->value.remote_typed_param_value.l;
-            break;
-        case VIR_TYPED_PARAM_ULLONG:
-            param->value.ul =
-                remote_param->value.remote_typed_param_value.ul;
-            break;
-        case VIR_TYPED_PARAM_DOUBLE:
-            param->value.d =
-                remote_param->value.remote_typed_param_value.d;
-            break;
-        case VIR_TYPED_PARAM_BOOLEAN:
-            param->value.b =
-                remote_param->value.remote_typed_param_value.b;
-            break;
-        case VIR_TYPED_PARAM_STRING:
-            if (VIR_STRDUP(param->value.s,
-                           remote_param->value.remote_typed_param_value.s) < 0)
-                goto cleanup;
-            break;
-        default:
-            virReportError(VIR_ERR_RPC, _("unknown parameter type: %d"),
-                           param->type);
+        if (virTypedParameterDeserializeValue(&remote_param->value,
+                                              param) < 0)
             goto cleanup;
-        }
     }
 
     rv = 0;
@@ -1523,35 +1589,8 @@ virTypedParamsSerialize(virTypedParameterPtr params,
          * depending on the calling side, i.e. server or client */
         if (VIR_STRDUP(val->field, param->field) < 0)
             goto cleanup;
-        val->value.type = param->type;
-        switch (param->type) {
-        case VIR_TYPED_PARAM_INT:
-            val->value.remote_typed_param_value.i = param->value.i;
-            break;
-        case VIR_TYPED_PARAM_UINT:
-            val->value.remote_typed_param_value.ui = param->value.ui;
-            break;
-        case VIR_TYPED_PARAM_LLONG:
-            val->value.remote_typed_param_value.l = param->value.l;
-            break;
-        case VIR_TYPED_PARAM_ULLONG:
-            val->value.remote_typed_param_value.ul = param->value.ul;
-            break;
-        case VIR_TYPED_PARAM_DOUBLE:
-            val->value.remote_typed_param_value.d = param->value.d;
-            break;
-        case VIR_TYPED_PARAM_BOOLEAN:
-            val->value.remote_typed_param_value.b = param->value.b;
-            break;
-        case VIR_TYPED_PARAM_STRING:
-            if (VIR_STRDUP(val->value.remote_typed_param_value.s, param->value.s) < 0)
-                goto cleanup;
-            break;
-        default:
-            virReportError(VIR_ERR_RPC, _("unknown parameter type: %d"),
-                           param->type);
+        if (virTypedParameterSerializeValue(param, &val->value) < 0)
             goto cleanup;
-        }
         j++;
     }
 
@@ -1563,3 +1602,327 @@ virTypedParamsSerialize(virTypedParameterPtr params,
     virTypedParamsRemoteFree(params_val, nparams);
     return rv;
 }
+
+
+/*
+ * virTypedParamList is meant for code that builds a long array of
+ * parameters piece by piece, like the bulk stats. Every parameter is
+ * indexed by its name in a small open addressing table, so that adding
+ * one can reject duplicates and looking one up doesn't have to compare
+ * all the names.
+ */
+
+/* Returns the slot of @name in the index of @list, or the empty slot it
+ * would be stored in. The names are chosen by libvirt itself, so a
+ * fixed seed is good enough. */
+static size_t
+virTypedParamListIndexSlot(virTypedParamListPtr list,
+                           const char *name)
+{
+    size_t mask = list->nslots - 1;
+    size_t slot = virHashCodeGen(name, strlen(name), 0) & mask;
+
+    while (list->slots[slot] &&
+           STRNEQ(list->par[list->slots[slot] - 1].field, name))
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+
+static int
+virTypedParamListIndexGrow(virTypedParamListPtr list)
+{
+    size_t *old = list->slots;
+    size_t nslots = MAX(list->nslots * 2, 16);
+    size_t i;
+
+    if (VIR_ALLOC_N(list->slots, nslots) < 0) {
+        list->slots = old;
+        return -1;
+    }
+    list->nslots = nslots;
+
+    for (i = 0; i < list->npar; i++)
+        list->slots[virTypedParamListIndexSlot(list, list->par[i].field)] = i + 1;
+
+    VIR_FREE(old);
+    return 0;
+}
+
+
+/* Appends a parameter named according to @namefmt and returns it with
+ * only the field filled in, or NULL on error */
+static virTypedParameterPtr ATTRIBUTE_FMT_PRINTF(2, 0)
+virTypedParamListExtend(virTypedParamListPtr list,
+                        const char *namefmt,
+                        va_list ap)
+{
+    virTypedParameterPtr par;
+    size_t slot;
+    int len;
+
+    /* Keep the index at most half full */
+    if ((list->npar + 1) * 2 > list->nslots &&
+        virTypedParamListIndexGrow(list) < 0)
+        return NULL;
+
+    if (VIR_RESIZE_N(list->par, list->par_alloc, list->npar, 1) < 0)
+        return NULL;
+
+    par = list->par + list->npar;
+    memset(par, 0, sizeof(*par));
+
+    len = vsnprintf(par->field, VIR_TYPED_PARAM_FIELD_LENGTH, namefmt, ap);
+    if (len < 0 || len >= VIR_TYPED_PARAM_FIELD_LENGTH) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Field name '%s' too long"), par->field);
+        return NULL;
+    }
+
+    slot = virTypedParamListIndexSlot(list, par->field);
+    if (list->slots[slot]) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("Parameter '%s' is already set"), par->field);
+        return NULL;
+    }
+
+    list->slots[slot] = ++list->npar;
+    return par;
+}
+
+
+void
+virTypedParamListFree(virTypedParamListPtr list)
+{
+    if (!list)
+        return;
+
+    virTypedParamsFree(list->par, list->npar);
+    VIR_FREE(list->slots);
+    VIR_FREE(list);
+}
+
+
+/**
+ * virTypedParamListStealParams:
+ * @list: list of parameters
+ * @params: filled with the array of parameters in @list
+ *
+ * Passes the ownership of the parameters to the caller, who has to free
+ * them with virTypedParamsFree(). @list is left empty.
+ *
+ * Returns the number of parameters stored in @params.
+ */
+size_t
+virTypedParamListStealParams(virTypedParamListPtr list,
+                             virTypedParameterPtr *params)
+{
+    size_t ret = list->npar;
+
+    *params = list->par;
+    list->par = NULL;
+    list->npar = 0;
+    list->par_alloc = 0;
+    VIR_FREE(list->slots);
+    list->nslots = 0;
+
+    return ret;
+}
+
+
+/**
+ * virTypedParamListGet:
+ * @list: list of parameters
+ * @name: name of the parameter to find
+ *
+ * Returns the parameter called @name, or NULL if @list doesn't have it.
+ */
+virTypedParameterPtr
+virTypedParamListGet(virTypedParamListPtr list,
+                     const char *name)
+{
+    size_t slot;
+
+    if (!list->nslots)
+        return NULL;
+
+    slot = virTypedParamListIndexSlot(list, name);
+    if (!list->slots[slot])
+        return NULL;
+
+    return list->par + list->slots[slot] - 1;
+}
+
+
+/**
+ * virTypedParamListAddInt:
+ * @list: list of parameters
+ * @value: the value to store
+ * @namefmt: printf-style format of the name of the new parameter
+ *
+ * Appends a new parameter with int type to @list. The function fails
+ * with VIR_ERR_INVALID_ARG error if @list already contains a parameter
+ * with the same name. The other virTypedParamListAdd*() functions work
+ * the same way with the other types.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virTypedParamListAddInt(virTypedParamListPtr list,
+                        int value,
+                        const char *namefmt,
+                        ...)
+{
+    virTypedParameterPtr par;
+    va_list ap;
+
+    va_start(ap, namefmt);
+    par = virTypedParamListExtend(list, namefmt, ap);
+    va_end(ap);
+
+    if (!par)
+        return -1;
+
+    par->type = VIR_TYPED_PARAM_INT;
+    par->value.i = value;
+    return 0;
+}
+
+
+int
+virTypedParamListAddUInt(virTypedParamListPtr list,
+                         unsigned int value,
+                         const char *namefmt,
+                         ...)
+{
+    virTypedParameterPtr par;
+    va_list ap;
+
+    va_start(ap, namefmt);
+    par = virTypedParamListExtend(list, namefmt, ap);
+    va_end(ap);
+
+    if (!par)
+        return -1;
+
+    par->type = VIR_TYPED_PARAM_UINT;
+    par->value.ui = value;
+    return 0;
+}
+
+
+int
+virTypedParamListAddLLong(virTypedParamListPtr list,
+                          long long value,
+                          const char *namefmt,
+                          ...)
+{
+    virTypedParameterPtr par;
+    va_list ap;
+
+    va_start(ap, namefmt);
+    par = virTypedParamListExtend(list, namefmt, ap);
+    va_end(ap);
+
+    if (!par)
+        return -1;
+
+    par->type = VIR_TYPED_PARAM_LLONG;
+    par->value.l = value;
+    return 0;
+}
+
+
+int
+virTypedParamListAddULLong(virTypedParamListPtr list,
+                           unsigned long long value,
+                           const char *namefmt,
+                           ...)
+{
+    virTypedParameterPtr par;
+    va_list ap;
+
+    va_start(ap, namefmt);
+    par = virTypedParamListExtend(list, namefmt, ap);
+    va_end(ap);
+
+    if (!par)
+        return -1;
+
+    par->type = VIR_TYPED_PARAM_ULLONG;
+    par->value.ul = value;
+    return 0;
+}
+
+
+int
+virTypedParamListAddDouble(virTypedParamListPtr list,
+                           double value,
+                           const char *namefmt,
+                           ...)
+{
+    virTypedParameterPtr par;
+    va_list ap;
+
+    va_start(ap, namefmt);
+    par = virTypedParamListExtend(list, namefmt, ap);
+    va_end(ap);
+
+    if (!par)
+        return -1;
+
+    par->type = VIR_TYPED_PARAM_DOUBLE;
+    par->value.d = value;
+    return 0;
+}
+
+
+int
+virTypedParamListAddBoolean(virTypedParamListPtr list,
+                            bool value,
+                            const char *namefmt,
+                            ...)
+{
+    virTypedParameterPtr par;
+    va_list ap;
+
+    va_start(ap, namefmt);
+    par = virTypedParamListExtend(list, namefmt, ap);
+    va_end(ap);
+
+    if (!par)
+        return -1;
+
+    par->type = VIR_TYPED_PARAM_BOOLEAN;
+    par->value.b = value;
+    return 0;
+}
+
+
+int
+virTypedParamListAddString(virTypedParamListPtr list,
+                           const char *value,
+                           const char *namefmt,
+                           ...)
+{
+    virTypedParameterPtr par;
+    char *str;
+    va_list ap;
+
+    if (VIR_STRDUP(str, value) < 0)
+        return -1;
+
+    va_start(ap, namefmt);
+    par = virTypedParamListExtend(list, namefmt, ap);
+    va_end(ap);
+
+    if (!par) {
+        VIR_FREE(str);
+        return -1;
+    }
+
+    par->type = VIR_TYPED_PARAM_STRING;
+    par->value.s = str;
+    return 0;
+}
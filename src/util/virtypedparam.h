@@ -37,7 +37,7 @@
 verify(!(VIR_TYPED_PARAM_LAST & VIR_TYPED_PARAM_MULTIPLE));
 
 typedef struct _virTypedParameterRemoteValue virTypedParameterRemoteValue;
-typedef struct virTypedParameterRemoteValue *virTypedParameterRemoteValuePtr;
+typedef struct _virTypedParameterRemoteValue *virTypedParameterRemoteValuePtr;
 
 struct _virTypedParameterRemoteValue {
     int type;
@@ -106,6 +106,12 @@ char *virTypedParameterToString(virTypedParameterPtr param);
 void virTypedParamsRemoteFree(virTypedParameterRemotePtr remote_params_val,
                               unsigned int remote_params_len);
 
+int virTypedParameterDeserializeValue(const virTypedParameterRemoteValue *remote_value,
+                                      virTypedParameterPtr param);
+
+int virTypedParameterSerializeValue(virTypedParameterPtr param,
+                                    virTypedParameterRemoteValuePtr remote_value);
+
 int virTypedParamsDeserialize(virTypedParameterRemotePtr remote_params,
                               unsigned int remote_params_len,
                               int limit,
@@ -118,6 +124,65 @@ int virTypedParamsSerialize(virTypedParameterPtr params,
                             unsigned int *remote_params_len,
                             unsigned int flags);
 
+typedef struct _virTypedParamList virTypedParamList;
+typedef virTypedParamList *virTypedParamListPtr;
+
+struct _virTypedParamList {
+    virTypedParameterPtr par;
+    size_t npar;
+    size_t par_alloc;
+
+    /* Hashed by name, positions in @par plus one */
+    size_t *slots;
+    size_t nslots;
+};
+
+void virTypedParamListFree(virTypedParamListPtr list);
+
+size_t virTypedParamListStealParams(virTypedParamListPtr list,
+                                    virTypedParameterPtr *params)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+virTypedParameterPtr virTypedParamListGet(virTypedParamListPtr list,
+                                          const char *name)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+int virTypedParamListAddInt(virTypedParamListPtr list,
+                            int value,
+                            const char *namefmt,
+                            ...)
+    ATTRIBUTE_FMT_PRINTF(3, 4) ATTRIBUTE_RETURN_CHECK;
+int virTypedParamListAddUInt(virTypedParamListPtr list,
+                             unsigned int value,
+                             const char *namefmt,
+                             ...)
+    ATTRIBUTE_FMT_PRINTF(3, 4) ATTRIBUTE_RETURN_CHECK;
+int virTypedParamListAddLLong(virTypedParamListPtr list,
+                              long long value,
+                              const char *namefmt,
+                              ...)
+    ATTRIBUTE_FMT_PRINTF(3, 4) ATTRIBUTE_RETURN_CHECK;
+int virTypedParamListAddULLong(virTypedParamListPtr list,
+                               unsigned long long value,
+                               const char *namefmt,
+                               ...)
+    ATTRIBUTE_FMT_PRINTF(3, 4) ATTRIBUTE_RETURN_CHECK;
+int virTypedParamListAddDouble(virTypedParamListPtr list,
+                               double value,
+                               const char *namefmt,
+                               ...)
+    ATTRIBUTE_FMT_PRINTF(3, 4) ATTRIBUTE_RETURN_CHECK;
+int virTypedParamListAddBoolean(virTypedParamListPtr list,
+                                bool value,
+                                const char *namefmt,
+                                ...)
+    ATTRIBUTE_FMT_PRINTF(3, 4) ATTRIBUTE_RETURN_CHECK;
+int virTypedParamListAddString(virTypedParamListPtr list,
+                               const char *value,
+                               const char *namefmt,
+                               ...)
+    ATTRIBUTE_FMT_PRINTF(3, 4) ATTRIBUTE_RETURN_CHECK;
+
 VIR_ENUM_DECL(virTypedParameter)
 
 # define VIR_TYPED_PARAMS_DEBUG(params, nparams)                            \
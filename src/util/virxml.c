@@ -37,6 +37,8 @@
 #include "viralloc.h"
 #include "virfile.h"
 #include "virstring.h"
+#include "virhash.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_XML
 
@@ -56,6 +58,71 @@ struct virParserData {
  *									*
  ************************************************************************/
 
+/* Upper bound of compiled expressions cached by every thread. Most
+ * expressions are string literals, but some are built on the fly. */
+#define VIR_XPATH_CACHE_MAX 2048
+
+static virThreadLocal virXPathCache;
+
+static void
+virXPathCacheFree(void *opaque)
+{
+    virHashFree(opaque);
+}
+
+static void
+virXPathCacheDataFree(void *payload,
+                      const void *name ATTRIBUTE_UNUSED)
+{
+    xmlXPathFreeCompExpr(payload);
+}
+
+static int
+virXPathCacheOnceInit(void)
+{
+    return virThreadLocalInit(&virXPathCache, virXPathCacheFree);
+}
+
+VIR_ONCE_GLOBAL_INIT(virXPathCache)
+
+
+/* Evaluate @xpath in @ctxt. Parsing any object evaluates the same
+ * expressions over and over again, so each thread keeps the compiled
+ * form of the expressions it has used. Compiling without a context
+ * keeps the result independent of the document it was first used on. */
+static xmlXPathObjectPtr
+virXPathEval(const char *xpath,
+             xmlXPathContextPtr ctxt)
+{
+    virHashTablePtr cache = NULL;
+    xmlXPathCompExprPtr comp;
+    xmlXPathObjectPtr ret;
+
+    if (virXPathCacheInitialize() == 0 &&
+        !(cache = virThreadLocalGet(&virXPathCache)) &&
+        (cache = virHashCreate(64, virXPathCacheDataFree)) &&
+        virThreadLocalSet(&virXPathCache, cache) < 0) {
+        virHashFree(cache);
+        cache = NULL;
+    }
+
+    if (cache && (comp = virHashLookup(cache, xpath)))
+        return xmlXPathCompiledEval(comp, ctxt);
+
+    if (!(comp = xmlXPathCompile(BAD_CAST xpath)))
+        return NULL;
+
+    ret = xmlXPathCompiledEval(comp, ctxt);
+
+    if (!cache ||
+        virHashSize(cache) >= VIR_XPATH_CACHE_MAX ||
+        virHashAddEntry(cache, xpath, comp) < 0)
+        xmlXPathFreeCompExpr(comp);
+
+    return ret;
+}
+
+
 /**
  * virXPathString:
  * @xpath: the XPath string to evaluate
@@ -80,7 +147,7 @@ virXPathString(const char *xpath,
         return NULL;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_STRING) ||
         (obj->stringval == NULL) || (obj->stringval[0] == 0)) {
@@ -147,7 +214,7 @@ virXPathNumber(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_NUMBER) ||
         (isnan(obj->floatval))) {
@@ -176,7 +243,7 @@ virXPathLongBase(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -281,7 +348,7 @@ virXPathULongBase(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -397,7 +464,7 @@ virXPathULongLong(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -443,7 +510,7 @@ virXPathLongLong(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj != NULL) && (obj->type == XPATH_STRING) &&
         (obj->stringval != NULL) && (obj->stringval[0] != 0)) {
@@ -529,7 +596,7 @@ virXPathBoolean(const char *xpath,
         return -1;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_BOOLEAN) ||
         (obj->boolval < 0) || (obj->boolval > 1)) {
@@ -566,7 +633,7 @@ virXPathNode(const char *xpath,
         return NULL;
     }
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if ((obj == NULL) || (obj->type != XPATH_NODESET) ||
         (obj->nodesetval == NULL) || (obj->nodesetval->nodeNr <= 0) ||
@@ -610,7 +677,7 @@ virXPathNodeSet(const char *xpath,
         *list = NULL;
 
     relnode = ctxt->node;
-    obj = xmlXPathEval(BAD_CAST xpath, ctxt);
+    obj = virXPathEval(xpath, ctxt);
     ctxt->node = relnode;
     if (obj == NULL)
         return 0;
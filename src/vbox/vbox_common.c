@@ -113,6 +113,7 @@ vboxDriverDispose(void *obj)
 
     virObjectUnref(driver->caps);
     virObjectUnref(driver->xmlopt);
+    virMutexDestroy(&driver->machinesLock);
 }
 
 static int
@@ -140,6 +141,13 @@ vboxDriverObjNew(void)
     if (!(driver = virObjectLockableNew(vboxDriverClass)))
         return NULL;
 
+    if (virMutexInit(&driver->machinesLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize machine cache mutex"));
+        virObjectUnref(driver);
+        return NULL;
+    }
+
     if (!(driver->caps = vboxCapsInit()) ||
         !(driver->xmlopt = virDomainXMLOptionNew(&vboxDomainDefParserConfig,
                                                  NULL, NULL)))
@@ -152,6 +160,292 @@ vboxDriverObjNew(void)
     return NULL;
 }
 
+/*
+ * Listing and looking up domains used to walk IVirtualBox::machines
+ * and ask every single machine for its name, UUID and state over
+ * COM, on each call. The driver instead keeps the answers for all
+ * machines in driver->machines, in the order of IVirtualBox::machines
+ * so that the domain IDs (index + 1) do not change.
+ *
+ * A passive listener registered for the machine events of IVirtualBox
+ * tells which machines were registered, unregistered or changed since
+ * the last call; vboxMachineCacheAcquire() drains its queue and reads
+ * those machines again. Without a working listener the list is read
+ * afresh every time, as before.
+ */
+
+static void
+vboxMachineCacheClear(vboxDriverPtr data)
+{
+    size_t i;
+
+    for (i = 0; i < data->nmachines; i++)
+        VIR_FREE(data->machines[i].name);
+    VIR_FREE(data->machines);
+    data->nmachines = 0;
+    data->machinesValid = false;
+}
+
+/* Must be called with machinesLock held */
+static void
+vboxMachineCacheReset(vboxDriverPtr data)
+{
+    vboxMachineCacheClear(data);
+
+    if (data->machineEvents && data->machineListener)
+        gVBoxAPI.UIEventSource.UnregisterListener(data->machineEvents,
+                                                  data->machineListener);
+    VBOX_RELEASE(data->machineListener);
+    VBOX_RELEASE(data->machineEvents);
+}
+
+static int
+vboxMachineCacheFill(vboxDriverPtr data,
+                     IMachine *machine,
+                     vboxMachineCacheEntryPtr entry)
+{
+    PRBool isAccessible = PR_FALSE;
+    PRUnichar *machineNameUtf16 = NULL;
+    char *machineNameUtf8 = NULL;
+    vboxIID iid;
+    int ret = -1;
+
+    VIR_FREE(entry->name);
+    entry->accessible = false;
+    entry->state = 0;
+
+    if (!machine)
+        return 0;
+
+    VBOX_IID_INITIALIZE(&iid);
+    if (NS_SUCCEEDED(gVBoxAPI.UIMachine.GetId(machine, &iid))) {
+        vboxIIDToUUID(&iid, entry->uuid);
+        vboxIIDUnalloc(&iid);
+    }
+
+    gVBoxAPI.UIMachine.GetAccessible(machine, &isAccessible);
+    if (!isAccessible)
+        return 0;
+
+    gVBoxAPI.UIMachine.GetName(machine, &machineNameUtf16);
+    VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineNameUtf8);
+    if (VIR_STRDUP(entry->name, machineNameUtf8) < 0)
+        goto cleanup;
+
+    /* A machine without a name cannot be looked up */
+    gVBoxAPI.UIMachine.GetState(machine, &entry->state);
+    entry->accessible = !!entry->name;
+    ret = 0;
+
+ cleanup:
+    VBOX_UTF8_FREE(machineNameUtf8);
+    VBOX_COM_UNALLOC_MEM(machineNameUtf16);
+    return ret;
+}
+
+static int
+vboxMachineCacheListen(vboxDriverPtr data)
+{
+    if (NS_FAILED(gVBoxAPI.UIVirtualBox.GetEventSource(data->vboxObj,
+                                                       &data->machineEvents)) ||
+        !data->machineEvents ||
+        NS_FAILED(gVBoxAPI.UIEventSource.CreateListener(data->machineEvents,
+                                                        &data->machineListener)) ||
+        !data->machineListener)
+        goto error;
+
+    if (NS_FAILED(gVBoxAPI.UIEventSource.RegisterMachineListener(data->machineEvents,
+                                                                 data->machineListener)))
+        goto error;
+
+    return 0;
+
+ error:
+    VBOX_RELEASE(data->machineListener);
+    VBOX_RELEASE(data->machineEvents);
+    return -1;
+}
+
+static int
+vboxMachineCacheLoad(vboxDriverPtr data)
+{
+    vboxArray machines = VBOX_ARRAY_INITIALIZER;
+    nsresult rc;
+    size_t i;
+    int ret = -1;
+
+    vboxMachineCacheReset(data);
+
+    /* Listen before reading the list, so that no change is missed */
+    if (vboxMachineCacheListen(data) < 0)
+        VIR_DEBUG("Cannot listen for machine events, not caching machines");
+
+    rc = gVBoxAPI.UArray.vboxArrayGet(&machines, data->vboxObj, ARRAY_GET_MACHINES);
+    if (NS_FAILED(rc)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Could not get list of machines, rc=%08x"),
+                       (unsigned)rc);
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(data->machines, machines.count) < 0)
+        goto cleanup;
+    data->nmachines = machines.count;
+
+    for (i = 0; i < machines.count; i++) {
+        if (vboxMachineCacheFill(data, machines.items[i],
+                                 &data->machines[i]) < 0)
+            goto cleanup;
+    }
+
+    data->machinesValid = !!data->machineListener;
+    ret = 0;
+
+ cleanup:
+    if (ret < 0)
+        vboxMachineCacheReset(data);
+    gVBoxAPI.UArray.vboxArrayRelease(&machines);
+    return ret;
+}
+
+static int
+vboxMachineCacheApplyEvent(vboxDriverPtr data,
+                           IEvent *event)
+{
+    vboxMachineCacheEntry entry;
+    IMachine *machine = NULL;
+    vboxIID iid;
+    size_t i;
+    int ret = -1;
+
+    memset(&entry, 0, sizeof(entry));
+    VBOX_IID_INITIALIZE(&iid);
+
+    if (NS_FAILED(gVBoxAPI.UIEvent.GetMachineId(event, &iid)))
+        goto cleanup;
+    vboxIIDToUUID(&iid, entry.uuid);
+
+    for (i = 0; i < data->nmachines; i++) {
+        if (memcmp(data->machines[i].uuid, entry.uuid, VIR_UUID_BUFLEN) == 0)
+            break;
+    }
+
+    /* The event only says which machine changed; its current state is
+     * what matters, and an unknown machine is no longer registered */
+    if (NS_FAILED(gVBoxAPI.UIVirtualBox.GetMachine(data->vboxObj, &iid,
+                                                   &machine)) ||
+        !machine) {
+        if (i < data->nmachines) {
+            VIR_FREE(data->machines[i].name);
+            VIR_DELETE_ELEMENT(data->machines, i, data->nmachines);
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (i < data->nmachines) {
+        if (vboxMachineCacheFill(data, machine, &data->machines[i]) < 0)
+            goto cleanup;
+    } else {
+        /* New machines are appended to IVirtualBox::machines */
+        if (vboxMachineCacheFill(data, machine, &entry) < 0 ||
+            VIR_APPEND_ELEMENT(data->machines, data->nmachines, entry) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(entry.name);
+    VBOX_RELEASE(machine);
+    vboxIIDUnalloc(&iid);
+    return ret;
+}
+
+/**
+ * vboxMachineCacheAcquire:
+ * @data: driver
+ *
+ * Locks the machine cache and brings it up to date, so that the
+ * caller can look at data->machines until vboxMachineCacheRelease().
+ *
+ * Returns 0 on success, -1 (with the cache unlocked) on error.
+ */
+static int
+vboxMachineCacheAcquire(vboxDriverPtr data)
+{
+    IEvent *event = NULL;
+    int rc;
+
+    virMutexLock(&data->machinesLock);
+
+    while (data->machinesValid) {
+        if (NS_FAILED(gVBoxAPI.UIEventSource.GetEvent(data->machineEvents,
+                                                      data->machineListener,
+                                                      0, &event))) {
+            /* VirtualBox drops passive listeners which are not polled
+             * for a long time; start all over again */
+            VIR_DEBUG("Lost machine event listener, reloading machines");
+            data->machinesValid = false;
+            break;
+        }
+
+        if (!event)
+            return 0;
+
+        rc = vboxMachineCacheApplyEvent(data, event);
+        gVBoxAPI.UIEventSource.EventProcessed(data->machineEvents,
+                                              data->machineListener, event);
+        VBOX_RELEASE(event);
+        if (rc < 0)
+            data->machinesValid = false;
+    }
+
+    if (vboxMachineCacheLoad(data) < 0) {
+        virMutexUnlock(&data->machinesLock);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+vboxMachineCacheRelease(vboxDriverPtr data)
+{
+    virMutexUnlock(&data->machinesLock);
+}
+
+/* Returns the libvirt ID of the domain at @idx in the cache */
+static int
+vboxMachineCacheGetID(vboxDriverPtr data, size_t idx)
+{
+    vboxMachineCacheEntryPtr entry = &data->machines[idx];
+
+    if (entry->accessible &&
+        gVBoxAPI.machineStateChecker.Online(entry->state))
+        return idx + 1;
+    return -1;
+}
+
+static vboxMachineCacheEntryPtr
+vboxMachineCacheFindByName(vboxDriverPtr data,
+                           const char *name,
+                           size_t *idx)
+{
+    size_t i;
+
+    for (i = 0; i < data->nmachines; i++) {
+        if (data->machines[i].accessible &&
+            STREQ(data->machines[i].name, name)) {
+            if (idx)
+                *idx = i;
+            return &data->machines[i];
+        }
+    }
+
+    return NULL;
+}
+
 static int
 vboxExtractVersion(void)
 {
@@ -217,6 +511,10 @@ vboxSdkUninitialize(void)
     if (vbox_driver->connectionCount > 0)
         return;
 
+    virMutexLock(&vbox_driver->machinesLock);
+    vboxMachineCacheReset(vbox_driver);
+    virMutexUnlock(&vbox_driver->machinesLock);
+
     gVBoxAPI.UPFN.Uninitialize(vbox_driver);
 }
 
@@ -667,102 +965,58 @@ static char *vboxConnectGetCapabilities(virConnectPtr conn)
 static int vboxConnectListDomains(virConnectPtr conn, int *ids, int nids)
 {
     vboxDriverPtr data = conn->privateData;
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    PRUint32 state;
-    nsresult rc;
     size_t i, j;
+    int id;
     int ret = -1;
 
     if (!data->vboxObj)
         return ret;
 
-    rc = gVBoxAPI.UArray.vboxArrayGet(&machines, data->vboxObj, ARRAY_GET_MACHINES);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of Domains, rc=%08x"),
-                       (unsigned)rc);
-        goto cleanup;
-    }
+    if (vboxMachineCacheAcquire(data) < 0)
+        return ret;
 
     ret = 0;
-    for (i = 0, j = 0; (i < machines.count) && (j < nids); ++i) {
-        IMachine *machine = machines.items[i];
-
-        if (machine) {
-            PRBool isAccessible = PR_FALSE;
-            gVBoxAPI.UIMachine.GetAccessible(machine, &isAccessible);
-            if (isAccessible) {
-                gVBoxAPI.UIMachine.GetState(machine, &state);
-                if (gVBoxAPI.machineStateChecker.Online(state)) {
-                    ret++;
-                    ids[j++] = i + 1;
-                }
-            }
+    for (i = 0, j = 0; (i < data->nmachines) && (j < nids); ++i) {
+        if ((id = vboxMachineCacheGetID(data, i)) > 0) {
+            ret++;
+            ids[j++] = id;
         }
     }
 
- cleanup:
-    gVBoxAPI.UArray.vboxArrayRelease(&machines);
+    vboxMachineCacheRelease(data);
     return ret;
 }
 
 static int vboxConnectNumOfDomains(virConnectPtr conn)
 {
     vboxDriverPtr data = conn->privateData;
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    PRUint32 state;
-    nsresult rc;
     size_t i;
     int ret = -1;
 
     if (!data->vboxObj)
         return ret;
 
-    rc = gVBoxAPI.UArray.vboxArrayGet(&machines, data->vboxObj, ARRAY_GET_MACHINES);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get number of Domains, rc=%08x"), (unsigned)rc);
-        goto cleanup;
-    }
+    if (vboxMachineCacheAcquire(data) < 0)
+        return ret;
 
     ret = 0;
-    for (i = 0; i < machines.count; ++i) {
-        IMachine *machine = machines.items[i];
-
-        if (machine) {
-            PRBool isAccessible = PR_FALSE;
-            gVBoxAPI.UIMachine.GetAccessible(machine, &isAccessible);
-            if (isAccessible) {
-                gVBoxAPI.UIMachine.GetState(machine, &state);
-                if (gVBoxAPI.machineStateChecker.Online(state))
-                    ret++;
-            }
-        }
+    for (i = 0; i < data->nmachines; ++i) {
+        if (vboxMachineCacheGetID(data, i) > 0)
+            ret++;
     }
 
- cleanup:
-    gVBoxAPI.UArray.vboxArrayRelease(&machines);
+    vboxMachineCacheRelease(data);
     return ret;
 }
 
 static virDomainPtr vboxDomainLookupByID(virConnectPtr conn, int id)
 {
     vboxDriverPtr data = conn->privateData;
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    IMachine *machine;
-    PRBool isAccessible = PR_FALSE;
-    PRUnichar *machineNameUtf16 = NULL;
-    char *machineNameUtf8 = NULL;
-    vboxIID iid;
-    unsigned char uuid[VIR_UUID_BUFLEN];
-    PRUint32 state;
-    nsresult rc;
     virDomainPtr ret = NULL;
 
     if (!data->vboxObj)
         return ret;
 
-    VBOX_IID_INITIALIZE(&iid);
     /* Internal vbox IDs start from 0, the public libvirt ID
      * starts from 1, so refuse id == 0, and adjust the rest*/
     if (id == 0) {
@@ -770,53 +1024,16 @@ static virDomainPtr vboxDomainLookupByID(virConnectPtr conn, int id)
                        _("no domain with matching id %d"), id);
         return NULL;
     }
-    id = id - 1;
 
-    rc = gVBoxAPI.UArray.vboxArrayGet(&machines, data->vboxObj, ARRAY_GET_MACHINES);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of machines, rc=%08x"), (unsigned)rc);
+    if (vboxMachineCacheAcquire(data) < 0)
         return NULL;
-    }
 
-    if (id >= machines.count)
-        goto cleanup;
+    if (id > 0 && id <= (int) data->nmachines &&
+        vboxMachineCacheGetID(data, id - 1) == id)
+        ret = virGetDomain(conn, data->machines[id - 1].name,
+                           data->machines[id - 1].uuid, id);
 
-    machine = machines.items[id];
-
-    if (!machine)
-        goto cleanup;
-
-    isAccessible = PR_FALSE;
-    gVBoxAPI.UIMachine.GetAccessible(machine, &isAccessible);
-    if (!isAccessible)
-        goto cleanup;
-
-    gVBoxAPI.UIMachine.GetState(machine, &state);
-    if (!gVBoxAPI.machineStateChecker.Online(state))
-        goto cleanup;
-
-    gVBoxAPI.UIMachine.GetName(machine, &machineNameUtf16);
-    VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineNameUtf8);
-
-    gVBoxAPI.UIMachine.GetId(machine, &iid);
-    vboxIIDToUUID(&iid, uuid);
-    vboxIIDUnalloc(&iid);
-
-    /* get a new domain pointer from virGetDomain, if it fails
-     * then no need to assign the id, else assign the id, cause
-     * it is -1 by default. rest is taken care by virGetDomain
-     * itself, so need not worry.
-     */
-
-    ret = virGetDomain(conn, machineNameUtf8, uuid, id + 1);
-
-    /* Cleanup all the XPCOM allocated stuff here */
-    VBOX_UTF8_FREE(machineNameUtf8);
-    VBOX_UTF16_FREE(machineNameUtf16);
-
- cleanup:
-    gVBoxAPI.UArray.vboxArrayRelease(&machines);
+    vboxMachineCacheRelease(data);
     return ret;
 }
 
@@ -824,71 +1041,27 @@ virDomainPtr vboxDomainLookupByUUID(virConnectPtr conn,
                                     const unsigned char *uuid)
 {
     vboxDriverPtr data = conn->privateData;
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    vboxIID iid;
-    char *machineNameUtf8 = NULL;
-    PRUnichar *machineNameUtf16 = NULL;
-    unsigned char iid_as_uuid[VIR_UUID_BUFLEN];
     size_t i;
-    bool matched = false;
-    nsresult rc;
     virDomainPtr ret = NULL;
 
     if (!data->vboxObj)
         return ret;
 
-    VBOX_IID_INITIALIZE(&iid);
-    rc = gVBoxAPI.UArray.vboxArrayGet(&machines, data->vboxObj, ARRAY_GET_MACHINES);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of machines, rc=%08x"), (unsigned)rc);
+    if (vboxMachineCacheAcquire(data) < 0)
         return NULL;
-    }
-
-    for (i = 0; i < machines.count; ++i) {
-        IMachine *machine = machines.items[i];
-        PRBool isAccessible = PR_FALSE;
-
-        if (!machine)
-            continue;
-
-        gVBoxAPI.UIMachine.GetAccessible(machine, &isAccessible);
-        if (!isAccessible)
-            continue;
-
-        rc = gVBoxAPI.UIMachine.GetId(machine, &iid);
-        if (NS_FAILED(rc))
-            continue;
-        vboxIIDToUUID(&iid, iid_as_uuid);
-        vboxIIDUnalloc(&iid);
-
-        if (memcmp(uuid, iid_as_uuid, VIR_UUID_BUFLEN) == 0) {
-            PRUint32 state;
-            int id = -1;
 
+    for (i = 0; i < data->nmachines; ++i) {
+        vboxMachineCacheEntryPtr entry = &data->machines[i];
 
-            matched = true;
-
-            gVBoxAPI.UIMachine.GetName(machine, &machineNameUtf16);
-            VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineNameUtf8);
-
-            gVBoxAPI.UIMachine.GetState(machine, &state);
-
-            if (gVBoxAPI.machineStateChecker.Online(state))
-                id = i + 1;
-
-            ret = virGetDomain(conn, machineNameUtf8, iid_as_uuid, id);
-         }
-
-         if (matched)
-             break;
+        if (entry->accessible &&
+            memcmp(uuid, entry->uuid, VIR_UUID_BUFLEN) == 0) {
+            ret = virGetDomain(conn, entry->name, entry->uuid,
+                               vboxMachineCacheGetID(data, i));
+            break;
+        }
     }
 
-    /* Do the cleanup and take care you dont leak any memory */
-    VBOX_UTF8_FREE(machineNameUtf8);
-    VBOX_COM_UNALLOC_MEM(machineNameUtf16);
-    gVBoxAPI.UArray.vboxArrayRelease(&machines);
-
+    vboxMachineCacheRelease(data);
     return ret;
 }
 
@@ -896,67 +1069,21 @@ static virDomainPtr
 vboxDomainLookupByName(virConnectPtr conn, const char *name)
 {
     vboxDriverPtr data = conn->privateData;
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    vboxIID iid;
-    char *machineNameUtf8 = NULL;
-    PRUnichar *machineNameUtf16 = NULL;
-    unsigned char uuid[VIR_UUID_BUFLEN];
-    size_t i;
-    bool matched = false;
-    nsresult rc;
+    vboxMachineCacheEntryPtr entry;
+    size_t idx;
     virDomainPtr ret = NULL;
 
     if (!data->vboxObj)
         return ret;
 
-    VBOX_IID_INITIALIZE(&iid);
-    rc = gVBoxAPI.UArray.vboxArrayGet(&machines, data->vboxObj, ARRAY_GET_MACHINES);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of machines, rc=%08x"), (unsigned)rc);
+    if (vboxMachineCacheAcquire(data) < 0)
         return NULL;
-    }
-
-    for (i = 0; i < machines.count; ++i) {
-        IMachine *machine = machines.items[i];
-        PRBool isAccessible = PR_FALSE;
-
-        if (!machine)
-            continue;
-
-        gVBoxAPI.UIMachine.GetAccessible(machine, &isAccessible);
-        if (!isAccessible)
-            continue;
-
-        gVBoxAPI.UIMachine.GetName(machine, &machineNameUtf16);
-        VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineNameUtf8);
-
-        if (STREQ(name, machineNameUtf8)) {
-            PRUint32 state;
-            int id = -1;
-
-            matched = true;
-
-            gVBoxAPI.UIMachine.GetId(machine, &iid);
-            vboxIIDToUUID(&iid, uuid);
-            vboxIIDUnalloc(&iid);
-
-            gVBoxAPI.UIMachine.GetState(machine, &state);
-
-            if (gVBoxAPI.machineStateChecker.Online(state))
-                id = i + 1;
-
-            ret = virGetDomain(conn, machineNameUtf8, uuid, id);
-        }
 
-        VBOX_UTF8_FREE(machineNameUtf8);
-        VBOX_COM_UNALLOC_MEM(machineNameUtf16);
-        if (matched)
-            break;
-    }
-
-    gVBoxAPI.UArray.vboxArrayRelease(&machines);
+    if ((entry = vboxMachineCacheFindByName(data, name, &idx)))
+        ret = virGetDomain(conn, entry->name, entry->uuid,
+                           vboxMachineCacheGetID(data, idx));
 
+    vboxMachineCacheRelease(data);
     return ret;
 }
 
@@ -2739,83 +2866,65 @@ static int vboxDomainSetMemory(virDomainPtr dom, unsigned long memory)
 static int vboxDomainGetInfo(virDomainPtr dom, virDomainInfoPtr info)
 {
     vboxDriverPtr data = dom->conn->privateData;
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    char *machineName = NULL;
-    PRUnichar *machineNameUtf16 = NULL;
+    vboxMachineCacheEntryPtr entry;
+    IMachine *machine = NULL;
+    ISystemProperties *systemProperties = NULL;
+    vboxIID iid;
+    PRUint32 CPUCount = 0;
+    PRUint32 memorySize = 0;
+    PRUint32 state;
+    PRUint32 maxMemorySize = 4 * 1024;
     nsresult rc;
-    size_t i = 0;
     int ret = -1;
 
     if (!data->vboxObj)
         return ret;
 
-    rc = gVBoxAPI.UArray.vboxArrayGet(&machines, data->vboxObj, ARRAY_GET_MACHINES);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of machines, rc=%08x"), (unsigned)rc);
-        goto cleanup;
-    }
-
-    info->nrVirtCpu = 0;
-    for (i = 0; i < machines.count; ++i) {
-        IMachine *machine = machines.items[i];
-        PRBool isAccessible = PR_FALSE;
-
-        if (!machine)
-            continue;
+    VBOX_IID_INITIALIZE(&iid);
 
-        gVBoxAPI.UIMachine.GetAccessible(machine, &isAccessible);
-        if (!isAccessible)
-            continue;
+    if (vboxMachineCacheAcquire(data) < 0)
+        return ret;
 
-        gVBoxAPI.UIMachine.GetName(machine, &machineNameUtf16);
-        VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineName);
-
-        if (STREQ(dom->name, machineName)) {
-            /* Get the Machine State (also match it with
-            * virDomainState). Get the Machine memory and
-            * for time being set max_balloon and cur_balloon to same
-            * Also since there is no direct way of checking
-            * the cputime required (one condition being the
-            * VM is remote), return zero for cputime. Get the
-            * number of CPU.
-            */
-            PRUint32 CPUCount = 0;
-            PRUint32 memorySize = 0;
-            PRUint32 state;
-            PRUint32 maxMemorySize = 4 * 1024;
-            ISystemProperties *systemProperties = NULL;
-
-            gVBoxAPI.UIVirtualBox.GetSystemProperties(data->vboxObj, &systemProperties);
-            if (systemProperties) {
-                gVBoxAPI.UISystemProperties.GetMaxGuestRAM(systemProperties, &maxMemorySize);
-                VBOX_RELEASE(systemProperties);
-                systemProperties = NULL;
-            }
+    if ((entry = vboxMachineCacheFindByName(data, dom->name, NULL)))
+        vboxIIDFromUUID(&iid, entry->uuid);
+    vboxMachineCacheRelease(data);
 
-            gVBoxAPI.UIMachine.GetCPUCount(machine, &CPUCount);
-            gVBoxAPI.UIMachine.GetMemorySize(machine, &memorySize);
-            gVBoxAPI.UIMachine.GetState(machine, &state);
+    if (!entry)
+        goto cleanup;
 
-            info->cpuTime = 0;
-            info->nrVirtCpu = CPUCount;
-            info->memory = memorySize * 1024;
-            info->maxMem = maxMemorySize * 1024;
-            info->state = gVBoxAPI.vboxConvertState(state);
+    rc = gVBoxAPI.UIVirtualBox.GetMachine(data->vboxObj, &iid, &machine);
+    if (NS_FAILED(rc) || !machine)
+        goto cleanup;
 
-            ret = 0;
-        }
+    /* Get the Machine State (also match it with
+     * virDomainState). Get the Machine memory and
+     * for time being set max_balloon and cur_balloon to same
+     * Also since there is no direct way of checking
+     * the cputime required (one condition being the
+     * VM is remote), return zero for cputime. Get the
+     * number of CPU.
+     */
+    gVBoxAPI.UIVirtualBox.GetSystemProperties(data->vboxObj, &systemProperties);
+    if (systemProperties) {
+        gVBoxAPI.UISystemProperties.GetMaxGuestRAM(systemProperties, &maxMemorySize);
+        VBOX_RELEASE(systemProperties);
+    }
 
-        VBOX_UTF8_FREE(machineName);
-        VBOX_COM_UNALLOC_MEM(machineNameUtf16);
-        if (info->nrVirtCpu)
-            break;
+    gVBoxAPI.UIMachine.GetCPUCount(machine, &CPUCount);
+    gVBoxAPI.UIMachine.GetMemorySize(machine, &memorySize);
+    gVBoxAPI.UIMachine.GetState(machine, &state);
 
-    }
+    info->cpuTime = 0;
+    info->nrVirtCpu = CPUCount;
+    info->memory = memorySize * 1024;
+    info->maxMem = maxMemorySize * 1024;
+    info->state = gVBoxAPI.vboxConvertState(state);
 
-    gVBoxAPI.UArray.vboxArrayRelease(&machines);
+    ret = 0;
 
  cleanup:
+    VBOX_RELEASE(machine);
+    vboxIIDUnalloc(&iid);
     return ret;
 }
 
@@ -3922,105 +4031,60 @@ static int vboxConnectListDefinedDomains(virConnectPtr conn,
                                          char ** const names, int maxnames)
 {
     vboxDriverPtr data = conn->privateData;
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    char *machineName = NULL;
-    PRUnichar *machineNameUtf16 = NULL;
-    PRUint32 state;
-    nsresult rc;
     size_t i, j;
     int ret = -1;
 
     if (!data->vboxObj)
         return ret;
 
-    rc = gVBoxAPI.UArray.vboxArrayGet(&machines, data->vboxObj,
-                                      ARRAY_GET_MACHINES);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of Defined Domains, rc=%08x"),
-                       (unsigned)rc);
-        goto cleanup;
-    }
+    if (vboxMachineCacheAcquire(data) < 0)
+        return ret;
 
     memset(names, 0, sizeof(names[i]) * maxnames);
 
     ret = 0;
-    for (i = 0, j = 0; (i < machines.count) && (j < maxnames); i++) {
-        PRBool isAccessible = PR_FALSE;
-        IMachine *machine = machines.items[i];
-
-        if (!machine)
-            continue;
-
-        gVBoxAPI.UIMachine.GetAccessible(machine, &isAccessible);
-        if (!isAccessible)
-            continue;
+    for (i = 0, j = 0; (i < data->nmachines) && (j < maxnames); i++) {
+        vboxMachineCacheEntryPtr entry = &data->machines[i];
 
-        gVBoxAPI.UIMachine.GetState(machine, &state);
-        if (!gVBoxAPI.machineStateChecker.Inactive(state))
+        if (!entry->accessible ||
+            !gVBoxAPI.machineStateChecker.Inactive(entry->state))
             continue;
 
-        gVBoxAPI.UIMachine.GetName(machine, &machineNameUtf16);
-        VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineName);
-        if (VIR_STRDUP(names[j], machineName) < 0) {
-            VBOX_UTF16_FREE(machineNameUtf16);
-            VBOX_UTF8_FREE(machineName);
+        if (VIR_STRDUP(names[j], entry->name) < 0) {
             for (j = 0; j < maxnames; j++)
                 VIR_FREE(names[j]);
             ret = -1;
             goto cleanup;
         }
-        VBOX_UTF16_FREE(machineNameUtf16);
-        VBOX_UTF8_FREE(machineName);
         j++;
         ret++;
     }
 
  cleanup:
-    gVBoxAPI.UArray.vboxArrayRelease(&machines);
+    vboxMachineCacheRelease(data);
     return ret;
 }
 
 static int vboxConnectNumOfDefinedDomains(virConnectPtr conn)
 {
     vboxDriverPtr data = conn->privateData;
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    PRUint32 state;
-    nsresult rc;
     size_t i;
     int ret = -1;
 
     if (!data->vboxObj)
         return ret;
 
-    rc = gVBoxAPI.UArray.vboxArrayGet(&machines, data->vboxObj,
-                                      ARRAY_GET_MACHINES);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get number of Defined Domains, rc=%08x"),
-                       (unsigned)rc);
-        goto cleanup;
-    }
+    if (vboxMachineCacheAcquire(data) < 0)
+        return ret;
 
     ret = 0;
-    for (i = 0; i < machines.count; ++i) {
-        PRBool isAccessible = PR_FALSE;
-        IMachine *machine = machines.items[i];
-
-        if (!machine)
-            continue;
-
-        gVBoxAPI.UIMachine.GetAccessible(machine, &isAccessible);
-        if (!isAccessible)
-            continue;
-
-        gVBoxAPI.UIMachine.GetState(machine, &state);
-        if (gVBoxAPI.machineStateChecker.Inactive(state))
+    for (i = 0; i < data->nmachines; ++i) {
+        if (data->machines[i].accessible &&
+            gVBoxAPI.machineStateChecker.Inactive(data->machines[i].state))
             ret++;
     }
 
- cleanup:
-    gVBoxAPI.UArray.vboxArrayRelease(&machines);
+    vboxMachineCacheRelease(data);
     return ret;
 }
 
@@ -7271,10 +7335,7 @@ vboxConnectListAllDomains(virConnectPtr conn,
                           unsigned int flags)
 {
     vboxDriverPtr data = conn->privateData;
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    char *machineNameUtf8 = NULL;
-    PRUnichar *machineNameUtf16 = NULL;
-    unsigned char uuid[VIR_UUID_BUFLEN];
+    IMachine *machine = NULL;
     vboxIID iid;
     PRUint32 state;
     nsresult rc;
@@ -7304,102 +7365,80 @@ vboxConnectListAllDomains(virConnectPtr conn,
          !MATCH(VIR_CONNECT_LIST_DOMAINS_NO_MANAGEDSAVE))) {
         if (domains &&
             VIR_ALLOC_N(*domains, 1) < 0)
-            goto cleanup;
+            return -1;
 
-        ret = 0;
-        goto cleanup;
+        return 0;
     }
 
-    rc = gVBoxAPI.UArray.vboxArrayGet(&machines, data->vboxObj, ARRAY_GET_MACHINES);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of domains, rc=%08x"), (unsigned)rc);
-        goto cleanup;
-    }
+    VBOX_IID_INITIALIZE(&iid);
+
+    if (vboxMachineCacheAcquire(data) < 0)
+        return -1;
 
     if (domains &&
-        VIR_ALLOC_N(doms, machines.count + 1) < 0)
+        VIR_ALLOC_N(doms, data->nmachines + 1) < 0)
         goto cleanup;
 
-    for (i = 0; i < machines.count; i++) {
-        IMachine *machine = machines.items[i];
-        int id = -1;
+    for (i = 0; i < data->nmachines; i++) {
+        vboxMachineCacheEntryPtr entry = &data->machines[i];
 
-        if (!machine)
+        if (!entry->accessible)
             continue;
 
-        PRBool isAccessible = PR_FALSE;
-        gVBoxAPI.UIMachine.GetAccessible(machine, &isAccessible);
+        state = entry->state;
+        active = gVBoxAPI.machineStateChecker.Online(state);
 
-        if (!isAccessible)
+        /* filter by active state */
+        if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE) &&
+            !((MATCH(VIR_CONNECT_LIST_DOMAINS_ACTIVE) && active) ||
+              (MATCH(VIR_CONNECT_LIST_DOMAINS_INACTIVE) && !active)))
+            continue;
+
+        /* filter by snapshot existence, which is not cached */
+        if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_SNAPSHOT)) {
+            vboxIIDFromUUID(&iid, entry->uuid);
+            rc = gVBoxAPI.UIVirtualBox.GetMachine(data->vboxObj, &iid, &machine);
+            if (NS_SUCCEEDED(rc))
+                rc = gVBoxAPI.UIMachine.GetSnapshotCount(machine, &snapshotCount);
+            VBOX_RELEASE(machine);
+            vboxIIDUnalloc(&iid);
+            if (NS_FAILED(rc)) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("could not get snapshot count for listed domains"));
+                goto cleanup;
+            }
+            if (!((MATCH(VIR_CONNECT_LIST_DOMAINS_HAS_SNAPSHOT) &&
+                   snapshotCount > 0) ||
+                  (MATCH(VIR_CONNECT_LIST_DOMAINS_NO_SNAPSHOT) &&
+                   snapshotCount == 0)))
+                continue;
+        }
+
+        /* filter by machine state */
+        if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE) &&
+            !((MATCH(VIR_CONNECT_LIST_DOMAINS_RUNNING) &&
+               gVBoxAPI.machineStateChecker.Running(state)) ||
+              (MATCH(VIR_CONNECT_LIST_DOMAINS_PAUSED) &&
+               gVBoxAPI.machineStateChecker.Paused(state)) ||
+              (MATCH(VIR_CONNECT_LIST_DOMAINS_SHUTOFF) &&
+               gVBoxAPI.machineStateChecker.PoweredOff(state)) ||
+              (MATCH(VIR_CONNECT_LIST_DOMAINS_OTHER) &&
+               (!gVBoxAPI.machineStateChecker.Running(state) &&
+                !gVBoxAPI.machineStateChecker.Paused(state) &&
+                !gVBoxAPI.machineStateChecker.PoweredOff(state)))))
+            continue;
+
+        /* just count the machines */
+        if (!doms) {
+            count++;
             continue;
+        }
 
-      gVBoxAPI.UIMachine.GetState(machine, &state);
-
-      if (gVBoxAPI.machineStateChecker.Online(state))
-          active = true;
-      else
-          active = false;
-
-      /* filter by active state */
-      if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE) &&
-          !((MATCH(VIR_CONNECT_LIST_DOMAINS_ACTIVE) && active) ||
-            (MATCH(VIR_CONNECT_LIST_DOMAINS_INACTIVE) && !active)))
-          continue;
-
-      /* filter by snapshot existence */
-      if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_SNAPSHOT)) {
-          rc = gVBoxAPI.UIMachine.GetSnapshotCount(machine, &snapshotCount);
-          if (NS_FAILED(rc)) {
-              virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                             _("could not get snapshot count for listed domains"));
-              goto cleanup;
-          }
-          if (!((MATCH(VIR_CONNECT_LIST_DOMAINS_HAS_SNAPSHOT) &&
-                 snapshotCount > 0) ||
-                (MATCH(VIR_CONNECT_LIST_DOMAINS_NO_SNAPSHOT) &&
-                 snapshotCount == 0)))
-              continue;
-      }
-
-      /* filter by machine state */
-      if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE) &&
-          !((MATCH(VIR_CONNECT_LIST_DOMAINS_RUNNING) &&
-             gVBoxAPI.machineStateChecker.Running(state)) ||
-            (MATCH(VIR_CONNECT_LIST_DOMAINS_PAUSED) &&
-             gVBoxAPI.machineStateChecker.Paused(state)) ||
-            (MATCH(VIR_CONNECT_LIST_DOMAINS_SHUTOFF) &&
-             gVBoxAPI.machineStateChecker.PoweredOff(state)) ||
-            (MATCH(VIR_CONNECT_LIST_DOMAINS_OTHER) &&
-             (!gVBoxAPI.machineStateChecker.Running(state) &&
-              !gVBoxAPI.machineStateChecker.Paused(state) &&
-              !gVBoxAPI.machineStateChecker.PoweredOff(state)))))
-          continue;
-
-      /* just count the machines */
-      if (!doms) {
-          count++;
-          continue;
-      }
-
-      gVBoxAPI.UIMachine.GetName(machine, &machineNameUtf16);
-      VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineNameUtf8);
-      gVBoxAPI.UIMachine.GetId(machine, &iid);
-      vboxIIDToUUID(&iid, uuid);
-      vboxIIDUnalloc(&iid);
-
-      if (active)
-          id = i + 1;
-
-      dom = virGetDomain(conn, machineNameUtf8, uuid, id);
-
-      VBOX_UTF8_FREE(machineNameUtf8);
-      VBOX_UTF16_FREE(machineNameUtf16);
-
-      if (!dom)
-          goto cleanup;
-
-      doms[count++] = dom;
+        if (!(dom = virGetDomain(conn, entry->name, entry->uuid,
+                                 vboxMachineCacheGetID(data, i))))
+            goto cleanup;
+
+        doms[count++] = dom;
     }
 
     if (doms) {
@@ -7419,7 +7458,7 @@ vboxConnectListAllDomains(virConnectPtr conn,
     }
     VIR_FREE(doms);
 
-    gVBoxAPI.UArray.vboxArrayRelease(&machines);
+    vboxMachineCacheRelease(data);
     return ret;
 }
 #undef MATCH
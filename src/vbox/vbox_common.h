@@ -341,6 +341,9 @@ typedef nsISupports IHost;
 typedef nsISupports IHostNetworkInterface;
 typedef nsISupports IDHCPServer;
 typedef nsISupports IKeyboard;
+typedef nsISupports IEventSource;
+typedef nsISupports IEventListener;
+typedef nsISupports IEvent;
 
 /* Macros for all vbox drivers. */
 
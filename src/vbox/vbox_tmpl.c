@@ -611,6 +611,12 @@ _virtualboxGetHost(IVirtualBox *vboxObj, IHost **host)
     return vboxObj->vtbl->GetHost(vboxObj, host);
 }
 
+static nsresult
+_virtualboxGetEventSource(IVirtualBox *vboxObj, IEventSource **eventSource)
+{
+    return vboxObj->vtbl->GetEventSource(vboxObj, eventSource);
+}
+
 static nsresult
 _virtualboxCreateMachine(vboxDriverPtr data, virDomainDefPtr def, IMachine **machine, char *uuidstr ATTRIBUTE_UNUSED)
 {
@@ -2191,6 +2197,71 @@ _keyboardPutScancodes(IKeyboard *keyboard, PRUint32 scancodesSize,
                                         codesStored);
 }
 
+static nsresult
+_eventSourceCreateListener(IEventSource *eventSource,
+                           IEventListener **listener)
+{
+    return eventSource->vtbl->CreateListener(eventSource, listener);
+}
+
+static nsresult
+_eventSourceRegisterMachineListener(IEventSource *eventSource,
+                                    IEventListener *listener)
+{
+    /* Every event which can add or remove a machine, or change its
+     * name or state. The listener is passive, so the events queue up
+     * until they are fetched by GetEvent. */
+    PRUint32 interesting[] = {
+        VBoxEventType_OnMachineStateChanged,
+        VBoxEventType_OnMachineDataChanged,
+        VBoxEventType_OnMachineRegistered,
+    };
+
+    return eventSource->vtbl->RegisterListener(eventSource, listener,
+                                               ARRAY_CARDINALITY(interesting),
+                                               interesting, PR_FALSE);
+}
+
+static nsresult
+_eventSourceUnregisterListener(IEventSource *eventSource,
+                               IEventListener *listener)
+{
+    return eventSource->vtbl->UnregisterListener(eventSource, listener);
+}
+
+static nsresult
+_eventSourceGetEvent(IEventSource *eventSource, IEventListener *listener,
+                     PRInt32 timeout, IEvent **event)
+{
+    return eventSource->vtbl->GetEvent(eventSource, listener, timeout, event);
+}
+
+static nsresult
+_eventSourceEventProcessed(IEventSource *eventSource,
+                           IEventListener *listener, IEvent *event)
+{
+    return eventSource->vtbl->EventProcessed(eventSource, listener, event);
+}
+
+static nsresult
+_eventGetMachineId(IEvent *event, vboxIID *iid)
+{
+    nsID machineEventIID = IMACHINEEVENT_IID;
+    IMachineEvent *machineEvent = NULL;
+    nsresult rc;
+
+    rc = event->vtbl->nsisupports.QueryInterface((nsISupports *)event,
+                                                 &machineEventIID,
+                                                 (void **)&machineEvent);
+    if (NS_FAILED(rc))
+        return rc;
+
+    rc = machineEvent->vtbl->GetMachineId(machineEvent, &iid->value);
+    _nsisupportsRelease((nsISupports *)machineEvent);
+
+    return rc;
+}
+
 static bool _machineStateOnline(PRUint32 state)
 {
     return ((state >= MachineState_FirstOnline) &&
@@ -2274,6 +2345,7 @@ static vboxUniformedIVirtualBox _UIVirtualBox = {
     .OpenMachine = _virtualboxOpenMachine,
     .GetSystemProperties = _virtualboxGetSystemProperties,
     .GetHost = _virtualboxGetHost,
+    .GetEventSource = _virtualboxGetEventSource,
     .CreateMachine = _virtualboxCreateMachine,
     .CreateHardDisk = _virtualboxCreateHardDisk,
     .RegisterMachine = _virtualboxRegisterMachine,
@@ -2544,6 +2616,18 @@ static vboxUniformedIKeyboard _UIKeyboard = {
     .PutScancodes = _keyboardPutScancodes,
 };
 
+static vboxUniformedIEventSource _UIEventSource = {
+    .CreateListener = _eventSourceCreateListener,
+    .RegisterMachineListener = _eventSourceRegisterMachineListener,
+    .UnregisterListener = _eventSourceUnregisterListener,
+    .GetEvent = _eventSourceGetEvent,
+    .EventProcessed = _eventSourceEventProcessed,
+};
+
+static vboxUniformedIEvent _UIEvent = {
+    .GetMachineId = _eventGetMachineId,
+};
+
 static uniformedMachineStateChecker _machineStateChecker = {
     .Online = _machineStateOnline,
     .Inactive = _machineStateInactive,
@@ -2589,6 +2673,8 @@ void NAME(InstallUniformedAPI)(vboxUniformedAPI *pVBoxAPI)
     pVBoxAPI->UIHNInterface = _UIHNInterface;
     pVBoxAPI->UIDHCPServer = _UIDHCPServer;
     pVBoxAPI->UIKeyboard = _UIKeyboard;
+    pVBoxAPI->UIEventSource = _UIEventSource;
+    pVBoxAPI->UIEvent = _UIEvent;
     pVBoxAPI->machineStateChecker = _machineStateChecker;
 
 #if VBOX_API_VERSION >= 4001000
@@ -20,6 +20,7 @@
 # define VBOX_UNIFORMED_API_H
 
 # include "internal.h"
+# include "virthread.h"
 
 /* This file may be used in three place. That is vbox_tmpl.c,
  * vbox_common.c and vbox_driver.c. The vboxUniformedAPI and some
@@ -73,6 +74,15 @@ typedef union {
     PRInt32 resultCode;
 } resultCodeUnion;
 
+typedef struct _vboxMachineCacheEntry vboxMachineCacheEntry;
+typedef vboxMachineCacheEntry *vboxMachineCacheEntryPtr;
+struct _vboxMachineCacheEntry {
+    bool accessible;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char *name;
+    PRUint32 state;
+};
+
 
 struct _vboxDriver {
     virObjectLockable parent;
@@ -91,6 +101,15 @@ struct _vboxDriver {
 
     unsigned long version;
 
+    /* IVirtualBox::machines in the same order, kept current by the
+     * machine events of a passive listener; protected by machinesLock */
+    virMutex machinesLock;
+    bool machinesValid;
+    IEventSource *machineEvents;
+    IEventListener *machineListener;
+    vboxMachineCacheEntryPtr machines;
+    size_t nmachines;
+
     /* reference counting of vbox connections */
     int volatile connectionCount;
 };
@@ -157,6 +176,7 @@ typedef struct {
     nsresult (*OpenMachine)(IVirtualBox *vboxObj, PRUnichar *settingsFile, IMachine **machine);
     nsresult (*GetSystemProperties)(IVirtualBox *vboxObj, ISystemProperties **systemProperties);
     nsresult (*GetHost)(IVirtualBox *vboxObj, IHost **host);
+    nsresult (*GetEventSource)(IVirtualBox *vboxObj, IEventSource **eventSource);
     nsresult (*CreateMachine)(vboxDriverPtr driver, virDomainDefPtr def, IMachine **machine, char *uuidstr);
     nsresult (*CreateHardDisk)(IVirtualBox *vboxObj, PRUnichar *format, PRUnichar *location, IMedium **medium);
     nsresult (*RegisterMachine)(IVirtualBox *vboxObj, IMachine *machine);
@@ -496,6 +516,22 @@ typedef struct {
                              PRInt32 *scanCodes, PRUint32 *codesStored);
 } vboxUniformedIKeyboard;
 
+/* Functions for IEventSource */
+typedef struct {
+    nsresult (*CreateListener)(IEventSource *eventSource, IEventListener **listener);
+    nsresult (*RegisterMachineListener)(IEventSource *eventSource, IEventListener *listener);
+    nsresult (*UnregisterListener)(IEventSource *eventSource, IEventListener *listener);
+    nsresult (*GetEvent)(IEventSource *eventSource, IEventListener *listener,
+                         PRInt32 timeout, IEvent **event);
+    nsresult (*EventProcessed)(IEventSource *eventSource, IEventListener *listener,
+                               IEvent *event);
+} vboxUniformedIEventSource;
+
+/* Functions for IEvent */
+typedef struct {
+    nsresult (*GetMachineId)(IEvent *event, vboxIID *iid);
+} vboxUniformedIEvent;
+
 typedef struct {
     bool (*Online)(PRUint32 state);
     bool (*Inactive)(PRUint32 state);
@@ -543,6 +579,8 @@ typedef struct {
     vboxUniformedIHNInterface UIHNInterface;
     vboxUniformedIDHCPServer UIDHCPServer;
     vboxUniformedIKeyboard UIKeyboard;
+    vboxUniformedIEventSource UIEventSource;
+    vboxUniformedIEvent UIEvent;
     uniformedMachineStateChecker machineStateChecker;
     /* vbox API features */
     bool chipsetType;
@@ -0,0 +1,235 @@
+/*
+ * benchutils.c: microbenchmark utils
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "benchutils.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Calibrated runs last at least this long */
+#define BENCH_MIN_RUN_NS (100ull * 1000 * 1000)
+#define BENCH_MAX_ITERATIONS (1ull << 32)
+#define BENCH_DEFAULT_REPEAT 5
+
+
+static unsigned int
+virBenchGetFlag(const char *name,
+                unsigned int def)
+{
+    char *flagStr;
+    unsigned int flag;
+
+    if ((flagStr = getenv(name)) == NULL)
+        return def;
+
+    if (virStrToLong_ui(flagStr, NULL, 10, &flag) < 0)
+        return def;
+
+    return flag;
+}
+
+
+/**
+ * virBenchNow:
+ * @ns: filled with the current time in nanoseconds
+ *
+ * Reads a monotonic clock where available, which unlike
+ * virTimeMillisNow() has the resolution needed for short operations.
+ *
+ * Returns 0 on success, -1 on error with an error reported.
+ */
+int
+virBenchNow(unsigned long long *ns)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to read clock"));
+        return -1;
+    }
+
+    *ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#else
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to read clock"));
+        return -1;
+    }
+
+    *ns = tv.tv_sec * 1000000000ull + tv.tv_usec * 1000ull;
+#endif
+    return 0;
+}
+
+
+bool
+virBenchWanted(const char *name)
+{
+    const char *filter = getenv("VIR_BENCH_FILTER");
+
+    return !filter || strstr(name, filter);
+}
+
+
+static void
+virBenchPrint(const char *name,
+              unsigned long long iterations,
+              unsigned int repeat,
+              double median,
+              double min,
+              double max)
+{
+    if (virBenchGetFlag("VIR_BENCH_JSON", 0)) {
+        printf("{\"name\": \"%s\", \"iterations\": %llu, \"repeat\": %u, "
+               "\"ns_per_op\": %.1f, \"min_ns_per_op\": %.1f, "
+               "\"max_ns_per_op\": %.1f}\n",
+               name, iterations, repeat, median, min, max);
+    } else {
+        printf("%-36s %12llu x %u %14.1f ns/op (min %.1f, max %.1f)\n",
+               name, iterations, repeat, median, min, max);
+    }
+    fflush(stdout);
+}
+
+
+static int
+virBenchCompareDouble(const void *a,
+                      const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+
+static int
+virBenchTime(virBenchFunc func,
+             const void *opaque,
+             unsigned long long iterations,
+             unsigned long long *ns)
+{
+    unsigned long long start;
+    unsigned long long end;
+
+    if (virBenchNow(&start) < 0 ||
+        func(opaque, iterations) < 0 ||
+        virBenchNow(&end) < 0)
+        return -1;
+
+    *ns = end - start;
+    return 0;
+}
+
+
+/**
+ * virBenchRun:
+ * @name: name of the benchmark, such as "hash/lookup"
+ * @func: benchmark body
+ * @opaque: data passed to @func
+ *
+ * Unless VIR_BENCH_ITERATIONS is set, the number of iterations is
+ * doubled until a single run of @func takes long enough to be timed
+ * reliably. The configured number of runs is then timed and the
+ * median, fastest and slowest time per iteration are printed.
+ *
+ * Returns 0 on success (including when the benchmark is filtered
+ * out), -1 on error.
+ */
+int
+virBenchRun(const char *name,
+            virBenchFunc func,
+            const void *opaque)
+{
+    unsigned long long iterations = virBenchGetFlag("VIR_BENCH_ITERATIONS", 0);
+    unsigned int repeat = virBenchGetFlag("VIR_BENCH_REPEAT",
+                                          BENCH_DEFAULT_REPEAT);
+    unsigned long long ns;
+    double *samples = NULL;
+    unsigned int i;
+    int ret = -1;
+
+    if (!virBenchWanted(name))
+        return 0;
+
+    if (repeat == 0)
+        repeat = 1;
+
+    if (iterations == 0) {
+        iterations = 1;
+        while (true) {
+            if (virBenchTime(func, opaque, iterations, &ns) < 0)
+                goto cleanup;
+            if (ns >= BENCH_MIN_RUN_NS || iterations >= BENCH_MAX_ITERATIONS)
+                break;
+            iterations *= 2;
+        }
+    }
+
+    if (VIR_ALLOC_N(samples, repeat) < 0)
+        goto cleanup;
+
+    for (i = 0; i < repeat; i++) {
+        if (virBenchTime(func, opaque, iterations, &ns) < 0)
+            goto cleanup;
+        samples[i] = (double) ns / iterations;
+    }
+
+    qsort(samples, repeat, sizeof(*samples), virBenchCompareDouble);
+    virBenchPrint(name, iterations, repeat,
+                  samples[repeat / 2], samples[0], samples[repeat - 1]);
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(samples);
+    return ret;
+}
+
+
+/**
+ * virBenchReport:
+ * @name: name of the benchmark
+ * @iterations: number of operations performed
+ * @ns: total time they took
+ *
+ * Print the result of a benchmark which did its own timing, in the
+ * same format as virBenchRun() does.
+ */
+void
+virBenchReport(const char *name,
+               unsigned long long iterations,
+               unsigned long long ns)
+{
+    double per = iterations ? (double) ns / iterations : 0.0;
+
+    virBenchPrint(name, iterations, 1, per, per, per);
+}
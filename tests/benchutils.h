@@ -0,0 +1,60 @@
+/*
+ * benchutils.h: microbenchmark utils
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_BENCH_UTILS_H__
+# define __VIR_BENCH_UTILS_H__
+
+# include "internal.h"
+
+/*
+ * The behaviour of all benchmarks is controlled by these environment
+ * variables so that runs can be reproduced:
+ *
+ *   VIR_BENCH_JSON=1        print one JSON object per benchmark
+ *   VIR_BENCH_ITERATIONS=N  fixed number of iterations per run, instead
+ *                           of calibrating it to the run time
+ *   VIR_BENCH_REPEAT=N      number of timed runs (5 by default)
+ *   VIR_BENCH_FILTER=STR    only run benchmarks whose name contains STR
+ */
+
+/*
+ * A benchmark body performs @iterations operations on @opaque and
+ * returns 0 on success, -1 on error.
+ */
+typedef int (*virBenchFunc)(const void *opaque,
+                            unsigned long long iterations);
+
+int virBenchNow(unsigned long long *ns)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
+int virBenchRun(const char *name,
+                virBenchFunc func,
+                const void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+bool virBenchWanted(const char *name)
+    ATTRIBUTE_NONNULL(1);
+
+void virBenchReport(const char *name,
+                    unsigned long long iterations,
+                    unsigned long long ns)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_BENCH_UTILS_H__ */
@@ -79,6 +79,71 @@ static int testGetFilesystem(const void *opaque)
     return ret;
 }
 
+struct testParseDeviceListData {
+    const char *xml;
+    size_t ndevs;
+    const virDomainDeviceType *types;
+};
+
+static int testParseDeviceList(const void *opaque)
+{
+    int ret = -1;
+    virDomainDefPtr def = NULL;
+    char *filename = NULL;
+    const struct testParseDeviceListData *data = opaque;
+    virDomainDeviceDefPtr *devs = NULL;
+    size_t ndevs = 0;
+    size_t i;
+    int rc;
+
+    if (virAsprintf(&filename, "%s/domainconfdata/getfilesystem.xml",
+                    abs_srcdir) < 0)
+        goto cleanup;
+
+    if (!(def = virDomainDefParseFile(filename, caps, xmlopt, NULL, 0)))
+        goto cleanup;
+
+    rc = virDomainDeviceDefParseList(data->xml, def, caps, xmlopt,
+                                     VIR_DOMAIN_DEF_PARSE_INACTIVE,
+                                     &devs, &ndevs);
+    if (data->ndevs == 0) {
+        if (rc == 0) {
+            fprintf(stderr, "Unexpected success parsing '%s'\n", data->xml);
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (rc < 0)
+        goto cleanup;
+
+    if (ndevs != data->ndevs) {
+        fprintf(stderr, "Expected %zu devices, got %zu\n",
+                data->ndevs, ndevs);
+        goto cleanup;
+    }
+
+    for (i = 0; i < ndevs; i++) {
+        if (devs[i]->type != data->types[i]) {
+            fprintf(stderr, "Expected device %zu to be '%s', got '%s'\n", i,
+                    virDomainDeviceTypeToString(data->types[i]),
+                    virDomainDeviceTypeToString(devs[i]->type));
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < ndevs; i++)
+        virDomainDeviceDefFree(devs[i]);
+    VIR_FREE(devs);
+    virDomainDefFree(def);
+    VIR_FREE(filename);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -106,6 +171,45 @@ mymain(void)
     DO_TEST_GET_FS("/dev/pts", false);
     DO_TEST_GET_FS("/doesnotexist", false);
 
+#define DO_TEST_PARSE_DEVICES(name, devxml, ...)                        \
+    do {                                                                \
+        static const virDomainDeviceType types[] = { __VA_ARGS__ };     \
+        struct testParseDeviceListData data = {                         \
+            .xml = devxml,                                              \
+            .ndevs = ARRAY_CARDINALITY(types) - 1,                      \
+            .types = types,                                             \
+        };                                                              \
+        if (virTestRun("Parse devices " name,                           \
+                       testParseDeviceList, &data) < 0)                 \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_PARSE_DEVICES("single",
+                          "<disk type='file' device='disk'>"
+                          "  <source file='/var/lib/a.img'/>"
+                          "  <target dev='vdb' bus='virtio'/>"
+                          "</disk>",
+                          VIR_DOMAIN_DEVICE_DISK, VIR_DOMAIN_DEVICE_NONE);
+    DO_TEST_PARSE_DEVICES("list",
+                          "<devices>"
+                          "  <disk type='file' device='disk'>"
+                          "    <source file='/var/lib/a.img'/>"
+                          "    <target dev='vdb' bus='virtio'/>"
+                          "  </disk>"
+                          "  <!-- comments are skipped -->"
+                          "  <serial type='pty'/>"
+                          "  <interface type='user'/>"
+                          "</devices>",
+                          VIR_DOMAIN_DEVICE_DISK, VIR_DOMAIN_DEVICE_CHR,
+                          VIR_DOMAIN_DEVICE_NET, VIR_DOMAIN_DEVICE_NONE);
+    DO_TEST_PARSE_DEVICES("empty", "<devices/>", VIR_DOMAIN_DEVICE_NONE);
+    DO_TEST_PARSE_DEVICES("unknown",
+                          "<devices><disk type='file' device='disk'>"
+                          "  <source file='/var/lib/a.img'/>"
+                          "  <target dev='vdb' bus='virtio'/>"
+                          "</disk><bogus/></devices>",
+                          VIR_DOMAIN_DEVICE_NONE);
+
     virObjectUnref(caps);
     virObjectUnref(xmlopt);
 
@@ -38,6 +38,7 @@
 #include "virlog.h"
 #include "virutil.h"
 #include "vireventpoll.h"
+#include "viratomic.h"
 
 VIR_LOG_INIT("tests.eventtest");
 
@@ -316,6 +317,7 @@ mymain(void)
     size_t i;
     pthread_t eventThread;
     char one = '1';
+    FILE *tmp = NULL;
 
     for (i = 0; i < NUM_FDS; i++) {
         if (pipe(handles[i].pipeFD) < 0) {
@@ -523,6 +525,47 @@ mymain(void)
     if (finishJob("Write duplicate", 1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
+    resetAll();
+
+    /* Regular files can't be watched by epoll, yet they are always
+     * readable for poll() and so have to be dispatched right away */
+    if (!(tmp = tmpfile()) ||
+        safewrite(fileno(tmp), &one, 1) != 1 ||
+        lseek(fileno(tmp), 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Cannot create temporary file: %d", errno);
+        return EXIT_FAILURE;
+    }
+    handles[3].pipeFD[0] = fileno(tmp);
+    handles[3].watch = virEventPollAddHandle(handles[3].pipeFD[0],
+                                             VIR_EVENT_HANDLE_READABLE,
+                                             testPipeReader,
+                                             &handles[3], NULL);
+    handles[3].delete = handles[3].watch;
+    startJob();
+    if (finishJob("Regular file", 3, -1) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    VIR_FORCE_FCLOSE(tmp);
+
+    resetAll();
+
+    /* Handles registered with a key are serviced by the additional
+     * event loop threads, without the main loop being run */
+    if (virEventPollStartShards(2) < 0)
+        return EXIT_FAILURE;
+
+    handles[2].watch = virEventPollAddHandleKey(handles[2].pipeFD[0],
+                                                VIR_EVENT_HANDLE_READABLE,
+                                                testPipeReader,
+                                                &handles[2], NULL, 1);
+    handles[2].delete = handles[2].watch;
+    if (safewrite(handles[2].pipeFD[1], &one, 1) != 1)
+        return EXIT_FAILURE;
+    for (i = 0; i < 50 && !virAtomicIntGet(&handles[2].fired); i++)
+        usleep(100 * 1000);
+    if (verifyFired("Sharded write", 2, -1) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    testEventReport("Sharded write", 0, NULL);
+
     /* pthread_kill(eventThread, SIGTERM); */
 
     return EXIT_SUCCESS;
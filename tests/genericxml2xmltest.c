@@ -100,11 +100,16 @@ mymain(void)
 
     DO_TEST("vcpus-individual");
     DO_TEST("disk-network-http");
+    DO_TEST_DIFFERENT("disk-watermark");
 
     DO_TEST("cpu-cache-emulate");
     DO_TEST("cpu-cache-passthrough");
     DO_TEST("cpu-cache-disable");
 
+    DO_TEST("cachetune");
+    DO_TEST_FULL("cachetune-overlap", 0, false,
+        TEST_COMPARE_DOM_XML2XML_RESULT_FAIL_PARSE);
+
     virObjectUnref(caps);
     virObjectUnref(xmlopt);
 
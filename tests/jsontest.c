@@ -311,6 +311,273 @@ testJSONCopy(const void *data)
 }
 
 
+static bool
+testJSONFilterDrop(const char *const *path,
+                   size_t npath,
+                   void *opaque ATTRIBUTE_UNUSED)
+{
+    return STRNEQ(path[npath - 1], "drop");
+}
+
+
+static int
+testJSONFiltered(const void *data)
+{
+    const struct testInfo *info = data;
+    virJSONValuePtr json = NULL;
+    char *result = NULL;
+    int ret = -1;
+
+    json = virJSONValueFromStringFiltered(info->doc, testJSONFilterDrop, NULL);
+
+    if (!info->pass) {
+        if (json) {
+            VIR_TEST_VERBOSE("Should not have parsed %s\n", info->doc);
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!json) {
+        VIR_TEST_VERBOSE("Fail to parse %s\n", info->doc);
+        goto cleanup;
+    }
+
+    if (!(result = virJSONValueToString(json, false)))
+        goto cleanup;
+
+    if (STRNEQ(info->expect, result)) {
+        virTestDifference(stderr, info->expect, result);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(result);
+    virJSONValueFree(json);
+    return ret;
+}
+
+
+#define TEST_LARGE_OBJECT_KEYS 100
+
+static int
+testJSONLargeObject(const void *data ATTRIBUTE_UNUSED)
+{
+    virJSONValuePtr json = NULL;
+    virJSONValuePtr copy = NULL;
+    virJSONValuePtr value = NULL;
+    char key[32];
+    int num;
+    size_t i;
+    int ret = -1;
+
+    if (!(json = virJSONValueNewObject()))
+        goto cleanup;
+
+    for (i = 0; i < TEST_LARGE_OBJECT_KEYS; i++) {
+        snprintf(key, sizeof(key), "key%zu", i);
+        if (virJSONValueObjectAppendNumberInt(json, key, i) < 0)
+            goto cleanup;
+    }
+
+    if (virJSONValueObjectAppendNumberInt(json, "key42", 0) == 0) {
+        VIR_TEST_VERBOSE("duplicate key was accepted\n");
+        goto cleanup;
+    }
+
+    /* drop every other key, then put them back at the end */
+    for (i = 0; i < TEST_LARGE_OBJECT_KEYS; i += 2) {
+        snprintf(key, sizeof(key), "key%zu", i);
+        if (virJSONValueObjectRemoveKey(json, key, &value) != 1)
+            goto cleanup;
+        if (virJSONValueObjectHasKey(json, key) != 0 ||
+            virJSONValueObjectRemoveKey(json, key, NULL) != 0) {
+            VIR_TEST_VERBOSE("key '%s' still present\n", key);
+            goto cleanup;
+        }
+        if (virJSONValueObjectAppend(json, key, value) < 0)
+            goto cleanup;
+        value = NULL;
+    }
+
+    if (virJSONValueObjectKeysNumber(json) != TEST_LARGE_OBJECT_KEYS ||
+        STRNEQ_NULLABLE(virJSONValueObjectGetKey(json, 0), "key1") ||
+        STRNEQ_NULLABLE(virJSONValueObjectGetKey(json,
+                                                TEST_LARGE_OBJECT_KEYS - 1),
+                        "key98")) {
+        VIR_TEST_VERBOSE("unexpected key order\n");
+        goto cleanup;
+    }
+
+    if (!(copy = virJSONValueCopy(json)))
+        goto cleanup;
+
+    for (i = 0; i < TEST_LARGE_OBJECT_KEYS; i++) {
+        snprintf(key, sizeof(key), "key%zu", i);
+        if (virJSONValueObjectGetNumberInt(copy, key, &num) < 0 ||
+            num != (int) i) {
+            VIR_TEST_VERBOSE("wrong value for '%s'\n", key);
+            goto cleanup;
+        }
+    }
+
+    if (virJSONValueObjectGet(copy, "key100")) {
+        VIR_TEST_VERBOSE("lookup of missing key succeeded\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(json);
+    virJSONValueFree(copy);
+    virJSONValueFree(value);
+    return ret;
+}
+
+
+/* The writer must format a tree exactly like virJSONValueToString */
+static int
+testJSONWriter(const void *data)
+{
+    const struct testInfo *info = data;
+    virJSONValuePtr json = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
+    char *expect = NULL;
+    char *result = NULL;
+    int ret = -1;
+
+    if (!(json = virJSONValueFromString(info->doc))) {
+        VIR_TEST_VERBOSE("Fail to parse %s\n", info->doc);
+        goto cleanup;
+    }
+
+    if (!(expect = virJSONValueToString(json, false)))
+        goto cleanup;
+
+    virJSONWriterInit(&writer, &buf);
+    virJSONWriterValue(&writer, json);
+    if (virJSONWriterFinish(&writer) < 0)
+        goto cleanup;
+    result = virBufferContentAndReset(&buf);
+
+    if (STRNEQ(expect, result)) {
+        virTestDifference(stderr, expect, result);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(expect);
+    VIR_FREE(result);
+    virBufferFreeAndReset(&buf);
+    virJSONValueFree(json);
+    return ret;
+}
+
+
+static int
+testJSONWriterBuild(const void *data ATTRIBUTE_UNUSED)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONWriter writer;
+    virJSONValuePtr props = NULL;
+    virJSONValuePtr invalid = NULL;
+    char *result = NULL;
+    char *invalidStr = NULL;
+    const char *expect =
+        "{\"execute\":\"object-add\",\"arguments\":{\"id\":\"a\\\"b\\\\c\","
+        "\"size\":-1,\"max\":18446744073709551615,\"share\":true,"
+        "\"list\":[\"tab\\tnl\\n\\u001F\",null,[],{}],"
+        "\"props\":{\"x\":1},\"utf8\":\"\xc5\xbe\xe2\x82\xac\"}}";
+    int ret = -1;
+
+    if (virJSONValueObjectCreate(&props, "i:x", 1, NULL) < 0)
+        goto cleanup;
+
+    virJSONWriterInit(&writer, &buf);
+    virJSONWriterObjectStart(&writer);
+    virJSONWriterObjectAppendString(&writer, "execute", "object-add");
+    virJSONWriterKey(&writer, "arguments");
+    virJSONWriterObjectStart(&writer);
+    virJSONWriterObjectAppendString(&writer, "id", "a\"b\\c");
+    virJSONWriterObjectAppendNumberLong(&writer, "size", -1);
+    virJSONWriterObjectAppendNumberUlong(&writer, "max", ULLONG_MAX);
+    virJSONWriterObjectAppendBoolean(&writer, "share", true);
+    virJSONWriterKey(&writer, "list");
+    virJSONWriterArrayStart(&writer);
+    virJSONWriterString(&writer, "tab\tnl\n\x1f");
+    virJSONWriterNull(&writer);
+    virJSONWriterArrayStart(&writer);
+    virJSONWriterArrayEnd(&writer);
+    virJSONWriterObjectStart(&writer);
+    virJSONWriterObjectEnd(&writer);
+    virJSONWriterArrayEnd(&writer);
+    virJSONWriterObjectAppend(&writer, "props", props);
+    virJSONWriterObjectAppendString(&writer, "utf8", "\xc5\xbe\xe2\x82\xac");
+    virJSONWriterObjectEnd(&writer);
+    virJSONWriterObjectEnd(&writer);
+    if (virJSONWriterFinish(&writer) < 0)
+        goto cleanup;
+    result = virBufferContentAndReset(&buf);
+
+    if (STRNEQ(expect, result)) {
+        virTestDifference(stderr, expect, result);
+        goto cleanup;
+    }
+
+    /* Unbalanced documents and invalid UTF-8 must be refused */
+    virJSONWriterInit(&writer, &buf);
+    virJSONWriterArrayStart(&writer);
+    if (virJSONWriterFinish(&writer) == 0) {
+        VIR_TEST_VERBOSE("unterminated array was accepted\n");
+        goto cleanup;
+    }
+    virBufferFreeAndReset(&buf);
+
+    virJSONWriterInit(&writer, &buf);
+    virJSONWriterString(&writer, "\x80");
+    if (virJSONWriterFinish(&writer) == 0) {
+        VIR_TEST_VERBOSE("invalid UTF-8 was accepted\n");
+        goto cleanup;
+    }
+
+    virBufferFreeAndReset(&buf);
+
+    /* A truncated sequence is refused by virJSONValueToString too */
+    if (!(invalid = virJSONValueNewString("ok\xe2\x82")))
+        goto cleanup;
+
+    virJSONWriterInit(&writer, &buf);
+    virJSONWriterValue(&writer, invalid);
+    if (virJSONWriterFinish(&writer) == 0) {
+        VIR_TEST_VERBOSE("truncated UTF-8 was accepted\n");
+        goto cleanup;
+    }
+
+    if ((invalidStr = virJSONValueToString(invalid, false))) {
+        VIR_TEST_VERBOSE("truncated UTF-8 was formatted as %s\n", invalidStr);
+        goto cleanup;
+    }
+    virResetLastError();
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(result);
+    VIR_FREE(invalidStr);
+    virBufferFreeAndReset(&buf);
+    virJSONValueFree(props);
+    virJSONValueFree(invalid);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -448,6 +715,41 @@ mymain(void)
                  "{ \"a\": {}, \"b\": 1, \"c\": \"str\", \"d\": [] }",
                  NULL, true);
 
+    DO_TEST_FULL("filter nothing", Filtered,
+                 "{ \"a\": 1, \"b\": [ 2, { \"c\": null } ] }",
+                 "{\"a\":1,\"b\":[2,{\"c\":null}]}", true);
+    DO_TEST_FULL("filter scalars", Filtered,
+                 "{ \"drop\": 1, \"a\": { \"drop\": \"x\", \"b\": true } }",
+                 "{\"a\":{\"b\":true}}", true);
+    DO_TEST_FULL("filter containers", Filtered,
+                 "{ \"return\": [ { \"device\": \"ide0\", "
+                 "\"drop\": { \"drop\": [ 1, [ {}, { \"a\": [] } ] ], "
+                 "\"b\": {} } }, { \"drop\": [], \"device\": \"ide1\" } ] }",
+                 "{\"return\":[{\"device\":\"ide0\"},{\"device\":\"ide1\"}]}",
+                 true);
+    DO_TEST_FULL("filter everything", Filtered,
+                 "{ \"drop\": { \"a\": 1 } }", "{}", true);
+    DO_TEST_FULL("filter invalid", Filtered,
+                 "{ \"drop\": { \"a\": 1 ] }", NULL, false);
+
+    DO_TEST_FULL("large object", LargeObject, NULL, NULL, true);
+
+    DO_TEST_FULL("writer scalars", Writer,
+                 "[ 1, -2.5e10, true, false, null, \"str\" ]", NULL, true);
+    DO_TEST_FULL("writer nesting", Writer,
+                 "{ \"a\": [ {}, [], { \"b\": [ 1, { \"c\": {} } ] } ], "
+                 "\"d\": \"e\" }", NULL, true);
+    DO_TEST_FULL("writer escaping", Writer,
+                 "{ \"q\\\"uo\\\\te\": \"\\b\\f\\n\\r\\t\\u0001\\u001f "
+                 "\\u00e9\\u20ac\" }", NULL, true);
+    DO_TEST_FULL("writer unescaped", Writer,
+                 "[ \"a/b\", \"\\u007f\", \"\xf0\x9f\x98\x80\", \"\" ]",
+                 NULL, true);
+    DO_TEST_FULL("writer numbers", Writer,
+                 "[ 0, -0, 1e3, 0.5, 18446744073709551615, "
+                 "-9223372036854775808 ]", NULL, true);
+    DO_TEST_FULL("writer build", WriterBuild, NULL, NULL, true);
+
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
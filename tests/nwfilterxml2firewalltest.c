@@ -25,6 +25,7 @@
 
 # include "testutils.h"
 # include "nwfilter/nwfilter_ebiptables_driver.h"
+# include "nwfilter/nwfilter_nftables_driver.h"
 # include "virbuffer.h"
 
 # define __VIR_FIREWALL_PRIV_H_ALLOW__
@@ -369,8 +370,25 @@ static int testSetDefaultParameters(virNWFilterHashTablePtr vars)
     return 0;
 }
 
+/* nft reads its rules from stdin, record them along with the command */
+static void
+testCommandDryRunInput(const char *const*args ATTRIBUTE_UNUSED,
+                       const char *const*env ATTRIBUTE_UNUSED,
+                       const char *input,
+                       char **output ATTRIBUTE_UNUSED,
+                       char **error ATTRIBUTE_UNUSED,
+                       int *status ATTRIBUTE_UNUSED,
+                       void *opaque)
+{
+    virBufferPtr buf = opaque;
+
+    if (input)
+        virBufferAdd(buf, input, -1);
+}
+
 static int testCompareXMLToArgvFiles(const char *xml,
-                                     const char *cmdline)
+                                     const char *cmdline,
+                                     virNWFilterTechDriverPtr driver)
 {
     char *actualargv = NULL;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
@@ -380,7 +398,7 @@ static int testCompareXMLToArgvFiles(const char *xml,
 
     memset(&inst, 0, sizeof(inst));
 
-    virCommandSetDryRun(&buf, NULL, NULL);
+    virCommandSetDryRun(&buf, testCommandDryRunInput, &buf);
 
     if (!vars)
         goto cleanup;
@@ -393,7 +411,7 @@ static int testCompareXMLToArgvFiles(const char *xml,
                              &inst) < 0)
         goto cleanup;
 
-    if (ebiptables_driver.applyNewRules("vnet0", inst.rules, inst.nrules) < 0)
+    if (driver->applyNewRules("vnet0", inst.rules, inst.nrules) < 0)
         goto cleanup;
 
     if (virBufferError(&buf))
@@ -420,6 +438,8 @@ static int testCompareXMLToArgvFiles(const char *xml,
 
 struct testInfo {
     const char *name;
+    const char *suffix;
+    virNWFilterTechDriverPtr driver;
 };
 
 
@@ -433,11 +453,11 @@ testCompareXMLToIPTablesHelper(const void *data)
 
     if (virAsprintf(&xml, "%s/nwfilterxml2firewalldata/%s.xml",
                     abs_srcdir, info->name) < 0 ||
-        virAsprintf(&args, "%s/nwfilterxml2firewalldata/%s-%s.args",
-                    abs_srcdir, info->name, RULESTYPE) < 0)
+        virAsprintf(&args, "%s/nwfilterxml2firewalldata/%s-%s%s.args",
+                    abs_srcdir, info->name, RULESTYPE, info->suffix) < 0)
         goto cleanup;
 
-    result = testCompareXMLToArgvFiles(xml, args);
+    result = testCompareXMLToArgvFiles(xml, args, info->driver);
 
  cleanup:
     VIR_FREE(xml);
@@ -463,16 +483,26 @@ mymain(void)
     if (!abs_top_srcdir)
         abs_top_srcdir = abs_srcdir "/..";
 
-# define DO_TEST(name)                                                  \
+# define DO_TEST_FULL(name, suffix, driver)                             \
     do {                                                                \
         static struct testInfo info = {                                 \
-            name,                                                       \
+            name, suffix, &driver,                                      \
         };                                                              \
-        if (virTestRun("NWFilter XML-2-firewall " name,                 \
+        if (virTestRun("NWFilter XML-2-firewall " name suffix,          \
                        testCompareXMLToIPTablesHelper, &info) < 0)      \
             ret = -1;                                                   \
     } while (0)
 
+# define DO_TEST(name) \
+    DO_TEST_FULL(name, "", ebiptables_driver)
+
+# define DO_TEST_NFT(name) \
+    DO_TEST_FULL(name, "-nft", nftables_driver)
+
+/* filters the nftables driver passes on to ebiptables */
+# define DO_TEST_NFT_FALLBACK(name) \
+    DO_TEST_FULL(name, "", nftables_driver)
+
     virFirewallSetLockOverride(true);
 
     if (virFirewallSetBackend(VIR_FIREWALL_BACKEND_DIRECT) < 0) {
@@ -524,6 +554,13 @@ mymain(void)
     DO_TEST("udplite-ipv6");
     DO_TEST("vlan");
 
+    DO_TEST_NFT("mac");
+    DO_TEST_NFT("nft-chains");
+    DO_TEST_NFT("nft-sets");
+    DO_TEST_NFT_FALLBACK("arp");
+    DO_TEST_NFT_FALLBACK("stp");
+    DO_TEST_NFT_FALLBACK("tcp");
+
  cleanup:
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
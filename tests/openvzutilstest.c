@@ -134,6 +134,51 @@ testReadNetworkConf(const void *data ATTRIBUTE_UNUSED)
     return result;
 }
 
+static int
+testParseInventory(const void *data ATTRIBUTE_UNUSED)
+{
+    int result = -1;
+    openvzInventoryEntryPtr entries = NULL;
+    size_t nentries = 0;
+    const char *output =
+        "       101 running ct101.example.com\n"
+        "       102 stopped -\n"
+        "\n"
+        "      1005 mounted ct1005\n";
+
+    if (openvzParseInventory(output, &entries, &nentries) < 0) {
+        fprintf(stderr, "ERROR: %s\n", virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    if (nentries != 3 ||
+        entries[0].veid != 101 || !entries[0].active ||
+        STRNEQ(entries[0].hostname, "ct101.example.com") ||
+        entries[1].veid != 102 || entries[1].active ||
+        STRNEQ(entries[1].hostname, "-") ||
+        entries[2].veid != 1005 || !entries[2].active ||
+        STRNEQ(entries[2].hostname, "ct1005")) {
+        fprintf(stderr, "ERROR: unexpected inventory\n");
+        goto cleanup;
+    }
+
+    openvzInventoryEntriesFree(entries, nentries);
+    entries = NULL;
+
+    if (openvzParseInventory("       101 running\n",
+                             &entries, &nentries) == 0) {
+        fprintf(stderr, "ERROR: truncated line was accepted\n");
+        goto cleanup;
+    }
+
+    result = 0;
+
+ cleanup:
+    openvzInventoryEntriesFree(entries, nentries);
+
+    return result;
+}
+
 static int
 mymain(void)
 {
@@ -151,6 +196,7 @@ mymain(void)
 
     DO_TEST(ReadConfigParam);
     DO_TEST(ReadNetworkConf);
+    DO_TEST(ParseInventory);
 
     return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
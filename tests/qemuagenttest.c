@@ -53,9 +53,6 @@ testQemuAgentFSFreeze(const void *data)
                                "{ \"return\" : 5 }") < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItem(test, "guest-fsfreeze-freeze",
                                "{ \"return\" : 7 }") < 0)
         goto cleanup;
@@ -104,9 +101,6 @@ testQemuAgentFSThaw(const void *data)
                                "{ \"return\" : 5 }") < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItem(test, "guest-fsfreeze-thaw",
                                "{ \"return\" : 7 }") < 0)
         goto cleanup;
@@ -269,9 +263,6 @@ testQemuAgentGetFSInfo(const void *data)
         goto cleanup;
     }
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItem(test, "guest-get-fsinfo",
                                "{\"error\":"
                                "    {\"class\":\"CommandDisabled\","
@@ -563,9 +554,6 @@ testQemuAgentCPU(const void *data)
     if (qemuAgentUpdateCPUInfo(2, cpuinfo, nvcpus) < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItemParams(test, "guest-set-vcpus",
                                      "{ \"return\" : 1 }",
                                      "vcpus", testQemuAgentCPUArguments1,
@@ -576,18 +564,12 @@ testQemuAgentCPU(const void *data)
         goto cleanup;
 
     /* try to hotplug two, second one will fail*/
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItemParams(test, "guest-set-vcpus",
                                      "{ \"return\" : 1 }",
                                      "vcpus", testQemuAgentCPUArguments2,
                                      NULL) < 0)
         goto cleanup;
 
-    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
-        goto cleanup;
-
     if (qemuMonitorTestAddItemParams(test, "guest-set-vcpus",
                                      "{ \"error\" : \"random error\" }",
                                      "vcpus", testQemuAgentCPUArguments3,
@@ -902,6 +884,95 @@ testQemuAgentGetInterfaces(const void *data)
     return ret;
 }
 
+
+static int
+testQemuAgentGuestInfo(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewAgent(xmlopt);
+    qemuAgentGuestInfo info;
+    long long seconds;
+    unsigned int nseconds;
+    int ret = -1;
+
+    memset(&info, 0, sizeof(info));
+
+    if (!test)
+        return -1;
+
+    /* all commands go out after a single sync */
+    if (qemuMonitorTestAddAgentSyncResponse(test) < 0)
+        goto cleanup;
+
+    if (qemuMonitorTestAddItem(test, "guest-get-time",
+                               "{ \"return\" : 1500000000123456789 }") < 0 ||
+        qemuMonitorTestAddItem(test, "guest-get-host-name",
+                               "{ \"return\" : "
+                               "  { \"host-name\" : \"guest.example.com\" } }") < 0 ||
+        qemuMonitorTestAddItem(test, "guest-get-fsinfo",
+                               "{\"error\":"
+                               "    {\"class\":\"CommandDisabled\","
+                               "     \"desc\":\"The command guest-get-fsinfo "
+                                               "has been disabled for "
+                                               "this instance\","
+                               "     \"data\":{\"name\":\"guest-get-fsinfo\"}"
+                               "    }"
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "guest-network-get-interfaces",
+                               testQemuAgentGetInterfacesResponse) < 0)
+        goto cleanup;
+
+    if (qemuAgentGetGuestInfo(qemuMonitorTestGetAgent(test), NULL, &info) < 0)
+        goto cleanup;
+
+    if (!info.haveTime ||
+        info.seconds != 1500000000 || info.nseconds != 123456789) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "unexpected guest time");
+        goto cleanup;
+    }
+
+    if (STRNEQ_NULLABLE(info.hostname, "guest.example.com")) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "unexpected host name '%s'", NULLSTR(info.hostname));
+        goto cleanup;
+    }
+
+    if (info.nfs != -1 || info.fs) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "disabled guest-get-fsinfo should be skipped");
+        goto cleanup;
+    }
+
+    if (info.nifaces != 4 || STRNEQ(info.ifaces[3]->name, "lo")) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "expected 4 interfaces, got %d", info.nifaces);
+        goto cleanup;
+    }
+
+    /* the agent stays in sync, so no further guest-sync is sent */
+    if (qemuMonitorTestAddItem(test, "guest-get-time",
+                               "{ \"return\" : 42000000000 }") < 0)
+        goto cleanup;
+
+    if (qemuAgentGetTime(qemuMonitorTestGetAgent(test),
+                         &seconds, &nseconds) < 0)
+        goto cleanup;
+
+    if (seconds != 42 || nseconds != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "unexpected guest time %lld.%09u", seconds, nseconds);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuAgentGuestInfoClear(&info);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -931,6 +1002,7 @@ mymain(void)
     DO_TEST(CPU);
     DO_TEST(ArbitraryCommand);
     DO_TEST(GetInterfaces);
+    DO_TEST(GuestInfo);
 
     DO_TEST(Timeout); /* Timeout should always be called last */
 
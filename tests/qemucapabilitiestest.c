@@ -19,6 +19,8 @@
 
 #include <config.h>
 
+#include <unistd.h>
+
 #include "testutils.h"
 #include "testutilsqemu.h"
 #include "qemumonitortestutils.h"
@@ -126,6 +128,67 @@ testQemuCapsCopy(const void *opaque)
 }
 
 
+static int
+testQemuCapsBinary(const void *opaque)
+{
+    int ret = -1;
+    const testQemuData *data = opaque;
+    char *capsFile = NULL;
+    char *binFile = NULL;
+    virCapsPtr caps = NULL;
+    virQEMUCapsPtr orig = NULL;
+    virQEMUCapsPtr loaded = NULL;
+    char *actual = NULL;
+
+    if (virAsprintf(&capsFile, "%s/qemucapabilitiesdata/%s.%s.xml",
+                    abs_srcdir, data->base, data->archName) < 0 ||
+        virAsprintf(&binFile, "%s/qemucapabilitiestest-%s.%s.bin",
+                    abs_builddir, data->base, data->archName) < 0)
+        goto cleanup;
+
+    if (!(caps = virCapabilitiesNew(virArchFromString(data->archName),
+                                    false, false)))
+        goto cleanup;
+
+    if (!(orig = qemuTestParseCapabilities(caps, capsFile)))
+        goto cleanup;
+
+    if (virQEMUCapsSaveBinaryCache(orig, binFile, 0, 0) < 0)
+        goto cleanup;
+
+    if (!(loaded = virQEMUCapsNew()))
+        goto cleanup;
+
+    /* A cache written by a different libvirt must be ignored */
+    if (virQEMUCapsLoadBinaryCache(caps, loaded, binFile, 0, 1) != 0) {
+        VIR_TEST_VERBOSE("outdated binary cache was not rejected\n");
+        goto cleanup;
+    }
+
+    if (virQEMUCapsLoadBinaryCache(caps, loaded, binFile, 0, 0) != 1)
+        goto cleanup;
+
+    if (!(actual = virQEMUCapsFormatCache(loaded, 0, 0)))
+        goto cleanup;
+
+    if (virTestCompareToFile(actual, capsFile) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (binFile)
+        unlink(binFile);
+    VIR_FREE(capsFile);
+    VIR_FREE(binFile);
+    virObjectUnref(caps);
+    virObjectUnref(orig);
+    virObjectUnref(loaded);
+    VIR_FREE(actual);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -155,6 +218,9 @@ mymain(void)
         if (virTestRun("copy " name "(" arch ")",                       \
                        testQemuCapsCopy, &data) < 0)                    \
             ret = -1;                                                   \
+        if (virTestRun("binary " name "(" arch ")",                     \
+                       testQemuCapsBinary, &data) < 0)                  \
+            ret = -1;                                                   \
     } while (0)
 
     DO_TEST("x86_64", "caps_1.2.2");
@@ -0,0 +1,218 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <fcntl.h>
+
+#include "testutils.h"
+
+#ifdef WITH_QEMU
+
+# include "internal.h"
+# include "virfile.h"
+# include "virstring.h"
+# include "conf/domain_conf.h"
+
+# include "testutilsqemu.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+static virQEMUDriver driver;
+
+struct testInfo {
+    const char *xml_path;
+    bool live;
+};
+
+
+/* Clone @def the way virDomainDefCopy used to do it unconditionally,
+ * through the XML round-trip, and return the formatted result. */
+static char *
+testDomainCopyViaXML(virDomainDefPtr def)
+{
+    char *xml = NULL;
+    char *ret = NULL;
+    virDomainDefPtr copy = NULL;
+
+    if (!(xml = virDomainDefFormat(def, driver.caps,
+                                   VIR_DOMAIN_DEF_FORMAT_SECURE)))
+        goto cleanup;
+
+    if (!(copy = virDomainDefParseString(xml, driver.caps, driver.xmlopt, NULL,
+                                         VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                                         VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
+        goto cleanup;
+
+    ret = virDomainDefFormat(copy, driver.caps, VIR_DOMAIN_DEF_FORMAT_SECURE);
+
+ cleanup:
+    virDomainDefFree(copy);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static int
+testDomainCopy(const void *opaque)
+{
+    const struct testInfo *info = opaque;
+    virDomainDefPtr def = NULL;
+    virDomainDefPtr copy = NULL;
+    char *expected = NULL;
+    char *actual = NULL;
+    size_t i;
+    int ret = -1;
+
+    /* Not every input is a valid definition, some are used to test
+     * error reporting of the command line generator */
+    if (!(def = virDomainDefParseFile(info->xml_path, driver.caps,
+                                      driver.xmlopt, NULL,
+                                      VIR_DOMAIN_DEF_PARSE_INACTIVE))) {
+        virResetLastError();
+        ret = EXIT_AM_SKIP;
+        goto cleanup;
+    }
+
+    if (info->live) {
+        /* Pretend the domain is running so that runtime-only state is
+         * present and has to be dropped by both copies */
+        def->id = 1;
+        for (i = 0; i < def->ndisks; i++) {
+            if (virAsprintf(&def->disks[i]->info.alias, "virtio-disk%zu", i) < 0)
+                goto cleanup;
+        }
+        for (i = 0; i < def->nnets; i++) {
+            if (virAsprintf(&def->nets[i]->info.alias, "net%zu", i) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (!(expected = testDomainCopyViaXML(def)))
+        goto cleanup;
+
+    if (!(copy = virDomainDefCopy(def, driver.caps, driver.xmlopt,
+                                  NULL, false)))
+        goto cleanup;
+
+    /* The copy must not share anything with the original */
+    virDomainDefFree(def);
+    def = NULL;
+
+    if (!(actual = virDomainDefFormat(copy, driver.caps,
+                                      VIR_DOMAIN_DEF_FORMAT_SECURE)))
+        goto cleanup;
+
+    if (STRNEQ(expected, actual)) {
+        virTestDifference(stderr, expected, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virDomainDefFree(def);
+    virDomainDefFree(copy);
+    VIR_FREE(expected);
+    VIR_FREE(actual);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    int rc;
+    int live;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    char *dir_path = NULL;
+    char *xml_path = NULL;
+    char *test_name = NULL;
+    struct testInfo info;
+
+    if (qemuTestDriverInit(&driver) < 0)
+        return EXIT_FAILURE;
+
+    if (virAsprintf(&dir_path, "%s/qemuxml2argvdata", abs_srcdir) < 0 ||
+        virDirOpen(&dir, dir_path) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    while ((rc = virDirRead(dir, &ent, dir_path)) > 0) {
+        if (!virFileHasSuffix(ent->d_name, ".xml"))
+            continue;
+
+        if (virAsprintf(&xml_path, "%s/%s", dir_path, ent->d_name) < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+        info.xml_path = xml_path;
+
+        for (live = 0; live < 2; live++) {
+            info.live = live;
+            if (virAsprintf(&test_name, "Copying %s %s", ent->d_name,
+                            info.live ? "live" : "inactive") < 0) {
+                ret = -1;
+                goto cleanup;
+            }
+
+            if (virTestRun(test_name, testDomainCopy, &info) < 0)
+                ret = -1;
+            VIR_FREE(test_name);
+        }
+
+        VIR_FREE(xml_path);
+    }
+
+    if (rc < 0)
+        ret = -1;
+
+    /* Resource control tunings are not used by any qemuxml2argvdata
+     * input yet */
+    if (virAsprintf(&xml_path, "%s/genericxml2xmlindata/generic-cachetune.xml",
+                    abs_srcdir) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+    info.xml_path = xml_path;
+
+    for (live = 0; live < 2; live++) {
+        info.live = live;
+        if (virAsprintf(&test_name, "Copying generic-cachetune.xml %s",
+                        info.live ? "live" : "inactive") < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+
+        if (virTestRun(test_name, testDomainCopy, &info) < 0)
+            ret = -1;
+        VIR_FREE(test_name);
+    }
+
+ cleanup:
+    VIR_DIR_CLOSE(dir);
+    VIR_FREE(test_name);
+    VIR_FREE(xml_path);
+    VIR_FREE(dir_path);
+    qemuTestDriverFree(&driver);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
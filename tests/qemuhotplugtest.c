@@ -52,6 +52,7 @@ struct qemuHotplugTestData {
     bool keep;
     virDomainObjPtr vm;
     bool deviceDeletedEvent;
+    bool async;
 };
 
 static int
@@ -313,7 +314,10 @@ testQemuHotplug(const void *data)
         break;
 
     case DETACH:
+        if (test->async)
+            priv->unplugMode = QEMU_DOMAIN_UNPLUG_ASYNC;
         ret = testQemuHotplugDetach(vm, dev);
+        priv->unplugMode = QEMU_DOMAIN_UNPLUG_WAIT;
         if (ret == 0 || fail)
             ret = testQemuHotplugCheckResult(vm, domain_xml,
                                              domain_filename, fail);
@@ -608,7 +612,7 @@ mymain(void)
     /* wait only 100ms for DEVICE_DELETED event */
     qemuDomainRemoveDeviceWaitTime = 100;
 
-#define DO_TEST(file, ACTION, dev, event, fial, kep, ...)                   \
+#define DO_TEST_FULL(file, ACTION, dev, event, asyn, fial, kep, ...)        \
     do {                                                                    \
         const char *my_mon[] = { __VA_ARGS__, NULL};                        \
         const char *name = file " " #ACTION " " dev;                        \
@@ -619,16 +623,23 @@ mymain(void)
         data.mon = my_mon;                                                  \
         data.keep = kep;                                                    \
         data.deviceDeletedEvent = event;                                    \
+        data.async = asyn;                                                  \
         if (virTestRun(name, testQemuHotplug, &data) < 0)                   \
             ret = -1;                                                       \
     } while (0)
 
+#define DO_TEST(file, ACTION, dev, event, fial, kep, ...)                   \
+    DO_TEST_FULL(file, ACTION, dev, event, false, fial, kep, __VA_ARGS__)
+
 #define DO_TEST_ATTACH(file, dev, fial, kep, ...)                           \
     DO_TEST(file, ATTACH, dev, false, fial, kep, __VA_ARGS__)
 
 #define DO_TEST_DETACH(file, dev, fial, kep, ...)                           \
     DO_TEST(file, DETACH, dev, false, fial, kep, __VA_ARGS__)
 
+#define DO_TEST_DETACH_ASYNC(file, dev, fial, kep, ...)                     \
+    DO_TEST_FULL(file, DETACH, dev, false, true, fial, kep, __VA_ARGS__)
+
 #define DO_TEST_ATTACH_EVENT(file, dev, fial, kep, ...)                     \
     DO_TEST(file, ATTACH, dev, true, fial, kep, __VA_ARGS__)
 
@@ -691,6 +702,17 @@ mymain(void)
                    "device_del", QMP_DEVICE_DELETED("virtio-disk4") QMP_OK,
                    "human-monitor-command", HMP(""));
 
+    /* Asynchronous detach returns without waiting for the guest, unless
+     * the removal already finished */
+    DO_TEST_ATTACH_EVENT("base-live", "disk-virtio", false, true,
+                         "human-monitor-command", HMP("OK\\r\\n"),
+                         "device_add", QMP_OK);
+    DO_TEST_DETACH_ASYNC("base-live", "disk-virtio", true, true,
+                         "device_del", QMP_OK);
+    DO_TEST_DETACH_ASYNC("base-live", "disk-virtio", false, false,
+                         "device_del", QMP_DEVICE_DELETED("virtio-disk4") QMP_OK,
+                         "human-monitor-command", HMP(""));
+
     DO_TEST_ATTACH("base-live", "disk-usb", false, true,
                    "human-monitor-command", HMP("OK\\r\\n"),
                    "device_add", QMP_OK);
@@ -1336,6 +1336,13 @@ GEN_TEST_FUNC(qemuMonitorJSONOpenGraphics, "spice", "spicefd", false)
 GEN_TEST_FUNC(qemuMonitorJSONNBDServerStart, "localhost", 12345)
 GEN_TEST_FUNC(qemuMonitorJSONNBDServerAdd, "vda", true)
 GEN_TEST_FUNC(qemuMonitorJSONDetachCharDev, "serial1")
+GEN_TEST_FUNC(qemuMonitorJSONStartDirtyRateCalc, 5)
+GEN_TEST_FUNC(qemuMonitorJSONBlockDirtyBitmapAdd, NULL, "drive-virtio-disk0",
+              "libvirt-backup", true)
+GEN_TEST_FUNC(qemuMonitorJSONBlockDirtyBitmapClear, NULL, "drive-virtio-disk0",
+              "libvirt-backup")
+GEN_TEST_FUNC(qemuMonitorJSONDriveBackup, NULL, "drive-virtio-disk0",
+              "/foo/bar", "qcow2", "libvirt-backup", 1024, true)
 
 static bool
 testQemuMonitorJSONqemuMonitorJSONQueryCPUsEqual(struct qemuMonitorQueryCpusEntry *a,
@@ -1408,7 +1415,7 @@ testQemuMonitorJSONqemuMonitorJSONQueryCPUs(const void *data)
         goto cleanup;
 
     if (qemuMonitorJSONQueryCPUs(qemuMonitorTestGetMonitor(test),
-                                 &cpudata, &ncpudata, true) < 0)
+                                 &cpudata, &ncpudata, true, false) < 0)
         goto cleanup;
 
     if (ncpudata != 4) {
@@ -1434,6 +1441,82 @@ testQemuMonitorJSONqemuMonitorJSONQueryCPUs(const void *data)
     return ret;
 }
 
+static int
+testQemuMonitorJSONqemuMonitorJSONQueryCPUsFast(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    int ret = -1;
+    struct qemuMonitorQueryCpusEntry *cpudata = NULL;
+    struct qemuMonitorQueryCpusEntry expect[] = {
+        {0, 17629, (char *) "/machine/unattached/device[0]", false},
+        {1, 17630, (char *) "/machine/unattached/device[1]", false},
+    };
+    size_t ncpudata = 0;
+    size_t i;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-cpus-fast",
+                               "{"
+                               "    \"return\": ["
+                               "        {"
+                               "            \"thread-id\": 17629,"
+                               "            \"props\": {"
+                               "                \"core-id\": 0,"
+                               "                \"thread-id\": 0,"
+                               "                \"socket-id\": 0"
+                               "            },"
+                               "            \"qom-path\": \"/machine/unattached/device[0]\","
+                               "            \"cpu-index\": 0,"
+                               "            \"arch\": \"x86\""
+                               "        },"
+                               "        {"
+                               "            \"thread-id\": 17630,"
+                               "            \"props\": {"
+                               "                \"core-id\": 0,"
+                               "                \"thread-id\": 0,"
+                               "                \"socket-id\": 1"
+                               "            },"
+                               "            \"qom-path\": \"/machine/unattached/device[1]\","
+                               "            \"cpu-index\": 1,"
+                               "            \"arch\": \"x86\""
+                               "        }"
+                               "    ],"
+                               "    \"id\": \"libvirt-8\""
+                               "}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONQueryCPUs(qemuMonitorTestGetMonitor(test),
+                                 &cpudata, &ncpudata, true, true) < 0)
+        goto cleanup;
+
+    if (ncpudata != 2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Expecting ncpupids = 2 but got %zu", ncpudata);
+        goto cleanup;
+    }
+
+    for (i = 0; i < ncpudata; i++) {
+        if (!testQemuMonitorJSONqemuMonitorJSONQueryCPUsEqual(cpudata + i,
+                                                              expect + i) ||
+            cpudata[i].qemu_id != expect[i].qemu_id ||
+            cpudata[i].halted) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "vcpu entry %zu does not match expected data", i);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorQueryCpusFree(cpudata, ncpudata);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
 static int
 testQemuMonitorJSONqemuMonitorJSONGetBalloonInfo(const void *data)
 {
@@ -1772,6 +1855,143 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
     return ret;
 }
 
+static int
+testQemuMonitorJSONqemuMonitorJSONGetAllBlockStatsInfoBatch(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    virHashTablePtr blockstats = NULL;
+    virJSONValuePtr nodedata = NULL;
+    qemuBlockStatsPtr stats;
+    int ret = -1;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-blockstats",
+                               "{"
+                               "    \"return\": ["
+                               "        {"
+                               "            \"device\": \"drive-virtio-disk0\","
+                               "            \"stats\": {"
+                               "                \"flush_total_time_ns\": 0,"
+                               "                \"wr_highest_offset\": 0,"
+                               "                \"wr_total_time_ns\": 0,"
+                               "                \"wr_bytes\": 2845696,"
+                               "                \"rd_total_time_ns\": 0,"
+                               "                \"flush_operations\": 0,"
+                               "                \"wr_operations\": 174,"
+                               "                \"rd_bytes\": 28505088,"
+                               "                \"rd_operations\": 1279"
+                               "            }"
+                               "        }"
+                               "    ]"
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-block",
+                               "{"
+                               "    \"return\": ["
+                               "        {"
+                               "            \"device\": \"drive-virtio-disk0\","
+                               "            \"inserted\": {"
+                               "                \"image\": {"
+                               "                    \"virtual-size\": 10737418240,"
+                               "                    \"actual-size\": 1073741824"
+                               "                }"
+                               "            }"
+                               "        }"
+                               "    ]"
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-named-block-nodes",
+                               "{\"return\": []}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorGetAllBlockStatsInfoBatch(qemuMonitorTestGetMonitor(test),
+                                             &blockstats, false,
+                                             &nodedata) < 0)
+        goto cleanup;
+
+    if (!(stats = virHashLookup(blockstats, "virtio-disk0"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "block stats for device 'virtio-disk0' is missing");
+        goto cleanup;
+    }
+
+    if (stats->rd_req != 1279 || stats->wr_req != 174 ||
+        stats->capacity != 10737418240ULL ||
+        stats->physical != 1073741824ULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "unexpected block stats rd_req=%lld wr_req=%lld "
+                       "capacity=%llu physical=%llu",
+                       stats->rd_req, stats->wr_req,
+                       stats->capacity, stats->physical);
+        goto cleanup;
+    }
+
+    if (!nodedata || virJSONValueArraySize(nodedata) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "unexpected query-named-block-nodes data");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorTestFree(test);
+    virHashFree(blockstats);
+    virJSONValueFree(nodedata);
+    return ret;
+}
+
+static int
+testQemuMonitorJSONBatchUnknownIDHandler(qemuMonitorTestPtr test,
+                                         qemuMonitorTestItemPtr item ATTRIBUTE_UNUSED,
+                                         const char *cmdstr ATTRIBUTE_UNUSED)
+{
+    return qemuMonitorTestAddResponse(test,
+                                      "{\"return\": [], \"id\": \"bogus\"}");
+}
+
+static int
+testQemuMonitorJSONqemuMonitorJSONGetAllBlockStatsInfoBatchUnknownID(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    virHashTablePtr blockstats = NULL;
+    int ret = -1;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-blockstats",
+                               "{\"return\": []}") < 0 ||
+        qemuMonitorTestAddHandler(test,
+                                  testQemuMonitorJSONBatchUnknownIDHandler,
+                                  NULL, NULL) < 0)
+        goto cleanup;
+
+    /* a reply which doesn't belong to any command fails the batch */
+    if (qemuMonitorGetAllBlockStatsInfoBatch(qemuMonitorTestGetMonitor(test),
+                                             &blockstats, false, NULL) == 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "reply with unknown id was accepted");
+        goto cleanup;
+    }
+
+    if (blockstats) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "block stats were returned on failure");
+        goto cleanup;
+    }
+
+    virResetLastError();
+    ret = 0;
+
+ cleanup:
+    qemuMonitorTestFree(test);
+    virHashFree(blockstats);
+    return ret;
+}
+
 static int
 testQemuMonitorJSONqemuMonitorJSONGetMigrationParams(const void *data)
 {
@@ -1791,6 +2011,7 @@ testQemuMonitorJSONqemuMonitorJSONGetMigrationParams(const void *data)
                                "        \"compress-threads\": 8,"
                                "        \"compress-level\": 1,"
                                "        \"cpu-throttle-initial\": 20,"
+                               "        \"x-multifd-channels\": 4,"
                                "        \"tls-creds\": \"tls0\","
                                "        \"tls-hostname\": \"\""
                                "    }"
@@ -1821,6 +2042,7 @@ testQemuMonitorJSONqemuMonitorJSONGetMigrationParams(const void *data)
     CHECK(decompressThreads, "decompress-threads", 2);
     CHECK(cpuThrottleInitial, "cpu-throttle-initial", 20);
     CHECK(cpuThrottleIncrement, "cpu-throttle-increment", 10);
+    CHECK(multifdChannels, "x-multifd-channels", 4);
 
 #undef CHECK
 
@@ -1889,6 +2111,145 @@ testQemuMonitorJSONqemuMonitorJSONGetMigrationCacheSize(const void *data)
     return ret;
 }
 
+static int
+testQemuMonitorJSONqemuMonitorJSONQueryDirtyRate(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    int ret = -1;
+    qemuMonitorDirtyRateInfo info;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-dirty-rate",
+                               "{"
+                               "    \"return\": {"
+                               "        \"status\": \"measuring\","
+                               "        \"start-time\": 1234,"
+                               "        \"calc-time\": 5"
+                               "    },"
+                               "    \"id\": \"libvirt-12\""
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-dirty-rate",
+                               "{"
+                               "    \"return\": {"
+                               "        \"status\": \"measured\","
+                               "        \"dirty-rate\": 108,"
+                               "        \"start-time\": 1234,"
+                               "        \"calc-time\": 5"
+                               "    },"
+                               "    \"id\": \"libvirt-13\""
+                               "}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONQueryDirtyRate(qemuMonitorTestGetMonitor(test),
+                                      &info) < 0)
+        goto cleanup;
+
+    if (info.status != VIR_DOMAIN_DIRTYRATE_MEASURING ||
+        info.startTime != 1234 || info.calcTime != 5 ||
+        info.dirtyRate != -1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Invalid dirty rate info of a running calculation: "
+                       "status=%d start=%lld calc=%d rate=%lld",
+                       info.status, info.startTime, info.calcTime,
+                       info.dirtyRate);
+        goto cleanup;
+    }
+
+    if (qemuMonitorJSONQueryDirtyRate(qemuMonitorTestGetMonitor(test),
+                                      &info) < 0)
+        goto cleanup;
+
+    if (info.status != VIR_DOMAIN_DIRTYRATE_MEASURED ||
+        info.dirtyRate != 108) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Invalid dirty rate info of a finished calculation: "
+                       "status=%d rate=%lld", info.status, info.dirtyRate);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+static int
+testQemuMonitorJSONqemuMonitorJSONBlockDirtyBitmapExists(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    const char *reply =
+        "{"
+        "    \"return\": ["
+        "        {"
+        "            \"device\": \"drive-virtio-disk0\","
+        "            \"dirty-bitmaps\": ["
+        "                {"
+        "                    \"name\": \"libvirt-backup\","
+        "                    \"count\": 65536,"
+        "                    \"granularity\": 65536,"
+        "                    \"status\": \"active\""
+        "                }"
+        "            ],"
+        "            \"locked\": false,"
+        "            \"removable\": false,"
+        "            \"type\": \"unknown\""
+        "        },"
+        "        {"
+        "            \"device\": \"drive-virtio-disk1\","
+        "            \"locked\": false,"
+        "            \"removable\": false,"
+        "            \"type\": \"unknown\""
+        "        }"
+        "    ],"
+        "    \"id\": \"libvirt-9\""
+        "}";
+    int ret = -1;
+    int rc;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-block", reply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-block", reply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-block", reply) < 0)
+        goto cleanup;
+
+    if ((rc = qemuMonitorJSONBlockDirtyBitmapExists(qemuMonitorTestGetMonitor(test),
+                                                    "drive-virtio-disk0",
+                                                    "libvirt-backup")) != 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "dirty bitmap of drive-virtio-disk0 not found: %d", rc);
+        goto cleanup;
+    }
+
+    if ((rc = qemuMonitorJSONBlockDirtyBitmapExists(qemuMonitorTestGetMonitor(test),
+                                                    "drive-virtio-disk1",
+                                                    "libvirt-backup")) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "unexpected dirty bitmap of drive-virtio-disk1: %d", rc);
+        goto cleanup;
+    }
+
+    if (qemuMonitorJSONBlockDirtyBitmapExists(qemuMonitorTestGetMonitor(test),
+                                              "drive-virtio-disk2",
+                                              "libvirt-backup") != -1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "lookup of a missing device should fail");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
 static int
 testQemuMonitorJSONqemuMonitorJSONGetMigrationStats(const void *data)
 {
@@ -2659,7 +3020,7 @@ testQemuMonitorCPUInfo(const void *opaque)
         goto cleanup;
 
     rc = qemuMonitorGetCPUInfo(qemuMonitorTestGetMonitor(test),
-                               &vcpus, data->maxvcpus, true);
+                               &vcpus, data->maxvcpus, true, false);
 
     if (rc < 0)
         goto cleanup;
@@ -2890,17 +3251,26 @@ mymain(void)
     DO_TEST_GEN(qemuMonitorJSONNBDServerStart);
     DO_TEST_GEN(qemuMonitorJSONNBDServerAdd);
     DO_TEST_GEN(qemuMonitorJSONDetachCharDev);
+    DO_TEST_GEN(qemuMonitorJSONStartDirtyRateCalc);
+    DO_TEST_GEN(qemuMonitorJSONBlockDirtyBitmapAdd);
+    DO_TEST_GEN(qemuMonitorJSONBlockDirtyBitmapClear);
+    DO_TEST_GEN(qemuMonitorJSONDriveBackup);
     DO_TEST(qemuMonitorJSONGetBalloonInfo);
     DO_TEST(qemuMonitorJSONGetBlockInfo);
     DO_TEST(qemuMonitorJSONGetBlockStatsInfo);
+    DO_TEST(qemuMonitorJSONGetAllBlockStatsInfoBatch);
+    DO_TEST(qemuMonitorJSONGetAllBlockStatsInfoBatchUnknownID);
     DO_TEST(qemuMonitorJSONGetMigrationCacheSize);
     DO_TEST(qemuMonitorJSONGetMigrationParams);
     DO_TEST(qemuMonitorJSONGetMigrationStats);
+    DO_TEST(qemuMonitorJSONQueryDirtyRate);
+    DO_TEST(qemuMonitorJSONBlockDirtyBitmapExists);
     DO_TEST(qemuMonitorJSONGetChardevInfo);
     DO_TEST(qemuMonitorJSONSetBlockIoThrottle);
     DO_TEST(qemuMonitorJSONGetTargetArch);
     DO_TEST(qemuMonitorJSONGetMigrationCapability);
     DO_TEST(qemuMonitorJSONQueryCPUs);
+    DO_TEST(qemuMonitorJSONQueryCPUsFast);
     DO_TEST(qemuMonitorJSONGetVirtType);
     DO_TEST(qemuMonitorJSONSendKey);
     DO_TEST(qemuMonitorJSONGetDumpGuestMemoryCapability);
@@ -537,6 +537,36 @@ qemuMonitorTestHandlerDataFree(void *opaque)
     VIR_FREE(data);
 }
 
+/*
+ * Like qemuMonitorTestAddResponse, but tags @response with the @id of
+ * the command it answers, as QEMU does.
+ */
+static int
+qemuMonitorTestAddResponseID(qemuMonitorTestPtr test,
+                             const char *response,
+                             const char *id)
+{
+    virJSONValuePtr val;
+    char *tagged = NULL;
+    int ret;
+
+    if (!(val = virJSONValueFromString(response)) ||
+        val->type != VIR_JSON_TYPE_OBJECT ||
+        virJSONValueObjectHasKey(val, "id") ||
+        virJSONValueObjectAppendString(val, "id", id) < 0 ||
+        !(tagged = virJSONValueToString(val, false))) {
+        virResetLastError();
+        ret = qemuMonitorTestAddResponse(test, response);
+    } else {
+        ret = qemuMonitorTestAddResponse(test, tagged);
+    }
+
+    VIR_FREE(tagged);
+    virJSONValueFree(val);
+    return ret;
+}
+
+
 static int
 qemuMonitorTestProcessCommandDefault(qemuMonitorTestPtr test,
                                      qemuMonitorTestItemPtr item,
@@ -546,6 +576,7 @@ qemuMonitorTestProcessCommandDefault(qemuMonitorTestPtr test,
     virJSONValuePtr val = NULL;
     char *cmdcopy = NULL;
     const char *cmdname;
+    const char *id;
     char *tmp;
     int ret = -1;
 
@@ -575,6 +606,8 @@ qemuMonitorTestProcessCommandDefault(qemuMonitorTestPtr test,
     if (data->command_name && STRNEQ(data->command_name, cmdname))
         ret = qemuMonitorTestAddInvalidCommandResponse(test, data->command_name,
                                                        cmdname);
+    else if (test->json && (id = virJSONValueObjectGetString(val, "id")))
+        ret = qemuMonitorTestAddResponseID(test, data->response, id);
     else
         ret = qemuMonitorTestAddResponse(test, data->response);
 
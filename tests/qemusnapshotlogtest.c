@@ -0,0 +1,150 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+
+#ifdef WITH_QEMU
+
+# include "internal.h"
+# include "virhash.h"
+# include "virstring.h"
+# include "qemu/qemu_domain.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+struct testInfo {
+    const char *log;
+    /* length of the well formed records at the start of @log */
+    size_t goodLen;
+    ssize_t nrecords;
+    /* name, XML pairs expected in the parsed records, NULL terminated */
+    const char *const *records;
+};
+
+
+static int
+testSnapshotLogParse(const void *opaque)
+{
+    const struct testInfo *info = opaque;
+    virHashTablePtr records = NULL;
+    char *content = NULL;
+    size_t len = strlen(info->log);
+    size_t goodLen = 0;
+    ssize_t nrecords;
+    size_t nexpected = 0;
+    const char *xml;
+    int ret = -1;
+
+    if (VIR_STRDUP(content, info->log) < 0 ||
+        !(records = virHashCreate(8, NULL)))
+        goto cleanup;
+
+    if ((nrecords = qemuDomainSnapshotLogParse(content, len, "test",
+                                               records, &goodLen)) < 0)
+        goto cleanup;
+
+    if (nrecords != info->nrecords) {
+        VIR_TEST_DEBUG("expected %zd records, got %zd\n",
+                       info->nrecords, nrecords);
+        goto cleanup;
+    }
+
+    if (goodLen != info->goodLen) {
+        VIR_TEST_DEBUG("expected %zu good bytes, got %zu\n",
+                       info->goodLen, goodLen);
+        goto cleanup;
+    }
+
+    for (; info->records[nexpected * 2]; nexpected++) {
+        const char *name = info->records[nexpected * 2];
+
+        if (!(xml = virHashLookup(records, name)) ||
+            STRNEQ(xml, info->records[nexpected * 2 + 1])) {
+            VIR_TEST_DEBUG("expected '%s' for '%s', got '%s'\n",
+                           info->records[nexpected * 2 + 1], name,
+                           NULLSTR(xml));
+            goto cleanup;
+        }
+    }
+
+    if (virHashSize(records) != nexpected) {
+        VIR_TEST_DEBUG("expected %zu names, got %zd\n",
+                       nexpected, virHashSize(records));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(records);
+    VIR_FREE(content);
+    return ret;
+}
+
+
+# define PUT_A1 "put 1 6\na\n<one/>\n"
+# define PUT_A2 "put 1 6\na\n<two/>\n"
+# define PUT_B "put 1 4\nb\n<b/>\n"
+# define DEL_A "del 1 0\na\n\n"
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+# define DO_TEST_FULL(name, log, goodLen, nrecords, ...) \
+    do { \
+        const char *const records[] = { __VA_ARGS__, NULL }; \
+        struct testInfo info = { log, goodLen, nrecords, records }; \
+        if (virTestRun(name, testSnapshotLogParse, &info) < 0) \
+            ret = -1; \
+    } while (0)
+
+# define DO_TEST(name, log, nrecords, ...) \
+    DO_TEST_FULL(name, log, strlen(log), nrecords, __VA_ARGS__)
+
+# define DO_TEST_TORN(name, good, tail, nrecords, ...) \
+    DO_TEST_FULL(name, good tail, strlen(good), nrecords, __VA_ARGS__)
+
+    DO_TEST("empty", "", 0, NULL);
+    DO_TEST("single", PUT_A1, 1, "a", "<one/>");
+    DO_TEST("two names", PUT_A1 PUT_B, 2, "a", "<one/>", "b", "<b/>");
+    DO_TEST("last record wins", PUT_A1 PUT_B PUT_A2, 3,
+            "a", "<two/>", "b", "<b/>");
+    DO_TEST("deleted", PUT_A1 PUT_B DEL_A, 3, "a", "", "b", "<b/>");
+    DO_TEST("put after delete", PUT_A1 DEL_A PUT_A2, 3, "a", "<two/>");
+    DO_TEST("newline in XML", "put 1 8\na\n<x>\n</x>\n", 1, "a", "<x>\n</x>");
+
+    DO_TEST_TORN("torn header", PUT_A1 PUT_B, "put 1", 2,
+                 "a", "<one/>", "b", "<b/>");
+    DO_TEST_TORN("torn name", PUT_A1, "put 1 6\na", 1, "a", "<one/>");
+    DO_TEST_TORN("torn XML", PUT_A1, "put 1 6\na\n<two", 1, "a", "<one/>");
+    DO_TEST_TORN("torn newline", PUT_A1, "put 1 6\na\n<two/>", 1,
+                 "a", "<one/>");
+    DO_TEST_TORN("torn delete", PUT_A1, "del 1 0\na\n", 1, "a", "<one/>");
+    DO_TEST_TORN("garbage", PUT_A1, "garbage\n" PUT_A2, 1, "a", "<one/>");
+    DO_TEST_TORN("wrong length", PUT_A1, "put 1 3\na\n<two/>\n", 1,
+                 "a", "<one/>");
+    DO_TEST_TORN("huge length", PUT_A1, "put 1 99999999999\na\n\n", 1,
+                 "a", "<one/>");
+    DO_TEST_TORN("delete with XML", PUT_A1, "del 1 4\na\n<b/>\n", 1,
+                 "a", "<one/>");
+    DO_TEST_TORN("all torn", "", "put 1 6\na\n<on", 0, NULL);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
@@ -24,6 +24,7 @@
 #include "viralloc.h"
 #include "vircommand.h"
 #include "vircrypto.h"
+#include "virhostcpu.h"
 #include "virmock.h"
 #include "virnetdev.h"
 #include "virnetdevip.h"
@@ -54,6 +55,12 @@ time_t time(time_t *t)
     return ret;
 }
 
+int
+virHostCPUGetCount(void)
+{
+    return 2;
+}
+
 int
 virNumaGetMaxNode(void)
 {
@@ -12,6 +12,7 @@
 
 #ifdef WITH_QEMU
 
+# include "benchutils.h"
 # include "internal.h"
 # include "viralloc.h"
 # include "qemu/qemu_alias.h"
@@ -38,6 +39,11 @@
 static const char *abs_top_srcdir;
 static virQEMUDriver driver;
 
+/* Set by VIR_TEST_BENCH, see mymain() */
+static unsigned int benchIterations;
+static unsigned long long benchBuilds;
+static unsigned long long benchNs;
+
 static unsigned char *
 fakeSecretGetValue(virSecretPtr obj ATTRIBUTE_UNUSED,
                    size_t *value_size,
@@ -401,6 +407,43 @@ testUpdateQEMUCaps(const struct testInfo *info,
 }
 
 
+/* Build the command line of @vm another benchIterations times, after
+ * the test made sure it is the expected one */
+static int
+testBenchBuildCommandLine(virDomainObjPtr vm,
+                          const char *migrateURI,
+                          bool enableFips)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virCommandPtr cmd;
+    unsigned long long start;
+    unsigned long long end;
+    unsigned int i;
+
+    if (virBenchNow(&start) < 0)
+        return -1;
+
+    for (i = 0; i < benchIterations; i++) {
+        if (!(cmd = qemuBuildCommandLine(&driver, NULL, vm->def,
+                                         priv->monConfig, priv->monJSON,
+                                         priv->qemuCaps, migrateURI, NULL,
+                                         VIR_NETDEV_VPORT_PROFILE_OP_NO_OP,
+                                         false, enableFips,
+                                         priv->autoNodeset, NULL, NULL,
+                                         priv->libDir)))
+            return -1;
+        virCommandFree(cmd);
+    }
+
+    if (virBenchNow(&end) < 0)
+        return -1;
+
+    benchBuilds += benchIterations;
+    benchNs += end - start;
+    return 0;
+}
+
+
 static int
 testCompareXMLToArgv(const void *data)
 {
@@ -504,6 +547,10 @@ testCompareXMLToArgv(const void *data)
     if (virTestCompareToFile(actualargv, args) < 0)
         goto cleanup;
 
+    if (benchIterations &&
+        testBenchBuildCommandLine(vm, migrateURI, flags & FLAG_FIPS) < 0)
+        goto cleanup;
+
     ret = 0;
 
  ok:
@@ -540,6 +587,7 @@ mymain(void)
 {
     int ret = 0;
     bool skipLegacyCPUs = false;
+    char *benchStr;
 
     abs_top_srcdir = getenv("abs_top_srcdir");
     if (!abs_top_srcdir)
@@ -555,6 +603,15 @@ mymain(void)
         return EXIT_FAILURE;
     }
 
+    /* VIR_TEST_BENCH=N makes every test which passes build its command
+     * line N more times and report how long that took on average as
+     * described in benchutils.h */
+    if ((benchStr = getenv("VIR_TEST_BENCH")) &&
+        virStrToLong_ui(benchStr, NULL, 10, &benchIterations) < 0) {
+        fprintf(stderr, "Invalid VIR_TEST_BENCH value '%s'\n", benchStr);
+        return EXIT_FAILURE;
+    }
+
     if (qemuTestDriverInit(&driver) < 0)
         return EXIT_FAILURE;
 
@@ -819,6 +876,11 @@ mymain(void)
             QEMU_CAPS_OBJECT_MEMORY_RAM, QEMU_CAPS_OBJECT_MEMORY_FILE);
     DO_TEST("hugepages-pages5", QEMU_CAPS_MEM_PATH);
     DO_TEST("hugepages-pages6", NONE);
+    DO_TEST("memory-allocation-threads", QEMU_CAPS_MEM_PATH,
+            QEMU_CAPS_OBJECT_MEMORY_RAM, QEMU_CAPS_OBJECT_MEMORY_FILE,
+            QEMU_CAPS_OBJECT_MEMORY_PREALLOC_THREADS);
+    DO_TEST_FAILURE("memory-allocation-threads", QEMU_CAPS_MEM_PATH,
+                    QEMU_CAPS_OBJECT_MEMORY_RAM, QEMU_CAPS_OBJECT_MEMORY_FILE);
     DO_TEST("nosharepages", QEMU_CAPS_MACHINE_OPT, QEMU_CAPS_MEM_MERGE);
     DO_TEST("disk-cdrom", NONE);
     DO_TEST("disk-iscsi", NONE);
@@ -1133,6 +1195,7 @@ mymain(void)
             QEMU_CAPS_VIRTIO_CCW, QEMU_CAPS_VIRTIO_S390);
     DO_TEST("net-virtio-rxqueuesize",
             QEMU_CAPS_VIRTIO_NET_RX_QUEUE_SIZE);
+    DO_TEST("net-virtio-queues-auto", QEMU_CAPS_NETDEV);
     DO_TEST_PARSE_ERROR("net-virtio-rxqueuesize-invalid-size", NONE);
     DO_TEST("net-eth", NONE);
     DO_TEST("net-eth-ifname", NONE);
@@ -2540,6 +2603,9 @@ mymain(void)
     DO_TEST_PARSE_ERROR("cpu-cache-passthrough3", QEMU_CAPS_KVM);
     DO_TEST_PARSE_ERROR("cpu-cache-passthrough-l3", QEMU_CAPS_KVM);
 
+    if (benchIterations)
+        virBenchReport("qemu/build-command-line", benchBuilds, benchNs);
+
     qemuTestDriverFree(&driver);
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Measure how long it takes to parse the domain definitions found in
+ * qemuxml2argvdata:
+ *
+ *   tests/qemuxmlparsebench [ITERATIONS]
+ *
+ * Each file is read into memory once and then parsed ITERATIONS times
+ * (100 by default), so that only the XML parser is measured. The
+ * result is printed as described in benchutils.h.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "benchutils.h"
+#include "testutils.h"
+#include "testutilsqemu.h"
+#include "internal.h"
+#include "virfile.h"
+#include "virstring.h"
+#include "conf/domain_conf.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define BENCH_MAX_XML_SIZE (1024 * 1024)
+
+
+int
+main(int argc, char **argv)
+{
+    virQEMUDriver driver;
+    unsigned int iterations = 100;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    char *dir_path = NULL;
+    char *xml_path = NULL;
+    char *xml = NULL;
+    size_t nfiles = 0;
+    size_t nskipped = 0;
+    unsigned long long total = 0;
+    unsigned long long start;
+    unsigned long long end;
+    virDomainDefPtr def;
+    unsigned int i;
+    int rc;
+    int ret = EXIT_FAILURE;
+
+    if (argc > 2 ||
+        (argc == 2 && (virStrToLong_ui(argv[1], NULL, 10, &iterations) < 0 ||
+                       iterations == 0))) {
+        fprintf(stderr, "%s [ITERATIONS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (virThreadInitialize() < 0 ||
+        qemuTestDriverInit(&driver) < 0)
+        return EXIT_FAILURE;
+
+    if (virAsprintf(&dir_path, "%s/qemuxml2argvdata", abs_srcdir) < 0 ||
+        virDirOpen(&dir, dir_path) < 0)
+        goto cleanup;
+
+    while ((rc = virDirRead(dir, &ent, dir_path)) > 0) {
+        if (!virFileHasSuffix(ent->d_name, ".xml"))
+            continue;
+
+        if (virAsprintf(&xml_path, "%s/%s", dir_path, ent->d_name) < 0 ||
+            virFileReadAll(xml_path, BENCH_MAX_XML_SIZE, &xml) < 0)
+            goto cleanup;
+
+        /* Not every input is a valid definition, some are used to test
+         * error reporting of the command line generator */
+        if (!(def = virDomainDefParseString(xml, driver.caps, driver.xmlopt,
+                                            NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE))) {
+            virResetLastError();
+            nskipped++;
+            goto next;
+        }
+        virDomainDefFree(def);
+
+        if (virBenchNow(&start) < 0)
+            goto cleanup;
+
+        for (i = 0; i < iterations; i++) {
+            if (!(def = virDomainDefParseString(xml, driver.caps,
+                                                driver.xmlopt, NULL,
+                                                VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+                goto cleanup;
+            virDomainDefFree(def);
+        }
+
+        if (virBenchNow(&end) < 0)
+            goto cleanup;
+
+        total += end - start;
+        nfiles++;
+
+     next:
+        VIR_FREE(xml);
+        VIR_FREE(xml_path);
+    }
+
+    if (rc < 0)
+        goto cleanup;
+
+    fprintf(stderr, "Parsed %zu definitions %u times (%zu skipped)\n",
+            nfiles, iterations, nskipped);
+    virBenchReport("domain/parse-qemuxml2argvdata",
+                   nfiles * iterations, total);
+
+    ret = EXIT_SUCCESS;
+
+ cleanup:
+    if (ret != EXIT_SUCCESS)
+        fprintf(stderr, "%s: %s\n",
+                NULLSTR(xml_path), virGetLastErrorMessage());
+    VIR_DIR_CLOSE(dir);
+    VIR_FREE(xml);
+    VIR_FREE(xml_path);
+    VIR_FREE(dir_path);
+    qemuTestDriverFree(&driver);
+    return ret;
+}
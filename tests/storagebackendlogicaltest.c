@@ -0,0 +1,175 @@
+/*
+ * storagebackendlogicaltest.c: test parsing of LVM output
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "storage/storage_backend_logical_priv.h"
+#include "virbuffer.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+struct testLVsParserData {
+    const char *output;
+    int expected_return;
+    const char *expected_rows;
+};
+
+
+static int
+testLVsParserRow(char **const groups,
+                 void *opaque)
+{
+    virBufferPtr buf = opaque;
+    size_t i;
+
+    for (i = 0; i < VIR_STORAGE_BACKEND_LOGICAL_LV_LAST; i++) {
+        if (i > 0)
+            virBufferAddChar(buf, '#');
+        virBufferAdd(buf, groups[i], -1);
+    }
+    virBufferAddChar(buf, '\n');
+
+    return 0;
+}
+
+
+static int
+testLVsParser(const void *opaque)
+{
+    const struct testLVsParserData *data = opaque;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *actual = NULL;
+    int ret = -1;
+
+    if (virStorageBackendLogicalParseLVs(data->output, testLVsParserRow,
+                                         &buf) != data->expected_return) {
+        VIR_TEST_VERBOSE("unexpected return value\n");
+        goto cleanup;
+    }
+
+    if (data->expected_return < 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    actual = virBufferContentAndReset(&buf);
+    if (STRNEQ_NULLABLE(actual, data->expected_rows)) {
+        virTestDifference(stderr, NULLSTR(data->expected_rows),
+                          NULLSTR(actual));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(actual);
+    return ret;
+}
+
+
+#define LV_ROW(name, origin, devices, segtype, stripes, segsize, size, attr) \
+    "{\"lv_name\":\"" name "\", \"origin\":\"" origin "\", "            \
+    "\"uuid\":\"06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky\", "            \
+    "\"devices\":\"" devices "\", \"segtype\":\"" segtype "\", "        \
+    "\"stripes\":\"" stripes "\", \"seg_size\":\"" segsize "\", "       \
+    "\"vg_extent_size\":\"4194304\", \"size\":\"" size "\", "           \
+    "\"lv_attr\":\"" attr "\", \"vg_size\":\"107369988096\", "          \
+    "\"vg_free\":\"55830380544\"}"
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#if !WITH_YAJL
+    fputs("libvirt not compiled with yajl, skipping this test\n", stderr);
+    return EXIT_AM_SKIP;
+#endif
+
+#define DO_TEST_FULL(name, output, expected_return, expected_rows)      \
+    do {                                                                \
+        struct testLVsParserData data = {                               \
+            output, expected_return, expected_rows                      \
+        };                                                              \
+        if (virTestRun("lvs " name, testLVsParser, &data) < 0)          \
+            ret = -1;                                                   \
+    } while (0)
+
+#define DO_TEST(name, output, expected_rows)                            \
+    DO_TEST_FULL(name, output, 0, expected_rows)
+
+#define DO_TEST_FAIL(name, output)                                      \
+    DO_TEST_FULL(name, output, -1, NULL)
+
+    DO_TEST("empty VG",
+            "{\"report\": [{\"lv\": []}]}",
+            NULL);
+
+    DO_TEST("volumes",
+            "{\"report\": [{\"lv\": ["
+            LV_ROW("RootLV", "", "/dev/hda2(0)", "linear", "1",
+                   "5234491392", "5234491392", "-wi-ao") ", "
+            LV_ROW("Test3", "Test2", "/dev/hda2(187)", "linear", "1",
+                   "1040187392", "1040187392", "swi-a-") ", "
+            LV_ROW("stripes", "", "/dev/sdc1(10240),/dev/sdd1(0)", "striped",
+                   "2", "42949672960", "42949672960", "-wi-a-")
+            "]}]}",
+            "RootLV##06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky#/dev/hda2(0)#"
+            "linear#1#5234491392#4194304#5234491392#-wi-ao#"
+            "107369988096#55830380544\n"
+            "Test3#Test2#06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky#/dev/hda2(187)#"
+            "linear#1#1040187392#4194304#1040187392#swi-a-#"
+            "107369988096#55830380544\n"
+            "stripes##06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky#"
+            "/dev/sdc1(10240),/dev/sdd1(0)#"
+            "striped#2#42949672960#4194304#42949672960#-wi-a-#"
+            "107369988096#55830380544\n");
+
+    DO_TEST("several reports",
+            "{\"report\": [{\"lv\": ["
+            LV_ROW("a", "", "/dev/sda1(0)", "linear", "1",
+                   "4194304", "4194304", "-wi-a-")
+            "]}, {}, {\"lv\": ["
+            LV_ROW("b", "", "/dev/sda1(1)", "linear", "1",
+                   "4194304", "4194304", "-wi-a-")
+            "]}]}",
+            "a##06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky#/dev/sda1(0)#"
+            "linear#1#4194304#4194304#4194304#-wi-a-#"
+            "107369988096#55830380544\n"
+            "b##06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky#/dev/sda1(1)#"
+            "linear#1#4194304#4194304#4194304#-wi-a-#"
+            "107369988096#55830380544\n");
+
+    DO_TEST_FAIL("garbage", "  LV   VG   Attr");
+    DO_TEST_FAIL("no report", "{\"lv\": []}");
+    DO_TEST_FAIL("missing field",
+                 "{\"report\": [{\"lv\": [{\"lv_name\":\"RootLV\"}]}]}");
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
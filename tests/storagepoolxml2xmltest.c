@@ -75,6 +75,7 @@ mymain(void)
 
     DO_TEST("pool-dir");
     DO_TEST("pool-dir-naming");
+    DO_TEST("pool-dir-refresh");
     DO_TEST("pool-fs");
     DO_TEST("pool-logical");
     DO_TEST("pool-logical-nopath");
@@ -101,6 +102,7 @@ mymain(void)
     DO_TEST("pool-zfs");
     DO_TEST("pool-zfs-sourcedev");
     DO_TEST("pool-rbd");
+    DO_TEST("pool-rbd-refresh");
     DO_TEST("pool-vstorage");
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
@@ -0,0 +1,755 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks of the core util and conf data structures:
+ *
+ *   tests/utilbench
+ *
+ * Every benchmark works on data generated deterministically at start
+ * up, so results of different builds can be compared. See benchutils.h
+ * for the environment variables controlling the runs and the output.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "benchutils.h"
+#include "internal.h"
+#include "viralloc.h"
+#include "virbitmap.h"
+#include "virbuffer.h"
+#include "virhash.h"
+#include "virjson.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "rpc/virnetmessage.h"
+#include "conf/domain_addr.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define BENCH_HASH_KEYS 10000
+#define BENCH_BITMAP_SIZE 4096
+#define BENCH_JSON_DEVICES 200
+#define BENCH_BUFFER_ELEMENTS 100
+#define BENCH_PCI_DEVICES 500
+
+
+/* Pseudo random sequence that is the same on every run */
+static unsigned int
+benchRandom(unsigned int *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+
+struct benchHashData {
+    virHashTablePtr hash;
+    char **keys;
+    char **extra;
+    size_t nkeys;
+};
+
+
+static int
+benchHashLookup(const void *opaque,
+                unsigned long long iterations)
+{
+    const struct benchHashData *data = opaque;
+    unsigned long long i;
+
+    for (i = 0; i < iterations; i++) {
+        const char *key = data->keys[i % data->nkeys];
+
+        if (virHashLookup(data->hash, key) != key) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "key '%s' not found", key);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+benchHashAddRemove(const void *opaque,
+                   unsigned long long iterations)
+{
+    const struct benchHashData *data = opaque;
+    unsigned long long i;
+
+    for (i = 0; i < iterations; i++) {
+        char *key = data->extra[i % data->nkeys];
+
+        if (virHashAddEntry(data->hash, key, key) < 0 ||
+            virHashRemoveEntry(data->hash, key) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+benchHashCreate(const void *opaque,
+                unsigned long long iterations)
+{
+    const struct benchHashData *data = opaque;
+    virHashTablePtr hash;
+    unsigned long long i;
+    size_t j;
+
+    for (i = 0; i < iterations; i++) {
+        if (!(hash = virHashCreate(0, NULL)))
+            return -1;
+
+        for (j = 0; j < data->nkeys; j++) {
+            if (virHashAddEntry(hash, data->keys[j], data->keys[j]) < 0) {
+                virHashFree(hash);
+                return -1;
+            }
+        }
+
+        virHashFree(hash);
+    }
+
+    return 0;
+}
+
+
+static int
+benchHash(void)
+{
+    struct benchHashData data = { 0 };
+    unsigned int flags[] = { 0, VIR_HASH_OPEN_ADDRESSING };
+    const char *suffix[] = { "", "-open" };
+    char *name = NULL;
+    size_t i, j;
+    int ret = -1;
+
+    data.nkeys = BENCH_HASH_KEYS;
+    if (VIR_ALLOC_N(data.keys, data.nkeys) < 0 ||
+        VIR_ALLOC_N(data.extra, data.nkeys) < 0)
+        goto cleanup;
+
+    for (i = 0; i < data.nkeys; i++) {
+        if (virAsprintf(&data.keys[i], "guest-%zu", i) < 0 ||
+            virAsprintf(&data.extra[i], "extra-guest-%zu", i) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(flags); i++) {
+        if (!(data.hash = virHashCreateFlags(0, NULL, flags[i])))
+            goto cleanup;
+
+        for (j = 0; j < data.nkeys; j++) {
+            if (virHashAddEntry(data.hash, data.keys[j], data.keys[j]) < 0)
+                goto cleanup;
+        }
+
+        if (virAsprintf(&name, "hash/lookup%s", suffix[i]) < 0 ||
+            virBenchRun(name, benchHashLookup, &data) < 0)
+            goto cleanup;
+        VIR_FREE(name);
+
+        if (virAsprintf(&name, "hash/add-remove%s", suffix[i]) < 0 ||
+            virBenchRun(name, benchHashAddRemove, &data) < 0)
+            goto cleanup;
+        VIR_FREE(name);
+
+        virHashFree(data.hash);
+        data.hash = NULL;
+    }
+
+    if (virBenchRun("hash/create-10000", benchHashCreate, &data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(data.hash);
+    VIR_FREE(name);
+    for (i = 0; i < data.nkeys; i++) {
+        if (data.keys)
+            VIR_FREE(data.keys[i]);
+        if (data.extra)
+            VIR_FREE(data.extra[i]);
+    }
+    VIR_FREE(data.keys);
+    VIR_FREE(data.extra);
+    return ret;
+}
+
+
+#if WITH_YAJL
+struct benchJSONData {
+    char *str;
+    virJSONValuePtr value;
+};
+
+
+static int
+benchJSONParse(const void *opaque,
+               unsigned long long iterations)
+{
+    const struct benchJSONData *data = opaque;
+    virJSONValuePtr value;
+    unsigned long long i;
+
+    for (i = 0; i < iterations; i++) {
+        if (!(value = virJSONValueFromString(data->str)))
+            return -1;
+        virJSONValueFree(value);
+    }
+
+    return 0;
+}
+
+
+static int
+benchJSONFormat(const void *opaque,
+                unsigned long long iterations)
+{
+    const struct benchJSONData *data = opaque;
+    char *str;
+    unsigned long long i;
+
+    for (i = 0; i < iterations; i++) {
+        if (!(str = virJSONValueToString(data->value, false)))
+            return -1;
+        VIR_FREE(str);
+    }
+
+    return 0;
+}
+
+
+/* A document shaped like the reply to QMP query-block */
+static char *
+benchJSONDocument(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    virBufferAddLit(&buf, "{\"return\": [");
+    for (i = 0; i < BENCH_JSON_DEVICES; i++) {
+        if (i)
+            virBufferAddLit(&buf, ", ");
+        virBufferAsprintf(&buf,
+                          "{\"device\": \"drive-virtio-disk%zu\", "
+                          "\"locked\": false, \"removable\": false, "
+                          "\"type\": \"unknown\", \"io-status\": \"ok\", "
+                          "\"inserted\": {\"iops_rd\": 0, \"iops_wr\": 0, "
+                          "\"ro\": false, \"backing_file_depth\": %zu, "
+                          "\"drv\": \"qcow2\", \"encrypted\": false, "
+                          "\"bps\": 0, \"bps_rd\": 0, \"bps_wr\": 0, "
+                          "\"write_threshold\": 0, \"cache\": "
+                          "{\"no-flush\": false, \"direct\": true, "
+                          "\"writeback\": true}, \"detect_zeroes\": \"off\", "
+                          "\"file\": \"/var/lib/libvirt/images/disk%zu.qcow2\", "
+                          "\"image\": {\"virtual-size\": %llu, "
+                          "\"filename\": \"/var/lib/libvirt/images/disk%zu.qcow2\", "
+                          "\"format\": \"qcow2\", \"actual-size\": 1.5e9, "
+                          "\"dirty-flag\": false}}}",
+                          i, i % 3, i, (unsigned long long) i << 30, i);
+    }
+    virBufferAddLit(&buf, "], \"id\": \"libvirt-42\"}");
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+static int
+benchJSON(void)
+{
+    struct benchJSONData data = { 0 };
+    int ret = -1;
+
+    if (!(data.str = benchJSONDocument()) ||
+        !(data.value = virJSONValueFromString(data.str)))
+        goto cleanup;
+
+    if (virBenchRun("json/parse-query-block", benchJSONParse, &data) < 0 ||
+        virBenchRun("json/format-query-block", benchJSONFormat, &data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(data.value);
+    VIR_FREE(data.str);
+    return ret;
+}
+#else /* !WITH_YAJL */
+static int
+benchJSON(void)
+{
+    fprintf(stderr, "libvirt not compiled with yajl, skipping JSON\n");
+    return 0;
+}
+#endif /* !WITH_YAJL */
+
+
+/* Build a document the way the XML formatters do */
+static int
+benchBufferFormat(const void *opaque ATTRIBUTE_UNUSED,
+                  unsigned long long iterations)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    unsigned long long i;
+    char *str;
+    size_t j;
+
+    for (i = 0; i < iterations; i++) {
+        virBufferAddLit(&buf, "<domain type='kvm'>\n");
+        virBufferAdjustIndent(&buf, 2);
+        for (j = 0; j < BENCH_BUFFER_ELEMENTS; j++) {
+            virBufferAsprintf(&buf, "<disk type='file' device='disk' "
+                              "index='%zu'>\n", j);
+            virBufferAdjustIndent(&buf, 2);
+            virBufferEscapeString(&buf, "<source file='%s'/>\n",
+                                  "/var/lib/libvirt/images/a&b.qcow2");
+            virBufferAddLit(&buf, "<target dev='vda' bus='virtio'/>\n");
+            virBufferAdjustIndent(&buf, -2);
+            virBufferAddLit(&buf, "</disk>\n");
+        }
+        virBufferAdjustIndent(&buf, -2);
+        virBufferAddLit(&buf, "</domain>\n");
+
+        if (virBufferCheckError(&buf) < 0)
+            return -1;
+        str = virBufferContentAndReset(&buf);
+        VIR_FREE(str);
+    }
+
+    return 0;
+}
+
+
+static int
+benchBufferAddChar(const void *opaque ATTRIBUTE_UNUSED,
+                   unsigned long long iterations)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    unsigned long long i;
+
+    for (i = 0; i < iterations; i++) {
+        virBufferAddChar(&buf, 'a' + i % 26);
+
+        /* Keep the buffer to a size typical for XML documents */
+        if (virBufferUse(&buf) >= 64 * 1024)
+            virBufferFreeAndReset(&buf);
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return -1;
+    virBufferFreeAndReset(&buf);
+    return 0;
+}
+
+
+static int
+benchBuffer(void)
+{
+    if (virBenchRun("buffer/format-document", benchBufferFormat, NULL) < 0 ||
+        virBenchRun("buffer/add-char", benchBufferAddChar, NULL) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+struct benchBitmapData {
+    virBitmapPtr bitmap;
+    char *str;
+    unsigned int *bits;
+    size_t nbits;
+};
+
+
+static int
+benchBitmapSetClear(const void *opaque,
+                    unsigned long long iterations)
+{
+    const struct benchBitmapData *data = opaque;
+    unsigned long long i;
+
+    for (i = 0; i < iterations; i++) {
+        unsigned int b = data->bits[i % data->nbits];
+
+        if (virBitmapSetBit(data->bitmap, b) < 0 ||
+            virBitmapClearBit(data->bitmap, b) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+benchBitmapFormat(const void *opaque,
+                  unsigned long long iterations)
+{
+    const struct benchBitmapData *data = opaque;
+    unsigned long long i;
+    char *str;
+
+    for (i = 0; i < iterations; i++) {
+        if (!(str = virBitmapFormat(data->bitmap)))
+            return -1;
+        VIR_FREE(str);
+    }
+
+    return 0;
+}
+
+
+static int
+benchBitmapParse(const void *opaque,
+                 unsigned long long iterations)
+{
+    const struct benchBitmapData *data = opaque;
+    virBitmapPtr bitmap;
+    unsigned long long i;
+
+    for (i = 0; i < iterations; i++) {
+        if (virBitmapParse(data->str, &bitmap, BENCH_BITMAP_SIZE) < 0)
+            return -1;
+        virBitmapFree(bitmap);
+    }
+
+    return 0;
+}
+
+
+static int
+benchBitmapNextSetBit(const void *opaque,
+                      unsigned long long iterations)
+{
+    const struct benchBitmapData *data = opaque;
+    unsigned long long i;
+    ssize_t pos;
+    size_t count;
+
+    for (i = 0; i < iterations; i++) {
+        pos = -1;
+        count = 0;
+        while ((pos = virBitmapNextSetBit(data->bitmap, pos)) >= 0)
+            count++;
+
+        if (count != virBitmapCountBits(data->bitmap)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           "bit count mismatch");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+benchBitmap(void)
+{
+    struct benchBitmapData data = { 0 };
+    unsigned int state = 1;
+    size_t i;
+    int ret = -1;
+
+    data.nbits = BENCH_BITMAP_SIZE;
+    if (!(data.bitmap = virBitmapNew(BENCH_BITMAP_SIZE)) ||
+        VIR_ALLOC_N(data.bits, data.nbits) < 0)
+        goto cleanup;
+
+    for (i = 0; i < data.nbits; i++)
+        data.bits[i] = benchRandom(&state) % BENCH_BITMAP_SIZE;
+
+    /* A mix of ranges and single bits, like host CPU or NUMA sets */
+    for (i = 0; i < BENCH_BITMAP_SIZE; i++) {
+        if ((i / 64) % 2 == 0 || benchRandom(&state) % 4 == 0)
+            ignore_value(virBitmapSetBit(data.bitmap, i));
+    }
+
+    if (!(data.str = virBitmapFormat(data.bitmap)))
+        goto cleanup;
+
+    if (virBenchRun("bitmap/format", benchBitmapFormat, &data) < 0 ||
+        virBenchRun("bitmap/parse", benchBitmapParse, &data) < 0 ||
+        virBenchRun("bitmap/next-set-bit", benchBitmapNextSetBit, &data) < 0)
+        goto cleanup;
+
+    virBitmapClearAll(data.bitmap);
+    if (virBenchRun("bitmap/set-clear", benchBitmapSetClear, &data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virBitmapFree(data.bitmap);
+    VIR_FREE(data.bits);
+    VIR_FREE(data.str);
+    return ret;
+}
+
+
+struct benchNetMessageData {
+    virNetMessageError err;
+    char *buffer;
+};
+
+
+static virNetMessagePtr
+benchNetMessageEncode(const struct benchNetMessageData *data)
+{
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetMessageNew(false)))
+        return NULL;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_MESSAGE;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_ERROR;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError,
+                                   (void *) &data->err) < 0) {
+        virNetMessageFree(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+
+static int
+benchNetMessageEncodeRun(const void *opaque,
+                         unsigned long long iterations)
+{
+    const struct benchNetMessageData *data = opaque;
+    virNetMessagePtr msg;
+    unsigned long long i;
+
+    for (i = 0; i < iterations; i++) {
+        if (!(msg = benchNetMessageEncode(data)))
+            return -1;
+        virNetMessageFree(msg);
+    }
+
+    return 0;
+}
+
+
+/* Follows what virNetSocket and virNetClient do for incoming data */
+static int
+benchNetMessageDecodeRun(const void *opaque,
+                         unsigned long long iterations)
+{
+    const struct benchNetMessageData *data = opaque;
+    virNetMessageError err;
+    virNetMessagePtr msg;
+    unsigned long long i;
+    int ret;
+
+    for (i = 0; i < iterations; i++) {
+        if (!(msg = virNetMessageNew(false)))
+            return -1;
+
+        memset(&err, 0, sizeof(err));
+        ret = -1;
+
+        if (virNetMessageGrowBuffer(msg, VIR_NET_MESSAGE_LEN_MAX, 0) < 0)
+            goto next;
+        msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+        memcpy(msg->buffer, data->buffer, msg->bufferLength);
+
+        if (virNetMessageDecodeLength(msg) < 0)
+            goto next;
+        memcpy(msg->buffer + msg->bufferOffset,
+               data->buffer + msg->bufferOffset,
+               msg->bufferLength - msg->bufferOffset);
+
+        if (virNetMessageDecodeHeader(msg) < 0 ||
+            virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageError,
+                                       &err) < 0)
+            goto next;
+
+        ret = 0;
+     next:
+        xdr_free((xdrproc_t)xdr_virNetMessageError, (void *) &err);
+        virNetMessageFree(msg);
+        if (ret < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+benchNetMessage(void)
+{
+    struct benchNetMessageData data = { { 0 } };
+    char *message = NULL;
+    char *str1 = NULL;
+    char *str2 = NULL;
+    virNetMessagePtr msg = NULL;
+    int ret = -1;
+
+    if (VIR_STRDUP(message, "Requested operation is not valid: "
+                   "domain is not running") < 0 ||
+        VIR_STRDUP(str1, "guest-1") < 0 ||
+        VIR_STRDUP(str2, "migration in progress") < 0)
+        goto cleanup;
+
+    data.err.code = VIR_ERR_OPERATION_INVALID;
+    data.err.domain = VIR_FROM_QEMU;
+    data.err.level = VIR_ERR_ERROR;
+    data.err.message = &message;
+    data.err.str1 = &str1;
+    data.err.str2 = &str2;
+    data.err.int1 = -1;
+    data.err.int2 = -1;
+
+    if (!(msg = benchNetMessageEncode(&data)) ||
+        VIR_ALLOC_N(data.buffer, msg->bufferLength) < 0)
+        goto cleanup;
+    memcpy(data.buffer, msg->buffer, msg->bufferLength);
+
+    if (virBenchRun("netmessage/encode-error", benchNetMessageEncodeRun,
+                    &data) < 0 ||
+        virBenchRun("netmessage/decode-error", benchNetMessageDecodeRun,
+                    &data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virNetMessageFree(msg);
+    VIR_FREE(data.buffer);
+    VIR_FREE(message);
+    VIR_FREE(str1);
+    VIR_FREE(str2);
+    return ret;
+}
+
+
+struct benchPCIAddressData {
+    virDomainControllerModelPCI rootModel;
+    /* alternately used for the devices */
+    virDomainPCIConnectFlags flags[2];
+};
+
+
+/* Assign addresses to a definition with lots of devices the way
+ * qemuDomainAssignPCIAddresses() does on its first pass, adding
+ * buses as needed */
+static int
+benchPCIAddressAssign(const void *opaque,
+                      unsigned long long iterations)
+{
+    const struct benchPCIAddressData *data = opaque;
+    virDomainPCIAddressSetPtr addrs = NULL;
+    virDomainDeviceInfo info = { 0 };
+    unsigned long long i;
+    size_t j;
+    int ret = -1;
+
+    for (i = 0; i < iterations; i++) {
+        if (!(addrs = virDomainPCIAddressSetAlloc(1)) ||
+            virDomainPCIAddressBusSetModel(&addrs->buses[0],
+                                           data->rootModel) < 0)
+            goto cleanup;
+        addrs->dryRun = true;
+
+        for (j = 0; j < BENCH_PCI_DEVICES; j++) {
+            if (virDomainPCIAddressReserveNextAddr(addrs, &info,
+                                                   data->flags[j % 2],
+                                                   -1) < 0)
+                goto cleanup;
+        }
+
+        virDomainPCIAddressSetFree(addrs);
+        addrs = NULL;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virDomainPCIAddressSetFree(addrs);
+    return ret;
+}
+
+
+static int
+benchPCIAddress(void)
+{
+    struct benchPCIAddressData pci = {
+        VIR_DOMAIN_CONTROLLER_MODEL_PCI_ROOT,
+        { VIR_PCI_CONNECT_TYPE_PCI_DEVICE | VIR_PCI_CONNECT_HOTPLUGGABLE,
+          VIR_PCI_CONNECT_TYPE_PCI_DEVICE },
+    };
+    struct benchPCIAddressData pcie = {
+        VIR_DOMAIN_CONTROLLER_MODEL_PCIE_ROOT,
+        { VIR_PCI_CONNECT_TYPE_PCIE_DEVICE | VIR_PCI_CONNECT_HOTPLUGGABLE,
+          VIR_PCI_CONNECT_TYPE_PCIE_DEVICE },
+    };
+
+    if (virBenchRun("pciaddr/assign-pci-500", benchPCIAddressAssign,
+                    &pci) < 0 ||
+        virBenchRun("pciaddr/assign-pcie-500", benchPCIAddressAssign,
+                    &pcie) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    if (argc > 1) {
+        fprintf(stderr, "%s\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (virThreadInitialize() < 0 ||
+        virErrorInitialize() < 0)
+        return EXIT_FAILURE;
+
+    if (benchHash() < 0 ||
+        benchJSON() < 0 ||
+        benchBuffer() < 0 ||
+        benchBitmap() < 0 ||
+        benchNetMessage() < 0 ||
+        benchPCIAddress() < 0) {
+        fprintf(stderr, "%s\n", virGetLastErrorMessage());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
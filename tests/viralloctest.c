@@ -418,6 +418,77 @@ testDispose(const void *opaque ATTRIBUTE_UNUSED)
 }
 
 
+static int
+testArena(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virAllocArenaPtr arena;
+    testDummyStruct *t[1000];
+    testDummyStruct *big = NULL;
+    char *str = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (!(arena = virAllocArenaNew(1024)))
+        return -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(t); i++) {
+        if (VIR_ARENA_ALLOC(arena, t[i]) < 0)
+            goto cleanup;
+
+        if (testCheckNonNull(t[i]) < 0)
+            goto cleanup;
+
+        if (t[i]->a != 0 || t[i]->b != 0) {
+            fprintf(stderr, "Allocated ram was not zerod\n");
+            goto cleanup;
+        }
+
+        if ((uintptr_t) t[i] % sizeof(void *) != 0) {
+            fprintf(stderr, "Allocated ram is not aligned\n");
+            goto cleanup;
+        }
+
+        t[i]->a = i;
+        t[i]->b = -(int) i;
+    }
+
+    /* Bigger than the chunk size */
+    if (VIR_ARENA_ALLOC_N(arena, big, 1000) < 0)
+        goto cleanup;
+
+    for (i = 0; i < 1000; i++) {
+        if (big[i].a != 0 || big[i].b != 0) {
+            fprintf(stderr, "Allocated ram was not zerod\n");
+            goto cleanup;
+        }
+        big[i].a = 1;
+    }
+
+    if (VIR_ARENA_STRDUP(arena, str, NULL) != 0 || str) {
+        fprintf(stderr, "Duplicating NULL should not allocate\n");
+        goto cleanup;
+    }
+
+    if (VIR_ARENA_STRDUP(arena, str, "test") != 1 ||
+        STRNEQ_NULLABLE(str, "test")) {
+        fprintf(stderr, "String was not duplicated\n");
+        goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(t); i++) {
+        if (t[i]->a != (int) i || t[i]->b != -(int) i) {
+            fprintf(stderr, "Allocations overlap\n");
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    virAllocArenaFree(arena);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -437,6 +508,8 @@ mymain(void)
         ret = -1;
     if (virTestRun("dispose tests", testDispose, NULL) < 0)
         ret = -1;
+    if (virTestRun("arena", testArena, NULL) < 0)
+        ret = -1;
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
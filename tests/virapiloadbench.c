@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Drive a concurrent mix of domain APIs against a connection:
+ *
+ *   tests/virapiloadbench URI [THREADS] [SECONDS]
+ *
+ * THREADS (8 by default) workers each open their own connection to URI
+ * and for SECONDS (10 by default) keep listing all domains, looking
+ * them up by name, getting their info and defining and undefining new
+ * ones, while the main connection counts the lifecycle events that
+ * causes. It is meant to be run against the synthesized population of
+ * the test driver, directly or through the daemon, for example
+ *
+ *   tests/virapiloadbench 'test+unix:///scale?domains=10000' 32 30
+ *
+ * The average latency of every kind of call is printed as described in
+ * benchutils.h.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "benchutils.h"
+#include "internal.h"
+#include "viralloc.h"
+#include "viratomic.h"
+#include "virerror.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Domains each worker looks up in advance for virDomainGetInfo */
+#define BENCH_INFO_DOMAINS 1000
+
+typedef enum {
+    BENCH_OP_LIST,
+    BENCH_OP_LOOKUP,
+    BENCH_OP_GETINFO,
+    BENCH_OP_DEFINE,
+
+    BENCH_OP_LAST
+} benchOp;
+
+static const char *benchOpNames[BENCH_OP_LAST] = {
+    "load/list-all-domains",
+    "load/lookup-by-name",
+    "load/get-info",
+    "load/define-undefine",
+};
+
+/* Out of every 100 calls */
+static const unsigned int benchOpWeights[BENCH_OP_LAST] = {
+    5, 45, 45, 5,
+};
+
+typedef struct _benchWorker benchWorker;
+typedef benchWorker *benchWorkerPtr;
+struct _benchWorker {
+    virThread thread;
+    const char *uri;
+    size_t id;
+    char **names;
+    size_t nnames;
+    unsigned long long deadline;
+
+    unsigned long long count[BENCH_OP_LAST];
+    unsigned long long ns[BENCH_OP_LAST];
+    bool failed;
+};
+
+static int benchEvents;
+static volatile bool benchQuit;
+
+
+static unsigned int
+benchRandom(unsigned int *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+
+static int
+benchWorkerCall(benchWorkerPtr worker,
+                virConnectPtr conn,
+                virDomainPtr *doms,
+                size_t ndoms,
+                benchOp op,
+                unsigned int rnd,
+                unsigned long long serial)
+{
+    virDomainPtr *list = NULL;
+    virDomainPtr dom = NULL;
+    virDomainInfo info;
+    char *xml = NULL;
+    int n;
+    int ret = -1;
+
+    switch (op) {
+    case BENCH_OP_LIST:
+        if ((n = virConnectListAllDomains(conn, &list, 0)) < 0)
+            goto cleanup;
+        while (n--)
+            virDomainFree(list[n]);
+        break;
+
+    case BENCH_OP_LOOKUP:
+        if (!(dom = virDomainLookupByName(conn,
+                                          worker->names[rnd % worker->nnames])))
+            goto cleanup;
+        break;
+
+    case BENCH_OP_GETINFO:
+        if (virDomainGetInfo(doms[rnd % ndoms], &info) < 0)
+            goto cleanup;
+        break;
+
+    case BENCH_OP_DEFINE:
+        if (virAsprintf(&xml,
+                        "<domain type='test'>"
+                        "  <name>load-%zu-%llu</name>"
+                        "  <memory>1048576</memory>"
+                        "  <os><type>hvm</type></os>"
+                        "</domain>",
+                        worker->id, serial) < 0 ||
+            !(dom = virDomainDefineXML(conn, xml)) ||
+            virDomainUndefine(dom) < 0)
+            goto cleanup;
+        break;
+
+    case BENCH_OP_LAST:
+        break;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (dom)
+        virDomainFree(dom);
+    VIR_FREE(list);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static void
+benchWorkerRun(void *opaque)
+{
+    benchWorkerPtr worker = opaque;
+    virConnectPtr conn = NULL;
+    virDomainPtr *doms = NULL;
+    size_t ndoms = 0;
+    unsigned int state = worker->id + 1;
+    unsigned long long serial = 0;
+    unsigned long long start, end;
+    size_t i;
+
+    if (!(conn = virConnectOpen(worker->uri)))
+        goto error;
+
+    ndoms = MIN(worker->nnames, BENCH_INFO_DOMAINS);
+    if (VIR_ALLOC_N(doms, ndoms) < 0)
+        goto error;
+    for (i = 0; i < ndoms; i++) {
+        if (!(doms[i] = virDomainLookupByName(conn, worker->names[i])))
+            goto error;
+    }
+
+    do {
+        unsigned int rnd = benchRandom(&state);
+        unsigned int pick = rnd % 100;
+        benchOp op = 0;
+
+        while (op < BENCH_OP_LAST - 1 && pick >= benchOpWeights[op])
+            pick -= benchOpWeights[op++];
+
+        rnd = benchRandom(&state);
+        if (virBenchNow(&start) < 0 ||
+            benchWorkerCall(worker, conn, doms, ndoms, op, rnd, serial++) < 0 ||
+            virBenchNow(&end) < 0)
+            goto error;
+
+        worker->count[op]++;
+        worker->ns[op] += end - start;
+    } while (end < worker->deadline && !benchQuit);
+
+ cleanup:
+    for (i = 0; i < ndoms; i++) {
+        if (doms[i])
+            virDomainFree(doms[i]);
+    }
+    VIR_FREE(doms);
+    if (conn)
+        virConnectClose(conn);
+    return;
+
+ error:
+    fprintf(stderr, "worker %zu: %s\n", worker->id, virGetLastErrorMessage());
+    worker->failed = true;
+    benchQuit = true;
+    goto cleanup;
+}
+
+
+static int
+benchEventCallback(virConnectPtr conn ATTRIBUTE_UNUSED,
+                   virDomainPtr dom ATTRIBUTE_UNUSED,
+                   int event ATTRIBUTE_UNUSED,
+                   int detail ATTRIBUTE_UNUSED,
+                   void *opaque ATTRIBUTE_UNUSED)
+{
+    virAtomicIntInc(&benchEvents);
+    return 0;
+}
+
+
+static void
+benchEventTimeout(int timer ATTRIBUTE_UNUSED,
+                  void *opaque ATTRIBUTE_UNUSED)
+{
+    /* Only there to wake up the event loop and check benchQuit */
+}
+
+
+static void
+benchEventLoop(void *opaque ATTRIBUTE_UNUSED)
+{
+    while (!benchQuit) {
+        if (virEventRunDefaultImpl() < 0)
+            break;
+    }
+}
+
+
+int
+main(int argc, char **argv)
+{
+    const char *uri;
+    unsigned int nworkers = 8;
+    unsigned int seconds = 10;
+    virConnectPtr conn = NULL;
+    virDomainPtr *list = NULL;
+    char **names = NULL;
+    benchWorkerPtr workers = NULL;
+    size_t nstarted = 0;
+    virThread eventThread;
+    bool eventStarted = false;
+    int callback = -1;
+    int timer = -1;
+    int ndoms = 0;
+    unsigned long long start, end;
+    unsigned long long total = 0;
+    size_t i, j;
+    int ret = EXIT_FAILURE;
+
+    if (argc < 2 || argc > 4 ||
+        (argc > 2 && (virStrToLong_ui(argv[2], NULL, 10, &nworkers) < 0 ||
+                      nworkers == 0)) ||
+        (argc > 3 && (virStrToLong_ui(argv[3], NULL, 10, &seconds) < 0 ||
+                      seconds == 0))) {
+        fprintf(stderr, "%s URI [THREADS] [SECONDS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    uri = argv[1];
+
+    if (virInitialize() < 0 ||
+        virEventRegisterDefaultImpl() < 0)
+        goto cleanup;
+
+    if (!(conn = virConnectOpen(uri)))
+        goto cleanup;
+
+    if ((ndoms = virConnectListAllDomains(conn, &list, 0)) < 0) {
+        ndoms = 0;
+        goto cleanup;
+    }
+    if (ndoms == 0) {
+        fprintf(stderr, "%s has no domains to work with\n", uri);
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(names, ndoms) < 0)
+        goto cleanup;
+    for (i = 0; i < ndoms; i++) {
+        if (VIR_STRDUP(names[i], virDomainGetName(list[i])) < 0)
+            goto cleanup;
+    }
+
+    if ((callback = virConnectDomainEventRegisterAny(conn, NULL,
+                                                     VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                                     VIR_DOMAIN_EVENT_CALLBACK(benchEventCallback),
+                                                     NULL, NULL)) < 0 ||
+        (timer = virEventAddTimeout(100, benchEventTimeout, NULL, NULL)) < 0)
+        goto cleanup;
+
+    if (virThreadCreate(&eventThread, true, benchEventLoop, NULL) < 0) {
+        virReportSystemError(errno, "%s", "Unable to create event thread");
+        goto cleanup;
+    }
+    eventStarted = true;
+
+    if (VIR_ALLOC_N(workers, nworkers) < 0 ||
+        virBenchNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nworkers; i++) {
+        workers[i].uri = uri;
+        workers[i].id = i;
+        workers[i].names = names;
+        workers[i].nnames = ndoms;
+        workers[i].deadline = start + seconds * 1000000000ull;
+
+        if (virThreadCreate(&workers[i].thread, true,
+                            benchWorkerRun, &workers[i]) < 0) {
+            virReportSystemError(errno, "%s", "Unable to create worker");
+            goto cleanup;
+        }
+        nstarted++;
+    }
+
+    for (i = 0; i < nstarted; i++)
+        virThreadJoin(&workers[i].thread);
+    nstarted = 0;
+
+    if (virBenchNow(&end) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nworkers; i++) {
+        if (workers[i].failed)
+            goto cleanup;
+    }
+
+    for (j = 0; j < BENCH_OP_LAST; j++) {
+        unsigned long long count = 0;
+        unsigned long long ns = 0;
+
+        for (i = 0; i < nworkers; i++) {
+            count += workers[i].count[j];
+            ns += workers[i].ns[j];
+        }
+        total += count;
+
+        if (virBenchWanted(benchOpNames[j]))
+            virBenchReport(benchOpNames[j], count, ns);
+    }
+
+    fprintf(stderr, "%llu calls by %u threads in %.1f s (%.0f calls/s), "
+            "%d lifecycle events\n",
+            total, nworkers, (end - start) / 1e9,
+            total / ((end - start) / 1e9),
+            virAtomicIntGet(&benchEvents));
+
+    ret = EXIT_SUCCESS;
+
+ cleanup:
+    if (ret != EXIT_SUCCESS)
+        fprintf(stderr, "%s\n", virGetLastErrorMessage());
+    benchQuit = true;
+    for (i = 0; i < nstarted; i++)
+        virThreadJoin(&workers[i].thread);
+    if (eventStarted)
+        virThreadJoin(&eventThread);
+    if (timer >= 0)
+        virEventRemoveTimeout(timer);
+    if (callback >= 0)
+        virConnectDomainEventDeregisterAny(conn, callback);
+    for (i = 0; i < ndoms; i++) {
+        if (list)
+            virDomainFree(list[i]);
+        if (names)
+            VIR_FREE(names[i]);
+    }
+    VIR_FREE(list);
+    VIR_FREE(names);
+    VIR_FREE(workers);
+    if (conn)
+        virConnectClose(conn);
+    return ret;
+}
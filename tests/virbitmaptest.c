@@ -662,6 +662,63 @@ test12(const void *opaque ATTRIBUTE_UNUSED)
     return ret;
 }
 
+
+/* test range APIs */
+static int
+test13(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBitmapPtr map = NULL;
+    int ret = -1;
+
+    if (!(map = virBitmapNew(200)))
+        return -1;
+
+    if (virBitmapSetBitRange(map, 3, 3) < 0 ||
+        virBitmapSetBitRange(map, 60, 130) < 0)
+        goto cleanup;
+
+    TEST_MAP(200, "3,60-130");
+
+    if (virBitmapLastSetBit(map) != 130)
+        goto cleanup;
+
+    if (virBitmapClearBitRange(map, 64, 127) < 0)
+        goto cleanup;
+
+    TEST_MAP(200, "3,60-63,128-130");
+
+    if (virBitmapSetBitRange(map, 190, 199) < 0)
+        goto cleanup;
+
+    TEST_MAP(200, "3,60-63,128-130,190-199");
+
+    if (virBitmapLastSetBit(map) != 199)
+        goto cleanup;
+
+    if (virBitmapSetBitRange(map, 10, 200) == 0 ||
+        virBitmapClearBitRange(map, 20, 10) == 0)
+        goto cleanup;
+
+    TEST_MAP(200, "3,60-63,128-130,190-199");
+
+    if (virBitmapClearBitRange(map, 0, 199) < 0)
+        goto cleanup;
+
+    TEST_MAP(200, "");
+
+    virBitmapFree(map);
+    if (!(map = virBitmapParseUnlimited("1,5-70,^6")))
+        goto cleanup;
+
+    TEST_MAP(71, "1,5,7-70");
+
+    ret = 0;
+
+ cleanup:
+    virBitmapFree(map);
+    return ret;
+}
+
 #undef TEST_MAP
 
 
@@ -710,6 +767,8 @@ mymain(void)
 
     if (virTestRun("test12", test12, NULL) < 0)
         ret = -1;
+    if (virTestRun("test13", test13, NULL) < 0)
+        ret = -1;
 
     return ret;
 }
@@ -404,6 +404,111 @@ testBufEscapeN(const void *opaque)
 }
 
 
+static int
+testBufEscapeStrFormat(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *actual;
+    const char *expect =
+        "  <a>&lt;%s&gt;</a>\n"
+        "  <b>100%</b>\n"
+        "  &lt;c v=&apos;&amp;&apos;/&gt;\n";
+    int ret = -1;
+
+    virBufferAdjustIndent(&buf, 2);
+    virBufferEscapeString(&buf, "<a>%s</a>\n", "<%s>");
+    virBufferEscapeString(&buf, "<b>%s%%</b>\n", "100");
+    virBufferEscapeString(&buf, "%s", "<c v='&'/>");
+    virBufferEscapeString(&buf, "%s", NULL);
+    virBufferEscapeString(&buf, "%s", "\n");
+
+    if (!(actual = virBufferContentAndReset(&buf)))
+        goto cleanup;
+
+    if (STRNEQ(actual, expect)) {
+        virTestDifference(stderr, expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(actual);
+    return ret;
+}
+
+
+static int
+testBufAddNumbers(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *actual = NULL;
+    char *expect = NULL;
+    int ret = -1;
+
+    virBufferAdjustIndent(&buf, 2);
+    virBufferAddLongLong(&buf, 0);
+    virBufferAddLit(&buf, " ");
+    virBufferAddLongLong(&buf, -42);
+    virBufferAddLit(&buf, " ");
+    virBufferAddLongLong(&buf, LLONG_MIN);
+    virBufferAddLit(&buf, " ");
+    virBufferAddLongLong(&buf, LLONG_MAX);
+    virBufferAddLit(&buf, "\n");
+    virBufferAddULongLong(&buf, 7);
+    virBufferAddLit(&buf, " ");
+    virBufferAddULongLong(&buf, ULLONG_MAX);
+
+    if (virAsprintf(&expect, "  0 -42 %lld %lld\n  7 %llu",
+                    LLONG_MIN, LLONG_MAX, ULLONG_MAX) < 0)
+        goto cleanup;
+
+    if (!(actual = virBufferContentAndReset(&buf)))
+        goto cleanup;
+
+    if (STRNEQ(actual, expect)) {
+        virTestDifference(stderr, expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(expect);
+    VIR_FREE(actual);
+    return ret;
+}
+
+
+static int
+testBufGrow(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    const char *content;
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; i < 100000; i++)
+        virBufferEscapeString(&buf, "<a>%s</a>", "&");
+
+    if (!(content = virBufferCurrentContent(&buf)))
+        goto cleanup;
+
+    if (virBufferUse(&buf) != 100000 * strlen("<a>&amp;</a>") ||
+        strlen(content) != virBufferUse(&buf) ||
+        STRNEQLEN(content + virBufferUse(&buf) - 12, "<a>&amp;</a>", 12)) {
+        VIR_TEST_DEBUG("testBufGrow: unexpected content\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    return ret;
+}
+
+
 static int
 testBufSetIndent(const void *opaque ATTRIBUTE_UNUSED)
 {
@@ -451,6 +556,9 @@ mymain(void)
     DO_TEST("Trim", testBufTrim, 0);
     DO_TEST("AddBuffer", testBufAddBuffer, 0);
     DO_TEST("set indent", testBufSetIndent, 0);
+    DO_TEST("EscapeString format", testBufEscapeStrFormat, 0);
+    DO_TEST("AddNumbers", testBufAddNumbers, 0);
+    DO_TEST("Grow", testBufGrow, 0);
 
 #define DO_TEST_ADD_STR(DATA, EXPECT)                                  \
     do {                                                               \
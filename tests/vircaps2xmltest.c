@@ -47,6 +47,7 @@ test_virCapabilities(const void *opaque)
     char *capsXML = NULL;
     char *path = NULL;
     char *dir = NULL;
+    char *resctrl_dir = NULL;
     int ret = -1;
 
     /*
@@ -55,10 +56,13 @@ test_virCapabilities(const void *opaque)
      */
     if (virAsprintf(&dir, "%s/vircaps2xmldata/linux-%s%s",
                     abs_srcdir, data->filename,
-                    data->resctrl ? "/system" : "") < 0)
+                    data->resctrl ? "/system" : "") < 0 ||
+        virAsprintf(&resctrl_dir, "%s/vircaps2xmldata/linux-%s/resctrl",
+                    abs_srcdir, data->filename) < 0)
         goto cleanup;
 
     virFileWrapperAddPrefix("/sys/devices/system", dir);
+    virFileWrapperAddPrefix("/sys/fs/resctrl", resctrl_dir);
     caps = virCapabilitiesNew(data->arch, data->offlineMigrate, data->liveMigrate);
 
     if (!caps)
@@ -84,6 +88,7 @@ test_virCapabilities(const void *opaque)
 
  cleanup:
     VIR_FREE(dir);
+    VIR_FREE(resctrl_dir);
     VIR_FREE(path);
     VIR_FREE(capsXML);
     virObjectUnref(caps);
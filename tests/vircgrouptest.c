@@ -25,6 +25,7 @@
 #ifdef __linux__
 
 # include <stdlib.h>
+# include <unistd.h>
 
 # define __VIR_CGROUP_ALLOW_INCLUDE_PRIV_H__
 # include "vircgrouppriv.h"
@@ -114,6 +115,16 @@ const char *mountsAllInOne[VIR_CGROUP_CONTROLLER_LAST] = {
     [VIR_CGROUP_CONTROLLER_BLKIO] = "/not/really/sys/fs/cgroup",
     [VIR_CGROUP_CONTROLLER_SYSTEMD] = NULL,
 };
+const char *mountsUnified[VIR_CGROUP_CONTROLLER_LAST] = {
+    [VIR_CGROUP_CONTROLLER_CPU] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_CPUACCT] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_CPUSET] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_MEMORY] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_DEVICES] = NULL,
+    [VIR_CGROUP_CONTROLLER_FREEZER] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_BLKIO] = "/not/really/sys/fs/cgroup/unified",
+    [VIR_CGROUP_CONTROLLER_SYSTEMD] = "/not/really/sys/fs/cgroup/unified",
+};
 const char *mountsLogind[VIR_CGROUP_CONTROLLER_LAST] = {
     [VIR_CGROUP_CONTROLLER_CPU] = NULL,
     [VIR_CGROUP_CONTROLLER_CPUACCT] = NULL,
@@ -565,6 +576,139 @@ static int testCgroupNewForSelfLogind(const void *args ATTRIBUTE_UNUSED)
 }
 
 
+static int testCgroupNewForSelfUnified(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    int ret = -1;
+    const char *placement[VIR_CGROUP_CONTROLLER_LAST] = {
+        [VIR_CGROUP_CONTROLLER_CPU] = "/system",
+        [VIR_CGROUP_CONTROLLER_CPUACCT] = "/system",
+        [VIR_CGROUP_CONTROLLER_CPUSET] = "/system",
+        [VIR_CGROUP_CONTROLLER_MEMORY] = "/system",
+        [VIR_CGROUP_CONTROLLER_DEVICES] = NULL,
+        [VIR_CGROUP_CONTROLLER_FREEZER] = "/system",
+        [VIR_CGROUP_CONTROLLER_BLKIO] = "/system",
+        [VIR_CGROUP_CONTROLLER_SYSTEMD] = "/system",
+    };
+
+    if (virCgroupNewSelf(&cgroup) < 0) {
+        fprintf(stderr, "Cannot create cgroup for self\n");
+        goto cleanup;
+    }
+
+    ret = validateCgroup(cgroup, "", mountsUnified, linksLogind, placement);
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+
+static int testCgroupUnified(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    virCgroupPtr thread = NULL;
+    unsigned long long ull, user, sys;
+    long long ll;
+    unsigned long ul;
+    char *str = NULL;
+    int rv, ret = -1;
+
+    if ((rv = virCgroupNewPartition("/virtualmachines", true, -1,
+                                    &cgroup)) < 0) {
+        fprintf(stderr, "Could not create /virtualmachines cgroup: %d\n", -rv);
+        goto cleanup;
+    }
+
+    if (virCgroupSetCpuShares(cgroup, 2048) < 0 ||
+        virCgroupGetCpuShares(cgroup, &ull) < 0 || ull != 2048) {
+        fprintf(stderr, "Wrong cpu shares from cpu.weight\n");
+        goto cleanup;
+    }
+
+    if (virCgroupSetCpuCfsPeriod(cgroup, 200000) < 0 ||
+        virCgroupGetCpuCfsPeriod(cgroup, &ull) < 0 || ull != 200000 ||
+        virCgroupGetCpuCfsQuota(cgroup, &ll) < 0 || ll != -1) {
+        fprintf(stderr, "Wrong cfs period and quota from cpu.max\n");
+        goto cleanup;
+    }
+
+    if (virCgroupGetCpuacctUsage(cgroup, &ull) < 0 ||
+        ull != 2787788855000ULL) {
+        fprintf(stderr, "Wrong cpu usage from cpu.stat\n");
+        goto cleanup;
+    }
+
+    if (virCgroupGetCpuacctStat(cgroup, &user, &sys) < 0 ||
+        user != 2166870000ULL || sys != 434213000ULL) {
+        fprintf(stderr, "Wrong user and system time from cpu.stat\n");
+        goto cleanup;
+    }
+
+    if (virCgroupGetMemoryUsage(cgroup, &ul) < 0 || ul != 1421212UL) {
+        fprintf(stderr, "Wrong memory usage from memory.current\n");
+        goto cleanup;
+    }
+
+    if (virCgroupGetMemoryHardLimit(cgroup, &ull) < 0 ||
+        ull != VIR_DOMAIN_MEMORY_PARAM_UNLIMITED) {
+        fprintf(stderr, "Expected an unlimited memory.max\n");
+        goto cleanup;
+    }
+
+    if (virCgroupSetMemoryHardLimit(cgroup, 1048576) < 0 ||
+        virCgroupGetMemoryHardLimit(cgroup, &ull) < 0 || ull != 1048576) {
+        fprintf(stderr, "Wrong hard limit from memory.max\n");
+        goto cleanup;
+    }
+
+    if (virCgroupSetMemSwapHardLimit(cgroup, 3145728) < 0 ||
+        virCgroupGetMemSwapHardLimit(cgroup, &ull) < 0 || ull != 3145728) {
+        fprintf(stderr, "Wrong swap hard limit from memory.swap.max\n");
+        goto cleanup;
+    }
+
+    if (virFileReadAll("/not/really/sys/fs/cgroup/unified/"
+                       "virtualmachines.partition/memory.swap.max",
+                       1024, &str) < 0 ||
+        STRNEQ(str, "2147483648")) {
+        fprintf(stderr, "Expected memory.swap.max to exclude the memory\n");
+        goto cleanup;
+    }
+    VIR_FREE(str);
+
+    if (virCgroupSetFreezerState(cgroup, "FROZEN") < 0 ||
+        virCgroupGetFreezerState(cgroup, &str) < 0 ||
+        STRNEQ(str, "FREEZING")) {
+        fprintf(stderr, "Wrong state from cgroup.freeze\n");
+        goto cleanup;
+    }
+    VIR_FREE(str);
+
+    if (virCgroupNewThread(cgroup, VIR_CGROUP_THREAD_VCPU, 0, true,
+                           &thread) < 0) {
+        fprintf(stderr, "Cannot create vcpu0 cgroup\n");
+        goto cleanup;
+    }
+
+    if (virFileReadAll("/not/really/sys/fs/cgroup/unified/"
+                       "virtualmachines.partition/vcpu0/cgroup.type",
+                       1024, &str) < 0 ||
+        STRNEQ(str, "threaded")) {
+        fprintf(stderr, "Expected a threaded vcpu0 cgroup\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(str);
+    virCgroupFree(&thread);
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+
 static int testCgroupAvailable(const void *args)
 {
     bool got = virCgroupAvailable();
@@ -692,6 +836,120 @@ static int testCgroupGetPercpuStats(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
+static int testCgroupGetCpuacctStat(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    size_t i;
+    int rv, ret = -1;
+    unsigned long long usage;
+    unsigned long long user;
+    unsigned long long sys;
+    unsigned long long scale = 1000000000ULL / sysconf(_SC_CLK_TCK);
+
+    if ((rv = virCgroupNewPartition("/virtualmachines", true,
+                                    (1 << VIR_CGROUP_CONTROLLER_CPU) |
+                                    (1 << VIR_CGROUP_CONTROLLER_CPUACCT),
+                                    &cgroup)) < 0) {
+        fprintf(stderr, "Could not create /virtualmachines cgroup: %d\n", -rv);
+        goto cleanup;
+    }
+
+    /* the second round reads through the cached descriptors */
+    for (i = 0; i < 2; i++) {
+        if ((rv = virCgroupGetCpuacctUsage(cgroup, &usage)) < 0) {
+            fprintf(stderr, "Could not retrieve CpuacctUsage for /virtualmachines cgroup: %d\n", -rv);
+            goto cleanup;
+        }
+
+        if (usage != 2787788855799582ULL) {
+            fprintf(stderr,
+                    "Wrong value from virCgroupGetCpuacctUsage at %zu (is %llu)\n",
+                    i, usage);
+            goto cleanup;
+        }
+
+        if ((rv = virCgroupGetCpuacctStat(cgroup, &user, &sys)) < 0) {
+            fprintf(stderr, "Could not retrieve CpuacctStat for /virtualmachines cgroup: %d\n", -rv);
+            goto cleanup;
+        }
+
+        if (user != 216687025ULL * scale || sys != 43421396ULL * scale) {
+            fprintf(stderr,
+                    "Wrong values from virCgroupGetCpuacctStat at %zu (is %llu %llu)\n",
+                    i, user, sys);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+static int testCgroupBatch(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    int rv, ret = -1;
+    unsigned long long shares;
+    unsigned long long period;
+
+    if ((rv = virCgroupNewPartition("/virtualmachines", true,
+                                    (1 << VIR_CGROUP_CONTROLLER_CPU) |
+                                    (1 << VIR_CGROUP_CONTROLLER_CPUACCT),
+                                    &cgroup)) < 0) {
+        fprintf(stderr, "Could not create /virtualmachines cgroup: %d\n", -rv);
+        goto cleanup;
+    }
+
+    if (virCgroupBatchBegin(cgroup) < 0 ||
+        virCgroupBatchBegin(cgroup) < 0) {
+        fprintf(stderr, "Could not start a batch\n");
+        goto cleanup;
+    }
+
+    if (virCgroupSetCpuShares(cgroup, 2048) < 0 ||
+        virCgroupSetCpuCfsPeriod(cgroup, 50000) < 0) {
+        fprintf(stderr, "Could not write values in a batch\n");
+        goto cleanup;
+    }
+
+    /* the inner end must not finish the batch */
+    virCgroupBatchEnd(cgroup);
+
+    if (virCgroupBatchGetWrites(cgroup) != 2) {
+        fprintf(stderr, "Wrong count of writes in the batch (is %zu)\n",
+                virCgroupBatchGetWrites(cgroup));
+        goto cleanup;
+    }
+
+    virCgroupBatchEnd(cgroup);
+
+    if (virCgroupBatchGetWrites(cgroup) != 0) {
+        fprintf(stderr, "Batch not finished\n");
+        goto cleanup;
+    }
+
+    if (virCgroupGetCpuShares(cgroup, &shares) < 0 ||
+        virCgroupGetCpuCfsPeriod(cgroup, &period) < 0) {
+        fprintf(stderr, "Could not read back values written in a batch\n");
+        goto cleanup;
+    }
+
+    if (shares != 2048 || period != 50000) {
+        fprintf(stderr, "Wrong values written in a batch (is %llu %llu)\n",
+                shares, period);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
 static int testCgroupGetMemoryUsage(const void *args ATTRIBUTE_UNUSED)
 {
     virCgroupPtr cgroup = NULL;
@@ -885,6 +1143,8 @@ mymain(void)
     DETECT_MOUNTS("cgroups3");
     DETECT_MOUNTS("all-in-one");
     DETECT_MOUNTS("no-cgroups");
+    DETECT_MOUNTS("unified");
+    DETECT_MOUNTS("hybrid");
 
     if (virTestRun("New cgroup for self", testCgroupNewForSelf, NULL) < 0)
         ret = -1;
@@ -922,6 +1182,12 @@ mymain(void)
     if (virTestRun("virCgroupGetPercpuStats works", testCgroupGetPercpuStats, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("virCgroupGetCpuacctStat works", testCgroupGetCpuacctStat, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("virCgroupBatch works", testCgroupBatch, NULL) < 0)
+        ret = -1;
+
     setenv("VIR_CGROUP_MOCK_MODE", "allinone", 1);
     if (virTestRun("New cgroup for self (allinone)", testCgroupNewForSelfAllInOne, NULL) < 0)
         ret = -1;
@@ -936,6 +1202,15 @@ mymain(void)
         ret = -1;
     unsetenv("VIR_CGROUP_MOCK_MODE");
 
+    setenv("VIR_CGROUP_MOCK_MODE", "unified", 1);
+    if (virTestRun("New cgroup for self (unified)", testCgroupNewForSelfUnified, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Cgroup available", testCgroupAvailable, (void*)0x1) < 0)
+        ret = -1;
+    if (virTestRun("Cgroup unified hierarchy", testCgroupUnified, NULL) < 0)
+        ret = -1;
+    unsetenv("VIR_CGROUP_MOCK_MODE");
+
     if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
         virFileDeleteTree(fakerootdir);
 
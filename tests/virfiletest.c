@@ -21,11 +21,14 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <fcntl.h>
 
 #include "testutils.h"
 #include "virfile.h"
 #include "virstring.h"
 
+#define VIR_FROM_THIS VIR_FROM_NONE
+
 
 #if defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R
 static int testFileCheckMounts(const char *prefix,
@@ -118,6 +121,141 @@ testFileSanitizePath(const void *opaque)
 }
 
 
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+
+# define EXTENT 1024 * 1024
+
+struct testFileInData {
+    bool startData;    /* whether the file begins with data */
+    size_t nextents;   /* number of alternating data/hole extents */
+};
+
+
+/* Create a file of @data->nextents extents, each EXTENT bytes
+ * long, alternating between data and holes. Returns a file
+ * descriptor, or -1 with @supported cleared if the underlying
+ * filesystem does not report holes. */
+static int
+makeSparseFile(const struct testFileInData *data,
+               bool *supported)
+{
+    char templ[] = "virFileInDataXXXXXX";
+    char *buf = NULL;
+    bool inData = data->startData;
+    size_t i;
+    int fd;
+
+    *supported = true;
+
+    if ((fd = mkostemp(templ, O_CLOEXEC|O_RDWR)) < 0)
+        return -1;
+    unlink(templ);
+
+    if (VIR_ALLOC_N(buf, EXTENT) < 0)
+        goto error;
+    memset(buf, 'x', EXTENT);
+
+    for (i = 0; i < data->nextents; i++) {
+        if (inData) {
+            if (safewrite(fd, buf, EXTENT) != EXTENT)
+                goto error;
+        } else if (lseek(fd, EXTENT, SEEK_CUR) == (off_t) -1) {
+            goto error;
+        }
+        inData = !inData;
+    }
+
+    if (ftruncate(fd, data->nextents * EXTENT) < 0)
+        goto error;
+
+    /* Check the first extent boundary is reported */
+    if (data->nextents > 1 &&
+        lseek(fd, 0, data->startData ? SEEK_HOLE : SEEK_DATA) != EXTENT)
+        *supported = false;
+
+    VIR_FREE(buf);
+    return fd;
+
+ error:
+    VIR_FREE(buf);
+    VIR_FORCE_CLOSE(fd);
+    return -1;
+}
+
+
+static int
+testFileInData(const void *opaque)
+{
+    const struct testFileInData *data = opaque;
+    bool supported;
+    bool inData = data->startData;
+    int realInData;
+    long long length;
+    size_t i;
+    int ret = -1;
+    int fd;
+
+    if ((fd = makeSparseFile(data, &supported)) < 0)
+        return -1;
+
+    if (!supported) {
+        ret = EXIT_AM_SKIP;
+        goto cleanup;
+    }
+
+    for (i = 0; i < data->nextents; i++) {
+        off_t start = i * EXTENT;
+        off_t offsets[] = { start, start + EXTENT / 2 };
+        size_t j;
+
+        for (j = 0; j < ARRAY_CARDINALITY(offsets); j++) {
+            long long expect = start + EXTENT - offsets[j];
+
+            if (lseek(fd, offsets[j], SEEK_SET) == (off_t) -1)
+                goto cleanup;
+
+            if (virFileInData(fd, &realInData, &length) < 0)
+                goto cleanup;
+
+            if (!!realInData != inData || length != expect) {
+                fprintf(stderr,
+                        "offset %lld: expected inData=%d length=%lld, "
+                        "got inData=%d length=%lld\n",
+                        (long long) offsets[j], inData, expect,
+                        realInData, length);
+                goto cleanup;
+            }
+
+            if (lseek(fd, 0, SEEK_CUR) != offsets[j]) {
+                fprintf(stderr, "file position not restored\n");
+                goto cleanup;
+            }
+        }
+
+        inData = !inData;
+    }
+
+    /* At EOF there is neither data nor a hole */
+    if (lseek(fd, 0, SEEK_END) == (off_t) -1 ||
+        virFileInData(fd, &realInData, &length) < 0)
+        goto cleanup;
+
+    if (realInData || length) {
+        fprintf(stderr, "expected EOF, got inData=%d length=%lld\n",
+                realInData, length);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+#endif /* defined(SEEK_DATA) && defined(SEEK_HOLE) */
+
+
 static int
 mymain(void)
 {
@@ -186,6 +324,23 @@ mymain(void)
     DO_TEST_SANITIZE_PATH_SAME("gluster://bar.baz/fooo//hoo");
     DO_TEST_SANITIZE_PATH_SAME("gluster://bar.baz/fooo///////hoo");
 
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+# define DO_TEST_IN_DATA(inData, nextents)                                  \
+    do {                                                                    \
+        struct testFileInData data = { inData, nextents };                  \
+        if (virTestRun(virTestCounterNext(), testFileInData, &data) < 0)    \
+            ret = -1;                                                       \
+    } while (0)
+
+    virTestCounterReset("testFileInData ");
+    DO_TEST_IN_DATA(true, 1);
+    DO_TEST_IN_DATA(false, 1);
+    DO_TEST_IN_DATA(true, 4);
+    DO_TEST_IN_DATA(false, 4);
+    DO_TEST_IN_DATA(true, 5);
+    DO_TEST_IN_DATA(false, 5);
+#endif /* defined(SEEK_DATA) && defined(SEEK_HOLE) */
+
     return ret != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
@@ -1123,6 +1123,224 @@ testFirewallQuery(const void *opaque ATTRIBUTE_UNUSED)
     return ret;
 }
 
+
+static void
+testFirewallRestoreHook(const char *const*args,
+                        const char *const*env,
+                        const char *input,
+                        char **output,
+                        char **error,
+                        int *status,
+                        void *opaque)
+{
+    virBufferPtr buf = opaque;
+
+    if (STRNEQ(args[0], IPTABLES_RESTORE_PATH) &&
+        STRNEQ(args[0], IP6TABLES_RESTORE_PATH) &&
+        STRNEQ(args[0], EBTABLES_RESTORE_PATH)) {
+        testFirewallRollbackHook(args, env, input, output, error,
+                                 status, NULL);
+        return;
+    }
+
+    /* Record the transaction and fake failure of the whole of it if
+     * it contains the rule which fails when applied on its own */
+    virBufferAdd(buf, input, -1);
+    if (strstr(input, "-A INPUT --source-host 192.168.122.255"))
+        *status = 1;
+}
+
+
+static int
+testFirewallRestoreBatch(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBuffer cmdbuf = VIR_BUFFER_INITIALIZER;
+    virFirewallPtr fw = NULL;
+    int ret = -1;
+    const char *actual = NULL;
+    const char *expected =
+        IPTABLES_RESTORE_PATH " --noflush\n"
+        "*filter\n"
+        "-A INPUT --source-host 192.168.122.1 --jump ACCEPT\n"
+        "-A INPUT --source-host !192.168.122.1 --jump REJECT\n"
+        "COMMIT\n"
+        IPTABLES_PATH " --table nat -A POSTROUTING --jump MASQUERADE\n"
+        IPTABLES_RESTORE_PATH " --noflush\n"
+        "*filter\n"
+        "-A FORWARD -m comment --comment \"libvirt rule\" --jump ACCEPT\n"
+        "-A FORWARD --jump DROP\n"
+        "COMMIT\n"
+        EBTABLES_RESTORE_PATH " --noflush\n"
+        "*nat\n"
+        "-A PREROUTING -i vnet0 -j ACCEPT\n"
+        "-A POSTROUTING -o vnet0 -j ACCEPT\n"
+        "COMMIT\n";
+
+    if (virFirewallSetBackend(VIR_FIREWALL_BACKEND_RESTORE) < 0)
+        goto cleanup;
+
+    virCommandSetDryRun(&cmdbuf, testFirewallRestoreHook, &cmdbuf);
+
+    fw = virFirewallNew();
+
+    virFirewallStartTransaction(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source-host", "192.168.122.1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source-host", "!192.168.122.1",
+                       "--jump", "REJECT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "--table", "nat",
+                       "-A", "POSTROUTING",
+                       "--jump", "MASQUERADE", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "FORWARD",
+                       "-m", "comment", "--comment", "libvirt rule",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "FORWARD",
+                       "--jump", "DROP", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                       "-t", "nat",
+                       "-A", "PREROUTING",
+                       "-i", "vnet0",
+                       "-j", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                       "-t", "nat",
+                       "-A", "POSTROUTING",
+                       "-o", "vnet0",
+                       "-j", "ACCEPT", NULL);
+
+    if (virFirewallApply(fw) < 0)
+        goto cleanup;
+
+    if (virBufferError(&cmdbuf))
+        goto cleanup;
+
+    actual = virBufferCurrentContent(&cmdbuf);
+
+    if (STRNEQ_NULLABLE(expected, actual)) {
+        fprintf(stderr, "Unexected command execution\n");
+        virTestDifference(stderr, expected, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&cmdbuf);
+    virCommandSetDryRun(NULL, NULL, NULL);
+    virFirewallFree(fw);
+    return ret;
+}
+
+
+static int
+testFirewallRestoreRollback(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virBuffer cmdbuf = VIR_BUFFER_INITIALIZER;
+    virFirewallPtr fw = NULL;
+    int ret = -1;
+    const char *actual = NULL;
+    const char *expected =
+        IPTABLES_RESTORE_PATH " --noflush\n"
+        "*filter\n"
+        "-A INPUT --source-host 192.168.122.1 --jump ACCEPT\n"
+        "-A INPUT --source-host 192.168.122.255 --jump REJECT\n"
+        "-A INPUT --source-host 192.168.122.2 --jump ACCEPT\n"
+        "COMMIT\n"
+        IPTABLES_PATH " -A INPUT --source-host 192.168.122.1 --jump ACCEPT\n"
+        IPTABLES_PATH " -A INPUT --source-host 192.168.122.255 --jump REJECT\n"
+        IPTABLES_PATH " -D INPUT --source-host 192.168.122.1 --jump ACCEPT\n"
+        IPTABLES_PATH " -D INPUT --source-host 192.168.122.255 --jump REJECT\n"
+        IPTABLES_PATH " -D INPUT --source-host 192.168.122.2 --jump ACCEPT\n";
+
+    if (virFirewallSetBackend(VIR_FIREWALL_BACKEND_RESTORE) < 0)
+        goto cleanup;
+
+    virCommandSetDryRun(&cmdbuf, testFirewallRestoreHook, &cmdbuf);
+
+    fw = virFirewallNew();
+
+    virFirewallStartTransaction(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source-host", "192.168.122.1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source-host", "192.168.122.255",
+                       "--jump", "REJECT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-A", "INPUT",
+                       "--source-host", "192.168.122.2",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallStartRollback(fw, 0);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-D", "INPUT",
+                       "--source-host", "192.168.122.1",
+                       "--jump", "ACCEPT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-D", "INPUT",
+                       "--source-host", "192.168.122.255",
+                       "--jump", "REJECT", NULL);
+
+    virFirewallAddRule(fw, VIR_FIREWALL_LAYER_IPV4,
+                       "-D", "INPUT",
+                       "--source-host", "192.168.122.2",
+                       "--jump", "ACCEPT", NULL);
+
+    if (virFirewallApply(fw) == 0) {
+        fprintf(stderr, "Firewall apply unexpectedly worked\n");
+        goto cleanup;
+    }
+
+    if (virTestOOMActive())
+        goto cleanup;
+
+    if (virBufferError(&cmdbuf))
+        goto cleanup;
+
+    actual = virBufferCurrentContent(&cmdbuf);
+
+    if (STRNEQ_NULLABLE(expected, actual)) {
+        fprintf(stderr, "Unexected command execution\n");
+        virTestDifference(stderr, expected, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virBufferFreeAndReset(&cmdbuf);
+    virCommandSetDryRun(NULL, NULL, NULL);
+    virFirewallFree(fw);
+    return ret;
+}
+
+
+static bool
+hasNetfilterRestoreTools(void)
+{
+    return virFileIsExecutable(IPTABLES_RESTORE_PATH) &&
+        virFileIsExecutable(IP6TABLES_RESTORE_PATH) &&
+        virFileIsExecutable(EBTABLES_RESTORE_PATH);
+}
+
 static bool
 hasNetfilterTools(void)
 {
@@ -1193,6 +1411,14 @@ mymain(void)
     RUN_TEST("chained rollback", testFirewallChainedRollback);
     RUN_TEST("query transaction", testFirewallQuery);
 
+    if (hasNetfilterRestoreTools()) {
+        if (virTestRun("restore batch", testFirewallRestoreBatch, NULL) < 0)
+            ret = -1;
+        if (virTestRun("restore rollback", testFirewallRestoreRollback,
+                       NULL) < 0)
+            ret = -1;
+    }
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
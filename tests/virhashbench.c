@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compare insert and lookup throughput of chained and open addressing
+ * hash tables, using keys shaped like those of the object lists:
+ *
+ *   tests/virhashbench [ENTRIES]
+ *
+ * ENTRIES (10000 by default) UUID strings and domain names are inserted
+ * into an empty table and then every one of them is looked up 10 times.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "internal.h"
+#include "viralloc.h"
+#include "virhash.h"
+#include "virstring.h"
+#include "virtime.h"
+#include "viruuid.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define BENCH_LOOKUPS 10
+
+
+static int
+benchHash(const char *desc,
+          char **keys,
+          size_t nkeys,
+          unsigned int flags)
+{
+    virHashTablePtr hash = NULL;
+    unsigned long long start, inserted, end;
+    size_t i, j;
+    int ret = -1;
+
+    if (!(hash = virHashCreateFlags(0, NULL, flags)) ||
+        virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nkeys; i++) {
+        if (virHashAddEntry(hash, keys[i], keys[i]) < 0)
+            goto cleanup;
+    }
+
+    if (virTimeMillisNow(&inserted) < 0)
+        goto cleanup;
+
+    for (j = 0; j < BENCH_LOOKUPS; j++) {
+        for (i = 0; i < nkeys; i++) {
+            if (virHashLookup(hash, keys[i]) != keys[i]) {
+                fprintf(stderr, "Key '%s' not found\n", keys[i]);
+                goto cleanup;
+            }
+        }
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    printf("%-6s keys, %-15s: %zu inserts in %llu ms, %zu lookups in %llu ms\n",
+           desc, flags & VIR_HASH_OPEN_ADDRESSING ? "open addressing" : "chained",
+           nkeys, inserted - start, nkeys * BENCH_LOOKUPS, end - inserted);
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(hash);
+    return ret;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    unsigned int nkeys = 10000;
+    char **uuids = NULL;
+    char **names = NULL;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    size_t i;
+    int ret = EXIT_FAILURE;
+
+    if (argc > 2 ||
+        (argc == 2 && (virStrToLong_ui(argv[1], NULL, 10, &nkeys) < 0 ||
+                       nkeys == 0))) {
+        fprintf(stderr, "%s [ENTRIES]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (virThreadInitialize() < 0 ||
+        VIR_ALLOC_N(uuids, nkeys) < 0 ||
+        VIR_ALLOC_N(names, nkeys) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nkeys; i++) {
+        if (virUUIDGenerate(uuid) < 0 ||
+            VIR_STRDUP(uuids[i], virUUIDFormat(uuid, uuidstr)) < 0 ||
+            virAsprintf(&names[i], "guest-%zu", i) < 0)
+            goto cleanup;
+    }
+
+    if (benchHash("UUID", uuids, nkeys, 0) < 0 ||
+        benchHash("UUID", uuids, nkeys, VIR_HASH_OPEN_ADDRESSING) < 0 ||
+        benchHash("name", names, nkeys, 0) < 0 ||
+        benchHash("name", names, nkeys, VIR_HASH_OPEN_ADDRESSING) < 0)
+        goto cleanup;
+
+    ret = EXIT_SUCCESS;
+
+ cleanup:
+    if (ret != EXIT_SUCCESS)
+        fprintf(stderr, "%s\n", virGetLastErrorMessage());
+    for (i = 0; i < nkeys; i++) {
+        if (uuids)
+            VIR_FREE(uuids[i]);
+        if (names)
+            VIR_FREE(names[i]);
+    }
+    VIR_FREE(uuids);
+    VIR_FREE(names);
+    return ret;
+}
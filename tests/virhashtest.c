@@ -17,13 +17,16 @@
 
 VIR_LOG_INIT("tests.hashtest");
 
+/* Flags passed to virHashCreateFlags, all tests run for each mode */
+static unsigned int testHashFlags;
+
 static virHashTablePtr
 testHashInit(int size)
 {
     virHashTablePtr hash;
     ssize_t i;
 
-    if (!(hash = virHashCreate(size, NULL)))
+    if (!(hash = virHashCreateFlags(size, NULL, testHashFlags)))
         return NULL;
 
     /* entires are added in reverse order so that they will be linked in
@@ -183,6 +186,65 @@ testHashRemove(const void *data ATTRIBUTE_UNUSED)
 }
 
 
+static int
+testHashChurn(const void *data ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr hash;
+    size_t i, j;
+    int ret = -1;
+
+    if (!(hash = testHashInit(0)))
+        return -1;
+
+    /* Keep removing and adding entries so that an open addressing table
+     * fills up with deleted slots and has to get rid of them */
+    for (i = 0; i < 100; i++) {
+        for (j = 0; j < ARRAY_CARDINALITY(uuids_subset); j++) {
+            if (virHashRemoveEntry(hash, uuids_subset[j]) < 0) {
+                VIR_TEST_VERBOSE("\nentry \"%s\" could not be removed\n",
+                                 uuids_subset[j]);
+                goto cleanup;
+            }
+        }
+
+        for (j = 0; j < ARRAY_CARDINALITY(uuids_subset); j++) {
+            if (virHashLookup(hash, uuids_subset[j])) {
+                VIR_TEST_VERBOSE("\nremoved entry \"%s\" found\n",
+                                 uuids_subset[j]);
+                goto cleanup;
+            }
+
+            if (virHashAddEntry(hash, uuids_subset[j],
+                                (void *) uuids_subset[j]) < 0) {
+                VIR_TEST_VERBOSE("\nentry \"%s\" could not be added\n",
+                                 uuids_subset[j]);
+                goto cleanup;
+            }
+        }
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(uuids); i++) {
+        if (virHashLookup(hash, uuids[i]) != uuids[i]) {
+            VIR_TEST_VERBOSE("\nentry \"%s\" could not be found\n", uuids[i]);
+            goto cleanup;
+        }
+    }
+
+    if (testHashCheckCount(hash, ARRAY_CARDINALITY(uuids)) < 0)
+        goto cleanup;
+
+    if (virHashRemoveAll(hash) != ARRAY_CARDINALITY(uuids) ||
+        testHashCheckCount(hash, 0) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(hash);
+    return ret;
+}
+
+
 const int testHashCountRemoveForEachSome =
     ARRAY_CARDINALITY(uuids) - ARRAY_CARDINALITY(uuids_subset);
 
@@ -455,6 +517,61 @@ testHashSearch(const void *data ATTRIBUTE_UNUSED)
 }
 
 
+static int
+testHashForEachReadOnlyIter(void *payload ATTRIBUTE_UNUSED,
+                            const void *name,
+                            void *data)
+{
+    virHashTablePtr hash = data;
+    size_t count = 0;
+
+    /* Nested read-only walks and lookups must be allowed */
+    if (virHashForEachReadOnly(hash, testHashCheckForEachCount, &count) < 0 ||
+        count != ARRAY_CARDINALITY(uuids)) {
+        VIR_TEST_VERBOSE("\nnested read-only iteration found %zu entries",
+                         count);
+        return -1;
+    }
+
+    if (!virHashLookup(hash, name)) {
+        VIR_TEST_VERBOSE("\nentry \"%s\" not found in read-only iteration",
+                         (const char *) name);
+        return -1;
+    }
+
+    if (!virHashSearch(hash, testHashSearchIter, NULL)) {
+        VIR_TEST_VERBOSE("\nsearching in read-only iteration failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testHashForEachReadOnly(const void *data ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr hash;
+    int ret = -1;
+
+    if (!(hash = testHashInit(0)))
+        return -1;
+
+    if (virHashForEachReadOnly(hash, testHashForEachReadOnlyIter, hash) < 0) {
+        VIR_TEST_VERBOSE("\nvirHashForEachReadOnly didn't go through all entries");
+        goto cleanup;
+    }
+
+    if (testHashCheckCount(hash, ARRAY_CARDINALITY(uuids)) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(hash);
+    return ret;
+}
+
+
 static int
 testHashGetItemsCompKey(const virHashKeyValuePair *a,
                         const virHashKeyValuePair *b)
@@ -482,7 +599,7 @@ testHashGetItems(const void *data ATTRIBUTE_UNUSED)
     char value2[] = "2";
     char value3[] = "3";
 
-    if (!(hash = virHashCreate(0, NULL)) ||
+    if (!(hash = virHashCreateFlags(0, NULL, testHashFlags)) ||
         virHashAddEntry(hash, keya, value3) < 0 ||
         virHashAddEntry(hash, keyc, value1) < 0 ||
         virHashAddEntry(hash, keyb, value2) < 0) {
@@ -552,8 +669,8 @@ testHashEqual(const void *data ATTRIBUTE_UNUSED)
     char value3_u[] = "O";
     char value4_u[] = "P";
 
-    if (!(hash1 = virHashCreate(0, NULL)) ||
-        !(hash2 = virHashCreate(0, NULL)) ||
+    if (!(hash1 = virHashCreateFlags(0, NULL, testHashFlags)) ||
+        !(hash2 = virHashCreateFlags(0, NULL, testHashFlags)) ||
         virHashAddEntry(hash1, keya, value1_l) < 0 ||
         virHashAddEntry(hash1, keyb, value2_l) < 0 ||
         virHashAddEntry(hash1, keyc, value3_l) < 0 ||
@@ -601,6 +718,7 @@ static int
 mymain(void)
 {
     int ret = 0;
+    size_t i;
 
 #define DO_TEST_FULL(name, cmd, data, count)                        \
     do {                                                            \
@@ -621,20 +739,28 @@ mymain(void)
 #define DO_TEST(name, cmd)                                          \
     DO_TEST_FULL(name, cmd, NULL, -1)
 
-    DO_TEST_COUNT("Grow", Grow, 1);
-    DO_TEST_COUNT("Grow", Grow, 10);
-    DO_TEST_COUNT("Grow", Grow, 42);
-    DO_TEST("Update", Update);
-    DO_TEST("Remove", Remove);
-    DO_TEST_DATA("Remove in ForEach", RemoveForEach, Some);
-    DO_TEST_DATA("Remove in ForEach", RemoveForEach, All);
-    DO_TEST_DATA("Remove in ForEach", RemoveForEach, Forbidden);
-    DO_TEST("Steal", Steal);
-    DO_TEST("Forbidden ops in ForEach", ForEach);
-    DO_TEST("RemoveSet", RemoveSet);
-    DO_TEST("Search", Search);
-    DO_TEST("GetItems", GetItems);
-    DO_TEST("Equal", Equal);
+    for (i = 0; i < 2; i++) {
+        testHashFlags = i ? VIR_HASH_OPEN_ADDRESSING : 0;
+        VIR_TEST_DEBUG("Testing %s hash tables\n",
+                       i ? "open addressing" : "chained");
+
+        DO_TEST_COUNT("Grow", Grow, 1);
+        DO_TEST_COUNT("Grow", Grow, 10);
+        DO_TEST_COUNT("Grow", Grow, 42);
+        DO_TEST("Update", Update);
+        DO_TEST("Remove", Remove);
+        DO_TEST_DATA("Remove in ForEach", RemoveForEach, Some);
+        DO_TEST_DATA("Remove in ForEach", RemoveForEach, All);
+        DO_TEST_DATA("Remove in ForEach", RemoveForEach, Forbidden);
+        DO_TEST("Steal", Steal);
+        DO_TEST("Forbidden ops in ForEach", ForEach);
+        DO_TEST("RemoveSet", RemoveSet);
+        DO_TEST("Search", Search);
+        DO_TEST("Nested ForEachReadOnly", ForEachReadOnly);
+        DO_TEST("GetItems", GetItems);
+        DO_TEST("Equal", Equal);
+        DO_TEST("Churn", Churn);
+    }
 
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
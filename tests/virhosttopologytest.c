@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#include "viralloc.h"
+#include "virhosttopology.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+
+static int
+testHostTopologyInfo(const void *data ATTRIBUTE_UNUSED)
+{
+    virHostTopologyPtr topo = NULL;
+    virHostTopologyPtr old = NULL;
+    virHostTopologyInfo info = { .arch = VIR_ARCH_X86_64, .cpus = 8,
+                                 .mhz = 2400, .nodes = 2, .sockets = 2,
+                                 .cores = 2, .threads = 2 };
+    virHostTopologyInfo got = { .arch = VIR_ARCH_X86_64 };
+    int ret = -1;
+
+    virHostTopologyInvalidate();
+
+    if (!(topo = virHostTopologyGet()))
+        goto cleanup;
+
+    if (virHostTopologyGetInfo(topo, &got)) {
+        fprintf(stderr, "empty snapshot has info\n");
+        goto cleanup;
+    }
+
+    virHostTopologySetInfo(topo, &info);
+
+    got.arch = VIR_ARCH_PPC64;
+    if (virHostTopologyGetInfo(topo, &got)) {
+        fprintf(stderr, "info found for the wrong arch\n");
+        goto cleanup;
+    }
+
+    got.arch = VIR_ARCH_X86_64;
+    if (!virHostTopologyGetInfo(topo, &got) ||
+        memcmp(&got, &info, sizeof(info)) != 0) {
+        fprintf(stderr, "cached info not returned\n");
+        goto cleanup;
+    }
+
+    /* Invalidating only affects the next users of the snapshot */
+    virHostTopologyInvalidate();
+    old = topo;
+    if (!(topo = virHostTopologyGet()))
+        goto cleanup;
+
+    if (topo == old ||
+        virHostTopologyGetInfo(topo, &got) ||
+        !virHostTopologyGetInfo(old, &got)) {
+        fprintf(stderr, "invalidation did not start a new snapshot\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(old);
+    virObjectUnref(topo);
+    return ret;
+}
+
+
+static int
+testHostTopologyNode(const void *data ATTRIBUTE_UNUSED)
+{
+    virHostTopologyPtr topo = NULL;
+    virBitmapPtr cpus = NULL;
+    virBitmapPtr got = NULL;
+    const int distances[] = { 10, 20, 20, 10 };
+    int *gotDistances = NULL;
+    int ngotDistances = 0;
+    const unsigned int sizes[] = { 2048, 1048576 };
+    unsigned int *gotSizes = NULL;
+    size_t ngotSizes = 0;
+    int ncpus = 0;
+    int ret = -1;
+
+    virHostTopologyInvalidate();
+
+    if (!(topo = virHostTopologyGet()) ||
+        virBitmapParse("0-3,8", &cpus, 16) < 0)
+        goto cleanup;
+
+    if (virHostTopologyGetNodeCPUs(topo, 1, &got, &ncpus) != 0 ||
+        virHostTopologyGetDistances(topo, 1, &gotDistances,
+                                    &ngotDistances) != 0 ||
+        virHostTopologyGetPageSizes(topo, -1, &gotSizes, &ngotSizes) != 0) {
+        fprintf(stderr, "empty snapshot has node data\n");
+        goto cleanup;
+    }
+
+    if (virHostTopologySetNodeCPUs(topo, 1, cpus, 5) < 0 ||
+        virHostTopologySetNodeCPUs(topo, 3, NULL, -2) < 0 ||
+        virHostTopologySetDistances(topo, 1, distances,
+                                    ARRAY_CARDINALITY(distances)) < 0 ||
+        virHostTopologySetPageSizes(topo, -1, sizes,
+                                    ARRAY_CARDINALITY(sizes)) < 0)
+        goto cleanup;
+
+    /* Nodes in between stay unknown */
+    if (virHostTopologyGetNodeCPUs(topo, 2, &got, &ncpus) != 0) {
+        fprintf(stderr, "unset node 2 has CPUs\n");
+        goto cleanup;
+    }
+
+    if (virHostTopologyGetNodeCPUs(topo, 1, &got, &ncpus) != 1 ||
+        ncpus != 5 || !virBitmapEqual(got, cpus)) {
+        fprintf(stderr, "CPUs of node 1 not returned\n");
+        goto cleanup;
+    }
+    virBitmapFree(got);
+    got = NULL;
+
+    if (virHostTopologyGetNodeCPUs(topo, 3, &got, &ncpus) != 1 ||
+        ncpus != -2 || got) {
+        fprintf(stderr, "missing CPUs of node 3 not remembered\n");
+        goto cleanup;
+    }
+
+    if (virHostTopologyGetDistances(topo, 1, &gotDistances,
+                                    &ngotDistances) != 1 ||
+        ngotDistances != ARRAY_CARDINALITY(distances) ||
+        memcmp(gotDistances, distances, sizeof(distances)) != 0) {
+        fprintf(stderr, "distances of node 1 not returned\n");
+        goto cleanup;
+    }
+
+    if (virHostTopologyGetPageSizes(topo, -1, &gotSizes, &ngotSizes) != 1 ||
+        ngotSizes != ARRAY_CARDINALITY(sizes) ||
+        memcmp(gotSizes, sizes, sizeof(sizes)) != 0) {
+        fprintf(stderr, "host page sizes not returned\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(topo);
+    virBitmapFree(cpus);
+    virBitmapFree(got);
+    VIR_FREE(gotDistances);
+    VIR_FREE(gotSizes);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virTestRun("Info", testHostTopologyInfo, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Node", testHostTopologyNode, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
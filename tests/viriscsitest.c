@@ -60,6 +60,8 @@ const char *iscsiadmSendtargetsOutput =
     "10.20.30.40:3260,1 iqn.2008-04.example:example1:iscsi.bar\n"
     "10.20.30.40:3260,1 iqn.2009-04.example:example1:iscsi.seven\n";
 
+static size_t iscsiadmSessionCalls;
+
 struct testSessionInfo {
     const char *device_path;
     int output_version;
@@ -79,6 +81,7 @@ static void testIscsiadmCb(const char *const*args,
         args[1] && STREQ(args[1], "--mode") &&
         args[2] && STREQ(args[2], "session") &&
         args[3] == NULL) {
+        iscsiadmSessionCalls++;
         if (*output_version == 1)
             ignore_value(VIR_STRDUP(*output, iscsiadmSessionOutputNonFlash));
         else
@@ -94,6 +97,16 @@ static void testIscsiadmCb(const char *const*args,
                args[8] && STREQ(args[8], "nonpersistent") &&
                args[9] == NULL) {
         ignore_value(VIR_STRDUP(*output, iscsiadmSendtargetsOutput));
+    } else if (args[0] && STREQ(args[0], ISCSIADM) &&
+               args[1] && STREQ(args[1], "--mode") &&
+               args[2] && STREQ(args[2], "node") &&
+               args[3] && STREQ(args[3], "--portal") &&
+               args[4] && STREQ(args[4], "10.20.30.40:3260,1") &&
+               args[5] && STREQ(args[5], "--targetname") &&
+               args[6] && STREQ(args[6], "iqn.2004-06.example:example1:iscsi.test") &&
+               args[7] && STREQ(args[7], "--login") &&
+               args[8] == NULL) {
+        /* Nothing to print */
     } else {
         *status = -1;
     }
@@ -107,6 +120,7 @@ testISCSIGetSession(const void *data)
     char *actual_session = NULL;
     int ret = -1;
 
+    virISCSISessionCacheFlush();
     virCommandSetDryRun(NULL, testIscsiadmCb, &ver);
 
     actual_session = virISCSIGetSession(info->device_path, true);
@@ -127,6 +141,62 @@ testISCSIGetSession(const void *data)
     return ret;
 }
 
+static int
+testISCSISessionCache(const void *data ATTRIBUTE_UNUSED)
+{
+    int ver = 0;
+    char *first = NULL;
+    char *second = NULL;
+    char *third = NULL;
+    int ret = -1;
+
+    virISCSISessionCacheFlush();
+    virCommandSetDryRun(NULL, testIscsiadmCb, &ver);
+    iscsiadmSessionCalls = 0;
+
+    /* Lookups following each other closely share one iscsiadm run... */
+    first = virISCSIGetSession("iqn.2004-06.example:example1:iscsi.test", true);
+    second = virISCSIGetSession("iqn.2009-04.example:example1:iscsi.seven", true);
+
+    if (STRNEQ_NULLABLE(first, "1") || STRNEQ_NULLABLE(second, "7")) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Expected sessions '1' and '7', got '%s' and '%s'",
+                       NULLSTR(first), NULLSTR(second));
+        goto cleanup;
+    }
+
+    if (iscsiadmSessionCalls != 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Expected 1 session listing, got %zu",
+                       iscsiadmSessionCalls);
+        goto cleanup;
+    }
+
+    /* ... until a login changes the set of sessions */
+    if (virISCSIConnectionLogin("10.20.30.40:3260,1", NULL,
+                                "iqn.2004-06.example:example1:iscsi.test") < 0)
+        goto cleanup;
+
+    third = virISCSIGetSession("iqn.2004-06.example:example1:iscsi.test", true);
+
+    if (STRNEQ_NULLABLE(third, "1") || iscsiadmSessionCalls != 2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Expected a new session listing after login, "
+                       "got session '%s' after %zu listings",
+                       NULLSTR(third), iscsiadmSessionCalls);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCommandSetDryRun(NULL, NULL, NULL);
+    VIR_FREE(first);
+    VIR_FREE(second);
+    VIR_FREE(third);
+    return ret;
+}
+
 struct testScanTargetsInfo {
     const char *fake_cmd_output;
     const char *portal;
@@ -195,6 +265,9 @@ mymain(void)
     DO_SESSION_TEST("iqn.2009-04.example:example1:iscsi.seven", "7");
     DO_SESSION_TEST("iqn.2009-04.example:example1:iscsi.eight", NULL);
 
+    if (virTestRun("ISCSI session cache", testISCSISessionCache, NULL) < 0)
+        rv = -1;
+
     const char *targets[] = {
         "iqn.2004-06.example:example1:iscsi.test",
         "iqn.2005-05.example:example1:iscsi.hello",
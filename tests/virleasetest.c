@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+
+#include "testutils.h"
+#include "viralloc.h"
+#include "virbuffer.h"
+#include "virfile.h"
+#include "virlease.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+static char scratchdir[] = abs_builddir "/virleasedir-XXXXXX";
+
+struct testData {
+    const char *file;
+    const char *hostname;
+    const char *mac;
+    long long now;
+    const char *addrs;
+};
+
+
+static int
+testLeaseIndexPrepare(const char *file,
+                      char **leasePath,
+                      char **indexPath)
+{
+    char *src = NULL;
+    char *content = NULL;
+    virJSONValuePtr leases = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&src, "%s/nssdata/%s.status", abs_srcdir, file) < 0 ||
+        virAsprintf(leasePath, "%s/%s.status", scratchdir, file) < 0 ||
+        virAsprintf(indexPath, "%s" VIR_LEASE_INDEX_SUFFIX, *leasePath) < 0)
+        goto cleanup;
+
+    if (virFileReadAll(src, 1024 * 1024, &content) < 0 ||
+        virFileRewriteStr(*leasePath, 0644, content) < 0)
+        goto cleanup;
+
+    if (!(leases = virJSONValueNewArray()) ||
+        virLeaseReadCustomLeaseFile(leases, *leasePath, NULL, NULL) < 0 ||
+        virLeaseIndexWrite(*indexPath, *leasePath, leases) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(src);
+    VIR_FREE(content);
+    virJSONValueFree(leases);
+    return ret;
+}
+
+
+static int
+testLeaseIndexIter(int family,
+                   const unsigned char *addr,
+                   void *opaque)
+{
+    virBufferPtr buf = opaque;
+    char str[INET6_ADDRSTRLEN];
+
+    if (!inet_ntop(family, addr, str, sizeof(str)))
+        return -1;
+
+    if (virBufferUse(buf))
+        virBufferAddChar(buf, ',');
+    virBufferAdd(buf, str, -1);
+    return 0;
+}
+
+
+static int
+testLeaseIndexLookup(const void *opaque)
+{
+    const struct testData *data = opaque;
+    char *leasePath = NULL;
+    char *indexPath = NULL;
+    virLeaseIndex idx = { NULL, 0 };
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *addrs = NULL;
+    int ret = -1;
+
+    if (testLeaseIndexPrepare(data->file, &leasePath, &indexPath) < 0)
+        goto cleanup;
+
+    if (virLeaseIndexOpen(&idx, indexPath, leasePath) < 0) {
+        fprintf(stderr, "Unable to open %s\n", indexPath);
+        goto cleanup;
+    }
+
+    if (virLeaseIndexLookup(&idx, data->hostname, data->mac, data->now,
+                            testLeaseIndexIter, &buf) < 0) {
+        fprintf(stderr, "Lookup failed\n");
+        goto cleanup;
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    addrs = virBufferContentAndReset(&buf);
+
+    if (STRNEQ_NULLABLE(addrs, data->addrs)) {
+        fprintf(stderr, "Expected '%s', got '%s'\n",
+                NULLSTR(data->addrs), NULLSTR(addrs));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virLeaseIndexClose(&idx);
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(addrs);
+    VIR_FREE(leasePath);
+    VIR_FREE(indexPath);
+    return ret;
+}
+
+
+static int
+testLeaseIndexStale(const void *opaque ATTRIBUTE_UNUSED)
+{
+    char *leasePath = NULL;
+    char *indexPath = NULL;
+    char *content = NULL;
+    virLeaseIndex idx = { NULL, 0 };
+    off_t len;
+    int ret = -1;
+
+    if (testLeaseIndexPrepare("virbr0", &leasePath, &indexPath) < 0)
+        goto cleanup;
+
+    if (virLeaseIndexOpen(&idx, indexPath, leasePath) < 0) {
+        fprintf(stderr, "Fresh index rejected\n");
+        goto cleanup;
+    }
+    virLeaseIndexClose(&idx);
+
+    /* Truncated index */
+    if ((len = virFileLength(indexPath, -1)) < 0 ||
+        truncate(indexPath, len - 1) < 0)
+        goto cleanup;
+
+    if (virLeaseIndexOpen(&idx, indexPath, leasePath) == 0) {
+        fprintf(stderr, "Truncated index accepted\n");
+        goto cleanup;
+    }
+
+    VIR_FREE(leasePath);
+    VIR_FREE(indexPath);
+    if (testLeaseIndexPrepare("virbr0", &leasePath, &indexPath) < 0)
+        goto cleanup;
+
+    /* Lease file rewritten behind the index' back */
+    if (virFileReadAll(leasePath, 1024 * 1024, &content) < 0 ||
+        virFileRewriteStr(leasePath, 0644, content) < 0)
+        goto cleanup;
+
+    if (virLeaseIndexOpen(&idx, indexPath, leasePath) == 0) {
+        fprintf(stderr, "Outdated index accepted\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virLeaseIndexClose(&idx);
+    VIR_FREE(content);
+    VIR_FREE(leasePath);
+    VIR_FREE(indexPath);
+    return ret;
+}
+
+
+static virJSONValuePtr
+testLeaseNew(const char *ip,
+             const char *mac,
+             const char *hostname)
+{
+    virJSONValuePtr lease;
+
+    if (!(lease = virJSONValueNewObject()) ||
+        virJSONValueObjectAppendString(lease, "ip-address", ip) < 0 ||
+        virJSONValueObjectAppendString(lease, "mac-address", mac) < 0 ||
+        virJSONValueObjectAppendString(lease, "hostname", hostname) < 0 ||
+        virJSONValueObjectAppendNumberLong(lease, "expiry-time",
+                                           2000000000) < 0) {
+        virJSONValueFree(lease);
+        return NULL;
+    }
+
+    return lease;
+}
+
+
+static int
+testLeaseJournalExpect(virLeaseIndexPtr idx,
+                       const char *hostname,
+                       const char *addrs)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *got = NULL;
+    int ret = -1;
+
+    if (virLeaseIndexLookup(idx, hostname, NULL, 0,
+                            testLeaseIndexIter, &buf) < 0 ||
+        virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    got = virBufferContentAndReset(&buf);
+    if (STRNEQ_NULLABLE(got, addrs)) {
+        fprintf(stderr, "Expected '%s' for %s, got '%s'\n",
+                NULLSTR(addrs), hostname, NULLSTR(got));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(got);
+    return ret;
+}
+
+
+static int
+testLeaseJournal(const void *opaque ATTRIBUTE_UNUSED)
+{
+    char *leasePath = NULL;
+    char *indexPath = NULL;
+    char *journalPath = NULL;
+    virJSONValuePtr lease = NULL;
+    virJSONValuePtr leases = NULL;
+    virLeaseIndex idx = { NULL, 0 };
+    const char *partial = "{\"action\":\"add\",";
+    char *content = NULL;
+    int fd = -1;
+    int ret = -1;
+
+    if (testLeaseIndexPrepare("virbr0", &leasePath, &indexPath) < 0 ||
+        virAsprintf(&journalPath, "%s" VIR_LEASE_JOURNAL_SUFFIX,
+                    leasePath) < 0)
+        goto cleanup;
+
+    if (!(lease = testLeaseNew("192.168.122.10", "52:54:00:00:00:10", "suse")) ||
+        virLeaseJournalAppend(leasePath, lease, NULL) != 0)
+        goto cleanup;
+    virJSONValueFree(lease);
+    lease = NULL;
+
+    /* Left behind by a helper which crashed half way */
+    if ((fd = open(journalPath, O_WRONLY | O_APPEND)) < 0 ||
+        safewrite(fd, partial, strlen(partial)) < 0 ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    if (virLeaseJournalAppend(leasePath, NULL, "192.168.122.197") <= 0 ||
+        !(lease = testLeaseNew("192.168.122.198", "52:54:00:a4:6f:92",
+                               "debian")) ||
+        virLeaseJournalAppend(leasePath, lease, NULL) <= 0)
+        goto cleanup;
+
+    if (virLeaseIndexOpen(&idx, indexPath, leasePath) == 0) {
+        fprintf(stderr, "Index used despite pending journal\n");
+        goto cleanup;
+    }
+
+    /* Fold the journal into the lease file the way leaseshelper does */
+    if (!(leases = virJSONValueNewArray()) ||
+        virLeaseReadCustomLeaseFile(leases, leasePath, NULL, NULL) < 0 ||
+        !(content = virJSONValueToString(leases, true)) ||
+        virFileRewriteStr(leasePath, 0644, content) < 0 ||
+        virLeaseIndexWrite(indexPath, leasePath, leases) < 0 ||
+        virLeaseJournalRemove(leasePath) < 0)
+        goto cleanup;
+
+    if (virLeaseIndexOpen(&idx, indexPath, leasePath) < 0) {
+        fprintf(stderr, "Index rejected after compaction\n");
+        goto cleanup;
+    }
+
+    if (testLeaseJournalExpect(&idx, "fedora", NULL) < 0 ||
+        testLeaseJournalExpect(&idx, "debian", "192.168.122.198") < 0 ||
+        testLeaseJournalExpect(&idx, "suse", "192.168.122.10") < 0 ||
+        testLeaseJournalExpect(&idx, "gentoo", "192.168.122.254") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    virLeaseIndexClose(&idx);
+    virJSONValueFree(lease);
+    virJSONValueFree(leases);
+    VIR_FREE(content);
+    VIR_FREE(leasePath);
+    VIR_FREE(indexPath);
+    VIR_FREE(journalPath);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (!mkdtemp(scratchdir)) {
+        fprintf(stderr, "Cannot create %s\n", scratchdir);
+        return EXIT_FAILURE;
+    }
+
+#define DO_TEST(file, hostname, mac, key, now, addrs) \
+    do { \
+        struct testData data = { file, hostname, mac, now, addrs }; \
+        if (virTestRun("Lookup " file " " key, \
+                       testLeaseIndexLookup, &data) < 0) \
+            ret = -1; \
+    } while (0)
+
+#define DO_TEST_NAME(file, hostname, now, addrs) \
+    DO_TEST(file, hostname, NULL, hostname, now, addrs)
+#define DO_TEST_MAC(file, mac, now, addrs) \
+    DO_TEST(file, NULL, mac, mac, now, addrs)
+
+    DO_TEST_NAME("virbr0", "fedora", 0, "192.168.122.197,192.168.122.198");
+    DO_TEST_NAME("virbr0", "gentoo", 0, "192.168.122.254");
+    DO_TEST_NAME("virbr0", "fedora", 1950000000, NULL);
+    DO_TEST_NAME("virbr0", "gentoo", 1950000000, "192.168.122.254");
+    DO_TEST_NAME("virbr0", "suse", 0, NULL);
+    DO_TEST_MAC("virbr0", "52:54:00:11:22:33", 0, "192.168.122.2");
+    DO_TEST_MAC("virbr0", "52:54:00:a4:6f:92", 0, "192.168.122.198");
+    DO_TEST_NAME("virbr1", "gentoo", 0, "2001:1234:dead:beef::2");
+    DO_TEST_NAME("virbr1", "fedora", 0, "192.168.122.199,192.168.122.200");
+    DO_TEST_NAME("virbr1", "fedora", 100, "192.168.122.199");
+
+    if (virTestRun("Stale index", testLeaseIndexStale, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Journal", testLeaseJournal, NULL) < 0)
+        ret = -1;
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -30,6 +30,7 @@
 #include "viralloc.h"
 #include "virfile.h"
 #include "virlog.h"
+#include "virstring.h"
 
 #include "virlockspace.h"
 
@@ -339,6 +340,80 @@ static int testLockSpaceResourceLockPath(const void *args ATTRIBUTE_UNUSED)
 }
 
 
+static int testLockSpaceResourceLockMany(const void *args ATTRIBUTE_UNUSED)
+{
+    virLockSpacePtr lockspace;
+    virLockSpaceRequest reqs[20];
+    virLockSpaceStats stats;
+    char *names[ARRAY_CARDINALITY(reqs)];
+    size_t i;
+    int ret = -1;
+
+    memset(names, 0, sizeof(names));
+
+    rmdir(LOCKSPACE_DIR);
+
+    if (!(lockspace = virLockSpaceNew(LOCKSPACE_DIR)))
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(reqs); i++) {
+        if (virAsprintf(&names[i], "res%zu", i) < 0)
+            goto cleanup;
+
+        reqs[i].lockspace = lockspace;
+        reqs[i].resname = names[i];
+        reqs[i].flags = VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE;
+    }
+
+    if (virLockSpaceAcquireResources(reqs, ARRAY_CARDINALITY(reqs),
+                                     geteuid()) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(reqs); i++) {
+        if (virLockSpaceAcquireResource(lockspace, names[i], geteuid(), 0) == 0)
+            goto cleanup;
+    }
+
+    if (virLockSpaceReleaseResourcesForOwner(lockspace, geteuid()) !=
+        ARRAY_CARDINALITY(reqs))
+        goto cleanup;
+
+    /* Nothing may remain held if any one of them is busy */
+    if (virLockSpaceAcquireResource(lockspace, names[13], geteuid() + 1,
+                                    VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE) < 0)
+        goto cleanup;
+
+    if (virLockSpaceAcquireResources(reqs, ARRAY_CARDINALITY(reqs),
+                                     geteuid()) == 0)
+        goto cleanup;
+
+    if (virLockSpaceReleaseResourcesForOwner(lockspace, geteuid()) != 0)
+        goto cleanup;
+
+    if (virLockSpaceReleaseResource(lockspace, names[13], geteuid() + 1) < 0)
+        goto cleanup;
+
+    virLockSpaceGetStats(lockspace, &stats);
+
+    if (stats.acquired < ARRAY_CARDINALITY(reqs) + 1 ||
+        stats.busy < ARRAY_CARDINALITY(reqs) + 1 ||
+        stats.errors != 0) {
+        VIR_TEST_DEBUG("Unexpected stats acquired=%llu busy=%llu errors=%llu\n",
+                       stats.acquired, stats.busy, stats.errors);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < ARRAY_CARDINALITY(reqs); i++)
+        VIR_FREE(names[i]);
+    virLockSpaceFree(lockspace);
+    rmdir(LOCKSPACE_DIR);
+    return ret;
+}
+
+
 
 static int
 mymain(void)
@@ -368,6 +443,9 @@ mymain(void)
     if (virTestRun("Lockspace res full path", testLockSpaceResourceLockPath, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Lockspace res lock many", testLockSpaceResourceLockMany, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
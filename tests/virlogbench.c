@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Measure the cost of logging statements filtered out by priority:
+ *
+ *   tests/virlogbench [CALLS]
+ *
+ * CALLS (100000000 by default) statements are issued with the inline
+ * check of the cached source priority, and then by calling the logger
+ * directly as done for messages which may pass the filters, both with
+ * no filters and with a set of filters not matching the source.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "internal.h"
+#include "virlog.h"
+#include "virstring.h"
+#include "virtime.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.logbench");
+
+#define BENCH_FILTERS "3:util 3:rpc 3:qemu 3:conf 3:security 3:storage " \
+                      "3:network 3:node_device 3:nwfilter 3:access"
+
+
+static int
+benchLog(const char *desc,
+         unsigned long long calls)
+{
+    unsigned long long start, inlined, end;
+    unsigned long long i;
+
+    if (virTimeMillisNow(&start) < 0)
+        return -1;
+
+    for (i = 0; i < calls; i++)
+        VIR_INFO("message %llu", i);
+
+    if (virTimeMillisNow(&inlined) < 0)
+        return -1;
+
+    for (i = 0; i < calls; i++)
+        virLogMessage(&virLogSelf, VIR_LOG_INFO, __FILE__, __LINE__, __func__,
+                      NULL, "message %llu", i);
+
+    if (virTimeMillisNow(&end) < 0)
+        return -1;
+
+    printf("%-10s: %llu filtered out messages, inline check in %llu ms, "
+           "logger call in %llu ms\n",
+           desc, calls, inlined - start, end - inlined);
+    return 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    unsigned long long calls = 100000000;
+    int ret = EXIT_FAILURE;
+
+    if (argc > 2 ||
+        (argc == 2 && (virStrToLong_ull(argv[1], NULL, 10, &calls) < 0 ||
+                       calls == 0))) {
+        fprintf(stderr, "%s [CALLS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (virThreadInitialize() < 0 ||
+        virLogSetDefaultPriority(VIR_LOG_WARN) < 0 ||
+        virLogSetOutputs("4:stderr") < 0)
+        goto cleanup;
+
+    if (benchLog("no filters", calls) < 0)
+        goto cleanup;
+
+    if (virLogSetFilters(BENCH_FILTERS) < 0 ||
+        benchLog("10 filters", calls) < 0)
+        goto cleanup;
+
+    ret = EXIT_SUCCESS;
+
+ cleanup:
+    if (ret != EXIT_SUCCESS)
+        fprintf(stderr, "%s\n", virGetLastErrorMessage());
+    return ret;
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2014 Red Hat, Inc.
+ * Copyright (C) 2014, 2017 Red Hat, Inc.
  *
  * This library is free software; you can redistribute it and/or
  * modify it under the terms of the GNU Lesser General Public
@@ -22,7 +22,41 @@
 #include <unistd.h>
 #include <sys/types.h>
 
+#include "internal.h"
+#include "virmock.h"
+#include "virfile.h"
+#include "virnetdev.h"
+
+static int (*real_virFileReadAll)(const char *path, int maxlen, char **buf);
+
 uid_t geteuid(void)
 {
     return 0;
 }
+
+int
+virNetDevGetIndex(const char *ifname ATTRIBUTE_UNUSED,
+                  int *ifindex)
+{
+    *ifindex = 1;
+    return 0;
+}
+
+/* Tick lengths depend on the packet scheduler clock of the host.
+ * Report the one all the recent kernels have so that the expected
+ * values do not depend on where the test runs. */
+int
+virFileReadAll(const char *path, int maxlen, char **buf)
+{
+    const char *psched = "000003e8 00000040 000f4240 3b9aca00\n";
+
+    VIR_MOCK_REAL_INIT(virFileReadAll);
+
+    if (STRNEQ(path, "/proc/net/psched"))
+        return real_virFileReadAll(path, maxlen, buf);
+
+    if (!(*buf = strdup(psched)))
+        return -1;
+
+    return strlen(psched);
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2014 Red Hat, Inc.
+ * Copyright (C) 2014, 2017 Red Hat, Inc.
  *
  * This library is free software; you can redistribute it and/or
  * modify it under the terms of the GNU Lesser General Public
@@ -21,12 +21,19 @@
 #include <config.h>
 
 #include "testutils.h"
-#define __VIR_COMMAND_PRIV_H_ALLOW__
-#include "vircommandpriv.h"
-#include "virnetdevbandwidth.h"
-#include "netdev_bandwidth_conf.c"
 
-#define VIR_FROM_THIS VIR_FROM_NONE
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+# include <linux/pkt_cls.h>
+# include <linux/pkt_sched.h>
+# include <linux/rtnetlink.h>
+
+# define __VIR_NETLINK_PRIV_H_ALLOW__
+# include "virnetlinkpriv.h"
+# include "virnetdevbandwidth.h"
+# include "netdev_bandwidth_conf.c"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
 
 struct testMinimalStruct {
     const char *expected_result;
@@ -41,7 +48,7 @@ struct testSetStruct {
     const bool hierarchical_class;
 };
 
-#define PARSE(xml, var)                                                 \
+# define PARSE(xml, var)                                                 \
     do {                                                                \
         int rc;                                                         \
         xmlDocPtr doc;                                                  \
@@ -64,6 +71,171 @@ struct testSetStruct {
             goto cleanup;                                               \
     } while (0)
 
+static void
+testParseAttrs(struct rtattr **tb, int max, struct rtattr *rta, int len)
+{
+    memset(tb, 0, sizeof(*tb) * (max + 1));
+
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        unsigned short type = rta->rta_type & ~NLA_F_NESTED;
+
+        if (type <= max)
+            tb[type] = rta;
+    }
+}
+
+/* Large enough for the options of every kind used by virnetdevbandwidth */
+# define TEST_OPTS_MAX 16
+
+# define PARSE_NESTED(tb, max, rta) \
+    testParseAttrs(tb, max, RTA_DATA(rta), RTA_PAYLOAD(rta))
+
+static void
+testFormatHandle(virBufferPtr buf, const char *name, uint32_t handle)
+{
+    virBufferAsprintf(buf, " %s %x:%x", name,
+                      TC_H_MAJ(handle) >> 16, TC_H_MIN(handle));
+}
+
+static void
+testFormatRate(virBufferPtr buf, const char *name, struct tc_ratespec *spec)
+{
+    virBufferAsprintf(buf, " %s %u/%u", name, spec->rate, spec->cell_log);
+}
+
+static void
+testFormatU32(virBufferPtr buf, struct rtattr **opts)
+{
+    struct rtattr *police[TCA_POLICE_MAX + 1];
+
+    if (opts[TCA_U32_SEL]) {
+        struct tc_u32_sel *sel = RTA_DATA(opts[TCA_U32_SEL]);
+        size_t i;
+
+        for (i = 0; i < sel->nkeys; i++)
+            virBufferAsprintf(buf, " match %08x/%08x at %d",
+                              ntohl(sel->keys[i].val),
+                              ntohl(sel->keys[i].mask),
+                              sel->keys[i].off);
+    }
+
+    if (opts[TCA_U32_POLICE]) {
+        struct tc_police *p;
+
+        PARSE_NESTED(police, TCA_POLICE_MAX, opts[TCA_U32_POLICE]);
+        p = RTA_DATA(police[TCA_POLICE_TBF]);
+        testFormatRate(buf, "police rate", &p->rate);
+        virBufferAsprintf(buf, " burst %u mtu %u action %d%s",
+                          p->burst, p->mtu, p->action,
+                          police[TCA_POLICE_RATE] ? " rtab" : "");
+    }
+
+    if (opts[TCA_U32_CLASSID])
+        testFormatHandle(buf, "flowid",
+                         *(uint32_t *) RTA_DATA(opts[TCA_U32_CLASSID]));
+}
+
+/* Format the traffic control requests in a tc(8) like fashion */
+static int
+testNetlinkDryRun(const struct nlmsghdr *nlmsg,
+                  void *opaque)
+{
+    virBufferPtr buf = opaque;
+    struct tcmsg *tcm = NLMSG_DATA(nlmsg);
+    struct rtattr *tb[TCA_MAX + 1];
+    struct rtattr *opts[TEST_OPTS_MAX + 1];
+    const char *kind = NULL;
+    bool create = nlmsg->nlmsg_flags & NLM_F_CREATE;
+    bool filter = false;
+
+    testParseAttrs(tb, TCA_MAX, TCA_RTA(tcm), TCA_PAYLOAD(nlmsg));
+    if (tb[TCA_KIND])
+        kind = RTA_DATA(tb[TCA_KIND]);
+
+    switch (nlmsg->nlmsg_type) {
+    case RTM_NEWQDISC:
+        virBufferAddLit(buf, "qdisc add");
+        break;
+    case RTM_DELQDISC:
+        virBufferAddLit(buf, "qdisc del");
+        break;
+    case RTM_NEWTCLASS:
+        virBufferAsprintf(buf, "class %s", create ? "add" : "change");
+        break;
+    case RTM_DELTCLASS:
+        virBufferAddLit(buf, "class del");
+        break;
+    case RTM_NEWTFILTER:
+        virBufferAddLit(buf, "filter add");
+        filter = true;
+        break;
+    case RTM_DELTFILTER:
+        virBufferAddLit(buf, "filter del");
+        filter = true;
+        break;
+    default:
+        virBufferAsprintf(buf, "unexpected message %d\n", nlmsg->nlmsg_type);
+        return -EINVAL;
+    }
+
+    virBufferAsprintf(buf, " dev %d", tcm->tcm_ifindex);
+
+    if (tcm->tcm_parent == TC_H_ROOT)
+        virBufferAddLit(buf, " root");
+    else if (tcm->tcm_parent == TC_H_INGRESS)
+        virBufferAddLit(buf, " ingress");
+    else if (tcm->tcm_parent)
+        testFormatHandle(buf, "parent", tcm->tcm_parent);
+
+    if (filter) {
+        virBufferAsprintf(buf, " protocol %04x prio %u",
+                          ntohs(TC_H_MIN(tcm->tcm_info)),
+                          TC_H_MAJ(tcm->tcm_info) >> 16);
+        if (tcm->tcm_handle)
+            virBufferAsprintf(buf, " handle %x", tcm->tcm_handle);
+    } else if (tcm->tcm_handle) {
+        testFormatHandle(buf, nlmsg->nlmsg_type == RTM_NEWQDISC ||
+                         nlmsg->nlmsg_type == RTM_DELQDISC ?
+                         "handle" : "classid", tcm->tcm_handle);
+    }
+
+    if (kind)
+        virBufferAsprintf(buf, " %s", kind);
+
+    if (tb[TCA_OPTIONS] && STREQ(kind, "sfq")) {
+        struct tc_sfq_qopt *sfq = RTA_DATA(tb[TCA_OPTIONS]);
+
+        virBufferAsprintf(buf, " perturb %d", sfq->perturb_period);
+    } else if (tb[TCA_OPTIONS]) {
+        PARSE_NESTED(opts, TEST_OPTS_MAX, tb[TCA_OPTIONS]);
+
+        if (STREQ(kind, "htb") && opts[TCA_HTB_INIT]) {
+            struct tc_htb_glob *glob = RTA_DATA(opts[TCA_HTB_INIT]);
+
+            virBufferAsprintf(buf, " ver %u r2q %u default %x",
+                              glob->version, glob->rate2quantum,
+                              glob->defcls);
+        } else if (STREQ(kind, "htb") && opts[TCA_HTB_PARMS]) {
+            struct tc_htb_opt *htb = RTA_DATA(opts[TCA_HTB_PARMS]);
+
+            testFormatRate(buf, "rate", &htb->rate);
+            testFormatRate(buf, "ceil", &htb->ceil);
+            virBufferAsprintf(buf, " buffer %u cbuffer %u quantum %u%s%s",
+                              htb->buffer, htb->cbuffer, htb->quantum,
+                              opts[TCA_HTB_RTAB] ? " rtab" : "",
+                              opts[TCA_HTB_CTAB] ? " ctab" : "");
+        } else if (STREQ(kind, "fw") && opts[TCA_FW_CLASSID]) {
+            testFormatHandle(buf, "flowid",
+                             *(uint32_t *) RTA_DATA(opts[TCA_FW_CLASSID]));
+        } else if (STREQ(kind, "u32")) {
+            testFormatU32(buf, opts);
+        }
+    }
+
+    virBufferAddLit(buf, "\n");
+    return 0;
+}
+
 static int
 testVirNetDevBandwidthSet(const void *data)
 {
@@ -79,7 +251,7 @@ testVirNetDevBandwidthSet(const void *data)
     if (!iface)
         iface = "eth0";
 
-    virCommandSetDryRun(&buf, NULL, NULL);
+    virNetlinkSetDryRun(testNetlinkDryRun, &buf);
 
     if (virNetDevBandwidthSet(iface, band, info->hierarchical_class) < 0)
         goto cleanup;
@@ -90,7 +262,7 @@ testVirNetDevBandwidthSet(const void *data)
             fprintf(stderr, "buffer's in error state: %d", err);
             goto cleanup;
         }
-        /* This is interesting, no command has been executed.
+        /* This is interesting, no request has been made.
          * Maybe that's expected, actually. */
     }
 
@@ -103,7 +275,7 @@ testVirNetDevBandwidthSet(const void *data)
 
     ret = 0;
  cleanup:
-    virCommandSetDryRun(NULL, NULL, NULL);
+    virNetlinkSetDryRun(NULL, NULL);
     virNetDevBandwidthFree(band);
     virBufferFreeAndReset(&buf);
     VIR_FREE(actual_cmd);
@@ -115,7 +287,7 @@ mymain(void)
 {
     int ret = 0;
 
-#define DO_TEST_SET(Band, Exp_cmd, ...)                     \
+# define DO_TEST_SET(Band, Exp_cmd, ...)                     \
     do {                                                    \
         struct testSetStruct data = {.band = Band,          \
                                      .exp_cmd = Exp_cmd,    \
@@ -134,37 +306,51 @@ mymain(void)
     DO_TEST_SET(("<bandwidth>"
                  "  <inbound average='1024'/>"
                  "</bandwidth>"),
-                (TC " qdisc del dev eth0 root\n"
-                 TC " qdisc del dev eth0 ingress\n"
-                 TC " qdisc add dev eth0 root handle 1: htb default 1\n"
-                 TC " class add dev eth0 parent 1: classid 1:1 htb rate 1024kbps quantum 87\n"
-                 TC " qdisc add dev eth0 parent 1:1 handle 2: sfq perturb 10\n"
-                 TC " filter add dev eth0 parent 1:0 protocol all prio 1 handle 1 fw flowid 1\n"));
+                ("qdisc del dev 1 root\n"
+                 "qdisc del dev 1 ingress handle ffff:0\n"
+                 "qdisc add dev 1 root handle 1:0 htb ver 3 r2q 10 default 1\n"
+                 "class add dev 1 parent 1:0 classid 1:1 htb rate 1024000/3 "
+                 "ceil 1024000/3 buffer 24406 cbuffer 24406 quantum 87 rtab ctab\n"
+                 "qdisc add dev 1 parent 1:1 handle 2:0 sfq perturb 10\n"
+                 "filter add dev 1 parent 1:0 protocol 0003 prio 1 handle 1 fw flowid 0:1\n"));
 
     DO_TEST_SET(("<bandwidth>"
                  "  <outbound average='1024'/>"
                  "</bandwidth>"),
-                (TC " qdisc del dev eth0 root\n"
-                 TC " qdisc del dev eth0 ingress\n"
-                 TC " qdisc add dev eth0 ingress\n"
-                 TC " filter add dev eth0 parent ffff: protocol all u32 match u32 0 0 "
-                 "police rate 1024kbps burst 1024kb mtu 64kb drop flowid :1\n"));
+                ("qdisc del dev 1 root\n"
+                 "qdisc del dev 1 ingress handle ffff:0\n"
+                 "qdisc add dev 1 ingress handle ffff:0 ingress\n"
+                 "filter add dev 1 parent ffff:0 protocol 0003 prio 0 u32 "
+                 "match 00000000/00000000 at 0 police rate 1024000/9 "
+                 "burst 16000000 mtu 65536 action 2 rtab flowid 0:1\n"));
 
     DO_TEST_SET(("<bandwidth>"
                  "  <inbound average='1' peak='2' floor='3' burst='4'/>"
                  "  <outbound average='5' peak='6' burst='7'/>"
                  "</bandwidth>"),
-                (TC " qdisc del dev eth0 root\n"
-                 TC " qdisc del dev eth0 ingress\n"
-                 TC " qdisc add dev eth0 root handle 1: htb default 1\n"
-                 TC " class add dev eth0 parent 1: classid 1:1 htb rate 1kbps ceil 2kbps burst 4kb quantum 1\n"
-                 TC " qdisc add dev eth0 parent 1:1 handle 2: sfq perturb 10\n"
-                 TC " filter add dev eth0 parent 1:0 protocol all prio 1 handle 1 fw flowid 1\n"
-                 TC " qdisc add dev eth0 ingress\n"
-                 TC " filter add dev eth0 parent ffff: protocol all u32 match u32 0 0 "
-                 "police rate 5kbps burst 7kb mtu 64kb drop flowid :1\n"));
+                ("qdisc del dev 1 root\n"
+                 "qdisc del dev 1 ingress handle ffff:0\n"
+                 "qdisc add dev 1 root handle 1:0 htb ver 3 r2q 10 default 1\n"
+                 "class add dev 1 parent 1:0 classid 1:1 htb rate 1000/3 "
+                 "ceil 2000/3 buffer 64000000 cbuffer 12500000 quantum 1 rtab ctab\n"
+                 "qdisc add dev 1 parent 1:1 handle 2:0 sfq perturb 10\n"
+                 "filter add dev 1 parent 1:0 protocol 0003 prio 1 handle 1 fw flowid 0:1\n"
+                 "qdisc add dev 1 ingress handle ffff:0 ingress\n"
+                 "filter add dev 1 parent ffff:0 protocol 0003 prio 0 u32 "
+                 "match 00000000/00000000 at 0 police rate 5000/9 "
+                 "burst 22400000 mtu 65536 action 2 rtab flowid 0:1\n"));
 
     return ret;
 }
 
 VIR_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/virnetdevbandwidthmock.so")
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* defined(__linux__) && defined(HAVE_LIBNL) */
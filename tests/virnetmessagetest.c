@@ -455,8 +455,10 @@ static int testMessagePayloadDecode(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
-static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
+static int testMessagePayloadStreamEncode(const void *args)
 {
+    bool inPlace = !!args;
+    char *payload;
     char stream[] = "The quick brown fox jumps over the lazy dog";
     virNetMessagePtr msg = virNetMessageNew(true);
     static const char expect[] = {
@@ -495,8 +497,17 @@ static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
     if (virNetMessageEncodeHeader(msg) < 0)
         goto cleanup;
 
-    if (virNetMessageEncodePayloadRaw(msg, stream, strlen(stream)) < 0)
-        goto cleanup;
+    if (inPlace) {
+        /* Over-reserve to check only the filled part gets sent */
+        if (!(payload = virNetMessageEncodePayloadRawBegin(msg, 1024)))
+            goto cleanup;
+        memcpy(payload, stream, strlen(stream));
+        if (virNetMessageEncodePayloadRawEnd(msg, strlen(stream)) < 0)
+            goto cleanup;
+    } else {
+        if (virNetMessageEncodePayloadRaw(msg, stream, strlen(stream)) < 0)
+            goto cleanup;
+    }
 
     if (ARRAY_CARDINALITY(expect) != msg->bufferLength) {
         VIR_DEBUG("Expect message length %zu got %zu",
@@ -522,6 +533,151 @@ static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
 }
 
 
+static int testMessageBufferPool(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessagePtr msg = virNetMessageNew(true);
+    virNetMessagePoolStats before;
+    virNetMessagePoolStats after;
+    char *buffer;
+    int ret = -1;
+
+    if (!msg)
+        return -1;
+
+    virNetMessagePoolGetStats(&before);
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+    buffer = msg->buffer;
+
+    /* Growing within the allocated size must keep the buffer */
+    if (virNetMessageGrowBuffer(msg, VIR_NET_MESSAGE_LEN_MAX, 0) < 0)
+        goto cleanup;
+
+    if (msg->buffer != buffer) {
+        VIR_DEBUG("Expect buffer to be kept");
+        goto cleanup;
+    }
+
+    virNetMessagePoolGetStats(&before);
+    virNetMessageClear(msg);
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+    virNetMessagePoolGetStats(&after);
+
+    if (after.hits != before.hits + 1 || msg->buffer != buffer) {
+        VIR_DEBUG("Expect released buffer to be reused");
+        goto cleanup;
+    }
+
+    /* A disabled pool must not keep anything */
+    virNetMessagePoolSetMaxBytes(0);
+    virNetMessageClear(msg);
+    virNetMessagePoolGetStats(&after);
+
+    if (after.buffers != 0 || after.bytes != 0) {
+        VIR_DEBUG("Expect empty pool, got %zu buffers", after.buffers);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessagePoolSetMaxBytes(before.maxBytes);
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+#if WITH_ZLIB
+static int testMessageCompress(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessagePtr msg = virNetMessageNew(true);
+    virNetMessagePtr rx = virNetMessageNew(true);
+    char payload[8192];
+    size_t rawlen;
+    size_t i;
+    int ret = -1;
+
+    if (!msg || !rx)
+        goto cleanup;
+
+    for (i = 0; i < sizeof(payload); i++)
+        payload[i] = "<domain type='kvm'>"[i % 19];
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_REPLY;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayloadRaw(msg, payload, sizeof(payload)) < 0)
+        goto cleanup;
+    rawlen = msg->bufferLength;
+
+    if (virNetMessageCompress(msg, 6) < 0)
+        goto cleanup;
+
+    if (!msg->compressed || msg->bufferLength >= rawlen) {
+        VIR_DEBUG("Expect message to shrink, got %zu of %zu bytes",
+                  msg->bufferLength, rawlen);
+        goto cleanup;
+    }
+
+    /* Feed it back as it would come off the wire */
+    rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageGrowBuffer(rx, rx->bufferLength, 0) < 0)
+        goto cleanup;
+    memcpy(rx->buffer, msg->buffer, VIR_NET_MESSAGE_LEN_MAX);
+
+    if (virNetMessageDecodeLength(rx) < 0)
+        goto cleanup;
+
+    if (!rx->compressed || rx->bufferLength != msg->bufferLength) {
+        VIR_DEBUG("Expect compressed length %zu, got %zu",
+                  msg->bufferLength, rx->bufferLength);
+        goto cleanup;
+    }
+
+    memcpy(rx->buffer, msg->buffer, msg->bufferLength);
+
+    if (virNetMessageDecodeHeader(rx) < 0)
+        goto cleanup;
+
+    if (rx->bufferLength != rawlen ||
+        rx->header.proc != 0x666 ||
+        rx->header.serial != 0x99 ||
+        memcmp(rx->buffer + rx->bufferOffset, payload, sizeof(payload)) != 0) {
+        VIR_DEBUG("Decompressed message does not match the original");
+        goto cleanup;
+    }
+
+    /* Stream data is sent as it is */
+    virNetMessageClear(msg);
+    msg->header.type = VIR_NET_STREAM;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayloadRaw(msg, payload, sizeof(payload)) < 0 ||
+        virNetMessageCompress(msg, 6) < 0)
+        goto cleanup;
+
+    if (msg->compressed) {
+        VIR_DEBUG("Expect stream data not to be compressed");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    virNetMessageFree(rx);
+    return ret;
+}
+#endif /* WITH_ZLIB */
+
+
 static int
 mymain(void)
 {
@@ -544,6 +700,18 @@ mymain(void)
     if (virTestRun("Message Payload Stream Encode", testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Message Payload Stream Encode In Place",
+                   testMessagePayloadStreamEncode, "in-place") < 0)
+        ret = -1;
+
+    if (virTestRun("Message Buffer Pool", testMessageBufferPool, NULL) < 0)
+        ret = -1;
+
+#if WITH_ZLIB
+    if (virTestRun("Message Compress", testMessageCompress, NULL) < 0)
+        ret = -1;
+#endif
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
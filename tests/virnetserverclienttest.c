@@ -137,6 +137,114 @@ static int testIdentity(const void *opaque ATTRIBUTE_UNUSED)
 }
 
 
+static int testMatch(const void *opaque ATTRIBUTE_UNUSED)
+{
+    int sv[2];
+    int ret = -1;
+    virNetSocketPtr sock = NULL;
+    virNetServerClientPtr client = NULL;
+    virIdentityPtr ident = NULL;
+    virNetServerClientMatch match = { .transport = -1 };
+    long long now;
+
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        virReportSystemError(errno, "%s",
+                             "Cannot create socket pair");
+        return -1;
+    }
+
+    if (virNetSocketNewConnectSockFD(sv[0], &sock) < 0) {
+        virDispatchError(NULL);
+        goto cleanup;
+    }
+    sv[0] = -1;
+
+    if (!(client = virNetServerClientNew(1, sock, 0, false, 1,
+# ifdef WITH_GNUTLS
+                                         NULL,
+# endif
+                                         NULL, NULL, NULL, NULL))) {
+        virDispatchError(NULL);
+        goto cleanup;
+    }
+
+    /* No identity has been assigned yet */
+    match.identity = "astrochicken";
+    if (virNetServerClientMatches(client, &match)) {
+        fprintf(stderr, "Client without identity matched '%s'\n",
+                match.identity);
+        goto cleanup;
+    }
+
+    if (!(ident = virNetServerClientGetIdentity(client))) {
+        fprintf(stderr, "Failed to create identity\n");
+        goto cleanup;
+    }
+
+    if (!virNetServerClientMatches(client, &match)) {
+        fprintf(stderr, "Client did not match identity '%s'\n",
+                match.identity);
+        goto cleanup;
+    }
+
+    match.identity = "nobody";
+    if (virNetServerClientMatches(client, &match)) {
+        fprintf(stderr, "Client matched identity '%s'\n", match.identity);
+        goto cleanup;
+    }
+    match.identity = NULL;
+
+    match.transport = VIR_CLIENT_TRANS_UNIX;
+    if (!virNetServerClientMatches(client, &match)) {
+        fprintf(stderr, "Client did not match the UNIX transport\n");
+        goto cleanup;
+    }
+
+    match.transport = VIR_CLIENT_TRANS_TCP;
+    if (virNetServerClientMatches(client, &match)) {
+        fprintf(stderr, "Client matched the TCP transport\n");
+        goto cleanup;
+    }
+    match.transport = -1;
+
+    now = virNetServerClientGetLastActivity(client);
+    if (now < virNetServerClientGetTimestamp(client)) {
+        fprintf(stderr, "Client was active before it connected\n");
+        goto cleanup;
+    }
+
+    match.now = now + 100;
+    match.minAge = 50;
+    match.minIdle = 50;
+    if (!virNetServerClientMatches(client, &match)) {
+        fprintf(stderr, "Client did not match minimal age and idle time\n");
+        goto cleanup;
+    }
+
+    match.minIdle = 200;
+    if (virNetServerClientMatches(client, &match)) {
+        fprintf(stderr, "Client matched excessive idle time\n");
+        goto cleanup;
+    }
+
+    match.minIdle = 0;
+    match.minAge = 200;
+    if (virNetServerClientMatches(client, &match)) {
+        fprintf(stderr, "Client matched excessive age\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(sock);
+    virObjectUnref(client);
+    virObjectUnref(ident);
+    VIR_FORCE_CLOSE(sv[0]);
+    VIR_FORCE_CLOSE(sv[1]);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -147,6 +255,10 @@ mymain(void)
                    testIdentity, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Match",
+                   testMatch, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 VIR_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/virnetserverclientmock.so")
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compare stream throughput of several remote transports:
+ *
+ *   tests/virnetstreambench VOLUME URI...
+ *
+ * The storage volume at path VOLUME is downloaded in full over a
+ * connection to each URI in turn, for example
+ *
+ *   tests/virnetstreambench /var/lib/libvirt/images/big.img \
+ *       qemu+tcp://host/system?no_verify=1 \
+ *       qemu+tls://host/system \
+ *       qemu+ssh://host/system
+ *
+ * where the tcp transport is configured for SASL with a security
+ * layer such as GSSAPI, to measure the cost of each of them.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "internal.h"
+#include "viralloc.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define BENCH_CHUNK (256 * 1024)
+
+
+static int
+benchStream(const char *uri,
+            const char *path,
+            char *buf)
+{
+    virConnectPtr conn = NULL;
+    virStorageVolPtr vol = NULL;
+    virStreamPtr st = NULL;
+    unsigned long long start, end;
+    unsigned long long total = 0;
+    int got;
+    int ret = -1;
+
+    if (!(conn = virConnectOpen(uri)) ||
+        !(vol = virStorageVolLookupByPath(conn, path)) ||
+        !(st = virStreamNew(conn, 0)) ||
+        virTimeMillisNow(&start) < 0 ||
+        virStorageVolDownload(vol, st, 0, 0, 0) < 0)
+        goto cleanup;
+
+    while ((got = virStreamRecv(st, buf, BENCH_CHUNK)) > 0)
+        total += got;
+
+    if (got < 0 ||
+        virStreamFinish(st) < 0 ||
+        virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    if (end == start)
+        end++;
+
+    printf("%-40s: %llu bytes in %llu ms, %.1f MiB/s\n",
+           uri, total, end - start,
+           (double) total / 1024 / 1024 * 1000 / (end - start));
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0 && st)
+        virStreamAbort(st);
+    if (st)
+        virStreamFree(st);
+    if (vol)
+        virStorageVolFree(vol);
+    if (conn)
+        virConnectClose(conn);
+    return ret;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    char *buf = NULL;
+    size_t i;
+    int ret = EXIT_FAILURE;
+
+    if (argc < 3) {
+        fprintf(stderr, "%s VOLUME URI...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (virInitialize() < 0 ||
+        VIR_ALLOC_N(buf, BENCH_CHUNK) < 0)
+        goto cleanup;
+
+    for (i = 2; i < argc; i++) {
+        if (benchStream(argv[i], argv[1], buf) < 0)
+            goto cleanup;
+    }
+
+    ret = EXIT_SUCCESS;
+
+ cleanup:
+    if (ret != EXIT_SUCCESS)
+        fprintf(stderr, "%s\n", virGetLastErrorMessage());
+    VIR_FREE(buf);
+    return ret;
+}
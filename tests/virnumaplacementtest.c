@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#include "viralloc.h"
+#include "virnuma.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define GiB (1024ULL * 1024)
+
+/* Four nodes of 4 CPUs, 0-1 and 2-3 being close to each other */
+static unsigned int testDistances[4][4] = {
+    { 10, 16, 32, 32 },
+    { 16, 10, 32, 32 },
+    { 32, 32, 10, 16 },
+    { 32, 32, 16, 10 },
+};
+
+struct testPlacementData {
+    unsigned int load[4];
+    unsigned long long memFree[4];
+    unsigned int vcpus;
+    unsigned long long memory;
+    const char *expect;
+};
+
+
+static int
+testPlacement(const void *opaque)
+{
+    const struct testPlacementData *data = opaque;
+    virNumaPlacementNode nodes[4];
+    virBitmapPtr nodeset = NULL;
+    char *actual = NULL;
+    int ret = -1;
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(nodes); i++) {
+        nodes[i].id = i;
+        nodes[i].ncpus = 4;
+        nodes[i].load = data->load[i];
+        nodes[i].memFree = data->memFree[i];
+        nodes[i].distances = testDistances[i];
+    }
+
+    if (!(nodeset = virNumaPlacementChoose(nodes, ARRAY_CARDINALITY(nodes),
+                                           data->vcpus, data->memory)) ||
+        !(actual = virBitmapFormat(nodeset)))
+        goto cleanup;
+
+    if (STRNEQ(actual, data->expect)) {
+        virTestDifference(stderr, data->expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(actual);
+    virBitmapFree(nodeset);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(name, vcpus, memory, expect, ...) \
+    do { \
+        struct testPlacementData data = { \
+            __VA_ARGS__, vcpus, memory, expect \
+        }; \
+        if (virTestRun(name, testPlacement, &data) < 0) \
+            ret = -1; \
+    } while (0)
+
+    DO_TEST("idle host", 2, 2 * GiB, "0",
+            { 0, 0, 0, 0 }, { 8 * GiB, 8 * GiB, 8 * GiB, 8 * GiB });
+    DO_TEST("spare CPUs", 2, 2 * GiB, "2",
+            { 4, 2, 0, 3 }, { 8 * GiB, 8 * GiB, 4 * GiB, 8 * GiB });
+    DO_TEST("free memory", 2, 2 * GiB, "1",
+            { 0, 0, 0, 0 }, { 4 * GiB, 8 * GiB, 4 * GiB, 4 * GiB });
+    DO_TEST("overcommitted", 6, 2 * GiB, "3",
+            { 4, 3, 2, 1 }, { 8 * GiB, 8 * GiB, 8 * GiB, 8 * GiB });
+    DO_TEST("memory only fits", 2, 6 * GiB, "0",
+            { 4, 0, 0, 0 }, { 8 * GiB, 4 * GiB, 4 * GiB, 4 * GiB });
+    DO_TEST("spread to nearest", 2, 12 * GiB, "2-3",
+            { 0, 0, 0, 0 }, { 4 * GiB, 4 * GiB, 8 * GiB, 6 * GiB });
+    DO_TEST("spread for CPUs", 6, 12 * GiB, "0-1",
+            { 0, 0, 0, 0 }, { 8 * GiB, 6 * GiB, 4 * GiB, 4 * GiB });
+    DO_TEST("does not fit", 2, 64 * GiB, "0-3",
+            { 0, 0, 0, 0 }, { 8 * GiB, 8 * GiB, 8 * GiB, 8 * GiB });
+
+#undef DO_TEST
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -425,6 +425,15 @@ mymain(void)
     DO_TEST_PCI(testVirPCIDeviceIsAssignable, 5, 0x90, 1, 0);
     DO_TEST_PCI(testVirPCIDeviceIsAssignable, 1, 1, 0, 0);
 
+    /* The same again, first filling the topology cache and then
+     * answering from it */
+    virPCITopologyEnableCache(true);
+    DO_TEST_PCI(testVirPCIDeviceIsAssignable, 5, 0x90, 1, 0);
+    DO_TEST_PCI(testVirPCIDeviceIsAssignable, 1, 1, 0, 0);
+    DO_TEST_PCI(testVirPCIDeviceIsAssignable, 5, 0x90, 1, 0);
+    DO_TEST_PCI(testVirPCIDeviceIsAssignable, 1, 1, 0, 0);
+    virPCITopologyEnableCache(false);
+
     DO_TEST_PCI(testVirPCIDeviceDetachFail, 0, 0x0a, 1, 0);
 
     /* Reattach a device already bound to non-stub a driver */
@@ -152,6 +152,61 @@ static int testAllocReuse(const void *args ATTRIBUTE_UNUSED)
 }
 
 
+static int testAllocRotate(const void *args ATTRIBUTE_UNUSED)
+{
+    virPortAllocatorPtr alloc;
+    int ret = -1;
+    unsigned short p1, p2, p3, p4, p5;
+
+    if (!(alloc = virPortAllocatorNew("test", 5900, 5904,
+                                      VIR_PORT_ALLOCATOR_ROTATE)))
+        return -1;
+
+    if (virPortAllocatorAcquire(alloc, &p1) < 0)
+        goto cleanup;
+    if (p1 != 5901) {
+        VIR_TEST_DEBUG("Expected 5901, got %d", p1);
+        goto cleanup;
+    }
+
+    if (virPortAllocatorAcquire(alloc, &p2) < 0)
+        goto cleanup;
+    if (p2 != 5902) {
+        VIR_TEST_DEBUG("Expected 5902, got %d", p2);
+        goto cleanup;
+    }
+
+    /* A released port isn't handed out again right away */
+    if (virPortAllocatorRelease(alloc, p1) < 0)
+        goto cleanup;
+
+    if (virPortAllocatorAcquire(alloc, &p3) < 0)
+        goto cleanup;
+    if (p3 != 5903) {
+        VIR_TEST_DEBUG("Expected 5903, got %d", p3);
+        goto cleanup;
+    }
+
+    /* 5904 is used by somebody else, so we wrap around */
+    if (virPortAllocatorAcquire(alloc, &p4) < 0)
+        goto cleanup;
+    if (p4 != 5901) {
+        VIR_TEST_DEBUG("Expected 5901, got %d", p4);
+        goto cleanup;
+    }
+
+    if (virPortAllocatorAcquire(alloc, &p5) == 0) {
+        VIR_TEST_DEBUG("Expected error, got %d", p5);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virObjectUnref(alloc);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -163,6 +218,9 @@ mymain(void)
     if (virTestRun("Test alloc reuse", testAllocReuse, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Test alloc rotate", testAllocRotate, NULL) < 0)
+        ret = -1;
+
     setenv("LIBVIRT_TEST_IPV4ONLY", "really", 1);
 
     if (virTestRun("Test IPv4-only alloc all", testAllocAll, NULL) < 0)
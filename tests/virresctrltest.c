@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "virfilewrapper.h"
+
+#define __VIR_RESCTRL_PRIV_H_ALLOW__
+#include "virresctrlpriv.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+struct virResctrlData {
+    const char *name;
+    unsigned long long size[2]; /* bytes per L3 cache id, 0 if not set */
+    virCacheType type;
+    unsigned int bandwidth[2]; /* percent per node id, 0 if not set */
+    const char *schemata; /* expected result, NULL if it should fail */
+};
+
+static int
+testResctrlAssign(const void *opaque)
+{
+    const struct virResctrlData *data = opaque;
+    virResctrlInfoPtr resctrl = NULL;
+    virResctrlAllocPtr alloc = NULL;
+    virResctrlInfoPerCachePtr *controls = NULL;
+    size_t ncontrols = 0;
+    char *dir = NULL;
+    char *schemata = NULL;
+    size_t i;
+    int rv;
+    int ret = -1;
+
+    if (virAsprintf(&dir, "%s/vircaps2xmldata/linux-resctrl/resctrl",
+                    abs_srcdir) < 0)
+        goto cleanup;
+
+    virFileWrapperAddPrefix("/sys/fs/resctrl", dir);
+
+    if (!(resctrl = virResctrlInfoNew()) ||
+        virResctrlInfoGetCache(resctrl, 3, 15360 * 1024,
+                               &ncontrols, &controls) < 0 ||
+        !(alloc = virResctrlAllocNew()))
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(data->size); i++) {
+        if (data->size[i] &&
+            virResctrlAllocSetCacheSize(alloc, 3, data->type,
+                                        i, data->size[i]) < 0)
+            goto cleanup;
+
+        if (data->bandwidth[i] &&
+            virResctrlAllocSetMemoryBandwidth(alloc, i,
+                                              data->bandwidth[i]) < 0)
+            goto cleanup;
+    }
+
+    rv = virResctrlAllocAssign(resctrl, alloc);
+
+    if (!data->schemata) {
+        if (rv == 0) {
+            VIR_TEST_DEBUG("Allocation '%s' should have failed\n", data->name);
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (rv < 0 || !(schemata = virResctrlAllocFormat(alloc)))
+        goto cleanup;
+
+    if (STRNEQ(schemata, data->schemata)) {
+        virTestDifference(stderr, data->schemata, schemata);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virFileWrapperClearPrefixes();
+    for (i = 0; i < ncontrols; i++)
+        VIR_FREE(controls[i]);
+    VIR_FREE(controls);
+    virResctrlAllocFree(alloc);
+    virResctrlInfoFree(resctrl);
+    VIR_FREE(schemata);
+    VIR_FREE(dir);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(name, size0, size1, type, bw0, bw1, schemata)           \
+    do {                                                                \
+        struct virResctrlData data = {name, {size0, size1}, type,       \
+                                      {bw0, bw1}, schemata};            \
+        if (virTestRun(name, testResctrlAssign, &data) < 0)             \
+            ret = -1;                                                   \
+    } while (0)
+
+    /* the lowest free bits come first, unused caches keep the defaults */
+    DO_TEST("cache-0", 3 << 20, 0, VIR_CACHE_TYPE_BOTH, 0, 0,
+            "L3:0=f;1=1ffff\nMB:0=100;1=100\n");
+    DO_TEST("cache-both", 1536 << 10, 1536 << 10, VIR_CACHE_TYPE_BOTH, 0, 0,
+            "L3:0=3;1=3\nMB:0=100;1=100\n");
+    /* 'manualres' already holds the upper three bits */
+    DO_TEST("cache-all-free", 17 * (768 << 10), 0, VIR_CACHE_TYPE_BOTH, 0, 0,
+            "L3:0=1ffff;1=1ffff\nMB:0=100;1=100\n");
+    DO_TEST("cache-too-big", 18 * (768 << 10), 0, VIR_CACHE_TYPE_BOTH, 0, 0,
+            NULL);
+    DO_TEST("cache-granularity", 1000 << 10, 0, VIR_CACHE_TYPE_BOTH, 0, 0,
+            NULL);
+    DO_TEST("cache-min", 768 << 10, 0, VIR_CACHE_TYPE_BOTH, 0, 0, NULL);
+    DO_TEST("cache-code", 3 << 20, 0, VIR_CACHE_TYPE_CODE, 0, 0, NULL);
+
+    DO_TEST("membw", 0, 0, VIR_CACHE_TYPE_BOTH, 60, 0,
+            "L3:0=1ffff;1=1ffff\nMB:0=60;1=100\n");
+    DO_TEST("membw-cache", 3 << 20, 0, VIR_CACHE_TYPE_BOTH, 80, 30,
+            "L3:0=f;1=1ffff\nMB:0=80;1=30\n");
+    /* 'manualres' already uses 20% */
+    DO_TEST("membw-overcommit", 0, 0, VIR_CACHE_TYPE_BOTH, 90, 0, NULL);
+    DO_TEST("membw-granularity", 0, 0, VIR_CACHE_TYPE_BOTH, 55, 0, NULL);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
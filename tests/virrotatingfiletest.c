@@ -35,6 +35,7 @@ VIR_LOG_INIT("tests.rotatingfiletest");
 #define FILENAME "virrotatingfiledata.txt"
 #define FILENAME0 "virrotatingfiledata.txt.0"
 #define FILENAME1 "virrotatingfiledata.txt.1"
+#define FILENAME1GZ "virrotatingfiledata.txt.1.gz"
 
 #define FILEBYTE 0xde
 #define FILEBYTE0 0xad
@@ -250,6 +251,83 @@ static int testRotatingFileWriterAppend(const void *data ATTRIBUTE_UNUSED)
 }
 
 
+static int testRotatingFileWriterSplice(const void *data ATTRIBUTE_UNUSED)
+{
+    virRotatingFileWriterPtr file;
+    int ret = -1;
+    int pipefd[2] = { -1, -1 };
+    char buf[256];
+    ssize_t got;
+
+    if (testRotatingFileInitFiles(512,
+                                  (off_t)-1,
+                                  (off_t)-1) < 0)
+        return -1;
+
+    file = virRotatingFileWriterNew(FILENAME,
+                                    1024,
+                                    2,
+                                    false,
+                                    0700);
+    if (!file)
+        goto cleanup;
+
+    if (pipe(pipefd) < 0)
+        goto cleanup;
+
+    memset(buf, 0x5e, sizeof(buf));
+    if (safewrite(pipefd[1], buf, sizeof(buf)) != sizeof(buf))
+        goto cleanup;
+
+    if (!virRotatingFileWriterCanSplice(file, 512) ||
+        virRotatingFileWriterCanSplice(file, 513)) {
+        fprintf(stderr, "Splicing must be limited to the current file\n");
+        goto cleanup;
+    }
+
+    if ((got = virRotatingFileWriterSplice(file, pipefd[0],
+                                           sizeof(buf))) == -2) {
+        /* Not supported here, data has to go through the buffer */
+        if (virRotatingFileWriterCanSplice(file, 0)) {
+            fprintf(stderr, "Splicing still expected to be possible\n");
+            goto cleanup;
+        }
+        ret = EXIT_AM_SKIP;
+        goto cleanup;
+    }
+
+    if (got != sizeof(buf)) {
+        fprintf(stderr, "Expected %zu bytes spliced not %zd\n",
+                sizeof(buf), got);
+        goto cleanup;
+    }
+
+    if (virRotatingFileWriterGetOffset(file) != 768 ||
+        testRotatingFileWriterAssertFileSizes(768,
+                                              (off_t)-1,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    /* Appending after splicing must continue at the same offset */
+    virRotatingFileWriterAppend(file, buf, sizeof(buf));
+
+    if (testRotatingFileWriterAssertFileSizes(1024,
+                                              (off_t)-1,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    virRotatingFileWriterFree(file);
+    unlink(FILENAME);
+    unlink(FILENAME0);
+    unlink(FILENAME1);
+    return ret;
+}
+
+
 static int testRotatingFileWriterTruncate(const void *data ATTRIBUTE_UNUSED)
 {
     virRotatingFileWriterPtr file;
@@ -653,6 +731,151 @@ static int testRotatingFileReaderPartial(const void *data ATTRIBUTE_UNUSED)
     return ret;
 }
 
+static int testRotatingFileReaderTail(const void *data ATTRIBUTE_UNUSED)
+{
+    virRotatingFileReaderPtr file;
+    int ret = -1;
+    char buf[600];
+    ssize_t got;
+    size_t regions[] = { 144, 256 };
+
+    if (testRotatingFileInitFiles(256, 256, 256) < 0)
+        return -1;
+
+    file = virRotatingFileReaderNew(FILENAME, 2);
+    if (!file)
+        goto cleanup;
+
+    if (virRotatingFileReaderSeekTail(file, 400) < 0)
+        goto cleanup;
+
+    if ((got = virRotatingFileReaderConsume(file, buf, sizeof(buf))) < 0)
+        goto cleanup;
+
+    if (testRotatingFileReaderAssertBufferContent(buf, got,
+                                                  ARRAY_CARDINALITY(regions),
+                                                  regions) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virRotatingFileReaderFree(file);
+    unlink(FILENAME);
+    unlink(FILENAME0);
+    unlink(FILENAME1);
+    return ret;
+}
+
+#if WITH_ZLIB
+static int testRotatingFileAssertRegions(const char *buf,
+                                         size_t buflen,
+                                         const char *bytes,
+                                         const size_t *sizes,
+                                         size_t nregions)
+{
+    size_t i, j;
+    size_t total = 0;
+
+    for (i = 0; i < nregions; i++)
+        total += sizes[i];
+
+    if (total != buflen) {
+        fprintf(stderr, "Expected %zu bytes in file not %zu\n",
+                total, buflen);
+        return -1;
+    }
+
+    for (i = 0; i < nregions; i++) {
+        for (j = 0; j < sizes[i]; j++) {
+            if (*buf != bytes[i]) {
+                fprintf(stderr,
+                        "Expected '0x%x' but got '0x%x' at region %zu byte %zu\n",
+                        bytes[i] & 0xff, *buf & 0xff, i, j);
+                return -1;
+            }
+            buf++;
+        }
+    }
+
+    return 0;
+}
+
+static int testRotatingFileCompress(const void *data ATTRIBUTE_UNUSED)
+{
+    virRotatingFileWriterPtr writer = NULL;
+    virRotatingFileReaderPtr reader = NULL;
+    int ret = -1;
+    char buf[2048];
+    ssize_t got;
+    char bytes[] = { FILEBYTE0, FILEBYTE, FILEBYTE1 };
+    size_t seekregions[] = { 24, 1024, 256 };
+    size_t tailregions[] = { 100, 1024, 256 };
+    struct stat sb;
+
+    if (testRotatingFileInitFiles(1024, 1024, (off_t)-1) < 0)
+        return -1;
+
+    if (stat(FILENAME0, &sb) < 0) {
+        virReportSystemError(errno, "Cannot stat %s", FILENAME0);
+        goto cleanup;
+    }
+
+    writer = virRotatingFileWriterNew(FILENAME,
+                                      1024,
+                                      2,
+                                      false,
+                                      0700);
+    if (!writer)
+        goto cleanup;
+    virRotatingFileWriterSetCompress(writer, true);
+
+    memset(buf, FILEBYTE1, 256);
+    virRotatingFileWriterAppend(writer, buf, 256);
+
+    /* Waits for the compression to finish */
+    virRotatingFileWriterFree(writer);
+    writer = NULL;
+
+    if (testRotatingFileWriterAssertFileSizes(256,
+                                              1024,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    if (access(FILENAME1GZ, R_OK) < 0) {
+        fprintf(stderr, "File %s does not exist\n", FILENAME1GZ);
+        goto cleanup;
+    }
+
+    /* The position given by the writer must still be valid, as well as
+     * the length of the data in the compressed file */
+    if (!(reader = virRotatingFileReaderNew(FILENAME, 2)) ||
+        virRotatingFileReaderSeek(reader, sb.st_ino, 1000) < 0 ||
+        (got = virRotatingFileReaderConsume(reader, buf, sizeof(buf))) < 0 ||
+        testRotatingFileAssertRegions(buf, got, bytes, seekregions,
+                                      ARRAY_CARDINALITY(seekregions)) < 0)
+        goto cleanup;
+
+    virRotatingFileReaderFree(reader);
+
+    if (!(reader = virRotatingFileReaderNew(FILENAME, 2)) ||
+        virRotatingFileReaderSeekTail(reader, 1380) < 0 ||
+        (got = virRotatingFileReaderConsume(reader, buf, sizeof(buf))) < 0 ||
+        testRotatingFileAssertRegions(buf, got, bytes, tailregions,
+                                      ARRAY_CARDINALITY(tailregions)) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virRotatingFileWriterFree(writer);
+    virRotatingFileReaderFree(reader);
+    unlink(FILENAME);
+    unlink(FILENAME0);
+    unlink(FILENAME1);
+    unlink(FILENAME1GZ);
+    return ret;
+}
+#endif /* WITH_ZLIB */
+
 static int testRotatingFileReaderSeek(const void *data ATTRIBUTE_UNUSED)
 {
     virRotatingFileReaderPtr file;
@@ -705,6 +928,9 @@ mymain(void)
     if (virTestRun("Rotating file write append", testRotatingFileWriterAppend, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Rotating file write splice", testRotatingFileWriterSplice, NULL) < 0)
+        ret = -1;
+
     if (virTestRun("Rotating file write truncate", testRotatingFileWriterTruncate, NULL) < 0)
         ret = -1;
 
@@ -738,6 +964,14 @@ mymain(void)
     if (virTestRun("Rotating file read seek", testRotatingFileReaderSeek, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Rotating file read tail", testRotatingFileReaderTail, NULL) < 0)
+        ret = -1;
+
+#if WITH_ZLIB
+    if (virTestRun("Rotating file compress", testRotatingFileCompress, NULL) < 0)
+        ret = -1;
+#endif
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
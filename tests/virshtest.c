@@ -89,11 +89,16 @@ testCompareOutputLit(const char *expectData,
     "test:///default"
 
 static char *custom_uri;
+static char *batch_file;
 
 # define VIRSH_CUSTOM     "../tools/virsh", \
     "--connect", \
     custom_uri
 
+# define VIRSH_SCALE      "../tools/virsh", \
+    "--connect", \
+    "test:///scale?domains=4&networks=1&pools=1"
+
 static int testCompareListDefault(const void *data ATTRIBUTE_UNUSED)
 {
   const char *const argv[] = { VIRSH_DEFAULT, "list", NULL };
@@ -117,6 +122,20 @@ static int testCompareListCustom(const void *data ATTRIBUTE_UNUSED)
   return testCompareOutputLit(exp, NULL, argv);
 }
 
+static int testCompareListScale(const void *data ATTRIBUTE_UNUSED)
+{
+  const char *const argv[] = { VIRSH_SCALE, "list", "--all", NULL };
+  const char *exp = "\
+ Id    Name                           State\n\
+----------------------------------------------------\n\
+ 1     scale-0                        running\n\
+ 2     scale-2                        running\n\
+ -     scale-1                        shut off\n\
+ -     scale-3                        shut off\n\
+\n";
+  return testCompareOutputLit(exp, NULL, argv);
+}
+
 static int testCompareNodeinfoDefault(const void *data ATTRIBUTE_UNUSED)
 {
   const char *const argv[] = { VIRSH_DEFAULT, "nodeinfo", NULL };
@@ -237,6 +256,22 @@ static int testCompareDomstateByName(const void *data ATTRIBUTE_UNUSED)
   return testCompareOutputLit(exp, NULL, argv);
 }
 
+static int testCompareBatchJSON(const void *data ATTRIBUTE_UNUSED)
+{
+  const char *const argv[] = { VIRSH_CUSTOM, "--batch", batch_file,
+                               "--jobs", "4", "--json", NULL };
+  const char *exp =
+      "{\"line\": 2, \"command\": \"domname 2\", \"success\": true, "
+      "\"output\": \"fc4\\n\\n\", \"error\": \"\"}\n"
+      "{\"line\": 4, \"command\": \"domid fc4; domuuid fc4\", "
+      "\"success\": true, "
+      "\"output\": \"2\\n\\n" DOM_UUID "\\n\\n\", \"error\": \"\"}\n"
+      "{\"line\": 5, \"command\": \"echo --shell \\\"a b\\\"\", "
+      "\"success\": true, "
+      "\"output\": \"'a b'\\n\", \"error\": \"\"}\n";
+  return testCompareOutputLit(exp, NULL, argv);
+}
+
 struct testInfo {
     const char *const *argv;
     const char *result;
@@ -258,6 +293,10 @@ mymain(void)
                     abs_srcdir) < 0)
         return EXIT_FAILURE;
 
+    if (virAsprintf(&batch_file, "%s/virshtestdata/batch.txt",
+                    abs_srcdir) < 0)
+        return EXIT_FAILURE;
+
     if (virTestRun("virsh list (default)",
                    testCompareListDefault, NULL) != 0)
         ret = -1;
@@ -266,6 +305,10 @@ mymain(void)
                    testCompareListCustom, NULL) != 0)
         ret = -1;
 
+    if (virTestRun("virsh list (scale)",
+                   testCompareListScale, NULL) != 0)
+        ret = -1;
+
     if (virTestRun("virsh nodeinfo (default)",
                    testCompareNodeinfoDefault, NULL) != 0)
         ret = -1;
@@ -322,6 +365,10 @@ mymain(void)
                    testCompareDomstateByName, NULL) != 0)
         ret = -1;
 
+    if (virTestRun("virsh batch (json)",
+                   testCompareBatchJSON, NULL) != 0)
+        ret = -1;
+
     /* It's a bit awkward listing result before argument, but that's a
      * limitation of C99 vararg macros.  */
 # define DO_TEST(i, result, ...)                                        \
@@ -416,6 +463,7 @@ mymain(void)
 # undef DO_TEST
 
     VIR_FREE(custom_uri);
+    VIR_FREE(batch_file);
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
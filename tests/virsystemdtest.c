@@ -329,6 +329,45 @@ static int testCreateBadSystemd(const void *opaque ATTRIBUTE_UNUSED)
 }
 
 
+static int testCreateMachineAsync(const void *opaque ATTRIBUTE_UNUSED)
+{
+    unsigned char uuid[VIR_UUID_BUFLEN] = {
+        1, 1, 1, 1,
+        2, 2, 2, 2,
+        3, 3, 3, 3,
+        4, 4, 4, 4
+    };
+    int nicindexes[] = {
+        2, 1729, 87539319,
+    };
+    size_t nnicindexes = ARRAY_CARDINALITY(nicindexes);
+    virSystemdMachineRequestPtr req;
+    int ret = -1;
+
+    if (!(req = virSystemdCreateMachineStart("demo",
+                                             "qemu",
+                                             uuid,
+                                             NULL,
+                                             123,
+                                             false,
+                                             nnicindexes, nicindexes,
+                                             "highpriority.slice"))) {
+        fprintf(stderr, "%s", "Failed to start creating KVM machine\n");
+        return -1;
+    }
+
+    if (virSystemdCreateMachineWait(req) < 0) {
+        fprintf(stderr, "%s", "Failed to create KVM machine\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virSystemdMachineRequestFree(req);
+    return ret;
+}
+
 static int testCreateNetwork(const void *opaque ATTRIBUTE_UNUSED)
 {
     unsigned char uuid[VIR_UUID_BUFLEN] = {
@@ -538,6 +577,7 @@ mymain(void)
     DO_TEST("Test create systemd not running ", testCreateSystemdNotRunning);
     DO_TEST("Test create bad systemd ", testCreateBadSystemd);
     DO_TEST("Test create with network ", testCreateNetwork);
+    DO_TEST("Test create machine asynchronously ", testCreateMachineAsync);
     DO_TEST("Test getting machine name ", testGetMachineName);
 
 # define TEST_SCOPE(_name, unitname, _legacy)                           \
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#include "virevent.h"
+#include "virtimerwheelpriv.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* The single event loop timeout of the wheel */
+static virEventTimeoutCallback testTimeoutCb;
+static void *testTimeoutOpaque;
+static virFreeCallback testTimeoutFf;
+static int testTimeoutFrequency = -1;
+
+typedef struct _testEntryData testEntryData;
+struct _testEntryData {
+    virTimerWheelPtr wheel;
+    size_t fired;
+    size_t freed;
+    bool remove;
+};
+
+
+static int
+testAddTimeout(int frequency,
+               virEventTimeoutCallback cb,
+               void *opaque,
+               virFreeCallback ff)
+{
+    if (testTimeoutCb)
+        return -1;
+
+    testTimeoutCb = cb;
+    testTimeoutOpaque = opaque;
+    testTimeoutFf = ff;
+    testTimeoutFrequency = frequency;
+    return 1;
+}
+
+
+static void
+testUpdateTimeout(int timer ATTRIBUTE_UNUSED,
+                  int frequency)
+{
+    testTimeoutFrequency = frequency;
+}
+
+
+static int
+testRemoveTimeout(int timer ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+
+static void
+testEntryCallback(virTimerWheelEntryPtr entry,
+                  void *opaque)
+{
+    testEntryData *data = opaque;
+
+    data->fired++;
+    if (data->remove)
+        virTimerWheelRemove(data->wheel, entry);
+}
+
+
+static void
+testEntryFree(void *opaque)
+{
+    testEntryData *data = opaque;
+
+    data->freed++;
+}
+
+
+static int
+testTimerWheelPeriodic(const void *opaque)
+{
+    virTimerWheelPtr wheel = (virTimerWheelPtr) opaque;
+    virTimerWheelEntryPtr entry;
+    testEntryData data = { .wheel = wheel };
+
+    if (!(entry = virTimerWheelAddAt(wheel, 250, testEntryCallback, &data,
+                                     testEntryFree, 0)))
+        return -1;
+
+    /* Deadlines are rounded up to whole ticks */
+    if (testTimeoutFrequency != 300) {
+        fprintf(stderr, "timeout armed for %d ms\n", testTimeoutFrequency);
+        goto error;
+    }
+
+    virTimerWheelRunAt(wheel, 299);
+    if (data.fired != 0) {
+        fprintf(stderr, "entry fired too early\n");
+        goto error;
+    }
+
+    virTimerWheelRunAt(wheel, 300);
+    if (data.fired != 1 || testTimeoutFrequency != 300) {
+        fprintf(stderr, "entry did not fire once\n");
+        goto error;
+    }
+
+    virTimerWheelRunAt(wheel, 600);
+    if (data.fired != 2) {
+        fprintf(stderr, "entry is not periodic\n");
+        goto error;
+    }
+
+    virTimerWheelUpdateAt(wheel, entry, -1, 600);
+    virTimerWheelRunAt(wheel, 10000);
+    if (data.fired != 2 || testTimeoutFrequency != -1) {
+        fprintf(stderr, "disabled entry fired\n");
+        goto error;
+    }
+
+    virTimerWheelRemove(wheel, entry);
+    if (data.freed != 1) {
+        fprintf(stderr, "entry not freed\n");
+        return -1;
+    }
+
+    return 0;
+
+ error:
+    virTimerWheelRemove(wheel, entry);
+    return -1;
+}
+
+
+static int
+testTimerWheelLong(const void *opaque)
+{
+    virTimerWheelPtr wheel = (virTimerWheelPtr) opaque;
+    virTimerWheelEntryPtr entry;
+    unsigned long long now = 20000;
+    int frequency = 2 * VIR_TIMER_WHEEL_SLOTS * VIR_TIMER_WHEEL_TICK;
+    testEntryData data = { .wheel = wheel };
+    int ret = -1;
+
+    if (!(entry = virTimerWheelAddAt(wheel, frequency, testEntryCallback,
+                                     &data, testEntryFree, now)))
+        return -1;
+
+    /* The slot of the entry comes up a full turn before it expires */
+    virTimerWheelRunAt(wheel, now + frequency / 4);
+    virTimerWheelRunAt(wheel, now + frequency / 2);
+    virTimerWheelRunAt(wheel, now + frequency - 1);
+    if (data.fired != 0) {
+        fprintf(stderr, "entry fired a turn of the wheel too early\n");
+        goto cleanup;
+    }
+
+    virTimerWheelRunAt(wheel, now + frequency);
+    if (data.fired != 1) {
+        fprintf(stderr, "entry did not fire\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virTimerWheelRemove(wheel, entry);
+    return ret;
+}
+
+
+static int
+testTimerWheelRemoveCallback(const void *opaque)
+{
+    virTimerWheelPtr wheel = (virTimerWheelPtr) opaque;
+    testEntryData data = { .wheel = wheel, .remove = true };
+
+    if (!virTimerWheelAddAt(wheel, 0, testEntryCallback, &data,
+                            testEntryFree, 200000))
+        return -1;
+
+    virTimerWheelRunAt(wheel, 200100);
+    virTimerWheelRunAt(wheel, 200200);
+    if (data.fired != 1 || data.freed != 1) {
+        fprintf(stderr, "entry fired %zu times, freed %zu times\n",
+                data.fired, data.freed);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    virTimerWheelPtr wheel;
+    int ret = 0;
+
+    virEventRegisterImpl(NULL, NULL, NULL,
+                         testAddTimeout,
+                         testUpdateTimeout,
+                         testRemoveTimeout);
+
+    if (!(wheel = virTimerWheelNewAt(0)))
+        return EXIT_FAILURE;
+
+    if (virTestRun("Periodic", testTimerWheelPeriodic, wheel) < 0)
+        ret = -1;
+    if (virTestRun("Long", testTimerWheelLong, wheel) < 0)
+        ret = -1;
+    if (virTestRun("Remove from callback",
+                   testTimerWheelRemoveCallback, wheel) < 0)
+        ret = -1;
+
+    if (testTimeoutFf)
+        testTimeoutFf(testTimeoutOpaque);
+    virObjectUnref(wheel);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -201,6 +201,134 @@ testTypedParamsGetStringList(const void *opaque ATTRIBUTE_UNUSED)
     return rv;
 }
 
+static int
+testTypedParamsSerializeValue(const void *opaque ATTRIBUTE_UNUSED)
+{
+    size_t i;
+    int rv = -1;
+    virTypedParameterRemoteValue remote[6];
+    virTypedParameter got[6];
+
+    virTypedParameter params[] = {
+        { .field = "i", .type = VIR_TYPED_PARAM_INT, .value = { .i = -3 } },
+        { .field = "ui", .type = VIR_TYPED_PARAM_UINT, .value = { .ui = 3 } },
+        { .field = "l", .type = VIR_TYPED_PARAM_LLONG,
+          .value = { .l = -(1LL << 40) } },
+        { .field = "ul", .type = VIR_TYPED_PARAM_ULLONG,
+          .value = { .ul = 1ULL << 63 } },
+        { .field = "b", .type = VIR_TYPED_PARAM_BOOLEAN, .value = { .b = 1 } },
+        { .field = "s", .type = VIR_TYPED_PARAM_STRING,
+          .value = { .s = (char*)"foo" } },
+    };
+
+    memset(remote, 0, sizeof(remote));
+    memset(got, 0, sizeof(got));
+
+    for (i = 0; i < ARRAY_CARDINALITY(params); i++) {
+        if (virTypedParameterSerializeValue(&params[i], &remote[i]) < 0 ||
+            virTypedParameterDeserializeValue(&remote[i], &got[i]) < 0)
+            goto cleanup;
+
+        /* Only the value is transferred */
+        if (got[i].field[0] != '\0' || got[i].type != params[i].type) {
+            fprintf(stderr, "parameter '%s' not copied\n", params[i].field);
+            goto cleanup;
+        }
+
+        if (got[i].type == VIR_TYPED_PARAM_STRING ?
+            STRNEQ(got[i].value.s, params[i].value.s) :
+            memcmp(&got[i].value, &params[i].value,
+                   sizeof(got[i].value)) != 0) {
+            fprintf(stderr, "wrong value of '%s'\n", params[i].field);
+            goto cleanup;
+        }
+    }
+
+    remote[0].type = VIR_TYPED_PARAM_LAST;
+    if (virTypedParameterDeserializeValue(&remote[0], &got[0]) == 0) {
+        fprintf(stderr, "unknown parameter type accepted\n");
+        goto cleanup;
+    }
+
+    rv = 0;
+ cleanup:
+    VIR_FREE(remote[5].remote_typed_param_value.s);
+    VIR_FREE(got[5].value.s);
+    return rv;
+}
+
+static int
+testTypedParamsList(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virTypedParamListPtr list = NULL;
+    virTypedParameterPtr params = NULL;
+    virTypedParameterPtr param;
+    size_t nparams = 0;
+    size_t i;
+    int rv = -1;
+
+    if (VIR_ALLOC(list) < 0)
+        return -1;
+
+    /* Enough to grow the index a few times */
+    for (i = 0; i < 100; i++) {
+        if (virTypedParamListAddULLong(list, i, "block.%zu.rd.reqs", i) < 0)
+            goto cleanup;
+    }
+
+    if (virTypedParamListAddString(list, "vda", "block.0.name") < 0 ||
+        virTypedParamListAddBoolean(list, true, "vcpu.0.halted") < 0)
+        goto cleanup;
+
+    if (virTypedParamListAddInt(list, 1, "block.%d.rd.reqs", 42) == 0) {
+        fprintf(stderr, "duplicate parameter accepted\n");
+        goto cleanup;
+    }
+
+    if (virTypedParamListAddUInt(list, 1, "%0100d", 0) == 0) {
+        fprintf(stderr, "too long name accepted\n");
+        goto cleanup;
+    }
+
+    if (list->npar != 102) {
+        fprintf(stderr, "expected 102 parameters, got %zu\n", list->npar);
+        goto cleanup;
+    }
+
+    for (i = 0; i < 100; i++) {
+        char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+        snprintf(name, sizeof(name), "block.%zu.rd.reqs", i);
+        if (!(param = virTypedParamListGet(list, name)) ||
+            param->type != VIR_TYPED_PARAM_ULLONG ||
+            param->value.ul != i) {
+            fprintf(stderr, "parameter '%s' not found\n", name);
+            goto cleanup;
+        }
+    }
+
+    if (!(param = virTypedParamListGet(list, "block.0.name")) ||
+        STRNEQ(param->value.s, "vda") ||
+        virTypedParamListGet(list, "block.100.rd.reqs")) {
+        fprintf(stderr, "wrong lookup result\n");
+        goto cleanup;
+    }
+
+    nparams = virTypedParamListStealParams(list, &params);
+    if (nparams != 102 || list->npar != 0 ||
+        STRNEQ(params[101].field, "vcpu.0.halted") ||
+        virTypedParamListGet(list, "block.0.name")) {
+        fprintf(stderr, "parameters not stolen\n");
+        goto cleanup;
+    }
+
+    rv = 0;
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    virTypedParamListFree(list);
+    return rv;
+}
+
 static int
 testTypedParamsValidator(void)
 {
@@ -302,6 +430,12 @@ mymain(void)
     if (virTestRun("Add string list", testTypedParamsAddStringList, NULL) < 0)
         rv = -1;
 
+    if (virTestRun("Serialize values", testTypedParamsSerializeValue, NULL) < 0)
+        rv = -1;
+
+    if (virTestRun("Parameter list", testTypedParamsList, NULL) < 0)
+        rv = -1;
+
     if (rv < 0)
         return EXIT_FAILURE;
     return EXIT_SUCCESS;
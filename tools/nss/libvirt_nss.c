@@ -82,6 +82,35 @@ typedef struct {
 } leaseAddress;
 
 
+static int
+addAddr(leaseAddress **tmpAddress,
+        size_t *ntmpAddress,
+        int family,
+        const void *addr)
+{
+    size_t i;
+
+    for (i = 0; i < *ntmpAddress; i++) {
+        if (memcmp((*tmpAddress)[i].addr, addr,
+                   FAMILY_ADDRESS_SIZE(family)) == 0) {
+            DEBUG("IP address already in the list");
+            return 0;
+        }
+    }
+
+    if (VIR_REALLOC_N_QUIET(*tmpAddress, *ntmpAddress + 1) < 0) {
+        ERROR("Out of memory");
+        return -1;
+    }
+
+    (*tmpAddress)[*ntmpAddress].af = family;
+    memcpy((*tmpAddress)[*ntmpAddress].addr, addr,
+           FAMILY_ADDRESS_SIZE(family));
+    (*ntmpAddress)++;
+    return 0;
+}
+
+
 static int
 appendAddr(leaseAddress **tmpAddress,
            size_t *ntmpAddress,
@@ -92,7 +121,6 @@ appendAddr(leaseAddress **tmpAddress,
     const char *ipAddr;
     virSocketAddr sa;
     int family;
-    size_t i;
 
     if (!(ipAddr = virJSONValueObjectGetString(lease, "ip-address"))) {
         ERROR("ip-address field missing for %s", name);
@@ -113,33 +141,75 @@ appendAddr(leaseAddress **tmpAddress,
         goto cleanup;
     }
 
-    for (i = 0; i < *ntmpAddress; i++) {
-        if (memcmp((*tmpAddress)[i].addr,
-                   (family == AF_INET ?
-                    (void *) &sa.data.inet4.sin_addr.s_addr :
-                    (void *) &sa.data.inet6.sin6_addr.s6_addr),
-                   FAMILY_ADDRESS_SIZE(family)) == 0) {
-            DEBUG("IP address already in the list");
-            ret = 0;
-            goto cleanup;
-        }
+    ret = addAddr(tmpAddress, ntmpAddress, family,
+                  (family == AF_INET ?
+                   (void *) &sa.data.inet4.sin_addr.s_addr :
+                   (void *) &sa.data.inet6.sin6_addr.s6_addr));
+ cleanup:
+    return ret;
+}
+
+
+typedef struct {
+    leaseAddress **tmpAddress;
+    size_t *ntmpAddress;
+    int af;
+} findLeaseInIndexData;
+
+
+static int
+findLeaseInIndexIter(int family,
+                     const unsigned char *addr,
+                     void *opaque)
+{
+    findLeaseInIndexData *data = opaque;
+
+    if (data->af != AF_UNSPEC && data->af != family) {
+        DEBUG("Skipping address which family is %d, %d requested",
+              family, data->af);
+        return 0;
     }
 
-    if (VIR_REALLOC_N_QUIET(*tmpAddress, *ntmpAddress + 1) < 0) {
-        ERROR("Out of memory");
-        goto cleanup;
+    return addAddr(data->tmpAddress, data->ntmpAddress, family, addr);
+}
+
+
+static int
+findLeaseInIndex(leaseAddress **tmpAddress,
+                 size_t *ntmpAddress,
+                 virLeaseIndexPtr idx,
+                 const char *name,
+                 const char **macs,
+                 int af,
+                 bool *found)
+{
+    findLeaseInIndexData data = { tmpAddress, ntmpAddress, af };
+    time_t currtime;
+    int rc;
+
+    if ((currtime = time(NULL)) == (time_t) - 1) {
+        ERROR("Failed to get current system time");
+        return -1;
     }
 
-    (*tmpAddress)[*ntmpAddress].af = family;
-    memcpy((*tmpAddress)[*ntmpAddress].addr,
-           (family == AF_INET ?
-            (void *) &sa.data.inet4.sin_addr.s_addr :
-            (void *) &sa.data.inet6.sin6_addr.s6_addr),
-           FAMILY_ADDRESS_SIZE(family));
-    (*ntmpAddress)++;
-    ret = 0;
- cleanup:
-    return ret;
+    if (!macs) {
+        if ((rc = virLeaseIndexLookup(idx, name, NULL, currtime,
+                                      findLeaseInIndexIter, &data)) < 0)
+            return -1;
+        if (rc > 0)
+            *found = true;
+        return 0;
+    }
+
+    for (; *macs; macs++) {
+        if ((rc = virLeaseIndexLookup(idx, NULL, *macs, currtime,
+                                      findLeaseInIndexIter, &data)) < 0)
+            return -1;
+        if (rc > 0)
+            *found = true;
+    }
+
+    return 0;
 }
 
 
@@ -232,6 +302,9 @@ findLeaseInJSON(leaseAddress **tmpAddress,
  * filtering is done and addresses from both families are
  * returned.
  *
+ * Networks whose lease file has an up to date index are looked up
+ * in it, only the lease files of the others are parsed.
+ *
  * Returns -1 on error
  *          0 on success
  */
@@ -253,6 +326,9 @@ findLease(const char *name,
     size_t ntmpAddress = 0;
     virMacMapPtr *macmaps = NULL;
     size_t nMacmaps = 0;
+    virLeaseIndexPtr indexes = NULL;
+    size_t nindexes = 0;
+    size_t i;
 
     *address = NULL;
     *naddress = 0;
@@ -278,9 +354,28 @@ findLease(const char *name,
         char *path;
 
         if (virFileHasSuffix(entry->d_name, ".status")) {
+            char *indexPath;
+
             if (!(path = virFileBuildPath(leaseDir, entry->d_name, NULL)))
                 goto cleanup;
 
+            if (!(indexPath = virFileBuildPath(leaseDir, entry->d_name,
+                                               VIR_LEASE_INDEX_SUFFIX)) ||
+                VIR_REALLOC_N_QUIET(indexes, nindexes + 1) < 0) {
+                VIR_FREE(indexPath);
+                VIR_FREE(path);
+                goto cleanup;
+            }
+
+            if (virLeaseIndexOpen(&indexes[nindexes], indexPath, path) == 0) {
+                DEBUG("Using index %s", indexPath);
+                nindexes++;
+                VIR_FREE(indexPath);
+                VIR_FREE(path);
+                continue;
+            }
+            VIR_FREE(indexPath);
+
             DEBUG("Processing %s", path);
             if (virLeaseReadCustomLeaseFile(leases_array, path, NULL, NULL) < 0) {
                 ERROR("Unable to parse %s", path);
@@ -314,6 +409,12 @@ findLease(const char *name,
     DEBUG("Read %zd leases", nleases);
 
 #if !defined(LIBVIRT_NSS_GUEST)
+    for (i = 0; i < nindexes; i++) {
+        if (findLeaseInIndex(&tmpAddress, &ntmpAddress, &indexes[i],
+                             name, NULL, af, found) < 0)
+            goto cleanup;
+    }
+
     if (findLeaseInJSON(&tmpAddress, &ntmpAddress,
                         leases_array, nleases,
                         name, NULL, af, found) < 0)
@@ -321,13 +422,19 @@ findLease(const char *name,
 
 #else /* defined(LIBVIRT_NSS_GUEST) */
 
-    size_t i;
     for (i = 0; i < nMacmaps; i++) {
         const char **macs = (const char **) virMacMapLookup(macmaps[i], name);
+        size_t j;
 
         if (!macs)
             continue;
 
+        for (j = 0; j < nindexes; j++) {
+            if (findLeaseInIndex(&tmpAddress, &ntmpAddress, &indexes[j],
+                                 name, macs, af, found) < 0)
+                goto cleanup;
+        }
+
         if (findLeaseInJSON(&tmpAddress, &ntmpAddress,
                             leases_array, nleases,
                             name, macs, af, found) < 0)
@@ -351,6 +458,9 @@ findLease(const char *name,
     while (nMacmaps)
         virObjectUnref(macmaps[--nMacmaps]);
     VIR_FREE(macmaps);
+    while (nindexes)
+        virLeaseIndexClose(&indexes[--nindexes]);
+    VIR_FREE(indexes);
     return ret;
 }
 
@@ -56,6 +56,15 @@ VIR_LOG_INIT("tools.virsh-console");
 
 # define VIR_FROM_THIS VIR_FROM_NONE
 
+/*
+ * Buffers start at VIR_CONSOLE_BUFFER_MIN bytes and double whenever less
+ * than that is left, so a chatty guest is copied in large chunks rather
+ * than a kilobyte at a time. Once the terminal side is VIR_CONSOLE_BUFFER_MAX
+ * bytes behind we stop reading the stream until stdout catches up.
+ */
+# define VIR_CONSOLE_BUFFER_MIN 4096
+# define VIR_CONSOLE_BUFFER_MAX (1024 * 1024)
+
 struct virConsoleBuffer {
     size_t length;
     size_t offset;
@@ -78,6 +87,8 @@ struct virConsole {
     struct virConsoleBuffer terminalToStream;
 
     char escapeChar;
+    bool batch;
+    int logfd;
 };
 
 
@@ -117,12 +128,70 @@ virConsoleFree(virConsolePtr con)
 
     if (con->st)
         virStreamFree(con->st);
+    VIR_FORCE_CLOSE(con->logfd);
     virMutexDestroy(&con->lock);
     virCondDestroy(&con->cond);
     VIR_FREE(con);
 }
 
 
+/*
+ * Make sure at least VIR_CONSOLE_BUFFER_MIN bytes are free in @buf,
+ * unless it already reached VIR_CONSOLE_BUFFER_MAX. Returns 0 on
+ * success (which does not imply there's free space), -1 on OOM.
+ */
+static int
+virConsoleBufferReserve(struct virConsoleBuffer *buf)
+{
+    size_t length;
+
+    if (buf->length - buf->offset >= VIR_CONSOLE_BUFFER_MIN ||
+        buf->length >= VIR_CONSOLE_BUFFER_MAX)
+        return 0;
+
+    length = MAX(buf->length * 2, VIR_CONSOLE_BUFFER_MIN);
+    length = MIN(length, VIR_CONSOLE_BUFFER_MAX);
+
+    if (VIR_REALLOC_N(buf->data, length) < 0)
+        return -1;
+
+    buf->length = length;
+    return 0;
+}
+
+
+static void
+virConsoleUpdateStreamEvents(virConsolePtr con)
+{
+    int events = 0;
+
+    if (!con->st)
+        return;
+
+    if (con->streamToTerminal.offset < VIR_CONSOLE_BUFFER_MAX)
+        events |= VIR_STREAM_EVENT_READABLE;
+    if (con->terminalToStream.offset)
+        events |= VIR_STREAM_EVENT_WRITABLE;
+
+    virStreamEventUpdateCallback(con->st, events);
+}
+
+
+static void
+virConsoleLog(virConsolePtr con,
+              const char *data,
+              size_t len)
+{
+    if (con->logfd < 0)
+        return;
+
+    if (safewrite(con->logfd, data, len) < 0) {
+        VIR_WARN("Unable to write console log, disabling it");
+        VIR_FORCE_CLOSE(con->logfd);
+    }
+}
+
+
 static void
 virConsoleEventOnStream(virStreamPtr st,
                         int events, void *opaque)
@@ -130,32 +199,38 @@ virConsoleEventOnStream(virStreamPtr st,
     virConsolePtr con = opaque;
 
     if (events & VIR_STREAM_EVENT_READABLE) {
-        size_t avail = con->streamToTerminal.length -
-            con->streamToTerminal.offset;
-        int got;
+        struct virConsoleBuffer *buf = &con->streamToTerminal;
 
-        if (avail < 1024) {
-            if (VIR_REALLOC_N(con->streamToTerminal.data,
-                              con->streamToTerminal.length + 1024) < 0) {
+        /* Drain everything the stream has queued instead of taking
+         * a single packet per wakeup. */
+        while (true) {
+            size_t avail;
+            int got;
+
+            if (virConsoleBufferReserve(buf) < 0) {
                 virConsoleShutdown(con);
                 return;
             }
-            con->streamToTerminal.length += 1024;
-            avail += 1024;
-        }
 
-        got = virStreamRecv(st,
-                            con->streamToTerminal.data +
-                            con->streamToTerminal.offset,
-                            avail);
-        if (got == -2)
-            return; /* blocking */
-        if (got <= 0) {
-            virConsoleShutdown(con);
-            return;
+            if (!(avail = buf->length - buf->offset))
+                break;
+
+            got = virStreamRecv(st, buf->data + buf->offset, avail);
+            if (got == -2)
+                break; /* blocking */
+            if (got <= 0) {
+                /* Don't lose the guest's last words on EOF */
+                if (got == 0 && buf->offset)
+                    ignore_value(safewrite(STDOUT_FILENO,
+                                           buf->data, buf->offset));
+                virConsoleShutdown(con);
+                return;
+            }
+            virConsoleLog(con, buf->data + buf->offset, got);
+            buf->offset += got;
         }
-        con->streamToTerminal.offset += got;
-        if (con->streamToTerminal.offset)
+
+        if (buf->offset)
             virEventUpdateHandle(con->stdoutWatch,
                                  VIR_EVENT_HANDLE_WRITABLE);
     }
@@ -163,7 +238,6 @@ virConsoleEventOnStream(virStreamPtr st,
     if (events & VIR_STREAM_EVENT_WRITABLE &&
         con->terminalToStream.offset) {
         ssize_t done;
-        size_t avail;
         done = virStreamSend(con->st,
                              con->terminalToStream.data,
                              con->terminalToStream.offset);
@@ -178,16 +252,11 @@ virConsoleEventOnStream(virStreamPtr st,
                 con->terminalToStream.offset - done);
         con->terminalToStream.offset -= done;
 
-        avail = con->terminalToStream.length - con->terminalToStream.offset;
-        if (avail > 1024) {
-            ignore_value(VIR_REALLOC_N(con->terminalToStream.data,
-                                       con->terminalToStream.offset + 1024));
-            con->terminalToStream.length = con->terminalToStream.offset + 1024;
-        }
+        if (con->stdinWatch != -1)
+            virEventUpdateHandle(con->stdinWatch, VIR_EVENT_HANDLE_READABLE);
     }
-    if (!con->terminalToStream.offset)
-        virStreamEventUpdateCallback(con->st,
-                                     VIR_STREAM_EVENT_READABLE);
+
+    virConsoleUpdateStreamEvents(con);
 
     if (events & VIR_STREAM_EVENT_ERROR ||
         events & VIR_STREAM_EVENT_HANGUP) {
@@ -196,6 +265,24 @@ virConsoleEventOnStream(virStreamPtr st,
 }
 
 
+/*
+ * In batch mode the end of input doesn't end the session, output is
+ * still copied until the console goes away.
+ */
+static void
+virConsoleStdinClosed(virConsolePtr con)
+{
+    if (!con->batch) {
+        virConsoleShutdown(con);
+        return;
+    }
+
+    if (con->stdinWatch != -1)
+        virEventRemoveHandle(con->stdinWatch);
+    con->stdinWatch = -1;
+}
+
+
 static void
 virConsoleEventOnStdin(int watch ATTRIBUTE_UNUSED,
                        int fd ATTRIBUTE_UNUSED,
@@ -205,18 +292,19 @@ virConsoleEventOnStdin(int watch ATTRIBUTE_UNUSED,
     virConsolePtr con = opaque;
 
     if (events & VIR_EVENT_HANDLE_READABLE) {
-        size_t avail = con->terminalToStream.length -
-            con->terminalToStream.offset;
+        size_t avail;
         int got;
 
-        if (avail < 1024) {
-            if (VIR_REALLOC_N(con->terminalToStream.data,
-                              con->terminalToStream.length + 1024) < 0) {
-                virConsoleShutdown(con);
-                return;
-            }
-            con->terminalToStream.length += 1024;
-            avail += 1024;
+        if (virConsoleBufferReserve(&con->terminalToStream) < 0) {
+            virConsoleShutdown(con);
+            return;
+        }
+
+        /* The guest is not keeping up, wait for the stream to drain */
+        if (!(avail = con->terminalToStream.length -
+              con->terminalToStream.offset)) {
+            virEventUpdateHandle(con->stdinWatch, 0);
+            return;
         }
 
         got = read(fd,
@@ -229,24 +317,22 @@ virConsoleEventOnStdin(int watch ATTRIBUTE_UNUSED,
             return;
         }
         if (got == 0) {
-            virConsoleShutdown(con);
+            virConsoleStdinClosed(con);
             return;
         }
-        if (con->terminalToStream.data[con->terminalToStream.offset] == con->escapeChar) {
+        if (!con->batch &&
+            con->terminalToStream.data[con->terminalToStream.offset] == con->escapeChar) {
             virConsoleShutdown(con);
             return;
         }
 
         con->terminalToStream.offset += got;
-        if (con->terminalToStream.offset)
-            virStreamEventUpdateCallback(con->st,
-                                         VIR_STREAM_EVENT_READABLE |
-                                         VIR_STREAM_EVENT_WRITABLE);
+        virConsoleUpdateStreamEvents(con);
     }
 
     if (events & VIR_EVENT_HANDLE_ERROR ||
         events & VIR_EVENT_HANDLE_HANGUP) {
-        virConsoleShutdown(con);
+        virConsoleStdinClosed(con);
     }
 }
 
@@ -262,7 +348,6 @@ virConsoleEventOnStdout(int watch ATTRIBUTE_UNUSED,
     if (events & VIR_EVENT_HANDLE_WRITABLE &&
         con->streamToTerminal.offset) {
         ssize_t done;
-        size_t avail;
         done = write(fd,
                      con->streamToTerminal.data,
                      con->streamToTerminal.offset);
@@ -276,12 +361,9 @@ virConsoleEventOnStdout(int watch ATTRIBUTE_UNUSED,
                 con->streamToTerminal.offset - done);
         con->streamToTerminal.offset -= done;
 
-        avail = con->streamToTerminal.length - con->streamToTerminal.offset;
-        if (avail > 1024) {
-            ignore_value(VIR_REALLOC_N(con->streamToTerminal.data,
-                                       con->streamToTerminal.offset + 1024));
-            con->streamToTerminal.length = con->streamToTerminal.offset + 1024;
-        }
+        /* Resume reading the stream if we had to throttle it */
+        if (con->streamToTerminal.offset + done >= VIR_CONSOLE_BUFFER_MAX)
+            virConsoleUpdateStreamEvents(con);
     }
 
     if (!con->streamToTerminal.offset)
@@ -308,6 +390,8 @@ int
 virshRunConsole(vshControl *ctl,
                 virDomainPtr dom,
                 const char *dev_name,
+                const char *logfile,
+                bool batch,
                 unsigned int flags)
 {
     virConsolePtr con = NULL;
@@ -324,25 +408,40 @@ virshRunConsole(vshControl *ctl,
 
     sigemptyset(&sighandler.sa_mask);
 
-    /* Put STDIN into raw mode so that stuff typed does not echo to the screen
-     * (the TTY reads will result in it being echoed back already), and also
-     * ensure Ctrl-C, etc is blocked, and misc other bits */
-    if (vshTTYMakeRaw(ctl, true) < 0)
-        goto resettty;
-
-    /* Trap all common signals so that we can safely restore the original
-     * terminal settings on STDIN before the process exits - people don't like
-     * being left with a messed up terminal ! */
-    sigaction(SIGQUIT, &sighandler, &old_sigquit);
-    sigaction(SIGTERM, &sighandler, &old_sigterm);
-    sigaction(SIGINT,  &sighandler, &old_sigint);
-    sigaction(SIGHUP,  &sighandler, &old_sighup);
-    sigaction(SIGPIPE, &sighandler, &old_sigpipe);
+    /* In batch mode there is no terminal to protect, so we leave the
+     * signals alone and let them terminate virsh as usual. */
+    if (!batch) {
+        /* Put STDIN into raw mode so that stuff typed does not echo to the
+         * screen (the TTY reads will result in it being echoed back already),
+         * and also ensure Ctrl-C, etc is blocked, and misc other bits */
+        if (vshTTYMakeRaw(ctl, true) < 0)
+            goto resettty;
+
+        /* Trap all common signals so that we can safely restore the original
+         * terminal settings on STDIN before the process exits - people don't
+         * like being left with a messed up terminal ! */
+        sigaction(SIGQUIT, &sighandler, &old_sigquit);
+        sigaction(SIGTERM, &sighandler, &old_sigterm);
+        sigaction(SIGINT,  &sighandler, &old_sigint);
+        sigaction(SIGHUP,  &sighandler, &old_sighup);
+        sigaction(SIGPIPE, &sighandler, &old_sigpipe);
+    }
 
     if (VIR_ALLOC(con) < 0)
         goto cleanup;
 
+    con->logfd = -1;
+    con->batch = batch;
     con->escapeChar = virshGetEscapeChar(priv->escapeChar);
+
+    if (logfile &&
+        (con->logfd = open(logfile,
+                           O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                           0644)) < 0) {
+        vshError(ctl, _("cannot open console log file %s"), logfile);
+        goto cleanup;
+    }
+
     con->st = virStreamNew(virDomainGetConnect(dom),
                            VIR_STREAM_NONBLOCK);
     if (!con->st)
@@ -388,6 +487,9 @@ virshRunConsole(vshControl *ctl,
  cleanup:
     virConsoleFree(con);
 
+    if (batch)
+        return ret;
+
     /* Restore original signal handlers */
     sigaction(SIGQUIT, &old_sigquit, NULL);
     sigaction(SIGTERM, &old_sigterm, NULL);
@@ -31,6 +31,8 @@
 int virshRunConsole(vshControl *ctl,
                     virDomainPtr dom,
                     const char *dev_name,
+                    const char *logfile,
+                    bool batch,
                     unsigned int flags);
 
 # endif /* !WIN32 */
@@ -39,6 +39,7 @@
 #include "virmacaddr.h"
 #include "virxml.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #define VIRSH_COMMON_OPT_DOMAIN_FULL                       \
     VIRSH_COMMON_OPT_DOMAIN(N_("domain name, id or uuid")) \
@@ -1945,6 +1946,34 @@ static const vshCmdOptDef opts_domstats[] = {
      .type = VSH_OT_BOOL,
      .help = N_("report domain perf event statistics"),
     },
+    {.name = "monitor",
+     .type = VSH_OT_BOOL,
+     .help = N_("report hypervisor monitor statistics"),
+    },
+    {.name = "startup",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain startup timing"),
+    },
+    {.name = "metadata",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain title, description and metadata elements"),
+    },
+    {.name = "agent",
+     .type = VSH_OT_BOOL,
+     .help = N_("report guest information from the guest agent"),
+    },
+    {.name = "job",
+     .type = VSH_OT_BOOL,
+     .help = N_("report time spent waiting for the domain job"),
+    },
+    {.name = "footprint",
+     .type = VSH_OT_BOOL,
+     .help = N_("report daemon memory used for the domain"),
+    },
+    {.name = "dirtyrate",
+     .type = VSH_OT_BOOL,
+     .help = N_("report domain dirty rate information"),
+    },
     {.name = "list-active",
      .type = VSH_OT_BOOL,
      .help = N_("list only active domains"),
@@ -1989,6 +2018,38 @@ static const vshCmdOptDef opts_domstats[] = {
      .type = VSH_OT_BOOL,
      .help = N_("add backing chain information to block stats"),
     },
+    {.name = "sampled",
+     .type = VSH_OT_BOOL,
+     .help = N_("report the latest sample taken by the daemon"),
+    },
+    {.name = "sample-history",
+     .type = VSH_OT_BOOL,
+     .help = N_("report all samples kept by the daemon"),
+    },
+    {.name = "format",
+     .type = VSH_OT_STRING,
+     .help = N_("output format: text (default), json or csv"),
+    },
+    {.name = "watch",
+     .type = VSH_OT_BOOL,
+     .help = N_("keep sampling the statistics until interrupted"),
+    },
+    {.name = "interval",
+     .type = VSH_OT_INT,
+     .help = N_("seconds between samples in watch mode (default 1)"),
+    },
+    {.name = "count",
+     .type = VSH_OT_INT,
+     .help = N_("stop watching after this many samples"),
+    },
+    {.name = "delta",
+     .type = VSH_OT_BOOL,
+     .help = N_("print the change of numeric fields since the previous sample"),
+    },
+    {.name = "rate",
+     .type = VSH_OT_BOOL,
+     .help = N_("print the change per second of numeric fields"),
+    },
     {.name = "domain",
      .type = VSH_OT_ARGV,
      .flags = VSH_OFLAG_NONE,
@@ -1998,30 +2059,328 @@ static const vshCmdOptDef opts_domstats[] = {
 };
 
 
+typedef enum {
+    VIRSH_DOMAIN_STATS_FORMAT_TEXT,
+    VIRSH_DOMAIN_STATS_FORMAT_JSON,
+    VIRSH_DOMAIN_STATS_FORMAT_CSV,
+
+    VIRSH_DOMAIN_STATS_FORMAT_LAST
+} virshDomainStatsFormat;
+
+VIR_ENUM_DECL(virshDomainStatsFormat)
+VIR_ENUM_IMPL(virshDomainStatsFormat,
+              VIRSH_DOMAIN_STATS_FORMAT_LAST,
+              "text",
+              "json",
+              "csv")
+
+typedef enum {
+    VIRSH_DOMAIN_STATS_VALUE_ABSOLUTE,
+    VIRSH_DOMAIN_STATS_VALUE_DELTA,
+    VIRSH_DOMAIN_STATS_VALUE_RATE,
+} virshDomainStatsValue;
+
+typedef struct _virshDomainStatsPrinter virshDomainStatsPrinter;
+typedef virshDomainStatsPrinter *virshDomainStatsPrinterPtr;
+struct _virshDomainStatsPrinter {
+    virshDomainStatsFormat format;
+    virshDomainStatsValue value;
+    bool watch;
+    bool header;                        /* CSV header already printed */
+    size_t samples;                     /* number of samples printed */
+
+    unsigned long long now;             /* time of the current sample */
+    double seconds;                     /* seconds since the previous one */
+    virDomainStatsRecordPtr *prev;      /* previous sample, if any */
+    size_t nprev;
+};
+
+
 static bool
-virshDomainStatsPrintRecord(vshControl *ctl ATTRIBUTE_UNUSED,
-                            virDomainStatsRecordPtr record,
-                            bool raw ATTRIBUTE_UNUSED)
+virshDomainStatsIsNumeric(virTypedParameterPtr param)
+{
+    switch ((virTypedParameterType) param->type) {
+    case VIR_TYPED_PARAM_INT:
+    case VIR_TYPED_PARAM_UINT:
+    case VIR_TYPED_PARAM_LLONG:
+    case VIR_TYPED_PARAM_ULLONG:
+    case VIR_TYPED_PARAM_DOUBLE:
+        return true;
+
+    case VIR_TYPED_PARAM_BOOLEAN:
+    case VIR_TYPED_PARAM_STRING:
+    case VIR_TYPED_PARAM_LAST:
+        break;
+    }
+
+    return false;
+}
+
+
+/* Records and their fields are reported in a stable order by the
+ * daemon, so look at the same index in the previous sample first
+ * before falling back to a linear search. */
+static virDomainStatsRecordPtr
+virshDomainStatsFindRecord(virshDomainStatsPrinterPtr printer,
+                           size_t idx,
+                           virDomainStatsRecordPtr record)
+{
+    const char *name = virDomainGetName(record->dom);
+    size_t i;
+
+    if (idx < printer->nprev &&
+        STREQ(virDomainGetName(printer->prev[idx]->dom), name))
+        return printer->prev[idx];
+
+    for (i = 0; i < printer->nprev; i++) {
+        if (STREQ(virDomainGetName(printer->prev[i]->dom), name))
+            return printer->prev[i];
+    }
+
+    return NULL;
+}
+
+
+static virTypedParameterPtr
+virshDomainStatsFindParam(virDomainStatsRecordPtr prev,
+                          size_t idx,
+                          virTypedParameterPtr param)
+{
+    virTypedParameterPtr ret;
+
+    if (!prev)
+        return NULL;
+
+    if (idx < prev->nparams && STREQ(prev->params[idx].field, param->field))
+        ret = prev->params + idx;
+    else
+        ret = virTypedParamsGet(prev->params, prev->nparams, param->field);
+
+    if (ret && ret->type != param->type)
+        return NULL;
+
+    return ret;
+}
+
+
+static void
+virshDomainStatsFormatChange(virBufferPtr buf,
+                             virshDomainStatsPrinterPtr printer,
+                             virTypedParameterPtr param,
+                             virTypedParameterPtr prev)
+{
+    long long diff = 0;
+    double ddiff;
+
+    switch ((virTypedParameterType) param->type) {
+    case VIR_TYPED_PARAM_INT:
+        diff = (long long) param->value.i - prev->value.i;
+        break;
+    case VIR_TYPED_PARAM_UINT:
+        diff = (long long) param->value.ui - prev->value.ui;
+        break;
+    case VIR_TYPED_PARAM_LLONG:
+        diff = param->value.l - prev->value.l;
+        break;
+    case VIR_TYPED_PARAM_ULLONG:
+        diff = (long long) (param->value.ul - prev->value.ul);
+        break;
+    case VIR_TYPED_PARAM_DOUBLE:
+        ddiff = param->value.d - prev->value.d;
+        if (printer->value == VIRSH_DOMAIN_STATS_VALUE_RATE)
+            ddiff /= printer->seconds;
+        virBufferAsprintf(buf, "%f", ddiff);
+        return;
+    case VIR_TYPED_PARAM_BOOLEAN:
+    case VIR_TYPED_PARAM_STRING:
+    case VIR_TYPED_PARAM_LAST:
+        break;
+    }
+
+    if (printer->value == VIRSH_DOMAIN_STATS_VALUE_RATE)
+        virBufferAsprintf(buf, "%f", diff / printer->seconds);
+    else
+        virBufferAsprintf(buf, "%lld", diff);
+}
+
+
+static void
+virshDomainStatsFormatCSVString(virBufferPtr buf,
+                                const char *str)
+{
+    if (!strpbrk(str, ",\"\r\n")) {
+        virBufferAdd(buf, str, -1);
+        return;
+    }
+
+    virBufferAddChar(buf, '"');
+    for (; *str; str++) {
+        if (*str == '"')
+            virBufferAddChar(buf, '"');
+        virBufferAddChar(buf, *str);
+    }
+    virBufferAddChar(buf, '"');
+}
+
+
+static void
+virshDomainStatsFormatValue(virBufferPtr buf,
+                            virshDomainStatsPrinterPtr printer,
+                            virTypedParameterPtr param,
+                            virTypedParameterPtr prev)
+{
+    bool text = printer->format == VIRSH_DOMAIN_STATS_FORMAT_TEXT;
+
+    if (prev) {
+        virshDomainStatsFormatChange(buf, printer, param, prev);
+        return;
+    }
+
+    switch ((virTypedParameterType) param->type) {
+    case VIR_TYPED_PARAM_INT:
+        virBufferAsprintf(buf, "%d", param->value.i);
+        break;
+    case VIR_TYPED_PARAM_UINT:
+        virBufferAsprintf(buf, "%u", param->value.ui);
+        break;
+    case VIR_TYPED_PARAM_LLONG:
+        virBufferAsprintf(buf, "%lld", param->value.l);
+        break;
+    case VIR_TYPED_PARAM_ULLONG:
+        virBufferAsprintf(buf, "%llu", param->value.ul);
+        break;
+    case VIR_TYPED_PARAM_DOUBLE:
+        virBufferAsprintf(buf, "%f", param->value.d);
+        break;
+    case VIR_TYPED_PARAM_BOOLEAN:
+        if (text)
+            virBufferAdd(buf, param->value.b ? _("yes") : _("no"), -1);
+        else
+            virBufferAdd(buf, param->value.b ? "true" : "false", -1);
+        break;
+    case VIR_TYPED_PARAM_STRING:
+        if (printer->format == VIRSH_DOMAIN_STATS_FORMAT_JSON)
+            vshBufferAddJSONString(buf, param->value.s);
+        else if (printer->format == VIRSH_DOMAIN_STATS_FORMAT_CSV)
+            virshDomainStatsFormatCSVString(buf, param->value.s);
+        else
+            virBufferAdd(buf, param->value.s, -1);
+        break;
+    case VIR_TYPED_PARAM_LAST:
+        break;
+    }
+}
+
+
+static void
+virshDomainStatsFormatRecord(virBufferPtr buf,
+                             virshDomainStatsPrinterPtr printer,
+                             size_t idx,
+                             virDomainStatsRecordPtr record)
 {
-    char *param;
+    const char *name = virDomainGetName(record->dom);
+    virDomainStatsRecordPtr prevrec = NULL;
+    bool first = true;
     size_t i;
 
-    vshPrint(ctl, "Domain: '%s'\n", virDomainGetName(record->dom));
+    if (printer->value != VIRSH_DOMAIN_STATS_VALUE_ABSOLUTE)
+        prevrec = virshDomainStatsFindRecord(printer, idx, record);
 
-    /* XXX: Implement pretty-printing */
+    switch (printer->format) {
+    case VIRSH_DOMAIN_STATS_FORMAT_TEXT:
+        virBufferAsprintf(buf, "Domain: '%s'\n", name);
+        break;
+    case VIRSH_DOMAIN_STATS_FORMAT_JSON:
+        virBufferAsprintf(buf, "{\"time\": %llu, \"domain\": ", printer->now);
+        vshBufferAddJSONString(buf, name);
+        virBufferAddLit(buf, ", \"stats\": {");
+        break;
+    case VIRSH_DOMAIN_STATS_FORMAT_CSV:
+    case VIRSH_DOMAIN_STATS_FORMAT_LAST:
+        break;
+    }
 
     for (i = 0; i < record->nparams; i++) {
-        if (!(param = vshGetTypedParamValue(ctl, record->params + i)))
-            return false;
+        virTypedParameterPtr param = record->params + i;
+        virTypedParameterPtr prev = NULL;
+
+        /* In delta or rate mode numeric fields are only printed once
+         * there is an earlier value to compare with */
+        if (printer->value != VIRSH_DOMAIN_STATS_VALUE_ABSOLUTE &&
+            virshDomainStatsIsNumeric(param) &&
+            !(prev = virshDomainStatsFindParam(prevrec, i, param)))
+            continue;
+
+        switch (printer->format) {
+        case VIRSH_DOMAIN_STATS_FORMAT_TEXT:
+            virBufferAsprintf(buf, "  %s=", param->field);
+            break;
+        case VIRSH_DOMAIN_STATS_FORMAT_JSON:
+            if (!first)
+                virBufferAddLit(buf, ", ");
+            vshBufferAddJSONString(buf, param->field);
+            virBufferAddLit(buf, ": ");
+            break;
+        case VIRSH_DOMAIN_STATS_FORMAT_CSV:
+            virBufferAsprintf(buf, "%llu,", printer->now);
+            virshDomainStatsFormatCSVString(buf, name);
+            virBufferAddChar(buf, ',');
+            virshDomainStatsFormatCSVString(buf, param->field);
+            virBufferAddChar(buf, ',');
+            break;
+        case VIRSH_DOMAIN_STATS_FORMAT_LAST:
+            break;
+        }
 
-        vshPrint(ctl, "  %s=%s\n", record->params[i].field, param);
+        virshDomainStatsFormatValue(buf, printer, param, prev);
+        if (printer->format != VIRSH_DOMAIN_STATS_FORMAT_JSON)
+            virBufferAddChar(buf, '\n');
+        first = false;
+    }
+
+    if (printer->format == VIRSH_DOMAIN_STATS_FORMAT_JSON)
+        virBufferAddLit(buf, "}}\n");
+}
+
+
+/* Format one sample into a single buffer and write it out at once, so
+ * that large hosts don't pay for a print call per field. */
+static bool
+virshDomainStatsPrint(vshControl *ctl,
+                      virshDomainStatsPrinterPtr printer,
+                      virDomainStatsRecordPtr *records)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *str;
+    size_t i;
 
-        VIR_FREE(param);
+    if (printer->format == VIRSH_DOMAIN_STATS_FORMAT_CSV && !printer->header) {
+        virBufferAddLit(&buf, "time,domain,field,value\n");
+        printer->header = true;
     }
 
+    for (i = 0; records[i]; i++) {
+        if (printer->format == VIRSH_DOMAIN_STATS_FORMAT_TEXT &&
+            (i > 0 || printer->samples > 0))
+            virBufferAddChar(&buf, '\n');
+
+        virshDomainStatsFormatRecord(&buf, printer, i, records[i]);
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return false;
+
+    if ((str = virBufferContentAndReset(&buf)))
+        vshPrint(ctl, "%s", str);
+    if (printer->watch)
+        fflush(stdout);
+    VIR_FREE(str);
+
+    printer->samples++;
     return true;
 }
 
+
 static bool
 cmdDomstats(vshControl *ctl, const vshCmd *cmd)
 {
@@ -2030,12 +2389,53 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     virDomainPtr dom;
     size_t ndoms = 0;
     virDomainStatsRecordPtr *records = NULL;
-    virDomainStatsRecordPtr *next;
-    bool raw = vshCommandOptBool(cmd, "raw");
     int flags = 0;
     const vshCmdOpt *opt = NULL;
     bool ret = false;
     virshControlPtr priv = ctl->privData;
+    virshDomainStatsPrinter printer = { 0 };
+    const char *format = NULL;
+    unsigned int interval = 1;
+    unsigned int count = 0;
+    unsigned long long then = 0;
+    bool eventStarted = false;
+    int nrecords;
+
+    VSH_EXCLUSIVE_OPTIONS("delta", "rate");
+    VSH_EXCLUSIVE_OPTIONS("sampled", "sample-history");
+    VSH_EXCLUSIVE_OPTIONS("sample-history", "watch");
+    VSH_REQUIRE_OPTION("interval", "watch");
+    VSH_REQUIRE_OPTION("count", "watch");
+    VSH_REQUIRE_OPTION("delta", "watch");
+    VSH_REQUIRE_OPTION("rate", "watch");
+
+    if (vshCommandOptStringReq(ctl, cmd, "format", &format) < 0)
+        return false;
+
+    if (format) {
+        int f;
+
+        if ((f = virshDomainStatsFormatTypeFromString(format)) < 0) {
+            vshError(ctl, _("Unknown output format '%s'"), format);
+            return false;
+        }
+        printer.format = f;
+    }
+
+    if (vshCommandOptUInt(ctl, cmd, "interval", &interval) < 0 ||
+        vshCommandOptUInt(ctl, cmd, "count", &count) < 0)
+        return false;
+
+    if (interval == 0 || interval > INT_MAX / 1000) {
+        vshError(ctl, "%s", _("Invalid interval value"));
+        return false;
+    }
+
+    printer.watch = vshCommandOptBool(cmd, "watch");
+    if (vshCommandOptBool(cmd, "delta"))
+        printer.value = VIRSH_DOMAIN_STATS_VALUE_DELTA;
+    if (vshCommandOptBool(cmd, "rate"))
+        printer.value = VIRSH_DOMAIN_STATS_VALUE_RATE;
 
     if (vshCommandOptBool(cmd, "state"))
         stats |= VIR_DOMAIN_STATS_STATE;
@@ -2058,6 +2458,27 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "perf"))
         stats |= VIR_DOMAIN_STATS_PERF;
 
+    if (vshCommandOptBool(cmd, "monitor"))
+        stats |= VIR_DOMAIN_STATS_MONITOR;
+
+    if (vshCommandOptBool(cmd, "startup"))
+        stats |= VIR_DOMAIN_STATS_STARTUP;
+
+    if (vshCommandOptBool(cmd, "metadata"))
+        stats |= VIR_DOMAIN_STATS_METADATA;
+
+    if (vshCommandOptBool(cmd, "agent"))
+        stats |= VIR_DOMAIN_STATS_AGENT;
+
+    if (vshCommandOptBool(cmd, "job"))
+        stats |= VIR_DOMAIN_STATS_JOB;
+
+    if (vshCommandOptBool(cmd, "footprint"))
+        stats |= VIR_DOMAIN_STATS_FOOTPRINT;
+
+    if (vshCommandOptBool(cmd, "dirtyrate"))
+        stats |= VIR_DOMAIN_STATS_DIRTYRATE;
+
     if (vshCommandOptBool(cmd, "list-active"))
         flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE;
 
@@ -2088,6 +2509,12 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "backing"))
         flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING;
 
+    if (vshCommandOptBool(cmd, "sampled"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED;
+
+    if (vshCommandOptBool(cmd, "sample-history"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLE_HISTORY;
+
     if (vshCommandOptBool(cmd, "domain")) {
         if (VIR_ALLOC_N(domlist, 1) < 0)
             goto cleanup;
@@ -2102,31 +2529,59 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
             if (VIR_INSERT_ELEMENT(domlist, ndoms - 1, ndoms, dom) < 0)
                 goto cleanup;
         }
+    }
 
-        if (virDomainListGetStats(domlist,
-                                  stats,
-                                  &records,
-                                  flags) < 0)
+    if (printer.watch) {
+        if (vshEventStart(ctl, interval * 1000) < 0)
             goto cleanup;
-    } else {
-       if ((virConnectGetAllDomainStats(priv->conn,
-                                        stats,
-                                        &records,
-                                        flags)) < 0)
-           goto cleanup;
+        eventStarted = true;
     }
 
-    next = records;
-    while (*next) {
-        if (!virshDomainStatsPrintRecord(ctl, *next, raw))
+    while (true) {
+        int rv;
+
+        if (domlist)
+            nrecords = virDomainListGetStats(domlist, stats, &records, flags);
+        else
+            nrecords = virConnectGetAllDomainStats(priv->conn, stats,
+                                                   &records, flags);
+        if (nrecords < 0)
             goto cleanup;
 
-        if (*(++next))
-            vshPrint(ctl, "\n");
+        if (virTimeMillisNow(&printer.now) < 0)
+            goto cleanup;
+
+        /* The first sample only sets the baseline for delta and rate */
+        if (printer.value == VIRSH_DOMAIN_STATS_VALUE_ABSOLUTE ||
+            printer.prev) {
+            printer.seconds = (printer.now - then) / 1000.0;
+            if (printer.seconds <= 0)
+                printer.seconds = 0.001;
+
+            if (!virshDomainStatsPrint(ctl, &printer, records))
+                goto cleanup;
+        }
+
+        virDomainStatsRecordListFree(printer.prev);
+        printer.prev = records;
+        printer.nprev = nrecords;
+        records = NULL;
+        then = printer.now;
+
+        if (!printer.watch || (count && printer.samples >= count))
+            break;
+
+        if ((rv = vshEventWait(ctl)) == VSH_EVENT_INTERRUPT)
+            break;
+        if (rv != VSH_EVENT_TIMEOUT)
+            goto cleanup;
     }
 
     ret = true;
  cleanup:
+    if (eventStarted)
+        vshEventCleanup(ctl);
+    virDomainStatsRecordListFree(printer.prev);
     virDomainStatsRecordListFree(records);
     virObjectListFree(domlist);
 
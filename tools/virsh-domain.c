@@ -1863,6 +1863,228 @@ virshBlockJobWait(virshBlockJobWaitDataPtr data)
 }
 
 
+/*
+ * "blockbackup" command
+ */
+static const vshCmdInfo info_block_backup[] = {
+    {.name = "help",
+     .data = N_("Start a block backup operation.")
+    },
+    {.name = "desc",
+     .data = N_("Back up the contents of a disk to dest, optionally only the "
+                "data changed since the previous backup.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_block_backup[] = {
+    VIRSH_COMMON_OPT_DOMAIN_FULL,
+    {.name = "path",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("fully-qualified path of source disk")
+    },
+    {.name = "dest",
+     .type = VSH_OT_STRING,
+     .help = N_("path of the backup to create")
+    },
+    {.name = "format",
+     .type = VSH_OT_STRING,
+     .help = N_("format of the destination file")
+    },
+    {.name = "xml",
+     .type = VSH_OT_STRING,
+     .help = N_("filename containing XML description of the backup destination")
+    },
+    {.name = "incremental",
+     .type = VSH_OT_BOOL,
+     .help = N_("copy only the data changed since the previous backup")
+    },
+    {.name = "reuse-external",
+     .type = VSH_OT_BOOL,
+     .help = N_("reuse existing destination")
+    },
+    {.name = "bandwidth",
+     .type = VSH_OT_INT,
+     .help = N_("bandwidth limit in MiB/s")
+    },
+    {.name = "bytes",
+     .type = VSH_OT_BOOL,
+     .help = N_("the bandwidth limit is in bytes/s rather than MiB/s")
+    },
+    {.name = "wait",
+     .type = VSH_OT_BOOL,
+     .help = N_("wait for job to complete")
+    },
+    {.name = "verbose",
+     .type = VSH_OT_BOOL,
+     .help = N_("with --wait, display the progress")
+    },
+    {.name = "timeout",
+     .type = VSH_OT_INT,
+     .help = N_("implies --wait, abort if backup exceeds timeout (in seconds)")
+    },
+    {.name = "async",
+     .type = VSH_OT_BOOL,
+     .help = N_("with --wait, don't wait for cancel to finish")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdBlockBackup(vshControl *ctl, const vshCmd *cmd)
+{
+    virDomainPtr dom = NULL;
+    const char *path = NULL;
+    const char *dest = NULL;
+    const char *format = NULL;
+    const char *xml = NULL;
+    char *xmlstr = NULL;
+    unsigned long bandwidth = 0;
+    unsigned long long speed;
+    unsigned int flags = 0;
+    bool ret = false;
+    bool verbose = vshCommandOptBool(cmd, "verbose");
+    bool blocking = vshCommandOptBool(cmd, "wait");
+    bool async = vshCommandOptBool(cmd, "async");
+    bool bytes = vshCommandOptBool(cmd, "bytes");
+    int timeout = 0;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    int maxparams = 0;
+    virshBlockJobWaitDataPtr bjWait = NULL;
+
+    VSH_EXCLUSIVE_OPTIONS("dest", "xml");
+    VSH_EXCLUSIVE_OPTIONS("format", "xml");
+
+    if (vshCommandOptStringReq(ctl, cmd, "path", &path) < 0 ||
+        vshCommandOptStringReq(ctl, cmd, "dest", &dest) < 0 ||
+        vshCommandOptStringReq(ctl, cmd, "format", &format) < 0 ||
+        vshCommandOptStringReq(ctl, cmd, "xml", &xml) < 0)
+        return false;
+    if (vshBlockJobOptionBandwidth(ctl, cmd, bytes, &bandwidth) < 0)
+        return false;
+    if (vshCommandOptTimeoutToMs(ctl, cmd, &timeout) < 0)
+        return false;
+
+    if (vshCommandOptBool(cmd, "incremental"))
+        flags |= VIR_DOMAIN_BLOCK_BACKUP_INCREMENTAL;
+    if (vshCommandOptBool(cmd, "reuse-external"))
+        flags |= VIR_DOMAIN_BLOCK_BACKUP_REUSE_EXT;
+
+    if (timeout)
+        blocking = true;
+
+    if (!dest && !xml) {
+        vshError(ctl, "%s", _("need either --dest or --xml"));
+        return false;
+    }
+
+    if (!blocking) {
+        if (verbose) {
+            vshError(ctl, "%s", _("--verbose requires at least one of --timeout, "
+                                  "--wait"));
+            return false;
+        }
+
+        if (async) {
+            vshError(ctl, "%s", _("--async requires at least one of --timeout, "
+                                  "--wait"));
+            return false;
+        }
+    }
+
+    if (bandwidth) {
+        speed = bandwidth;
+        if (!bytes) {
+            /* bandwidth is ulong MiB/s, but the typed parameter is
+             * ullong bytes/s; make sure we don't overflow */
+            unsigned long long limit = MIN(ULONG_MAX, ULLONG_MAX >> 20);
+            if (speed > limit) {
+                vshError(ctl, _("bandwidth must be less than %llu"), limit);
+                return false;
+            }
+
+            speed <<= 20ULL;
+        }
+
+        if (virTypedParamsAddULLong(&params, &nparams, &maxparams,
+                                    VIR_DOMAIN_BLOCK_BACKUP_BANDWIDTH,
+                                    speed) < 0)
+            goto save_error;
+    }
+
+    if (xml) {
+        if (virFileReadAll(xml, VSH_MAX_XML_FILE, &xmlstr) < 0) {
+            vshReportError(ctl);
+            goto cleanup;
+        }
+    } else {
+        virBuffer buf = VIR_BUFFER_INITIALIZER;
+        virBufferAddLit(&buf, "<disk type='file'>\n");
+        virBufferAdjustIndent(&buf, 2);
+        virBufferEscapeString(&buf, "<source file='%s'/>\n", dest);
+        virBufferEscapeString(&buf, "<driver type='%s'/>\n", format);
+        virBufferAdjustIndent(&buf, -2);
+        virBufferAddLit(&buf, "</disk>\n");
+        if (virBufferCheckError(&buf) < 0)
+            goto cleanup;
+        xmlstr = virBufferContentAndReset(&buf);
+    }
+
+    if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
+        goto cleanup;
+
+    if (blocking &&
+        !(bjWait = virshBlockJobWaitInit(ctl, dom, path, _("Block Backup"),
+                                         verbose, timeout, async)))
+        goto cleanup;
+
+    if (virDomainBlockBackup(dom, path, xmlstr, params, nparams, flags) < 0)
+        goto cleanup;
+
+    if (!blocking) {
+        vshPrintExtra(ctl, "%s", _("Block Backup started"));
+        ret = true;
+        goto cleanup;
+    }
+
+    /* Execution continues here only if --wait or friends were specified */
+    switch (virshBlockJobWait(bjWait)) {
+        case -1:
+            goto cleanup;
+
+        case VIR_DOMAIN_BLOCK_JOB_CANCELED:
+            vshPrintExtra(ctl, "\n%s", _("Backup aborted"));
+            goto cleanup;
+            break;
+
+        case VIR_DOMAIN_BLOCK_JOB_FAILED:
+            vshError(ctl, "\n%s", _("Backup failed"));
+            goto cleanup;
+            break;
+
+        case VIR_DOMAIN_BLOCK_JOB_READY:
+        case VIR_DOMAIN_BLOCK_JOB_COMPLETED:
+            break;
+    }
+
+    vshPrintExtra(ctl, "\n%s", _("Backup complete"));
+    ret = true;
+
+ cleanup:
+    VIR_FREE(xmlstr);
+    virTypedParamsFree(params, nparams);
+    virshDomainFree(dom);
+    virshBlockJobWaitFree(bjWait);
+    return ret;
+
+ save_error:
+    vshSaveLibvirtError();
+    goto cleanup;
+}
+
+
 /*
  * "blockcommit" command
  */
@@ -2454,7 +2676,8 @@ VIR_ENUM_IMPL(virshDomainBlockJob,
               N_("Block Pull"),
               N_("Block Copy"),
               N_("Block Commit"),
-              N_("Active Block Commit"))
+              N_("Active Block Commit"),
+              N_("Block Backup"))
 
 static const char *
 virshDomainBlockJobToString(int type)
@@ -2876,12 +3099,22 @@ static const vshCmdOptDef opts_console[] = {
      .type = VSH_OT_BOOL,
      .help =  N_("only connect if safe console handling is supported")
     },
+    {.name = "log",
+     .type = VSH_OT_STRING,
+     .help = N_("append console output to a file")
+    },
+    {.name = "batch",
+     .type = VSH_OT_BOOL,
+     .help = N_("non-interactive mode, no controlling TTY required")
+    },
     {.name = NULL}
 };
 
 static bool
 cmdRunConsole(vshControl *ctl, virDomainPtr dom,
               const char *name,
+              const char *logfile,
+              bool batch,
               unsigned int flags)
 {
     bool ret = false;
@@ -2898,15 +3131,18 @@ cmdRunConsole(vshControl *ctl, virDomainPtr dom,
         goto cleanup;
     }
 
-    if (!isatty(STDIN_FILENO)) {
+    if (!batch && !isatty(STDIN_FILENO)) {
         vshError(ctl, "%s", _("Cannot run interactive console without a controlling TTY"));
         goto cleanup;
     }
 
-    vshPrintExtra(ctl, _("Connected to domain %s\n"), virDomainGetName(dom));
-    vshPrintExtra(ctl, _("Escape character is %s\n"), priv->escapeChar);
+    /* In batch mode stdout carries only the guest output */
+    if (!batch) {
+        vshPrintExtra(ctl, _("Connected to domain %s\n"), virDomainGetName(dom));
+        vshPrintExtra(ctl, _("Escape character is %s\n"), priv->escapeChar);
+    }
     fflush(stdout);
-    if (virshRunConsole(ctl, dom, name, flags) == 0)
+    if (virshRunConsole(ctl, dom, name, logfile, batch, flags) == 0)
         ret = true;
 
  cleanup:
@@ -2921,8 +3157,10 @@ cmdConsole(vshControl *ctl, const vshCmd *cmd)
     bool ret = false;
     bool force = vshCommandOptBool(cmd, "force");
     bool safe = vshCommandOptBool(cmd, "safe");
+    bool batch = vshCommandOptBool(cmd, "batch");
     unsigned int flags = 0;
     const char *name = NULL;
+    const char *logfile = NULL;
 
     if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
         return false;
@@ -2930,12 +3168,15 @@ cmdConsole(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptStringReq(ctl, cmd, "devname", &name) < 0) /* sc_prohibit_devname */
         goto cleanup;
 
+    if (vshCommandOptStringReq(ctl, cmd, "log", &logfile) < 0)
+        goto cleanup;
+
     if (force)
         flags |= VIR_DOMAIN_CONSOLE_FORCE;
     if (safe)
         flags |= VIR_DOMAIN_CONSOLE_SAFE;
 
-    ret = cmdRunConsole(ctl, dom, name, flags);
+    ret = cmdRunConsole(ctl, dom, name, logfile, batch, flags);
 
  cleanup:
     virshDomainFree(dom);
@@ -4056,7 +4297,7 @@ cmdStart(vshControl *ctl, const vshCmd *cmd)
     vshPrintExtra(ctl, _("Domain %s started\n"),
                   virDomainGetName(dom));
 #ifndef WIN32
-    if (console && !cmdRunConsole(ctl, dom, NULL, 0))
+    if (console && !cmdRunConsole(ctl, dom, NULL, NULL, false, 0))
         goto cleanup;
 #endif
 
@@ -5690,6 +5931,7 @@ cmdDomjobinfo(vshControl *ctl, const vshCmd *cmd)
     int nparams = 0;
     unsigned long long value;
     unsigned int flags = 0;
+    unsigned int uivalue;
     int ivalue;
     int op;
     int rc;
@@ -5779,6 +6021,23 @@ cmdDomjobinfo(vshControl *ctl, const vshCmd *cmd)
                  value);
     }
 
+    if ((rc = virTypedParamsGetUInt(params, nparams,
+                                    VIR_DOMAIN_JOB_QUEUE_POSITION,
+                                    &uivalue)) < 0) {
+        goto save_error;
+    } else if (rc) {
+        vshPrint(ctl, "%-17s %-12u\n", _("Queue position:"), uivalue);
+    }
+
+    if ((rc = virTypedParamsGetULLong(params, nparams,
+                                      VIR_DOMAIN_JOB_QUEUE_TIME_REMAINING,
+                                      &value)) < 0) {
+        goto save_error;
+    } else if (rc) {
+        vshPrint(ctl, "%-17s %-12llu ms\n", _("Queue time remaining:"),
+                 value);
+    }
+
     if (info.type == VIR_DOMAIN_JOB_BOUNDED)
         vshPrint(ctl, "%-17s %-12llu ms\n", _("Time remaining:"),
                  info.timeRemaining);
@@ -7079,6 +7338,58 @@ cmdDomblkthreshold(vshControl *ctl, const vshCmd *cmd)
 }
 
 
+/*
+ * "domdirtyrate-calc" command
+ */
+static const vshCmdInfo info_domdirtyrate_calc[] = {
+    {.name = "help",
+     .data = N_("Calculate a vm's memory dirty rate")
+    },
+    {.name = "desc",
+     .data = N_("Calculate memory dirty rate of a domain in order to "
+                "decide whether it's proper to be migrated out or not.\n"
+                "The calculated dirty rate information is available by "
+                "calling 'domstats --dirtyrate'.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_domdirtyrate_calc[] = {
+    VIRSH_COMMON_OPT_DOMAIN_FULL,
+    {.name = "seconds",
+     .type = VSH_OT_INT,
+     .help = N_("calculate memory dirty rate within specified seconds, "
+                "the supported value range from 1 to 60, default to 1.")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDomDirtyRateCalc(vshControl *ctl, const vshCmd *cmd)
+{
+    virDomainPtr dom = NULL;
+    int seconds = 1; /* the default value is 1 */
+    bool ret = false;
+
+    if (vshCommandOptInt(ctl, cmd, "seconds", &seconds) < 0)
+        return false;
+
+    if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
+        return false;
+
+    if (virDomainStartDirtyRateCalc(dom, seconds, 0) < 0)
+        goto cleanup;
+
+    vshPrintExtra(ctl, _("Start to calculate domain's memory "
+                         "dirty rate successfully.\n"));
+    ret = true;
+
+ cleanup:
+    virshDomainFree(dom);
+    return ret;
+}
+
+
 /*
  * "iothreadinfo" command
  */
@@ -7847,7 +8158,7 @@ cmdCreate(vshControl *ctl, const vshCmd *cmd)
                   virDomainGetName(dom), from);
 #ifndef WIN32
     if (console)
-        cmdRunConsole(ctl, dom, NULL, 0);
+        cmdRunConsole(ctl, dom, NULL, NULL, false, 0);
 #endif
     virshDomainFree(dom);
     ret = true;
@@ -10169,6 +10480,30 @@ static const vshCmdOptDef opts_migrate[] = {
      .type = VSH_OT_INT,
      .help = N_("port to use by target server for incoming disks migration")
     },
+    {.name = "disks-bandwidth",
+     .type = VSH_OT_INT,
+     .help = N_("bandwidth limit in MiB/s for each migrated disk")
+    },
+    {.name = "disks-total-bandwidth",
+     .type = VSH_OT_INT,
+     .help = N_("bandwidth limit in MiB/s shared by all migrated disks")
+    },
+    {.name = "disks-buf-size",
+     .type = VSH_OT_INT,
+     .help = N_("buffer size in bytes used for each disk mirror")
+    },
+    {.name = "disks-granularity",
+     .type = VSH_OT_INT,
+     .help = N_("dirty bitmap granularity in bytes used for each disk mirror")
+    },
+    {.name = "converge-max-downtime",
+     .type = VSH_OT_INT,
+     .help = N_("maximum downtime in ms migration may use to converge")
+    },
+    {.name = "converge-max-time",
+     .type = VSH_OT_INT,
+     .help = N_("time in seconds migration is expected to finish within")
+    },
     {.name = "comp-methods",
      .type = VSH_OT_STRING,
      .help = N_("comma separated list of compression methods to be used")
@@ -10205,6 +10540,14 @@ static const vshCmdOptDef opts_migrate[] = {
      .type = VSH_OT_BOOL,
      .help = N_("use TLS for migration")
     },
+    {.name = "parallel",
+     .type = VSH_OT_BOOL,
+     .help = N_("enable parallel migration")
+    },
+    {.name = "parallel-connections",
+     .type = VSH_OT_INT,
+     .help = N_("number of connections for parallel migration")
+    },
     {.name = NULL}
 };
 
@@ -10225,6 +10568,7 @@ doMigrate(void *opaque)
     int nparams = 0;
     int maxparams = 0;
     int intOpt = 0;
+    unsigned int uintOpt = 0;
     unsigned long long ullOpt = 0;
     int rv;
     virConnectPtr dconn = data->dconn;
@@ -10268,6 +10612,63 @@ doMigrate(void *opaque)
                              VIR_MIGRATE_PARAM_DISKS_PORT, disksPort) < 0)
         goto save_error;
 
+    if ((rv = vshCommandOptULongLong(ctl, cmd, "disks-bandwidth", &ullOpt)) < 0) {
+        goto out;
+    } else if (rv > 0) {
+        if (virTypedParamsAddULLong(&params, &nparams, &maxparams,
+                                    VIR_MIGRATE_PARAM_DISKS_BANDWIDTH,
+                                    ullOpt) < 0)
+            goto save_error;
+    }
+
+    if ((rv = vshCommandOptULongLong(ctl, cmd, "disks-total-bandwidth",
+                                     &ullOpt)) < 0) {
+        goto out;
+    } else if (rv > 0) {
+        if (virTypedParamsAddULLong(&params, &nparams, &maxparams,
+                                    VIR_MIGRATE_PARAM_DISKS_TOTAL_BANDWIDTH,
+                                    ullOpt) < 0)
+            goto save_error;
+    }
+
+    if ((rv = vshCommandOptULongLong(ctl, cmd, "disks-buf-size", &ullOpt)) < 0) {
+        goto out;
+    } else if (rv > 0) {
+        if (virTypedParamsAddULLong(&params, &nparams, &maxparams,
+                                    VIR_MIGRATE_PARAM_DISKS_BUF_SIZE,
+                                    ullOpt) < 0)
+            goto save_error;
+    }
+
+    if ((rv = vshCommandOptUInt(ctl, cmd, "disks-granularity", &uintOpt)) < 0) {
+        goto out;
+    } else if (rv > 0) {
+        if (virTypedParamsAddUInt(&params, &nparams, &maxparams,
+                                  VIR_MIGRATE_PARAM_DISKS_GRANULARITY,
+                                  uintOpt) < 0)
+            goto save_error;
+    }
+
+    if ((rv = vshCommandOptULongLong(ctl, cmd, "converge-max-downtime",
+                                     &ullOpt)) < 0) {
+        goto out;
+    } else if (rv > 0) {
+        if (virTypedParamsAddULLong(&params, &nparams, &maxparams,
+                                    VIR_MIGRATE_PARAM_CONVERGE_MAX_DOWNTIME,
+                                    ullOpt) < 0)
+            goto save_error;
+    }
+
+    if ((rv = vshCommandOptULongLong(ctl, cmd, "converge-max-time",
+                                     &ullOpt)) < 0) {
+        goto out;
+    } else if (rv > 0) {
+        if (virTypedParamsAddULLong(&params, &nparams, &maxparams,
+                                    VIR_MIGRATE_PARAM_CONVERGE_MAX_TIME,
+                                    ullOpt) < 0)
+            goto save_error;
+    }
+
     if (vshCommandOptStringReq(ctl, cmd, "dname", &opt) < 0)
         goto out;
     if (opt &&
@@ -10401,6 +10802,15 @@ doMigrate(void *opaque)
             goto save_error;
     }
 
+    if ((rv = vshCommandOptInt(ctl, cmd, "parallel-connections", &intOpt)) < 0) {
+        goto out;
+    } else if (rv > 0) {
+        if (virTypedParamsAddInt(&params, &nparams, &maxparams,
+                                 VIR_MIGRATE_PARAM_PARALLEL_CONNECTIONS,
+                                 intOpt) < 0)
+            goto save_error;
+    }
+
     if (vshCommandOptBool(cmd, "live"))
         flags |= VIR_MIGRATE_LIVE;
     if (vshCommandOptBool(cmd, "p2p"))
@@ -10449,6 +10859,9 @@ doMigrate(void *opaque)
     if (vshCommandOptBool(cmd, "tls"))
         flags |= VIR_MIGRATE_TLS;
 
+    if (vshCommandOptBool(cmd, "parallel"))
+        flags |= VIR_MIGRATE_PARALLEL;
+
     if (flags & VIR_MIGRATE_PEER2PEER || vshCommandOptBool(cmd, "direct")) {
         if (virDomainMigrateToURI3(dom, desturi, params, nparams, flags) == 0)
             ret = '0';
@@ -11412,6 +11825,10 @@ static const vshCmdOptDef opts_detach_device[] = {
     VIRSH_COMMON_OPT_DOMAIN_CONFIG,
     VIRSH_COMMON_OPT_DOMAIN_LIVE,
     VIRSH_COMMON_OPT_DOMAIN_CURRENT,
+    {.name = "async",
+     .type = VSH_OT_BOOL,
+     .help = N_("don't wait for the guest to release the device")
+    },
     {.name = NULL}
 };
 
@@ -11438,6 +11855,8 @@ cmdDetachDevice(vshControl *ctl, const vshCmd *cmd)
         flags |= VIR_DOMAIN_AFFECT_CONFIG;
     if (live)
         flags |= VIR_DOMAIN_AFFECT_LIVE;
+    if (vshCommandOptBool(cmd, "async"))
+        flags |= VIR_DOMAIN_DEVICE_MODIFY_ASYNC;
 
     if (!(dom = virshCommandOptDomain(ctl, cmd, NULL)))
         return false;
@@ -13475,6 +13894,12 @@ const vshCmdDef domManagementCmds[] = {
      .info = info_blkiotune,
      .flags = 0
     },
+    {.name = "blockbackup",
+     .handler = cmdBlockBackup,
+     .opts = opts_block_backup,
+     .info = info_block_backup,
+     .flags = 0
+    },
     {.name = "blockcommit",
      .handler = cmdBlockCommit,
      .opts = opts_block_commit,
@@ -14023,5 +14448,11 @@ const vshCmdDef domManagementCmds[] = {
      .info = info_domblkthreshold,
      .flags = 0
     },
+    {.name = "domdirtyrate-calc",
+     .handler = cmdDomDirtyRateCalc,
+     .opts = opts_domdirtyrate_calc,
+     .info = info_domdirtyrate_calc,
+     .flags = 0
+    },
     {.name = NULL}
 };
@@ -57,6 +57,11 @@ virshStreamSink(virStreamPtr st,
                 size_t nbytes,
                 void *opaque);
 
+int
+virshStreamSkip(virStreamPtr st,
+                long long offset,
+                void *opaque);
+
 int
 virshDomainGetXMLFromDom(vshControl *ctl,
                          virDomainPtr dom,
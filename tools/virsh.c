@@ -407,6 +407,7 @@ virshDeinit(vshControl *ctl)
 
     vshDeinit(ctl);
     VIR_FREE(ctl->connname);
+    VIR_FREE(priv->batchFile);
     if (priv->conn) {
         int ret;
         virConnectUnregisterCloseCallback(priv->conn, virshCatchDisconnect);
@@ -456,10 +457,13 @@ virshUsage(void)
     fprintf(stdout, _("\n%s [options]... [<command_string>]"
                       "\n%s [options]... <command> [args...]\n\n"
                       "  options:\n"
+                      "    -b | --batch=FILE       run commands from FILE, - for stdin\n"
                       "    -c | --connect=URI      hypervisor connection URI\n"
                       "    -d | --debug=NUM        debug level [0-4]\n"
                       "    -e | --escape <char>    set escape sequence for console\n"
                       "    -h | --help             this help\n"
+                      "    -j | --jobs=NUM         run up to NUM batch lines at once\n"
+                      "         --json             report batch results as JSON\n"
                       "    -k | --keepalive-interval=NUM\n"
                       "                            keepalive interval in seconds, 0 for disable\n"
                       "    -K | --keepalive-count=NUM\n"
@@ -671,10 +675,13 @@ virshParseArgv(vshControl *ctl, int argc, char **argv)
     int longindex = -1;
     virshControlPtr priv = ctl->privData;
     struct option opt[] = {
+        {"batch", required_argument, NULL, 'b'},
         {"connect", required_argument, NULL, 'c'},
         {"debug", required_argument, NULL, 'd'},
         {"escape", required_argument, NULL, 'e'},
         {"help", no_argument, NULL, 'h'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"json", no_argument, NULL, 'J'},
         {"keepalive-interval", required_argument, NULL, 'k'},
         {"keepalive-count", required_argument, NULL, 'K'},
         {"log", required_argument, NULL, 'l'},
@@ -688,8 +695,12 @@ virshParseArgv(vshControl *ctl, int argc, char **argv)
     /* Standard (non-command) options. The leading + ensures that no
      * argument reordering takes place, so that command options are
      * not confused with top-level virsh options. */
-    while ((arg = getopt_long(argc, argv, "+:c:d:e:hk:K:l:qrtvV", opt, &longindex)) != -1) {
+    while ((arg = getopt_long(argc, argv, "+:b:c:d:e:hj:k:K:l:qrtvV", opt, &longindex)) != -1) {
         switch (arg) {
+        case 'b':
+            VIR_FREE(priv->batchFile);
+            priv->batchFile = vshStrdup(ctl, optarg);
+            break;
         case 'c':
             VIR_FREE(ctl->connname);
             ctl->connname = vshStrdup(ctl, optarg);
@@ -723,6 +734,18 @@ virshParseArgv(vshControl *ctl, int argc, char **argv)
             virshUsage();
             exit(EXIT_SUCCESS);
             break;
+        case 'j':
+            if (virStrToLong_ui(optarg, NULL, 10, &priv->batchJobs) < 0 ||
+                priv->batchJobs == 0) {
+                vshError(ctl,
+                         _("option %s requires a positive integer argument"),
+                         longindex == -1 ? "-j" : "--jobs");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'J':
+            priv->batchJSON = true;
+            break;
         case 'k':
             if (virStrToLong_i(optarg, NULL, 0, &keepalive) < 0) {
                 vshError(ctl,
@@ -802,7 +825,17 @@ virshParseArgv(vshControl *ctl, int argc, char **argv)
         longindex = -1;
     }
 
-    if (argc == optind) {
+    if (priv->batchFile) {
+        if (argc != optind) {
+            vshError(ctl, "%s",
+                     _("commands cannot be given together with --batch"));
+            exit(EXIT_FAILURE);
+        }
+        ctl->imode = false;
+    } else if (priv->batchJobs || priv->batchJSON) {
+        vshError(ctl, "%s", _("--jobs and --json require --batch"));
+        exit(EXIT_FAILURE);
+    } else if (argc == optind) {
         ctl->imode = true;
     } else {
         /* parse command */
@@ -922,7 +955,10 @@ main(int argc, char **argv)
         ctl->connname = vshStrdup(ctl,
                                   virGetEnvBlockSUID("VIRSH_DEFAULT_CONNECT_URI"));
 
-    if (!ctl->imode) {
+    if (virshCtl.batchFile) {
+        ret = vshBatchRun(ctl, virshCtl.batchFile,
+                          virshCtl.batchJobs, virshCtl.batchJSON);
+    } else if (!ctl->imode) {
         ret = vshCommandRun(ctl, ctl->cmd);
     } else {
         /* interactive mode */
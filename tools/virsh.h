@@ -123,6 +123,9 @@ struct _virshControl {
                                    are missing */
     const char *escapeChar;     /* String representation of
                                    console escape character */
+    char *batchFile;            /* file to read batch commands from */
+    unsigned int batchJobs;     /* batch lines to run at once */
+    bool batchJSON;             /* report batch results as JSON */
 };
 
 /* Typedefs, function prototypes for job progress reporting.
@@ -597,9 +597,146 @@ static const vshCmdOptDef opts_srv_clients_list[] = {
      .flags = VSH_OFLAG_REQ,
      .help = N_("server which to list connected clients from"),
     },
+    {.name = "transport",
+     .type = VSH_OT_STRING,
+     .help = N_("only list clients connected over this transport"),
+    },
+    {.name = "identity",
+     .type = VSH_OT_STRING,
+     .help = N_("only list clients with this UNIX, SASL or x509 user name"),
+    },
+    {.name = "min-age",
+     .type = VSH_OT_INT,
+     .help = N_("only list clients connected for at least this many seconds"),
+    },
+    {.name = "min-idle",
+     .type = VSH_OT_INT,
+     .help = N_("only list clients idle for at least this many seconds"),
+    },
+    {.name = "page-size",
+     .type = VSH_OT_INT,
+     .help = N_("number of clients to fetch from the server at once"),
+    },
     {.name = NULL}
 };
 
+static bool
+vshAdmPrintClients(vshControl *ctl,
+                   virAdmClientPtr *clts,
+                   int nclts)
+{
+    size_t i;
+    char *timestr = NULL;
+
+    for (i = 0; i < nclts; i++) {
+        virAdmClientPtr client = clts[i];
+        if (vshAdmGetTimeStr(ctl, virAdmClientGetTimestamp(client),
+                             &timestr) < 0)
+            return false;
+
+        vshPrint(ctl, " %-5llu %-15s %-15s\n",
+                 virAdmClientGetID(client),
+                 vshAdmClientTransportToString(virAdmClientGetTransport(client)),
+                 timestr);
+        VIR_FREE(timestr);
+    }
+
+    return true;
+}
+
+/*
+ * Fetch the clients matching the filters requested in @cmd page by page,
+ * so that the server only has to look at a few clients per call.
+ */
+static int
+vshAdmListClientsFiltered(vshControl *ctl,
+                          const vshCmd *cmd,
+                          virAdmServerPtr srv)
+{
+    int ret = -1;
+    int nclts = 0;
+    size_t i;
+    const char *str = NULL;
+    unsigned long long val;
+    unsigned int limit = 0;
+    unsigned long long cursor = 0;
+    virTypedParameterPtr filters = NULL;
+    int nfilters = 0;
+    int maxfilters = 0;
+    virAdmClientPtr *clts = NULL;
+    int rv;
+
+    if (vshCommandOptStringReq(ctl, cmd, "transport", &str) < 0)
+        goto cleanup;
+    if (str) {
+        int transport = virClientTransportTypeFromString(str);
+        if (transport < 0) {
+            vshError(ctl, _("Unknown client transport '%s'"), str);
+            goto cleanup;
+        }
+        if (virTypedParamsAddInt(&filters, &nfilters, &maxfilters,
+                                 VIR_CLIENT_FILTER_TRANSPORT, transport) < 0)
+            goto save_error;
+    }
+
+    if (vshCommandOptStringReq(ctl, cmd, "identity", &str) < 0)
+        goto cleanup;
+    if (str &&
+        virTypedParamsAddString(&filters, &nfilters, &maxfilters,
+                                VIR_CLIENT_FILTER_IDENTITY, str) < 0)
+        goto save_error;
+
+    if ((rv = vshCommandOptULongLong(ctl, cmd, "min-age", &val)) < 0)
+        goto cleanup;
+    if (rv > 0 &&
+        virTypedParamsAddULLong(&filters, &nfilters, &maxfilters,
+                                VIR_CLIENT_FILTER_MIN_AGE, val) < 0)
+        goto save_error;
+
+    if ((rv = vshCommandOptULongLong(ctl, cmd, "min-idle", &val)) < 0)
+        goto cleanup;
+    if (rv > 0 &&
+        virTypedParamsAddULLong(&filters, &nfilters, &maxfilters,
+                                VIR_CLIENT_FILTER_MIN_IDLE, val) < 0)
+        goto save_error;
+
+    if (vshCommandOptUInt(ctl, cmd, "page-size", &limit) < 0)
+        goto cleanup;
+
+    do {
+        if ((nclts = virAdmServerListClientsFiltered(srv, filters, nfilters,
+                                                     &cursor, limit,
+                                                     &clts, 0)) < 0) {
+            vshError(ctl, _("failed to obtain list of connected clients "
+                            "from server '%s'"), virAdmServerGetName(srv));
+            goto cleanup;
+        }
+
+        if (!vshAdmPrintClients(ctl, clts, nclts))
+            goto cleanup;
+
+        for (i = 0; i < nclts; i++)
+            virAdmClientFree(clts[i]);
+        VIR_FREE(clts);
+        nclts = 0;
+    } while (cursor);
+
+    ret = 0;
+
+ cleanup:
+    if (clts) {
+        for (i = 0; i < nclts; i++)
+            virAdmClientFree(clts[i]);
+        VIR_FREE(clts);
+    }
+    virTypedParamsFree(filters, nfilters);
+    return ret;
+
+ save_error:
+    vshSaveLibvirtError();
+    goto cleanup;
+}
+
 static bool
 cmdSrvClientsList(vshControl *ctl, const vshCmd *cmd)
 {
@@ -607,9 +744,6 @@ cmdSrvClientsList(vshControl *ctl, const vshCmd *cmd)
     size_t i;
     bool ret = false;
     const char *srvname = NULL;
-    unsigned long long id;
-    virClientTransport transport;
-    char *timestr = NULL;
     virAdmServerPtr srv = NULL;
     virAdmClientPtr *clts = NULL;
     vshAdmControlPtr priv = ctl->privData;
@@ -620,31 +754,32 @@ cmdSrvClientsList(vshControl *ctl, const vshCmd *cmd)
     if (!(srv = virAdmConnectLookupServer(priv->conn, srvname, 0)))
         goto cleanup;
 
-    /* Obtain a list of clients connected to server @srv */
-    if ((nclts = virAdmServerListClients(srv, &clts, 0)) < 0) {
-        vshError(ctl, _("failed to obtain list of connected clients "
-                        "from server '%s'"), virAdmServerGetName(srv));
-        goto cleanup;
-    }
-
     vshPrintExtra(ctl, " %-5s %-15s %-15s\n%s\n", _("Id"), _("Transport"),
                   _("Connected since"),
                   "-------------------------"
                   "-------------------------");
 
-    for (i = 0; i < nclts; i++) {
-        virAdmClientPtr client = clts[i];
-        id = virAdmClientGetID(client);
-        transport = virAdmClientGetTransport(client);
-        if (vshAdmGetTimeStr(ctl, virAdmClientGetTimestamp(client),
-                             &timestr) < 0)
-            goto cleanup;
+    /* Only use the paginated listing when asked to, so that listing
+     * all clients keeps working with older daemons */
+    if (vshCommandOptBool(cmd, "transport") ||
+        vshCommandOptBool(cmd, "identity") ||
+        vshCommandOptBool(cmd, "min-age") ||
+        vshCommandOptBool(cmd, "min-idle") ||
+        vshCommandOptBool(cmd, "page-size")) {
+        ret = vshAdmListClientsFiltered(ctl, cmd, srv) == 0;
+        goto cleanup;
+    }
 
-        vshPrint(ctl, " %-5llu %-15s %-15s\n",
-                 id, vshAdmClientTransportToString(transport), timestr);
-        VIR_FREE(timestr);
+    /* Obtain a list of clients connected to server @srv */
+    if ((nclts = virAdmServerListClients(srv, &clts, 0)) < 0) {
+        vshError(ctl, _("failed to obtain list of connected clients "
+                        "from server '%s'"), virAdmServerGetName(srv));
+        goto cleanup;
     }
 
+    if (!vshAdmPrintClients(ctl, clts, nclts))
+        goto cleanup;
+
     ret = true;
 
  cleanup:
@@ -867,6 +1002,518 @@ cmdSrvClientsInfo(vshControl *ctl, const vshCmd *cmd)
     return ret;
 }
 
+/* -------------------------
+ * Command srv-clients-stats
+ * -------------------------
+ */
+
+static const vshCmdInfo info_srv_clients_stats[] = {
+    {.name = "help",
+     .data = N_("get summary statistics of clients connected to <server>")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve the number of clients connected to <server> per "
+                "transport and access mode, without listing them.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_srv_clients_stats[] = {
+    {.name = "server",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("Server to retrieve the client statistics from."),
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdSrvClientsStats(vshControl *ctl, const vshCmd *cmd)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    size_t i;
+    const char *srvname = NULL;
+    virAdmServerPtr srv = NULL;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (vshCommandOptStringReq(ctl, cmd, "server", &srvname) < 0)
+        return false;
+
+    if (!(srv = virAdmConnectLookupServer(priv->conn, srvname, 0)))
+        goto cleanup;
+
+    if (virAdmServerGetClientStats(srv, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to retrieve client statistics "
+                              "from server"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nparams; i++)
+        vshPrint(ctl, "%-20s: %u\n", params[i].field, params[i].value.ui);
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    virAdmServerFree(srv);
+    return ret;
+}
+
+/* --------------------------------
+ * Command daemon-message-pool-info
+ * --------------------------------
+ */
+
+static const vshCmdInfo info_daemon_message_pool_info[] = {
+    {.name = "help",
+     .data = N_("get usage of the daemon's RPC message buffer pool")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve counters of the pool of idle RPC message buffers "
+                "shared by all servers of the daemon")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonMessagePoolInfo(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    size_t i;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (virAdmConnectGetMessagePoolStats(priv->conn, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to retrieve message pool statistics"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nparams; i++)
+        vshPrint(ctl, "%-15s: %llu\n", params[i].field, params[i].value.ul);
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
+/* ---------------------------
+ * Command daemon-object-stats
+ * ---------------------------
+ */
+
+static const vshCmdInfo info_daemon_object_stats[] = {
+    {.name = "help",
+     .data = N_("get the daemon's object counts per class")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve how many objects of every class the daemon "
+                "currently uses and how many released ones it caches")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonObjectStats(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    unsigned int count = 0;
+    size_t i;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (virAdmConnectGetObjectStats(priv->conn, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to retrieve object statistics"));
+        goto cleanup;
+    }
+
+    if (virTypedParamsGetUInt(params, nparams,
+                              VIR_OBJECT_STATS_COUNT, &count) < 0)
+        goto cleanup;
+
+    vshPrintExtra(ctl, " %-40s %8s %10s %10s\n",
+                  _("Class"), _("Size"), _("Live"), _("Cached"));
+    vshPrintExtra(ctl, "---------------------------------------------"
+                  "---------------------------\n");
+
+    for (i = 0; i < count; i++) {
+        char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+        const char *name = NULL;
+        unsigned long long size = 0;
+        unsigned int live = 0;
+        unsigned int cached = 0;
+
+#define VSH_ADM_OBJECT_FIELD(suffix) \
+        snprintf(field, sizeof(field), \
+                 VIR_OBJECT_STATS_PREFIX "%zu" suffix, i)
+
+        VSH_ADM_OBJECT_FIELD(VIR_OBJECT_STATS_SUFFIX_NAME);
+        ignore_value(virTypedParamsGetString(params, nparams, field, &name));
+        VSH_ADM_OBJECT_FIELD(VIR_OBJECT_STATS_SUFFIX_SIZE);
+        ignore_value(virTypedParamsGetULLong(params, nparams, field, &size));
+        VSH_ADM_OBJECT_FIELD(VIR_OBJECT_STATS_SUFFIX_LIVE);
+        ignore_value(virTypedParamsGetUInt(params, nparams, field, &live));
+        VSH_ADM_OBJECT_FIELD(VIR_OBJECT_STATS_SUFFIX_CACHED);
+        ignore_value(virTypedParamsGetUInt(params, nparams, field, &cached));
+
+#undef VSH_ADM_OBJECT_FIELD
+
+        vshPrint(ctl, " %-40s %8llu %10u %10u\n",
+                 name ? name : "-", size, live, cached);
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
+/* ---------------------------
+ * Command daemon-stream-stats
+ * ---------------------------
+ */
+
+static const vshCmdInfo info_daemon_stream_stats[] = {
+    {.name = "help",
+     .data = N_("get the daemon's file stream counters")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve throughput counters of the streams of files and "
+                "block devices, whose data is copied by the daemon's I/O "
+                "workers")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonStreamStats(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    size_t i;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (virAdmConnectGetStreamStats(priv->conn, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to retrieve stream statistics"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nparams; i++)
+        vshPrint(ctl, "%-15s: %llu\n", params[i].field, params[i].value.ul);
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
+/* -------------------------
+ * Command daemon-lock-stats
+ * -------------------------
+ */
+
+static const vshCmdInfo info_daemon_lock_stats[] = {
+    {.name = "help",
+     .data = N_("get the daemon's lock contention statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve how often the daemon's locks were contended and "
+                "how long they were waited for and held, per class of locks")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_daemon_lock_stats[] = {
+    {.name = "reset",
+     .type = VSH_OT_BOOL,
+     .help = N_("clear the statistics once retrieved")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonLockStats(vshControl *ctl, const vshCmd *cmd)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    int enabled = 0;
+    unsigned int count = 0;
+    unsigned int flags = 0;
+    size_t i;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (vshCommandOptBool(cmd, "reset"))
+        flags |= VIR_ADM_LOCK_STATS_RESET;
+
+    if (virAdmConnectGetLockStats(priv->conn, &params, &nparams, flags) < 0) {
+        vshError(ctl, "%s", _("Unable to retrieve lock statistics"));
+        goto cleanup;
+    }
+
+    if (virTypedParamsGetBoolean(params, nparams,
+                                 VIR_LOCK_STATS_ENABLED, &enabled) < 0 ||
+        virTypedParamsGetUInt(params, nparams,
+                              VIR_LOCK_STATS_COUNT, &count) < 0)
+        goto cleanup;
+
+    if (!enabled) {
+        vshError(ctl, "%s", _("Lock profiling is disabled, the daemon must "
+                              "be started with LIBVIRT_LOCK_PROFILE=1"));
+        goto cleanup;
+    }
+
+    vshPrintExtra(ctl, " %-32s %12s %10s %12s %10s %12s %10s %10s\n",
+                  _("Lock class"), _("Acquired"), _("Contended"),
+                  _("Wait (us)"), _("Max wait"), _("Held (us)"),
+                  _("Max held"), _("Cond waits"));
+    vshPrintExtra(ctl, "---------------------------------------------"
+                  "---------------------------------------------"
+                  "-------------------------------\n");
+
+    for (i = 0; i < count; i++) {
+        char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+        const char *name = NULL;
+        unsigned long long acquired = 0;
+        unsigned long long contended = 0;
+        unsigned long long waitTime = 0;
+        unsigned long long maxWaitTime = 0;
+        unsigned long long holdTime = 0;
+        unsigned long long maxHoldTime = 0;
+        unsigned long long condWaits = 0;
+
+#define VSH_ADM_LOCK_FIELD(suffix) \
+        snprintf(field, sizeof(field), \
+                 VIR_LOCK_STATS_PREFIX "%zu" suffix, i)
+
+        VSH_ADM_LOCK_FIELD(VIR_LOCK_STATS_SUFFIX_NAME);
+        ignore_value(virTypedParamsGetString(params, nparams, field, &name));
+        VSH_ADM_LOCK_FIELD(VIR_LOCK_STATS_SUFFIX_ACQUIRED);
+        ignore_value(virTypedParamsGetULLong(params, nparams, field,
+                                             &acquired));
+        VSH_ADM_LOCK_FIELD(VIR_LOCK_STATS_SUFFIX_CONTENDED);
+        ignore_value(virTypedParamsGetULLong(params, nparams, field,
+                                             &contended));
+        VSH_ADM_LOCK_FIELD(VIR_LOCK_STATS_SUFFIX_WAIT_TIME);
+        ignore_value(virTypedParamsGetULLong(params, nparams, field,
+                                             &waitTime));
+        VSH_ADM_LOCK_FIELD(VIR_LOCK_STATS_SUFFIX_MAX_WAIT_TIME);
+        ignore_value(virTypedParamsGetULLong(params, nparams, field,
+                                             &maxWaitTime));
+        VSH_ADM_LOCK_FIELD(VIR_LOCK_STATS_SUFFIX_HOLD_TIME);
+        ignore_value(virTypedParamsGetULLong(params, nparams, field,
+                                             &holdTime));
+        VSH_ADM_LOCK_FIELD(VIR_LOCK_STATS_SUFFIX_MAX_HOLD_TIME);
+        ignore_value(virTypedParamsGetULLong(params, nparams, field,
+                                             &maxHoldTime));
+        VSH_ADM_LOCK_FIELD(VIR_LOCK_STATS_SUFFIX_COND_WAITS);
+        ignore_value(virTypedParamsGetULLong(params, nparams, field,
+                                             &condWaits));
+
+#undef VSH_ADM_LOCK_FIELD
+
+        vshPrint(ctl, " %-32s %12llu %10llu %12llu %10llu %12llu %10llu %10llu\n",
+                 name ? name : "-", acquired, contended, waitTime,
+                 maxWaitTime, holdTime, maxHoldTime, condWaits);
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    return ret;
+}
+
+/* ---------------------------
+ * Command srv-procedure-stats
+ * ---------------------------
+ */
+
+static const vshCmdInfo info_srv_procedure_stats[] = {
+    {.name = "help",
+     .data = N_("get server's per procedure RPC latency statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve the number of calls, average queue wait and "
+                "execution times and latency percentiles of every RPC "
+                "procedure the server has processed")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_srv_procedure_stats[] = {
+    {.name = "server",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("Server to retrieve the procedure statistics from."),
+    },
+    {.name = "histogram",
+     .type = VSH_OT_BOOL,
+     .help = N_("print the latency histograms of every procedure"),
+    },
+    {.name = NULL}
+};
+
+/* Fetch the histogram of procedure @idx, missing buckets are empty */
+static void
+vshAdmProcedureStatsHistogram(virTypedParameterPtr params,
+                              int nparams,
+                              size_t idx,
+                              const char *suffix,
+                              unsigned long long *buckets)
+{
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t i;
+
+    for (i = 0; i < VIR_SERVER_PROCEDURE_STATS_BUCKETS; i++) {
+        snprintf(field, sizeof(field),
+                 VIR_SERVER_PROCEDURE_STATS_PREFIX "%zu%s%zu", idx, suffix, i);
+        buckets[i] = 0;
+        ignore_value(virTypedParamsGetULLong(params, nparams, field,
+                                             &buckets[i]));
+    }
+}
+
+/* Upper bound in microseconds of the bucket holding the @pct percentile */
+static unsigned long long
+vshAdmProcedureStatsPercentile(const unsigned long long *buckets,
+                               unsigned long long calls,
+                               unsigned int pct)
+{
+    unsigned long long want = (calls * pct + 99) / 100;
+    unsigned long long seen = 0;
+    size_t i;
+
+    for (i = 0; i < VIR_SERVER_PROCEDURE_STATS_BUCKETS - 1; i++) {
+        seen += buckets[i];
+        if (seen >= want)
+            break;
+    }
+
+    return 1ULL << (i + 1);
+}
+
+static bool
+cmdSrvProcedureStats(vshControl *ctl, const vshCmd *cmd)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    unsigned int count = 0;
+    size_t i;
+    size_t j;
+    const char *srvname = NULL;
+    bool histogram = vshCommandOptBool(cmd, "histogram");
+    virAdmServerPtr srv = NULL;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (vshCommandOptStringReq(ctl, cmd, "server", &srvname) < 0)
+        return false;
+
+    if (!(srv = virAdmConnectLookupServer(priv->conn, srvname, 0)))
+        goto cleanup;
+
+    if (virAdmServerGetProcedureStats(srv, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to retrieve procedure statistics "
+                              "from the server"));
+        goto cleanup;
+    }
+
+    if (virTypedParamsGetUInt(params, nparams,
+                              VIR_SERVER_PROCEDURE_STATS_COUNT, &count) < 0)
+        goto cleanup;
+
+    vshPrintExtra(ctl, " %-10s %-5s %-40s %10s %8s %10s %10s %10s %10s\n",
+                  _("Program"), _("Proc"), _("Name"), _("Calls"),
+                  _("Errors"), _("Wait avg"), _("Exec avg"),
+                  _("Exec p50"), _("Exec p99"));
+    vshPrintExtra(ctl, "-------------------------------------------------------"
+                  "-------------------------------------------------------"
+                  "--------\n");
+
+    for (i = 0; i < count; i++) {
+        char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+        unsigned int program = 0;
+        unsigned int number = 0;
+        const char *name = NULL;
+        unsigned long long calls = 0;
+        unsigned long long errors = 0;
+        unsigned long long waitTotal = 0;
+        unsigned long long execTotal = 0;
+        unsigned long long wait[VIR_SERVER_PROCEDURE_STATS_BUCKETS];
+        unsigned long long exec[VIR_SERVER_PROCEDURE_STATS_BUCKETS];
+
+#define VSH_ADM_PROC_FIELD(suffix) \
+        snprintf(field, sizeof(field), \
+                 VIR_SERVER_PROCEDURE_STATS_PREFIX "%zu" suffix, i)
+
+        VSH_ADM_PROC_FIELD(VIR_SERVER_PROCEDURE_STATS_SUFFIX_PROGRAM);
+        ignore_value(virTypedParamsGetUInt(params, nparams, field, &program));
+        VSH_ADM_PROC_FIELD(VIR_SERVER_PROCEDURE_STATS_SUFFIX_NUMBER);
+        ignore_value(virTypedParamsGetUInt(params, nparams, field, &number));
+        VSH_ADM_PROC_FIELD(VIR_SERVER_PROCEDURE_STATS_SUFFIX_NAME);
+        ignore_value(virTypedParamsGetString(params, nparams, field, &name));
+        VSH_ADM_PROC_FIELD(VIR_SERVER_PROCEDURE_STATS_SUFFIX_CALLS);
+        ignore_value(virTypedParamsGetULLong(params, nparams, field, &calls));
+        VSH_ADM_PROC_FIELD(VIR_SERVER_PROCEDURE_STATS_SUFFIX_ERRORS);
+        ignore_value(virTypedParamsGetULLong(params, nparams, field, &errors));
+        VSH_ADM_PROC_FIELD(VIR_SERVER_PROCEDURE_STATS_SUFFIX_WAIT_TOTAL);
+        ignore_value(virTypedParamsGetULLong(params, nparams, field,
+                                             &waitTotal));
+        VSH_ADM_PROC_FIELD(VIR_SERVER_PROCEDURE_STATS_SUFFIX_EXEC_TOTAL);
+        ignore_value(virTypedParamsGetULLong(params, nparams, field,
+                                             &execTotal));
+
+#undef VSH_ADM_PROC_FIELD
+
+        if (!calls)
+            continue;
+
+        vshAdmProcedureStatsHistogram(params, nparams, i,
+                                      VIR_SERVER_PROCEDURE_STATS_SUFFIX_WAIT_BUCKET,
+                                      wait);
+        vshAdmProcedureStatsHistogram(params, nparams, i,
+                                      VIR_SERVER_PROCEDURE_STATS_SUFFIX_EXEC_BUCKET,
+                                      exec);
+
+        vshPrint(ctl, " %-10x %-5u %-40s %10llu %8llu %10llu %10llu %10llu %10llu\n",
+                 program, number, name ? name : "-", calls, errors,
+                 waitTotal / calls, execTotal / calls,
+                 vshAdmProcedureStatsPercentile(exec, calls, 50),
+                 vshAdmProcedureStatsPercentile(exec, calls, 99));
+
+        if (!histogram)
+            continue;
+
+        for (j = 0; j < VIR_SERVER_PROCEDURE_STATS_BUCKETS; j++) {
+            if (!wait[j] && !exec[j])
+                continue;
+
+            if (j == VIR_SERVER_PROCEDURE_STATS_BUCKETS - 1)
+                vshPrint(ctl, "     >= %10llu us: wait %10llu exec %10llu\n",
+                         1ULL << j, wait[j], exec[j]);
+            else
+                vshPrint(ctl, "     <  %10llu us: wait %10llu exec %10llu\n",
+                         1ULL << (j + 1), wait[j], exec[j]);
+        }
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    virAdmServerFree(srv);
+    return ret;
+}
+
 /* -----------------------
  * Command srv-clients-set
  * -----------------------
@@ -899,6 +1546,21 @@ static const vshCmdOptDef opts_srv_clients_set[] = {
      .help = N_("Change the upper limit to number of clients waiting for "
                 "authentication to be connected to the server"),
     },
+    {.name = "rate-limit",
+     .type = VSH_OT_INT,
+     .help = N_("Change the number of requests per second each client may "
+                "issue, 0 for no limit"),
+    },
+    {.name = "rate-burst",
+     .type = VSH_OT_INT,
+     .help = N_("Change the number of requests a client may issue at once "
+                "above its rate limit"),
+    },
+    {.name = "rw-weight",
+     .type = VSH_OT_INT,
+     .help = N_("Change the share of busy workers given to a read-write "
+                "client relative to a read-only one"),
+    },
     {.name = NULL}
 };
 
@@ -930,12 +1592,16 @@ cmdSrvClientsSet(vshControl *ctl, const vshCmd *cmd)
 
     PARSE_CMD_TYPED_PARAM("max-clients", VIR_SERVER_CLIENTS_MAX);
     PARSE_CMD_TYPED_PARAM("max-unauth-clients", VIR_SERVER_CLIENTS_UNAUTH_MAX);
+    PARSE_CMD_TYPED_PARAM("rate-limit", VIR_SERVER_CLIENTS_RATE_LIMIT);
+    PARSE_CMD_TYPED_PARAM("rate-burst", VIR_SERVER_CLIENTS_RATE_BURST);
+    PARSE_CMD_TYPED_PARAM("rw-weight", VIR_SERVER_CLIENTS_RW_WEIGHT);
 
 #undef PARSE_CMD_TYPED_PARAM
 
     if (!nparams) {
         vshError(ctl, "%s", _("At least one of options --max-clients, "
-                              "--max-unauth-clients is mandatory"));
+                              "--max-unauth-clients, --rate-limit, "
+                              "--rate-burst, --rw-weight is mandatory"));
         goto cleanup;
     }
 
@@ -1079,6 +1745,38 @@ cmdDaemonLogOutputs(vshControl *ctl, const vshCmd *cmd)
     return true;
 }
 
+/* -----------------------
+ * Command daemon-log-dump
+ * -----------------------
+ */
+static const vshCmdInfo info_daemon_log_dump[] = {
+    {.name = "help",
+     .data = N_("dump logging messages recorded in memory by daemon")
+    },
+    {.name = "desc",
+     .data = N_("Print the messages recorded by the daemon's 'memory' logging "
+                "output, oldest first.")
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdDaemonLogDump(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
+{
+    char *messages = NULL;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (virAdmConnectDumpLoggingMemory(priv->conn, &messages, 0) < 0) {
+        vshError(ctl, _("Unable to dump daemon logging messages"));
+        return false;
+    }
+
+    vshPrint(ctl, "%s", messages);
+    VIR_FREE(messages);
+
+    return true;
+}
+
 static void *
 vshAdmConnectionHandler(vshControl *ctl)
 {
@@ -1383,6 +2081,30 @@ static const vshCmdDef monitoringCmds[] = {
      .info = info_srv_list,
      .flags = 0
     },
+    {.name = "daemon-message-pool-info",
+     .handler = cmdDaemonMessagePoolInfo,
+     .opts = NULL,
+     .info = info_daemon_message_pool_info,
+     .flags = 0
+    },
+    {.name = "daemon-object-stats",
+     .handler = cmdDaemonObjectStats,
+     .opts = NULL,
+     .info = info_daemon_object_stats,
+     .flags = 0
+    },
+    {.name = "daemon-stream-stats",
+     .handler = cmdDaemonStreamStats,
+     .opts = NULL,
+     .info = info_daemon_stream_stats,
+     .flags = 0
+    },
+    {.name = "daemon-lock-stats",
+     .handler = cmdDaemonLockStats,
+     .opts = opts_daemon_lock_stats,
+     .info = info_daemon_lock_stats,
+     .flags = 0
+    },
     {.name = "srv-threadpool-info",
      .flags = VSH_CMD_FLAG_ALIAS,
      .alias = "server-threadpool-info"
@@ -1419,6 +2141,26 @@ static const vshCmdDef monitoringCmds[] = {
      .info = info_srv_clients_info,
      .flags = 0
     },
+    {.name = "srv-clients-stats",
+     .flags = VSH_CMD_FLAG_ALIAS,
+     .alias = "server-clients-stats"
+    },
+    {.name = "server-clients-stats",
+     .handler = cmdSrvClientsStats,
+     .opts = opts_srv_clients_stats,
+     .info = info_srv_clients_stats,
+     .flags = 0
+    },
+    {.name = "srv-procedure-stats",
+     .flags = VSH_CMD_FLAG_ALIAS,
+     .alias = "server-procedure-stats"
+    },
+    {.name = "server-procedure-stats",
+     .handler = cmdSrvProcedureStats,
+     .opts = opts_srv_procedure_stats,
+     .info = info_srv_procedure_stats,
+     .flags = 0
+    },
     {.name = NULL}
 };
 
@@ -1461,6 +2203,12 @@ static const vshCmdDef managementCmds[] = {
      .info = info_daemon_log_outputs,
      .flags = 0
     },
+    {.name = "daemon-log-dump",
+     .handler = cmdDaemonLogDump,
+     .opts = NULL,
+     .info = info_daemon_log_dump,
+     .flags = 0
+    },
     {.name = NULL}
 };
 
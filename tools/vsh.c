@@ -54,6 +54,7 @@
 #include <libvirt/libvirt-lxc.h>
 #include "virfile.h"
 #include "virthread.h"
+#include "virthreadpool.h"
 #include "vircommand.h"
 #include "conf/domain_conf.h"
 #include "virtypedparam.h"
@@ -236,7 +237,72 @@ vshStringToArray(const char *str,
     return nstr_tokens;
 }
 
-virErrorPtr last_error;
+/*
+ * Commands run in batch mode record their output and errors in their
+ * job, which is found through this thread local
+ */
+typedef struct _vshBatchJob vshBatchJob;
+typedef vshBatchJob *vshBatchJobPtr;
+
+struct _vshBatchJob {
+    size_t line;                /* line of the batch input */
+    char *cmdstr;
+    vshCmd *cmd;
+    bool ret;
+    bool done;
+    virBuffer output;
+    virBuffer errors;
+    virErrorPtr error;          /* last_error of the job */
+};
+
+static virThreadLocal vshBatchJobLocal;
+static bool vshBatchJobLocalReady;
+static virMutex vshConnectLock;
+
+static virErrorPtr vshLastErrorMain;
+
+static vshBatchJobPtr
+vshBatchJobCurrent(void)
+{
+    if (!vshBatchJobLocalReady)
+        return NULL;
+
+    return virThreadLocalGet(&vshBatchJobLocal);
+}
+
+
+/*
+ * Where last_error is stored, which differs between threads
+ * running batch jobs
+ */
+virErrorPtr *
+vshLastError(void)
+{
+    vshBatchJobPtr job = vshBatchJobCurrent();
+
+    if (job)
+        return &job->error;
+
+    return &vshLastErrorMain;
+}
+
+
+/*
+ * Write @str to @stream, or collect it in the current batch job
+ */
+static void
+vshOutput(FILE *stream, const char *str)
+{
+    vshBatchJobPtr job = vshBatchJobCurrent();
+
+    if (job) {
+        virBufferAdd(stream == stderr ? &job->errors : &job->output, str, -1);
+        return;
+    }
+
+    fputs(str, stream);
+}
+
 
 /*
  * Quieten libvirt until we're done with the command.
@@ -659,12 +725,12 @@ vshCmddefHelp(vshControl *ctl, const char *cmdname)
         return false;
     }
 
-    fputs(_("  NAME\n"), stdout);
-    fprintf(stdout, "    %s - %s\n", def->name,
+    vshPrint(ctl, "%s", _("  NAME\n"));
+    vshPrint(ctl, "    %s - %s\n", def->name,
             _(vshCmddefGetInfo(def, "help")));
 
-    fputs(_("\n  SYNOPSIS\n"), stdout);
-    fprintf(stdout, "    %s", def->name);
+    vshPrint(ctl, "%s", _("\n  SYNOPSIS\n"));
+    vshPrint(ctl, "    %s", def->name);
     if (def->opts) {
         const vshCmdOptDef *opt;
         for (opt = def->opts; opt->name; opt++) {
@@ -706,22 +772,22 @@ vshCmddefHelp(vshControl *ctl, const char *cmdname)
                 /* aliases are intentionally undocumented */
                 continue;
             }
-            fputc(' ', stdout);
-            fprintf(stdout, fmt, opt->name);
+            vshPrint(ctl, " ");
+            vshPrint(ctl, fmt, opt->name);
         }
     }
-    fputc('\n', stdout);
+    vshPrint(ctl, "\n");
 
     desc = vshCmddefGetInfo(def, "desc");
     if (*desc) {
         /* Print the description only if it's not empty.  */
-        fputs(_("\n  DESCRIPTION\n"), stdout);
-        fprintf(stdout, "    %s\n", _(desc));
+        vshPrint(ctl, "%s", _("\n  DESCRIPTION\n"));
+        vshPrint(ctl, "    %s\n", _(desc));
     }
 
     if (def->opts && def->opts->name) {
         const vshCmdOptDef *opt;
-        fputs(_("\n  OPTIONS\n"), stdout);
+        vshPrint(ctl, "%s", _("\n  OPTIONS\n"));
         for (opt = def->opts; opt->name; opt++) {
             switch (opt->type) {
             case VSH_OT_BOOL:
@@ -762,10 +828,10 @@ vshCmddefHelp(vshControl *ctl, const char *cmdname)
                 continue;
             }
 
-            fprintf(stdout, "    %-15s  %s\n", buf, _(opt->help));
+            vshPrint(ctl, "    %-15s  %s\n", buf, _(opt->help));
         }
     }
-    fputc('\n', stdout);
+    vshPrint(ctl, "\n");
 
     return true;
 }
@@ -1306,6 +1372,23 @@ vshBlockJobOptionBandwidth(vshControl *ctl,
 }
 
 
+/*
+ * Batch jobs run commands from several threads, only one of them
+ * may (re)connect at a time
+ */
+static void *
+vshCommandConnect(vshControl *ctl)
+{
+    void *ret;
+
+    virMutexLock(&vshConnectLock);
+    ret = ctl->hooks->connHandler(ctl);
+    virMutexUnlock(&vshConnectLock);
+
+    return ret;
+}
+
+
 /*
  * Executes command(s) and returns return code from last command
  */
@@ -1323,7 +1406,7 @@ vshCommandRun(vshControl *ctl, const vshCmd *cmd)
             GETTIMEOFDAY(&before);
 
         if ((cmd->def->flags & VSH_CMD_FLAG_NOCONNECT) ||
-            (hooks && hooks->connHandler && hooks->connHandler(ctl))) {
+            (hooks && hooks->connHandler && vshCommandConnect(ctl))) {
             ret = cmd->def->handler(ctl, cmd);
         } else {
             /* connection is not usable, return error */
@@ -1701,6 +1784,337 @@ vshCommandStringParse(vshControl *ctl, char *cmdstr)
     return vshCommandParse(ctl, &parser);
 }
 
+/* ----------
+ * Batch mode
+ * ----------
+ */
+
+typedef struct _vshBatch vshBatch;
+typedef vshBatch *vshBatchPtr;
+
+struct _vshBatch {
+    vshControl *ctl;
+    bool json;
+    bool ret;
+
+    virMutex lock;
+    virCond cond;
+    size_t running;             /* jobs handed to the pool, not yet done */
+    size_t njobs;
+    vshBatchJobPtr *jobs;       /* in input order, not yet reported */
+};
+
+static void
+vshBatchJobFree(vshBatchJobPtr job)
+{
+    if (!job)
+        return;
+
+    vshCommandFree(job->cmd);
+    VIR_FREE(job->cmdstr);
+    virBufferFreeAndReset(&job->output);
+    virBufferFreeAndReset(&job->errors);
+    virFreeError(job->error);
+    VIR_FREE(job);
+}
+
+
+static void
+vshBatchJobRun(vshControl *ctl, vshBatchJobPtr job)
+{
+    ignore_value(virThreadLocalSet(&vshBatchJobLocal, job));
+    job->ret = vshCommandRun(ctl, job->cmd);
+    ignore_value(virThreadLocalSet(&vshBatchJobLocal, NULL));
+}
+
+
+static void
+vshBatchWorker(void *jobdata, void *opaque)
+{
+    vshBatchJobPtr job = jobdata;
+    vshBatchPtr batch = opaque;
+
+    vshBatchJobRun(batch->ctl, job);
+
+    virMutexLock(&batch->lock);
+    job->done = true;
+    batch->running--;
+    virCondSignal(&batch->cond);
+    virMutexUnlock(&batch->lock);
+}
+
+
+static void
+vshBatchJobReport(vshBatchPtr batch, vshBatchJobPtr job)
+{
+    char *output;
+    char *errors;
+
+    if (virBufferCheckError(&job->output) < 0 ||
+        virBufferCheckError(&job->errors) < 0)
+        vshErrorOOM();
+
+    output = virBufferContentAndReset(&job->output);
+    errors = virBufferContentAndReset(&job->errors);
+
+    if (!job->ret)
+        batch->ret = false;
+
+    if (batch->json) {
+        virBuffer buf = VIR_BUFFER_INITIALIZER;
+        char *str;
+
+        virBufferAsprintf(&buf, "{\"line\": %zu, \"command\": ", job->line);
+        vshBufferAddJSONString(&buf, job->cmdstr);
+        virBufferAsprintf(&buf, ", \"success\": %s, \"output\": ",
+                          job->ret ? "true" : "false");
+        vshBufferAddJSONString(&buf, output);
+        virBufferAddLit(&buf, ", \"error\": ");
+        vshBufferAddJSONString(&buf, errors);
+        virBufferAddLit(&buf, "}\n");
+
+        if (!(str = virBufferContentAndReset(&buf)))
+            vshErrorOOM();
+        fputs(str, stdout);
+        VIR_FREE(str);
+    } else {
+        if (output)
+            fputs(output, stdout);
+        if (errors) {
+            fflush(stdout);
+            fputs(errors, stderr);
+            fflush(stderr);
+        }
+    }
+    fflush(stdout);
+
+    VIR_FREE(output);
+    VIR_FREE(errors);
+}
+
+
+/* Must be called with batch->lock held */
+static void
+vshBatchFlush(vshBatchPtr batch)
+{
+    while (batch->njobs && batch->jobs[0]->done) {
+        vshBatchJobPtr job = batch->jobs[0];
+
+        VIR_DELETE_ELEMENT(batch->jobs, 0, batch->njobs);
+        vshBatchJobReport(batch, job);
+        vshBatchJobFree(job);
+    }
+}
+
+
+/* Must be called with batch->lock held, waits until fewer than
+ * @running jobs are running and fewer than @queued are waiting to
+ * be reported, reporting finished ones meanwhile */
+static void
+vshBatchWait(vshBatchPtr batch, size_t running, size_t queued)
+{
+    vshBatchFlush(batch);
+    while (batch->running >= running || batch->njobs >= queued) {
+        if (virCondWait(&batch->cond, &batch->lock) < 0) {
+            vshError(batch->ctl, "%s", _("failed to wait for batch jobs"));
+            exit(EXIT_FAILURE);
+        }
+        vshBatchFlush(batch);
+    }
+}
+
+
+static char *
+vshBatchReadLine(vshControl *ctl, FILE *fp)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char chunk[1024];
+    char *line;
+    size_t len;
+    bool eof = true;
+
+    while (fgets(chunk, sizeof(chunk), fp)) {
+        eof = false;
+        virBufferAdd(&buf, chunk, -1);
+        len = strlen(chunk);
+        if (len && chunk[len - 1] == '\n')
+            break;
+    }
+
+    if (eof) {
+        if (ferror(fp))
+            vshError(ctl, "%s", _("failed to read batch input"));
+        return NULL;
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        vshErrorOOM();
+
+    line = virBufferContentAndReset(&buf);
+    len = strlen(line);
+    if (len && line[len - 1] == '\n')
+        line[len - 1] = '\0';
+    return line;
+}
+
+
+/*
+ * Whether @cmd, a list of commands, has to run on its own, like 'cd'
+ * or 'connect' which change state other commands depend on
+ */
+static bool
+vshBatchIsBarrier(const vshCmd *cmd)
+{
+    for (; cmd; cmd = cmd->next) {
+        if (cmd->def->flags & VSH_CMD_FLAG_NOCONNECT)
+            return true;
+    }
+
+    return false;
+}
+
+
+static bool
+vshBatchIsQuit(const vshCmd *cmd)
+{
+    for (; cmd; cmd = cmd->next) {
+        if (STREQ(cmd->def->name, "quit") ||
+            STREQ(cmd->def->name, "exit"))
+            return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * vshBatchRun:
+ * @ctl: virtshell control structure
+ * @path: file to read commands from, "-" for standard input
+ * @jobs: how many lines of commands may be run at the same time
+ * @json: report each line's results as a JSON object
+ *
+ * Reads commands from @path, one line at a time and runs them on the
+ * connection already established by @ctl. Commands separated by ';'
+ * on the same line run one after the other, up to @jobs lines run
+ * at once, except for those containing commands which don't use
+ * the connection, which run alone. The output of each line is
+ * reported in input order once it has finished.
+ *
+ * Returns true if all commands succeeded, false otherwise.
+ */
+bool
+vshBatchRun(vshControl *ctl, const char *path, unsigned int jobs, bool json)
+{
+    vshBatch batch;
+    virThreadPoolPtr pool = NULL;
+    FILE *fp = NULL;
+    char *line;
+    size_t lineno = 0;
+    bool quit = false;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.ctl = ctl;
+    batch.json = json;
+    batch.ret = true;
+
+    if (jobs == 0)
+        jobs = 1;
+
+    if (STREQ(path, "-")) {
+        fp = stdin;
+    } else if (!(fp = fopen(path, "r"))) {
+        char ebuf[1024];
+        vshError(ctl, _("Failed to open '%s': %s"), path,
+                 virStrerror(errno, ebuf, sizeof(ebuf)));
+        return false;
+    }
+
+    if (virMutexInit(&batch.lock) < 0 ||
+        virCondInit(&batch.cond) < 0) {
+        vshError(ctl, "%s", _("Failed to initialize mutex"));
+        goto cleanup;
+    }
+
+    if (jobs > 1 &&
+        !(pool = virThreadPoolNew(0, jobs, 0, vshBatchWorker, &batch))) {
+        vshReportError(ctl);
+        goto cleanup;
+    }
+
+    while (!quit && (line = vshBatchReadLine(ctl, fp))) {
+        vshBatchJobPtr job = vshCalloc(ctl, 1, sizeof(*job));
+        char *cmdstr;
+
+        job->line = ++lineno;
+        job->cmdstr = line;
+
+        virSkipSpaces((const char **)&line);
+        if (*line == '\0' || *line == '#') {
+            vshBatchJobFree(job);
+            continue;
+        }
+
+        /* Parse errors are reported with the job */
+        cmdstr = vshStrdup(ctl, job->cmdstr);
+        ignore_value(virThreadLocalSet(&vshBatchJobLocal, job));
+        if (vshCommandStringParse(ctl, cmdstr)) {
+            job->cmd = ctl->cmd;
+            ctl->cmd = NULL;
+        } else {
+            job->ret = false;
+            job->done = true;
+        }
+        vshResetLibvirtError();
+        ignore_value(virThreadLocalSet(&vshBatchJobLocal, NULL));
+        VIR_FREE(cmdstr);
+
+        virMutexLock(&batch.lock);
+        if (job->cmd) {
+            bool alone = !pool || vshBatchIsBarrier(job->cmd);
+
+            quit = vshBatchIsQuit(job->cmd);
+
+            if (!alone) {
+                /* Keep the workers busy, but limit how much output
+                 * can pile up behind a slow line */
+                vshBatchWait(&batch, 2 * jobs, 16 * jobs);
+                if (virThreadPoolSendJob(pool, 0, job) == 0) {
+                    batch.running++;
+                } else {
+                    vshResetLibvirtError();
+                    alone = true;
+                }
+            }
+
+            if (alone) {
+                vshBatchWait(&batch, 1, SIZE_MAX);
+                virMutexUnlock(&batch.lock);
+                vshBatchJobRun(ctl, job);
+                virMutexLock(&batch.lock);
+                job->done = true;
+            }
+        }
+
+        if (VIR_APPEND_ELEMENT(batch.jobs, batch.njobs, job) < 0)
+            vshErrorOOM();
+        vshBatchFlush(&batch);
+        virMutexUnlock(&batch.lock);
+    }
+
+    virMutexLock(&batch.lock);
+    vshBatchWait(&batch, 1, 1);
+    virMutexUnlock(&batch.lock);
+
+ cleanup:
+    virThreadPoolFree(pool);
+    if (fp != stdin)
+        VIR_FORCE_FCLOSE(fp);
+    virCondDestroy(&batch.cond);
+    virMutexDestroy(&batch.lock);
+    return batch.ret;
+}
+
 /**
  * virshCommandOptTimeoutToMs:
  * @ctl virsh control structure
@@ -1789,6 +2203,39 @@ vshGetTypedParamValue(vshControl *ctl, virTypedParameterPtr item)
     return str;
 }
 
+/*
+ * Append @str to @buf as a quoted and escaped JSON string
+ */
+void
+vshBufferAddJSONString(virBufferPtr buf, const char *str)
+{
+    virBufferAddChar(buf, '"');
+    for (; str && *str; str++) {
+        unsigned char c = *str;
+
+        switch (c) {
+        case '"':
+            virBufferAddLit(buf, "\\\"");
+            break;
+        case '\\':
+            virBufferAddLit(buf, "\\\\");
+            break;
+        case '\n':
+            virBufferAddLit(buf, "\\n");
+            break;
+        case '\t':
+            virBufferAddLit(buf, "\\t");
+            break;
+        default:
+            if (c < 0x20)
+                virBufferAsprintf(buf, "\\u%04x", c);
+            else
+                virBufferAddChar(buf, c);
+        }
+    }
+    virBufferAddChar(buf, '"');
+}
+
 void
 vshDebug(vshControl *ctl, int level, const char *format, ...)
 {
@@ -1813,7 +2260,7 @@ vshDebug(vshControl *ctl, int level, const char *format, ...)
         return;
     }
     va_end(ap);
-    fputs(str, stdout);
+    vshOutput(stdout, str);
     VIR_FREE(str);
 }
 
@@ -1830,7 +2277,7 @@ vshPrintExtra(vshControl *ctl, const char *format, ...)
     if (virVasprintfQuiet(&str, format, ap) < 0)
         vshErrorOOM();
     va_end(ap);
-    fputs(str, stdout);
+    vshOutput(stdout, str);
     VIR_FREE(str);
 }
 
@@ -1845,7 +2292,7 @@ vshPrint(vshControl *ctl ATTRIBUTE_UNUSED, const char *format, ...)
     if (virVasprintfQuiet(&str, format, ap) < 0)
         vshErrorOOM();
     va_end(ap);
-    fputs(str, stdout);
+    vshOutput(stdout, str);
     VIR_FREE(str);
 }
 
@@ -1961,6 +2408,7 @@ vshError(vshControl *ctl, const char *format, ...)
 {
     va_list ap;
     char *str;
+    vshBatchJobPtr job;
 
     if (ctl != NULL) {
         va_start(ap, format);
@@ -1968,18 +2416,23 @@ vshError(vshControl *ctl, const char *format, ...)
         va_end(ap);
     }
 
-    /* Most output is to stdout, but if someone ran virsh 2>&1, then
-     * printing to stderr will not interleave correctly with stdout
-     * unless we flush between every transition between streams.  */
-    fflush(stdout);
-    fputs(_("error: "), stderr);
-
     va_start(ap, format);
     /* We can't recursively call vshError on an OOM situation, so ignore
        failure here. */
     ignore_value(virVasprintf(&str, format, ap));
     va_end(ap);
 
+    if ((job = vshBatchJobCurrent())) {
+        virBufferAsprintf(&job->errors, _("error: %s\n"), NULLSTR(str));
+        VIR_FREE(str);
+        return;
+    }
+
+    /* Most output is to stdout, but if someone ran virsh 2>&1, then
+     * printing to stderr will not interleave correctly with stdout
+     * unless we flush between every transition between streams.  */
+    fflush(stdout);
+    fputs(_("error: "), stderr);
     fprintf(stderr, "%s\n", NULLSTR(str));
     fflush(stderr);
     VIR_FREE(str);
@@ -3078,6 +3531,15 @@ vshInit(vshControl *ctl, const vshCmdGrp *groups, const vshCmdDef *set)
     cmdGroups = groups;
     cmdSet = set;
 
+    if (!vshBatchJobLocalReady) {
+        if (virThreadLocalInit(&vshBatchJobLocal, NULL) < 0 ||
+            virMutexInit(&vshConnectLock) < 0) {
+            vshError(ctl, "%s", _("Failed to initialize batch mode data"));
+            return false;
+        }
+        vshBatchJobLocalReady = true;
+    }
+
     if (vshInitDebug(ctl) < 0 ||
         (ctl->imode && vshReadlineInit(ctl) < 0))
         return false;
@@ -34,6 +34,7 @@
 # include <termios.h>
 
 # include "internal.h"
+# include "virbuffer.h"
 # include "virerror.h"
 # include "virthread.h"
 
@@ -300,6 +301,8 @@ int vshBlockJobOptionBandwidth(vshControl *ctl,
 bool vshCommandOptBool(const vshCmd *cmd, const char *name);
 bool vshCommandRun(vshControl *ctl, const vshCmd *cmd);
 bool vshCommandStringParse(vshControl *ctl, char *cmdstr);
+bool vshBatchRun(vshControl *ctl, const char *path,
+                 unsigned int jobs, bool json);
 
 const vshCmdOpt *vshCommandOptArgv(vshControl *ctl, const vshCmd *cmd,
                                    const vshCmdOpt *opt);
@@ -315,6 +318,8 @@ bool vshInitReload(vshControl *ctl);
 void vshDeinit(vshControl *ctl);
 void vshDebug(vshControl *ctl, int level, const char *format, ...)
     ATTRIBUTE_FMT_PRINTF(3, 4);
+void vshBufferAddJSONString(virBufferPtr buf, const char *str)
+    ATTRIBUTE_NONNULL(1);
 
 /* User visible sort, so we want locale-specific case comparison.  */
 # define vshStrcasecmp(S1, S2) strcasecmp(S1, S2)
@@ -336,7 +341,8 @@ int vshTreePrint(vshControl *ctl, vshTreeLookup lookup, void *opaque,
                  int num_devices, int devid);
 
 /* error handling */
-extern virErrorPtr last_error;
+virErrorPtr *vshLastError(void);
+# define last_error (*vshLastError())
 void vshErrorHandler(void *opaque, virErrorPtr error);
 void vshReportError(vshControl *ctl);
 void vshResetLibvirtError(void);